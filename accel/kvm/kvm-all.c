@@ -37,11 +37,15 @@
 #include "exec/ram_addr.h"
 #include "qemu/event_notifier.h"
 #include "qemu/main-loop.h"
+#include "qemu/timer.h"
 #include "trace.h"
 #include "hw/irq.h"
 #include "qapi/visitor.h"
 #include "qapi/qapi-types-common.h"
 #include "qapi/qapi-visit-common.h"
+#include "qapi/qapi-commands-machine.h"
+#include "qapi/type-helpers.h"
+#include "monitor/monitor.h"
 #include "sysemu/reset.h"
 #include "qemu/guest-random.h"
 #include "sysemu/hw_accel.h"
@@ -320,6 +324,187 @@ err:
     return ret;
 }
 
+/*
+ * Per-vCPU exit statistics, enabled with the x-exit-stats property.  Each
+ * vCPU thread updates its own counters, the lock only orders that against
+ * x-query-kvm-exits.
+ */
+#define KVM_EXIT_STATS_REASONS  64
+
+typedef struct KVMExitRegionStats {
+    char *name;         /* copied, the region may go away later */
+    uint64_t count;
+    uint64_t ns;
+} KVMExitRegionStats;
+
+struct KVMExitStats {
+    QemuMutex lock;
+    uint64_t count[KVM_EXIT_STATS_REASONS];
+    uint64_t ns[KVM_EXIT_STATS_REASONS];
+    /* MemoryRegion * -> KVMExitRegionStats, only used as a key */
+    GHashTable *mmio;
+    GHashTable *pio;
+};
+
+#define KVM_EXIT_NAME(x) [KVM_EXIT_##x] = #x
+
+static const char *const kvm_exit_names[KVM_EXIT_STATS_REASONS] = {
+    KVM_EXIT_NAME(UNKNOWN), KVM_EXIT_NAME(EXCEPTION), KVM_EXIT_NAME(IO),
+    KVM_EXIT_NAME(HYPERCALL), KVM_EXIT_NAME(DEBUG), KVM_EXIT_NAME(HLT),
+    KVM_EXIT_NAME(MMIO), KVM_EXIT_NAME(IRQ_WINDOW_OPEN),
+    KVM_EXIT_NAME(SHUTDOWN), KVM_EXIT_NAME(FAIL_ENTRY), KVM_EXIT_NAME(INTR),
+    KVM_EXIT_NAME(SET_TPR), KVM_EXIT_NAME(TPR_ACCESS),
+    KVM_EXIT_NAME(S390_SIEIC), KVM_EXIT_NAME(S390_RESET), KVM_EXIT_NAME(DCR),
+    KVM_EXIT_NAME(NMI), KVM_EXIT_NAME(INTERNAL_ERROR), KVM_EXIT_NAME(OSI),
+    KVM_EXIT_NAME(PAPR_HCALL), KVM_EXIT_NAME(S390_UCONTROL),
+    KVM_EXIT_NAME(WATCHDOG), KVM_EXIT_NAME(S390_TSCH), KVM_EXIT_NAME(EPR),
+    KVM_EXIT_NAME(SYSTEM_EVENT), KVM_EXIT_NAME(S390_STSI),
+    KVM_EXIT_NAME(IOAPIC_EOI), KVM_EXIT_NAME(HYPERV),
+    KVM_EXIT_NAME(ARM_NISV), KVM_EXIT_NAME(X86_RDMSR),
+    KVM_EXIT_NAME(X86_WRMSR), KVM_EXIT_NAME(DIRTY_RING_FULL),
+    KVM_EXIT_NAME(AP_RESET_HOLD), KVM_EXIT_NAME(X86_BUS_LOCK),
+    KVM_EXIT_NAME(XEN), KVM_EXIT_NAME(RISCV_SBI), KVM_EXIT_NAME(RISCV_CSR),
+    KVM_EXIT_NAME(NOTIFY),
+};
+
+static void kvm_exit_region_stats_free(gpointer data)
+{
+    KVMExitRegionStats *rs = data;
+
+    g_free(rs->name);
+    g_free(rs);
+}
+
+static KVMExitStats *kvm_exit_stats_new(void)
+{
+    KVMExitStats *stats = g_new0(KVMExitStats, 1);
+
+    qemu_mutex_init(&stats->lock);
+    stats->mmio = g_hash_table_new_full(NULL, NULL, NULL,
+                                        kvm_exit_region_stats_free);
+    stats->pio = g_hash_table_new_full(NULL, NULL, NULL,
+                                       kvm_exit_region_stats_free);
+    return stats;
+}
+
+static void kvm_exit_stats_free(KVMExitStats *stats)
+{
+    g_hash_table_destroy(stats->mmio);
+    g_hash_table_destroy(stats->pio);
+    qemu_mutex_destroy(&stats->lock);
+    g_free(stats);
+}
+
+/* Charge @ns to the region of @as mapped at @addr.  Called with the lock. */
+static void kvm_exit_stats_account_region(GHashTable *regions,
+                                          AddressSpace *as, hwaddr addr,
+                                          uint64_t ns)
+{
+    KVMExitRegionStats *rs;
+    MemoryRegion *mr;
+    hwaddr xlat, len = 1;
+
+    RCU_READ_LOCK_GUARD();
+    mr = address_space_translate(as, addr, &xlat, &len, false,
+                                 MEMTXATTRS_UNSPECIFIED);
+    rs = g_hash_table_lookup(regions, mr);
+    if (!rs) {
+        rs = g_new0(KVMExitRegionStats, 1);
+        rs->name = g_strdup(memory_region_name(mr));
+        g_hash_table_insert(regions, mr, rs);
+    }
+    rs->count++;
+    rs->ns += ns;
+}
+
+static void kvm_exit_stats_account(CPUState *cpu, struct kvm_run *run,
+                                   uint64_t ns)
+{
+    KVMExitStats *stats = cpu->kvm_exit_stats;
+    uint32_t reason = MIN(run->exit_reason, KVM_EXIT_STATS_REASONS - 1);
+
+    qemu_mutex_lock(&stats->lock);
+    stats->count[reason]++;
+    stats->ns[reason] += ns;
+    if (run->exit_reason == KVM_EXIT_MMIO) {
+        kvm_exit_stats_account_region(stats->mmio, &address_space_memory,
+                                      run->mmio.phys_addr, ns);
+    } else if (run->exit_reason == KVM_EXIT_IO) {
+        kvm_exit_stats_account_region(stats->pio, &address_space_io,
+                                      run->io.port, ns);
+    }
+    qemu_mutex_unlock(&stats->lock);
+}
+
+static gint kvm_exit_region_stats_cmp(gconstpointer a, gconstpointer b)
+{
+    const KVMExitRegionStats *ra = a, *rb = b;
+
+    return ra->ns < rb->ns ? 1 : ra->ns > rb->ns ? -1 : 0;
+}
+
+static void kvm_exit_stats_dump_regions(GString *buf, const char *kind,
+                                        GHashTable *regions)
+{
+    GList *list = g_list_sort(g_hash_table_get_values(regions),
+                              kvm_exit_region_stats_cmp);
+    GList *l;
+
+    for (l = list; l; l = l->next) {
+        KVMExitRegionStats *rs = l->data;
+
+        g_string_append_printf(buf, "  %-4s %-28s %12" PRIu64 " %14" PRIu64
+                               " %8" PRIu64 "\n", kind, rs->name, rs->count,
+                               rs->ns, rs->ns / rs->count);
+    }
+    g_list_free(list);
+}
+
+HumanReadableText *qmp_x_query_kvm_exits(Error **errp)
+{
+    g_autoptr(GString) buf = g_string_new("");
+    CPUState *cpu;
+    int i;
+
+    if (!kvm_enabled() || !kvm_state->exit_stats) {
+        error_setg(errp, "KVM exit statistics are only available with "
+                   "-accel kvm,x-exit-stats=on");
+        return NULL;
+    }
+
+    CPU_FOREACH(cpu) {
+        KVMExitStats *stats = cpu->kvm_exit_stats;
+
+        if (!stats) {
+            continue;
+        }
+
+        g_string_append_printf(buf, "CPU %d:\n  %-33s %12s %14s %8s\n",
+                               cpu->cpu_index, "exit", "count",
+                               "userspace ns", "avg ns");
+        qemu_mutex_lock(&stats->lock);
+        for (i = 0; i < KVM_EXIT_STATS_REASONS; i++) {
+            if (!stats->count[i]) {
+                continue;
+            }
+            if (kvm_exit_names[i]) {
+                g_string_append_printf(buf, "  %-33s", kvm_exit_names[i]);
+            } else {
+                g_string_append_printf(buf, "  %-33d", i);
+            }
+            g_string_append_printf(buf, " %12" PRIu64 " %14" PRIu64
+                                   " %8" PRIu64 "\n", stats->count[i],
+                                   stats->ns[i],
+                                   stats->ns[i] / stats->count[i]);
+        }
+        kvm_exit_stats_dump_regions(buf, "mmio", stats->mmio);
+        kvm_exit_stats_dump_regions(buf, "pio", stats->pio);
+        qemu_mutex_unlock(&stats->lock);
+    }
+
+    return human_readable_text_from_str(buf);
+}
+
 static int do_kvm_destroy_vcpu(CPUState *cpu)
 {
     KVMState *s = kvm_state;
@@ -353,6 +538,11 @@ static int do_kvm_destroy_vcpu(CPUState *cpu)
         }
     }
 
+    if (cpu->kvm_exit_stats) {
+        kvm_exit_stats_free(cpu->kvm_exit_stats);
+        cpu->kvm_exit_stats = NULL;
+    }
+
     vcpu = g_malloc0(sizeof(*vcpu));
     vcpu->vcpu_id = kvm_arch_vcpu_id(cpu);
     vcpu->kvm_fd = cpu->kvm_fd;
@@ -451,6 +641,9 @@ int kvm_init_vcpu(CPUState *cpu, Error **errp)
                          kvm_arch_vcpu_id(cpu));
     }
     cpu->kvm_vcpu_stats_fd = kvm_vcpu_ioctl(cpu, KVM_GET_STATS_FD, NULL);
+    if (s->exit_stats) {
+        cpu->kvm_exit_stats = kvm_exit_stats_new();
+    }
 
 err:
     return ret;
@@ -644,7 +837,12 @@ static void kvm_dirty_ring_mark_page(KVMState *s, uint32_t as_id,
         return;
     }
 
-    set_bit(offset, mem->dirty_bmap);
+    /* With dirty-ring-reap-threads > 1, reapers share the slot bitmaps */
+    if (s->reaper.workers) {
+        set_bit_atomic(offset, mem->dirty_bmap);
+    } else {
+        set_bit(offset, mem->dirty_bmap);
+    }
 }
 
 static bool dirty_gfn_is_dirtied(struct kvm_dirty_gfn *gfn)
@@ -711,23 +909,87 @@ static uint32_t kvm_dirty_ring_reap_one(KVMState *s, CPUState *cpu)
         fetch++;
         count++;
     }
-    cpu->kvm_fetch_index = fetch;
+    qatomic_set(&cpu->kvm_fetch_index, fetch);
     cpu->dirty_pages += count;
 
     return count;
 }
 
+typedef struct KVMDirtyRingReapWorker {
+    KVMState *s;
+    QemuThread thread;
+    QemuSemaphore start;
+    unsigned index;
+    uint64_t total;
+} KVMDirtyRingReapWorker;
+
+/*
+ * Reap the rings of every n-th vcpu, starting with the index-th one.  Each
+ * vcpu belongs to exactly one share, so shares can be reaped concurrently
+ * as long as the caller of kvm_dirty_ring_reap_locked() holds slots_lock.
+ */
+static uint64_t kvm_dirty_ring_reap_share(KVMState *s, unsigned index,
+                                          unsigned n)
+{
+    CPUState *cpu;
+    uint64_t total = 0;
+    unsigned i = 0;
+
+    RCU_READ_LOCK_GUARD();
+    CPU_FOREACH(cpu) {
+        if (i++ % n == index) {
+            total += kvm_dirty_ring_reap_one(s, cpu);
+        }
+    }
+
+    return total;
+}
+
+static void *kvm_dirty_ring_reap_worker_thread(void *opaque)
+{
+    KVMDirtyRingReapWorker *w = opaque;
+    KVMState *s = w->s;
+
+    rcu_register_thread();
+
+    while (true) {
+        qemu_sem_wait(&w->start);
+        w->total = kvm_dirty_ring_reap_share(s, w->index,
+                                             s->kvm_dirty_ring_reap_threads);
+        qemu_sem_post(&s->reaper.workers_done);
+    }
+
+    rcu_unregister_thread();
+
+    return NULL;
+}
+
 /* Must be with slots_lock held */
 static uint64_t kvm_dirty_ring_reap_locked(KVMState *s, CPUState* cpu)
 {
+    struct KVMDirtyRingReaper *r = &s->reaper;
+    unsigned n = s->kvm_dirty_ring_reap_threads;
     int ret;
     uint64_t total = 0;
     int64_t stamp;
+    unsigned i;
 
     stamp = get_clock();
 
     if (cpu) {
         total = kvm_dirty_ring_reap_one(s, cpu);
+    } else if (r->workers) {
+        /* Worker i reaps share i + 1, this thread takes share 0 */
+        for (i = 0; i < n - 1; i++) {
+            qemu_sem_post(&r->workers[i].start);
+        }
+        total = kvm_dirty_ring_reap_share(s, 0, n);
+        for (i = 0; i < n - 1; i++) {
+            qemu_sem_wait(&r->workers_done);
+        }
+        for (i = 0; i < n - 1; i++) {
+            total += r->workers[i].total;
+        }
     } else {
         CPU_FOREACH(cpu) {
             total += kvm_dirty_ring_reap_one(s, cpu);
@@ -870,8 +1132,29 @@ static int kvm_log_clear_one_slot(KVMSlot *mem, int as_id, uint64_t start,
     uint64_t end, bmap_start, start_delta, bmap_npages;
     struct kvm_clear_dirty_log d;
     unsigned long *bmap_clear = NULL, psize = qemu_real_host_page_size();
+    unsigned long first, last, range_end;
     int ret;
 
+    /* We should never do log_clear before log_sync */
+    assert(mem->dirty_bmap);
+
+    /*
+     * The kernel only write-protects again the pages whose bit is set in
+     * the bitmap we pass, so only the span between the first and the last
+     * cached dirty bit needs to be sent.  A sparse bitmap then costs a
+     * small ioctl, and a clean range no ioctl at all.
+     */
+    range_end = (start + size) / psize;
+    first = find_next_bit(mem->dirty_bmap, range_end, start / psize);
+    if (first >= range_end) {
+        trace_kvm_clear_dirty_log_skip(mem->slot | (as_id << 16),
+                                       start / psize, size / psize);
+        return 0;
+    }
+    last = find_last_bit(mem->dirty_bmap, range_end);
+    start = (uint64_t)first * psize;
+    size = (uint64_t)(last + 1 - first) * psize;
+
     /*
      * We need to extend either the start or the size or both to
      * satisfy the KVM interface requirement.  Firstly, do the start
@@ -918,8 +1201,6 @@ static int kvm_log_clear_one_slot(KVMSlot *mem, int as_id, uint64_t start,
      */
 
     assert(bmap_start % BITS_PER_LONG == 0);
-    /* We should never do log_clear before log_sync */
-    assert(mem->dirty_bmap);
     if (start_delta || bmap_npages - size / psize) {
         /* Slow path - we need to manipulate a temp bitmap */
         bmap_clear = bitmap_new(bmap_npages);
@@ -1415,6 +1696,61 @@ static void kvm_set_phys_mem(KVMMemoryListener *kml,
     } while (size);
 }
 
+/*
+ * Returns true if a vcpu ring holds at least kvm_dirty_ring_soft_full
+ * percent of its size in uncollected entries.  Since entries are pushed in
+ * order, it's enough to look at the entry that many slots past the fetch
+ * index.  This runs without slots_lock, so it's only a hint.
+ */
+static bool kvm_dirty_ring_soft_full(KVMState *s)
+{
+    uint32_t ring_size = s->kvm_dirty_ring_size;
+    uint32_t limit = (uint64_t)ring_size * s->kvm_dirty_ring_soft_full / 100;
+    CPUState *cpu;
+
+    if (!limit) {
+        return false;
+    }
+
+    RCU_READ_LOCK_GUARD();
+    CPU_FOREACH(cpu) {
+        struct kvm_dirty_gfn *dirty_gfns = cpu->kvm_dirty_gfns;
+        uint32_t fetch = qatomic_read(&cpu->kvm_fetch_index) + limit - 1;
+
+        if (cpu->created && dirty_gfns &&
+            dirty_gfn_is_dirtied(&dirty_gfns[fetch % ring_size])) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+#define KVM_DIRTY_RING_REAPER_POLL_MS  100
+
+/*
+ * Sleep for up to one second, checking the rings every
+ * KVM_DIRTY_RING_REAPER_POLL_MS when a soft-full threshold is set so that
+ * busy vcpus don't have to run into a full ring and exit to userspace.
+ */
+static void kvm_dirty_ring_reaper_sleep(KVMState *s)
+{
+    int i;
+
+    if (!s->kvm_dirty_ring_soft_full) {
+        sleep(1);
+        return;
+    }
+
+    for (i = 0; i < 1000 / KVM_DIRTY_RING_REAPER_POLL_MS; i++) {
+        g_usleep(KVM_DIRTY_RING_REAPER_POLL_MS * 1000);
+        if (kvm_dirty_ring_soft_full(s)) {
+            trace_kvm_dirty_ring_reaper("soft-full");
+            return;
+        }
+    }
+}
+
 static void *kvm_dirty_ring_reaper_thread(void *data)
 {
     KVMState *s = data;
@@ -1427,10 +1763,7 @@ static void *kvm_dirty_ring_reaper_thread(void *data)
     while (true) {
         r->reaper_state = KVM_DIRTY_RING_REAPER_WAIT;
         trace_kvm_dirty_ring_reaper("wait");
-        /*
-         * TODO: provide a smarter timeout rather than a constant?
-         */
-        sleep(1);
+        kvm_dirty_ring_reaper_sleep(s);
 
         /* keep sleeping so that dirtylimit not be interfered by reaper */
         if (dirtylimit_in_service()) {
@@ -1457,6 +1790,24 @@ static void *kvm_dirty_ring_reaper_thread(void *data)
 static void kvm_dirty_ring_reaper_init(KVMState *s)
 {
     struct KVMDirtyRingReaper *r = &s->reaper;
+    unsigned n = s->kvm_dirty_ring_reap_threads;
+    unsigned i;
+
+    if (n > 1) {
+        qemu_sem_init(&r->workers_done, 0);
+        r->workers = g_new0(KVMDirtyRingReapWorker, n - 1);
+        for (i = 0; i < n - 1; i++) {
+            KVMDirtyRingReapWorker *w = &r->workers[i];
+            g_autofree char *name = g_strdup_printf("kvm-reaper-%u", i + 1);
+
+            w->s = s;
+            w->index = i + 1;
+            qemu_sem_init(&w->start, 0);
+            qemu_thread_create(&w->thread, name,
+                               kvm_dirty_ring_reap_worker_thread,
+                               w, QEMU_THREAD_DETACHED);
+        }
+    }
 
     qemu_thread_create(&r->reaper_thr, "kvm-reaper",
                        kvm_dirty_ring_reaper_thread,
@@ -1550,11 +1901,88 @@ static void kvm_region_del(MemoryListener *listener,
     QSIMPLEQ_INSERT_TAIL(&kml->transaction_del, update, next);
 }
 
+/* Cleared if the kernel refused to move a memslot */
+static bool kvm_slot_move_allowed = true;
+
+/*
+ * Find the section added by this transaction that maps the same RAM as the
+ * removed section @del at another address, e.g. a RAM-backed BAR that the
+ * guest reprogrammed.
+ */
+static KVMMemoryUpdate *kvm_find_moved_section(KVMMemoryListener *kml,
+                                               MemoryRegionSection *del)
+{
+    KVMMemoryUpdate *u;
+
+    if (!memory_region_is_ram(del->mr)) {
+        return NULL;
+    }
+
+    QSIMPLEQ_FOREACH(u, &kml->transaction_add, next) {
+        if (u->section.mr == del->mr &&
+            u->section.offset_within_region == del->offset_within_region &&
+            int128_eq(u->section.size, del->size) &&
+            u->section.readonly == del->readonly &&
+            u->section.offset_within_address_space !=
+            del->offset_within_address_space) {
+            return u;
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * Move the memslot backing @from to the address of @to with a single
+ * KVM_SET_USER_MEMORY_REGION.  Returns false if the sections can't be
+ * handled as a move, in which case nothing has been changed.
+ *
+ * Called with KVMMemoryListener.slots_lock held.
+ */
+static bool kvm_move_phys_mem(KVMMemoryListener *kml,
+                              MemoryRegionSection *from,
+                              MemoryRegionSection *to)
+{
+    hwaddr from_addr, to_addr, size;
+    KVMSlot *mem;
+
+    if (!kvm_slot_move_allowed) {
+        return false;
+    }
+
+    size = kvm_align_section(from, &from_addr);
+    if (!size || size > kvm_max_slot_size ||
+        kvm_align_section(to, &to_addr) != size ||
+        to_addr - to->offset_within_address_space !=
+        from_addr - from->offset_within_address_space) {
+        return false;
+    }
+
+    mem = kvm_lookup_matching_slot(kml, from_addr, size);
+    /* Dirty logging slots go through the sync done on removal */
+    if (!mem || (mem->flags & KVM_MEM_LOG_DIRTY_PAGES) ||
+        mem->flags != kvm_mem_flags(to->mr)) {
+        return false;
+    }
+
+    mem->start_addr = to_addr;
+    if (kvm_set_user_memory_region(kml, mem, false) < 0) {
+        mem->start_addr = from_addr;
+        kvm_slot_move_allowed = false;
+        return false;
+    }
+    trace_kvm_move_phys_mem(mem->slot, from_addr, to_addr, size);
+
+    return true;
+}
+
 static void kvm_region_commit(MemoryListener *listener)
 {
     KVMMemoryListener *kml = container_of(listener, KVMMemoryListener,
                                           listener);
-    KVMMemoryUpdate *u1, *u2;
+    KVMMemoryUpdate *u1, *u2, *tmp;
+    QSIMPLEQ_HEAD(, KVMMemoryUpdate) transaction_move =
+        QSIMPLEQ_HEAD_INITIALIZER(transaction_move);
     bool need_inhibit = false;
 
     if (QSIMPLEQ_EMPTY(&kml->transaction_add) &&
@@ -1590,6 +2018,23 @@ static void kvm_region_commit(MemoryListener *listener)
         }
     }
 
+    /*
+     * Diff the removals against the additions: RAM that only changed its
+     * address doesn't need its memslot torn down and created again.  The
+     * removed entry stays behind for the move, the added one is dropped
+     * since the MemoryRegion reference moves along with the memslot.
+     */
+    QSIMPLEQ_FOREACH_SAFE(u1, &kml->transaction_del, next, tmp) {
+        u2 = kvm_find_moved_section(kml, &u1->section);
+        if (u2) {
+            QSIMPLEQ_REMOVE(&kml->transaction_del, u1, KVMMemoryUpdate, next);
+            QSIMPLEQ_REMOVE(&kml->transaction_add, u2, KVMMemoryUpdate, next);
+            u1->move_to = u2->section;
+            QSIMPLEQ_INSERT_TAIL(&transaction_move, u1, next);
+            g_free(u2);
+        }
+    }
+
     kvm_slots_lock();
     if (need_inhibit) {
         accel_ioctl_inhibit_begin();
@@ -1605,6 +2050,17 @@ static void kvm_region_commit(MemoryListener *listener)
 
         g_free(u1);
     }
+    while (!QSIMPLEQ_EMPTY(&transaction_move)) {
+        u1 = QSIMPLEQ_FIRST(&transaction_move);
+        QSIMPLEQ_REMOVE_HEAD(&transaction_move, next);
+
+        if (!kvm_move_phys_mem(kml, &u1->section, &u1->move_to)) {
+            kvm_set_phys_mem(kml, &u1->section, false);
+            kvm_set_phys_mem(kml, &u1->move_to, true);
+        }
+
+        g_free(u1);
+    }
     while (!QSIMPLEQ_EMPTY(&kml->transaction_add)) {
         u1 = QSIMPLEQ_FIRST(&kml->transaction_add);
         QSIMPLEQ_REMOVE_HEAD(&kml->transaction_add, next);
@@ -1847,10 +2303,16 @@ void kvm_init_irq_routing(KVMState *s)
         /* Round up so we can search ints using ffs */
         s->used_gsi_bitmap = bitmap_new(gsi_count);
         s->gsi_count = gsi_count;
+        s->irq_route_index = g_new(int, gsi_count);
+        for (i = 0; i < gsi_count; i++) {
+            s->irq_route_index[i] = -1;
+        }
     }
 
     s->irq_routes = g_malloc0(sizeof(*s->irq_routes));
     s->nr_allocated_irq_routes = 0;
+    /* The first commit replaces whatever table the kernel starts with */
+    s->irq_routes_dirty = true;
 
     if (!kvm_direct_msi_allowed) {
         for (i = 0; i < KVM_MSI_HASHTAB_SIZE; i++) {
@@ -1873,10 +2335,44 @@ void kvm_irqchip_commit_routes(KVMState *s)
         return;
     }
 
+    /*
+     * Vector updates that didn't change the route, or several commits
+     * for one batch of changes, don't need to rebuild the kernel table.
+     */
+    if (!s->irq_routes_dirty) {
+        return;
+    }
+
     s->irq_routes->flags = 0;
     trace_kvm_irqchip_commit_routes();
     ret = kvm_vm_ioctl(s, KVM_SET_GSI_ROUTING, s->irq_routes);
     assert(ret == 0);
+    s->irq_routes_dirty = false;
+}
+
+/* Find the routing entry of @gsi, starting with its cached position. */
+static struct kvm_irq_routing_entry *kvm_find_routing_entry(KVMState *s,
+                                                            int gsi)
+{
+    struct kvm_irq_routing_entry *entry;
+    int n;
+
+    if (s->irq_route_index && gsi < s->gsi_count) {
+        n = s->irq_route_index[gsi];
+        if (n >= 0 && n < s->irq_routes->nr &&
+            s->irq_routes->entries[n].gsi == gsi) {
+            return &s->irq_routes->entries[n];
+        }
+    }
+
+    for (n = 0; n < s->irq_routes->nr; n++) {
+        entry = &s->irq_routes->entries[n];
+        if (entry->gsi == gsi) {
+            return entry;
+        }
+    }
+
+    return NULL;
 }
 
 static void kvm_add_routing_entry(KVMState *s,
@@ -1899,6 +2395,10 @@ static void kvm_add_routing_entry(KVMState *s,
     new = &s->irq_routes->entries[n];
 
     *new = *entry;
+    if (s->irq_route_index && entry->gsi < s->gsi_count) {
+        s->irq_route_index[entry->gsi] = n;
+    }
+    s->irq_routes_dirty = true;
 
     set_gsi(s, entry->gsi);
 }
@@ -1907,24 +2407,20 @@ static int kvm_update_routing_entry(KVMState *s,
                                     struct kvm_irq_routing_entry *new_entry)
 {
     struct kvm_irq_routing_entry *entry;
-    int n;
 
-    for (n = 0; n < s->irq_routes->nr; n++) {
-        entry = &s->irq_routes->entries[n];
-        if (entry->gsi != new_entry->gsi) {
-            continue;
-        }
-
-        if(!memcmp(entry, new_entry, sizeof *entry)) {
-            return 0;
-        }
-
-        *entry = *new_entry;
+    entry = kvm_find_routing_entry(s, new_entry->gsi);
+    if (!entry) {
+        return -ESRCH;
+    }
 
+    if (!memcmp(entry, new_entry, sizeof *entry)) {
         return 0;
     }
 
-    return -ESRCH;
+    *entry = *new_entry;
+    s->irq_routes_dirty = true;
+
+    return 0;
 }
 
 void kvm_irqchip_add_irq_route(KVMState *s, int irq, int irqchip, int pin)
@@ -1955,8 +2451,16 @@ void kvm_irqchip_release_virq(KVMState *s, int virq)
         if (e->gsi == virq) {
             s->irq_routes->nr--;
             *e = s->irq_routes->entries[s->irq_routes->nr];
+            if (s->irq_route_index && e->gsi < s->gsi_count &&
+                s->irq_route_index[e->gsi] == s->irq_routes->nr) {
+                s->irq_route_index[e->gsi] = i;
+            }
+            s->irq_routes_dirty = true;
         }
     }
+    if (s->irq_route_index && virq < s->gsi_count) {
+        s->irq_route_index[virq] = -1;
+    }
     clear_gsi(s, virq);
     kvm_arch_release_virq_post(virq);
     trace_kvm_irqchip_release_virq(virq);
@@ -2432,6 +2936,7 @@ bool kvm_dirty_ring_enabled(void)
 static void query_stats_cb(StatsResultList **result, StatsTarget target,
                            strList *names, strList *targets, Error **errp);
 static void query_stats_schemas_cb(StatsSchemaList **result, Error **errp);
+static void kvm_halt_poll_init(KVMState *s);
 
 uint32_t kvm_dirty_ring_size(void)
 {
@@ -2750,6 +3255,10 @@ static int kvm_init(MachineState *ms)
                             query_stats_schemas_cb);
     }
 
+    if (s->halt_poll_budget) {
+        kvm_halt_poll_init(s);
+    }
+
     return 0;
 
 err:
@@ -2967,6 +3476,7 @@ int kvm_cpu_exec(CPUState *cpu)
 
     do {
         MemTxAttrs attrs;
+        int64_t exit_stamp = 0;
 
         if (cpu->vcpu_dirty) {
             kvm_arch_put_registers(cpu, KVM_PUT_RUNTIME_STATE);
@@ -2990,6 +3500,9 @@ int kvm_cpu_exec(CPUState *cpu)
         smp_rmb();
 
         run_ret = kvm_vcpu_ioctl(cpu, KVM_RUN, 0);
+        if (cpu->kvm_exit_stats) {
+            exit_stamp = get_clock();
+        }
 
         attrs = kvm_arch_post_run(cpu, run);
 
@@ -3044,6 +3557,10 @@ int kvm_cpu_exec(CPUState *cpu)
                              run->mmio.data,
                              run->mmio.len,
                              run->mmio.is_write);
+            if (run->mmio.is_write) {
+                address_space_note_write_exit(&address_space_memory,
+                                              run->mmio.phys_addr);
+            }
             ret = 0;
             break;
         case KVM_EXIT_IRQ_WINDOW_OPEN:
@@ -3113,6 +3630,10 @@ int kvm_cpu_exec(CPUState *cpu)
             ret = kvm_arch_handle_exit(cpu, run);
             break;
         }
+
+        if (exit_stamp) {
+            kvm_exit_stats_account(cpu, run, get_clock() - exit_stamp);
+        }
     } while (ret == 0);
 
     cpu_exec_end(cpu);
@@ -3752,6 +4273,163 @@ static void kvm_set_dirty_ring_size(Object *obj, Visitor *v,
     s->kvm_dirty_ring_size = value;
 }
 
+static void kvm_get_dirty_ring_reap_threads(Object *obj, Visitor *v,
+                                            const char *name, void *opaque,
+                                            Error **errp)
+{
+    KVMState *s = KVM_STATE(obj);
+    uint32_t value = s->kvm_dirty_ring_reap_threads;
+
+    visit_type_uint32(v, name, &value, errp);
+}
+
+static void kvm_set_dirty_ring_reap_threads(Object *obj, Visitor *v,
+                                            const char *name, void *opaque,
+                                            Error **errp)
+{
+    KVMState *s = KVM_STATE(obj);
+    uint32_t value;
+
+    if (s->fd != -1) {
+        error_setg(errp, "Cannot set properties after the accelerator has been initialized");
+        return;
+    }
+
+    if (!visit_type_uint32(v, name, &value, errp)) {
+        return;
+    }
+    if (value < 1 || value > 64) {
+        error_setg(errp, "dirty-ring-reap-threads must be between 1 and 64.");
+        return;
+    }
+
+    s->kvm_dirty_ring_reap_threads = value;
+}
+
+static void kvm_get_dirty_ring_soft_full(Object *obj, Visitor *v,
+                                         const char *name, void *opaque,
+                                         Error **errp)
+{
+    KVMState *s = KVM_STATE(obj);
+    uint8_t value = s->kvm_dirty_ring_soft_full;
+
+    visit_type_uint8(v, name, &value, errp);
+}
+
+static void kvm_set_dirty_ring_soft_full(Object *obj, Visitor *v,
+                                         const char *name, void *opaque,
+                                         Error **errp)
+{
+    KVMState *s = KVM_STATE(obj);
+    uint8_t value;
+
+    if (s->fd != -1) {
+        error_setg(errp, "Cannot set properties after the accelerator has been initialized");
+        return;
+    }
+
+    if (!visit_type_uint8(v, name, &value, errp)) {
+        return;
+    }
+    if (value > 100) {
+        error_setg(errp, "dirty-ring-soft-full is a percentage (0-100).");
+        return;
+    }
+
+    s->kvm_dirty_ring_soft_full = value;
+}
+
+static void kvm_get_halt_poll_budget(Object *obj, Visitor *v,
+                                     const char *name, void *opaque,
+                                     Error **errp)
+{
+    KVMState *s = KVM_STATE(obj);
+    uint8_t value = s->halt_poll_budget;
+
+    visit_type_uint8(v, name, &value, errp);
+}
+
+static void kvm_set_halt_poll_budget(Object *obj, Visitor *v,
+                                     const char *name, void *opaque,
+                                     Error **errp)
+{
+    KVMState *s = KVM_STATE(obj);
+    uint8_t value;
+
+    if (s->fd != -1) {
+        error_setg(errp, "Cannot set properties after the accelerator has been initialized");
+        return;
+    }
+
+    if (!visit_type_uint8(v, name, &value, errp)) {
+        return;
+    }
+    if (value > 100) {
+        error_setg(errp, "halt-poll-budget is a percentage (0-100).");
+        return;
+    }
+
+    s->halt_poll_budget = value;
+}
+
+static void kvm_get_halt_poll_max_ns(Object *obj, Visitor *v,
+                                     const char *name, void *opaque,
+                                     Error **errp)
+{
+    KVMState *s = KVM_STATE(obj);
+    uint32_t value = s->halt_poll_max_ns;
+
+    visit_type_uint32(v, name, &value, errp);
+}
+
+static void kvm_set_halt_poll_max_ns(Object *obj, Visitor *v,
+                                     const char *name, void *opaque,
+                                     Error **errp)
+{
+    KVMState *s = KVM_STATE(obj);
+    uint32_t value;
+
+    if (s->fd != -1) {
+        error_setg(errp, "Cannot set properties after the accelerator has been initialized");
+        return;
+    }
+
+    if (!visit_type_uint32(v, name, &value, errp)) {
+        return;
+    }
+
+    s->halt_poll_max_ns = value;
+}
+
+static bool kvm_get_exit_stats(Object *obj, Error **errp)
+{
+    KVMState *s = KVM_STATE(obj);
+
+    return s->exit_stats;
+}
+
+static void kvm_set_exit_stats(Object *obj, bool value, Error **errp)
+{
+    KVMState *s = KVM_STATE(obj);
+
+    if (s->fd != -1) {
+        error_setg(errp, "Cannot set properties after the accelerator has been initialized");
+        return;
+    }
+
+    s->exit_stats = value;
+}
+
+static void kvm_get_halt_poll_ns(Object *obj, Visitor *v,
+                                 const char *name, void *opaque,
+                                 Error **errp)
+{
+    KVMState *s = KVM_STATE(obj);
+    uint32_t value = s->halt_poll_ns;
+
+    visit_type_uint32(v, name, &value, errp);
+}
+
 static void kvm_accel_instance_init(Object *obj)
 {
     KVMState *s = KVM_STATE(obj);
@@ -3764,6 +4442,11 @@ static void kvm_accel_instance_init(Object *obj)
     /* KVM dirty ring is by default off */
     s->kvm_dirty_ring_size = 0;
     s->kvm_dirty_ring_with_bitmap = false;
+    s->kvm_dirty_ring_reap_threads = 1;
+    s->kvm_dirty_ring_soft_full = 0;
+    /* Halt-polling is left to the kernel by default */
+    s->halt_poll_budget = 0;
+    s->halt_poll_max_ns = 200000;
     s->notify_vmexit = NOTIFY_VMEXIT_OPTION_RUN;
     s->notify_window = 0;
     s->xen_version = 0;
@@ -3809,6 +4492,43 @@ static void kvm_accel_class_init(ObjectClass *oc, void *data)
     object_class_property_set_description(oc, "dirty-ring-size",
         "Size of KVM dirty page ring buffer (default: 0, i.e. use bitmap)");
 
+    object_class_property_add(oc, "dirty-ring-reap-threads", "uint32",
+        kvm_get_dirty_ring_reap_threads, kvm_set_dirty_ring_reap_threads,
+        NULL, NULL);
+    object_class_property_set_description(oc, "dirty-ring-reap-threads",
+        "Number of threads collecting KVM dirty rings (default: 1)");
+
+    object_class_property_add(oc, "dirty-ring-soft-full", "uint8",
+        kvm_get_dirty_ring_soft_full, kvm_set_dirty_ring_soft_full,
+        NULL, NULL);
+    object_class_property_set_description(oc, "dirty-ring-soft-full",
+        "Reap dirty rings early once one is this many percent full "
+        "(default: 0, i.e. once a second)");
+
+    object_class_property_add(oc, "halt-poll-budget", "uint8",
+        kvm_get_halt_poll_budget, kvm_set_halt_poll_budget,
+        NULL, NULL);
+    object_class_property_set_description(oc, "halt-poll-budget",
+        "Percentage of vCPU time that may be wasted in failed halt polls "
+        "(default: 0, i.e. let KVM manage halt polling)");
+
+    object_class_property_add(oc, "halt-poll-max-ns", "uint32",
+        kvm_get_halt_poll_max_ns, kvm_set_halt_poll_max_ns,
+        NULL, NULL);
+    object_class_property_set_description(oc, "halt-poll-max-ns",
+        "Upper bound for the halt polling time set by halt-poll-budget");
+
+    object_class_property_add(oc, "halt-poll-ns", "uint32",
+        kvm_get_halt_poll_ns, NULL, NULL, NULL);
+    object_class_property_set_description(oc, "halt-poll-ns",
+        "Halt polling time currently chosen by halt-poll-budget");
+
+    object_class_property_add_bool(oc, "x-exit-stats",
+        kvm_get_exit_stats, kvm_set_exit_stats);
+    object_class_property_set_description(oc, "x-exit-stats",
+        "Count KVM exits and the time spent handling them per vCPU, "
+        "see x-query-kvm-exits");
+
     kvm_arch_accel_class_init(oc);
 }
 
@@ -3827,6 +4547,13 @@ static void kvm_type_init(void)
 
 type_init(kvm_type_init);
 
+static void hmp_kvm_register(void)
+{
+    monitor_register_hmp_info_hrt("kvm-exits", qmp_x_query_kvm_exits);
+}
+
+type_init(hmp_kvm_register);
+
 typedef struct StatsArgs {
     union StatsResultsType {
         StatsResultList **stats;
@@ -4227,3 +4954,128 @@ void query_stats_schemas_cb(StatsSchemaList **result, Error **errp)
         query_stats_schema_vcpu(first_cpu, &stats_args);
     }
 }
+
+/*
+ * Read a single u64 statistic called @name from @stats_fd.  Returns false
+ * if KVM doesn't provide it.
+ */
+static bool kvm_stats_read_u64(StatsTarget target, int stats_fd,
+                               const char *name, uint64_t *value)
+{
+    struct kvm_stats_header *kvm_stats_header;
+    StatsDescriptors *descriptors;
+    struct kvm_stats_desc *pdesc;
+    size_t size_desc;
+    int i;
+
+    descriptors = find_stats_descriptors(target, stats_fd, NULL);
+    if (!descriptors) {
+        return false;
+    }
+
+    kvm_stats_header = &descriptors->kvm_stats_header;
+    size_desc = sizeof(*descriptors->kvm_stats_desc) +
+                kvm_stats_header->name_size;
+
+    for (i = 0; i < kvm_stats_header->num_desc; ++i) {
+        pdesc = (void *)descriptors->kvm_stats_desc + i * size_desc;
+        if (pdesc->size == 1 && g_str_equal(pdesc->name, name)) {
+            return pread(stats_fd, value, sizeof(*value),
+                         kvm_stats_header->data_offset + pdesc->offset) ==
+                   sizeof(*value);
+        }
+    }
+
+    return false;
+}
+
+#define KVM_HALT_POLL_PERIOD_MS  1000
+#define KVM_HALT_POLL_MIN_NS     10000
+
+/*
+ * Once a period, compare the time all vcpus spent in failed halt polls
+ * against halt_poll_budget percent of their run time.  Over budget, the
+ * VM-wide halt_poll_ns is halved.  Under budget, and as long as polling
+ * pays off more often than not, it is doubled up to halt_poll_max_ns.
+ * KVM still grows and shrinks the per-vcpu polling window within that
+ * limit according to each vcpu's own halts.
+ */
+static void kvm_halt_poll_update(void *opaque)
+{
+    KVMState *s = opaque;
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    uint64_t success = 0, fail = 0, success_delta, fail_delta, val;
+    uint64_t budget_ns;
+    uint32_t ns = s->halt_poll_ns;
+    unsigned int nr_vcpus = 0;
+    CPUState *cpu;
+
+    CPU_FOREACH(cpu) {
+        int stats_fd = cpu->kvm_vcpu_stats_fd;
+
+        if (stats_fd == -1) {
+            continue;
+        }
+        if (kvm_stats_read_u64(STATS_TARGET_VCPU, stats_fd,
+                               "halt_poll_success_ns", &val)) {
+            success += val;
+        }
+        if (kvm_stats_read_u64(STATS_TARGET_VCPU, stats_fd,
+                               "halt_poll_fail_ns", &val)) {
+            fail += val;
+        }
+        nr_vcpus++;
+    }
+
+    /* Totals go backwards when a vcpu is unplugged, skip that pass */
+    success_delta = success >= s->halt_poll_success_ns ?
+                    success - s->halt_poll_success_ns : 0;
+    fail_delta = fail >= s->halt_poll_fail_ns ?
+                 fail - s->halt_poll_fail_ns : 0;
+    budget_ns = (now - s->halt_poll_stamp) / 100 * nr_vcpus *
+                s->halt_poll_budget;
+
+    if (fail_delta > budget_ns) {
+        ns = ns / 2 < KVM_HALT_POLL_MIN_NS ? 0 : ns / 2;
+    } else if (!ns) {
+        /* Nothing to measure without polling, so probe again */
+        ns = MIN(KVM_HALT_POLL_MIN_NS, s->halt_poll_max_ns);
+    } else if (success_delta > fail_delta) {
+        ns = MIN((uint64_t)ns * 2, s->halt_poll_max_ns);
+    }
+
+    if (ns != s->halt_poll_ns &&
+        kvm_vm_enable_cap(s, KVM_CAP_HALT_POLL, 0, ns) == 0) {
+        s->halt_poll_ns = ns;
+    }
+    trace_kvm_halt_poll_update(s->halt_poll_ns, success_delta, fail_delta,
+                               budget_ns);
+
+    s->halt_poll_stamp = now;
+    s->halt_poll_success_ns = success;
+    s->halt_poll_fail_ns = fail;
+    timer_mod(s->halt_poll_timer,
+              qemu_clock_get_ms(QEMU_CLOCK_REALTIME) + KVM_HALT_POLL_PERIOD_MS);
+}
+
+static void kvm_halt_poll_init(KVMState *s)
+{
+    if (!kvm_vm_check_extension(s, KVM_CAP_HALT_POLL) ||
+        !kvm_check_extension(s, KVM_CAP_BINARY_STATS_FD)) {
+        warn_report("KVM does not support halt-polling control, "
+                    "ignoring halt-poll-budget");
+        return;
+    }
+
+    if (kvm_vm_enable_cap(s, KVM_CAP_HALT_POLL, 0, s->halt_poll_max_ns)) {
+        warn_report("Failed to set halt_poll_ns, ignoring halt-poll-budget");
+        return;
+    }
+
+    s->halt_poll_ns = s->halt_poll_max_ns;
+    s->halt_poll_stamp = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    s->halt_poll_timer = timer_new_ms(QEMU_CLOCK_REALTIME,
+                                      kvm_halt_poll_update, s);
+    timer_mod(s->halt_poll_timer,
+              qemu_clock_get_ms(QEMU_CLOCK_REALTIME) + KVM_HALT_POLL_PERIOD_MS);
+}
@@ -13,6 +13,8 @@
 #include "qemu/osdep.h"
 #include "sysemu/kvm.h"
 #include "hw/pci/msi.h"
+#include "qapi/error.h"
+#include "qapi/qapi-commands-machine.h"
 
 KVMState *kvm_state;
 bool kvm_kernel_irqchip;
@@ -133,3 +135,10 @@ uint32_t kvm_dirty_ring_size(void)
 {
     return 0;
 }
+
+HumanReadableText *qmp_x_query_kvm_exits(Error **errp)
+{
+    error_setg(errp, "KVM exit statistics are only available with "
+               "-accel kvm,x-exit-stats=on");
+    return NULL;
+}
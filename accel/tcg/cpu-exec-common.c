@@ -25,6 +25,64 @@
 #include "internal.h"
 
 bool tcg_allowed;
+bool tcg_atomic_stripes;
+
+#define ATOMIC_STRIPE_LINE_BITS 6
+#define ATOMIC_STRIPE_BITS      10
+
+struct atomic_stripe {
+    QemuSpin lock;
+    size_t count;
+} QEMU_ALIGNED(1 << ATOMIC_STRIPE_LINE_BITS);
+
+static struct atomic_stripe atomic_stripes[1 << ATOMIC_STRIPE_BITS];
+
+static unsigned atomic_stripe_index(uintptr_t haddr)
+{
+    return (haddr >> ATOMIC_STRIPE_LINE_BITS) &
+           (ARRAY_SIZE(atomic_stripes) - 1);
+}
+
+void atomic_stripe_lock(const void *haddr, size_t size)
+{
+    unsigned first = atomic_stripe_index((uintptr_t)haddr);
+    unsigned last = atomic_stripe_index((uintptr_t)haddr + size - 1);
+    struct atomic_stripe *s = &atomic_stripes[first];
+
+    /* An access crossing two lines takes both stripes, lowest first */
+    if (first > last) {
+        qemu_spin_lock(&atomic_stripes[last].lock);
+        qemu_spin_lock(&s->lock);
+    } else {
+        qemu_spin_lock(&s->lock);
+        if (last != first) {
+            qemu_spin_lock(&atomic_stripes[last].lock);
+        }
+    }
+    qatomic_set(&s->count, s->count + 1);
+}
+
+void atomic_stripe_unlock(const void *haddr, size_t size)
+{
+    unsigned first = atomic_stripe_index((uintptr_t)haddr);
+    unsigned last = atomic_stripe_index((uintptr_t)haddr + size - 1);
+
+    if (last != first) {
+        qemu_spin_unlock(&atomic_stripes[last].lock);
+    }
+    qemu_spin_unlock(&atomic_stripes[first].lock);
+}
+
+size_t atomic_stripe_count(void)
+{
+    size_t count = 0;
+    int i;
+
+    for (i = 0; i < ARRAY_SIZE(atomic_stripes); i++) {
+        count += qatomic_read(&atomic_stripes[i].count);
+    }
+    return count;
+}
 
 /* exit the current TB, but without causing any exception to be raised */
 void cpu_loop_exit_noexc(CPUState *cpu)
@@ -577,6 +577,8 @@ void cpu_exec_step_atomic(CPUState *cpu)
         g_assert(cpu == current_cpu);
         g_assert(!cpu->running);
         cpu->running = true;
+        qatomic_set(&tb_ctx.atomic_exclusive_count,
+                    tb_ctx.atomic_exclusive_count + 1);
 
         cpu_get_tb_cpu_state(env, &pc, &cs_base, &flags);
 
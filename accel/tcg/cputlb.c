@@ -234,7 +234,9 @@ static void tlb_mmu_flush_locked(CPUTLBDesc *desc, CPUTLBDescFast *fast)
     desc->n_used_entries = 0;
     desc->large_page_addr = -1;
     desc->large_page_mask = -1;
-    desc->vindex = 0;
+    memset(desc->large_pages, -1, sizeof(desc->large_pages));
+    desc->large_page_next = 0;
+    memset(desc->vindex, 0, sizeof(desc->vindex));
     memset(fast->table, -1, sizeof_tlb(fast));
     memset(desc->vtable, -1, sizeof(desc->vtable));
 }
@@ -247,6 +249,7 @@ static void tlb_flush_one_mmuidx_locked(CPUArchState *env, int mmu_idx,
 
     tlb_mmu_resize_locked(desc, fast, now);
     tlb_mmu_flush_locked(desc, fast);
+    qatomic_set(&desc->flush_count, desc->flush_count + 1);
 }
 
 static void tlb_mmu_init(CPUTLBDesc *desc, CPUTLBDescFast *fast, int64_t now)
@@ -338,6 +341,24 @@ void tlb_flush_counts(size_t *pfull, size_t *ppart, size_t *pelide)
     *pelide = elide;
 }
 
+void tlb_mmu_idx_counts(int mmu_idx, size_t *pvtlb_hit, size_t *pvtlb_miss,
+                        size_t *pflush)
+{
+    CPUState *cpu;
+    size_t vtlb_hit = 0, vtlb_miss = 0, flush = 0;
+
+    CPU_FOREACH(cpu) {
+        CPUTLBDesc *desc = &env_tlb(cpu->env_ptr)->d[mmu_idx];
+
+        vtlb_hit += qatomic_read(&desc->vtlb_hit_count);
+        vtlb_miss += qatomic_read(&desc->vtlb_miss_count);
+        flush += qatomic_read(&desc->flush_count);
+    }
+    *pvtlb_hit = vtlb_hit;
+    *pvtlb_miss = vtlb_miss;
+    *pflush = flush;
+}
+
 static void tlb_flush_by_mmuidx_async_work(CPUState *cpu, run_on_cpu_data data)
 {
     CPUArchState *env = cpu->env_ptr;
@@ -468,16 +489,31 @@ static inline bool tlb_flush_entry_locked(CPUTLBEntry *tlb_entry, vaddr page)
     return tlb_flush_entry_mask_locked(tlb_entry, page, -1);
 }
 
+/*
+ * Return the victim tlb set for @addr.  Because CPU_VTLB_SETS is not
+ * larger than the smallest fast tlb, this is also the fast tlb index
+ * modulo CPU_VTLB_SETS; any @mask used to flush the victim tlb keeps
+ * at least the fast tlb index bits, so it never spans several sets.
+ */
+static inline size_t vtlb_set_index(vaddr addr)
+{
+    QEMU_BUILD_BUG_ON(CPU_VTLB_SETS > (1 << CPU_TLB_DYN_MIN_BITS));
+    QEMU_BUILD_BUG_ON(CPU_VTLB_SETS & (CPU_VTLB_SETS - 1));
+    QEMU_BUILD_BUG_ON(CPU_VTLB_WAYS > UINT8_MAX);
+    return (addr >> TARGET_PAGE_BITS) & (CPU_VTLB_SETS - 1);
+}
+
 /* Called with tlb_c.lock held */
 static void tlb_flush_vtlb_page_mask_locked(CPUArchState *env, int mmu_idx,
                                             vaddr page,
                                             vaddr mask)
 {
     CPUTLBDesc *d = &env_tlb(env)->d[mmu_idx];
+    size_t set = vtlb_set_index(page);
     int k;
 
     assert_cpu_is_self(env_cpu(env));
-    for (k = 0; k < CPU_VTLB_SIZE; k++) {
+    for (k = set * CPU_VTLB_WAYS; k < (set + 1) * CPU_VTLB_WAYS; k++) {
         if (tlb_flush_entry_mask_locked(&d->vtable[k], page, mask)) {
             tlb_n_used_entries_dec(env, mmu_idx);
         }
@@ -490,10 +526,59 @@ static inline void tlb_flush_vtlb_page_locked(CPUArchState *env, int mmu_idx,
     tlb_flush_vtlb_page_mask_locked(env, mmu_idx, page, -1);
 }
 
+/*
+ * Flush all of the tlb entries covered by the large page @lp, and
+ * forget about it.  The entries are looked up either one target page
+ * at a time, or by scanning the whole tlb if it has fewer entries
+ * than @lp has pages.  Called with tlb_c.lock held.
+ */
+static void tlb_flush_large_page_locked(CPUArchState *env, int midx,
+                                        CPUTLBLargePage *lp)
+{
+    CPUTLBDesc *d = &env_tlb(env)->d[midx];
+    CPUTLBDescFast *f = &env_tlb(env)->f[midx];
+    vaddr n_pages = (~lp->mask + 1) >> TARGET_PAGE_BITS;
+    size_t n_entries = tlb_n_entries(f);
+    size_t i;
+
+    tlb_debug("flush large page midx %d (%016" VADDR_PRIx "/%016"
+              VADDR_PRIx ")\n", midx, lp->addr, lp->mask);
+
+    if (n_pages < n_entries) {
+        for (i = 0; i < n_pages; i++) {
+            vaddr page = lp->addr + ((vaddr)i << TARGET_PAGE_BITS);
+
+            if (tlb_flush_entry_mask_locked(tlb_entry(env, midx, page),
+                                            lp->addr, lp->mask)) {
+                tlb_n_used_entries_dec(env, midx);
+            }
+        }
+    } else {
+        for (i = 0; i < n_entries; i++) {
+            if (tlb_flush_entry_mask_locked(&f->table[i],
+                                            lp->addr, lp->mask)) {
+                tlb_n_used_entries_dec(env, midx);
+            }
+        }
+    }
+
+    /* The pages of @lp are spread over all of the victim tlb sets.  */
+    for (i = 0; i < CPU_VTLB_SIZE; i++) {
+        if (tlb_flush_entry_mask_locked(&d->vtable[i], lp->addr, lp->mask)) {
+            tlb_n_used_entries_dec(env, midx);
+        }
+    }
+
+    lp->addr = -1;
+    lp->mask = -1;
+}
+
 static void tlb_flush_page_locked(CPUArchState *env, int midx, vaddr page)
 {
-    vaddr lp_addr = env_tlb(env)->d[midx].large_page_addr;
-    vaddr lp_mask = env_tlb(env)->d[midx].large_page_mask;
+    CPUTLBDesc *d = &env_tlb(env)->d[midx];
+    vaddr lp_addr = d->large_page_addr;
+    vaddr lp_mask = d->large_page_mask;
+    int i;
 
     /* Check if we need to flush due to large pages.  */
     if ((page & lp_mask) == lp_addr) {
@@ -501,12 +586,21 @@ static void tlb_flush_page_locked(CPUArchState *env, int midx, vaddr page)
                   VADDR_PRIx "/%016" VADDR_PRIx ")\n",
                   midx, lp_addr, lp_mask);
         tlb_flush_one_mmuidx_locked(env, midx, get_clock_realtime());
-    } else {
-        if (tlb_flush_entry_locked(tlb_entry(env, midx, page), page)) {
-            tlb_n_used_entries_dec(env, midx);
+        return;
+    }
+
+    for (i = 0; i < CPU_TLB_LARGE_PAGES; i++) {
+        CPUTLBLargePage *lp = &d->large_pages[i];
+
+        if ((page & lp->mask) == lp->addr) {
+            tlb_flush_large_page_locked(env, midx, lp);
         }
-        tlb_flush_vtlb_page_locked(env, midx, page);
     }
+
+    if (tlb_flush_entry_locked(tlb_entry(env, midx, page), page)) {
+        tlb_n_used_entries_dec(env, midx);
+    }
+    tlb_flush_vtlb_page_locked(env, midx, page);
 }
 
 /**
@@ -747,6 +841,15 @@ static void tlb_flush_range_locked(CPUArchState *env, int midx,
         return;
     }
 
+    for (int i = 0; i < CPU_TLB_LARGE_PAGES; i++) {
+        CPUTLBLargePage *lp = &d->large_pages[i];
+
+        if (lp->addr != (vaddr)-1 &&
+            lp->addr <= addr + len - 1 && addr <= (lp->addr | ~lp->mask)) {
+            tlb_flush_large_page_locked(env, midx, lp);
+        }
+    }
+
     for (vaddr i = 0; i < len; i += TARGET_PAGE_SIZE) {
         vaddr page = addr + i;
         CPUTLBEntry *entry = tlb_entry(env, midx, page);
@@ -1075,21 +1178,20 @@ void tlb_set_dirty(CPUState *cpu, vaddr addr)
     }
 
     for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
+        size_t set = vtlb_set_index(addr);
         int k;
-        for (k = 0; k < CPU_VTLB_SIZE; k++) {
+
+        for (k = set * CPU_VTLB_WAYS; k < (set + 1) * CPU_VTLB_WAYS; k++) {
             tlb_set_dirty1_locked(&env_tlb(env)->d[mmu_idx].vtable[k], addr);
         }
     }
     qemu_spin_unlock(&env_tlb(env)->c.lock);
 }
 
-/* Our TLB does not support large pages, so remember the area covered by
-   large pages and trigger a full TLB flush if these are invalidated.  */
-static void tlb_add_large_page(CPUArchState *env, int mmu_idx,
-                               vaddr addr, uint64_t size)
+/* Extend the large page region to include the large page at ADDR.  */
+static void tlb_merge_large_page(CPUTLBDesc *d, vaddr addr, vaddr lp_mask)
 {
-    vaddr lp_addr = env_tlb(env)->d[mmu_idx].large_page_addr;
-    vaddr lp_mask = ~(size - 1);
+    vaddr lp_addr = d->large_page_addr;
 
     if (lp_addr == (vaddr)-1) {
         /* No previous large page.  */
@@ -1098,13 +1200,46 @@ static void tlb_add_large_page(CPUArchState *env, int mmu_idx,
         /* Extend the existing region to include the new page.
            This is a compromise between unnecessary flushes and
            the cost of maintaining a full variable size TLB.  */
-        lp_mask &= env_tlb(env)->d[mmu_idx].large_page_mask;
+        lp_mask &= d->large_page_mask;
         while (((lp_addr ^ addr) & lp_mask) != 0) {
             lp_mask <<= 1;
         }
     }
-    env_tlb(env)->d[mmu_idx].large_page_addr = lp_addr & lp_mask;
-    env_tlb(env)->d[mmu_idx].large_page_mask = lp_mask;
+    d->large_page_addr = lp_addr & lp_mask;
+    d->large_page_mask = lp_mask;
+}
+
+/* Our TLB does not support large pages, so remember the pages covered by
+   the most recent large pages, so that invalidating one of them flushes
+   only these pages.  Older large pages are merged into an area that
+   triggers a full TLB flush if it is invalidated.  */
+static void tlb_add_large_page(CPUArchState *env, int mmu_idx,
+                               vaddr addr, uint64_t size)
+{
+    CPUTLBDesc *d = &env_tlb(env)->d[mmu_idx];
+    vaddr lp_mask = ~(size - 1);
+    CPUTLBLargePage *lp;
+    int i;
+
+    addr &= lp_mask;
+    if ((addr & d->large_page_mask) == d->large_page_addr) {
+        return;
+    }
+    for (i = 0; i < CPU_TLB_LARGE_PAGES; i++) {
+        lp = &d->large_pages[i];
+        if ((addr & lp->mask) == lp->addr && lp->mask <= lp_mask) {
+            /* Already covered by the same or a larger page.  */
+            return;
+        }
+    }
+
+    lp = &d->large_pages[d->large_page_next];
+    d->large_page_next = (d->large_page_next + 1) % CPU_TLB_LARGE_PAGES;
+    if (lp->addr != (vaddr)-1) {
+        tlb_merge_large_page(d, lp->addr, lp->mask);
+    }
+    lp->addr = addr;
+    lp->mask = lp_mask;
 }
 
 static inline void tlb_set_compare(CPUTLBEntryFull *full, CPUTLBEntry *ent,
@@ -1243,9 +1378,13 @@ void tlb_set_page_full(CPUState *cpu, int mmu_idx,
      * different page; otherwise just overwrite the stale data.
      */
     if (!tlb_hit_page_anyprot(te, addr_page) && !tlb_entry_is_empty(te)) {
-        unsigned vidx = desc->vindex++ % CPU_VTLB_SIZE;
+        size_t set = vtlb_set_index(addr_page);
+        unsigned way = desc->vindex[set];
+        unsigned vidx = set * CPU_VTLB_WAYS + way;
         CPUTLBEntry *tv = &desc->vtable[vidx];
 
+        desc->vindex[set] = (way + 1) % CPU_VTLB_WAYS;
+
         /* Evict the old entry into the victim tlb.  */
         copy_tlb_helper_locked(tv, te);
         desc->vfulltlb[vidx] = desc->fulltlb[index];
@@ -1269,6 +1408,11 @@ void tlb_set_page_full(CPUState *cpu, int mmu_idx,
     full = &desc->fulltlb[index];
     full->xlat_section = iotlb - addr_page;
     full->phys_addr = paddr_page;
+    full->mmio_direct = 0;
+    if (!is_ram) {
+        full->mmio_direct = memory_region_direct_sizes(section->mr, false) |
+                            memory_region_direct_sizes(section->mr, true) << 4;
+    }
 
     /* Now calculate the new entry */
     tn.addend = addend - addr_page;
@@ -1336,6 +1480,14 @@ static void tlb_fill(CPUState *cpu, vaddr addr, int size,
     ok = cpu->cc->tcg_ops->tlb_fill(cpu, addr, size,
                                     access_type, mmu_idx, false, retaddr);
     assert(ok);
+
+    if (unlikely(tcg_tb_profile) && retaddr) {
+        TranslationBlock *tb = tcg_tb_lookup(retaddr);
+
+        if (tb) {
+            tb->tlb_fill_count++;
+        }
+    }
 }
 
 static inline void cpu_unaligned_access(CPUState *cpu, vaddr addr,
@@ -1405,7 +1557,13 @@ static uint64_t io_readx(CPUArchState *env, CPUTLBEntryFull *full,
 
     {
         QEMU_IOTHREAD_LOCK_GUARD();
-        r = memory_region_dispatch_read(mr, mr_offset, &val, op, full->attrs);
+        if (full->mmio_direct & (1 << (op & MO_SIZE))) {
+            r = memory_region_dispatch_read_direct(mr, mr_offset, &val, op,
+                                                   full->attrs);
+        } else {
+            r = memory_region_dispatch_read(mr, mr_offset, &val, op,
+                                            full->attrs);
+        }
     }
 
     if (r != MEMTX_OK) {
@@ -1445,7 +1603,13 @@ static void io_writex(CPUArchState *env, CPUTLBEntryFull *full,
 
     {
         QEMU_IOTHREAD_LOCK_GUARD();
-        r = memory_region_dispatch_write(mr, mr_offset, val, op, full->attrs);
+        if (full->mmio_direct & (0x10 << (op & MO_SIZE))) {
+            r = memory_region_dispatch_write_direct(mr, mr_offset, val, op,
+                                                    full->attrs);
+        } else {
+            r = memory_region_dispatch_write(mr, mr_offset, val, op,
+                                             full->attrs);
+        }
     }
 
     if (r != MEMTX_OK) {
@@ -1464,11 +1628,13 @@ static void io_writex(CPUArchState *env, CPUTLBEntryFull *full,
 static bool victim_tlb_hit(CPUArchState *env, size_t mmu_idx, size_t index,
                            MMUAccessType access_type, vaddr page)
 {
+    CPUTLBDesc *desc = &env_tlb(env)->d[mmu_idx];
+    size_t set = vtlb_set_index(page);
     size_t vidx;
 
     assert_cpu_is_self(env_cpu(env));
-    for (vidx = 0; vidx < CPU_VTLB_SIZE; ++vidx) {
-        CPUTLBEntry *vtlb = &env_tlb(env)->d[mmu_idx].vtable[vidx];
+    for (vidx = set * CPU_VTLB_WAYS; vidx < (set + 1) * CPU_VTLB_WAYS; ++vidx) {
+        CPUTLBEntry *vtlb = &desc->vtable[vidx];
         uint64_t cmp = tlb_read_idx(vtlb, access_type);
 
         if (cmp == page) {
@@ -1485,9 +1651,11 @@ static bool victim_tlb_hit(CPUArchState *env, size_t mmu_idx, size_t index,
             CPUTLBEntryFull *f2 = &env_tlb(env)->d[mmu_idx].vfulltlb[vidx];
             CPUTLBEntryFull tmpf;
             tmpf = *f1; *f1 = *f2; *f2 = tmpf;
+            qatomic_set(&desc->vtlb_hit_count, desc->vtlb_hit_count + 1);
             return true;
         }
     }
+    qatomic_set(&desc->vtlb_miss_count, desc->vtlb_miss_count + 1);
     return false;
 }
 
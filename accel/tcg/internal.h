@@ -55,11 +55,14 @@ static inline void tb_lock_page1(tb_page_addr_t p0, tb_page_addr_t p1)
 
 static inline void tb_unlock_page1(tb_page_addr_t p0, tb_page_addr_t p1) { }
 static inline void tb_unlock_pages(TranslationBlock *tb) { }
+static inline bool tb_page_smc_hot(tb_page_addr_t p) { return false; }
 #else
 void tb_lock_page0(tb_page_addr_t);
 void tb_lock_page1(tb_page_addr_t, tb_page_addr_t);
 void tb_unlock_page1(tb_page_addr_t, tb_page_addr_t);
 void tb_unlock_pages(TranslationBlock *);
+/* True if guest writes keep invalidating code on the page of @p. */
+bool tb_page_smc_hot(tb_page_addr_t p);
 #endif
 
 #ifdef CONFIG_SOFTMMU
@@ -72,6 +75,7 @@ G_NORETURN void cpu_io_recompile(CPUState *cpu, uintptr_t retaddr);
 TranslationBlock *tb_gen_code(CPUState *cpu, vaddr pc,
                               uint64_t cs_base, uint32_t flags,
                               int cflags);
+void tb_evict_region(void);
 void page_init(void);
 void tb_htable_init(void);
 void tb_reset_jump(TranslationBlock *tb, int n);
@@ -103,6 +107,19 @@ extern int64_t max_delay;
 extern int64_t max_advance;
 
 extern bool one_insn_per_tb;
+extern bool tcg_tb_profile;
+extern bool tcg_atomic_stripes;
+
+/*
+ * With "-accel tcg,atomic-stripes=on", atomic accesses that the host
+ * cannot perform natively take a spinlock chosen by the host cache line
+ * instead of stopping all vCPUs.  They are only atomic with respect to
+ * other accesses that also go through the stripes.
+ */
+void atomic_stripe_lock(const void *haddr, size_t size);
+void atomic_stripe_unlock(const void *haddr, size_t size);
+/* Number of accesses that went through the stripes */
+size_t atomic_stripe_count(void);
 
 /**
  * tcg_req_mo:
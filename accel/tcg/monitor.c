@@ -66,6 +66,21 @@ HumanReadableText *qmp_x_query_jit(Error **errp)
     return human_readable_text_from_str(buf);
 }
 
+HumanReadableText *qmp_x_query_jit_profile(Error **errp)
+{
+    g_autoptr(GString) buf = g_string_new("");
+
+    if (!tcg_enabled()) {
+        error_setg(errp,
+                   "JIT profile information is only available with accel=tcg");
+        return NULL;
+    }
+
+    dump_tb_profile(buf);
+
+    return human_readable_text_from_str(buf);
+}
+
 HumanReadableText *qmp_x_query_opcount(Error **errp)
 {
     g_autoptr(GString) buf = g_string_new("");
@@ -84,6 +99,7 @@ HumanReadableText *qmp_x_query_opcount(Error **errp)
 static void hmp_tcg_register(void)
 {
     monitor_register_hmp_info_hrt("jit", qmp_x_query_jit);
+    monitor_register_hmp_info_hrt("jit-profile", qmp_x_query_jit_profile);
     monitor_register_hmp_info_hrt("opcount", qmp_x_query_opcount);
 }
 
@@ -41,6 +41,12 @@
  * optimization to avoid generating redundant operations. For instance, for the
  * second and all subsequent callbacks of an event, we do not need to reload the
  * CPU's index into a TCG temp, since the first callback did it already.
+ *
+ * Inline operations and conditional callbacks do not follow this scheme:
+ * their code depends on the operation, on whether it applies to a per-vCPU
+ * scoreboard, and may contain branches. For those the empty event is only
+ * a marker; the ops are generated from scratch in front of it, by pointing
+ * tcg_ctx->emit_before_op at the marker, and the marker is then removed.
  */
 #include "qemu/osdep.h"
 #include "cpu.h"
@@ -67,6 +73,8 @@
  * 0: enum plugin_gen_from
  * 1: enum plugin_gen_cb
  * 2: set to 1 for mem callback that is a write, 0 otherwise.
+ * 3: for mem callbacks, the qemu_plugin_meminfo_t of the access
+ * 4: for mem callbacks, the TCGv_i64 holding the address of the access
  */
 
 enum plugin_gen_from {
@@ -98,6 +106,11 @@ void HELPER(plugin_vcpu_mem_cb)(unsigned int vcpu_index,
                                 void *userdata)
 { }
 
+void HELPER(plugin_mem_ring_flush)(uint32_t cpu_index, void *ring)
+{
+    qemu_plugin_mem_ring_flush(ring, cpu_index);
+}
+
 static void gen_empty_udata_cb(void)
 {
     TCGv_i32 cpu_index = tcg_temp_ebb_new_i32();
@@ -112,22 +125,9 @@ static void gen_empty_udata_cb(void)
     tcg_temp_free_i32(cpu_index);
 }
 
-/*
- * For now we only support addi_i64.
- * When we support more ops, we can generate one empty inline cb for each.
- */
+/* inline ops are generated at injection time, see plugin_gen_inline() */
 static void gen_empty_inline_cb(void)
 {
-    TCGv_i64 val = tcg_temp_ebb_new_i64();
-    TCGv_ptr ptr = tcg_temp_ebb_new_ptr();
-
-    tcg_gen_movi_ptr(ptr, 0);
-    tcg_gen_ld_i64(val, ptr, 0);
-    /* pass an immediate != 0 so that it doesn't get optimized away */
-    tcg_gen_addi_i64(val, val, 0xdeadface);
-    tcg_gen_st_i64(val, ptr, 0);
-    tcg_temp_free_ptr(ptr);
-    tcg_temp_free_i64(val);
 }
 
 static void gen_empty_mem_cb(TCGv_i64 addr, uint32_t info)
@@ -165,7 +165,7 @@ static void gen_empty_mem_helper(void)
 static void gen_plugin_cb_start(enum plugin_gen_from from,
                                 enum plugin_gen_cb type, unsigned wr)
 {
-    tcg_gen_plugin_cb_start(from, type, wr);
+    tcg_gen_plugin_cb_start(from, type, wr, 0, NULL);
 }
 
 static void gen_wrapped(enum plugin_gen_from from,
@@ -192,8 +192,9 @@ static void plugin_gen_empty_callback(enum plugin_gen_from from)
                     gen_empty_mem_helper);
         /* fall through */
     case PLUGIN_GEN_FROM_TB:
-        gen_wrapped(from, PLUGIN_GEN_CB_UDATA, gen_empty_udata_cb);
+        /* inline ops and conditional callbacks come before regular ones */
         gen_wrapped(from, PLUGIN_GEN_CB_INLINE, gen_empty_inline_cb);
+        gen_wrapped(from, PLUGIN_GEN_CB_UDATA, gen_empty_udata_cb);
         break;
     default:
         g_assert_not_reached();
@@ -208,7 +209,9 @@ void plugin_gen_empty_mem_callback(TCGv_i64 addr, uint32_t info)
     gen_empty_mem_cb(addr, info);
     tcg_gen_plugin_cb_end();
 
-    gen_plugin_cb_start(PLUGIN_GEN_FROM_MEM, PLUGIN_GEN_CB_INLINE, rw);
+    /* rings need the address, see plugin_gen_mem_inline() */
+    tcg_gen_plugin_cb_start(PLUGIN_GEN_FROM_MEM, PLUGIN_GEN_CB_INLINE, rw,
+                            info, addr);
     gen_empty_inline_cb();
     tcg_gen_plugin_cb_end();
 }
@@ -274,19 +277,6 @@ static TCGOp *copy_const_ptr(TCGOp **begin_op, TCGOp *op, void *ptr)
     return op;
 }
 
-static TCGOp *copy_ld_i64(TCGOp **begin_op, TCGOp *op)
-{
-    if (TCG_TARGET_REG_BITS == 32) {
-        /* 2x ld_i32 */
-        op = copy_op(begin_op, op, INDEX_op_ld_i32);
-        op = copy_op(begin_op, op, INDEX_op_ld_i32);
-    } else {
-        /* ld_i64 */
-        op = copy_op(begin_op, op, INDEX_op_ld_i64);
-    }
-    return op;
-}
-
 static TCGOp *copy_st_i64(TCGOp **begin_op, TCGOp *op)
 {
     if (TCG_TARGET_REG_BITS == 32) {
@@ -300,21 +290,6 @@ static TCGOp *copy_st_i64(TCGOp **begin_op, TCGOp *op)
     return op;
 }
 
-static TCGOp *copy_add_i64(TCGOp **begin_op, TCGOp *op, uint64_t v)
-{
-    if (TCG_TARGET_REG_BITS == 32) {
-        /* all 32-bit backends must implement add2_i32 */
-        g_assert(TCG_TARGET_HAS_add2_i32);
-        op = copy_op(begin_op, op, INDEX_op_add2_i32);
-        op->args[4] = tcgv_i32_arg(tcg_constant_i32(v));
-        op->args[5] = tcgv_i32_arg(tcg_constant_i32(v >> 32));
-    } else {
-        op = copy_op(begin_op, op, INDEX_op_add_i64);
-        op->args[2] = tcgv_i64_arg(tcg_constant_i64(v));
-    }
-    return op;
-}
-
 static TCGOp *copy_st_ptr(TCGOp **begin_op, TCGOp *op)
 {
     if (UINTPTR_MAX == UINT32_MAX) {
@@ -378,25 +353,6 @@ static TCGOp *append_udata_cb(const struct qemu_plugin_dyn_cb *cb,
     return op;
 }
 
-static TCGOp *append_inline_cb(const struct qemu_plugin_dyn_cb *cb,
-                               TCGOp *begin_op, TCGOp *op,
-                               int *unused)
-{
-    /* const_ptr */
-    op = copy_const_ptr(&begin_op, op, cb->userp);
-
-    /* ld_i64 */
-    op = copy_ld_i64(&begin_op, op);
-
-    /* add_i64 */
-    op = copy_add_i64(&begin_op, op, cb->inline_insn.imm);
-
-    /* st_i64 */
-    op = copy_st_i64(&begin_op, op);
-
-    return op;
-}
-
 static TCGOp *append_mem_cb(const struct qemu_plugin_dyn_cb *cb,
                             TCGOp *begin_op, TCGOp *op, int *cb_idx)
 {
@@ -479,10 +435,292 @@ inject_udata_cb(const GArray *cbs, TCGOp *begin_op)
     inject_cb_type(cbs, begin_op, append_udata_cb, op_ok);
 }
 
-static void
-inject_inline_cb(const GArray *cbs, TCGOp *begin_op, op_ok_fn ok)
+/* pointer to the calling vCPU's element of @entry, or to @ptr */
+static TCGv_ptr gen_plugin_u64_ptr(qemu_plugin_u64 entry, void *ptr)
+{
+    TCGv_ptr addr = tcg_temp_ebb_new_ptr();
+    TCGv_i32 idx;
+    size_t stride;
+    char *base;
+
+    qemu_plugin_u64_layout(entry, ptr, &base, &stride);
+    if (!stride) {
+        tcg_gen_movi_ptr(addr, (uintptr_t)base);
+        return addr;
+    }
+
+    idx = tcg_temp_ebb_new_i32();
+    tcg_gen_ld_i32(idx, cpu_env,
+                   -offsetof(ArchCPU, env) + offsetof(CPUState, cpu_index));
+    tcg_gen_muli_i32(idx, idx, stride);
+    tcg_gen_ext_i32_ptr(addr, idx);
+    tcg_temp_free_i32(idx);
+    tcg_gen_addi_ptr(addr, addr, (uintptr_t)base);
+    return addr;
+}
+
+static void gen_inline_cb(const struct qemu_plugin_dyn_cb *cb)
+{
+    TCGv_ptr ptr = gen_plugin_u64_ptr(cb->inline_insn.entry, cb->userp);
+    TCGv_i64 val;
+
+    switch (cb->inline_insn.op) {
+    case QEMU_PLUGIN_INLINE_ADD_U64:
+        val = tcg_temp_ebb_new_i64();
+        tcg_gen_ld_i64(val, ptr, 0);
+        tcg_gen_addi_i64(val, val, cb->inline_insn.imm);
+        tcg_gen_st_i64(val, ptr, 0);
+        tcg_temp_free_i64(val);
+        break;
+    case QEMU_PLUGIN_INLINE_STORE_U64:
+        tcg_gen_st_i64(tcg_constant_i64(cb->inline_insn.imm), ptr, 0);
+        break;
+    default:
+        g_assert_not_reached();
+    }
+    tcg_temp_free_ptr(ptr);
+}
+
+/* the condition under which the callback is skipped */
+static TCGCond plugin_cond_to_skip_tcgcond(enum qemu_plugin_cond cond)
+{
+    switch (cond) {
+    case QEMU_PLUGIN_COND_EQ:
+        return TCG_COND_NE;
+    case QEMU_PLUGIN_COND_NE:
+        return TCG_COND_EQ;
+    case QEMU_PLUGIN_COND_LT:
+        return TCG_COND_GEU;
+    case QEMU_PLUGIN_COND_LE:
+        return TCG_COND_GTU;
+    case QEMU_PLUGIN_COND_GT:
+        return TCG_COND_LEU;
+    case QEMU_PLUGIN_COND_GE:
+        return TCG_COND_LTU;
+    default:
+        /* NEVER and ALWAYS are resolved at registration time */
+        g_assert_not_reached();
+    }
+}
+
+static void gen_cond_cb(const struct qemu_plugin_dyn_cb *cb)
+{
+    TCGLabel *skip = gen_new_label();
+    TCGv_ptr ptr = gen_plugin_u64_ptr(cb->cond.entry, NULL);
+    TCGv_i64 val = tcg_temp_ebb_new_i64();
+    TCGv_i32 cpu_index = tcg_temp_ebb_new_i32();
+    TCGOp *op;
+
+    tcg_gen_ld_i64(val, ptr, 0);
+    tcg_gen_brcondi_i64(plugin_cond_to_skip_tcgcond(cb->cond.cond), val,
+                        cb->cond.imm, skip);
+    tcg_gen_ld_i32(cpu_index, cpu_env,
+                   -offsetof(ArchCPU, env) + offsetof(CPUState, cpu_index));
+    gen_helper_plugin_vcpu_udata_cb(cpu_index, tcg_constant_ptr(cb->userp));
+
+    /* point the call at the plugin instead of the empty helper */
+    op = tcg_last_op();
+    tcg_debug_assert(op->opc == INDEX_op_call);
+    op->args[TCGOP_CALLO(op) + TCGOP_CALLI(op)] = (uintptr_t)cb->f.vcpu_udata;
+    gen_set_label(skip);
+
+    tcg_temp_free_i32(cpu_index);
+    tcg_temp_free_i64(val);
+    tcg_temp_free_ptr(ptr);
+}
+
+/*
+ * Memory access rings. Appending a record is branch-free; instead, the
+ * buffer is flushed ahead of time when the accesses about to be logged
+ * might not fit. That check is done once per TB, or for each instruction
+ * if the TB logs more accesses than the ring can hold.
+ */
+
+/* number of accesses logged to @ring by a TB or an instruction */
+struct plugin_ring_count {
+    struct qemu_plugin_mem_ring *ring;
+    unsigned int n;
+};
+
+static void ring_count_add(GArray *counts, struct qemu_plugin_mem_ring *ring,
+                           unsigned int n)
+{
+    struct plugin_ring_count new = { ring, n };
+    int i;
+
+    for (i = 0; i < counts->len; i++) {
+        struct plugin_ring_count *c =
+            &g_array_index(counts, struct plugin_ring_count, i);
+
+        if (c->ring == ring) {
+            c->n += n;
+            return;
+        }
+    }
+    g_array_append_val(counts, new);
+}
+
+static unsigned int ring_count_get(const GArray *counts,
+                                   struct qemu_plugin_mem_ring *ring)
+{
+    int i;
+
+    for (i = 0; i < counts->len; i++) {
+        const struct plugin_ring_count *c =
+            &g_array_index(counts, struct plugin_ring_count, i);
+
+        if (c->ring == ring) {
+            return c->n;
+        }
+    }
+    return 0;
+}
+
+static bool ring_ok(const TCGOp *op, const struct qemu_plugin_dyn_cb *cb)
+{
+    return cb->rw & op->args[2];
+}
+
+static TCGv_ptr gen_mem_ring_buf(struct qemu_plugin_mem_ring *ring)
+{
+    qemu_plugin_u64 entry = { ring->score, 0 };
+
+    return gen_plugin_u64_ptr(entry, NULL);
+}
+
+/* flush @ring unless it has room for @n more records */
+static void gen_mem_ring_check(const struct plugin_ring_count *c)
+{
+    TCGLabel *skip = gen_new_label();
+    TCGv_ptr buf = gen_mem_ring_buf(c->ring);
+    TCGv_i64 count = tcg_temp_ebb_new_i64();
+    TCGv_i32 cpu_index = tcg_temp_ebb_new_i32();
+
+    tcg_debug_assert(c->n <= c->ring->n_records);
+    tcg_gen_ld_i64(count, buf, offsetof(struct qemu_plugin_mem_ring_buf,
+                                        count));
+    tcg_gen_brcondi_i64(TCG_COND_LEU, count, c->ring->n_records - c->n, skip);
+    tcg_gen_ld_i32(cpu_index, cpu_env,
+                   -offsetof(ArchCPU, env) + offsetof(CPUState, cpu_index));
+    gen_helper_plugin_mem_ring_flush(cpu_index, tcg_constant_ptr(c->ring));
+    gen_set_label(skip);
+
+    tcg_temp_free_i32(cpu_index);
+    tcg_temp_free_i64(count);
+    tcg_temp_free_ptr(buf);
+}
+
+static void gen_mem_ring_append(const struct qemu_plugin_dyn_cb *cb,
+                                TCGv_i64 addr, qemu_plugin_meminfo_t info)
+{
+    const size_t rec0 = offsetof(struct qemu_plugin_mem_ring_buf, records);
+    TCGv_ptr buf = gen_mem_ring_buf(cb->userp);
+    TCGv_i64 count = tcg_temp_ebb_new_i64();
+    TCGv_i64 off = tcg_temp_ebb_new_i64();
+    TCGv_ptr rec = tcg_temp_ebb_new_ptr();
+
+    tcg_gen_ld_i64(count, buf, offsetof(struct qemu_plugin_mem_ring_buf,
+                                        count));
+    tcg_gen_muli_i64(off, count, sizeof(qemu_plugin_mem_record));
+    tcg_gen_trunc_i64_ptr(rec, off);
+    tcg_gen_add_ptr(rec, rec, buf);
+    tcg_gen_st_i64(addr, rec, rec0 + offsetof(qemu_plugin_mem_record, vaddr));
+    tcg_gen_st_i64(tcg_constant_i64(cb->ring.pc), rec,
+                   rec0 + offsetof(qemu_plugin_mem_record, pc));
+    tcg_gen_st_i32(tcg_constant_i32(info), rec,
+                   rec0 + offsetof(qemu_plugin_mem_record, info));
+    tcg_gen_addi_i64(count, count, 1);
+    tcg_gen_st_i64(count, buf, offsetof(struct qemu_plugin_mem_ring_buf,
+                                        count));
+
+    tcg_temp_free_ptr(rec);
+    tcg_temp_free_i64(off);
+    tcg_temp_free_i64(count);
+    tcg_temp_free_ptr(buf);
+}
+
+/*
+ * Count how many accesses each instruction logs to each of its rings,
+ * and return the totals for the whole TB, or NULL if there are no rings.
+ */
+static GArray *plugin_gen_count_ring_accesses(struct qemu_plugin_tb *ptb)
+{
+    GArray *counts = NULL;
+    TCGOp *op;
+    int insn_idx = -1;
+    int i, j;
+
+    for (i = 0; i < ptb->n; i++) {
+        struct qemu_plugin_insn *insn = g_ptr_array_index(ptb->insns, i);
+
+        if (insn->cbs[PLUGIN_CB_MEM][PLUGIN_CB_RING]->len) {
+            counts = g_array_new(false, false,
+                                 sizeof(struct plugin_ring_count));
+            break;
+        }
+    }
+    if (!counts) {
+        return NULL;
+    }
+
+    QTAILQ_FOREACH(op, &tcg_ctx->ops, link) {
+        struct qemu_plugin_insn *insn;
+        GArray *cbs;
+
+        if (op->opc == INDEX_op_insn_start) {
+            insn_idx++;
+            continue;
+        }
+        if (op->opc != INDEX_op_plugin_cb_start ||
+            op->args[0] != PLUGIN_GEN_FROM_MEM ||
+            op->args[1] != PLUGIN_GEN_CB_INLINE) {
+            continue;
+        }
+        insn = g_ptr_array_index(ptb->insns, insn_idx);
+        cbs = insn->cbs[PLUGIN_CB_MEM][PLUGIN_CB_RING];
+        for (j = 0; j < cbs->len; j++) {
+            struct qemu_plugin_dyn_cb *cb =
+                &g_array_index(cbs, struct qemu_plugin_dyn_cb, j);
+
+            if (ring_ok(op, cb)) {
+                cb->ring.n_accesses++;
+                ring_count_add(counts, cb->userp, 1);
+            }
+        }
+    }
+    return counts;
+}
+
+/*
+ * Generate the inline ops in @inline_cbs that @ok accepts, followed by the
+ * conditional callbacks in @cond_cbs and the checks for room in
+ * @ring_checks, in place of the marker at @begin_op.
+ */
+static void plugin_gen_inline(const GArray *inline_cbs, const GArray *cond_cbs,
+                              const GArray *ring_checks, TCGOp *begin_op,
+                              op_ok_fn ok)
 {
-    inject_cb_type(cbs, begin_op, append_inline_cb, ok);
+    int i;
+
+    tcg_ctx->emit_before_op = begin_op;
+    for (i = 0; inline_cbs && i < inline_cbs->len; i++) {
+        struct qemu_plugin_dyn_cb *cb =
+            &g_array_index(inline_cbs, struct qemu_plugin_dyn_cb, i);
+
+        if (ok(begin_op, cb)) {
+            gen_inline_cb(cb);
+        }
+    }
+    for (i = 0; cond_cbs && i < cond_cbs->len; i++) {
+        gen_cond_cb(&g_array_index(cond_cbs, struct qemu_plugin_dyn_cb, i));
+    }
+    for (i = 0; ring_checks && i < ring_checks->len; i++) {
+        gen_mem_ring_check(&g_array_index(ring_checks,
+                                          struct plugin_ring_count, i));
+    }
+    tcg_ctx->emit_before_op = NULL;
+
+    rm_ops(begin_op);
 }
 
 static void
@@ -526,12 +764,13 @@ static void inject_mem_enable_helper(struct qemu_plugin_tb *ptb,
                                      struct qemu_plugin_insn *plugin_insn,
                                      TCGOp *begin_op)
 {
-    GArray *cbs[2];
+    GArray *cbs[3];
     GArray *arr;
     size_t n_cbs, i;
 
     cbs[0] = plugin_insn->cbs[PLUGIN_CB_MEM][PLUGIN_CB_REGULAR];
     cbs[1] = plugin_insn->cbs[PLUGIN_CB_MEM][PLUGIN_CB_INLINE];
+    cbs[2] = plugin_insn->cbs[PLUGIN_CB_MEM][PLUGIN_CB_RING];
 
     n_cbs = 0;
     for (i = 0; i < ARRAY_SIZE(cbs); i++) {
@@ -592,9 +831,24 @@ static void plugin_gen_tb_udata(const struct qemu_plugin_tb *ptb,
 }
 
 static void plugin_gen_tb_inline(const struct qemu_plugin_tb *ptb,
-                                 TCGOp *begin_op)
+                                 TCGOp *begin_op, const GArray *ring_counts)
 {
-    inject_inline_cb(ptb->cbs[PLUGIN_CB_INLINE], begin_op, op_ok);
+    g_autoptr(GArray) checks = NULL;
+    int i;
+
+    if (ring_counts) {
+        checks = g_array_new(false, false, sizeof(struct plugin_ring_count));
+        for (i = 0; i < ring_counts->len; i++) {
+            const struct plugin_ring_count *c =
+                &g_array_index(ring_counts, struct plugin_ring_count, i);
+
+            if (c->n <= c->ring->n_records) {
+                g_array_append_val(checks, *c);
+            }
+        }
+    }
+    plugin_gen_inline(ptb->cbs[PLUGIN_CB_INLINE], ptb->cbs[PLUGIN_CB_COND],
+                      checks, begin_op, op_ok);
 }
 
 static void plugin_gen_insn_udata(const struct qemu_plugin_tb *ptb,
@@ -606,11 +860,32 @@ static void plugin_gen_insn_udata(const struct qemu_plugin_tb *ptb,
 }
 
 static void plugin_gen_insn_inline(const struct qemu_plugin_tb *ptb,
-                                   TCGOp *begin_op, int insn_idx)
+                                   TCGOp *begin_op, int insn_idx,
+                                   const GArray *ring_counts)
 {
     struct qemu_plugin_insn *insn = g_ptr_array_index(ptb->insns, insn_idx);
-    inject_inline_cb(insn->cbs[PLUGIN_CB_INSN][PLUGIN_CB_INLINE],
-                     begin_op, op_ok);
+    GArray *rings = insn->cbs[PLUGIN_CB_MEM][PLUGIN_CB_RING];
+    g_autoptr(GArray) checks = NULL;
+    int i;
+
+    /* rings that the TB as a whole would overflow are checked here */
+    for (i = 0; ring_counts && i < rings->len; i++) {
+        struct qemu_plugin_dyn_cb *cb =
+            &g_array_index(rings, struct qemu_plugin_dyn_cb, i);
+        struct qemu_plugin_mem_ring *ring = cb->userp;
+
+        if (cb->ring.n_accesses &&
+            ring_count_get(ring_counts, ring) > ring->n_records) {
+            if (!checks) {
+                checks = g_array_new(false, false,
+                                     sizeof(struct plugin_ring_count));
+            }
+            ring_count_add(checks, ring, cb->ring.n_accesses);
+        }
+    }
+    plugin_gen_inline(insn->cbs[PLUGIN_CB_INSN][PLUGIN_CB_INLINE],
+                      insn->cbs[PLUGIN_CB_INSN][PLUGIN_CB_COND],
+                      checks, begin_op, op_ok);
 }
 
 static void plugin_gen_mem_regular(const struct qemu_plugin_tb *ptb,
@@ -626,8 +901,25 @@ static void plugin_gen_mem_inline(const struct qemu_plugin_tb *ptb,
     const GArray *cbs;
     struct qemu_plugin_insn *insn = g_ptr_array_index(ptb->insns, insn_idx);
 
+    cbs = insn->cbs[PLUGIN_CB_MEM][PLUGIN_CB_RING];
+    if (cbs->len) {
+        TCGv_i64 addr = temp_tcgv_i64(arg_temp(begin_op->args[4]));
+        int i;
+
+        tcg_ctx->emit_before_op = begin_op;
+        for (i = 0; i < cbs->len; i++) {
+            struct qemu_plugin_dyn_cb *cb =
+                &g_array_index(cbs, struct qemu_plugin_dyn_cb, i);
+
+            if (ring_ok(begin_op, cb)) {
+                gen_mem_ring_append(cb, addr, begin_op->args[3]);
+            }
+        }
+        tcg_ctx->emit_before_op = NULL;
+    }
+
     cbs = insn->cbs[PLUGIN_CB_MEM][PLUGIN_CB_INLINE];
-    inject_inline_cb(cbs, begin_op, op_rw);
+    plugin_gen_inline(cbs, NULL, NULL, begin_op, op_rw);
 }
 
 static void plugin_gen_enable_mem_helper(struct qemu_plugin_tb *ptb,
@@ -700,11 +992,14 @@ static void pr_ops(void)
 
 static void plugin_gen_inject(struct qemu_plugin_tb *plugin_tb)
 {
+    g_autoptr(GArray) ring_counts = NULL;
     TCGOp *op;
     int insn_idx = -1;
 
     pr_ops();
 
+    ring_counts = plugin_gen_count_ring_accesses(plugin_tb);
+
     QTAILQ_FOREACH(op, &tcg_ctx->ops, link) {
         switch (op->opc) {
         case INDEX_op_insn_start:
@@ -725,7 +1020,7 @@ static void plugin_gen_inject(struct qemu_plugin_tb *plugin_tb)
                     plugin_gen_tb_udata(plugin_tb, op);
                     break;
                 case PLUGIN_GEN_CB_INLINE:
-                    plugin_gen_tb_inline(plugin_tb, op);
+                    plugin_gen_tb_inline(plugin_tb, op, ring_counts);
                     break;
                 default:
                     g_assert_not_reached();
@@ -741,7 +1036,8 @@ static void plugin_gen_inject(struct qemu_plugin_tb *plugin_tb)
                     plugin_gen_insn_udata(plugin_tb, op, insn_idx);
                     break;
                 case PLUGIN_GEN_CB_INLINE:
-                    plugin_gen_insn_inline(plugin_tb, op, insn_idx);
+                    plugin_gen_insn_inline(plugin_tb, op, insn_idx,
+                                           ring_counts);
                     break;
                 case PLUGIN_GEN_ENABLE_MEM_HELPER:
                     plugin_gen_enable_mem_helper(plugin_tb, op, insn_idx);
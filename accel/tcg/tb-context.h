@@ -35,6 +35,9 @@ struct TBContext {
     /* statistics */
     unsigned tb_flush_count;
     unsigned tb_phys_invalidate_count;
+    unsigned tb_region_evict_count;
+    unsigned atomic_exclusive_count;
+    unsigned smc_hot_count;
 };
 
 extern TBContext tb_ctx;
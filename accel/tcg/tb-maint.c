@@ -30,6 +30,7 @@
 #include "tb-hash.h"
 #include "tb-context.h"
 #include "internal.h"
+#include "trace.h"
 
 
 /* List iterators for lists of tagged pointers in TranslationBlock. */
@@ -181,8 +182,45 @@ struct PageDesc {
     QemuSpin lock;
     /* list of TBs intersecting this ram page */
     uintptr_t first_tb;
+    /* superset of the TB_CODE_GRANULE_BITS granules holding code */
+    uint64_t code_bitmap;
+    /* guest writes that invalidated code, saturating at TB_SMC_HOT */
+    unsigned int smc_count;
 };
 
+/* The code bitmap splits each page into 64 granules */
+#define TB_CODE_GRANULE_BITS  (TARGET_PAGE_BITS - 6)
+
+/*
+ * Once this many guest writes have invalidated code on a page, code and
+ * data are assumed to share it and its TBs are kept to one instruction,
+ * so that each write throws away as little translated code as possible.
+ */
+#define TB_SMC_HOT  64
+
+static uint64_t tb_code_granules(tb_page_addr_t start, tb_page_addr_t last)
+{
+    unsigned first = (start & ~TARGET_PAGE_MASK) >> TB_CODE_GRANULE_BITS;
+    unsigned end = (last & ~TARGET_PAGE_MASK) >> TB_CODE_GRANULE_BITS;
+
+    return MAKE_64BIT_MASK(first, end - first + 1);
+}
+
+/* Return in @start and @last the bytes of page @n covered by @tb */
+static void tb_page_range(const TranslationBlock *tb, unsigned int n,
+                          tb_page_addr_t *start, tb_page_addr_t *last)
+{
+    /* NOTE: this is subtle as a TB may span two physical pages */
+    *start = tb_page_addr0(tb);
+    *last = *start + tb->size - 1;
+    if (n == 0) {
+        *last = MIN(*last, *start | ~TARGET_PAGE_MASK);
+    } else {
+        *start = tb_page_addr1(tb);
+        *last = *start + (*last & ~TARGET_PAGE_MASK);
+    }
+}
+
 void page_table_config_init(void)
 {
     uint32_t v_l1_bits;
@@ -663,6 +701,8 @@ static void tb_remove_all_1(int level, void **lp)
         for (i = 0; i < V_L2_SIZE; ++i) {
             page_lock(&pd[i]);
             pd[i].first_tb = (uintptr_t)NULL;
+            pd[i].code_bitmap = 0;
+            qatomic_set(&pd[i].smc_count, 0);
             page_unlock(&pd[i]);
         }
     } else {
@@ -690,12 +730,19 @@ static void tb_remove_all(void)
 static void tb_page_add(PageDesc *p, TranslationBlock *tb, unsigned int n)
 {
     bool page_already_protected;
+    tb_page_addr_t start, last;
+    uint64_t granules;
 
     assert_page_locked(p);
 
+    tb_page_range(tb, n, &start, &last);
+    granules = tb_code_granules(start, last);
+
     tb->page_next[n] = p->first_tb;
     page_already_protected = p->first_tb != 0;
     p->first_tb = (uintptr_t)tb | n;
+    p->code_bitmap = page_already_protected ? p->code_bitmap | granules
+                                            : granules;
 
     /*
      * If some code is already present, then the pages are already
@@ -798,6 +845,35 @@ void tb_flush(CPUState *cpu)
     }
 }
 
+/*
+ * Evict the oldest full region of the code buffer when it runs low on
+ * free regions, so that the buffer does not fill up and need a global
+ * tb_flush(): its TBs are invalidated, which unlinks them from the other
+ * TBs and the jump caches, and the region is reused once no vCPU can be
+ * executing them anymore.  Unlike tb_flush(), this does not stop the
+ * other vCPUs.
+ */
+void tb_evict_region(void)
+{
+    unsigned int generation;
+    GPtrArray *tbs;
+    size_t idx, i;
+
+    if (!tcg_region_evict_begin(&idx, &generation)) {
+        return;
+    }
+
+    tbs = tcg_region_tbs(idx);
+    for (i = 0; i < tbs->len; i++) {
+        tb_phys_invalidate(g_ptr_array_index(tbs, i), -1);
+    }
+    trace_tb_evict_region(idx, tbs->len);
+    g_ptr_array_free(tbs, true);
+
+    tcg_region_evict_end(idx, generation);
+    qatomic_inc(&tb_ctx.tb_region_evict_count);
+}
+
 /* remove @orig from its @n_orig-th jump list */
 static inline void tb_remove_from_jmp_list(TranslationBlock *orig, int n_orig)
 {
@@ -1101,14 +1177,24 @@ tb_invalidate_phys_page_range__locked(struct page_collection *pages,
 {
     TranslationBlock *tb;
     PageForEachNext n;
+    bool invalidated = false;
 #ifdef TARGET_HAS_PRECISE_SMC
     bool current_tb_modified = false;
-    TranslationBlock *current_tb = retaddr ? tcg_tb_lookup(retaddr) : NULL;
+    TranslationBlock *current_tb;
 #endif /* TARGET_HAS_PRECISE_SMC */
 
     /* Range may not cross a page. */
     tcg_debug_assert(((start ^ last) & TARGET_PAGE_MASK) == 0);
 
+    /* Data that merely shares a page with code needs no TB walk. */
+    if (p->first_tb && !(p->code_bitmap & tb_code_granules(start, last))) {
+        return;
+    }
+
+#ifdef TARGET_HAS_PRECISE_SMC
+    current_tb = retaddr ? tcg_tb_lookup(retaddr) : NULL;
+#endif
+
     /*
      * We remove all the TBs in the range [start, last].
      * XXX: see if in some cases it could be faster to invalidate all the code
@@ -1116,15 +1202,7 @@ tb_invalidate_phys_page_range__locked(struct page_collection *pages,
     PAGE_FOR_EACH_TB(start, last, p, tb, n) {
         tb_page_addr_t tb_start, tb_last;
 
-        /* NOTE: this is subtle as a TB may span two physical pages */
-        tb_start = tb_page_addr0(tb);
-        tb_last = tb_start + tb->size - 1;
-        if (n == 0) {
-            tb_last = MIN(tb_last, tb_start | ~TARGET_PAGE_MASK);
-        } else {
-            tb_start = tb_page_addr1(tb);
-            tb_last = tb_start + (tb_last & ~TARGET_PAGE_MASK);
-        }
+        tb_page_range(tb, n, &tb_start, &tb_last);
         if (!(tb_last < start || tb_start > last)) {
 #ifdef TARGET_HAS_PRECISE_SMC
             if (current_tb == tb &&
@@ -1141,11 +1219,20 @@ tb_invalidate_phys_page_range__locked(struct page_collection *pages,
             }
 #endif /* TARGET_HAS_PRECISE_SMC */
             tb_phys_invalidate__locked(tb);
+            invalidated = true;
+        }
+    }
+
+    if (invalidated && retaddr && p->smc_count < TB_SMC_HOT) {
+        qatomic_set(&p->smc_count, p->smc_count + 1);
+        if (p->smc_count == TB_SMC_HOT) {
+            qatomic_inc(&tb_ctx.smc_hot_count);
         }
     }
 
     /* if no code remaining, no need to continue to use slow writes */
     if (!p->first_tb) {
+        p->code_bitmap = 0;
         tlb_unprotect_code(start);
     }
 
@@ -1160,6 +1247,13 @@ tb_invalidate_phys_page_range__locked(struct page_collection *pages,
 #endif
 }
 
+bool tb_page_smc_hot(tb_page_addr_t addr)
+{
+    PageDesc *p = page_find(addr >> TARGET_PAGE_BITS);
+
+    return p && qatomic_read(&p->smc_count) >= TB_SMC_HOT;
+}
+
 /*
  * Invalidate all TBs which intersect with the target physical
  * address page @addr.
@@ -28,7 +28,9 @@
 #include "sysemu/cpu-timers.h"
 #include "qemu/main-loop.h"
 #include "qemu/guest-random.h"
+#include "qemu/rcu.h"
 #include "exec/exec-all.h"
+#include "sysemu/cpus.h"
 
 #include "tcg-accel-ops.h"
 #include "tcg-accel-ops-icount.h"
@@ -147,6 +149,132 @@ void icount_process_data(CPUState *cpu)
     replay_mutex_unlock();
 }
 
+/*
+ * With multi-threaded TCG, every vCPU counts its own instructions in
+ * icount_local and may run ahead of QEMU_CLOCK_VIRTUAL by up to one
+ * quantum.  Once all the vCPUs that are not idle have reached the end
+ * of the quantum, the last one to get there moves the clock forward and
+ * runs the expired timers before letting the others go.
+ */
+static struct {
+    QemuMutex lock;
+    QemuCond cond;
+    int64_t end;        /* instruction count at the end of the quantum */
+    bool advancing;     /* a vCPU is moving the clock to @end */
+} icount_quantum;
+
+void icount_quantum_init(void)
+{
+    qemu_mutex_init(&icount_quantum.lock);
+    qemu_cond_init(&icount_quantum.cond);
+}
+
+/*
+ * The next quantum ends early if a timer expires in between, so that
+ * timers always run at the same instruction count.
+ */
+static int64_t icount_quantum_length(void)
+{
+    int64_t deadline = qemu_clock_deadline_ns_all(QEMU_CLOCK_VIRTUAL,
+                                                  QEMU_TIMER_ATTR_ALL);
+    int64_t length = icount_get_quantum();
+
+    if (deadline >= 0) {
+        length = MIN(length, icount_round(deadline));
+    }
+    return MAX(length, 1);
+}
+
+/* Called with icount_quantum.lock held */
+static bool icount_quantum_done(void)
+{
+    CPUState *cpu;
+
+    if (icount_quantum.advancing) {
+        return false;
+    }
+
+    RCU_READ_LOCK_GUARD();
+    CPU_FOREACH(cpu) {
+        if (qatomic_read_i64(&cpu->icount_local) < icount_quantum.end &&
+            !cpu_thread_is_idle(cpu)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * Called with icount_quantum.lock held, which is dropped while taking
+ * the iothread lock to run the timers.
+ */
+static void icount_quantum_advance(void)
+{
+    int64_t now, length;
+
+    icount_quantum.advancing = true;
+    qemu_mutex_unlock(&icount_quantum.lock);
+
+    qemu_mutex_lock_iothread();
+    now = icount_advance_to(icount_quantum.end);
+    icount_notify_aio_contexts();
+    length = icount_quantum_length();
+    qemu_mutex_unlock_iothread();
+
+    qemu_mutex_lock(&icount_quantum.lock);
+    icount_quantum.end = now + length;
+    icount_quantum.advancing = false;
+    qemu_cond_broadcast(&icount_quantum.cond);
+}
+
+bool icount_quantum_prepare_for_run(CPUState *cpu)
+{
+    int insns_left;
+
+    g_assert(cpu_neg(cpu)->icount_decr.u16.low == 0);
+    g_assert(cpu->icount_extra == 0);
+
+    /* Catch up with the clock if the vCPU was idle */
+    qatomic_set_i64(&cpu->icount_local, icount_get_raw());
+
+    qemu_mutex_lock(&icount_quantum.lock);
+    while (cpu->icount_local >= icount_quantum.end) {
+        if (icount_quantum_done()) {
+            icount_quantum_advance();
+        } else if (qatomic_read(&cpu->exit_request)) {
+            qemu_mutex_unlock(&icount_quantum.lock);
+            return false;
+        } else {
+            qemu_cond_wait(&icount_quantum.cond, &icount_quantum.lock);
+        }
+    }
+    cpu->icount_budget = icount_quantum.end - cpu->icount_local;
+    qemu_mutex_unlock(&icount_quantum.lock);
+
+    insns_left = MIN(0xffff, cpu->icount_budget);
+    cpu_neg(cpu)->icount_decr.u16.low = insns_left;
+    cpu->icount_extra = cpu->icount_budget - insns_left;
+    return true;
+}
+
+void icount_quantum_process_data(CPUState *cpu)
+{
+    /* Account for executed instructions */
+    icount_update(cpu);
+
+    /* Reset the counters */
+    cpu_neg(cpu)->icount_decr.u16.low = 0;
+    cpu->icount_extra = 0;
+    cpu->icount_budget = 0;
+}
+
+void icount_quantum_kick(void)
+{
+    qemu_mutex_lock(&icount_quantum.lock);
+    qemu_cond_broadcast(&icount_quantum.cond);
+    qemu_mutex_unlock(&icount_quantum.lock);
+}
+
 void icount_handle_interrupt(CPUState *cpu, int mask)
 {
     int old_mask = cpu->interrupt_request;
@@ -15,6 +15,17 @@ void icount_prepare_for_run(CPUState *cpu, int64_t cpu_budget);
 int64_t icount_percpu_budget(int cpu_count);
 void icount_process_data(CPUState *cpu);
 
+/* Multi-threaded icount, see icount_quantum in tcg-accel-ops-icount.c */
+void icount_quantum_init(void);
+/*
+ * Give @cpu the rest of the current quantum, first waiting for the other
+ * vCPUs if it has used it up.  Returns false if kicked while waiting.
+ */
+bool icount_quantum_prepare_for_run(CPUState *cpu);
+void icount_quantum_process_data(CPUState *cpu);
+/* Wake up vCPUs waiting for the end of the quantum */
+void icount_quantum_kick(void);
+
 void icount_handle_interrupt(CPUState *cpu, int mask);
 
 #endif /* TCG_ACCEL_OPS_ICOUNT_H */
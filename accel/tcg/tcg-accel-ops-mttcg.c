@@ -35,6 +35,7 @@
 #include "tcg/tcg.h"
 #include "tcg-accel-ops.h"
 #include "tcg-accel-ops-mttcg.h"
+#include "tcg-accel-ops-icount.h"
 
 typedef struct MttcgForceRcuNotifier {
     Notifier notifier;
@@ -68,7 +69,7 @@ static void *mttcg_cpu_thread_fn(void *arg)
     CPUState *cpu = arg;
 
     assert(tcg_enabled());
-    g_assert(!icount_enabled());
+    g_assert(!icount_enabled() || icount_get_quantum());
 
     rcu_register_thread();
     force_rcu.notifier.notify = mttcg_force_rcu;
@@ -92,7 +93,14 @@ static void *mttcg_cpu_thread_fn(void *arg)
         if (cpu_can_run(cpu)) {
             int r;
             qemu_mutex_unlock_iothread();
-            r = tcg_cpus_exec(cpu);
+            if (!icount_enabled()) {
+                r = tcg_cpus_exec(cpu);
+            } else if (icount_quantum_prepare_for_run(cpu)) {
+                r = tcg_cpus_exec(cpu);
+                icount_quantum_process_data(cpu);
+            } else {
+                r = EXCP_INTERRUPT;
+            }
             qemu_mutex_lock_iothread();
             switch (r) {
             case EXCP_DEBUG:
@@ -120,6 +128,10 @@ static void *mttcg_cpu_thread_fn(void *arg)
         }
 
         qatomic_set_mb(&cpu->exit_request, 0);
+        if (icount_enabled()) {
+            /* This vCPU may be idle now, don't hold up the quantum */
+            icount_quantum_kick();
+        }
         qemu_wait_io_event(cpu);
     } while (!cpu->unplug || cpu_can_run(cpu));
 
@@ -133,6 +145,10 @@ static void *mttcg_cpu_thread_fn(void *arg)
 void mttcg_kick_vcpu_thread(CPUState *cpu)
 {
     cpu_exit(cpu);
+    if (icount_enabled()) {
+        /* It may be waiting for the other vCPUs to end the quantum */
+        icount_quantum_kick();
+    }
 }
 
 void mttcg_start_vcpu_thread(CPUState *cpu)
@@ -45,6 +45,8 @@ struct TCGState {
 
     bool mttcg_enabled;
     bool one_insn_per_tb;
+    bool tb_profile;
+    bool atomic_stripes;
     int splitwx_enabled;
     unsigned long tb_size;
 };
@@ -70,7 +72,7 @@ DECLARE_INSTANCE_CHECKER(TCGState, TCG_STATE,
 
 static bool default_mttcg_enabled(void)
 {
-    if (icount_enabled() || TCG_OVERSIZED_GUEST) {
+    if ((icount_enabled() && !icount_get_quantum()) || TCG_OVERSIZED_GUEST) {
         return false;
     }
 #ifdef TARGET_SUPPORTS_MTTCG
@@ -99,6 +101,7 @@ static void tcg_accel_instance_init(Object *obj)
 
 bool mttcg_enabled;
 bool one_insn_per_tb;
+bool tcg_tb_profile;
 
 static int tcg_init_machine(MachineState *ms)
 {
@@ -111,6 +114,11 @@ static int tcg_init_machine(MachineState *ms)
 
     tcg_allowed = true;
     mttcg_enabled = s->mttcg_enabled;
+    if (icount_get_quantum() && !mttcg_enabled) {
+        warn_report("icount quantum has no effect with single-threaded TCG");
+    }
+    tcg_tb_profile = s->tb_profile;
+    tcg_atomic_stripes = s->atomic_stripes;
 
     page_init();
     tb_htable_init();
@@ -141,8 +149,8 @@ static void tcg_set_thread(Object *obj, const char *value, Error **errp)
     if (strcmp(value, "multi") == 0) {
         if (TCG_OVERSIZED_GUEST) {
             error_setg(errp, "No MTTCG when guest word size > hosts");
-        } else if (icount_enabled()) {
-            error_setg(errp, "No MTTCG when icount is enabled");
+        } else if (icount_enabled() && !icount_get_quantum()) {
+            error_setg(errp, "No MTTCG when icount is enabled without quantum");
         } else {
 #ifndef TARGET_SUPPORTS_MTTCG
             warn_report("Guest not yet converted to MTTCG - "
@@ -207,6 +215,30 @@ static void tcg_set_one_insn_per_tb(Object *obj, bool value, Error **errp)
     qatomic_set(&one_insn_per_tb, value);
 }
 
+static bool tcg_get_tb_profile(Object *obj, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    return s->tb_profile;
+}
+
+static void tcg_set_tb_profile(Object *obj, bool value, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    s->tb_profile = value;
+}
+
+static bool tcg_get_atomic_stripes(Object *obj, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    return s->atomic_stripes;
+}
+
+static void tcg_set_atomic_stripes(Object *obj, bool value, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    s->atomic_stripes = value;
+}
+
 static int tcg_gdbstub_supported_sstep_flags(void)
 {
     /*
@@ -250,6 +282,19 @@ static void tcg_accel_class_init(ObjectClass *oc, void *data)
                                    tcg_set_one_insn_per_tb);
     object_class_property_set_description(oc, "one-insn-per-tb",
         "Only put one guest insn in each translation block");
+
+    object_class_property_add_bool(oc, "x-tb-profile",
+                                   tcg_get_tb_profile,
+                                   tcg_set_tb_profile);
+    object_class_property_set_description(oc, "x-tb-profile",
+        "Count executions and TLB fills of each translation block");
+
+    object_class_property_add_bool(oc, "atomic-stripes",
+                                   tcg_get_atomic_stripes,
+                                   tcg_set_atomic_stripes);
+    object_class_property_set_description(oc, "atomic-stripes",
+        "Emulate atomics the host lacks with per-cache-line locks "
+        "instead of stopping all vCPUs");
 }
 
 static const TypeInfo tcg_accel_type = {
@@ -314,6 +314,9 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
 
  buffer_overflow:
     assert_no_pages_locked();
+    if (unlikely(tcg_region_evict_needed())) {
+        tb_evict_region();
+    }
     tb = tcg_tb_alloc(tcg_ctx);
     if (unlikely(!tb)) {
         /* flush must be done */
@@ -332,10 +335,16 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     tb->cs_base = cs_base;
     tb->flags = flags;
     tb->cflags = cflags;
+    tb->exec_count = 0;
+    tb->tlb_fill_count = 0;
     tb_set_page_addr0(tb, phys_pc);
     tb_set_page_addr1(tb, -1);
     if (phys_pc != -1) {
         tb_lock_page0(phys_pc);
+        /* Code mixed with hot data: translate one insn at a time. */
+        if (tb_page_smc_hot(phys_pc)) {
+            max_insns = 1;
+        }
     }
 
     tcg_ctx->gen_tb = tb;
@@ -765,14 +774,100 @@ void dump_exec_info(GString *buf)
                            qatomic_read(&tb_ctx.tb_flush_count));
     g_string_append_printf(buf, "TB invalidate count %u\n",
                            qatomic_read(&tb_ctx.tb_phys_invalidate_count));
+    g_string_append_printf(buf, "TB region evictions %u\n",
+                           qatomic_read(&tb_ctx.tb_region_evict_count));
+    g_string_append_printf(buf, "atomic exclusive    %u\n",
+                           qatomic_read(&tb_ctx.atomic_exclusive_count));
+    g_string_append_printf(buf, "atomic striped      %zu\n",
+                           atomic_stripe_count());
+    g_string_append_printf(buf, "SMC hot pages       %u\n",
+                           qatomic_read(&tb_ctx.smc_hot_count));
 
     tlb_flush_counts(&flush_full, &flush_part, &flush_elide);
     g_string_append_printf(buf, "TLB full flushes    %zu\n", flush_full);
     g_string_append_printf(buf, "TLB partial flushes %zu\n", flush_part);
     g_string_append_printf(buf, "TLB elided flushes  %zu\n", flush_elide);
+    for (int mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
+        size_t vtlb_hit, vtlb_miss, flush;
+
+        tlb_mmu_idx_counts(mmu_idx, &vtlb_hit, &vtlb_miss, &flush);
+        if (vtlb_hit || vtlb_miss || flush) {
+            g_string_append_printf(buf, "TLB mmu_idx %-2d      "
+                                   "victim hits %zu, misses %zu, "
+                                   "flushes %zu\n",
+                                   mmu_idx, vtlb_hit, vtlb_miss, flush);
+        }
+    }
     tcg_dump_info(buf);
 }
 
+#define TB_PROFILE_TOP 32
+
+static gboolean tb_profile_iter(gpointer key, gpointer value, gpointer data)
+{
+    TranslationBlock *tb = value;
+    GPtrArray *tbs = data;
+
+    if (tb->exec_count) {
+        g_ptr_array_add(tbs, tb);
+    }
+    return false;
+}
+
+static gint tb_profile_cmp(gconstpointer a, gconstpointer b)
+{
+    const TranslationBlock *tb_a = *(TranslationBlock * const *)a;
+    const TranslationBlock *tb_b = *(TranslationBlock * const *)b;
+
+    return tb_a->exec_count < tb_b->exec_count ? 1 :
+           tb_a->exec_count > tb_b->exec_count ? -1 : 0;
+}
+
+void dump_tb_profile(GString *buf)
+{
+    g_autoptr(GPtrArray) tbs = g_ptr_array_new();
+    uint64_t total = 0;
+    guint i;
+
+    if (!tcg_tb_profile) {
+        g_string_append_printf(buf, "TB profiling is disabled, "
+                               "use -accel tcg,x-tb-profile=on\n");
+        return;
+    }
+
+    /*
+     * The counters are updated by the vCPUs while we read them,
+     * so this is only a snapshot.
+     */
+    tcg_tb_foreach(tb_profile_iter, tbs);
+    g_ptr_array_sort(tbs, tb_profile_cmp);
+    for (i = 0; i < tbs->len; i++) {
+        total += ((TranslationBlock *)g_ptr_array_index(tbs, i))->exec_count;
+    }
+
+    g_string_append_printf(buf, "%u TBs executed, %" PRIu64 " executions, "
+                           "top %u:\n", tbs->len, total,
+                           MIN(tbs->len, TB_PROFILE_TOP));
+    g_string_append_printf(buf, "%-18s %8s %8s %14s %6s %12s\n",
+                           "guest pc", "guest sz", "host sz", "exec count",
+                           "%", "tlb fills");
+    for (i = 0; i < tbs->len && i < TB_PROFILE_TOP; i++) {
+        TranslationBlock *tb = g_ptr_array_index(tbs, i);
+
+        if (tb_cflags(tb) & CF_PCREL) {
+            g_string_append_printf(buf, "phys 0x%-12" PRIx64,
+                                   (uint64_t)tb_page_addr0(tb));
+        } else {
+            g_string_append_printf(buf, "0x%-16" VADDR_PRIx, tb->pc);
+        }
+        g_string_append_printf(buf, " %8u %8u %14" PRIu64 " %5.1f%% %12"
+                               PRIu64 "\n", tb->size, tb->tc.size,
+                               tb->exec_count,
+                               (double)tb->exec_count * 100 / total,
+                               tb->tlb_fill_count);
+    }
+}
+
 #else /* CONFIG_USER_ONLY */
 
 void cpu_interrupt(CPUState *cpu, int mask)
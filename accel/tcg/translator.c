@@ -47,7 +47,7 @@ bool translator_io_start(DisasContextBase *db)
     return true;
 }
 
-static TCGOp *gen_tb_start(uint32_t cflags)
+static TCGOp *gen_tb_start(const TranslationBlock *tb, uint32_t cflags)
 {
     TCGv_i32 count = tcg_temp_new_i32();
     TCGOp *icount_start_insn = NULL;
@@ -80,6 +80,15 @@ static TCGOp *gen_tb_start(uint32_t cflags)
         tcg_gen_brcondi_i32(TCG_COND_LT, count, 0, tcg_ctx->exitreq_label);
     }
 
+    if (tcg_tb_profile) {
+        TCGv_ptr ptr = tcg_constant_ptr(&tb->exec_count);
+        TCGv_i64 exec_count = tcg_temp_new_i64();
+
+        tcg_gen_ld_i64(exec_count, ptr, 0);
+        tcg_gen_addi_i64(exec_count, exec_count, 1);
+        tcg_gen_st_i64(exec_count, ptr, 0);
+    }
+
     if (cflags & CF_USE_ICOUNT) {
         tcg_gen_st16_i32(count, cpu_env,
                          offsetof(ArchCPU, neg.icount_decr.u16.low) -
@@ -151,7 +160,7 @@ void translator_loop(CPUState *cpu, TranslationBlock *tb, int *max_insns,
     tcg_debug_assert(db->is_jmp == DISAS_NEXT);  /* no early exit */
 
     /* Start translating.  */
-    icount_start_insn = gen_tb_start(cflags);
+    icount_start_insn = gen_tb_start(tb, cflags);
     ops->tb_start(db, cpu);
     tcg_debug_assert(db->is_jmp == DISAS_NEXT);  /* no early exit */
 
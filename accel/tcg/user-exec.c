@@ -144,6 +144,39 @@ typedef struct PageFlagsNode {
 
 static IntervalTreeRoot pageflags_root;
 
+/*
+ * With the exclusive mmap_lock held, nobody else modifies pageflags_root
+ * or targetdata_root.  Threads holding disjoint ranges of the address
+ * space with the mmap range lock may do so concurrently, however, and
+ * they serialize on pageflags_mutex.  They use it for lookups as well,
+ * since lockless lookups have false negatives.
+ */
+static QemuMutex pageflags_mutex;
+
+static void __attribute__((constructor)) pageflags_mutex_init(void)
+{
+    qemu_mutex_init(&pageflags_mutex);
+}
+
+static bool pageflags_lock(void)
+{
+    if (have_mmap_range_lock()) {
+        qemu_mutex_lock(&pageflags_mutex);
+        return true;
+    }
+    return false;
+}
+
+static void pageflags_unlock(bool locked)
+{
+    if (locked) {
+        qemu_mutex_unlock(&pageflags_mutex);
+    }
+}
+
+#define assert_pageflags_lock() \
+    tcg_debug_assert(have_mmap_lock() || have_mmap_range_lock())
+
 static PageFlagsNode *pageflags_find(target_ulong start, target_ulong last)
 {
     IntervalTreeNode *n;
@@ -207,7 +240,17 @@ void page_dump(FILE *f)
 
 int page_get_flags(target_ulong address)
 {
-    PageFlagsNode *p = pageflags_find(address, address);
+    PageFlagsNode *p;
+    int flags;
+
+    if (pageflags_lock()) {
+        p = pageflags_find(address, address);
+        flags = p ? p->flags : 0;
+        pageflags_unlock(true);
+        return flags;
+    }
+
+    p = pageflags_find(address, address);
 
     /*
      * See util/interval-tree.c re lockless lookups: no false positives but
@@ -478,12 +521,14 @@ static bool pageflags_set_clear(target_ulong start, target_ulong last,
 /*
  * Modify the flags of a page and invalidate the code if necessary.
  * The flag PAGE_WRITE_ORG is positioned automatically depending
- * on PAGE_WRITE.  The mmap_lock should already be held.
+ * on PAGE_WRITE.  The mmap_lock should already be held, either exclusively
+ * or for a range covering [start, last].
  */
 void page_set_flags(target_ulong start, target_ulong last, int flags)
 {
     bool reset = false;
     bool inval_tb = false;
+    bool locked;
 
     /* This function should never be called with addresses outside the
        guest address space.  If this assert fires, it probably indicates
@@ -492,7 +537,7 @@ void page_set_flags(target_ulong start, target_ulong last, int flags)
     assert(last <= GUEST_ADDR_MAX);
     /* Only set PAGE_ANON with new mappings. */
     assert(!(flags & PAGE_ANON) || (flags & PAGE_RESET));
-    assert_memory_lock();
+    assert_pageflags_lock();
 
     start &= TARGET_PAGE_MASK;
     last |= ~TARGET_PAGE_MASK;
@@ -509,12 +554,21 @@ void page_set_flags(target_ulong start, target_ulong last, int flags)
 
     if (!flags || reset) {
         page_reset_target_data(start, last);
+    }
+    locked = pageflags_lock();
+    if (!flags || reset) {
         inval_tb |= pageflags_unset(start, last);
     }
     if (flags) {
         inval_tb |= pageflags_set_clear(start, last, flags,
                                         ~(reset ? 0 : PAGE_STICKY));
     }
+    pageflags_unlock(locked);
+
+    /*
+     * Range holders leave executable pages alone, as they could not
+     * invalidate the translations; see mmap_lock_range().
+     */
     if (inval_tb) {
         tb_invalidate_phys_range(start, last);
     }
@@ -524,6 +578,7 @@ bool page_check_range(target_ulong start, target_ulong len, int flags)
 {
     target_ulong last;
     int locked;  /* tri-state: =0: unlocked, +1: global, -1: local */
+    bool range_locked;
     bool ret;
 
     if (len == 0) {
@@ -536,6 +591,12 @@ bool page_check_range(target_ulong start, target_ulong len, int flags)
     }
 
     locked = have_mmap_lock();
+    range_locked = pageflags_lock();
+    if (range_locked) {
+        /* page_unprotect() needs the exclusive lock. */
+        tcg_debug_assert(!(flags & PAGE_WRITE));
+        locked = 1;
+    }
     while (true) {
         PageFlagsNode *p = pageflags_find(start, last);
         int missing;
@@ -595,14 +656,41 @@ bool page_check_range(target_ulong start, target_ulong len, int flags)
     if (locked < 0) {
         mmap_unlock();
     }
+    pageflags_unlock(range_locked);
     return ret;
 }
 
 bool page_check_range_empty(target_ulong start, target_ulong last)
 {
+    bool locked, ret;
+
     assert(last >= start);
-    assert_memory_lock();
-    return pageflags_find(start, last) == NULL;
+    assert_pageflags_lock();
+
+    locked = pageflags_lock();
+    ret = pageflags_find(start, last) == NULL;
+    pageflags_unlock(locked);
+    return ret;
+}
+
+bool page_check_range_any(target_ulong start, target_ulong last, int flags)
+{
+    PageFlagsNode *p;
+    bool locked, ret = false;
+
+    assert(last >= start);
+    assert_pageflags_lock();
+
+    locked = pageflags_lock();
+    for (p = pageflags_find(start, last); p;
+         p = pageflags_next(p, start, last)) {
+        if (p->flags & flags) {
+            ret = true;
+            break;
+        }
+    }
+    pageflags_unlock(locked);
+    return ret;
 }
 
 target_ulong page_find_range_empty(target_ulong min, target_ulong max,
@@ -869,8 +957,10 @@ static IntervalTreeRoot targetdata_root;
 void page_reset_target_data(target_ulong start, target_ulong last)
 {
     IntervalTreeNode *n, *next;
+    bool locked;
 
-    assert_memory_lock();
+    assert_pageflags_lock();
+    locked = pageflags_lock();
 
     start &= TARGET_PAGE_MASK;
     last |= ~TARGET_PAGE_MASK;
@@ -901,6 +991,8 @@ void page_reset_target_data(target_ulong start, target_ulong last)
 
         memset(t->data[p_ofs], 0, p_len * TARGET_PAGE_DATA_SIZE);
     }
+
+    pageflags_unlock(locked);
 }
 
 void *page_get_target_data(target_ulong address)
@@ -1408,6 +1500,8 @@ static void *atomic_mmu_lookup(CPUArchState *env, vaddr addr, MemOpIdx oi,
     return ret;
 }
 
+#define ATOMIC_MMU_CLEANUP do { clear_helper_retaddr(); } while (0)
+
 #include "atomic_common.c.inc"
 
 /*
@@ -1417,7 +1511,6 @@ static void *atomic_mmu_lookup(CPUArchState *env, vaddr addr, MemOpIdx oi,
 
 #define ATOMIC_NAME(X) \
     glue(glue(glue(cpu_atomic_ ## X, SUFFIX), END), _mmu)
-#define ATOMIC_MMU_CLEANUP do { clear_helper_retaddr(); } while (0)
 
 #define DATA_SIZE 1
 #include "atomic_template.h"
@@ -817,15 +817,59 @@ static int audio_is_timer_needed(AudioState *s)
     return 0;
 }
 
+static int64_t audio_quarter_buffer_ns(size_t samples, int freq)
+{
+    return muldiv64(samples, NANOSECONDS_PER_SECOND / 4, freq);
+}
+
+/*
+ * With timer-adaptive, wake up four times per buffer of the enabled voice
+ * with the shortest buffer instead of every timer-period.  timer-period
+ * remains the lower bound.
+ */
+static int64_t audio_timer_period(AudioState *s)
+{
+    HWVoiceIn *hwi = NULL;
+    HWVoiceOut *hwo = NULL;
+    int64_t period = INT64_MAX;
+
+    if (!s->dev->timer_adaptive) {
+        return s->period_ticks;
+    }
+
+    while ((hwo = audio_pcm_hw_find_any_enabled_out(s, hwo))) {
+        if (!hwo->poll_mode && hwo->info.freq) {
+            period = MIN(period, audio_quarter_buffer_ns(hwo->samples,
+                                                         hwo->info.freq));
+        }
+    }
+    while ((hwi = audio_pcm_hw_find_any_enabled_in(s, hwi))) {
+        if (!hwi->poll_mode && hwi->info.freq) {
+            period = MIN(period, audio_quarter_buffer_ns(hwi->samples,
+                                                         hwi->info.freq));
+        }
+    }
+    if (period == INT64_MAX) {
+        return s->period_ticks;
+    }
+    return MAX(period, s->period_ticks);
+}
+
 static void audio_reset_timer (AudioState *s)
 {
     if (audio_is_timer_needed(s)) {
+        int64_t period = audio_timer_period(s);
+
+        if (period != s->timer_period) {
+            trace_audio_timer_period(period / SCALE_US);
+            s->timer_period = period;
+        }
         timer_mod_anticipate_ns(s->ts,
-            qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + s->period_ticks);
+            qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + period);
         if (!s->timer_running) {
             s->timer_running = true;
             s->timer_last = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
-            trace_audio_timer_start(s->period_ticks / SCALE_MS);
+            trace_audio_timer_start(period / SCALE_MS);
         }
     } else {
         timer_del(s->ts);
@@ -843,7 +887,7 @@ static void audio_timer (void *opaque)
 
     now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
     diff = now - s->timer_last;
-    if (diff > s->period_ticks * 3 / 2) {
+    if (diff > s->timer_period * 3 / 2) {
         trace_audio_timer_delayed(diff / SCALE_MS);
     }
     s->timer_last = now;
@@ -1823,6 +1867,7 @@ static AudioState *audio_init(Audiodev *dev, const char *name)
     } else {
         s->period_ticks = dev->timer_period * (int64_t)SCALE_US;
     }
+    s->timer_period = s->period_ticks;
 
     e = qemu_add_vm_change_state_handler (audio_vm_change_state_handler, s);
     if (!e) {
@@ -231,6 +231,7 @@ typedef struct AudioState {
     int nb_hw_voices_in;
     int vm_running;
     int64_t period_ticks;
+    int64_t timer_period;   /* current period, see audio_timer_period() */
 
     bool timer_running;
     uint64_t timer_last;
@@ -286,23 +286,23 @@ static const float float_scale_reciprocal = 1.f / ((int64_t)INT32_MAX + 1);
 static void conv_natural_float_to_mono(struct st_sample *dst, const void *src,
                                        int samples)
 {
-    float *in = (float *)src;
+    const float *in = src;
+    int i;
 
-    while (samples--) {
-        dst->r = dst->l = CONV_NATURAL_FLOAT(*in++);
-        dst++;
+    for (i = 0; i < samples; i++) {
+        dst[i].r = dst[i].l = CONV_NATURAL_FLOAT(in[i]);
     }
 }
 
 static void conv_natural_float_to_stereo(struct st_sample *dst, const void *src,
                                          int samples)
 {
-    float *in = (float *)src;
+    const float *in = src;
+    int i;
 
-    while (samples--) {
-        dst->l = CONV_NATURAL_FLOAT(*in++);
-        dst->r = CONV_NATURAL_FLOAT(*in++);
-        dst++;
+    for (i = 0; i < samples; i++) {
+        dst[i].l = CONV_NATURAL_FLOAT(in[2 * i]);
+        dst[i].r = CONV_NATURAL_FLOAT(in[2 * i + 1]);
     }
 }
 
@@ -314,23 +314,23 @@ t_sample *mixeng_conv_float[2] = {
 static void clip_natural_float_from_mono(void *dst, const struct st_sample *src,
                                          int samples)
 {
-    float *out = (float *)dst;
+    float *out = dst;
+    int i;
 
-    while (samples--) {
-        *out++ = CLIP_NATURAL_FLOAT(src->l + src->r);
-        src++;
+    for (i = 0; i < samples; i++) {
+        out[i] = CLIP_NATURAL_FLOAT(src[i].l + src[i].r);
     }
 }
 
 static void clip_natural_float_from_stereo(
     void *dst, const struct st_sample *src, int samples)
 {
-    float *out = (float *)dst;
+    float *out = dst;
+    int i;
 
-    while (samples--) {
-        *out++ = CLIP_NATURAL_FLOAT(src->l);
-        *out++ = CLIP_NATURAL_FLOAT(src->r);
-        src++;
+    for (i = 0; i < samples; i++) {
+        out[2 * i] = CLIP_NATURAL_FLOAT(src[i].l);
+        out[2 * i + 1] = CLIP_NATURAL_FLOAT(src[i].r);
     }
 }
 
@@ -527,19 +527,25 @@ void mixeng_clear (struct st_sample *buf, int len)
 
 void mixeng_volume (struct st_sample *buf, int len, struct mixeng_volume *vol)
 {
+    int i;
+
     if (vol->mute) {
         mixeng_clear (buf, len);
         return;
     }
 
-    while (len--) {
+    /* Most voices play at full volume, which leaves the samples as is */
+    if (vol->l == nominal_volume.l && vol->r == nominal_volume.r) {
+        return;
+    }
+
+    for (i = 0; i < len; i++) {
 #ifdef FLOAT_MIXENG
-        buf->l = buf->l * vol->l;
-        buf->r = buf->r * vol->r;
+        buf[i].l = buf[i].l * vol->l;
+        buf[i].r = buf[i].r * vol->r;
 #else
-        buf->l = (buf->l * vol->l) >> 32;
-        buf->r = (buf->r * vol->r) >> 32;
+        buf[i].l = (buf[i].l * vol->l) >> 32;
+        buf[i].r = (buf[i].r * vol->r) >> 32;
 #endif
-        buf += 1;
     }
 }
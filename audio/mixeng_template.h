@@ -97,53 +97,54 @@ static inline IN_T glue (clip_, ET) (int64_t v)
 }
 #endif
 
+/*
+ * The loops below index both buffers with a counter instead of walking
+ * pointers, which lets the compiler vectorize them.
+ */
 static void glue (glue (conv_, ET), _to_stereo)
     (struct st_sample *dst, const void *src, int samples)
 {
-    struct st_sample *out = dst;
-    IN_T *in = (IN_T *) src;
+    const IN_T *in = src;
+    int i;
 
-    while (samples--) {
-        out->l = glue (conv_, ET) (*in++);
-        out->r = glue (conv_, ET) (*in++);
-        out += 1;
+    for (i = 0; i < samples; i++) {
+        dst[i].l = glue (conv_, ET) (in[2 * i]);
+        dst[i].r = glue (conv_, ET) (in[2 * i + 1]);
     }
 }
 
 static void glue (glue (conv_, ET), _to_mono)
     (struct st_sample *dst, const void *src, int samples)
 {
-    struct st_sample *out = dst;
-    IN_T *in = (IN_T *) src;
-
-    while (samples--) {
-        out->l = glue (conv_, ET) (in[0]);
-        out->r = out->l;
-        out += 1;
-        in += 1;
+    const IN_T *in = src;
+    int i;
+
+    for (i = 0; i < samples; i++) {
+        dst[i].l = glue (conv_, ET) (in[i]);
+        dst[i].r = dst[i].l;
     }
 }
 
 static void glue (glue (clip_, ET), _from_stereo)
     (void *dst, const struct st_sample *src, int samples)
 {
-    const struct st_sample *in = src;
-    IN_T *out = (IN_T *) dst;
-    while (samples--) {
-        *out++ = glue (clip_, ET) (in->l);
-        *out++ = glue (clip_, ET) (in->r);
-        in += 1;
+    IN_T *out = dst;
+    int i;
+
+    for (i = 0; i < samples; i++) {
+        out[2 * i] = glue (clip_, ET) (src[i].l);
+        out[2 * i + 1] = glue (clip_, ET) (src[i].r);
     }
 }
 
 static void glue (glue (clip_, ET), _from_mono)
     (void *dst, const struct st_sample *src, int samples)
 {
-    const struct st_sample *in = src;
-    IN_T *out = (IN_T *) dst;
-    while (samples--) {
-        *out++ = glue (clip_, ET) (in->l + in->r);
-        in += 1;
+    IN_T *out = dst;
+    int i;
+
+    for (i = 0; i < samples; i++) {
+        out[i] = glue (clip_, ET) (src[i].l + src[i].r);
     }
 }
 
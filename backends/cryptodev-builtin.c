@@ -27,6 +27,10 @@
 #include "standard-headers/linux/virtio_crypto.h"
 #include "crypto/cipher.h"
 #include "crypto/akcipher.h"
+#include "block/aio-wait.h"
+#include "block/thread-pool.h"
+#include "qemu/error-report.h"
+#include "qemu/main-loop.h"
 #include "qom/object.h"
 
 
@@ -44,6 +48,10 @@ typedef struct CryptoDevBackendBuiltinSession {
     uint8_t direction; /* encryption or decryption */
     uint8_t type; /* cipher? hash? aead? */
     QCryptoAkCipher *akcipher;
+    /* Serializes operations, cipher and akcipher objects keep state */
+    QemuMutex lock;
+    unsigned int in_flight;
+    bool closed; /* free once in_flight drops to zero */
     QTAILQ_ENTRY(CryptoDevBackendBuiltinSession) next;
 } CryptoDevBackendBuiltinSession;
 
@@ -53,12 +61,27 @@ typedef struct CryptoDevBackendBuiltinSession {
 #define CRYPTODEV_BUITLIN_MAX_AUTH_KEY_LEN    512
 #define CRYPTODEV_BUITLIN_MAX_CIPHER_KEY_LEN  64
 
+/*
+ * Symmetric operations shorter than this run in the request handler, where
+ * they cost less than a round trip through the thread pool.
+ */
+#define CRYPTODEV_BUILTIN_OFFLOAD_MIN_LEN     4096
+
 struct CryptoDevBackendBuiltin {
     CryptoDevBackend parent_obj;
 
     CryptoDevBackendBuiltinSession *sessions[MAX_NUM_SESSIONS];
+    unsigned int in_flight; /* operations submitted to the thread pool */
 };
 
+typedef struct CryptoDevBuiltinTask {
+    CryptoDevBackendBuiltin *builtin;
+    CryptoDevBackendBuiltinSession *sess;
+    CryptoDevBackendOpInfo *op_info;
+    int status;
+    Error *err;
+} CryptoDevBuiltinTask;
+
 static void cryptodev_builtin_init_akcipher(CryptoDevBackend *backend)
 {
     QCryptoAkCipherOptions opts;
@@ -75,21 +98,27 @@ static void cryptodev_builtin_init_akcipher(CryptoDevBackend *backend)
 static void cryptodev_builtin_init(
              CryptoDevBackend *backend, Error **errp)
 {
-    /* Only support one queue */
     int queues = backend->conf.peers.queues;
     CryptoDevBackendClient *cc;
+    int i;
 
-    if (queues != 1) {
-        error_setg(errp,
-                  "Only support one queue in cryptdov-builtin backend");
+    if (queues > MAX_CRYPTO_QUEUE_NUM) {
+        error_setg(errp, "The maximum number of queues is %d",
+                   MAX_CRYPTO_QUEUE_NUM);
         return;
     }
 
-    cc = cryptodev_backend_new_client();
-    cc->info_str = g_strdup_printf("cryptodev-builtin0");
-    cc->queue_index = 0;
-    cc->type = QCRYPTODEV_BACKEND_TYPE_BUILTIN;
-    backend->conf.peers.ccs[0] = cc;
+    /*
+     * Sessions are shared by all queues; operations from any of them run
+     * in parallel on the thread pool.
+     */
+    for (i = 0; i < queues; i++) {
+        cc = cryptodev_backend_new_client();
+        cc->info_str = g_strdup_printf("cryptodev-builtin%d", i);
+        cc->queue_index = i;
+        cc->type = QCRYPTODEV_BACKEND_TYPE_BUILTIN;
+        backend->conf.peers.ccs[i] = cc;
+    }
 
     backend->conf.crypto_services =
                          1u << QCRYPTODEV_BACKEND_SERVICE_CIPHER |
@@ -295,6 +324,7 @@ static int cryptodev_builtin_create_cipher_session(
     }
 
     sess = g_new0(CryptoDevBackendBuiltinSession, 1);
+    qemu_mutex_init(&sess->lock);
     sess->cipher = cipher;
     sess->direction = sess_info->direction;
     sess->type = sess_info->op_type;
@@ -359,6 +389,7 @@ static int cryptodev_builtin_create_akcipher_session(
     }
 
     sess = g_new0(CryptoDevBackendBuiltinSession, 1);
+    qemu_mutex_init(&sess->lock);
     sess->akcipher = akcipher;
 
     builtin->sessions[index] = sess;
@@ -416,6 +447,18 @@ static int cryptodev_builtin_create_session(
     return 0;
 }
 
+static void
+cryptodev_builtin_free_session(CryptoDevBackendBuiltinSession *session)
+{
+    if (session->cipher) {
+        qcrypto_cipher_free(session->cipher);
+    } else if (session->akcipher) {
+        qcrypto_akcipher_free(session->akcipher);
+    }
+    qemu_mutex_destroy(&session->lock);
+    g_free(session);
+}
+
 static int cryptodev_builtin_close_session(
            CryptoDevBackend *backend,
            uint64_t session_id,
@@ -430,14 +473,13 @@ static int cryptodev_builtin_close_session(
     assert(session_id < MAX_NUM_SESSIONS && builtin->sessions[session_id]);
 
     session = builtin->sessions[session_id];
-    if (session->cipher) {
-        qcrypto_cipher_free(session->cipher);
-    } else if (session->akcipher) {
-        qcrypto_akcipher_free(session->akcipher);
-    }
-
-    g_free(session);
     builtin->sessions[session_id] = NULL;
+    if (session->in_flight) {
+        /* The last operation to complete frees it */
+        session->closed = true;
+    } else {
+        cryptodev_builtin_free_session(session);
+    }
     if (cb) {
         cb(opaque, VIRTIO_CRYPTO_OK);
     }
@@ -448,6 +490,7 @@ static int cryptodev_builtin_sym_operation(
                  CryptoDevBackendBuiltinSession *sess,
                  CryptoDevBackendSymOpInfo *op_info, Error **errp)
 {
+    QCryptoCipherBatchOp op;
     int ret;
 
     if (op_info->op_type == VIRTIO_CRYPTO_SYM_OP_ALGORITHM_CHAINING) {
@@ -456,26 +499,25 @@ static int cryptodev_builtin_sym_operation(
         return -VIRTIO_CRYPTO_NOTSUPP;
     }
 
-    if (op_info->iv_len > 0) {
-        ret = qcrypto_cipher_setiv(sess->cipher, op_info->iv,
-                                   op_info->iv_len, errp);
-        if (ret < 0) {
-            return -VIRTIO_CRYPTO_ERR;
-        }
+    if (op_info->iv_len > 0 &&
+        op_info->iv_len != qcrypto_cipher_get_iv_len(sess->cipher->alg,
+                                                     sess->cipher->mode)) {
+        error_setg(errp, "Invalid IV length %" PRIu32, op_info->iv_len);
+        return -VIRTIO_CRYPTO_ERR;
     }
 
-    if (sess->direction == VIRTIO_CRYPTO_OP_ENCRYPT) {
-        ret = qcrypto_cipher_encrypt(sess->cipher, op_info->src,
-                                     op_info->dst, op_info->src_len, errp);
-        if (ret < 0) {
-            return -VIRTIO_CRYPTO_ERR;
-        }
-    } else {
-        ret = qcrypto_cipher_decrypt(sess->cipher, op_info->src,
-                                     op_info->dst, op_info->src_len, errp);
-        if (ret < 0) {
-            return -VIRTIO_CRYPTO_ERR;
-        }
+    op = (QCryptoCipherBatchOp) {
+        .iv = op_info->iv_len > 0 ? op_info->iv : NULL,
+        .in = op_info->src,
+        .out = op_info->dst,
+        .len = op_info->src_len,
+    };
+
+    ret = qcrypto_cipher_batch(sess->cipher,
+                               sess->direction == VIRTIO_CRYPTO_OP_ENCRYPT,
+                               &op, 1, errp);
+    if (ret < 0) {
+        return -VIRTIO_CRYPTO_ERR;
     }
 
     return VIRTIO_CRYPTO_OK;
@@ -537,6 +579,62 @@ static int cryptodev_builtin_asym_operation(
     return VIRTIO_CRYPTO_OK;
 }
 
+static int cryptodev_builtin_do_operation(
+                 CryptoDevBackendBuiltinSession *sess,
+                 CryptoDevBackendOpInfo *op_info, Error **errp)
+{
+    int status = -VIRTIO_CRYPTO_ERR;
+
+    qemu_mutex_lock(&sess->lock);
+    if (op_info->algtype == QCRYPTODEV_BACKEND_ALG_SYM) {
+        status = cryptodev_builtin_sym_operation(sess, op_info->u.sym_op_info,
+                                                 errp);
+    } else if (op_info->algtype == QCRYPTODEV_BACKEND_ALG_ASYM) {
+        status = cryptodev_builtin_asym_operation(sess, op_info->op_code,
+                                                  op_info->u.asym_op_info,
+                                                  errp);
+    }
+    qemu_mutex_unlock(&sess->lock);
+    return status;
+}
+
+/* Runs in a thread pool worker */
+static int cryptodev_builtin_task_run(void *opaque)
+{
+    CryptoDevBuiltinTask *task = opaque;
+
+    task->status = cryptodev_builtin_do_operation(task->sess, task->op_info,
+                                                  &task->err);
+    return 0;
+}
+
+static void cryptodev_builtin_task_done(void *opaque, int ret)
+{
+    CryptoDevBuiltinTask *task = opaque;
+    CryptoDevBackendBuiltinSession *sess = task->sess;
+    CryptoDevBackendOpInfo *op_info = task->op_info;
+
+    if (task->err) {
+        error_report_err(task->err);
+    }
+    if (--sess->in_flight == 0 && sess->closed) {
+        cryptodev_builtin_free_session(sess);
+    }
+    task->builtin->in_flight--;
+    aio_wait_kick();
+
+    if (op_info->cb) {
+        op_info->cb(op_info->opaque, task->status);
+    }
+    g_free(task);
+}
+
+/*
+ * Akcipher and large symmetric operations are handed to the thread pool so
+ * that they don't stall the main loop; they complete from a bottom half.
+ * Small symmetric operations run right away unless older operations of the
+ * same session are still pending.
+ */
 static int cryptodev_builtin_operation(
                  CryptoDevBackend *backend,
                  CryptoDevBackendOpInfo *op_info)
@@ -544,10 +642,8 @@ static int cryptodev_builtin_operation(
     CryptoDevBackendBuiltin *builtin =
                       CRYPTODEV_BACKEND_BUILTIN(backend);
     CryptoDevBackendBuiltinSession *sess;
-    CryptoDevBackendSymOpInfo *sym_op_info;
-    CryptoDevBackendAsymOpInfo *asym_op_info;
-    QCryptodevBackendAlgType algtype = op_info->algtype;
-    int status = -VIRTIO_CRYPTO_ERR;
+    CryptoDevBuiltinTask *task;
+    int status;
     Error *local_error = NULL;
 
     if (op_info->session_id >= MAX_NUM_SESSIONS ||
@@ -558,22 +654,26 @@ static int cryptodev_builtin_operation(
     }
 
     sess = builtin->sessions[op_info->session_id];
-    if (algtype == QCRYPTODEV_BACKEND_ALG_SYM) {
-        sym_op_info = op_info->u.sym_op_info;
-        status = cryptodev_builtin_sym_operation(sess, sym_op_info,
-                                                 &local_error);
-    } else if (algtype == QCRYPTODEV_BACKEND_ALG_ASYM) {
-        asym_op_info = op_info->u.asym_op_info;
-        status = cryptodev_builtin_asym_operation(sess, op_info->op_code,
-                                                  asym_op_info, &local_error);
+    if (!sess->in_flight && op_info->algtype == QCRYPTODEV_BACKEND_ALG_SYM &&
+        op_info->u.sym_op_info->src_len < CRYPTODEV_BUILTIN_OFFLOAD_MIN_LEN) {
+        status = cryptodev_builtin_do_operation(sess, op_info, &local_error);
+        if (local_error) {
+            error_report_err(local_error);
+        }
+        if (op_info->cb) {
+            op_info->cb(op_info->opaque, status);
+        }
+        return 0;
     }
 
-    if (local_error) {
-        error_report_err(local_error);
-    }
-    if (op_info->cb) {
-        op_info->cb(op_info->opaque, status);
-    }
+    task = g_new0(CryptoDevBuiltinTask, 1);
+    task->builtin = builtin;
+    task->sess = sess;
+    task->op_info = op_info;
+    sess->in_flight++;
+    builtin->in_flight++;
+    thread_pool_submit_aio(cryptodev_builtin_task_run, task,
+                           cryptodev_builtin_task_done, task);
     return 0;
 }
 
@@ -587,6 +687,9 @@ static void cryptodev_builtin_cleanup(
     int queues = backend->conf.peers.queues;
     CryptoDevBackendClient *cc;
 
+    /* Operations still running on the thread pool refer to the sessions */
+    AIO_WAIT_WHILE_UNLOCKED(NULL, builtin->in_flight > 0);
+
     for (i = 0; i < MAX_NUM_SESSIONS; i++) {
         if (builtin->sessions[i] != NULL) {
             cryptodev_builtin_close_session(backend, i, 0, NULL, NULL);
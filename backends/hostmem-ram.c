@@ -13,12 +13,144 @@
 #include "qemu/osdep.h"
 #include "sysemu/hostmem.h"
 #include "qapi/error.h"
+#include "qemu/cutils.h"
+#include "qemu/error-report.h"
+#include "qemu/host-utils.h"
+#include "qemu/madvise.h"
 #include "qemu/module.h"
+#include "qemu/rcu.h"
+#include "qemu/units.h"
 #include "qom/object_interfaces.h"
+#include "qom/object.h"
+
+OBJECT_DECLARE_SIMPLE_TYPE(HostMemoryBackendRam, MEMORY_BACKEND_RAM)
+
+struct HostMemoryBackendRam {
+    HostMemoryBackend parent_obj;
+
+    MemoryBackendLayout layout;
+    void *area;             /* mapping created for layout=auto */
+    size_t area_size;
+};
+
+#ifdef CONFIG_LINUX
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+#define RAM_LAYOUT_BULK_PAGE_SIZE (1 * GiB)
+#define RAM_LAYOUT_THP_SIZE_FILE \
+    "/sys/kernel/mm/transparent_hugepage/hpage_pmd_size"
+
+typedef struct RamLayoutArea {
+    struct rcu_head rcu;
+    void *ptr;
+    size_t size;
+} RamLayoutArea;
+
+static uint64_t ram_backend_thp_size(void)
+{
+    g_autofree char *content = NULL;
+    uint64_t size;
+
+    if (g_file_get_contents(RAM_LAYOUT_THP_SIZE_FILE, &content, NULL, NULL) &&
+        !qemu_strtou64(content, NULL, 0, &size) && is_power_of_2(size)) {
+        return size;
+    }
+    return 2 * MiB;
+}
+
+static void ram_backend_add_region(HostMemoryBackend *backend,
+                                   MemdevRegionList ***tail, uint64_t offset,
+                                   uint64_t size, uint64_t page_size)
+{
+    MemdevRegion *region = g_new0(MemdevRegion, 1);
+
+    region->offset = offset;
+    region->size = size;
+    region->page_size = page_size;
+    QAPI_LIST_APPEND(*tail, region);
+}
+
+/*
+ * Reserve an area aligned to RAM_LAYOUT_BULK_PAGE_SIZE, so that host page
+ * tables, the IOMMU and KVM can all map it with the largest pages.  The
+ * aligned bulk is replaced with 1 GiB hugetlb pages and the tail with
+ * anonymous memory that is eligible for transparent huge pages.  The whole
+ * area then becomes a single RAMBlock.
+ */
+static void ram_backend_alloc_auto(HostMemoryBackendRam *ram, const char *name,
+                                   Error **errp)
+{
+    HostMemoryBackend *backend = MEMORY_BACKEND(ram);
+    MemdevRegionList **tail = &backend->layout;
+    size_t size = ROUND_UP(backend->size, qemu_real_host_page_size());
+    size_t bulk = QEMU_ALIGN_DOWN(size, RAM_LAYOUT_BULK_PAGE_SIZE);
+    size_t reserved = size + RAM_LAYOUT_BULK_PAGE_SIZE;
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED;
+    uint64_t thp_size = ram_backend_thp_size();
+    void *area, *ptr;
+
+    if (backend->share) {
+        error_setg(errp, "layout=auto is not supported with share=on");
+        return;
+    }
+    if (!backend->reserve) {
+        flags |= MAP_NORESERVE;
+    }
+
+    area = mmap(NULL, reserved, PROT_NONE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (area == MAP_FAILED) {
+        error_setg_errno(errp, errno, "cannot reserve memory for '%s'", name);
+        return;
+    }
+    ptr = QEMU_ALIGN_PTR_UP(area, RAM_LAYOUT_BULK_PAGE_SIZE);
+    if (ptr != area) {
+        munmap(area, ptr - area);
+    }
+    munmap(ptr + size, area + reserved - (ptr + size));
+
+    if (bulk && mmap(ptr, bulk, PROT_READ | PROT_WRITE,
+                     flags | MAP_HUGETLB | (30 << MAP_HUGE_SHIFT),
+                     -1, 0) == MAP_FAILED) {
+        warn_report("memory backend '%s': no 1 GiB huge pages available, "
+                    "using transparent huge pages", name);
+        bulk = 0;
+    }
+    if (bulk) {
+        ram_backend_add_region(backend, &tail, 0, bulk,
+                               RAM_LAYOUT_BULK_PAGE_SIZE);
+    }
+    if (bulk < size) {
+        if (mmap(ptr + bulk, size - bulk, PROT_READ | PROT_WRITE, flags,
+                 -1, 0) == MAP_FAILED) {
+            error_setg_errno(errp, errno, "cannot map memory for '%s'", name);
+            munmap(ptr, size);
+            qapi_free_MemdevRegionList(backend->layout);
+            backend->layout = NULL;
+            return;
+        }
+        qemu_madvise(ptr + bulk, size - bulk, QEMU_MADV_HUGEPAGE);
+        ram_backend_add_region(backend, &tail, bulk, size - bulk, thp_size);
+    }
+
+    ram->area = ptr;
+    ram->area_size = size;
+    memory_region_init_ram_ptr(&backend->mr, OBJECT(backend), name,
+                               backend->size, ptr);
+}
+
+static void ram_backend_unmap_area(RamLayoutArea *area)
+{
+    munmap(area->ptr, area->size);
+    g_free(area);
+}
+#endif
 
 static void
 ram_backend_memory_alloc(HostMemoryBackend *backend, Error **errp)
 {
+    HostMemoryBackendRam *ram = MEMORY_BACKEND_RAM(backend);
     uint32_t ram_flags;
     char *name;
 
@@ -28,6 +160,16 @@ ram_backend_memory_alloc(HostMemoryBackend *backend, Error **errp)
     }
 
     name = host_memory_backend_get_name(backend);
+    if (ram->layout == MEMORY_BACKEND_LAYOUT_AUTO) {
+#ifdef CONFIG_LINUX
+        ram_backend_alloc_auto(ram, name, errp);
+#else
+        error_setg(errp, "layout=auto is not supported on this host");
+#endif
+        g_free(name);
+        return;
+    }
+
     ram_flags = backend->share ? RAM_SHARED : 0;
     ram_flags |= backend->reserve ? 0 : RAM_NORESERVE;
     memory_region_init_ram_flags_nomigrate(&backend->mr, OBJECT(backend), name,
@@ -35,18 +177,60 @@ ram_backend_memory_alloc(HostMemoryBackend *backend, Error **errp)
     g_free(name);
 }
 
+static int ram_backend_get_layout(Object *obj, Error **errp)
+{
+    return MEMORY_BACKEND_RAM(obj)->layout;
+}
+
+static void ram_backend_set_layout(Object *obj, int value, Error **errp)
+{
+    HostMemoryBackend *backend = MEMORY_BACKEND(obj);
+
+    if (host_memory_backend_mr_inited(backend)) {
+        error_setg(errp, "cannot change property 'layout' of %s",
+                   object_get_typename(obj));
+        return;
+    }
+    MEMORY_BACKEND_RAM(obj)->layout = value;
+}
+
+static void ram_backend_instance_finalize(Object *obj)
+{
+#ifdef CONFIG_LINUX
+    HostMemoryBackendRam *ram = MEMORY_BACKEND_RAM(obj);
+
+    if (ram->area) {
+        RamLayoutArea *area = g_new(RamLayoutArea, 1);
+
+        /* The RAMBlock is freed after a grace period, unmap after it */
+        area->ptr = ram->area;
+        area->size = ram->area_size;
+        call_rcu(area, ram_backend_unmap_area, rcu);
+    }
+#endif
+}
+
 static void
 ram_backend_class_init(ObjectClass *oc, void *data)
 {
     HostMemoryBackendClass *bc = MEMORY_BACKEND_CLASS(oc);
 
     bc->alloc = ram_backend_memory_alloc;
+
+    object_class_property_add_enum(oc, "layout", "MemoryBackendLayout",
+                                   &MemoryBackendLayout_lookup,
+                                   ram_backend_get_layout,
+                                   ram_backend_set_layout);
+    object_class_property_set_description(oc, "layout",
+        "How to lay out the memory in host pages");
 }
 
 static const TypeInfo ram_backend_info = {
     .name = TYPE_MEMORY_BACKEND_RAM,
     .parent = TYPE_MEMORY_BACKEND,
     .class_init = ram_backend_class_init,
+    .instance_size = sizeof(HostMemoryBackendRam),
+    .instance_finalize = ram_backend_instance_finalize,
 };
 
 static void register_types(void)
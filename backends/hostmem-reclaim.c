@@ -0,0 +1,669 @@
+/*
+ * Cold page detection and reclaim for memory backends
+ *
+ * A thread per backend samples the accessed state of the guest RAM through
+ * the kernel's idle page tracking, in chunks of RECLAIM_CHUNK bytes.  Chunks
+ * that stay idle for reclaim-age consecutive scans are handed to the kernel
+ * for reclaim, or moved to a slower NUMA node.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "sysemu/hostmem.h"
+#include "sysemu/stats.h"
+#include "qapi/error.h"
+#include "qapi/visitor.h"
+#include "qemu/error-report.h"
+#include "qemu/stats64.h"
+#include "qemu/thread.h"
+#include "qemu/units.h"
+#include "trace.h"
+
+#ifdef CONFIG_NUMA
+#include <numaif.h>
+#endif
+
+#ifndef MADV_COLD
+#define MADV_COLD 20
+#endif
+#ifndef MADV_PAGEOUT
+#define MADV_PAGEOUT 21
+#endif
+
+#define RECLAIM_CHUNK           (2 * MiB)
+#define RECLAIM_IDLE_WORDS      64
+#define RECLAIM_MAP_SLOTS       64
+
+#define PAGEMAP_PRESENT         (1ULL << 63)
+#define PAGEMAP_PFN_MASK        ((1ULL << 55) - 1)
+
+#define PAGE_IDLE_BITMAP        "/sys/kernel/mm/page_idle/bitmap"
+
+struct HostMemoryReclaim {
+    HostMemoryBackend *backend;
+    QemuThread thread;
+    QemuSemaphore stop_sem;
+    bool stop;
+
+    int pagemap_fd;
+    int idle_fd;
+    uint8_t *ptr;
+    uint64_t size;
+    uint64_t nb_chunks;
+    uint64_t *pfns;             /* scratch buffer for one chunk */
+
+    /*
+     * Number of consecutive scans each chunk was found idle in, saturating
+     * at UINT8_MAX.  Written by the scanner only; readers may see a sample
+     * that is one scan old.
+     */
+    uint8_t *age;
+    unsigned long *reclaimed;   /* chunks currently reclaimed or demoted */
+
+    Stat64 scans;
+    Stat64 reclaimed_bytes;
+    Stat64 promoted_bytes;
+};
+
+static uint64_t reclaim_chunk_size(HostMemoryReclaim *r, uint64_t chunk)
+{
+    return MIN(RECLAIM_CHUNK, r->size - chunk * RECLAIM_CHUNK);
+}
+
+/*
+ * Check the idle bits of @pfns, which are sorted, and set them again for the
+ * next scan.  The bitmap is accessed in runs of up to RECLAIM_IDLE_WORDS
+ * 64-bit words; writing zero bits leaves the corresponding pages alone.
+ */
+static int reclaim_check_idle(HostMemoryReclaim *r, const uint64_t *pfns,
+                              size_t n, bool *idle)
+{
+    uint64_t bits[RECLAIM_IDLE_WORDS], mask[RECLAIM_IDLE_WORDS];
+    size_t i = 0, j;
+
+    while (i < n) {
+        uint64_t first = pfns[i] / 64;
+        ssize_t ret;
+        size_t len;
+
+        for (j = i; j < n && pfns[j] / 64 < first + RECLAIM_IDLE_WORDS; j++) {
+            /* nothing */
+        }
+        len = (pfns[j - 1] / 64 - first + 1) * sizeof(uint64_t);
+
+        ret = pread(r->idle_fd, bits, len, first * sizeof(uint64_t));
+        if (ret != len) {
+            return ret < 0 ? -errno : -EIO;
+        }
+        memset(mask, 0, len);
+        for (; i < j; i++) {
+            uint64_t word = pfns[i] / 64 - first;
+            uint64_t bit = BIT_ULL(pfns[i] % 64);
+
+            if (!(bits[word] & bit)) {
+                *idle = false;
+            }
+            mask[word] |= bit;
+        }
+        ret = pwrite(r->idle_fd, mask, len, first * sizeof(uint64_t));
+        if (ret != len) {
+            return ret < 0 ? -errno : -EIO;
+        }
+    }
+    return 0;
+}
+
+static int reclaim_pfn_cmp(const void *a, const void *b)
+{
+    uint64_t pa = *(const uint64_t *)a;
+    uint64_t pb = *(const uint64_t *)b;
+
+    return pa < pb ? -1 : pa > pb;
+}
+
+/*
+ * Find out whether any page of @chunk was accessed since the previous scan.
+ * Pages that are not present, for example because they were swapped out or
+ * never touched, count as idle.
+ */
+static int reclaim_scan_chunk(HostMemoryReclaim *r, uint64_t chunk,
+                              bool *idle)
+{
+    size_t page_size = qemu_real_host_page_size();
+    uintptr_t addr = (uintptr_t)r->ptr + chunk * RECLAIM_CHUNK;
+    size_t npages = reclaim_chunk_size(r, chunk) / page_size;
+    size_t len = npages * sizeof(uint64_t);
+    size_t i, n;
+    ssize_t ret;
+
+    ret = pread(r->pagemap_fd, r->pfns, len,
+                addr / page_size * sizeof(uint64_t));
+    if (ret != len) {
+        return ret < 0 ? -errno : -EIO;
+    }
+
+    for (i = n = 0; i < npages; i++) {
+        if (r->pfns[i] & PAGEMAP_PRESENT) {
+            r->pfns[n] = r->pfns[i] & PAGEMAP_PFN_MASK;
+            if (!r->pfns[n]) {
+                /* The kernel hides PFNs from processes without CAP_SYS_ADMIN */
+                return -EPERM;
+            }
+            n++;
+        }
+    }
+
+    *idle = true;
+    if (!n) {
+        return 0;
+    }
+    qsort(r->pfns, n, sizeof(uint64_t), reclaim_pfn_cmp);
+    return reclaim_check_idle(r, r->pfns, n, idle);
+}
+
+#ifdef CONFIG_NUMA
+/*
+ * Apply @mode and @nodes to the chunk and move its pages accordingly.  Note
+ * that with MPOL_DEFAULT the pages stay where they are until the kernel's
+ * own NUMA balancing moves them.
+ */
+static int reclaim_mbind(HostMemoryReclaim *r, uint64_t chunk, int mode,
+                         const unsigned long *nodes, unsigned long maxnode)
+{
+    if (mbind(r->ptr + chunk * RECLAIM_CHUNK, reclaim_chunk_size(r, chunk),
+              mode, nodes, maxnode, MPOL_MF_MOVE)) {
+        return -errno;
+    }
+    return 0;
+}
+#endif
+
+static int reclaim_chunk(HostMemoryReclaim *r, uint64_t chunk)
+{
+    HostMemoryBackend *backend = r->backend;
+    MemoryReclaimAction action = backend->reclaim_action;
+    void *addr = r->ptr + chunk * RECLAIM_CHUNK;
+    uint64_t size = reclaim_chunk_size(r, chunk);
+
+    trace_hostmem_reclaim_chunk(backend, chunk * RECLAIM_CHUNK, size,
+                                MemoryReclaimAction_str(action));
+
+    switch (action) {
+    case MEMORY_RECLAIM_ACTION_COLD:
+        return madvise(addr, size, MADV_COLD) ? -errno : 0;
+    case MEMORY_RECLAIM_ACTION_PAGEOUT:
+        return madvise(addr, size, MADV_PAGEOUT) ? -errno : 0;
+#ifdef CONFIG_NUMA
+    case MEMORY_RECLAIM_ACTION_DEMOTE: {
+        DECLARE_BITMAP(nodes, MAX_NODES + 1) = { 0 };
+
+        set_bit(backend->reclaim_node, nodes);
+        /* See host_memory_backend_memory_complete() for the + 1 */
+        return reclaim_mbind(r, chunk, MPOL_BIND, nodes,
+                             backend->reclaim_node + 2);
+    }
+#endif
+    default:
+        g_assert_not_reached();
+    }
+}
+
+/* Move a demoted chunk that became hot back under the backend's policy */
+static int reclaim_promote_chunk(HostMemoryReclaim *r, uint64_t chunk)
+{
+#ifdef CONFIG_NUMA
+    HostMemoryBackend *backend = r->backend;
+    unsigned long lastbit = find_last_bit(backend->host_nodes, MAX_NODES);
+    unsigned long maxnode = (lastbit + 1) % (MAX_NODES + 1);
+
+    trace_hostmem_reclaim_promote(backend, chunk * RECLAIM_CHUNK,
+                                  reclaim_chunk_size(r, chunk));
+    return reclaim_mbind(r, chunk, backend->policy,
+                         maxnode ? backend->host_nodes : NULL,
+                         maxnode ? maxnode + 1 : 0);
+#else
+    g_assert_not_reached();
+#endif
+}
+
+static int reclaim_scan(HostMemoryReclaim *r)
+{
+    HostMemoryBackend *backend = r->backend;
+    uint64_t chunk, cold = 0;
+    int ret;
+
+    for (chunk = 0; chunk < r->nb_chunks; chunk++) {
+        uint64_t size = reclaim_chunk_size(r, chunk);
+        uint8_t age = r->age[chunk];
+        bool idle;
+
+        if (qatomic_read(&r->stop)) {
+            return 0;
+        }
+
+        ret = reclaim_scan_chunk(r, chunk, &idle);
+        if (ret < 0) {
+            return ret;
+        }
+
+        if (!idle) {
+            age = 0;
+            if (test_bit(chunk, r->reclaimed)) {
+                clear_bit(chunk, r->reclaimed);
+                if (backend->reclaim_action == MEMORY_RECLAIM_ACTION_DEMOTE) {
+                    ret = reclaim_promote_chunk(r, chunk);
+                    if (ret < 0) {
+                        return ret;
+                    }
+                    stat64_add(&r->promoted_bytes, size);
+                }
+            }
+        } else if (age < UINT8_MAX) {
+            age++;
+        }
+        qatomic_set(&r->age[chunk], age);
+
+        if (age >= backend->reclaim_age) {
+            cold += size;
+            if (!test_bit(chunk, r->reclaimed)) {
+                ret = reclaim_chunk(r, chunk);
+                if (ret < 0) {
+                    return ret;
+                }
+                set_bit(chunk, r->reclaimed);
+                stat64_add(&r->reclaimed_bytes, size);
+            }
+        }
+    }
+
+    stat64_inc(&r->scans);
+    trace_hostmem_reclaim_scan(backend, cold);
+    return 0;
+}
+
+static void *reclaim_thread(void *opaque)
+{
+    HostMemoryReclaim *r = opaque;
+    HostMemoryBackend *backend = r->backend;
+    int ret;
+
+    while (qemu_sem_timedwait(&r->stop_sem, backend->reclaim_interval) < 0) {
+        ret = reclaim_scan(r);
+        if (ret < 0) {
+            g_autofree char *path = object_get_canonical_path(OBJECT(backend));
+
+            error_report("%s: cold page scan failed, stopping: %s",
+                         path, strerror(-ret));
+            break;
+        }
+    }
+    return NULL;
+}
+
+bool host_memory_backend_reclaim_start(HostMemoryBackend *backend,
+                                       Error **errp)
+{
+    Object *obj = OBJECT(backend);
+    HostMemoryReclaim *r;
+    g_autofree char *name = NULL;
+    int pagemap_fd, idle_fd;
+
+    if (!backend->reclaim_interval) {
+        return true;
+    }
+
+    if (host_memory_backend_pagesize(backend) !=
+        qemu_real_host_page_size()) {
+        error_setg(errp, "reclaim-interval is not supported with huge pages");
+        return false;
+    }
+#ifndef CONFIG_NUMA
+    if (backend->reclaim_action == MEMORY_RECLAIM_ACTION_DEMOTE) {
+        error_setg(errp, "reclaim-action=demote needs NUMA support");
+        return false;
+    }
+#endif
+
+    idle_fd = open(PAGE_IDLE_BITMAP, O_RDWR);
+    if (idle_fd < 0) {
+        error_setg_errno(errp, errno, "cannot open " PAGE_IDLE_BITMAP
+                         " for reclaim-interval");
+        return false;
+    }
+    pagemap_fd = open("/proc/self/pagemap", O_RDONLY);
+    if (pagemap_fd < 0) {
+        error_setg_errno(errp, errno, "cannot open /proc/self/pagemap");
+        close(idle_fd);
+        return false;
+    }
+
+    r = g_new0(HostMemoryReclaim, 1);
+    r->backend = backend;
+    r->idle_fd = idle_fd;
+    r->pagemap_fd = pagemap_fd;
+    r->ptr = memory_region_get_ram_ptr(&backend->mr);
+    r->size = memory_region_size(&backend->mr);
+    r->nb_chunks = DIV_ROUND_UP(r->size, RECLAIM_CHUNK);
+    r->pfns = g_new(uint64_t, RECLAIM_CHUNK / qemu_real_host_page_size());
+    r->age = g_new0(uint8_t, r->nb_chunks);
+    r->reclaimed = bitmap_new(r->nb_chunks);
+    qemu_sem_init(&r->stop_sem, 0);
+    backend->reclaim = r;
+
+    name = g_strdup_printf("reclaim %s",
+                           object_get_canonical_path_component(obj));
+    qemu_thread_create(&r->thread, name, reclaim_thread, r,
+                       QEMU_THREAD_JOINABLE);
+    return true;
+}
+
+void host_memory_backend_reclaim_stop(HostMemoryBackend *backend)
+{
+    HostMemoryReclaim *r = backend->reclaim;
+
+    if (!r) {
+        return;
+    }
+
+    qatomic_set(&r->stop, true);
+    qemu_sem_post(&r->stop_sem);
+    qemu_thread_join(&r->thread);
+
+    qemu_sem_destroy(&r->stop_sem);
+    close(r->idle_fd);
+    close(r->pagemap_fd);
+    g_free(r->pfns);
+    g_free(r->age);
+    g_free(r->reclaimed);
+    g_free(r);
+    backend->reclaim = NULL;
+}
+
+static void host_memory_backend_get_reclaim_interval(Object *obj, Visitor *v,
+    const char *name, void *opaque, Error **errp)
+{
+    HostMemoryBackend *backend = MEMORY_BACKEND(obj);
+
+    visit_type_uint32(v, name, &backend->reclaim_interval, errp);
+}
+
+static void host_memory_backend_set_reclaim_interval(Object *obj, Visitor *v,
+    const char *name, void *opaque, Error **errp)
+{
+    HostMemoryBackend *backend = MEMORY_BACKEND(obj);
+
+    if (host_memory_backend_mr_inited(backend)) {
+        error_setg(errp, "cannot change property %s of %s ", name,
+                   object_get_typename(obj));
+        return;
+    }
+    visit_type_uint32(v, name, &backend->reclaim_interval, errp);
+}
+
+static void host_memory_backend_get_reclaim_age(Object *obj, Visitor *v,
+    const char *name, void *opaque, Error **errp)
+{
+    HostMemoryBackend *backend = MEMORY_BACKEND(obj);
+
+    visit_type_uint8(v, name, &backend->reclaim_age, errp);
+}
+
+static void host_memory_backend_set_reclaim_age(Object *obj, Visitor *v,
+    const char *name, void *opaque, Error **errp)
+{
+    HostMemoryBackend *backend = MEMORY_BACKEND(obj);
+    uint8_t value;
+
+    if (host_memory_backend_mr_inited(backend)) {
+        error_setg(errp, "cannot change property %s of %s ", name,
+                   object_get_typename(obj));
+        return;
+    }
+    if (!visit_type_uint8(v, name, &value, errp)) {
+        return;
+    }
+    if (!value) {
+        error_setg(errp, "property '%s' of %s doesn't take value '%d'", name,
+                   object_get_typename(obj), value);
+        return;
+    }
+    backend->reclaim_age = value;
+}
+
+static int host_memory_backend_get_reclaim_action(Object *obj, Error **errp)
+{
+    return MEMORY_BACKEND(obj)->reclaim_action;
+}
+
+static void host_memory_backend_set_reclaim_action(Object *obj, int value,
+                                                   Error **errp)
+{
+    HostMemoryBackend *backend = MEMORY_BACKEND(obj);
+
+    if (host_memory_backend_mr_inited(backend)) {
+        error_setg(errp, "cannot change property reclaim-action of %s",
+                   object_get_typename(obj));
+        return;
+    }
+    backend->reclaim_action = value;
+}
+
+static void host_memory_backend_get_reclaim_node(Object *obj, Visitor *v,
+    const char *name, void *opaque, Error **errp)
+{
+    HostMemoryBackend *backend = MEMORY_BACKEND(obj);
+
+    visit_type_uint16(v, name, &backend->reclaim_node, errp);
+}
+
+static void host_memory_backend_set_reclaim_node(Object *obj, Visitor *v,
+    const char *name, void *opaque, Error **errp)
+{
+    HostMemoryBackend *backend = MEMORY_BACKEND(obj);
+    uint16_t value;
+
+    if (host_memory_backend_mr_inited(backend)) {
+        error_setg(errp, "cannot change property %s of %s ", name,
+                   object_get_typename(obj));
+        return;
+    }
+    if (!visit_type_uint16(v, name, &value, errp)) {
+        return;
+    }
+    if (value >= MAX_NODES) {
+        error_setg(errp, "Invalid host node: %d", value);
+        return;
+    }
+    backend->reclaim_node = value;
+}
+
+typedef struct {
+    StatsResultList **result;
+    strList *names;
+} ReclaimStatsIter;
+
+static StatsList *reclaim_stats_add(StatsList *list, strList *names,
+                                    const char *name, uint64_t value)
+{
+    Stats *stats;
+
+    if (!apply_str_list_filter(name, names)) {
+        return list;
+    }
+
+    stats = g_new0(Stats, 1);
+    stats->name = g_strdup(name);
+    stats->value = g_new0(StatsValue, 1);
+    stats->value->type = QTYPE_QNUM;
+    stats->value->u.scalar = value;
+    QAPI_LIST_PREPEND(list, stats);
+    return list;
+}
+
+static StatsList *reclaim_stats_add_list(StatsList *list, strList *names,
+                                         const char *name,
+                                         const uint64_t *values, int n)
+{
+    uint64List *values_list = NULL;
+    Stats *stats;
+    int i;
+
+    if (!apply_str_list_filter(name, names)) {
+        return list;
+    }
+
+    for (i = n - 1; i >= 0; i--) {
+        QAPI_LIST_PREPEND(values_list, values[i]);
+    }
+    stats = g_new0(Stats, 1);
+    stats->name = g_strdup(name);
+    stats->value = g_new0(StatsValue, 1);
+    stats->value->type = QTYPE_QLIST;
+    stats->value->u.list = values_list;
+    QAPI_LIST_PREPEND(list, stats);
+    return list;
+}
+
+/*
+ * Besides counters, report a histogram of the chunk ages, with the last
+ * bucket for all cold chunks, and a map of the cold bytes in each of up to
+ * RECLAIM_MAP_SLOTS equal slices of the backend.
+ */
+static int reclaim_stats_one(Object *obj, void *opaque)
+{
+    ReclaimStatsIter *iter = opaque;
+    HostMemoryBackend *backend;
+    HostMemoryReclaim *r;
+    StatsList *stats_list = NULL;
+    g_autofree uint64_t *ages = NULL;
+    uint64_t map[RECLAIM_MAP_SLOTS] = { 0 };
+    uint64_t chunk, slots, cold = 0;
+    char *qom_path;
+
+    backend = (HostMemoryBackend *)object_dynamic_cast(obj,
+                                                       TYPE_MEMORY_BACKEND);
+    if (!backend || !backend->reclaim) {
+        return 0;
+    }
+    r = backend->reclaim;
+
+    ages = g_new0(uint64_t, backend->reclaim_age + 1);
+    slots = MIN(r->nb_chunks, RECLAIM_MAP_SLOTS);
+    for (chunk = 0; chunk < r->nb_chunks; chunk++) {
+        uint8_t age = qatomic_read(&r->age[chunk]);
+
+        ages[MIN(age, backend->reclaim_age)]++;
+        if (age >= backend->reclaim_age) {
+            cold += reclaim_chunk_size(r, chunk);
+            map[chunk * slots / r->nb_chunks] += reclaim_chunk_size(r, chunk);
+        }
+    }
+
+    stats_list = reclaim_stats_add_list(stats_list, iter->names, "cold-map",
+                                        map, slots);
+    stats_list = reclaim_stats_add_list(stats_list, iter->names,
+                                        "chunk-age", ages,
+                                        backend->reclaim_age + 1);
+    stats_list = reclaim_stats_add(stats_list, iter->names, "promoted-bytes",
+                                   stat64_get(&r->promoted_bytes));
+    stats_list = reclaim_stats_add(stats_list, iter->names, "reclaimed-bytes",
+                                   stat64_get(&r->reclaimed_bytes));
+    stats_list = reclaim_stats_add(stats_list, iter->names, "cold-bytes",
+                                   cold);
+    stats_list = reclaim_stats_add(stats_list, iter->names, "scans",
+                                   stat64_get(&r->scans));
+
+    if (stats_list) {
+        qom_path = object_get_canonical_path(obj);
+        add_stats_entry(iter->result, STATS_PROVIDER_MEMORY_BACKEND, qom_path,
+                        stats_list);
+        g_free(qom_path);
+    }
+    return 0;
+}
+
+static void reclaim_stats_cb(StatsResultList **result, StatsTarget target,
+                             strList *names, strList *targets, Error **errp)
+{
+    ReclaimStatsIter iter = { .result = result, .names = names };
+
+    if (target != STATS_TARGET_VM) {
+        return;
+    }
+
+    object_child_foreach(object_get_objects_root(), reclaim_stats_one, &iter);
+}
+
+static StatsSchemaValueList *reclaim_schemas_add(StatsSchemaValueList *list,
+                                                 const char *name,
+                                                 StatsType type, bool bytes)
+{
+    StatsSchemaValue *value = g_new0(StatsSchemaValue, 1);
+
+    value->name = g_strdup(name);
+    value->type = type;
+    if (bytes) {
+        value->has_unit = true;
+        value->unit = STATS_UNIT_BYTES;
+    }
+    if (type == STATS_TYPE_LINEAR_HISTOGRAM) {
+        value->has_bucket_size = true;
+        value->bucket_size = 1;
+    }
+    QAPI_LIST_PREPEND(list, value);
+    return list;
+}
+
+static void reclaim_schemas_cb(StatsSchemaList **result, Error **errp)
+{
+    StatsSchemaValueList *stats_list = NULL;
+
+    stats_list = reclaim_schemas_add(stats_list, "cold-map",
+                                     STATS_TYPE_INSTANT, true);
+    stats_list = reclaim_schemas_add(stats_list, "chunk-age",
+                                     STATS_TYPE_LINEAR_HISTOGRAM, false);
+    stats_list = reclaim_schemas_add(stats_list, "promoted-bytes",
+                                     STATS_TYPE_CUMULATIVE, true);
+    stats_list = reclaim_schemas_add(stats_list, "reclaimed-bytes",
+                                     STATS_TYPE_CUMULATIVE, true);
+    stats_list = reclaim_schemas_add(stats_list, "cold-bytes",
+                                     STATS_TYPE_INSTANT, true);
+    stats_list = reclaim_schemas_add(stats_list, "scans",
+                                     STATS_TYPE_CUMULATIVE, false);
+
+    add_stats_schema(result, STATS_PROVIDER_MEMORY_BACKEND, STATS_TARGET_VM,
+                     stats_list);
+}
+
+void host_memory_backend_reclaim_class_init(ObjectClass *oc)
+{
+    object_class_property_add(oc, "reclaim-interval", "int",
+        host_memory_backend_get_reclaim_interval,
+        host_memory_backend_set_reclaim_interval,
+        NULL, NULL);
+    object_class_property_set_description(oc, "reclaim-interval",
+        "Milliseconds between cold page scans, 0 to disable");
+    object_class_property_add(oc, "reclaim-age", "int",
+        host_memory_backend_get_reclaim_age,
+        host_memory_backend_set_reclaim_age,
+        NULL, NULL);
+    object_class_property_set_description(oc, "reclaim-age",
+        "Number of idle scans after which memory is cold");
+    object_class_property_add_enum(oc, "reclaim-action", "MemoryReclaimAction",
+        &MemoryReclaimAction_lookup,
+        host_memory_backend_get_reclaim_action,
+        host_memory_backend_set_reclaim_action);
+    object_class_property_set_description(oc, "reclaim-action",
+        "What to do with cold memory");
+    object_class_property_add(oc, "reclaim-node", "int",
+        host_memory_backend_get_reclaim_node,
+        host_memory_backend_set_reclaim_node,
+        NULL, NULL);
+    object_class_property_set_description(oc, "reclaim-node",
+        "Host NUMA node that cold memory is demoted to");
+
+    add_stats_callbacks(STATS_PROVIDER_MEMORY_BACKEND, reclaim_stats_cb,
+                        reclaim_schemas_cb);
+}
@@ -17,6 +17,8 @@
 #include "qapi/qapi-builtin-visit.h"
 #include "qapi/visitor.h"
 #include "qemu/config-file.h"
+#include "qemu/error-report.h"
+#include "qemu/main-loop.h"
 #include "qom/object_interfaces.h"
 #include "qemu/mmap-alloc.h"
 #include "qemu/madvise.h"
@@ -247,6 +249,47 @@ static void host_memory_backend_set_prealloc(Object *obj, bool value,
     }
 }
 
+static bool host_memory_backend_get_prealloc_async(Object *obj, Error **errp)
+{
+    HostMemoryBackend *backend = MEMORY_BACKEND(obj);
+
+    return backend->prealloc_async;
+}
+
+static void host_memory_backend_set_prealloc_async(Object *obj, bool value,
+                                                   Error **errp)
+{
+    HostMemoryBackend *backend = MEMORY_BACKEND(obj);
+
+    if (host_memory_backend_mr_inited(backend)) {
+        error_setg(errp, "cannot change property '%s' of %s",
+                   "prealloc-async", object_get_typename(obj));
+        return;
+    }
+    backend->prealloc_async = value;
+}
+
+static void host_memory_backend_get_prealloc_sync_size(Object *obj, Visitor *v,
+    const char *name, void *opaque, Error **errp)
+{
+    HostMemoryBackend *backend = MEMORY_BACKEND(obj);
+
+    visit_type_size(v, name, &backend->prealloc_sync_size, errp);
+}
+
+static void host_memory_backend_set_prealloc_sync_size(Object *obj, Visitor *v,
+    const char *name, void *opaque, Error **errp)
+{
+    HostMemoryBackend *backend = MEMORY_BACKEND(obj);
+
+    if (host_memory_backend_mr_inited(backend)) {
+        error_setg(errp, "cannot change property '%s' of %s", name,
+                   object_get_typename(obj));
+        return;
+    }
+    visit_type_size(v, name, &backend->prealloc_sync_size, errp);
+}
+
 static void host_memory_backend_get_prealloc_threads(Object *obj, Visitor *v,
     const char *name, void *opaque, Error **errp)
 {
@@ -281,6 +324,17 @@ static void host_memory_backend_init(Object *obj)
     backend->dump = machine_dump_guest_core(machine);
     backend->reserve = true;
     backend->prealloc_threads = machine->smp.cpus;
+    backend->reclaim_age = 2;
+}
+
+static void host_memory_backend_finalize(Object *obj)
+{
+    HostMemoryBackend *backend = MEMORY_BACKEND(obj);
+
+#ifdef CONFIG_LINUX
+    host_memory_backend_reclaim_stop(backend);
+#endif
+    qapi_free_MemdevRegionList(backend->layout);
 }
 
 static void host_memory_backend_post_init(Object *obj)
@@ -319,6 +373,76 @@ size_t host_memory_backend_pagesize(HostMemoryBackend *memdev)
     return pagesize;
 }
 
+static void host_memory_backend_prealloc_done_bh(void *opaque)
+{
+    HostMemoryBackend *backend = opaque;
+    int ret = backend->prealloc_async_ret;
+
+    if (ret < 0) {
+        error_report("memory backend '%s': background preallocation failed: "
+                     "%s", object_get_canonical_path_component(OBJECT(backend)),
+                     strerror(-ret));
+    }
+    object_unref(OBJECT(backend));
+}
+
+/* Called from a preallocation thread */
+static void host_memory_backend_prealloc_done(void *opaque, int ret)
+{
+    HostMemoryBackend *backend = opaque;
+
+    backend->prealloc_async_ret = ret;
+    aio_bh_schedule_oneshot(qemu_get_aio_context(),
+                            host_memory_backend_prealloc_done_bh, backend);
+}
+
+/*
+ * With prealloc-async, only the first prealloc-sync-size bytes are populated
+ * before returning.  The rest is populated in the background while the guest
+ * runs; guest faults on ranges that are not populated yet are served as
+ * usual.
+ */
+static bool host_memory_backend_prealloc(HostMemoryBackend *backend,
+                                         void *ptr, uint64_t sz, Error **errp)
+{
+    ERRP_GUARD();
+    int fd = memory_region_get_fd(&backend->mr);
+    uint64_t sync_sz = sz;
+
+    if (backend->prealloc_async) {
+        sync_sz = MIN(ROUND_UP(backend->prealloc_sync_size,
+                               qemu_fd_getpagesize(fd)), sz);
+    }
+
+    if (sync_sz) {
+        qemu_prealloc_mem(fd, ptr, sync_sz, backend->prealloc_threads,
+                          backend->prealloc_context, errp);
+        if (*errp) {
+            return false;
+        }
+    }
+    if (sync_sz == sz) {
+        return true;
+    }
+
+    /* Keep the memory mapped until the threads are done with it */
+    object_ref(OBJECT(backend));
+    if (!qemu_prealloc_mem_async(fd, ptr + sync_sz, sz - sync_sz,
+                                 backend->prealloc_threads,
+                                 backend->prealloc_context,
+                                 host_memory_backend_prealloc_done,
+                                 backend)) {
+        object_unref(OBJECT(backend));
+        warn_report_once("background preallocation needs "
+                         "MADV_POPULATE_WRITE, preallocating synchronously");
+        qemu_prealloc_mem(fd, ptr + sync_sz, sz - sync_sz,
+                          backend->prealloc_threads,
+                          backend->prealloc_context, errp);
+        return !*errp;
+    }
+    return true;
+}
+
 static void
 host_memory_backend_memory_complete(UserCreatable *uc, Error **errp)
 {
@@ -399,13 +523,16 @@ host_memory_backend_memory_complete(UserCreatable *uc, Error **errp)
          * specified NUMA policy in place.
          */
         if (backend->prealloc) {
-            qemu_prealloc_mem(memory_region_get_fd(&backend->mr), ptr, sz,
-                              backend->prealloc_threads,
-                              backend->prealloc_context, &local_err);
+            host_memory_backend_prealloc(backend, ptr, sz, &local_err);
             if (local_err) {
                 goto out;
             }
         }
+#ifdef CONFIG_LINUX
+        if (!host_memory_backend_reclaim_start(backend, &local_err)) {
+            goto out;
+        }
+#endif
     }
 out:
     error_propagate(errp, local_err);
@@ -503,6 +630,17 @@ host_memory_backend_class_init(ObjectClass *oc, void *data)
         host_memory_backend_set_prealloc);
     object_class_property_set_description(oc, "prealloc",
         "Preallocate memory");
+    object_class_property_add_bool(oc, "prealloc-async",
+        host_memory_backend_get_prealloc_async,
+        host_memory_backend_set_prealloc_async);
+    object_class_property_set_description(oc, "prealloc-async",
+        "Finish preallocation in the background while the guest runs");
+    object_class_property_add(oc, "prealloc-sync-size", "int",
+        host_memory_backend_get_prealloc_sync_size,
+        host_memory_backend_set_prealloc_sync_size,
+        NULL, NULL);
+    object_class_property_set_description(oc, "prealloc-sync-size",
+        "With prealloc-async, bytes to preallocate before the guest starts");
     object_class_property_add(oc, "prealloc-threads", "int",
         host_memory_backend_get_prealloc_threads,
         host_memory_backend_set_prealloc_threads,
@@ -541,6 +679,7 @@ host_memory_backend_class_init(ObjectClass *oc, void *data)
         host_memory_backend_get_reserve, host_memory_backend_set_reserve);
     object_class_property_set_description(oc, "reserve",
         "Reserve swap space (or huge pages) if applicable");
+    host_memory_backend_reclaim_class_init(oc);
 #endif /* CONFIG_LINUX */
     /*
      * Do not delete/rename option. This option must be considered stable
@@ -566,6 +705,7 @@ static const TypeInfo host_memory_backend_info = {
     .instance_size = sizeof(HostMemoryBackend),
     .instance_init = host_memory_backend_init,
     .instance_post_init = host_memory_backend_post_init,
+    .instance_finalize = host_memory_backend_finalize,
     .interfaces = (InterfaceInfo[]) {
         { TYPE_USER_CREATABLE },
         { }
@@ -50,7 +50,6 @@
 #include "qemu/timer.h"
 #include "qemu/cutils.h"
 #include "qemu/id.h"
-#include "qemu/range.h"
 #include "qemu/rcu.h"
 #include "block/coroutines.h"
 
@@ -422,8 +421,8 @@ BlockDriverState *bdrv_new(void)
 
     qemu_co_queue_init(&bs->flush_queue);
 
-    qemu_co_mutex_init(&bs->bsc_modify_lock);
-    bs->block_status_cache = g_new0(BdrvBlockStatusCache, 1);
+    qemu_mutex_init(&bs->block_status_cache.lock);
+    QTAILQ_INIT(&bs->block_status_cache.lru);
 
     for (i = 0; i < bdrv_drain_all_count; i++) {
         bdrv_drained_begin(bs);
@@ -5083,8 +5082,7 @@ static void bdrv_close(BlockDriverState *bs)
     bs->explicit_options = NULL;
     qobject_unref(bs->full_open_options);
     bs->full_open_options = NULL;
-    g_free(bs->block_status_cache);
-    bs->block_status_cache = NULL;
+    bdrv_bsc_invalidate_range(bs, 0, INT64_MAX);
 
     bdrv_release_named_dirty_bitmaps(bs);
     assert(QLIST_EMPTY(&bs->dirty_bitmaps));
@@ -5476,6 +5474,7 @@ static void bdrv_delete(BlockDriverState *bs)
 
     bdrv_close(bs);
 
+    qemu_mutex_destroy(&bs->block_status_cache.lock);
     g_free(bs);
 }
 
@@ -8325,31 +8324,34 @@ BlockDriverState *bdrv_backing_chain_next(BlockDriverState *bs)
     return bdrv_skip_filters(bdrv_cow_bs(bdrv_skip_filters(bs)));
 }
 
-/**
- * Check whether [offset, offset + bytes) overlaps with the cached
- * block-status data region.
- *
- * If so, and @pnum is not NULL, set *pnum to `bsc.data_end - offset`,
- * which is what bdrv_bsc_is_data()'s interface needs.
- * Otherwise, *pnum is not touched.
- */
-static bool bdrv_bsc_range_overlaps_locked(BlockDriverState *bs,
-                                           int64_t offset, int64_t bytes,
-                                           int64_t *pnum)
+static void bdrv_bsc_insert_locked(BdrvBlockStatusCache *bsc,
+                                   uint64_t start, uint64_t last)
 {
-    BdrvBlockStatusCache *bsc = qatomic_rcu_read(&bs->block_status_cache);
-    bool overlaps;
-
-    overlaps =
-        qatomic_read(&bsc->valid) &&
-        ranges_overlap(offset, bytes, bsc->data_start,
-                       bsc->data_end - bsc->data_start);
+    BdrvBscRegion *region;
 
-    if (overlaps && pnum) {
-        *pnum = bsc->data_end - offset;
+    if (bsc->nb_regions == BDRV_BSC_MAX_REGIONS) {
+        /* Evict the region that was filled longest ago */
+        region = QTAILQ_FIRST(&bsc->lru);
+        interval_tree_remove(&region->node, &bsc->regions);
+        QTAILQ_REMOVE(&bsc->lru, region, next);
+    } else {
+        region = g_new(BdrvBscRegion, 1);
+        bsc->nb_regions++;
     }
 
-    return overlaps;
+    region->node.start = start;
+    region->node.last = last;
+    interval_tree_insert(&region->node, &bsc->regions);
+    QTAILQ_INSERT_TAIL(&bsc->lru, region, next);
+}
+
+static void bdrv_bsc_remove_locked(BdrvBlockStatusCache *bsc,
+                                   BdrvBscRegion *region)
+{
+    interval_tree_remove(&region->node, &bsc->regions);
+    QTAILQ_REMOVE(&bsc->lru, region, next);
+    bsc->nb_regions--;
+    g_free(region);
 }
 
 /**
@@ -8357,9 +8359,21 @@ static bool bdrv_bsc_range_overlaps_locked(BlockDriverState *bs,
  */
 bool bdrv_bsc_is_data(BlockDriverState *bs, int64_t offset, int64_t *pnum)
 {
+    BdrvBlockStatusCache *bsc = &bs->block_status_cache;
+    IntervalTreeNode *node;
     IO_CODE();
-    RCU_READ_LOCK_GUARD();
-    return bdrv_bsc_range_overlaps_locked(bs, offset, 1, pnum);
+
+    QEMU_LOCK_GUARD(&bsc->lock);
+
+    node = interval_tree_iter_first(&bsc->regions, offset, offset);
+    if (!node) {
+        return false;
+    }
+
+    if (pnum) {
+        *pnum = node->last + 1 - offset;
+    }
+    return true;
 }
 
 /**
@@ -8368,11 +8382,32 @@ bool bdrv_bsc_is_data(BlockDriverState *bs, int64_t offset, int64_t *pnum)
 void bdrv_bsc_invalidate_range(BlockDriverState *bs,
                                int64_t offset, int64_t bytes)
 {
+    BdrvBlockStatusCache *bsc = &bs->block_status_cache;
+    uint64_t last = bytes > INT64_MAX - offset ? INT64_MAX
+                                               : offset + bytes - 1;
+    IntervalTreeNode *node;
     IO_CODE();
-    RCU_READ_LOCK_GUARD();
 
-    if (bdrv_bsc_range_overlaps_locked(bs, offset, bytes, NULL)) {
-        qatomic_set(&bs->block_status_cache->valid, false);
+    if (!bytes) {
+        return;
+    }
+
+    QEMU_LOCK_GUARD(&bsc->lock);
+
+    while ((node = interval_tree_iter_first(&bsc->regions, offset, last))) {
+        uint64_t node_start = node->start;
+        uint64_t node_last = node->last;
+
+        bdrv_bsc_remove_locked(bsc,
+                               container_of(node, BdrvBscRegion, node));
+
+        /* Keep what lies outside of the invalidated range */
+        if (node_start < offset) {
+            bdrv_bsc_insert_locked(bsc, node_start, offset - 1);
+        }
+        if (node_last > last) {
+            bdrv_bsc_insert_locked(bsc, last + 1, node_last);
+        }
     }
 }
 
@@ -8381,21 +8416,25 @@ void bdrv_bsc_invalidate_range(BlockDriverState *bs,
  */
 void bdrv_bsc_fill(BlockDriverState *bs, int64_t offset, int64_t bytes)
 {
-    BdrvBlockStatusCache *new_bsc = g_new(BdrvBlockStatusCache, 1);
-    BdrvBlockStatusCache *old_bsc;
+    BdrvBlockStatusCache *bsc = &bs->block_status_cache;
+    uint64_t start = offset;
+    uint64_t last = offset + bytes - 1;
+    IntervalTreeNode *node;
     IO_CODE();
 
-    *new_bsc = (BdrvBlockStatusCache) {
-        .valid = true,
-        .data_start = offset,
-        .data_end = offset + bytes,
-    };
+    assert(bytes > 0);
 
-    QEMU_LOCK_GUARD(&bs->bsc_modify_lock);
+    QEMU_LOCK_GUARD(&bsc->lock);
 
-    old_bsc = qatomic_rcu_read(&bs->block_status_cache);
-    qatomic_rcu_set(&bs->block_status_cache, new_bsc);
-    if (old_bsc) {
-        g_free_rcu(old_bsc, rcu);
+    /* Absorb the regions that overlap or directly adjoin the new one */
+    while ((node = interval_tree_iter_first(&bsc->regions,
+                                            start ? start - 1 : 0,
+                                            last + 1))) {
+        start = MIN(start, node->start);
+        last = MAX(last, node->last);
+        bdrv_bsc_remove_locked(bsc,
+                               container_of(node, BdrvBscRegion, node));
     }
+
+    bdrv_bsc_insert_locked(bsc, start, last);
 }
@@ -26,6 +26,7 @@
 #include "qemu/osdep.h"
 #include "block/accounting.h"
 #include "block/block_int.h"
+#include "qemu/host-utils.h"
 #include "qemu/timer.h"
 #include "sysemu/qtest.h"
 
@@ -200,6 +201,70 @@ void block_latency_histograms_clear(BlockAcctStats *stats)
     }
 }
 
+static unsigned block_latency_bucket(uint64_t latency_ns)
+{
+    unsigned msb;
+
+    if (latency_ns < (1 << BLOCK_LATENCY_SUB_BITS)) {
+        return latency_ns;
+    }
+    msb = 63 - clz64(latency_ns);
+    if (msb >= BLOCK_LATENCY_MAX_BITS) {
+        return BLOCK_LATENCY_BUCKETS - 1;
+    }
+    return (msb - BLOCK_LATENCY_SUB_BITS + 1) << BLOCK_LATENCY_SUB_BITS |
+           extract64(latency_ns, msb - BLOCK_LATENCY_SUB_BITS,
+                     BLOCK_LATENCY_SUB_BITS);
+}
+
+/* Largest latency that falls in bucket @i */
+static uint64_t block_latency_bucket_limit(unsigned i)
+{
+    unsigned group = i >> BLOCK_LATENCY_SUB_BITS;
+    uint64_t sub = i & ((1 << BLOCK_LATENCY_SUB_BITS) - 1);
+
+    if (group == 0) {
+        return i;
+    }
+    sub |= 1 << BLOCK_LATENCY_SUB_BITS;
+    return ((sub + 1) << (group - 1)) - 1;
+}
+
+/*
+ * Return an upper bound for the latency under which @ppm parts per million
+ * of the requests of type @type so far completed, or 0 if there were none.  The buckets are
+ * sampled one by one while requests keep completing, which only matters
+ * if the tail moves by a whole bucket during the walk.
+ */
+uint64_t block_acct_latency_percentile(BlockAcctStats *stats,
+                                       enum BlockAcctType type,
+                                       unsigned ppm)
+{
+    Stat64 *buckets = stats->latency_buckets[type];
+    uint64_t counts[BLOCK_LATENCY_BUCKETS];
+    uint64_t total = 0, rank, sum = 0;
+    unsigned i;
+
+    assert(type < BLOCK_MAX_IOTYPE);
+
+    for (i = 0; i < BLOCK_LATENCY_BUCKETS; i++) {
+        counts[i] = stat64_get(&buckets[i]);
+        total += counts[i];
+    }
+    if (!total) {
+        return 0;
+    }
+
+    rank = MAX(DIV_ROUND_UP(total * ppm, 1000000), 1);
+    for (i = 0; i < BLOCK_LATENCY_BUCKETS - 1; i++) {
+        sum += counts[i];
+        if (sum >= rank) {
+            break;
+        }
+    }
+    return block_latency_bucket_limit(i);
+}
+
 static void block_account_one_io(BlockAcctStats *stats, BlockAcctCookie *cookie,
                                  bool failed)
 {
@@ -238,6 +303,12 @@ static void block_account_one_io(BlockAcctStats *stats, BlockAcctCookie *cookie,
         }
     }
 
+    if (!failed || stats->account_failed) {
+        unsigned i = block_latency_bucket(MAX(latency_ns, 0));
+
+        stat64_add(&stats->latency_buckets[cookie->type][i], 1);
+    }
+
     cookie->type = BLOCK_ACCT_NONE;
 }
 
@@ -36,6 +36,16 @@
 #define BLOCK_COPY_SLICE_TIME 100000000ULL /* ns */
 #define BLOCK_COPY_CLUSTER_SIZE_DEFAULT (1 << 16)
 
+/*
+ * Chunk size tuning: the chunk size for buffered copies and copy_range may
+ * grow up to BLOCK_COPY_MAX_CHUNK_SHIFT doublings, but never beyond a quarter
+ * of BLOCK_COPY_MAX_MEM so that several tasks can still run in parallel.
+ * Throughput is measured over BLOCK_COPY_TUNE_WINDOW bytes per step.
+ */
+#define BLOCK_COPY_MAX_CHUNK_SHIFT 4
+#define BLOCK_COPY_MAX_TUNED_CHUNK (BLOCK_COPY_MAX_MEM / 4)
+#define BLOCK_COPY_TUNE_WINDOW (256 * MiB)
+
 typedef enum {
     COPY_READ_WRITE_CLUSTER,
     COPY_READ_WRITE,
@@ -137,6 +147,12 @@ typedef struct BlockCopyState {
     CoMutex lock;
     int64_t in_flight_bytes;
     BlockCopyMethod method;
+    /* Chunk size tuning for @method, see block_copy_tune_chunk_size() */
+    int chunk_shift;
+    bool chunk_tuned;
+    int64_t tune_bytes;
+    int64_t tune_start_ns;
+    uint64_t tune_prev_rate;
     BlockReqList reqs;
     QLIST_HEAD(, BlockCopyCallState) calls;
     /*
@@ -164,22 +180,86 @@ typedef struct BlockCopyState {
 /* Called with lock held */
 static int64_t block_copy_chunk_size(BlockCopyState *s)
 {
+    int64_t tuned;
+
     switch (s->method) {
     case COPY_READ_WRITE_CLUSTER:
         return s->cluster_size;
-    case COPY_READ_WRITE:
     case COPY_RANGE_SMALL:
         return MIN(MAX(s->cluster_size, BLOCK_COPY_MAX_BUFFER),
                    s->max_transfer);
+    case COPY_READ_WRITE:
+        tuned = MIN(BLOCK_COPY_MAX_BUFFER << s->chunk_shift,
+                    BLOCK_COPY_MAX_TUNED_CHUNK);
+        return MIN(MAX(s->cluster_size, tuned), s->max_transfer);
     case COPY_RANGE_FULL:
-        return MIN(MAX(s->cluster_size, BLOCK_COPY_MAX_COPY_RANGE),
-                   s->max_transfer);
+        tuned = MIN(BLOCK_COPY_MAX_COPY_RANGE << s->chunk_shift,
+                    BLOCK_COPY_MAX_TUNED_CHUNK);
+        return MIN(MAX(s->cluster_size, tuned), s->max_transfer);
     default:
         /* Cannot have COPY_WRITE_ZEROES here.  */
         abort();
     }
 }
 
+/* Called with lock held */
+static void block_copy_reset_chunk_tuning(BlockCopyState *s)
+{
+    s->chunk_shift = 0;
+    s->chunk_tuned = false;
+    s->tune_bytes = 0;
+    s->tune_start_ns = 0;
+    s->tune_prev_rate = 0;
+}
+
+/*
+ * Called with lock held after a task using s->method has succeeded.
+ *
+ * Measure the overall copy throughput over BLOCK_COPY_TUNE_WINDOW bytes and
+ * keep doubling the chunk size for as long as that improves throughput by
+ * at least an eighth.  Larger chunks also mean fewer tasks fit into
+ * BLOCK_COPY_MAX_MEM, so this trades parallelism for request size.  When
+ * throughput does not improve, go back to the previous size and stop.
+ */
+static void block_copy_tune_chunk_size(BlockCopyState *s, int64_t bytes)
+{
+    int64_t now, elapsed;
+    uint64_t rate;
+
+    if (s->chunk_tuned) {
+        return;
+    }
+
+    now = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    if (!s->tune_start_ns) {
+        s->tune_start_ns = now;
+        s->tune_bytes = 0;
+        return;
+    }
+
+    s->tune_bytes += bytes;
+    elapsed = now - s->tune_start_ns;
+    if (s->tune_bytes < BLOCK_COPY_TUNE_WINDOW || elapsed <= 0) {
+        return;
+    }
+
+    rate = s->tune_bytes * NANOSECONDS_PER_SECOND / elapsed;
+    trace_block_copy_tune_chunk_size(s, block_copy_chunk_size(s), rate);
+
+    if (s->tune_prev_rate && rate < s->tune_prev_rate + s->tune_prev_rate / 8) {
+        s->chunk_shift--;
+        s->chunk_tuned = true;
+    } else if (s->chunk_shift < BLOCK_COPY_MAX_CHUNK_SHIFT) {
+        s->tune_prev_rate = rate;
+        s->chunk_shift++;
+    } else {
+        s->chunk_tuned = true;
+    }
+
+    /* Start a new window with the next completed task */
+    s->tune_start_ns = 0;
+}
+
 /*
  * Search for the first dirty area in offset/bytes range and create task at
  * the beginning of it.
@@ -306,6 +386,7 @@ void block_copy_set_copy_opts(BlockCopyState *s, bool use_copy_range,
          */
         s->method = use_copy_range ? COPY_RANGE_SMALL : COPY_READ_WRITE;
     }
+    block_copy_reset_chunk_tuning(s);
 }
 
 static int64_t block_copy_calculate_cluster_size(BlockDriverState *target,
@@ -564,7 +645,13 @@ static coroutine_fn int block_copy_task_entry(AioTask *task)
 
     WITH_QEMU_LOCK_GUARD(&s->lock) {
         if (s->method == t->method) {
-            s->method = method;
+            if (s->method != method) {
+                s->method = method;
+                block_copy_reset_chunk_tuning(s);
+            } else if (ret >= 0 && (method == COPY_READ_WRITE ||
+                                    method == COPY_RANGE_FULL)) {
+                block_copy_tune_chunk_size(s, t->req.bytes);
+            }
         }
 
         if (ret < 0) {
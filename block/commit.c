@@ -15,6 +15,7 @@
 #include "qemu/osdep.h"
 #include "qemu/cutils.h"
 #include "trace.h"
+#include "block/aio_task.h"
 #include "block/block_int.h"
 #include "block/blockjob_int.h"
 #include "qapi/error.h"
@@ -29,8 +30,26 @@ enum {
      * contiguous regions of the image is efficient.
      */
     COMMIT_BUFFER_SIZE = 512 * 1024, /* in bytes */
+
+    /*
+     * The buffer size doubles up to this while allocated extents are longer
+     * than a buffer, and halves back towards COMMIT_BUFFER_SIZE when they are
+     * not.
+     */
+    COMMIT_MAX_BUFFER_SIZE = 8 * 1024 * 1024, /* in bytes */
+
+    /* Number of buffers copied in parallel */
+    COMMIT_MAX_WORKERS = 8,
 };
 
+typedef struct CommitFailedRange {
+    int64_t offset;
+    int64_t bytes;
+    int ret;
+    bool error_in_source;
+    QSIMPLEQ_ENTRY(CommitFailedRange) next;
+} CommitFailedRange;
+
 typedef struct CommitBlockJob {
     BlockJob common;
     BlockDriverState *commit_top_bs;
@@ -42,8 +61,17 @@ typedef struct CommitBlockJob {
     bool base_read_only;
     bool chain_frozen;
     char *backing_file_str;
+    /* Ranges whose copy failed, handled by the job coroutine */
+    QSIMPLEQ_HEAD(, CommitFailedRange) failed;
 } CommitBlockJob;
 
+typedef struct CommitTask {
+    AioTask task;
+    CommitBlockJob *s;
+    int64_t offset;
+    int64_t bytes;
+} CommitTask;
+
 static int commit_prepare(Job *job)
 {
     CommitBlockJob *s = container_of(job, CommitBlockJob, common.job);
@@ -112,13 +140,114 @@ static void commit_clean(Job *job)
     blk_unref(s->top);
 }
 
+static int coroutine_fn commit_copy(CommitBlockJob *s, int64_t offset,
+                                    int64_t bytes, bool *error_in_source)
+{
+    QEMU_AUTO_VFREE void *buf = NULL;
+    int ret;
+
+    assert(bytes < SIZE_MAX);
+    buf = blk_blockalign(s->top, bytes);
+
+    *error_in_source = true;
+    ret = blk_co_pread(s->top, offset, bytes, buf, 0);
+    if (ret >= 0) {
+        ret = blk_co_pwrite(s->base, offset, bytes, buf, 0);
+        if (ret < 0) {
+            *error_in_source = false;
+        }
+    }
+    return ret;
+}
+
+static void commit_add_failed(CommitBlockJob *s, int64_t offset,
+                              int64_t bytes, int ret, bool error_in_source)
+{
+    CommitFailedRange *f = g_new(CommitFailedRange, 1);
+
+    *f = (CommitFailedRange) {
+        .offset          = offset,
+        .bytes           = bytes,
+        .ret             = ret,
+        .error_in_source = error_in_source,
+    };
+    QSIMPLEQ_INSERT_TAIL(&s->failed, f, next);
+}
+
+static int coroutine_fn commit_task_entry(AioTask *task)
+{
+    CommitTask *t = container_of(task, CommitTask, task);
+    CommitBlockJob *s = t->s;
+    bool error_in_source;
+    int ret;
+
+    ret = commit_copy(s, t->offset, t->bytes, &error_in_source);
+    if (ret < 0) {
+        commit_add_failed(s, t->offset, t->bytes, ret, error_in_source);
+        /* Errors are handled by the job, do not let the pool fail */
+        return 0;
+    }
+
+    job_progress_update(&s->common.job, t->bytes);
+    return 0;
+}
+
+/*
+ * Apply the on_error policy to the ranges whose copy failed, retrying them
+ * one at a time like the sequential loop did.  Returns the error to fail the
+ * job with, or 0 to go on.
+ */
+static int coroutine_fn commit_handle_failures(CommitBlockJob *s)
+{
+    CommitFailedRange *f;
+    int ret = 0;
+
+    while (ret == 0 && (f = QSIMPLEQ_FIRST(&s->failed))) {
+        QSIMPLEQ_REMOVE_HEAD(&s->failed, next);
+
+        while (f->ret < 0) {
+            BlockErrorAction action =
+                block_job_error_action(&s->common, s->on_error,
+                                       f->error_in_source, -f->ret);
+            if (action == BLOCK_ERROR_ACTION_REPORT) {
+                ret = f->ret;
+                break;
+            }
+
+            block_job_ratelimit_sleep(&s->common);
+            if (job_is_cancelled(&s->common.job)) {
+                break;
+            }
+            f->ret = commit_copy(s, f->offset, f->bytes, &f->error_in_source);
+            if (f->ret >= 0) {
+                job_progress_update(&s->common.job, f->bytes);
+                block_job_ratelimit_processed_bytes(&s->common, f->bytes);
+            }
+        }
+        g_free(f);
+    }
+
+    return ret;
+}
+
+static void commit_free_failures(CommitBlockJob *s)
+{
+    while (!QSIMPLEQ_EMPTY(&s->failed)) {
+        CommitFailedRange *f = QSIMPLEQ_FIRST(&s->failed);
+
+        QSIMPLEQ_REMOVE_HEAD(&s->failed, next);
+        g_free(f);
+    }
+}
+
 static int coroutine_fn commit_run(Job *job, Error **errp)
 {
     CommitBlockJob *s = container_of(job, CommitBlockJob, common.job);
+    AioTaskPool *pool;
     int64_t offset;
+    int64_t chunk = COMMIT_BUFFER_SIZE;
     int ret = 0;
     int64_t n = 0; /* bytes */
-    QEMU_AUTO_VFREE void *buf = NULL;
     int64_t len, base_len;
 
     len = blk_co_getlength(s->top);
@@ -139,55 +268,66 @@ static int coroutine_fn commit_run(Job *job, Error **errp)
         }
     }
 
-    buf = blk_blockalign(s->top, COMMIT_BUFFER_SIZE);
+    QSIMPLEQ_INIT(&s->failed);
+    pool = aio_task_pool_new(COMMIT_MAX_WORKERS);
 
     for (offset = 0; offset < len; offset += n) {
-        bool copy;
-        bool error_in_source = true;
-
         /* Note that even when no rate limit is applied we need to yield
-         * with no pending I/O here so that bdrv_drain_all() returns.
+         * here so that bdrv_drain_all() returns.
          */
         block_job_ratelimit_sleep(&s->common);
         if (job_is_cancelled(&s->common.job)) {
             break;
         }
+
+        if (!QSIMPLEQ_EMPTY(&s->failed)) {
+            aio_task_pool_wait_all(pool);
+            ret = commit_handle_failures(s);
+            if (ret < 0 || job_is_cancelled(&s->common.job)) {
+                break;
+            }
+        }
+
         /* Copy if allocated above the base */
         ret = blk_co_is_allocated_above(s->top, s->base_overlay, true,
-                                        offset, COMMIT_BUFFER_SIZE, &n);
-        copy = (ret > 0);
+                                        offset, chunk, &n);
         trace_commit_one_iteration(s, offset, n, ret);
-        if (copy) {
-            assert(n < SIZE_MAX);
-
-            ret = blk_co_pread(s->top, offset, n, buf, 0);
-            if (ret >= 0) {
-                ret = blk_co_pwrite(s->base, offset, n, buf, 0);
-                if (ret < 0) {
-                    error_in_source = false;
-                }
-            }
-        }
         if (ret < 0) {
-            BlockErrorAction action =
-                block_job_error_action(&s->common, s->on_error,
-                                       error_in_source, -ret);
-            if (action == BLOCK_ERROR_ACTION_REPORT) {
-                return ret;
-            } else {
-                n = 0;
-                continue;
+            n = MIN(chunk, len - offset);
+            commit_add_failed(s, offset, n, ret, true);
+        } else if (ret > 0) {
+            CommitTask *t = g_new(CommitTask, 1);
+
+            *t = (CommitTask) {
+                .task.func = commit_task_entry,
+                .s         = s,
+                .offset    = offset,
+                .bytes     = n,
+            };
+            aio_task_pool_start_task(pool, &t->task);
+            block_job_ratelimit_processed_bytes(&s->common, n);
+
+            /* Long allocated extents: copy them in larger buffers */
+            if (n == chunk) {
+                chunk = MIN(chunk * 2, COMMIT_MAX_BUFFER_SIZE);
+            } else if (n < chunk / 2) {
+                chunk = MAX(chunk / 2, COMMIT_BUFFER_SIZE);
             }
+        } else {
+            /* Publish progress */
+            job_progress_update(&s->common.job, n);
         }
-        /* Publish progress */
-        job_progress_update(&s->common.job, n);
+        ret = 0;
+    }
 
-        if (copy) {
-            block_job_ratelimit_processed_bytes(&s->common, n);
-        }
+    aio_task_pool_wait_all(pool);
+    aio_task_pool_free(pool);
+    if (ret == 0 && !job_is_cancelled(&s->common.job)) {
+        ret = commit_handle_failures(s);
     }
+    commit_free_failures(s);
 
-    return 0;
+    return ret;
 }
 
 static const BlockJobDriver commit_job_driver = {
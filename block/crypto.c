@@ -21,7 +21,9 @@
 #include "qemu/osdep.h"
 
 #include "block/block_int.h"
+#include "block/aio_task.h"
 #include "block/qdict.h"
+#include "block/thread-pool.h"
 #include "sysemu/block-backend.h"
 #include "crypto/block.h"
 #include "qapi/opts-visitor.h"
@@ -36,9 +38,24 @@
 
 typedef struct BlockCrypto BlockCrypto;
 
+/*
+ * Requests from this size on are encrypted/decrypted in the thread pool,
+ * split into up to BLOCK_CRYPTO_MAX_THREADS slices that run in parallel.
+ * Below it, the round trip to a worker costs more than the cipher itself.
+ */
+#define BLOCK_CRYPTO_OFFLOAD_MIN (64 * 1024)
+#define BLOCK_CRYPTO_MAX_THREADS 4
+
+/* Number of idle bounce buffers kept around for reuse */
+#define BLOCK_CRYPTO_BOUNCE_POOL 8
+
 struct BlockCrypto {
     QCryptoBlock *block;
     bool updating_keys;
+
+    QemuMutex bounce_lock;
+    void *bounce[BLOCK_CRYPTO_BOUNCE_POOL];
+    int nb_bounce;
 };
 
 
@@ -293,7 +310,8 @@ static int block_crypto_open_generic(QCryptoBlockFormat format,
                                        block_crypto_read_func,
                                        bs,
                                        cflags,
-                                       1,
+                                       MAX(BLOCK_CRYPTO_MAX_THREADS,
+                                           g_get_num_processors()),
                                        errp);
 
     if (!crypto->block) {
@@ -302,6 +320,7 @@ static int block_crypto_open_generic(QCryptoBlockFormat format,
     }
 
     bs->encrypted = true;
+    qemu_mutex_init(&crypto->bounce_lock);
 
     ret = 0;
  cleanup:
@@ -378,6 +397,11 @@ block_crypto_co_truncate(BlockDriverState *bs, int64_t offset, bool exact,
 static void block_crypto_close(BlockDriverState *bs)
 {
     BlockCrypto *crypto = bs->opaque;
+
+    while (crypto->nb_bounce) {
+        qemu_vfree(crypto->bounce[--crypto->nb_bounce]);
+    }
+    qemu_mutex_destroy(&crypto->bounce_lock);
     qcrypto_block_free(crypto->block);
 }
 
@@ -394,6 +418,111 @@ static int block_crypto_reopen_prepare(BDRVReopenState *state,
  */
 #define BLOCK_CRYPTO_MAX_IO_SIZE (1024 * 1024)
 
+static void *block_crypto_get_bounce(BlockDriverState *bs)
+{
+    BlockCrypto *crypto = bs->opaque;
+    void *buf = NULL;
+
+    qemu_mutex_lock(&crypto->bounce_lock);
+    if (crypto->nb_bounce) {
+        buf = crypto->bounce[--crypto->nb_bounce];
+    }
+    qemu_mutex_unlock(&crypto->bounce_lock);
+
+    return buf ?: qemu_try_blockalign(bs->file->bs, BLOCK_CRYPTO_MAX_IO_SIZE);
+}
+
+static void block_crypto_put_bounce(BlockDriverState *bs, void *buf)
+{
+    BlockCrypto *crypto = bs->opaque;
+
+    if (!buf) {
+        return;
+    }
+    qemu_mutex_lock(&crypto->bounce_lock);
+    if (crypto->nb_bounce < BLOCK_CRYPTO_BOUNCE_POOL) {
+        crypto->bounce[crypto->nb_bounce++] = buf;
+        buf = NULL;
+    }
+    qemu_mutex_unlock(&crypto->bounce_lock);
+    qemu_vfree(buf);
+}
+
+typedef struct BlockCryptoTask {
+    AioTask task;
+    QCryptoBlock *block;
+    uint64_t offset;
+    uint8_t *buf;
+    size_t len;
+    bool encrypt;
+} BlockCryptoTask;
+
+static int block_crypto_encdec_func(void *opaque)
+{
+    BlockCryptoTask *t = opaque;
+    int ret;
+
+    if (t->encrypt) {
+        ret = qcrypto_block_encrypt(t->block, t->offset, t->buf, t->len, NULL);
+    } else {
+        ret = qcrypto_block_decrypt(t->block, t->offset, t->buf, t->len, NULL);
+    }
+    return ret < 0 ? -EIO : 0;
+}
+
+static int coroutine_fn block_crypto_encdec_task_entry(AioTask *task)
+{
+    return thread_pool_submit_co(block_crypto_encdec_func,
+                                 container_of(task, BlockCryptoTask, task));
+}
+
+/*
+ * Encrypt or decrypt @len bytes of @buf in place; @offset is the guest
+ * offset of the data, which determines the IVs.
+ */
+static int coroutine_fn
+block_crypto_co_encdec(BlockCrypto *crypto, uint64_t offset, uint8_t *buf,
+                       size_t len, bool encrypt)
+{
+    uint64_t sector_size = qcrypto_block_get_sector_size(crypto->block);
+    BlockCryptoTask t = {
+        .block = crypto->block,
+        .offset = offset,
+        .buf = buf,
+        .len = len,
+        .encrypt = encrypt,
+    };
+    AioTaskPool *pool;
+    size_t slice, done, cur;
+    int ret;
+
+    if (len < BLOCK_CRYPTO_OFFLOAD_MIN) {
+        return block_crypto_encdec_func(&t);
+    }
+
+    slice = QEMU_ALIGN_UP(DIV_ROUND_UP(len, BLOCK_CRYPTO_MAX_THREADS),
+                          sector_size);
+    slice = MAX(slice, BLOCK_CRYPTO_OFFLOAD_MIN);
+
+    pool = aio_task_pool_new(BLOCK_CRYPTO_MAX_THREADS);
+    for (done = 0; done < len && !aio_task_pool_status(pool); done += cur) {
+        BlockCryptoTask *task = g_new(BlockCryptoTask, 1);
+
+        cur = MIN(slice, len - done);
+        *task = t;
+        task->task.func = block_crypto_encdec_task_entry;
+        task->offset = offset + done;
+        task->buf = buf + done;
+        task->len = cur;
+        aio_task_pool_start_task(pool, &task->task);
+    }
+    aio_task_pool_wait_all(pool);
+    ret = aio_task_pool_status(pool);
+    aio_task_pool_free(pool);
+
+    return ret;
+}
+
 static int coroutine_fn GRAPH_RDLOCK
 block_crypto_co_preadv(BlockDriverState *bs, int64_t offset, int64_t bytes,
                        QEMUIOVector *qiov, BdrvRequestFlags flags)
@@ -416,9 +545,7 @@ block_crypto_co_preadv(BlockDriverState *bs, int64_t offset, int64_t bytes,
     /* Bounce buffer because we don't wish to expose cipher text
      * in qiov which points to guest memory.
      */
-    cipher_data =
-        qemu_try_blockalign(bs->file->bs, MIN(BLOCK_CRYPTO_MAX_IO_SIZE,
-                                              qiov->size));
+    cipher_data = block_crypto_get_bounce(bs);
     if (cipher_data == NULL) {
         ret = -ENOMEM;
         goto cleanup;
@@ -436,9 +563,9 @@ block_crypto_co_preadv(BlockDriverState *bs, int64_t offset, int64_t bytes,
             goto cleanup;
         }
 
-        if (qcrypto_block_decrypt(crypto->block, offset + bytes_done,
-                                  cipher_data, cur_bytes, NULL) < 0) {
-            ret = -EIO;
+        ret = block_crypto_co_encdec(crypto, offset + bytes_done,
+                                     cipher_data, cur_bytes, false);
+        if (ret < 0) {
             goto cleanup;
         }
 
@@ -450,7 +577,7 @@ block_crypto_co_preadv(BlockDriverState *bs, int64_t offset, int64_t bytes,
 
  cleanup:
     qemu_iovec_destroy(&hd_qiov);
-    qemu_vfree(cipher_data);
+    block_crypto_put_bounce(bs, cipher_data);
 
     return ret;
 }
@@ -480,9 +607,7 @@ block_crypto_co_pwritev(BlockDriverState *bs, int64_t offset, int64_t bytes,
     /* Bounce buffer because we're not permitted to touch
      * contents of qiov - it points to guest memory.
      */
-    cipher_data =
-        qemu_try_blockalign(bs->file->bs, MIN(BLOCK_CRYPTO_MAX_IO_SIZE,
-                                              qiov->size));
+    cipher_data = block_crypto_get_bounce(bs);
     if (cipher_data == NULL) {
         ret = -ENOMEM;
         goto cleanup;
@@ -493,9 +618,9 @@ block_crypto_co_pwritev(BlockDriverState *bs, int64_t offset, int64_t bytes,
 
         qemu_iovec_to_buf(qiov, bytes_done, cipher_data, cur_bytes);
 
-        if (qcrypto_block_encrypt(crypto->block, offset + bytes_done,
-                                  cipher_data, cur_bytes, NULL) < 0) {
-            ret = -EIO;
+        ret = block_crypto_co_encdec(crypto, offset + bytes_done,
+                                     cipher_data, cur_bytes, true);
+        if (ret < 0) {
             goto cleanup;
         }
 
@@ -514,7 +639,7 @@ block_crypto_co_pwritev(BlockDriverState *bs, int64_t offset, int64_t bytes,
 
  cleanup:
     qemu_iovec_destroy(&hd_qiov);
-    qemu_vfree(cipher_data);
+    block_crypto_put_bounce(bs, cipher_data);
 
     return ret;
 }
@@ -48,10 +48,16 @@
                    CURLPROTO_FTP | CURLPROTO_FTPS)
 #endif
 
-#define CURL_NUM_STATES 8
+#define CURL_NUM_STATES 16
 #define CURL_NUM_ACB    8
 #define CURL_TIMEOUT_MAX 10000
 
+/* Upper bound for the readahead window while reads are sequential */
+#define CURL_READAHEAD_MAX (4 * 1024 * 1024)
+
+/* Granularity of the on-disk cache map */
+#define CURL_CACHE_CHUNK (64 * 1024)
+
 #define CURL_BLOCK_OPT_URL       "url"
 #define CURL_BLOCK_OPT_READAHEAD "readahead"
 #define CURL_BLOCK_OPT_SSLVERIFY "sslverify"
@@ -62,6 +68,7 @@
 #define CURL_BLOCK_OPT_PASSWORD_SECRET "password-secret"
 #define CURL_BLOCK_OPT_PROXY_USERNAME "proxy-username"
 #define CURL_BLOCK_OPT_PROXY_PASSWORD_SECRET "proxy-password-secret"
+#define CURL_BLOCK_OPT_CACHE_DIR "cache-dir"
 
 #define CURL_BLOCK_OPT_READAHEAD_DEFAULT (256 * 1024)
 #define CURL_BLOCK_OPT_SSLVERIFY_DEFAULT true
@@ -122,6 +129,13 @@ typedef struct BDRVCURLState {
     char *password;
     char *proxyusername;
     char *proxypassword;
+    char *etag;
+    uint64_t seq_end;       /* end of the last read, to detect streaming */
+    size_t cur_readahead;   /* current readahead window */
+    int cache_fd;           /* -1 if there is no on-disk cache */
+    int cache_map_fd;
+    uint8_t *cache_map;     /* one byte per CURL_CACHE_CHUNK, 1 if cached */
+    uint64_t cache_chunks;
 } BDRVCURLState;
 
 static void curl_clean_state(CURLState *s);
@@ -213,8 +227,22 @@ static size_t curl_header_cb(void *ptr, size_t size, size_t nmemb, void *opaque)
     const char *header = (char *)ptr;
     const char *end = header + realsize;
     const char *accept_ranges = "accept-ranges:";
+    const char *etag = "etag:";
     const char *bytes = "bytes";
 
+    if (realsize > strlen(etag)
+        && g_ascii_strncasecmp(header, etag, strlen(etag)) == 0) {
+        g_autofree char *value = g_strndup(header + strlen(etag),
+                                           realsize - strlen(etag));
+
+        g_free(s->etag);
+        s->etag = g_strdup(g_strstrip(value));
+        if (!*s->etag) {
+            g_free(s->etag);
+            s->etag = NULL;
+        }
+    }
+
     if (realsize >= strlen(accept_ranges)
         && g_ascii_strncasecmp(header, accept_ranges,
                                strlen(accept_ranges)) == 0) {
@@ -328,6 +356,181 @@ static bool curl_find_buf(BDRVCURLState *s, uint64_t start, uint64_t len,
     return false;
 }
 
+/*
+ * The on-disk cache lives in two files named after the SHA-256 of the URL
+ * and the ETag that the server reported: <hash>.data is a sparse copy of
+ * the image and <hash>.map has one byte per CURL_CACHE_CHUNK, set once the
+ * chunk has reached the data file.  Map bytes only ever go from 0 to 1, so
+ * several QEMU processes can share the same cache directory.
+ */
+static int curl_cache_rw(int fd, void *opaque, size_t len, off_t offset,
+                         bool write)
+{
+    uint8_t *buf = opaque;
+
+    while (len) {
+        ssize_t ret = write ? pwrite(fd, buf, len, offset)
+                            : pread(fd, buf, len, offset);
+
+        if (ret < 0 && errno == EINTR) {
+            continue;
+        }
+        if (ret <= 0) {
+            return ret < 0 ? -errno : -EIO;
+        }
+        buf += ret;
+        len -= ret;
+        offset += ret;
+    }
+    return 0;
+}
+
+static void curl_cache_close(BDRVCURLState *s)
+{
+    if (s->cache_fd >= 0) {
+        qemu_close(s->cache_fd);
+    }
+    if (s->cache_map_fd >= 0) {
+        qemu_close(s->cache_map_fd);
+    }
+    s->cache_fd = s->cache_map_fd = -1;
+    g_free(s->cache_map);
+    s->cache_map = NULL;
+}
+
+static void curl_cache_open(BDRVCURLState *s, const char *dir)
+{
+    g_autofree char *key = NULL;
+    g_autofree char *hash = NULL;
+    g_autofree char *path = NULL;
+    Error *local_err = NULL;
+    struct stat st;
+
+    if (!s->etag) {
+        warn_report("curl: server sent no ETag for '%s', not caching it",
+                    s->url);
+        return;
+    }
+
+    key = g_strdup_printf("%s\n%s", s->url, s->etag);
+    hash = g_compute_checksum_for_string(G_CHECKSUM_SHA256, key, -1);
+    s->cache_chunks = DIV_ROUND_UP(s->len, CURL_CACHE_CHUNK);
+
+    path = g_strdup_printf("%s/%s.data", dir, hash);
+    s->cache_fd = qemu_create(path, O_RDWR, 0644, &local_err);
+    if (s->cache_fd < 0) {
+        goto fail;
+    }
+    g_free(path);
+    path = g_strdup_printf("%s/%s.map", dir, hash);
+    s->cache_map_fd = qemu_create(path, O_RDWR, 0644, &local_err);
+    if (s->cache_map_fd < 0) {
+        goto fail;
+    }
+
+    /* Size the files; never shrink them under another user's feet */
+    if (fstat(s->cache_fd, &st) < 0 ||
+        (st.st_size < s->len && ftruncate(s->cache_fd, s->len) < 0) ||
+        fstat(s->cache_map_fd, &st) < 0 ||
+        (st.st_size < s->cache_chunks &&
+         ftruncate(s->cache_map_fd, s->cache_chunks) < 0)) {
+        error_setg_errno(&local_err, errno, "Could not size the cache files");
+        goto fail;
+    }
+
+    s->cache_map = g_malloc0(s->cache_chunks);
+    if (curl_cache_rw(s->cache_map_fd, s->cache_map, s->cache_chunks, 0,
+                      false) < 0) {
+        error_setg(&local_err, "Could not read '%s'", path);
+        goto fail;
+    }
+    trace_curl_cache_open(path, s->cache_chunks);
+    return;
+
+fail:
+    warn_reportf_err(local_err, "curl: not using the cache: ");
+    curl_cache_close(s);
+}
+
+static bool curl_cache_present(BDRVCURLState *s, uint64_t first,
+                               uint64_t last)
+{
+    return !memchr(s->cache_map + first, 0, last - first);
+}
+
+/* Serve @acb from the on-disk cache if possible.  Called with s->mutex held. */
+static bool curl_cache_read(BDRVCURLState *s, CURLAIOCB *acb)
+{
+    uint64_t end = MIN(acb->offset + acb->bytes, s->len);
+    uint64_t first, last;
+    g_autofree void *buf = NULL;
+
+    if (s->cache_fd < 0 || acb->offset >= end) {
+        return false;
+    }
+
+    first = acb->offset / CURL_CACHE_CHUNK;
+    last = DIV_ROUND_UP(end, CURL_CACHE_CHUNK);
+    if (!curl_cache_present(s, first, last)) {
+        /* Another process may have fetched the data in the meantime */
+        if (curl_cache_rw(s->cache_map_fd, s->cache_map + first,
+                          last - first, first, false) < 0 ||
+            !curl_cache_present(s, first, last)) {
+            return false;
+        }
+    }
+
+    buf = g_try_malloc(end - acb->offset);
+    if (!buf || curl_cache_rw(s->cache_fd, buf, end - acb->offset,
+                              acb->offset, false) < 0) {
+        return false;
+    }
+
+    trace_curl_cache_hit(acb->offset, acb->bytes);
+    qemu_iovec_from_buf(acb->qiov, 0, buf, end - acb->offset);
+    if (end - acb->offset < acb->bytes) {
+        qemu_iovec_memset(acb->qiov, end - acb->offset, 0,
+                          acb->bytes - (end - acb->offset));
+    }
+    acb->ret = 0;
+    return true;
+}
+
+/*
+ * Store the chunks that a finished transfer covered completely.  Called with
+ * s->mutex held.
+ */
+static void curl_cache_write(BDRVCURLState *s, CURLState *state)
+{
+    uint64_t start = ROUND_UP(state->buf_start, CURL_CACHE_CHUNK);
+    uint64_t end = state->buf_start + state->buf_off;
+    uint64_t first, last;
+
+    if (end != s->len) {
+        end = ROUND_DOWN(end, CURL_CACHE_CHUNK);
+    }
+    if (s->cache_fd < 0 || start >= end) {
+        return;
+    }
+
+    first = start / CURL_CACHE_CHUNK;
+    last = DIV_ROUND_UP(end, CURL_CACHE_CHUNK);
+    if (curl_cache_present(s, first, last)) {
+        return;
+    }
+
+    /* The data must be stable before the map says it is there */
+    if (curl_cache_rw(s->cache_fd, state->orig_buf + (start - state->buf_start),
+                      end - start, start, true) < 0 ||
+        qemu_fdatasync(s->cache_fd) < 0) {
+        return;
+    }
+    memset(s->cache_map + first, 1, last - first);
+    curl_cache_rw(s->cache_map_fd, s->cache_map + first, last - first, first,
+                  true);
+    trace_curl_cache_store(start, end - start);
+}
+
 /* Called with s->mutex held.  */
 static void curl_multi_check_completion(BDRVCURLState *s)
 {
@@ -394,6 +597,9 @@ static void curl_multi_check_completion(BDRVCURLState *s)
                 qemu_mutex_lock(&s->mutex);
             }
 
+            if (!error) {
+                curl_cache_write(s, state);
+            }
             curl_clean_state(state);
             break;
         }
@@ -490,6 +696,17 @@ static int curl_init_state(BDRVCURLState *s, CURLState *state)
             curl_easy_setopt(state->curl, CURLOPT_FAILONERROR, 1)) {
             goto err;
         }
+#if LIBCURL_VERSION_NUM >= 0x072f00
+        /*
+         * Prefer HTTP/2 so that concurrent range requests are multiplexed
+         * over one connection.  Not fatal if libcurl was built without it.
+         */
+        curl_easy_setopt(state->curl, CURLOPT_HTTP_VERSION,
+                         (long)CURL_HTTP_VERSION_2TLS);
+        if (curl_easy_setopt(state->curl, CURLOPT_PIPEWAIT, 1L)) {
+            goto err;
+        }
+#endif
         if (s->username) {
             if (curl_easy_setopt(state->curl, CURLOPT_USERNAME, s->username)) {
                 goto err;
@@ -616,6 +833,9 @@ static void curl_attach_aio_context(BlockDriverState *bs,
     curl_multi_setopt(s->multi, CURLMOPT_SOCKETFUNCTION, curl_sock_cb);
     curl_multi_setopt(s->multi, CURLMOPT_TIMERDATA, s);
     curl_multi_setopt(s->multi, CURLMOPT_TIMERFUNCTION, curl_timer_cb);
+#ifdef CURLPIPE_MULTIPLEX
+    curl_multi_setopt(s->multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+#endif
 }
 
 static QemuOptsList runtime_opts = {
@@ -672,6 +892,11 @@ static QemuOptsList runtime_opts = {
             .type = QEMU_OPT_STRING,
             .help = "ID of secret used as password for HTTP proxy auth",
         },
+        {
+            .name = CURL_BLOCK_OPT_CACHE_DIR,
+            .type = QEMU_OPT_STRING,
+            .help = "Directory for a persistent cache of the image contents",
+        },
         { /* end of list */ }
     },
 };
@@ -694,6 +919,7 @@ static int curl_open(BlockDriverState *bs, QDict *options, int flags,
 #endif
     const char *secretid;
     const char *protocol_delimiter;
+    const char *cache_dir;
     int ret;
 
     ret = bdrv_apply_auto_read_only(bs, "curl driver does not support writes",
@@ -712,6 +938,7 @@ static int curl_open(BlockDriverState *bs, QDict *options, int flags,
     }
 
     qemu_mutex_init(&s->mutex);
+    s->cache_fd = s->cache_map_fd = -1;
     opts = qemu_opts_create(&runtime_opts, NULL, 0, &error_abort);
     if (!qemu_opts_absorb_qdict(opts, options, errp)) {
         goto out_noclean;
@@ -724,6 +951,7 @@ static int curl_open(BlockDriverState *bs, QDict *options, int flags,
                    s->readahead_size);
         goto out_noclean;
     }
+    s->cur_readahead = s->readahead_size;
 
     s->timeout = qemu_opt_get_number(opts, CURL_BLOCK_OPT_TIMEOUT,
                                      CURL_BLOCK_OPT_TIMEOUT_DEFAULT);
@@ -858,6 +1086,11 @@ static int curl_open(BlockDriverState *bs, QDict *options, int flags,
     }
     trace_curl_open_size(s->len);
 
+    cache_dir = qemu_opt_get(opts, CURL_BLOCK_OPT_CACHE_DIR);
+    if (cache_dir) {
+        curl_cache_open(s, cache_dir);
+    }
+
     qemu_mutex_lock(&s->mutex);
     curl_clean_state(state);
     qemu_mutex_unlock(&s->mutex);
@@ -880,6 +1113,7 @@ out_noclean:
     g_free(s->username);
     g_free(s->proxyusername);
     g_free(s->proxypassword);
+    g_free(s->etag);
     if (s->sockets) {
         curl_drop_all_sockets(s->sockets);
         g_hash_table_destroy(s->sockets);
@@ -900,9 +1134,19 @@ static void coroutine_fn curl_setup_preadv(BlockDriverState *bs, CURLAIOCB *acb)
 
     qemu_mutex_lock(&s->mutex);
 
+    /* Grow the readahead window for as long as the guest streams */
+    if (start == s->seq_end) {
+        s->cur_readahead = MIN(s->cur_readahead * 2,
+                               MAX(s->readahead_size, CURL_READAHEAD_MAX));
+    } else {
+        s->cur_readahead = s->readahead_size;
+    }
+    s->seq_end = start + acb->bytes;
+
     // In case we have the requested data already (e.g. read-ahead),
     // we can just call the callback and be done.
-    if (curl_find_buf(s, start, acb->bytes, acb)) {
+    if (curl_find_buf(s, start, acb->bytes, acb) ||
+        curl_cache_read(s, acb)) {
         goto out;
     }
 
@@ -927,7 +1171,7 @@ static void coroutine_fn curl_setup_preadv(BlockDriverState *bs, CURLAIOCB *acb)
     state->buf_off = 0;
     g_free(state->orig_buf);
     state->buf_start = start;
-    state->buf_len = MIN(acb->end + s->readahead_size, s->len - start);
+    state->buf_len = MIN(acb->end + s->cur_readahead, s->len - start);
     end = start + state->buf_len - 1;
     state->orig_buf = g_try_malloc(state->buf_len);
     if (state->buf_len && state->orig_buf == NULL) {
@@ -988,6 +1232,8 @@ static void curl_close(BlockDriverState *bs)
     g_free(s->username);
     g_free(s->proxyusername);
     g_free(s->proxypassword);
+    g_free(s->etag);
+    curl_cache_close(s);
 }
 
 static int64_t coroutine_fn curl_co_getlength(BlockDriverState *bs)
@@ -61,9 +61,20 @@ struct BdrvDirtyBitmapIter {
     BdrvDirtyBitmap *bitmap;
 };
 
+/*
+ * Every user of the mutex other than bdrv_set_dirty() may clear bits or
+ * enable bitmaps, so it must forget the known-dirty chunks before it can
+ * do so.
+ */
 static inline void bdrv_dirty_bitmaps_lock(BlockDriverState *bs)
 {
+    int i;
+
     qemu_mutex_lock(&bs->dirty_bitmap_mutex);
+    for (i = 0; i < BDRV_DIRTY_CHUNK_CACHE_SIZE; i++) {
+        qatomic_set(&bs->dirty_chunk_cache[i], 0);
+    }
+    smp_wmb();
 }
 
 static inline void bdrv_dirty_bitmaps_unlock(BlockDriverState *bs)
@@ -653,16 +664,80 @@ void bdrv_dirty_bitmap_deserialize_finish(BdrvDirtyBitmap *bitmap)
     hbitmap_deserialize_finish(bitmap->bitmap);
 }
 
+/*
+ * Whether all of [offset, offset + bytes) lies in chunks known to be dirty
+ * in every enabled bitmap.  A hit is as good as setting the bits: anyone
+ * who clears them afterwards emptied the cache first, and so also comes
+ * after the write that is being recorded.
+ */
+static bool bdrv_dirty_chunks_cached(BlockDriverState *bs, int64_t offset,
+                                     int64_t bytes)
+{
+    uint64_t first = offset >> BDRV_DIRTY_CHUNK_BITS;
+    uint64_t last = (offset + bytes - 1) >> BDRV_DIRTY_CHUNK_BITS;
+    uint64_t chunk;
+
+    if (!bytes || last - first >= BDRV_DIRTY_CHUNK_CACHE_SIZE) {
+        return false;
+    }
+
+    /* Order the completed write before the lookup */
+    smp_mb();
+    for (chunk = first; chunk <= last; chunk++) {
+        if (qatomic_read(&bs->dirty_chunk_cache[chunk %
+                                                BDRV_DIRTY_CHUNK_CACHE_SIZE])
+            != chunk + 1) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Called with dirty_bitmap_mutex held, after setting the range */
+static void bdrv_dirty_chunks_fill(BlockDriverState *bs, int64_t offset,
+                                   int64_t bytes)
+{
+    uint64_t first = offset >> BDRV_DIRTY_CHUNK_BITS;
+    uint64_t last = (offset + bytes - 1) >> BDRV_DIRTY_CHUNK_BITS;
+    BdrvDirtyBitmap *bitmap;
+    uint64_t chunk;
+
+    if (!bytes || last - first >= BDRV_DIRTY_CHUNK_CACHE_SIZE) {
+        return;
+    }
+
+    for (chunk = first; chunk <= last; chunk++) {
+        int64_t start = chunk << BDRV_DIRTY_CHUNK_BITS;
+
+        QLIST_FOREACH(bitmap, &bs->dirty_bitmaps, list) {
+            int64_t len = MIN(1 << BDRV_DIRTY_CHUNK_BITS,
+                              bitmap->size - start);
+
+            if (bdrv_dirty_bitmap_enabled(bitmap) && len > 0 &&
+                hbitmap_next_zero(bitmap->bitmap, start, len) >= 0) {
+                break;
+            }
+        }
+        if (!bitmap) {
+            qatomic_set(&bs->dirty_chunk_cache[chunk %
+                                               BDRV_DIRTY_CHUNK_CACHE_SIZE],
+                        chunk + 1);
+        }
+    }
+}
+
 void bdrv_set_dirty(BlockDriverState *bs, int64_t offset, int64_t bytes)
 {
     BdrvDirtyBitmap *bitmap;
     IO_CODE();
 
-    if (QLIST_EMPTY(&bs->dirty_bitmaps)) {
+    if (QLIST_EMPTY(&bs->dirty_bitmaps) ||
+        bdrv_dirty_chunks_cached(bs, offset, bytes)) {
         return;
     }
 
-    bdrv_dirty_bitmaps_lock(bs);
+    /* Not bdrv_dirty_bitmaps_lock(), which would empty the cache */
+    qemu_mutex_lock(&bs->dirty_bitmap_mutex);
     QLIST_FOREACH(bitmap, &bs->dirty_bitmaps, list) {
         if (!bdrv_dirty_bitmap_enabled(bitmap)) {
             continue;
@@ -670,6 +745,7 @@ void bdrv_set_dirty(BlockDriverState *bs, int64_t offset, int64_t bytes)
         assert(!bdrv_dirty_bitmap_readonly(bitmap));
         hbitmap_set(bitmap->bitmap, offset, bytes);
     }
+    bdrv_dirty_chunks_fill(bs, offset, bytes);
     bdrv_dirty_bitmaps_unlock(bs);
 }
 
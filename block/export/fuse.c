@@ -27,8 +27,10 @@
 #include "block/qapi.h"
 #include "qapi/error.h"
 #include "qapi/qapi-commands-block.h"
+#include "qemu/coroutine.h"
 #include "qemu/main-loop.h"
 #include "sysemu/block-backend.h"
+#include "sysemu/iothread.h"
 
 #include <fuse.h>
 #include <fuse_lowlevel.h>
@@ -44,15 +46,43 @@
 /* Prevent overly long bounce buffer allocations */
 #define FUSE_MAX_BOUNCE_BYTES (MIN(BDRV_REQUEST_MAX_BYTES, 64 * 1024 * 1024))
 
+/* Request buffers kept for reuse per queue */
+#define FUSE_MAX_FREE_BUFS 16
 
-typedef struct FuseExport {
+
+typedef struct FuseExport FuseExport;
+
+/*
+ * The FUSE session fd is read from in the AioContext of every queue.  Queue 0
+ * runs in the export's AioContext, the others in the IOThreads given with
+ * the queue-iothreads option.
+ */
+typedef struct FuseQueue {
+    FuseExport *exp;
+    AioContext *ctx;
+
+    /* Request buffers allocated by libfuse; only accessed from @ctx */
+    GSList *free_bufs;
+    unsigned int nr_free_bufs;
+} FuseQueue;
+
+typedef struct FuseRequest {
+    FuseQueue *q;
+    struct fuse_buf buf;
+} FuseRequest;
+
+struct FuseExport {
     BlockExport common;
 
     struct fuse_session *fuse_session;
-    struct fuse_buf fuse_buf;
     unsigned int in_flight; /* atomic */
+    bool quiesced; /* atomic, set while drained */
     bool mounted, fd_handler_set_up;
 
+    FuseQueue *queues;
+    int nr_queues;
+    IOThread **iothreads;
+
     char *mountpoint;
     bool writable;
     bool growable;
@@ -62,7 +92,7 @@ typedef struct FuseExport {
     mode_t st_mode;
     uid_t st_uid;
     gid_t st_gid;
-} FuseExport;
+};
 
 static GHashTable *exports;
 static const struct fuse_lowlevel_ops fuse_ops;
@@ -79,14 +109,32 @@ static void read_from_fuse_export(void *opaque);
 static bool is_regular_file(const char *path, Error **errp);
 
 
+static void fuse_export_set_fd_handlers(FuseExport *exp, bool enable)
+{
+    int fd = fuse_session_fd(exp->fuse_session);
+    int i;
+
+    for (i = 0; i < exp->nr_queues; i++) {
+        aio_set_fd_handler(exp->queues[i].ctx, fd,
+                           enable ? read_from_fuse_export : NULL,
+                           NULL, NULL, NULL, &exp->queues[i]);
+    }
+    exp->fd_handler_set_up = enable;
+}
+
 static void fuse_export_drained_begin(void *opaque)
 {
     FuseExport *exp = opaque;
 
-    aio_set_fd_handler(exp->common.ctx,
-                       fuse_session_fd(exp->fuse_session),
-                       NULL, NULL, NULL, NULL, NULL);
-    exp->fd_handler_set_up = false;
+    /*
+     * Handlers in other IOThreads may be running concurrently; they check
+     * this after raising in_flight, so fuse_export_drained_poll() either
+     * waits for them or they drop the request.
+     */
+    qatomic_set(&exp->quiesced, true);
+    smp_mb();
+
+    fuse_export_set_fd_handlers(exp, false);
 }
 
 static void fuse_export_drained_end(void *opaque)
@@ -95,11 +143,10 @@ static void fuse_export_drained_end(void *opaque)
 
     /* Refresh AioContext in case it changed */
     exp->common.ctx = blk_get_aio_context(exp->common.blk);
+    exp->queues[0].ctx = exp->common.ctx;
 
-    aio_set_fd_handler(exp->common.ctx,
-                       fuse_session_fd(exp->fuse_session),
-                       read_from_fuse_export, NULL, NULL, NULL, exp);
-    exp->fd_handler_set_up = true;
+    qatomic_set(&exp->quiesced, false);
+    fuse_export_set_fd_handlers(exp, true);
 }
 
 static bool fuse_export_drained_poll(void *opaque)
@@ -121,10 +168,39 @@ static int fuse_export_create(BlockExport *blk_exp,
 {
     FuseExport *exp = container_of(blk_exp, FuseExport, common);
     BlockExportOptionsFuse *args = &blk_exp_args->u.fuse;
+    strList *iothreads;
+    int max_queues = 1;
     int ret;
 
     assert(blk_exp_args->type == BLOCK_EXPORT_TYPE_FUSE);
 
+    for (iothreads = args->queue_iothreads; iothreads;
+         iothreads = iothreads->next) {
+        max_queues++;
+    }
+    exp->queues = g_new0(FuseQueue, max_queues);
+    exp->iothreads = g_new0(IOThread *, max_queues);
+    exp->queues[exp->nr_queues++] = (FuseQueue) {
+        .exp = exp,
+        .ctx = exp->common.ctx,
+    };
+    for (iothreads = args->queue_iothreads; iothreads;
+         iothreads = iothreads->next) {
+        IOThread *iothread = iothread_by_id(iothreads->value);
+
+        if (!iothread) {
+            error_setg(errp, "iothread \"%s\" not found", iothreads->value);
+            ret = -EINVAL;
+            goto fail;
+        }
+        object_ref(OBJECT(iothread));
+        exp->iothreads[exp->nr_queues] = iothread;
+        exp->queues[exp->nr_queues++] = (FuseQueue) {
+            .exp = exp,
+            .ctx = iothread_get_aio_context(iothread),
+        };
+    }
+
     /* For growable and writable exports, take the RESIZE permission */
     if (args->growable || blk_exp_args->writable) {
         uint64_t blk_perm, blk_shared_perm;
@@ -134,7 +210,7 @@ static int fuse_export_create(BlockExport *blk_exp,
         ret = blk_set_perm(exp->common.blk, blk_perm | BLK_PERM_RESIZE,
                            blk_shared_perm, errp);
         if (ret < 0) {
-            return ret;
+            goto fail;
         }
     }
 
@@ -269,10 +345,18 @@ static int setup_fuse_export(FuseExport *exp, const char *mountpoint,
 
     g_hash_table_insert(exports, g_strdup(mountpoint), NULL);
 
-    aio_set_fd_handler(exp->common.ctx,
-                       fuse_session_fd(exp->fuse_session),
-                       read_from_fuse_export, NULL, NULL, NULL, exp);
-    exp->fd_handler_set_up = true;
+    /*
+     * All queues wait for the same fd; the ones that lose the race for a
+     * request must not block.
+     */
+    if (!g_unix_set_fd_nonblocking(fuse_session_fd(exp->fuse_session), true,
+                                   NULL)) {
+        error_setg_errno(errp, errno, "Failed to make FUSE fd non-blocking");
+        ret = -errno;
+        goto fail;
+    }
+
+    fuse_export_set_fd_handlers(exp, true);
 
     return 0;
 
@@ -281,34 +365,85 @@ fail:
     return ret;
 }
 
+static void fuse_request_free(FuseRequest *r)
+{
+    FuseQueue *q = r->q;
+
+    if (r->buf.mem && q->nr_free_bufs < FUSE_MAX_FREE_BUFS) {
+        q->free_bufs = g_slist_prepend(q->free_bufs, r->buf.mem);
+        q->nr_free_bufs++;
+    } else {
+        free(r->buf.mem);
+    }
+    g_free(r);
+}
+
+static void fuse_export_request_done(FuseExport *exp)
+{
+    if (qatomic_fetch_dec(&exp->in_flight) == 1) {
+        aio_wait_kick(); /* wake AIO_WAIT_WHILE() */
+    }
+
+    blk_exp_unref(&exp->common);
+}
+
+/*
+ * Process one request.  The fuse_lowlevel_ops callbacks run in this
+ * coroutine, so a queue can have many requests in flight.
+ */
+static void coroutine_fn co_fuse_process_request(void *opaque)
+{
+    FuseRequest *r = opaque;
+    FuseExport *exp = r->q->exp;
+
+    fuse_session_process_buf(exp->fuse_session, &r->buf);
+
+    fuse_request_free(r);
+    fuse_export_request_done(exp);
+}
+
 /**
  * Callback to be invoked when the FUSE session FD can be read from.
  * (This is basically the FUSE event loop.)
  */
 static void read_from_fuse_export(void *opaque)
 {
-    FuseExport *exp = opaque;
+    FuseQueue *q = opaque;
+    FuseExport *exp = q->exp;
+    FuseRequest *r;
+    Coroutine *co;
     int ret;
 
     blk_exp_ref(&exp->common);
 
     qatomic_inc(&exp->in_flight);
 
-    do {
-        ret = fuse_session_receive_buf(exp->fuse_session, &exp->fuse_buf);
-    } while (ret == -EINTR);
-    if (ret < 0) {
-        goto out;
+    /* Pairs with smp_mb() in fuse_export_drained_begin() */
+    if (qatomic_read(&exp->quiesced)) {
+        fuse_export_request_done(exp);
+        return;
     }
 
-    fuse_session_process_buf(exp->fuse_session, &exp->fuse_buf);
+    r = g_new0(FuseRequest, 1);
+    r->q = q;
+    if (q->free_bufs) {
+        r->buf.mem = q->free_bufs->data;
+        q->free_bufs = g_slist_delete_link(q->free_bufs, q->free_bufs);
+        q->nr_free_bufs--;
+    }
 
-out:
-    if (qatomic_fetch_dec(&exp->in_flight) == 1) {
-        aio_wait_kick(); /* wake AIO_WAIT_WHILE() */
+    do {
+        ret = fuse_session_receive_buf(exp->fuse_session, &r->buf);
+    } while (ret == -EINTR);
+    if (ret <= 0) {
+        /* -EAGAIN if another queue took the request */
+        fuse_request_free(r);
+        fuse_export_request_done(exp);
+        return;
     }
 
-    blk_exp_unref(&exp->common);
+    co = qemu_coroutine_create(co_fuse_process_request, r);
+    qemu_coroutine_enter(co);
 }
 
 static void fuse_export_shutdown(BlockExport *blk_exp)
@@ -319,10 +454,7 @@ static void fuse_export_shutdown(BlockExport *blk_exp)
         fuse_session_exit(exp->fuse_session);
 
         if (exp->fd_handler_set_up) {
-            aio_set_fd_handler(exp->common.ctx,
-                               fuse_session_fd(exp->fuse_session),
-                               NULL, NULL, NULL, NULL, NULL);
-            exp->fd_handler_set_up = false;
+            fuse_export_set_fd_handlers(exp, false);
         }
     }
 
@@ -338,6 +470,7 @@ static void fuse_export_shutdown(BlockExport *blk_exp)
 static void fuse_export_delete(BlockExport *blk_exp)
 {
     FuseExport *exp = container_of(blk_exp, FuseExport, common);
+    int i;
 
     if (exp->fuse_session) {
         if (exp->mounted) {
@@ -347,7 +480,14 @@ static void fuse_export_delete(BlockExport *blk_exp)
         fuse_session_destroy(exp->fuse_session);
     }
 
-    free(exp->fuse_buf.mem);
+    for (i = 0; i < exp->nr_queues; i++) {
+        g_slist_free_full(exp->queues[i].free_bufs, free);
+        if (exp->iothreads[i]) {
+            object_unref(OBJECT(exp->iothreads[i]));
+        }
+    }
+    g_free(exp->queues);
+    g_free(exp->iothreads);
     g_free(exp->mountpoint);
 }
 
@@ -403,21 +543,24 @@ static void fuse_lookup(fuse_req_t req, fuse_ino_t parent, const char *name)
 /**
  * Let clients get file attributes (i.e., stat() the file).
  */
-static void fuse_getattr(fuse_req_t req, fuse_ino_t inode,
-                         struct fuse_file_info *fi)
+static void coroutine_fn
+fuse_getattr(fuse_req_t req, fuse_ino_t inode, struct fuse_file_info *fi)
 {
     struct stat statbuf;
     int64_t length, allocated_blocks;
     time_t now = time(NULL);
     FuseExport *exp = fuse_req_userdata(req);
 
-    length = blk_getlength(exp->common.blk);
+    length = blk_co_getlength(exp->common.blk);
     if (length < 0) {
         fuse_reply_err(req, -length);
         return;
     }
 
-    allocated_blocks = bdrv_get_allocated_file_size(blk_bs(exp->common.blk));
+    WITH_GRAPH_RDLOCK_GUARD() {
+        allocated_blocks =
+            bdrv_co_get_allocated_file_size(blk_bs(exp->common.blk));
+    }
     if (allocated_blocks <= 0) {
         allocated_blocks = DIV_ROUND_UP(length, 512);
     } else {
@@ -441,8 +584,9 @@ static void fuse_getattr(fuse_req_t req, fuse_ino_t inode,
     fuse_reply_attr(req, &statbuf, 1.);
 }
 
-static int fuse_do_truncate(const FuseExport *exp, int64_t size,
-                            bool req_zero_write, PreallocMode prealloc)
+static int coroutine_fn
+fuse_do_truncate(const FuseExport *exp, int64_t size, bool req_zero_write,
+                 PreallocMode prealloc)
 {
     uint64_t blk_perm, blk_shared_perm;
     BdrvRequestFlags truncate_flags = 0;
@@ -472,7 +616,7 @@ static int fuse_do_truncate(const FuseExport *exp, int64_t size,
         }
     }
 
-    ret = blk_truncate(exp->common.blk, size, true, prealloc,
+    ret = blk_co_truncate(exp->common.blk, size, true, prealloc,
                        truncate_flags, NULL);
 
     if (add_resize_perm) {
@@ -493,8 +637,9 @@ static int fuse_do_truncate(const FuseExport *exp, int64_t size,
  * without allow_other cannot be given a different UID or GID, and
  * they cannot be given non-owner access.
  */
-static void fuse_setattr(fuse_req_t req, fuse_ino_t inode, struct stat *statbuf,
-                         int to_set, struct fuse_file_info *fi)
+static void coroutine_fn
+fuse_setattr(fuse_req_t req, fuse_ino_t inode, struct stat *statbuf, int to_set,
+             struct fuse_file_info *fi)
 {
     FuseExport *exp = fuse_req_userdata(req);
     int supported_attrs;
@@ -573,8 +718,9 @@ static void fuse_open(fuse_req_t req, fuse_ino_t inode,
 /**
  * Handle client reads from the exported image.
  */
-static void fuse_read(fuse_req_t req, fuse_ino_t inode,
-                      size_t size, off_t offset, struct fuse_file_info *fi)
+static void coroutine_fn
+fuse_read(fuse_req_t req, fuse_ino_t inode, size_t size, off_t offset,
+          struct fuse_file_info *fi)
 {
     FuseExport *exp = fuse_req_userdata(req);
     int64_t length;
@@ -591,7 +737,7 @@ static void fuse_read(fuse_req_t req, fuse_ino_t inode,
      * Clients will expect short reads at EOF, so we have to limit
      * offset+size to the image length.
      */
-    length = blk_getlength(exp->common.blk);
+    length = blk_co_getlength(exp->common.blk);
     if (length < 0) {
         fuse_reply_err(req, -length);
         return;
@@ -607,7 +753,7 @@ static void fuse_read(fuse_req_t req, fuse_ino_t inode,
         return;
     }
 
-    ret = blk_pread(exp->common.blk, offset, size, buf, 0);
+    ret = blk_co_pread(exp->common.blk, offset, size, buf, 0);
     if (ret >= 0) {
         fuse_reply_buf(req, buf, size);
     } else {
@@ -620,8 +766,9 @@ static void fuse_read(fuse_req_t req, fuse_ino_t inode,
 /**
  * Handle client writes to the exported image.
  */
-static void fuse_write(fuse_req_t req, fuse_ino_t inode, const char *buf,
-                       size_t size, off_t offset, struct fuse_file_info *fi)
+static void coroutine_fn
+fuse_write(fuse_req_t req, fuse_ino_t inode, const char *buf, size_t size,
+           off_t offset, struct fuse_file_info *fi)
 {
     FuseExport *exp = fuse_req_userdata(req);
     int64_t length;
@@ -642,7 +789,7 @@ static void fuse_write(fuse_req_t req, fuse_ino_t inode, const char *buf,
      * Clients will expect short writes at EOF, so we have to limit
      * offset+size to the image length.
      */
-    length = blk_getlength(exp->common.blk);
+    length = blk_co_getlength(exp->common.blk);
     if (length < 0) {
         fuse_reply_err(req, -length);
         return;
@@ -660,7 +807,7 @@ static void fuse_write(fuse_req_t req, fuse_ino_t inode, const char *buf,
         }
     }
 
-    ret = blk_pwrite(exp->common.blk, offset, size, buf, 0);
+    ret = blk_co_pwrite(exp->common.blk, offset, size, buf, 0);
     if (ret >= 0) {
         fuse_reply_write(req, size);
     } else {
@@ -671,9 +818,9 @@ static void fuse_write(fuse_req_t req, fuse_ino_t inode, const char *buf,
 /**
  * Let clients perform various fallocate() operations.
  */
-static void fuse_fallocate(fuse_req_t req, fuse_ino_t inode, int mode,
-                           off_t offset, off_t length,
-                           struct fuse_file_info *fi)
+static void coroutine_fn
+fuse_fallocate(fuse_req_t req, fuse_ino_t inode, int mode, off_t offset,
+               off_t length, struct fuse_file_info *fi)
 {
     FuseExport *exp = fuse_req_userdata(req);
     int64_t blk_len;
@@ -684,7 +831,7 @@ static void fuse_fallocate(fuse_req_t req, fuse_ino_t inode, int mode,
         return;
     }
 
-    blk_len = blk_getlength(exp->common.blk);
+    blk_len = blk_co_getlength(exp->common.blk);
     if (blk_len < 0) {
         fuse_reply_err(req, -blk_len);
         return;
@@ -725,7 +872,7 @@ static void fuse_fallocate(fuse_req_t req, fuse_ino_t inode, int mode,
         do {
             int size = MIN(length, BDRV_REQUEST_MAX_BYTES);
 
-            ret = blk_pwrite_zeroes(exp->common.blk, offset, size,
+            ret = blk_co_pwrite_zeroes(exp->common.blk, offset, size,
                                     BDRV_REQ_MAY_UNMAP | BDRV_REQ_NO_FALLBACK);
             if (ret == -ENOTSUP) {
                 /*
@@ -755,7 +902,7 @@ static void fuse_fallocate(fuse_req_t req, fuse_ino_t inode, int mode,
         do {
             int size = MIN(length, BDRV_REQUEST_MAX_BYTES);
 
-            ret = blk_pwrite_zeroes(exp->common.blk,
+            ret = blk_co_pwrite_zeroes(exp->common.blk,
                                     offset, size, 0);
             offset += size;
             length -= size;
@@ -772,13 +919,14 @@ static void fuse_fallocate(fuse_req_t req, fuse_ino_t inode, int mode,
 /**
  * Let clients fsync the exported image.
  */
-static void fuse_fsync(fuse_req_t req, fuse_ino_t inode, int datasync,
-                       struct fuse_file_info *fi)
+static void coroutine_fn
+fuse_fsync(fuse_req_t req, fuse_ino_t inode, int datasync,
+           struct fuse_file_info *fi)
 {
     FuseExport *exp = fuse_req_userdata(req);
     int ret;
 
-    ret = blk_flush(exp->common.blk);
+    ret = blk_co_flush(exp->common.blk);
     fuse_reply_err(req, ret < 0 ? -ret : 0);
 }
 
@@ -786,8 +934,8 @@ static void fuse_fsync(fuse_req_t req, fuse_ino_t inode, int datasync,
  * Called before an FD to the exported image is closed.  (libfuse
  * notes this to be a way to return last-minute errors.)
  */
-static void fuse_flush(fuse_req_t req, fuse_ino_t inode,
-                        struct fuse_file_info *fi)
+static void coroutine_fn
+fuse_flush(fuse_req_t req, fuse_ino_t inode, struct fuse_file_info *fi)
 {
     fuse_fsync(req, inode, 1, fi);
 }
@@ -796,8 +944,9 @@ static void fuse_flush(fuse_req_t req, fuse_ino_t inode,
 /**
  * Let clients inquire allocation status.
  */
-static void fuse_lseek(fuse_req_t req, fuse_ino_t inode, off_t offset,
-                       int whence, struct fuse_file_info *fi)
+static void coroutine_fn
+fuse_lseek(fuse_req_t req, fuse_ino_t inode, off_t offset, int whence,
+           struct fuse_file_info *fi)
 {
     FuseExport *exp = fuse_req_userdata(req);
 
@@ -810,8 +959,11 @@ static void fuse_lseek(fuse_req_t req, fuse_ino_t inode, off_t offset,
         int64_t pnum;
         int ret;
 
-        ret = bdrv_block_status_above(blk_bs(exp->common.blk), NULL,
-                                      offset, INT64_MAX, &pnum, NULL, NULL);
+        WITH_GRAPH_RDLOCK_GUARD() {
+            ret = bdrv_co_block_status_above(blk_bs(exp->common.blk), NULL,
+                                             offset, INT64_MAX, &pnum,
+                                             NULL, NULL);
+        }
         if (ret < 0) {
             fuse_reply_err(req, -ret);
             return;
@@ -829,7 +981,7 @@ static void fuse_lseek(fuse_req_t req, fuse_ino_t inode, off_t offset,
              * and @blk_len (the client-visible EOF).
              */
 
-            blk_len = blk_getlength(exp->common.blk);
+            blk_len = blk_co_getlength(exp->common.blk);
             if (blk_len < 0) {
                 fuse_reply_err(req, -blk_len);
                 return;
@@ -866,6 +1018,7 @@ static void fuse_lseek(fuse_req_t req, fuse_ino_t inode, off_t offset,
 }
 #endif
 
+/* Called from co_fuse_process_request() */
 static const struct fuse_lowlevel_ops fuse_ops = {
     .init       = fuse_init,
     .lookup     = fuse_lookup,
@@ -18,6 +18,7 @@
 #include "vhost-user-blk-server.h"
 #include "qapi/error.h"
 #include "qom/object_interfaces.h"
+#include "sysemu/iothread.h"
 #include "util/block-helpers.h"
 #include "virtio-blk-handler.h"
 
@@ -25,10 +26,19 @@ enum {
     VHOST_USER_BLK_NUM_QUEUES_DEFAULT = 1,
 };
 
+/* Per-virtqueue state, only accessed from the virtqueue's AioContext */
+typedef struct VuBlkQueue {
+    /* vu_blk_process_vq() is submitting requests */
+    bool batching;
+    /* Completions were pushed while batching, notify at the end */
+    bool notify_pending;
+} VuBlkQueue;
+
 typedef struct VuBlkReq {
     VuVirtqElement elem;
     VuServer *server;
     struct VuVirtq *vq;
+    VuBlkQueue *queue;
 } VuBlkReq;
 
 /* vhost user block device */
@@ -38,6 +48,10 @@ typedef struct {
     VirtioBlkHandler handler;
     QIOChannelSocket *sioc;
     struct virtio_blk_config blkcfg;
+    VuBlkQueue *queues;
+    IOThread **queue_iothreads;
+    AioContext **queue_ctxs;
+    int nr_queue_iothreads;
 } VuBlkExport;
 
 static void vu_blk_req_complete(VuBlkReq *req, size_t in_len)
@@ -45,7 +59,11 @@ static void vu_blk_req_complete(VuBlkReq *req, size_t in_len)
     VuDev *vu_dev = &req->server->vu_dev;
 
     vu_queue_push(vu_dev, req->vq, &req->elem, in_len);
-    vu_queue_notify(vu_dev, req->vq);
+    if (req->queue->batching) {
+        req->queue->notify_pending = true;
+    } else {
+        vu_queue_notify(vu_dev, req->vq);
+    }
 
     free(req);
 }
@@ -82,7 +100,16 @@ static void coroutine_fn vu_blk_virtio_process_req(void *opaque)
 static void vu_blk_process_vq(VuDev *vu_dev, int idx)
 {
     VuServer *server = container_of(vu_dev, VuServer, vu_dev);
+    VuBlkExport *vexp = container_of(server, VuBlkExport, vu_server);
     VuVirtq *vq = vu_get_queue(vu_dev, idx);
+    VuBlkQueue *queue = &vexp->queues[idx];
+
+    /*
+     * Submit everything the driver queued as one batch and signal the
+     * requests that complete synchronously with a single notification.
+     */
+    queue->batching = true;
+    blk_io_plug();
 
     while (1) {
         VuBlkReq *req;
@@ -94,6 +121,7 @@ static void vu_blk_process_vq(VuDev *vu_dev, int idx)
 
         req->server = server;
         req->vq = vq;
+        req->queue = queue;
 
         Coroutine *co =
             qemu_coroutine_create(vu_blk_virtio_process_req, req);
@@ -101,6 +129,13 @@ static void vu_blk_process_vq(VuDev *vu_dev, int idx)
         vhost_user_server_inc_in_flight(server);
         qemu_coroutine_enter(co);
     }
+
+    blk_io_unplug();
+    queue->batching = false;
+    if (queue->notify_pending) {
+        queue->notify_pending = false;
+        vu_queue_notify(vu_dev, vq);
+    }
 }
 
 static void vu_blk_queue_set_started(VuDev *vu_dev, int idx, bool started)
@@ -313,6 +348,22 @@ static const BlockDevOps vu_blk_dev_ops = {
     .resize_cb = vu_blk_exp_resize,
 };
 
+static void vu_blk_free_queue_iothreads(VuBlkExport *vexp)
+{
+    int i;
+
+    for (i = 0; i < vexp->nr_queue_iothreads; i++) {
+        object_unref(OBJECT(vexp->queue_iothreads[i]));
+    }
+    g_free(vexp->queue_iothreads);
+    g_free(vexp->queue_ctxs);
+    g_free(vexp->queues);
+    vexp->queue_iothreads = NULL;
+    vexp->queue_ctxs = NULL;
+    vexp->queues = NULL;
+    vexp->nr_queue_iothreads = 0;
+}
+
 static int vu_blk_exp_create(BlockExport *exp, BlockExportOptions *opts,
                              Error **errp)
 {
@@ -321,6 +372,8 @@ static int vu_blk_exp_create(BlockExport *exp, BlockExportOptions *opts,
     Error *local_err = NULL;
     uint64_t logical_block_size;
     uint16_t num_queues = VHOST_USER_BLK_NUM_QUEUES_DEFAULT;
+    strList *iothreads;
+    int ret;
 
     vexp->blkcfg.wce = 0;
 
@@ -343,6 +396,28 @@ static int vu_blk_exp_create(BlockExport *exp, BlockExportOptions *opts,
         error_setg(errp, "num-queues must be greater than 0");
         return -EINVAL;
     }
+
+    for (iothreads = vu_opts->queue_iothreads; iothreads;
+         iothreads = iothreads->next) {
+        IOThread *iothread = iothread_by_id(iothreads->value);
+
+        if (!iothread) {
+            error_setg(errp, "iothread \"%s\" not found", iothreads->value);
+            ret = -EINVAL;
+            goto fail;
+        }
+        vexp->queue_iothreads = g_renew(IOThread *, vexp->queue_iothreads,
+                                        vexp->nr_queue_iothreads + 1);
+        vexp->queue_ctxs = g_renew(AioContext *, vexp->queue_ctxs,
+                                   vexp->nr_queue_iothreads + 1);
+        vexp->queue_iothreads[vexp->nr_queue_iothreads] = iothread;
+        vexp->queue_ctxs[vexp->nr_queue_iothreads] =
+            iothread_get_aio_context(iothread);
+        vexp->nr_queue_iothreads++;
+        object_ref(OBJECT(iothread));
+    }
+
+    vexp->queues = g_new0(VuBlkQueue, num_queues);
     vexp->handler.blk = exp->blk;
     vexp->handler.serial = g_strdup("vhost_user_blk");
     vexp->handler.logical_block_size = logical_block_size;
@@ -361,10 +436,19 @@ static int vu_blk_exp_create(BlockExport *exp, BlockExportOptions *opts,
         blk_remove_aio_context_notifier(exp->blk, blk_aio_attached,
                                         blk_aio_detach, vexp);
         g_free(vexp->handler.serial);
-        return -EADDRNOTAVAIL;
+        ret = -EADDRNOTAVAIL;
+        goto fail;
+    }
+    if (vexp->nr_queue_iothreads) {
+        vhost_user_server_set_queue_ctxs(&vexp->vu_server, vexp->queue_ctxs,
+                                         vexp->nr_queue_iothreads);
     }
 
     return 0;
+
+fail:
+    vu_blk_free_queue_iothreads(vexp);
+    return ret;
 }
 
 static void vu_blk_exp_delete(BlockExport *exp)
@@ -374,6 +458,7 @@ static void vu_blk_exp_delete(BlockExport *exp)
     blk_remove_aio_context_notifier(exp->blk, blk_aio_attached, blk_aio_detach,
                                     vexp);
     g_free(vexp->handler.serial);
+    vu_blk_free_queue_iothreads(vexp);
 }
 
 const BlockExportDriver blk_exp_vhost_user_blk = {
@@ -86,6 +86,9 @@
 #endif
 #if defined(CONFIG_FALLOCATE_PUNCH_HOLE) || defined(CONFIG_FALLOCATE_ZERO_RANGE)
 #include <linux/falloc.h>
+#ifdef CONFIG_LINUX_IO_URING
+#define HAVE_LURING_FALLOCATE
+#endif
 #endif
 #if defined (__FreeBSD__) || defined(__FreeBSD_kernel__)
 #include <sys/disk.h>
@@ -151,6 +154,7 @@ typedef struct BDRVRawState {
     uint64_t locked_shared_perm;
 
     uint64_t aio_max_batch;
+    LuringMode luring_mode;
 
     int perm_change_fd;
     int perm_change_flags;
@@ -174,6 +178,12 @@ typedef struct BDRVRawState {
     } stats;
 
     PRManager *pr_mgr;
+
+    /* Asynchronous SG_IO on sg character devices, see raw_sg_co_submit() */
+    bool sg_async;
+    QemuMutex sg_lock;
+    unsigned sg_inflight;   /* protected by sg_lock */
+    AioContext *sg_ctx;     /* where the completion handler runs */
 } BDRVRawState;
 
 typedef struct BDRVRawReopenState {
@@ -561,6 +571,13 @@ static QemuOptsList raw_runtime_opts = {
             .type = QEMU_OPT_NUMBER,
             .help = "AIO max batch size (0 = auto handled by AIO backend, default: 0)",
         },
+#ifdef CONFIG_LINUX_IO_URING
+        {
+            .name = "aio-poll-mode",
+            .type = QEMU_OPT_STRING,
+            .help = "io_uring polling mode (none, sqpoll, iopoll, default: none)",
+        },
+#endif
         {
             .name = "locking",
             .type = QEMU_OPT_STRING,
@@ -642,6 +659,45 @@ static int raw_open_common(BlockDriverState *bs, QDict *options,
 
     s->aio_max_batch = qemu_opt_get_number(opts, "aio-max-batch", 0);
 
+#ifdef CONFIG_LINUX_IO_URING
+    {
+        BlockdevAioPollMode poll_mode;
+
+        poll_mode = qapi_enum_parse(&BlockdevAioPollMode_lookup,
+                                    qemu_opt_get(opts, "aio-poll-mode"),
+                                    BLOCKDEV_AIO_POLL_MODE_NONE, &local_err);
+        if (local_err) {
+            error_propagate(errp, local_err);
+            ret = -EINVAL;
+            goto fail;
+        }
+
+        switch (poll_mode) {
+        case BLOCKDEV_AIO_POLL_MODE_SQPOLL:
+            s->luring_mode = LURING_MODE_SQPOLL;
+            break;
+        case BLOCKDEV_AIO_POLL_MODE_IOPOLL:
+            s->luring_mode = LURING_MODE_IOPOLL;
+            break;
+        default:
+            s->luring_mode = LURING_MODE_DEFAULT;
+            break;
+        }
+
+        if (s->luring_mode != LURING_MODE_DEFAULT && !s->use_linux_io_uring) {
+            error_setg(errp, "aio-poll-mode requires aio=io_uring");
+            ret = -EINVAL;
+            goto fail;
+        }
+        if (s->luring_mode == LURING_MODE_IOPOLL &&
+            !(bdrv_flags & BDRV_O_NOCACHE)) {
+            error_setg(errp, "aio-poll-mode=iopoll requires cache.direct=on");
+            ret = -EINVAL;
+            goto fail;
+        }
+    }
+#endif
+
     locking = qapi_enum_parse(&OnOffAuto_lookup,
                               qemu_opt_get(opts, "locking"),
                               ON_OFF_AUTO_AUTO, &local_err);
@@ -736,7 +792,21 @@ static int raw_open_common(BlockDriverState *bs, QDict *options,
 
 #ifdef CONFIG_LINUX_IO_URING
     if (s->use_linux_io_uring) {
-        if (!aio_setup_linux_io_uring(bdrv_get_aio_context(bs), errp)) {
+        /*
+         * Polling rings are created lazily in the home thread of each
+         * AioContext, so only check here that the kernel allows them.
+         */
+        LuringState *probe = luring_init(s->luring_mode, errp);
+
+        if (!probe) {
+            error_prepend(errp, "Unable to use io_uring: ");
+            goto fail;
+        }
+        luring_cleanup(probe);
+
+        if (s->luring_mode == LURING_MODE_DEFAULT &&
+            !aio_setup_linux_io_uring(bdrv_get_aio_context(bs),
+                                      LURING_MODE_DEFAULT, errp)) {
             error_prepend(errp, "Unable to use io_uring: ");
             goto fail;
         }
@@ -1146,6 +1216,13 @@ static int raw_reopen_prepare(BDRVReopenState *state,
         goto out;
     }
 
+    if (s->luring_mode == LURING_MODE_IOPOLL &&
+        !(state->flags & BDRV_O_NOCACHE)) {
+        error_setg(errp, "aio-poll-mode=iopoll requires cache.direct=on");
+        ret = -EINVAL;
+        goto out;
+    }
+
     rs->drop_cache = qemu_opt_get_bool_del(opts, "drop-cache", true);
     rs->check_cache_dropped =
         qemu_opt_get_bool_del(opts, "x-check-cache-dropped", false);
@@ -2472,7 +2549,7 @@ static int coroutine_fn raw_co_prw(BlockDriverState *bs, uint64_t offset,
 #ifdef CONFIG_LINUX_IO_URING
     } else if (s->use_linux_io_uring) {
         assert(qiov->size == bytes);
-        ret = luring_co_submit(bs, s->fd, offset, qiov, type);
+        ret = luring_co_submit(bs, s->fd, offset, qiov, type, s->luring_mode);
         goto out;
 #endif
 #ifdef CONFIG_LINUX_AIO
@@ -2566,8 +2643,10 @@ static int coroutine_fn raw_co_flush_to_disk(BlockDriverState *bs)
     };
 
 #ifdef CONFIG_LINUX_IO_URING
-    if (s->use_linux_io_uring) {
-        return luring_co_submit(bs, s->fd, 0, NULL, QEMU_AIO_FLUSH);
+    /* IOPOLL rings can't carry fsync, use the thread pool for those */
+    if (s->use_linux_io_uring && s->luring_mode != LURING_MODE_IOPOLL) {
+        return luring_co_submit(bs, s->fd, 0, NULL, QEMU_AIO_FLUSH,
+                                s->luring_mode);
     }
 #endif
     return raw_thread_pool_submit(handle_aiocb_flush, &acb);
@@ -2588,9 +2667,10 @@ static void raw_aio_attach_aio_context(BlockDriverState *bs,
     }
 #endif
 #ifdef CONFIG_LINUX_IO_URING
-    if (s->use_linux_io_uring) {
+    if (s->use_linux_io_uring && s->luring_mode == LURING_MODE_DEFAULT) {
         Error *local_err = NULL;
-        if (!aio_setup_linux_io_uring(new_context, &local_err)) {
+        if (!aio_setup_linux_io_uring(new_context, LURING_MODE_DEFAULT,
+                                      &local_err)) {
             error_reportf_err(local_err, "Unable to use linux io_uring, "
                                          "falling back to thread pool: ");
             s->use_linux_io_uring = false;
@@ -2599,6 +2679,32 @@ static void raw_aio_attach_aio_context(BlockDriverState *bs,
 #endif
 }
 
+#ifdef CONFIG_LINUX_IO_URING
+static bool raw_register_buf(BlockDriverState *bs, void *host, size_t size,
+                             Error **errp)
+{
+    BDRVRawState *s = bs->opaque;
+
+    /*
+     * Failing to use fixed buffers is not fatal, io_uring then falls back to
+     * readv/writev, so never fail the registration itself.
+     */
+    if (s->use_linux_io_uring) {
+        luring_register_buf(host, size);
+    }
+    return true;
+}
+
+static void raw_unregister_buf(BlockDriverState *bs, void *host, size_t size)
+{
+    BDRVRawState *s = bs->opaque;
+
+    if (s->use_linux_io_uring) {
+        luring_unregister_buf(host, size);
+    }
+}
+#endif
+
 static void raw_close(BlockDriverState *bs)
 {
     BDRVRawState *s = bs->opaque;
@@ -2606,10 +2712,19 @@ static void raw_close(BlockDriverState *bs)
     if (s->fd >= 0) {
 #if defined(CONFIG_BLKZONED)
         g_free(bs->wps);
+#endif
+#ifdef CONFIG_LINUX_IO_URING
+        if (s->use_linux_io_uring) {
+            luring_invalidate_fds();
+        }
 #endif
         qemu_close(s->fd);
         s->fd = -1;
     }
+    if (s->sg_async) {
+        qemu_mutex_destroy(&s->sg_lock);
+        s->sg_async = false;
+    }
 }
 
 /**
@@ -3534,6 +3649,60 @@ static int coroutine_fn raw_co_zone_append(BlockDriverState *bs,
 }
 #endif
 
+#ifdef HAVE_LURING_FALLOCATE
+/*
+ * Submit fallocate() on a regular file to the io_uring ring from the current
+ * AioContext, so that discard and write zeroes storms don't go through the
+ * thread pool.  -ENOTSUP means that the caller should use the thread pool,
+ * which also knows how to deal with file systems that don't support @mode.
+ */
+static int coroutine_fn raw_luring_fallocate(BlockDriverState *bs, int type,
+                                             int mode, int64_t offset,
+                                             int64_t bytes)
+{
+    BDRVRawState *s = bs->opaque;
+
+    if (!s->use_linux_io_uring || s->luring_mode == LURING_MODE_IOPOLL ||
+        !luring_has_fallocate()) {
+        return -ENOTSUP;
+    }
+    return translate_err(luring_co_fallocate(bs, s->fd, type, mode, offset,
+                                             bytes, s->luring_mode));
+}
+
+static int coroutine_fn raw_luring_pwrite_zeroes(BlockDriverState *bs,
+                                                 int64_t offset, int64_t bytes,
+                                                 BdrvRequestFlags flags)
+{
+    BDRVRawState *s = bs->opaque;
+    int ret;
+
+#ifdef CONFIG_FALLOCATE_PUNCH_HOLE
+    /* Same order as handle_aiocb_write_zeroes_unmap() */
+    if ((flags & BDRV_REQ_MAY_UNMAP) && s->has_discard) {
+        ret = raw_luring_fallocate(bs, QEMU_AIO_WRITE_ZEROES,
+                                   FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                                   offset, bytes);
+        if (ret != -ENOTSUP && ret != -EINVAL && ret != -EBUSY) {
+            return ret;
+        }
+    }
+#endif
+
+#ifdef CONFIG_FALLOCATE_ZERO_RANGE
+    if (s->has_write_zeroes) {
+        ret = raw_luring_fallocate(bs, QEMU_AIO_WRITE_ZEROES,
+                                   FALLOC_FL_ZERO_RANGE, offset, bytes);
+        if (ret != -ENOTSUP && ret != -EINVAL) {
+            return ret;
+        }
+    }
+#endif
+
+    return -ENOTSUP;
+}
+#endif
+
 static coroutine_fn int
 raw_do_pdiscard(BlockDriverState *bs, int64_t offset, int64_t bytes,
                 bool blkdev)
@@ -3542,6 +3711,18 @@ raw_do_pdiscard(BlockDriverState *bs, int64_t offset, int64_t bytes,
     RawPosixAIOData acb;
     int ret;
 
+#if defined(CONFIG_LINUX_IO_URING) && defined(CONFIG_FALLOCATE_PUNCH_HOLE)
+    if (!blkdev && s->has_discard) {
+        ret = raw_luring_fallocate(bs, QEMU_AIO_DISCARD,
+                                   FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                                   offset, bytes);
+        if (ret != -ENOTSUP) {
+            raw_account_discard(s, bytes, ret);
+            return ret;
+        }
+    }
+#endif
+
     acb = (RawPosixAIOData) {
         .bs             = bs,
         .aio_fildes     = s->fd,
@@ -3607,6 +3788,16 @@ raw_do_pwrite_zeroes(BlockDriverState *bs, int64_t offset, int64_t bytes,
     }
 #endif
 
+#ifdef HAVE_LURING_FALLOCATE
+    if (!blkdev) {
+        int ret = raw_luring_pwrite_zeroes(bs, offset, bytes, flags);
+
+        if (ret != -ENOTSUP) {
+            return ret;
+        }
+    }
+#endif
+
     acb = (RawPosixAIOData) {
         .bs             = bs,
         .aio_fildes     = s->fd,
@@ -3800,6 +3991,11 @@ static void raw_set_perm(BlockDriverState *bs, uint64_t perm, uint64_t shared)
     /* For reopen, we have already switched to the new fd (.bdrv_set_perm is
      * called after .bdrv_reopen_commit) */
     if (s->perm_change_fd && s->fd != s->perm_change_fd) {
+#ifdef CONFIG_LINUX_IO_URING
+        if (s->use_linux_io_uring) {
+            luring_invalidate_fds();
+        }
+#endif
         qemu_close(s->fd);
         s->fd = s->perm_change_fd;
         s->open_flags = s->perm_change_flags;
@@ -3898,6 +4094,10 @@ BlockDriver bdrv_file = {
     .bdrv_co_copy_range_to  = raw_co_copy_range_to,
     .bdrv_refresh_limits = raw_refresh_limits,
     .bdrv_attach_aio_context = raw_aio_attach_aio_context,
+#ifdef CONFIG_LINUX_IO_URING
+    .bdrv_register_buf       = raw_register_buf,
+    .bdrv_unregister_buf     = raw_unregister_buf,
+#endif
 
     .bdrv_co_truncate                   = raw_co_truncate,
     .bdrv_co_getlength                  = raw_co_getlength,
@@ -4174,11 +4374,94 @@ hdev_open_Mac_error:
 
     /* Since this does ioctl the device must be already opened */
     bs->sg = hdev_is_sg(bs);
+#if defined(__linux__)
+    if (bs->sg) {
+        s->sg_async = true;
+        qemu_mutex_init(&s->sg_lock);
+    }
+#endif
 
     return ret;
 }
 
 #if defined(__linux__)
+/*
+ * SG_IO on sg character devices uses the sg driver's asynchronous
+ * interface: write() queues the command and read() returns its header once
+ * it has completed.  Commands are submitted straight from the calling
+ * AioContext instead of taking a round trip through the thread pool; the
+ * headers are read back by an fd handler in the node's AioContext, which
+ * is only registered while commands are in flight.  Synchronous SG_IO
+ * ioctls on the same fd are never returned by read().
+ */
+typedef struct RawSgRequest {
+    Coroutine *co;
+    struct sg_io_hdr *hdr;
+} RawSgRequest;
+
+static void raw_sg_read_completion(void *opaque)
+{
+    BlockDriverState *bs = opaque;
+    BDRVRawState *s = bs->opaque;
+    struct sg_io_hdr hdr = { .interface_id = 'S' };
+    RawSgRequest *req;
+    ssize_t ret;
+
+    /* Only called when the fd is readable, so this does not block */
+    ret = read(s->fd, &hdr, sizeof(hdr));
+    if (ret != sizeof(hdr)) {
+        return;
+    }
+
+    req = hdr.usr_ptr;
+    hdr.usr_ptr = req->hdr->usr_ptr;
+    *req->hdr = hdr;
+
+    qemu_mutex_lock(&s->sg_lock);
+    if (--s->sg_inflight == 0) {
+        aio_set_fd_handler(s->sg_ctx, s->fd, NULL, NULL, NULL, NULL, NULL);
+    }
+    qemu_mutex_unlock(&s->sg_lock);
+
+    aio_co_wake(req->co);
+}
+
+/*
+ * Returns -EDOM when the sg request queue is full, in which case the caller
+ * goes through the thread pool instead.
+ */
+static int coroutine_fn raw_sg_co_submit(BlockDriverState *bs,
+                                         struct sg_io_hdr *hdr)
+{
+    BDRVRawState *s = bs->opaque;
+    RawSgRequest req = {
+        .co = qemu_coroutine_self(),
+        .hdr = hdr,
+    };
+    struct sg_io_hdr submit = *hdr;
+    ssize_t ret;
+
+    submit.usr_ptr = &req;
+
+    qemu_mutex_lock(&s->sg_lock);
+    ret = RETRY_ON_EINTR(write(s->fd, &submit, sizeof(submit)));
+    if (ret < 0) {
+        ret = -errno;
+        qemu_mutex_unlock(&s->sg_lock);
+        return ret;
+    }
+    if (s->sg_inflight++ == 0) {
+        s->sg_ctx = bdrv_get_aio_context(bs);
+        aio_set_fd_handler(s->sg_ctx, s->fd, raw_sg_read_completion,
+                           NULL, NULL, NULL, bs);
+    }
+    qemu_mutex_unlock(&s->sg_lock);
+
+    /* Woken exactly once, by raw_sg_read_completion() */
+    qemu_coroutine_yield();
+    return 0;
+}
+
 static int coroutine_fn
 hdev_co_ioctl(BlockDriverState *bs, unsigned long int req, void *buf)
 {
@@ -4200,6 +4483,13 @@ hdev_co_ioctl(BlockDriverState *bs, unsigned long int req, void *buf)
         }
     }
 
+    if (req == SG_IO && s->sg_async) {
+        ret = raw_sg_co_submit(bs, buf);
+        if (ret != -EDOM) {
+            return ret;
+        }
+    }
+
     acb = (RawPosixAIOData) {
         .bs         = bs,
         .aio_type   = QEMU_AIO_IOCTL,
@@ -4268,6 +4558,10 @@ static BlockDriver bdrv_host_device = {
     .bdrv_co_copy_range_to  = raw_co_copy_range_to,
     .bdrv_refresh_limits = raw_refresh_limits,
     .bdrv_attach_aio_context = raw_aio_attach_aio_context,
+#ifdef CONFIG_LINUX_IO_URING
+    .bdrv_register_buf       = raw_register_buf,
+    .bdrv_unregister_buf     = raw_unregister_buf,
+#endif
 
     .bdrv_co_truncate                   = raw_co_truncate,
     .bdrv_co_getlength                  = raw_co_getlength,
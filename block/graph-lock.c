@@ -106,9 +106,10 @@ static uint32_t reader_count(void)
     return rd;
 }
 
-void bdrv_graph_wrlock(BlockDriverState *bs)
+void bdrv_graph_wrlock_impl(BlockDriverState *bs, const char *file, int line)
 {
     AioContext *ctx = NULL;
+    int64_t t0 = qsp_co_start();
 
     GLOBAL_STATE_CODE();
     assert(!qatomic_read(&has_writer));
@@ -158,6 +159,7 @@ void bdrv_graph_wrlock(BlockDriverState *bs)
     if (ctx) {
         aio_context_acquire(bdrv_get_aio_context(bs));
     }
+    qsp_co_record(&has_writer, QSP_GRAPH_LOCK, file, line, t0);
 }
 
 void bdrv_graph_wrunlock(void)
@@ -176,7 +178,7 @@ void bdrv_graph_wrunlock(void)
     qemu_co_enter_all(&reader_queue, &aio_context_list_lock);
 }
 
-void coroutine_fn bdrv_graph_co_rdlock(void)
+static void coroutine_fn bdrv_graph_co_do_rdlock(void)
 {
     BdrvGraphRWlock *bdrv_graph;
     bdrv_graph = qemu_get_current_aio_context()->bdrv_graph;
@@ -239,6 +241,14 @@ void coroutine_fn bdrv_graph_co_rdlock(void)
     }
 }
 
+void coroutine_fn bdrv_graph_co_rdlock_impl(const char *file, int line)
+{
+    int64_t t0 = qsp_co_start();
+
+    bdrv_graph_co_do_rdlock();
+    qsp_co_record(&has_writer, QSP_GRAPH_LOCK, file, line, t0);
+}
+
 void coroutine_fn bdrv_graph_co_rdunlock(void)
 {
     BdrvGraphRWlock *bdrv_graph;
@@ -593,10 +593,23 @@ static void coroutine_fn tracked_request_end(BdrvTrackedRequest *req)
 
     qemu_co_mutex_lock(&req->bs->reqs_lock);
     QLIST_REMOVE(req, list);
+    interval_tree_remove(&req->node, &req->bs->tracked_requests_tree);
     qemu_co_queue_restart_all(&req->wait_queue);
     qemu_co_mutex_unlock(&req->bs->reqs_lock);
 }
 
+/*
+ * Requests are indexed by their overlap range.  Zero-length ranges take one
+ * byte so that the tree is a superset of what tracked_request_overlaps()
+ * accepts.
+ */
+static void tracked_request_set_node(IntervalTreeNode *node,
+                                     int64_t offset, int64_t bytes)
+{
+    node->start = offset;
+    node->last = offset + MAX(bytes, 1) - 1;
+}
+
 /**
  * Add an active request to the tracked requests list
  */
@@ -620,9 +633,11 @@ static void coroutine_fn tracked_request_begin(BdrvTrackedRequest *req,
     };
 
     qemu_co_queue_init(&req->wait_queue);
+    tracked_request_set_node(&req->node, offset, bytes);
 
     qemu_co_mutex_lock(&bs->reqs_lock);
     QLIST_INSERT_HEAD(&bs->tracked_requests, req, list);
+    interval_tree_insert(&req->node, &bs->tracked_requests_tree);
     qemu_co_mutex_unlock(&bs->reqs_lock);
 }
 
@@ -642,13 +657,23 @@ static bool tracked_request_overlaps(BdrvTrackedRequest *req,
     return true;
 }
 
-/* Called with self->bs->reqs_lock held */
+/*
+ * Called with self->bs->reqs_lock held.  Only the requests whose overlap
+ * range intersects that of @self are visited, so with many requests in
+ * flight the cost does not grow with the queue depth.
+ */
 static coroutine_fn BdrvTrackedRequest *
 bdrv_find_conflicting_request(BdrvTrackedRequest *self)
 {
+    IntervalTreeNode *node;
     BdrvTrackedRequest *req;
 
-    QLIST_FOREACH(req, &self->bs->tracked_requests, list) {
+    for (node = interval_tree_iter_first(&self->bs->tracked_requests_tree,
+                                         self->node.start, self->node.last);
+         node;
+         node = interval_tree_iter_next(node, self->node.start,
+                                        self->node.last)) {
+        req = container_of(node, BdrvTrackedRequest, node);
         if (req == self || (!req->serialising && !self->serialising)) {
             continue;
         }
@@ -706,6 +731,12 @@ static void tracked_request_set_serialising(BdrvTrackedRequest *req,
 
     req->overlap_offset = MIN(req->overlap_offset, overlap_offset);
     req->overlap_bytes = MAX(req->overlap_bytes, overlap_bytes);
+
+    /* Reindex the request, since its overlap range may have grown */
+    interval_tree_remove(&req->node, &req->bs->tracked_requests_tree);
+    tracked_request_set_node(&req->node, req->overlap_offset,
+                             req->overlap_bytes);
+    interval_tree_insert(&req->node, &req->bs->tracked_requests_tree);
 }
 
 /**
@@ -2446,8 +2477,8 @@ bdrv_co_block_status(BlockDriverState *bs, bool want_zero,
          * long time, and we can do nothing in qemu to fix it.
          * This is especially problematic for images with large data areas,
          * because finding the few holes in them and giving them special
-         * treatment does not gain much performance.  Therefore, we try to
-         * cache the last-identified data region.
+         * treatment does not gain much performance.  Therefore, we cache
+         * the data regions identified so far.
          *
          * Second, limiting ourselves to protocol nodes allows us to assume
          * the block status for data regions to be DATA | OFFSET_VALID, and
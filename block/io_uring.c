@@ -15,6 +15,8 @@
 #include "block/block.h"
 #include "block/raw-aio.h"
 #include "qemu/coroutine.h"
+#include "qemu/atomic.h"
+#include "qemu/lockable.h"
 #include "qapi/error.h"
 #include "sysemu/block-backend.h"
 #include "trace.h"
@@ -25,14 +27,52 @@
 /* io_uring ring size */
 #define MAX_ENTRIES 128
 
+/* Number of slots in each ring's registered file table */
+#define LURING_MAX_FILES 16
+
+/* Idle time before the SQPOLL kernel thread goes to sleep */
+#define LURING_SQ_THREAD_IDLE_MS 10
+
+/* The kernel refuses to register fixed buffers larger than 1 GiB */
+#define LURING_MAX_FIXED_BUF_SIZE (1ULL << 30)
+
+/*
+ * Host memory registered through bdrv_register_buf().  The list is global
+ * because requests can be submitted from any thread's ring.  Every ring keeps
+ * its own snapshot in LuringState and only refreshes it from its home thread
+ * when it is idle and luring_bufs_gen has changed.
+ */
+typedef struct LuringBuf {
+    void *host;
+    size_t size;
+    unsigned refcnt;
+} LuringBuf;
+
+static QemuMutex luring_bufs_lock;
+static GArray *luring_bufs; /* of LuringBuf, protected by luring_bufs_lock */
+static unsigned luring_bufs_gen;
+static unsigned luring_nr_bufs; /* luring_bufs->len, for lockless readers */
+
+/*
+ * Bumped before a file descriptor that may be in a registered file table is
+ * closed, so that rings drop their fd -> slot mappings before the fd number
+ * can be reused.
+ */
+static unsigned luring_files_gen;
+
 typedef struct LuringAIOCB {
     Coroutine *co;
     struct io_uring_sqe sqeq;
     ssize_t ret;
     QEMUIOVector *qiov;
     bool is_read;
+    bool fixed_buf; /* submitted as IORING_OP_READ_FIXED/WRITE_FIXED */
     QSIMPLEQ_ENTRY(LuringAIOCB) next;
 
+    /* For QEMU_AIO_DISCARD and QEMU_AIO_WRITE_ZEROES, i.e. fallocate() */
+    int falloc_mode;
+    uint64_t len;
+
     /*
      * Buffered reads may require resubmission, see
      * luring_resubmit_short_read().
@@ -50,6 +90,7 @@ typedef struct LuringQueue {
 
 typedef struct LuringState {
     AioContext *aio_context;
+    LuringMode mode;
 
     struct io_uring ring;
 
@@ -57,6 +98,16 @@ typedef struct LuringState {
     LuringQueue io_q;
 
     QEMUBH *completion_bh;
+
+    /* Registered file table, slots hold -1 when unused */
+    bool fixed_files_ok;
+    unsigned fixed_files_gen;
+    int fixed_fds[LURING_MAX_FILES];
+
+    /* Snapshot of luring_bufs registered as fixed buffers, sorted by base */
+    unsigned fixed_bufs_gen;
+    struct iovec *fixed_bufs;
+    unsigned int nr_fixed_bufs;
 } LuringState;
 
 /**
@@ -101,8 +152,14 @@ static void luring_resubmit_short_read(LuringState *s, LuringAIOCB *luringcb,
 
     /* Update sqe */
     luringcb->sqeq.off += nread;
-    luringcb->sqeq.addr = (__u64)(uintptr_t)luringcb->resubmit_qiov.iov;
-    luringcb->sqeq.len = luringcb->resubmit_qiov.niov;
+    if (luringcb->fixed_buf) {
+        /* Fixed buffer requests describe a single contiguous buffer */
+        luringcb->sqeq.addr += nread;
+        luringcb->sqeq.len = remaining;
+    } else {
+        luringcb->sqeq.addr = (__u64)(uintptr_t)luringcb->resubmit_qiov.iov;
+        luringcb->sqeq.len = luringcb->resubmit_qiov.niov;
+    }
 
     luring_resubmit(s, luringcb);
 }
@@ -120,6 +177,18 @@ static void luring_resubmit_short_read(LuringState *s, LuringAIOCB *luringcb,
  * canceled.
  *
  */
+/**
+ * luring_iopoll_reap:
+ *
+ * IORING_SETUP_IOPOLL rings never signal the ring fd, completions are only
+ * posted when the kernel is asked to poll the device for them.
+ */
+static void luring_iopoll_reap(LuringState *s)
+{
+    syscall(__NR_io_uring_enter, s->ring.ring_fd, 0, 0,
+            IORING_ENTER_GETEVENTS, NULL, 0);
+}
+
 static void luring_process_completions(LuringState *s)
 {
     struct io_uring_cqe *cqes;
@@ -141,6 +210,10 @@ static void luring_process_completions(LuringState *s)
      */
     qemu_bh_schedule(s->completion_bh);
 
+    if (s->mode == LURING_MODE_IOPOLL && s->io_q.in_flight) {
+        luring_iopoll_reap(s);
+    }
+
     while (io_uring_peek_cqe(&s->ring, &cqes) == 0) {
         LuringAIOCB *luringcb;
         int ret;
@@ -163,8 +236,9 @@ static void luring_process_completions(LuringState *s)
 
         if (ret < 0) {
             /*
-             * Only writev/readv/fsync requests on regular files or host block
-             * devices are submitted. Therefore -EAGAIN is not expected but it's
+             * Only writev/readv/fsync/fallocate requests on regular files or
+             * host block devices are submitted. Therefore -EAGAIN is not
+             * expected but it's
              * known to happen sometimes with Linux SCSI. Submit again and hope
              * the request completes successfully.
              *
@@ -216,7 +290,15 @@ end:
             aio_co_wake(luringcb->co);
         }
     }
-    qemu_bh_cancel(s->completion_bh);
+
+    /*
+     * Nothing will wake up the event loop for an IOPOLL ring, so keep the BH
+     * scheduled (and thus the event loop spinning) while requests are in
+     * flight.
+     */
+    if (s->mode != LURING_MODE_IOPOLL || !s->io_q.in_flight) {
+        qemu_bh_cancel(s->completion_bh);
+    }
 }
 
 static int ioq_submit(LuringState *s)
@@ -288,6 +370,10 @@ static bool qemu_luring_poll_cb(void *opaque)
 {
     LuringState *s = opaque;
 
+    if (s->mode == LURING_MODE_IOPOLL) {
+        /* Completions only show up after luring_iopoll_reap() */
+        return s->io_q.in_flight;
+    }
     return io_uring_cq_ready(&s->ring);
 }
 
@@ -316,6 +402,182 @@ static void luring_unplug_fn(void *opaque)
     }
 }
 
+static bool luring_ring_idle(LuringState *s)
+{
+    return s->io_q.in_flight == 0 && s->io_q.in_queue == 0;
+}
+
+static int luring_cmp_iovec(const void *a, const void *b)
+{
+    const struct iovec *x = a;
+    const struct iovec *y = b;
+
+    if (x->iov_base < y->iov_base) {
+        return -1;
+    }
+    return x->iov_base > y->iov_base;
+}
+
+/**
+ * luring_sync_fixed_bufs:
+ *
+ * Replace the ring's fixed buffer table with the current contents of
+ * luring_bufs.  The caller must ensure that no request using the old table is
+ * queued or in flight.
+ */
+static void luring_sync_fixed_bufs(LuringState *s, unsigned gen)
+{
+    GArray *iovs = g_array_new(false, false, sizeof(struct iovec));
+    int ret;
+
+    if (s->nr_fixed_bufs) {
+        io_uring_unregister_buffers(&s->ring);
+        g_free(s->fixed_bufs);
+        s->fixed_bufs = NULL;
+        s->nr_fixed_bufs = 0;
+    }
+    s->fixed_bufs_gen = gen;
+
+    WITH_QEMU_LOCK_GUARD(&luring_bufs_lock) {
+        for (guint i = 0; luring_bufs && i < luring_bufs->len; i++) {
+            LuringBuf *buf = &g_array_index(luring_bufs, LuringBuf, i);
+            size_t done = 0;
+
+            while (done < buf->size) {
+                struct iovec iov = {
+                    .iov_base = buf->host + done,
+                    .iov_len = MIN(buf->size - done,
+                                   LURING_MAX_FIXED_BUF_SIZE),
+                };
+
+                g_array_append_val(iovs, iov);
+                done += iov.iov_len;
+            }
+        }
+    }
+
+    if (iovs->len == 0) {
+        g_array_free(iovs, true);
+        return;
+    }
+
+    g_array_sort(iovs, luring_cmp_iovec);
+    ret = io_uring_register_buffers(&s->ring, (struct iovec *)iovs->data,
+                                    iovs->len);
+    trace_luring_sync_fixed_bufs(s, iovs->len, ret);
+    if (ret < 0) {
+        /* Typically RLIMIT_MEMLOCK, keep using plain readv/writev */
+        g_array_free(iovs, true);
+        return;
+    }
+
+    s->nr_fixed_bufs = iovs->len;
+    s->fixed_bufs = (struct iovec *)g_array_free(iovs, false);
+}
+
+/**
+ * luring_fixed_buf_index:
+ *
+ * Returns the index of the registered buffer that contains the whole of
+ * @qiov, or -1 if the request cannot be submitted with a fixed buffer.
+ */
+static int luring_fixed_buf_index(LuringState *s, QEMUIOVector *qiov)
+{
+    unsigned gen = qatomic_load_acquire(&luring_bufs_gen);
+    uintptr_t start, end;
+    unsigned int lo, hi;
+
+    if (gen != s->fixed_bufs_gen) {
+        /* Stale entries may refer to unmapped memory, don't use them */
+        if (!luring_ring_idle(s)) {
+            return -1;
+        }
+        luring_sync_fixed_bufs(s, gen);
+    }
+
+    if (!s->nr_fixed_bufs || qiov->niov != 1) {
+        return -1;
+    }
+
+    start = (uintptr_t)qiov->iov[0].iov_base;
+    end = start + qiov->iov[0].iov_len;
+
+    /* Find the last buffer starting at or below start */
+    lo = 0;
+    hi = s->nr_fixed_bufs;
+    while (hi - lo > 1) {
+        unsigned int mid = lo + (hi - lo) / 2;
+
+        if ((uintptr_t)s->fixed_bufs[mid].iov_base <= start) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+
+    if ((uintptr_t)s->fixed_bufs[lo].iov_base <= start &&
+        end <= (uintptr_t)s->fixed_bufs[lo].iov_base +
+               s->fixed_bufs[lo].iov_len) {
+        return lo;
+    }
+    return -1;
+}
+
+/**
+ * luring_fixed_file_index:
+ *
+ * Returns the registered file table slot for @fd, registering it on first
+ * use, or -1 if the plain file descriptor must be used.
+ */
+static int luring_fixed_file_index(LuringState *s, int fd)
+{
+    unsigned gen;
+    int free_slot = -1;
+    int ret;
+
+    if (!s->fixed_files_ok) {
+        return -1;
+    }
+
+    gen = qatomic_load_acquire(&luring_files_gen);
+    if (gen != s->fixed_files_gen) {
+        /* A slot may still point to a closed file that shares the fd number */
+        if (!luring_ring_idle(s)) {
+            return -1;
+        }
+        for (int i = 0; i < LURING_MAX_FILES; i++) {
+            int unused = -1;
+
+            if (s->fixed_fds[i] != -1) {
+                io_uring_register_files_update(&s->ring, i, &unused, 1);
+                s->fixed_fds[i] = -1;
+            }
+        }
+        s->fixed_files_gen = gen;
+    }
+
+    for (int i = 0; i < LURING_MAX_FILES; i++) {
+        if (s->fixed_fds[i] == fd) {
+            return i;
+        }
+        if (free_slot == -1 && s->fixed_fds[i] == -1) {
+            free_slot = i;
+        }
+    }
+
+    if (free_slot == -1) {
+        return -1;
+    }
+
+    ret = io_uring_register_files_update(&s->ring, free_slot, &fd, 1);
+    trace_luring_register_file(s, fd, free_slot, ret);
+    if (ret != 1) {
+        return -1;
+    }
+    s->fixed_fds[free_slot] = fd;
+    return free_slot;
+}
+
 /**
  * luring_do_submit:
  * @fd: file descriptor for I/O
@@ -332,28 +594,57 @@ static int luring_do_submit(int fd, LuringAIOCB *luringcb, LuringState *s,
 {
     int ret;
     struct io_uring_sqe *sqes = &luringcb->sqeq;
+    int file_index = luring_fixed_file_index(s, fd);
+    int buf_index = -1;
+
+    if (file_index >= 0) {
+        fd = file_index;
+    }
+    if (luringcb->qiov) {
+        buf_index = luring_fixed_buf_index(s, luringcb->qiov);
+        luringcb->fixed_buf = buf_index >= 0;
+    }
 
     switch (type) {
     case QEMU_AIO_WRITE:
-        io_uring_prep_writev(sqes, fd, luringcb->qiov->iov,
-                             luringcb->qiov->niov, offset);
-        break;
     case QEMU_AIO_ZONE_APPEND:
-        io_uring_prep_writev(sqes, fd, luringcb->qiov->iov,
-                             luringcb->qiov->niov, offset);
+        if (luringcb->fixed_buf) {
+            io_uring_prep_write_fixed(sqes, fd,
+                                      luringcb->qiov->iov[0].iov_base,
+                                      luringcb->qiov->iov[0].iov_len,
+                                      offset, buf_index);
+        } else {
+            io_uring_prep_writev(sqes, fd, luringcb->qiov->iov,
+                                 luringcb->qiov->niov, offset);
+        }
         break;
     case QEMU_AIO_READ:
-        io_uring_prep_readv(sqes, fd, luringcb->qiov->iov,
-                            luringcb->qiov->niov, offset);
+        if (luringcb->fixed_buf) {
+            io_uring_prep_read_fixed(sqes, fd,
+                                     luringcb->qiov->iov[0].iov_base,
+                                     luringcb->qiov->iov[0].iov_len,
+                                     offset, buf_index);
+        } else {
+            io_uring_prep_readv(sqes, fd, luringcb->qiov->iov,
+                                luringcb->qiov->niov, offset);
+        }
         break;
     case QEMU_AIO_FLUSH:
         io_uring_prep_fsync(sqes, fd, IORING_FSYNC_DATASYNC);
         break;
+    case QEMU_AIO_DISCARD:
+    case QEMU_AIO_WRITE_ZEROES:
+        io_uring_prep_fallocate(sqes, fd, luringcb->falloc_mode, offset,
+                                luringcb->len);
+        break;
     default:
         fprintf(stderr, "%s: invalid AIO request type, aborting 0x%x.\n",
                         __func__, type);
         abort();
     }
+    if (file_index >= 0) {
+        sqes->flags |= IOSQE_FIXED_FILE;
+    }
     io_uring_sqe_set_data(sqes, luringcb);
 
     QSIMPLEQ_INSERT_TAIL(&s->io_q.submit_queue, luringcb, next);
@@ -372,20 +663,176 @@ static int luring_do_submit(int fd, LuringAIOCB *luringcb, LuringState *s,
     return 0;
 }
 
-int coroutine_fn luring_co_submit(BlockDriverState *bs, int fd, uint64_t offset,
-                                  QEMUIOVector *qiov, int type)
+/*
+ * A request placed directly on the AioContext's fd monitoring ring with
+ * aio_add_sqe().  This avoids a separate ring whose completions must be
+ * signalled through its ring fd, but registered files and fixed buffers are
+ * only available with a LuringState.
+ */
+typedef struct {
+    Coroutine *co;
+    CqeHandler cqe_handler;
+    int fd;
+    uint64_t offset;
+    QEMUIOVector *qiov;
+    int type;
+    int ret;
+
+    /* For QEMU_AIO_DISCARD and QEMU_AIO_WRITE_ZEROES, i.e. fallocate() */
+    int falloc_mode;
+    uint64_t len;
+
+    /* Buffered reads may require resubmission, see luring_req_cqe_handler() */
+    size_t total_read;
+    QEMUIOVector resubmit_qiov;
+} LuringRequest;
+
+static void luring_req_prep_sqe(struct io_uring_sqe *sqe, void *opaque)
+{
+    LuringRequest *req = opaque;
+    QEMUIOVector *qiov = req->total_read ? &req->resubmit_qiov : req->qiov;
+    uint64_t offset = req->offset + req->total_read;
+
+    switch (req->type) {
+    case QEMU_AIO_WRITE:
+    case QEMU_AIO_ZONE_APPEND:
+        io_uring_prep_writev(sqe, req->fd, qiov->iov, qiov->niov, offset);
+        break;
+    case QEMU_AIO_READ:
+        io_uring_prep_readv(sqe, req->fd, qiov->iov, qiov->niov, offset);
+        break;
+    case QEMU_AIO_FLUSH:
+        io_uring_prep_fsync(sqe, req->fd, IORING_FSYNC_DATASYNC);
+        break;
+    case QEMU_AIO_DISCARD:
+    case QEMU_AIO_WRITE_ZEROES:
+        io_uring_prep_fallocate(sqe, req->fd, req->falloc_mode, req->offset,
+                                req->len);
+        break;
+    default:
+        fprintf(stderr, "%s: invalid AIO request type, aborting 0x%x.\n",
+                        __func__, req->type);
+        abort();
+    }
+}
+
+static void luring_req_cqe_handler(CqeHandler *cqe_handler)
+{
+    LuringRequest *req = container_of(cqe_handler, LuringRequest, cqe_handler);
+    int ret = cqe_handler->cqe.res;
+    size_t total_bytes;
+
+    trace_luring_req_cqe_handler(req, ret);
+
+    if (ret < 0) {
+        /* See luring_process_completions() for why this is resubmitted */
+        if (ret == -EINTR || ret == -EAGAIN) {
+            aio_add_sqe(luring_req_prep_sqe, req, &req->cqe_handler);
+            return;
+        }
+        goto end;
+    }
+
+    if (!req->qiov) {
+        goto end;
+    }
+
+    total_bytes = ret + req->total_read;
+    if (total_bytes == req->qiov->size) {
+        ret = 0;
+    } else if (req->type == QEMU_AIO_READ) {
+        if (ret > 0) {
+            /* Short read, resubmit the remainder */
+            req->total_read = total_bytes;
+            if (req->resubmit_qiov.iov == NULL) {
+                qemu_iovec_init(&req->resubmit_qiov, req->qiov->niov);
+            } else {
+                qemu_iovec_reset(&req->resubmit_qiov);
+            }
+            qemu_iovec_concat(&req->resubmit_qiov, req->qiov, total_bytes,
+                              req->qiov->size - total_bytes);
+            aio_add_sqe(luring_req_prep_sqe, req, &req->cqe_handler);
+            return;
+        }
+
+        /* Pad with zeroes */
+        qemu_iovec_memset(req->qiov, total_bytes, 0,
+                          req->qiov->size - total_bytes);
+        ret = 0;
+    } else {
+        ret = -ENOSPC;
+    }
+
+end:
+    req->ret = ret;
+    qemu_iovec_destroy(&req->resubmit_qiov);
+    aio_co_wake(req->co);
+}
+
+static int coroutine_fn luring_co_submit_fdmon(int fd, uint64_t offset,
+                                               QEMUIOVector *qiov, int type,
+                                               int falloc_mode, uint64_t len)
+{
+    LuringRequest req = {
+        .co             = qemu_coroutine_self(),
+        .cqe_handler.cb = luring_req_cqe_handler,
+        .fd             = fd,
+        .offset         = offset,
+        .qiov           = qiov,
+        .type           = type,
+        .ret            = -EINPROGRESS,
+        .falloc_mode    = falloc_mode,
+        .len            = len,
+    };
+
+    aio_add_sqe(luring_req_prep_sqe, &req, &req.cqe_handler);
+
+    /* The cqe handler only runs from the event loop, after this yield */
+    qemu_coroutine_yield();
+    assert(req.ret != -EINPROGRESS);
+    return req.ret;
+}
+
+static int coroutine_fn luring_co_do_submit(BlockDriverState *bs, int fd,
+                                            uint64_t offset,
+                                            QEMUIOVector *qiov, int type,
+                                            int falloc_mode, uint64_t len,
+                                            LuringMode mode)
 {
     int ret;
     AioContext *ctx = qemu_get_current_aio_context();
-    LuringState *s = aio_get_linux_io_uring(ctx);
+    LuringState *s;
     LuringAIOCB luringcb = {
-        .co         = qemu_coroutine_self(),
-        .ret        = -EINPROGRESS,
-        .qiov       = qiov,
-        .is_read    = (type == QEMU_AIO_READ),
+        .co             = qemu_coroutine_self(),
+        .ret            = -EINPROGRESS,
+        .qiov           = qiov,
+        .is_read        = (type == QEMU_AIO_READ),
+        .falloc_mode    = falloc_mode,
+        .len            = len,
     };
-    trace_luring_co_submit(bs, s, &luringcb, fd, offset, qiov ? qiov->size : 0,
-                           type);
+
+    /*
+     * Share the event loop's own ring when there is one.  Polling rings have
+     * different setup flags and always need their own LuringState.  Once
+     * guest RAM is registered, the fixed buffers of the LuringState save more
+     * per request than the shared ring does.
+     */
+    if (mode == LURING_MODE_DEFAULT && aio_has_io_uring(ctx) &&
+        !qatomic_read(&luring_nr_bufs)) {
+        trace_luring_co_submit_fdmon(bs, ctx, fd, offset, len, type);
+        return luring_co_submit_fdmon(fd, offset, qiov, type, falloc_mode,
+                                      len);
+    }
+
+    s = aio_get_linux_io_uring(ctx, mode);
+    if (!s) {
+        return -EIO;
+    }
+
+    /* IOPOLL rings can only carry reads and writes */
+    assert(mode != LURING_MODE_IOPOLL || qiov);
+
+    trace_luring_co_submit(bs, s, &luringcb, fd, offset, len, type);
     ret = luring_do_submit(fd, &luringcb, s, offset, type);
 
     if (ret < 0) {
@@ -398,6 +845,39 @@ int coroutine_fn luring_co_submit(BlockDriverState *bs, int fd, uint64_t offset,
     return luringcb.ret;
 }
 
+int coroutine_fn luring_co_submit(BlockDriverState *bs, int fd, uint64_t offset,
+                                  QEMUIOVector *qiov, int type,
+                                  LuringMode mode)
+{
+    return luring_co_do_submit(bs, fd, offset, qiov, type, 0,
+                               qiov ? qiov->size : 0, mode);
+}
+
+static gpointer luring_probe_fallocate(gpointer data)
+{
+    struct io_uring_probe *probe = io_uring_get_probe();
+    bool ok = probe && io_uring_opcode_supported(probe, IORING_OP_FALLOCATE);
+
+    io_uring_free_probe(probe);
+    return GINT_TO_POINTER(ok);
+}
+
+bool luring_has_fallocate(void)
+{
+    static GOnce once = G_ONCE_INIT;
+
+    return GPOINTER_TO_INT(g_once(&once, luring_probe_fallocate, NULL));
+}
+
+int coroutine_fn luring_co_fallocate(BlockDriverState *bs, int fd, int type,
+                                     int falloc_mode, uint64_t offset,
+                                     uint64_t len, LuringMode mode)
+{
+    assert(type == QEMU_AIO_DISCARD || type == QEMU_AIO_WRITE_ZEROES);
+    return luring_co_do_submit(bs, fd, offset, NULL, type, falloc_mode, len,
+                               mode);
+}
+
 void luring_detach_aio_context(LuringState *s, AioContext *old_context)
 {
     aio_set_fd_handler(old_context, s->ring.ring_fd,
@@ -415,7 +895,69 @@ void luring_attach_aio_context(LuringState *s, AioContext *new_context)
                        qemu_luring_poll_cb, qemu_luring_poll_ready, s);
 }
 
-LuringState *luring_init(Error **errp)
+/**
+ * luring_sq_thread_cpu:
+ *
+ * Pick a CPU for the SQPOLL kernel thread next to the calling thread: the
+ * next CPU in the caller's affinity mask, so that the poller and the IOThread
+ * don't compete for the same CPU.  Returns -1 to leave the thread unpinned.
+ */
+static int luring_sq_thread_cpu(void)
+{
+    cpu_set_t set;
+    int self = sched_getcpu();
+
+    if (self < 0 || sched_getaffinity(0, sizeof(set), &set) < 0 ||
+        CPU_COUNT(&set) < 2) {
+        return -1;
+    }
+
+    for (int i = 1; i < CPU_SETSIZE; i++) {
+        int cpu = (self + i) % CPU_SETSIZE;
+
+        if (CPU_ISSET(cpu, &set)) {
+            return cpu;
+        }
+    }
+    return -1;
+}
+
+static int luring_queue_init(struct io_uring *ring, LuringMode mode)
+{
+    struct io_uring_params p = {};
+
+    switch (mode) {
+    case LURING_MODE_DEFAULT:
+        break;
+    case LURING_MODE_SQPOLL: {
+        int cpu = luring_sq_thread_cpu();
+
+        p.flags |= IORING_SETUP_SQPOLL;
+        p.sq_thread_idle = LURING_SQ_THREAD_IDLE_MS;
+        if (cpu >= 0) {
+            p.flags |= IORING_SETUP_SQ_AFF;
+            p.sq_thread_cpu = cpu;
+        }
+        break;
+    }
+    case LURING_MODE_IOPOLL:
+        p.flags |= IORING_SETUP_IOPOLL;
+        break;
+    default:
+        g_assert_not_reached();
+    }
+
+#ifdef HAVE_IO_URING_QUEUE_INIT_PARAMS
+    return io_uring_queue_init_params(MAX_ENTRIES, ring, &p);
+#else
+    if (mode != LURING_MODE_DEFAULT) {
+        return -ENOTSUP;
+    }
+    return io_uring_queue_init(MAX_ENTRIES, ring, 0);
+#endif
+}
+
+LuringState *luring_init(LuringMode mode, Error **errp)
 {
     int rc;
     LuringState *s = g_new0(LuringState, 1);
@@ -423,21 +965,91 @@ LuringState *luring_init(Error **errp)
 
     trace_luring_init_state(s, sizeof(*s));
 
-    rc = io_uring_queue_init(MAX_ENTRIES, ring, 0);
+    rc = luring_queue_init(ring, mode);
     if (rc < 0) {
-        error_setg_errno(errp, errno, "failed to init linux io_uring ring");
+        error_setg_errno(errp, -rc, "failed to init linux io_uring ring");
         g_free(s);
         return NULL;
     }
+    s->mode = mode;
 
     ioq_init(&s->io_q);
+
+    /*
+     * Start with an empty registered file table.  Kernels that don't accept
+     * sparse tables simply keep using unregistered file descriptors.
+     */
+    for (int i = 0; i < LURING_MAX_FILES; i++) {
+        s->fixed_fds[i] = -1;
+    }
+    s->fixed_files_gen = qatomic_read(&luring_files_gen);
+    s->fixed_files_ok = io_uring_register_files(ring, s->fixed_fds,
+                                                LURING_MAX_FILES) == 0;
     return s;
 
 }
 
 void luring_cleanup(LuringState *s)
 {
+    /* This also drops the registered files and buffers */
     io_uring_queue_exit(&s->ring);
+    g_free(s->fixed_bufs);
     trace_luring_cleanup_state(s);
     g_free(s);
 }
+
+void luring_register_buf(void *host, size_t size)
+{
+    LuringBuf new_buf = {
+        .host = host,
+        .size = size,
+        .refcnt = 1,
+    };
+
+    QEMU_LOCK_GUARD(&luring_bufs_lock);
+
+    if (!luring_bufs) {
+        luring_bufs = g_array_new(false, false, sizeof(LuringBuf));
+    }
+
+    for (guint i = 0; i < luring_bufs->len; i++) {
+        LuringBuf *buf = &g_array_index(luring_bufs, LuringBuf, i);
+
+        if (buf->host == host && buf->size == size) {
+            buf->refcnt++;
+            return;
+        }
+    }
+
+    g_array_append_val(luring_bufs, new_buf);
+    qatomic_set(&luring_nr_bufs, luring_bufs->len);
+    qatomic_store_release(&luring_bufs_gen, luring_bufs_gen + 1);
+}
+
+void luring_unregister_buf(void *host, size_t size)
+{
+    QEMU_LOCK_GUARD(&luring_bufs_lock);
+
+    for (guint i = 0; luring_bufs && i < luring_bufs->len; i++) {
+        LuringBuf *buf = &g_array_index(luring_bufs, LuringBuf, i);
+
+        if (buf->host == host && buf->size == size) {
+            if (--buf->refcnt == 0) {
+                g_array_remove_index_fast(luring_bufs, i);
+                qatomic_set(&luring_nr_bufs, luring_bufs->len);
+                qatomic_store_release(&luring_bufs_gen, luring_bufs_gen + 1);
+            }
+            return;
+        }
+    }
+}
+
+void luring_invalidate_fds(void)
+{
+    qatomic_inc(&luring_files_gen);
+}
+
+static void __attribute__((constructor)) luring_bufs_init(void)
+{
+    qemu_mutex_init(&luring_bufs_lock);
+}
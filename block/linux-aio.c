@@ -35,6 +35,12 @@
 /* Maximum number of requests in a batch. (default value) */
 #define DEFAULT_MAX_BATCH 32
 
+/*
+ * Gaps between submissions longer than this are treated as idle periods
+ * by adaptive batching rather than as a measure of the arrival rate.
+ */
+#define ADAPTIVE_MAX_GAP_NS (1 * SCALE_MS)
+
 struct qemu_laiocb {
     Coroutine *co;
     LinuxAioState *ctx;
@@ -43,6 +49,7 @@ struct qemu_laiocb {
     size_t nbytes;
     QEMUIOVector *qiov;
     bool is_read;
+    int64_t submit_ns; /* only set with adaptive batching */
     QSIMPLEQ_ENTRY(qemu_laiocb) next;
 };
 
@@ -64,6 +71,12 @@ struct LinuxAioState {
     QEMUBH *completion_bh;
     int event_idx;
     int event_max;
+
+    /* Adaptive batching state, see laio_adaptive_batch() */
+    uint64_t batch;         /* last batch size used */
+    int64_t last_submit_ns; /* when the previous request was queued */
+    int64_t gap_ns;         /* average time between two requests */
+    int64_t latency_ns;     /* average completion latency */
 };
 
 static void ioq_submit(LinuxAioState *s);
@@ -203,10 +216,15 @@ io_getevents_advance_and_peek(io_context_t ctx,
 static void qemu_laio_process_completions(LinuxAioState *s)
 {
     struct io_event *events;
+    int64_t now = 0;
 
     /* Reschedule so nested event loops see currently pending completions */
     qemu_bh_schedule(s->completion_bh);
 
+    if (s->aio_context->aio_batch_adaptive) {
+        now = get_clock();
+    }
+
     while ((s->event_max = io_getevents_advance_and_peek(s->ctx, &events,
                                                          s->event_idx))) {
         for (s->event_idx = 0; s->event_idx < s->event_max; ) {
@@ -216,6 +234,10 @@ static void qemu_laio_process_completions(LinuxAioState *s)
 
             laiocb->ret = io_event_ret(&events[s->event_idx]);
 
+            if (now && laiocb->submit_ns) {
+                s->latency_ns += (now - laiocb->submit_ns - s->latency_ns) / 8;
+            }
+
             /* Change counters one-by-one because we can be nested. */
             s->io_q.in_flight--;
             s->event_idx++;
@@ -336,6 +358,25 @@ static void ioq_submit(LinuxAioState *s)
     }
 }
 
+/*
+ * Pick a batch size in the spirit of interrupt coalescing: holding requests
+ * back only pays off while the device is kept busy by earlier ones, so the
+ * batch may grow to half the number of requests in flight.  It is further
+ * capped so that waiting for the batch to fill adds no more than about an
+ * eighth of the average completion latency.  With nothing in flight, each
+ * request is submitted right away.
+ */
+static uint64_t laio_adaptive_batch(LinuxAioState *s, uint64_t max_batch)
+{
+    uint64_t batch = MAX(s->io_q.in_flight / 2, 1);
+
+    if (s->gap_ns > 0) {
+        batch = MIN(batch, MAX(s->latency_ns / (8 * s->gap_ns), 1));
+    }
+
+    return MIN(batch, max_batch);
+}
+
 static uint64_t laio_max_batch(LinuxAioState *s, uint64_t dev_max_batch)
 {
     uint64_t max_batch = s->aio_context->aio_max_batch ?: DEFAULT_MAX_BATCH;
@@ -347,6 +388,11 @@ static uint64_t laio_max_batch(LinuxAioState *s, uint64_t dev_max_batch)
      */
     max_batch = MIN_NON_ZERO(dev_max_batch, max_batch);
 
+    if (s->aio_context->aio_batch_adaptive) {
+        max_batch = laio_adaptive_batch(s, max_batch);
+    }
+    s->batch = max_batch;
+
     /* limit the batch with the number of available events */
     max_batch = MIN_NON_ZERO(MAX_EVENTS - s->io_q.in_flight, max_batch);
 
@@ -387,6 +433,17 @@ static int laio_do_submit(int fd, struct qemu_laiocb *laiocb, off_t offset,
     }
     io_set_eventfd(&laiocb->iocb, event_notifier_get_fd(&s->e));
 
+    if (s->aio_context->aio_batch_adaptive) {
+        int64_t now = get_clock();
+
+        if (s->last_submit_ns) {
+            int64_t gap = MIN(now - s->last_submit_ns, ADAPTIVE_MAX_GAP_NS);
+            s->gap_ns += (gap - s->gap_ns) / 8;
+        }
+        s->last_submit_ns = now;
+        laiocb->submit_ns = now;
+    }
+
     QSIMPLEQ_INSERT_TAIL(&s->io_q.pending, laiocb, next);
     s->io_q.in_queue++;
     if (!s->io_q.blocked) {
@@ -442,6 +499,17 @@ void laio_attach_aio_context(LinuxAioState *s, AioContext *new_context)
                            qemu_laio_poll_ready);
 }
 
+/*
+ * Called from the monitor, so the values may be slightly out of date, which
+ * doesn't matter for statistics.
+ */
+void laio_get_batch_info(LinuxAioState *s, uint64_t *batch,
+                         uint64_t *latency_ns)
+{
+    *batch = s->batch ?: DEFAULT_MAX_BATCH;
+    *latency_ns = s->latency_ns;
+}
+
 LinuxAioState *laio_init(Error **errp)
 {
     int rc;
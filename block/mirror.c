@@ -29,6 +29,18 @@
 #define MAX_IO_BYTES (1 << 20) /* 1 Mb */
 #define DEFAULT_MIRROR_BUF_SIZE (MAX_IN_FLIGHT * MAX_IO_BYTES)
 
+/*
+ * The number of background copy operations in flight starts at
+ * MAX_IN_FLIGHT and is adapted to the target's write latency: it grows while
+ * the latency stays close to the lowest one seen, and shrinks when the target
+ * queues up requests.  Fewer operations in flight mean larger ones.
+ */
+#define MIRROR_MAX_IN_FLIGHT_LIMIT 64
+#define MIRROR_LATENCY_CONGESTED 2 /* times the lowest latency seen */
+
+/* Guest writes are tracked in at most this many regions */
+#define MIRROR_HOT_REGIONS (1 << 23)
+
 /* The mirroring buffer is a list of granularity-sized chunks.
  * Free chunks are organized in a list.
  */
@@ -74,7 +86,22 @@ typedef struct MirrorBlockJob {
     uint64_t last_pause_ns;
     unsigned long *in_flight_bitmap;
     unsigned in_flight;
+    unsigned max_in_flight;
+    unsigned max_in_flight_limit;
     int64_t bytes_in_flight;
+    /* Target write latency statistics for adapting max_in_flight */
+    int64_t latency_ewma_ns;
+    int64_t latency_min_ns;
+    unsigned latency_samples;
+    /*
+     * Regions of hot_granularity bytes written by the guest during the
+     * current pass over the dirty bitmap.  Their copy is deferred to the
+     * next pass, because they are likely to be dirtied again.
+     */
+    unsigned long *hot_bitmap;
+    int64_t hot_granularity;
+    bool skip_hot;
+    bool pass_copied;
     QTAILQ_HEAD(, MirrorOp) ops_in_flight;
     int ret;
     bool unmap;
@@ -106,6 +133,7 @@ struct MirrorOp {
     bool is_pseudo_op;
     bool is_active_write;
     bool is_in_flight;
+    int64_t write_start_ns;
     CoQueue waiting_requests;
     Coroutine *co;
     MirrorOp *waiting_for_op;
@@ -222,6 +250,46 @@ static void coroutine_fn mirror_iteration_done(MirrorOp *op, int ret)
     g_free(op);
 }
 
+/*
+ * Adapt the number of background operations in flight to the latency of a
+ * completed copy write.  Decisions are taken once per max_in_flight samples,
+ * so that each one sees the effect of the previous.
+ */
+static void mirror_adapt_in_flight(MirrorBlockJob *s, int64_t latency_ns)
+{
+    unsigned old = s->max_in_flight;
+
+    if (!s->latency_samples++) {
+        s->latency_ewma_ns = latency_ns;
+        s->latency_min_ns = latency_ns;
+        return;
+    }
+
+    s->latency_ewma_ns += (latency_ns - s->latency_ewma_ns) / 8;
+    if (latency_ns < s->latency_min_ns) {
+        s->latency_min_ns = latency_ns;
+    } else {
+        /* Forget the minimum slowly in case the target got slower */
+        s->latency_min_ns += (latency_ns - s->latency_min_ns) / 256;
+    }
+
+    if (s->latency_samples < s->max_in_flight) {
+        return;
+    }
+    s->latency_samples = 1;
+
+    if (s->latency_ewma_ns > MIRROR_LATENCY_CONGESTED * s->latency_min_ns) {
+        s->max_in_flight = MAX(s->max_in_flight - s->max_in_flight / 4, 1);
+    } else if (s->max_in_flight < s->max_in_flight_limit) {
+        s->max_in_flight++;
+    }
+
+    if (s->max_in_flight != old) {
+        trace_mirror_adapt_in_flight(s, s->latency_ewma_ns, s->latency_min_ns,
+                                     s->max_in_flight);
+    }
+}
+
 static void coroutine_fn mirror_write_complete(MirrorOp *op, int ret)
 {
     MirrorBlockJob *s = op->s;
@@ -234,6 +302,9 @@ static void coroutine_fn mirror_write_complete(MirrorOp *op, int ret)
         if (action == BLOCK_ERROR_ACTION_REPORT && s->ret >= 0) {
             s->ret = ret;
         }
+    } else if (op->write_start_ns) {
+        mirror_adapt_in_flight(s, qemu_clock_get_ns(QEMU_CLOCK_REALTIME) -
+                                  op->write_start_ns);
     }
 
     mirror_iteration_done(op, ret);
@@ -256,6 +327,7 @@ static void coroutine_fn mirror_read_complete(MirrorOp *op, int ret)
         return;
     }
 
+    op->write_start_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
     ret = blk_co_pwritev(s->target, op->offset, op->qiov.size, &op->qiov, 0);
     mirror_write_complete(op, ret);
 }
@@ -471,24 +543,80 @@ static unsigned mirror_perform(MirrorBlockJob *s, int64_t offset,
     return bytes_handled;
 }
 
+/* Called from the guest write path, possibly in another thread */
+static void mirror_mark_hot(MirrorBlockJob *s, int64_t offset, int64_t bytes)
+{
+    int64_t region;
+
+    if (!s->hot_bitmap || !bytes) {
+        return;
+    }
+    for (region = offset / s->hot_granularity;
+         region <= (offset + bytes - 1) / s->hot_granularity;
+         region++) {
+        set_bit_atomic(region, s->hot_bitmap);
+    }
+}
+
+/* Called with the dirty bitmap locked */
+static void mirror_restart_pass(MirrorBlockJob *s)
+{
+    bdrv_set_dirty_iter(s->dbi, 0);
+    trace_mirror_restart_iter(s, bdrv_get_dirty_count(s->dirty_bitmap));
+
+    if (s->hot_bitmap) {
+        s->skip_hot = s->pass_copied;
+        s->pass_copied = false;
+        bitmap_zero(s->hot_bitmap,
+                    DIV_ROUND_UP(s->bdev_length, s->hot_granularity));
+    }
+}
+
+/*
+ * Return the next dirty offset to copy, skipping regions the guest wrote
+ * during the current pass.  A pass that only finds such regions disables
+ * skipping for the next one, so the job always makes progress.
+ *
+ * Called with the dirty bitmap locked; the bitmap must not be clean.
+ */
+static int64_t mirror_next_dirty_offset(MirrorBlockJob *s)
+{
+    for (;;) {
+        int64_t offset = bdrv_dirty_iter_next(s->dbi);
+        int64_t next_region;
+
+        if (offset < 0) {
+            mirror_restart_pass(s);
+            continue;
+        }
+
+        if (!s->skip_hot ||
+            !test_bit(offset / s->hot_granularity, s->hot_bitmap)) {
+            s->pass_copied = true;
+            return offset;
+        }
+
+        next_region = QEMU_ALIGN_UP(offset + 1, s->hot_granularity);
+        if (next_region < s->bdev_length) {
+            bdrv_set_dirty_iter(s->dbi, next_region);
+        } else {
+            mirror_restart_pass(s);
+        }
+    }
+}
+
 static void coroutine_fn mirror_iteration(MirrorBlockJob *s)
 {
     BlockDriverState *source = s->mirror_top_bs->backing->bs;
     MirrorOp *pseudo_op;
-    int64_t offset;
+    int64_t offset, end, dirty_start, dirty_count;
     /* At least the first dirty chunk is mirrored in one iteration. */
     int nb_chunks = 1;
     bool write_zeroes_ok = bdrv_can_write_zeroes_with_unmap(blk_bs(s->target));
-    int max_io_bytes = MAX(s->buf_size / MAX_IN_FLIGHT, MAX_IO_BYTES);
+    int max_io_bytes = MAX(s->buf_size / s->max_in_flight, MAX_IO_BYTES);
 
     bdrv_dirty_bitmap_lock(s->dirty_bitmap);
-    offset = bdrv_dirty_iter_next(s->dbi);
-    if (offset < 0) {
-        bdrv_set_dirty_iter(s->dbi, 0);
-        offset = bdrv_dirty_iter_next(s->dbi);
-        trace_mirror_restart_iter(s, bdrv_get_dirty_count(s->dirty_bitmap));
-        assert(offset >= 0);
-    }
+    offset = mirror_next_dirty_offset(s);
     bdrv_dirty_bitmap_unlock(s->dirty_bitmap);
 
     /*
@@ -502,29 +630,25 @@ static void coroutine_fn mirror_iteration(MirrorBlockJob *s)
 
     job_pause_point(&s->common.job);
 
-    /* Find the number of consective dirty chunks following the first dirty
-     * one, and wait for in flight requests in them. */
+    /* Coalesce the dirty chunks directly following the first dirty one,
+     * up to the first chunk with a request in flight. */
     bdrv_dirty_bitmap_lock(s->dirty_bitmap);
-    while (nb_chunks * s->granularity < s->buf_size) {
-        int64_t next_dirty;
-        int64_t next_offset = offset + nb_chunks * s->granularity;
-        int64_t next_chunk = next_offset / s->granularity;
-        if (next_offset >= s->bdev_length ||
-            !bdrv_dirty_bitmap_get_locked(s->dirty_bitmap, next_offset)) {
-            break;
-        }
-        if (test_bit(next_chunk, s->in_flight_bitmap)) {
-            break;
-        }
+    end = MIN(offset + s->buf_size, s->bdev_length);
+    if (offset + s->granularity < end &&
+        bdrv_dirty_bitmap_next_dirty_area(s->dirty_bitmap,
+                                          offset + s->granularity, end,
+                                          end - offset - s->granularity,
+                                          &dirty_start, &dirty_count) &&
+        dirty_start == offset + s->granularity) {
+        int64_t first_chunk = dirty_start / s->granularity;
+        int64_t end_chunk = DIV_ROUND_UP(dirty_start + dirty_count,
+                                         s->granularity);
 
-        next_dirty = bdrv_dirty_iter_next(s->dbi);
-        if (next_dirty > next_offset || next_dirty < 0) {
-            /* The bitmap iterator's cache is stale, refresh it */
-            bdrv_set_dirty_iter(s->dbi, next_offset);
-            next_dirty = bdrv_dirty_iter_next(s->dbi);
-        }
-        assert(next_dirty == next_offset);
-        nb_chunks++;
+        nb_chunks += find_next_bit(s->in_flight_bitmap, end_chunk,
+                                   first_chunk) - first_chunk;
+    }
+    if (offset + nb_chunks * s->granularity < s->bdev_length) {
+        bdrv_set_dirty_iter(s->dbi, offset + nb_chunks * s->granularity);
     }
 
     /* Clear dirty bits before querying the block status, because
@@ -587,7 +711,7 @@ static void coroutine_fn mirror_iteration(MirrorBlockJob *s)
             }
         }
 
-        while (s->in_flight >= MAX_IN_FLIGHT) {
+        while (s->in_flight >= s->max_in_flight) {
             trace_mirror_yield_in_flight(s, offset, s->in_flight);
             mirror_wait_for_free_in_flight_slot(s);
         }
@@ -786,6 +910,8 @@ static int mirror_exit_common(Job *job)
     bdrv_replace_node(mirror_top_bs, mirror_top_bs->backing->bs, &error_abort);
 
     bs_opaque->job = NULL;
+    g_free(s->hot_bitmap);
+    s->hot_bitmap = NULL;
 
     bdrv_drained_end(src);
     bdrv_drained_end(mirror_top_bs);
@@ -968,6 +1094,12 @@ static int coroutine_fn mirror_run(Job *job, Error **errp)
     length = DIV_ROUND_UP(s->bdev_length, s->granularity);
     s->in_flight_bitmap = bitmap_new(length);
 
+    s->hot_granularity = MAX(s->granularity,
+                             DIV_ROUND_UP(s->bdev_length, MIRROR_HOT_REGIONS));
+    s->hot_bitmap = bitmap_new(DIV_ROUND_UP(s->bdev_length,
+                                            s->hot_granularity));
+    s->skip_hot = true;
+
     /* If we have no backing file yet in the destination, we cannot let
      * the destination do COW.  Instead, we copy sectors around the
      * dirty data if needed.  We need a bitmap to do that.
@@ -988,6 +1120,12 @@ static int coroutine_fn mirror_run(Job *job, Error **errp)
     }
     s->max_iov = MIN(bs->bl.max_iov, target_bs->bl.max_iov);
 
+    /* Beyond this, operations would only wait for buffer space */
+    s->max_in_flight = MAX_IN_FLIGHT;
+    s->max_in_flight_limit = MIN(MIRROR_MAX_IN_FLIGHT_LIMIT,
+                                 MAX(MAX_IN_FLIGHT,
+                                     s->buf_size / MAX_IO_BYTES));
+
     s->buf = qemu_try_blockalign(bs, s->buf_size);
     if (s->buf == NULL) {
         ret = -ENOMEM;
@@ -1046,7 +1184,7 @@ static int coroutine_fn mirror_run(Job *job, Error **errp)
         }
         if (delta < BLOCK_JOB_SLICE_TIME &&
             iostatus == BLOCK_DEVICE_IO_STATUS_OK) {
-            if (s->in_flight >= MAX_IN_FLIGHT || s->buf_free_count == 0 ||
+            if (s->in_flight >= s->max_in_flight || s->buf_free_count == 0 ||
                 (cnt == 0 && s->in_flight > 0)) {
                 trace_mirror_yield(s, cnt, s->buf_free_count, s->in_flight);
                 mirror_wait_for_free_in_flight_slot(s);
@@ -1477,6 +1615,8 @@ bdrv_mirror_top_do_write(BlockDriverState *bs, MirrorMethod method,
 
     if (copy_to_target) {
         op = active_write_prepare(s->job, offset, bytes);
+    } else if (s->job) {
+        mirror_mark_hot(s->job, offset, bytes);
     }
 
     switch (method) {
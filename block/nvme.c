@@ -92,6 +92,16 @@ typedef struct {
 
     /* Thread-safe, no lock necessary */
     QEMUBH      *completion_bh;
+
+    /*
+     * I/O queues are claimed by the first AioContext that submits to them.
+     * That AioContext polls the queue through @poll_notifier, which is never
+     * signalled; completions are also picked up by the shared IRQ handler
+     * when the owning AioContext isn't polling.  Claims are dropped when the
+     * node changes AioContext.
+     */
+    AioContext  *ctx;
+    EventNotifier poll_notifier;
 } NVMeQueuePair;
 
 struct BDRVNVMeState {
@@ -142,6 +152,7 @@ struct BDRVNVMeState {
 
 #define NVME_BLOCK_OPT_DEVICE "device"
 #define NVME_BLOCK_OPT_NAMESPACE "namespace"
+#define NVME_BLOCK_OPT_IO_QUEUES "io-queues"
 
 static void nvme_process_completion_bh(void *opaque);
 
@@ -159,6 +170,11 @@ static QemuOptsList runtime_opts = {
             .type = QEMU_OPT_NUMBER,
             .help = "NVMe namespace",
         },
+        {
+            .name = NVME_BLOCK_OPT_IO_QUEUES,
+            .type = QEMU_OPT_NUMBER,
+            .help = "Number of I/O queue pairs (default: 1)",
+        },
         { /* end of list */ }
     },
 };
@@ -196,6 +212,7 @@ static void nvme_free_queue_pair(NVMeQueuePair *q)
     if (q->completion_bh) {
         qemu_bh_delete(q->completion_bh);
     }
+    event_notifier_cleanup(&q->poll_notifier);
     nvme_free_queue(&q->sq);
     nvme_free_queue(&q->cq);
     qemu_vfree(q->prp_list_pages);
@@ -240,6 +257,12 @@ static NVMeQueuePair *nvme_create_queue_pair(BDRVNVMeState *s,
         goto fail;
     }
     memset(q->prp_list_pages, 0, bytes);
+    if (event_notifier_init(&q->poll_notifier, 0)) {
+        error_setg(errp, "Failed to init queue event notifier");
+        qemu_vfree(q->prp_list_pages);
+        g_free(q);
+        return NULL;
+    }
     qemu_mutex_init(&q->lock);
     q->s = s;
     q->index = idx;
@@ -341,8 +364,9 @@ static void nvme_put_free_req_locked(NVMeQueuePair *q, NVMeRequest *req)
 static void nvme_wake_free_req_locked(NVMeQueuePair *q)
 {
     if (!qemu_co_queue_empty(&q->free_req_queue)) {
-        replay_bh_schedule_oneshot_event(q->s->aio_context,
-                nvme_free_req_queue_cb, q);
+        AioContext *ctx = qatomic_read(&q->ctx) ?: q->s->aio_context;
+
+        replay_bh_schedule_oneshot_event(ctx, nvme_free_req_queue_cb, q);
     }
 }
 
@@ -455,11 +479,13 @@ static void nvme_process_completion_bh(void *opaque)
      * called aio_poll(). The callback may be waiting for further completions
      * so notify the device that it has space to fill in more completions now.
      */
+    qemu_mutex_lock(&q->lock);
     smp_mb_release();
     *q->cq.doorbell = cpu_to_le32(q->cq.head);
     nvme_wake_free_req_locked(q);
 
     nvme_process_completion(q);
+    qemu_mutex_unlock(&q->lock);
 }
 
 static void nvme_trace_command(const NvmeCmd *cmd)
@@ -620,18 +646,23 @@ out:
     return ret;
 }
 
-static void nvme_poll_queue(NVMeQueuePair *q)
+/*
+ * Early check for completions.  q->lock isn't taken: at worst a stale head
+ * or phase makes us take the lock for nothing, or skip a completion that
+ * the other thread polling this queue is about to process anyway.
+ */
+static bool nvme_cq_pending(NVMeQueuePair *q)
 {
     const size_t cqe_offset = q->cq.head * NVME_CQ_ENTRY_BYTES;
     NvmeCqe *cqe = (NvmeCqe *)&q->cq.queue[cqe_offset];
 
+    return (le16_to_cpu(cqe->status) & 0x1) != q->cq_phase;
+}
+
+static void nvme_poll_queue(NVMeQueuePair *q)
+{
     trace_nvme_poll_queue(q->s, q->index);
-    /*
-     * Do an early check for completions. q->lock isn't needed because
-     * nvme_process_completion() only runs in the event loop thread and
-     * cannot race with itself.
-     */
-    if ((le16_to_cpu(cqe->status) & 0x1) == q->cq_phase) {
+    if (!nvme_cq_pending(q)) {
         return;
     }
 
@@ -670,6 +701,11 @@ static bool nvme_add_io_queue(BlockDriverState *bs, Error **errp)
     unsigned queue_size = NVME_QUEUE_SIZE;
 
     assert(n <= UINT16_MAX);
+    if ((n + 1) * s->doorbell_scale * sizeof(*s->doorbells) >
+        NVME_DOORBELL_SIZE) {
+        error_setg(errp, "No doorbell space for io queue [%u]", n);
+        return false;
+    }
     q = nvme_create_queue_pair(s, bdrv_get_aio_context(bs),
                                n, queue_size, errp);
     if (!q) {
@@ -712,15 +748,7 @@ static bool nvme_poll_cb(void *opaque)
     int i;
 
     for (i = 0; i < s->queue_count; i++) {
-        NVMeQueuePair *q = s->queues[i];
-        const size_t cqe_offset = q->cq.head * NVME_CQ_ENTRY_BYTES;
-        NvmeCqe *cqe = (NvmeCqe *)&q->cq.queue[cqe_offset];
-
-        /*
-         * q->lock isn't needed because nvme_process_completion() only runs in
-         * the event loop thread and cannot race with itself.
-         */
-        if ((le16_to_cpu(cqe->status) & 0x1) != q->cq_phase) {
+        if (nvme_cq_pending(s->queues[i])) {
             return true;
         }
     }
@@ -735,8 +763,75 @@ static void nvme_poll_ready(EventNotifier *e)
     nvme_poll_queues(s);
 }
 
+static void nvme_queue_handle_event(EventNotifier *n)
+{
+    NVMeQueuePair *q = container_of(n, NVMeQueuePair, poll_notifier);
+
+    event_notifier_test_and_clear(n);
+    nvme_poll_queue(q);
+}
+
+static bool nvme_queue_poll_cb(void *opaque)
+{
+    EventNotifier *e = opaque;
+    NVMeQueuePair *q = container_of(e, NVMeQueuePair, poll_notifier);
+
+    return nvme_cq_pending(q);
+}
+
+static void nvme_queue_poll_ready(EventNotifier *e)
+{
+    NVMeQueuePair *q = container_of(e, NVMeQueuePair, poll_notifier);
+
+    nvme_poll_queue(q);
+}
+
+/*
+ * Pick the I/O queue for the current AioContext, claiming an unused one the
+ * first time an AioContext submits.  Once every queue is claimed, further
+ * AioContexts share them.
+ */
+static NVMeQueuePair *nvme_get_io_queue(BDRVNVMeState *s)
+{
+    AioContext *ctx = qemu_get_current_aio_context();
+    unsigned nr_io_queues = s->queue_count - INDEX_IO(0);
+    unsigned i;
+
+    for (i = 0; i < nr_io_queues; i++) {
+        NVMeQueuePair *q = s->queues[INDEX_IO(i)];
+        AioContext *owner = qatomic_read(&q->ctx);
+
+        if (owner == ctx) {
+            return q;
+        }
+        if (!owner && !qatomic_cmpxchg(&q->ctx, NULL, ctx)) {
+            trace_nvme_claim_io_queue(s, q->index, ctx);
+            aio_set_event_notifier(ctx, &q->poll_notifier,
+                                   nvme_queue_handle_event,
+                                   nvme_queue_poll_cb,
+                                   nvme_queue_poll_ready);
+            return q;
+        }
+    }
+    return s->queues[INDEX_IO(((uintptr_t)ctx >> 6) % nr_io_queues)];
+}
+
+/* Called with the node drained */
+static void nvme_release_io_queues(BDRVNVMeState *s)
+{
+    for (unsigned i = INDEX_IO(0); i < s->queue_count; i++) {
+        NVMeQueuePair *q = s->queues[i];
+
+        if (q->ctx) {
+            aio_set_event_notifier(q->ctx, &q->poll_notifier,
+                                   NULL, NULL, NULL);
+            qatomic_set(&q->ctx, NULL);
+        }
+    }
+}
+
 static int nvme_init(BlockDriverState *bs, const char *device, int namespace,
-                     Error **errp)
+                     unsigned io_queues, Error **errp)
 {
     BDRVNVMeState *s = bs->opaque;
     NVMeQueuePair *q;
@@ -875,9 +970,32 @@ static int nvme_init(BlockDriverState *bs, const char *device, int namespace,
         goto out;
     }
 
+    if (io_queues > 1) {
+        /* Number of Queues, both counts are 0's based */
+        NvmeCmd cmd = {
+            .opcode = NVME_ADM_CMD_SET_FEATURES,
+            .cdw10 = cpu_to_le32(0x07),
+            .cdw11 = cpu_to_le32(((io_queues - 1) << 16) | (io_queues - 1)),
+        };
+
+        if (nvme_admin_cmd_sync(bs, &cmd)) {
+            warn_report("nvme: failed to request %u I/O queues", io_queues);
+        }
+    }
+
     /* Set up command queues. */
     if (!nvme_add_io_queue(bs, errp)) {
         ret = -EIO;
+        goto out;
+    }
+    while (s->queue_count < INDEX_IO(io_queues)) {
+        Error *local_err = NULL;
+
+        if (!nvme_add_io_queue(bs, &local_err)) {
+            warn_reportf_err(local_err, "nvme: using %u of %u I/O queues: ",
+                             s->queue_count - INDEX_IO(0), io_queues);
+            break;
+        }
     }
 out:
     if (regs) {
@@ -947,6 +1065,7 @@ static void nvme_close(BlockDriverState *bs)
 {
     BDRVNVMeState *s = bs->opaque;
 
+    nvme_release_io_queues(s);
     for (unsigned i = 0; i < s->queue_count; ++i) {
         nvme_free_queue_pair(s->queues[i]);
     }
@@ -968,6 +1087,7 @@ static int nvme_file_open(BlockDriverState *bs, QDict *options, int flags,
     const char *device;
     QemuOpts *opts;
     int namespace;
+    uint64_t io_queues;
     int ret;
     BDRVNVMeState *s = bs->opaque;
 
@@ -983,7 +1103,14 @@ static int nvme_file_open(BlockDriverState *bs, QDict *options, int flags,
     }
 
     namespace = qemu_opt_get_number(opts, NVME_BLOCK_OPT_NAMESPACE, 1);
-    ret = nvme_init(bs, device, namespace, errp);
+    io_queues = qemu_opt_get_number(opts, NVME_BLOCK_OPT_IO_QUEUES, 1);
+    if (io_queues < 1 || io_queues > UINT16_MAX) {
+        error_setg(errp, "'" NVME_BLOCK_OPT_IO_QUEUES "' must be between 1 "
+                   "and %u", UINT16_MAX);
+        qemu_opts_del(opts);
+        return -EINVAL;
+    }
+    ret = nvme_init(bs, device, namespace, io_queues, errp);
     qemu_opts_del(opts);
     if (ret) {
         goto fail;
@@ -1183,7 +1310,7 @@ static coroutine_fn int nvme_co_prw_aligned(BlockDriverState *bs,
 {
     int r;
     BDRVNVMeState *s = bs->opaque;
-    NVMeQueuePair *ioq = s->queues[INDEX_IO(0)];
+    NVMeQueuePair *ioq = nvme_get_io_queue(s);
     NVMeRequest *req;
 
     uint32_t cdw12 = (((bytes >> s->blkshift) - 1) & 0xFFFF) |
@@ -1196,7 +1323,7 @@ static coroutine_fn int nvme_co_prw_aligned(BlockDriverState *bs,
         .cdw12 = cpu_to_le32(cdw12),
     };
     NVMeCoData data = {
-        .ctx = bdrv_get_aio_context(bs),
+        .ctx = qemu_get_current_aio_context(),
         .ret = -EINPROGRESS,
     };
 
@@ -1304,14 +1431,14 @@ static coroutine_fn int nvme_co_pwritev(BlockDriverState *bs,
 static coroutine_fn int nvme_co_flush(BlockDriverState *bs)
 {
     BDRVNVMeState *s = bs->opaque;
-    NVMeQueuePair *ioq = s->queues[INDEX_IO(0)];
+    NVMeQueuePair *ioq = nvme_get_io_queue(s);
     NVMeRequest *req;
     NvmeCmd cmd = {
         .opcode = NVME_CMD_FLUSH,
         .nsid = cpu_to_le32(s->nsid),
     };
     NVMeCoData data = {
-        .ctx = bdrv_get_aio_context(bs),
+        .ctx = qemu_get_current_aio_context(),
         .ret = -EINPROGRESS,
     };
 
@@ -1335,7 +1462,7 @@ static coroutine_fn int nvme_co_pwrite_zeroes(BlockDriverState *bs,
                                               BdrvRequestFlags flags)
 {
     BDRVNVMeState *s = bs->opaque;
-    NVMeQueuePair *ioq = s->queues[INDEX_IO(0)];
+    NVMeQueuePair *ioq = nvme_get_io_queue(s);
     NVMeRequest *req;
     uint32_t cdw12;
 
@@ -1362,7 +1489,7 @@ static coroutine_fn int nvme_co_pwrite_zeroes(BlockDriverState *bs,
     };
 
     NVMeCoData data = {
-        .ctx = bdrv_get_aio_context(bs),
+        .ctx = qemu_get_current_aio_context(),
         .ret = -EINPROGRESS,
     };
 
@@ -1398,7 +1525,7 @@ static int coroutine_fn nvme_co_pdiscard(BlockDriverState *bs,
                                          int64_t bytes)
 {
     BDRVNVMeState *s = bs->opaque;
-    NVMeQueuePair *ioq = s->queues[INDEX_IO(0)];
+    NVMeQueuePair *ioq = nvme_get_io_queue(s);
     NVMeRequest *req;
     QEMU_AUTO_VFREE NvmeDsmRange *buf = NULL;
     QEMUIOVector local_qiov;
@@ -1412,7 +1539,7 @@ static int coroutine_fn nvme_co_pdiscard(BlockDriverState *bs,
     };
 
     NVMeCoData data = {
-        .ctx = bdrv_get_aio_context(bs),
+        .ctx = qemu_get_current_aio_context(),
         .ret = -EINPROGRESS,
     };
 
@@ -1542,6 +1669,7 @@ static void nvme_detach_aio_context(BlockDriverState *bs)
 {
     BDRVNVMeState *s = bs->opaque;
 
+    nvme_release_io_queues(s);
     for (unsigned i = 0; i < s->queue_count; i++) {
         NVMeQueuePair *q = s->queues[i];
 
@@ -1612,6 +1740,7 @@ static BlockStatsSpecific *nvme_get_specific_stats(BlockDriverState *bs)
 static const char *const nvme_strong_runtime_opts[] = {
     NVME_BLOCK_OPT_DEVICE,
     NVME_BLOCK_OPT_NAMESPACE,
+    NVME_BLOCK_OPT_IO_QUEUES,
 
     NULL
 };
@@ -451,7 +451,7 @@ fail:
 }
 
 /* @p_info will be set only on success. */
-static void bdrv_query_info(BlockBackend *blk, BlockInfo **p_info,
+static bool bdrv_query_info(BlockBackend *blk, BlockInfo **p_info,
                             Error **errp)
 {
     BlockInfo *info = g_malloc0(sizeof(*info));
@@ -491,10 +491,11 @@ static void bdrv_query_info(BlockBackend *blk, BlockInfo **p_info,
     }
 
     *p_info = info;
-    return;
+    return true;
 
  err:
     qapi_free_BlockInfo(info);
+    return false;
 }
 
 static uint64List *uint64_list(uint64_t *list, int size)
@@ -694,37 +695,106 @@ bdrv_query_bds_stats(BlockDriverState *bs, bool blk_level)
     return s;
 }
 
-BlockInfoList *qmp_query_block(Error **errp)
+/*
+ * The filtered forms of the block queries below only visit the nodes or
+ * devices that the caller asked for, so that management software can poll
+ * a few of them cheaply even when the VM has hundreds.
+ */
+static BlockBackend *qmp_query_find_blk(const char *name, Error **errp)
+{
+    BlockBackend *blk = blk_by_name(name);
+
+    if (!blk) {
+        error_set(errp, ERROR_CLASS_DEVICE_NOT_FOUND,
+                  "Device '%s' not found", name);
+    }
+    return blk;
+}
+
+static BlockDriverState *qmp_query_find_node(const char *name, Error **errp)
+{
+    BlockDriverState *bs = bdrv_find_node(name);
+
+    if (!bs) {
+        error_setg(errp, "Cannot find node '%s'", name);
+    }
+    return bs;
+}
+
+static bool qmp_query_blk_visible(BlockBackend *blk)
 {
-    BlockInfoList *head = NULL, **p_next = &head;
+    return *blk_name(blk) || blk_get_attached_dev(blk);
+}
+
+BlockInfoList *qmp_query_block(strList *devices, Error **errp)
+{
+    BlockInfoList *head = NULL, **tail = &head;
     BlockBackend *blk;
-    Error *local_err = NULL;
+    BlockInfo *info;
+
+    if (devices) {
+        for (; devices; devices = devices->next) {
+            blk = qmp_query_find_blk(devices->value, errp);
+            if (!blk || !bdrv_query_info(blk, &info, errp)) {
+                qapi_free_BlockInfoList(head);
+                return NULL;
+            }
+            QAPI_LIST_APPEND(tail, info);
+        }
+        return head;
+    }
 
     for (blk = blk_all_next(NULL); blk; blk = blk_all_next(blk)) {
-        BlockInfoList *info;
-
-        if (!*blk_name(blk) && !blk_get_attached_dev(blk)) {
+        if (!qmp_query_blk_visible(blk)) {
             continue;
         }
-
-        info = g_malloc0(sizeof(*info));
-        bdrv_query_info(blk, &info->value, &local_err);
-        if (local_err) {
-            error_propagate(errp, local_err);
-            g_free(info);
+        if (!bdrv_query_info(blk, &info, errp)) {
             qapi_free_BlockInfoList(head);
             return NULL;
         }
-
-        *p_next = info;
-        p_next = &info->next;
+        QAPI_LIST_APPEND(tail, info);
     }
 
     return head;
 }
 
+static BlockStats *qmp_query_blk_stats(BlockBackend *blk)
+{
+    AioContext *ctx = blk_get_aio_context(blk);
+    BlockStats *s;
+    char *qdev;
+
+    aio_context_acquire(ctx);
+    s = bdrv_query_bds_stats(blk_bs(blk), true);
+    s->device = g_strdup(blk_name(blk));
+
+    qdev = blk_get_attached_dev_id(blk);
+    if (qdev && *qdev) {
+        s->qdev = qdev;
+    } else {
+        g_free(qdev);
+    }
+
+    bdrv_query_blk_stats(s->stats, blk);
+    aio_context_release(ctx);
+    return s;
+}
+
+static BlockStats *qmp_query_node_stats(BlockDriverState *bs)
+{
+    AioContext *ctx = bdrv_get_aio_context(bs);
+    BlockStats *s;
+
+    aio_context_acquire(ctx);
+    s = bdrv_query_bds_stats(bs, false);
+    aio_context_release(ctx);
+    return s;
+}
+
 BlockStatsList *qmp_query_blockstats(bool has_query_nodes,
                                      bool query_nodes,
+                                     strList *node_names,
+                                     strList *devices,
                                      Error **errp)
 {
     BlockStatsList *head = NULL, **tail = &head;
@@ -733,40 +803,39 @@ BlockStatsList *qmp_query_blockstats(bool has_query_nodes,
 
     GRAPH_RDLOCK_GUARD_MAINLOOP();
 
+    if (node_names && devices) {
+        error_setg(errp, "'node-names' and 'devices' are mutually exclusive");
+        return NULL;
+    }
+
+    if (node_names) {
+        for (; node_names; node_names = node_names->next) {
+            bs = qmp_query_find_node(node_names->value, errp);
+            if (!bs) {
+                qapi_free_BlockStatsList(head);
+                return NULL;
+            }
+            QAPI_LIST_APPEND(tail, qmp_query_node_stats(bs));
+        }
+    } else if (devices) {
+        for (; devices; devices = devices->next) {
+            blk = qmp_query_find_blk(devices->value, errp);
+            if (!blk) {
+                qapi_free_BlockStatsList(head);
+                return NULL;
+            }
+            QAPI_LIST_APPEND(tail, qmp_query_blk_stats(blk));
+        }
     /* Just to be safe if query_nodes is not always initialized */
-    if (has_query_nodes && query_nodes) {
+    } else if (has_query_nodes && query_nodes) {
         for (bs = bdrv_next_node(NULL); bs; bs = bdrv_next_node(bs)) {
-            AioContext *ctx = bdrv_get_aio_context(bs);
-
-            aio_context_acquire(ctx);
-            QAPI_LIST_APPEND(tail, bdrv_query_bds_stats(bs, false));
-            aio_context_release(ctx);
+            QAPI_LIST_APPEND(tail, qmp_query_node_stats(bs));
         }
     } else {
         for (blk = blk_all_next(NULL); blk; blk = blk_all_next(blk)) {
-            AioContext *ctx = blk_get_aio_context(blk);
-            BlockStats *s;
-            char *qdev;
-
-            if (!*blk_name(blk) && !blk_get_attached_dev(blk)) {
-                continue;
+            if (qmp_query_blk_visible(blk)) {
+                QAPI_LIST_APPEND(tail, qmp_query_blk_stats(blk));
             }
-
-            aio_context_acquire(ctx);
-            s = bdrv_query_bds_stats(blk_bs(blk), true);
-            s->device = g_strdup(blk_name(blk));
-
-            qdev = blk_get_attached_dev_id(blk);
-            if (qdev && *qdev) {
-                s->qdev = qdev;
-            } else {
-                g_free(qdev);
-            }
-
-            bdrv_query_blk_stats(s->stats, blk);
-            aio_context_release(ctx);
-
-            QAPI_LIST_APPEND(tail, s);
         }
     }
 
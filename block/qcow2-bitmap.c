@@ -26,6 +26,7 @@
  */
 
 #include "qemu/osdep.h"
+#include "block/aio_task.h"
 #include "block/block-io.h"
 #include "block/dirty-bitmap.h"
 #include "qapi/error.h"
@@ -280,18 +281,49 @@ static int free_bitmap_clusters(BlockDriverState *bs, Qcow2BitmapTable *tb)
     return 0;
 }
 
+typedef struct Qcow2BitmapLoadTask {
+    AioTask task;
+
+    BlockDriverState *bs;
+    BdrvDirtyBitmap *bitmap;
+    uint64_t data_offset;
+    uint64_t offset;
+    uint64_t count;
+} Qcow2BitmapLoadTask;
+
+static int coroutine_fn GRAPH_RDLOCK load_bitmap_cluster_entry(AioTask *task)
+{
+    Qcow2BitmapLoadTask *t = container_of(task, Qcow2BitmapLoadTask, task);
+    BDRVQcow2State *s = t->bs->opaque;
+    g_autofree uint8_t *buf = g_malloc(s->cluster_size);
+    int ret;
+
+    ret = bdrv_co_pread(t->bs->file, t->data_offset, s->cluster_size, buf, 0);
+    if (ret < 0) {
+        return ret;
+    }
+
+    bdrv_dirty_bitmap_deserialize_part(t->bitmap, buf, t->offset, t->count,
+                                       false);
+    return 0;
+}
+
 /* load_bitmap_data
  * @bitmap_table entries must satisfy specification constraints.
- * @bitmap must be cleared */
+ * @bitmap must be cleared
+ *
+ * Data clusters are read by up to QCOW2_MAX_WORKERS concurrent requests, so
+ * that opening an image with large bitmaps is not bound by the latency of
+ * one cluster read after the other. */
 static int coroutine_fn GRAPH_RDLOCK
 load_bitmap_data(BlockDriverState *bs, const uint64_t *bitmap_table,
                  uint32_t bitmap_table_size, BdrvDirtyBitmap *bitmap)
 {
-    int ret = 0;
+    int ret;
     BDRVQcow2State *s = bs->opaque;
     uint64_t offset, limit;
     uint64_t bm_size = bdrv_dirty_bitmap_size(bitmap);
-    uint8_t *buf = NULL;
+    AioTaskPool *aio = NULL;
     uint64_t i, tab_size =
             size_to_clusters(s,
                 bdrv_dirty_bitmap_serialization_size(bitmap, 0, bm_size));
@@ -300,9 +332,9 @@ load_bitmap_data(BlockDriverState *bs, const uint64_t *bitmap_table,
         return -EINVAL;
     }
 
-    buf = g_malloc(s->cluster_size);
     limit = bdrv_dirty_bitmap_serialization_coverage(s->cluster_size, bitmap);
-    for (i = 0, offset = 0; i < tab_size; ++i, offset += limit) {
+    for (i = 0, offset = 0; i < tab_size && aio_task_pool_status(aio) == 0;
+         ++i, offset += limit) {
         uint64_t count = MIN(bm_size - offset, limit);
         uint64_t entry = bitmap_table[i];
         uint64_t data_offset = entry & BME_TABLE_ENTRY_OFFSET_MASK;
@@ -318,22 +350,35 @@ load_bitmap_data(BlockDriverState *bs, const uint64_t *bitmap_table,
                  * already cleared */
             }
         } else {
-            ret = bdrv_co_pread(bs->file, data_offset, s->cluster_size, buf, 0);
-            if (ret < 0) {
-                goto finish;
+            Qcow2BitmapLoadTask *task = g_new(Qcow2BitmapLoadTask, 1);
+
+            if (!aio) {
+                aio = aio_task_pool_new(QCOW2_MAX_WORKERS);
             }
-            bdrv_dirty_bitmap_deserialize_part(bitmap, buf, offset, count,
-                                               false);
+            *task = (Qcow2BitmapLoadTask) {
+                .task.func = load_bitmap_cluster_entry,
+                .bs = bs,
+                .bitmap = bitmap,
+                .data_offset = data_offset,
+                .offset = offset,
+                .count = count,
+            };
+            aio_task_pool_start_task(aio, &task->task);
         }
     }
-    ret = 0;
 
-    bdrv_dirty_bitmap_deserialize_finish(bitmap);
+    if (aio) {
+        aio_task_pool_wait_all(aio);
+        ret = aio_task_pool_status(aio);
+        aio_task_pool_free(aio);
+        if (ret < 0) {
+            return ret;
+        }
+    }
 
-finish:
-    g_free(buf);
+    bdrv_dirty_bitmap_deserialize_finish(bitmap);
 
-    return ret;
+    return 0;
 }
 
 static coroutine_fn GRAPH_RDLOCK
@@ -30,6 +30,8 @@
 #include "qemu/bswap.h"
 #include "qemu/cutils.h"
 #include "qemu/memalign.h"
+#include "qemu/qemu-progress.h"
+#include "block/aio_task.h"
 #include "trace.h"
 
 static int64_t alloc_clusters_noref(BlockDriverState *bs, uint64_t size,
@@ -1067,6 +1069,87 @@ int64_t coroutine_fn qcow2_alloc_clusters_at(BlockDriverState *bs, uint64_t offs
     return i;
 }
 
+/*
+ * Data cluster allocation pool
+ *
+ * Every allocating write has to look up and update refcount blocks while
+ * holding s->lock, which serialises concurrent writers on a fresh image. If
+ * alloc-pool-size is set, data clusters are instead reserved in batches: a
+ * contiguous run of clusters gets its refcount set to 1 in a single update
+ * and is then handed out to allocating writes without touching the refcount
+ * structures again.
+ *
+ * Clusters still in the pool are not referenced from any L2 table, so they
+ * must be released before the refcounts are checked or rebuilt and before
+ * the image is inactivated. After a crash, they show up as leaked clusters.
+ */
+int64_t qcow2_alloc_data_clusters(BlockDriverState *bs, uint64_t nb_clusters)
+{
+    BDRVQcow2State *s = bs->opaque;
+    uint64_t pool_clusters = s->alloc_pool_size >> s->cluster_bits;
+    int64_t offset;
+
+    if (nb_clusters > s->alloc_pool_clusters) {
+        if (nb_clusters >= pool_clusters) {
+            return qcow2_alloc_clusters(bs, nb_clusters << s->cluster_bits);
+        }
+
+        /* Let the refill reuse whatever was left over */
+        qcow2_release_alloc_pool(bs);
+
+        offset = qcow2_alloc_clusters(bs, pool_clusters << s->cluster_bits);
+        if (offset < 0) {
+            return qcow2_alloc_clusters(bs, nb_clusters << s->cluster_bits);
+        }
+
+        trace_qcow2_alloc_pool_refill(bs, offset, pool_clusters);
+        s->alloc_pool_offset = offset;
+        s->alloc_pool_clusters = pool_clusters;
+    }
+
+    offset = s->alloc_pool_offset;
+    s->alloc_pool_offset += nb_clusters << s->cluster_bits;
+    s->alloc_pool_clusters -= nb_clusters;
+
+    return offset;
+}
+
+/*
+ * Like qcow2_alloc_clusters_at(), but takes the clusters from the allocation
+ * pool if @offset is where the pool starts.
+ */
+int64_t coroutine_fn qcow2_alloc_data_clusters_at(BlockDriverState *bs,
+                                                  uint64_t offset,
+                                                  int64_t nb_clusters)
+{
+    BDRVQcow2State *s = bs->opaque;
+
+    if (s->alloc_pool_clusters > 0 && offset == s->alloc_pool_offset) {
+        nb_clusters = MIN(nb_clusters, s->alloc_pool_clusters);
+        s->alloc_pool_offset += nb_clusters << s->cluster_bits;
+        s->alloc_pool_clusters -= nb_clusters;
+        return nb_clusters;
+    }
+
+    return qcow2_alloc_clusters_at(bs, offset, nb_clusters);
+}
+
+void qcow2_release_alloc_pool(BlockDriverState *bs)
+{
+    BDRVQcow2State *s = bs->opaque;
+
+    if (s->alloc_pool_clusters == 0) {
+        return;
+    }
+
+    trace_qcow2_alloc_pool_release(bs, s->alloc_pool_offset,
+                                   s->alloc_pool_clusters);
+    qcow2_free_clusters(bs, s->alloc_pool_offset,
+                        s->alloc_pool_clusters << s->cluster_bits,
+                        QCOW2_DISCARD_NEVER);
+    s->alloc_pool_clusters = 0;
+}
+
 /* only used to allocate compressed sectors. We try to allocate
    contiguous sectors. size must be <= cluster_size */
 int64_t coroutine_fn GRAPH_RDLOCK qcow2_alloc_bytes(BlockDriverState *bs, int size)
@@ -1658,6 +1741,8 @@ fail:
  * referenced in the L2 table. While doing so, performs some checks on L2
  * entries.
  *
+ * @l2_table is the L2 table if the caller has already read it, or NULL.
+ *
  * Returns the number of errors found by the checks or -errno if an internal
  * error occurred.
  */
@@ -1665,22 +1750,26 @@ static int coroutine_fn GRAPH_RDLOCK
 check_refcounts_l2(BlockDriverState *bs, BdrvCheckResult *res,
                    void **refcount_table,
                    int64_t *refcount_table_size, int64_t l2_offset,
-                   int flags, BdrvCheckMode fix, bool active)
+                   uint64_t *l2_table, int flags, BdrvCheckMode fix,
+                   bool active)
 {
     BDRVQcow2State *s = bs->opaque;
     uint64_t l2_entry, l2_bitmap;
     uint64_t next_contiguous_offset = 0;
     int i, ret;
     size_t l2_size_bytes = s->l2_size * l2_entry_size(s);
-    g_autofree uint64_t *l2_table = g_malloc(l2_size_bytes);
+    g_autofree uint64_t *l2_buf = NULL;
     bool metadata_overlap;
 
-    /* Read L2 table from disk */
-    ret = bdrv_co_pread(bs->file, l2_offset, l2_size_bytes, l2_table, 0);
-    if (ret < 0) {
-        fprintf(stderr, "ERROR: I/O error in check_refcounts_l2\n");
-        res->check_errors++;
-        return ret;
+    if (!l2_table) {
+        /* Read L2 table from disk */
+        l2_table = l2_buf = g_malloc(l2_size_bytes);
+        ret = bdrv_co_pread(bs->file, l2_offset, l2_size_bytes, l2_table, 0);
+        if (ret < 0) {
+            fprintf(stderr, "ERROR: I/O error in check_refcounts_l2\n");
+            res->check_errors++;
+            return ret;
+        }
     }
 
     /* Do the actual checks */
@@ -1853,11 +1942,134 @@ check_refcounts_l2(BlockDriverState *bs, BdrvCheckResult *res,
     return 0;
 }
 
+/*
+ * Reading L2 tables one at a time makes checking large images latency bound,
+ * so check_refcounts_l1() reads the tables for a batch of L1 entries in
+ * parallel and only then checks them in order.
+ */
+#define CHECK_L2_BATCH QCOW2_MAX_WORKERS
+
+typedef struct CheckL2ReadTask {
+    AioTask task;
+    BlockDriverState *bs;
+    uint64_t l2_offset;
+    uint64_t *l2_table;
+    bool *ok;
+} CheckL2ReadTask;
+
+static int coroutine_fn GRAPH_RDLOCK check_l2_read_task_entry(AioTask *task)
+{
+    CheckL2ReadTask *t = container_of(task, CheckL2ReadTask, task);
+    BDRVQcow2State *s = t->bs->opaque;
+    size_t l2_size_bytes = s->l2_size * l2_entry_size(s);
+
+    /* On failure, check_refcounts_l2() reads again and reports the error */
+    *t->ok = bdrv_co_pread(t->bs->file, t->l2_offset, l2_size_bytes,
+                           t->l2_table, 0) >= 0;
+    return 0;
+}
+
+/*
+ * Start reading the L2 tables for the non-zero entries of @l1_table from
+ * index @start on, until @batch has CHECK_L2_BATCH entries.  A table that is
+ * referenced twice in the batch is only read ahead for the first entry,
+ * because the check of that entry may repair it.
+ *
+ * Returns the L1 index that the next batch starts from.
+ */
+static int coroutine_fn GRAPH_RDLOCK
+check_l2_read_batch(BlockDriverState *bs, AioTaskPool *pool,
+                    const uint64_t *l1_table, int l1_size, int start,
+                    uint64_t *l2_tables, int *batch, int *batch_len,
+                    bool *ok)
+{
+    BDRVQcow2State *s = bs->opaque;
+    size_t l2_size_bytes = s->l2_size * l2_entry_size(s);
+    int i, j, n = 0;
+
+    for (i = start; i < l1_size && n < CHECK_L2_BATCH; i++) {
+        uint64_t l2_offset = l1_table[i] & L1E_OFFSET_MASK;
+        CheckL2ReadTask *t;
+
+        if (!l1_table[i]) {
+            continue;
+        }
+
+        batch[n] = i;
+        ok[n] = false;
+        for (j = 0; j < n; j++) {
+            if ((l1_table[batch[j]] & L1E_OFFSET_MASK) == l2_offset) {
+                break;
+            }
+        }
+        if (j == n) {
+            t = g_new(CheckL2ReadTask, 1);
+            *t = (CheckL2ReadTask) {
+                .task.func = check_l2_read_task_entry,
+                .bs = bs,
+                .l2_offset = l2_offset,
+                .l2_table = (void *)l2_tables + n * l2_size_bytes,
+                .ok = &ok[n],
+            };
+            aio_task_pool_start_task(pool, &t->task);
+        }
+        n++;
+    }
+
+    *batch_len = n;
+    return i;
+}
+
+/*
+ * Check one L1 entry and the L2 table it points to, see check_refcounts_l1().
+ * @l2_table is the L2 table if it has been read ahead, or NULL.
+ */
+static int coroutine_fn GRAPH_RDLOCK
+check_l1_entry(BlockDriverState *bs, BdrvCheckResult *res,
+               void **refcount_table, int64_t *refcount_table_size,
+               uint64_t l1_entry, uint64_t *l2_table,
+               int flags, BdrvCheckMode fix, bool active)
+{
+    BDRVQcow2State *s = bs->opaque;
+    uint64_t l2_offset;
+    int ret;
+
+    if (l1_entry & L1E_RESERVED_MASK) {
+        fprintf(stderr, "ERROR found L1 entry with reserved bits set: "
+                "%" PRIx64 "\n", l1_entry);
+        res->corruptions++;
+    }
+
+    l2_offset = l1_entry & L1E_OFFSET_MASK;
+
+    /* Mark L2 table as used */
+    ret = qcow2_inc_refcounts_imrt(bs, res,
+                                   refcount_table, refcount_table_size,
+                                   l2_offset, s->cluster_size);
+    if (ret < 0) {
+        return ret;
+    }
+
+    /* L2 tables are cluster aligned */
+    if (offset_into_cluster(s, l2_offset)) {
+        fprintf(stderr, "ERROR l2_offset=%" PRIx64 ": Table is not "
+            "cluster aligned; L1 entry corrupted\n", l2_offset);
+        res->corruptions++;
+    }
+
+    /* Process and check L2 entries */
+    return check_refcounts_l2(bs, res, refcount_table, refcount_table_size,
+                              l2_offset, l2_table, flags, fix, active);
+}
+
 /*
  * Increases the refcount for the L1 table, its L2 tables and all referenced
  * clusters in the given refcount table. While doing so, performs some checks
  * on L1 and L2 entries.
  *
+ * Progress is reported as going from @progress_start to @progress_end
+ * percent over the L1 table.
+ *
  * Returns the number of errors found by the checks or -errno if an internal
  * error occurred.
  */
@@ -1865,15 +2077,22 @@ static int coroutine_fn GRAPH_RDLOCK
 check_refcounts_l1(BlockDriverState *bs, BdrvCheckResult *res,
                    void **refcount_table, int64_t *refcount_table_size,
                    int64_t l1_table_offset, int l1_size,
-                   int flags, BdrvCheckMode fix, bool active)
+                   int flags, BdrvCheckMode fix, bool active,
+                   float progress_start, float progress_end)
 {
     BDRVQcow2State *s = bs->opaque;
     size_t l1_size_bytes = l1_size * L1E_SIZE;
+    size_t l2_size_bytes = s->l2_size * l2_entry_size(s);
     g_autofree uint64_t *l1_table = NULL;
-    uint64_t l2_offset;
+    g_autofree uint64_t *l2_tables = NULL;
+    AioTaskPool *pool;
+    int batch[CHECK_L2_BATCH];
+    bool ok[CHECK_L2_BATCH];
+    int batch_len, next, k;
     int i, ret;
 
     if (!l1_size) {
+        qemu_progress_print(progress_end, 0);
         return 0;
     }
 
@@ -1902,45 +2121,37 @@ check_refcounts_l1(BlockDriverState *bs, BdrvCheckResult *res,
         be64_to_cpus(&l1_table[i]);
     }
 
-    /* Do the actual checks */
-    for (i = 0; i < l1_size; i++) {
-        if (!l1_table[i]) {
-            continue;
-        }
-
-        if (l1_table[i] & L1E_RESERVED_MASK) {
-            fprintf(stderr, "ERROR found L1 entry with reserved bits set: "
-                    "%" PRIx64 "\n", l1_table[i]);
-            res->corruptions++;
-        }
+    l2_tables = g_try_malloc(CHECK_L2_BATCH * l2_size_bytes);
+    if (l2_tables == NULL) {
+        res->check_errors++;
+        return -ENOMEM;
+    }
 
-        l2_offset = l1_table[i] & L1E_OFFSET_MASK;
+    /* Do the actual checks */
+    pool = aio_task_pool_new(CHECK_L2_BATCH);
+    ret = 0;
+    for (next = 0; next < l1_size && ret >= 0; ) {
+        next = check_l2_read_batch(bs, pool, l1_table, l1_size, next,
+                                   l2_tables, batch, &batch_len, ok);
+        aio_task_pool_wait_all(pool);
 
-        /* Mark L2 table as used */
-        ret = qcow2_inc_refcounts_imrt(bs, res,
-                                       refcount_table, refcount_table_size,
-                                       l2_offset, s->cluster_size);
-        if (ret < 0) {
-            return ret;
-        }
+        for (k = 0; k < batch_len; k++) {
+            uint64_t *l2_table = (void *)l2_tables + k * l2_size_bytes;
 
-        /* L2 tables are cluster aligned */
-        if (offset_into_cluster(s, l2_offset)) {
-            fprintf(stderr, "ERROR l2_offset=%" PRIx64 ": Table is not "
-                "cluster aligned; L1 entry corrupted\n", l2_offset);
-            res->corruptions++;
+            ret = check_l1_entry(bs, res, refcount_table, refcount_table_size,
+                                 l1_table[batch[k]], ok[k] ? l2_table : NULL,
+                                 flags, fix, active);
+            if (ret < 0) {
+                break;
+            }
         }
 
-        /* Process and check L2 entries */
-        ret = check_refcounts_l2(bs, res, refcount_table,
-                                 refcount_table_size, l2_offset, flags,
-                                 fix, active);
-        if (ret < 0) {
-            return ret;
-        }
+        qemu_progress_print(progress_start + (progress_end - progress_start) *
+                            next / l1_size, 0);
     }
+    aio_task_pool_free(pool);
 
-    return 0;
+    return ret < 0 ? ret : 0;
 }
 
 /*
@@ -2207,6 +2418,7 @@ calculate_refcounts(BlockDriverState *bs, BdrvCheckResult *res,
     BDRVQcow2State *s = bs->opaque;
     int64_t i;
     QCowSnapshot *sn;
+    float progress_step;
     int ret;
 
     if (!*refcount_table) {
@@ -2227,9 +2439,10 @@ calculate_refcounts(BlockDriverState *bs, BdrvCheckResult *res,
     }
 
     /* current L1 table */
+    progress_step = 100.f / (s->nb_snapshots + 1);
     ret = check_refcounts_l1(bs, res, refcount_table, nb_clusters,
                              s->l1_table_offset, s->l1_size, CHECK_FRAG_INFO,
-                             fix, true);
+                             fix, true, 0.f, progress_step);
     if (ret < 0) {
         return ret;
     }
@@ -2259,7 +2472,8 @@ calculate_refcounts(BlockDriverState *bs, BdrvCheckResult *res,
         }
         ret = check_refcounts_l1(bs, res, refcount_table, nb_clusters,
                                  sn->l1_table_offset, sn->l1_size, 0, fix,
-                                 false);
+                                 false, (i + 1) * progress_step,
+                                 (i + 2) * progress_step);
         if (ret < 0) {
             return ret;
         }
@@ -150,6 +150,7 @@
 #define QCOW2_OPT_L2_CACHE_ENTRY_SIZE "l2-cache-entry-size"
 #define QCOW2_OPT_REFCOUNT_CACHE_SIZE "refcount-cache-size"
 #define QCOW2_OPT_CACHE_CLEAN_INTERVAL "cache-clean-interval"
+#define QCOW2_OPT_ALLOC_POOL_SIZE "alloc-pool-size"
 
 typedef struct QCowHeader {
     uint32_t magic;
@@ -322,6 +323,10 @@ typedef struct Qcow2BitmapHeaderExt {
     uint64_t bitmap_directory_offset;
 } QEMU_PACKED Qcow2BitmapHeaderExt;
 
+/*
+ * Minimum number of thread pool tasks (compression, encryption) a qcow2
+ * node may have in flight; hosts with more CPUs allow one per CPU.
+ */
 #define QCOW2_MAX_THREADS 4
 
 typedef struct BDRVQcow2State {
@@ -357,6 +362,14 @@ typedef struct BDRVQcow2State {
     uint64_t free_cluster_index;
     uint64_t free_byte_offset;
 
+    /*
+     * Data clusters that have been allocated (refcount 1) ahead of time but
+     * are not referenced by any L2 entry yet, see qcow2_alloc_data_clusters()
+     */
+    uint64_t alloc_pool_size;
+    uint64_t alloc_pool_offset;
+    uint64_t alloc_pool_clusters;
+
     CoMutex lock;
 
     Qcow2CryptoHeaderExtension crypto_header; /* QCow2 header extension */
@@ -410,6 +423,7 @@ typedef struct BDRVQcow2State {
 
     CoQueue thread_task_queue;
     int nb_threads;
+    int max_threads;
 
     BdrvChild *data_file;
 
@@ -867,6 +881,11 @@ int64_t qcow2_alloc_clusters(BlockDriverState *bs, uint64_t size);
 int64_t coroutine_fn qcow2_alloc_clusters_at(BlockDriverState *bs, uint64_t offset,
                                              int64_t nb_clusters);
 int64_t coroutine_fn GRAPH_RDLOCK qcow2_alloc_bytes(BlockDriverState *bs, int size);
+int64_t qcow2_alloc_data_clusters(BlockDriverState *bs, uint64_t nb_clusters);
+int64_t coroutine_fn qcow2_alloc_data_clusters_at(BlockDriverState *bs,
+                                                  uint64_t offset,
+                                                  int64_t nb_clusters);
+void qcow2_release_alloc_pool(BlockDriverState *bs);
 void qcow2_free_clusters(BlockDriverState *bs,
                           int64_t offset, int64_t size,
                           enum qcow2_discard_type type);
@@ -23,6 +23,7 @@
 #include "block/qdict.h"
 #include "crypto/secret.h"
 #include "qemu/cutils.h"
+#include "sysemu/block-backend.h"
 #include "sysemu/replay.h"
 #include "qapi/qmp/qstring.h"
 #include "qapi/qmp/qdict.h"
@@ -60,6 +61,10 @@
 
 #define RBD_MAX_SNAPS 100
 
+/* Writes up to this size may be coalesced, into requests up to this size */
+#define RBD_COALESCE_MAX_WRITE (64 * 1024)
+#define RBD_COALESCE_MAX_BYTES (1024 * 1024)
+
 #define RBD_ENCRYPTION_LUKS_HEADER_VERIFICATION_LEN 8
 
 static const char rbd_luks_header_verification[
@@ -90,6 +95,8 @@ typedef enum {
     RBD_AIO_WRITE_ZEROES
 } RBDAIOCmd;
 
+typedef struct RBDTask RBDTask;
+
 typedef struct BDRVRBDState {
     rados_t cluster;
     rados_ioctx_t io_ctx;
@@ -99,14 +106,33 @@ typedef struct BDRVRBDState {
     char *namespace;
     uint64_t image_size;
     uint64_t object_size;
+    bool coalesce_writes;
+
+    /* Small writes waiting for the end of the plugged section */
+    QSIMPLEQ_HEAD(, RBDTask) pending_writes;
+
+    /* Completed tasks, filled by librbd threads */
+    QSLIST_HEAD(, RBDTask) completed;
+    bool completion_bh_scheduled;
 } BDRVRBDState;
 
-typedef struct RBDTask {
+struct RBDTask {
     BlockDriverState *bs;
     Coroutine *co;
     bool complete;
     int64_t ret;
-} RBDTask;
+    uint64_t offset;                    /* for pending writes */
+    QEMUIOVector *qiov;                 /* for pending writes */
+    QSIMPLEQ_ENTRY(RBDTask) next_pending;
+    QSLIST_ENTRY(RBDTask) next_completed;
+};
+
+/* Adjacent pending writes submitted as one */
+typedef struct RBDWriteBatch {
+    QEMUIOVector qiov;
+    int nr_tasks;
+    RBDTask *tasks[];
+} RBDWriteBatch;
 
 typedef struct RBDDiffIterateReq {
     uint64_t offs;
@@ -1164,6 +1190,8 @@ static int qemu_rbd_open(BlockDriverState *bs, QDict *options, int flags,
     }
     s->image_size = info.size;
     s->object_size = info.obj_size;
+    s->coalesce_writes = opts->has_coalesce_writes && opts->coalesce_writes;
+    QSIMPLEQ_INIT(&s->pending_writes);
 
     /* If we are using an rbd snapshot, we must be r/o, otherwise
      * leave as-is */
@@ -1245,11 +1273,38 @@ static int qemu_rbd_resize(BlockDriverState *bs, uint64_t size)
     return 0;
 }
 
+/* Wake up the coroutines of all the tasks completed so far */
 static void qemu_rbd_finish_bh(void *opaque)
 {
-    RBDTask *task = opaque;
-    task->complete = true;
-    aio_co_wake(task->co);
+    BDRVRBDState *s = opaque;
+    QSLIST_HEAD(, RBDTask) completed;
+    RBDTask *task, *next;
+
+    /* Tasks completed from now on need another BH */
+    qatomic_set(&s->completion_bh_scheduled, false);
+    QSLIST_MOVE_ATOMIC(&completed, &s->completed);
+
+    QSLIST_FOREACH_SAFE(task, &completed, next_completed, next) {
+        task->complete = true;
+        aio_co_wake(task->co);
+    }
+}
+
+/*
+ * Hand a completed task over to qemu_rbd_finish_bh().  May be called
+ * from a non qemu thread.  The task may be gone as soon as it is on
+ * the list, so it must not be touched afterwards.
+ */
+static void qemu_rbd_task_done(RBDTask *task)
+{
+    BlockDriverState *bs = task->bs;
+    BDRVRBDState *s = bs->opaque;
+
+    QSLIST_INSERT_HEAD_ATOMIC(&s->completed, task, next_completed);
+    if (!qatomic_xchg(&s->completion_bh_scheduled, true)) {
+        aio_bh_schedule_oneshot(bdrv_get_aio_context(bs),
+                                qemu_rbd_finish_bh, s);
+    }
 }
 
 /*
@@ -1258,15 +1313,113 @@ static void qemu_rbd_finish_bh(void *opaque)
  *
  * Note: this function is being called from a non qemu thread so
  * we need to be careful about what we do here. Generally we only
- * schedule a BH, and do the rest of the io completion handling
- * from qemu_rbd_finish_bh() which runs in a qemu context.
+ * queue the task, and do the rest of the io completion handling
+ * from qemu_rbd_finish_bh() which runs in a qemu context.  A single
+ * BH handles all the tasks completed until it runs.
  */
 static void qemu_rbd_completion_cb(rbd_completion_t c, RBDTask *task)
 {
     task->ret = rbd_aio_get_return_value(c);
     rbd_aio_release(c);
-    aio_bh_schedule_oneshot(bdrv_get_aio_context(task->bs),
-                            qemu_rbd_finish_bh, task);
+    qemu_rbd_task_done(task);
+}
+
+static void qemu_rbd_batch_completion_cb(rbd_completion_t c,
+                                         RBDWriteBatch *batch)
+{
+    int64_t ret = rbd_aio_get_return_value(c);
+    int i;
+
+    rbd_aio_release(c);
+    for (i = 0; i < batch->nr_tasks; i++) {
+        batch->tasks[i]->ret = MIN(ret, 0);
+        qemu_rbd_task_done(batch->tasks[i]);
+    }
+    qemu_iovec_destroy(&batch->qiov);
+    g_free(batch);
+}
+
+static void qemu_rbd_submit_writes(BDRVRBDState *s, RBDTask **tasks,
+                                   int nr_tasks)
+{
+    RBDWriteBatch *batch = g_malloc(sizeof(*batch) +
+                                    nr_tasks * sizeof(batch->tasks[0]));
+    rbd_completion_t c;
+    int i, r;
+
+    batch->nr_tasks = nr_tasks;
+    qemu_iovec_init(&batch->qiov, nr_tasks);
+    for (i = 0; i < nr_tasks; i++) {
+        batch->tasks[i] = tasks[i];
+        qemu_iovec_concat(&batch->qiov, tasks[i]->qiov, 0,
+                          tasks[i]->qiov->size);
+    }
+
+    r = rbd_aio_create_completion(batch, (rbd_callback_t)
+                                  qemu_rbd_batch_completion_cb, &c);
+    if (r == 0) {
+        r = rbd_aio_writev(s->image, batch->qiov.iov, batch->qiov.niov,
+                           tasks[0]->offset, c);
+        if (r < 0) {
+            rbd_aio_release(c);
+        }
+    }
+    if (r < 0) {
+        error_report("rbd request failed early: write offset %" PRIu64
+                     " bytes %zu r %d (%s)", tasks[0]->offset,
+                     batch->qiov.size, r, strerror(-r));
+        for (i = 0; i < nr_tasks; i++) {
+            tasks[i]->ret = r;
+            qemu_rbd_task_done(tasks[i]);
+        }
+        qemu_iovec_destroy(&batch->qiov);
+        g_free(batch);
+    }
+}
+
+static gint qemu_rbd_task_cmp(gconstpointer a, gconstpointer b)
+{
+    const RBDTask *ta = *(RBDTask * const *)a;
+    const RBDTask *tb = *(RBDTask * const *)b;
+
+    return ta->offset < tb->offset ? -1 : ta->offset > tb->offset;
+}
+
+/*
+ * Called at the end of the plugged section: submit the pending writes,
+ * merging those that are adjacent into a single rbd_aio_writev().
+ */
+static void qemu_rbd_unplug_fn(void *opaque)
+{
+    BDRVRBDState *s = opaque;
+    g_autoptr(GPtrArray) tasks = g_ptr_array_new();
+    RBDTask *task;
+    int i, j;
+
+    while ((task = QSIMPLEQ_FIRST(&s->pending_writes))) {
+        QSIMPLEQ_REMOVE_HEAD(&s->pending_writes, next_pending);
+        g_ptr_array_add(tasks, task);
+    }
+    g_ptr_array_sort(tasks, qemu_rbd_task_cmp);
+
+    for (i = 0; i < tasks->len; i = j) {
+        RBDTask *first = g_ptr_array_index(tasks, i);
+        uint64_t end = first->offset + first->qiov->size;
+        int niov = first->qiov->niov;
+
+        for (j = i + 1; j < tasks->len; j++) {
+            task = g_ptr_array_index(tasks, j);
+            if (task->offset != end ||
+                end + task->qiov->size - first->offset >
+                RBD_COALESCE_MAX_BYTES ||
+                niov + task->qiov->niov > IOV_MAX) {
+                break;
+            }
+            end += task->qiov->size;
+            niov += task->qiov->niov;
+        }
+        qemu_rbd_submit_writes(s, (RBDTask **)&tasks->pdata[i], j - i);
+    }
 }
 
 static int coroutine_fn qemu_rbd_start_co(BlockDriverState *bs,
@@ -1297,6 +1450,16 @@ static int coroutine_fn qemu_rbd_start_co(BlockDriverState *bs,
         }
     }
 
+    if (cmd == RBD_AIO_WRITE && s->coalesce_writes &&
+        bytes <= RBD_COALESCE_MAX_WRITE) {
+        /* Submitted by qemu_rbd_unplug_fn(), maybe along with others */
+        task.offset = offset;
+        task.qiov = qiov;
+        QSIMPLEQ_INSERT_TAIL(&s->pending_writes, &task, next_pending);
+        blk_io_plug_call(qemu_rbd_unplug_fn, s);
+        goto wait;
+    }
+
     r = rbd_aio_create_completion(&task,
                                   (rbd_callback_t) qemu_rbd_completion_cb, &c);
     if (r < 0) {
@@ -1340,6 +1503,7 @@ static int coroutine_fn qemu_rbd_start_co(BlockDriverState *bs,
         return r;
     }
 
+wait:
     while (!task.complete) {
         qemu_coroutine_yield();
     }
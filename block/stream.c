@@ -13,6 +13,7 @@
 
 #include "qemu/osdep.h"
 #include "trace.h"
+#include "block/aio_task.h"
 #include "block/block_int.h"
 #include "block/blockjob_int.h"
 #include "qapi/error.h"
@@ -28,8 +29,24 @@ enum {
      * that populating contiguous regions of the image is efficient.
      */
     STREAM_CHUNK = 512 * 1024, /* in bytes */
+
+    /*
+     * The chunk size doubles up to this while allocated extents are longer
+     * than a chunk, and halves back towards STREAM_CHUNK when they are not.
+     */
+    STREAM_MAX_CHUNK = 8 * 1024 * 1024, /* in bytes */
+
+    /* Number of chunks populated in parallel */
+    STREAM_MAX_WORKERS = 8,
 };
 
+typedef struct StreamFailedRange {
+    int64_t offset;
+    int64_t bytes;
+    int ret;
+    QSIMPLEQ_ENTRY(StreamFailedRange) next;
+} StreamFailedRange;
+
 typedef struct StreamBlockJob {
     BlockJob common;
     BlockBackend *blk;
@@ -40,8 +57,17 @@ typedef struct StreamBlockJob {
     BlockdevOnError on_error;
     char *backing_file_str;
     bool bs_read_only;
+    /* Ranges whose population failed, handled by the job coroutine */
+    QSIMPLEQ_HEAD(, StreamFailedRange) failed;
 } StreamBlockJob;
 
+typedef struct StreamTask {
+    AioTask task;
+    StreamBlockJob *s;
+    int64_t offset;
+    int64_t bytes;
+} StreamTask;
+
 static int coroutine_fn stream_populate(BlockBackend *blk,
                                         int64_t offset, uint64_t bytes)
 {
@@ -50,6 +76,79 @@ static int coroutine_fn stream_populate(BlockBackend *blk,
     return blk_co_preadv(blk, offset, bytes, NULL, BDRV_REQ_PREFETCH);
 }
 
+static int coroutine_fn stream_task_entry(AioTask *task)
+{
+    StreamTask *t = container_of(task, StreamTask, task);
+    StreamBlockJob *s = t->s;
+    int ret;
+
+    ret = stream_populate(s->blk, t->offset, t->bytes);
+    if (ret < 0) {
+        StreamFailedRange *f = g_new(StreamFailedRange, 1);
+
+        *f = (StreamFailedRange) {
+            .offset = t->offset,
+            .bytes  = t->bytes,
+            .ret    = ret,
+        };
+        QSIMPLEQ_INSERT_TAIL(&s->failed, f, next);
+
+        /* Errors are handled by the job, do not let the pool fail */
+        return 0;
+    }
+
+    job_progress_update(&s->common.job, t->bytes);
+    return 0;
+}
+
+/*
+ * Apply the on_error policy to the ranges whose population failed, one at
+ * a time like the sequential loop did.  Returns the error to fail the job
+ * with, or 0 to go on.  *error collects ignored errors.
+ */
+static int coroutine_fn stream_handle_failures(StreamBlockJob *s, int *error)
+{
+    StreamFailedRange *f;
+    int ret = 0;
+
+    while ((f = QSIMPLEQ_FIRST(&s->failed))) {
+        QSIMPLEQ_REMOVE_HEAD(&s->failed, next);
+
+        while (ret == 0 && f->ret < 0) {
+            BlockErrorAction action =
+                block_job_error_action(&s->common, s->on_error, true,
+                                       -f->ret);
+
+            if (action == BLOCK_ERROR_ACTION_STOP) {
+                /* Retry once the job is resumed */
+                block_job_ratelimit_sleep(&s->common);
+                if (job_is_cancelled(&s->common.job)) {
+                    break;
+                }
+                f->ret = stream_populate(s->blk, f->offset, f->bytes);
+                if (f->ret >= 0) {
+                    job_progress_update(&s->common.job, f->bytes);
+                    block_job_ratelimit_processed_bytes(&s->common, f->bytes);
+                }
+                continue;
+            }
+
+            if (*error == 0) {
+                *error = f->ret;
+            }
+            if (action == BLOCK_ERROR_ACTION_REPORT) {
+                ret = f->ret;
+            } else {
+                job_progress_update(&s->common.job, f->bytes);
+            }
+            break;
+        }
+        g_free(f);
+    }
+
+    return ret;
+}
+
 static int stream_prepare(Job *job)
 {
     StreamBlockJob *s = container_of(job, StreamBlockJob, common.job);
@@ -125,13 +224,26 @@ static void stream_clean(Job *job)
     g_free(s->backing_file_str);
 }
 
+static void stream_free_failures(StreamBlockJob *s)
+{
+    while (!QSIMPLEQ_EMPTY(&s->failed)) {
+        StreamFailedRange *f = QSIMPLEQ_FIRST(&s->failed);
+
+        QSIMPLEQ_REMOVE_HEAD(&s->failed, next);
+        g_free(f);
+    }
+}
+
 static int coroutine_fn stream_run(Job *job, Error **errp)
 {
     StreamBlockJob *s = container_of(job, StreamBlockJob, common.job);
     BlockDriverState *unfiltered_bs = bdrv_skip_filters(s->target_bs);
+    AioTaskPool *pool;
     int64_t len;
     int64_t offset = 0;
+    int64_t chunk = STREAM_CHUNK;
     int error = 0;
+    bool failed = false;
     int64_t n = 0; /* bytes */
 
     if (unfiltered_bs == s->base_overlay) {
@@ -147,22 +259,33 @@ static int coroutine_fn stream_run(Job *job, Error **errp)
     }
     job_progress_set_remaining(&s->common.job, len);
 
+    QSIMPLEQ_INIT(&s->failed);
+    pool = aio_task_pool_new(STREAM_MAX_WORKERS);
+
     for ( ; offset < len; offset += n) {
         bool copy;
         int ret;
 
         /* Note that even when no rate limit is applied we need to yield
-         * with no pending I/O here so that bdrv_drain_all() returns.
+         * here so that bdrv_drain_all() returns.
          */
         block_job_ratelimit_sleep(&s->common);
         if (job_is_cancelled(&s->common.job)) {
             break;
         }
 
+        if (!QSIMPLEQ_EMPTY(&s->failed)) {
+            aio_task_pool_wait_all(pool);
+            failed = stream_handle_failures(s, &error) < 0;
+            if (failed || job_is_cancelled(&s->common.job)) {
+                break;
+            }
+        }
+
         copy = false;
 
         WITH_GRAPH_RDLOCK_GUARD() {
-            ret = bdrv_is_allocated(unfiltered_bs, offset, STREAM_CHUNK, &n);
+            ret = bdrv_is_allocated(unfiltered_bs, offset, chunk, &n);
             if (ret == 1) {
                 /* Allocated in the top, no need to copy.  */
             } else if (ret >= 0) {
@@ -182,31 +305,51 @@ static int coroutine_fn stream_run(Job *job, Error **errp)
             }
         }
         trace_stream_one_iteration(s, offset, n, ret);
-        if (copy) {
-            ret = stream_populate(s->blk, offset, n);
-        }
         if (ret < 0) {
-            BlockErrorAction action =
-                block_job_error_action(&s->common, s->on_error, true, -ret);
-            if (action == BLOCK_ERROR_ACTION_STOP) {
-                n = 0;
-                continue;
-            }
-            if (error == 0) {
-                error = ret;
-            }
-            if (action == BLOCK_ERROR_ACTION_REPORT) {
-                break;
-            }
+            /* Status query failed, let the job handle it like a copy error */
+            StreamFailedRange *f = g_new(StreamFailedRange, 1);
+
+            n = MIN(chunk, len - offset);
+            *f = (StreamFailedRange) {
+                .offset = offset,
+                .bytes  = n,
+                .ret    = ret,
+            };
+            QSIMPLEQ_INSERT_TAIL(&s->failed, f, next);
+            continue;
         }
 
-        /* Publish progress */
-        job_progress_update(&s->common.job, n);
         if (copy) {
+            StreamTask *t = g_new(StreamTask, 1);
+
+            *t = (StreamTask) {
+                .task.func = stream_task_entry,
+                .s         = s,
+                .offset    = offset,
+                .bytes     = n,
+            };
+            aio_task_pool_start_task(pool, &t->task);
             block_job_ratelimit_processed_bytes(&s->common, n);
+
+            /* Long allocated extents: copy them in larger chunks */
+            if (n == chunk) {
+                chunk = MIN(chunk * 2, STREAM_MAX_CHUNK);
+            } else if (n < chunk / 2) {
+                chunk = MAX(chunk / 2, STREAM_CHUNK);
+            }
+        } else {
+            /* Publish progress */
+            job_progress_update(&s->common.job, n);
         }
     }
 
+    aio_task_pool_wait_all(pool);
+    aio_task_pool_free(pool);
+    if (!failed && !job_is_cancelled(&s->common.job)) {
+        stream_handle_failures(s, &error);
+    }
+    stream_free_failures(s);
+
     /* Do not remove the backing file if an error was there but ignored. */
     return error;
 }
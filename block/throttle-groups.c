@@ -35,6 +35,10 @@
 #include "qom/object.h"
 #include "qom/object_interfaces.h"
 
+/* Each grant of allowance covers this fraction of a second of the limits */
+#define THROTTLE_ALLOWANCE_DIV 100
+#define THROTTLE_ALLOWANCE_UNLIMITED (INT_MAX / 2)
+
 static void throttle_group_obj_init(Object *obj);
 static void throttle_group_obj_complete(UserCreatable *obj, Error **errp);
 static void timer_cb(ThrottleGroupMember *tgm, bool is_write);
@@ -254,6 +258,155 @@ static ThrottleGroupMember *next_throttle_token(ThrottleGroupMember *tgm,
     return token;
 }
 
+/* Return the lowest average limit that applies to a request, 0 if none does
+ *
+ * @ts:        the ThrottleState of the group
+ * @is_write:  the type of operation (read/write)
+ * @ops:       whether to look at the iops or the bps limits
+ */
+static uint64_t throttle_group_avg_limit(ThrottleState *ts, bool is_write,
+                                         bool ops)
+{
+    const BucketType bucket_types[2][2][2] = {
+        { { THROTTLE_BPS_TOTAL, THROTTLE_BPS_READ },
+          { THROTTLE_BPS_TOTAL, THROTTLE_BPS_WRITE } },
+        { { THROTTLE_OPS_TOTAL, THROTTLE_OPS_READ },
+          { THROTTLE_OPS_TOTAL, THROTTLE_OPS_WRITE } },
+    };
+    uint64_t limit = 0;
+    int i;
+
+    for (i = 0; i < 2; i++) {
+        uint64_t avg = ts->cfg.buckets[bucket_types[ops][is_write][i]].avg;
+        limit = MIN_NON_ZERO(limit, avg);
+    }
+
+    return limit;
+}
+
+/* Hand out a slice of the group's budget to a ThrottleGroupMember, so that
+ * its next requests can be admitted by throttle_group_use_allowance()
+ * without taking tg->lock. The slice is accounted in the group's buckets
+ * right away, so other members and later requests see it as used and the
+ * group limits stay accurate. Budget that is not used before the next grant
+ * or a configuration change is lost.
+ *
+ * Nothing is granted if other requests are waiting, so that the round-robin
+ * order between members is preserved.
+ *
+ * This assumes that tg->lock is held.
+ *
+ * @tgm:       the current ThrottleGroupMember
+ * @is_write:  the type of operation (read/write)
+ */
+static void throttle_group_grant_allowance(ThrottleGroupMember *tgm,
+                                           bool is_write)
+{
+    ThrottleState *ts = tgm->throttle_state;
+    ThrottleGroup *tg = container_of(ts, ThrottleGroup, ts);
+    uint64_t bps, iops, bytes, ops;
+
+    /* The virtual clock of qtest needs exact per-request accounting */
+    if (tg->clock_type != QEMU_CLOCK_REALTIME) {
+        return;
+    }
+
+    /* With iops-size, the number of units depends on the request size */
+    if (ts->cfg.op_size || qatomic_read(&tgm->io_limits_disabled)) {
+        return;
+    }
+
+    if (tg->any_timer_armed[is_write] || tgm->pending_reqs[is_write]) {
+        return;
+    }
+
+    if (throttle_must_wait(ts, is_write, qemu_clock_get_ns(tg->clock_type))) {
+        return;
+    }
+
+    bps = throttle_group_avg_limit(ts, is_write, false);
+    iops = throttle_group_avg_limit(ts, is_write, true);
+
+    bytes = MIN(MAX(bps / THROTTLE_ALLOWANCE_DIV, 1),
+                THROTTLE_ALLOWANCE_UNLIMITED);
+    ops = MIN(MAX(iops / THROTTLE_ALLOWANCE_DIV, 1),
+              THROTTLE_ALLOWANCE_UNLIMITED);
+
+    throttle_account_units(ts, is_write, bps ? bytes : 0, iops ? ops : 0);
+
+    qatomic_set(&tgm->allowance_bytes[is_write],
+                bps ? bytes : THROTTLE_ALLOWANCE_UNLIMITED);
+    qatomic_set(&tgm->allowance_ops[is_write],
+                iops ? ops : THROTTLE_ALLOWANCE_UNLIMITED);
+}
+
+/* Drop the allowance of all members, e.g. because the limits changed.
+ *
+ * This assumes that tg->lock is held.
+ */
+static void throttle_group_revoke_allowances(ThrottleGroup *tg)
+{
+    ThrottleGroupMember *tgm;
+    int i;
+
+    QLIST_FOREACH(tgm, &tg->head, round_robin) {
+        for (i = 0; i < 2; i++) {
+            qatomic_set(&tgm->allowance_bytes[i], 0);
+            qatomic_set(&tgm->allowance_ops[i], 0);
+        }
+    }
+}
+
+static bool tgm_take_allowance(int *allowance, int n)
+{
+    int old = qatomic_read(allowance);
+
+    while (old >= n) {
+        int prev = qatomic_cmpxchg(allowance, old, old - n);
+        if (prev == old) {
+            return true;
+        }
+        old = prev;
+    }
+
+    return false;
+}
+
+/* Admit a request from the member's allowance, without taking tg->lock.
+ * Return whether that was possible.
+ *
+ * @tgm:       the current ThrottleGroupMember
+ * @bytes:     the number of bytes for this I/O
+ * @is_write:  the type of operation (read/write)
+ */
+static bool throttle_group_use_allowance(ThrottleGroupMember *tgm,
+                                         int64_t bytes, bool is_write)
+{
+    ThrottleGroup *tg = container_of(tgm->throttle_state, ThrottleGroup, ts);
+
+    if (bytes > THROTTLE_ALLOWANCE_UNLIMITED) {
+        return false;
+    }
+
+    /* Let throttled requests go first. This check can race with other
+     * threads, but at worst one more request gets admitted from the
+     * allowance, which has been accounted already anyway. */
+    if (qatomic_read(&tgm->pending_reqs[is_write]) ||
+        qatomic_read(&tg->any_timer_armed[is_write])) {
+        return false;
+    }
+
+    if (!tgm_take_allowance(&tgm->allowance_bytes[is_write], bytes)) {
+        return false;
+    }
+    if (!tgm_take_allowance(&tgm->allowance_ops[is_write], 1)) {
+        qatomic_add(&tgm->allowance_bytes[is_write], bytes);
+        return false;
+    }
+
+    return true;
+}
+
 /* Check if the next I/O request for a ThrottleGroupMember needs to be
  * throttled or not. If there's no timer set in this group, set one and update
  * the token accordingly.
@@ -367,6 +520,10 @@ void coroutine_fn throttle_group_co_io_limits_intercept(ThrottleGroupMember *tgm
 
     assert(bytes >= 0);
 
+    if (throttle_group_use_allowance(tgm, bytes, is_write)) {
+        return;
+    }
+
     qemu_mutex_lock(&tg->lock);
 
     /* First we check if this I/O has to be throttled. */
@@ -391,6 +548,9 @@ void coroutine_fn throttle_group_co_io_limits_intercept(ThrottleGroupMember *tgm
     /* Schedule the next request */
     schedule_next_request(tgm, is_write);
 
+    /* Let the next requests of this member skip the lock */
+    throttle_group_grant_allowance(tgm, is_write);
+
     qemu_mutex_unlock(&tg->lock);
 }
 
@@ -475,6 +635,7 @@ void throttle_group_config(ThrottleGroupMember *tgm, ThrottleConfig *cfg)
     ThrottleGroup *tg = container_of(ts, ThrottleGroup, ts);
     qemu_mutex_lock(&tg->lock);
     throttle_config(ts, tg->clock_type, cfg);
+    throttle_group_revoke_allowances(tg);
     qemu_mutex_unlock(&tg->lock);
 
     throttle_group_restart_tgm(tgm);
@@ -600,6 +761,8 @@ void throttle_group_unregister_tgm(ThrottleGroupMember *tgm)
             assert(tgm->pending_reqs[i] == 0);
             assert(qemu_co_queue_empty(&tgm->throttled_reqs[i]));
             assert(!timer_pending(tgm->throttle_timers.timers[i]));
+            qatomic_set(&tgm->allowance_bytes[i], 0);
+            qatomic_set(&tgm->allowance_ops[i], 0);
             if (tg->tokens[i] == tgm) {
                 token = throttle_group_next_tgm(tgm);
                 /* Take care of the case where this is the last tgm in the group */
@@ -900,6 +1063,7 @@ static void throttle_group_set_limits(Object *obj, Visitor *v,
         goto unlock;
     }
     throttle_config(&tg->ts, tg->clock_type, &cfg);
+    throttle_group_revoke_allowances(tg);
 
 unlock:
     qemu_mutex_unlock(&tg->lock);
@@ -1314,6 +1314,23 @@ static void vhdx_update_bat_table_entry(BlockDriverState *bs, BDRVVHDXState *s,
 
 }
 
+/* Write BAT entries first..last to the log journal and flush it */
+static int coroutine_fn GRAPH_RDLOCK
+vhdx_log_bat_range(BlockDriverState *bs, BDRVVHDXState *s,
+                   uint32_t first, uint32_t last)
+{
+    uint32_t n = last - first + 1;
+    g_autofree uint64_t *entries = g_new(uint64_t, n);
+    uint32_t i;
+
+    for (i = 0; i < n; i++) {
+        entries[i] = cpu_to_le64(s->bat[first + i]);
+    }
+    return vhdx_log_write_and_flush(bs, s, entries, n * sizeof(VHDXBatEntry),
+                                    s->bat_offset +
+                                    first * sizeof(VHDXBatEntry));
+}
+
 /* Per the spec, on the first write of guest-visible data to the file the
  * data write guid must be updated in the header */
 int vhdx_user_visible_write(BlockDriverState *bs, BDRVVHDXState *s)
@@ -1343,6 +1360,9 @@ vhdx_co_writev(BlockDriverState *bs, int64_t sector_num, int nb_sectors,
     int bat_state;
     uint64_t bat_prior_offset = 0;
     bool bat_update = false;
+    /* BAT entries updated by this request, journaled together at the end */
+    uint32_t bat_first = UINT32_MAX;
+    uint32_t bat_last = 0;
 
     qemu_iovec_init(&hd_qiov, qiov->niov);
 
@@ -1464,14 +1484,8 @@ vhdx_co_writev(BlockDriverState *bs, int64_t sector_num, int nb_sectors,
             }
 
             if (bat_update) {
-                /* this will update the BAT entry into the log journal, and
-                 * then flush the log journal out to disk */
-                ret =  vhdx_log_write_and_flush(bs, s, &bat_entry,
-                                                sizeof(VHDXBatEntry),
-                                                bat_entry_offset);
-                if (ret < 0) {
-                    goto exit;
-                }
+                bat_first = MIN(bat_first, sinfo.bat_idx);
+                bat_last = MAX(bat_last, sinfo.bat_idx);
             }
 
             nb_sectors -= sinfo.sectors_avail;
@@ -1492,6 +1506,19 @@ error_bat_restore:
                                     &bat_entry_offset, bat_state);
     }
 exit:
+    if (bat_first <= bat_last) {
+        int log_ret;
+
+        /*
+         * Journal all new BAT entries in one log write and flush, after
+         * their data has been written.  Entries in between that this
+         * request did not change are logged with their current value.
+         */
+        log_ret = vhdx_log_bat_range(bs, s, bat_first, bat_last);
+        if (ret >= 0) {
+            ret = log_ret;
+        }
+    }
     qemu_vfree(iov1.iov_base);
     qemu_vfree(iov2.iov_base);
     qemu_co_mutex_unlock(&s->lock);
@@ -33,9 +33,11 @@
 #include "qemu/module.h"
 #include "qemu/option.h"
 #include "qemu/bswap.h"
+#include "qemu/host-utils.h"
 #include "qemu/memalign.h"
 #include "migration/blocker.h"
 #include "qemu/cutils.h"
+#include "qemu/units.h"
 #include <zlib.h>
 
 #define VMDK3_MAGIC (('C' << 24) | ('O' << 16) | ('W' << 8) | 'D')
@@ -131,7 +133,20 @@ typedef struct VMDKSESparseVolatileHeader {
     uint8_t pad[480];
 } QEMU_PACKED VMDKSESparseVolatileHeader;
 
-#define L2_CACHE_SIZE 16
+/*
+ * Grain tables are cached per extent, in as many slots as fit in
+ * L2_CACHE_BYTES but at least L2_CACHE_MIN_SIZE and never more than the
+ * extent has tables.  Lookups go through a chained hash table indexed by
+ * table offset; eviction uses the CLOCK algorithm like the qcow2 cache.
+ */
+#define L2_CACHE_BYTES (1 * MiB)
+#define L2_CACHE_MIN_SIZE 16
+
+typedef struct VmdkL2CacheEntry {
+    uint32_t offset;        /* in sectors, 0 if the slot is unused */
+    int hash_next;          /* next slot in the same bucket, or -1 */
+    bool accessed;          /* CLOCK reference bit */
+} VmdkL2CacheEntry;
 
 typedef struct VmdkExtent {
     BdrvChild *file;
@@ -156,8 +171,11 @@ typedef struct VmdkExtent {
 
     unsigned int l2_size;
     void *l2_cache;
-    uint32_t l2_cache_offsets[L2_CACHE_SIZE];
-    uint32_t l2_cache_counts[L2_CACHE_SIZE];
+    VmdkL2CacheEntry *l2_cache_entries;
+    int l2_cache_size;
+    int *l2_cache_buckets;  /* first slot of each chain, or -1 */
+    unsigned int l2_cache_bucket_mask;
+    int l2_cache_clock_hand;
 
     int64_t cluster_sectors;
     int64_t next_cluster_sector;
@@ -276,6 +294,8 @@ static void vmdk_free_extents(BlockDriverState *bs)
         e = &s->extents[i];
         g_free(e->l1_table);
         g_free(e->l2_cache);
+        g_free(e->l2_cache_entries);
+        g_free(e->l2_cache_buckets);
         g_free(e->l1_backup_table);
         g_free(e->type);
         if (e->file != bs->file) {
@@ -575,6 +595,92 @@ static int vmdk_add_extent(BlockDriverState *bs,
     return 0;
 }
 
+static void vmdk_l2_cache_init(VmdkExtent *extent)
+{
+    size_t l2_size_bytes = extent->entry_size * extent->l2_size;
+    unsigned int num_buckets;
+    int i;
+
+    extent->l2_cache_size = MAX(L2_CACHE_BYTES / l2_size_bytes,
+                                L2_CACHE_MIN_SIZE);
+    extent->l2_cache_size = MIN(extent->l2_cache_size,
+                                MAX(extent->l1_size, 1));
+    num_buckets = pow2ceil(extent->l2_cache_size);
+
+    extent->l2_cache = g_malloc(l2_size_bytes * extent->l2_cache_size);
+    extent->l2_cache_entries = g_new0(VmdkL2CacheEntry,
+                                      extent->l2_cache_size);
+    extent->l2_cache_buckets = g_new(int, num_buckets);
+    extent->l2_cache_bucket_mask = num_buckets - 1;
+    extent->l2_cache_clock_hand = 0;
+    for (i = 0; i < extent->l2_cache_size; i++) {
+        extent->l2_cache_entries[i].hash_next = -1;
+    }
+    for (i = 0; i < num_buckets; i++) {
+        extent->l2_cache_buckets[i] = -1;
+    }
+}
+
+static inline unsigned int vmdk_l2_cache_bucket(VmdkExtent *extent,
+                                                uint32_t l2_offset)
+{
+    return ((uint64_t)l2_offset * 0x9e3779b97f4a7c15ULL) >> 32 &
+           extent->l2_cache_bucket_mask;
+}
+
+static int vmdk_l2_cache_lookup(VmdkExtent *extent, uint32_t l2_offset)
+{
+    int i;
+
+    for (i = extent->l2_cache_buckets[vmdk_l2_cache_bucket(extent, l2_offset)];
+         i != -1; i = extent->l2_cache_entries[i].hash_next) {
+        if (extent->l2_cache_entries[i].offset == l2_offset) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void vmdk_l2_cache_hash_insert(VmdkExtent *extent, int i)
+{
+    VmdkL2CacheEntry *e = &extent->l2_cache_entries[i];
+    unsigned int b = vmdk_l2_cache_bucket(extent, e->offset);
+
+    e->hash_next = extent->l2_cache_buckets[b];
+    extent->l2_cache_buckets[b] = i;
+}
+
+static void vmdk_l2_cache_hash_remove(VmdkExtent *extent, int i)
+{
+    VmdkL2CacheEntry *e = &extent->l2_cache_entries[i];
+    int *p = &extent->l2_cache_buckets[vmdk_l2_cache_bucket(extent,
+                                                            e->offset)];
+
+    while (*p != i) {
+        assert(*p != -1);
+        p = &extent->l2_cache_entries[*p].hash_next;
+    }
+    *p = e->hash_next;
+    e->hash_next = -1;
+}
+
+/* Pick a slot to replace; tables accessed since the last sweep stay */
+static int vmdk_l2_cache_find_victim(VmdkExtent *extent)
+{
+    for (;;) {
+        int i = extent->l2_cache_clock_hand;
+        VmdkL2CacheEntry *e = &extent->l2_cache_entries[i];
+
+        if (++extent->l2_cache_clock_hand == extent->l2_cache_size) {
+            extent->l2_cache_clock_hand = 0;
+        }
+        if (!e->offset || !e->accessed) {
+            return i;
+        }
+        e->accessed = false;
+    }
+}
+
 static int vmdk_init_tables(BlockDriverState *bs, VmdkExtent *extent,
                             Error **errp)
 {
@@ -628,8 +734,7 @@ static int vmdk_init_tables(BlockDriverState *bs, VmdkExtent *extent,
         }
     }
 
-    extent->l2_cache =
-        g_malloc(extent->entry_size * extent->l2_size * L2_CACHE_SIZE);
+    vmdk_l2_cache_init(extent);
     return 0;
  fail_l1b:
     g_free(extent->l1_backup_table);
@@ -1542,8 +1647,7 @@ get_cluster_offset(BlockDriverState *bs, VmdkExtent *extent,
                    uint64_t skip_end_bytes)
 {
     unsigned int l1_index, l2_offset, l2_index;
-    int min_index, i, j;
-    uint32_t min_count;
+    int i;
     void *l2_table;
     bool zeroed = false;
     int64_t ret;
@@ -1596,28 +1700,19 @@ get_cluster_offset(BlockDriverState *bs, VmdkExtent *extent,
     if (!l2_offset) {
         return VMDK_UNALLOC;
     }
-    for (i = 0; i < L2_CACHE_SIZE; i++) {
-        if (l2_offset == extent->l2_cache_offsets[i]) {
-            /* increment the hit count */
-            if (++extent->l2_cache_counts[i] == 0xffffffff) {
-                for (j = 0; j < L2_CACHE_SIZE; j++) {
-                    extent->l2_cache_counts[j] >>= 1;
-                }
-            }
-            l2_table = (char *)extent->l2_cache + (i * l2_size_bytes);
-            goto found;
-        }
+    i = vmdk_l2_cache_lookup(extent, l2_offset);
+    if (i != -1) {
+        extent->l2_cache_entries[i].accessed = true;
+        l2_table = (char *)extent->l2_cache + (i * l2_size_bytes);
+        goto found;
     }
-    /* not found: load a new entry in the least used one */
-    min_index = 0;
-    min_count = 0xffffffff;
-    for (i = 0; i < L2_CACHE_SIZE; i++) {
-        if (extent->l2_cache_counts[i] < min_count) {
-            min_count = extent->l2_cache_counts[i];
-            min_index = i;
-        }
+    /* not found: load the table in place of one not used recently */
+    i = vmdk_l2_cache_find_victim(extent);
+    if (extent->l2_cache_entries[i].offset) {
+        vmdk_l2_cache_hash_remove(extent, i);
+        extent->l2_cache_entries[i].offset = 0;
     }
-    l2_table = (char *)extent->l2_cache + (min_index * l2_size_bytes);
+    l2_table = (char *)extent->l2_cache + (i * l2_size_bytes);
     BLKDBG_CO_EVENT(extent->file, BLKDBG_L2_LOAD);
     if (bdrv_co_pread(extent->file,
                 (int64_t)l2_offset * 512,
@@ -1627,8 +1722,9 @@ get_cluster_offset(BlockDriverState *bs, VmdkExtent *extent,
         return VMDK_ERROR;
     }
 
-    extent->l2_cache_offsets[min_index] = l2_offset;
-    extent->l2_cache_counts[min_index] = 1;
+    extent->l2_cache_entries[i].offset = l2_offset;
+    extent->l2_cache_entries[i].accessed = true;
+    vmdk_l2_cache_hash_insert(extent, i);
  found:
     l2_index = ((offset >> 9) / extent->cluster_sectors) % extent->l2_size;
     if (m_data) {
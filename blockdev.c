@@ -2820,11 +2820,35 @@ void qmp_drive_backup(DriveBackup *backup, Error **errp)
 
 BlockDeviceInfoList *qmp_query_named_block_nodes(bool has_flat,
                                                  bool flat,
+                                                 strList *node_names,
                                                  Error **errp)
 {
     bool return_flat = has_flat && flat;
+    BlockDeviceInfoList *head = NULL, **tail = &head;
 
-    return bdrv_named_nodes_list(return_flat, errp);
+    if (!node_names) {
+        return bdrv_named_nodes_list(return_flat, errp);
+    }
+
+    for (; node_names; node_names = node_names->next) {
+        BlockDriverState *bs = bdrv_find_node(node_names->value);
+        BlockDeviceInfo *info;
+
+        if (!bs) {
+            error_setg(errp, "Cannot find node '%s'", node_names->value);
+            goto fail;
+        }
+        info = bdrv_block_device_info(NULL, bs, return_flat, errp);
+        if (!info) {
+            goto fail;
+        }
+        QAPI_LIST_APPEND(tail, info);
+    }
+    return head;
+
+fail:
+    qapi_free_BlockDeviceInfoList(head);
+    return NULL;
 }
 
 XDbgBlockGraph *qmp_x_debug_query_block_graph(Error **errp)
@@ -43,6 +43,12 @@ bool have_mmap_lock(void)
     return mmap_lock_count > 0 ? true : false;
 }
 
+/* bsd-user only takes the mmap lock exclusively. */
+bool have_mmap_range_lock(void)
+{
+    return false;
+}
+
 /* Grab lock to make sure things are in a consistent state after fork().  */
 void mmap_fork_start(void)
 {
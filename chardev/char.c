@@ -183,6 +183,69 @@ int qemu_chr_write(Chardev *s, const uint8_t *buf, int len, bool write_all)
     return offset;
 }
 
+/* Write the buffers one by one, stopping at the first short write */
+static int qemu_chr_writev_buffers(Chardev *s, const struct iovec *iov,
+                                   int iovcnt)
+{
+    int done = 0;
+    int i, res;
+
+    for (i = 0; i < iovcnt && done < INT_MAX; i++) {
+        int len = MIN(iov[i].iov_len, INT_MAX - done);
+
+        res = qemu_chr_write(s, iov[i].iov_base, len, false);
+        if (res < 0) {
+            return done ? done : res;
+        }
+        done += res;
+        if (res < len) {
+            break;
+        }
+    }
+    return done;
+}
+
+/*
+ * Write as much of @iov as the backend accepts without blocking, with a
+ * single call into the backend when it implements chr_writev.  At most
+ * INT_MAX bytes are written.
+ *
+ * Returns: the number of bytes written, or -1 with errno set.
+ */
+int qemu_chr_writev(Chardev *s, const struct iovec *iov, int iovcnt)
+{
+    ChardevClass *cc = CHARDEV_GET_CLASS(s);
+    size_t len = 0, logged;
+    int i, n, res;
+
+    /* Replay records one event per buffer */
+    if (!cc->chr_writev || qemu_chr_replay(s)) {
+        return qemu_chr_writev_buffers(s, iov, iovcnt);
+    }
+
+    for (n = 0; n < iovcnt && len + iov[n].iov_len <= INT_MAX; n++) {
+        len += iov[n].iov_len;
+    }
+    if (n < 2) {
+        return qemu_chr_writev_buffers(s, iov, iovcnt);
+    }
+
+    qemu_mutex_lock(&s->chr_write_lock);
+    res = cc->chr_writev(s, iov, n);
+
+    /* Same logging rules as qemu_chr_write_buffer() */
+    logged = res > 0 ? res : res < 0 ? len : 0;
+    for (i = 0; i < n && logged; i++) {
+        size_t chunk = MIN(logged, iov[i].iov_len);
+
+        qemu_chr_write_log(s, iov[i].iov_base, chunk);
+        logged -= chunk;
+    }
+    qemu_mutex_unlock(&s->chr_write_lock);
+
+    return res;
+}
+
 int qemu_chr_be_can_write(Chardev *s)
 {
     CharBackend *be = s->be;
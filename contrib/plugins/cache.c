@@ -25,6 +25,10 @@ static GRand *rng;
 static int limit;
 static bool sys;
 
+/* Data accesses are delivered in batches through a ring */
+static bool batch;
+static struct qemu_plugin_mem_ring *mem_ring;
+
 enum EvictionPolicy {
     LRU,
     FIFO,
@@ -385,27 +389,17 @@ static bool access_cache(Cache *cache, uint64_t addr)
     return false;
 }
 
-static void vcpu_mem_access(unsigned int vcpu_index, qemu_plugin_meminfo_t info,
-                            uint64_t vaddr, void *userdata)
+static void data_access(unsigned int vcpu_index, uint64_t effective_addr,
+                        InsnData *insn)
 {
-    uint64_t effective_addr;
-    struct qemu_plugin_hwaddr *hwaddr;
     int cache_idx;
-    InsnData *insn;
     bool hit_in_l1;
 
-    hwaddr = qemu_plugin_get_hwaddr(info, vaddr);
-    if (hwaddr && qemu_plugin_hwaddr_is_io(hwaddr)) {
-        return;
-    }
-
-    effective_addr = hwaddr ? qemu_plugin_hwaddr_phys_addr(hwaddr) : vaddr;
     cache_idx = vcpu_index % cores;
 
     g_mutex_lock(&l1_dcache_locks[cache_idx]);
     hit_in_l1 = access_cache(l1_dcaches[cache_idx], effective_addr);
     if (!hit_in_l1) {
-        insn = userdata;
         __atomic_fetch_add(&insn->l1_dmisses, 1, __ATOMIC_SEQ_CST);
         l1_dcaches[cache_idx]->misses++;
     }
@@ -419,7 +413,6 @@ static void vcpu_mem_access(unsigned int vcpu_index, qemu_plugin_meminfo_t info,
 
     g_mutex_lock(&l2_ucache_locks[cache_idx]);
     if (!access_cache(l2_ucaches[cache_idx], effective_addr)) {
-        insn = userdata;
         __atomic_fetch_add(&insn->l2_misses, 1, __ATOMIC_SEQ_CST);
         l2_ucaches[cache_idx]->misses++;
     }
@@ -427,6 +420,40 @@ static void vcpu_mem_access(unsigned int vcpu_index, qemu_plugin_meminfo_t info,
     g_mutex_unlock(&l2_ucache_locks[cache_idx]);
 }
 
+static void vcpu_mem_access(unsigned int vcpu_index, qemu_plugin_meminfo_t info,
+                            uint64_t vaddr, void *userdata)
+{
+    uint64_t effective_addr;
+    struct qemu_plugin_hwaddr *hwaddr;
+
+    hwaddr = qemu_plugin_get_hwaddr(info, vaddr);
+    if (hwaddr && qemu_plugin_hwaddr_is_io(hwaddr)) {
+        return;
+    }
+
+    effective_addr = hwaddr ? qemu_plugin_hwaddr_phys_addr(hwaddr) : vaddr;
+    data_access(vcpu_index, effective_addr, userdata);
+}
+
+/*
+ * Batched accesses only carry the virtual addresses, so this is limited
+ * to user mode, where instructions are also keyed by their vaddr.
+ */
+static void vcpu_mem_batch(unsigned int vcpu_index,
+                           const qemu_plugin_mem_record *records,
+                           size_t n_records, void *userdata)
+{
+    size_t i;
+
+    g_mutex_lock(&hashtable_lock);
+    for (i = 0; i < n_records; i++) {
+        InsnData *insn = g_hash_table_lookup(miss_ht,
+                                             GUINT_TO_POINTER(records[i].pc));
+        data_access(vcpu_index, records[i].vaddr, insn);
+    }
+    g_mutex_unlock(&hashtable_lock);
+}
+
 static void vcpu_insn_exec(unsigned int vcpu_index, void *userdata)
 {
     uint64_t insn_addr;
@@ -496,9 +523,13 @@ static void vcpu_tb_trans(qemu_plugin_id_t id, struct qemu_plugin_tb *tb)
         }
         g_mutex_unlock(&hashtable_lock);
 
-        qemu_plugin_register_vcpu_mem_cb(insn, vcpu_mem_access,
-                                         QEMU_PLUGIN_CB_NO_REGS,
-                                         rw, data);
+        if (batch) {
+            qemu_plugin_register_vcpu_mem_ring(insn, rw, mem_ring);
+        } else {
+            qemu_plugin_register_vcpu_mem_cb(insn, vcpu_mem_access,
+                                             QEMU_PLUGIN_CB_NO_REGS,
+                                             rw, data);
+        }
 
         qemu_plugin_register_vcpu_insn_exec_cb(insn, vcpu_insn_exec,
                                                QEMU_PLUGIN_CB_NO_REGS, data);
@@ -703,6 +734,10 @@ finish:
 
 static void plugin_exit(qemu_plugin_id_t id, void *p)
 {
+    if (mem_ring) {
+        qemu_plugin_mem_ring_free(mem_ring);
+    }
+
     log_stats();
     log_top_insns();
 
@@ -804,6 +839,11 @@ int qemu_plugin_install(qemu_plugin_id_t id, const qemu_info_t *info,
                 fprintf(stderr, "boolean argument parsing failed: %s\n", opt);
                 return -1;
             }
+        } else if (g_strcmp0(tokens[0], "batch") == 0) {
+            if (!qemu_plugin_bool_parse(tokens[0], tokens[1], &batch)) {
+                fprintf(stderr, "boolean argument parsing failed: %s\n", opt);
+                return -1;
+            }
         } else if (g_strcmp0(tokens[0], "evict") == 0) {
             if (g_strcmp0(tokens[1], "rand") == 0) {
                 policy = RAND;
@@ -821,6 +861,11 @@ int qemu_plugin_install(qemu_plugin_id_t id, const qemu_info_t *info,
         }
     }
 
+    if (batch && sys) {
+        fprintf(stderr, "batch is only supported in user mode\n");
+        return -1;
+    }
+
     policy_init();
 
     l1_dcaches = caches_init(l1_dblksize, l1_dassoc, l1_dcachesize);
@@ -851,6 +896,10 @@ int qemu_plugin_install(qemu_plugin_id_t id, const qemu_info_t *info,
     l1_icache_locks = g_new0(GMutex, cores);
     l2_ucache_locks = use_l2 ? g_new0(GMutex, cores) : NULL;
 
+    if (batch) {
+        mem_ring = qemu_plugin_mem_ring_new(0, vcpu_mem_batch, NULL);
+    }
+
     qemu_plugin_register_vcpu_tb_trans_cb(id, vcpu_tb_trans);
     qemu_plugin_register_atexit_cb(id, plugin_exit, NULL);
 
@@ -124,20 +124,32 @@ CPUState *qemu_get_cpu(int index)
 __thread CPUState *current_cpu;
 
 struct qemu_work_item {
-    QSIMPLEQ_ENTRY(qemu_work_item) node;
+    QSLIST_ENTRY(qemu_work_item) node;
     run_on_cpu_func func;
     run_on_cpu_data data;
     bool free, exclusive, done;
 };
 
+/*
+ * The work list is a lock-free LIFO: producers push with cmpxchg and
+ * the vCPU thread grabs the whole list at once.  Only the producer that
+ * finds the list empty kicks the vCPU; everybody else piggybacks on the
+ * kick that is already pending, so a storm of requests to one vCPU does
+ * not turn into a storm of signals.
+ */
 static void queue_work_on_cpu(CPUState *cpu, struct qemu_work_item *wi)
 {
-    qemu_mutex_lock(&cpu->work_mutex);
-    QSIMPLEQ_INSERT_TAIL(&cpu->work_list, wi, node);
+    struct qemu_work_item *old;
+
     wi->done = false;
-    qemu_mutex_unlock(&cpu->work_mutex);
+    do {
+        old = qatomic_read(&QSLIST_FIRST(&cpu->work_list));
+        wi->node.sle_next = old;
+    } while (qatomic_cmpxchg(&QSLIST_FIRST(&cpu->work_list), old, wi) != old);
 
-    qemu_cpu_kick(cpu);
+    if (!old) {
+        qemu_cpu_kick(cpu);
+    }
 }
 
 void do_run_on_cpu(CPUState *cpu, run_on_cpu_func func, run_on_cpu_data data,
@@ -331,42 +343,67 @@ void async_safe_run_on_cpu(CPUState *cpu, run_on_cpu_func func,
     queue_work_on_cpu(cpu, wi);
 }
 
+static void complete_work_item(struct qemu_work_item *wi)
+{
+    if (wi->free) {
+        g_free(wi);
+    } else {
+        qatomic_store_release(&wi->done, true);
+    }
+}
+
 void process_queued_cpu_work(CPUState *cpu)
 {
-    struct qemu_work_item *wi;
+    QSLIST_HEAD(, qemu_work_item) batch, list;
+    struct qemu_work_item *wi, *next;
 
-    qemu_mutex_lock(&cpu->work_mutex);
-    if (QSIMPLEQ_EMPTY(&cpu->work_list)) {
-        qemu_mutex_unlock(&cpu->work_mutex);
+    if (!qatomic_read(&QSLIST_FIRST(&cpu->work_list))) {
         return;
     }
-    while (!QSIMPLEQ_EMPTY(&cpu->work_list)) {
-        wi = QSIMPLEQ_FIRST(&cpu->work_list);
-        QSIMPLEQ_REMOVE_HEAD(&cpu->work_list, node);
-        qemu_mutex_unlock(&cpu->work_mutex);
-        if (wi->exclusive) {
-            /* Running work items outside the BQL avoids the following deadlock:
-             * 1) start_exclusive() is called with the BQL taken while another
-             * CPU is running; 2) cpu_exec in the other CPU tries to takes the
-             * BQL, so it goes to sleep; start_exclusive() is sleeping too, so
-             * neither CPU can proceed.
-             */
-            qemu_mutex_unlock_iothread();
-            start_exclusive();
-            wi->func(cpu, wi->data);
-            end_exclusive();
-            qemu_mutex_lock_iothread();
-        } else {
-            wi->func(cpu, wi->data);
+
+    for (;;) {
+        QSLIST_MOVE_ATOMIC(&batch, &cpu->work_list);
+        if (QSLIST_EMPTY(&batch)) {
+            break;
         }
-        qemu_mutex_lock(&cpu->work_mutex);
-        if (wi->free) {
-            g_free(wi);
-        } else {
-            qatomic_store_release(&wi->done, true);
+
+        /* Items were pushed in LIFO order, run them in submission order. */
+        QSLIST_INIT(&list);
+        QSLIST_FOREACH_SAFE(wi, &batch, node, next) {
+            QSLIST_INSERT_HEAD(&list, wi, node);
+        }
+
+        while (!QSLIST_EMPTY(&list)) {
+            wi = QSLIST_FIRST(&list);
+            if (wi->exclusive) {
+                /*
+                 * Running work items outside the BQL avoids the following
+                 * deadlock: 1) start_exclusive() is called with the BQL
+                 * taken while another CPU is running; 2) cpu_exec in the
+                 * other CPU tries to takes the BQL, so it goes to sleep;
+                 * start_exclusive() is sleeping too, so neither CPU can
+                 * proceed.
+                 *
+                 * Consecutive exclusive items share a single exclusive
+                 * section, which makes flush storms much cheaper.
+                 */
+                qemu_mutex_unlock_iothread();
+                start_exclusive();
+                while (wi && wi->exclusive) {
+                    QSLIST_REMOVE_HEAD(&list, node);
+                    wi->func(cpu, wi->data);
+                    complete_work_item(wi);
+                    wi = QSLIST_FIRST(&list);
+                }
+                end_exclusive();
+                qemu_mutex_lock_iothread();
+            } else {
+                QSLIST_REMOVE_HEAD(&list, node);
+                wi->func(cpu, wi->data);
+                complete_work_item(wi);
+            }
         }
     }
-    qemu_mutex_unlock(&cpu->work_mutex);
     qemu_cond_broadcast(&qemu_work_cond);
 }
 
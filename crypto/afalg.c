@@ -93,6 +93,21 @@ error:
     return NULL;
 }
 
+void qcrypto_afalg_batch_free(QCryptoAFAlg *afalg)
+{
+    int i;
+
+    if (afalg->aio_ctx) {
+        syscall(__NR_io_destroy, afalg->aio_ctx);
+        afalg->aio_ctx = 0;
+    }
+
+    for (i = 0; i < afalg->nbatch_fd; i++) {
+        close(afalg->batch_fd[i]);
+    }
+    afalg->nbatch_fd = 0;
+}
+
 void qcrypto_afalg_comm_free(QCryptoAFAlg *afalg)
 {
     if (!afalg) {
@@ -112,5 +127,7 @@ void qcrypto_afalg_comm_free(QCryptoAFAlg *afalg)
         close(afalg->opfd);
     }
 
+    qcrypto_afalg_batch_free(afalg);
+
     g_free(afalg);
 }
@@ -15,6 +15,8 @@
 #define QCRYPTO_AFALGPRIV_H
 
 #include <linux/if_alg.h>
+#include <linux/aio_abi.h>
+#include <sys/syscall.h>
 #include "crypto/cipher.h"
 
 #define SALG_TYPE_LEN_MAX 14
@@ -30,6 +32,9 @@
 #define ALG_OPTYPE_LEN 4
 #define ALG_MSGIV_LEN(len) (sizeof(struct af_alg_iv) + (len))
 
+/* Maximum number of cipher operations kept in flight by a batch */
+#define AFALG_BATCH_DEPTH 16
+
 typedef struct QCryptoAFAlg QCryptoAFAlg;
 
 struct QCryptoAFAlg {
@@ -39,6 +44,12 @@ struct QCryptoAFAlg {
     int opfd;
     struct msghdr *msg;
     struct cmsghdr *cmsg;
+
+    /* Extra operation sockets and AIO context used by batches */
+    int batch_fd[AFALG_BATCH_DEPTH];
+    int nbatch_fd;
+    aio_context_t aio_ctx;
+    bool batch_unsupported;
 };
 
 /**
@@ -64,4 +75,13 @@ qcrypto_afalg_comm_alloc(const char *type, const char *name,
  */
 void qcrypto_afalg_comm_free(QCryptoAFAlg *afalg);
 
+/**
+ * qcrypto_afalg_batch_free:
+ * @afalg: the QCryptoAFAlg object
+ *
+ * Close the batch operation sockets and AIO context of
+ * @afalg, if any. They are set up again by the next batch.
+ */
+void qcrypto_afalg_batch_free(QCryptoAFAlg *afalg);
+
 #endif
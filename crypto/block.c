@@ -347,11 +347,8 @@ void qcrypto_block_free(QCryptoBlock *block)
 }
 
 
-typedef int (*QCryptoCipherEncDecFunc)(QCryptoCipher *cipher,
-                                        const void *in,
-                                        void *out,
-                                        size_t len,
-                                        Error **errp);
+/* Maximum number of sectors handed to the cipher in a single batch */
+#define QCRYPTO_BLOCK_BATCH_SECTORS 64
 
 static int do_qcrypto_block_cipher_encdec(QCryptoCipher *cipher,
                                           size_t niv,
@@ -361,46 +358,59 @@ static int do_qcrypto_block_cipher_encdec(QCryptoCipher *cipher,
                                           uint64_t offset,
                                           uint8_t *buf,
                                           size_t len,
-                                          QCryptoCipherEncDecFunc func,
+                                          bool encrypt,
                                           Error **errp)
 {
-    g_autofree uint8_t *iv = niv ? g_new0(uint8_t, niv) : NULL;
-    int ret = -1;
+    QCryptoCipherBatchOp ops[QCRYPTO_BLOCK_BATCH_SECTORS];
+    g_autofree uint8_t *iv =
+        niv ? g_new0(uint8_t, niv * QCRYPTO_BLOCK_BATCH_SECTORS) : NULL;
     uint64_t startsector = offset / sectorsize;
 
     assert(QEMU_IS_ALIGNED(offset, sectorsize));
     assert(QEMU_IS_ALIGNED(len, sectorsize));
 
     while (len > 0) {
-        size_t nbytes;
-        if (niv) {
-            if (ivgen_mutex) {
-                qemu_mutex_lock(ivgen_mutex);
-            }
-            ret = qcrypto_ivgen_calculate(ivgen, startsector, iv, niv, errp);
-            if (ivgen_mutex) {
-                qemu_mutex_unlock(ivgen_mutex);
-            }
+        size_t nops = 0;
+        int ret = 0;
 
-            if (ret < 0) {
-                return -1;
+        if (niv && ivgen_mutex) {
+            qemu_mutex_lock(ivgen_mutex);
+        }
+        while (len > 0 && nops < QCRYPTO_BLOCK_BATCH_SECTORS) {
+            size_t nbytes = len > sectorsize ? sectorsize : len;
+            uint8_t *opiv = NULL;
+
+            if (niv) {
+                opiv = iv + nops * niv;
+                ret = qcrypto_ivgen_calculate(ivgen, startsector,
+                                              opiv, niv, errp);
+                if (ret < 0) {
+                    break;
+                }
             }
 
-            if (qcrypto_cipher_setiv(cipher,
-                                     iv, niv,
-                                     errp) < 0) {
-                return -1;
-            }
+            ops[nops++] = (QCryptoCipherBatchOp) {
+                .iv = opiv,
+                .in = buf,
+                .out = buf,
+                .len = nbytes,
+            };
+
+            startsector++;
+            buf += nbytes;
+            len -= nbytes;
+        }
+        if (niv && ivgen_mutex) {
+            qemu_mutex_unlock(ivgen_mutex);
         }
 
-        nbytes = len > sectorsize ? sectorsize : len;
-        if (func(cipher, buf, buf, nbytes, errp) < 0) {
+        if (ret < 0) {
             return -1;
         }
 
-        startsector++;
-        buf += nbytes;
-        len -= nbytes;
+        if (qcrypto_cipher_batch(cipher, encrypt, ops, nops, errp) < 0) {
+            return -1;
+        }
     }
 
     return 0;
@@ -417,8 +427,7 @@ int qcrypto_block_cipher_decrypt_helper(QCryptoCipher *cipher,
                                         Error **errp)
 {
     return do_qcrypto_block_cipher_encdec(cipher, niv, ivgen, NULL, sectorsize,
-                                          offset, buf, len,
-                                          qcrypto_cipher_decrypt, errp);
+                                          offset, buf, len, false, errp);
 }
 
 
@@ -432,8 +441,7 @@ int qcrypto_block_cipher_encrypt_helper(QCryptoCipher *cipher,
                                         Error **errp)
 {
     return do_qcrypto_block_cipher_encdec(cipher, niv, ivgen, NULL, sectorsize,
-                                          offset, buf, len,
-                                          qcrypto_cipher_encrypt, errp);
+                                          offset, buf, len, true, errp);
 }
 
 int qcrypto_block_decrypt_helper(QCryptoBlock *block,
@@ -448,7 +456,7 @@ int qcrypto_block_decrypt_helper(QCryptoBlock *block,
 
     ret = do_qcrypto_block_cipher_encdec(cipher, block->niv, block->ivgen,
                                          &block->mutex, sectorsize, offset, buf,
-                                         len, qcrypto_cipher_decrypt, errp);
+                                         len, false, errp);
 
     qcrypto_block_push_cipher(block, cipher);
 
@@ -467,7 +475,7 @@ int qcrypto_block_encrypt_helper(QCryptoBlock *block,
 
     ret = do_qcrypto_block_cipher_encdec(cipher, block->niv, block->ivgen,
                                          &block->mutex, sectorsize, offset, buf,
-                                         len, qcrypto_cipher_encrypt, errp);
+                                         len, true, errp);
 
     qcrypto_block_push_cipher(block, cipher);
 
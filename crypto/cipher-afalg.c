@@ -12,6 +12,7 @@
  */
 #include "qemu/osdep.h"
 #include "qemu/sockets.h"
+#include "qemu/units.h"
 #include "qapi/error.h"
 #include "crypto/cipher.h"
 #include "cipherpriv.h"
@@ -217,6 +218,202 @@ qcrypto_afalg_cipher_decrypt(QCryptoCipher *cipher,
     return qcrypto_afalg_cipher_op(afalg, in, out, len, false, errp);
 }
 
+/*
+ * Batches keep up to AFALG_BATCH_DEPTH operations in flight: each one is
+ * queued on its own operation socket, with its own IV, and the results are
+ * collected with Linux AIO so that asynchronous engines behind AF_ALG can
+ * work on all of them at once.  Larger operations would not fit in the
+ * socket buffer in one go, so they use the sequential path.
+ */
+#define AFALG_BATCH_MAX_LEN (16 * KiB)
+
+static bool qcrypto_afalg_batch_init(QCryptoAFAlg *afalg)
+{
+    aio_context_t ctx = 0;
+
+    if (afalg->nbatch_fd) {
+        return true;
+    }
+    if (afalg->batch_unsupported) {
+        return false;
+    }
+
+    if (syscall(__NR_io_setup, AFALG_BATCH_DEPTH, &ctx) < 0) {
+        afalg->batch_unsupported = true;
+        return false;
+    }
+    afalg->aio_ctx = ctx;
+
+    while (afalg->nbatch_fd < AFALG_BATCH_DEPTH) {
+        int fd = qemu_accept(afalg->tfmfd, NULL, 0);
+
+        if (fd == -1) {
+            break;
+        }
+        afalg->batch_fd[afalg->nbatch_fd++] = fd;
+    }
+
+    if (!afalg->nbatch_fd) {
+        qcrypto_afalg_batch_free(afalg);
+        afalg->batch_unsupported = true;
+        return false;
+    }
+    return true;
+}
+
+static int
+qcrypto_afalg_cipher_batch_window(QCryptoAFAlg *afalg, bool encrypt,
+                                  size_t niv,
+                                  const QCryptoCipherBatchOp *ops,
+                                  size_t nops, Error **errp)
+{
+    struct iocb iocb[AFALG_BATCH_DEPTH];
+    struct iocb *iocbp[AFALG_BATCH_DEPTH];
+    struct io_event events[AFALG_BATCH_DEPTH];
+    Error *local_err = NULL;
+    struct cmsghdr *cmsg;
+    struct iovec iov;
+    long submitted, done = 0;
+    size_t i;
+
+    assert(nops <= afalg->nbatch_fd);
+
+    afalg->msg->msg_iov = &iov;
+    afalg->msg->msg_iovlen = 1;
+
+    for (i = 0; i < nops; i++) {
+        ssize_t sent;
+
+        cmsg = CMSG_FIRSTHDR(afalg->msg);
+        cmsg->cmsg_level = SOL_ALG;
+        *(uint32_t *)CMSG_DATA(cmsg) = encrypt ? ALG_OP_ENCRYPT
+                                               : ALG_OP_DECRYPT;
+        if (niv) {
+            struct af_alg_iv *alg_iv;
+
+            cmsg = CMSG_NXTHDR(afalg->msg, cmsg);
+            cmsg->cmsg_level = SOL_ALG;
+            alg_iv = (struct af_alg_iv *)CMSG_DATA(cmsg);
+            alg_iv->ivlen = niv;
+            memcpy(alg_iv->iv, ops[i].iv, niv);
+        }
+
+        iov.iov_base = (void *)ops[i].in;
+        iov.iov_len = ops[i].len;
+        sent = sendmsg(afalg->batch_fd[i], afalg->msg, 0);
+        if (sent != ops[i].len) {
+            error_setg_errno(&local_err, sent == -1 ? errno : EIO,
+                             "Send data to AF_ALG core failed");
+            nops = i;
+            break;
+        }
+
+        iocb[i] = (struct iocb) {
+            .aio_data = i,
+            .aio_lio_opcode = IOCB_CMD_PREAD,
+            .aio_fildes = afalg->batch_fd[i],
+            .aio_buf = (uintptr_t)ops[i].out,
+            .aio_nbytes = ops[i].len,
+        };
+        iocbp[i] = &iocb[i];
+    }
+    afalg->cmsg = CMSG_FIRSTHDR(afalg->msg);
+
+    submitted = nops ? syscall(__NR_io_submit, afalg->aio_ctx,
+                               (long)nops, iocbp) : 0;
+    if (submitted < 0) {
+        if (errno != EAGAIN) {
+            afalg->batch_unsupported = true;
+        }
+        submitted = 0;
+    }
+
+    /* Whatever the kernel did not take is read synchronously */
+    for (i = submitted; i < nops; i++) {
+        ssize_t rlen = read(afalg->batch_fd[i], ops[i].out, ops[i].len);
+
+        if (rlen != ops[i].len && !local_err) {
+            error_setg_errno(&local_err, rlen == -1 ? errno : EIO,
+                             "Get result from AF_ALG core failed");
+        }
+    }
+
+    while (done < submitted) {
+        long n = syscall(__NR_io_getevents, afalg->aio_ctx,
+                         submitted - done, submitted - done, events, NULL);
+
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (!local_err) {
+                error_setg_errno(&local_err, errno,
+                                 "Get result from AF_ALG core failed");
+            }
+            break;
+        }
+
+        for (i = 0; i < n; i++) {
+            const QCryptoCipherBatchOp *op = &ops[events[i].data];
+
+            if (events[i].res != op->len && !local_err) {
+                error_setg_errno(&local_err,
+                                 events[i].res < 0 ? -events[i].res : EIO,
+                                 "Get result from AF_ALG core failed");
+            }
+        }
+        done += n;
+    }
+
+    /*
+     * Start from fresh sockets after an error, as they could still hold
+     * unread data; io_destroy() also waits for anything left in flight.
+     */
+    if (local_err || afalg->batch_unsupported) {
+        qcrypto_afalg_batch_free(afalg);
+    }
+    if (local_err) {
+        error_propagate(errp, local_err);
+        return -1;
+    }
+    return 0;
+}
+
+static int
+qcrypto_afalg_cipher_batch(QCryptoCipher *cipher, bool encrypt,
+                           const QCryptoCipherBatchOp *ops, size_t nops,
+                           Error **errp)
+{
+    QCryptoAFAlg *afalg = container_of(cipher, QCryptoAFAlg, base);
+    size_t niv = qcrypto_cipher_get_iv_len(cipher->alg, cipher->mode);
+    size_t i, n;
+
+    for (i = 0; i < nops; i++) {
+        if ((niv && !ops[i].iv) || ops[i].len > AFALG_BATCH_MAX_LEN) {
+            break;
+        }
+    }
+    if (nops < 2 || i < nops || !qcrypto_afalg_batch_init(afalg)) {
+        return qcrypto_cipher_batch_sequential(cipher, encrypt, ops, nops,
+                                               errp);
+    }
+
+    for (i = 0; i < nops; i += n) {
+        n = MIN(nops - i, afalg->nbatch_fd);
+        if (qcrypto_afalg_cipher_batch_window(afalg, encrypt, niv,
+                                              ops + i, n, errp) < 0) {
+            return -1;
+        }
+        if (!afalg->nbatch_fd && i + n < nops) {
+            /* AIO turned out to be unavailable, finish the slow way */
+            return qcrypto_cipher_batch_sequential(cipher, encrypt,
+                                                   ops + i + n,
+                                                   nops - i - n, errp);
+        }
+    }
+    return 0;
+}
+
 static void qcrypto_afalg_comm_ctx_free(QCryptoCipher *cipher)
 {
     QCryptoAFAlg *afalg = container_of(cipher, QCryptoAFAlg, base);
@@ -228,5 +425,6 @@ static const struct QCryptoCipherDriver qcrypto_cipher_afalg_driver = {
     .cipher_encrypt = qcrypto_afalg_cipher_encrypt,
     .cipher_decrypt = qcrypto_afalg_cipher_decrypt,
     .cipher_setiv = qcrypto_afalg_cipher_setiv,
+    .cipher_batch = qcrypto_afalg_cipher_batch,
     .cipher_free = qcrypto_afalg_comm_ctx_free,
 };
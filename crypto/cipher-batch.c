@@ -0,0 +1,87 @@
+/*
+ * QEMU Crypto asynchronous cipher batches
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * (at your option) any later version.  See the COPYING file in the
+ * top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qapi/error.h"
+#include "block/thread-pool.h"
+#include "crypto/cipher.h"
+
+typedef struct QCryptoCipherBatchReq {
+    QCryptoCipher *cipher;
+    bool encrypt;
+    const QCryptoCipherBatchOp *ops;
+    size_t nops;
+    Error *err;
+
+    QCryptoCipherBatchCompletionFunc *cb;
+    void *opaque;
+} QCryptoCipherBatchReq;
+
+static int qcrypto_cipher_batch_worker(void *opaque)
+{
+    QCryptoCipherBatchReq *req = opaque;
+
+    if (qcrypto_cipher_batch(req->cipher, req->encrypt, req->ops, req->nops,
+                             &req->err) < 0) {
+        return -EIO;
+    }
+    return 0;
+}
+
+static void qcrypto_cipher_batch_complete(void *opaque, int ret)
+{
+    QCryptoCipherBatchReq *req = opaque;
+
+    if (ret < 0 && !req->err) {
+        error_setg_errno(&req->err, -ret, "Cipher batch failed");
+    }
+    req->cb(req->opaque, req->err);
+    g_free(req);
+}
+
+void qcrypto_cipher_batch_submit(QCryptoCipher *cipher, bool encrypt,
+                                 const QCryptoCipherBatchOp *ops,
+                                 size_t nops,
+                                 QCryptoCipherBatchCompletionFunc *cb,
+                                 void *opaque)
+{
+    QCryptoCipherBatchReq *req = g_new0(QCryptoCipherBatchReq, 1);
+
+    req->cipher = cipher;
+    req->encrypt = encrypt;
+    req->ops = ops;
+    req->nops = nops;
+    req->cb = cb;
+    req->opaque = opaque;
+
+    thread_pool_submit_aio(qcrypto_cipher_batch_worker, req,
+                           qcrypto_cipher_batch_complete, req);
+}
+
+int coroutine_fn qcrypto_cipher_co_batch(QCryptoCipher *cipher, bool encrypt,
+                                         const QCryptoCipherBatchOp *ops,
+                                         size_t nops, Error **errp)
+{
+    QCryptoCipherBatchReq req = {
+        .cipher = cipher,
+        .encrypt = encrypt,
+        .ops = ops,
+        .nops = nops,
+    };
+    int ret;
+
+    ret = thread_pool_submit_co(qcrypto_cipher_batch_worker, &req);
+    if (ret < 0) {
+        if (!req.err) {
+            error_setg_errno(&req.err, -ret, "Cipher batch failed");
+        }
+        error_propagate(errp, req.err);
+        return -1;
+    }
+    return 0;
+}
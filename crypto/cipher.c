@@ -198,6 +198,49 @@ int qcrypto_cipher_setiv(QCryptoCipher *cipher,
 }
 
 
+int qcrypto_cipher_batch_sequential(QCryptoCipher *cipher, bool encrypt,
+                                    const QCryptoCipherBatchOp *ops,
+                                    size_t nops, Error **errp)
+{
+    const QCryptoCipherDriver *drv = cipher->driver;
+    size_t niv = qcrypto_cipher_get_iv_len(cipher->alg, cipher->mode);
+    size_t i;
+
+    for (i = 0; i < nops; i++) {
+        if (ops[i].iv &&
+            drv->cipher_setiv(cipher, ops[i].iv, niv, errp) < 0) {
+            return -1;
+        }
+        if (encrypt) {
+            if (drv->cipher_encrypt(cipher, ops[i].in, ops[i].out,
+                                    ops[i].len, errp) < 0) {
+                return -1;
+            }
+        } else {
+            if (drv->cipher_decrypt(cipher, ops[i].in, ops[i].out,
+                                    ops[i].len, errp) < 0) {
+                return -1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+
+int qcrypto_cipher_batch(QCryptoCipher *cipher, bool encrypt,
+                         const QCryptoCipherBatchOp *ops, size_t nops,
+                         Error **errp)
+{
+    const QCryptoCipherDriver *drv = cipher->driver;
+
+    if (drv->cipher_batch) {
+        return drv->cipher_batch(cipher, encrypt, ops, nops, errp);
+    }
+    return qcrypto_cipher_batch_sequential(cipher, encrypt, ops, nops, errp);
+}
+
+
 void qcrypto_cipher_free(QCryptoCipher *cipher)
 {
     if (cipher) {
@@ -34,9 +34,18 @@ struct QCryptoCipherDriver {
                         const uint8_t *iv, size_t niv,
                         Error **errp);
 
+    /* Optional, qcrypto_cipher_batch_sequential() is used if NULL */
+    int (*cipher_batch)(QCryptoCipher *cipher, bool encrypt,
+                        const QCryptoCipherBatchOp *ops, size_t nops,
+                        Error **errp);
+
     void (*cipher_free)(QCryptoCipher *cipher);
 };
 
+int qcrypto_cipher_batch_sequential(QCryptoCipher *cipher, bool encrypt,
+                                    const QCryptoCipherBatchOp *ops,
+                                    size_t nops, Error **errp);
+
 #ifdef CONFIG_AF_ALG
 
 #include "afalgpriv.h"
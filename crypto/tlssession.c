@@ -33,6 +33,10 @@
 
 #include <gnutls/x509.h>
 
+#ifdef CONFIG_KTLS
+#include <netinet/tcp.h>
+#include <linux/tls.h>
+#endif
 
 struct QCryptoTLSSession {
     QCryptoTLSCreds *creds;
@@ -552,6 +556,107 @@ qcrypto_tls_session_get_key_size(QCryptoTLSSession *session,
 }
 
 
+#ifdef CONFIG_KTLS
+int
+qcrypto_tls_session_enable_ktls_tx(QCryptoTLSSession *session,
+                                   int fd,
+                                   Error **errp)
+{
+    gnutls_protocol_t version = gnutls_protocol_get_version(session->handle);
+    gnutls_cipher_algorithm_t cipher = gnutls_cipher_get(session->handle);
+    gnutls_datum_t iv, key;
+    unsigned char seq[8];
+    union {
+        struct tls_crypto_info info;
+        struct tls12_crypto_info_aes_gcm_128 aes128;
+        struct tls12_crypto_info_aes_gcm_256 aes256;
+    } crypto_info = { 0 };
+    socklen_t len;
+    int ret;
+
+    assert(session->handshakeComplete);
+
+    if (version == GNUTLS_TLS1_2) {
+        crypto_info.info.version = TLS_1_2_VERSION;
+    } else if (version == GNUTLS_TLS1_3) {
+        crypto_info.info.version = TLS_1_3_VERSION;
+    } else {
+        error_setg(errp, "kTLS does not support %s",
+                   gnutls_protocol_get_name(version));
+        return -1;
+    }
+
+    ret = gnutls_record_get_state(session->handle, 0, NULL, &iv, &key, seq);
+    if (ret < 0) {
+        error_setg(errp, "Cannot get TLS transmit state: %s",
+                   gnutls_strerror(ret));
+        return -1;
+    }
+
+    /*
+     * The first four bytes of the IV are the implicit salt. The explicit
+     * part is the record sequence number for TLS 1.2, which is what
+     * GnuTLS sends, and the rest of the IV for TLS 1.3.
+     */
+    switch (cipher) {
+    case GNUTLS_CIPHER_AES_128_GCM:
+        crypto_info.info.cipher_type = TLS_CIPHER_AES_GCM_128;
+        memcpy(crypto_info.aes128.salt, iv.data,
+               TLS_CIPHER_AES_GCM_128_SALT_SIZE);
+        memcpy(crypto_info.aes128.iv,
+               version == GNUTLS_TLS1_2 ? seq : iv.data + 4,
+               TLS_CIPHER_AES_GCM_128_IV_SIZE);
+        memcpy(crypto_info.aes128.key, key.data,
+               TLS_CIPHER_AES_GCM_128_KEY_SIZE);
+        memcpy(crypto_info.aes128.rec_seq, seq,
+               TLS_CIPHER_AES_GCM_128_REC_SEQ_SIZE);
+        len = sizeof(crypto_info.aes128);
+        break;
+    case GNUTLS_CIPHER_AES_256_GCM:
+        crypto_info.info.cipher_type = TLS_CIPHER_AES_GCM_256;
+        memcpy(crypto_info.aes256.salt, iv.data,
+               TLS_CIPHER_AES_GCM_256_SALT_SIZE);
+        memcpy(crypto_info.aes256.iv,
+               version == GNUTLS_TLS1_2 ? seq : iv.data + 4,
+               TLS_CIPHER_AES_GCM_256_IV_SIZE);
+        memcpy(crypto_info.aes256.key, key.data,
+               TLS_CIPHER_AES_GCM_256_KEY_SIZE);
+        memcpy(crypto_info.aes256.rec_seq, seq,
+               TLS_CIPHER_AES_GCM_256_REC_SEQ_SIZE);
+        len = sizeof(crypto_info.aes256);
+        break;
+    default:
+        error_setg(errp, "kTLS does not support cipher %s",
+                   gnutls_cipher_get_name(cipher));
+        return -1;
+    }
+
+    if (setsockopt(fd, SOL_TCP, TCP_ULP, "tls", sizeof("tls")) < 0 &&
+        errno != EEXIST) {
+        error_setg_errno(errp, errno, "Cannot enable kTLS on socket");
+        ret = -1;
+    } else if (setsockopt(fd, SOL_TLS, TLS_TX, &crypto_info, len) < 0) {
+        error_setg_errno(errp, errno, "Cannot set kTLS transmit keys");
+        ret = -1;
+    } else {
+        ret = 0;
+    }
+
+    memset(&crypto_info, 0, sizeof(crypto_info));
+    return ret;
+}
+#else /* ! CONFIG_KTLS */
+int
+qcrypto_tls_session_enable_ktls_tx(QCryptoTLSSession *session,
+                                   int fd,
+                                   Error **errp)
+{
+    error_setg(errp, "kTLS is not supported on this platform");
+    return -1;
+}
+#endif /* ! CONFIG_KTLS */
+
+
 char *
 qcrypto_tls_session_get_peer_name(QCryptoTLSSession *session)
 {
@@ -654,6 +759,16 @@ qcrypto_tls_session_get_key_size(QCryptoTLSSession *sess,
 }
 
 
+int
+qcrypto_tls_session_enable_ktls_tx(QCryptoTLSSession *sess,
+                                   int fd,
+                                   Error **errp)
+{
+    error_setg(errp, "TLS requires GNUTLS support");
+    return -1;
+}
+
+
 char *
 qcrypto_tls_session_get_peer_name(QCryptoTLSSession *sess)
 {
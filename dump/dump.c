@@ -38,12 +38,19 @@
 #ifdef CONFIG_SNAPPY
 #include <snappy-c.h>
 #endif
+#ifdef CONFIG_ZSTD
+#include <zstd.h>
+#endif
 #ifndef ELF_MACHINE_UNAME
 #define ELF_MACHINE_UNAME "Unknown"
 #endif
 
 #define MAX_GUEST_NOTE_SIZE (1 << 20) /* 1MB should be enough */
 
+/* Pages compressed in parallel before they are written out */
+#define DUMP_COMPRESS_BATCH 256
+#define DUMP_ZSTD_LEVEL 1
+
 static Error *dump_migration_blocker;
 
 #define ELF_NOTE_SIZE(hdr_size, name_size, desc_size)   \
@@ -979,6 +986,11 @@ static void create_header32(DumpState *s, Error **errp)
     if (s->flag_compress & DUMP_DH_COMPRESSED_SNAPPY) {
         status |= DUMP_DH_COMPRESSED_SNAPPY;
     }
+#endif
+#ifdef CONFIG_ZSTD
+    if (s->flag_compress & DUMP_DH_COMPRESSED_ZSTD) {
+        status |= DUMP_DH_COMPRESSED_ZSTD;
+    }
 #endif
     dh->status = cpu_to_dump32(s, status);
 
@@ -1090,6 +1102,11 @@ static void create_header64(DumpState *s, Error **errp)
     if (s->flag_compress & DUMP_DH_COMPRESSED_SNAPPY) {
         status |= DUMP_DH_COMPRESSED_SNAPPY;
     }
+#endif
+#ifdef CONFIG_ZSTD
+    if (s->flag_compress & DUMP_DH_COMPRESSED_ZSTD) {
+        status |= DUMP_DH_COMPRESSED_ZSTD;
+    }
 #endif
     dh->status = cpu_to_dump32(s, status);
 
@@ -1442,25 +1459,249 @@ static size_t get_len_buf_out(size_t page_size, uint32_t flag_compress)
     case DUMP_DH_COMPRESSED_SNAPPY:
         return snappy_max_compressed_length(page_size);
 #endif
+
+#ifdef CONFIG_ZSTD
+    case DUMP_DH_COMPRESSED_ZSTD:
+        return ZSTD_compressBound(page_size);
+#endif
     }
     return 0;
 }
 
+/* Per-thread compression state */
+typedef struct DumpCompressor {
+#ifdef CONFIG_LZO
+    lzo_bytep wrkmem;
+#endif
+#ifdef CONFIG_ZSTD
+    ZSTD_CCtx *zstd;
+#endif
+} DumpCompressor;
+
+typedef struct DumpPage {
+    uint8_t *buf;       /* page contents, often straight from guest RAM */
+    uint8_t *page;      /* room for pages that get_next_page() assembles */
+    uint8_t *out;       /* compressed contents */
+    size_t size_out;    /* size of the data to write, compressed or not */
+    uint32_t flags;     /* DUMP_DH_COMPRESSED_*, or 0 if not compressed */
+    bool zero;
+} DumpPage;
+
+typedef struct DumpCompressState DumpCompressState;
+
+typedef struct DumpCompressThread {
+    DumpCompressState *cs;
+    QemuThread thread;
+    QemuSemaphore sem;
+    DumpCompressor comp;
+    int index;
+} DumpCompressThread;
+
+/*
+ * Pages are gathered in batches of DUMP_COMPRESS_BATCH.  The dump thread
+ * and nr_threads - 1 helpers compress a batch in interleaved stripes, then
+ * the dump thread writes it out in order, so that the file is the same as
+ * with a single thread.
+ */
+struct DumpCompressState {
+    DumpState *s;
+    size_t len_buf_out;
+    int nr_threads;
+    bool quit;
+    QemuSemaphore done;
+    DumpCompressor comp;            /* for the dump thread */
+    DumpCompressThread *threads;    /* the helpers */
+    int nr_pages;
+    DumpPage pages[DUMP_COMPRESS_BATCH];
+};
+
+static void dump_compressor_init(DumpCompressor *c)
+{
+#ifdef CONFIG_LZO
+    c->wrkmem = g_malloc(LZO1X_1_MEM_COMPRESS);
+#endif
+#ifdef CONFIG_ZSTD
+    c->zstd = ZSTD_createCCtx();
+#endif
+}
+
+static void dump_compressor_cleanup(DumpCompressor *c)
+{
+#ifdef CONFIG_LZO
+    g_free(c->wrkmem);
+#endif
+#ifdef CONFIG_ZSTD
+    ZSTD_freeCCtx(c->zstd);
+#endif
+}
+
+/*
+ * Check whether the page is zero and otherwise compress it.  When the
+ * compression fails or does not save space, the page is saved in plain
+ * text.
+ */
+static void dump_compress_page(DumpCompressState *cs, DumpCompressor *c,
+                               DumpPage *p)
+{
+    DumpState *s = cs->s;
+    size_t page_size = s->dump_info.page_size;
+    size_t size_out = cs->len_buf_out;
+
+    p->zero = buffer_is_zero(p->buf, page_size);
+    p->flags = 0;
+    p->size_out = page_size;
+    if (p->zero) {
+        return;
+    }
+
+    switch (s->flag_compress) {
+    case DUMP_DH_COMPRESSED_ZLIB:
+        if (compress2(p->out, (uLongf *)&size_out, p->buf, page_size,
+                      Z_BEST_SPEED) != Z_OK) {
+            return;
+        }
+        break;
+#ifdef CONFIG_LZO
+    case DUMP_DH_COMPRESSED_LZO:
+        if (lzo1x_1_compress(p->buf, page_size, p->out,
+                             (lzo_uint *)&size_out, c->wrkmem) != LZO_E_OK) {
+            return;
+        }
+        break;
+#endif
+#ifdef CONFIG_SNAPPY
+    case DUMP_DH_COMPRESSED_SNAPPY:
+        if (snappy_compress((char *)p->buf, page_size, (char *)p->out,
+                            &size_out) != SNAPPY_OK) {
+            return;
+        }
+        break;
+#endif
+#ifdef CONFIG_ZSTD
+    case DUMP_DH_COMPRESSED_ZSTD:
+        size_out = ZSTD_compressCCtx(c->zstd, p->out, cs->len_buf_out,
+                                     p->buf, page_size, DUMP_ZSTD_LEVEL);
+        if (ZSTD_isError(size_out)) {
+            return;
+        }
+        break;
+#endif
+    default:
+        return;
+    }
+
+    if (size_out < page_size) {
+        p->flags = s->flag_compress;
+        p->size_out = size_out;
+    }
+}
+
+static void dump_compress_stripe(DumpCompressState *cs, DumpCompressor *c,
+                                 int index)
+{
+    int i;
+
+    for (i = index; i < cs->nr_pages; i += cs->nr_threads) {
+        dump_compress_page(cs, c, &cs->pages[i]);
+    }
+}
+
+static void *dump_compress_thread(void *opaque)
+{
+    DumpCompressThread *t = opaque;
+    DumpCompressState *cs = t->cs;
+
+    for (;;) {
+        qemu_sem_wait(&t->sem);
+        if (cs->quit) {
+            break;
+        }
+        dump_compress_stripe(cs, &t->comp, t->index);
+        qemu_sem_post(&cs->done);
+    }
+    return NULL;
+}
+
+static void dump_compress_batch(DumpCompressState *cs)
+{
+    int i;
+
+    for (i = 1; i < cs->nr_threads; i++) {
+        qemu_sem_post(&cs->threads[i - 1].sem);
+    }
+    dump_compress_stripe(cs, &cs->comp, 0);
+    for (i = 1; i < cs->nr_threads; i++) {
+        qemu_sem_wait(&cs->done);
+    }
+}
+
+static DumpCompressState *dump_compress_start(DumpState *s)
+{
+    DumpCompressState *cs = g_new0(DumpCompressState, 1);
+    int i;
+
+    cs->s = s;
+    cs->len_buf_out = get_len_buf_out(s->dump_info.page_size,
+                                      s->flag_compress);
+    assert(cs->len_buf_out != 0);
+    for (i = 0; i < DUMP_COMPRESS_BATCH; i++) {
+        cs->pages[i].page = g_malloc(s->dump_info.page_size);
+        cs->pages[i].out = g_malloc(cs->len_buf_out);
+    }
+
+    dump_compressor_init(&cs->comp);
+    cs->nr_threads = MAX(s->nr_compress_threads, 1);
+    qemu_sem_init(&cs->done, 0);
+    cs->threads = g_new0(DumpCompressThread, cs->nr_threads - 1);
+    for (i = 0; i < cs->nr_threads - 1; i++) {
+        DumpCompressThread *t = &cs->threads[i];
+
+        t->cs = cs;
+        t->index = i + 1;
+        dump_compressor_init(&t->comp);
+        qemu_sem_init(&t->sem, 0);
+        qemu_thread_create(&t->thread, "dump-compress", dump_compress_thread,
+                           t, QEMU_THREAD_JOINABLE);
+    }
+    return cs;
+}
+
+static void dump_compress_finish(DumpCompressState *cs)
+{
+    int i;
+
+    cs->quit = true;
+    for (i = 0; i < cs->nr_threads - 1; i++) {
+        qemu_sem_post(&cs->threads[i].sem);
+    }
+    for (i = 0; i < cs->nr_threads - 1; i++) {
+        qemu_thread_join(&cs->threads[i].thread);
+        qemu_sem_destroy(&cs->threads[i].sem);
+        dump_compressor_cleanup(&cs->threads[i].comp);
+    }
+    g_free(cs->threads);
+    qemu_sem_destroy(&cs->done);
+    dump_compressor_cleanup(&cs->comp);
+
+    for (i = 0; i < DUMP_COMPRESS_BATCH; i++) {
+        g_free(cs->pages[i].page);
+        g_free(cs->pages[i].out);
+    }
+    g_free(cs);
+}
+
 static void write_dump_pages(DumpState *s, Error **errp)
 {
     int ret = 0;
     DataCache page_desc, page_data;
-    size_t len_buf_out, size_out;
-#ifdef CONFIG_LZO
-    lzo_bytep wrkmem = NULL;
-#endif
-    uint8_t *buf_out = NULL;
     off_t offset_desc, offset_data;
     PageDescriptor pd, pd_zero;
     uint8_t *buf;
     GuestPhysBlock *block_iter = NULL;
     uint64_t pfn_iter;
-    g_autofree uint8_t *page = NULL;
+    DumpCompressState *cs;
+    bool more = true;
+    int i;
 
     /* get offset of page_desc and page_data in dump file */
     offset_desc = s->offset_page;
@@ -1469,15 +1710,7 @@ static void write_dump_pages(DumpState *s, Error **errp)
     prepare_data_cache(&page_desc, s, offset_desc);
     prepare_data_cache(&page_data, s, offset_data);
 
-    /* prepare buffer to store compressed data */
-    len_buf_out = get_len_buf_out(s->dump_info.page_size, s->flag_compress);
-    assert(len_buf_out != 0);
-
-#ifdef CONFIG_LZO
-    wrkmem = g_malloc(LZO1X_1_MEM_COMPRESS);
-#endif
-
-    buf_out = g_malloc(len_buf_out);
+    cs = dump_compress_start(s);
 
     /*
      * init zero page's page_desc and page_data, because every zero page
@@ -1496,103 +1729,59 @@ static void write_dump_pages(DumpState *s, Error **errp)
     }
 
     offset_data += s->dump_info.page_size;
-    page = g_malloc(s->dump_info.page_size);
 
     /*
-     * dump memory to vmcore page by page. zero page will all be resided in the
-     * first page of page section
+     * dump memory to vmcore a batch of pages at a time. zero page will all
+     * be resided in the first page of page section
      */
-    for (buf = page; get_next_page(&block_iter, &pfn_iter, &buf, s); buf = page) {
-        /* check zero page */
-        if (buffer_is_zero(buf, s->dump_info.page_size)) {
-            ret = write_cache(&page_desc, &pd_zero, sizeof(PageDescriptor),
-                              false);
-            if (ret < 0) {
-                error_setg(errp, "dump: failed to write page desc");
-                goto out;
+    while (more) {
+        for (cs->nr_pages = 0; cs->nr_pages < DUMP_COMPRESS_BATCH;
+             cs->nr_pages++) {
+            DumpPage *p = &cs->pages[cs->nr_pages];
+
+            p->buf = p->page;
+            more = get_next_page(&block_iter, &pfn_iter, &p->buf, s);
+            if (!more) {
+                break;
             }
-        } else {
-            /*
-             * not zero page, then:
-             * 1. compress the page
-             * 2. write the compressed page into the cache of page_data
-             * 3. get page desc of the compressed page and write it into the
-             *    cache of page_desc
-             *
-             * only one compression format will be used here, for
-             * s->flag_compress is set. But when compression fails to work,
-             * we fall back to save in plaintext.
-             */
-             size_out = len_buf_out;
-             if ((s->flag_compress & DUMP_DH_COMPRESSED_ZLIB) &&
-                    (compress2(buf_out, (uLongf *)&size_out, buf,
-                               s->dump_info.page_size, Z_BEST_SPEED) == Z_OK) &&
-                    (size_out < s->dump_info.page_size)) {
-                pd.flags = cpu_to_dump32(s, DUMP_DH_COMPRESSED_ZLIB);
-                pd.size  = cpu_to_dump32(s, size_out);
-
-                ret = write_cache(&page_data, buf_out, size_out, false);
-                if (ret < 0) {
-                    error_setg(errp, "dump: failed to write page data");
-                    goto out;
-                }
-#ifdef CONFIG_LZO
-            } else if ((s->flag_compress & DUMP_DH_COMPRESSED_LZO) &&
-                    (lzo1x_1_compress(buf, s->dump_info.page_size, buf_out,
-                    (lzo_uint *)&size_out, wrkmem) == LZO_E_OK) &&
-                    (size_out < s->dump_info.page_size)) {
-                pd.flags = cpu_to_dump32(s, DUMP_DH_COMPRESSED_LZO);
-                pd.size  = cpu_to_dump32(s, size_out);
-
-                ret = write_cache(&page_data, buf_out, size_out, false);
-                if (ret < 0) {
-                    error_setg(errp, "dump: failed to write page data");
-                    goto out;
-                }
-#endif
-#ifdef CONFIG_SNAPPY
-            } else if ((s->flag_compress & DUMP_DH_COMPRESSED_SNAPPY) &&
-                    (snappy_compress((char *)buf, s->dump_info.page_size,
-                    (char *)buf_out, &size_out) == SNAPPY_OK) &&
-                    (size_out < s->dump_info.page_size)) {
-                pd.flags = cpu_to_dump32(s, DUMP_DH_COMPRESSED_SNAPPY);
-                pd.size  = cpu_to_dump32(s, size_out);
-
-                ret = write_cache(&page_data, buf_out, size_out, false);
+        }
+
+        dump_compress_batch(cs);
+
+        for (i = 0; i < cs->nr_pages; i++) {
+            DumpPage *p = &cs->pages[i];
+
+            if (p->zero) {
+                ret = write_cache(&page_desc, &pd_zero,
+                                  sizeof(PageDescriptor), false);
                 if (ret < 0) {
-                    error_setg(errp, "dump: failed to write page data");
+                    error_setg(errp, "dump: failed to write page desc");
                     goto out;
                 }
-#endif
             } else {
-                /*
-                 * fall back to save in plaintext, size_out should be
-                 * assigned the target's page size
-                 */
-                pd.flags = cpu_to_dump32(s, 0);
-                size_out = s->dump_info.page_size;
-                pd.size = cpu_to_dump32(s, size_out);
-
-                ret = write_cache(&page_data, buf,
-                                  s->dump_info.page_size, false);
+                ret = write_cache(&page_data, p->flags ? p->out : p->buf,
+                                  p->size_out, false);
                 if (ret < 0) {
                     error_setg(errp, "dump: failed to write page data");
                     goto out;
                 }
-            }
 
-            /* get and write page desc here */
-            pd.page_flags = cpu_to_dump64(s, 0);
-            pd.offset = cpu_to_dump64(s, offset_data);
-            offset_data += size_out;
+                /* get and write page desc here */
+                pd.flags = cpu_to_dump32(s, p->flags);
+                pd.size = cpu_to_dump32(s, p->size_out);
+                pd.page_flags = cpu_to_dump64(s, 0);
+                pd.offset = cpu_to_dump64(s, offset_data);
+                offset_data += p->size_out;
 
-            ret = write_cache(&page_desc, &pd, sizeof(PageDescriptor), false);
-            if (ret < 0) {
-                error_setg(errp, "dump: failed to write page desc");
-                goto out;
+                ret = write_cache(&page_desc, &pd, sizeof(PageDescriptor),
+                                  false);
+                if (ret < 0) {
+                    error_setg(errp, "dump: failed to write page desc");
+                    goto out;
+                }
             }
+            s->written_size += s->dump_info.page_size;
         }
-        s->written_size += s->dump_info.page_size;
     }
 
     ret = write_cache(&page_desc, NULL, 0, true);
@@ -1607,14 +1796,9 @@ static void write_dump_pages(DumpState *s, Error **errp)
     }
 
 out:
+    dump_compress_finish(cs);
     free_data_cache(&page_desc);
     free_data_cache(&page_data);
-
-#ifdef CONFIG_LZO
-    g_free(wrkmem);
-#endif
-
-    g_free(buf_out);
 }
 
 static void create_kdump_vmcore(DumpState *s, Error **errp)
@@ -1946,6 +2130,10 @@ static void dump_init(DumpState *s, int fd, bool has_format,
             s->flag_compress = DUMP_DH_COMPRESSED_SNAPPY;
             break;
 
+        case DUMP_GUEST_MEMORY_FORMAT_KDUMP_ZSTD:
+            s->flag_compress = DUMP_DH_COMPRESSED_ZSTD;
+            break;
+
         default:
             s->flag_compress = 0;
         }
@@ -2065,7 +2253,8 @@ void qmp_dump_guest_memory(bool paging, const char *file,
                            bool has_detach, bool detach,
                            bool has_begin, int64_t begin, bool has_length,
                            int64_t length, bool has_format,
-                           DumpGuestMemoryFormat format, Error **errp)
+                           DumpGuestMemoryFormat format,
+                           bool has_threads, int64_t threads, Error **errp)
 {
     ERRP_GUARD();
     const char *p;
@@ -2122,6 +2311,27 @@ void qmp_dump_guest_memory(bool paging, const char *file,
     }
 #endif
 
+#ifndef CONFIG_ZSTD
+    if (has_format && format == DUMP_GUEST_MEMORY_FORMAT_KDUMP_ZSTD) {
+        error_setg(errp, "kdump-zstd is not available now");
+        return;
+    }
+#endif
+
+    if (has_threads) {
+        if (!has_format || format == DUMP_GUEST_MEMORY_FORMAT_ELF ||
+            format == DUMP_GUEST_MEMORY_FORMAT_WIN_DMP) {
+            error_setg(errp, "threads is only supported with the "
+                       "kdump-compressed formats");
+            return;
+        }
+        if (threads < 1 || threads > DUMP_MAX_COMPRESS_THREADS) {
+            error_setg(errp, "threads must be between 1 and %d",
+                       DUMP_MAX_COMPRESS_THREADS);
+            return;
+        }
+    }
+
     if (has_format && format == DUMP_GUEST_MEMORY_FORMAT_WIN_DMP
         && !win_dump_available(errp)) {
         return;
@@ -2166,6 +2376,7 @@ void qmp_dump_guest_memory(bool paging, const char *file,
 
     s = &dump_state_global;
     dump_state_prepare(s);
+    s->nr_compress_threads = has_threads ? threads : 1;
 
     dump_init(s, fd, has_format, format, paging, has_begin,
               begin, length, errp);
@@ -2207,6 +2418,11 @@ DumpGuestMemoryCapability *qmp_query_dump_guest_memory_capability(Error **errp)
     QAPI_LIST_APPEND(tail, DUMP_GUEST_MEMORY_FORMAT_KDUMP_SNAPPY);
 #endif
 
+    /* add new item if kdump-zstd is available */
+#ifdef CONFIG_ZSTD
+    QAPI_LIST_APPEND(tail, DUMP_GUEST_MEMORY_FORMAT_KDUMP_ZSTD);
+#endif
+
     if (win_dump_available(NULL)) {
         QAPI_LIST_APPEND(tail, DUMP_GUEST_MEMORY_FORMAT_WIN_DMP);
     }
@@ -77,6 +77,42 @@ static void event_loop_base_set_param(Object *obj, Visitor *v,
     return;
 }
 
+static bool event_loop_base_get_aio_batch_adaptive(Object *obj, Error **errp)
+{
+    return EVENT_LOOP_BASE(obj)->aio_batch_adaptive;
+}
+
+static void event_loop_base_set_aio_batch_adaptive(Object *obj, bool value,
+                                                   Error **errp)
+{
+    EventLoopBaseClass *bc = EVENT_LOOP_BASE_GET_CLASS(obj);
+    EventLoopBase *base = EVENT_LOOP_BASE(obj);
+
+    base->aio_batch_adaptive = value;
+
+    if (bc->update_params) {
+        bc->update_params(base, errp);
+    }
+}
+
+static bool event_loop_base_get_latency_stats(Object *obj, Error **errp)
+{
+    return EVENT_LOOP_BASE(obj)->latency_stats;
+}
+
+static void event_loop_base_set_latency_stats(Object *obj, bool value,
+                                              Error **errp)
+{
+    EventLoopBaseClass *bc = EVENT_LOOP_BASE_GET_CLASS(obj);
+    EventLoopBase *base = EVENT_LOOP_BASE(obj);
+
+    base->latency_stats = value;
+
+    if (bc->update_params) {
+        bc->update_params(base, errp);
+    }
+}
+
 static void event_loop_base_complete(UserCreatable *uc, Error **errp)
 {
     EventLoopBaseClass *bc = EVENT_LOOP_BASE_GET_CLASS(uc);
@@ -109,6 +145,12 @@ static void event_loop_base_class_init(ObjectClass *klass, void *class_data)
                               event_loop_base_get_param,
                               event_loop_base_set_param,
                               NULL, &aio_max_batch_info);
+    object_class_property_add_bool(klass, "aio-batch-adaptive",
+                                   event_loop_base_get_aio_batch_adaptive,
+                                   event_loop_base_set_aio_batch_adaptive);
+    object_class_property_add_bool(klass, "latency-stats",
+                                   event_loop_base_get_latency_stats,
+                                   event_loop_base_set_latency_stats);
     object_class_property_add(klass, "thread-pool-min", "int",
                               event_loop_base_get_param,
                               event_loop_base_set_param,
@@ -94,6 +94,7 @@ typedef struct FsDriverEntry {
     FsThrottle fst;
     mode_t fmode;
     mode_t dmode;
+    uint64_t attr_cache_ms;
 } FsDriverEntry;
 
 struct FsContext {
@@ -46,6 +46,9 @@ static QemuOptsList qemu_fsdev_opts = {
         }, {
             .name = "dmode",
             .type = QEMU_OPT_NUMBER,
+        }, {
+            .name = "attr_cache",
+            .type = QEMU_OPT_NUMBER,
         },
 
         THROTTLE_OPTS,
@@ -59,6 +59,7 @@ static FsDriverTable FsDrivers[] = {
             "fmode",
             "dmode",
             "multidevs",
+            "attr_cache",
             "throttling.bps-total",
             "throttling.bps-read",
             "throttling.bps-write",
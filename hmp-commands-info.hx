@@ -269,6 +269,21 @@ SRST
     Show dynamic compiler info.
 ERST
 
+#if defined(CONFIG_TCG)
+    {
+        .name       = "jit-profile",
+        .args_type  = "",
+        .params     = "",
+        .help       = "show the most executed translation blocks",
+    },
+#endif
+
+SRST
+  ``info jit-profile``
+    Show the most executed translation blocks, when enabled with
+    ``-accel tcg,x-tb-profile=on``.
+ERST
+
 #if defined(CONFIG_TCG)
     {
         .name       = "opcount",
@@ -285,17 +300,18 @@ ERST
 
     {
         .name       = "sync-profile",
-        .args_type  = "mean:-m,no_coalesce:-n,max:i?",
-        .params     = "[-m] [-n] [max]",
+        .args_type  = "mean:-m,no_coalesce:-n,folded:-f,max:i?",
+        .params     = "[-m] [-n] [-f] [max]",
         .help       = "show synchronization profiling info, up to max entries "
                       "(default: 10), sorted by total wait time. (-m: sort by "
                       "mean wait time; -n: do not coalesce objects with the "
-                      "same call site)",
+                      "same call site; -f: print folded stacks for flame "
+                      "graphs)",
         .cmd        = hmp_info_sync_profile,
     },
 
 SRST
-  ``info sync-profile [-m|-n]`` [*max*]
+  ``info sync-profile [-m|-n|-f]`` [*max*]
     Show synchronization profiling info, up to *max* entries (default: 10),
     sorted by total wait time.
 
@@ -303,10 +319,18 @@ SRST
       sort by mean wait time
     ``-n``
       do not coalesce objects with the same call site
+    ``-f``
+      print one ``type;[object;]call-site nanoseconds`` line per entry, in
+      the folded stack format accepted by ``flamegraph.pl``
 
     When different objects that share the same call site are coalesced,
     the "Object" field shows---enclosed in brackets---the number of objects
     being coalesced.
+
+    Besides mutexes, recursive mutexes and condition variables, the profile
+    covers coroutine mutexes, read-write locks and queues, as well as the
+    block graph lock.  For these, the wait time includes the time the
+    coroutine spent yielded.
 ERST
 
     {
@@ -322,6 +346,22 @@ SRST
     Show KVM information.
 ERST
 
+#if defined(CONFIG_KVM)
+    {
+        .name       = "kvm-exits",
+        .args_type  = "",
+        .params     = "",
+        .help       = "show KVM exit statistics per vCPU",
+    },
+#endif
+
+SRST
+  ``info kvm-exits``
+    Show the KVM exits of each vCPU by exit reason and by the memory
+    region that handled them, when enabled with
+    ``-accel kvm,x-exit-stats=on``.
+ERST
+
     {
         .name       = "numa",
         .args_type  = "",
@@ -591,6 +631,20 @@ SRST
     Show roms.
 ERST
 
+    {
+        .name       = "startup-time",
+        .args_type  = "",
+        .params     = "",
+        .help       = "show time spent in each startup phase",
+        .cmd_info_hrt = qmp_x_query_startup_time,
+    },
+
+SRST
+  ``info startup-time``
+    Show the wall-clock time spent in each phase of machine creation and
+    in the realize method of each cold-plugged device.
+ERST
+
     {
         .name       = "trace-events",
         .args_type  = "name:s?,vcpu:i?",
@@ -899,7 +953,8 @@ ERST
         .name       = "stats",
         .args_type  = "target:s,names:s?,provider:s?",
         .params     = "target [names] [provider]",
-        .help       = "show statistics for the given target (vm or vcpu); optionally filter by"
+        .help       = "show statistics for the given target (vm, vcpu, cryptodev, "
+                      "block, net or virtio); optionally filter by "
                       "name (comma-separated list, or * for all) and provider",
         .cmd        = hmp_info_stats,
     },
@@ -10,6 +10,7 @@
 #define CPUINFO_LSE             (1u << 1)
 #define CPUINFO_LSE2            (1u << 2)
 #define CPUINFO_AES             (1u << 3)
+#define CPUINFO_CRC32           (1u << 4)
 
 /* Initialized with a constructor. */
 extern unsigned cpuinfo;
@@ -27,6 +27,8 @@
 #define CPUINFO_ATOMIC_VMOVDQA  (1u << 16)
 #define CPUINFO_ATOMIC_VMOVDQU  (1u << 17)
 #define CPUINFO_AES             (1u << 18)
+#define CPUINFO_SSE42           (1u << 19)
+#define CPUINFO_PCLMUL          (1u << 20)
 
 /* Initialized with a constructor. */
 extern unsigned cpuinfo;
@@ -1550,6 +1550,8 @@ static int local_parse_opts(QemuOpts *opts, FsDriverEntry *fse, Error **errp)
         return -1;
     }
 
+    fse->attr_cache_ms = qemu_opt_get_number(opts, "attr_cache", 0);
+
     if (fse->export_flags & V9FS_SM_MAPPED ||
         fse->export_flags & V9FS_SM_MAPPED_FILE) {
         fse->fmode =
@@ -27,6 +27,7 @@
 #include "qemu/iov.h"
 #include "qemu/main-loop.h"
 #include "qemu/sockets.h"
+#include "qemu/timer.h"
 #include "virtio-9p.h"
 #include "fsdev/qemu-fsdev.h"
 #include "9p-xattr.h"
@@ -4250,6 +4251,12 @@ int v9fs_device_realize_common(V9fsState *s, const V9fsTransport *t,
     s->fids = g_hash_table_new(NULL, NULL);
     qemu_co_rwlock_init(&s->rename_lock);
 
+    if (fse->attr_cache_ms) {
+        s->attr_cache = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                              g_free, g_free);
+        s->attr_cache_ns = fse->attr_cache_ms * SCALE_MS;
+    }
+
     if (s->ops->init(&s->ctx, errp) < 0) {
         error_prepend(errp, "cannot initialize fsdev '%s': ",
                       s->fsconf.fsdev_id);
@@ -4311,6 +4318,10 @@ void v9fs_device_unrealize_common(V9fsState *s)
         g_hash_table_destroy(s->fids);
         s->fids = NULL;
     }
+    if (s->attr_cache) {
+        g_hash_table_destroy(s->attr_cache);
+        s->attr_cache = NULL;
+    }
     g_free(s->tag);
     qp_table_destroy(&s->qpd_table);
     qp_table_destroy(&s->qpp_table);
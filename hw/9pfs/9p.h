@@ -363,6 +363,10 @@ struct V9fsState {
     uint64_t qp_ndevices; /* Amount of entries in qpd_table. */
     uint16_t qp_affix_next;
     uint64_t qp_fullpath_next;
+    /* lstat results keyed by path, NULL unless attr_cache is set */
+    GHashTable *attr_cache;
+    uint64_t attr_cache_gen;
+    int64_t attr_cache_ns;
 };
 
 /* 9p2000.L open flags */
@@ -20,8 +20,70 @@
 #include "fsdev/qemu-fsdev.h"
 #include "qemu/thread.h"
 #include "qemu/main-loop.h"
+#include "qemu/timer.h"
 #include "coth.h"
 
+/* Flush the whole attribute cache rather than letting it grow past this */
+#define V9FS_ATTR_CACHE_MAX 4096
+
+typedef struct V9fsAttrCacheEntry {
+    struct stat st;
+    int64_t expire;
+} V9fsAttrCacheEntry;
+
+/*
+ * Called after every operation that may change the attributes of @path, or
+ * with a NULL @path after any namespace change (create, link, unlink,
+ * rename), which can also affect parent directories and hard link aliases.
+ * Bumping the generation keeps lstat requests that are in flight in a
+ * worker thread from inserting stale results afterwards.
+ */
+void v9fs_attr_cache_invalidate(V9fsState *s, V9fsPath *path)
+{
+    if (!s->attr_cache) {
+        return;
+    }
+    s->attr_cache_gen++;
+    if (path && path->data) {
+        g_hash_table_remove(s->attr_cache, path->data);
+    } else {
+        g_hash_table_remove_all(s->attr_cache);
+    }
+}
+
+static bool v9fs_attr_cache_lookup(V9fsState *s, V9fsPath *path,
+                                   struct stat *stbuf)
+{
+    V9fsAttrCacheEntry *e;
+
+    if (!s->attr_cache || !path->data) {
+        return false;
+    }
+    e = g_hash_table_lookup(s->attr_cache, path->data);
+    if (!e) {
+        return false;
+    }
+    if (qemu_clock_get_ns(QEMU_CLOCK_REALTIME) >= e->expire) {
+        g_hash_table_remove(s->attr_cache, path->data);
+        return false;
+    }
+    *stbuf = e->st;
+    return true;
+}
+
+static void v9fs_attr_cache_insert(V9fsState *s, V9fsPath *path,
+                                   const struct stat *stbuf)
+{
+    V9fsAttrCacheEntry *e = g_new(V9fsAttrCacheEntry, 1);
+
+    if (g_hash_table_size(s->attr_cache) >= V9FS_ATTR_CACHE_MAX) {
+        g_hash_table_remove_all(s->attr_cache);
+    }
+    e->st = *stbuf;
+    e->expire = qemu_clock_get_ns(QEMU_CLOCK_REALTIME) + s->attr_cache_ns;
+    g_hash_table_replace(s->attr_cache, g_strdup(path->data), e);
+}
+
 int coroutine_fn v9fs_co_st_gen(V9fsPDU *pdu, V9fsPath *path, mode_t st_mode,
                                 V9fsStatDotl *v9stat)
 {
@@ -50,10 +112,14 @@ int coroutine_fn v9fs_co_lstat(V9fsPDU *pdu, V9fsPath *path, struct stat *stbuf)
 {
     int err;
     V9fsState *s = pdu->s;
+    uint64_t gen = s->attr_cache_gen;
 
     if (v9fs_request_cancelled(pdu)) {
         return -EINTR;
     }
+    if (v9fs_attr_cache_lookup(s, path, stbuf)) {
+        return 0;
+    }
     v9fs_path_read_lock(s);
     v9fs_co_run_in_worker(
         {
@@ -63,6 +129,9 @@ int coroutine_fn v9fs_co_lstat(V9fsPDU *pdu, V9fsPath *path, struct stat *stbuf)
             }
         });
     v9fs_path_unlock(s);
+    if (!err && s->attr_cache && path->data && gen == s->attr_cache_gen) {
+        v9fs_attr_cache_insert(s, path, stbuf);
+    }
     return err;
 }
 
@@ -118,6 +187,9 @@ int coroutine_fn v9fs_co_open(V9fsPDU *pdu, V9fsFidState *fidp, int flags)
             }
         });
     v9fs_path_unlock(s);
+    if (flags & O_TRUNC) {
+        v9fs_attr_cache_invalidate(s, &fidp->path);
+    }
     if (!err) {
         total_open_fd++;
         if (total_open_fd > open_fd_hw) {
@@ -179,6 +251,7 @@ int coroutine_fn v9fs_co_open2(V9fsPDU *pdu, V9fsFidState *fidp,
             v9fs_reclaim_fd(pdu);
         }
     }
+    v9fs_attr_cache_invalidate(s, NULL);
     return err;
 }
 
@@ -240,6 +313,7 @@ int coroutine_fn v9fs_co_link(V9fsPDU *pdu, V9fsFidState *oldfid,
             }
         });
     v9fs_path_unlock(s);
+    v9fs_attr_cache_invalidate(s, NULL);
     return err;
 }
 
@@ -260,6 +334,7 @@ int coroutine_fn v9fs_co_pwritev(V9fsPDU *pdu, V9fsFidState *fidp,
                 err = -errno;
             }
         });
+    v9fs_attr_cache_invalidate(s, &fidp->path);
     return err;
 }
 
@@ -115,6 +115,7 @@ int coroutine_fn v9fs_co_chmod(V9fsPDU *pdu, V9fsPath *path, mode_t mode)
             }
         });
     v9fs_path_unlock(s);
+    v9fs_attr_cache_invalidate(s, path);
     return err;
 }
 
@@ -136,6 +137,7 @@ int coroutine_fn v9fs_co_utimensat(V9fsPDU *pdu, V9fsPath *path,
             }
         });
     v9fs_path_unlock(s);
+    v9fs_attr_cache_invalidate(s, path);
     return err;
 }
 
@@ -161,6 +163,7 @@ int coroutine_fn v9fs_co_chown(V9fsPDU *pdu, V9fsPath *path, uid_t uid,
             }
         });
     v9fs_path_unlock(s);
+    v9fs_attr_cache_invalidate(s, path);
     return err;
 }
 
@@ -181,6 +184,7 @@ int coroutine_fn v9fs_co_truncate(V9fsPDU *pdu, V9fsPath *path, off_t size)
             }
         });
     v9fs_path_unlock(s);
+    v9fs_attr_cache_invalidate(s, path);
     return err;
 }
 
@@ -220,6 +224,7 @@ int coroutine_fn v9fs_co_mknod(V9fsPDU *pdu, V9fsFidState *fidp,
             }
         });
     v9fs_path_unlock(s);
+    v9fs_attr_cache_invalidate(s, NULL);
     return err;
 }
 
@@ -241,6 +246,7 @@ int coroutine_fn v9fs_co_remove(V9fsPDU *pdu, V9fsPath *path)
             }
         });
     v9fs_path_unlock(s);
+    v9fs_attr_cache_invalidate(s, NULL);
     return err;
 }
 
@@ -262,6 +268,7 @@ int coroutine_fn v9fs_co_unlinkat(V9fsPDU *pdu, V9fsPath *path,
             }
         });
     v9fs_path_unlock(s);
+    v9fs_attr_cache_invalidate(s, NULL);
     return err;
 }
 
@@ -282,6 +289,7 @@ int coroutine_fn v9fs_co_rename(V9fsPDU *pdu, V9fsPath *oldpath,
                 err = -errno;
             }
         });
+    v9fs_attr_cache_invalidate(s, NULL);
     return err;
 }
 
@@ -303,6 +311,7 @@ int coroutine_fn v9fs_co_renameat(V9fsPDU *pdu, V9fsPath *olddirpath,
                 err = -errno;
             }
         });
+    v9fs_attr_cache_invalidate(s, NULL);
     return err;
 }
 
@@ -342,6 +351,7 @@ int coroutine_fn v9fs_co_symlink(V9fsPDU *pdu, V9fsFidState *dfidp,
             }
         });
     v9fs_path_unlock(s);
+    v9fs_attr_cache_invalidate(s, NULL);
     return err;
 }
 
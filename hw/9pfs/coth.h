@@ -59,6 +59,7 @@
     } while (0)
 
 void co_run_in_worker_bh(void *);
+void v9fs_attr_cache_invalidate(V9fsState *s, V9fsPath *path);
 int coroutine_fn v9fs_co_readlink(V9fsPDU *, V9fsPath *, V9fsString *);
 int coroutine_fn v9fs_co_readdir(V9fsPDU *, V9fsFidState *, struct dirent **);
 int coroutine_fn v9fs_co_readdir_many(V9fsPDU *, V9fsFidState *,
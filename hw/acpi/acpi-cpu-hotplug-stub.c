@@ -42,6 +42,16 @@ void acpi_cpu_unplug_cb(CPUHotplugState *cpu_st,
     return;
 }
 
+void acpi_cpu_hotplug_batch_begin(void)
+{
+    return;
+}
+
+void acpi_cpu_hotplug_batch_end(void)
+{
+    return;
+}
+
 void acpi_cpu_unplug_request_cb(HotplugHandler *hotplug_dev,
                                 CPUHotplugState *cpu_st,
                                 DeviceState *dev, Error **errp)
@@ -247,6 +247,27 @@ static AcpiCpuStatus *get_cpu_status(CPUHotplugState *cpu_st, DeviceState *dev)
     return NULL;
 }
 
+static unsigned int cpu_hotplug_batch_depth;
+static DeviceState *cpu_hotplug_batch_event_dev;
+
+void acpi_cpu_hotplug_batch_begin(void)
+{
+    cpu_hotplug_batch_depth++;
+}
+
+void acpi_cpu_hotplug_batch_end(void)
+{
+    DeviceState *dev = cpu_hotplug_batch_event_dev;
+
+    assert(cpu_hotplug_batch_depth);
+    if (--cpu_hotplug_batch_depth || !dev) {
+        return;
+    }
+    cpu_hotplug_batch_event_dev = NULL;
+    trace_cpuhp_acpi_batch_event();
+    acpi_send_event(dev, ACPI_CPU_HOTPLUG_STATUS);
+}
+
 void acpi_cpu_plug_cb(HotplugHandler *hotplug_dev,
                       CPUHotplugState *cpu_st, DeviceState *dev, Error **errp)
 {
@@ -260,7 +281,11 @@ void acpi_cpu_plug_cb(HotplugHandler *hotplug_dev,
     cdev->cpu = CPU(dev);
     if (dev->hotplugged) {
         cdev->is_inserting = true;
-        acpi_send_event(DEVICE(hotplug_dev), ACPI_CPU_HOTPLUG_STATUS);
+        if (cpu_hotplug_batch_depth) {
+            cpu_hotplug_batch_event_dev = DEVICE(hotplug_dev);
+        } else {
+            acpi_send_event(DEVICE(hotplug_dev), ACPI_CPU_HOTPLUG_STATUS);
+        }
     }
 }
 
@@ -337,10 +362,29 @@ const VMStateDescription vmstate_cpu_hotplug = {
 #define CPU_EJECT_EVENT   "CEJ0"
 #define CPU_FW_EJECT_EVENT "CEJF"
 
-void build_cpus_aml(Aml *table, MachineState *machine, CPUHotplugFeatures opts,
-                    hwaddr io_base,
-                    const char *res_root,
-                    const char *event_handler_method)
+/*
+ * The CPU hotplug AML only depends on the possible CPUs and on the hotplug
+ * options, none of which change during the lifetime of the machine, yet
+ * it grows linearly with the number of vCPUs and is regenerated every
+ * time the tables are rebuilt for the firmware.  Generate it once and
+ * replay the bytes afterwards.
+ */
+typedef struct CPUAmlCache {
+    GArray *aml;
+    CPUHotplugFeatures opts;
+    char *smi_path;
+    hwaddr io_base;
+    char *res_root;
+    char *event_handler_method;
+    int nr_cpus;
+} CPUAmlCache;
+
+static CPUAmlCache cpus_aml_cache;
+
+static void do_build_cpus_aml(Aml *table, MachineState *machine,
+                              CPUHotplugFeatures opts, hwaddr io_base,
+                              const char *res_root,
+                              const char *event_handler_method)
 {
     Aml *ifctx;
     Aml *field;
@@ -705,3 +749,47 @@ void build_cpus_aml(Aml *table, MachineState *machine, CPUHotplugFeatures opts,
 
     g_free(cphp_res_path);
 }
+
+void build_cpus_aml(Aml *table, MachineState *machine, CPUHotplugFeatures opts,
+                    hwaddr io_base,
+                    const char *res_root,
+                    const char *event_handler_method)
+{
+    MachineClass *mc = MACHINE_GET_CLASS(machine);
+    int nr_cpus = mc->possible_cpu_arch_ids(machine)->len;
+    CPUAmlCache *cache = &cpus_aml_cache;
+    guint start = table->buf->len;
+
+    if (cache->aml &&
+        cache->nr_cpus == nr_cpus &&
+        cache->io_base == io_base &&
+        cache->opts.acpi_1_compatible == opts.acpi_1_compatible &&
+        cache->opts.has_legacy_cphp == opts.has_legacy_cphp &&
+        cache->opts.fw_unplugs_cpu == opts.fw_unplugs_cpu &&
+        !g_strcmp0(cache->smi_path, opts.smi_path) &&
+        g_str_equal(cache->res_root, res_root) &&
+        g_str_equal(cache->event_handler_method, event_handler_method)) {
+        g_array_append_vals(table->buf, cache->aml->data, cache->aml->len);
+        return;
+    }
+
+    do_build_cpus_aml(table, machine, opts, io_base, res_root,
+                      event_handler_method);
+
+    if (cache->aml) {
+        g_array_free(cache->aml, true);
+        g_free(cache->smi_path);
+        g_free(cache->res_root);
+        g_free(cache->event_handler_method);
+    }
+    cache->aml = g_array_sized_new(false, false, 1, table->buf->len - start);
+    g_array_append_vals(cache->aml, table->buf->data + start,
+                        table->buf->len - start);
+    cache->opts = opts;
+    cache->smi_path = g_strdup(opts.smi_path);
+    cache->opts.smi_path = NULL;
+    cache->io_base = io_base;
+    cache->res_root = g_strdup(res_root);
+    cache->event_handler_method = g_strdup(event_handler_method);
+    cache->nr_cpus = nr_cpus;
+}
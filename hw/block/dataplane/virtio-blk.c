@@ -41,7 +41,7 @@ struct VirtIOBlockDataPlane {
      * use it).
      */
     IOThread *iothread;
-    AioContext *ctx;
+    AioContext *ctx;    /* home AioContext of the BlockBackend */
 };
 
 /* Raise an interrupt to signal guest, if necessary */
@@ -79,18 +79,115 @@ static void notify_guest_bh(void *opaque)
     }
 }
 
+/*
+ * Fill in @vq_aio_context from @iothread_vq_mapping_list, checking that every
+ * virtqueue is assigned to exactly one IOThread.
+ *
+ * Context: QEMU global mutex held
+ */
+static bool
+apply_vq_mapping(IOThreadVirtQueueMappingList *iothread_vq_mapping_list,
+                 AioContext **vq_aio_context, uint16_t num_queues,
+                 Error **errp)
+{
+    IOThreadVirtQueueMappingList *node;
+    size_t num_iothreads = 0;
+    size_t cur_iothread = 0;
+
+    for (node = iothread_vq_mapping_list; node; node = node->next) {
+        num_iothreads++;
+    }
+
+    for (node = iothread_vq_mapping_list; node; node = node->next) {
+        const char *name = node->value->iothread;
+        IOThreadVirtQueueMappingList *other;
+        IOThread *iothread;
+        AioContext *ctx;
+
+        iothread = iothread_by_id(name);
+        if (!iothread) {
+            error_setg(errp, "IOThread \"%s\" object does not exist", name);
+            return false;
+        }
+        ctx = iothread_get_aio_context(iothread);
+
+        for (other = iothread_vq_mapping_list; other != node;
+             other = other->next) {
+            if (!strcmp(other->value->iothread, name)) {
+                error_setg(errp, "duplicate IOThread name \"%s\" in "
+                           "iothread-vq-mapping", name);
+                return false;
+            }
+        }
+
+        if (!node->value->vqs != !iothread_vq_mapping_list->value->vqs) {
+            error_setg(errp, "either all items in iothread-vq-mapping "
+                             "must have vqs or none of them must have it");
+            return false;
+        }
+
+        if (node->value->vqs) {
+            uint16List *vq;
+
+            for (vq = node->value->vqs; vq; vq = vq->next) {
+                if (vq->value >= num_queues) {
+                    error_setg(errp, "vq index %u for IOThread \"%s\" must "
+                               "be less than num_queues %u in "
+                               "iothread-vq-mapping", vq->value, name,
+                               num_queues);
+                    return false;
+                }
+
+                if (vq_aio_context[vq->value]) {
+                    error_setg(errp, "cannot assign vq %u to IOThread \"%s\" "
+                               "because it is already assigned", vq->value,
+                               name);
+                    return false;
+                }
+
+                vq_aio_context[vq->value] = ctx;
+            }
+        } else {
+            /* Round-robin assignment */
+            for (size_t i = cur_iothread; i < num_queues; i += num_iothreads) {
+                vq_aio_context[i] = ctx;
+            }
+        }
+
+        cur_iothread++;
+    }
+
+    for (uint16_t i = 0; i < num_queues; i++) {
+        if (!vq_aio_context[i]) {
+            error_setg(errp, "missing vq %u IOThread assignment in "
+                       "iothread-vq-mapping", i);
+            return false;
+        }
+    }
+
+    return true;
+}
+
 /* Context: QEMU global mutex held */
 bool virtio_blk_data_plane_create(VirtIODevice *vdev, VirtIOBlkConf *conf,
                                   VirtIOBlockDataPlane **dataplane,
                                   Error **errp)
 {
+    VirtIOBlock *vblk = VIRTIO_BLK(vdev);
     VirtIOBlockDataPlane *s;
     BusState *qbus = BUS(qdev_get_parent_bus(DEVICE(vdev)));
     VirtioBusClass *k = VIRTIO_BUS_GET_CLASS(qbus);
 
     *dataplane = NULL;
 
-    if (conf->iothread) {
+    if (conf->iothread && conf->iothread_vq_mapping_list) {
+        error_setg(errp,
+                   "iothread and iothread-vq-mapping properties cannot be set "
+                   "at the same time");
+        return false;
+    }
+
+    if (conf->iothread || conf->iothread_vq_mapping_list) {
         if (!k->set_guest_notifiers || !k->ioeventfd_assign) {
             error_setg(errp,
                        "device is incompatible with iothread "
@@ -118,13 +215,37 @@ bool virtio_blk_data_plane_create(VirtIODevice *vdev, VirtIOBlkConf *conf,
     s = g_new0(VirtIOBlockDataPlane, 1);
     s->vdev = vdev;
     s->conf = conf;
+    vblk->vq_aio_context = g_new0(AioContext *, conf->num_queues);
+
+    if (conf->iothread_vq_mapping_list) {
+        IOThreadVirtQueueMappingList *node;
+
+        if (!apply_vq_mapping(conf->iothread_vq_mapping_list,
+                              vblk->vq_aio_context, conf->num_queues, errp)) {
+            g_free(vblk->vq_aio_context);
+            vblk->vq_aio_context = NULL;
+            g_free(s);
+            return false;
+        }
+
+        for (node = conf->iothread_vq_mapping_list; node; node = node->next) {
+            object_ref(OBJECT(iothread_by_id(node->value->iothread)));
+        }
 
-    if (conf->iothread) {
-        s->iothread = conf->iothread;
-        object_ref(OBJECT(s->iothread));
-        s->ctx = iothread_get_aio_context(s->iothread);
+        /* The BlockBackend lives in the first virtqueue's AioContext */
+        s->ctx = vblk->vq_aio_context[0];
     } else {
-        s->ctx = qemu_get_aio_context();
+        if (conf->iothread) {
+            s->iothread = conf->iothread;
+            object_ref(OBJECT(s->iothread));
+            s->ctx = iothread_get_aio_context(s->iothread);
+        } else {
+            s->ctx = qemu_get_aio_context();
+        }
+
+        for (unsigned i = 0; i < conf->num_queues; i++) {
+            vblk->vq_aio_context[i] = s->ctx;
+        }
     }
     s->bh = aio_bh_new_guarded(s->ctx, notify_guest_bh, s,
                                &DEVICE(vdev)->mem_reentrancy_guard);
@@ -146,6 +267,18 @@ void virtio_blk_data_plane_destroy(VirtIOBlockDataPlane *s)
 
     vblk = VIRTIO_BLK(s->vdev);
     assert(!vblk->dataplane_started);
+
+    if (s->conf->iothread_vq_mapping_list) {
+        IOThreadVirtQueueMappingList *node;
+
+        for (node = s->conf->iothread_vq_mapping_list; node;
+             node = node->next) {
+            object_unref(OBJECT(iothread_by_id(node->value->iothread)));
+        }
+    }
+
+    g_free(vblk->vq_aio_context);
+    vblk->vq_aio_context = NULL;
     g_free(s->batch_notify_vqs);
     qemu_bh_delete(s->bh);
     if (s->iothread) {
@@ -173,7 +306,12 @@ int virtio_blk_data_plane_start(VirtIODevice *vdev)
 
     s->starting = true;
 
-    if (!virtio_vdev_has_feature(vdev, VIRTIO_RING_F_EVENT_IDX)) {
+    /*
+     * The notification BH and its bitmap belong to a single AioContext, so
+     * don't batch when virtqueues are spread across several IOThreads.
+     */
+    if (!virtio_vdev_has_feature(vdev, VIRTIO_RING_F_EVENT_IDX) &&
+        !s->conf->iothread_vq_mapping_list) {
         s->batch_notifications = true;
     } else {
         s->batch_notifications = false;
@@ -251,13 +389,14 @@ int virtio_blk_data_plane_start(VirtIODevice *vdev)
 
     /* Get this show started by hooking up our callbacks */
     if (!blk_in_drain(s->conf->conf.blk)) {
-        aio_context_acquire(s->ctx);
         for (i = 0; i < nvqs; i++) {
             VirtQueue *vq = virtio_get_queue(s->vdev, i);
+            AioContext *ctx = vblk->vq_aio_context[i];
 
-            virtio_queue_aio_attach_host_notifier(vq, s->ctx);
+            aio_context_acquire(ctx);
+            virtio_queue_aio_attach_host_notifier(vq, ctx);
+            aio_context_release(ctx);
         }
-        aio_context_release(s->ctx);
     }
     return 0;
 
@@ -283,25 +422,20 @@ int virtio_blk_data_plane_start(VirtIODevice *vdev)
 
 /* Stop notifications for new requests from guest.
  *
- * Context: BH in IOThread
+ * Context: BH in the IOThread that handles the virtqueue
  */
-static void virtio_blk_data_plane_stop_bh(void *opaque)
+static void virtio_blk_data_plane_stop_vq_bh(void *opaque)
 {
-    VirtIOBlockDataPlane *s = opaque;
-    unsigned i;
-
-    for (i = 0; i < s->conf->num_queues; i++) {
-        VirtQueue *vq = virtio_get_queue(s->vdev, i);
-        EventNotifier *host_notifier = virtio_queue_get_host_notifier(vq);
+    VirtQueue *vq = opaque;
+    EventNotifier *host_notifier = virtio_queue_get_host_notifier(vq);
 
-        virtio_queue_aio_detach_host_notifier(vq, s->ctx);
+    virtio_queue_aio_detach_host_notifier(vq, qemu_get_current_aio_context());
 
-        /*
-         * Test and clear notifier after disabling event, in case poll callback
-         * didn't have time to run.
-         */
-        virtio_queue_host_notifier_read(host_notifier);
-    }
+    /*
+     * Test and clear notifier after disabling event, in case poll callback
+     * didn't have time to run.
+     */
+    virtio_queue_host_notifier_read(host_notifier);
 }
 
 /* Context: QEMU global mutex held */
@@ -328,7 +462,12 @@ void virtio_blk_data_plane_stop(VirtIODevice *vdev)
     trace_virtio_blk_data_plane_stop(s);
 
     if (!blk_in_drain(s->conf->conf.blk)) {
-        aio_wait_bh_oneshot(s->ctx, virtio_blk_data_plane_stop_bh, s);
+        for (i = 0; i < nvqs; i++) {
+            VirtQueue *vq = virtio_get_queue(s->vdev, i);
+
+            aio_wait_bh_oneshot(vblk->vq_aio_context[i],
+                                virtio_blk_data_plane_stop_vq_bh, vq);
+        }
     }
 
     /*
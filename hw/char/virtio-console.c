@@ -13,6 +13,7 @@
 #include "qemu/osdep.h"
 #include "chardev/char-fe.h"
 #include "qemu/error-report.h"
+#include "qemu/iov.h"
 #include "qemu/module.h"
 #include "trace.h"
 #include "hw/qdev-properties.h"
@@ -48,6 +49,55 @@ static gboolean chr_write_unblocked(void *do_not_use, GIOCondition cond,
     return FALSE;
 }
 
+/*
+ * Called when the backend took less than what the guest sent; returns how
+ * much was actually written.
+ */
+static ssize_t flush_short_write(VirtIOSerialPort *port, ssize_t ret)
+{
+    VirtConsole *vcon = VIRTIO_CONSOLE(port);
+    VirtIOSerialPortClass *k = VIRTIO_SERIAL_PORT_GET_CLASS(port);
+
+    /*
+     * Ideally we'd get a better error code than just -1, but
+     * that's what the chardev interface gives us right now.  If
+     * we had a finer-grained message, like -EPIPE, we could close
+     * this connection.
+     */
+    if (ret < 0)
+        ret = 0;
+
+    /* XXX we should be queuing data to send later for the
+     * console devices too rather than silently dropping
+     * console data on EAGAIN. The Linux virtio-console
+     * hvc driver though does sends with spinlocks held,
+     * so if we enable throttling that'll stall the entire
+     * guest kernel, not merely the process writing to the
+     * console.
+     *
+     * While we could queue data for later write without
+     * enabling throttling, this would result in the guest
+     * being able to trigger arbitrary memory usage in QEMU
+     * buffering data for later writes.
+     *
+     * So fixing this problem likely requires fixing the
+     * Linux virtio-console hvc driver to not hold spinlocks
+     * while writing, and instead merely block the process
+     * that's writing. QEMU would then need some way to detect
+     * if the guest had the fixed driver too, before we can
+     * use throttling on host side.
+     */
+    if (!k->is_console) {
+        virtio_serial_throttle_port(port, true);
+        if (!vcon->watch) {
+            vcon->watch = qemu_chr_fe_add_watch(&vcon->chr,
+                                                G_IO_OUT|G_IO_HUP,
+                                                chr_write_unblocked, vcon);
+        }
+    }
+    return ret;
+}
+
 /* Callback function that's called when the guest sends us data */
 static ssize_t flush_buf(VirtIOSerialPort *port,
                          const uint8_t *buf, ssize_t len)
@@ -64,45 +114,28 @@ static ssize_t flush_buf(VirtIOSerialPort *port,
     trace_virtio_console_flush_buf(port->id, len, ret);
 
     if (ret < len) {
-        VirtIOSerialPortClass *k = VIRTIO_SERIAL_PORT_GET_CLASS(port);
+        ret = flush_short_write(port, ret);
+    }
+    return ret;
+}
 
-        /*
-         * Ideally we'd get a better error code than just -1, but
-         * that's what the chardev interface gives us right now.  If
-         * we had a finer-grained message, like -EPIPE, we could close
-         * this connection.
-         */
-        if (ret < 0)
-            ret = 0;
-
-        /* XXX we should be queuing data to send later for the
-         * console devices too rather than silently dropping
-         * console data on EAGAIN. The Linux virtio-console
-         * hvc driver though does sends with spinlocks held,
-         * so if we enable throttling that'll stall the entire
-         * guest kernel, not merely the process writing to the
-         * console.
-         *
-         * While we could queue data for later write without
-         * enabling throttling, this would result in the guest
-         * being able to trigger arbitrary memory usage in QEMU
-         * buffering data for later writes.
-         *
-         * So fixing this problem likely requires fixing the
-         * Linux virtio-console hvc driver to not hold spinlocks
-         * while writing, and instead merely block the process
-         * that's writing. QEMU would then need some way to detect
-         * if the guest had the fixed driver too, before we can
-         * use throttling on host side.
-         */
-        if (!k->is_console) {
-            virtio_serial_throttle_port(port, true);
-            if (!vcon->watch) {
-                vcon->watch = qemu_chr_fe_add_watch(&vcon->chr,
-                                                    G_IO_OUT|G_IO_HUP,
-                                                    chr_write_unblocked, vcon);
-            }
-        }
+/* Same as flush_buf, for the data of several virtqueue elements at once */
+static ssize_t flush_iov(VirtIOSerialPort *port,
+                         const struct iovec *iov, int iovcnt)
+{
+    VirtConsole *vcon = VIRTIO_CONSOLE(port);
+    size_t len = iov_size(iov, iovcnt);
+    ssize_t ret;
+
+    if (!qemu_chr_fe_backend_connected(&vcon->chr)) {
+        return len;
+    }
+
+    ret = qemu_chr_fe_writev(&vcon->chr, iov, iovcnt);
+    trace_virtio_console_flush_buf(port->id, len, ret);
+
+    if (ret < 0 || ret < len) {
+        ret = flush_short_write(port, ret);
     }
     return ret;
 }
@@ -287,6 +320,7 @@ static void virtserialport_class_init(ObjectClass *klass, void *data)
     k->realize = virtconsole_realize;
     k->unrealize = virtconsole_unrealize;
     k->have_data = flush_buf;
+    k->have_data_iov = flush_iov;
     k->set_guest_connected = set_guest_connected;
     k->enable_backend = virtconsole_enable_backend;
     k->guest_writable = guest_writable;
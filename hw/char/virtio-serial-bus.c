@@ -157,6 +157,125 @@ static void discard_throttle_data(VirtIOSerialPort *port)
     }
 }
 
+/* Advance the position in @elem by @len bytes */
+static void elem_advance(VirtQueueElement *elem, uint32_t *iov_idx,
+                         uint64_t *iov_offset, size_t len)
+{
+    while (len) {
+        size_t left = elem->out_sg[*iov_idx].iov_len - *iov_offset;
+
+        if (len < left) {
+            *iov_offset += len;
+            return;
+        }
+        len -= left;
+        (*iov_idx)++;
+        *iov_offset = 0;
+    }
+}
+
+/*
+ * Hand the data of up to VIRTQUEUE_POP_BATCH_SIZE elements to the port at
+ * once.  Elements that were consumed entirely are completed together; the
+ * one the port stopped in is kept in port->elem, and those after it are
+ * put back in the virtqueue.
+ */
+static void do_flush_queued_data_iov(VirtIOSerialPort *port, VirtQueue *vq,
+                                     VirtIODevice *vdev)
+{
+    VirtIOSerialPortClass *vsc = VIRTIO_SERIAL_PORT_GET_CLASS(port);
+    VirtQueueElement *elems[VIRTQUEUE_POP_BATCH_SIZE];
+    struct iovec iov[VIRTQUEUE_MAX_SIZE];
+
+    while (!port->throttled) {
+        uint32_t iov_idx = 0;
+        uint64_t iov_offset = 0;
+        unsigned int num = 0, done, i;
+        int niov = 0;
+        size_t total = 0;
+        ssize_t ret;
+
+        /* Resume the element we left off mid-way first */
+        if (port->elem) {
+            elems[num++] = port->elem;
+            iov_idx = port->iov_idx;
+            iov_offset = port->iov_offset;
+            port->elem = NULL;
+        }
+        num += virtqueue_pop_batch(vq, sizeof(VirtQueueElement),
+                                   (void **)elems + num,
+                                   VIRTQUEUE_POP_BATCH_SIZE - num);
+        if (!num) {
+            break;
+        }
+
+        for (i = 0; i < num; i++) {
+            VirtQueueElement *elem = elems[i];
+            unsigned int first = i ? 0 : iov_idx;
+            unsigned int j;
+
+            if (niov + elem->out_num - first > ARRAY_SIZE(iov)) {
+                virtqueue_unpop_batch(vq, (void **)elems + i, num - i);
+                num = i;
+                break;
+            }
+            for (j = first; j < elem->out_num; j++) {
+                size_t skip = i == 0 && j == first ? iov_offset : 0;
+
+                iov[niov].iov_base = elem->out_sg[j].iov_base + skip;
+                iov[niov].iov_len = elem->out_sg[j].iov_len - skip;
+                total += iov[niov++].iov_len;
+            }
+        }
+
+        ret = niov ? vsc->have_data_iov(port, iov, niov) : 0;
+        if (ret < 0) {
+            ret = 0;
+        }
+        if (!port->host_connected || !port->throttled) {
+            /*
+             * Everything was consumed, or dropped by a port that does not
+             * throttle, or the port got disconnected.
+             */
+            ret = total;
+        }
+
+        /* Complete the elements that were consumed entirely */
+        for (done = 0; done < num; done++) {
+            VirtQueueElement *elem = elems[done];
+            size_t left = iov_size(elem->out_sg, elem->out_num);
+
+            if (done == 0) {
+                left -= iov_size(elem->out_sg, iov_idx) + iov_offset;
+            }
+            if (ret < left) {
+                break;
+            }
+            ret -= left;
+            virtqueue_fill(vq, elem, 0, done);
+        }
+        virtqueue_flush(vq, done);
+        for (i = 0; i < done; i++) {
+            g_free(elems[i]);
+        }
+
+        if (done < num) {
+            /* The port is throttled; keep the partially consumed element */
+            if (done) {
+                iov_idx = 0;
+                iov_offset = 0;
+            }
+            elem_advance(elems[done], &iov_idx, &iov_offset, ret);
+            port->elem = elems[done];
+            port->iov_idx = iov_idx;
+            port->iov_offset = iov_offset;
+            virtqueue_unpop_batch(vq, (void **)elems + done + 1,
+                                  num - done - 1);
+        }
+    }
+    virtio_notify(vdev, vq);
+}
+
 static void do_flush_queued_data(VirtIOSerialPort *port, VirtQueue *vq,
                                  VirtIODevice *vdev)
 {
@@ -166,6 +285,10 @@ static void do_flush_queued_data(VirtIOSerialPort *port, VirtQueue *vq,
     assert(virtio_queue_ready(vq));
 
     vsc = VIRTIO_SERIAL_PORT_GET_CLASS(port);
+    if (vsc->have_data_iov) {
+        do_flush_queued_data_iov(port, vq, vdev);
+        return;
+    }
 
     while (!port->throttled) {
         unsigned int i;
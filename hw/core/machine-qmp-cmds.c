@@ -8,18 +8,25 @@
  */
 
 #include "qemu/osdep.h"
+#include "hw/acpi/cpu.h"
 #include "hw/acpi/vmgenid.h"
 #include "hw/boards.h"
 #include "hw/intc/intc.h"
 #include "hw/mem/memory-device.h"
 #include "hw/rdma/rdma.h"
+#include "monitor/qdev.h"
+#include "qapi/clone-visitor.h"
 #include "qapi/error.h"
 #include "qapi/qapi-builtin-visit.h"
 #include "qapi/qapi-commands-machine.h"
+#include "qapi/qapi-visit-machine.h"
+#include "qapi/qmp/qdict.h"
 #include "qapi/qmp/qobject.h"
 #include "qapi/qobject-input-visitor.h"
+#include "qapi/qobject-output-visitor.h"
 #include "qapi/type-helpers.h"
 #include "qemu/main-loop.h"
+#include "qemu/rcu.h"
 #include "qemu/uuid.h"
 #include "qom/qom-qobject.h"
 #include "sysemu/hostmem.h"
@@ -136,6 +143,54 @@ HotpluggableCPUList *qmp_query_hotpluggable_cpus(Error **errp)
     return machine_query_hotpluggable_cpus(ms);
 }
 
+static QDict *hotplug_cpu_opts(const char *driver, HotplugCpu *cpu)
+{
+    CpuInstanceProperties *props = cpu->props;
+    Visitor *v;
+    QObject *obj;
+    QDict *opts;
+
+    v = qobject_output_visitor_new(&obj);
+    visit_type_CpuInstanceProperties(v, NULL, &props, &error_abort);
+    visit_complete(v, &obj);
+    visit_free(v);
+
+    opts = qobject_to(QDict, obj);
+    qdict_put_str(opts, "driver", driver);
+    qdict_put_str(opts, "id", cpu->id);
+    return opts;
+}
+
+void qmp_hotplug_cpus(const char *driver, HotplugCpuList *cpus, Error **errp)
+{
+    MachineState *ms = MACHINE(qdev_get_machine());
+    MachineClass *mc = MACHINE_GET_CLASS(ms);
+    HotplugCpuList *l;
+
+    if (!mc->has_hotpluggable_cpus) {
+        error_setg(errp, "machine does not support hot-plugging CPUs");
+        return;
+    }
+
+    /* Let the guest rescan its CPUs once rather than after each of them */
+    acpi_cpu_hotplug_batch_begin();
+    for (l = cpus; l; l = l->next) {
+        QDict *opts = hotplug_cpu_opts(driver, l->value);
+        DeviceState *dev;
+
+        dev = qdev_device_add_from_qdict(opts, true, errp);
+        qobject_unref(opts);
+        if (!dev) {
+            break;
+        }
+        object_unref(OBJECT(dev));
+    }
+    acpi_cpu_hotplug_batch_end();
+
+    /* As in qmp_device_add(), complete the removal of a failed device */
+    drain_call_rcu();
+}
+
 void qmp_set_numa_node(NumaOptions *cmd, Error **errp)
 {
     if (phase_check(PHASE_MACHINE_INITIALIZED)) {
@@ -179,6 +234,7 @@ static int query_memdev(Object *obj, void *opaque)
         visit_type_uint16List(v, NULL, &m->host_nodes, &error_abort);
         visit_free(v);
         qobject_unref(host_nodes);
+        m->layout = QAPI_CLONE(MemdevRegionList, MEMORY_BACKEND(obj)->layout);
 
         QAPI_LIST_PREPEND(*list, m);
     }
@@ -42,6 +42,7 @@
 #include "qemu/option.h"
 #include "qemu/config-file.h"
 #include "qemu/cutils.h"
+#include "qemu/thread-context.h"
 
 QemuOptsList qemu_numa_opts = {
     .name = "numa",
@@ -164,6 +165,19 @@ static void parse_numa_node(MachineState *ms, NumaNodeOptions *node,
         numa_info[nodenr].node_mem = object_property_get_uint(o, "size", NULL);
         numa_info[nodenr].node_memdev = MEMORY_BACKEND(o);
     }
+    if (node->vcpu_context) {
+        Object *o;
+        o = object_resolve_path_type(node->vcpu_context, TYPE_THREAD_CONTEXT,
+                                     NULL);
+        if (!o) {
+            error_setg(errp, "vcpu-context=%s is not a thread-context",
+                       node->vcpu_context);
+            return;
+        }
+
+        object_ref(o);
+        numa_info[nodenr].vcpu_context = THREAD_CONTEXT(o);
+    }
 
     numa_info[nodenr].present = true;
     max_numa_nodeid = MAX(max_numa_nodeid, nodenr + 1);
@@ -896,3 +910,37 @@ void ram_block_notify_resize(void *host, size_t old_size, size_t new_size)
         }
     }
 }
+
+/*
+ * Give the thread of @cpu the CPU affinity of the vcpu-context of its NUMA
+ * node, if there is one.  Threads of accelerators running all vCPUs on
+ * one thread simply end up with the affinity of the last vCPU.
+ */
+void numa_cpu_thread_place(MachineState *ms, CPUState *cpu)
+{
+    MachineClass *mc = MACHINE_GET_CLASS(ms);
+    g_autofree unsigned long *host_cpus = NULL;
+    CpuInstanceProperties props;
+    ThreadContext *tc;
+    unsigned long nbits;
+
+    if (!ms->numa_state || !ms->numa_state->num_nodes ||
+        !mc->cpu_index_to_instance_props || !cpu->thread) {
+        return;
+    }
+
+    props = mc->cpu_index_to_instance_props(ms, cpu->cpu_index);
+    if (!props.has_node_id || props.node_id >= MAX_NODES) {
+        return;
+    }
+    tc = ms->numa_state->nodes[props.node_id].vcpu_context;
+    if (!tc) {
+        return;
+    }
+
+    if (qemu_thread_get_affinity(&tc->thread, &host_cpus, &nbits) ||
+        qemu_thread_set_affinity(cpu->thread, host_cpus, nbits)) {
+        warn_report("Could not place the thread of CPU %d on the host CPUs "
+                    "of NUMA node %" PRId64, cpu->cpu_index, props.node_id);
+    }
+}
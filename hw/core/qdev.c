@@ -33,12 +33,14 @@
 #include "qapi/visitor.h"
 #include "qemu/error-report.h"
 #include "qemu/option.h"
+#include "qemu/timer.h"
 #include "hw/irq.h"
 #include "hw/qdev-properties.h"
 #include "hw/boards.h"
 #include "hw/sysbus.h"
 #include "hw/qdev-clock.h"
 #include "migration/vmstate.h"
+#include "sysemu/startup-time.h"
 #include "trace.h"
 
 static bool qdev_hot_added = false;
@@ -437,6 +439,20 @@ void qdev_del_unplug_blocker(DeviceState *dev, Error *reason)
     dev->unplug_blockers = g_slist_remove(dev->unplug_blockers, reason);
 }
 
+void qdev_lock(DeviceState *dev)
+{
+    assert(DEVICE_GET_CLASS(dev)->has_lock);
+    qemu_mutex_lock(&dev->lock);
+    qatomic_set(&dev->lock_owner, qemu_get_thread_id());
+}
+
+void qdev_unlock(DeviceState *dev)
+{
+    qdev_assert_locked(dev);
+    qatomic_set(&dev->lock_owner, 0);
+    qemu_mutex_unlock(&dev->lock);
+}
+
 bool qdev_unplug_blocked(DeviceState *dev, Error **errp)
 {
     if (dev->unplug_blockers) {
@@ -507,10 +523,13 @@ static void device_set_realized(Object *obj, bool value, Error **errp)
         }
 
         if (dc->realize) {
+            int64_t start = get_clock();
+
             dc->realize(dev, &local_err);
             if (local_err != NULL) {
                 goto fail;
             }
+            startup_time_device(dev, get_clock() - start);
         }
 
         DEVICE_LISTENER_CALL(realize, Forward, dev);
@@ -664,6 +683,10 @@ static void device_initfn(Object *obj)
 
     QLIST_INIT(&dev->gpios);
     QLIST_INIT(&dev->clocks);
+
+    if (DEVICE_GET_CLASS(dev)->has_lock) {
+        qemu_mutex_init(&dev->lock);
+    }
 }
 
 static void device_post_init(Object *obj)
@@ -706,6 +729,10 @@ static void device_finalize(Object *obj)
         dev->canonical_path = NULL;
     }
 
+    if (DEVICE_GET_CLASS(dev)->has_lock) {
+        qemu_mutex_destroy(&dev->lock);
+    }
+
     qobject_unref(dev->opts);
     g_free(dev->id);
 }
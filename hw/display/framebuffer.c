@@ -18,9 +18,107 @@
  */
 
 #include "qemu/osdep.h"
+#include "qemu/atomic.h"
+#include "qemu/thread.h"
 #include "ui/console.h"
 #include "framebuffer.h"
 
+/*
+ * Large redraws are split in chunks of rows that are converted by a small
+ * pool of helper threads, with the calling thread taking its share.  The
+ * draw functions only read device state, which cannot change while the
+ * caller holds the BQL and waits for the helpers.
+ */
+#define FB_MAX_WORKERS      8
+#define FB_PARALLEL_ROWS    128     /* minimum dirty rows to go parallel */
+#define FB_CHUNK_ROWS       16
+
+typedef struct FramebufferJob {
+    drawfn fn;
+    void *opaque;
+    int cols;
+    int dest_col_pitch;
+    int src_width;
+    int dest_row_pitch;
+    uint8_t *src;                   /* row 0 */
+    uint8_t *dest;                  /* row 0 */
+    const int *rows;                /* dirty row numbers */
+    int n_rows;
+    int next;                       /* next index in @rows, atomic */
+} FramebufferJob;
+
+static int fb_n_workers = -1;
+static FramebufferJob *fb_job;
+static QemuSemaphore fb_start_sem;
+static QemuSemaphore fb_done_sem;
+
+static void framebuffer_run_job(FramebufferJob *job)
+{
+    int i, end, row;
+
+    for (;;) {
+        i = qatomic_fetch_add(&job->next, FB_CHUNK_ROWS);
+        if (i >= job->n_rows) {
+            break;
+        }
+        end = MIN(i + FB_CHUNK_ROWS, job->n_rows);
+        for (; i < end; i++) {
+            row = job->rows[i];
+            job->fn(job->opaque,
+                    job->dest + (ptrdiff_t)row * job->dest_row_pitch,
+                    job->src + (ptrdiff_t)row * job->src_width,
+                    job->cols, job->dest_col_pitch);
+        }
+    }
+}
+
+static void *framebuffer_worker(void *opaque)
+{
+    for (;;) {
+        qemu_sem_wait(&fb_start_sem);
+        framebuffer_run_job(qatomic_load_acquire(&fb_job));
+        qemu_sem_post(&fb_done_sem);
+    }
+    return NULL;
+}
+
+static int framebuffer_workers(void)
+{
+    QemuThread thread;
+    int i;
+
+    if (fb_n_workers < 0) {
+        fb_n_workers = MIN(g_get_num_processors() - 1, FB_MAX_WORKERS);
+        fb_n_workers = MAX(fb_n_workers, 0);
+        qemu_sem_init(&fb_start_sem, 0);
+        qemu_sem_init(&fb_done_sem, 0);
+        for (i = 0; i < fb_n_workers; i++) {
+            qemu_thread_create(&thread, "fb-worker", framebuffer_worker,
+                               NULL, QEMU_THREAD_DETACHED);
+        }
+    }
+    return fb_n_workers;
+}
+
+static void framebuffer_draw_rows(FramebufferJob *job)
+{
+    int n = 0;
+    int i;
+
+    if (job->n_rows >= FB_PARALLEL_ROWS) {
+        n = MIN(framebuffer_workers(), job->n_rows / FB_CHUNK_ROWS - 1);
+    }
+
+    qatomic_store_release(&fb_job, job);
+    for (i = 0; i < n; i++) {
+        qemu_sem_post(&fb_start_sem);
+    }
+    framebuffer_run_job(job);
+    for (i = 0; i < n; i++) {
+        qemu_sem_wait(&fb_done_sem);
+    }
+}
+
 void framebuffer_update_memory_section(
     MemoryRegionSection *mem_section,
     MemoryRegion *root,
@@ -67,6 +165,8 @@ void framebuffer_update_display(
     int *last_row /* Output only */)
 {
     DirtyBitmapSnapshot *snap;
+    FramebufferJob job;
+    g_autofree int *dirty_rows = NULL;
     uint8_t *dest;
     uint8_t *src;
     int first, last = 0;
@@ -95,28 +195,40 @@ void framebuffer_update_display(
     }
     first = -1;
 
+    job = (FramebufferJob) {
+        .fn = fn,
+        .opaque = opaque,
+        .cols = cols,
+        .dest_col_pitch = dest_col_pitch,
+        .src_width = src_width,
+        .dest_row_pitch = dest_row_pitch,
+        .src = src,
+        .dest = dest,
+    };
+    dirty_rows = g_new(int, rows);
+
     addr += i * src_width;
-    src += i * src_width;
-    dest += i * dest_row_pitch;
 
     snap = memory_region_snapshot_and_clear_dirty(mem, addr, src_width * rows,
                                                   DIRTY_MEMORY_VGA);
     for (; i < rows; i++) {
         dirty = memory_region_snapshot_get_dirty(mem, snap, addr, src_width);
         if (dirty || invalidate) {
-            fn(opaque, dest, src, cols, dest_col_pitch);
+            dirty_rows[job.n_rows++] = i;
             if (first == -1)
                 first = i;
             last = i;
         }
         addr += src_width;
-        src += src_width;
-        dest += dest_row_pitch;
     }
     g_free(snap);
     if (first < 0) {
         return;
     }
+
+    job.rows = dirty_rows;
+    framebuffer_draw_rows(&job);
+
     *first_row = first;
     *last_row = last;
 }
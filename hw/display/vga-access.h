@@ -41,6 +41,23 @@ static inline uint16_t vga_read_word_be(VGACommonState *vga, uint32_t addr)
     return lduw_be_p(ptr);
 }
 
+/*
+ * Return a pointer to @len bytes of VRAM starting at @addr, or NULL if
+ * the range is not @align aligned or wraps around the VBE window.  Line
+ * renderers use it to read whole scanlines without masking each access.
+ */
+static inline const uint8_t *vga_line_ptr(VGACommonState *vga, uint32_t addr,
+                                          uint32_t len, uint32_t align)
+{
+    uint32_t offset = addr & vga->vbe_size_mask;
+
+    if ((offset & (align - 1)) ||
+        (uint64_t)offset + len > (uint64_t)vga->vbe_size_mask + 1) {
+        return NULL;
+    }
+    return vga->vram_ptr + offset;
+}
+
 static inline uint32_t vga_read_dword_le(VGACommonState *vga, uint32_t addr)
 {
     uint32_t offset = addr & vga->vbe_size_mask & ~3;
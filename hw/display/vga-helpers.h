@@ -259,10 +259,19 @@ static void vga_draw_line8d2(VGACommonState *vga, uint8_t *d,
 static void vga_draw_line8(VGACommonState *vga, uint8_t *d,
                            uint32_t addr, int width)
 {
+    const uint8_t *s;
     uint32_t *palette;
     int x;
 
     palette = vga->last_palette;
+    width &= ~7;
+    s = vga_line_ptr(vga, addr, width, 1);
+    if (s) {
+        for (x = 0; x < width; x++) {
+            ((uint32_t *)d)[x] = palette[s[x]];
+        }
+        return;
+    }
     width >>= 3;
     for(x = 0; x < width; x++) {
         ((uint32_t *)d)[0] = palette[vga_read_byte(vga, addr + 0)];
@@ -284,9 +293,21 @@ static void vga_draw_line8(VGACommonState *vga, uint8_t *d,
 static void vga_draw_line15_le(VGACommonState *vga, uint8_t *d,
                                uint32_t addr, int width)
 {
-    int w;
+    const uint8_t *s = vga_line_ptr(vga, addr, width * 2, 2);
+    int w, x;
     uint32_t v, r, g, b;
 
+    if (s) {
+        for (x = 0; x < width; x++) {
+            v = lduw_le_p(s + x * 2);
+            r = (v >> 7) & 0xf8;
+            g = (v >> 2) & 0xf8;
+            b = (v << 3) & 0xf8;
+            ((uint32_t *)d)[x] = rgb_to_pixel32(r, g, b);
+        }
+        return;
+    }
+
     w = width;
     do {
         v = vga_read_word_le(vga, addr);
@@ -302,9 +323,21 @@ static void vga_draw_line15_le(VGACommonState *vga, uint8_t *d,
 static void vga_draw_line15_be(VGACommonState *vga, uint8_t *d,
                                uint32_t addr, int width)
 {
-    int w;
+    const uint8_t *s = vga_line_ptr(vga, addr, width * 2, 2);
+    int w, x;
     uint32_t v, r, g, b;
 
+    if (s) {
+        for (x = 0; x < width; x++) {
+            v = lduw_be_p(s + x * 2);
+            r = (v >> 7) & 0xf8;
+            g = (v >> 2) & 0xf8;
+            b = (v << 3) & 0xf8;
+            ((uint32_t *)d)[x] = rgb_to_pixel32(r, g, b);
+        }
+        return;
+    }
+
     w = width;
     do {
         v = vga_read_word_be(vga, addr);
@@ -323,9 +356,21 @@ static void vga_draw_line15_be(VGACommonState *vga, uint8_t *d,
 static void vga_draw_line16_le(VGACommonState *vga, uint8_t *d,
                                uint32_t addr, int width)
 {
-    int w;
+    const uint8_t *s = vga_line_ptr(vga, addr, width * 2, 2);
+    int w, x;
     uint32_t v, r, g, b;
 
+    if (s) {
+        for (x = 0; x < width; x++) {
+            v = lduw_le_p(s + x * 2);
+            r = (v >> 8) & 0xf8;
+            g = (v >> 3) & 0xfc;
+            b = (v << 3) & 0xf8;
+            ((uint32_t *)d)[x] = rgb_to_pixel32(r, g, b);
+        }
+        return;
+    }
+
     w = width;
     do {
         v = vga_read_word_le(vga, addr);
@@ -341,9 +386,21 @@ static void vga_draw_line16_le(VGACommonState *vga, uint8_t *d,
 static void vga_draw_line16_be(VGACommonState *vga, uint8_t *d,
                                uint32_t addr, int width)
 {
-    int w;
+    const uint8_t *s = vga_line_ptr(vga, addr, width * 2, 2);
+    int w, x;
     uint32_t v, r, g, b;
 
+    if (s) {
+        for (x = 0; x < width; x++) {
+            v = lduw_be_p(s + x * 2);
+            r = (v >> 8) & 0xf8;
+            g = (v >> 3) & 0xfc;
+            b = (v << 3) & 0xf8;
+            ((uint32_t *)d)[x] = rgb_to_pixel32(r, g, b);
+        }
+        return;
+    }
+
     w = width;
     do {
         v = vga_read_word_be(vga, addr);
@@ -362,9 +419,20 @@ static void vga_draw_line16_be(VGACommonState *vga, uint8_t *d,
 static void vga_draw_line24_le(VGACommonState *vga, uint8_t *d,
                                uint32_t addr, int width)
 {
-    int w;
+    const uint8_t *s = vga_line_ptr(vga, addr, width * 3, 1);
+    int w, x;
     uint32_t r, g, b;
 
+    if (s) {
+        for (x = 0; x < width; x++) {
+            b = s[x * 3 + 0];
+            g = s[x * 3 + 1];
+            r = s[x * 3 + 2];
+            ((uint32_t *)d)[x] = rgb_to_pixel32(r, g, b);
+        }
+        return;
+    }
+
     w = width;
     do {
         b = vga_read_byte(vga, addr + 0);
@@ -379,9 +447,20 @@ static void vga_draw_line24_le(VGACommonState *vga, uint8_t *d,
 static void vga_draw_line24_be(VGACommonState *vga, uint8_t *d,
                                uint32_t addr, int width)
 {
-    int w;
+    const uint8_t *s = vga_line_ptr(vga, addr, width * 3, 1);
+    int w, x;
     uint32_t r, g, b;
 
+    if (s) {
+        for (x = 0; x < width; x++) {
+            r = s[x * 3 + 0];
+            g = s[x * 3 + 1];
+            b = s[x * 3 + 2];
+            ((uint32_t *)d)[x] = rgb_to_pixel32(r, g, b);
+        }
+        return;
+    }
+
     w = width;
     do {
         r = vga_read_byte(vga, addr + 0);
@@ -399,9 +478,17 @@ static void vga_draw_line24_be(VGACommonState *vga, uint8_t *d,
 static void vga_draw_line32_le(VGACommonState *vga, uint8_t *d,
                                uint32_t addr, int width)
 {
-    int w;
+    const uint8_t *s = vga_line_ptr(vga, addr, width * 4, 1);
+    int w, x;
     uint32_t r, g, b;
 
+    if (s) {
+        for (x = 0; x < width; x++) {
+            ((uint32_t *)d)[x] = ldl_le_p(s + x * 4) & 0x00ffffff;
+        }
+        return;
+    }
+
     w = width;
     do {
         b = vga_read_byte(vga, addr + 0);
@@ -416,9 +503,17 @@ static void vga_draw_line32_le(VGACommonState *vga, uint8_t *d,
 static void vga_draw_line32_be(VGACommonState *vga, uint8_t *d,
                                uint32_t addr, int width)
 {
-    int w;
+    const uint8_t *s = vga_line_ptr(vga, addr, width * 4, 1);
+    int w, x;
     uint32_t r, g, b;
 
+    if (s) {
+        for (x = 0; x < width; x++) {
+            ((uint32_t *)d)[x] = ldl_be_p(s + x * 4) & 0x00ffffff;
+        }
+        return;
+    }
+
     w = width;
     do {
         r = vga_read_byte(vga, addr + 1);
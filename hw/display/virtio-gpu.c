@@ -418,6 +418,7 @@ static void virtio_gpu_resource_destroy(VirtIOGPU *g,
     }
 
     qemu_pixman_image_unref(res->image);
+    res->image = NULL;
     virtio_gpu_cleanup_mapping(g, res);
     QTAILQ_REMOVE(&g->reslist, res, next);
     g->hostmem -= res->hostmem;
@@ -673,9 +674,10 @@ static void virtio_gpu_do_set_scanout(VirtIOGPU *g,
     }
 
     /* create a surface for this scanout */
-    if ((res->blob && !console_has_gl(scanout->con)) ||
-        !scanout->ds ||
+    if (!scanout->ds ||
         surface_data(scanout->ds) != data + fb->offset ||
+        surface_format(scanout->ds) != fb->format ||
+        surface_stride(scanout->ds) != fb->stride ||
         scanout->width != r->width ||
         scanout->height != r->height) {
         pixman_image_t *rect;
@@ -697,6 +699,11 @@ static void virtio_gpu_do_set_scanout(VirtIOGPU *g,
         }
 #ifdef WIN32
         qemu_displaysurface_win32_set_handle(scanout->ds, res->handle, fb->offset);
+#else
+        if (res->blob && res->dmabuf_fd >= 0) {
+            qemu_displaysurface_set_share_fd(scanout->ds, res->dmabuf_fd,
+                                             fb->offset);
+        }
 #endif
 
         pixman_image_unref(rect);
@@ -904,9 +911,79 @@ void virtio_gpu_cleanup_mapping_iov(VirtIOGPU *g,
     g_free(iov);
 }
 
+/*
+ * With blob support, the backing of a 2D resource is remapped through
+ * udmabuf and the resource image points straight at guest memory: the
+ * scanout shows the guest pages and transfers become no-ops.
+ */
+static void virtio_gpu_map_2d_backing(VirtIOGPU *g,
+                                      struct virtio_gpu_simple_resource *res)
+{
+    pixman_format_code_t format = pixman_image_get_format(res->image);
+    uint32_t stride = pixman_image_get_stride(res->image);
+    pixman_image_t *image;
+
+    if (!virtio_gpu_blob_enabled(g->parent_obj.conf) ||
+        res->scanout_bitmask ||
+        iov_size(res->iov, res->iov_cnt) < (size_t)stride * res->height) {
+        return;
+    }
+
+    res->blob_size = iov_size(res->iov, res->iov_cnt);
+    virtio_gpu_init_udmabuf(res);
+    if (!res->blob || res->dmabuf_fd < 0) {
+        /* small single-page backings are not worth it */
+        res->blob = NULL;
+        res->blob_size = 0;
+        return;
+    }
+
+    image = pixman_image_create_bits(format, res->width, res->height,
+                                     (uint32_t *)res->blob, stride);
+    if (!image) {
+        virtio_gpu_fini_udmabuf(res);
+        res->blob = NULL;
+        res->blob_size = 0;
+        return;
+    }
+    pixman_image_unref(res->image);
+    res->image = image;
+}
+
+static void virtio_gpu_unmap_2d_backing(VirtIOGPU *g,
+                                        struct virtio_gpu_simple_resource *res)
+{
+    pixman_format_code_t format = pixman_image_get_format(res->image);
+    uint32_t stride = pixman_image_get_stride(res->image);
+    pixman_image_t *image;
+    int i;
+
+    /* scanout surfaces point at the mapping, which is about to go away */
+    for (i = 0; i < g->parent_obj.conf.max_outputs; i++) {
+        if (res->scanout_bitmask & (1 << i)) {
+            virtio_gpu_disable_scanout(g, i);
+        }
+    }
+
+    image = pixman_image_create_bits(format, res->width, res->height,
+                                     NULL, stride);
+    if (image) {
+        memcpy(pixman_image_get_data(image), res->blob,
+               (size_t)stride * res->height);
+    }
+    pixman_image_unref(res->image);
+    res->image = image;
+}
+
 static void virtio_gpu_cleanup_mapping(VirtIOGPU *g,
                                        struct virtio_gpu_simple_resource *res)
 {
+    bool mapped_2d = res->blob && res->image;
+
+    if (mapped_2d) {
+        virtio_gpu_unmap_2d_backing(g, res);
+    }
+
     virtio_gpu_cleanup_mapping_iov(g, res->iov, res->iov_cnt);
     res->iov = NULL;
     res->iov_cnt = 0;
@@ -916,6 +993,10 @@ static void virtio_gpu_cleanup_mapping(VirtIOGPU *g,
     if (res->blob) {
         virtio_gpu_fini_udmabuf(res);
     }
+    if (mapped_2d) {
+        res->blob = NULL;
+        res->blob_size = 0;
+    }
 }
 
 static void
@@ -949,6 +1030,8 @@ virtio_gpu_resource_attach_backing(VirtIOGPU *g,
         cmd->error = VIRTIO_GPU_RESP_ERR_UNSPEC;
         return;
     }
+
+    virtio_gpu_map_2d_backing(g, res);
 }
 
 static void
@@ -1322,6 +1405,8 @@ static int virtio_gpu_load(QEMUFile *f, void *opaque, size_t size,
             }
         }
 
+        virtio_gpu_map_2d_backing(g, res);
+
         QTAILQ_INSERT_HEAD(&g->reslist, res, next);
         g->hostmem += res->hostmem;
 
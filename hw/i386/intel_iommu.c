@@ -218,6 +218,14 @@ static gboolean vtd_iotlb_equal(gconstpointer v1, gconstpointer v2)
            key1->gfn == key2->gfn;
 }
 
+static void vtd_iotlb_entry_free(gpointer v)
+{
+    VTDIOTLBEntry *entry = v;
+
+    QTAILQ_REMOVE(&entry->iommu->iotlb_lru, entry, lru);
+    g_free(entry);
+}
+
 static guint vtd_iotlb_hash(gconstpointer v)
 {
     const struct vtd_iotlb_key *key = v;
@@ -342,6 +350,8 @@ static VTDIOTLBEntry *vtd_lookup_iotlb(IntelIOMMUState *s, uint16_t source_id,
         key.pasid = pasid;
         entry = g_hash_table_lookup(s->iotlb, &key);
         if (entry) {
+            QTAILQ_REMOVE(&s->iotlb_lru, entry, lru);
+            QTAILQ_INSERT_HEAD(&s->iotlb_lru, entry, lru);
             goto out;
         }
     }
@@ -362,8 +372,10 @@ static void vtd_update_iotlb(IntelIOMMUState *s, uint16_t source_id,
 
     trace_vtd_iotlb_page_update(source_id, addr, slpte, domain_id);
     if (g_hash_table_size(s->iotlb) >= VTD_IOTLB_MAX_SIZE) {
-        trace_vtd_iotlb_reset("iotlb exceeds size limit");
-        vtd_reset_iotlb_locked(s);
+        VTDIOTLBEntry *last = QTAILQ_LAST(&s->iotlb_lru);
+
+        trace_vtd_iotlb_evict(last->key->sid, last->gfn, last->domain_id);
+        g_hash_table_remove(s->iotlb, last->key);
     }
 
     entry->gfn = gfn;
@@ -372,13 +384,17 @@ static void vtd_update_iotlb(IntelIOMMUState *s, uint16_t source_id,
     entry->access_flags = access_flags;
     entry->mask = vtd_slpt_level_page_mask(level);
     entry->pasid = pasid;
+    entry->key = key;
+    entry->iommu = s;
 
     key->gfn = gfn;
     key->sid = source_id;
     key->level = level;
     key->pasid = pasid;
 
+    /* Replacing an entry unlinks the old one from the LRU list */
     g_hash_table_replace(s->iotlb, key, entry);
+    QTAILQ_INSERT_HEAD(&s->iotlb_lru, entry, lru);
 }
 
 /* Given the reg addr of both the message data and address, generate an
@@ -1498,10 +1514,67 @@ static int vtd_dev_to_context_entry(IntelIOMMUState *s, uint8_t bus_num,
     return 0;
 }
 
+/*
+ * A page walk reports one event per page table entry, and for an assigned
+ * device each event ends up in a VFIO ioctl.  Contiguous events of the
+ * same kind are merged into a run, which is notified as few naturally
+ * aligned power-of-two ranges as possible.
+ */
+typedef struct VTDNotifyBatch {
+    IOMMUMemoryRegion *iommu;
+    uint8_t aw;
+    bool pending;
+    IOMMUTLBEvent event;        /* first event of the run */
+    hwaddr size;                /* size of the run */
+} VTDNotifyBatch;
+
+static void vtd_notify_batch_flush(VTDNotifyBatch *batch)
+{
+    IOMMUTLBEvent event = batch->event;
+    hwaddr end = event.entry.iova + batch->size - 1;
+
+    if (!batch->pending) {
+        return;
+    }
+
+    while (event.entry.iova <= end) {
+        uint64_t mask = dma_aligned_pow2_mask(event.entry.iova, end,
+                                              batch->aw);
+
+        if (event.type == IOMMU_NOTIFIER_MAP) {
+            while (event.entry.translated_addr & mask) {
+                mask >>= 1;
+            }
+        }
+        event.entry.addr_mask = mask;
+        trace_vtd_notify_batch(event.entry.iova, mask, event.type);
+        memory_region_notify_iommu(batch->iommu, 0, event);
+        event.entry.iova += mask + 1;
+        event.entry.translated_addr += mask + 1;
+    }
+    batch->pending = false;
+}
+
 static int vtd_sync_shadow_page_hook(IOMMUTLBEvent *event,
                                      void *private)
 {
-    memory_region_notify_iommu(private, 0, *event);
+    VTDNotifyBatch *batch = private;
+    IOMMUTLBEntry *run = &batch->event.entry;
+    IOMMUTLBEntry *entry = &event->entry;
+
+    if (batch->pending && batch->event.type == event->type &&
+        run->iova + batch->size == entry->iova &&
+        (event->type == IOMMU_NOTIFIER_UNMAP ||
+         (run->perm == entry->perm &&
+          run->translated_addr + batch->size == entry->translated_addr))) {
+        batch->size += entry->addr_mask + 1;
+        return 0;
+    }
+
+    vtd_notify_batch_flush(batch);
+    batch->event = *event;
+    batch->size = entry->addr_mask + 1;
+    batch->pending = true;
     return 0;
 }
 
@@ -1524,16 +1597,23 @@ static int vtd_sync_shadow_page_table_range(VTDAddressSpace *vtd_as,
                                             hwaddr addr, hwaddr size)
 {
     IntelIOMMUState *s = vtd_as->iommu_state;
+    VTDNotifyBatch batch = {
+        .iommu = &vtd_as->iommu,
+        .aw = s->aw_bits,
+    };
     vtd_page_walk_info info = {
         .hook_fn = vtd_sync_shadow_page_hook,
-        .private = (void *)&vtd_as->iommu,
+        .private = &batch,
         .notify_unmap = true,
         .aw = s->aw_bits,
         .as = vtd_as,
         .domain_id = vtd_get_domain_id(s, ce, vtd_as->pasid),
     };
+    int ret;
 
-    return vtd_page_walk(s, ce, addr, addr + size, &info, vtd_as->pasid);
+    ret = vtd_page_walk(s, ce, addr, addr + size, &info, vtd_as->pasid);
+    vtd_notify_batch_flush(&batch);
+    return ret;
 }
 
 static int vtd_address_space_sync(VTDAddressSpace *vtd_as)
@@ -4151,8 +4231,9 @@ static void vtd_realize(DeviceState *dev, Error **errp)
 
     sysbus_init_mmio(SYS_BUS_DEVICE(s), &s->csrmem);
     /* No corresponding destroy */
+    QTAILQ_INIT(&s->iotlb_lru);
     s->iotlb = g_hash_table_new_full(vtd_iotlb_hash, vtd_iotlb_equal,
-                                     g_free, g_free);
+                                     g_free, vtd_iotlb_entry_free);
     s->vtd_address_spaces = g_hash_table_new_full(vtd_as_hash, vtd_as_equal,
                                       g_free, g_free);
     vtd_init(s);
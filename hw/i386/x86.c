@@ -784,6 +784,29 @@ static bool load_elfboot(const char *kernel_filename,
     return true;
 }
 
+/*
+ * Map a file passed for direct kernel boot.  The descriptor is returned
+ * too, and stays open, so that fw_cfg can map the file straight into
+ * guest RAM when the firmware reads it by DMA.
+ */
+static GMappedFile *x86_map_boot_file(const char *filename, int *fd,
+                                      GError **errp)
+{
+    GMappedFile *mapped_file;
+
+    *fd = qemu_open_old(filename, O_RDONLY);
+    if (*fd < 0) {
+        g_set_error(errp, G_FILE_ERROR, g_file_error_from_errno(errno),
+                    "%s", g_strerror(errno));
+        return NULL;
+    }
+    mapped_file = g_mapped_file_new_from_fd(*fd, false, errp);
+    if (!mapped_file) {
+        close(*fd);
+    }
+    return mapped_file;
+}
+
 void x86_load_linux(X86MachineState *x86ms,
                     FWCfgState *fw_cfg,
                     int acpi_data_size,
@@ -805,6 +828,9 @@ void x86_load_linux(X86MachineState *x86ms,
     const char *dtb_filename = machine->dtb;
     const char *kernel_cmdline = machine->kernel_cmdline;
     SevKernelLoaderContext sev_load_ctx = {};
+    GMappedFile *mapped_kernel;
+    GError *kernel_err = NULL;
+    int kernel_fd;
 
     /* Align to 16 bytes as a paranoia measure */
     cmdline_size = (strlen(kernel_cmdline) + 16) & ~15;
@@ -865,8 +891,10 @@ void x86_load_linux(X86MachineState *x86ms,
                 gsize initrd_size;
                 gchar *initrd_data;
                 GError *gerr = NULL;
+                int initrd_fd;
 
-                mapped_file = g_mapped_file_new(initrd_filename, false, &gerr);
+                mapped_file = x86_map_boot_file(initrd_filename, &initrd_fd,
+                                                &gerr);
                 if (!mapped_file) {
                     fprintf(stderr, "qemu: error reading initrd %s: %s\n",
                             initrd_filename, gerr->message);
@@ -888,8 +916,9 @@ void x86_load_linux(X86MachineState *x86ms,
 
                 fw_cfg_add_i32(fw_cfg, FW_CFG_INITRD_ADDR, initrd_addr);
                 fw_cfg_add_i32(fw_cfg, FW_CFG_INITRD_SIZE, initrd_size);
-                fw_cfg_add_bytes(fw_cfg, FW_CFG_INITRD_DATA, initrd_data,
-                                 initrd_size);
+                fw_cfg_add_bytes_from_fd(fw_cfg, FW_CFG_INITRD_DATA,
+                                         initrd_data, initrd_size,
+                                         initrd_fd, 0);
             }
 
             option_rom[nb_option_roms].bootindex = 0;
@@ -1006,13 +1035,14 @@ void x86_load_linux(X86MachineState *x86ms,
         gsize initrd_size;
         gchar *initrd_data;
         GError *gerr = NULL;
+        int initrd_fd;
 
         if (protocol < 0x200) {
             fprintf(stderr, "qemu: linux kernel too old to load a ram disk\n");
             exit(1);
         }
 
-        mapped_file = g_mapped_file_new(initrd_filename, false, &gerr);
+        mapped_file = x86_map_boot_file(initrd_filename, &initrd_fd, &gerr);
         if (!mapped_file) {
             fprintf(stderr, "qemu: error reading initrd %s: %s\n",
                     initrd_filename, gerr->message);
@@ -1033,7 +1063,8 @@ void x86_load_linux(X86MachineState *x86ms,
 
         fw_cfg_add_i32(fw_cfg, FW_CFG_INITRD_ADDR, initrd_addr);
         fw_cfg_add_i32(fw_cfg, FW_CFG_INITRD_SIZE, initrd_size);
-        fw_cfg_add_bytes(fw_cfg, FW_CFG_INITRD_DATA, initrd_data, initrd_size);
+        fw_cfg_add_bytes_from_fd(fw_cfg, FW_CFG_INITRD_DATA, initrd_data,
+                                 initrd_size, initrd_fd, 0);
         sev_load_ctx.initrd_data = initrd_data;
         sev_load_ctx.initrd_size = initrd_size;
 
@@ -1053,18 +1084,20 @@ void x86_load_linux(X86MachineState *x86ms,
     }
     kernel_size -= setup_size;
 
-    setup  = g_malloc(setup_size);
-    kernel = g_malloc(kernel_size);
-    fseek(f, 0, SEEK_SET);
-    if (fread(setup, 1, setup_size, f) != setup_size) {
-        fprintf(stderr, "fread() failed\n");
-        exit(1);
-    }
-    if (fread(kernel, 1, kernel_size, f) != kernel_size) {
-        fprintf(stderr, "fread() failed\n");
+    fclose(f);
+    mapped_kernel = x86_map_boot_file(kernel_filename, &kernel_fd, &kernel_err);
+    if (!mapped_kernel ||
+        g_mapped_file_get_length(mapped_kernel) < setup_size + kernel_size) {
+        fprintf(stderr, "qemu: could not load kernel '%s': %s\n",
+                kernel_filename,
+                kernel_err ? kernel_err->message : "file truncated");
         exit(1);
     }
-    fclose(f);
+    x86ms->kernel_mapped_file = mapped_kernel;
+
+    /* The setup code is patched below, the kernel is used in place */
+    setup = g_memdup2(g_mapped_file_get_contents(mapped_kernel), setup_size);
+    kernel = (uint8_t *)g_mapped_file_get_contents(mapped_kernel) + setup_size;
 
     /* append dtb to kernel */
     if (dtb_filename) {
@@ -1080,9 +1113,13 @@ void x86_load_linux(X86MachineState *x86ms,
             exit(1);
         }
 
+        /* Copy the kernel out of the file to append the dtb */
         setup_data_offset = QEMU_ALIGN_UP(kernel_size, 16);
+        kernel = memcpy(g_malloc0(setup_data_offset +
+                                  sizeof(struct setup_data) + dtb_size),
+                        kernel, kernel_size);
         kernel_size = setup_data_offset + sizeof(struct setup_data) + dtb_size;
-        kernel = g_realloc(kernel, kernel_size);
+        kernel_fd = -1;
 
         stq_p(header + 0x250, prot_addr + setup_data_offset);
 
@@ -1107,7 +1144,12 @@ void x86_load_linux(X86MachineState *x86ms,
 
     fw_cfg_add_i32(fw_cfg, FW_CFG_KERNEL_ADDR, prot_addr);
     fw_cfg_add_i32(fw_cfg, FW_CFG_KERNEL_SIZE, kernel_size);
-    fw_cfg_add_bytes(fw_cfg, FW_CFG_KERNEL_DATA, kernel, kernel_size);
+    if (kernel_fd >= 0) {
+        fw_cfg_add_bytes_from_fd(fw_cfg, FW_CFG_KERNEL_DATA, kernel,
+                                 kernel_size, kernel_fd, setup_size);
+    } else {
+        fw_cfg_add_bytes(fw_cfg, FW_CFG_KERNEL_DATA, kernel, kernel_size);
+    }
     sev_load_ctx.kernel_data = (char *)kernel;
     sev_load_ctx.kernel_size = kernel_size;
 
@@ -32,6 +32,7 @@
 #include "qemu/log.h"
 #include "qemu/main-loop.h"
 #include "qemu/module.h"
+#include "qemu/timer.h"
 #include "sysemu/block-backend.h"
 #include "sysemu/dma.h"
 #include "hw/ide/internal.h"
@@ -204,12 +205,22 @@ static void ahci_irq_lower(AHCIState *s)
     }
 }
 
+/* IS bit used for the CCC interrupt, 0 if CCC is not supported */
+static uint32_t ahci_ccc_irq(AHCIState *s)
+{
+    if (!(s->control_regs.cap & HOST_CAP_CCC)) {
+        return 0;
+    }
+    return 1U << extract32(s->control_regs.ccc_ctl, AHCI_CCC_CTL_INT_SHIFT, 5);
+}
+
 static void ahci_check_irq(AHCIState *s)
 {
     int i;
     uint32_t old_irq = s->control_regs.irqstatus;
 
-    s->control_regs.irqstatus = 0;
+    /* The CCC bit is cleared by the guest only */
+    s->control_regs.irqstatus &= ahci_ccc_irq(s);
     for (i = 0; i < s->ports; i++) {
         AHCIPortRegs *pr = &s->dev[i].port_regs;
         if (pr->irq_stat & pr->irq_mask) {
@@ -225,6 +236,57 @@ static void ahci_check_irq(AHCIState *s)
     }
 }
 
+static void ahci_ccc_fire(AHCIState *s)
+{
+    trace_ahci_ccc_fire(s, s->ccc_count);
+    s->ccc_count = 0;
+    timer_del(s->ccc_timer);
+    s->control_regs.irqstatus |= ahci_ccc_irq(s);
+    ahci_check_irq(s);
+}
+
+static void ahci_ccc_timer_cb(void *opaque)
+{
+    ahci_ccc_fire(opaque);
+}
+
+/*
+ * AHCI 1.3 section 11 ("Command Completion Coalescing"): count command
+ * completions on the ports in CCC_PORTS and raise the CCC interrupt after
+ * CCC_CTL.CC of them, or CCC_CTL.TV milliseconds after the first one.
+ * The per-port interrupts are still set; the guest masks them in PxIE.
+ */
+static void ahci_ccc_complete(AHCIState *s, AHCIDevice *d)
+{
+    uint32_t ctl = s->control_regs.ccc_ctl;
+    unsigned cc = extract32(ctl, AHCI_CCC_CTL_CC_SHIFT, 8);
+    unsigned tv = extract32(ctl, AHCI_CCC_CTL_TV_SHIFT, 16);
+
+    if (!(ctl & AHCI_CCC_CTL_EN) ||
+        !(s->control_regs.ccc_ports & (1U << d->port_no))) {
+        return;
+    }
+
+    s->ccc_count++;
+    if (cc && s->ccc_count >= cc) {
+        ahci_ccc_fire(s);
+    } else if (tv && !timer_pending(s->ccc_timer)) {
+        timer_mod(s->ccc_timer,
+                  qemu_clock_get_ms(QEMU_CLOCK_VIRTUAL) + tv);
+    }
+}
+
+static void ahci_ccc_reset(AHCIState *s)
+{
+    /* TV = 1 ms, CC = 1, INT = first IS bit after the ports */
+    s->control_regs.ccc_ctl = (1 << AHCI_CCC_CTL_TV_SHIFT) |
+                              (1 << AHCI_CCC_CTL_CC_SHIFT) |
+                              (s->ports << AHCI_CCC_CTL_INT_SHIFT);
+    s->control_regs.ccc_ports = 0;
+    s->ccc_count = 0;
+    timer_del(s->ccc_timer);
+}
+
 static void ahci_trigger_irq(AHCIState *s, AHCIDevice *d,
                              enum AHCIPortIRQ irqbit)
 {
@@ -238,6 +300,9 @@ static void ahci_trigger_irq(AHCIState *s, AHCIDevice *d,
                            irqstat & d->port_regs.irq_mask);
 
     d->port_regs.irq_stat = irqstat;
+    if (irqbit == AHCI_PORT_IRQ_BIT_DHRS || irqbit == AHCI_PORT_IRQ_BIT_SDBS) {
+        ahci_ccc_complete(s, d);
+    }
     ahci_check_irq(s);
 }
 
@@ -409,6 +474,16 @@ static uint64_t ahci_mem_read_32(void *opaque, hwaddr addr)
         case AHCI_HOST_REG_VERSION:
             val = s->control_regs.version;
             break;
+        case AHCI_HOST_REG_CCC_CTL:
+            if (s->control_regs.cap & HOST_CAP_CCC) {
+                val = s->control_regs.ccc_ctl;
+            }
+            break;
+        case AHCI_HOST_REG_CCC_PORTS:
+            if (s->control_regs.cap & HOST_CAP_CCC) {
+                val = s->control_regs.ccc_ports;
+            }
+            break;
         default:
             trace_ahci_mem_read_32_host_default(s, AHCIHostReg_lookup[regnum],
                                                 addr);
@@ -499,6 +574,24 @@ static void ahci_mem_write(void *opaque, hwaddr addr,
         case AHCI_HOST_REG_VERSION: /* RO */
             /* FIXME report write? */
             break;
+        case AHCI_HOST_REG_CCC_CTL: /* R/W, INT is RO */
+            if (!(s->control_regs.cap & HOST_CAP_CCC)) {
+                break;
+            }
+            s->control_regs.ccc_ctl =
+                (val & AHCI_CCC_CTL_RW_MASK) |
+                (s->control_regs.ccc_ctl & ~AHCI_CCC_CTL_RW_MASK);
+            if (!(val & AHCI_CCC_CTL_EN)) {
+                s->ccc_count = 0;
+                timer_del(s->ccc_timer);
+            }
+            break;
+        case AHCI_HOST_REG_CCC_PORTS: /* R/W */
+            if (!(s->control_regs.cap & HOST_CAP_CCC)) {
+                break;
+            }
+            s->control_regs.ccc_ports = val & s->control_regs.impl;
+            break;
         default:
             qemu_log_mask(LOG_UNIMP,
                           "Attempted write to unimplemented register: "
@@ -574,6 +667,9 @@ static void ahci_reg_init(AHCIState *s)
                           (AHCI_NUM_COMMAND_SLOTS << 8) |
                           (AHCI_SUPPORTED_SPEED_GEN1 << AHCI_SUPPORTED_SPEED) |
                           HOST_CAP_NCQ | HOST_CAP_AHCI | HOST_CAP_64;
+    if (s->ccc && s->ports < 32) {
+        s->control_regs.cap |= HOST_CAP_CCC;
+    }
 
     s->control_regs.impl = (1 << s->ports) - 1;
 
@@ -913,6 +1009,9 @@ static int prdt_tbl_entry_size(const AHCI_SG *tbl)
  * building the sglist from the PRDT as soon as we hit @limit bytes,
  * which is <= INT32_MAX/2GiB.
  */
+/* Number of PRDT entries read from guest memory at a time */
+#define AHCI_PRDT_BATCH 32
+
 static int ahci_populate_sglist(AHCIDevice *ad, QEMUSGList *sglist,
                                 AHCICmdHdr *cmd, int64_t limit, uint64_t offset)
 {
@@ -920,11 +1019,8 @@ static int ahci_populate_sglist(AHCIDevice *ad, QEMUSGList *sglist,
     uint16_t prdtl = le16_to_cpu(cmd->prdtl);
     uint64_t cfis_addr = le64_to_cpu(cmd->tbl_addr);
     uint64_t prdt_addr = cfis_addr + 0x80;
-    dma_addr_t prdt_len = (prdtl * sizeof(AHCI_SG));
-    dma_addr_t real_prdt_len = prdt_len;
-    uint8_t *prdt;
+    AHCI_SG tbl[AHCI_PRDT_BATCH];
     int i;
-    int r = 0;
     uint64_t sum = 0;
     int off_idx = -1;
     int64_t off_pos = -1;
@@ -939,57 +1035,52 @@ static int ahci_populate_sglist(AHCIDevice *ad, QEMUSGList *sglist,
         return -1;
     }
 
-    /* map PRDT */
-    if (!(prdt = dma_memory_map(ad->hba->as, prdt_addr, &prdt_len,
-                                DMA_DIRECTION_TO_DEVICE,
-                                MEMTXATTRS_UNSPECIFIED))){
-        trace_ahci_populate_sglist_no_map(ad->hba, ad->port_no);
-        return -1;
-    }
-
-    if (prdt_len < real_prdt_len) {
-        trace_ahci_populate_sglist_short_map(ad->hba, ad->port_no);
-        r = -1;
-        goto out;
-    }
-
-    /* Get entries in the PRDT, init a qemu sglist accordingly */
-    if (prdtl > 0) {
-        AHCI_SG *tbl = (AHCI_SG *)prdt;
-        sum = 0;
-        for (i = 0; i < prdtl; i++) {
-            tbl_entry_size = prdt_tbl_entry_size(&tbl[i]);
-            if (offset < (sum + tbl_entry_size)) {
-                off_idx = i;
-                off_pos = offset - sum;
-                break;
+    /*
+     * Read the PRDT through the translation cache a batch at a time and
+     * init a qemu sglist from the entries, starting at @offset.
+     */
+    for (i = 0; i < prdtl && (off_idx == -1 || sglist->size < limit); i++) {
+        AHCI_SG *entry = &tbl[i % AHCI_PRDT_BATCH];
+
+        if (i % AHCI_PRDT_BATCH == 0) {
+            int n = MIN(prdtl - i, AHCI_PRDT_BATCH);
+
+            if (dma_translation_cache_rw(ad->hba->dma_cache,
+                                         prdt_addr + i * sizeof(AHCI_SG),
+                                         tbl, n * sizeof(AHCI_SG),
+                                         DMA_DIRECTION_TO_DEVICE,
+                                         MEMTXATTRS_UNSPECIFIED)
+                != MEMTX_OK) {
+                trace_ahci_populate_sglist_no_map(ad->hba, ad->port_no);
+                if (off_idx != -1) {
+                    qemu_sglist_destroy(sglist);
+                }
+                return -1;
             }
-            sum += tbl_entry_size;
         }
-        if ((off_idx == -1) || (off_pos < 0) || (off_pos > tbl_entry_size)) {
-            trace_ahci_populate_sglist_bad_offset(ad->hba, ad->port_no,
-                                                  off_idx, off_pos);
-            r = -1;
-            goto out;
-        }
-
-        qemu_sglist_init(sglist, qbus->parent, (prdtl - off_idx),
-                         ad->hba->as);
-        qemu_sglist_add(sglist, le64_to_cpu(tbl[off_idx].addr) + off_pos,
-                        MIN(prdt_tbl_entry_size(&tbl[off_idx]) - off_pos,
-                            limit));
 
-        for (i = off_idx + 1; i < prdtl && sglist->size < limit; i++) {
-            qemu_sglist_add(sglist, le64_to_cpu(tbl[i].addr),
-                            MIN(prdt_tbl_entry_size(&tbl[i]),
-                                limit - sglist->size));
+        tbl_entry_size = prdt_tbl_entry_size(entry);
+        if (off_idx != -1) {
+            qemu_sglist_add(sglist, le64_to_cpu(entry->addr),
+                            MIN(tbl_entry_size, limit - sglist->size));
+        } else if (offset < (sum + tbl_entry_size)) {
+            off_idx = i;
+            off_pos = offset - sum;
+            qemu_sglist_init(sglist, qbus->parent, (prdtl - off_idx),
+                             ad->hba->as);
+            qemu_sglist_add(sglist, le64_to_cpu(entry->addr) + off_pos,
+                            MIN(tbl_entry_size - off_pos, limit));
+        } else {
+            sum += tbl_entry_size;
         }
     }
 
-out:
-    dma_memory_unmap(ad->hba->as, prdt, prdt_len,
-                     DMA_DIRECTION_TO_DEVICE, prdt_len);
-    return r;
+    if (off_idx == -1) {
+        trace_ahci_populate_sglist_bad_offset(ad->hba, ad->port_no,
+                                              off_idx, off_pos);
+        return -1;
+    }
+    return 0;
 }
 
 static void ncq_err(NCQTransferState *ncq_tfs)
@@ -1277,8 +1368,7 @@ static int handle_cmd(AHCIState *s, int port, uint8_t slot)
     IDEState *ide_state;
     uint64_t tbl_addr;
     AHCICmdHdr *cmd;
-    uint8_t *cmd_fis;
-    dma_addr_t cmd_len;
+    uint8_t cmd_fis[0x80];
 
     if (s->dev[port].port.ifs[0].status & (BUSY_STAT|DRQ_STAT)) {
         /* Engine currently busy, try again later */
@@ -1302,16 +1392,12 @@ static int handle_cmd(AHCIState *s, int port, uint8_t slot)
     }
 
     tbl_addr = le64_to_cpu(cmd->tbl_addr);
-    cmd_len = 0x80;
-    cmd_fis = dma_memory_map(s->as, tbl_addr, &cmd_len,
-                             DMA_DIRECTION_TO_DEVICE, MEMTXATTRS_UNSPECIFIED);
-    if (!cmd_fis) {
+    if (dma_translation_cache_rw(s->dma_cache, tbl_addr, cmd_fis,
+                                 sizeof(cmd_fis), DMA_DIRECTION_TO_DEVICE,
+                                 MEMTXATTRS_UNSPECIFIED) != MEMTX_OK) {
+        ahci_trigger_irq(s, &s->dev[port], AHCI_PORT_IRQ_BIT_HBFS);
         trace_handle_cmd_badfis(s, port);
         return -1;
-    } else if (cmd_len != 0x80) {
-        ahci_trigger_irq(s, &s->dev[port], AHCI_PORT_IRQ_BIT_HBFS);
-        trace_handle_cmd_badmap(s, port, cmd_len);
-        goto out;
     }
     if (trace_event_get_state_backends(TRACE_HANDLE_CMD_FIS_DUMP)) {
         char *pretty_fis = ahci_pretty_buffer_fis(cmd_fis, 0x80);
@@ -1328,9 +1414,6 @@ static int handle_cmd(AHCIState *s, int port, uint8_t slot)
             break;
     }
 
-out:
-    dma_memory_unmap(s->as, cmd_fis, cmd_len, DMA_DIRECTION_TO_DEVICE,
-                     cmd_len);
 
     if (s->dev[port].port.ifs[0].status & (BUSY_STAT|DRQ_STAT)) {
         /* async command, complete later */
@@ -1547,8 +1630,10 @@ void ahci_realize(AHCIState *s, DeviceState *qdev, AddressSpace *as, int ports)
     int i;
 
     s->as = as;
+    s->dma_cache = dma_translation_cache_new(as);
     s->ports = ports;
     s->dev = g_new0(AHCIDevice, ports);
+    s->ccc_timer = timer_new_ms(QEMU_CLOCK_VIRTUAL, ahci_ccc_timer_cb, s);
     ahci_reg_init(s);
     irqs = qemu_allocate_irqs(ahci_irq_set, s, s->ports);
     for (i = 0; i < s->ports; i++) {
@@ -1582,6 +1667,8 @@ void ahci_uninit(AHCIState *s)
     }
 
     g_free(s->dev);
+    timer_free(s->ccc_timer);
+    dma_translation_cache_free(s->dma_cache);
 }
 
 void ahci_reset(AHCIState *s)
@@ -1601,6 +1688,7 @@ void ahci_reset(AHCIState *s)
      * We set HOST_CAP_AHCI so we must enable AHCI at reset.
      */
     s->control_regs.ghc = HOST_CTL_AHCI_EN;
+    ahci_ccc_reset(s);
 
     for (i = 0; i < s->ports; i++) {
         pr = &s->dev[i].port_regs;
@@ -1743,6 +1831,27 @@ static int ahci_state_post_load(void *opaque, int version_id)
     return 0;
 }
 
+static bool ahci_ccc_needed(void *opaque)
+{
+    AHCIState *s = opaque;
+
+    return s->control_regs.cap & HOST_CAP_CCC;
+}
+
+static const VMStateDescription vmstate_ahci_ccc = {
+    .name = "ahci/ccc",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .needed = ahci_ccc_needed,
+    .fields = (VMStateField[]) {
+        VMSTATE_UINT32(control_regs.ccc_ctl, AHCIState),
+        VMSTATE_UINT32(control_regs.ccc_ports, AHCIState),
+        VMSTATE_UINT32(ccc_count, AHCIState),
+        VMSTATE_TIMER_PTR(ccc_timer, AHCIState),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
 const VMStateDescription vmstate_ahci = {
     .name = "ahci",
     .version_id = 1,
@@ -1759,6 +1868,10 @@ const VMStateDescription vmstate_ahci = {
         VMSTATE_INT32_EQUAL(ports, AHCIState, NULL),
         VMSTATE_END_OF_LIST()
     },
+    .subsections = (const VMStateDescription * []) {
+        &vmstate_ahci_ccc,
+        NULL
+    }
 };
 
 static const VMStateDescription vmstate_sysbus_ahci = {
@@ -1796,6 +1909,7 @@ static void sysbus_ahci_realize(DeviceState *dev, Error **errp)
 
 static Property sysbus_ahci_properties[] = {
     DEFINE_PROP_UINT32("num-ports", SysbusAHCIState, num_ports, 1),
+    DEFINE_PROP_BOOL("ccc", SysbusAHCIState, ahci.ccc, true),
     DEFINE_PROP_END_OF_LIST(),
 };
 
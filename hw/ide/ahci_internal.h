@@ -77,6 +77,7 @@ enum AHCIHostReg {
 #define HOST_CTL_AHCI_EN          (1U << 31) /* AHCI enabled */
 
 /* HOST_CAP bits */
+#define HOST_CAP_CCC              (1 << 7)  /* Command Completion Coalescing */
 #define HOST_CAP_SSC              (1 << 14) /* Slumber capable */
 #define HOST_CAP_AHCI             (1 << 18) /* AHCI only */
 #define HOST_CAP_CLO              (1 << 24) /* Command List Override support */
@@ -84,6 +85,13 @@ enum AHCIHostReg {
 #define HOST_CAP_NCQ              (1 << 30) /* Native Command Queueing */
 #define HOST_CAP_64               (1U << 31) /* PCI DAC (64-bit DMA) support */
 
+/* CCC_CTL fields */
+#define AHCI_CCC_CTL_EN           (1 << 0)  /* CCC enable */
+#define AHCI_CCC_CTL_INT_SHIFT    3         /* IS bit used for CCC, RO */
+#define AHCI_CCC_CTL_CC_SHIFT     8         /* Command completions */
+#define AHCI_CCC_CTL_TV_SHIFT     16        /* Timeout value, in ms */
+#define AHCI_CCC_CTL_RW_MASK      0xffffff01
+
 /* registers for each SATA port */
 enum AHCIPortReg {
     AHCI_PORT_REG_LST_ADDR    = 0, /* PxCLB: command list DMA addr */
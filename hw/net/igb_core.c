@@ -62,6 +62,16 @@ union e1000_rx_desc_union {
     union e1000_adv_rx_desc adv;
 };
 
+/* Rx descriptors are read and written back this many at a time */
+#define IGB_RX_DESC_BATCH 8
+
+typedef struct IGBRxDescBatch {
+    dma_addr_t base;
+    unsigned int count;
+    unsigned int pos;
+    union e1000_rx_desc_union descs[IGB_RX_DESC_BATCH];
+} IGBRxDescBatch;
+
 typedef struct IGBTxPktVmdqCallbackContext {
     IGBCore *core;
     NetClientState *nc;
@@ -1481,38 +1491,92 @@ igb_write_rx_descr(IGBCore *core, union e1000_rx_desc_union *desc,
     }
 }
 
-static inline void
-igb_pci_dma_write_rx_desc(IGBCore *core, PCIDevice *dev, dma_addr_t addr,
-                          union e1000_rx_desc_union *desc, dma_addr_t len)
+/*
+ * Write back the descriptors in one go with DD clear, then set DD one
+ * descriptor after the other, so the guest never sees a descriptor done
+ * before its contents are.
+ */
+static void
+igb_pci_dma_write_rx_descs(IGBCore *core, PCIDevice *dev, dma_addr_t addr,
+                           union e1000_rx_desc_union *descs, unsigned int n)
 {
-    if (igb_rx_use_legacy_descriptor(core)) {
-        struct e1000_rx_desc *d = &desc->legacy;
-        size_t offset = offsetof(struct e1000_rx_desc, status);
-        uint8_t status = d->status;
+    uint32_t status[IGB_RX_DESC_BATCH];
+    size_t offset;
+    unsigned int i;
 
-        d->status &= ~E1000_RXD_STAT_DD;
-        pci_dma_write(dev, addr, desc, len);
+    QEMU_BUILD_BUG_ON(sizeof(union e1000_rx_desc_union) !=
+                      E1000_RING_DESC_LEN);
+    assert(n <= IGB_RX_DESC_BATCH);
 
-        if (status & E1000_RXD_STAT_DD) {
-            d->status = status;
-            pci_dma_write(dev, addr + offset, &status, sizeof(status));
+    if (igb_rx_use_legacy_descriptor(core)) {
+        offset = offsetof(struct e1000_rx_desc, status);
+        for (i = 0; i < n; i++) {
+            status[i] = descs[i].legacy.status;
+            descs[i].legacy.status &= ~E1000_RXD_STAT_DD;
         }
     } else {
-        union e1000_adv_rx_desc *d = &desc->adv;
-        size_t offset =
-            offsetof(union e1000_adv_rx_desc, wb.upper.status_error);
-        uint32_t status = d->wb.upper.status_error;
+        offset = offsetof(union e1000_adv_rx_desc, wb.upper.status_error);
+        for (i = 0; i < n; i++) {
+            status[i] = descs[i].adv.wb.upper.status_error;
+            descs[i].adv.wb.upper.status_error &= ~E1000_RXD_STAT_DD;
+        }
+    }
+
+    pci_dma_write(dev, addr, descs, n * core->rx_desc_len);
 
-        d->wb.upper.status_error &= ~E1000_RXD_STAT_DD;
-        pci_dma_write(dev, addr, desc, len);
+    for (i = 0; i < n; i++, addr += core->rx_desc_len) {
+        if (igb_rx_use_legacy_descriptor(core)) {
+            uint8_t st = status[i];
 
-        if (status & E1000_RXD_STAT_DD) {
-            d->wb.upper.status_error = status;
-            pci_dma_write(dev, addr + offset, &status, sizeof(status));
+            descs[i].legacy.status = st;
+            if (st & E1000_RXD_STAT_DD) {
+                pci_dma_write(dev, addr + offset, &st, sizeof(st));
+            }
+        } else {
+            descs[i].adv.wb.upper.status_error = status[i];
+            if (status[i] & E1000_RXD_STAT_DD) {
+                pci_dma_write(dev, addr + offset, &status[i],
+                              sizeof(status[i]));
+            }
         }
     }
 }
 
+static void
+igb_rx_desc_batch_flush(IGBCore *core, PCIDevice *d, IGBRxDescBatch *batch)
+{
+    if (batch->pos) {
+        igb_pci_dma_write_rx_descs(core, d, batch->base, batch->descs,
+                                   batch->pos);
+    }
+    batch->count = batch->pos = 0;
+}
+
+/*
+ * Read up to @want descriptors from the head of the ring, stopping at
+ * the descriptors not owned by the device and at the end of the ring.
+ * The ring must not be empty.
+ */
+static void
+igb_rx_desc_batch_fill(IGBCore *core, PCIDevice *d, const E1000E_RingInfo *rxi,
+                       IGBRxDescBatch *batch, size_t want)
+{
+    int64_t to_end = core->mac[rxi->dlen] / E1000_RING_DESC_LEN -
+                     (int64_t)core->mac[rxi->dh];
+    size_t n = MIN(want, IGB_RX_DESC_BATCH);
+
+    n = MIN(n, igb_ring_free_descr_num(core, rxi));
+    if (to_end > 0) {
+        n = MIN(n, to_end);
+    }
+    n = MAX(n, 1);
+
+    igb_rx_desc_batch_flush(core, d, batch);
+    batch->base = igb_ring_head_descr(core, rxi);
+    batch->count = n;
+    pci_dma_read(d, batch->base, batch->descs, n * core->rx_desc_len);
+}
+
 static void
 igb_write_to_rx_buffers(IGBCore *core,
                         PCIDevice *d,
@@ -1558,10 +1622,11 @@ igb_write_packet_to_guest(IGBCore *core, struct NetRxPkt *pkt,
                           uint16_t etqf, bool ts)
 {
     PCIDevice *d;
-    dma_addr_t base;
-    union e1000_rx_desc_union desc;
+    IGBRxDescBatch batch = { .count = 0, .pos = 0 };
+    union e1000_rx_desc_union *desc;
     size_t desc_size;
     size_t desc_offset = 0;
+    size_t desc_left;
     size_t iov_ofs = 0;
 
     struct iovec *iov = net_rx_pkt_get_iovec(pkt);
@@ -1575,6 +1640,8 @@ igb_write_packet_to_guest(IGBCore *core, struct NetRxPkt *pkt,
         d = core->owner;
     }
 
+    desc_left = bufsize ? DIV_ROUND_UP(total_size, bufsize) : 1;
+
     do {
         hwaddr ba;
         uint16_t written = 0;
@@ -1587,16 +1654,20 @@ igb_write_packet_to_guest(IGBCore *core, struct NetRxPkt *pkt,
         }
 
         if (igb_ring_empty(core, rxi)) {
+            igb_rx_desc_batch_flush(core, d, &batch);
             return;
         }
 
-        base = igb_ring_head_descr(core, rxi);
-
-        pci_dma_read(d, base, &desc, core->rx_desc_len);
+        if (batch.pos == batch.count) {
+            igb_rx_desc_batch_fill(core, d, rxi, &batch, desc_left);
+        }
+        desc = &batch.descs[batch.pos];
 
-        trace_e1000e_rx_descr(rxi->idx, base, core->rx_desc_len);
+        trace_e1000e_rx_descr(rxi->idx,
+                              batch.base + batch.pos * core->rx_desc_len,
+                              core->rx_desc_len);
 
-        igb_read_rx_descr(core, &desc, &ba);
+        igb_read_rx_descr(core, desc, &ba);
 
         if (ba) {
             if (desc_offset < size) {
@@ -1636,14 +1707,19 @@ igb_write_packet_to_guest(IGBCore *core, struct NetRxPkt *pkt,
             is_last = true;
         }
 
-        igb_write_rx_descr(core, &desc, is_last ? core->rx_pkt : NULL,
+        igb_write_rx_descr(core, desc, is_last ? core->rx_pkt : NULL,
                            rss_info, etqf, ts, written);
-        igb_pci_dma_write_rx_desc(core, d, base, &desc, core->rx_desc_len);
+        batch.pos++;
+        if (desc_left > 1) {
+            desc_left--;
+        }
 
         igb_ring_advance(core, rxi, core->rx_desc_len / E1000_MIN_RX_DESC_LEN);
 
     } while (desc_offset < total_size);
 
+    igb_rx_desc_batch_flush(core, d, &batch);
+
     igb_update_rx_stats(core, rxi, size, total_size);
 }
 
@@ -47,6 +47,7 @@ static const int kernel_feature_bits[] = {
     VIRTIO_NET_F_MTU,
     VIRTIO_F_IOMMU_PLATFORM,
     VIRTIO_F_RING_PACKED,
+    VIRTIO_F_IN_ORDER,
     VIRTIO_F_RING_RESET,
     VIRTIO_NET_F_HASH_REPORT,
     VHOST_INVALID_FEATURE_BIT
@@ -75,6 +76,7 @@ static const int user_feature_bits[] = {
     VIRTIO_NET_F_MTU,
     VIRTIO_F_IOMMU_PLATFORM,
     VIRTIO_F_RING_PACKED,
+    VIRTIO_F_IN_ORDER,
     VIRTIO_F_RING_RESET,
     VIRTIO_NET_F_RSS,
     VIRTIO_NET_F_HASH_REPORT,
@@ -164,6 +166,40 @@ static int vhost_net_get_fd(NetClientState *backend)
     }
 }
 
+/*
+ * The kernel starts each device with one worker shared by its virtqueues,
+ * keep it for the first one and give the others a worker of their own.
+ */
+static int vhost_net_set_workers(struct vhost_net *net)
+{
+    struct vhost_dev *dev = &net->dev;
+    struct vhost_worker_state worker;
+    struct vhost_vring_worker vq_worker;
+    int i, r;
+
+    if (!dev->vhost_ops->vhost_new_worker ||
+        !dev->vhost_ops->vhost_attach_vring_worker) {
+        return -ENOTSUP;
+    }
+
+    for (i = 1; i < dev->nvqs; i++) {
+        r = dev->vhost_ops->vhost_new_worker(dev, &worker);
+        if (r < 0) {
+            return r;
+        }
+
+        vq_worker.index = dev->vhost_ops->vhost_get_vq_index(dev,
+                                                             dev->vq_index + i);
+        vq_worker.worker_id = worker.worker_id;
+        r = dev->vhost_ops->vhost_attach_vring_worker(dev, &vq_worker);
+        if (r < 0) {
+            return r;
+        }
+    }
+
+    return 0;
+}
+
 struct vhost_net *vhost_net_init(VhostNetOptions *options)
 {
     int r;
@@ -218,6 +254,14 @@ struct vhost_net *vhost_net_init(VhostNetOptions *options)
                    (uint64_t)(~net->dev.features & net->dev.backend_features));
             goto fail;
         }
+        if (options->worker_per_vq) {
+            r = vhost_net_set_workers(net);
+            if (r < 0) {
+                error_report("vhost-net: can't create a worker per "
+                             "virtqueue: %s", strerror(-r));
+                goto fail;
+            }
+        }
     }
 
     /* Set sane init value. Override when guest acks. */
@@ -40,10 +40,12 @@
 #include "migration/misc.h"
 #include "standard-headers/linux/ethtool.h"
 #include "sysemu/sysemu.h"
+#include "sysemu/iothread.h"
 #include "trace.h"
 #include "monitor/qdev.h"
 #include "hw/pci/pci_device.h"
 #include "net_rx_pkt.h"
+#include "net_tx_pkt.h"
 #include "hw/virtio/vhost.h"
 #include "sysemu/qtest.h"
 
@@ -124,6 +126,21 @@ static int vq2q(int queue_index)
     return queue_index / 2;
 }
 
+/*
+ * Queue pairs processed in an IOThread must not touch the interrupt
+ * controller directly and signal the guest notifier instead.
+ */
+static void virtio_net_notify(VirtIONetQueue *q, VirtQueue *vq)
+{
+    VirtIODevice *vdev = VIRTIO_DEVICE(q->n);
+
+    if (q->dataplane) {
+        virtio_notify_irqfd(vdev, vq);
+    } else {
+        virtio_notify(vdev, vq);
+    }
+}
+
 static void flush_or_purge_queued_packets(NetClientState *nc)
 {
     if (!nc->peer) {
@@ -381,6 +398,8 @@ static void virtio_net_drop_tx_queue_data(VirtIODevice *vdev, VirtQueue *vq)
     }
 }
 
+static void virtio_net_dataplane_update(VirtIONet *n, uint8_t status);
+
 static void virtio_net_set_status(struct VirtIODevice *vdev, uint8_t status)
 {
     VirtIONet *n = VIRTIO_NET(vdev);
@@ -390,6 +409,7 @@ static void virtio_net_set_status(struct VirtIODevice *vdev, uint8_t status)
 
     virtio_net_vnet_endian_status(n, status);
     virtio_net_vhost_status(n, status);
+    virtio_net_dataplane_update(n, status);
 
     for (i = 0; i < n->max_queue_pairs; i++) {
         NetClientState *ncs = qemu_get_subqueue(n->nic, i);
@@ -405,7 +425,12 @@ static void virtio_net_set_status(struct VirtIODevice *vdev, uint8_t status)
             virtio_net_started(n, queue_status) && !n->vhost_started;
 
         if (queue_started) {
-            qemu_flush_queued_packets(ncs);
+            if (q->dataplane) {
+                /* The IOThread flushes the queue when rx buffers arrive */
+                event_notifier_set(virtio_queue_get_host_notifier(q->rx_vq));
+            } else {
+                qemu_flush_queued_packets(ncs);
+            }
         }
 
         if (!q->tx_waiting) {
@@ -632,6 +657,12 @@ static void virtio_net_reset(VirtIODevice *vdev)
     for (i = 0;  i < n->max_queue_pairs; i++) {
         flush_or_purge_queued_packets(qemu_get_subqueue(n->nic, i));
     }
+
+    /* The virtqueues drop their own coalescing state on reset */
+    n->rx_coal_max_packets = 0;
+    n->rx_coal_usecs = 0;
+    n->tx_coal_max_packets = 0;
+    n->tx_coal_usecs = 0;
 }
 
 static void peer_test_vnet_hdr(VirtIONet *n)
@@ -786,10 +817,13 @@ static uint64_t virtio_net_get_features(VirtIODevice *vdev, uint64_t features,
     virtio_add_feature(&features, VIRTIO_NET_F_MAC);
 
     if (!peer_has_vnet_hdr(n)) {
-        virtio_clear_feature(&features, VIRTIO_NET_F_CSUM);
-        virtio_clear_feature(&features, VIRTIO_NET_F_HOST_TSO4);
-        virtio_clear_feature(&features, VIRTIO_NET_F_HOST_TSO6);
-        virtio_clear_feature(&features, VIRTIO_NET_F_HOST_ECN);
+        /* x-tx-sw-offload does these in QEMU instead */
+        if (!n->tx_sw_offload) {
+            virtio_clear_feature(&features, VIRTIO_NET_F_CSUM);
+            virtio_clear_feature(&features, VIRTIO_NET_F_HOST_TSO4);
+            virtio_clear_feature(&features, VIRTIO_NET_F_HOST_TSO6);
+            virtio_clear_feature(&features, VIRTIO_NET_F_HOST_ECN);
+        }
 
         virtio_clear_feature(&features, VIRTIO_NET_F_GUEST_CSUM);
         virtio_clear_feature(&features, VIRTIO_NET_F_GUEST_TSO4);
@@ -804,6 +838,10 @@ static uint64_t virtio_net_get_features(VirtIODevice *vdev, uint64_t features,
         virtio_clear_feature(&features, VIRTIO_NET_F_HOST_UFO);
     }
 
+    if (!virtio_has_feature(features, VIRTIO_NET_F_CTRL_VQ)) {
+        virtio_clear_feature(&features, VIRTIO_NET_F_NOTF_COAL);
+    }
+
     if (!get_vhost_net(nc->peer)) {
         return features;
     }
@@ -811,6 +849,8 @@ static uint64_t virtio_net_get_features(VirtIODevice *vdev, uint64_t features,
     if (!ebpf_rss_is_loaded(&n->ebpf_rss)) {
         virtio_clear_feature(&features, VIRTIO_NET_F_RSS);
     }
+    /* The datapath virtqueues are not notified by QEMU with vhost */
+    virtio_clear_feature(&features, VIRTIO_NET_F_NOTF_COAL);
     features = vhost_net_get_features(get_vhost_net(nc->peer), features);
     vdev->backend_features = features;
 
@@ -1104,6 +1144,60 @@ static int virtio_net_handle_offloads(VirtIONet *n, uint8_t cmd,
     }
 }
 
+static void virtio_net_apply_coalescing(VirtIONet *n)
+{
+    int queue_pairs = n->multiqueue ? n->max_queue_pairs : 1;
+    int i;
+
+    for (i = 0; i < queue_pairs; i++) {
+        virtio_queue_set_notification_coalescing(n->vqs[i].rx_vq,
+                                                 n->rx_coal_max_packets,
+                                                 n->rx_coal_usecs,
+                                                 n->coal_adaptive);
+        virtio_queue_set_notification_coalescing(n->vqs[i].tx_vq,
+                                                 n->tx_coal_max_packets,
+                                                 n->tx_coal_usecs,
+                                                 n->coal_adaptive);
+    }
+}
+
+static int virtio_net_handle_coal(VirtIONet *n, uint8_t cmd,
+                                  struct iovec *iov, unsigned int iov_cnt)
+{
+    VirtIODevice *vdev = VIRTIO_DEVICE(n);
+    struct virtio_net_ctrl_coal_tx coal_tx;
+    struct virtio_net_ctrl_coal_rx coal_rx;
+    size_t s;
+
+    if (!virtio_vdev_has_feature(vdev, VIRTIO_NET_F_NOTF_COAL)) {
+        return VIRTIO_NET_ERR;
+    }
+
+    if (cmd == VIRTIO_NET_CTRL_NOTF_COAL_TX_SET) {
+        s = iov_to_buf(iov, iov_cnt, 0, &coal_tx, sizeof(coal_tx));
+        if (s != sizeof(coal_tx)) {
+            return VIRTIO_NET_ERR;
+        }
+        n->tx_coal_max_packets = le32_to_cpu(coal_tx.tx_max_packets);
+        n->tx_coal_usecs = le32_to_cpu(coal_tx.tx_usecs);
+    } else if (cmd == VIRTIO_NET_CTRL_NOTF_COAL_RX_SET) {
+        s = iov_to_buf(iov, iov_cnt, 0, &coal_rx, sizeof(coal_rx));
+        if (s != sizeof(coal_rx)) {
+            return VIRTIO_NET_ERR;
+        }
+        n->rx_coal_max_packets = le32_to_cpu(coal_rx.rx_max_packets);
+        n->rx_coal_usecs = le32_to_cpu(coal_rx.rx_usecs);
+    } else {
+        return VIRTIO_NET_ERR;
+    }
+
+    trace_virtio_net_handle_coal(n, n->rx_coal_max_packets, n->rx_coal_usecs,
+                                 n->tx_coal_max_packets, n->tx_coal_usecs);
+    virtio_net_apply_coalescing(n);
+
+    return VIRTIO_NET_OK;
+}
+
 static int virtio_net_handle_mac(VirtIONet *n, uint8_t cmd,
                                  struct iovec *iov, unsigned int iov_cnt)
 {
@@ -1281,6 +1375,11 @@ static bool virtio_net_attach_epbf_rss(VirtIONet *n)
 {
     struct EBPFRSSConfig config = {};
 
+    if (n->steering_prog_fd >= 0) {
+        /* The management layer's program takes over the steering */
+        return virtio_net_attach_ebpf_to_backend(n->nic, n->steering_prog_fd);
+    }
+
     if (!ebpf_rss_is_loaded(&n->ebpf_rss)) {
         return false;
     }
@@ -1301,7 +1400,33 @@ static bool virtio_net_attach_epbf_rss(VirtIONet *n)
 
 static void virtio_net_detach_epbf_rss(VirtIONet *n)
 {
-    virtio_net_attach_ebpf_to_backend(n->nic, -1);
+    virtio_net_attach_ebpf_to_backend(n->nic, n->steering_prog_fd);
+}
+
+static bool virtio_net_set_steering_program(NetClientState *nc, int prog_fd,
+                                            Error **errp)
+{
+    VirtIONet *n = qemu_get_nic_opaque(nc);
+    int old_fd = n->steering_prog_fd;
+    bool ok;
+
+    n->steering_prog_fd = prog_fd;
+    if (n->rss_data.enabled && !n->rss_data.enabled_software_rss) {
+        ok = virtio_net_attach_epbf_rss(n);
+    } else {
+        ok = virtio_net_attach_ebpf_to_backend(n->nic, prog_fd);
+    }
+
+    if (!ok) {
+        error_setg(errp, "network backend does not support steering eBPF");
+        n->steering_prog_fd = old_fd;
+        return false;
+    }
+
+    if (old_fd >= 0) {
+        close(old_fd);
+    }
+    return true;
 }
 
 static bool virtio_net_load_ebpf(VirtIONet *n)
@@ -1531,6 +1656,13 @@ size_t virtio_net_handle_ctrl_iov(VirtIODevice *vdev,
         return 0;
     }
 
+    /*
+     * Receive filtering state is not protected against the IOThreads, bring
+     * all queue pairs back to the main loop while it changes.
+     */
+    n->ctrl_in_progress = true;
+    virtio_net_dataplane_update(n, vdev->status);
+
     iov2 = iov = g_memdup2(out_sg, sizeof(struct iovec) * out_num);
     s = iov_to_buf(iov, out_num, 0, &ctrl, sizeof(ctrl));
     iov_discard_front(&iov, &out_num, sizeof(ctrl));
@@ -1548,11 +1680,16 @@ size_t virtio_net_handle_ctrl_iov(VirtIODevice *vdev,
         status = virtio_net_handle_mq(n, ctrl.cmd, iov, out_num);
     } else if (ctrl.class == VIRTIO_NET_CTRL_GUEST_OFFLOADS) {
         status = virtio_net_handle_offloads(n, ctrl.cmd, iov, out_num);
+    } else if (ctrl.class == VIRTIO_NET_CTRL_NOTF_COAL) {
+        status = virtio_net_handle_coal(n, ctrl.cmd, iov, out_num);
     }
 
     s = iov_from_buf(in_sg, in_num, 0, &status, sizeof(status));
     assert(s == sizeof(status));
 
+    n->ctrl_in_progress = false;
+    virtio_net_dataplane_update(n, vdev->status);
+
     g_free(iov2);
     return sizeof(status);
 }
@@ -1659,14 +1796,20 @@ static void virtio_net_hdr_swap(VirtIODevice *vdev, struct virtio_net_hdr *hdr)
  * we should provide a mechanism to disable it to avoid polluting the host
  * cache.
  */
-static void work_around_broken_dhclient(struct virtio_net_hdr *hdr,
-                                        uint8_t *buf, size_t size)
+static bool is_broken_dhclient_packet(const struct virtio_net_hdr *hdr,
+                                      const uint8_t *buf, size_t size)
 {
-    if ((hdr->flags & VIRTIO_NET_HDR_F_NEEDS_CSUM) && /* missing csum */
+    return (hdr->flags & VIRTIO_NET_HDR_F_NEEDS_CSUM) && /* missing csum */
         (size > 27 && size < 1500) && /* normal sized MTU */
         (buf[12] == 0x08 && buf[13] == 0x00) && /* ethertype == IPv4 */
         (buf[23] == 17) && /* ip.protocol == UDP */
-        (buf[34] == 0 && buf[35] == 67)) { /* udp.srcport == bootps */
+        (buf[34] == 0 && buf[35] == 67); /* udp.srcport == bootps */
+}
+
+static void work_around_broken_dhclient(struct virtio_net_hdr *hdr,
+                                        uint8_t *buf, size_t size)
+{
+    if (is_broken_dhclient_packet(hdr, buf, size)) {
         net_checksum_calculate(buf, size, CSUM_UDP);
         hdr->flags &= ~VIRTIO_NET_HDR_F_NEEDS_CSUM;
     }
@@ -1994,7 +2137,11 @@ static ssize_t virtio_net_receive_rcu(NetClientState *nc, const uint8_t *buf,
     }
 
     virtqueue_flush(q->rx_vq, i);
-    virtio_notify(vdev, q->rx_vq);
+    if (q->rx_batch) {
+        q->rx_batch_notify = true;
+    } else {
+        virtio_net_notify(q, q->rx_vq);
+    }
 
     return size;
 
@@ -2015,6 +2162,151 @@ static ssize_t virtio_net_do_receive(NetClientState *nc, const uint8_t *buf,
     return virtio_net_receive_rcu(nc, buf, size, false);
 }
 
+/*
+ * The peer can read a packet straight into a guest buffer only if that is
+ * what virtio_net_receive_rcu() would have put there: the header must be
+ * passed through unchanged and the packet must not be steered or
+ * coalesced based on its contents.
+ */
+static bool virtio_net_rx_zerocopy_possible(VirtIONet *n)
+{
+    return n->rx_zerocopy &&
+        n->has_vnet_hdr &&
+        n->host_hdr_len == n->guest_hdr_len &&
+        !n->needs_vnet_hdr_swap &&
+        !n->rsc4_enabled && !n->rsc6_enabled &&
+        !(n->rss_data.enabled && n->rss_data.enabled_software_rss) &&
+        !n->rss_data.populate_hash;
+}
+
+static int virtio_net_rx_zerocopy_begin(NetClientState *nc,
+                                        struct iovec *iov, int iovcnt)
+{
+    VirtIONet *n = qemu_get_nic_opaque(nc);
+    VirtIONetQueue *q = virtio_net_get_subqueue(nc);
+    VirtQueueElement *elem;
+
+    RCU_READ_LOCK_GUARD();
+
+    assert(!q->rx_zerocopy_elem);
+
+    if (!virtio_net_rx_zerocopy_possible(n) || !virtio_net_can_receive(nc) ||
+        !virtio_net_has_buffers(q, n->guest_hdr_len + ETH_ZLEN)) {
+        return -1;
+    }
+
+    elem = virtqueue_pop(q->rx_vq, sizeof(VirtQueueElement));
+    if (!elem) {
+        return -1;
+    }
+
+    /* Leave odd chains to the copying path and its error reporting */
+    if (elem->in_num < 1 || elem->in_num > iovcnt) {
+        virtqueue_unpop(q->rx_vq, elem, 0);
+        g_free(elem);
+        return -1;
+    }
+
+    memcpy(iov, elem->in_sg, elem->in_num * sizeof(*iov));
+    q->rx_zerocopy_elem = elem;
+
+    return elem->in_num;
+}
+
+static bool virtio_net_rx_zerocopy_end(NetClientState *nc, ssize_t size)
+{
+    VirtIONet *n = qemu_get_nic_opaque(nc);
+    VirtIONetQueue *q = virtio_net_get_subqueue(nc);
+    VirtIODevice *vdev = VIRTIO_DEVICE(n);
+    VirtQueueElement *elem = q->rx_zerocopy_elem;
+    /* Enough of the packet for receive_filter() and the dhclient check */
+    uint8_t head[sizeof(struct virtio_net_hdr_mrg_rxbuf) + 64] = {};
+    struct virtio_net_hdr_mrg_rxbuf mhdr;
+
+    RCU_READ_LOCK_GUARD();
+
+    assert(elem);
+
+    if (size < 0) {
+        q->rx_zerocopy_elem = NULL;
+        virtqueue_unpop(q->rx_vq, elem, 0);
+        g_free(elem);
+        return false;
+    }
+
+    /* From here on, returning false keeps the buffer for the caller */
+    if (size < n->host_hdr_len) {
+        return false;
+    }
+
+    iov_to_buf(elem->in_sg, elem->in_num, 0, head,
+               MIN((size_t)size, sizeof(head)));
+
+    if (!receive_filter(n, head, size)) {
+        q->rx_zerocopy_elem = NULL;
+        virtqueue_unpop(q->rx_vq, elem, 0);
+        g_free(elem);
+        return true;
+    }
+
+    if (is_broken_dhclient_packet((struct virtio_net_hdr *)head,
+                                  head + n->host_hdr_len,
+                                  size - n->host_hdr_len)) {
+        return false;
+    }
+
+    if (n->mergeable_rx_bufs) {
+        virtio_stw_p(vdev, &mhdr.num_buffers, 1);
+        iov_from_buf(elem->in_sg, elem->in_num,
+                     offsetof(typeof(mhdr), num_buffers),
+                     &mhdr.num_buffers, sizeof(mhdr.num_buffers));
+    }
+
+    q->rx_zerocopy_elem = NULL;
+    virtqueue_fill(q->rx_vq, elem, size, 0);
+    g_free(elem);
+    virtqueue_flush(q->rx_vq, 1);
+    virtio_net_notify(q, q->rx_vq);
+
+    return true;
+}
+
+/*
+ * Receive a burst of packets with a single guest notification.  A packet
+ * that cannot be delivered ends the burst; the sender queues it, and
+ * everything after it, the usual way.
+ */
+static int virtio_net_receive_batch(NetClientState *nc,
+                                    const struct iovec *pkts, int count)
+{
+    VirtIONet *n = qemu_get_nic_opaque(nc);
+    VirtIONetQueue *q = virtio_net_get_subqueue(nc);
+    int i;
+
+    /* Coalescing has its own receive path */
+    if (n->rsc4_enabled || n->rsc6_enabled) {
+        return 0;
+    }
+
+    RCU_READ_LOCK_GUARD();
+
+    q->rx_batch = true;
+    for (i = 0; i < count; i++) {
+        if (virtio_net_receive_rcu(nc, pkts[i].iov_base, pkts[i].iov_len,
+                                   false) <= 0) {
+            break;
+        }
+    }
+    q->rx_batch = false;
+
+    if (q->rx_batch_notify) {
+        q->rx_batch_notify = false;
+        virtio_net_notify(q, q->rx_vq);
+    }
+
+    return i;
+}
+
 static void virtio_net_rsc_extract_unit4(VirtioNetRscChain *chain,
                                          const uint8_t *buf,
                                          VirtioNetRscUnit *unit)
@@ -2625,11 +2917,10 @@ static void virtio_net_tx_complete(NetClientState *nc, ssize_t len)
 {
     VirtIONet *n = qemu_get_nic_opaque(nc);
     VirtIONetQueue *q = virtio_net_get_subqueue(nc);
-    VirtIODevice *vdev = VIRTIO_DEVICE(n);
     int ret;
 
     virtqueue_push(q->tx_vq, q->async_tx.elem, 0);
-    virtio_notify(vdev, q->tx_vq);
+    virtio_net_notify(q, q->tx_vq);
 
     g_free(q->async_tx.elem);
     q->async_tx.elem = NULL;
@@ -2654,11 +2945,81 @@ static void virtio_net_tx_complete(NetClientState *nc, ssize_t len)
 }
 
 /* TX */
+static void virtio_net_tx_pkt_free_frag(void *opaque, void *base, size_t len)
+{
+    /* The fragments point into the element, which is unmapped by the caller */
+}
+
+/*
+ * Complete a packet whose guest header asks for checksum offload, when
+ * the peer cannot take the header.  The packet is not written to: the
+ * checksum goes out in a separate buffer.
+ */
+static void virtio_net_tx_sw_csum(NetClientState *nc, VirtIODevice *vdev,
+                                  const struct virtio_net_hdr *hdr,
+                                  const struct iovec *sg, unsigned num)
+{
+    struct iovec out[VIRTQUEUE_MAX_SIZE + 1];
+    size_t size = iov_size(sg, num);
+    size_t start = virtio_tswap16(vdev, hdr->csum_start);
+    size_t off = start + virtio_tswap16(vdev, hdr->csum_offset);
+    unsigned out_num;
+    uint16_t csum;
+
+    if (off + sizeof(csum) > size) {
+        return;
+    }
+
+    /* The guest has put the pseudo header sum into the checksum field */
+    csum = cpu_to_be16(net_checksum_finish_nozero(
+        net_checksum_add_iov(sg, num, start, size - start, 0)));
+
+    out_num = iov_copy(out, ARRAY_SIZE(out) - 1, sg, num, 0, off);
+    out[out_num].iov_base = &csum;
+    out[out_num].iov_len = sizeof(csum);
+    out_num++;
+    out_num += iov_copy(out + out_num, ARRAY_SIZE(out) - out_num, sg, num,
+                        off + sizeof(csum), -1);
+
+    qemu_sendv_packet(nc, out, out_num);
+}
+
+/*
+ * Segment a TSO packet in software, the way the emulated NICs built on
+ * net_tx_pkt do.  The headers of the segments are built in buffers of
+ * the NetTxPkt; the payload is sent straight from guest memory.
+ */
+static void virtio_net_tx_sw_gso(VirtIONetQueue *q, NetClientState *nc,
+                                 const struct virtio_net_hdr *hdr,
+                                 const struct iovec *sg, unsigned num)
+{
+    VirtIODevice *vdev = VIRTIO_DEVICE(q->n);
+    unsigned i;
+
+    for (i = 0; i < num; i++) {
+        if (!net_tx_pkt_add_raw_fragment(q->tx_pkt, sg[i].iov_base,
+                                         sg[i].iov_len)) {
+            goto out;
+        }
+    }
+
+    if (net_tx_pkt_parse(q->tx_pkt) &&
+        net_tx_pkt_build_vheader(q->tx_pkt, true, true,
+                                 virtio_tswap16(vdev, hdr->gso_size))) {
+        net_tx_pkt_send(q->tx_pkt, nc);
+    }
+
+out:
+    net_tx_pkt_reset(q->tx_pkt, virtio_net_tx_pkt_free_frag, NULL);
+}
+
 static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
 {
     VirtIONet *n = q->n;
     VirtIODevice *vdev = VIRTIO_DEVICE(n);
     VirtQueueElement *elem;
+    VirtQueueElement *elems[VIRTQUEUE_POP_BATCH_SIZE];
+    unsigned int num_elems = 0, next_elem = 0;
     int32_t num_packets = 0;
     int queue_index = vq2q(virtio_get_queue_index(q->tx_vq));
     if (!(vdev->status & VIRTIO_CONFIG_S_DRIVER_OK)) {
@@ -2676,29 +3037,41 @@ static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
         struct iovec sg[VIRTQUEUE_MAX_SIZE], sg2[VIRTQUEUE_MAX_SIZE + 1], *out_sg;
         struct virtio_net_hdr_mrg_rxbuf mhdr;
 
-        elem = virtqueue_pop(q->tx_vq, sizeof(VirtQueueElement));
-        if (!elem) {
-            break;
+        if (next_elem == num_elems) {
+            /* Never pop more than what the remaining burst can send */
+            num_elems = virtqueue_pop_batch(q->tx_vq, sizeof(VirtQueueElement),
+                                            (void **)elems,
+                                            MIN(ARRAY_SIZE(elems),
+                                                n->tx_burst - num_packets));
+            next_elem = 0;
+            if (!num_elems) {
+                break;
+            }
         }
+        elem = elems[next_elem++];
 
         out_num = elem->out_num;
         out_sg = elem->out_sg;
         if (out_num < 1) {
             virtio_error(vdev, "virtio-net header not in first element");
+            virtqueue_unpop_batch(q->tx_vq, (void **)elems + next_elem,
+                                  num_elems - next_elem);
             virtqueue_detach_element(q->tx_vq, elem, 0);
             g_free(elem);
             return -EINVAL;
         }
 
-        if (n->has_vnet_hdr) {
+        if (n->has_vnet_hdr || q->tx_pkt) {
             if (iov_to_buf(out_sg, out_num, 0, &mhdr, n->guest_hdr_len) <
                 n->guest_hdr_len) {
                 virtio_error(vdev, "virtio-net header incorrect");
+                virtqueue_unpop_batch(q->tx_vq, (void **)elems + next_elem,
+                                      num_elems - next_elem);
                 virtqueue_detach_element(q->tx_vq, elem, 0);
                 g_free(elem);
                 return -EINVAL;
             }
-            if (n->needs_vnet_hdr_swap) {
+            if (n->has_vnet_hdr && n->needs_vnet_hdr_swap) {
                 virtio_net_hdr_swap(vdev, (void *) &mhdr);
                 sg2[0].iov_base = &mhdr;
                 sg2[0].iov_len = n->guest_hdr_len;
@@ -2729,17 +3102,33 @@ static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
             out_sg = sg;
         }
 
+        if (!n->has_vnet_hdr && q->tx_pkt) {
+            NetClientState *nc = qemu_get_subqueue(n->nic, queue_index);
+
+            /* These are sent synchronously and dropped if the peer is busy */
+            if (mhdr.hdr.gso_type != VIRTIO_NET_HDR_GSO_NONE) {
+                virtio_net_tx_sw_gso(q, nc, &mhdr.hdr, out_sg, out_num);
+                goto drop;
+            }
+            if (mhdr.hdr.flags & VIRTIO_NET_HDR_F_NEEDS_CSUM) {
+                virtio_net_tx_sw_csum(nc, vdev, &mhdr.hdr, out_sg, out_num);
+                goto drop;
+            }
+        }
+
         ret = qemu_sendv_packet_async(qemu_get_subqueue(n->nic, queue_index),
                                       out_sg, out_num, virtio_net_tx_complete);
         if (ret == 0) {
             virtio_queue_set_notification(q->tx_vq, 0);
+            virtqueue_unpop_batch(q->tx_vq, (void **)elems + next_elem,
+                                  num_elems - next_elem);
             q->async_tx.elem = elem;
             return -EBUSY;
         }
 
 drop:
         virtqueue_push(q->tx_vq, elem, 0);
-        virtio_notify(vdev, q->tx_vq);
+        virtio_net_notify(q, q->tx_vq);
         g_free(elem);
 
         if (++num_packets >= n->tx_burst) {
@@ -2923,6 +3312,10 @@ static void virtio_net_add_queue(VirtIONet *n, int index)
                                                   &DEVICE(vdev)->mem_reentrancy_guard);
     }
 
+    if (n->tx_sw_offload) {
+        net_tx_pkt_init(&n->vqs[index].tx_pkt, VIRTQUEUE_MAX_SIZE);
+    }
+
     n->vqs[index].tx_waiting = 0;
     n->vqs[index].n = n;
 }
@@ -2944,9 +3337,320 @@ static void virtio_net_del_queue(VirtIONet *n, int index)
         q->tx_bh = NULL;
     }
     q->tx_waiting = 0;
+    if (q->tx_pkt) {
+        net_tx_pkt_uninit(q->tx_pkt);
+        q->tx_pkt = NULL;
+    }
     virtio_del_queue(vdev, index * 2 + 1);
 }
 
+/* Recreate the tx bottom half or timer of @q in @ctx, NULL for main loop */
+static void virtio_net_queue_set_tx_context(VirtIONetQueue *q,
+                                            AioContext *ctx)
+{
+    VirtIODevice *vdev = VIRTIO_DEVICE(q->n);
+
+    if (q->tx_timer) {
+        timer_free(q->tx_timer);
+        if (ctx) {
+            q->tx_timer = aio_timer_new(ctx, QEMU_CLOCK_VIRTUAL, SCALE_NS,
+                                        virtio_net_tx_timer, q);
+        } else {
+            q->tx_timer = timer_new_ns(QEMU_CLOCK_VIRTUAL,
+                                       virtio_net_tx_timer, q);
+        }
+        if (q->tx_waiting) {
+            timer_mod(q->tx_timer,
+                      qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) +
+                      q->n->tx_timeout);
+        }
+    } else {
+        qemu_bh_delete(q->tx_bh);
+        if (ctx) {
+            q->tx_bh = aio_bh_new_guarded(ctx, virtio_net_tx_bh, q,
+                                          &DEVICE(vdev)->mem_reentrancy_guard);
+        } else {
+            q->tx_bh = qemu_bh_new_guarded(virtio_net_tx_bh, q,
+                                           &DEVICE(vdev)->mem_reentrancy_guard);
+        }
+        if (q->tx_waiting) {
+            qemu_bh_schedule(q->tx_bh);
+        }
+    }
+}
+
+static bool virtio_net_queue_pair_wants_iothread(VirtIONet *n, int index,
+                                                 uint8_t status)
+{
+    NetClientState *peer = qemu_get_subqueue(n->nic, index)->peer;
+
+    if (!n->vqs[index].ctx || !n->ioeventfd_started || n->vhost_started ||
+        n->ctrl_in_progress) {
+        return false;
+    }
+
+    if ((!n->multiqueue && index != 0) || index >= n->curr_queue_pairs ||
+        !virtio_net_started(n, status)) {
+        return false;
+    }
+
+    /* Filters run in the main loop */
+    if (!qemu_net_client_can_set_aio_context(peer) ||
+        !QTAILQ_EMPTY(&peer->filters)) {
+        return false;
+    }
+
+    /* Software RSS and RSC move packets between queue pairs */
+    if ((n->rss_data.enabled && n->rss_data.enabled_software_rss) ||
+        n->rsc4_enabled || n->rsc6_enabled) {
+        return false;
+    }
+
+    return true;
+}
+
+static void virtio_net_dataplane_start_pair(VirtIONet *n, int index)
+{
+    VirtIONetQueue *q = &n->vqs[index];
+    EventNotifier *rx_notifier = virtio_queue_get_host_notifier(q->rx_vq);
+    EventNotifier *tx_notifier = virtio_queue_get_host_notifier(q->tx_vq);
+
+    trace_virtio_net_dataplane_start(n, index);
+
+    event_notifier_set_handler(rx_notifier, NULL);
+    event_notifier_set_handler(tx_notifier, NULL);
+
+    virtio_net_queue_set_tx_context(q, q->ctx);
+    qemu_net_client_set_aio_context(qemu_get_subqueue(n->nic, index)->peer,
+                                    q->ctx);
+    q->dataplane = true;
+
+    /* rx buffers are only refilled by the guest, polling would not help */
+    aio_context_acquire(q->ctx);
+    virtio_queue_aio_attach_host_notifier_no_poll(q->rx_vq, q->ctx);
+    virtio_queue_aio_attach_host_notifier(q->tx_vq, q->ctx);
+    aio_context_release(q->ctx);
+
+    /* Pick up requests that were made while the notifiers were moving */
+    event_notifier_set(rx_notifier);
+    event_notifier_set(tx_notifier);
+}
+
+/* Context: the queue pair's IOThread */
+static void virtio_net_dataplane_stop_pair_bh(void *opaque)
+{
+    VirtIONetQueue *q = opaque;
+    VirtIONet *n = q->n;
+
+    virtio_queue_aio_detach_host_notifier(q->rx_vq, q->ctx);
+    virtio_queue_aio_detach_host_notifier(q->tx_vq, q->ctx);
+    qemu_net_client_set_aio_context(qemu_get_subqueue(n->nic,
+                                                      q - n->vqs)->peer,
+                                    NULL);
+
+    if (q->tx_timer) {
+        timer_del(q->tx_timer);
+    } else {
+        qemu_bh_cancel(q->tx_bh);
+    }
+}
+
+static void virtio_net_dataplane_stop_pair(VirtIONet *n, int index)
+{
+    VirtIONetQueue *q = &n->vqs[index];
+    EventNotifier *rx_notifier = virtio_queue_get_host_notifier(q->rx_vq);
+    EventNotifier *tx_notifier = virtio_queue_get_host_notifier(q->tx_vq);
+
+    trace_virtio_net_dataplane_stop(n, index);
+
+    aio_wait_bh_oneshot(q->ctx, virtio_net_dataplane_stop_pair_bh, q);
+    q->dataplane = false;
+    virtio_net_queue_set_tx_context(q, NULL);
+
+    event_notifier_set_handler(rx_notifier, virtio_queue_host_notifier_read);
+    event_notifier_set_handler(tx_notifier, virtio_queue_host_notifier_read);
+    event_notifier_set(rx_notifier);
+    event_notifier_set(tx_notifier);
+}
+
+/*
+ * Move queue pairs between their iothread-vq-mapping IOThread and the main
+ * loop.  Queue pairs only leave the main loop while the device runs with
+ * ioeventfd and nothing else needs to see their packets from the main loop.
+ */
+static void virtio_net_dataplane_update(VirtIONet *n, uint8_t status)
+{
+    VirtIODevice *vdev = VIRTIO_DEVICE(n);
+    BusState *qbus = qdev_get_parent_bus(DEVICE(vdev));
+    VirtioBusClass *k = VIRTIO_BUS_GET_CLASS(qbus);
+    int nvqs = n->max_queue_pairs * 2 + 1;
+    int i, r;
+
+    if (!n->iothread_vq_mapping_list) {
+        return;
+    }
+
+    for (i = 0; i < n->max_queue_pairs; i++) {
+        bool wanted = virtio_net_queue_pair_wants_iothread(n, i, status);
+
+        if (n->vqs[i].dataplane == wanted) {
+            continue;
+        }
+
+        if (wanted) {
+            if (!n->dataplane_queue_pairs) {
+                r = k->set_guest_notifiers(qbus->parent, nvqs, true);
+                if (r < 0) {
+                    error_report("virtio-net: failed to set guest notifiers "
+                                 "(%d), queue pairs stay in the main loop",
+                                 -r);
+                    return;
+                }
+            }
+            n->dataplane_queue_pairs++;
+            virtio_net_dataplane_start_pair(n, i);
+        } else {
+            virtio_net_dataplane_stop_pair(n, i);
+            if (!--n->dataplane_queue_pairs) {
+                k->set_guest_notifiers(qbus->parent, nvqs, false);
+            }
+        }
+    }
+}
+
+static int virtio_net_start_ioeventfd(VirtIODevice *vdev)
+{
+    VirtIONet *n = VIRTIO_NET(vdev);
+    int r;
+
+    r = virtio_device_start_ioeventfd_impl(vdev);
+    if (r < 0) {
+        return r;
+    }
+
+    n->ioeventfd_started = true;
+    virtio_net_dataplane_update(n, vdev->status);
+    return 0;
+}
+
+static void virtio_net_stop_ioeventfd(VirtIODevice *vdev)
+{
+    VirtIONet *n = VIRTIO_NET(vdev);
+
+    n->ioeventfd_started = false;
+    virtio_net_dataplane_update(n, vdev->status);
+    virtio_device_stop_ioeventfd_impl(vdev);
+}
+
+static bool virtio_net_apply_vq_mapping(VirtIONet *n, Error **errp)
+{
+    VirtIODevice *vdev = VIRTIO_DEVICE(n);
+    BusState *qbus = qdev_get_parent_bus(DEVICE(vdev));
+    VirtioBusClass *k = VIRTIO_BUS_GET_CLASS(qbus);
+    IOThreadVirtQueueMappingList *list = n->iothread_vq_mapping_list;
+    IOThreadVirtQueueMappingList *node;
+    size_t num_iothreads = 0;
+    size_t cur_iothread = 0;
+    int i;
+
+    if (!k->set_guest_notifiers || !k->ioeventfd_assign ||
+        !virtio_device_ioeventfd_enabled(vdev)) {
+        error_setg(errp, "iothread-vq-mapping requires a transport with "
+                   "ioeventfd and guest notifier support");
+        return false;
+    }
+
+    if (!n->nic_conf.peers.queues) {
+        error_setg(errp, "iothread-vq-mapping requires a netdev");
+        return false;
+    }
+
+    for (i = 0; i < n->max_queue_pairs; i++) {
+        NetClientState *peer = n->nic_conf.peers.ncs[i];
+
+        if (get_vhost_net(peer)) {
+            error_setg(errp, "iothread-vq-mapping cannot be used with vhost");
+            return false;
+        }
+        if (!qemu_net_client_can_set_aio_context(peer)) {
+            error_setg(errp, "netdev '%s' does not support "
+                       "iothread-vq-mapping", peer->name);
+            return false;
+        }
+    }
+
+    for (node = list; node; node = node->next) {
+        num_iothreads++;
+    }
+
+    for (node = list; node; node = node->next) {
+        const char *name = node->value->iothread;
+        IOThreadVirtQueueMappingList *other;
+        IOThread *iothread;
+        AioContext *ctx;
+
+        iothread = iothread_by_id(name);
+        if (!iothread) {
+            error_setg(errp, "IOThread \"%s\" object does not exist", name);
+            return false;
+        }
+        ctx = iothread_get_aio_context(iothread);
+
+        for (other = list; other != node; other = other->next) {
+            if (!strcmp(other->value->iothread, name)) {
+                error_setg(errp, "duplicate IOThread name \"%s\" in "
+                           "iothread-vq-mapping", name);
+                return false;
+            }
+        }
+
+        if (!node->value->vqs != !list->value->vqs) {
+            error_setg(errp, "either all items in iothread-vq-mapping "
+                             "must have vqs or none of them must have it");
+            return false;
+        }
+
+        if (node->value->vqs) {
+            uint16List *vq;
+
+            for (vq = node->value->vqs; vq; vq = vq->next) {
+                if (vq->value >= n->max_queue_pairs) {
+                    error_setg(errp, "queue pair index %u for IOThread "
+                               "\"%s\" must be less than the number of "
+                               "queue pairs %u in iothread-vq-mapping",
+                               vq->value, name, n->max_queue_pairs);
+                    return false;
+                }
+
+                if (n->vqs[vq->value].ctx) {
+                    error_setg(errp, "cannot assign queue pair %u to "
+                               "IOThread \"%s\" because it is already "
+                               "assigned", vq->value, name);
+                    return false;
+                }
+
+                n->vqs[vq->value].ctx = ctx;
+            }
+        } else {
+            /* Round-robin assignment */
+            for (i = cur_iothread; i < n->max_queue_pairs;
+                 i += num_iothreads) {
+                n->vqs[i].ctx = ctx;
+            }
+        }
+
+        cur_iothread++;
+    }
+
+    for (node = list; node; node = node->next) {
+        object_ref(OBJECT(iothread_by_id(node->value->iothread)));
+    }
+
+    /* Guest notifiers of these queue pairs are consumed by the transport */
+    vdev->use_guest_notifier_mask = false;
+    return true;
+}
+
 static void virtio_net_change_num_queue_pairs(VirtIONet *n, int new_max_queue_pairs)
 {
     VirtIODevice *vdev = VIRTIO_DEVICE(n);
@@ -3052,6 +3756,10 @@ static int virtio_net_post_load_device(void *opaque, int version_id)
         }
     }
 
+    if (n->rx_coal_usecs || n->tx_coal_usecs) {
+        virtio_net_apply_coalescing(n);
+    }
+
     if (n->rss_data.enabled) {
         n->rss_data.enabled_software_rss = n->rss_data.populate_hash;
         if (!n->rss_data.populate_hash) {
@@ -3249,6 +3957,27 @@ static const VMStateDescription vmstate_virtio_net_has_vnet = {
     },
 };
 
+static bool virtio_net_coal_needed(void *opaque)
+{
+    VirtIONet *n = VIRTIO_NET(opaque);
+
+    return n->rx_coal_usecs || n->tx_coal_usecs;
+}
+
+static const VMStateDescription vmstate_virtio_net_coal = {
+    .name      = "virtio-net-device/coal",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .needed = virtio_net_coal_needed,
+    .fields = (VMStateField[]) {
+        VMSTATE_UINT32(rx_coal_max_packets, VirtIONet),
+        VMSTATE_UINT32(rx_coal_usecs, VirtIONet),
+        VMSTATE_UINT32(tx_coal_max_packets, VirtIONet),
+        VMSTATE_UINT32(tx_coal_usecs, VirtIONet),
+        VMSTATE_END_OF_LIST()
+    },
+};
+
 static bool virtio_net_rss_needed(void *opaque)
 {
     return VIRTIO_NET(opaque)->rss_data.enabled;
@@ -3327,6 +4056,7 @@ static const VMStateDescription vmstate_virtio_net_device = {
    },
     .subsections = (const VMStateDescription * []) {
         &vmstate_virtio_net_rss,
+        &vmstate_virtio_net_coal,
         NULL
     }
 };
@@ -3339,13 +4069,25 @@ static NetClientInfo net_virtio_info = {
     .link_status_changed = virtio_net_set_link_status,
     .query_rx_filter = virtio_net_query_rxfilter,
     .announce = virtio_net_announce,
+    .rx_zerocopy_begin = virtio_net_rx_zerocopy_begin,
+    .rx_zerocopy_end = virtio_net_rx_zerocopy_end,
+    .receive_batch = virtio_net_receive_batch,
+    .set_steering_program = virtio_net_set_steering_program,
 };
 
 static bool virtio_net_guest_notifier_pending(VirtIODevice *vdev, int idx)
 {
     VirtIONet *n = VIRTIO_NET(vdev);
     NetClientState *nc;
-    assert(n->vhost_started);
+
+    if (!n->vhost_started) {
+        /* Guest notifiers are in use for queue pairs run in IOThreads */
+        EventNotifier *notifier = idx == VIRTIO_CONFIG_IRQ_IDX ?
+            virtio_config_get_guest_notifier(vdev) :
+            virtio_queue_get_guest_notifier(virtio_get_queue(vdev, idx));
+
+        return event_notifier_test_and_clear(notifier);
+    }
     if (!virtio_vdev_has_feature(vdev, VIRTIO_NET_F_MQ) && idx == 2) {
         /* Must guard against invalid features and bogus queue index
          * from being set by malicious guest, or penetrated through
@@ -3663,6 +4405,15 @@ static void virtio_net_device_realize(DeviceState *dev, Error **errp)
         return;
     }
     n->vqs = g_new0(VirtIONetQueue, n->max_queue_pairs);
+
+    if (n->iothread_vq_mapping_list &&
+        !virtio_net_apply_vq_mapping(n, errp)) {
+        g_free(n->vqs);
+        n->vqs = NULL;
+        virtio_cleanup(vdev);
+        return;
+    }
+
     n->curr_queue_pairs = 1;
     n->tx_timeout = n->net_conf.txtimer;
 
@@ -3754,6 +4505,10 @@ static void virtio_net_device_unrealize(DeviceState *dev)
     if (virtio_has_feature(n->host_features, VIRTIO_NET_F_RSS)) {
         virtio_net_unload_ebpf(n);
     }
+    if (n->steering_prog_fd >= 0) {
+        close(n->steering_prog_fd);
+        n->steering_prog_fd = -1;
+    }
 
     /* This will stop vhost backend if appropriate. */
     virtio_net_set_status(vdev, 0);
@@ -3766,6 +4521,14 @@ static void virtio_net_device_unrealize(DeviceState *dev)
     g_free(n->mac_table.macs);
     g_free(n->vlans);
 
+    if (n->iothread_vq_mapping_list) {
+        IOThreadVirtQueueMappingList *node;
+
+        for (node = n->iothread_vq_mapping_list; node; node = node->next) {
+            object_unref(OBJECT(iothread_by_id(node->value->iothread)));
+        }
+    }
+
     if (n->failover) {
         qobject_unref(n->primary_opts);
         device_listener_unregister(&n->primary_listener);
@@ -3803,6 +4566,7 @@ static void virtio_net_instance_init(Object *obj)
                                   DEVICE(n));
 
     ebpf_rss_init(&n->ebpf_rss);
+    n->steering_prog_fd = -1;
 }
 
 static int virtio_net_pre_save(void *opaque)
@@ -3905,6 +4669,9 @@ static Property virtio_net_properties[] = {
                     VIRTIO_NET_F_HASH_REPORT, false),
     DEFINE_PROP_BIT64("guest_rsc_ext", VirtIONet, host_features,
                     VIRTIO_NET_F_RSC_EXT, false),
+    DEFINE_PROP_BIT64("notf_coal", VirtIONet, host_features,
+                    VIRTIO_NET_F_NOTF_COAL, false),
+    DEFINE_PROP_BOOL("x-notf-coal-adaptive", VirtIONet, coal_adaptive, false),
     DEFINE_PROP_UINT32("rsc_interval", VirtIONet, rsc_timeout,
                        VIRTIO_NET_RSC_DEFAULT_INTERVAL),
     DEFINE_NIC_PROPERTIES(VirtIONet, nic_conf),
@@ -3919,6 +4686,10 @@ static Property virtio_net_properties[] = {
     DEFINE_PROP_UINT16("host_mtu", VirtIONet, net_conf.mtu, 0),
     DEFINE_PROP_BOOL("x-mtu-bypass-backend", VirtIONet, mtu_bypass_backend,
                      true),
+    DEFINE_PROP_BOOL("x-rx-zerocopy", VirtIONet, rx_zerocopy, false),
+    DEFINE_PROP_BOOL("x-tx-sw-offload", VirtIONet, tx_sw_offload, false),
+    DEFINE_PROP_IOTHREAD_VQ_MAPPING_LIST("iothread-vq-mapping", VirtIONet,
+                                         iothread_vq_mapping_list),
     DEFINE_PROP_INT32("speed", VirtIONet, net_conf.speed, SPEED_UNKNOWN),
     DEFINE_PROP_STRING("duplex", VirtIONet, net_conf.duplex_str),
     DEFINE_PROP_BOOL("failover", VirtIONet, failover, false),
@@ -3944,6 +4715,8 @@ static void virtio_net_class_init(ObjectClass *klass, void *data)
     vdc->queue_reset = virtio_net_queue_reset;
     vdc->queue_enable = virtio_net_queue_enable;
     vdc->set_status = virtio_net_set_status;
+    vdc->start_ioeventfd = virtio_net_start_ioeventfd;
+    vdc->stop_ioeventfd = virtio_net_stop_ioeventfd;
     vdc->guest_notifier_mask = virtio_net_guest_notifier_mask;
     vdc->guest_notifier_pending = virtio_net_guest_notifier_pending;
     vdc->legacy_features |= (0x1 << VIRTIO_NET_F_GSO);
@@ -40,6 +40,8 @@
  *              sriov_vi_flexible=<N[optional]> \
  *              sriov_max_vi_per_vf=<N[optional]> \
  *              sriov_max_vq_per_vf=<N[optional]> \
+ *              ioeventfd=<on|off[optional]>, \
+ *              iothread=<iothread_id[optional]> \
  *              subsys=<subsys_id>
  *      -device nvme-ns,drive=<drive_id>,bus=<bus_name>,nsid=<nsid>,\
  *              zoned=<true|false[optional]>, \
@@ -203,6 +205,7 @@
 #include "sysemu/hostmem.h"
 #include "hw/pci/msix.h"
 #include "hw/pci/pcie_sriov.h"
+#include "block/aio-wait.h"
 #include "migration/vmstate.h"
 
 #include "nvme.h"
@@ -581,6 +584,12 @@ static int nvme_addr_read(NvmeCtrl *n, hwaddr addr, void *buf, int size)
         return 0;
     }
 
+    if (n->dma_cache) {
+        return dma_translation_cache_rw(n->dma_cache, addr, buf, size,
+                                        DMA_DIRECTION_TO_DEVICE,
+                                        MEMTXATTRS_UNSPECIFIED);
+    }
+
     return pci_dma_read(PCI_DEVICE(n), addr, buf, size);
 }
 
@@ -601,6 +610,12 @@ static int nvme_addr_write(NvmeCtrl *n, hwaddr addr, const void *buf, int size)
         return 0;
     }
 
+    if (n->dma_cache) {
+        return dma_translation_cache_rw(n->dma_cache, addr, (void *)buf, size,
+                                        DMA_DIRECTION_FROM_DEVICE,
+                                        MEMTXATTRS_UNSPECIFIED);
+    }
+
     return pci_dma_write(PCI_DEVICE(n), addr, buf, size);
 }
 
@@ -639,6 +654,11 @@ static uint8_t nvme_cq_full(NvmeCQueue *cq)
     return (cq->tail + 1) % cq->size == cq->head;
 }
 
+static uint32_t nvme_cq_free(NvmeCQueue *cq)
+{
+    return (cq->head + cq->size - cq->tail - 1) % cq->size;
+}
+
 static uint8_t nvme_sq_empty(NvmeSQueue *sq)
 {
     return sq->head == sq->tail;
@@ -854,6 +874,20 @@ static uint16_t nvme_map_addr(NvmeCtrl *n, NvmeSg *sg, hwaddr addr, size_t len)
         return NVME_INVALID_USE_OF_CMB | NVME_DNR;
     }
 
+    /*
+     * PRP lists usually describe physically contiguous pages; coalesce them
+     * so that the DMA helpers map one larger region instead of many pages.
+     */
+    if (sg->qsg.nsg) {
+        ScatterGatherEntry *last = &sg->qsg.sg[sg->qsg.nsg - 1];
+
+        if (last->base + last->len == addr) {
+            last->len += len;
+            sg->qsg.size += len;
+            return NVME_SUCCESS;
+        }
+    }
+
     if (sg->qsg.nsg + 1 > IOV_MAX) {
         goto max_mappings_exceeded;
     }
@@ -1482,19 +1516,63 @@ static void nvme_update_cq_head(NvmeCQueue *cq)
     trace_pci_nvme_update_cq_head(cq->cqid, cq->head);
 }
 
+/* Maximum number of completion queue entries written with a single DMA */
+#define NVME_CQE_BATCH 32
+
+/*
+ * Write 'count' completions to consecutive entries starting at the current
+ * tail, which must not wrap around the end of the queue, and hand the
+ * requests back to their submission queues.
+ */
+static int nvme_post_cqe_batch(NvmeCtrl *n, NvmeCQueue *cq,
+                               NvmeRequest **reqs, NvmeCqe *cqes, int count)
+{
+    hwaddr addr = cq->dma_addr + (cq->tail << NVME_CQES);
+    int i, ret;
+
+    ret = nvme_addr_write(n, addr, cqes, count * sizeof(NvmeCqe));
+    if (ret) {
+        trace_pci_nvme_err_addr_write(addr);
+        trace_pci_nvme_err_cfs();
+        stl_le_p(&n->bar.csts, NVME_CSTS_FAILED);
+        return ret;
+    }
+
+    for (i = 0; i < count; i++) {
+        NvmeRequest *req = reqs[i];
+
+        QTAILQ_REMOVE(&cq->req_list, req, entry);
+        nvme_inc_cq_tail(cq);
+        nvme_sg_unmap(&req->sg);
+        QTAILQ_INSERT_TAIL(&req->sq->req_list, req, entry);
+    }
+
+    return 0;
+}
+
 static void nvme_post_cqes(void *opaque)
 {
     NvmeCQueue *cq = opaque;
     NvmeCtrl *n = cq->ctrl;
-    NvmeRequest *req, *next;
+    NvmeRequest *reqs[NVME_CQE_BATCH];
+    NvmeCqe cqes[NVME_CQE_BATCH];
+    NvmeRequest *req;
     bool pending = cq->head != cq->tail;
-    int ret;
 
-    QTAILQ_FOREACH_SAFE(req, &cq->req_list, entry, next) {
-        NvmeSQueue *sq;
-        hwaddr addr;
+    /*
+     * With shadow doorbells, read the head once for the whole batch and only
+     * look again if the queue appears to be full.
+     */
+    if (n->dbbuf_enabled) {
+        nvme_update_cq_eventidx(cq);
+        nvme_update_cq_head(cq);
+    }
 
-        if (n->dbbuf_enabled) {
+    while (!QTAILQ_EMPTY(&cq->req_list)) {
+        uint32_t avail;
+        int count = 0;
+
+        if (nvme_cq_full(cq) && n->dbbuf_enabled) {
             nvme_update_cq_eventidx(cq);
             nvme_update_cq_head(cq);
         }
@@ -1503,24 +1581,29 @@ static void nvme_post_cqes(void *opaque)
             break;
         }
 
-        sq = req->sq;
-        req->cqe.status = cpu_to_le16((req->status << 1) | cq->phase);
-        req->cqe.sq_id = cpu_to_le16(sq->sqid);
-        req->cqe.sq_head = cpu_to_le16(sq->head);
-        addr = cq->dma_addr + (cq->tail << NVME_CQES);
-        ret = pci_dma_write(PCI_DEVICE(n), addr, (void *)&req->cqe,
-                            sizeof(req->cqe));
-        if (ret) {
-            trace_pci_nvme_err_addr_write(addr);
-            trace_pci_nvme_err_cfs();
-            stl_le_p(&n->bar.csts, NVME_CSTS_FAILED);
+        /* entries up to the end of the queue share the same phase tag */
+        avail = MIN(nvme_cq_free(cq), cq->size - cq->tail);
+        avail = MIN(avail, NVME_CQE_BATCH);
+
+        QTAILQ_FOREACH(req, &cq->req_list, entry) {
+            NvmeSQueue *sq = req->sq;
+
+            req->cqe.status = cpu_to_le16((req->status << 1) | cq->phase);
+            req->cqe.sq_id = cpu_to_le16(sq->sqid);
+            req->cqe.sq_head = cpu_to_le16(sq->head);
+            cqes[count] = req->cqe;
+            reqs[count] = req;
+
+            if (++count == avail) {
+                break;
+            }
+        }
+
+        if (nvme_post_cqe_batch(n, cq, reqs, cqes, count)) {
             break;
         }
-        QTAILQ_REMOVE(&cq->req_list, req, entry);
-        nvme_inc_cq_tail(cq);
-        nvme_sg_unmap(&req->sg);
-        QTAILQ_INSERT_TAIL(&sq->req_list, req, entry);
     }
+
     if (cq->tail != cq->head) {
         if (cq->irq_enabled && !pending) {
             n->cq_pending++;
@@ -4543,6 +4626,88 @@ static void nvme_sq_notifier(EventNotifier *e)
     nvme_process_sq(sq);
 }
 
+/*
+ * With an iothread, the I/O submission queue doorbells (both the ioeventfd
+ * and the shadow doorbell in guest memory) are watched from the iothread,
+ * which polls the shadow doorbell while the AioContext is busy polling.
+ * While polling, the eventidx is left behind the tail so that the guest
+ * does not ring the MMIO doorbell at all.  Commands are still processed by
+ * sq->bh in the main loop.
+ */
+static uint32_t nvme_sq_read_shadow_tail(NvmeSQueue *sq)
+{
+    uint32_t tail = 0;
+
+    ldl_le_pci_dma(PCI_DEVICE(sq->ctrl), sq->db_addr, &tail,
+                   MEMTXATTRS_UNSPECIFIED);
+    return tail;
+}
+
+static void nvme_sq_kick(NvmeSQueue *sq, uint32_t tail)
+{
+    sq->poll_tail = tail;
+    qemu_bh_schedule(sq->bh);
+}
+
+static void nvme_sq_iothread_notifier(EventNotifier *e)
+{
+    NvmeSQueue *sq = container_of(e, NvmeSQueue, notifier);
+
+    if (!event_notifier_test_and_clear(e)) {
+        return;
+    }
+
+    nvme_sq_kick(sq, nvme_sq_read_shadow_tail(sq));
+}
+
+static bool nvme_sq_poll(void *opaque)
+{
+    EventNotifier *e = opaque;
+    NvmeSQueue *sq = container_of(e, NvmeSQueue, notifier);
+
+    return nvme_sq_read_shadow_tail(sq) != sq->poll_tail;
+}
+
+static void nvme_sq_poll_ready(EventNotifier *e)
+{
+    NvmeSQueue *sq = container_of(e, NvmeSQueue, notifier);
+
+    event_notifier_test_and_clear(e);
+    nvme_sq_kick(sq, nvme_sq_read_shadow_tail(sq));
+}
+
+static void nvme_sq_poll_begin(EventNotifier *e)
+{
+    NvmeSQueue *sq = container_of(e, NvmeSQueue, notifier);
+    uint32_t tail = nvme_sq_read_shadow_tail(sq);
+
+    qatomic_set(&sq->polling, true);
+    smp_mb();
+
+    /* an eventidx just behind the tail never triggers a doorbell write */
+    stl_le_pci_dma(PCI_DEVICE(sq->ctrl), sq->ei_addr,
+                   (tail ? tail : sq->size) - 1, MEMTXATTRS_UNSPECIFIED);
+}
+
+static void nvme_sq_poll_end(EventNotifier *e)
+{
+    NvmeSQueue *sq = container_of(e, NvmeSQueue, notifier);
+    uint32_t tail = nvme_sq_read_shadow_tail(sq);
+
+    qatomic_set(&sq->polling, false);
+    smp_mb();
+
+    stl_le_pci_dma(PCI_DEVICE(sq->ctrl), sq->ei_addr, tail,
+                   MEMTXATTRS_UNSPECIFIED);
+    smp_mb();
+
+    /* catch submissions made while doorbells were suppressed */
+    tail = nvme_sq_read_shadow_tail(sq);
+    if (tail != sq->poll_tail) {
+        nvme_sq_kick(sq, tail);
+    }
+}
+
 static int nvme_init_sq_ioeventfd(NvmeSQueue *sq)
 {
     NvmeCtrl *n = sq->ctrl;
@@ -4554,25 +4719,48 @@ static int nvme_init_sq_ioeventfd(NvmeSQueue *sq)
         return ret;
     }
 
-    event_notifier_set_handler(&sq->notifier, nvme_sq_notifier);
+    if (n->iothread) {
+        AioContext *ctx = iothread_get_aio_context(n->iothread);
+
+        sq->polling = false;
+        sq->poll_tail = sq->tail;
+        aio_set_event_notifier(ctx, &sq->notifier, nvme_sq_iothread_notifier,
+                               nvme_sq_poll, nvme_sq_poll_ready);
+        aio_set_event_notifier_poll(ctx, &sq->notifier,
+                                    nvme_sq_poll_begin, nvme_sq_poll_end);
+    } else {
+        event_notifier_set_handler(&sq->notifier, nvme_sq_notifier);
+    }
     memory_region_add_eventfd(&n->iomem,
                               0x1000 + offset, 4, false, 0, &sq->notifier);
 
     return 0;
 }
 
+static void nvme_sq_iothread_sync(void *opaque)
+{
+    /* nothing, just wait for the iothread to leave the sq handlers */
+}
+
 static void nvme_free_sq(NvmeSQueue *sq, NvmeCtrl *n)
 {
     uint16_t offset = sq->sqid << 3;
 
     n->sq[sq->sqid] = NULL;
-    qemu_bh_delete(sq->bh);
     if (sq->ioeventfd_enabled) {
         memory_region_del_eventfd(&n->iomem,
                                   0x1000 + offset, 4, false, 0, &sq->notifier);
-        event_notifier_set_handler(&sq->notifier, NULL);
+        if (n->iothread) {
+            AioContext *ctx = iothread_get_aio_context(n->iothread);
+
+            aio_set_event_notifier(ctx, &sq->notifier, NULL, NULL, NULL);
+            aio_wait_bh_oneshot(ctx, nvme_sq_iothread_sync, NULL);
+        } else {
+            event_notifier_set_handler(&sq->notifier, NULL);
+        }
         event_notifier_cleanup(&sq->notifier);
     }
+    qemu_bh_delete(sq->bh);
     g_free(sq->io_req);
     if (sq->sqid) {
         g_free(sq);
@@ -6984,6 +7172,11 @@ static uint16_t nvme_admin_cmd(NvmeCtrl *n, NvmeRequest *req)
 
 static void nvme_update_sq_eventidx(const NvmeSQueue *sq)
 {
+    /* the iothread is polling the shadow doorbell, keep doorbells off */
+    if (qatomic_read(&sq->polling)) {
+        return;
+    }
+
     trace_pci_nvme_update_sq_eventidx(sq->sqid, sq->tail);
 
     stl_le_pci_dma(PCI_DEVICE(sq->ctrl), sq->ei_addr, sq->tail,
@@ -7785,6 +7978,11 @@ static bool nvme_check_params(NvmeCtrl *n, Error **errp)
         return false;
     }
 
+    if (n->iothread && !params->ioeventfd) {
+        error_setg(errp, "iothread requires ioeventfd=on");
+        return false;
+    }
+
     if (params->max_ioqpairs < 1 ||
         params->max_ioqpairs > NVME_MAX_IOQPAIRS) {
         error_setg(errp, "max_ioqpairs must be between 1 and %d",
@@ -8320,6 +8518,7 @@ static void nvme_realize(PCIDevice *pci_dev, Error **errp)
          */
         memcpy(&n->params, &pn->params, sizeof(NvmeParams));
         n->subsys = pn->subsys;
+        n->iothread = pn->iothread;
     }
 
     if (!nvme_check_params(n, errp)) {
@@ -8348,6 +8547,8 @@ static void nvme_realize(PCIDevice *pci_dev, Error **errp)
 
         nvme_attach_ns(n, ns);
     }
+
+    n->dma_cache = dma_translation_cache_new(pci_get_address_space(pci_dev));
 }
 
 static void nvme_exit(PCIDevice *pci_dev)
@@ -8369,6 +8570,7 @@ static void nvme_exit(PCIDevice *pci_dev)
         nvme_subsys_unregister_ctrl(n->subsys, n);
     }
 
+    dma_translation_cache_free(n->dma_cache);
     g_free(n->cq);
     g_free(n->sq);
     g_free(n->aer_reqs);
@@ -8407,6 +8609,8 @@ static Property nvme_props[] = {
     DEFINE_PROP_BOOL("use-intel-id", NvmeCtrl, params.use_intel_id, false),
     DEFINE_PROP_BOOL("legacy-cmb", NvmeCtrl, params.legacy_cmb, false),
     DEFINE_PROP_BOOL("ioeventfd", NvmeCtrl, params.ioeventfd, false),
+    DEFINE_PROP_LINK("iothread", NvmeCtrl, iothread, TYPE_IOTHREAD,
+                     IOThread *),
     DEFINE_PROP_UINT8("zoned.zasl", NvmeCtrl, params.zasl, 0),
     DEFINE_PROP_BOOL("zoned.auto_transition", NvmeCtrl,
                      params.auto_transition_zones, true),
@@ -21,6 +21,7 @@
 #include "qemu/uuid.h"
 #include "hw/pci/pci_device.h"
 #include "hw/block/block.h"
+#include "sysemu/iothread.h"
 
 #include "block/nvme.h"
 
@@ -473,6 +474,8 @@ typedef struct NvmeSQueue {
     QEMUBH      *bh;
     EventNotifier notifier;
     bool        ioeventfd_enabled;
+    bool        polling;    /* eventidx suppressed by the iothread, atomic */
+    uint32_t    poll_tail;  /* last shadow tail seen by the iothread */
     NvmeRequest *io_req;
     QTAILQ_HEAD(, NvmeRequest) req_list;
     QTAILQ_HEAD(, NvmeRequest) out_req_list;
@@ -551,6 +554,8 @@ typedef struct NvmeCtrl {
     uint64_t    dbbuf_dbs;
     uint64_t    dbbuf_eis;
     bool        dbbuf_enabled;
+    DMATranslationCache *dma_cache;
+    IOThread    *iothread;      /* polls I/O submission queue doorbells */
 
     struct {
         MemoryRegion mem;
@@ -38,6 +38,7 @@
 #include "qemu/option.h"
 #include "qemu/config-file.h"
 #include "qemu/cutils.h"
+#include "qemu/units.h"
 #include "qapi/error.h"
 #include "hw/acpi/aml-build.h"
 #include "hw/pci/pci_bus.h"
@@ -58,6 +59,9 @@
 
 #define FW_CFG_DMA_SIGNATURE 0x51454d5520434647ULL /* "QEMU CFG" */
 
+/* Smallest DMA read of a file-backed item that is mapped, not copied */
+#define FW_CFG_DMA_MAP_MIN (1 * MiB)
+
 struct FWCfgEntry {
     uint32_t len;
     bool allow_write;
@@ -65,6 +69,10 @@ struct FWCfgEntry {
     void *callback_opaque;
     FWCfgCallback select_cb;
     FWCfgWriteCallback write_cb;
+    /* If set, @data is the contents of @fd starting at @fd_offset */
+    bool has_fd;
+    int fd;
+    off_t fd_offset;
 };
 
 /**
@@ -331,6 +339,66 @@ static void fw_cfg_data_mem_write(void *opaque, hwaddr addr,
     } while (i);
 }
 
+/*
+ * Read @len bytes of @e at the current offset into guest memory.  If the
+ * item is backed by a file and the destination is private guest RAM with
+ * the same alignment within a host page, the host pages that the read
+ * fully covers are mapped copy-on-write from the file instead of copied,
+ * so that they are only read from the file (or page cache) on access.
+ */
+static MemTxResult fw_cfg_dma_read_entry(FWCfgState *s, FWCfgEntry *e,
+                                         dma_addr_t addr, dma_addr_t len)
+{
+    size_t hps = qemu_real_host_page_size();
+    off_t file_offset = e->fd_offset + s->cur_offset;
+    uint8_t *data = &e->data[s->cur_offset];
+    hwaddr xlat, plen = len;
+    ram_addr_t offset, start, end;
+    MemoryRegion *mr;
+    RAMBlock *block;
+    MemTxResult res;
+
+    if (!e->has_fd || len < FW_CFG_DMA_MAP_MIN) {
+        goto copy;
+    }
+
+    WITH_RCU_READ_LOCK_GUARD() {
+        mr = address_space_translate(s->dma_as, addr, &xlat, &plen, true,
+                                     MEMTXATTRS_UNSPECIFIED);
+        if (plen < len || !memory_region_is_ram(mr) ||
+            memory_region_is_rom(mr)) {
+            goto copy;
+        }
+        block = qemu_ram_block_from_host(memory_region_get_ram_ptr(mr) + xlat,
+                                         false, &offset);
+        if (!block || !qemu_ram_can_map_file_private(block) ||
+            offset % hps != file_offset % hps) {
+            goto copy;
+        }
+
+        start = ROUND_UP(offset, hps);
+        end = ROUND_DOWN(offset + len, hps);
+        if (qemu_ram_map_file_private(block, start, end - start, e->fd,
+                                      file_offset + (start - offset)) < 0) {
+            goto copy;
+        }
+    }
+    trace_fw_cfg_dma_map_file(s, s->cur_entry, addr + (start - offset),
+                              end - start);
+
+    /* Copy the partial host pages at either end */
+    res = dma_memory_write(s->dma_as, addr, data, start - offset,
+                           MEMTXATTRS_UNSPECIFIED);
+    res |= dma_memory_write(s->dma_as, addr + (end - offset),
+                            data + (end - offset), offset + len - end,
+                            MEMTXATTRS_UNSPECIFIED);
+    return res;
+
+copy:
+    return dma_memory_write(s->dma_as, addr, data, len,
+                            MEMTXATTRS_UNSPECIFIED);
+}
+
 static void fw_cfg_dma_transfer(FWCfgState *s)
 {
     dma_addr_t len;
@@ -406,9 +474,7 @@ static void fw_cfg_dma_transfer(FWCfgState *s)
              * tested before.
              */
             if (read) {
-                if (dma_memory_write(s->dma_as, dma.address,
-                                     &e->data[s->cur_offset], len,
-                                     MEMTXATTRS_UNSPECIFIED)) {
+                if (fw_cfg_dma_read_entry(s, e, dma.address, len)) {
                     dma.control |= FW_CFG_DMA_CTL_ERROR;
                 }
             }
@@ -731,6 +797,7 @@ static void *fw_cfg_modify_bytes_read(FWCfgState *s, uint16_t key,
     s->entries[arch][key].len = len;
     s->entries[arch][key].callback_opaque = NULL;
     s->entries[arch][key].allow_write = false;
+    s->entries[arch][key].has_fd = false;
 
     return ptr;
 }
@@ -741,6 +808,18 @@ void fw_cfg_add_bytes(FWCfgState *s, uint16_t key, void *data, size_t len)
     fw_cfg_add_bytes_callback(s, key, NULL, NULL, NULL, data, len, true);
 }
 
+void fw_cfg_add_bytes_from_fd(FWCfgState *s, uint16_t key, void *data,
+                              size_t len, int fd, off_t offset)
+{
+    int arch = !!(key & FW_CFG_ARCH_LOCAL);
+    FWCfgEntry *e = &s->entries[arch][key & FW_CFG_ENTRY_MASK];
+
+    fw_cfg_add_bytes(s, key, data, len);
+    e->has_fd = true;
+    e->fd = fd;
+    e->fd_offset = offset;
+}
+
 void fw_cfg_add_string(FWCfgState *s, uint16_t key, const char *value)
 {
     size_t sz = strlen(value) + 1;
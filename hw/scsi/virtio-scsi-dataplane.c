@@ -20,6 +20,94 @@
 #include "scsi/constants.h"
 #include "hw/virtio/virtio-bus.h"
 
+/*
+ * Fill in @vq_aio_context for the command virtqueues from the
+ * iothread-vq-mapping property, checking that every command virtqueue is
+ * assigned to exactly one IOThread.
+ *
+ * Context: QEMU global mutex held
+ */
+static bool virtio_scsi_apply_vq_mapping(IOThreadVirtQueueMappingList *list,
+                                         AioContext **vq_aio_context,
+                                         uint32_t num_queues, Error **errp)
+{
+    IOThreadVirtQueueMappingList *node;
+    size_t num_iothreads = 0;
+    size_t cur_iothread = 0;
+
+    for (node = list; node; node = node->next) {
+        num_iothreads++;
+    }
+
+    for (node = list; node; node = node->next) {
+        const char *name = node->value->iothread;
+        IOThreadVirtQueueMappingList *other;
+        IOThread *iothread;
+        AioContext *ctx;
+
+        iothread = iothread_by_id(name);
+        if (!iothread) {
+            error_setg(errp, "IOThread \"%s\" object does not exist", name);
+            return false;
+        }
+        ctx = iothread_get_aio_context(iothread);
+
+        for (other = list; other != node; other = other->next) {
+            if (!strcmp(other->value->iothread, name)) {
+                error_setg(errp, "duplicate IOThread name \"%s\" in "
+                           "iothread-vq-mapping", name);
+                return false;
+            }
+        }
+
+        if (!node->value->vqs != !list->value->vqs) {
+            error_setg(errp, "either all items in iothread-vq-mapping "
+                             "must have vqs or none of them must have it");
+            return false;
+        }
+
+        if (node->value->vqs) {
+            uint16List *vq;
+
+            for (vq = node->value->vqs; vq; vq = vq->next) {
+                if (vq->value >= num_queues) {
+                    error_setg(errp, "vq index %u for IOThread \"%s\" must "
+                               "be less than num_queues %u in "
+                               "iothread-vq-mapping", vq->value, name,
+                               num_queues);
+                    return false;
+                }
+
+                if (vq_aio_context[vq->value]) {
+                    error_setg(errp, "cannot assign vq %u to IOThread \"%s\" "
+                               "because it is already assigned", vq->value,
+                               name);
+                    return false;
+                }
+
+                vq_aio_context[vq->value] = ctx;
+            }
+        } else {
+            /* Round-robin assignment */
+            for (size_t i = cur_iothread; i < num_queues; i += num_iothreads) {
+                vq_aio_context[i] = ctx;
+            }
+        }
+
+        cur_iothread++;
+    }
+
+    for (uint32_t i = 0; i < num_queues; i++) {
+        if (!vq_aio_context[i]) {
+            error_setg(errp, "missing vq %u IOThread assignment in "
+                       "iothread-vq-mapping", i);
+            return false;
+        }
+    }
+
+    return true;
+}
+
 /* Context: QEMU global mutex held */
 void virtio_scsi_dataplane_setup(VirtIOSCSI *s, Error **errp)
 {
@@ -27,8 +115,18 @@ void virtio_scsi_dataplane_setup(VirtIOSCSI *s, Error **errp)
     VirtIODevice *vdev = VIRTIO_DEVICE(s);
     BusState *qbus = qdev_get_parent_bus(DEVICE(vdev));
     VirtioBusClass *k = VIRTIO_BUS_GET_CLASS(qbus);
+    IOThreadVirtQueueMappingList *list = vs->conf.iothread_vq_mapping_list;
+    uint32_t num_vqs = VIRTIO_SCSI_VQ_NUM_FIXED + vs->conf.num_queues;
+    uint32_t i;
+
+    if (vs->conf.iothread && list) {
+        error_setg(errp,
+                   "iothread and iothread-vq-mapping properties cannot be set "
+                   "at the same time");
+        return;
+    }
 
-    if (vs->conf.iothread) {
+    if (vs->conf.iothread || list) {
         if (!k->set_guest_notifiers || !k->ioeventfd_assign) {
             error_setg(errp,
                        "device is incompatible with iothread "
@@ -39,13 +137,63 @@ void virtio_scsi_dataplane_setup(VirtIOSCSI *s, Error **errp)
             error_setg(errp, "ioeventfd is required for iothread");
             return;
         }
-        s->ctx = iothread_get_aio_context(vs->conf.iothread);
-    } else {
-        if (!virtio_device_ioeventfd_enabled(vdev)) {
+    } else if (!virtio_device_ioeventfd_enabled(vdev)) {
+        return;
+    }
+
+    s->vq_aio_context = g_new0(AioContext *, num_vqs);
+
+    if (list) {
+        IOThreadVirtQueueMappingList *node;
+
+        /* vqs in the mapping are command virtqueue indices */
+        if (!virtio_scsi_apply_vq_mapping(list,
+                                          s->vq_aio_context +
+                                          VIRTIO_SCSI_VQ_NUM_FIXED,
+                                          vs->conf.num_queues, errp)) {
+            g_free(s->vq_aio_context);
+            s->vq_aio_context = NULL;
             return;
         }
+
+        for (node = list; node; node = node->next) {
+            object_ref(OBJECT(iothread_by_id(node->value->iothread)));
+        }
+
+        /*
+         * The BlockBackends of all LUNs, the control and the event virtqueue
+         * live in the IOThread of the first command virtqueue.  Command virtqueues in other IOThreads
+         * take its AioContext lock around request processing.
+         */
+        s->ctx = s->vq_aio_context[VIRTIO_SCSI_VQ_NUM_FIXED];
+    } else if (vs->conf.iothread) {
+        s->ctx = iothread_get_aio_context(vs->conf.iothread);
+    } else {
         s->ctx = qemu_get_aio_context();
     }
+
+    for (i = 0; i < num_vqs; i++) {
+        if (!s->vq_aio_context[i]) {
+            s->vq_aio_context[i] = s->ctx;
+        }
+    }
+}
+
+/* Context: QEMU global mutex held */
+void virtio_scsi_dataplane_cleanup(VirtIOSCSI *s)
+{
+    VirtIOSCSICommon *vs = VIRTIO_SCSI_COMMON(s);
+    IOThreadVirtQueueMappingList *node;
+
+    if (s->vq_aio_context && vs->conf.iothread_vq_mapping_list) {
+        for (node = vs->conf.iothread_vq_mapping_list; node;
+             node = node->next) {
+            object_unref(OBJECT(iothread_by_id(node->value->iothread)));
+        }
+    }
+
+    g_free(s->vq_aio_context);
+    s->vq_aio_context = NULL;
 }
 
 static int virtio_scsi_set_host_notifier(VirtIOSCSI *s, VirtQueue *vq, int n)
@@ -65,32 +213,19 @@ static int virtio_scsi_set_host_notifier(VirtIOSCSI *s, VirtQueue *vq, int n)
     return 0;
 }
 
-/* Context: BH in IOThread */
-static void virtio_scsi_dataplane_stop_bh(void *opaque)
+/* Context: BH in the IOThread that handles the virtqueue */
+static void virtio_scsi_dataplane_stop_vq_bh(void *opaque)
 {
-    VirtIOSCSI *s = opaque;
-    VirtIOSCSICommon *vs = VIRTIO_SCSI_COMMON(s);
-    EventNotifier *host_notifier;
-    int i;
+    VirtQueue *vq = opaque;
+    EventNotifier *host_notifier = virtio_queue_get_host_notifier(vq);
 
-    virtio_queue_aio_detach_host_notifier(vs->ctrl_vq, s->ctx);
-    host_notifier = virtio_queue_get_host_notifier(vs->ctrl_vq);
+    virtio_queue_aio_detach_host_notifier(vq, qemu_get_current_aio_context());
 
     /*
      * Test and clear notifier after disabling event, in case poll callback
      * didn't have time to run.
      */
     virtio_queue_host_notifier_read(host_notifier);
-
-    virtio_queue_aio_detach_host_notifier(vs->event_vq, s->ctx);
-    host_notifier = virtio_queue_get_host_notifier(vs->event_vq);
-    virtio_queue_host_notifier_read(host_notifier);
-
-    for (i = 0; i < vs->conf.num_queues; i++) {
-        virtio_queue_aio_detach_host_notifier(vs->cmd_vqs[i], s->ctx);
-        host_notifier = virtio_queue_get_host_notifier(vs->cmd_vqs[i]);
-        virtio_queue_host_notifier_read(host_notifier);
-    }
 }
 
 /* Context: QEMU global mutex held */
@@ -161,11 +296,16 @@ int virtio_scsi_dataplane_start(VirtIODevice *vdev)
         aio_context_acquire(s->ctx);
         virtio_queue_aio_attach_host_notifier(vs->ctrl_vq, s->ctx);
         virtio_queue_aio_attach_host_notifier_no_poll(vs->event_vq, s->ctx);
+        aio_context_release(s->ctx);
 
         for (i = 0; i < vs->conf.num_queues; i++) {
-            virtio_queue_aio_attach_host_notifier(vs->cmd_vqs[i], s->ctx);
+            AioContext *ctx =
+                s->vq_aio_context[VIRTIO_SCSI_VQ_NUM_FIXED + i];
+
+            aio_context_acquire(ctx);
+            virtio_queue_aio_attach_host_notifier(vs->cmd_vqs[i], ctx);
+            aio_context_release(ctx);
         }
-        aio_context_release(s->ctx);
     }
     return 0;
 
@@ -213,7 +353,11 @@ void virtio_scsi_dataplane_stop(VirtIODevice *vdev)
     s->dataplane_stopping = true;
 
     if (s->bus.drain_count == 0) {
-        aio_wait_bh_oneshot(s->ctx, virtio_scsi_dataplane_stop_bh, s);
+        for (i = 0; i < vs->conf.num_queues + VIRTIO_SCSI_VQ_NUM_FIXED; i++) {
+            aio_wait_bh_oneshot(s->vq_aio_context[i],
+                                virtio_scsi_dataplane_stop_vq_bh,
+                                virtio_get_queue(vdev, i));
+        }
     }
 
     blk_drain_all(); /* ensure there are no in-flight requests */
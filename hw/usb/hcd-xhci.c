@@ -127,6 +127,9 @@
 
 #define ERDP_EHB        (1<<3)
 
+#define IMOD_IMODI_MASK 0xffff
+#define IMOD_UNIT_NS    250
+
 #define TRB_SIZE 16
 typedef struct XHCITRB {
     uint64_t parameter;
@@ -582,6 +585,46 @@ static void xhci_intr_update(XHCIState *xhci, int v)
     }
 }
 
+/*
+ * Send the interrupt, unless IMODI says it's too early since the last one;
+ * in that case the IMOD timer sends it once the interval has passed.
+ */
+static void xhci_intr_send(XHCIState *xhci, int v)
+{
+    XHCIInterrupter *intr = &xhci->intr[v];
+    uint32_t imodi = intr->imod & IMOD_IMODI_MASK;
+
+    if (imodi) {
+        int64_t now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+
+        if (now < intr->imod_deadline) {
+            if (!timer_pending(intr->imod_timer)) {
+                timer_mod(intr->imod_timer, intr->imod_deadline);
+            }
+            return;
+        }
+        intr->imod_deadline = now + imodi * IMOD_UNIT_NS;
+    }
+
+    if (xhci->intr_raise) {
+        if (xhci->intr_raise(xhci, v, true)) {
+            intr->iman &= ~IMAN_IP;
+        }
+    }
+}
+
+static void xhci_imod_timer(void *opaque)
+{
+    XHCIInterrupter *intr = opaque;
+    XHCIState *xhci = intr->xhci;
+
+    if (!(intr->iman & IMAN_IP) || !(intr->iman & IMAN_IE) ||
+        !(xhci->usbcmd & USBCMD_INTE)) {
+        return;
+    }
+    xhci_intr_send(xhci, intr - xhci->intr);
+}
+
 static void xhci_intr_raise(XHCIState *xhci, int v)
 {
     bool pending = (xhci->intr[v].erdp_low & ERDP_EHB);
@@ -600,11 +643,16 @@ static void xhci_intr_raise(XHCIState *xhci, int v)
     if (!(xhci->usbcmd & USBCMD_INTE)) {
         return;
     }
-    if (xhci->intr_raise) {
-        if (xhci->intr_raise(xhci, v, true)) {
-            xhci->intr[v].iman &= ~IMAN_IP;
-        }
+    xhci_intr_send(xhci, v);
+}
+
+/* The address space is only known once the wrapper device is realized */
+static DMATranslationCache *xhci_dma_cache(XHCIState *xhci)
+{
+    if (!xhci->dma_cache) {
+        xhci->dma_cache = dma_translation_cache_new(xhci->as);
     }
+    return xhci->dma_cache;
 }
 
 static inline int xhci_running(XHCIState *xhci)
@@ -632,8 +680,9 @@ static void xhci_write_event(XHCIState *xhci, XHCIEvent *event, int v)
                                ev_trb.status, ev_trb.control);
 
     addr = intr->er_start + TRB_SIZE*intr->er_ep_idx;
-    if (dma_memory_write(xhci->as, addr, &ev_trb, TRB_SIZE,
-                         MEMTXATTRS_UNSPECIFIED) != MEMTX_OK) {
+    if (dma_translation_cache_rw(xhci_dma_cache(xhci), addr, &ev_trb,
+                                 TRB_SIZE, DMA_DIRECTION_FROM_DEVICE,
+                                 MEMTXATTRS_UNSPECIFIED) != MEMTX_OK) {
         qemu_log_mask(LOG_GUEST_ERROR, "%s: DMA memory access failed!\n",
                       __func__);
         xhci_die(xhci);
@@ -698,8 +747,9 @@ static TRBType xhci_ring_fetch(XHCIState *xhci, XHCIRing *ring, XHCITRB *trb,
 
     while (1) {
         TRBType type;
-        if (dma_memory_read(xhci->as, ring->dequeue, trb, TRB_SIZE,
-                            MEMTXATTRS_UNSPECIFIED) != MEMTX_OK) {
+        if (dma_translation_cache_rw(xhci_dma_cache(xhci), ring->dequeue,
+                                     trb, TRB_SIZE, DMA_DIRECTION_TO_DEVICE,
+                                     MEMTXATTRS_UNSPECIFIED) != MEMTX_OK) {
             qemu_log_mask(LOG_GUEST_ERROR, "%s: DMA memory access failed!\n",
                           __func__);
             return 0;
@@ -750,8 +800,9 @@ static int xhci_ring_chain_length(XHCIState *xhci, const XHCIRing *ring)
 
     do {
         TRBType type;
-        if (dma_memory_read(xhci->as, dequeue, &trb, TRB_SIZE,
-                        MEMTXATTRS_UNSPECIFIED) != MEMTX_OK) {
+        if (dma_translation_cache_rw(xhci_dma_cache(xhci), dequeue,
+                                     &trb, TRB_SIZE, DMA_DIRECTION_TO_DEVICE,
+                                     MEMTXATTRS_UNSPECIFIED) != MEMTX_OK) {
             qemu_log_mask(LOG_GUEST_ERROR, "%s: DMA memory access failed!\n",
                           __func__);
             return -1;
@@ -2724,6 +2775,8 @@ static void xhci_reset(DeviceState *dev)
     for (i = 0; i < xhci->numintrs; i++) {
         xhci->intr[i].iman = 0;
         xhci->intr[i].imod = 0;
+        xhci->intr[i].imod_deadline = 0;
+        timer_del(xhci->intr[i].imod_timer);
         xhci->intr[i].erstsz = 0;
         xhci->intr[i].erstba_low = 0;
         xhci->intr[i].erstba_high = 0;
@@ -3415,6 +3468,12 @@ static void usb_xhci_realize(DeviceState *dev, Error **errp)
 
     usb_xhci_init(xhci);
     xhci->mfwrap_timer = timer_new_ns(QEMU_CLOCK_VIRTUAL, xhci_mfwrap_timer, xhci);
+    for (i = 0; i < xhci->numintrs; i++) {
+        xhci->intr[i].xhci = xhci;
+        xhci->intr[i].imod_timer = timer_new_ns(QEMU_CLOCK_VIRTUAL,
+                                                xhci_imod_timer,
+                                                &xhci->intr[i]);
+    }
 
     memory_region_init(&xhci->mem, OBJECT(dev), "xhci", XHCI_LEN_REGS);
     memory_region_init_io(&xhci->mem_cap, OBJECT(dev), &xhci_cap_ops, xhci,
@@ -3456,6 +3515,10 @@ static void usb_xhci_unrealize(DeviceState *dev)
         timer_free(xhci->mfwrap_timer);
         xhci->mfwrap_timer = NULL;
     }
+    for (i = 0; i < xhci->numintrs; i++) {
+        g_clear_pointer(&xhci->intr[i].imod_timer, timer_free);
+    }
+    g_clear_pointer(&xhci->dma_cache, dma_translation_cache_free);
 
     memory_region_del_subregion(&xhci->mem, &xhci->mem_cap);
     memory_region_del_subregion(&xhci->mem, &xhci->mem_oper);
@@ -3570,6 +3633,24 @@ static bool xhci_er_full(void *opaque, int version_id)
     return false;
 }
 
+static bool xhci_intr_imod_needed(void *opaque)
+{
+    XHCIInterrupter *intr = opaque;
+
+    return timer_pending(intr->imod_timer);
+}
+
+static const VMStateDescription vmstate_xhci_intr_imod = {
+    .name = "xhci-intr/imod",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .needed = xhci_intr_imod_needed,
+    .fields = (VMStateField[]) {
+        VMSTATE_TIMER_PTR(imod_timer, XHCIInterrupter),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
 static const VMStateDescription vmstate_xhci_intr = {
     .name = "xhci-intr",
     .version_id = 1,
@@ -3599,6 +3680,10 @@ static const VMStateDescription vmstate_xhci_intr = {
                                   vmstate_xhci_event, XHCIEvent),
 
         VMSTATE_END_OF_LIST()
+    },
+    .subsections = (const VMStateDescription * []) {
+        &vmstate_xhci_intr_imod,
+        NULL
     }
 };
 
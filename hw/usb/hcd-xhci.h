@@ -172,6 +172,11 @@ typedef struct XHCIInterrupter {
     unsigned int ev_buffer_put;
     unsigned int ev_buffer_get;
 
+    /* Interrupt moderation: no interrupt is sent before imod_deadline */
+    XHCIState *xhci;
+    QEMUTimer *imod_timer;
+    int64_t imod_deadline;
+
 } XHCIInterrupter;
 
 typedef struct XHCIState {
@@ -181,6 +186,7 @@ typedef struct XHCIState {
     MemoryRegion mem;
     MemoryRegion *dma_mr;
     AddressSpace *as;
+    DMATranslationCache *dma_cache;     /* TRB fetches and event writes */
     MemoryRegion mem_cap;
     MemoryRegion mem_oper;
     MemoryRegion mem_runtime;
@@ -31,9 +31,11 @@
 #include "exec/memory.h"
 #include "exec/ram_addr.h"
 #include "hw/hw.h"
+#include "qemu/bitmap.h"
 #include "qemu/error-report.h"
 #include "qemu/main-loop.h"
 #include "qemu/range.h"
+#include "qemu/units.h"
 #include "sysemu/kvm.h"
 #include "sysemu/reset.h"
 #include "sysemu/runstate.h"
@@ -655,6 +657,68 @@ static int vfio_dma_map(VFIOContainer *container, hwaddr iova,
     return -errno;
 }
 
+/*
+ * RAM sections are mapped in chunks of this size at the end of the memory
+ * transaction, several at a time, so that pinning a large guest does not
+ * happen one section after the other on a single thread.
+ */
+#define VFIO_DMA_MAP_CHUNK_SIZE (1 * GiB)
+#define VFIO_DMA_MAP_THREADS_MAX 8
+
+typedef struct VFIODMAMap {
+    MemoryRegion *mr;
+    hwaddr iova;
+    ram_addr_t size;
+    void *vaddr;
+    bool readonly;
+    int ret;
+} VFIODMAMap;
+
+typedef struct VFIODMAMapWork {
+    VFIOContainer *container;
+    GArray *maps;
+    unsigned next;
+} VFIODMAMapWork;
+
+static void *vfio_dma_map_worker(void *opaque)
+{
+    VFIODMAMapWork *work = opaque;
+    unsigned i;
+
+    while ((i = qatomic_fetch_inc(&work->next)) < work->maps->len) {
+        VFIODMAMap *map = &g_array_index(work->maps, VFIODMAMap, i);
+
+        map->ret = vfio_dma_map(work->container, map->iova, map->size,
+                                map->vaddr, map->readonly);
+    }
+    return NULL;
+}
+
+static void vfio_dma_map_queue(VFIOContainer *container, MemoryRegion *mr,
+                               hwaddr iova, ram_addr_t size, void *vaddr,
+                               bool readonly)
+{
+    if (!container->dma_map_pending) {
+        container->dma_map_pending = g_array_new(false, false,
+                                                 sizeof(VFIODMAMap));
+    }
+
+    while (size) {
+        VFIODMAMap map = {
+            .mr = mr,
+            .iova = iova,
+            .size = MIN(size, VFIO_DMA_MAP_CHUNK_SIZE),
+            .vaddr = vaddr,
+            .readonly = readonly,
+        };
+
+        g_array_append_val(container->dma_map_pending, map);
+        iova += map.size;
+        vaddr += map.size;
+        size -= map.size;
+    }
+}
+
 static void vfio_host_win_add(VFIOContainer *container,
                               hwaddr min_iova, hwaddr max_iova,
                               uint64_t iova_pgsizes)
@@ -1028,6 +1092,27 @@ static bool vfio_get_section_iova_range(VFIOContainer *container,
     return true;
 }
 
+static void vfio_listener_region_add_fail(VFIOContainer *container,
+                                          MemoryRegion *mr, Error *err)
+{
+    /*
+     * On the initfn path, store the first error in the container so we
+     * can gracefully fail.  Runtime, there's not much we can do other
+     * than throw a hardware error.
+     */
+    if (!container->initialized) {
+        if (!container->error) {
+            error_propagate_prepend(&container->error, err,
+                                    "Region %s: ", memory_region_name(mr));
+        } else {
+            error_free(err);
+        }
+    } else {
+        error_report_err(err);
+        hw_error("vfio: DMA mapping failed, unable to continue");
+    }
+}
+
 static void vfio_listener_region_add(MemoryListener *listener,
                                      MemoryRegionSection *section)
 {
@@ -1202,6 +1287,13 @@ static void vfio_listener_region_add(MemoryListener *listener,
         }
     }
 
+    if (!memory_region_is_ram_device(section->mr)) {
+        /* Pinned by vfio_listener_commit() together with the other sections */
+        vfio_dma_map_queue(container, section->mr, iova, int128_get64(llsize),
+                           vaddr, section->readonly);
+        return;
+    }
+
     ret = vfio_dma_map(container, iova, int128_get64(llsize),
                        vaddr, section->readonly);
     if (ret) {
@@ -1209,12 +1301,8 @@ static void vfio_listener_region_add(MemoryListener *listener,
                    "0x%"HWADDR_PRIx", %p) = %d (%s)",
                    container, iova, int128_get64(llsize), vaddr, ret,
                    strerror(-ret));
-        if (memory_region_is_ram_device(section->mr)) {
-            /* Allow unexpected mappings not to be fatal for RAM devices */
-            error_report_err(err);
-            return;
-        }
-        goto fail;
+        /* Allow unexpected mappings not to be fatal for RAM devices */
+        error_report_err(err);
     }
 
     return;
@@ -1224,22 +1312,59 @@ fail:
         error_report("failed to vfio_dma_map. pci p2p may not work");
         return;
     }
-    /*
-     * On the initfn path, store the first error in the container so we
-     * can gracefully fail.  Runtime, there's not much we can do other
-     * than throw a hardware error.
-     */
-    if (!container->initialized) {
-        if (!container->error) {
-            error_propagate_prepend(&container->error, err,
-                                    "Region %s: ",
-                                    memory_region_name(section->mr));
-        } else {
-            error_free(err);
+    vfio_listener_region_add_fail(container, section->mr, err);
+}
+
+/*
+ * Map the RAM sections queued by vfio_listener_region_add() during this
+ * transaction.  The kernel pins every page when mapping, which dominates
+ * the start of large guests, so the chunks are spread over several threads
+ * and waited for once.
+ */
+static void vfio_listener_commit(MemoryListener *listener)
+{
+    VFIOContainer *container = container_of(listener, VFIOContainer, listener);
+    g_autoptr(GArray) maps = g_steal_pointer(&container->dma_map_pending);
+    VFIODMAMapWork work;
+    QemuThread *threads;
+    unsigned i, nthreads;
+
+    if (!maps || !maps->len) {
+        return;
+    }
+
+    work = (VFIODMAMapWork) {
+        .container = container,
+        .maps = maps,
+    };
+
+    /* The calling thread takes its share as well */
+    nthreads = MIN(maps->len, VFIO_DMA_MAP_THREADS_MAX) - 1;
+    trace_vfio_listener_commit(maps->len, nthreads + 1);
+
+    threads = g_new(QemuThread, nthreads);
+    for (i = 0; i < nthreads; i++) {
+        qemu_thread_create(&threads[i], "vfio-dma-map", vfio_dma_map_worker,
+                           &work, QEMU_THREAD_JOINABLE);
+    }
+    vfio_dma_map_worker(&work);
+    for (i = 0; i < nthreads; i++) {
+        qemu_thread_join(&threads[i]);
+    }
+    g_free(threads);
+
+    for (i = 0; i < maps->len; i++) {
+        VFIODMAMap *map = &g_array_index(maps, VFIODMAMap, i);
+        Error *err = NULL;
+
+        if (!map->ret) {
+            continue;
         }
-    } else {
-        error_report_err(err);
-        hw_error("vfio: DMA mapping failed, unable to continue");
+        error_setg(&err, "vfio_dma_map(%p, 0x%"HWADDR_PRIx", "
+                   "0x%"HWADDR_PRIx", %p) = %d (%s)",
+                   container, map->iova, (hwaddr)map->size, map->vaddr,
+                   map->ret, strerror(-map->ret));
+        vfio_listener_region_add_fail(container, map->mr, err);
     }
 }
 
@@ -1646,30 +1771,115 @@ static int vfio_device_dma_logging_report(VFIODevice *vbasedev, hwaddr iova,
     return 0;
 }
 
+/*
+ * Devices are queried for their DMA logging report concurrently.  The
+ * kernel only sets bits in the bitmap it is given, without atomics, so
+ * every thread fills its own bitmap and they are OR-ed together at the
+ * end.
+ */
+#define VFIO_DIRTY_QUERY_THREADS_MAX 8
+
+typedef struct VFIODirtyQuery {
+    VFIODevice **devices;
+    unsigned ndevices;
+    unsigned next;
+    hwaddr iova;
+    hwaddr size;
+    int ret;
+} VFIODirtyQuery;
+
+typedef struct VFIODirtyQueryThread {
+    VFIODirtyQuery *query;
+    VFIOBitmap *vbmap;
+    VFIOBitmap own;
+    QemuThread thread;
+} VFIODirtyQueryThread;
+
+static void *vfio_devices_query_worker(void *opaque)
+{
+    VFIODirtyQueryThread *t = opaque;
+    VFIODirtyQuery *q = t->query;
+    unsigned i;
+
+    while ((i = qatomic_fetch_inc(&q->next)) < q->ndevices) {
+        VFIODevice *vbasedev = q->devices[i];
+        int ret;
+
+        ret = vfio_device_dma_logging_report(vbasedev, q->iova, q->size,
+                                             t->vbmap->bitmap);
+        if (ret) {
+            error_report("%s: Failed to get DMA logging report, iova: "
+                         "0x%" HWADDR_PRIx ", size: 0x%" HWADDR_PRIx
+                         ", err: %d (%s)",
+                         vbasedev->name, q->iova, q->size, ret,
+                         strerror(-ret));
+            qatomic_cmpxchg(&q->ret, 0, ret);
+        }
+    }
+    return NULL;
+}
+
 static int vfio_devices_query_dirty_bitmap(VFIOContainer *container,
                                            VFIOBitmap *vbmap, hwaddr iova,
                                            hwaddr size)
 {
+    g_autofree VFIODevice **devices = NULL;
+    g_autofree VFIODirtyQueryThread *threads = NULL;
+    VFIODirtyQuery query = {
+        .iova = iova,
+        .size = size,
+    };
     VFIODevice *vbasedev;
     VFIOGroup *group;
-    int ret;
+    unsigned i, nthreads;
+    int ret = 0;
 
     QLIST_FOREACH(group, &container->group_list, container_next) {
         QLIST_FOREACH(vbasedev, &group->device_list, next) {
-            ret = vfio_device_dma_logging_report(vbasedev, iova, size,
-                                                 vbmap->bitmap);
-            if (ret) {
-                error_report("%s: Failed to get DMA logging report, iova: "
-                             "0x%" HWADDR_PRIx ", size: 0x%" HWADDR_PRIx
-                             ", err: %d (%s)",
-                             vbasedev->name, iova, size, ret, strerror(-ret));
+            query.ndevices++;
+        }
+    }
 
-                return ret;
-            }
+    devices = g_new(VFIODevice *, query.ndevices);
+    query.devices = devices;
+    i = 0;
+    QLIST_FOREACH(group, &container->group_list, container_next) {
+        QLIST_FOREACH(vbasedev, &group->device_list, next) {
+            devices[i++] = vbasedev;
         }
     }
 
-    return 0;
+    nthreads = MIN(query.ndevices, VFIO_DIRTY_QUERY_THREADS_MAX);
+    threads = g_new0(VFIODirtyQueryThread, MAX(nthreads, 1));
+
+    /* The calling thread fills @vbmap, the others their own bitmap */
+    threads[0].query = &query;
+    threads[0].vbmap = vbmap;
+    for (i = 1; i < nthreads; i++) {
+        threads[i].query = &query;
+        threads[i].vbmap = &threads[i].own;
+        ret = vfio_bitmap_alloc(&threads[i].own, size);
+        if (ret) {
+            nthreads = i;
+            break;
+        }
+        qemu_thread_create(&threads[i].thread, "vfio-dirty-query",
+                           vfio_devices_query_worker, &threads[i],
+                           QEMU_THREAD_JOINABLE);
+    }
+
+    vfio_devices_query_worker(&threads[0]);
+
+    for (i = 1; i < nthreads; i++) {
+        qemu_thread_join(&threads[i].thread);
+        if (!ret && !query.ret) {
+            bitmap_or(vbmap->bitmap, vbmap->bitmap, threads[i].own.bitmap,
+                      vbmap->pages);
+        }
+        g_free(threads[i].own.bitmap);
+    }
+
+    return ret ?: query.ret;
 }
 
 static int vfio_query_dirty_bitmap(VFIOContainer *container, VFIOBitmap *vbmap,
@@ -1903,6 +2113,7 @@ static const MemoryListener vfio_memory_listener = {
     .name = "vfio",
     .region_add = vfio_listener_region_add,
     .region_del = vfio_listener_region_del,
+    .commit = vfio_listener_commit,
     .log_global_start = vfio_listener_log_global_start,
     .log_global_stop = vfio_listener_log_global_stop,
     .log_sync = vfio_listener_log_sync,
@@ -642,6 +642,7 @@ static const SaveVMHandlers savevm_vfio_handlers = {
     .load_cleanup = vfio_load_cleanup,
     .load_state = vfio_load_state,
     .switchover_ack_needed = vfio_switchover_ack_needed,
+    .complete_precopy_thread_safe = true,
 };
 
 /* ---------------------------------------------------------------------- */
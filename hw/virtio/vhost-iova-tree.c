@@ -28,6 +28,9 @@ struct VhostIOVATree {
 
     /* IOVA address to qemu memory maps. */
     IOVATree *iova_taddr_map;
+
+    /* Bumped whenever a map is removed, so users can drop cached maps */
+    uint64_t generation;
 };
 
 /**
@@ -44,6 +47,7 @@ VhostIOVATree *vhost_iova_tree_new(hwaddr iova_first, hwaddr iova_last)
     tree->iova_last = iova_last;
 
     tree->iova_taddr_map = iova_tree_new();
+    tree->generation = 0;
     return tree;
 }
 
@@ -107,4 +111,18 @@ int vhost_iova_tree_map_alloc(VhostIOVATree *tree, DMAMap *map)
 void vhost_iova_tree_remove(VhostIOVATree *iova_tree, DMAMap map)
 {
     iova_tree_remove(iova_tree->iova_taddr_map, map);
+    iova_tree->generation++;
+}
+
+/**
+ * Return the generation of the tree
+ *
+ * @iova_tree: The iova tree
+ *
+ * Any map obtained from the tree may have been removed once the generation
+ * changes.
+ */
+uint64_t vhost_iova_tree_generation(const VhostIOVATree *iova_tree)
+{
+    return iova_tree->generation;
 }
@@ -79,14 +79,21 @@ static uint16_t vhost_svq_available_slots(const VhostShadowVirtqueue *svq)
  * @iovec: Source qemu's VA addresses
  * @num: Length of iovec and minimum length of vaddr
  */
-static bool vhost_svq_translate_addr(const VhostShadowVirtqueue *svq,
+static bool vhost_svq_translate_addr(VhostShadowVirtqueue *svq,
                                      hwaddr *addrs, const struct iovec *iovec,
                                      size_t num)
 {
+    uint64_t gen;
+
     if (num == 0) {
         return true;
     }
 
+    gen = vhost_iova_tree_generation(svq->iova_tree);
+    if (svq->iova_cache_valid && svq->iova_cache_gen != gen) {
+        svq->iova_cache_valid = false;
+    }
+
     for (size_t i = 0; i < num; ++i) {
         DMAMap needle = {
             .translated_addr = (hwaddr)(uintptr_t)iovec[i].iov_base,
@@ -94,17 +101,29 @@ static bool vhost_svq_translate_addr(const VhostShadowVirtqueue *svq,
         };
         Int128 needle_last, map_last;
         size_t off;
+        const DMAMap *map = &svq->iova_cache;
 
-        const DMAMap *map = vhost_iova_tree_find_iova(svq->iova_tree, &needle);
         /*
-         * Map cannot be NULL since iova map contains all guest space and
-         * qemu already has a physical address mapped
+         * Guest buffers mostly live in the same big RAM map, so try the
+         * last map we used before walking the tree.
          */
-        if (unlikely(!map)) {
-            qemu_log_mask(LOG_GUEST_ERROR,
-                          "Invalid address 0x%"HWADDR_PRIx" given by guest",
-                          needle.translated_addr);
-            return false;
+        if (!svq->iova_cache_valid ||
+            needle.translated_addr < map->translated_addr ||
+            needle.translated_addr - map->translated_addr > map->size) {
+            map = vhost_iova_tree_find_iova(svq->iova_tree, &needle);
+            /*
+             * Map cannot be NULL since iova map contains all guest space and
+             * qemu already has a physical address mapped
+             */
+            if (unlikely(!map)) {
+                qemu_log_mask(LOG_GUEST_ERROR,
+                              "Invalid address 0x%"HWADDR_PRIx" given by guest",
+                              needle.translated_addr);
+                return false;
+            }
+            svq->iova_cache = *map;
+            svq->iova_cache_gen = gen;
+            svq->iova_cache_valid = true;
         }
 
         off = needle.translated_addr - map->translated_addr;
@@ -172,6 +191,13 @@ static bool vhost_svq_vring_write_descs(VhostShadowVirtqueue *svq, hwaddr *sg,
     return true;
 }
 
+/* Update the avail index after writing the descriptors */
+static void vhost_svq_publish_avail(VhostShadowVirtqueue *svq)
+{
+    smp_wmb();
+    svq->vring.avail->idx = cpu_to_le16(svq->shadow_avail_idx);
+}
+
 static bool vhost_svq_add_split(VhostShadowVirtqueue *svq,
                                 const struct iovec *out_sg, size_t out_num,
                                 const struct iovec *in_sg, size_t in_num,
@@ -210,17 +236,23 @@ static bool vhost_svq_add_split(VhostShadowVirtqueue *svq,
     avail->ring[avail_idx] = cpu_to_le16(*head);
     svq->shadow_avail_idx++;
 
-    /* Update the avail index after write the descriptor */
-    smp_wmb();
-    avail->idx = cpu_to_le16(svq->shadow_avail_idx);
+    if (!svq->batching) {
+        vhost_svq_publish_avail(svq);
+    }
 
     return true;
 }
 
 static void vhost_svq_kick(VhostShadowVirtqueue *svq)
 {
+    uint16_t old = svq->kick_avail_idx;
     bool needs_kick;
 
+    if (old == svq->shadow_avail_idx) {
+        return;
+    }
+    svq->kick_avail_idx = svq->shadow_avail_idx;
+
     /*
      * We need to expose the available array entries before checking the used
      * flags
@@ -229,7 +261,7 @@ static void vhost_svq_kick(VhostShadowVirtqueue *svq)
 
     if (virtio_vdev_has_feature(svq->vdev, VIRTIO_RING_F_EVENT_IDX)) {
         uint16_t avail_event = *(uint16_t *)(&svq->vring.used->ring[svq->vring.num]);
-        needs_kick = vring_need_event(avail_event, svq->shadow_avail_idx, svq->shadow_avail_idx - 1);
+        needs_kick = vring_need_event(avail_event, svq->shadow_avail_idx, old);
     } else {
         needs_kick = !(svq->vring.used->flags & VRING_USED_F_NO_NOTIFY);
     }
@@ -266,7 +298,9 @@ int vhost_svq_add(VhostShadowVirtqueue *svq, const struct iovec *out_sg,
     svq->num_free -= ndescs;
     svq->desc_state[qemu_head].elem = elem;
     svq->desc_state[qemu_head].ndescs = ndescs;
-    vhost_svq_kick(svq);
+    if (!svq->batching) {
+        vhost_svq_kick(svq);
+    }
     return 0;
 }
 
@@ -291,7 +325,7 @@ static int vhost_svq_add_element(VhostShadowVirtqueue *svq,
  * If that happens, guest's kick notifications will be disabled until the
  * device uses some buffers.
  */
-static void vhost_handle_guest_kick(VhostShadowVirtqueue *svq)
+static void vhost_svq_forward_avail(VhostShadowVirtqueue *svq)
 {
     /* Clear event notifier */
     event_notifier_test_and_clear(&svq->svq_kick);
@@ -346,6 +380,28 @@ static void vhost_handle_guest_kick(VhostShadowVirtqueue *svq)
     } while (!virtio_queue_empty(svq->vq));
 }
 
+/*
+ * Forward available buffers as one batch: the avail index is published and
+ * the device kicked once for everything forwarded in this round.
+ *
+ * Callers with their own avail handler (i.e. shadow CVQ) add buffers and
+ * poll for the device answer synchronously, so they are not batched.
+ */
+static void vhost_handle_guest_kick(VhostShadowVirtqueue *svq)
+{
+    if (svq->ops || svq->batching) {
+        vhost_svq_forward_avail(svq);
+        return;
+    }
+
+    svq->batching = true;
+    vhost_svq_forward_avail(svq);
+    svq->batching = false;
+
+    vhost_svq_publish_avail(svq);
+    vhost_svq_kick(svq);
+}
+
 /**
  * Handle guest's kick.
  *
@@ -476,6 +532,7 @@ static void vhost_svq_flush(VhostShadowVirtqueue *svq,
                             bool check_for_avail_queue)
 {
     VirtQueue *vq = svq->vq;
+    unsigned flushed = 0;
 
     /* Forward as many used buffers as possible. */
     do {
@@ -501,7 +558,7 @@ static void vhost_svq_flush(VhostShadowVirtqueue *svq,
         }
 
         virtqueue_flush(vq, i);
-        event_notifier_set(&svq->svq_call);
+        flushed += i;
 
         if (check_for_avail_queue && svq->next_guest_avail_elem) {
             /*
@@ -511,6 +568,14 @@ static void vhost_svq_flush(VhostShadowVirtqueue *svq,
             vhost_handle_guest_kick(svq);
         }
     } while (!vhost_svq_enable_notification(svq));
+
+    /*
+     * Call the guest once for the whole flush, and only if it asked for it
+     * (EVENT_IDX or VRING_AVAIL_F_NO_INTERRUPT).
+     */
+    if (flushed && virtio_queue_should_notify(vq)) {
+        event_notifier_set(&svq->svq_call);
+    }
 }
 
 /**
@@ -654,6 +719,9 @@ void vhost_svq_start(VhostShadowVirtqueue *svq, VirtIODevice *vdev,
     event_notifier_set_handler(&svq->hdev_call, vhost_svq_handle_call);
     svq->next_guest_avail_elem = NULL;
     svq->shadow_avail_idx = 0;
+    svq->kick_avail_idx = 0;
+    svq->batching = false;
+    svq->iova_cache_valid = false;
     svq->shadow_used_idx = 0;
     svq->last_used_idx = 0;
     svq->vdev = vdev;
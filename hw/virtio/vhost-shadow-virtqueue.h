@@ -99,6 +99,17 @@ typedef struct VhostShadowVirtqueue {
     /* Next head to expose to the device */
     uint16_t shadow_avail_idx;
 
+    /* Avail idx the device has been last kicked for */
+    uint16_t kick_avail_idx;
+
+    /* Defer avail idx update and kick until the end of a forwarding batch */
+    bool batching;
+
+    /* Last IOVA map used for translation, valid for iova_cache_gen */
+    DMAMap iova_cache;
+    uint64_t iova_cache_gen;
+    bool iova_cache_valid;
+
     /* Next free descriptor */
     uint16_t free_head;
 
@@ -1302,6 +1302,23 @@ static int vhost_user_get_features(struct vhost_dev *dev, uint64_t *features)
     return 0;
 }
 
+/*
+ * Like vhost_user_get_features(), but answered from the shared state if
+ * another vhost_dev already asked the backend on this connection.  Must
+ * not be used where the round trip itself matters (see enforce_reply()).
+ */
+static int vhost_user_get_features_cached(struct vhost_dev *dev,
+                                          uint64_t *features)
+{
+    struct vhost_user *u = dev->opaque;
+
+    if (u->user->backend_info_valid) {
+        *features = u->user->backend_features;
+        return 0;
+    }
+    return vhost_user_get_features(dev, features);
+}
+
 static int enforce_reply(struct vhost_dev *dev,
                          const VhostUserMsg *msg)
 {
@@ -2003,11 +2020,17 @@ static int vhost_user_backend_init(struct vhost_dev *dev, void *opaque,
     u->dev = dev;
     dev->opaque = u;
 
-    err = vhost_user_get_features(dev, &features);
+    /* The first vhost_dev of a (re)connection queries the backend afresh */
+    if (dev->vq_index == 0) {
+        vus->backend_info_valid = false;
+    }
+
+    err = vhost_user_get_features_cached(dev, &features);
     if (err < 0) {
         error_setg_errno(errp, -err, "vhost_backend_init failed");
         return err;
     }
+    vus->backend_features = features;
 
     if (virtio_has_feature(features, VHOST_USER_F_PROTOCOL_FEATURES)) {
         bool supports_f_config = vus->supports_config ||
@@ -2016,11 +2039,16 @@ static int vhost_user_backend_init(struct vhost_dev *dev, void *opaque,
 
         dev->backend_features |= 1ULL << VHOST_USER_F_PROTOCOL_FEATURES;
 
-        err = vhost_user_get_u64(dev, VHOST_USER_GET_PROTOCOL_FEATURES,
-                                 &protocol_features);
-        if (err < 0) {
-            error_setg_errno(errp, EPROTO, "vhost_backend_init failed");
-            return -EPROTO;
+        if (vus->backend_info_valid) {
+            protocol_features = vus->backend_protocol_features;
+        } else {
+            err = vhost_user_get_u64(dev, VHOST_USER_GET_PROTOCOL_FEATURES,
+                                     &protocol_features);
+            if (err < 0) {
+                error_setg_errno(errp, EPROTO, "vhost_backend_init failed");
+                return -EPROTO;
+            }
+            vus->backend_protocol_features = protocol_features;
         }
 
         /*
@@ -2057,11 +2085,16 @@ static int vhost_user_backend_init(struct vhost_dev *dev, void *opaque,
 
         /* query the max queues we support if backend supports Multiple Queue */
         if (dev->protocol_features & (1ULL << VHOST_USER_PROTOCOL_F_MQ)) {
-            err = vhost_user_get_u64(dev, VHOST_USER_GET_QUEUE_NUM,
-                                     &dev->max_queues);
-            if (err < 0) {
-                error_setg_errno(errp, EPROTO, "vhost_backend_init failed");
-                return -EPROTO;
+            if (vus->backend_info_valid) {
+                dev->max_queues = vus->backend_max_queues;
+            } else {
+                err = vhost_user_get_u64(dev, VHOST_USER_GET_QUEUE_NUM,
+                                         &dev->max_queues);
+                if (err < 0) {
+                    error_setg_errno(errp, EPROTO, "vhost_backend_init failed");
+                    return -EPROTO;
+                }
+                vus->backend_max_queues = dev->max_queues;
             }
         } else {
             dev->max_queues = 1;
@@ -2088,10 +2121,15 @@ static int vhost_user_backend_init(struct vhost_dev *dev, void *opaque,
                                 VHOST_USER_PROTOCOL_F_CONFIGURE_MEM_SLOTS)) {
             u->user->memory_slots = VHOST_MEMORY_BASELINE_NREGIONS;
         } else {
-            err = vhost_user_get_max_memslots(dev, &ram_slots);
-            if (err < 0) {
-                error_setg_errno(errp, EPROTO, "vhost_backend_init failed");
-                return -EPROTO;
+            if (vus->backend_info_valid) {
+                ram_slots = vus->backend_max_memslots;
+            } else {
+                err = vhost_user_get_max_memslots(dev, &ram_slots);
+                if (err < 0) {
+                    error_setg_errno(errp, EPROTO, "vhost_backend_init failed");
+                    return -EPROTO;
+                }
+                vus->backend_max_memslots = ram_slots;
             }
 
             if (ram_slots < u->user->memory_slots) {
@@ -2125,6 +2163,7 @@ static int vhost_user_backend_init(struct vhost_dev *dev, void *opaque,
     u->postcopy_notifier.notify = vhost_user_postcopy_notifier;
     postcopy_add_notifier(&u->postcopy_notifier);
 
+    vus->backend_info_valid = true;
     return 0;
 }
 
@@ -2635,6 +2674,7 @@ void vhost_user_cleanup(VhostUserState *user)
     user->notifiers = (GPtrArray *) g_ptr_array_free(user->notifiers, true);
     memory_region_transaction_commit();
     user->chr = NULL;
+    user->backend_info_valid = false;
 }
 
 
@@ -2757,7 +2797,7 @@ const VhostOps user_ops = {
         .vhost_set_vring_call = vhost_user_set_vring_call,
         .vhost_set_vring_err = vhost_user_set_vring_err,
         .vhost_set_features = vhost_user_set_features,
-        .vhost_get_features = vhost_user_get_features,
+        .vhost_get_features = vhost_user_get_features_cached,
         .vhost_set_owner = vhost_user_set_owner,
         .vhost_reset_device = vhost_user_reset_device,
         .vhost_get_vq_index = vhost_user_get_vq_index,
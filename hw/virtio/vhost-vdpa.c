@@ -166,9 +166,8 @@ static void vhost_vdpa_iotlb_batch_begin_once(struct vhost_vdpa *v)
     v->iotlb_batch_begin_sent = true;
 }
 
-static void vhost_vdpa_listener_commit(MemoryListener *listener)
+static void vhost_vdpa_iotlb_batch_end_once(struct vhost_vdpa *v)
 {
-    struct vhost_vdpa *v = container_of(listener, struct vhost_vdpa, listener);
     struct vhost_dev *dev = v->dev;
     struct vhost_msg_v2 msg = {};
     int fd = v->device_fd;
@@ -193,6 +192,13 @@ static void vhost_vdpa_listener_commit(MemoryListener *listener)
     v->iotlb_batch_begin_sent = false;
 }
 
+static void vhost_vdpa_listener_commit(MemoryListener *listener)
+{
+    struct vhost_vdpa *v = container_of(listener, struct vhost_vdpa, listener);
+
+    vhost_vdpa_iotlb_batch_end_once(v);
+}
+
 static void vhost_vdpa_iommu_map_notify(IOMMUNotifier *n, IOMMUTLBEntry *iotlb)
 {
     struct vdpa_iommu *iommu = container_of(n, struct vdpa_iommu, n);
@@ -278,6 +284,8 @@ static void vhost_vdpa_iommu_region_add(MemoryListener *listener,
     }
 
     QLIST_INSERT_HEAD(&v->iommu_list, iommu, iommu_next);
+    /* The replay runs within the listener transaction, batch its updates */
+    vhost_vdpa_iotlb_batch_begin_once(v);
     memory_region_iommu_replay(iommu->iommu_mr, &iommu->n);
 
     return;
@@ -347,7 +355,7 @@ static void vhost_vdpa_listener_region_add(MemoryListener *listener,
                                          vaddr, section->readonly);
 
     llsize = int128_sub(llend, int128_make64(iova));
-    if (v->shadow_data) {
+    if (v->listener_shadow_data) {
         int r;
 
         mem_region.translated_addr = (hwaddr)(uintptr_t)vaddr,
@@ -374,7 +382,7 @@ static void vhost_vdpa_listener_region_add(MemoryListener *listener,
     return;
 
 fail_map:
-    if (v->shadow_data) {
+    if (v->listener_shadow_data) {
         vhost_iova_tree_remove(v->iova_tree, mem_region);
     }
 
@@ -425,7 +433,7 @@ static void vhost_vdpa_listener_region_del(MemoryListener *listener,
 
     llsize = int128_sub(llend, int128_make64(iova));
 
-    if (v->shadow_data) {
+    if (v->listener_shadow_data) {
         const DMAMap *result;
         const void *vaddr = memory_region_get_ram_ptr(section->mr) +
             section->offset_within_region +
@@ -746,6 +754,7 @@ static int vhost_vdpa_cleanup(struct vhost_dev *dev)
 
     vhost_vdpa_host_notifiers_uninit(dev, dev->nvqs);
     memory_listener_unregister(&v->listener);
+    v->listener_registered = false;
     vhost_vdpa_svq_cleanup(dev);
 
     dev->opaque = NULL;
@@ -826,7 +835,8 @@ static int vhost_vdpa_set_backend_cap(struct vhost_dev *dev)
     uint64_t f = 0x1ULL << VHOST_BACKEND_F_IOTLB_MSG_V2 |
         0x1ULL << VHOST_BACKEND_F_IOTLB_BATCH |
         0x1ULL << VHOST_BACKEND_F_IOTLB_ASID |
-        0x1ULL << VHOST_BACKEND_F_SUSPEND;
+        0x1ULL << VHOST_BACKEND_F_SUSPEND |
+        0x1ULL << VHOST_BACKEND_F_IOTLB_PERSIST;
     int r;
 
     if (vhost_vdpa_call(dev, VHOST_GET_BACKEND_FEATURES, &features)) {
@@ -1199,6 +1209,8 @@ static bool vhost_vdpa_svqs_start(struct vhost_dev *dev)
         return true;
     }
 
+    /* Map all the shadow vrings with a single IOTLB batch */
+    vhost_vdpa_iotlb_batch_begin_once(v);
     for (i = 0; i < v->shadow_vqs->len; ++i) {
         VirtQueue *vq = virtio_get_queue(dev->vdev, dev->vq_index + i);
         VhostShadowVirtqueue *svq = g_ptr_array_index(v->shadow_vqs, i);
@@ -1225,6 +1237,7 @@ static bool vhost_vdpa_svqs_start(struct vhost_dev *dev)
         }
     }
 
+    vhost_vdpa_iotlb_batch_end_once(v);
     return true;
 
 err_set_addr:
@@ -1240,6 +1253,7 @@ err:
         vhost_vdpa_svq_unmap_rings(dev, svq);
         vhost_svq_stop(svq);
     }
+    vhost_vdpa_iotlb_batch_end_once(v);
 
     return false;
 }
@@ -1252,6 +1266,7 @@ static void vhost_vdpa_svqs_stop(struct vhost_dev *dev)
         return;
     }
 
+    vhost_vdpa_iotlb_batch_begin_once(v);
     for (unsigned i = 0; i < v->shadow_vqs->len; ++i) {
         VhostShadowVirtqueue *svq = g_ptr_array_index(v->shadow_vqs, i);
 
@@ -1261,6 +1276,7 @@ static void vhost_vdpa_svqs_stop(struct vhost_dev *dev)
         event_notifier_cleanup(&svq->hdev_kick);
         event_notifier_cleanup(&svq->hdev_call);
     }
+    vhost_vdpa_iotlb_batch_end_once(v);
 }
 
 static void vhost_vdpa_suspend(struct vhost_dev *dev)
@@ -1315,7 +1331,21 @@ static int vhost_vdpa_dev_start(struct vhost_dev *dev, bool started)
                          "IOMMU and try again");
             return -1;
         }
-        memory_listener_register(&v->listener, dev->vdev->dma_as);
+        /*
+         * A listener kept across the last reset already has guest memory
+         * mapped, unless the mappings have to move between GPA and the
+         * shadow IOVA space.
+         */
+        if (v->listener_registered &&
+            v->listener_shadow_data != v->shadow_data) {
+            memory_listener_unregister(&v->listener);
+            v->listener_registered = false;
+        }
+        if (!v->listener_registered) {
+            v->listener_shadow_data = v->shadow_data;
+            memory_listener_register(&v->listener, dev->vdev->dma_as);
+            v->listener_registered = true;
+        }
 
         return vhost_vdpa_add_status(dev, VIRTIO_CONFIG_S_DRIVER_OK);
     }
@@ -1334,7 +1364,20 @@ static void vhost_vdpa_reset_status(struct vhost_dev *dev)
     vhost_vdpa_reset_device(dev);
     vhost_vdpa_add_status(dev, VIRTIO_CONFIG_S_ACKNOWLEDGE |
                                VIRTIO_CONFIG_S_DRIVER);
+
+    /*
+     * A backend that keeps its IOTLB across reset does not need guest memory
+     * to be unmapped and mapped again on the next start.  Shadow IOVA
+     * mappings still go away, as their IOVA tree does not survive the stop.
+     */
+    if (dev->backend_cap & BIT_ULL(VHOST_BACKEND_F_IOTLB_PERSIST) &&
+        !v->shadow_data) {
+        trace_vhost_vdpa_reset_status_keep_iotlb(dev);
+        return;
+    }
+
     memory_listener_unregister(&v->listener);
+    v->listener_registered = false;
 }
 
 static int vhost_vdpa_set_log_base(struct vhost_dev *dev, uint64_t base,
@@ -18,6 +18,8 @@
 #include "qemu/module.h"
 #include "qemu/timer.h"
 #include "qemu/madvise.h"
+#include "block/aio-wait.h"
+#include "block/thread-pool.h"
 #include "hw/virtio/virtio.h"
 #include "hw/mem/pc-dimm.h"
 #include "hw/qdev-properties.h"
@@ -325,14 +327,127 @@ static void balloon_stats_set_poll_interval(Object *obj, Visitor *v,
     balloon_stats_change_timer(s, 0);
 }
 
+typedef struct VirtIOBalloonReportRange {
+    RAMBlock *rb;
+    ram_addr_t offset;
+    size_t size;
+} VirtIOBalloonReportRange;
+
+/*
+ * Reported elements are discarded in a batch by a thread pool worker and
+ * only returned to the guest afterwards: the guest reuses the pages as soon
+ * as it gets them back.  The mapping held by each element keeps its
+ * RAMBlocks alive until then.
+ */
+typedef struct VirtIOBalloonReportBatch {
+    VirtIOBalloon *dev;
+    GArray *ranges;
+    GPtrArray *elems;
+} VirtIOBalloonReportBatch;
+
+static gint virtio_balloon_report_range_cmp(gconstpointer a, gconstpointer b)
+{
+    const VirtIOBalloonReportRange *ra = a, *rb = b;
+
+    if (ra->rb != rb->rb) {
+        return (uintptr_t)ra->rb < (uintptr_t)rb->rb ? -1 : 1;
+    }
+    if (ra->offset != rb->offset) {
+        return ra->offset < rb->offset ? -1 : 1;
+    }
+    return 0;
+}
+
+/* Runs in a worker thread, without the BQL */
+static int virtio_balloon_report_discard(void *opaque)
+{
+    VirtIOBalloonReportBatch *batch = opaque;
+    VirtIOBalloonReportRange cur = { 0 };
+    guint i;
+
+    /*
+     * Merge adjacent ranges, the guest usually reports runs of neighbouring
+     * high-order pages, and do one discard per run.
+     */
+    g_array_sort(batch->ranges, virtio_balloon_report_range_cmp);
+    for (i = 0; i <= batch->ranges->len; i++) {
+        VirtIOBalloonReportRange *r = NULL;
+
+        if (i < batch->ranges->len) {
+            r = &g_array_index(batch->ranges, VirtIOBalloonReportRange, i);
+            if (cur.rb == r->rb && cur.offset + cur.size == r->offset) {
+                cur.size += r->size;
+                continue;
+            }
+        }
+        /* Discarding may have been inhibited since the ranges were queued */
+        if (cur.rb && !virtio_balloon_inhibited()) {
+            trace_virtio_balloon_report_discard(cur.offset, cur.size);
+            ram_block_discard_range(cur.rb, cur.offset, cur.size);
+        }
+        if (r) {
+            cur = *r;
+        }
+    }
+    return 0;
+}
+
+static void virtio_balloon_handle_report(VirtIODevice *vdev, VirtQueue *vq);
+
+static void virtio_balloon_report_done(void *opaque, int ret)
+{
+    VirtIOBalloonReportBatch *batch = opaque;
+    VirtIOBalloon *dev = batch->dev;
+    VirtIODevice *vdev = VIRTIO_DEVICE(dev);
+    guint i;
+
+    for (i = 0; i < batch->elems->len; i++) {
+        VirtQueueElement *elem = g_ptr_array_index(batch->elems, i);
+
+        virtqueue_push(dev->reporting_vq, elem, 0);
+        g_free(elem);
+    }
+    virtio_notify(vdev, dev->reporting_vq);
+
+    g_array_free(batch->ranges, true);
+    g_ptr_array_free(batch->elems, true);
+    g_free(batch);
+    dev->report_batch = NULL;
+    aio_wait_kick();
+
+    /* Pick up whatever the guest reported in the meantime */
+    if (vdev->vm_running) {
+        virtio_balloon_handle_report(vdev, dev->reporting_vq);
+    }
+}
+
+/* Wait until all reported pages were returned to the guest */
+static void virtio_balloon_report_drain(VirtIOBalloon *dev)
+{
+    AIO_WAIT_WHILE_UNLOCKED(NULL, dev->report_batch);
+}
+
 static void virtio_balloon_handle_report(VirtIODevice *vdev, VirtQueue *vq)
 {
     VirtIOBalloon *dev = VIRTIO_BALLOON(vdev);
+    VirtIOBalloonReportBatch *batch;
     VirtQueueElement *elem;
 
+    /* Only one batch at a time; the rest waits in the virtqueue */
+    if (dev->report_batch) {
+        return;
+    }
+
+    batch = g_new0(VirtIOBalloonReportBatch, 1);
+    batch->dev = dev;
+    batch->ranges = g_array_new(false, false, sizeof(VirtIOBalloonReportRange));
+    batch->elems = g_ptr_array_new();
+
     while ((elem = virtqueue_pop(vq, sizeof(VirtQueueElement)))) {
         unsigned int i;
 
+        g_ptr_array_add(batch->elems, elem);
+
         /*
          * When we discard the page it has the effect of removing the page
          * from the hypervisor itself and causing it to be zeroed when it
@@ -341,7 +456,7 @@ static void virtio_balloon_handle_report(VirtIODevice *vdev, VirtQueue *vq)
          * expecting it to retain a non-zero value.
          */
         if (virtio_balloon_inhibited() || dev->poison_val) {
-            goto skip_element;
+            continue;
         }
 
         for (i = 0; i < elem->in_num; i++) {
@@ -376,14 +491,30 @@ static void virtio_balloon_handle_report(VirtIODevice *vdev, VirtQueue *vq)
                 continue;
             }
 
-            ram_block_discard_range(rb, ram_offset, size);
+            g_array_append_val(batch->ranges, ((VirtIOBalloonReportRange) {
+                .rb = rb,
+                .offset = ram_offset,
+                .size = size,
+            }));
         }
+    }
 
-skip_element:
-        virtqueue_push(vq, elem, 0);
-        virtio_notify(vdev, vq);
-        g_free(elem);
+    if (!batch->elems->len) {
+        g_array_free(batch->ranges, true);
+        g_ptr_array_free(batch->elems, true);
+        g_free(batch);
+        return;
+    }
+
+    dev->report_batch = batch;
+    if (!batch->ranges->len) {
+        /* Nothing to discard */
+        virtio_balloon_report_done(batch, 0);
+        return;
     }
+    trace_virtio_balloon_report_batch(batch->elems->len, batch->ranges->len);
+    thread_pool_submit_aio(virtio_balloon_report_discard, batch,
+                           virtio_balloon_report_done, batch);
 }
 
 static void virtio_balloon_handle_output(VirtIODevice *vdev, VirtQueue *vq)
@@ -904,6 +1035,7 @@ static void virtio_balloon_device_unrealize(DeviceState *dev)
     VirtIODevice *vdev = VIRTIO_DEVICE(dev);
     VirtIOBalloon *s = VIRTIO_BALLOON(dev);
 
+    virtio_balloon_report_drain(s);
     if (s->free_page_bh) {
         qemu_bh_delete(s->free_page_bh);
         object_unref(OBJECT(s->iothread));
@@ -929,6 +1061,8 @@ static void virtio_balloon_device_reset(VirtIODevice *vdev)
 {
     VirtIOBalloon *s = VIRTIO_BALLOON(vdev);
 
+    /* Reported pages must go back to the guest before the queue is reset */
+    virtio_balloon_report_drain(s);
     if (virtio_balloon_free_page_support(s)) {
         virtio_balloon_free_page_stop(s);
     }
@@ -953,6 +1087,14 @@ static void virtio_balloon_set_status(VirtIODevice *vdev, uint8_t status)
         virtio_balloon_receive_stats(vdev, s->svq);
     }
 
+    if (!vdev->vm_running) {
+        /* Device state is saved with the VM stopped */
+        virtio_balloon_report_drain(s);
+    } else if (s->reporting_vq && (status & VIRTIO_CONFIG_S_DRIVER_OK)) {
+        /* Reports may have queued up behind the batch drained on stop */
+        virtio_balloon_handle_report(vdev, s->reporting_vq);
+    }
+
     if (virtio_balloon_free_page_support(s)) {
         /*
          * The VM is woken up and the iothread was blocked, so signal it to
@@ -249,6 +249,14 @@ void hmp_virtio_queue_status(Monitor *mon, const QDict *qdict)
         monitor_printf(mon, "  shadow_avail_idx:     %d\n",
                        s->shadow_avail_idx);
     }
+    if (s->has_poll_hits) {
+        monitor_printf(mon, "  poll_hits:            %"PRIu64"\n",
+                       s->poll_hits);
+    }
+    if (s->has_wakeups) {
+        monitor_printf(mon, "  wakeups:              %"PRIu64"\n",
+                       s->wakeups);
+    }
     monitor_printf(mon, "  VRing:\n");
     monitor_printf(mon, "    num:          %"PRId32"\n", s->vring_num);
     monitor_printf(mon, "    num_default:  %"PRId32"\n",
@@ -267,6 +267,80 @@ static void virtio_iommu_notify_unmap(IOMMUMemoryRegion *mr, hwaddr virt_start,
     virtio_iommu_notify_map_unmap(mr, &event, virt_start, virt_end);
 }
 
+/*
+ * MAP and UNMAP requests only update the domain mappings right away.  The
+ * IOMMU notifications they cause are queued, merged with the previous one
+ * for the same memory region when the ranges are adjacent, and delivered
+ * once the request queue has been drained, before the requests complete.
+ */
+typedef struct VirtIOIOMMUNotify {
+    IOMMUMemoryRegion *mr;
+    IOMMUNotifierFlag type;
+    hwaddr virt_start;
+    hwaddr virt_end;
+    hwaddr paddr;
+    uint32_t flags;
+} VirtIOIOMMUNotify;
+
+/* How far back to look for a notification to merge with */
+#define VIOMMU_NOTIFY_MERGE_DEPTH 8
+
+static void virtio_iommu_queue_notify(VirtIOIOMMU *s, IOMMUMemoryRegion *mr,
+                                      IOMMUNotifierFlag type,
+                                      hwaddr virt_start, hwaddr virt_end,
+                                      hwaddr paddr, uint32_t flags)
+{
+    VirtIOIOMMUNotify n = {
+        .mr = mr,
+        .type = type,
+        .virt_start = virt_start,
+        .virt_end = virt_end,
+        .paddr = paddr,
+        .flags = flags,
+    };
+    int i;
+
+    for (i = s->notify_batch->len - 1;
+         i >= 0 && i >= (int)s->notify_batch->len - VIOMMU_NOTIFY_MERGE_DEPTH;
+         i--) {
+        VirtIOIOMMUNotify *prev = &g_array_index(s->notify_batch,
+                                                 VirtIOIOMMUNotify, i);
+
+        if (prev->mr != mr) {
+            continue;
+        }
+        /* Only the latest notification for @mr can be extended */
+        if (prev->type == type && prev->virt_end + 1 == virt_start &&
+            virt_start != 0 &&
+            (type == IOMMU_NOTIFIER_UNMAP ||
+             (prev->flags == flags &&
+              prev->paddr + (virt_start - prev->virt_start) == paddr))) {
+            prev->virt_end = virt_end;
+            return;
+        }
+        break;
+    }
+    g_array_append_val(s->notify_batch, n);
+}
+
+static void virtio_iommu_flush_notify(VirtIOIOMMU *s)
+{
+    int i;
+
+    for (i = 0; i < s->notify_batch->len; i++) {
+        VirtIOIOMMUNotify *n = &g_array_index(s->notify_batch,
+                                              VirtIOIOMMUNotify, i);
+
+        if (n->type == IOMMU_NOTIFIER_MAP) {
+            virtio_iommu_notify_map(n->mr, n->virt_start, n->virt_end,
+                                    n->paddr, n->flags);
+        } else {
+            virtio_iommu_notify_unmap(n->mr, n->virt_start, n->virt_end);
+        }
+    }
+    g_array_set_size(s->notify_batch, 0);
+}
+
 static gboolean virtio_iommu_notify_unmap_cb(gpointer key, gpointer value,
                                              gpointer data)
 {
@@ -571,8 +645,8 @@ static int virtio_iommu_map(VirtIOIOMMU *s,
     g_tree_insert(domain->mappings, interval, mapping);
 
     QLIST_FOREACH(ep, &domain->endpoint_list, next) {
-        virtio_iommu_notify_map(ep->iommu_mr, virt_start, virt_end, phys_start,
-                                flags);
+        virtio_iommu_queue_notify(s, ep->iommu_mr, IOMMU_NOTIFIER_MAP,
+                                  virt_start, virt_end, phys_start, flags);
     }
 
     return VIRTIO_IOMMU_S_OK;
@@ -611,8 +685,9 @@ static int virtio_iommu_unmap(VirtIOIOMMU *s,
 
         if (interval.low <= current_low && interval.high >= current_high) {
             QLIST_FOREACH(ep, &domain->endpoint_list, next) {
-                virtio_iommu_notify_unmap(ep->iommu_mr, current_low,
-                                          current_high);
+                virtio_iommu_queue_notify(s, ep->iommu_mr,
+                                          IOMMU_NOTIFIER_UNMAP, current_low,
+                                          current_high, 0, 0);
             }
             g_tree_remove(domain->mappings, iter_key);
             trace_virtio_iommu_unmap_done(domain_id, current_low, current_high);
@@ -730,16 +805,22 @@ static void virtio_iommu_handle_command(VirtIODevice *vdev, VirtQueue *vq)
     struct virtio_iommu_req_tail tail = {};
     VirtQueueElement *elem;
     unsigned int iov_cnt;
+    unsigned int done = 0;
     struct iovec *iov;
     void *buf = NULL;
     size_t sz;
 
+    /*
+     * Drain the queue before delivering the queued notifications, then
+     * complete all the requests at once: the guest must not see a request
+     * complete before the mappings it changed have been propagated.
+     */
     for (;;) {
         size_t output_size = sizeof(tail);
 
         elem = virtqueue_pop(vq, sizeof(VirtQueueElement));
         if (!elem) {
-            return;
+            break;
         }
 
         if (iov_size(elem->in_sg, elem->in_num) < sizeof(tail) ||
@@ -760,9 +841,12 @@ static void virtio_iommu_handle_command(VirtIODevice *vdev, VirtQueue *vq)
         qemu_rec_mutex_lock(&s->mutex);
         switch (head.type) {
         case VIRTIO_IOMMU_T_ATTACH:
+            /* Attach and detach notify directly, keep the order */
+            virtio_iommu_flush_notify(s);
             tail.status = virtio_iommu_handle_attach(s, iov, iov_cnt);
             break;
         case VIRTIO_IOMMU_T_DETACH:
+            virtio_iommu_flush_notify(s);
             tail.status = virtio_iommu_handle_detach(s, iov, iov_cnt);
             break;
         case VIRTIO_IOMMU_T_MAP:
@@ -792,12 +876,20 @@ out:
                           buf ? buf : &tail, output_size);
         assert(sz == output_size);
 
-        virtqueue_push(vq, elem, sz);
-        virtio_notify(vdev, vq);
+        virtqueue_fill(vq, elem, sz, done++);
         g_free(elem);
         g_free(buf);
         buf = NULL;
     }
+
+    qemu_rec_mutex_lock(&s->mutex);
+    virtio_iommu_flush_notify(s);
+    qemu_rec_mutex_unlock(&s->mutex);
+
+    if (done) {
+        virtqueue_flush(vq, done);
+        virtio_notify(vdev, vq);
+    }
 }
 
 static void virtio_iommu_report_fault(VirtIOIOMMU *viommu, uint8_t reason,
@@ -1202,6 +1294,7 @@ static void virtio_iommu_device_realize(DeviceState *dev, Error **errp)
     virtio_add_feature(&s->features, VIRTIO_IOMMU_F_BYPASS_CONFIG);
 
     qemu_rec_mutex_init(&s->mutex);
+    s->notify_batch = g_array_new(false, false, sizeof(VirtIOIOMMUNotify));
 
     s->as_by_busptr = g_hash_table_new_full(NULL, NULL, NULL, g_free);
 
@@ -1234,6 +1327,7 @@ static void virtio_iommu_device_unrealize(DeviceState *dev)
     }
 
     qemu_rec_mutex_destroy(&s->mutex);
+    g_array_free(s->notify_batch, true);
 
     virtio_delete_queue(s->req_vq);
     virtio_delete_queue(s->event_vq);
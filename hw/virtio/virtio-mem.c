@@ -483,6 +483,59 @@ static bool virtio_mem_valid_range(const VirtIOMEM *vmem, uint64_t gpa,
     return true;
 }
 
+static void virtio_mem_prealloc_failed(Error *err)
+{
+    static bool warned;
+
+    /* Warn only once, we don't want to fill the log with these warnings. */
+    if (!warned) {
+        warn_report_err(err);
+        warned = true;
+    } else {
+        error_free(err);
+    }
+}
+
+/*
+ * Preallocate using the threads and thread context configured for the
+ * memory backend ("prealloc-threads", "prealloc-context"), even though
+ * "prealloc" itself is not set on the backend.
+ */
+static int virtio_mem_prealloc(const VirtIOMEM *vmem, uint64_t offset,
+                               uint64_t size, Error **errp)
+{
+    void *area = memory_region_get_ram_ptr(&vmem->memdev->mr) + offset;
+    int fd = memory_region_get_fd(&vmem->memdev->mr);
+    Error *local_err = NULL;
+
+    qemu_prealloc_mem(fd, area, size, vmem->memdev->prealloc_threads,
+                      vmem->memdev->prealloc_context, &local_err);
+    if (local_err) {
+        error_propagate(errp, local_err);
+        return -ENOMEM;
+    }
+    return 0;
+}
+
+/* Expose a preallocated range to the listeners and mark it plugged. */
+static int virtio_mem_plug_finish(VirtIOMEM *vmem, uint64_t start_gpa,
+                                  uint64_t size, int ret)
+{
+    const uint64_t offset = start_gpa - vmem->addr;
+
+    if (!ret) {
+        ret = virtio_mem_notify_plug(vmem, offset, size);
+    }
+    if (ret) {
+        /* Could be preallocation or a notifier populated memory. */
+        ram_block_discard_range(vmem->memdev->mr.ram_block, offset, size);
+        return -EBUSY;
+    }
+
+    virtio_mem_set_range_plugged(vmem, start_gpa, size);
+    return 0;
+}
+
 static int virtio_mem_set_block_state(VirtIOMEM *vmem, uint64_t start_gpa,
                                       uint64_t size, bool plug)
 {
@@ -504,47 +557,35 @@ static int virtio_mem_set_block_state(VirtIOMEM *vmem, uint64_t start_gpa,
     }
 
     if (vmem->prealloc) {
-        void *area = memory_region_get_ram_ptr(&vmem->memdev->mr) + offset;
-        int fd = memory_region_get_fd(&vmem->memdev->mr);
         Error *local_err = NULL;
 
-        qemu_prealloc_mem(fd, area, size, 1, NULL, &local_err);
-        if (local_err) {
-            static bool warned;
-
-            /*
-             * Warn only once, we don't want to fill the log with these
-             * warnings.
-             */
-            if (!warned) {
-                warn_report_err(local_err);
-                warned = true;
-            } else {
-                error_free(local_err);
-            }
+        if (virtio_mem_prealloc(vmem, offset, size, &local_err)) {
+            virtio_mem_prealloc_failed(local_err);
             ret = -EBUSY;
         }
     }
 
-    if (!ret) {
-        ret = virtio_mem_notify_plug(vmem, offset, size);
-    }
+    return virtio_mem_plug_finish(vmem, start_gpa, size, ret);
+}
+
+static uint16_t virtio_mem_state_changed(VirtIOMEM *vmem, uint64_t size,
+                                         bool plug, int ret)
+{
     if (ret) {
-        /* Could be preallocation or a notifier populated memory. */
-        ram_block_discard_range(vmem->memdev->mr.ram_block, offset, size);
-        return -EBUSY;
+        return VIRTIO_MEM_RESP_BUSY;
     }
-
-    virtio_mem_set_range_plugged(vmem, start_gpa, size);
-    return 0;
+    if (plug) {
+        vmem->size += size;
+    } else {
+        vmem->size -= size;
+    }
+    notifier_list_notify(&vmem->size_change_notifiers, &vmem->size);
+    return VIRTIO_MEM_RESP_ACK;
 }
 
-static int virtio_mem_state_change_request(VirtIOMEM *vmem, uint64_t gpa,
-                                           uint16_t nb_blocks, bool plug)
+static uint16_t virtio_mem_check_state_change(VirtIOMEM *vmem, uint64_t gpa,
+                                              uint64_t size, bool plug)
 {
-    const uint64_t size = nb_blocks * vmem->block_size;
-    int ret;
-
     if (!virtio_mem_valid_range(vmem, gpa, size)) {
         return VIRTIO_MEM_RESP_ERROR;
     }
@@ -558,21 +599,105 @@ static int virtio_mem_state_change_request(VirtIOMEM *vmem, uint64_t gpa,
         (!plug && !virtio_mem_is_range_plugged(vmem, gpa, size))) {
         return VIRTIO_MEM_RESP_ERROR;
     }
+    return VIRTIO_MEM_RESP_ACK;
+}
+
+static int virtio_mem_state_change_request(VirtIOMEM *vmem, uint64_t gpa,
+                                           uint16_t nb_blocks, bool plug)
+{
+    const uint64_t size = nb_blocks * vmem->block_size;
+    uint16_t type;
+    int ret;
+
+    type = virtio_mem_check_state_change(vmem, gpa, size, plug);
+    if (type != VIRTIO_MEM_RESP_ACK) {
+        return type;
+    }
 
     ret = virtio_mem_set_block_state(vmem, gpa, size, plug);
-    if (ret) {
-        return VIRTIO_MEM_RESP_BUSY;
+    return virtio_mem_state_changed(vmem, size, plug, ret);
+}
+
+/* Called from a preallocation thread. */
+static void virtio_mem_plug_prealloc_done(void *opaque, int ret)
+{
+    VirtIOMEM *vmem = opaque;
+
+    vmem->plug_ret = ret;
+    qemu_event_set(&vmem->plug_done);
+    qemu_bh_schedule(vmem->plug_bh);
+}
+
+/*
+ * Start preallocating the range of a plug request in the background, so
+ * that plugging large amounts of memory neither blocks the main loop nor
+ * runs single-threaded. Returns false if the request has to be handled
+ * synchronously instead.
+ */
+static bool virtio_mem_plug_request_async(VirtIOMEM *vmem,
+                                          VirtQueueElement *elem,
+                                          uint64_t gpa, uint16_t nb_blocks)
+{
+    const uint64_t size = nb_blocks * vmem->block_size;
+    const uint64_t offset = gpa - vmem->addr;
+
+    if (!vmem->prealloc || virtio_mem_is_busy() ||
+        virtio_mem_check_state_change(vmem, gpa, size, true) !=
+        VIRTIO_MEM_RESP_ACK) {
+        return false;
     }
-    if (plug) {
-        vmem->size += size;
-    } else {
-        vmem->size -= size;
+
+    vmem->plug_elem = elem;
+    vmem->plug_gpa = gpa;
+    vmem->plug_size = size;
+    qemu_event_reset(&vmem->plug_done);
+    if (!qemu_prealloc_mem_async(memory_region_get_fd(&vmem->memdev->mr),
+                                 memory_region_get_ram_ptr(&vmem->memdev->mr) +
+                                 offset, size, vmem->memdev->prealloc_threads,
+                                 vmem->memdev->prealloc_context,
+                                 virtio_mem_plug_prealloc_done, vmem)) {
+        vmem->plug_elem = NULL;
+        return false;
     }
-    notifier_list_notify(&vmem->size_change_notifiers, &vmem->size);
-    return VIRTIO_MEM_RESP_ACK;
+    trace_virtio_mem_plug_prealloc_async(gpa, size);
+    return true;
+}
+
+/*
+ * Complete the pending plug request, waiting for its preallocation to
+ * finish if necessary. Returns false if there was none.
+ */
+static bool virtio_mem_plug_complete(VirtIOMEM *vmem)
+{
+    VirtQueueElement *elem = vmem->plug_elem;
+    uint16_t type;
+    int ret;
+
+    if (!elem) {
+        return false;
+    }
+    qemu_event_wait(&vmem->plug_done);
+    vmem->plug_elem = NULL;
+
+    ret = vmem->plug_ret;
+    trace_virtio_mem_plug_prealloc_done(vmem->plug_gpa, ret);
+    if (ret) {
+        Error *local_err = NULL;
+
+        error_setg_errno(&local_err, -ret, "virtio-mem: preallocation failed");
+        virtio_mem_prealloc_failed(local_err);
+    } else if (virtio_mem_is_busy()) {
+        /* Migration started in the meantime. */
+        ret = -EBUSY;
+    }
+    ret = virtio_mem_plug_finish(vmem, vmem->plug_gpa, vmem->plug_size, ret);
+    type = virtio_mem_state_changed(vmem, vmem->plug_size, true, ret);
+    virtio_mem_send_response_simple(vmem, elem, type);
+    g_free(elem);
+    return true;
 }
 
-static void virtio_mem_plug_request(VirtIOMEM *vmem, VirtQueueElement *elem,
+static bool virtio_mem_plug_request(VirtIOMEM *vmem, VirtQueueElement *elem,
                                     struct virtio_mem_req *req)
 {
     const uint64_t gpa = le64_to_cpu(req->u.plug.addr);
@@ -580,8 +705,12 @@ static void virtio_mem_plug_request(VirtIOMEM *vmem, VirtQueueElement *elem,
     uint16_t type;
 
     trace_virtio_mem_plug_request(gpa, nb_blocks);
+    if (virtio_mem_plug_request_async(vmem, elem, gpa, nb_blocks)) {
+        return true;
+    }
     type = virtio_mem_state_change_request(vmem, gpa, nb_blocks, true);
     virtio_mem_send_response_simple(vmem, elem, type);
+    return false;
 }
 
 static void virtio_mem_unplug_request(VirtIOMEM *vmem, VirtQueueElement *elem,
@@ -622,6 +751,7 @@ static int virtio_mem_unplug_all(VirtIOMEM *vmem)
 {
     RAMBlock *rb = vmem->memdev->mr.ram_block;
 
+    virtio_mem_plug_complete(vmem);
     if (vmem->size) {
         if (virtio_mem_is_busy()) {
             return -EBUSY;
@@ -688,6 +818,10 @@ static void virtio_mem_handle_request(VirtIODevice *vdev, VirtQueue *vq)
     uint16_t type;
 
     while (true) {
+        if (vmem->plug_elem) {
+            /* Resumed from virtio_mem_plug_bh() */
+            return;
+        }
         elem = virtqueue_pop(vq, sizeof(VirtQueueElement));
         if (!elem) {
             return;
@@ -714,7 +848,10 @@ static void virtio_mem_handle_request(VirtIODevice *vdev, VirtQueue *vq)
         type = le16_to_cpu(req.type);
         switch (type) {
         case VIRTIO_MEM_REQ_PLUG:
-            virtio_mem_plug_request(vmem, elem, &req);
+            if (virtio_mem_plug_request(vmem, elem, &req)) {
+                /* Responded to from virtio_mem_plug_bh() */
+                continue;
+            }
             break;
         case VIRTIO_MEM_REQ_UNPLUG:
             virtio_mem_unplug_request(vmem, elem, &req);
@@ -737,6 +874,34 @@ static void virtio_mem_handle_request(VirtIODevice *vdev, VirtQueue *vq)
     }
 }
 
+static void virtio_mem_plug_bh(void *opaque)
+{
+    VirtIOMEM *vmem = VIRTIO_MEM(opaque);
+
+    virtio_mem_plug_complete(vmem);
+    /* Don't start new requests while device state might get saved */
+    if (runstate_is_running()) {
+        virtio_mem_handle_request(VIRTIO_DEVICE(vmem), vmem->vq);
+    }
+}
+
+/*
+ * Device state is saved with the VM stopped; make sure no request is in
+ * flight by then, and pick up requests that queued up behind it once the
+ * VM runs again.
+ */
+static void virtio_mem_vm_state_change(void *opaque, bool running,
+                                       RunState state)
+{
+    VirtIOMEM *vmem = VIRTIO_MEM(opaque);
+
+    if (running) {
+        qemu_bh_schedule(vmem->plug_bh);
+    } else {
+        virtio_mem_plug_complete(vmem);
+    }
+}
+
 static void virtio_mem_get_config(VirtIODevice *vdev, uint8_t *config_data)
 {
     VirtIOMEM *vmem = VIRTIO_MEM(vdev);
@@ -778,6 +943,12 @@ static int virtio_mem_validate_features(VirtIODevice *vdev)
     return 0;
 }
 
+static void virtio_mem_device_reset(VirtIODevice *vdev)
+{
+    /* Respond before the virtqueue is reset */
+    virtio_mem_plug_complete(VIRTIO_MEM(vdev));
+}
+
 static void virtio_mem_system_reset(void *opaque)
 {
     VirtIOMEM *vmem = VIRTIO_MEM(opaque);
@@ -930,6 +1101,12 @@ static void virtio_mem_device_realize(DeviceState *dev, Error **errp)
     virtio_init(vdev, VIRTIO_ID_MEM, sizeof(struct virtio_mem_config));
     vmem->vq = virtio_add_queue(vdev, 128, virtio_mem_handle_request);
 
+    qemu_event_init(&vmem->plug_done, true);
+    vmem->plug_bh = qemu_bh_new_guarded(virtio_mem_plug_bh, vmem,
+                                        &dev->mem_reentrancy_guard);
+    vmem->vmstate_change = qemu_add_vm_change_state_handler(
+                               virtio_mem_vm_state_change, vmem);
+
     host_memory_backend_set_mapped(vmem->memdev, true);
     vmstate_register_ram(&vmem->memdev->mr, DEVICE(vmem));
     if (vmem->early_migration) {
@@ -957,6 +1134,10 @@ static void virtio_mem_device_unrealize(DeviceState *dev)
      */
     memory_region_set_ram_discard_manager(&vmem->memdev->mr, NULL);
     qemu_unregister_reset(virtio_mem_system_reset, vmem);
+    virtio_mem_plug_complete(vmem);
+    qemu_del_vm_change_state_handler(vmem->vmstate_change);
+    qemu_bh_delete(vmem->plug_bh);
+    qemu_event_destroy(&vmem->plug_done);
     if (vmem->early_migration) {
         vmstate_unregister(VMSTATE_IF(vmem), &vmstate_virtio_mem_device_early,
                            vmem);
@@ -1024,16 +1205,14 @@ static int virtio_mem_post_load(void *opaque, int version_id)
 static int virtio_mem_prealloc_range_cb(const VirtIOMEM *vmem, void *arg,
                                         uint64_t offset, uint64_t size)
 {
-    void *area = memory_region_get_ram_ptr(&vmem->memdev->mr) + offset;
-    int fd = memory_region_get_fd(&vmem->memdev->mr);
     Error *local_err = NULL;
+    int ret;
 
-    qemu_prealloc_mem(fd, area, size, 1, NULL, &local_err);
-    if (local_err) {
+    ret = virtio_mem_prealloc(vmem, offset, size, &local_err);
+    if (ret) {
         error_report_err(local_err);
-        return -ENOMEM;
     }
-    return 0;
+    return ret;
 }
 
 static int virtio_mem_post_load_early(void *opaque, int version_id)
@@ -1552,6 +1731,7 @@ static void virtio_mem_class_init(ObjectClass *klass, void *data)
     vdc->get_config = virtio_mem_get_config;
     vdc->get_features = virtio_mem_get_features;
     vdc->validate_features = virtio_mem_validate_features;
+    vdc->reset = virtio_mem_device_reset;
     vdc->vmsd = &vmstate_virtio_mem_device;
 
     vmc->fill_device_info = virtio_mem_fill_device_info;
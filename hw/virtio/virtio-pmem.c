@@ -28,66 +28,90 @@
 
 typedef struct VirtIODeviceRequest {
     VirtQueueElement elem;
-    int fd;
-    VirtIOPMEM *pmem;
-    VirtIODevice *vdev;
     struct virtio_pmem_req req;
     struct virtio_pmem_resp resp;
+    QSIMPLEQ_ENTRY(VirtIODeviceRequest) next;
 } VirtIODeviceRequest;
 
+static void virtio_pmem_flush_start(VirtIOPMEM *pmem);
+
 static int worker_cb(void *opaque)
 {
-    VirtIODeviceRequest *req_data = opaque;
-    int err = 0;
+    VirtIOPMEM *pmem = opaque;
+    HostMemoryBackend *backend = MEMORY_BACKEND(pmem->memdev);
+    int err;
 
-    /* flush raw backing image */
-    err = fsync(req_data->fd);
+    /*
+     * Flush raw backing image. The file size never changes, so there is no
+     * metadata that fdatasync would miss.
+     */
+    err = qemu_fdatasync(memory_region_get_fd(&backend->mr));
     trace_virtio_pmem_flush_done(err);
-    if (err != 0) {
-        err = 1;
-    }
+    return err ? -errno : 0;
+}
 
-    virtio_stl_p(req_data->vdev, &req_data->resp.ret, err);
+static void done_cb(void *opaque, int ret)
+{
+    VirtIOPMEM *pmem = opaque;
+    VirtIODevice *vdev = VIRTIO_DEVICE(pmem);
+    VirtIODeviceRequest *req_data, *next;
+
+    QSIMPLEQ_FOREACH_SAFE(req_data, &pmem->flush_running, next, next) {
+        int len;
+
+        virtio_stl_p(vdev, &req_data->resp.ret, ret ? 1 : 0);
+        len = iov_from_buf(req_data->elem.in_sg, req_data->elem.in_num, 0,
+                           &req_data->resp, sizeof(struct virtio_pmem_resp));
+        virtqueue_push(pmem->rq_vq, &req_data->elem, len);
+        trace_virtio_pmem_response();
+        g_free(req_data);
+    }
+    QSIMPLEQ_INIT(&pmem->flush_running);
+    virtio_notify(vdev, pmem->rq_vq);
 
-    return 0;
+    virtio_pmem_flush_start(pmem);
 }
 
-static void done_cb(void *opaque, int ret)
+/*
+ * Only one fdatasync runs at a time. Requests that arrive while it is in
+ * flight may cover writes it does not, so they wait for the next one, which
+ * then completes all of them at once.
+ */
+static void virtio_pmem_flush_start(VirtIOPMEM *pmem)
 {
-    VirtIODeviceRequest *req_data = opaque;
-    int len = iov_from_buf(req_data->elem.in_sg, req_data->elem.in_num, 0,
-                              &req_data->resp, sizeof(struct virtio_pmem_resp));
-
-    /* Callbacks are serialized, so no need to use atomic ops. */
-    virtqueue_push(req_data->pmem->rq_vq, &req_data->elem, len);
-    virtio_notify((VirtIODevice *)req_data->pmem, req_data->pmem->rq_vq);
-    trace_virtio_pmem_response();
-    g_free(req_data);
+    VirtIODeviceRequest *req_data;
+    unsigned int reqs = 0;
+
+    if (!QSIMPLEQ_EMPTY(&pmem->flush_running) ||
+        QSIMPLEQ_EMPTY(&pmem->flush_pending)) {
+        return;
+    }
+
+    QSIMPLEQ_CONCAT(&pmem->flush_running, &pmem->flush_pending);
+    QSIMPLEQ_FOREACH(req_data, &pmem->flush_running, next) {
+        reqs++;
+    }
+    trace_virtio_pmem_flush_start(reqs);
+    thread_pool_submit_aio(worker_cb, pmem, done_cb, pmem);
 }
 
 static void virtio_pmem_flush(VirtIODevice *vdev, VirtQueue *vq)
 {
     VirtIODeviceRequest *req_data;
     VirtIOPMEM *pmem = VIRTIO_PMEM(vdev);
-    HostMemoryBackend *backend = MEMORY_BACKEND(pmem->memdev);
 
-    trace_virtio_pmem_flush_request();
-    req_data = virtqueue_pop(vq, sizeof(VirtIODeviceRequest));
-    if (!req_data) {
-        virtio_error(vdev, "virtio-pmem missing request data");
-        return;
+    while ((req_data = virtqueue_pop(vq, sizeof(VirtIODeviceRequest)))) {
+        trace_virtio_pmem_flush_request();
+        if (req_data->elem.out_num < 1 || req_data->elem.in_num < 1) {
+            virtio_error(vdev, "virtio-pmem request not proper");
+            virtqueue_detach_element(vq, (VirtQueueElement *)req_data, 0);
+            g_free(req_data);
+            break;
+        }
+        QSIMPLEQ_INSERT_TAIL(&pmem->flush_pending, req_data, next);
     }
 
-    if (req_data->elem.out_num < 1 || req_data->elem.in_num < 1) {
-        virtio_error(vdev, "virtio-pmem request not proper");
-        virtqueue_detach_element(vq, (VirtQueueElement *)req_data, 0);
-        g_free(req_data);
-        return;
-    }
-    req_data->fd   = memory_region_get_fd(&backend->mr);
-    req_data->pmem = pmem;
-    req_data->vdev = vdev;
-    thread_pool_submit_aio(worker_cb, req_data, done_cb, req_data);
+    virtio_pmem_flush_start(pmem);
 }
 
 static void virtio_pmem_get_config(VirtIODevice *vdev, uint8_t *config)
@@ -124,6 +148,8 @@ static void virtio_pmem_realize(DeviceState *dev, Error **errp)
     host_memory_backend_set_mapped(pmem->memdev, true);
     virtio_init(vdev, VIRTIO_ID_PMEM, sizeof(struct virtio_pmem_config));
     pmem->rq_vq = virtio_add_queue(vdev, 128, virtio_pmem_flush);
+    QSIMPLEQ_INIT(&pmem->flush_pending);
+    QSIMPLEQ_INIT(&pmem->flush_running);
 }
 
 static void virtio_pmem_unrealize(DeviceState *dev)
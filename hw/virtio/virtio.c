@@ -30,6 +30,8 @@
 #include "hw/virtio/virtio-access.h"
 #include "sysemu/dma.h"
 #include "sysemu/runstate.h"
+#include "sysemu/stats.h"
+#include "sysemu/xen.h"
 #include "virtio-qmp.h"
 
 #include "standard-headers/linux/virtio_ids.h"
@@ -153,6 +155,23 @@ struct VirtQueue
     EventNotifier host_notifier;
     bool host_notifier_enabled;
     QLIST_ENTRY(VirtQueue) node;
+
+    /* Notification coalescing, disabled while coalesce_timer is NULL */
+    uint32_t coalesce_max_frames;
+    uint32_t coalesce_usecs;
+    bool coalesce_adaptive;
+    /* Whether the deferred notification goes through the irqfd */
+    bool coalesce_irqfd;
+    uint32_t coalesce_pending;
+    int64_t coalesce_last_us;
+    AioContext *coalesce_ctx;
+    QEMUTimer *coalesce_timer;
+
+    /* Minimum AioContext polling time, 0 for the adaptive default */
+    int64_t poll_budget_ns;
+    /* Requests found by polling and by host notifier wakeups */
+    uint64_t poll_hits;
+    uint64_t wakeups;
 };
 
 const char *virtio_device_names[] = {
@@ -226,6 +245,19 @@ static void virtio_virtqueue_reset_region_cache(struct VirtQueue *vq)
     }
 }
 
+/* Drop the coalescing state without delivering what it holds back */
+static void virtio_queue_coalesce_reset(VirtQueue *vq)
+{
+    if (vq->coalesce_timer) {
+        timer_free(vq->coalesce_timer);
+        vq->coalesce_timer = NULL;
+    }
+    vq->coalesce_max_frames = 0;
+    vq->coalesce_usecs = 0;
+    vq->coalesce_adaptive = false;
+    vq->coalesce_pending = 0;
+}
+
 void virtio_init_region_cache(VirtIODevice *vdev, int n)
 {
     VirtQueue *vq = &vdev->vq[n];
@@ -873,9 +905,15 @@ static void virtqueue_packed_fill(VirtQueue *vq, const VirtQueueElement *elem,
     vq->used_elems[idx].ndescs = elem->ndescs;
 }
 
+/*
+ * Write the used descriptor for @elem @off descriptors after used_idx.
+ * Used descriptors are written at the position of the first descriptor
+ * of their chain, so @off must account for the ndescs of any element
+ * flushed before @elem.
+ */
 static void virtqueue_packed_fill_desc(VirtQueue *vq,
                                        const VirtQueueElement *elem,
-                                       unsigned int idx,
+                                       unsigned int off,
                                        bool strict_order)
 {
     uint16_t head;
@@ -890,7 +928,7 @@ static void virtqueue_packed_fill_desc(VirtQueue *vq,
         return;
     }
 
-    head = vq->used_idx + idx;
+    head = vq->used_idx + off;
     if (head >= vq->vring.num) {
         head -= vq->vring.num;
         wrap_counter ^= 1;
@@ -911,6 +949,72 @@ static void virtqueue_packed_fill_desc(VirtQueue *vq,
     vring_packed_desc_write(vq->vdev, &desc, &caches->desc, head, strict_order);
 }
 
+/*
+ * With VIRTIO_F_IN_ORDER, used_elems is indexed by ring position: each
+ * popped element is recorded at the slot it was made available in, and
+ * completions are written back to the used ring only once all elements
+ * before them have completed too.
+ */
+static void virtqueue_ordered_record(VirtQueue *vq, unsigned int slot,
+                                     const VirtQueueElement *elem)
+{
+    VirtQueueElement *used;
+
+    /* used_elems is sized for the default ring size */
+    if (unlikely(vq->vring.num > vq->vring.num_default)) {
+        virtio_error(vq->vdev, "In-order ring size %u exceeds maximum %u",
+                     vq->vring.num, vq->vring.num_default);
+        return;
+    }
+
+    used = &vq->used_elems[slot];
+    used->index = elem->index;
+    used->ndescs = elem->ndescs;
+    used->len = 0;
+    used->in_order_filled = false;
+}
+
+static unsigned int virtqueue_ordered_first_slot(VirtQueue *vq)
+{
+    if (virtio_vdev_has_feature(vq->vdev, VIRTIO_F_RING_PACKED)) {
+        return vq->used_idx;
+    }
+    return vq->used_idx % vq->vring.num;
+}
+
+static unsigned int virtqueue_ordered_next_slot(VirtQueue *vq,
+                                                unsigned int slot)
+{
+    unsigned int step = 1;
+
+    if (virtio_vdev_has_feature(vq->vdev, VIRTIO_F_RING_PACKED)) {
+        step = MAX(vq->used_elems[slot].ndescs, 1);
+    }
+    slot += step;
+    return slot >= vq->vring.num ? slot - vq->vring.num : slot;
+}
+
+static void virtqueue_ordered_fill(VirtQueue *vq, const VirtQueueElement *elem,
+                                   unsigned int len)
+{
+    unsigned int slot = virtqueue_ordered_first_slot(vq);
+    unsigned int n;
+
+    for (n = 0; n < vq->vring.num; n++) {
+        VirtQueueElement *used = &vq->used_elems[slot];
+
+        if (used->index == elem->index && !used->in_order_filled) {
+            used->len = len;
+            used->in_order_filled = true;
+            return;
+        }
+        slot = virtqueue_ordered_next_slot(vq, slot);
+    }
+
+    virtio_error(vq->vdev, "Element %u was not made available in order",
+                 elem->index);
+}
+
 /* Called within rcu_read_lock().  */
 void virtqueue_fill(VirtQueue *vq, const VirtQueueElement *elem,
                     unsigned int len, unsigned int idx)
@@ -923,7 +1027,9 @@ void virtqueue_fill(VirtQueue *vq, const VirtQueueElement *elem,
         return;
     }
 
-    if (virtio_vdev_has_feature(vq->vdev, VIRTIO_F_RING_PACKED)) {
+    if (virtio_vdev_has_feature(vq->vdev, VIRTIO_F_IN_ORDER)) {
+        virtqueue_ordered_fill(vq, elem, len);
+    } else if (virtio_vdev_has_feature(vq->vdev, VIRTIO_F_RING_PACKED)) {
         virtqueue_packed_fill(vq, elem, len, idx);
     } else {
         virtqueue_split_fill(vq, elem, len, idx);
@@ -950,27 +1056,83 @@ static void virtqueue_split_flush(VirtQueue *vq, unsigned int count)
         vq->signalled_used_valid = false;
 }
 
+static void virtqueue_packed_advance_used(VirtQueue *vq, unsigned int ndescs)
+{
+    vq->inuse -= ndescs;
+    vq->used_idx += ndescs;
+    if (vq->used_idx >= vq->vring.num) {
+        vq->used_idx -= vq->vring.num;
+        vq->used_wrap_counter ^= 1;
+        vq->signalled_used_valid = false;
+    }
+}
+
 static void virtqueue_packed_flush(VirtQueue *vq, unsigned int count)
 {
-    unsigned int i, ndescs = 0;
+    unsigned int i, ndescs;
 
     if (unlikely(!vq->vring.desc)) {
         return;
     }
 
+    /*
+     * The first descriptor is written last, with a barrier, so that the
+     * driver does not see any of the batch before all of it is there.
+     */
+    ndescs = vq->used_elems[0].ndescs;
     for (i = 1; i < count; i++) {
-        virtqueue_packed_fill_desc(vq, &vq->used_elems[i], i, false);
+        virtqueue_packed_fill_desc(vq, &vq->used_elems[i], ndescs, false);
         ndescs += vq->used_elems[i].ndescs;
     }
     virtqueue_packed_fill_desc(vq, &vq->used_elems[0], 0, true);
-    ndescs += vq->used_elems[0].ndescs;
 
-    vq->inuse -= ndescs;
-    vq->used_idx += ndescs;
-    if (vq->used_idx >= vq->vring.num) {
-        vq->used_idx -= vq->vring.num;
-        vq->used_wrap_counter ^= 1;
-        vq->signalled_used_valid = false;
+    virtqueue_packed_advance_used(vq, ndescs);
+}
+
+/*
+ * Write back all completed elements that are next in ring order, as
+ * one batch: a single barrier and used index update for split rings,
+ * the first used descriptor written last for packed rings.
+ */
+static void virtqueue_ordered_flush(VirtQueue *vq)
+{
+    bool packed = virtio_vdev_has_feature(vq->vdev, VIRTIO_F_RING_PACKED);
+    unsigned int first = virtqueue_ordered_first_slot(vq);
+    unsigned int slot = first, count = 0, ndescs = 0;
+    VirtQueueElement *used;
+
+    if (unlikely(packed ? !vq->vring.desc : !vq->vring.used)) {
+        return;
+    }
+
+    while (count < vq->vring.num && vq->used_elems[slot].in_order_filled) {
+        used = &vq->used_elems[slot];
+        if (packed) {
+            if (count) {
+                virtqueue_packed_fill_desc(vq, used, ndescs, false);
+            }
+            ndescs += used->ndescs;
+        } else {
+            VRingUsedElem uelem = {
+                .id = used->index,
+                .len = used->len,
+            };
+            vring_used_write(vq, &uelem, slot);
+        }
+        used->in_order_filled = false;
+        count++;
+        slot = virtqueue_ordered_next_slot(vq, slot);
+    }
+
+    if (!count) {
+        return;
+    }
+
+    if (packed) {
+        virtqueue_packed_fill_desc(vq, &vq->used_elems[first], 0, true);
+        virtqueue_packed_advance_used(vq, ndescs);
+    } else {
+        virtqueue_split_flush(vq, count);
     }
 }
 
@@ -981,7 +1143,9 @@ void virtqueue_flush(VirtQueue *vq, unsigned int count)
         return;
     }
 
-    if (virtio_vdev_has_feature(vq->vdev, VIRTIO_F_RING_PACKED)) {
+    if (virtio_vdev_has_feature(vq->vdev, VIRTIO_F_IN_ORDER)) {
+        virtqueue_ordered_flush(vq);
+    } else if (virtio_vdev_has_feature(vq->vdev, VIRTIO_F_RING_PACKED)) {
         virtqueue_packed_flush(vq, count);
     } else {
         virtqueue_split_flush(vq, count);
@@ -1365,6 +1529,134 @@ int virtqueue_avail_bytes(VirtQueue *vq, unsigned int in_bytes,
     return in_bytes <= in_total && out_bytes <= out_total;
 }
 
+typedef struct VirtIORAMSection {
+    hwaddr start;
+    hwaddr size;
+    void *hva;
+    MemoryRegion *mr;
+    bool readonly;
+} VirtIORAMSection;
+
+typedef struct VirtIORAMMap {
+    struct rcu_head rcu;
+    unsigned int num;
+    VirtIORAMSection sections[];
+} VirtIORAMMap;
+
+/*
+ * Map @pa directly if it falls into a plain RAM section of the device's
+ * DMA address space, bypassing the flatview walk of address_space_map().
+ * The buffer is released with dma_memory_unmap() like any other mapping,
+ * so the MemoryRegion is referenced the same way address_space_map()
+ * does it.
+ */
+static void *virtio_ram_map(VirtIODevice *vdev, hwaddr pa, hwaddr *len,
+                            bool is_write)
+{
+    VirtIORAMMap *map;
+    VirtIORAMSection *s;
+    unsigned int lo = 0, hi;
+
+    RCU_READ_LOCK_GUARD();
+    map = qatomic_rcu_read(&vdev->ram_map);
+    if (!map) {
+        return NULL;
+    }
+
+    hi = map->num;
+    while (lo < hi) {
+        unsigned int mid = lo + (hi - lo) / 2;
+
+        s = &map->sections[mid];
+        if (pa < s->start) {
+            hi = mid;
+        } else if (pa - s->start >= s->size) {
+            lo = mid + 1;
+        } else {
+            if (is_write && s->readonly) {
+                return NULL;
+            }
+            *len = MIN(*len, s->size - (pa - s->start));
+            memory_region_ref(s->mr);
+            return s->hva + (pa - s->start);
+        }
+    }
+    return NULL;
+}
+
+static void virtio_ram_map_begin(MemoryListener *listener)
+{
+    VirtIODevice *vdev = container_of(listener, VirtIODevice, listener);
+
+    if (xen_enabled()) {
+        return;
+    }
+    g_assert(!vdev->ram_map_pending);
+    vdev->ram_map_pending = g_array_new(false, false,
+                                        sizeof(VirtIORAMSection));
+}
+
+static void virtio_ram_map_region_add(MemoryListener *listener,
+                                      MemoryRegionSection *section)
+{
+    VirtIODevice *vdev = container_of(listener, VirtIODevice, listener);
+    MemoryRegion *mr = section->mr;
+    VirtIORAMSection s;
+
+    if (!vdev->ram_map_pending || !memory_region_is_ram(mr) ||
+        memory_region_is_ram_device(mr)) {
+        return;
+    }
+
+    s.start = section->offset_within_address_space;
+    s.size = int128_get64(section->size);
+    s.hva = memory_region_get_ram_ptr(mr) + section->offset_within_region;
+    s.mr = mr;
+    s.readonly = !memory_access_is_direct(mr, true);
+    g_array_append_val(vdev->ram_map_pending, s);
+}
+
+static gint virtio_ram_section_cmp(gconstpointer a, gconstpointer b)
+{
+    const VirtIORAMSection *sa = a, *sb = b;
+
+    return sa->start < sb->start ? -1 : sa->start > sb->start;
+}
+
+static void virtio_ram_map_commit(VirtIODevice *vdev)
+{
+    GArray *pending = vdev->ram_map_pending;
+    VirtIORAMMap *map, *old;
+
+    if (!pending) {
+        return;
+    }
+
+    g_array_sort(pending, virtio_ram_section_cmp);
+    map = g_malloc(sizeof(*map) + pending->len * sizeof(VirtIORAMSection));
+    map->num = pending->len;
+    memcpy(map->sections, pending->data,
+           pending->len * sizeof(VirtIORAMSection));
+    g_array_free(pending, true);
+    vdev->ram_map_pending = NULL;
+
+    old = vdev->ram_map;
+    qatomic_rcu_set(&vdev->ram_map, map);
+    if (old) {
+        g_free_rcu(old, rcu);
+    }
+}
+
+static void virtio_ram_map_free(VirtIODevice *vdev)
+{
+    VirtIORAMMap *old = vdev->ram_map;
+
+    qatomic_rcu_set(&vdev->ram_map, NULL);
+    if (old) {
+        g_free_rcu(old, rcu);
+    }
+}
+
 static bool virtqueue_map_desc(VirtIODevice *vdev, unsigned int *p_num_sg,
                                hwaddr *addr, struct iovec *iov,
                                unsigned int max_num_sg, bool is_write,
@@ -1388,11 +1680,15 @@ static bool virtqueue_map_desc(VirtIODevice *vdev, unsigned int *p_num_sg,
             goto out;
         }
 
-        iov[num_sg].iov_base = dma_memory_map(vdev->dma_as, pa, &len,
-                                              is_write ?
-                                              DMA_DIRECTION_FROM_DEVICE :
-                                              DMA_DIRECTION_TO_DEVICE,
-                                              MEMTXATTRS_UNSPECIFIED);
+        iov[num_sg].iov_base = virtio_ram_map(vdev, pa, &len, is_write);
+        if (!iov[num_sg].iov_base) {
+            len = sz;
+            iov[num_sg].iov_base = dma_memory_map(vdev->dma_as, pa, &len,
+                                                  is_write ?
+                                                  DMA_DIRECTION_FROM_DEVICE :
+                                                  DMA_DIRECTION_TO_DEVICE,
+                                                  MEMTXATTRS_UNSPECIFIED);
+        }
         if (!iov[num_sg].iov_base) {
             virtio_error(vdev, "virtio: bogus descriptor or out of resources");
             goto out;
@@ -1483,7 +1779,7 @@ static void *virtqueue_alloc_element(size_t sz, unsigned out_num, unsigned in_nu
     return elem;
 }
 
-static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
+static void *virtqueue_split_pop(VirtQueue *vq, size_t sz, bool set_event)
 {
     unsigned int i, head, max;
     VRingMemoryRegionCaches *caches;
@@ -1520,7 +1816,7 @@ static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
         goto done;
     }
 
-    if (virtio_vdev_has_feature(vdev, VIRTIO_RING_F_EVENT_IDX)) {
+    if (set_event && virtio_vdev_has_feature(vdev, VIRTIO_RING_F_EVENT_IDX)) {
         vring_set_avail_event(vq, vq->last_avail_idx);
     }
 
@@ -1608,6 +1904,10 @@ static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
     }
 
     vq->inuse++;
+    if (virtio_vdev_has_feature(vdev, VIRTIO_F_IN_ORDER)) {
+        virtqueue_ordered_record(vq, (uint16_t)(vq->last_avail_idx - 1) %
+                                     vq->vring.num, elem);
+    }
 
     trace_virtqueue_pop(vq, elem, elem->in_num, elem->out_num);
 done:
@@ -1733,6 +2033,9 @@ static void *virtqueue_packed_pop(VirtQueue *vq, size_t sz)
 
     elem->index = id;
     elem->ndescs = (desc_cache == &indirect_desc_cache) ? 1 : elem_entries;
+    if (virtio_vdev_has_feature(vdev, VIRTIO_F_IN_ORDER)) {
+        virtqueue_ordered_record(vq, vq->last_avail_idx, elem);
+    }
     vq->last_avail_idx += elem->ndescs;
     vq->inuse += elem->ndescs;
 
@@ -1764,7 +2067,78 @@ void *virtqueue_pop(VirtQueue *vq, size_t sz)
     if (virtio_vdev_has_feature(vq->vdev, VIRTIO_F_RING_PACKED)) {
         return virtqueue_packed_pop(vq, sz);
     } else {
-        return virtqueue_split_pop(vq, sz);
+        return virtqueue_split_pop(vq, sz, true);
+    }
+}
+
+/* virtqueue_pop_batch:
+ * @vq: The #VirtQueue
+ * @sz: Size of each element, as for virtqueue_pop()
+ * @elems: Array receiving the popped elements
+ * @num: Maximum number of elements to pop
+ *
+ * Pop up to @num elements in one go.  The RCU critical section is entered
+ * once for the whole batch and, for split rings with VIRTIO_RING_F_EVENT_IDX,
+ * the avail event is written back once at the end rather than once per
+ * element.
+ *
+ * Elements are allocated and must be freed exactly as those returned by
+ * virtqueue_pop().  Elements that end up not being processed can be handed
+ * back with virtqueue_unpop_batch().
+ *
+ * Returns: the number of elements stored in @elems.
+ */
+unsigned int virtqueue_pop_batch(VirtQueue *vq, size_t sz, void **elems,
+                                 unsigned int num)
+{
+    VirtIODevice *vdev = vq->vdev;
+    bool packed = virtio_vdev_has_feature(vdev, VIRTIO_F_RING_PACKED);
+    unsigned int popped = 0;
+
+    if (virtio_device_disabled(vdev)) {
+        return 0;
+    }
+
+    RCU_READ_LOCK_GUARD();
+    while (popped < num) {
+        void *elem = packed ? virtqueue_packed_pop(vq, sz) :
+                              virtqueue_split_pop(vq, sz, false);
+        if (!elem) {
+            break;
+        }
+        elems[popped++] = elem;
+    }
+
+    if (popped && !packed &&
+        virtio_vdev_has_feature(vdev, VIRTIO_RING_F_EVENT_IDX)) {
+        vring_set_avail_event(vq, vq->last_avail_idx);
+    }
+    return popped;
+}
+
+/* virtqueue_unpop_batch:
+ * @vq: The #VirtQueue
+ * @elems: Elements returned by virtqueue_pop_batch()
+ * @num: Number of elements in @elems
+ *
+ * Pretend the @num elements, which must be the most recently popped ones,
+ * weren't popped from the virtqueue, and free them.  The next call to
+ * virtqueue_pop() will refetch the first of them.
+ */
+void virtqueue_unpop_batch(VirtQueue *vq, void **elems, unsigned int num)
+{
+    bool packed = virtio_vdev_has_feature(vq->vdev, VIRTIO_F_RING_PACKED);
+
+    while (num--) {
+        VirtQueueElement *elem = elems[num];
+
+        if (packed) {
+            virtqueue_packed_rewind(vq, elem->ndescs);
+        } else {
+            virtqueue_split_rewind(vq, 1);
+        }
+        virtqueue_detach_element(vq, elem, 0);
+        g_free(elem);
     }
 }
 
@@ -1805,6 +2179,10 @@ static unsigned int virtqueue_packed_drop_all(VirtQueue *vq)
                                                vq->vring.num, &idx, false)) {
             ++elem.ndescs;
         }
+        vq->inuse += elem.ndescs;
+        if (virtio_vdev_has_feature(vdev, VIRTIO_F_IN_ORDER)) {
+            virtqueue_ordered_record(vq, vq->last_avail_idx, &elem);
+        }
         /*
          * immediately push the element, nothing to unmap
          * as both in_num and out_num are set to 0.
@@ -1840,6 +2218,10 @@ static unsigned int virtqueue_split_drop_all(VirtQueue *vq)
         if (fEventIdx) {
             vring_set_avail_event(vq, vq->last_avail_idx);
         }
+        if (virtio_vdev_has_feature(vdev, VIRTIO_F_IN_ORDER)) {
+            virtqueue_ordered_record(vq, (uint16_t)(vq->last_avail_idx - 1) %
+                                         vq->vring.num, &elem);
+        }
         /* immediately push the element, nothing to unmap
          * as both in_num and out_num are set to 0 */
         virtqueue_push(vq, &elem, 0);
@@ -2071,6 +2453,11 @@ static void __virtio_queue_reset(VirtIODevice *vdev, uint32_t i)
     vdev->vq[i].notification = true;
     vdev->vq[i].vring.num = vdev->vq[i].vring.num_default;
     vdev->vq[i].inuse = 0;
+    if (vdev->vq[i].used_elems) {
+        memset(vdev->vq[i].used_elems, 0,
+               vdev->vq[i].vring.num_default * sizeof(VirtQueueElement));
+    }
+    virtio_queue_coalesce_reset(&vdev->vq[i]);
     virtio_virtqueue_reset_region_cache(&vdev->vq[i]);
 }
 
@@ -2325,6 +2712,7 @@ void virtio_delete_queue(VirtQueue *vq)
     vq->handle_output = NULL;
     g_free(vq->used_elems);
     vq->used_elems = NULL;
+    virtio_queue_coalesce_reset(vq);
     virtio_virtqueue_reset_region_cache(vq);
 }
 
@@ -2426,6 +2814,133 @@ static bool virtio_should_notify(VirtIODevice *vdev, VirtQueue *vq)
     }
 }
 
+/*
+ * For callers that signal the guest notifier themselves, such as the
+ * shadow virtqueue: returns whether the driver wants to be notified about
+ * the used buffers flushed since the last call.
+ */
+bool virtio_queue_should_notify(VirtQueue *vq)
+{
+    RCU_READ_LOCK_GUARD();
+    return virtio_should_notify(vq->vdev, vq);
+}
+
+static void virtio_irq(VirtQueue *vq)
+{
+    virtio_set_isr(vq->vdev, 0x1);
+    virtio_notify_vector(vq->vdev, vq->vector);
+}
+
+/*
+ * Decide whether a notification that virtio_should_notify() let through is
+ * sent now or deferred to the coalescing timer.  A notification is sent
+ * immediately once coalesce_max_frames of them have accumulated; otherwise
+ * the first one of a window arms the timer and the rest ride along with it.
+ * In adaptive mode a queue that has been quiet for a whole window notifies
+ * immediately, so the timer only adds latency while the queue is busy.
+ */
+static bool virtio_queue_coalesce(VirtQueue *vq, bool irqfd)
+{
+    int64_t now;
+
+    if (!vq->coalesce_timer) {
+        return true;
+    }
+
+    now = qemu_clock_get_us(QEMU_CLOCK_VIRTUAL);
+    vq->coalesce_irqfd = irqfd;
+    vq->coalesce_pending++;
+
+    if (vq->coalesce_max_frames &&
+        vq->coalesce_pending >= vq->coalesce_max_frames) {
+        goto notify;
+    }
+
+    if (!timer_pending(vq->coalesce_timer)) {
+        if (vq->coalesce_adaptive &&
+            now - vq->coalesce_last_us >= vq->coalesce_usecs) {
+            goto notify;
+        }
+        timer_mod(vq->coalesce_timer, now + vq->coalesce_usecs);
+    }
+    return false;
+
+notify:
+    timer_del(vq->coalesce_timer);
+    vq->coalesce_pending = 0;
+    vq->coalesce_last_us = now;
+    return true;
+}
+
+/* Deliver a notification deferred by virtio_queue_coalesce() */
+static void virtio_queue_coalesce_flush(VirtQueue *vq)
+{
+    uint32_t frames = vq->coalesce_pending;
+
+    if (vq->coalesce_timer) {
+        timer_del(vq->coalesce_timer);
+    }
+    if (!frames) {
+        return;
+    }
+
+    vq->coalesce_pending = 0;
+    vq->coalesce_last_us = qemu_clock_get_us(QEMU_CLOCK_VIRTUAL);
+    trace_virtio_notify_coalesced(vq->vdev, vq, frames);
+
+    if (vq->coalesce_irqfd) {
+        virtio_set_isr(vq->vdev, 0x1);
+        event_notifier_set(&vq->guest_notifier);
+    } else {
+        virtio_irq(vq);
+    }
+}
+
+static void virtio_queue_coalesce_timer_cb(void *opaque)
+{
+    virtio_queue_coalesce_flush(opaque);
+}
+
+static void virtio_queue_coalesce_update_timer(VirtQueue *vq)
+{
+    bool enabled = vq->coalesce_usecs && vq->coalesce_max_frames != 1;
+
+    if (vq->coalesce_timer) {
+        timer_free(vq->coalesce_timer);
+        vq->coalesce_timer = NULL;
+    }
+    if (enabled) {
+        AioContext *ctx = vq->coalesce_ctx ?: qemu_get_aio_context();
+
+        vq->coalesce_timer = aio_timer_new(ctx, QEMU_CLOCK_VIRTUAL, SCALE_US,
+                                           virtio_queue_coalesce_timer_cb, vq);
+    }
+}
+
+/*
+ * Must be called from the thread that services @vq, or while that thread
+ * is quiescent.  Any notification still held back is delivered first.
+ */
+void virtio_queue_set_notification_coalescing(VirtQueue *vq,
+                                              uint32_t max_frames,
+                                              uint32_t usecs, bool adaptive)
+{
+    virtio_queue_coalesce_flush(vq);
+
+    vq->coalesce_max_frames = max_frames;
+    vq->coalesce_usecs = usecs;
+    vq->coalesce_adaptive = adaptive;
+    virtio_queue_coalesce_update_timer(vq);
+}
+
+/* The coalescing timer runs in the AioContext that handles the queue */
+static void virtio_queue_coalesce_set_context(VirtQueue *vq, AioContext *ctx)
+{
+    virtio_queue_coalesce_flush(vq);
+    vq->coalesce_ctx = ctx;
+    virtio_queue_coalesce_update_timer(vq);
+}
+
 void virtio_notify_irqfd(VirtIODevice *vdev, VirtQueue *vq)
 {
     WITH_RCU_READ_LOCK_GUARD() {
@@ -2434,6 +2949,10 @@ void virtio_notify_irqfd(VirtIODevice *vdev, VirtQueue *vq)
         }
     }
 
+    if (!virtio_queue_coalesce(vq, true)) {
+        return;
+    }
+
     trace_virtio_notify_irqfd(vdev, vq);
 
     /*
@@ -2455,12 +2974,6 @@ void virtio_notify_irqfd(VirtIODevice *vdev, VirtQueue *vq)
     event_notifier_set(&vq->guest_notifier);
 }
 
-static void virtio_irq(VirtQueue *vq)
-{
-    virtio_set_isr(vq->vdev, 0x1);
-    virtio_notify_vector(vq->vdev, vq->vector);
-}
-
 void virtio_notify(VirtIODevice *vdev, VirtQueue *vq)
 {
     WITH_RCU_READ_LOCK_GUARD() {
@@ -2469,6 +2982,10 @@ void virtio_notify(VirtIODevice *vdev, VirtQueue *vq)
         }
     }
 
+    if (!virtio_queue_coalesce(vq, false)) {
+        return;
+    }
+
     trace_virtio_notify(vdev, vq);
     virtio_irq(vq);
 }
@@ -3099,6 +3616,22 @@ int virtio_load(VirtIODevice *vdev, QEMUFile *f, int version_id)
                              vdev->vq[i].used_idx);
                 return -1;
             }
+
+            /*
+             * The in-order bookkeeping is not migrated, but for split
+             * rings it follows from the avail ring: in-flight elements
+             * are exactly the ones between used_idx and last_avail_idx.
+             */
+            if (virtio_vdev_has_feature(vdev, VIRTIO_F_IN_ORDER)) {
+                VirtQueue *vq = &vdev->vq[i];
+                VirtQueueElement elem = { .ndescs = 1 };
+                uint16_t idx;
+
+                for (idx = vq->used_idx; idx != vq->last_avail_idx; idx++) {
+                    elem.index = vring_avail_ring(vq, idx % vq->vring.num);
+                    virtqueue_ordered_record(vq, idx % vq->vring.num, &elem);
+                }
+            }
         }
     }
 
@@ -3133,6 +3666,17 @@ static void virtio_vmstate_change(void *opaque, bool running, RunState state)
         k->vmstate_change(qbus->parent, backend_run);
     }
 
+    if (!running) {
+        int i;
+
+        /* Coalescing timers are not migrated, deliver what they hold now */
+        for (i = 0; i < VIRTIO_QUEUE_MAX; i++) {
+            if (vdev->vq[i].coalesce_timer) {
+                virtio_queue_coalesce_flush(&vdev->vq[i]);
+            }
+        }
+    }
+
     if (!backend_run) {
         virtio_set_status(vdev, vdev->status);
     }
@@ -3478,6 +4022,7 @@ static void virtio_queue_host_notifier_aio_poll_ready(EventNotifier *n)
 {
     VirtQueue *vq = container_of(n, VirtQueue, host_notifier);
 
+    vq->poll_hits++;
     virtio_queue_notify_vq(vq);
 }
 
@@ -3491,6 +4036,7 @@ static void virtio_queue_host_notifier_aio_poll_end(EventNotifier *n)
 
 void virtio_queue_aio_attach_host_notifier(VirtQueue *vq, AioContext *ctx)
 {
+    virtio_queue_coalesce_set_context(vq, ctx);
     aio_set_event_notifier(ctx, &vq->host_notifier,
                            virtio_queue_host_notifier_read,
                            virtio_queue_host_notifier_aio_poll,
@@ -3498,6 +4044,18 @@ void virtio_queue_aio_attach_host_notifier(VirtQueue *vq, AioContext *ctx)
     aio_set_event_notifier_poll(ctx, &vq->host_notifier,
                                 virtio_queue_host_notifier_aio_poll_begin,
                                 virtio_queue_host_notifier_aio_poll_end);
+    aio_set_event_notifier_poll_budget(ctx, &vq->host_notifier,
+                                       vq->poll_budget_ns);
+}
+
+/*
+ * Set how long the AioContext polls at least while @vq is active, instead of
+ * the adaptive polling time of the AioContext.  Takes effect the next time
+ * the host notifier is attached to an AioContext.
+ */
+void virtio_queue_set_poll_budget(VirtQueue *vq, int64_t budget_ns)
+{
+    vq->poll_budget_ns = budget_ns;
 }
 
 /*
@@ -3508,6 +4066,7 @@ void virtio_queue_aio_attach_host_notifier(VirtQueue *vq, AioContext *ctx)
  */
 void virtio_queue_aio_attach_host_notifier_no_poll(VirtQueue *vq, AioContext *ctx)
 {
+    virtio_queue_coalesce_set_context(vq, ctx);
     aio_set_event_notifier(ctx, &vq->host_notifier,
                            virtio_queue_host_notifier_read,
                            NULL, NULL);
@@ -3516,12 +4075,14 @@ void virtio_queue_aio_attach_host_notifier_no_poll(VirtQueue *vq, AioContext *ct
 void virtio_queue_aio_detach_host_notifier(VirtQueue *vq, AioContext *ctx)
 {
     aio_set_event_notifier(ctx, &vq->host_notifier, NULL, NULL, NULL);
+    virtio_queue_coalesce_set_context(vq, NULL);
 }
 
 void virtio_queue_host_notifier_read(EventNotifier *n)
 {
     VirtQueue *vq = container_of(n, VirtQueue, host_notifier);
     if (event_notifier_test_and_clear(n)) {
+        vq->wakeups++;
         virtio_queue_notify_vq(vq);
     }
 }
@@ -3581,6 +4142,8 @@ static void virtio_memory_listener_commit(MemoryListener *listener)
     VirtIODevice *vdev = container_of(listener, VirtIODevice, listener);
     int i;
 
+    virtio_ram_map_commit(vdev);
+
     for (i = 0; i < VIRTIO_QUEUE_MAX; i++) {
         if (vdev->vq[i].vring.num == 0) {
             break;
@@ -3613,6 +4176,9 @@ static void virtio_device_realize(DeviceState *dev, Error **errp)
         return;
     }
 
+    vdev->listener.begin = virtio_ram_map_begin;
+    vdev->listener.region_add = virtio_ram_map_region_add;
+    vdev->listener.region_nop = virtio_ram_map_region_add;
     vdev->listener.commit = virtio_memory_listener_commit;
     vdev->listener.name = "virtio";
     memory_listener_register(&vdev->listener, vdev->dma_as);
@@ -3625,6 +4191,7 @@ static void virtio_device_unrealize(DeviceState *dev)
     VirtioDeviceClass *vdc = VIRTIO_DEVICE_GET_CLASS(dev);
 
     memory_listener_unregister(&vdev->listener);
+    virtio_ram_map_free(vdev);
     virtio_bus_device_unplugged(vdev);
 
     if (vdc->unrealize != NULL) {
@@ -3671,7 +4238,7 @@ static Property virtio_properties[] = {
     DEFINE_PROP_END_OF_LIST(),
 };
 
-static int virtio_device_start_ioeventfd_impl(VirtIODevice *vdev)
+int virtio_device_start_ioeventfd_impl(VirtIODevice *vdev)
 {
     VirtioBusState *qbus = VIRTIO_BUS(qdev_get_parent_bus(DEVICE(vdev)));
     int i, n, r, err;
@@ -3741,7 +4308,7 @@ int virtio_device_start_ioeventfd(VirtIODevice *vdev)
     return virtio_bus_start_ioeventfd(vbus);
 }
 
-static void virtio_device_stop_ioeventfd_impl(VirtIODevice *vdev)
+void virtio_device_stop_ioeventfd_impl(VirtIODevice *vdev)
 {
     VirtioBusState *qbus = VIRTIO_BUS(qdev_get_parent_bus(DEVICE(vdev)));
     int n, r;
@@ -3807,6 +4374,8 @@ static void virtio_device_class_init(ObjectClass *klass, void *data)
     vdc->legacy_features |= VIRTIO_LEGACY_FEATURES;
 
     QTAILQ_INIT(&virtio_list);
+    add_stats_callbacks(STATS_PROVIDER_VIRTIO, virtio_stats_cb,
+                        virtio_schemas_cb);
 }
 
 bool virtio_device_ioeventfd_enabled(VirtIODevice *vdev)
@@ -3871,11 +4440,108 @@ VirtQueueStatus *qmp_x_query_virtio_queue_status(const char *path,
         status->has_last_avail_idx = true;
         status->last_avail_idx = vdev->vq[queue].last_avail_idx;
         status->shadow_avail_idx = vdev->vq[queue].shadow_avail_idx;
+        status->has_poll_hits = true;
+        status->poll_hits = vdev->vq[queue].poll_hits;
+        status->has_wakeups = true;
+        status->wakeups = vdev->vq[queue].wakeups;
     }
 
     return status;
 }
 
+enum {
+    VIRTIO_STAT_POLL_HITS,
+    VIRTIO_STAT_WAKEUPS,
+    VIRTIO_STAT_INUSE,
+    VIRTIO_STAT__MAX,
+};
+
+static const char *const virtio_stat_names[VIRTIO_STAT__MAX] = {
+    [VIRTIO_STAT_POLL_HITS] = "poll-hits",
+    [VIRTIO_STAT_WAKEUPS] = "wakeups",
+    [VIRTIO_STAT_INUSE] = "inuse",
+};
+
+static uint64_t virtio_queue_stat(VirtQueue *vq, int stat)
+{
+    switch (stat) {
+    case VIRTIO_STAT_POLL_HITS:
+        return vq->poll_hits;
+    case VIRTIO_STAT_WAKEUPS:
+        return vq->wakeups;
+    case VIRTIO_STAT_INUSE:
+        return vq->inuse;
+    default:
+        g_assert_not_reached();
+    }
+}
+
+/*
+ * One list per statistic, indexed by virtqueue.  Queues handled by vhost
+ * do not go through these counters, so such devices are skipped.
+ */
+static void virtio_stats_cb(StatsResultList **result, StatsTarget target,
+                            strList *names, strList *targets, Error **errp)
+{
+    VirtIODevice *vdev;
+
+    if (target != STATS_TARGET_VIRTIO) {
+        return;
+    }
+
+    QTAILQ_FOREACH(vdev, &virtio_list, next) {
+        int nvqs = virtio_get_num_queues(vdev);
+        StatsList *stats_list = NULL;
+        int stat, i;
+
+        if (vdev->vhost_started || !nvqs) {
+            continue;
+        }
+
+        for (stat = 0; stat < VIRTIO_STAT__MAX; stat++) {
+            uint64List **tail;
+            Stats *stats;
+
+            if (!apply_str_list_filter(virtio_stat_names[stat], names)) {
+                continue;
+            }
+
+            stats = g_new0(Stats, 1);
+            stats->name = g_strdup(virtio_stat_names[stat]);
+            stats->value = g_new0(StatsValue, 1);
+            stats->value->type = QTYPE_QLIST;
+            tail = &stats->value->u.list;
+            for (i = 0; i < nvqs; i++) {
+                QAPI_LIST_APPEND(tail, virtio_queue_stat(&vdev->vq[i], stat));
+            }
+            QAPI_LIST_PREPEND(stats_list, stats);
+        }
+
+        if (stats_list) {
+            add_stats_entry(result, STATS_PROVIDER_VIRTIO,
+                            DEVICE(vdev)->canonical_path, stats_list);
+        }
+    }
+}
+
+static void virtio_schemas_cb(StatsSchemaList **result, Error **errp)
+{
+    StatsSchemaValueList *stats_list = NULL;
+    int stat;
+
+    for (stat = 0; stat < VIRTIO_STAT__MAX; stat++) {
+        StatsSchemaValue *value = g_new0(StatsSchemaValue, 1);
+
+        value->name = g_strdup(virtio_stat_names[stat]);
+        value->type = stat == VIRTIO_STAT_INUSE ? STATS_TYPE_INSTANT
+                                                : STATS_TYPE_CUMULATIVE;
+        QAPI_LIST_PREPEND(stats_list, value);
+    }
+
+    add_stats_schema(result, STATS_PROVIDER_VIRTIO, STATS_TARGET_VIRTIO,
+                     stats_list);
+}
+
 static strList *qmp_decode_vring_desc_flags(uint16_t flags)
 {
     strList *list = NULL;
@@ -26,6 +26,7 @@
 #define BLOCK_ACCOUNTING_H
 
 #include "qemu/timed-average.h"
+#include "qemu/stats64.h"
 #include "qemu/thread.h"
 #include "qapi/qapi-types-common.h"
 
@@ -79,6 +80,18 @@ typedef struct BlockLatencyHistogram {
     uint64_t *bins;
 } BlockLatencyHistogram;
 
+/*
+ * Always-on log-linear latency histogram: latencies below 2^SUB_BITS ns
+ * get one bucket each, then every power of two is split into
+ * 2^SUB_BITS equal buckets, for a relative error below 12.5%.  Latencies
+ * of 2^MAX_BITS ns (about 18 minutes) and above share the last bucket.
+ */
+#define BLOCK_LATENCY_SUB_BITS  3
+#define BLOCK_LATENCY_MAX_BITS  40
+#define BLOCK_LATENCY_BUCKETS \
+    ((BLOCK_LATENCY_MAX_BITS - BLOCK_LATENCY_SUB_BITS + 1) << \
+     BLOCK_LATENCY_SUB_BITS)
+
 struct BlockAcctStats {
     QemuMutex lock;
     uint64_t nr_bytes[BLOCK_MAX_IOTYPE];
@@ -92,6 +105,8 @@ struct BlockAcctStats {
     bool account_invalid;
     bool account_failed;
     BlockLatencyHistogram latency_histogram[BLOCK_MAX_IOTYPE];
+    /* Updated without @lock */
+    Stat64 latency_buckets[BLOCK_MAX_IOTYPE][BLOCK_LATENCY_BUCKETS];
 };
 
 typedef struct BlockAcctCookie {
@@ -115,6 +130,9 @@ void block_acct_invalid(BlockAcctStats *stats, enum BlockAcctType type);
 void block_acct_merge_done(BlockAcctStats *stats, enum BlockAcctType type,
                            int num_requests);
 int64_t block_acct_idle_time_ns(BlockAcctStats *stats);
+uint64_t block_acct_latency_percentile(BlockAcctStats *stats,
+                                       enum BlockAcctType type,
+                                       unsigned ppm);
 double block_acct_queue_depth(BlockAcctTimedStats *stats,
                               enum BlockAcctType type);
 int block_latency_histogram_set(BlockAcctStats *stats, enum BlockAcctType type,
@@ -22,6 +22,8 @@
 #include "qemu/event_notifier.h"
 #include "qemu/thread.h"
 #include "qemu/timer.h"
+#include "qemu/host-utils.h"
+#include "qemu/stats64.h"
 #include "block/graph-lock.h"
 #include "hw/qdev-core.h"
 
@@ -58,6 +60,34 @@ struct ThreadPool;
 struct LinuxAioState;
 struct LuringState;
 
+/* Flavours of io_uring ring that an AioContext can own for block I/O */
+typedef enum {
+    LURING_MODE_DEFAULT,    /* completions signalled through the ring fd */
+    LURING_MODE_SQPOLL,     /* kernel thread polls the SQ (IORING_SETUP_SQPOLL) */
+    LURING_MODE_IOPOLL,     /* completions are busy-polled (IORING_SETUP_IOPOLL) */
+    LURING_MODE__MAX,
+} LuringMode;
+
+#ifdef CONFIG_LINUX_IO_URING
+/**
+ * CqeHandler:
+ * @cb: called from aio_poll() once the request has completed
+ * @cqe: a copy of the request's cqe, filled in before @cb is called
+ *
+ * Embedded in the state of a request submitted with aio_add_sqe().
+ */
+typedef struct CqeHandler CqeHandler;
+typedef void CqeHandlerFunc(CqeHandler *cqe_handler);
+
+struct CqeHandler {
+    CqeHandlerFunc *cb;
+    struct io_uring_cqe cqe;
+    QSIMPLEQ_ENTRY(CqeHandler) next;
+};
+
+typedef QSIMPLEQ_HEAD(, CqeHandler) CqeHandlerSimpleQ;
+#endif /* CONFIG_LINUX_IO_URING */
+
 /* Is polling disabled? */
 bool aio_poll_disabled(AioContext *ctx);
 
@@ -106,6 +136,17 @@ typedef struct {
      * Returns: true if ->wait() should be called, false otherwise.
      */
     bool (*need_wait)(AioContext *ctx);
+
+    /*
+     * dispatch:
+     * @ctx: the AioContext
+     *
+     * Optional.  Invoke callbacks for non-fd events that ->wait() collected,
+     * such as completed aio_add_sqe() requests.
+     *
+     * Returns: true if progress was made, false otherwise.
+     */
+    bool (*dispatch)(AioContext *ctx);
 } FDMonOps;
 
 /*
@@ -123,6 +164,23 @@ struct BHListSlice {
 
 typedef QSLIST_HEAD(, AioHandler) AioHandlerSList;
 
+/*
+ * Latency histograms are log2 histograms of nanoseconds: bucket 0 counts
+ * zero-length samples, bucket i > 0 counts samples in [2^(i-1), 2^i) and
+ * the last bucket also counts everything above it.
+ */
+#define AIO_LATENCY_BUCKETS 32
+
+typedef struct AioLatencyStats {
+    Stat64 iteration[AIO_LATENCY_BUCKETS];  /* aio_poll() iterations */
+    Stat64 fd_handler[AIO_LATENCY_BUCKETS]; /* fd and poll-ready callbacks */
+    Stat64 bh[AIO_LATENCY_BUCKETS];         /* BH callbacks */
+    Stat64 bh_delay[AIO_LATENCY_BUCKETS];   /* from scheduling to callback */
+    Stat64 timers[AIO_LATENCY_BUCKETS];     /* expired timer callbacks */
+    Stat64 poll_ns;                         /* time spent busy polling */
+    Stat64 block_ns;                        /* time spent waiting for events */
+} AioLatencyStats;
+
 struct AioContext {
     GSource source;
 
@@ -213,11 +271,15 @@ struct AioContext {
     struct LinuxAioState *linux_aio;
 #endif
 #ifdef CONFIG_LINUX_IO_URING
-    struct LuringState *linux_io_uring;
+    /* io_uring rings for block I/O, one per LuringMode */
+    struct LuringState *linux_io_uring[LURING_MODE__MAX];
 
     /* State for file descriptor monitoring using Linux io_uring */
     struct io_uring fdmon_io_uring;
     AioHandlerSList submit_list;
+
+    /* aio_add_sqe() requests that completed and await dispatch */
+    CqeHandlerSimpleQ cqe_handler_ready_list;
 #endif
 
     /* TimerLists for calling timers - one per clock type.  Has its own
@@ -233,9 +295,20 @@ struct AioContext {
     int64_t poll_max_ns;    /* maximum polling time in nanoseconds */
     int64_t poll_grow;      /* polling time growth factor */
     int64_t poll_shrink;    /* polling time shrink factor */
+    bool poll_busy;         /* never block while handlers are polled */
 
     /* AIO engine parameters */
     int64_t aio_max_batch;  /* maximum number of requests in a batch */
+    bool aio_batch_adaptive; /* let the engine pick the batch size */
+
+    /*
+     * Latency histograms.  @latency_stats is NULL unless they are enabled
+     * with aio_context_set_latency_stats(); @latency_stats_data keeps the
+     * samples across disable/enable cycles and is freed with the context.
+     * Only updated by the event loop thread.
+     */
+    AioLatencyStats *latency_stats;
+    AioLatencyStats *latency_stats_data;
 
     /*
      * List of handlers participating in userspace polling.  Protected by
@@ -507,6 +580,15 @@ void aio_set_event_notifier_poll(AioContext *ctx,
                                  EventNotifierHandler *io_poll_begin,
                                  EventNotifierHandler *io_poll_end);
 
+/* Poll for at least @budget_ns whenever an event notifier that has already
+ * been registered with aio_set_event_notifier() is being polled, regardless
+ * of the adaptive polling time of the AioContext.  0 removes the budget.  Do
+ * nothing if the event notifier is not registered.
+ */
+void aio_set_event_notifier_poll_budget(AioContext *ctx,
+                                        EventNotifier *notifier,
+                                        int64_t budget_ns);
+
 /* Return a GSource that lets the main loop poll the file descriptors attached
  * to this AioContext.
  */
@@ -521,11 +603,47 @@ struct LinuxAioState *aio_setup_linux_aio(AioContext *ctx, Error **errp);
 /* Return the LinuxAioState bound to this AioContext */
 struct LinuxAioState *aio_get_linux_aio(AioContext *ctx);
 
-/* Setup the LuringState bound to this AioContext */
-struct LuringState *aio_setup_linux_io_uring(AioContext *ctx, Error **errp);
+/* Setup the LuringState of the given mode bound to this AioContext */
+struct LuringState *aio_setup_linux_io_uring(AioContext *ctx, LuringMode mode,
+                                             Error **errp);
+
+/*
+ * Return the LuringState of the given mode bound to this AioContext.
+ *
+ * Polling rings are created lazily here because their kernel SQ thread is
+ * placed according to the CPU affinity of the calling thread, so this must be
+ * called from the AioContext's home thread.  Returns NULL if a lazily created
+ * ring could not be set up.
+ */
+struct LuringState *aio_get_linux_io_uring(AioContext *ctx, LuringMode mode);
+
+#ifdef CONFIG_LINUX_IO_URING
+/**
+ * aio_has_io_uring:
+ * @ctx: the AioContext
+ *
+ * Returns: true if @ctx monitors file descriptors with io_uring and
+ * aio_add_sqe() can be used from its home thread.
+ */
+bool aio_has_io_uring(AioContext *ctx);
 
-/* Return the LuringState bound to this AioContext */
-struct LuringState *aio_get_linux_io_uring(AioContext *ctx);
+/**
+ * aio_add_sqe:
+ * @prep_sqe: fills in the sqe, must not call io_uring_sqe_set_data()
+ * @opaque: passed to @prep_sqe
+ * @cqe_handler: @cqe_handler->cb is invoked when the request completes
+ *
+ * Queue an io_uring request on the current thread's AioContext ring, which
+ * must satisfy aio_has_io_uring().  The sqe is submitted by the next
+ * aio_poll() together with the fd monitoring and timeout sqes, so a single
+ * io_uring_enter(2) call both submits requests and waits for events.
+ *
+ * @prep_sqe is called before aio_add_sqe() returns.  @cqe_handler must stay
+ * valid until its callback has run.
+ */
+void aio_add_sqe(void (*prep_sqe)(struct io_uring_sqe *sqe, void *opaque),
+                 void *opaque, CqeHandler *cqe_handler);
+#endif /* CONFIG_LINUX_IO_URING */
 /**
  * aio_timer_new_with_attrs:
  * @ctx: the aio context
@@ -711,14 +829,61 @@ void aio_context_set_poll_params(AioContext *ctx, int64_t max_ns,
                                  int64_t grow, int64_t shrink,
                                  Error **errp);
 
+/**
+ * aio_context_set_poll_busy:
+ * @ctx: the aio context
+ * @busy: keep polling instead of blocking
+ *
+ * In busy-poll mode aio_poll() never blocks while there are handlers in
+ * userspace polling.  File descriptors that are not polled are checked
+ * without waiting between polling rounds.  This is meant for event loops
+ * that run on a dedicated host CPU.
+ */
+void aio_context_set_poll_busy(AioContext *ctx, bool busy, Error **errp);
+
 /**
  * aio_context_set_aio_params:
  * @ctx: the aio context
  * @max_batch: maximum number of requests in a batch, 0 means that the
  *             engine will use its default
+ * @adaptive: let the engine choose the batch size, up to @max_batch, from
+ *            the queue depth and completion latency
  */
 void aio_context_set_aio_params(AioContext *ctx, int64_t max_batch,
-                                Error **errp);
+                                bool adaptive, Error **errp);
+
+/**
+ * aio_context_set_latency_stats:
+ * @ctx: the aio context
+ * @enable: whether to record latency histograms
+ *
+ * Recording adds a few clock reads to every event loop iteration and
+ * callback; when disabled, the cost is a pointer check.
+ */
+void aio_context_set_latency_stats(AioContext *ctx, bool enable);
+
+/**
+ * aio_context_latency_stats:
+ * @ctx: the aio context
+ *
+ * Returns: the histograms of @ctx if they are being recorded, or NULL.
+ */
+static inline AioLatencyStats *aio_context_latency_stats(AioContext *ctx)
+{
+    return qatomic_rcu_read(&ctx->latency_stats);
+}
+
+/**
+ * aio_latency_record:
+ * @hist: a histogram of AioLatencyStats
+ * @ns: the sample, in nanoseconds
+ */
+static inline void aio_latency_record(Stat64 *hist, int64_t ns)
+{
+    int bucket = ns > 0 ? 64 - clz64(ns) : 0;
+
+    stat64_add(&hist[MIN(bucket, AIO_LATENCY_BUCKETS - 1)], 1);
+}
 
 /**
  * aio_context_set_thread_pool_params:
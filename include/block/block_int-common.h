@@ -28,12 +28,16 @@
 #include "block/block-common.h"
 #include "block/block-global-state.h"
 #include "block/snapshot.h"
+#include "qemu/interval-tree.h"
 #include "qemu/iov.h"
 #include "qemu/rcu.h"
 #include "qemu/stats64.h"
 
 #define BLOCK_FLAG_LAZY_REFCOUNTS   8
 
+#define BDRV_DIRTY_CHUNK_BITS       16  /* 64 KiB */
+#define BDRV_DIRTY_CHUNK_CACHE_SIZE 64
+
 #define BLOCK_OPT_SIZE              "size"
 #define BLOCK_OPT_ENCRYPT           "encryption"
 #define BLOCK_OPT_ENCRYPT_FORMAT    "encrypt.format"
@@ -84,6 +88,7 @@ typedef struct BdrvTrackedRequest {
     int64_t overlap_bytes;
 
     QLIST_ENTRY(BdrvTrackedRequest) list;
+    IntervalTreeNode node; /* overlap range in bs->tracked_requests_tree */
     Coroutine *co; /* owner, used for deadlock detection */
     CoQueue wait_queue; /* coroutines blocked on this request */
 
@@ -1042,21 +1047,29 @@ struct BdrvChild {
 };
 
 /*
- * Allows bdrv_co_block_status() to cache one data region for a
- * protocol node.
+ * Allows bdrv_co_block_status() to cache the data regions of a protocol
+ * node.  Adjacent and overlapping regions are merged, so a lookup
+ * answers with the whole known data extent around an offset.
  *
- * @valid: Whether the cache is valid (should be accessed with atomic
- *         functions so this can be reset by RCU readers)
- * @data_start: Offset where we know (or strongly assume) is data
- * @data_end: Offset where the data region ends (which is not necessarily
- *            the start of a zeroed region)
+ * @lock: Protects all other fields; never held across a yield
+ * @regions: Data regions, each a BdrvBscRegion.  A region's end is not
+ *           necessarily the start of a zeroed region
+ * @lru: The regions, least recently filled first, for eviction
+ * @nb_regions: Number of regions in the cache, at most
+ *              BDRV_BSC_MAX_REGIONS
  */
-typedef struct BdrvBlockStatusCache {
-    struct rcu_head rcu;
+#define BDRV_BSC_MAX_REGIONS 256
 
-    bool valid;
-    int64_t data_start;
-    int64_t data_end;
+typedef struct BdrvBscRegion {
+    IntervalTreeNode node;
+    QTAILQ_ENTRY(BdrvBscRegion) next;
+} BdrvBscRegion;
+
+typedef struct BdrvBlockStatusCache {
+    QemuMutex lock;
+    IntervalTreeRoot regions;
+    QTAILQ_HEAD(, BdrvBscRegion) lru;
+    unsigned nb_regions;
 } BdrvBlockStatusCache;
 
 struct BlockDriverState {
@@ -1205,6 +1218,14 @@ struct BlockDriverState {
     QemuMutex dirty_bitmap_mutex;
     QLIST_HEAD(, BdrvDirtyBitmap) dirty_bitmaps;
 
+    /*
+     * Chunks known to be dirty in every enabled bitmap, so that rewrites
+     * can skip the bitmaps without taking dirty_bitmap_mutex.  Entries are
+     * chunk index + 1, or 0 if unused.  Read with atomics, filled by
+     * bdrv_set_dirty() and emptied whenever anyone else takes the mutex.
+     */
+    uint64_t dirty_chunk_cache[BDRV_DIRTY_CHUNK_CACHE_SIZE];
+
     /* Offset after the highest byte written to */
     Stat64 wr_highest_offset;
 
@@ -1233,6 +1254,7 @@ struct BlockDriverState {
     /* Protected by reqs_lock.  */
     CoMutex reqs_lock;
     QLIST_HEAD(, BdrvTrackedRequest) tracked_requests;
+    IntervalTreeRoot tracked_requests_tree; /* same requests, by range */
     CoQueue flush_queue;                  /* Serializing flush queue */
     bool active_flush_req;                /* Flush request in flight? */
 
@@ -1242,10 +1264,7 @@ struct BlockDriverState {
     /* BdrvChild links to this node may never be frozen */
     bool never_freeze;
 
-    /* Lock for block-status cache RCU writers */
-    CoMutex bsc_modify_lock;
-    /* Always non-NULL, but must only be dereferenced under an RCU read guard */
-    BdrvBlockStatusCache *block_status_cache;
+    BdrvBlockStatusCache block_status_cache;
 
     /* array of write pointers' location of each zone in the zoned device. */
     BlockZoneWps *wps;
@@ -162,19 +162,18 @@ static inline BlockDriverState *bdrv_primary_bs(BlockDriverState *bs)
 }
 
 /**
- * Check whether the given offset is in the cached block-status data
+ * Check whether the given offset is in a cached block-status data
  * region.
  *
- * If it is, and @pnum is not NULL, *pnum is set to
- * `bsc.data_end - offset`, i.e. how many bytes, starting from
- * @offset, are data (according to the cache).
+ * If it is, and @pnum is not NULL, *pnum is set to how many bytes,
+ * starting from @offset, are data (according to the cache).
  * Otherwise, *pnum is not touched.
  */
 bool bdrv_bsc_is_data(BlockDriverState *bs, int64_t offset, int64_t *pnum);
 
 /**
- * If [offset, offset + bytes) overlaps with the currently cached
- * block-status region, invalidate the cache.
+ * Drop [offset, offset + bytes) from the cached block-status data
+ * regions.  Parts of regions outside of the range stay cached.
  *
  * (To be used by I/O paths that cause data regions to be zero or
  * holes.)
@@ -183,7 +182,8 @@ void bdrv_bsc_invalidate_range(BlockDriverState *bs,
                                int64_t offset, int64_t bytes);
 
 /**
- * Mark the range [offset, offset + bytes) as a data region.
+ * Mark the range [offset, offset + bytes) as a data region, merging it
+ * with cached regions it overlaps or touches.
  */
 void bdrv_bsc_fill(BlockDriverState *bs, int64_t offset, int64_t bytes);
 
@@ -115,8 +115,13 @@ void unregister_aiocontext(AioContext *ctx);
  *
  * This function polls. Callers must not hold the lock of any AioContext other
  * than the current one and the one of @bs.
+ *
+ * @file and @line identify the call site for the synchronization profiler,
+ * for both this function and bdrv_graph_co_rdlock().
  */
-void bdrv_graph_wrlock(BlockDriverState *bs) TSA_ACQUIRE(graph_lock) TSA_NO_TSA;
+void bdrv_graph_wrlock_impl(BlockDriverState *bs, const char *file, int line)
+    TSA_ACQUIRE(graph_lock) TSA_NO_TSA;
+#define bdrv_graph_wrlock(bs) bdrv_graph_wrlock_impl(bs, __FILE__, __LINE__)
 
 /*
  * bdrv_graph_wrunlock:
@@ -148,7 +153,8 @@ void bdrv_graph_wrunlock(void) TSA_RELEASE(graph_lock) TSA_NO_TSA;
  * we always signal that a reader is running.
  */
 void coroutine_fn TSA_ACQUIRE_SHARED(graph_lock) TSA_NO_TSA
-bdrv_graph_co_rdlock(void);
+bdrv_graph_co_rdlock_impl(const char *file, int line);
+#define bdrv_graph_co_rdlock() bdrv_graph_co_rdlock_impl(__FILE__, __LINE__)
 
 /*
  * bdrv_graph_rdunlock:
@@ -62,18 +62,49 @@ int coroutine_fn laio_co_submit(int fd, uint64_t offset, QEMUIOVector *qiov,
 
 void laio_detach_aio_context(LinuxAioState *s, AioContext *old_context);
 void laio_attach_aio_context(LinuxAioState *s, AioContext *new_context);
+void laio_get_batch_info(LinuxAioState *s, uint64_t *batch,
+                         uint64_t *latency_ns);
 #endif
 /* io_uring.c - Linux io_uring implementation */
 #ifdef CONFIG_LINUX_IO_URING
 typedef struct LuringState LuringState;
-LuringState *luring_init(Error **errp);
+LuringState *luring_init(LuringMode mode, Error **errp);
 void luring_cleanup(LuringState *s);
 
-/* luring_co_submit: submit I/O requests in the thread's current AioContext. */
+/*
+ * luring_co_submit: submit I/O requests in the thread's current AioContext,
+ * using its ring of the given @mode.  Flushes cannot be submitted to
+ * LURING_MODE_IOPOLL rings.
+ */
 int coroutine_fn luring_co_submit(BlockDriverState *bs, int fd, uint64_t offset,
-                                  QEMUIOVector *qiov, int type);
+                                  QEMUIOVector *qiov, int type,
+                                  LuringMode mode);
+
+/*
+ * luring_co_fallocate: fallocate() @fd with @falloc_mode through the ring,
+ * instead of tying up a thread pool worker.  @type is QEMU_AIO_DISCARD or
+ * QEMU_AIO_WRITE_ZEROES.  Only valid if luring_has_fallocate() and @mode is
+ * not LURING_MODE_IOPOLL.
+ */
+bool luring_has_fallocate(void);
+int coroutine_fn luring_co_fallocate(BlockDriverState *bs, int fd, int type,
+                                     int falloc_mode, uint64_t offset,
+                                     uint64_t len, LuringMode mode);
 void luring_detach_aio_context(LuringState *s, AioContext *old_context);
 void luring_attach_aio_context(LuringState *s, AioContext *new_context);
+
+/*
+ * Host memory registered with luring_register_buf() is used as io_uring fixed
+ * buffers by all rings.  Calls must be balanced with luring_unregister_buf().
+ */
+void luring_register_buf(void *host, size_t size);
+void luring_unregister_buf(void *host, size_t size);
+
+/*
+ * luring_invalidate_fds: must be called before closing a file descriptor that
+ * was passed to luring_co_submit() so rings drop its registered file slot.
+ */
+void luring_invalidate_fds(void);
 #endif
 
 #ifdef _WIN32
@@ -40,4 +40,14 @@ void thread_pool_submit(ThreadPoolFunc *func, void *arg);
 
 void thread_pool_update_params(ThreadPool *pool, struct AioContext *ctx);
 
+typedef struct ThreadPoolStats {
+    int min_threads;
+    int max_threads;
+    int cur_threads;        /* including threads that are being created */
+    int idle_threads;
+    int queued_requests;    /* submitted but not picked up by a worker */
+} ThreadPoolStats;
+
+void thread_pool_get_stats(ThreadPool *pool, ThreadPoolStats *stats);
+
 #endif
@@ -49,6 +49,13 @@ typedef struct ThrottleGroupMember {
      */
     unsigned int restart_pending;
 
+    /* Budget taken in advance from the group, so that requests can be
+     * admitted without taking the ThrottleGroup lock.  Accessed with atomic
+     * operations.  See throttle_group_grant_allowance().
+     */
+    int allowance_bytes[2];
+    int allowance_ops[2];
+
     /* The following fields are protected by the ThrottleGroup lock.
      * See the ThrottleGroup documentation for details.
      * throttle_state tells us if I/O limits are configured. */
@@ -226,6 +226,20 @@ int qemu_chr_fe_write(CharBackend *be, const uint8_t *buf, int len);
  */
 int qemu_chr_fe_write_all(CharBackend *be, const uint8_t *buf, int len);
 
+/**
+ * qemu_chr_fe_writev:
+ * @iov: the buffers to send
+ * @iovcnt: the number of buffers
+ *
+ * Like qemu_chr_fe_write(), but for a scatter/gather list.  Backends that
+ * support it send all the buffers with one system call, straight from the
+ * caller's memory.  This function is thread-safe.
+ *
+ * Returns: the number of bytes consumed (0 if no associated Chardev), or
+ * -1 with errno set
+ */
+int qemu_chr_fe_writev(CharBackend *be, const struct iovec *iov, int iovcnt);
+
 /**
  * qemu_chr_fe_read_all:
  * @buf: the data buffer
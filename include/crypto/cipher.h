@@ -235,4 +235,95 @@ int qcrypto_cipher_setiv(QCryptoCipher *cipher,
                          const uint8_t *iv, size_t niv,
                          Error **errp);
 
+/**
+ * QCryptoCipherBatchOp:
+ * @iv: the initialization vector for this operation, or NULL
+ * @in: buffer holding the input data
+ * @out: buffer to fill with the output data
+ * @len: the length of @in and @out buffers
+ *
+ * A single operation within a batch submitted to
+ * qcrypto_cipher_batch(). If @iv is NULL the IV is left
+ * as it was set by a previous operation or by
+ * qcrypto_cipher_setiv(). @in and @out may be the same
+ * buffer.
+ */
+typedef struct QCryptoCipherBatchOp {
+    const uint8_t *iv;
+    const void *in;
+    void *out;
+    size_t len;
+} QCryptoCipherBatchOp;
+
+/**
+ * qcrypto_cipher_batch:
+ * @cipher: the cipher object
+ * @encrypt: true to encrypt, false to decrypt
+ * @ops: the operations to perform
+ * @nops: the number of elements in @ops
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Performs each operation in @ops, as if by calling
+ * qcrypto_cipher_setiv() when an IV is given followed by
+ * qcrypto_cipher_encrypt() or qcrypto_cipher_decrypt().
+ * Backends that drive an offload engine may keep several
+ * operations of the batch in flight at once, so this is
+ * preferable to a loop over the individual operations
+ * whenever the data is available up front.
+ *
+ * Returns: 0 on success, or -1 on error
+ */
+int qcrypto_cipher_batch(QCryptoCipher *cipher, bool encrypt,
+                         const QCryptoCipherBatchOp *ops, size_t nops,
+                         Error **errp);
+
+/**
+ * QCryptoCipherBatchCompletionFunc:
+ * @opaque: the opaque pointer passed to qcrypto_cipher_batch_submit()
+ * @err: NULL on success, otherwise the error, owned by the callee
+ */
+typedef void QCryptoCipherBatchCompletionFunc(void *opaque, Error *err);
+
+/**
+ * qcrypto_cipher_batch_submit:
+ * @cipher: the cipher object
+ * @encrypt: true to encrypt, false to decrypt
+ * @ops: the operations to perform
+ * @nops: the number of elements in @ops
+ * @cb: the function to call on completion
+ * @opaque: the opaque pointer to pass to @cb
+ *
+ * Asynchronous version of qcrypto_cipher_batch(). The batch
+ * runs in the thread pool and @cb is invoked in the current
+ * AioContext once every operation has completed. @cipher,
+ * @ops and the buffers they reference must stay valid, and
+ * @cipher must not be used by anyone else, until then.
+ *
+ * Only available in builds with the block layer.
+ */
+void qcrypto_cipher_batch_submit(QCryptoCipher *cipher, bool encrypt,
+                                 const QCryptoCipherBatchOp *ops,
+                                 size_t nops,
+                                 QCryptoCipherBatchCompletionFunc *cb,
+                                 void *opaque);
+
+/**
+ * qcrypto_cipher_co_batch:
+ * @cipher: the cipher object
+ * @encrypt: true to encrypt, false to decrypt
+ * @ops: the operations to perform
+ * @nops: the number of elements in @ops
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Coroutine version of qcrypto_cipher_batch(): the batch runs
+ * in the thread pool while the calling coroutine yields.
+ *
+ * Only available in builds with the block layer.
+ *
+ * Returns: 0 on success, or -1 on error
+ */
+int coroutine_fn qcrypto_cipher_co_batch(QCryptoCipher *cipher, bool encrypt,
+                                         const QCryptoCipherBatchOp *ops,
+                                         size_t nops, Error **errp);
+
 #endif /* QCRYPTO_CIPHER_H */
@@ -315,6 +315,28 @@ qcrypto_tls_session_get_handshake_status(QCryptoTLSSession *sess);
 int qcrypto_tls_session_get_key_size(QCryptoTLSSession *sess,
                                      Error **errp);
 
+/**
+ * qcrypto_tls_session_enable_ktls_tx:
+ * @sess: the TLS session object
+ * @fd: the socket the session runs over
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Hand the transmit keys of a session whose handshake has
+ * completed to the kernel TLS implementation (kTLS). Payload
+ * data is then written to @fd in plain text, and encrypted
+ * by the kernel or by the NIC, avoiding a copy through a
+ * userspace buffer. Receiving is not affected.
+ *
+ * Once this succeeds, qcrypto_tls_session_write() must no
+ * longer be used. On failure the session is left unchanged.
+ *
+ * Returns: 0 on success, -1 if kTLS is not available for
+ * the negotiated protocol version and cipher
+ */
+int qcrypto_tls_session_enable_ktls_tx(QCryptoTLSSession *sess,
+                                       int fd,
+                                       Error **errp);
+
 /**
  * qcrypto_tls_session_get_peer_name:
  * @sess: the TLS session object
@@ -247,6 +247,17 @@ bool page_check_range(target_ulong start, target_ulong last, int flags);
  */
 bool page_check_range_empty(target_ulong start, target_ulong last);
 
+/**
+ * page_check_range_any:
+ * @start: first byte of range
+ * @last: last byte of range
+ * @flags: flags to look for
+ * Context: holding mmap lock
+ *
+ * Return true if any page in [@start, @last] has any of @flags set.
+ */
+bool page_check_range_any(target_ulong start, target_ulong last, int flags);
+
 /**
  * page_find_range_empty
  * @min: first byte of search range
@@ -416,6 +427,7 @@ static inline bool tlb_hit(target_ulong tlb_addr, target_ulong addr)
 #ifdef CONFIG_TCG
 /* accel/tcg/translate-all.c */
 void dump_exec_info(GString *buf);
+void dump_tb_profile(GString *buf);
 #endif /* CONFIG_TCG */
 
 #endif /* !CONFIG_USER_ONLY */
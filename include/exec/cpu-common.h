@@ -72,6 +72,9 @@ typedef uintptr_t ram_addr_t;
 /* memory API */
 
 void qemu_ram_remap(ram_addr_t addr, ram_addr_t length);
+bool qemu_ram_can_map_file_private(RAMBlock *block);
+int qemu_ram_map_file_private(RAMBlock *block, ram_addr_t offset,
+                              ram_addr_t length, int fd, off_t fd_offset);
 /* This should not be used by devices.  */
 ram_addr_t qemu_ram_addr_from_host(void *ptr);
 ram_addr_t qemu_ram_addr_from_host_nofail(void *ptr);
@@ -63,8 +63,23 @@
 #if defined(CONFIG_SOFTMMU) && defined(CONFIG_TCG)
 #include "exec/tlb-common.h"
 
-/* use a fully associative victim tlb of 8 entries */
-#define CPU_VTLB_SIZE 8
+/*
+ * Use a set-associative victim tlb.  The set is selected by the low bits
+ * of the page number, which are also part of the index into the fast tlb,
+ * so that each set holds the entries evicted from a fixed group of fast
+ * tlb slots.  This requires CPU_VTLB_SETS <= 1 << CPU_TLB_DYN_MIN_BITS.
+ * Targets with a large working set may override both in cpu-param.h.
+ */
+#ifndef CPU_VTLB_SETS
+# define CPU_VTLB_SETS 8
+#endif
+#ifndef CPU_VTLB_WAYS
+# define CPU_VTLB_WAYS 8
+#endif
+#define CPU_VTLB_SIZE (CPU_VTLB_SETS * CPU_VTLB_WAYS)
+
+/* Track up to 8 large pages individually, per mmu_idx */
+#define CPU_TLB_LARGE_PAGES 8
 
 #define CPU_TLB_DYN_MIN_BITS 6
 #define CPU_TLB_DYN_DEFAULT_BITS 8
@@ -130,6 +145,14 @@ typedef struct CPUTLBEntryFull {
      */
     uint8_t slow_flags[MMU_ACCESS_COUNT];
 
+    /*
+     * @mmio_direct caches memory_region_direct_sizes() for an I/O page,
+     * with the read sizes in the low nibble and the write sizes in the
+     * high nibble.  The TLB is flushed on every memory map change, so
+     * this stays valid for the lifetime of the entry.
+     */
+    uint8_t mmio_direct;
+
     /*
      * Allow target-specific additions to this structure.
      * This may be used to cache items from the guest cpu
@@ -142,16 +165,34 @@ typedef struct CPUTLBEntryFull {
 #endif /* CONFIG_SOFTMMU */
 
 #if defined(CONFIG_SOFTMMU) && defined(CONFIG_TCG)
+/*
+ * A large page allocated into the tlb, which covers
+ * any page such that (page & mask) == addr.  Unused entries have
+ * both fields set to -1.
+ */
+typedef struct CPUTLBLargePage {
+    vaddr addr;
+    vaddr mask;
+} CPUTLBLargePage;
+
 /*
  * Data elements that are per MMU mode, minus the bits accessed by
  * the TCG fast path.
  */
 typedef struct CPUTLBDesc {
     /*
-     * Describe a region covering all of the large pages allocated
-     * into the tlb.  When any page within this region is flushed,
-     * we must flush the entire tlb.  The region is matched if
-     * (addr & large_page_mask) == large_page_addr.
+     * The most recent large pages allocated into the tlb.  When a page
+     * within one of them is flushed, only the tlb entries covered by
+     * that large page are flushed.
+     */
+    CPUTLBLargePage large_pages[CPU_TLB_LARGE_PAGES];
+    /* The next index to use in large_pages.  */
+    size_t large_page_next;
+    /*
+     * Describe a region covering all of the older large pages, that
+     * no longer fit in large_pages.  When any page within this region
+     * is flushed, we must flush the entire tlb.  The region is matched
+     * if (addr & large_page_mask) == large_page_addr.
      */
     vaddr large_page_addr;
     vaddr large_page_mask;
@@ -160,9 +201,21 @@ typedef struct CPUTLBDesc {
     /* maximum number of entries observed in the window */
     size_t window_max_entries;
     size_t n_used_entries;
-    /* The next index to use in the tlb victim table.  */
-    size_t vindex;
-    /* The tlb victim table, in two parts.  */
+    /*
+     * Statistics, read and written atomically like the ones in
+     * CPUTLBCommon: lookups that missed the fast tlb and were found
+     * in the victim tlb, lookups that missed both and had to call
+     * tlb_fill, and full flushes of this mmu_idx.
+     */
+    size_t vtlb_hit_count;
+    size_t vtlb_miss_count;
+    size_t flush_count;
+    /* The next way to use in each set of the tlb victim table.  */
+    uint8_t vindex[CPU_VTLB_SETS];
+    /*
+     * The tlb victim table, in two parts.  Set S is made of the
+     * entries [S * CPU_VTLB_WAYS, (S + 1) * CPU_VTLB_WAYS).
+     */
     CPUTLBEntry vtable[CPU_VTLB_SIZE];
     CPUTLBEntryFull vfulltlb[CPU_VTLB_SIZE];
     CPUTLBEntryFull *fulltlb;
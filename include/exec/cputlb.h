@@ -27,5 +27,7 @@
 void tlb_protect_code(ram_addr_t ram_addr);
 void tlb_unprotect_code(ram_addr_t ram_addr);
 void tlb_flush_counts(size_t *full, size_t *part, size_t *elide);
+void tlb_mmu_idx_counts(int mmu_idx, size_t *vtlb_hit, size_t *vtlb_miss,
+                        size_t *flush);
 #endif
 #endif
@@ -628,6 +628,12 @@ static inline tb_page_addr_t get_page_addr_code(CPUArchState *env,
 void TSA_NO_TSA mmap_lock(void);
 void TSA_NO_TSA mmap_unlock(void);
 bool have_mmap_lock(void);
+/*
+ * True if the thread holds the mmap lock for a range of the address
+ * space only, rather than exclusively; linux-user takes it that way
+ * for mmap, mprotect and munmap of non-executable memory.
+ */
+bool have_mmap_range_lock(void);
 
 static inline void mmap_unlock_guard(void *unused)
 {
@@ -747,6 +747,7 @@ bool memory_get_xlat_addr(IOMMUTLBEntry *iotlb, void **vaddr,
                           bool *mr_has_discard_manager);
 
 typedef struct CoalescedMemoryRange CoalescedMemoryRange;
+typedef struct CoalescingHint CoalescingHint;
 typedef struct MemoryRegionIoeventfd MemoryRegionIoeventfd;
 
 /** MemoryRegion:
@@ -766,6 +767,8 @@ struct MemoryRegion {
     bool nonvolatile;
     bool rom_device;
     bool flush_coalesced_mmio;
+    bool global_locking;
+    bool device_locking;
     uint8_t dirty_log_mask;
     bool is_iommu;
     RAMBlock *ram_block;
@@ -791,7 +794,11 @@ struct MemoryRegion {
     int32_t priority;
     QTAILQ_HEAD(, MemoryRegion) subregions;
     QTAILQ_ENTRY(MemoryRegion) subregions_link;
+    /* Aliases of this region, to find the FlatViews a change affects */
+    QTAILQ_HEAD(, MemoryRegion) aliased_by;
+    QTAILQ_ENTRY(MemoryRegion) aliased_by_link;
     QTAILQ_HEAD(, CoalescedMemoryRange) coalesced;
+    QTAILQ_HEAD(, CoalescingHint) coalescing_hints;
     const char *name;
     unsigned ioeventfd_nb;
     MemoryRegionIoeventfd *ioeventfds;
@@ -2168,6 +2175,39 @@ void memory_region_add_coalescing(MemoryRegion *mr,
  */
 void memory_region_clear_coalescing(MemoryRegion *mr);
 
+/**
+ * memory_region_add_coalescing_hint: Allow coalescing a sub-range of a region
+ *                                    once it turns out to be hot.
+ *
+ * Declares that writes to the range can be delayed like with
+ * memory_region_add_coalescing(), but only asks for it if the guest writes
+ * to the range often enough that trapping each write is costly.  This suits
+ * doorbell-like registers that some guests hammer and others barely touch.
+ * Accelerators report their write exits with address_space_note_write_exit().
+ *
+ * @mr: the memory region to be updated.
+ * @offset: the start of the range within the region.
+ * @size: the size of the range.
+ */
+void memory_region_add_coalescing_hint(MemoryRegion *mr,
+                                       hwaddr offset,
+                                       uint64_t size);
+
+/**
+ * address_space_note_write_exit: Account a trapped MMIO write.
+ *
+ * Called by accelerators after dispatching a write that exited to QEMU.  If
+ * the write hit a range registered with memory_region_add_coalescing_hint()
+ * and that range was written often enough recently, coalescing is enabled
+ * for it.  This is cheap as long as no hint is pending.
+ *
+ * Must be called without holding the BQL.
+ *
+ * @as: the address space the write was dispatched to.
+ * @addr: the address of the write.
+ */
+void address_space_note_write_exit(AddressSpace *as, hwaddr addr);
+
 /**
  * memory_region_set_flush_coalesced: Enforce memory coalescing flush before
  *                                    accesses.
@@ -2193,6 +2233,23 @@ void memory_region_set_flush_coalesced(MemoryRegion *mr);
  */
 void memory_region_clear_flush_coalesced(MemoryRegion *mr);
 
+/**
+ * memory_region_clear_global_locking: Declares that access processing does
+ *                                     not depend on the QEMU global lock.
+ *
+ * By default, memory regions have Big QEMU Lock (BQL) locking semantics: the
+ * BQL is taken before invoking the region's callbacks.  After calling this
+ * function, the callbacks run with whatever locks the caller holds, possibly
+ * none, and concurrently from several vCPU threads.  They must therefore
+ * synchronize on their own, or only touch immutable state.
+ *
+ * Regions owned by a device whose class sets #DeviceClass.has_lock are
+ * dispatched under the device lock instead of the BQL automatically.
+ *
+ * @mr: the memory region to be updated.
+ */
+void memory_region_clear_global_locking(MemoryRegion *mr);
+
 /**
  * memory_region_add_eventfd: Request an eventfd to be triggered when a word
  *                            is written to a location.
@@ -2532,6 +2589,59 @@ MemTxResult memory_region_dispatch_write(MemoryRegion *mr,
                                          MemOp op,
                                          MemTxAttrs attrs);
 
+/**
+ * memory_region_direct_sizes: return the access sizes that can skip the
+ * generic MMIO dispatch
+ *
+ * Returns a mask with bit (1 << MO_SIZE) set for each access size that
+ * memory_region_dispatch_read_direct() or memory_region_dispatch_write_direct()
+ * can hand straight to the region's read or write callback: no access
+ * splitting, no validity callback and no per-device lock.  The result only
+ * changes when the memory map does, so callers may cache it until the next
+ * memory transaction.
+ *
+ * @mr: #MemoryRegion to check; must not be an alias
+ * @is_write: whether to check writes or reads
+ */
+unsigned memory_region_direct_sizes(MemoryRegion *mr, bool is_write);
+
+/**
+ * memory_region_dispatch_read_direct: like memory_region_dispatch_read(),
+ * for a size returned by memory_region_direct_sizes()
+ *
+ * Unaligned or re-entrant accesses fall back to memory_region_dispatch_read().
+ *
+ * @mr: #MemoryRegion to access
+ * @addr: address within that region
+ * @pval: pointer to uint64_t which the data is written to
+ * @op: size, sign, and endianness of the memory operation
+ * @attrs: memory transaction attributes to use for the access
+ */
+MemTxResult memory_region_dispatch_read_direct(MemoryRegion *mr,
+                                               hwaddr addr,
+                                               uint64_t *pval,
+                                               MemOp op,
+                                               MemTxAttrs attrs);
+
+/**
+ * memory_region_dispatch_write_direct: like memory_region_dispatch_write(),
+ * for a size returned by memory_region_direct_sizes()
+ *
+ * Unaligned or re-entrant accesses, and writes to regions with ioeventfds,
+ * fall back to memory_region_dispatch_write().
+ *
+ * @mr: #MemoryRegion to access
+ * @addr: address within that region
+ * @data: data to write
+ * @op: size, sign, and endianness of the memory operation
+ * @attrs: memory transaction attributes to use for the access
+ */
+MemTxResult memory_region_dispatch_write_direct(MemoryRegion *mr,
+                                                hwaddr addr,
+                                                uint64_t data,
+                                                MemOp op,
+                                                MemTxAttrs attrs);
+
 /**
  * address_space_init: initializes an address space
  *
@@ -43,7 +43,8 @@ static inline long clear_bmap_size(uint64_t pages, uint8_t shift)
 
 /**
  * clear_bmap_set: set clear bitmap for the page range.  Must be with
- * bitmap_mutex held.
+ * bitmap_mutex held.  The bits are set atomically, because the dirty
+ * bitmap of a RAMBlock may be synchronized by several threads at once.
  *
  * @rb: the ramblock to operate on
  * @start: the start page number
@@ -56,7 +57,8 @@ static inline void clear_bmap_set(RAMBlock *rb, uint64_t start,
 {
     uint8_t shift = rb->clear_bmap_shift;
 
-    bitmap_set(rb->clear_bmap, start >> shift, clear_bmap_size(npages, shift));
+    bitmap_set_atomic(rb->clear_bmap, start >> shift,
+                      clear_bmap_size(npages, shift));
 }
 
 /**
@@ -236,7 +238,9 @@ static inline bool cpu_physical_memory_get_dirty_flag(ram_addr_t addr,
 
 static inline bool cpu_physical_memory_is_clean(ram_addr_t addr)
 {
-    bool vga = cpu_physical_memory_get_dirty_flag(addr, DIRTY_MEMORY_VGA);
+    /* The VGA bitmap is not maintained while nobody logs it. */
+    bool vga = !qatomic_read(&ram_list.vga_logging_regions) ||
+        cpu_physical_memory_get_dirty_flag(addr, DIRTY_MEMORY_VGA);
     bool code = cpu_physical_memory_get_dirty_flag(addr, DIRTY_MEMORY_CODE);
     bool migration =
         cpu_physical_memory_get_dirty_flag(addr, DIRTY_MEMORY_MIGRATION);
@@ -292,6 +296,9 @@ static inline void cpu_physical_memory_set_dirty_range(ram_addr_t start,
     unsigned long idx, offset, base;
     int i;
 
+    if (!qatomic_read(&ram_list.vga_logging_regions)) {
+        mask &= ~(1 << DIRTY_MEMORY_VGA);
+    }
     if (!mask && !xen_enabled()) {
         return;
     }
@@ -311,16 +318,17 @@ static inline void cpu_physical_memory_set_dirty_range(ram_addr_t start,
             unsigned long next = MIN(end, base + DIRTY_MEMORY_BLOCK_SIZE);
 
             if (likely(mask & (1 << DIRTY_MEMORY_MIGRATION))) {
-                bitmap_set_atomic(blocks[DIRTY_MEMORY_MIGRATION]->blocks[idx],
-                                  offset, next - page);
+                bitmap_set_atomic_lazy(
+                    blocks[DIRTY_MEMORY_MIGRATION]->blocks[idx],
+                    offset, next - page);
             }
             if (unlikely(mask & (1 << DIRTY_MEMORY_VGA))) {
-                bitmap_set_atomic(blocks[DIRTY_MEMORY_VGA]->blocks[idx],
-                                  offset, next - page);
+                bitmap_set_atomic_lazy(blocks[DIRTY_MEMORY_VGA]->blocks[idx],
+                                       offset, next - page);
             }
             if (unlikely(mask & (1 << DIRTY_MEMORY_CODE))) {
-                bitmap_set_atomic(blocks[DIRTY_MEMORY_CODE]->blocks[idx],
-                                  offset, next - page);
+                bitmap_set_atomic_lazy(blocks[DIRTY_MEMORY_CODE]->blocks[idx],
+                                       offset, next - page);
             }
 
             page = next;
@@ -359,6 +367,7 @@ uint64_t cpu_physical_memory_set_dirty_lebitmap(unsigned long *bitmap,
     if ((((page * BITS_PER_LONG) << TARGET_PAGE_BITS) == start) &&
         (hpratio == 1)) {
         unsigned long **blocks[DIRTY_MEMORY_NUM];
+        bool vga = qatomic_read(&ram_list.vga_logging_regions);
         unsigned long idx;
         unsigned long offset;
         long k;
@@ -379,7 +388,10 @@ uint64_t cpu_physical_memory_set_dirty_lebitmap(unsigned long *bitmap,
                     unsigned long temp = leul_to_cpu(bitmap[k]);
 
                     nbits = ctpopl(temp);
-                    qatomic_or(&blocks[DIRTY_MEMORY_VGA][idx][offset], temp);
+                    if (vga) {
+                        qatomic_or(&blocks[DIRTY_MEMORY_VGA][idx][offset],
+                                   temp);
+                    }
 
                     if (global_dirty_tracking) {
                         qatomic_or(
@@ -413,6 +425,9 @@ uint64_t cpu_physical_memory_set_dirty_lebitmap(unsigned long *bitmap,
         if (!global_dirty_tracking) {
             clients &= ~(1 << DIRTY_MEMORY_MIGRATION);
         }
+        if (!qatomic_read(&ram_list.vga_logging_regions)) {
+            clients &= ~(1 << DIRTY_MEMORY_VGA);
+        }
 
         /*
          * bitmap-traveling is faster than memory-traveling (for addr...)
@@ -75,6 +75,16 @@ struct RAMBlock {
      * could not have been valid on the source.
      */
     ram_addr_t postcopy_length;
+
+    /*
+     * Only used with the mapped-ram migration format, on the source side.
+     * @file_bmap tracks which pages are stored in the migration file, and
+     * is written at @bitmap_offset at the end of migration; the page at
+     * offset X of the block is stored at @pages_offset + X.
+     */
+    unsigned long *file_bmap;
+    off_t bitmap_offset;
+    uint64_t pages_offset;
 };
 #endif
 #endif
@@ -52,6 +52,12 @@ typedef struct RAMList {
     DirtyMemoryBlocks *dirty_memory[DIRTY_MEMORY_NUM];
     uint32_t version;
     QLIST_HEAD(, RAMBlockNotifier) ramblock_notifiers;
+    /*
+     * Number of memory regions with DIRTY_MEMORY_VGA logging enabled.
+     * Written under the BQL; while it is zero nobody consumes the VGA
+     * bitmap and it is not updated.
+     */
+    unsigned int vga_logging_regions;
 } RAMList;
 extern RAMList ram_list;
 
@@ -141,6 +141,15 @@ struct TranslationBlock {
     uintptr_t jmp_list_head;
     uintptr_t jmp_list_next[2];
     uintptr_t jmp_dest[2];
+
+    /*
+     * With -accel tcg,x-tb-profile=on, the number of times this TB has
+     * been entered, incremented by its own code, and the number of TLB
+     * fills made on its behalf.  Neither is atomic, so both are only
+     * approximate when several vCPUs run the same TB.
+     */
+    uint64_t exec_count;
+    uint64_t tlb_fill_count;
 };
 
 /* The alignment given to TranslationBlock during allocation. */
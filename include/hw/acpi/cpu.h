@@ -45,6 +45,14 @@ void acpi_cpu_unplug_request_cb(HotplugHandler *hotplug_dev,
 void acpi_cpu_unplug_cb(CPUHotplugState *cpu_st,
                         DeviceState *dev, Error **errp);
 
+/*
+ * CPUs plugged between acpi_cpu_hotplug_batch_begin() and
+ * acpi_cpu_hotplug_batch_end() are announced to the guest with a single
+ * hotplug event when the outermost batch ends.
+ */
+void acpi_cpu_hotplug_batch_begin(void);
+void acpi_cpu_hotplug_batch_end(void);
+
 void cpu_hotplug_hw_init(MemoryRegion *as, Object *owner,
                          CPUHotplugState *state, hwaddr base_addr);
 
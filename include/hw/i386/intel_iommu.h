@@ -155,6 +155,9 @@ struct VTDIOTLBEntry {
     uint64_t slpte;
     uint64_t mask;
     uint8_t access_flags;
+    struct vtd_iotlb_key *key;      /* key of the entry in the IOTLB */
+    IntelIOMMUState *iommu;
+    QTAILQ_ENTRY(VTDIOTLBEntry) lru;
 };
 
 /* VT-d Source-ID Qualifier types */
@@ -286,6 +289,8 @@ struct IntelIOMMUState {
 
     uint32_t context_cache_gen;     /* Should be in [1,MAX] */
     GHashTable *iotlb;              /* IOTLB */
+    /* IOTLB entries, most recently used first */
+    QTAILQ_HEAD(, VTDIOTLBEntry) iotlb_lru;
 
     GHashTable *vtd_address_spaces;             /* VTD address spaces */
     VTDAddressSpace *vtd_as_cache[VTD_PCI_BUS_MAX]; /* VTD address space cache */
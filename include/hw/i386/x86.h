@@ -48,6 +48,7 @@ struct X86MachineState {
     qemu_irq *gsi;
     DeviceState *ioapic2;
     GMappedFile *initrd_mapped_file;
+    GMappedFile *kernel_mapped_file;
     HotplugHandler *acpi_dev;
 
     /* RAM information (sizes, addresses, configuration): */
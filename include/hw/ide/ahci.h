@@ -26,6 +26,7 @@
 
 #include "hw/sysbus.h"
 #include "qom/object.h"
+#include "sysemu/dma.h"
 
 typedef struct AHCIDevice AHCIDevice;
 
@@ -35,6 +36,8 @@ typedef struct AHCIControlRegs {
     uint32_t    irqstatus;
     uint32_t    impl;
     uint32_t    version;
+    uint32_t    ccc_ctl;
+    uint32_t    ccc_ports;
 } AHCIControlRegs;
 
 typedef struct AHCIState {
@@ -49,6 +52,10 @@ typedef struct AHCIState {
     int32_t ports;
     qemu_irq irq;
     AddressSpace *as;
+    DMATranslationCache *dma_cache;  /* PRDT and command FIS reads */
+    bool ccc;               /* Advertise command completion coalescing */
+    QEMUTimer *ccc_timer;
+    uint32_t ccc_count;     /* Completions since the last CCC interrupt */
 } AHCIState;
 
 
@@ -117,6 +117,24 @@ struct FWCfgMemState {
  */
 void fw_cfg_add_bytes(FWCfgState *s, uint16_t key, void *data, size_t len);
 
+/**
+ * fw_cfg_add_bytes_from_fd:
+ * @s: fw_cfg device being modified
+ * @key: selector key value for new fw_cfg item
+ * @data: pointer to start of item data
+ * @len: size of item data
+ * @fd: file that holds the item data
+ * @offset: offset of the item data in @fd
+ *
+ * Like fw_cfg_add_bytes(), for data that is also the contents of @fd at
+ * @offset, typically because it was mapped from that file.  Large DMA
+ * reads of the item into guest RAM may then map the file copy-on-write
+ * rather than copy the data.  @fd must stay open, and the file unchanged,
+ * for the lifetime of the fw_cfg device.
+ */
+void fw_cfg_add_bytes_from_fd(FWCfgState *s, uint16_t key, void *data,
+                              size_t len, int fd, off_t offset);
+
 /**
  * fw_cfg_add_string:
  * @s: fw_cfg device being modified
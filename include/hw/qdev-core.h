@@ -150,6 +150,18 @@ struct DeviceClass {
     bool user_creatable;
     bool hotpluggable;
 
+    /**
+     * @has_lock: instances carry their own #DeviceState.lock
+     *
+     * MMIO and PIO regions owned by such a device are dispatched under
+     * the device lock instead of the BQL, so vCPUs accessing different
+     * devices do not serialize against each other or the main loop.
+     * Every path that touches the state those regions access, including
+     * timers, reset and migration, must take the lock with qdev_lock(),
+     * and must not acquire the BQL while holding it.
+     */
+    bool has_lock;
+
     /* callbacks */
     /**
      * @reset: deprecated device reset method pointer
@@ -292,6 +304,14 @@ struct DeviceState {
      * Used to prevent re-entrancy confusing things.
      */
     MemReentrancyGuard mem_reentrancy_guard;
+    /**
+     * @lock: protects device state if #DeviceClass.has_lock is set
+     */
+    QemuMutex lock;
+    /**
+     * @lock_owner: thread id of the current holder of @lock, or 0
+     */
+    int lock_owner;
 };
 
 struct DeviceListener {
@@ -581,6 +601,48 @@ void qdev_del_unplug_blocker(DeviceState *dev, Error *reason);
  */
 bool qdev_unplug_blocked(DeviceState *dev, Error **errp);
 
+/**
+ * qdev_lock: Acquire the lock of a device
+ *
+ * @dev: Device whose class sets #DeviceClass.has_lock
+ *
+ * The lock is not recursive.  It nests inside the BQL: it can be taken
+ * with or without the BQL held, but the BQL must never be taken while
+ * holding it.
+ */
+void qdev_lock(DeviceState *dev);
+
+/**
+ * qdev_unlock: Release the lock of a device
+ *
+ * @dev: Device locked by the calling thread with qdev_lock()
+ */
+void qdev_unlock(DeviceState *dev);
+
+/**
+ * qdev_is_locked: Check whether the calling thread holds a device lock
+ *
+ * @dev: Device whose class sets #DeviceClass.has_lock
+ */
+static inline bool qdev_is_locked(DeviceState *dev)
+{
+    return qatomic_read(&dev->lock_owner) == qemu_get_thread_id();
+}
+
+/**
+ * qdev_assert_locked: Annotate code that requires the device lock
+ *
+ * @dev: Device whose class sets #DeviceClass.has_lock
+ *
+ * The check is only compiled in with --enable-debug-mutex.
+ */
+static inline void qdev_assert_locked(DeviceState *dev)
+{
+#ifdef CONFIG_DEBUG_MUTEX
+    assert(qdev_is_locked(dev));
+#endif
+}
+
 /**
  * typedef GpioPolarity - Polarity of a GPIO line
  *
@@ -97,6 +97,7 @@ typedef struct VFIOContainer {
     QLIST_HEAD(, VFIOHostDMAWindow) hostwin_list;
     QLIST_HEAD(, VFIOGroup) group_list;
     QLIST_HEAD(, VFIORamDiscardListener) vrdl_list;
+    GArray *dma_map_pending; /* VFIODMAMap, issued at listener commit */
     QLIST_ENTRY(VFIOContainer) next;
 } VFIOContainer;
 
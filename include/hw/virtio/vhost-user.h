@@ -43,6 +43,16 @@ typedef struct VhostUserState {
     GPtrArray *notifiers;
     int memory_slots;
     bool supports_config;
+    /*
+     * Backend capabilities, queried by the vhost_dev with vq_index 0 and
+     * reused by the other vhost_devs (e.g. queue pairs) of the same
+     * connection instead of asking the backend again.
+     */
+    bool backend_info_valid;
+    uint64_t backend_features;
+    uint64_t backend_protocol_features;
+    uint64_t backend_max_queues;
+    uint64_t backend_max_memslots;
 } VhostUserState;
 
 /**
@@ -37,6 +37,9 @@ typedef struct vhost_vdpa {
     bool iotlb_batch_begin_sent;
     uint32_t address_space_id;
     MemoryListener listener;
+    bool listener_registered;
+    /* Value of shadow_data when the listener mapped guest memory */
+    bool listener_shadow_data;
     struct vhost_vdpa_iova_range iova_range;
     uint64_t acked_features;
     bool shadow_vqs_enabled;
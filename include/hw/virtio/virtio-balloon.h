@@ -71,6 +71,9 @@ struct VirtIOBalloon {
 
     bool qemu_4_0_config_size;
     uint32_t poison_val;
+
+    /* Free page reports being discarded in the thread pool, if any */
+    struct VirtIOBalloonReportBatch *report_batch;
 };
 
 #endif
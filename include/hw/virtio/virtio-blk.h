@@ -18,6 +18,7 @@
 #include "hw/virtio/virtio.h"
 #include "hw/block/block.h"
 #include "sysemu/iothread.h"
+#include "qapi/qapi-types-virtio.h"
 #include "sysemu/block-backend.h"
 #include "sysemu/block-ram-registrar.h"
 #include "qom/object.h"
@@ -37,10 +38,12 @@ struct VirtIOBlkConf
 {
     BlockConf conf;
     IOThread *iothread;
+    IOThreadVirtQueueMappingList *iothread_vq_mapping_list;
     char *serial;
     uint32_t request_merging;
     uint16_t num_queues;
     uint16_t queue_size;
+    uint32_t poll_budget_ns;
     bool seg_max_adjust;
     bool report_discard_granularity;
     uint32_t max_discard_sectors;
@@ -62,6 +65,7 @@ struct VirtIOBlock {
     bool dataplane_disabled;
     bool dataplane_started;
     struct VirtIOBlockDataPlane *dataplane;
+    AioContext **vq_aio_context; /* per-virtqueue, set up by dataplane */
     uint64_t host_features;
     size_t config_size;
     BlockRAMRegistrar blk_ram_registrar;
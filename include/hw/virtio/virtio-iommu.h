@@ -63,6 +63,7 @@ struct VirtIOIOMMU {
     bool boot_bypass;
     Notifier machine_done;
     bool granule_frozen;
+    GArray *notify_batch;   /* VirtIOIOMMUNotify not yet delivered */
 };
 
 #endif
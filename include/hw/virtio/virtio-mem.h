@@ -17,6 +17,7 @@
 #include "hw/virtio/virtio.h"
 #include "qapi/qapi-types-misc.h"
 #include "sysemu/hostmem.h"
+#include "qemu/thread.h"
 #include "qom/object.h"
 
 #define TYPE_VIRTIO_MEM "virtio-mem"
@@ -87,6 +88,18 @@ struct VirtIOMEM {
 
     /* listeners to notify on plug/unplug activity. */
     QLIST_HEAD(, RamDiscardListener) rdl_list;
+
+    /*
+     * Plug request waiting for background preallocation, if any. No further
+     * requests are processed until it completes.
+     */
+    VirtQueueElement *plug_elem;
+    uint64_t plug_gpa;
+    uint64_t plug_size;
+    int plug_ret;
+    QemuEvent plug_done;
+    QEMUBH *plug_bh;
+    VMChangeStateEntry *vmstate_change;
 };
 
 struct VirtIOMEMClass {
@@ -19,6 +19,7 @@
 #include "hw/virtio/virtio.h"
 #include "net/announce.h"
 #include "qemu/option_int.h"
+#include "qapi/qapi-types-virtio.h"
 #include "qom/object.h"
 
 #include "ebpf/ebpf_rss.h"
@@ -154,6 +155,17 @@ typedef struct VirtIONetQueue {
     struct {
         VirtQueueElement *elem;
     } async_tx;
+    /* Receive buffer lent to the peer by virtio_net_rx_zerocopy_begin() */
+    VirtQueueElement *rx_zerocopy_elem;
+    /* Set while virtio_net_receive_batch() defers the rx notification */
+    bool rx_batch;
+    bool rx_batch_notify;
+    /* Segments packets when the peer cannot take a vnet header */
+    struct NetTxPkt *tx_pkt;
+    /* IOThread from iothread-vq-mapping, NULL to stay in the main loop */
+    AioContext *ctx;
+    /* The pair is currently being processed in @ctx */
+    bool dataplane;
     struct VirtIONet *n;
 } VirtIONetQueue;
 
@@ -209,6 +221,14 @@ struct VirtIONet {
     AnnounceTimer announce_timer;
     bool needs_vnet_hdr_swap;
     bool mtu_bypass_backend;
+    bool rx_zerocopy;
+    bool tx_sw_offload;
+    IOThreadVirtQueueMappingList *iothread_vq_mapping_list;
+    bool ioeventfd_started;
+    /* Keep all queue pairs in the main loop during control commands */
+    bool ctrl_in_progress;
+    /* Number of queue pairs running in an IOThread */
+    uint16_t dataplane_queue_pairs;
     /* primary failover device is hidden*/
     bool failover_primary_hidden;
     bool failover;
@@ -217,8 +237,16 @@ struct VirtIONet {
     bool primary_opts_from_json;
     Notifier migration_state;
     VirtioNetRssData rss_data;
+    /* Notification coalescing set through VIRTIO_NET_CTRL_NOTF_COAL */
+    uint32_t rx_coal_max_packets;
+    uint32_t rx_coal_usecs;
+    uint32_t tx_coal_max_packets;
+    uint32_t tx_coal_usecs;
+    bool coal_adaptive;
     struct NetRxPkt *rx_pkt;
     struct EBPFRSSContext ebpf_rss;
+    /* Steering program set by the management layer, or -1 */
+    int steering_prog_fd;
 };
 
 size_t virtio_net_handle_ctrl_iov(VirtIODevice *vdev,
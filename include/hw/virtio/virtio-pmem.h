@@ -32,6 +32,13 @@ struct VirtIOPMEM {
     VirtQueue *rq_vq;
     uint64_t start;
     HostMemoryBackend *memdev;
+
+    /*
+     * Flush requests waiting for the next fdatasync, and those that the one
+     * in flight will complete.
+     */
+    QSIMPLEQ_HEAD(, VirtIODeviceRequest) flush_pending;
+    QSIMPLEQ_HEAD(, VirtIODeviceRequest) flush_running;
 };
 
 struct VirtIOPMEMClass {
@@ -80,6 +80,15 @@ struct VirtIOSerialPortClass {
      */
     ssize_t (*have_data)(VirtIOSerialPort *port, const uint8_t *buf,
                          ssize_t len);
+
+    /*
+     * Optional variant of have_data that receives the data of several
+     * elements at once.  Like have_data, it returns how much was consumed
+     * and enables throttling if that is less than the total; a console
+     * port that does not throttle drops the rest instead.
+     */
+    ssize_t (*have_data_iov)(VirtIOSerialPort *port,
+                             const struct iovec *iov, int iovcnt);
 };
 
 /*
@@ -49,6 +49,8 @@ struct QIOChannelTLS {
     QCryptoTLSSession *session;
     QIOChannelShutdown shutdown;
     guint hs_ioc_tag;
+    bool want_ktls_tx;
+    bool ktls_tx;
 };
 
 /**
@@ -132,6 +134,23 @@ void qio_channel_tls_handshake(QIOChannelTLS *ioc,
                                GDestroyNotify destroy,
                                GMainContext *context);
 
+/**
+ * qio_channel_tls_set_ktls_tx:
+ * @ioc: the TLS channel object
+ * @enabled: whether to try kernel TLS for sending
+ *
+ * Request that, once the handshake completes, encryption of
+ * outgoing data is handed to the kernel (kTLS) if the master
+ * channel is a socket and the negotiated cipher allows it.
+ * Otherwise the channel silently keeps encrypting in
+ * userspace. Must be called before qio_channel_tls_handshake().
+ *
+ * Only use this if the peer is not expected to send TLS 1.3
+ * KeyUpdate messages, which would need a reply from the
+ * userspace TLS stack.
+ */
+void qio_channel_tls_set_ktls_tx(QIOChannelTLS *ioc, bool enabled);
+
 /**
  * qio_channel_tls_get_session:
  * @ioc: the TLS channel object
@@ -73,6 +73,17 @@ typedef struct SaveVMHandlers {
     int (*resume_prepare)(MigrationState *s, void *opaque);
     /* Checks if switchover ack should be used. Called only in dest */
     bool (*switchover_ack_needed)(void *opaque);
+
+    /*
+     * With the parallel-device-state capability, save_live_complete_precopy
+     * runs on a worker thread, outside the iothread lock and concurrently
+     * with the other sections that set this; on the destination, so does
+     * load_state for the data it saved.  The callbacks must only access
+     * the state of their own section.  A section that does not set it
+     * waits for all the sections before it to be done, so ordering
+     * dependencies follow the order of registration (MigrationPriority).
+     */
+    bool complete_precopy_thread_safe;
 } SaveVMHandlers;
 
 int register_savevm_live(const char *idstr,
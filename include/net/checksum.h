@@ -26,6 +26,10 @@ struct iovec;
 #define CSUM_UDP    0x04
 #define CSUM_ALL    (CSUM_IP | CSUM_TCP | CSUM_UDP)
 
+/*
+ * The partial sums returned by the functions below are only meant to be
+ * added up and passed to net_checksum_finish().
+ */
 uint32_t net_checksum_add_cont(int len, uint8_t *buf, int seq);
 uint16_t net_checksum_finish(uint32_t sum);
 uint16_t net_checksum_tcpudp(uint16_t length, uint16_t proto,
@@ -64,6 +68,9 @@ uint32_t net_checksum_add_iov(const struct iovec *iov,
                               uint32_t iov_off, uint32_t size,
                               uint32_t csum_offset);
 
+/* Select the next checksum accelerator to be tested */
+bool test_net_checksum_next_accel(void);
+
 typedef struct toeplitz_key_st {
     uint32_t leftmost_32_bits;
     uint8_t *next_byte;
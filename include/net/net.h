@@ -2,6 +2,7 @@
 #define QEMU_NET_H
 
 #include "qemu/queue.h"
+#include "qemu/stats64.h"
 #include "qapi/qapi-types-net.h"
 #include "net/queue.h"
 #include "hw/qdev-properties-system.h"
@@ -67,7 +68,12 @@ typedef struct SocketReadState SocketReadState;
 typedef void (SocketReadStateFinalize)(SocketReadState *rs);
 typedef void (NetAnnounce)(NetClientState *);
 typedef bool (SetSteeringEBPF)(NetClientState *, int);
+typedef bool (SetSteeringProgram)(NetClientState *, int, Error **);
 typedef bool (NetCheckPeerType)(NetClientState *, ObjectClass *, Error **);
+typedef int (NetRxZerocopyBegin)(NetClientState *, struct iovec *, int);
+typedef bool (NetRxZerocopyEnd)(NetClientState *, ssize_t);
+typedef int (NetReceiveBatch)(NetClientState *, const struct iovec *, int);
+typedef void (NetSetAioContext)(NetClientState *, AioContext *);
 
 typedef struct NetClientInfo {
     NetClientDriver type;
@@ -96,6 +102,11 @@ typedef struct NetClientInfo {
     NetAnnounce *announce;
     SetSteeringEBPF *set_steering_ebpf;
     NetCheckPeerType *check_peer_type;
+    NetRxZerocopyBegin *rx_zerocopy_begin;
+    NetRxZerocopyEnd *rx_zerocopy_end;
+    NetReceiveBatch *receive_batch;
+    NetSetAioContext *set_aio_context;
+    SetSteeringProgram *set_steering_program;
 } NetClientInfo;
 
 struct NetClientState {
@@ -116,7 +127,15 @@ struct NetClientState {
     bool is_netdev;
     bool do_not_pad; /* do not pad to the minimum ethernet frame length */
     bool is_datapath;
+    /* AioContext that processes the packets, NULL for the main loop */
+    AioContext *aio_context;
     QTAILQ_HEAD(, NetFilterState) filters;
+    /* Packets delivered to and sent by this client, for query-stats */
+    Stat64 rx_packets;
+    Stat64 rx_bytes;
+    Stat64 rx_dropped;
+    Stat64 tx_packets;
+    Stat64 tx_bytes;
 };
 
 typedef QTAILQ_HEAD(NetClientStateList, NetClientState) NetClientStateList;
@@ -180,6 +199,11 @@ ssize_t qemu_receive_packet_iov(NetClientState *nc,
 ssize_t qemu_send_packet_raw(NetClientState *nc, const uint8_t *buf, int size);
 ssize_t qemu_send_packet_async(NetClientState *nc, const uint8_t *buf,
                                int size, NetPacketSent *sent_cb);
+int qemu_rx_zerocopy_begin(NetClientState *nc, struct iovec *iov,
+                           int iovcnt);
+bool qemu_rx_zerocopy_end(NetClientState *nc, ssize_t size);
+int qemu_send_packet_batch(NetClientState *nc, const struct iovec *pkts,
+                           int count);
 void qemu_purge_queued_packets(NetClientState *nc);
 void qemu_flush_queued_packets(NetClientState *nc);
 void qemu_flush_or_purge_queued_packets(NetClientState *nc, bool purge);
@@ -190,6 +214,8 @@ bool qemu_has_ufo(NetClientState *nc);
 bool qemu_has_vnet_hdr(NetClientState *nc);
 bool qemu_has_vnet_hdr_len(NetClientState *nc, int len);
 bool qemu_get_using_vnet_hdr(NetClientState *nc);
+bool qemu_net_client_can_set_aio_context(NetClientState *nc);
+void qemu_net_client_set_aio_context(NetClientState *nc, AioContext *ctx);
 void qemu_using_vnet_hdr(NetClientState *nc, bool enable);
 void qemu_set_offload(NetClientState *nc, int csum, int tso4, int tso6,
                       int ecn, int ufo);
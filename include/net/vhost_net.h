@@ -14,6 +14,8 @@ typedef struct VhostNetOptions {
     VhostBackendType backend_type;
     NetClientState *net_backend;
     uint32_t busyloop_timeout;
+    /* Give each virtqueue its own vhost worker thread */
+    bool worker_per_vq;
     unsigned int nvqs;
     void *opaque;
 } VhostNetOptions;
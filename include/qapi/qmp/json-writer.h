@@ -14,7 +14,16 @@
 #ifndef JSON_WRITER_H
 #define JSON_WRITER_H
 
+/*
+ * Streaming writers hand their output to a JSONWriterFlushFunc in chunks
+ * instead of accumulating it all in memory.
+ */
+typedef void JSONWriterFlushFunc(void *opaque, const char *buf, size_t len);
+
 JSONWriter *json_writer_new(bool pretty);
+JSONWriter *json_writer_new_stream(bool pretty, JSONWriterFlushFunc *flush,
+                                   void *opaque);
+void json_writer_flush(JSONWriter *);
 const char *json_writer_get(JSONWriter *);
 GString *json_writer_get_and_free(JSONWriter *);
 void json_writer_free(JSONWriter *);
@@ -36,6 +36,7 @@
  * bitmap_full(src, nbits)                      Are all bits set in *src?
  * bitmap_set(dst, pos, nbits)                  Set specified bit area
  * bitmap_set_atomic(dst, pos, nbits)           Set specified bit area with atomic ops
+ * bitmap_set_atomic_lazy(dst, pos, nbits)      Same, skipping words already set
  * bitmap_clear(dst, pos, nbits)                Clear specified bit area
  * bitmap_test_and_clear_atomic(dst, pos, nbits)    Test and clear area
  * bitmap_find_next_zero_area(buf, len, pos, n, mask)  Find bit free area
@@ -251,6 +252,7 @@ static inline long bitmap_count_one_with_offset(const unsigned long *bitmap,
 
 void bitmap_set(unsigned long *map, long i, long len);
 void bitmap_set_atomic(unsigned long *map, long i, long len);
+void bitmap_set_atomic_lazy(unsigned long *map, long i, long len);
 void bitmap_clear(unsigned long *map, long start, long nr);
 bool bitmap_test_and_clear_atomic(unsigned long *map, long start, long nr);
 bool bitmap_test_and_clear(unsigned long *map, long start, long nr);
@@ -76,6 +76,40 @@ typedef void coroutine_fn CoroutineEntry(void *opaque);
  */
 Coroutine *qemu_coroutine_create(CoroutineEntry *entry, void *opaque);
 
+/**
+ * Coroutine stack size classes
+ *
+ * @COROUTINE_STACK_DEFAULT: 1 MiB, for arbitrary code
+ * @COROUTINE_STACK_SMALL: 256 KiB, for short call chains such as the block
+ * layer I/O paths, where many coroutines can be in flight at once
+ */
+typedef enum {
+    COROUTINE_STACK_DEFAULT,
+    COROUTINE_STACK_SMALL,
+    COROUTINE_STACK__MAX,
+} CoroutineStackClass;
+
+/**
+ * Create a new coroutine with a stack from the given size class
+ *
+ * Each class has its own pool of coroutines for reuse.  Overflowing the
+ * stack hits a guard page and crashes, so only use a small stack where the
+ * call chain below the entry point is known to be shallow.
+ */
+Coroutine *qemu_coroutine_create_sized(CoroutineEntry *entry, void *opaque,
+                                       CoroutineStackClass stack_class);
+
+/**
+ * Get stack usage statistics for a stack size class
+ *
+ * @count: number of coroutines, including pooled ones
+ * @reserved: address space reserved for their stacks
+ * @resident: bytes of their stacks backed by host memory
+ */
+void qemu_coroutine_stack_stats(CoroutineStackClass stack_class,
+                                uint64_t *count, uint64_t *reserved,
+                                uint64_t *resident);
+
 /**
  * Transfer control to a coroutine
  */
@@ -142,8 +176,12 @@ void qemu_co_mutex_init(CoMutex *mutex);
 /**
  * Locks the mutex. If the lock cannot be taken immediately, control is
  * transferred to the caller of the current coroutine.
+ *
+ * @file and @line identify the call site for the synchronization profiler.
  */
-void coroutine_fn qemu_co_mutex_lock(CoMutex *mutex);
+void coroutine_fn qemu_co_mutex_lock_impl(CoMutex *mutex, const char *file,
+                                          int line);
+#define qemu_co_mutex_lock(m) qemu_co_mutex_lock_impl(m, __FILE__, __LINE__)
 
 /**
  * Unlocks the mutex and schedules the next coroutine that was waiting for this
@@ -151,4 +189,10 @@ void coroutine_fn qemu_co_mutex_lock(CoMutex *mutex);
  */
 void coroutine_fn qemu_co_mutex_unlock(CoMutex *mutex);
 
+/* Out-of-line version for QemuLockable */
+static inline void coroutine_fn (qemu_co_mutex_lock)(CoMutex *mutex)
+{
+    qemu_co_mutex_lock(mutex);
+}
+
 #endif
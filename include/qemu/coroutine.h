@@ -113,11 +113,14 @@ typedef enum {
  * locked again afterwards.
  */
 #define qemu_co_queue_wait(queue, lock) \
-    qemu_co_queue_wait_impl(queue, QEMU_MAKE_LOCKABLE(lock), 0)
+    qemu_co_queue_wait_impl(queue, QEMU_MAKE_LOCKABLE(lock), 0, \
+                            __FILE__, __LINE__)
 #define qemu_co_queue_wait_flags(queue, lock, flags) \
-    qemu_co_queue_wait_impl(queue, QEMU_MAKE_LOCKABLE(lock), (flags))
+    qemu_co_queue_wait_impl(queue, QEMU_MAKE_LOCKABLE(lock), (flags), \
+                            __FILE__, __LINE__)
 void coroutine_fn qemu_co_queue_wait_impl(CoQueue *queue, QemuLockable *lock,
-                                          CoQueueWaitFlags flags);
+                                          CoQueueWaitFlags flags,
+                                          const char *file, int line);
 
 /**
  * Removes the next coroutine from the CoQueue, and queue it to run after
@@ -188,7 +191,10 @@ void qemu_co_rwlock_init(CoRwlock *lock);
  * of a parallel writer, control is transferred to the caller of the current
  * coroutine.
  */
-void coroutine_fn qemu_co_rwlock_rdlock(CoRwlock *lock);
+void coroutine_fn qemu_co_rwlock_rdlock_impl(CoRwlock *lock,
+                                             const char *file, int line);
+#define qemu_co_rwlock_rdlock(lock) \
+    qemu_co_rwlock_rdlock_impl(lock, __FILE__, __LINE__)
 
 /**
  * Write Locks the CoRwlock from a reader.  This is a bit more efficient than
@@ -197,7 +203,10 @@ void coroutine_fn qemu_co_rwlock_rdlock(CoRwlock *lock);
  * to the caller of the current coroutine; another writer might run while
  * @qemu_co_rwlock_upgrade blocks.
  */
-void coroutine_fn qemu_co_rwlock_upgrade(CoRwlock *lock);
+void coroutine_fn qemu_co_rwlock_upgrade_impl(CoRwlock *lock,
+                                              const char *file, int line);
+#define qemu_co_rwlock_upgrade(lock) \
+    qemu_co_rwlock_upgrade_impl(lock, __FILE__, __LINE__)
 
 /**
  * Downgrades a write-side critical section to a reader.  Downgrading with
@@ -212,7 +221,10 @@ void coroutine_fn qemu_co_rwlock_downgrade(CoRwlock *lock);
  * of a parallel reader, control is transferred to the caller of the current
  * coroutine.
  */
-void coroutine_fn qemu_co_rwlock_wrlock(CoRwlock *lock);
+void coroutine_fn qemu_co_rwlock_wrlock_impl(CoRwlock *lock,
+                                             const char *file, int line);
+#define qemu_co_rwlock_wrlock(lock) \
+    qemu_co_rwlock_wrlock_impl(lock, __FILE__, __LINE__)
 
 /**
  * Unlocks the read/write lock and schedules the next coroutine that was
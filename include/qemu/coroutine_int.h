@@ -34,6 +34,7 @@ extern __thread void *__safestack_unsafe_stack_ptr;
 #endif
 
 #define COROUTINE_STACK_SIZE (1 << 20)
+#define COROUTINE_SMALL_STACK_SIZE (1 << 18)
 
 typedef enum {
     COROUTINE_YIELD = 1,
@@ -46,6 +47,9 @@ struct Coroutine {
     void *entry_arg;
     Coroutine *caller;
 
+    CoroutineStackClass stack_class;
+    QLIST_ENTRY(Coroutine) all_next;
+
     /* Only used when the coroutine has terminated.  */
     QSLIST_ENTRY(Coroutine) pool_next;
 
@@ -69,8 +73,10 @@ struct Coroutine {
     QSLIST_ENTRY(Coroutine) co_scheduled_next;
 };
 
-Coroutine *qemu_coroutine_new(void);
+Coroutine *qemu_coroutine_new(size_t stack_size);
 void qemu_coroutine_delete(Coroutine *co);
+/* Bytes of the coroutine's stack that are backed by host memory */
+size_t qemu_coroutine_stack_resident(Coroutine *co);
 CoroutineAction qemu_coroutine_switch(Coroutine *from, Coroutine *to,
                                       CoroutineAction action);
 
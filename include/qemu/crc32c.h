@@ -32,4 +32,10 @@
 uint32_t crc32c(uint32_t crc, const uint8_t *data, unsigned int length);
 uint32_t iov_crc32c(uint32_t crc, const struct iovec *iov, size_t iov_cnt);
 
+/*
+ * Switch crc32c() to the next available accelerated implementation,
+ * returning false when all of them have been used.  For tests only.
+ */
+bool test_crc32c_next_accel(void);
+
 #endif
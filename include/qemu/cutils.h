@@ -190,6 +190,31 @@ char *freq_to_str(uint64_t freq_hz);
 bool buffer_is_zero(const void *buf, size_t len);
 bool test_buffer_is_zero_next_accel(void);
 
+typedef struct BufferZeroRun {
+    size_t offset;
+    size_t length;
+    bool zero;
+} BufferZeroRun;
+
+/**
+ * buffer_find_zero_runs:
+ * @buf: buffer to scan
+ * @len: length of @buf in bytes
+ * @granularity: size of the blocks that are classified as zero or non-zero;
+ *               the last block may be shorter
+ * @runs: array that receives the runs
+ * @max_runs: size of @runs, at least 1
+ *
+ * Split @buf into alternating runs of all-zero and non-zero blocks, in a
+ * single pass.  The scan stops at the end of @buf or where run number
+ * @max_runs + 1 would start, so with @max_runs == 1 it only measures how
+ * far the state of the first block extends.
+ *
+ * Returns the number of runs stored in @runs.
+ */
+size_t buffer_find_zero_runs(const void *buf, size_t len, size_t granularity,
+                             BufferZeroRun *runs, size_t max_runs);
+
 /*
  * Implementation of ULEB128 (http://en.wikipedia.org/wiki/LEB128)
  * Input is limited to 14-bit numbers
@@ -153,6 +153,12 @@ size_t iov_discard_front_undoable(struct iovec **iov, unsigned int *iov_cnt,
 size_t iov_discard_back_undoable(struct iovec *iov, unsigned int *iov_cnt,
                                  size_t bytes, IOVDiscardUndo *undo);
 
+/*
+ * Number of iovec elements a QEMUIOVector can hold without allocating.
+ * Most requests, and most slices of them, are no larger than that.
+ */
+#define QEMU_IOVEC_INLINE_NIOV 4
+
 typedef struct QEMUIOVector {
     struct iovec *iov;
     int niov;
@@ -170,6 +176,10 @@ typedef struct QEMUIOVector {
      * @nalloc is always valid and is -1 both for embedded and external
      * cases. It is included in the union only to ensure the padding prior
      * to the @size field will not result in a 0-length array.
+     *
+     * Vectors created by qemu_iovec_init() start out in @inline_iov and
+     * only move to the heap once they grow beyond QEMU_IOVEC_INLINE_NIOV
+     * elements.  Such a QEMUIOVector must not be copied by value.
      */
     union {
         struct {
@@ -181,6 +191,7 @@ typedef struct QEMUIOVector {
             size_t size;
         };
     };
+    struct iovec inline_iov[QEMU_IOVEC_INLINE_NIOV];
 } QEMUIOVector;
 
 QEMU_BUILD_BUG_ON(offsetof(QEMUIOVector, size) !=
@@ -247,4 +258,22 @@ ssize_t qemu_iovec_compare(QEMUIOVector *a, QEMUIOVector *b);
 void qemu_iovec_clone(QEMUIOVector *dest, const QEMUIOVector *src, void *buf);
 void qemu_iovec_discard_back(QEMUIOVector *qiov, size_t bytes);
 
+/*
+ * Position inside a QEMUIOVector.  Walking a vector with a cursor costs
+ * O(niov) in total, where repeated qemu_iovec_init_slice() calls with
+ * increasing offsets have to skip over the leading elements every time.
+ */
+typedef struct QEMUIOVCursor {
+    struct iovec *iov;      /* current element */
+    struct iovec *end;      /* one past the last element */
+    size_t offset;          /* offset inside *iov */
+    size_t remaining;       /* bytes left until the end of the vector */
+} QEMUIOVCursor;
+
+void qemu_iovec_cursor_init(QEMUIOVCursor *cur, QEMUIOVector *qiov,
+                            size_t offset);
+void qemu_iovec_cursor_advance(QEMUIOVCursor *cur, size_t bytes);
+void qemu_iovec_cursor_slice(QEMUIOVCursor *cur, QEMUIOVector *qiov,
+                             size_t bytes);
+
 #endif
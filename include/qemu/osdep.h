@@ -652,6 +652,29 @@ typedef struct ThreadContext ThreadContext;
 void qemu_prealloc_mem(int fd, char *area, size_t sz, int max_threads,
                        ThreadContext *tc, Error **errp);
 
+typedef void PreallocAsyncDoneFunc(void *opaque, int ret);
+
+/**
+ * qemu_prealloc_mem_async:
+ * @fd: the fd mapped into the area, -1 for anonymous memory
+ * @area: start address of the are to preallocate
+ * @sz: the size of the area to preallocate
+ * @max_threads: maximum number of threads to use
+ * @tc: thread context to create the threads in, or NULL
+ * @done: called with 0 or a negative errno once the area is populated
+ * @opaque: argument for @done
+ *
+ * Like qemu_prealloc_mem(), but populate the area in background threads
+ * while the caller, and the guest, keep running and possibly fault in
+ * pages on their own.  @done is called from an arbitrary thread.
+ *
+ * This requires MADV_POPULATE_WRITE.  If it is not available, nothing is
+ * done and false is returned; the caller should use qemu_prealloc_mem().
+ */
+bool qemu_prealloc_mem_async(int fd, char *area, size_t sz, int max_threads,
+                             ThreadContext *tc, PreallocAsyncDoneFunc *done,
+                             void *opaque);
+
 /**
  * qemu_get_pid_name:
  * @pid: pid of a process
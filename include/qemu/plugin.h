@@ -74,6 +74,8 @@ enum plugin_dyn_cb_type {
 enum plugin_dyn_cb_subtype {
     PLUGIN_CB_REGULAR,
     PLUGIN_CB_INLINE,
+    PLUGIN_CB_COND,     /* regular callback guarded by an inline condition */
+    PLUGIN_CB_RING,     /* memory access logged to a qemu_plugin_mem_ring */
     PLUGIN_N_CB_SUBTYPES,
 };
 
@@ -88,15 +90,47 @@ struct qemu_plugin_dyn_cb {
     enum plugin_dyn_cb_subtype type;
     /* @rw applies to mem callbacks only (both regular and inline) */
     enum qemu_plugin_mem_rw rw;
-    /* fields specific to each dyn_cb type go here */
+    /*
+     * fields specific to each dyn_cb type go here. Inline ops without a
+     * scoreboard (@entry.score == NULL) work on the uint64_t at @userp.
+     * For rings, @userp points to the qemu_plugin_mem_ring.
+     */
     union {
         struct {
+            qemu_plugin_u64 entry;
             enum qemu_plugin_op op;
             uint64_t imm;
         } inline_insn;
+        struct {
+            qemu_plugin_u64 entry;
+            enum qemu_plugin_cond cond;
+            uint64_t imm;
+        } cond;
+        struct {
+            uint64_t pc;
+            /* accesses instrumented in the instruction, set by plugin-gen */
+            unsigned int n_accesses;
+        } ring;
     };
 };
 
+/*
+ * Memory access rings: one buffer per vCPU, kept in a scoreboard so that
+ * translated code finds the executing vCPU's one like any other entry.
+ */
+struct qemu_plugin_mem_ring_buf {
+    uint64_t count;
+    qemu_plugin_mem_record records[];
+};
+
+struct qemu_plugin_mem_ring {
+    struct qemu_plugin_scoreboard *score;
+    size_t n_records;
+    qemu_plugin_vcpu_mem_batch_cb_t cb;
+    void *userdata;
+    QLIST_ENTRY(qemu_plugin_mem_ring) entry;
+};
+
 /* Internal context for instrumenting an instruction */
 struct qemu_plugin_insn {
     GByteArray *data;
@@ -205,6 +239,23 @@ void qemu_plugin_atexit_cb(void);
 
 void qemu_plugin_add_dyn_cb_arr(GArray *arr);
 
+/**
+ * qemu_plugin_u64_layout(): locate the counters behind a qemu_plugin_u64
+ * @entry: scoreboard entry, or one with a NULL scoreboard
+ * @ptr: the counter to use when @entry has no scoreboard
+ * @base: set to the address of vCPU 0's counter
+ * @stride: set to the distance between two vCPUs' counters, or 0
+ *
+ * The layout only changes across a code cache flush, so it can be baked
+ * into translated code.
+ */
+void qemu_plugin_u64_layout(qemu_plugin_u64 entry, void *ptr,
+                            char **base, size_t *stride);
+
+/* deliver the records pending in @cpu_index's buffer of @ring */
+void qemu_plugin_mem_ring_flush(struct qemu_plugin_mem_ring *ring,
+                                unsigned int cpu_index);
+
 static inline void qemu_plugin_disable_mem_helpers(CPUState *cpu)
 {
     cpu->plugin_mem_cbs = NULL;
@@ -11,13 +11,53 @@
 #ifndef QEMU_QSP_H
 #define QEMU_QSP_H
 
+enum QSPType {
+    QSP_MUTEX,
+    QSP_BQL_MUTEX,
+    QSP_REC_MUTEX,
+    QSP_CONDVAR,
+    QSP_CO_MUTEX,
+    QSP_CO_RWLOCK,
+    QSP_CO_QUEUE,
+    QSP_GRAPH_LOCK,
+};
+
 enum QSPSortBy {
     QSP_SORT_BY_TOTAL_WAIT_TIME,
     QSP_SORT_BY_AVG_WAIT_TIME,
 };
 
 void qsp_report(size_t max, enum QSPSortBy sort_by,
-                bool callsite_coalesce);
+                bool callsite_coalesce, bool folded);
+
+/*
+ * Coroutine locks cannot be intercepted through function pointers like the
+ * primitives above, because the wait time spans one or more yields and the
+ * coroutine may even resume in a different thread.  Instead, the lock
+ * implementations sample the clock themselves when qsp_co_enabled is set,
+ * and report the wait with qsp_co_record() once the lock has been taken.
+ */
+extern bool qsp_co_enabled;
+
+int64_t qsp_co_clock(void);
+
+/* Returns the start time of a wait, or 0 if profiling is disabled */
+static inline int64_t qsp_co_start(void)
+{
+    return unlikely(qatomic_read(&qsp_co_enabled)) ? qsp_co_clock() : 0;
+}
+
+void qsp_co_do_record(const void *obj, enum QSPType type, const char *file,
+                      int line, int64_t t0);
+
+static inline void qsp_co_record(const void *obj, enum QSPType type,
+                                 const char *file, int line, int64_t t0)
+{
+    /* t0 is 0 if profiling was off when the wait started */
+    if (unlikely(t0)) {
+        qsp_co_do_record(obj, type, file, line, t0);
+    }
+}
 
 bool qsp_is_enabled(void);
 void qsp_enable(void);
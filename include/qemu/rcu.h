@@ -54,6 +54,25 @@ extern unsigned long rcu_gp_ctr;
 
 extern QemuEvent rcu_gp_event;
 
+struct rcu_head;
+typedef void RCUCBFunc(struct rcu_head *head);
+
+struct rcu_head {
+    struct rcu_head *next;
+    RCUCBFunc *func;
+};
+
+/*
+ * Wait-free multi-producer, single-consumer queue of call_rcu() callbacks.
+ * The head is only used by the consumer.
+ */
+struct rcu_call_queue {
+    struct rcu_head *head;
+    struct rcu_head **tail;
+    struct rcu_head dummy;
+    int count;
+};
+
 struct rcu_reader_data {
     /* Data used by both reader and synchronize_rcu() */
     unsigned long ctr;
@@ -71,6 +90,12 @@ struct rcu_reader_data {
      * the thread!
      */
     NotifierList force_rcu;
+
+    /*
+     * Callbacks passed to call_rcu() by this thread while it is registered.
+     * Filled by the thread itself and drained under rcu_registry_lock.
+     */
+    struct rcu_call_queue call_queue;
 };
 
 QEMU_DECLARE_CO_TLS(struct rcu_reader_data, rcu_reader)
@@ -132,14 +157,6 @@ extern void rcu_unregister_thread(void);
 extern void rcu_enable_atfork(void);
 extern void rcu_disable_atfork(void);
 
-struct rcu_head;
-typedef void RCUCBFunc(struct rcu_head *head);
-
-struct rcu_head {
-    struct rcu_head *next;
-    RCUCBFunc *func;
-};
-
 extern void call_rcu1(struct rcu_head *head, RCUCBFunc *func);
 extern void drain_call_rcu(void);
 
@@ -192,6 +209,16 @@ G_DEFINE_AUTOPTR_CLEANUP_FUNC(RCUReadAuto, rcu_read_auto_unlock)
  * Force-RCU notifiers tell readers that they should exit their
  * read-side critical section.
  */
+typedef struct RCUStats {
+    uint64_t grace_periods;         /* calls to synchronize_rcu() */
+    uint64_t grace_period_ns;       /* total time spent in synchronize_rcu() */
+    uint64_t grace_period_max_ns;   /* longest synchronize_rcu() */
+    uint64_t callbacks;             /* call_rcu() callbacks invoked */
+    uint64_t callbacks_pending;     /* call_rcu() callbacks not invoked yet */
+} RCUStats;
+
+void rcu_get_stats(RCUStats *stats);
+
 void rcu_add_force_rcu_notifier(Notifier *n);
 void rcu_remove_force_rcu_notifier(Notifier *n);
 
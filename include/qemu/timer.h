@@ -87,6 +87,8 @@ struct QEMUTimer {
     QEMUTimerCB *cb;
     void *opaque;
     QEMUTimer *next;
+    QEMUTimer **pprev;
+    unsigned slot;              /* timer wheel slot, if pending */
     int attributes;
     int scale;
 };
@@ -24,6 +24,7 @@ typedef struct VuFdWatch {
     int fd; /*kick fd*/
     void *pvt;
     vu_watch_cb cb;
+    AioContext *ctx; /* The virtqueue's AioContext, NULL for the server's */
     QTAILQ_ENTRY(VuFdWatch) next;
 } VuFdWatch;
 
@@ -31,7 +32,9 @@ typedef struct VuFdWatch {
  * VuServer:
  * A vhost-user server instance with user-defined VuDevIface callbacks.
  * Vhost-user device backends can be implemented using VuServer. VuDevIface
- * callbacks and virtqueue kicks run in the given AioContext.
+ * callbacks and virtqueue kicks run in the given AioContext, unless
+ * virtqueues are spread over other AioContexts with
+ * vhost_user_server_set_queue_ctxs().
  */
 typedef struct {
     QIONetListener *listener;
@@ -50,6 +53,19 @@ typedef struct {
     QTAILQ_HEAD(, VuFdWatch) vu_fd_watches;
 
     Coroutine *co_trip; /* coroutine for processing VhostUserMsg */
+
+    /*
+     * Virtqueue i is handled in queue_ctxs[i % nr_queue_ctxs].  Kicks are
+     * not monitored in these contexts while a vhost-user message is
+     * processed (queues_paused) or while the server is detached
+     * (queues_detached).
+     */
+    AioContext **queue_ctxs;
+    int nr_queue_ctxs;
+    QemuMutex fd_watches_lock; /* protects vu_fd_watches */
+    bool queues_paused;
+    bool queues_detached;
+    unsigned int queue_ctxs_pausing; /* atomic */
 } VuServer;
 
 bool vhost_user_server_start(VuServer *server,
@@ -61,6 +77,9 @@ bool vhost_user_server_start(VuServer *server,
 
 void vhost_user_server_stop(VuServer *server);
 
+void vhost_user_server_set_queue_ctxs(VuServer *server, AioContext **ctxs,
+                                      int nr_ctxs);
+
 void vhost_user_server_inc_in_flight(VuServer *server);
 void vhost_user_server_dec_in_flight(VuServer *server);
 bool vhost_user_server_has_in_flight(VuServer *server);
@@ -50,6 +50,18 @@ int64_t icount_get(void);
  */
 int64_t icount_to_ns(int64_t icount);
 
+/*
+ * Instructions that a vCPU may execute ahead of QEMU_CLOCK_VIRTUAL with
+ * multi-threaded TCG, from the icount "quantum" option; 0 if not set.
+ */
+int64_t icount_get_quantum(void);
+
+/*
+ * Move the instruction counter forward to @icount, if it is behind.
+ * Returns the new value. Used at the end of each MTTCG icount quantum.
+ */
+int64_t icount_advance_to(int64_t icount);
+
 /* configure the icount options, including "shift" */
 void icount_configure(QemuOpts *opts, Error **errp);
 
@@ -188,6 +188,55 @@ static inline MemTxResult dma_memory_write(AddressSpace *as, dma_addr_t addr,
 MemTxResult dma_memory_set(AddressSpace *as, dma_addr_t addr,
                            uint8_t c, dma_addr_t len, MemTxAttrs attrs);
 
+typedef struct DMATranslationCache DMATranslationCache;
+
+/**
+ * dma_translation_cache_new: Create a DMA translation cache
+ *
+ * A DMA translation cache remembers a few recent bus address to host
+ * pointer translations of @as, so that a device processing a batch of
+ * small descriptors does not walk the FlatView (and any vIOMMU in it)
+ * for every single access.  The cache is flushed whenever the memory
+ * topology changes and whenever a vIOMMU in @as invalidates a mapping.
+ *
+ * Translations through nested vIOMMUs are not tracked; only the first
+ * level of translation is covered by the invalidation notifiers.
+ *
+ * Must be called with the BQL held.
+ *
+ * @as: #AddressSpace the device performs DMA on
+ */
+DMATranslationCache *dma_translation_cache_new(AddressSpace *as);
+
+/**
+ * dma_translation_cache_free: Destroy a DMA translation cache
+ *
+ * Must be called with the BQL held, before @as is destroyed.
+ *
+ * @cache: the cache returned by dma_translation_cache_new()
+ */
+void dma_translation_cache_free(DMATranslationCache *cache);
+
+/**
+ * dma_translation_cache_rw: Read from or write to memory through a
+ *                           DMA translation cache
+ *
+ * Behaves like dma_memory_rw() on the address space of @cache.  Accesses
+ * that do not hit RAM fall back to the uncached path.  A cache must only
+ * be used by one thread at a time.
+ *
+ * @cache: the cache returned by dma_translation_cache_new()
+ * @addr: address within the address space
+ * @buf: buffer with the data transferred
+ * @len: the number of bytes to read or write
+ * @dir: indicates the transfer direction
+ * @attrs: memory transaction attributes
+ */
+MemTxResult dma_translation_cache_rw(DMATranslationCache *cache,
+                                     dma_addr_t addr, void *buf,
+                                     dma_addr_t len, DMADirection dir,
+                                     MemTxAttrs attrs);
+
 /**
  * address_space_map: Map a physical memory region into a host virtual address.
  *
@@ -32,6 +32,10 @@ struct EventLoopBase {
 
     /* AioContext AIO engine parameters */
     int64_t aio_max_batch;
+    bool aio_batch_adaptive;
+
+    /* Record AioContext latency histograms */
+    bool latency_stats;
 
     /* AioContext thread pool parameters */
     int64_t thread_pool_min;
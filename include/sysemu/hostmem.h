@@ -39,6 +39,8 @@ OBJECT_DECLARE_TYPE(HostMemoryBackend, HostMemoryBackendClass,
  */
 #define TYPE_MEMORY_BACKEND_FILE "memory-backend-file"
 
+typedef struct HostMemoryReclaim HostMemoryReclaim;
+
 
 /**
  * HostMemoryBackendClass:
@@ -57,6 +59,14 @@ struct HostMemoryBackendClass {
  * @size: amount of memory backend provides
  * @mr: MemoryRegion representing host memory belonging to backend
  * @prealloc_threads: number of threads to be used for preallocatining RAM
+ * @prealloc_async: finish preallocation in the background
+ * @prealloc_sync_size: bytes preallocated before completing, with
+ * @prealloc_async
+ * @reclaim_interval: milliseconds between cold page scans, 0 if disabled
+ * @reclaim_age: idle scans after which a chunk is cold
+ * @reclaim_action: what to do with cold chunks
+ * @reclaim_node: host node for MEMORY_RECLAIM_ACTION_DEMOTE
+ * @reclaim: the cold page scanner, see hostmem-reclaim.c
  */
 struct HostMemoryBackend {
     /* private */
@@ -68,8 +78,18 @@ struct HostMemoryBackend {
     bool prealloc, is_mapped, share, reserve;
     uint32_t prealloc_threads;
     ThreadContext *prealloc_context;
+    bool prealloc_async;
+    uint64_t prealloc_sync_size;
+    int prealloc_async_ret;
     DECLARE_BITMAP(host_nodes, MAX_NODES + 1);
     HostMemPolicy policy;
+    uint32_t reclaim_interval;
+    uint8_t reclaim_age;
+    MemoryReclaimAction reclaim_action;
+    uint16_t reclaim_node;
+    HostMemoryReclaim *reclaim;
+    /* page size layout reported by query-memdev, NULL if uniform */
+    MemdevRegionList *layout;
 
     MemoryRegion mr;
 };
@@ -82,4 +102,12 @@ bool host_memory_backend_is_mapped(HostMemoryBackend *backend);
 size_t host_memory_backend_pagesize(HostMemoryBackend *memdev);
 char *host_memory_backend_get_name(HostMemoryBackend *backend);
 
+#ifdef CONFIG_LINUX
+/* hostmem-reclaim.c */
+void host_memory_backend_reclaim_class_init(ObjectClass *oc);
+bool host_memory_backend_reclaim_start(HostMemoryBackend *backend,
+                                       Error **errp);
+void host_memory_backend_reclaim_stop(HostMemoryBackend *backend);
+#endif
+
 #endif
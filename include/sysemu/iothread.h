@@ -33,11 +33,14 @@ struct IOThread {
     bool stopping;              /* has iothread_stop() been called? */
     bool running;               /* should iothread_run() continue? */
     int thread_id;
+    /* Thread context to create the thread in, for its CPU affinity */
+    struct ThreadContext *thread_context;
 
     /* AioContext poll parameters */
     int64_t poll_max_ns;
     int64_t poll_grow;
     int64_t poll_shrink;
+    bool poll_busy;
 };
 typedef struct IOThread IOThread;
 
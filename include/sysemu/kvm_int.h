@@ -32,9 +32,13 @@ typedef struct KVMSlot
     ram_addr_t ram_start_offset;
 } KVMSlot;
 
+typedef struct KVMExitStats KVMExitStats;
+
 typedef struct KVMMemoryUpdate {
     QSIMPLEQ_ENTRY(KVMMemoryUpdate) next;
     MemoryRegionSection section;
+    /* Where the RAM of @section shows up again, when that is a move */
+    MemoryRegionSection move_to;
 } KVMMemoryUpdate;
 
 typedef struct KVMMemoryListener {
@@ -64,6 +68,12 @@ struct KVMDirtyRingReaper {
     QemuThread reaper_thr;
     volatile uint64_t reaper_iteration; /* iteration number of reaper thr */
     volatile enum KVMDirtyRingReaperState reaper_state; /* reap thr state */
+    /*
+     * Helper threads that reap a share of the vcpu rings each, in
+     * parallel with the thread that asked for a full reap.
+     */
+    struct KVMDirtyRingReapWorker *workers;
+    QemuSemaphore workers_done;
 };
 struct KVMState
 {
@@ -100,6 +110,10 @@ struct KVMState
 #ifdef KVM_CAP_IRQ_ROUTING
     struct kvm_irq_routing *irq_routes;
     int nr_allocated_irq_routes;
+    /* Position of each GSI's last entry in irq_routes, or -1 */
+    int *irq_route_index;
+    /* irq_routes has changed since the last KVM_SET_GSI_ROUTING */
+    bool irq_routes_dirty;
     unsigned long *used_gsi_bitmap;
     unsigned int gsi_count;
     QTAILQ_HEAD(, KVMMSIRoute) msi_hashtab[KVM_MSI_HASHTAB_SIZE];
@@ -116,7 +130,23 @@ struct KVMState
     uint64_t kvm_dirty_ring_bytes;  /* Size of the per-vcpu dirty ring */
     uint32_t kvm_dirty_ring_size;   /* Number of dirty GFNs per ring */
     bool kvm_dirty_ring_with_bitmap;
+    /* Number of threads reaping the rings together, including the caller */
+    uint32_t kvm_dirty_ring_reap_threads;
+    /* Reap early when a ring is that full, in percent (0: once a second) */
+    uint8_t kvm_dirty_ring_soft_full;
     struct KVMDirtyRingReaper reaper;
+    /*
+     * Halt-polling controller: share of the vcpu time that may be spent
+     * in failed polls, in percent (0: leave halt_poll_ns to the kernel).
+     */
+    uint8_t halt_poll_budget;
+    uint32_t halt_poll_max_ns;      /* Upper bound for halt_poll_ns */
+    uint32_t halt_poll_ns;          /* Value currently set in the kernel */
+    QEMUTimer *halt_poll_timer;
+    int64_t halt_poll_stamp;        /* QEMU_CLOCK_REALTIME of the last pass */
+    uint64_t halt_poll_success_ns;  /* Totals over all vcpus at that time */
+    uint64_t halt_poll_fail_ns;
+    bool exit_stats;                /* Count exits per vCPU */
     NotifyVmexitOption notify_vmexit;
     uint32_t notify_window;
     uint32_t xen_version;
@@ -39,6 +39,8 @@ enum {
 struct NodeInfo {
     uint64_t node_mem;
     struct HostMemoryBackend *node_memdev;
+    /* Host CPUs to run this node's vCPU threads on */
+    struct ThreadContext *vcpu_context;
     bool present;
     bool has_cpu;
     uint8_t lb_info_provided;
@@ -109,5 +111,6 @@ extern QemuOptsList qemu_numa_opts;
 void numa_cpu_pre_plug(const struct CPUArchId *slot, DeviceState *dev,
                        Error **errp);
 bool numa_uses_legacy_mem(void);
+void numa_cpu_thread_place(MachineState *ms, CPUState *cpu);
 
 #endif
@@ -81,6 +81,17 @@ void *qemu_alloc_stack(size_t *sz);
  */
 void qemu_free_stack(void *stack, size_t sz);
 
+/**
+ * qemu_stack_resident:
+ * @stack: stack allocated via qemu_alloc_stack()
+ * @sz: adjusted stack size returned by qemu_alloc_stack()
+ *
+ * Stacks are only backed by host memory once they are touched.  Where
+ * the host can tell, return how many bytes of the stack are resident;
+ * otherwise return @sz.
+ */
+size_t qemu_stack_resident(void *stack, size_t sz);
+
 /* POSIX and Mingw32 differ in the name of the stdio lock functions.  */
 
 static inline void qemu_flockfile(FILE *f)
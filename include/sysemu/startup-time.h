@@ -0,0 +1,38 @@
+/*
+ * Startup time breakdown
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef SYSEMU_STARTUP_TIME_H
+#define SYSEMU_STARTUP_TIME_H
+
+/**
+ * startup_time_mark:
+ * @phase: name of the startup phase that just completed
+ *
+ * Record the wall-clock time at which @phase ended.  The first mark is
+ * the origin of the timeline.  Marks after the guest first started are
+ * ignored.
+ */
+void startup_time_mark(const char *phase);
+
+/**
+ * startup_time_finish:
+ *
+ * Record that the guest is about to execute its first instruction, and
+ * stop recording.
+ */
+void startup_time_finish(void);
+
+/**
+ * startup_time_device:
+ * @dev: device that was just realized
+ * @ns: time spent in its realize method, in nanoseconds
+ *
+ * Account the realize time of a cold-plugged device.
+ */
+void startup_time_device(DeviceState *dev, int64_t ns);
+
+#endif
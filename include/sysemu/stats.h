@@ -28,8 +28,11 @@ void add_stats_callbacks(StatsProvider provider,
 /*
  * Helper routines for adding stats entries to the results lists.
  */
-void add_stats_entry(StatsResultList **, StatsProvider, const char *id,
+void add_stats_entry(StatsResultList **, StatsProvider, const char *qom_path,
                      StatsList *stats_list);
+void add_stats_entry_id(StatsResultList **, StatsProvider,
+                        const char *qom_path, const char *id,
+                        StatsList *stats_list);
 void add_stats_schema(StatsSchemaList **, StatsProvider, StatsTarget,
                       StatsSchemaValueList *);
 
@@ -42,4 +45,34 @@ void add_stats_schema(StatsSchemaList **, StatsProvider, StatsTarget,
  */
 bool apply_str_list_filter(const char *string, strList *list);
 
+/*
+ * Register the coroutine stack usage statistics.
+ */
+void coroutine_stats_init(void);
+
+/*
+ * Register the RCU grace period statistics.
+ */
+void rcu_stats_init(void);
+
+/*
+ * Register the event loop latency statistics.
+ */
+void aio_stats_init(void);
+
+/*
+ * Register the block backend I/O accounting statistics.
+ */
+void block_stats_init(void);
+
+/*
+ * Register the network client packet statistics.
+ */
+void net_stats_init(void);
+
+/*
+ * Register the iothread polling statistics.
+ */
+void iothread_stats_init(void);
+
 #endif /* STATS_H */
@@ -286,9 +286,11 @@ void tcg_gen_goto_tb(unsigned idx);
 void tcg_gen_lookup_and_goto_ptr(void);
 
 static inline void tcg_gen_plugin_cb_start(unsigned from, unsigned type,
-                                           unsigned wr)
+                                           unsigned wr, uint32_t info,
+                                           TCGv_i64 addr)
 {
-    tcg_gen_op3(INDEX_op_plugin_cb_start, from, type, wr);
+    tcg_gen_op5(INDEX_op_plugin_cb_start, from, type, wr, info,
+                addr ? tcgv_i64_arg(addr) : 0);
 }
 
 static inline void tcg_gen_plugin_cb_end(void)
@@ -549,6 +549,9 @@ struct TCGContext {
 
     /* descriptor of the instruction being translated */
     struct qemu_plugin_insn *plugin_insn;
+
+    /* if set, tcg_emit_op() inserts ops before this one, not at the end */
+    TCGOp *emit_before_op;
 #endif
 
     GHashTable *const_table[TCG_TYPE_COUNT];
@@ -730,6 +733,11 @@ static inline void tcg_set_insn_start_param(TCGOp *op, int arg, uint64_t v)
 /* The last op that was emitted.  */
 static inline TCGOp *tcg_last_op(void)
 {
+#ifdef CONFIG_PLUGIN
+    if (tcg_ctx->emit_before_op) {
+        return QTAILQ_PREV(tcg_ctx->emit_before_op, link);
+    }
+#endif
     return QTAILQ_LAST(&tcg_ctx->ops);
 }
 
@@ -754,6 +762,10 @@ void tcg_pool_reset(TCGContext *s);
 TranslationBlock *tcg_tb_alloc(TCGContext *s);
 
 void tcg_region_reset_all(void);
+bool tcg_region_evict_needed(void);
+bool tcg_region_evict_begin(size_t *pidx, unsigned int *pgen);
+GPtrArray *tcg_region_tbs(size_t idx);
+void tcg_region_evict_end(size_t idx, unsigned int generation);
 
 size_t tcg_code_size(void);
 size_t tcg_code_capacity(void);
@@ -147,6 +147,9 @@ typedef struct DisplaySurface {
 #ifdef WIN32
     HANDLE handle;
     uint32_t handle_offset;
+#else
+    int share_fd;               /* memfd backing the image, or -1 */
+    uint32_t share_offset;
 #endif
 } DisplaySurface;
 
@@ -338,6 +341,9 @@ DisplaySurface *qemu_create_placeholder_surface(int w, int h,
 #ifdef WIN32
 void qemu_displaysurface_win32_set_handle(DisplaySurface *surface,
                                           HANDLE h, uint32_t offset);
+#else
+void qemu_displaysurface_set_share_fd(DisplaySurface *surface,
+                                      int fd, uint32_t offset);
 #endif
 PixelFormat qemu_default_pixelformat(int bpp);
 
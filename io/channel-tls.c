@@ -22,6 +22,7 @@
 #include "qapi/error.h"
 #include "qemu/module.h"
 #include "io/channel-tls.h"
+#include "io/channel-socket.h"
 #include "trace.h"
 #include "qemu/atomic.h"
 
@@ -155,6 +156,29 @@ static gboolean qio_channel_tls_handshake_io(QIOChannel *ioc,
                                              GIOCondition condition,
                                              gpointer user_data);
 
+static void qio_channel_tls_enable_ktls_tx(QIOChannelTLS *ioc)
+{
+    QIOChannelSocket *sioc;
+    Error *local_err = NULL;
+
+    if (!ioc->want_ktls_tx) {
+        return;
+    }
+    sioc = (QIOChannelSocket *)object_dynamic_cast(OBJECT(ioc->master),
+                                                   TYPE_QIO_CHANNEL_SOCKET);
+    if (!sioc) {
+        return;
+    }
+    if (qcrypto_tls_session_enable_ktls_tx(ioc->session, sioc->fd,
+                                           &local_err) < 0) {
+        trace_qio_channel_tls_ktls_tx_fail(ioc, error_get_pretty(local_err));
+        error_free(local_err);
+        return;
+    }
+    trace_qio_channel_tls_ktls_tx(ioc);
+    ioc->ktls_tx = true;
+}
+
 static void qio_channel_tls_handshake_task(QIOChannelTLS *ioc,
                                            QIOTask *task,
                                            GMainContext *context)
@@ -178,6 +202,7 @@ static void qio_channel_tls_handshake_task(QIOChannelTLS *ioc,
             qio_task_set_error(task, err);
         } else {
             trace_qio_channel_tls_credentials_allow(ioc);
+            qio_channel_tls_enable_ktls_tx(ioc);
         }
         qio_task_complete(task);
     } else {
@@ -314,6 +339,12 @@ static ssize_t qio_channel_tls_writev(QIOChannel *ioc,
     size_t i;
     ssize_t done = 0;
 
+    if (tioc->ktls_tx) {
+        /* The kernel encrypts, hand it the plain text in one go */
+        return qio_channel_writev_full(tioc->master, iov, niov,
+                                       NULL, 0, flags, errp);
+    }
+
     for (i = 0 ; i < niov ; i++) {
         ssize_t ret = qcrypto_tls_session_write(tioc->session,
                                                 iov[i].iov_base,
@@ -471,6 +502,11 @@ static GSource *qio_channel_tls_create_watch(QIOChannel *ioc,
     return source;
 }
 
+void qio_channel_tls_set_ktls_tx(QIOChannelTLS *ioc, bool enabled)
+{
+    ioc->want_ktls_tx = enabled;
+}
+
 QCryptoTLSSession *
 qio_channel_tls_get_session(QIOChannelTLS *ioc)
 {
@@ -17,6 +17,8 @@
 #include "qemu/module.h"
 #include "block/aio.h"
 #include "block/block.h"
+#include "block/raw-aio.h"
+#include "block/thread-pool.h"
 #include "sysemu/event-loop-base.h"
 #include "sysemu/iothread.h"
 #include "qapi/error.h"
@@ -24,6 +26,7 @@
 #include "qemu/error-report.h"
 #include "qemu/rcu.h"
 #include "qemu/main-loop.h"
+#include "qemu/thread-context.h"
 
 
 #ifdef CONFIG_POSIX
@@ -167,10 +170,18 @@ static void iothread_set_aio_context_params(EventLoopBase *base, Error **errp)
         return;
     }
 
+    aio_context_set_poll_busy(iothread->ctx, iothread->poll_busy, errp);
+    if (*errp) {
+        return;
+    }
+
     aio_context_set_aio_params(iothread->ctx,
                                iothread->parent_obj.aio_max_batch,
+                               iothread->parent_obj.aio_batch_adaptive,
                                errp);
 
+    aio_context_set_latency_stats(iothread->ctx, base->latency_stats);
+
     aio_context_set_thread_pool_params(iothread->ctx, base->thread_pool_min,
                                        base->thread_pool_max, errp);
 }
@@ -204,12 +215,19 @@ static void iothread_init(EventLoopBase *base, Error **errp)
     }
 
     /* This assumes we are called from a thread with useful CPU affinity for us
-     * to inherit.
+     * to inherit, unless a thread context was given.
      */
     thread_name = g_strdup_printf("IO %s",
                         object_get_canonical_path_component(OBJECT(base)));
-    qemu_thread_create(&iothread->thread, thread_name, iothread_run,
-                       iothread, QEMU_THREAD_JOINABLE);
+    if (iothread->thread_context) {
+        thread_context_create_thread(iothread->thread_context,
+                                     &iothread->thread, thread_name,
+                                     iothread_run, iothread,
+                                     QEMU_THREAD_JOINABLE);
+    } else {
+        qemu_thread_create(&iothread->thread, thread_name, iothread_run,
+                           iothread, QEMU_THREAD_JOINABLE);
+    }
     g_free(thread_name);
 
     /* Wait for initialization to complete */
@@ -291,6 +309,24 @@ static void iothread_set_poll_param(Object *obj, Visitor *v,
     }
 }
 
+static bool iothread_get_poll_busy(Object *obj, Error **errp)
+{
+    IOThread *iothread = IOTHREAD(obj);
+
+    return iothread->poll_busy;
+}
+
+static void iothread_set_poll_busy(Object *obj, bool value, Error **errp)
+{
+    IOThread *iothread = IOTHREAD(obj);
+
+    iothread->poll_busy = value;
+
+    if (iothread->ctx) {
+        aio_context_set_poll_busy(iothread->ctx, value, errp);
+    }
+}
+
 static void iothread_class_init(ObjectClass *klass, void *class_data)
 {
     EventLoopBaseClass *bc = EVENT_LOOP_BASE_CLASS(klass);
@@ -310,6 +346,16 @@ static void iothread_class_init(ObjectClass *klass, void *class_data)
                               iothread_get_poll_param,
                               iothread_set_poll_param,
                               NULL, &poll_shrink_info);
+    object_class_property_add_bool(klass, "poll-busy",
+                                   iothread_get_poll_busy,
+                                   iothread_set_poll_busy);
+    object_class_property_add_link(klass, "thread-context",
+                                   TYPE_THREAD_CONTEXT,
+                                   offsetof(IOThread, thread_context),
+                                   object_property_allow_set_link,
+                                   OBJ_PROP_LINK_STRONG);
+    object_class_property_set_description(klass, "thread-context",
+        "Thread context to create the iothread in");
 }
 
 static const TypeInfo iothread_info = {
@@ -355,7 +401,33 @@ static int query_one_iothread(Object *object, void *opaque)
     info->poll_max_ns = iothread->poll_max_ns;
     info->poll_grow = iothread->poll_grow;
     info->poll_shrink = iothread->poll_shrink;
+    info->poll_busy = iothread->poll_busy;
     info->aio_max_batch = iothread->parent_obj.aio_max_batch;
+    info->aio_batch_adaptive = iothread->parent_obj.aio_batch_adaptive;
+#ifdef CONFIG_LINUX_AIO
+    if (iothread->ctx && iothread->ctx->linux_aio) {
+        uint64_t batch, latency_ns;
+
+        laio_get_batch_info(iothread->ctx->linux_aio, &batch, &latency_ns);
+        info->has_aio_batch_size = true;
+        info->aio_batch_size = batch;
+        if (info->aio_batch_adaptive) {
+            info->has_aio_latency_ns = true;
+            info->aio_latency_ns = latency_ns;
+        }
+    }
+#endif
+    if (iothread->ctx && iothread->ctx->thread_pool) {
+        ThreadPoolStats stats;
+
+        thread_pool_get_stats(iothread->ctx->thread_pool, &stats);
+        info->thread_pool = g_new0(ThreadPoolInfo, 1);
+        info->thread_pool->min_threads = stats.min_threads;
+        info->thread_pool->max_threads = stats.max_threads;
+        info->thread_pool->cur_threads = stats.cur_threads;
+        info->thread_pool->idle_threads = stats.idle_threads;
+        info->thread_pool->queue_depth = stats.queued_requests;
+    }
 
     QAPI_LIST_APPEND(*tail, info);
     return 0;
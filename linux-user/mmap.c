@@ -24,13 +24,77 @@
 #include "user-mmap.h"
 #include "target_mman.h"
 
+/*
+ * The mmap lock is normally taken exclusively with mmap_lock(), which
+ * protects the page flags, the translation blocks and the host mappings
+ * of the whole guest address space.
+ *
+ * mmap, mprotect, munmap and madvise of fixed ranges instead only lock
+ * the host pages they touch with mmap_lock_range(), so that threads
+ * working on disjoint ranges proceed concurrently; the page flags have
+ * a mutex of their own for that case.  Range holders do not have the
+ * translation blocks, so a range that includes executable pages is
+ * locked exclusively instead.  A waiting exclusive locker keeps new
+ * ranges from being granted, so that translation is not starved.
+ */
+typedef struct MmapRange {
+    abi_ulong start;
+    abi_ulong last;
+    QLIST_ENTRY(MmapRange) next;
+} MmapRange;
+
 static pthread_mutex_t mmap_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t mmap_cond = PTHREAD_COND_INITIALIZER;
+static bool mmap_exclusive;
+static unsigned mmap_exclusive_waiting;
+static unsigned mmap_waiting;
+static QLIST_HEAD(, MmapRange) mmap_ranges =
+    QLIST_HEAD_INITIALIZER(mmap_ranges);
+
 static __thread int mmap_lock_count;
+static __thread int mmap_range_count;
+static __thread MmapRange mmap_range;
+
+static void mmap_wait(void)
+{
+    mmap_waiting++;
+    pthread_cond_wait(&mmap_cond, &mmap_mutex);
+    mmap_waiting--;
+}
+
+static void mmap_wake(void)
+{
+    if (mmap_waiting) {
+        pthread_cond_broadcast(&mmap_cond);
+    }
+}
+
+static void mmap_exclusive_acquire(void)
+{
+    pthread_mutex_lock(&mmap_mutex);
+    mmap_exclusive_waiting++;
+    while (mmap_exclusive || !QLIST_EMPTY(&mmap_ranges)) {
+        mmap_wait();
+    }
+    mmap_exclusive_waiting--;
+    mmap_exclusive = true;
+    pthread_mutex_unlock(&mmap_mutex);
+}
+
+static void mmap_exclusive_release(void)
+{
+    pthread_mutex_lock(&mmap_mutex);
+    mmap_exclusive = false;
+    mmap_wake();
+    pthread_mutex_unlock(&mmap_mutex);
+}
 
 void mmap_lock(void)
 {
     if (mmap_lock_count++ == 0) {
-        pthread_mutex_lock(&mmap_mutex);
+        /* Cannot upgrade a range: mmap_lock_range() must decide up front. */
+        assert(mmap_range_count == 0);
+        mmap_exclusive_acquire();
     }
 }
 
@@ -38,7 +102,7 @@ void mmap_unlock(void)
 {
     assert(mmap_lock_count > 0);
     if (--mmap_lock_count == 0) {
-        pthread_mutex_unlock(&mmap_mutex);
+        mmap_exclusive_release();
     }
 }
 
@@ -47,20 +111,102 @@ bool have_mmap_lock(void)
     return mmap_lock_count > 0 ? true : false;
 }
 
+bool have_mmap_range_lock(void)
+{
+    return mmap_range_count > 0;
+}
+
+static bool mmap_range_busy(abi_ulong start, abi_ulong last)
+{
+    MmapRange *r;
+
+    if (mmap_exclusive || mmap_exclusive_waiting) {
+        return true;
+    }
+    QLIST_FOREACH(r, &mmap_ranges, next) {
+        if (r->start <= last && start <= r->last) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void mmap_unlock_range(void)
+{
+    if (mmap_lock_count) {
+        mmap_unlock();
+        return;
+    }
+
+    assert(mmap_range_count > 0);
+    if (--mmap_range_count == 0) {
+        pthread_mutex_lock(&mmap_mutex);
+        QLIST_REMOVE(&mmap_range, next);
+        mmap_wake();
+        pthread_mutex_unlock(&mmap_mutex);
+    }
+}
+
+/*
+ * Lock the host pages covering the guest range [start, last], or the
+ * whole address space if they hold executable pages.  Nested calls are
+ * allowed within an exclusive lock or a range that covers them.  Release
+ * with mmap_unlock_range().
+ */
+static void mmap_lock_range(abi_ulong start, abi_ulong last)
+{
+    start &= qemu_host_page_mask;
+    last |= ~qemu_host_page_mask;
+
+    if (mmap_lock_count) {
+        mmap_lock();
+        return;
+    }
+    if (mmap_range_count) {
+        assert(mmap_range.start <= start && last <= mmap_range.last);
+        mmap_range_count++;
+        return;
+    }
+
+    pthread_mutex_lock(&mmap_mutex);
+    while (mmap_range_busy(start, last)) {
+        mmap_wait();
+    }
+    mmap_range.start = start;
+    mmap_range.last = last;
+    QLIST_INSERT_HEAD(&mmap_ranges, &mmap_range, next);
+    pthread_mutex_unlock(&mmap_mutex);
+    mmap_range_count = 1;
+
+    /*
+     * Changing executable pages may require invalidating translation
+     * blocks, which is only possible with the exclusive lock.
+     */
+    if (page_check_range_any(start, last, PAGE_EXEC)) {
+        mmap_unlock_range();
+        mmap_lock();
+    }
+}
+
 /* Grab lock to make sure things are in a consistent state after fork().  */
 void mmap_fork_start(void)
 {
-    if (mmap_lock_count)
+    if (mmap_lock_count || mmap_range_count)
         abort();
-    pthread_mutex_lock(&mmap_mutex);
+    mmap_exclusive_acquire();
 }
 
 void mmap_fork_end(int child)
 {
     if (child) {
         pthread_mutex_init(&mmap_mutex, NULL);
+        pthread_cond_init(&mmap_cond, NULL);
+        mmap_exclusive = false;
+        mmap_exclusive_waiting = 0;
+        mmap_waiting = 0;
+        QLIST_INIT(&mmap_ranges);
     } else {
-        pthread_mutex_unlock(&mmap_mutex);
+        mmap_exclusive_release();
     }
 }
 
@@ -149,7 +295,7 @@ int target_mprotect(abi_ulong start, abi_ulong len, int target_prot)
     host_last = HOST_PAGE_ALIGN(last) - 1;
     nranges = 0;
 
-    mmap_lock();
+    mmap_lock_range(start, last);
 
     if (host_last - host_start < qemu_host_page_size) {
         /* Single host page contains all guest pages: sum the prot. */
@@ -218,7 +364,7 @@ int target_mprotect(abi_ulong start, abi_ulong len, int target_prot)
     ret = 0;
 
  error:
-    mmap_unlock();
+    mmap_unlock_range();
     return ret;
 }
 
@@ -444,16 +590,15 @@ abi_ulong mmap_find_vma(abi_ulong start, abi_ulong size, abi_ulong align)
     }
 }
 
-/* NOTE: all the constants are the HOST ones */
-abi_long target_mmap(abi_ulong start, abi_ulong len, int target_prot,
-                     int flags, int fd, off_t offset)
+static abi_long target_mmap__locked(abi_ulong start, abi_ulong len,
+                                    int target_prot, int flags,
+                                    int fd, off_t offset)
 {
     abi_ulong ret, last, real_start, real_last, retaddr, host_len;
     abi_ulong passthrough_start = -1, passthrough_last = 0;
     int page_flags;
     off_t host_offset;
 
-    mmap_lock();
     trace_target_mmap(start, len, target_prot, flags, fd, offset);
 
     if (!len) {
@@ -730,13 +875,36 @@ abi_long target_mmap(abi_ulong start, abi_ulong len, int target_prot,
             qemu_log_unlock(f);
         }
     }
-    mmap_unlock();
     return start;
 fail:
-    mmap_unlock();
     return -1;
 }
 
+/* NOTE: all the constants are the HOST ones */
+abi_long target_mmap(abi_ulong start, abi_ulong len, int target_prot,
+                     int flags, int fd, off_t offset)
+{
+    abi_ulong alen = TARGET_PAGE_ALIGN(len);
+    abi_long ret;
+
+    /*
+     * Only fixed mappings know their range up front; finding a free
+     * range, and dumping the page layout, need the whole address space.
+     */
+    if ((flags & (MAP_FIXED | MAP_FIXED_NOREPLACE))
+        && alen && guest_range_valid_untagged(start, alen)
+        && !qemu_loglevel_mask(CPU_LOG_PAGE)) {
+        mmap_lock_range(start, start + alen - 1);
+        ret = target_mmap__locked(start, len, target_prot, flags, fd, offset);
+        mmap_unlock_range();
+    } else {
+        mmap_lock();
+        ret = target_mmap__locked(start, len, target_prot, flags, fd, offset);
+        mmap_unlock();
+    }
+    return ret;
+}
+
 static void mmap_reserve_or_unmap(abi_ulong start, abi_ulong len)
 {
     abi_ulong real_start;
@@ -814,10 +982,10 @@ int target_munmap(abi_ulong start, abi_ulong len)
         return -TARGET_EINVAL;
     }
 
-    mmap_lock();
+    mmap_lock_range(start, start + len - 1);
     mmap_reserve_or_unmap(start, len);
     page_set_flags(start, start + len - 1, 0);
-    mmap_unlock();
+    mmap_unlock_range();
 
     return 0;
 }
@@ -963,7 +1131,7 @@ abi_long target_madvise(abi_ulong start, abi_ulong len_in, int advice)
      * otherwise. Completely implementing such emulation is quite complicated
      * though.
      */
-    mmap_lock();
+    mmap_lock_range(start, start + len - 1);
     switch (advice) {
     case MADV_WIPEONFORK:
     case MADV_KEEPONFORK:
@@ -977,7 +1145,7 @@ abi_long target_madvise(abi_ulong start, abi_ulong len_in, int advice)
             }
         }
     }
-    mmap_unlock();
+    mmap_unlock_range();
 
     return ret;
 }
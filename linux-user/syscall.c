@@ -144,6 +144,13 @@
 #include "tcg/tcg.h"
 #include "cpu_loop-common.h"
 
+#if defined(TARGET_NR_io_uring_setup) && defined(__NR_io_uring_setup)
+#include <linux/io_uring.h>
+#ifdef IORING_SETUP_DEFER_TASKRUN
+#define EMULATE_IO_URING
+#endif
+#endif
+
 #ifndef CLONE_IO
 #define CLONE_IO                0x80000000      /* Clone io context */
 #endif
@@ -752,6 +759,11 @@ safe_syscall6(ssize_t, copy_file_range, int, infd, loff_t *, pinoff,
               int, outfd, loff_t *, poutoff, size_t, length,
               unsigned int, flags)
 #endif
+#ifdef EMULATE_IO_URING
+safe_syscall6(int, io_uring_enter, unsigned int, fd, unsigned int, to_submit,
+              unsigned int, min_complete, unsigned int, flags,
+              const void *, argp, size_t, argsz)
+#endif
 
 /* We do ioctl like this rather than via safe_syscall3 to preserve the
  * "third argument might be integer or pointer or not present" behaviour of
@@ -9194,6 +9206,676 @@ _syscall5(int, sys_move_mount, int, __from_dfd, const char *, __from_pathname,
            int, __to_dfd, const char *, __to_pathname, unsigned int, flag)
 #endif
 
+#ifdef EMULATE_IO_URING
+/*
+ * io_uring rings are shared between the guest and the host kernel: the guest
+ * maps the host ring fd directly, so completions need no translation at all
+ * as long as both sides agree on byte order and errno values.  Submission
+ * queue entries may carry guest pointers and target flag values, which are
+ * rewritten in place just before io_uring_enter() hands them to the kernel.
+ * The host's IORING_FEAT_SUBMIT_STABLE guarantees that anything an SQE
+ * points to has been consumed by then, so the original entries are put back
+ * and any scratch memory freed as soon as the syscall returns.
+ *
+ * QEMU keeps its own mapping of the SQ ring and SQE array for every ring fd
+ * created by the guest; it is dropped when the last fd referring to the
+ * ring is closed, so that the ring itself goes away with it.
+ */
+typedef struct TargetIoUring {
+    int refcnt;
+    pthread_mutex_t lock;       /* serializes SQE translation and submission */
+    unsigned sq_entries;
+    size_t sqe_size;
+    void *sq_ring;
+    size_t sq_ring_size;
+    void *sqes;
+    size_t sqes_size;
+    unsigned *khead;
+    unsigned *ktail;
+    unsigned *kring_mask;
+    unsigned *array;
+} TargetIoUring;
+
+static GHashTable *target_io_urings;    /* fd -> TargetIoUring */
+static pthread_mutex_t target_io_urings_lock = PTHREAD_MUTEX_INITIALIZER;
+
+#define TARGET_IO_URING_SETUP_FLAGS \
+    (IORING_SETUP_IOPOLL | IORING_SETUP_CQSIZE | IORING_SETUP_CLAMP | \
+     IORING_SETUP_ATTACH_WQ | IORING_SETUP_R_DISABLED | \
+     IORING_SETUP_SUBMIT_ALL | IORING_SETUP_COOP_TASKRUN | \
+     IORING_SETUP_TASKRUN_FLAG | IORING_SETUP_SQE128 | IORING_SETUP_CQE32 | \
+     IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN)
+
+#define TARGET_IO_URING_ENTER_FLAGS \
+    (IORING_ENTER_GETEVENTS | IORING_ENTER_SQ_WAKEUP | \
+     IORING_ENTER_SQ_WAIT | IORING_ENTER_EXT_ARG)
+
+static bool io_uring_supported(void)
+{
+#if HOST_BIG_ENDIAN != TARGET_BIG_ENDIAN
+    /* Every ring, SQE and CQE field would need swapping */
+    return false;
+#else
+    /* CQEs are read by the guest as they come, with host errno values */
+#define E(X)  if (TARGET_##X != X) { return false; }
+#include "errnos.c.inc"
+#undef E
+    return true;
+#endif
+}
+
+/*
+ * Messages, cmsgs and provided buffer rings are passed through untouched,
+ * which is only right when guest addresses are host addresses and the
+ * structures have the same layout.
+ */
+static bool io_uring_identity_map(void)
+{
+    return guest_base == 0 && TARGET_ABI_BITS == HOST_LONG_BITS;
+}
+
+static void target_io_uring_unref(TargetIoUring *ring)
+{
+    bool last;
+
+    pthread_mutex_lock(&target_io_urings_lock);
+    last = --ring->refcnt == 0;
+    pthread_mutex_unlock(&target_io_urings_lock);
+
+    if (last) {
+        munmap(ring->sqes, ring->sqes_size);
+        munmap(ring->sq_ring, ring->sq_ring_size);
+        pthread_mutex_destroy(&ring->lock);
+        g_free(ring);
+    }
+}
+
+static TargetIoUring *target_io_uring_get(int fd)
+{
+    TargetIoUring *ring = NULL;
+
+    pthread_mutex_lock(&target_io_urings_lock);
+    if (target_io_urings) {
+        ring = g_hash_table_lookup(target_io_urings, GINT_TO_POINTER(fd));
+        if (ring) {
+            ring->refcnt++;
+        }
+    }
+    pthread_mutex_unlock(&target_io_urings_lock);
+    return ring;
+}
+
+static void target_io_uring_set(int fd, TargetIoUring *ring)
+{
+    TargetIoUring *old = NULL;
+
+    pthread_mutex_lock(&target_io_urings_lock);
+    if (!target_io_urings) {
+        target_io_urings = g_hash_table_new(NULL, NULL);
+    }
+    if (ring) {
+        ring->refcnt++;
+    }
+    old = g_hash_table_lookup(target_io_urings, GINT_TO_POINTER(fd));
+    if (ring) {
+        g_hash_table_insert(target_io_urings, GINT_TO_POINTER(fd), ring);
+    } else {
+        g_hash_table_remove(target_io_urings, GINT_TO_POINTER(fd));
+    }
+    pthread_mutex_unlock(&target_io_urings_lock);
+
+    if (old) {
+        target_io_uring_unref(old);
+    }
+}
+
+/* Forget about fd, which has been closed or replaced by dup2() */
+static void io_uring_fd_unregister(int fd)
+{
+    if (qatomic_read(&target_io_urings)) {
+        target_io_uring_set(fd, NULL);
+    }
+}
+
+static void io_uring_fd_unregister_range(unsigned int first,
+                                         unsigned int last)
+{
+    g_autoptr(GArray) fds = g_array_new(false, false, sizeof(int));
+    GHashTableIter iter;
+    gpointer key;
+    unsigned i;
+
+    if (!qatomic_read(&target_io_urings)) {
+        return;
+    }
+    pthread_mutex_lock(&target_io_urings_lock);
+    g_hash_table_iter_init(&iter, target_io_urings);
+    while (g_hash_table_iter_next(&iter, &key, NULL)) {
+        int fd = GPOINTER_TO_INT(key);
+
+        if (fd >= first && fd <= last) {
+            g_array_append_val(fds, fd);
+        }
+    }
+    pthread_mutex_unlock(&target_io_urings_lock);
+
+    for (i = 0; i < fds->len; i++) {
+        io_uring_fd_unregister(g_array_index(fds, int, i));
+    }
+}
+
+static void io_uring_fd_dup(int oldfd, int newfd)
+{
+    TargetIoUring *ring;
+
+    if (oldfd == newfd || !qatomic_read(&target_io_urings)) {
+        return;
+    }
+    ring = target_io_uring_get(oldfd);
+    target_io_uring_set(newfd, ring);
+    if (ring) {
+        target_io_uring_unref(ring);
+    }
+}
+
+static TargetIoUring *target_io_uring_new(int fd, struct io_uring_params *p)
+{
+    TargetIoUring *ring = g_new0(TargetIoUring, 1);
+
+    ring->sq_entries = p->sq_entries;
+    ring->sq_ring_size = p->sq_off.array + p->sq_entries * sizeof(unsigned);
+    ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ring == MAP_FAILED) {
+        g_free(ring);
+        return NULL;
+    }
+
+    ring->sqe_size = sizeof(struct io_uring_sqe);
+    if (p->flags & IORING_SETUP_SQE128) {
+        ring->sqe_size *= 2;
+    }
+    ring->sqes_size = p->sq_entries * ring->sqe_size;
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        munmap(ring->sq_ring, ring->sq_ring_size);
+        g_free(ring);
+        return NULL;
+    }
+
+    ring->khead = ring->sq_ring + p->sq_off.head;
+    ring->ktail = ring->sq_ring + p->sq_off.tail;
+    ring->kring_mask = ring->sq_ring + p->sq_off.ring_mask;
+    ring->array = ring->sq_ring + p->sq_off.array;
+    ring->refcnt = 1;
+    pthread_mutex_init(&ring->lock, NULL);
+    return ring;
+}
+
+static abi_long do_io_uring_setup(abi_ulong entries, abi_ulong target_params)
+{
+    struct io_uring_params params;
+    TargetIoUring *ring;
+    abi_long ret;
+    int fd;
+
+    if (!io_uring_supported()) {
+        return -TARGET_ENOSYS;
+    }
+    if (copy_from_user(&params, target_params, sizeof(params))) {
+        return -TARGET_EFAULT;
+    }
+    /* The kernel must never look at an SQE that has not been translated */
+    if (params.flags & ~TARGET_IO_URING_SETUP_FLAGS) {
+        return -TARGET_EINVAL;
+    }
+
+    ret = get_errno(syscall(__NR_io_uring_setup, entries, &params));
+    if (is_error(ret)) {
+        return ret;
+    }
+    fd = ret;
+
+    if (!(params.features & IORING_FEAT_SUBMIT_STABLE)) {
+        close(fd);
+        return -TARGET_ENOSYS;
+    }
+    ring = target_io_uring_new(fd, &params);
+    if (!ring) {
+        close(fd);
+        return -TARGET_ENOMEM;
+    }
+    if (copy_to_user(target_params, &params, sizeof(params))) {
+        target_io_uring_unref(ring);
+        close(fd);
+        return -TARGET_EFAULT;
+    }
+
+    fd_trans_unregister(fd);
+    target_io_uring_set(fd, ring);
+    target_io_uring_unref(ring);
+    return fd;
+}
+
+/* Replace the guest address in *field with the host address */
+static abi_long io_uring_sqe_addr(__u64 *field, int type, abi_ulong len)
+{
+    void *p;
+
+    if (*field == 0) {
+        return 0;
+    }
+    if (*field != (abi_ulong)*field) {
+        return -TARGET_EFAULT;
+    }
+    p = lock_user(type, *field, len, 0);
+    if (!p) {
+        return -TARGET_EFAULT;
+    }
+    *field = (uintptr_t)p;
+    return 0;
+}
+
+static abi_long io_uring_sqe_path(__u64 *field)
+{
+    void *p;
+
+    if (*field != (abi_ulong)*field) {
+        return -TARGET_EFAULT;
+    }
+    p = lock_user_string(*field);
+    if (!p) {
+        return -TARGET_EFAULT;
+    }
+    *field = (uintptr_t)p;
+    return 0;
+}
+
+/*
+ * Rewrite one SQE for the host.  Host iovec arrays are allocated into
+ * @scratch.  Opcodes whose arguments cannot be translated fail with EINVAL,
+ * which keeps them (and everything after them) away from the kernel.
+ */
+static abi_long io_uring_translate_sqe(struct io_uring_sqe *sqe,
+                                       GPtrArray *scratch)
+{
+    struct iovec *vec;
+    abi_long ret;
+    int type;
+
+    switch (sqe->opcode) {
+    case IORING_OP_NOP:
+    case IORING_OP_FSYNC:
+    case IORING_OP_POLL_ADD:
+    case IORING_OP_POLL_REMOVE:
+    case IORING_OP_SYNC_FILE_RANGE:
+    case IORING_OP_ASYNC_CANCEL:
+    case IORING_OP_FALLOCATE:
+    case IORING_OP_FADVISE:
+    case IORING_OP_CLOSE:
+    case IORING_OP_REMOVE_BUFFERS:
+    case IORING_OP_SPLICE:
+    case IORING_OP_TEE:
+    case IORING_OP_SHUTDOWN:
+    case IORING_OP_MSG_RING:
+        /* addr, if used at all, is user_data or an offset */
+        return 0;
+
+    case IORING_OP_READ:
+    case IORING_OP_READ_FIXED:
+    case IORING_OP_RECV:
+        return io_uring_sqe_addr(&sqe->addr, VERIFY_WRITE, sqe->len);
+    case IORING_OP_WRITE:
+    case IORING_OP_WRITE_FIXED:
+    case IORING_OP_SEND:
+        return io_uring_sqe_addr(&sqe->addr, VERIFY_READ, sqe->len);
+    case IORING_OP_SEND_ZC:
+        ret = io_uring_sqe_addr(&sqe->addr, VERIFY_READ, sqe->len);
+        if (ret == 0) {
+            ret = io_uring_sqe_addr(&sqe->addr2, VERIFY_READ, sqe->addr_len);
+        }
+        return ret;
+    case IORING_OP_PROVIDE_BUFFERS:
+        return io_uring_sqe_addr(&sqe->addr, VERIFY_WRITE,
+                                 (abi_ulong)sqe->len * (uint32_t)sqe->fd);
+
+    case IORING_OP_READV:
+    case IORING_OP_WRITEV:
+        if (sqe->flags & IOSQE_BUFFER_SELECT) {
+            /* The kernel reads the buffer length from a host iovec */
+            return io_uring_identity_map() ? 0 : -TARGET_EINVAL;
+        }
+        if (sqe->len == 0) {
+            return 0;
+        }
+        if (sqe->addr != (abi_ulong)sqe->addr) {
+            return -TARGET_EFAULT;
+        }
+        type = sqe->opcode == IORING_OP_READV ? VERIFY_WRITE : VERIFY_READ;
+        vec = lock_iovec(type, sqe->addr, sqe->len, 0);
+        if (!vec) {
+            return -host_to_target_errno(errno);
+        }
+        /* lock_user() is g2h(), the buffers stay valid after this */
+        g_ptr_array_add(scratch, vec);
+        sqe->addr = (uintptr_t)vec;
+        return 0;
+
+    case IORING_OP_SENDMSG:
+    case IORING_OP_RECVMSG:
+        if (!io_uring_identity_map()) {
+            return -TARGET_EINVAL;
+        }
+        return io_uring_sqe_addr(&sqe->addr, VERIFY_WRITE,
+                                 sizeof(struct target_msghdr));
+
+    case IORING_OP_TIMEOUT:
+    case IORING_OP_LINK_TIMEOUT:
+        return io_uring_sqe_addr(&sqe->addr, VERIFY_READ,
+                                 sizeof(struct target__kernel_timespec));
+    case IORING_OP_TIMEOUT_REMOVE:
+        if (!(sqe->timeout_flags & IORING_TIMEOUT_UPDATE_MASK)) {
+            return 0;
+        }
+        return io_uring_sqe_addr(&sqe->addr2, VERIFY_READ,
+                                 sizeof(struct target__kernel_timespec));
+
+    case IORING_OP_ACCEPT:
+        ret = io_uring_sqe_addr(&sqe->addr2, VERIFY_WRITE, sizeof(socklen_t));
+        if (ret == 0 && sqe->addr2) {
+            ret = io_uring_sqe_addr(&sqe->addr, VERIFY_WRITE,
+                                    *(socklen_t *)(uintptr_t)sqe->addr2);
+        }
+        return ret;
+    case IORING_OP_CONNECT:
+        return io_uring_sqe_addr(&sqe->addr, VERIFY_READ, sqe->off);
+
+    case IORING_OP_OPENAT:
+        sqe->open_flags = target_to_host_bitmask(sqe->open_flags,
+                                                 fcntl_flags_tbl);
+        return io_uring_sqe_path(&sqe->addr);
+    case IORING_OP_STATX:
+        ret = io_uring_sqe_path(&sqe->addr);
+        if (ret == 0) {
+            ret = io_uring_sqe_addr(&sqe->addr2, VERIFY_WRITE,
+                                    sizeof(struct target_statx));
+        }
+        return ret;
+    case IORING_OP_UNLINKAT:
+    case IORING_OP_MKDIRAT:
+        return io_uring_sqe_path(&sqe->addr);
+    case IORING_OP_RENAMEAT:
+    case IORING_OP_SYMLINKAT:
+    case IORING_OP_LINKAT:
+        ret = io_uring_sqe_path(&sqe->addr);
+        if (ret == 0) {
+            ret = io_uring_sqe_path(&sqe->addr2);
+        }
+        return ret;
+
+    case IORING_OP_FILES_UPDATE:
+        return io_uring_sqe_addr(&sqe->addr, VERIFY_WRITE,
+                                 sqe->len * sizeof(int));
+
+    default:
+        /*
+         * epoll_event layouts, madvise on guest memory, socket type flags,
+         * xattrs, open_how and passthrough commands are not translated.
+         */
+        return -TARGET_EINVAL;
+    }
+}
+
+static bool io_uring_op_supported(uint8_t opcode)
+{
+    struct io_uring_sqe sqe = { .opcode = opcode };
+
+    /* An empty SQE may well fault, but only unsupported opcodes fail so */
+    return io_uring_translate_sqe(&sqe, NULL) != -TARGET_EINVAL;
+}
+
+/* Translate and submit up to @to_submit entries; ring->lock is held. */
+static abi_long target_io_uring_submit(TargetIoUring *ring, int fd,
+                                       unsigned to_submit)
+{
+    g_autoptr(GPtrArray) scratch = g_ptr_array_new_with_free_func(g_free);
+    g_autofree uint8_t *orig = NULL;
+    unsigned head, tail, mask, n, i, done;
+    abi_long ret = 0, err = 0;
+
+    head = qatomic_load_acquire(ring->khead);
+    tail = qatomic_load_acquire(ring->ktail);
+    mask = qatomic_read(ring->kring_mask);
+    n = MIN(to_submit, tail - head);
+    orig = g_malloc(n * ring->sqe_size);
+
+    for (i = 0; i < n; i++) {
+        unsigned idx = qatomic_read(&ring->array[(head + i) & mask]);
+        struct io_uring_sqe *sqe;
+
+        if (idx >= ring->sq_entries) {
+            /* The kernel drops these, nothing to translate */
+            memset(orig + i * ring->sqe_size, 0, ring->sqe_size);
+            continue;
+        }
+        sqe = ring->sqes + idx * ring->sqe_size;
+        memcpy(orig + i * ring->sqe_size, sqe, ring->sqe_size);
+        err = io_uring_translate_sqe(sqe, scratch);
+        if (err) {
+            memcpy(sqe, orig + i * ring->sqe_size, ring->sqe_size);
+            break;
+        }
+    }
+    if (i == 0) {
+        return err;
+    }
+
+    ret = get_errno(safe_io_uring_enter(fd, i, 0, 0, NULL, 0));
+
+    /* Whatever the kernel did not consume goes back to the guest as it was */
+    done = qatomic_load_acquire(ring->khead) - head;
+    while (i-- > done) {
+        unsigned idx = qatomic_read(&ring->array[(head + i) & mask]);
+
+        if (idx < ring->sq_entries) {
+            memcpy(ring->sqes + idx * ring->sqe_size,
+                   orig + i * ring->sqe_size, ring->sqe_size);
+        }
+    }
+    return ret;
+}
+
+static abi_long target_io_uring_wait(int fd, unsigned min_complete,
+                                     unsigned flags, abi_ulong argp,
+                                     abi_ulong argsz)
+{
+    struct io_uring_getevents_arg arg;
+    struct target__kernel_timespec ts;
+    sigset_t *set = NULL;
+    void *host_argp = NULL;
+    size_t host_argsz = 0;
+    abi_long ret;
+
+    if (flags & IORING_ENTER_EXT_ARG) {
+        if (argsz != sizeof(arg)) {
+            return -TARGET_EINVAL;
+        }
+        if (copy_from_user(&arg, argp, sizeof(arg))) {
+            return -TARGET_EFAULT;
+        }
+        if (arg.ts) {
+            if (copy_from_user(&ts, arg.ts, sizeof(ts))) {
+                return -TARGET_EFAULT;
+            }
+            arg.ts = (uintptr_t)&ts;
+        }
+        if (arg.sigmask) {
+            ret = process_sigsuspend_mask(&set, arg.sigmask, arg.sigmask_sz);
+            if (ret != 0) {
+                return ret;
+            }
+            arg.sigmask = (uintptr_t)set;
+            arg.sigmask_sz = SIGSET_T_SIZE;
+        }
+        host_argp = &arg;
+        host_argsz = sizeof(arg);
+    } else if (argp) {
+        ret = process_sigsuspend_mask(&set, argp, argsz);
+        if (ret != 0) {
+            return ret;
+        }
+        host_argp = set;
+        host_argsz = SIGSET_T_SIZE;
+    }
+
+    ret = get_errno(safe_io_uring_enter(fd, 0, min_complete, flags,
+                                        host_argp, host_argsz));
+
+    if (set) {
+        finish_sigsuspend_mask(ret);
+    }
+    return ret;
+}
+
+static abi_long do_io_uring_enter(int fd, unsigned to_submit,
+                                  unsigned min_complete, unsigned flags,
+                                  abi_ulong argp, abi_ulong argsz)
+{
+    TargetIoUring *ring;
+    abi_long ret = 0;
+
+    if (flags & ~TARGET_IO_URING_ENTER_FLAGS) {
+        return -TARGET_EINVAL;
+    }
+
+    /*
+     * Submission happens under the ring lock, waiting must not: another
+     * guest thread may have to submit what this one is waiting for.
+     */
+    if (to_submit) {
+        ring = target_io_uring_get(fd);
+        if (!ring) {
+            return -TARGET_EOPNOTSUPP;
+        }
+        pthread_mutex_lock(&ring->lock);
+        ret = target_io_uring_submit(ring, fd, to_submit);
+        pthread_mutex_unlock(&ring->lock);
+        target_io_uring_unref(ring);
+        if (is_error(ret)) {
+            return ret;
+        }
+    }
+
+    if (!to_submit || (flags & IORING_ENTER_GETEVENTS)) {
+        abi_long wait = target_io_uring_wait(fd, min_complete, flags,
+                                             argp, argsz);
+
+        /* Like the kernel, report submissions even if waiting failed */
+        if (ret == 0) {
+            ret = wait;
+        }
+    }
+    return ret;
+}
+
+static abi_long do_io_uring_register(int fd, unsigned opcode, abi_ulong arg,
+                                     unsigned nr_args)
+{
+    struct io_uring_files_update update;
+    struct io_uring_probe *probe;
+    struct iovec *vec;
+    void *p = NULL;
+    size_t size = 0;
+    abi_long ret;
+    unsigned i;
+
+    switch (opcode) {
+    case IORING_UNREGISTER_BUFFERS:
+    case IORING_UNREGISTER_FILES:
+    case IORING_UNREGISTER_EVENTFD:
+    case IORING_REGISTER_PERSONALITY:
+    case IORING_UNREGISTER_PERSONALITY:
+    case IORING_REGISTER_ENABLE_RINGS:
+        return get_errno(syscall(__NR_io_uring_register, fd, opcode,
+                                 NULL, nr_args));
+
+    case IORING_REGISTER_BUFFERS:
+        vec = lock_iovec(VERIFY_WRITE, arg, nr_args, 0);
+        if (!vec) {
+            return -host_to_target_errno(errno ? errno : EINVAL);
+        }
+        ret = get_errno(syscall(__NR_io_uring_register, fd, opcode,
+                                vec, nr_args));
+        g_free(vec);
+        return ret;
+
+    case IORING_REGISTER_FILES:
+        size = (size_t)nr_args * sizeof(int);
+        break;
+    case IORING_REGISTER_EVENTFD:
+    case IORING_REGISTER_EVENTFD_ASYNC:
+        size = sizeof(int);
+        break;
+    case IORING_REGISTER_IOWQ_MAX_WORKERS:
+        size = 2 * sizeof(uint32_t);
+        break;
+
+    case IORING_REGISTER_FILES_UPDATE:
+        if (copy_from_user(&update, arg, sizeof(update))) {
+            return -TARGET_EFAULT;
+        }
+        ret = io_uring_sqe_addr((__u64 *)&update.fds, VERIFY_READ,
+                                (abi_ulong)nr_args * sizeof(int));
+        if (ret) {
+            return ret;
+        }
+        return get_errno(syscall(__NR_io_uring_register, fd, opcode,
+                                 &update, nr_args));
+
+    case IORING_REGISTER_PROBE:
+        size = sizeof(*probe) + nr_args * sizeof(struct io_uring_probe_op);
+        probe = lock_user(VERIFY_WRITE, arg, size, 1);
+        if (!probe) {
+            return -TARGET_EFAULT;
+        }
+        ret = get_errno(syscall(__NR_io_uring_register, fd, opcode,
+                                probe, nr_args));
+        if (!is_error(ret)) {
+            for (i = 0; i < probe->ops_len && i < nr_args; i++) {
+                if (!io_uring_op_supported(probe->ops[i].op)) {
+                    probe->ops[i].flags &= ~IO_URING_OP_SUPPORTED;
+                }
+            }
+        }
+        unlock_user(probe, arg, size);
+        return ret;
+
+    case IORING_REGISTER_PBUF_RING:
+    case IORING_UNREGISTER_PBUF_RING:
+        /* The guest fills the buffer ring with its own addresses */
+        if (!io_uring_identity_map()) {
+            return -TARGET_EINVAL;
+        }
+        size = sizeof(struct io_uring_buf_reg);
+        break;
+
+    default:
+        return -TARGET_EINVAL;
+    }
+
+    if (size) {
+        p = lock_user(VERIFY_WRITE, arg, size, 1);
+        if (!p) {
+            return -TARGET_EFAULT;
+        }
+    }
+    ret = get_errno(syscall(__NR_io_uring_register, fd, opcode, p, nr_args));
+    unlock_user(p, arg, size);
+    return ret;
+}
+#endif /* EMULATE_IO_URING */
+
 /* This is an internal helper for do_syscall so that it is easier
  * to have a single return point, so that actions, such as logging
  * of syscall results, can be performed.
@@ -9353,9 +10035,20 @@ static abi_long do_syscall1(CPUArchState *cpu_env, int num, abi_long arg1,
 #if defined(__NR_pidfd_getfd) && defined(TARGET_NR_pidfd_getfd)
     case TARGET_NR_pidfd_getfd:
         return get_errno(pidfd_getfd(arg1, arg2, arg3));
+#endif
+#ifdef EMULATE_IO_URING
+    case TARGET_NR_io_uring_setup:
+        return do_io_uring_setup(arg1, arg2);
+    case TARGET_NR_io_uring_enter:
+        return do_io_uring_enter(arg1, arg2, arg3, arg4, arg5, arg6);
+    case TARGET_NR_io_uring_register:
+        return do_io_uring_register(arg1, arg2, arg3, arg4);
 #endif
     case TARGET_NR_close:
         fd_trans_unregister(arg1);
+#ifdef EMULATE_IO_URING
+        io_uring_fd_unregister(arg1);
+#endif
         return get_errno(close(arg1));
 #if defined(__NR_close_range) && defined(TARGET_NR_close_range)
     case TARGET_NR_close_range:
@@ -9366,6 +10059,9 @@ static abi_long do_syscall1(CPUArchState *cpu_env, int num, abi_long arg1,
             for (fd = arg1; fd < maxfd; fd++) {
                 fd_trans_unregister(fd);
             }
+#ifdef EMULATE_IO_URING
+            io_uring_fd_unregister_range(arg1, arg2);
+#endif
         }
         return ret;
 #endif
@@ -9840,6 +10536,9 @@ static abi_long do_syscall1(CPUArchState *cpu_env, int num, abi_long arg1,
         ret = get_errno(dup(arg1));
         if (ret >= 0) {
             fd_trans_dup(arg1, ret);
+#ifdef EMULATE_IO_URING
+            io_uring_fd_dup(arg1, ret);
+#endif
         }
         return ret;
 #ifdef TARGET_NR_pipe
@@ -9909,6 +10608,9 @@ static abi_long do_syscall1(CPUArchState *cpu_env, int num, abi_long arg1,
         ret = get_errno(dup2(arg1, arg2));
         if (ret >= 0) {
             fd_trans_dup(arg1, arg2);
+#ifdef EMULATE_IO_URING
+            io_uring_fd_dup(arg1, arg2);
+#endif
         }
         return ret;
 #endif
@@ -9924,6 +10626,9 @@ static abi_long do_syscall1(CPUArchState *cpu_env, int num, abi_long arg1,
         ret = get_errno(dup3(arg1, arg2, host_flags));
         if (ret >= 0) {
             fd_trans_dup(arg1, arg2);
+#ifdef EMULATE_IO_URING
+            io_uring_fd_dup(arg1, arg2);
+#endif
         }
         return ret;
     }
@@ -420,6 +420,20 @@ static void send_bitmap_complete(QEMUFile *f, DBMSaveState *s,
     send_bitmap_header(f, s, dbms, DIRTY_BITMAP_MIG_FLAG_COMPLETE);
 }
 
+static void send_bitmap_zeroes(QEMUFile *f, DBMSaveState *s,
+                               SaveBitmapState *dbms,
+                               uint64_t start_sector, uint32_t nr_sectors)
+{
+    uint32_t flags = DIRTY_BITMAP_MIG_FLAG_BITS | DIRTY_BITMAP_MIG_FLAG_ZEROES;
+
+    trace_send_bitmap_bits(flags, start_sector, nr_sectors, 0);
+
+    send_bitmap_header(f, s, dbms, flags);
+
+    qemu_put_be64(f, start_sector);
+    qemu_put_be32(f, nr_sectors);
+}
+
 static void send_bitmap_bits(QEMUFile *f, DBMSaveState *s,
                              SaveBitmapState *dbms,
                              uint64_t start_sector, uint32_t nr_sectors)
@@ -440,8 +454,8 @@ static void send_bitmap_bits(QEMUFile *f, DBMSaveState *s,
 
     if (buffer_is_zero(buf, buf_size)) {
         g_free(buf);
-        buf = NULL;
-        flags |= DIRTY_BITMAP_MIG_FLAG_ZEROES;
+        send_bitmap_zeroes(f, s, dbms, start_sector, nr_sectors);
+        return;
     }
 
     trace_send_bitmap_bits(flags, start_sector, nr_sectors, buf_size);
@@ -450,16 +464,8 @@ static void send_bitmap_bits(QEMUFile *f, DBMSaveState *s,
 
     qemu_put_be64(f, start_sector);
     qemu_put_be32(f, nr_sectors);
-
-    /* if a block is zero we need to flush here since the network
-     * bandwidth is now a lot higher than the storage device bandwidth.
-     * thus if we queue zero blocks we slow down the migration. */
-    if (flags & DIRTY_BITMAP_MIG_FLAG_ZEROES) {
-        qemu_fflush(f);
-    } else {
-        qemu_put_be64(f, buf_size);
-        qemu_put_buffer(f, buf, buf_size);
-    }
+    qemu_put_be64(f, buf_size);
+    qemu_put_buffer(f, buf, buf_size);
 
     g_free(buf);
 }
@@ -689,8 +695,31 @@ static void bulk_phase_send_chunk(QEMUFile *f, DBMSaveState *s,
 {
     uint32_t nr_sectors = MIN(dbms->total_sectors - dbms->cur_sector,
                              dbms->sectors_per_chunk);
+    uint64_t max_zero_sectors = QEMU_ALIGN_DOWN(UINT32_MAX,
+                                                dbms->sectors_per_chunk);
+    uint64_t zero_end = dbms->total_sectors;
+    int64_t next_dirty;
 
-    send_bitmap_bits(f, s, dbms, dbms->cur_sector, nr_sectors);
+    /*
+     * Describe a clean stretch of the bitmap with a single ZEROES chunk
+     * instead of serializing and scanning it one chunk at a time.  Zero runs
+     * stay chunk-aligned, so any destination can deserialize them.
+     */
+    next_dirty = bdrv_dirty_bitmap_next_dirty(
+        dbms->bitmap, dbms->cur_sector << BDRV_SECTOR_BITS,
+        (dbms->total_sectors - dbms->cur_sector) << BDRV_SECTOR_BITS);
+    if (next_dirty >= 0) {
+        zero_end = QEMU_ALIGN_DOWN(next_dirty >> BDRV_SECTOR_BITS,
+                                   dbms->sectors_per_chunk);
+    }
+    zero_end = MIN(zero_end, dbms->cur_sector + max_zero_sectors);
+
+    if (zero_end >= dbms->cur_sector + nr_sectors) {
+        nr_sectors = zero_end - dbms->cur_sector;
+        send_bitmap_zeroes(f, s, dbms, dbms->cur_sector, nr_sectors);
+    } else {
+        send_bitmap_bits(f, s, dbms, dbms->cur_sector, nr_sectors);
+    }
 
     dbms->cur_sector += nr_sectors;
     if (dbms->cur_sector >= dbms->total_sectors) {
@@ -35,6 +35,7 @@
 #include "sysemu/runstate.h"
 #include "net/filter.h"
 #include "options.h"
+#include "xbzrle.h"
 
 static bool vmstate_loading;
 static Notifier packets_compare_notifier;
@@ -380,31 +381,86 @@ static void colo_receive_check_message(QEMUFile *f, COLOMessage expect_msg,
     }
 }
 
-static uint64_t colo_receive_message_value(QEMUFile *f, uint32_t expect_msg,
-                                           Error **errp)
+/*
+ * Device state of the previous checkpoint, used by the primary to send the
+ * next one as an XBZRLE delta.  The secondary keeps its copy in the
+ * channel buffer it loads the device state from.
+ */
+typedef struct ColoVmstateDelta {
+    uint8_t *prev;
+    uint64_t prev_size;
+    uint8_t *buf;
+} ColoVmstateDelta;
+
+/*
+ * xbzrle_encode_buffer() works on whole longs: pad the device state in
+ * @bioc with zeroes up to a multiple of sizeof(long) and return the
+ * padded size.
+ */
+static uint64_t colo_vmstate_pad(QIOChannelBuffer *bioc)
 {
-    Error *local_err = NULL;
-    uint64_t value;
-    int ret;
+    uint64_t size = ROUND_UP(bioc->usage, sizeof(long));
 
-    colo_receive_check_message(f, expect_msg, &local_err);
-    if (local_err) {
-        error_propagate(errp, local_err);
-        return 0;
+    if (size > bioc->capacity) {
+        bioc->capacity = size;
+        bioc->data = g_realloc(bioc->data, bioc->capacity);
     }
+    memset(bioc->data + bioc->usage, 0, size - bioc->usage);
+    return size;
+}
 
-    value = qemu_get_be64(f);
-    ret = qemu_file_get_error(f);
-    if (ret < 0) {
-        error_setg_errno(errp, -ret, "Failed to get value for COLO message: %s",
-                         COLOMessage_str(expect_msg));
+static void colo_send_vmstate(MigrationState *s, QIOChannelBuffer *bioc,
+                              ColoVmstateDelta *delta, Error **errp)
+{
+    ERRP_GUARD();
+    uint64_t size;
+    int len = -1;
+
+    if (!migrate_colo_vmstate_delta() || bioc->usage >= INT_MAX) {
+        g_clear_pointer(&delta->prev, g_free);
+        delta->prev_size = 0;
+    } else {
+        size = colo_vmstate_pad(bioc);
+        if (delta->prev && delta->prev_size == bioc->usage) {
+            /* Only worth it if smaller than the state itself */
+            len = xbzrle_encode_buffer(delta->prev, bioc->data, size,
+                                       delta->buf, bioc->usage);
+        } else {
+            g_free(delta->prev);
+            g_free(delta->buf);
+            delta->prev = g_malloc(size);
+            delta->buf = g_malloc(bioc->usage);
+        }
+        memcpy(delta->prev, bioc->data, size);
+        delta->prev_size = bioc->usage;
+    }
+
+    if (len >= 0) {
+        colo_send_message_value(s->to_dst_file, COLO_MESSAGE_VMSTATE_DELTA_SIZE,
+                                len, errp);
+        if (*errp) {
+            return;
+        }
+        qemu_put_buffer(s->to_dst_file, delta->buf, len);
+    } else {
+        /*
+         * We need the size of the VMstate data in Secondary side,
+         * With which we can decide how much data should be read.
+         */
+        colo_send_message_value(s->to_dst_file, COLO_MESSAGE_VMSTATE_SIZE,
+                                bioc->usage, errp);
+        if (*errp) {
+            return;
+        }
+        qemu_put_buffer(s->to_dst_file, bioc->data, bioc->usage);
     }
-    return value;
+    trace_colo_send_vmstate(bioc->usage, len);
 }
 
 static int colo_do_checkpoint_transaction(MigrationState *s,
                                           QIOChannelBuffer *bioc,
-                                          QEMUFile *fb)
+                                          QEMUFile *fb,
+                                          ColoVmstateDelta *delta)
 {
     Error *local_err = NULL;
     int ret = -1;
@@ -472,17 +528,10 @@ static int colo_do_checkpoint_transaction(MigrationState *s,
 
     qemu_fflush(fb);
 
-    /*
-     * We need the size of the VMstate data in Secondary side,
-     * With which we can decide how much data should be read.
-     */
-    colo_send_message_value(s->to_dst_file, COLO_MESSAGE_VMSTATE_SIZE,
-                            bioc->usage, &local_err);
+    colo_send_vmstate(s, bioc, delta, &local_err);
     if (local_err) {
         goto out;
     }
-
-    qemu_put_buffer(s->to_dst_file, bioc->data, bioc->usage);
     qemu_fflush(s->to_dst_file);
     ret = qemu_file_get_error(s->to_dst_file);
     if (ret < 0) {
@@ -530,6 +579,7 @@ static void colo_process_checkpoint(MigrationState *s)
 {
     QIOChannelBuffer *bioc;
     QEMUFile *fb = NULL;
+    ColoVmstateDelta delta = {};
     Error *local_err = NULL;
     int ret;
 
@@ -587,7 +637,7 @@ static void colo_process_checkpoint(MigrationState *s)
         if (s->state != MIGRATION_STATUS_COLO) {
             goto out;
         }
-        ret = colo_do_checkpoint_transaction(s, bioc, fb);
+        ret = colo_do_checkpoint_transaction(s, bioc, fb, &delta);
         if (ret < 0) {
             goto out;
         }
@@ -602,6 +652,8 @@ out:
     if (fb) {
         qemu_fclose(fb);
     }
+    g_free(delta.prev);
+    g_free(delta.buf);
 
     /*
      * There are only two reasons we can get here, some error happened
@@ -654,11 +706,84 @@ void migrate_start_colo_process(MigrationState *s)
     qemu_mutex_lock_iothread();
 }
 
-static void colo_incoming_process_checkpoint(MigrationIncomingState *mis,
-                      QEMUFile *fb, QIOChannelBuffer *bioc, Error **errp)
+/*
+ * Read the device state of a checkpoint into @bioc, either in full or as
+ * a delta against the state of the previous checkpoint that @bioc still
+ * holds.
+ */
+static void colo_receive_vmstate(MigrationIncomingState *mis,
+                                 QIOChannelBuffer *bioc, Error **errp)
 {
+    ERRP_GUARD();
+    g_autofree uint8_t *buf = NULL;
     uint64_t total_size;
     uint64_t value;
+    COLOMessage msg;
+    int ret;
+
+    msg = colo_receive_message(mis->from_src_file, errp);
+    if (*errp) {
+        return;
+    }
+    if (msg != COLO_MESSAGE_VMSTATE_SIZE &&
+        msg != COLO_MESSAGE_VMSTATE_DELTA_SIZE) {
+        error_setg(errp, "Unexpected COLO message %d, expected %d or %d",
+                   msg, COLO_MESSAGE_VMSTATE_SIZE,
+                   COLO_MESSAGE_VMSTATE_DELTA_SIZE);
+        return;
+    }
+    value = qemu_get_be64(mis->from_src_file);
+    ret = qemu_file_get_error(mis->from_src_file);
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "Failed to get value for COLO message: %s",
+                         COLOMessage_str(msg));
+        return;
+    }
+
+    if (msg == COLO_MESSAGE_VMSTATE_DELTA_SIZE) {
+        if (!bioc->usage || value > bioc->usage) {
+            error_setg(errp, "Unexpected VMState delta of %" PRIu64 " bytes",
+                       value);
+            return;
+        }
+        buf = g_malloc(value);
+        total_size = qemu_get_buffer(mis->from_src_file, buf, value);
+        if (total_size != value) {
+            error_setg(errp, "Got %" PRIu64 " VMState delta, less than "
+                       "expected %" PRIu64, total_size, value);
+            return;
+        }
+        if (xbzrle_decode_buffer(buf, value, bioc->data,
+                                 ROUND_UP(bioc->usage, sizeof(long))) < 0) {
+            error_setg(errp, "Failed to decode VMState delta");
+            return;
+        }
+    } else {
+        /*
+         * Read VM device state data into channel buffer,
+         * It's better to re-use the memory allocated.
+         * Here we need to handle the channel buffer directly.
+         */
+        if (value > bioc->capacity) {
+            bioc->capacity = value;
+            bioc->data = g_realloc(bioc->data, bioc->capacity);
+        }
+        total_size = qemu_get_buffer(mis->from_src_file, bioc->data, value);
+        if (total_size != value) {
+            error_setg(errp, "Got %" PRIu64 " VMState data, less than expected"
+                        " %" PRIu64, total_size, value);
+            return;
+        }
+        bioc->usage = total_size;
+        /* The next checkpoint may be a delta against this one */
+        colo_vmstate_pad(bioc);
+    }
+    qio_channel_io_seek(QIO_CHANNEL(bioc), 0, 0, NULL);
+}
+
+static void colo_incoming_process_checkpoint(MigrationIncomingState *mis,
+                      QEMUFile *fb, QIOChannelBuffer *bioc, Error **errp)
+{
     Error *local_err = NULL;
     int ret;
 
@@ -692,31 +817,12 @@ static void colo_incoming_process_checkpoint(MigrationIncomingState *mis,
         return;
     }
 
-    value = colo_receive_message_value(mis->from_src_file,
-                             COLO_MESSAGE_VMSTATE_SIZE, &local_err);
+    colo_receive_vmstate(mis, bioc, &local_err);
     if (local_err) {
         error_propagate(errp, local_err);
         return;
     }
 
-    /*
-     * Read VM device state data into channel buffer,
-     * It's better to re-use the memory allocated.
-     * Here we need to handle the channel buffer directly.
-     */
-    if (value > bioc->capacity) {
-        bioc->capacity = value;
-        bioc->data = g_realloc(bioc->data, bioc->capacity);
-    }
-    total_size = qemu_get_buffer(mis->from_src_file, bioc->data, value);
-    if (total_size != value) {
-        error_setg(errp, "Got %" PRIu64 " VMState data, less than expected"
-                    " %" PRIu64, total_size, value);
-        return;
-    }
-    bioc->usage = total_size;
-    qio_channel_io_seek(QIO_CHANNEL(bioc), 0, 0, NULL);
-
     colo_send_message(mis->to_src_file, COLO_MESSAGE_VMSTATE_RECEIVED,
                  &local_err);
     if (local_err) {
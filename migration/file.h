@@ -0,0 +1,19 @@
+/*
+ * QEMU live migration to and from regular files
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef QEMU_MIGRATION_FILE_H
+#define QEMU_MIGRATION_FILE_H
+
+#include "io/task.h"
+
+void file_start_incoming_migration(const char *filespec, Error **errp);
+
+void file_start_outgoing_migration(MigrationState *s, const char *filespec,
+                                   Error **errp);
+void file_send_channel_create(QIOTaskFunc f, void *data);
+void file_cleanup_outgoing_migration(void);
+#endif
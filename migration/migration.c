@@ -20,6 +20,7 @@
 #include "migration/blocker.h"
 #include "exec.h"
 #include "fd.h"
+#include "file.h"
 #include "socket.h"
 #include "sysemu/runstate.h"
 #include "sysemu/sysemu.h"
@@ -113,8 +114,17 @@ static bool uri_supports_multi_channels(const char *uri)
 static bool
 migration_channels_and_uri_compatible(const char *uri, Error **errp)
 {
+    bool file_uri = strstart(uri, "file:", NULL);
+
+    if (migrate_mapped_ram() && !file_uri) {
+        error_setg(errp, "Mapped-ram migration requires a file: URI");
+        return false;
+    }
+
+    /* With mapped-ram, the multifd channels are opened on the same file */
     if (migration_needs_multiple_sockets() &&
-        !uri_supports_multi_channels(uri)) {
+        !uri_supports_multi_channels(uri) &&
+        !(file_uri && migrate_mapped_ram())) {
         error_setg(errp, "Migration requires multi-channel URIs (e.g. tcp)");
         return false;
     }
@@ -316,11 +326,11 @@ static int migrate_send_rp_message(MigrationIncomingState *mis,
  *   Len: Length in bytes required - must be a multiple of pagesize
  */
 int migrate_send_rp_message_req_pages(MigrationIncomingState *mis,
-                                      RAMBlock *rb, ram_addr_t start)
+                                      RAMBlock *rb, ram_addr_t start,
+                                      size_t len)
 {
     uint8_t bufc[12 + 1 + 255]; /* start (8), len (4), rbname up to 256 */
     size_t msglen = 12; /* start + len */
-    size_t len = qemu_ram_pagesize(rb);
     enum mig_rp_message_type msg_type;
     const char *rbname;
     int rbname_len;
@@ -352,35 +362,54 @@ int migrate_send_rp_message_req_pages(MigrationIncomingState *mis,
     return migrate_send_rp_message(mis, msg_type, msglen, bufc);
 }
 
+/*
+ * Request the host pages in [start, start + len) of a RAMBlock, unless
+ * they have all been received already.  haddr is the faulting address
+ * within the first page, len a multiple of the host page size.
+ */
 int migrate_send_rp_req_pages(MigrationIncomingState *mis,
-                              RAMBlock *rb, ram_addr_t start, uint64_t haddr)
+                              RAMBlock *rb, ram_addr_t start, uint64_t haddr,
+                              size_t len)
 {
-    void *aligned = (void *)(uintptr_t)ROUND_DOWN(haddr, qemu_ram_pagesize(rb));
-    bool received = false;
+    size_t pagesize = qemu_ram_pagesize(rb);
+    void *aligned = (void *)(uintptr_t)ROUND_DOWN(haddr, pagesize);
+    /* Odd, so that it is never NULL even once truncated to a pointer */
+    uintptr_t now = qemu_clock_get_us(QEMU_CLOCK_REALTIME) | 1;
+    bool received = true;
+    size_t offset;
 
     WITH_QEMU_LOCK_GUARD(&mis->page_request_mutex) {
-        received = ramblock_recv_bitmap_test_byte_offset(rb, start);
-        if (!received && !g_tree_lookup(mis->page_requested, aligned)) {
-            /*
-             * The page has not been received, and it's not yet in the page
-             * request list.  Queue it.  Set the value of element to 1, so that
-             * things like g_tree_lookup() will return TRUE (1) when found.
-             */
-            g_tree_insert(mis->page_requested, aligned, (gpointer)1);
-            mis->page_requested_count++;
-            trace_postcopy_page_req_add(aligned, mis->page_requested_count);
+        for (offset = 0; offset < len; offset += pagesize) {
+            void *host = aligned + offset;
+
+            if (ramblock_recv_bitmap_test_byte_offset(rb, start + offset)) {
+                continue;
+            }
+            received = false;
+            if (!g_tree_lookup(mis->page_requested, host)) {
+                /*
+                 * The page has not been received, and it's not yet in the
+                 * page request list.  Queue it.  The value of the element
+                 * is the time of the request, which is never zero, so that
+                 * things like g_tree_lookup() will return TRUE when found
+                 * and the latency of the fault can be accounted for.
+                 */
+                g_tree_insert(mis->page_requested, host, (gpointer)now);
+                mis->page_requested_count++;
+                trace_postcopy_page_req_add(host, mis->page_requested_count);
+            }
         }
     }
 
     /*
-     * If the page is there, skip sending the message.  We don't even need the
-     * lock because as long as the page arrived, it'll be there forever.
+     * If the pages are there, skip sending the message.  We don't even need
+     * the lock because as long as a page arrived, it'll be there forever.
      */
     if (received) {
         return 0;
     }
 
-    return migrate_send_rp_message_req_pages(mis, rb, start);
+    return migrate_send_rp_message_req_pages(mis, rb, start, len);
 }
 
 static bool migration_colo_enabled;
@@ -447,6 +476,8 @@ static void qemu_start_incoming_migration(const char *uri, Error **errp)
         exec_start_incoming_migration(p, errp);
     } else if (strstart(uri, "fd:", &p)) {
         fd_start_incoming_migration(p, errp);
+    } else if (strstart(uri, "file:", &p)) {
+        file_start_incoming_migration(p, errp);
     } else {
         error_setg(errp, "unknown migration protocol: %s", uri);
     }
@@ -914,6 +945,10 @@ static void populate_time_info(MigrationInfo *info, MigrationState *s)
     } else {
         info->has_expected_downtime = true;
         info->expected_downtime = s->expected_downtime;
+        if (s->predicted_downtime) {
+            info->has_predicted_downtime = true;
+            info->predicted_downtime = s->predicted_downtime;
+        }
     }
 }
 
@@ -1177,6 +1212,8 @@ static void migrate_fd_cleanup(MigrationState *s)
         qemu_fclose(tmp);
     }
 
+    file_cleanup_outgoing_migration();
+
     if (s->postcopy_qemufile_src) {
         migration_ioc_unregister_yank_from_file(s->postcopy_qemufile_src);
         qemu_fclose(s->postcopy_qemufile_src);
@@ -1409,6 +1446,7 @@ void migrate_init(MigrationState *s)
     s->pages_per_second = 0.0;
     s->downtime = 0;
     s->expected_downtime = 0;
+    s->predicted_downtime = 0;
     s->setup_time = 0;
     s->start_postcopy = false;
     s->postcopy_after_devices = false;
@@ -1685,6 +1723,8 @@ void qmp_migrate(const char *uri, bool has_blk, bool blk,
         exec_start_outgoing_migration(s, p, &local_err);
     } else if (strstart(uri, "fd:", &p)) {
         fd_start_outgoing_migration(s, p, &local_err);
+    } else if (strstart(uri, "file:", &p)) {
+        file_start_outgoing_migration(s, p, &local_err);
     } else {
         if (!resume_requested) {
             yank_unregister_instance(MIGRATION_YANK_INSTANCE);
@@ -2679,6 +2719,34 @@ static void update_iteration_initial_status(MigrationState *s)
     s->iteration_initial_pages = ram_get_total_transferred_pages();
 }
 
+/*
+ * Predict the downtime if the migration switched over at the end of the
+ * next pass over the dirty memory.  That pass sends the RAM that is dirty
+ * now, during which the guest dirties again the share of it given by the
+ * ratio of its dirty rate to the bandwidth; that share, and the state of
+ * the devices, is what would be left for the downtime.
+ *
+ * @bandwidth: the measured bandwidth, in bytes per millisecond
+ */
+static int64_t migration_predict_downtime(double bandwidth)
+{
+    uint64_t must_precopy, can_postcopy, pending, ram, device;
+    /* In bytes per millisecond too */
+    double dirty_rate = (double)stat64_get(&mig_stats.dirty_pages_rate) *
+                        qemu_target_page_size() / 1000;
+    double ram_left;
+
+    qemu_savevm_state_pending_estimate(&must_precopy, &can_postcopy);
+    pending = must_precopy + can_postcopy;
+    ram = MIN(ram_bytes_remaining(), pending);
+    device = pending - ram;
+
+    ram_left = MIN(dirty_rate * ram / bandwidth, (double)ram_bytes_total());
+    trace_migration_predict_downtime(dirty_rate, ram, device, ram_left);
+
+    return (ram_left + device) / bandwidth;
+}
+
 static void migration_update_counters(MigrationState *s,
                                       int64_t current_time)
 {
@@ -2712,6 +2780,7 @@ static void migration_update_counters(MigrationState *s,
         transferred > 10000) {
         s->expected_downtime =
             stat64_get(&mig_stats.dirty_bytes_last_sync) / bandwidth;
+        s->predicted_downtime = migration_predict_downtime(bandwidth);
     }
 
     migration_rate_reset(s->to_dst_file);
@@ -2722,6 +2791,17 @@ static void migration_update_counters(MigrationState *s,
                               bandwidth, s->threshold_size);
 }
 
+/*
+ * Return true if the predicted downtime is above the downtime limit, in
+ * which case throttling should not wait to see the dirty rate stay high.
+ */
+bool migration_downtime_unreachable(void)
+{
+    MigrationState *s = migrate_get_current();
+
+    return s->predicted_downtime > migrate_downtime_limit();
+}
+
 static bool migration_can_switchover(MigrationState *s)
 {
     if (!migrate_switchover_ack()) {
@@ -29,6 +29,9 @@
 
 struct PostcopyBlocktimeContext;
 
+/* Buckets of the postcopy page fault latency histogram */
+#define POSTCOPY_LATENCY_BUCKETS 32
+
 #define  MIGRATION_RESUME_ACK_VALUE  (1)
 
 /*
@@ -48,6 +51,14 @@ struct PostcopyBlocktimeContext;
  */
 #define CLEAR_BITMAP_SHIFT_MAX            31
 
+/*
+ * Default number of threads used to synchronize the dirty bitmap of
+ * large guests, see RAM_SYNC_THREADS_MIN_RAM in ram.c.
+ */
+#define DIRTY_SYNC_THREADS_DEFAULT         4
+/* Upper limit of the x-dirty-sync-threads property */
+#define DIRTY_SYNC_THREADS_MAX            64
+
 /* This is an abstraction of a "temp huge page" for postcopy's purpose */
 typedef struct {
     /*
@@ -210,6 +221,13 @@ struct MigrationIncomingState {
      * contains valid information.
      */
     QemuMutex page_request_mutex;
+    /*
+     * Histogram of the time it took to resolve the page faults requested
+     * to the source: bucket N counts the faults resolved in [2^N, 2^(N+1))
+     * microseconds, the last one everything above.  Protected by
+     * page_request_mutex.
+     */
+    uint64_t postcopy_latency_dist[POSTCOPY_LATENCY_BUCKETS];
 
     /*
      * Number of devices that have yet to approve switchover. When this reaches
@@ -323,6 +341,12 @@ struct MigrationState {
     int64_t downtime_start;
     int64_t downtime;
     int64_t expected_downtime;
+    /*
+     * Downtime (ms) predicted if the migration switched over at the end
+     * of the next pass over the dirty memory, see
+     * migration_predict_downtime(); 0 until it can be predicted
+     */
+    int64_t predicted_downtime;
     bool capabilities[MIGRATION_CAPABILITY__MAX];
     int64_t setup_time;
 
@@ -439,6 +463,12 @@ struct MigrationState {
      * (which is in 4M chunk).
      */
     uint8_t clear_bitmap_shift;
+    /*
+     * Number of threads (including the migration thread itself) used to
+     * synchronize the dirty bitmap of large guests.  0 or 1 means the
+     * bitmap is always synchronized serially.
+     */
+    uint8_t dirty_sync_threads;
 
     /*
      * This save hostname when out-going migration starts
@@ -464,6 +494,7 @@ void migration_incoming_process(void);
 bool  migration_has_all_channels(void);
 
 uint64_t migrate_max_downtime(void);
+bool migration_downtime_unreachable(void);
 
 void migrate_set_error(MigrationState *s, const Error *error);
 
@@ -486,9 +517,10 @@ void migrate_send_rp_shut(MigrationIncomingState *mis,
 void migrate_send_rp_pong(MigrationIncomingState *mis,
                           uint32_t value);
 int migrate_send_rp_req_pages(MigrationIncomingState *mis, RAMBlock *rb,
-                              ram_addr_t start, uint64_t haddr);
+                              ram_addr_t start, uint64_t haddr, size_t len);
 int migrate_send_rp_message_req_pages(MigrationIncomingState *mis,
-                                      RAMBlock *rb, ram_addr_t start);
+                                      RAMBlock *rb, ram_addr_t start,
+                                      size_t len);
 void migrate_send_rp_recv_bitmap(MigrationIncomingState *mis,
                                  char *block_name);
 void migrate_send_rp_resume_ack(MigrationIncomingState *mis, uint32_t value);
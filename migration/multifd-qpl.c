@@ -0,0 +1,444 @@
+/*
+ * Multifd qpl compression accelerator implementation
+ *
+ * Copyright (c) 2023 Intel Corporation
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/rcu.h"
+#include "exec/ramblock.h"
+#include "exec/target_page.h"
+#include "qapi/error.h"
+#include "migration.h"
+#include "trace.h"
+#include "options.h"
+#include "multifd.h"
+#include "qpl/qpl.h"
+
+/*
+ * Every page of a packet is compressed independently, as one deflate
+ * job.  This is what lets a whole packet be handed to the accelerator
+ * at once: all jobs are submitted first, and only then waited for, so
+ * the send thread does not spend CPU time on compression while the
+ * IAA device works.
+ *
+ * On the wire, the payload of a packet is an array of normal_num
+ * big-endian 32-bit sizes, followed by the data of each page.  A size
+ * equal to the page size means that the page is sent uncompressed,
+ * which is the case when compression does not make it smaller (or
+ * fails for any reason).
+ */
+
+typedef struct {
+    qpl_job *job;
+    /* the job was queued on the accelerator and must be waited for */
+    bool pending;
+    /* result of the job */
+    qpl_status status;
+    uint32_t out_len;
+} QplPage;
+
+typedef struct {
+    /* execution path of the jobs in pages[] */
+    qpl_path_t path;
+    /* one job per page of a packet */
+    QplPage *pages;
+    uint32_t page_num;
+    /*
+     * Software job, used for the pages that cannot be queued because
+     * the accelerator work queues are full.
+     */
+    qpl_job *sw_job;
+    /* compressed data, one page size slot per page */
+    uint8_t *zbuf;
+    /* compressed size of each page, in wire (big-endian) format */
+    uint32_t *zlen;
+} QplData;
+
+static qpl_job *multifd_qpl_job_new(qpl_path_t path)
+{
+    qpl_job *job;
+    uint32_t size = 0;
+
+    if (qpl_get_job_size(path, &size) != QPL_STS_OK) {
+        return NULL;
+    }
+    job = g_malloc0(size);
+    if (qpl_init_job(path, job) != QPL_STS_OK) {
+        g_free(job);
+        return NULL;
+    }
+    return job;
+}
+
+static void multifd_qpl_job_free(qpl_job *job)
+{
+    if (job) {
+        qpl_fini_job(job);
+        g_free(job);
+    }
+}
+
+static void multifd_qpl_free_jobs(QplData *qpl)
+{
+    uint32_t i;
+
+    for (i = 0; i < qpl->page_num; i++) {
+        multifd_qpl_job_free(qpl->pages[i].job);
+    }
+    g_free(qpl->pages);
+    qpl->pages = NULL;
+    multifd_qpl_job_free(qpl->sw_job);
+    qpl->sw_job = NULL;
+}
+
+static bool multifd_qpl_init_jobs(QplData *qpl, qpl_path_t path)
+{
+    uint32_t i;
+
+    qpl->path = path;
+    qpl->pages = g_new0(QplPage, qpl->page_num);
+    for (i = 0; i < qpl->page_num; i++) {
+        qpl->pages[i].job = multifd_qpl_job_new(path);
+        if (!qpl->pages[i].job) {
+            multifd_qpl_free_jobs(qpl);
+            return false;
+        }
+    }
+    if (path == qpl_path_hardware) {
+        qpl->sw_job = multifd_qpl_job_new(qpl_path_software);
+        if (!qpl->sw_job) {
+            multifd_qpl_free_jobs(qpl);
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * multifd_qpl_init: allocate the jobs and buffers of a channel
+ *
+ * The jobs run on the IAA accelerator if the host has one that QPL can
+ * use, and fall back to the QPL software implementation otherwise.
+ *
+ * Returns the state of the channel, or NULL on error
+ *
+ * @id: the channel number
+ * @errp: pointer to an error
+ */
+static QplData *multifd_qpl_init(uint8_t id, Error **errp)
+{
+    uint32_t page_size = qemu_target_page_size();
+    QplData *qpl = g_new0(QplData, 1);
+
+    qpl->page_num = MULTIFD_PACKET_SIZE / page_size;
+    if (!multifd_qpl_init_jobs(qpl, qpl_path_hardware) &&
+        !multifd_qpl_init_jobs(qpl, qpl_path_software)) {
+        g_free(qpl);
+        error_setg(errp, "multifd %u: failed to initialize qpl jobs", id);
+        return NULL;
+    }
+    trace_multifd_qpl_setup(id, qpl->path == qpl_path_hardware);
+
+    qpl->zbuf = g_try_malloc(qpl->page_num * page_size);
+    if (!qpl->zbuf) {
+        multifd_qpl_free_jobs(qpl);
+        g_free(qpl);
+        error_setg(errp, "multifd %u: out of memory for zbuf", id);
+        return NULL;
+    }
+    qpl->zlen = g_new0(uint32_t, qpl->page_num);
+    return qpl;
+}
+
+static void multifd_qpl_deinit(QplData *qpl)
+{
+    if (qpl) {
+        multifd_qpl_free_jobs(qpl);
+        g_free(qpl->zbuf);
+        g_free(qpl->zlen);
+        g_free(qpl);
+    }
+}
+
+static void multifd_qpl_prepare_job(qpl_job *job, qpl_opcode op,
+                                    uint8_t *in, uint32_t in_len,
+                                    uint8_t *out, uint32_t out_len)
+{
+    job->op = op;
+    job->next_in_ptr = in;
+    job->available_in = in_len;
+    job->next_out_ptr = out;
+    job->available_out = out_len;
+    job->flags = QPL_FLAG_FIRST | QPL_FLAG_LAST | QPL_FLAG_OMIT_VERIFY;
+    if (op == qpl_op_compress) {
+        job->flags |= QPL_FLAG_DYNAMIC_HUFFMAN;
+        job->level = qpl_default_level;
+    }
+}
+
+/*
+ * Start the job of @page.  On the accelerator the job is only queued;
+ * in software, or when the accelerator queues are full, it runs to
+ * completion on the CPU right away.
+ */
+static void multifd_qpl_start(QplData *qpl, QplPage *page, qpl_opcode op,
+                              uint8_t *in, uint32_t in_len,
+                              uint8_t *out, uint32_t out_len)
+{
+    qpl_job *job = page->job;
+
+    multifd_qpl_prepare_job(job, op, in, in_len, out, out_len);
+    page->pending = false;
+    page->out_len = 0;
+    if (qpl->path == qpl_path_hardware) {
+        page->status = qpl_submit_job(job);
+        if (page->status == QPL_STS_OK) {
+            page->pending = true;
+            return;
+        }
+        if (page->status != QPL_STS_QUEUES_ARE_BUSY_ERR) {
+            return;
+        }
+        job = qpl->sw_job;
+        multifd_qpl_prepare_job(job, op, in, in_len, out, out_len);
+    }
+    page->status = qpl_execute_job(job);
+    page->out_len = job->total_out;
+}
+
+static void multifd_qpl_finish(QplPage *page)
+{
+    if (page->pending) {
+        page->status = qpl_wait_job(page->job);
+        page->out_len = page->job->total_out;
+        page->pending = false;
+    }
+}
+
+/**
+ * multifd_qpl_send_setup: setup send side
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @errp: pointer to an error
+ */
+static int multifd_qpl_send_setup(MultiFDSendParams *p, Error **errp)
+{
+    p->data = multifd_qpl_init(p->id, errp);
+    return p->data ? 0 : -1;
+}
+
+/**
+ * multifd_qpl_send_cleanup: cleanup send side
+ *
+ * @p: Params for the channel that we are using
+ * @errp: pointer to an error
+ */
+static void multifd_qpl_send_cleanup(MultiFDSendParams *p, Error **errp)
+{
+    multifd_qpl_deinit(p->data);
+    p->data = NULL;
+}
+
+/**
+ * multifd_qpl_send_prepare: prepare data to be able to send
+ *
+ * Compress all the pages of the packet as a batch of jobs, and
+ * queue the size header and the page data for sending.  Pages that
+ * do not compress are sent straight from guest memory.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @errp: pointer to an error
+ */
+static int multifd_qpl_send_prepare(MultiFDSendParams *p, Error **errp)
+{
+    QplData *qpl = p->data;
+    uint8_t *host = p->pages->block->host;
+    uint32_t size = p->normal_num * sizeof(uint32_t);
+    uint32_t raw_pages = 0, sw_pages = 0;
+    uint32_t i;
+
+    assert(p->normal_num <= qpl->page_num);
+
+    for (i = 0; i < p->normal_num; i++) {
+        /*
+         * Leave no room for output that is not smaller than the page:
+         * such a page is better sent as is.
+         */
+        multifd_qpl_start(qpl, &qpl->pages[i], qpl_op_compress,
+                          host + p->normal[i], p->page_size,
+                          qpl->zbuf + i * p->page_size, p->page_size - 1);
+        if (!qpl->pages[i].pending) {
+            sw_pages++;
+        }
+    }
+
+    p->iov[p->iovs_num].iov_base = qpl->zlen;
+    p->iov[p->iovs_num].iov_len = size;
+    p->iovs_num++;
+
+    for (i = 0; i < p->normal_num; i++) {
+        QplPage *page = &qpl->pages[i];
+        struct iovec *iov = &p->iov[p->iovs_num++];
+
+        multifd_qpl_finish(page);
+        if (page->status == QPL_STS_OK && page->out_len &&
+            page->out_len < p->page_size) {
+            iov->iov_base = qpl->zbuf + i * p->page_size;
+            iov->iov_len = page->out_len;
+        } else {
+            iov->iov_base = host + p->normal[i];
+            iov->iov_len = p->page_size;
+            raw_pages++;
+        }
+        qpl->zlen[i] = cpu_to_be32(iov->iov_len);
+        size += iov->iov_len;
+    }
+
+    p->next_packet_size = size;
+    p->flags |= MULTIFD_FLAG_QPL;
+    trace_multifd_qpl_send_prepare(p->id, p->normal_num, raw_pages,
+                                   sw_pages, size);
+    return 0;
+}
+
+/**
+ * multifd_qpl_recv_setup: setup receive side
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @errp: pointer to an error
+ */
+static int multifd_qpl_recv_setup(MultiFDRecvParams *p, Error **errp)
+{
+    p->data = multifd_qpl_init(p->id, errp);
+    return p->data ? 0 : -1;
+}
+
+/**
+ * multifd_qpl_recv_cleanup: cleanup receive side
+ *
+ * @p: Params for the channel that we are using
+ */
+static void multifd_qpl_recv_cleanup(MultiFDRecvParams *p)
+{
+    multifd_qpl_deinit(p->data);
+    p->data = NULL;
+}
+
+/**
+ * multifd_qpl_recv_pages: read the data from the channel into actual pages
+ *
+ * Uncompressed pages are read straight into guest memory; compressed
+ * ones are read into a buffer and decompressed as a batch of jobs.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @errp: pointer to an error
+ */
+static int multifd_qpl_recv_pages(MultiFDRecvParams *p, Error **errp)
+{
+    QplData *qpl = p->data;
+    uint32_t flags = p->flags & MULTIFD_FLAG_COMPRESSION_MASK;
+    uint32_t hdr_len = p->normal_num * sizeof(uint32_t);
+    uint32_t data_len = 0;
+    uint8_t *zbuf = qpl->zbuf;
+    uint32_t i;
+    int ret;
+
+    if (flags != MULTIFD_FLAG_QPL) {
+        error_setg(errp, "multifd %u: flags received %x flags expected %x",
+                   p->id, flags, MULTIFD_FLAG_QPL);
+        return -1;
+    }
+    if (p->normal_num > qpl->page_num) {
+        error_setg(errp, "multifd %u: too many pages received %u max %u",
+                   p->id, p->normal_num, qpl->page_num);
+        return -1;
+    }
+
+    ret = qio_channel_read_all(p->c, (void *)qpl->zlen, hdr_len, errp);
+    if (ret != 0) {
+        return ret;
+    }
+
+    for (i = 0; i < p->normal_num; i++) {
+        uint32_t len = be32_to_cpu(qpl->zlen[i]);
+
+        if (!len || len > p->page_size) {
+            error_setg(errp, "multifd %u: invalid compressed page size %u",
+                       p->id, len);
+            return -1;
+        }
+        qpl->zlen[i] = len;
+        data_len += len;
+        if (len == p->page_size) {
+            p->iov[i].iov_base = p->host + p->normal[i];
+        } else {
+            p->iov[i].iov_base = zbuf;
+            zbuf += len;
+        }
+        p->iov[i].iov_len = len;
+    }
+    if (hdr_len + data_len != p->next_packet_size) {
+        error_setg(errp, "multifd %u: packet size received %u size expected %u",
+                   p->id, p->next_packet_size, hdr_len + data_len);
+        return -1;
+    }
+
+    ret = qio_channel_readv_all(p->c, p->iov, p->normal_num, errp);
+    if (ret != 0) {
+        return ret;
+    }
+
+    for (i = 0; i < p->normal_num; i++) {
+        if (qpl->zlen[i] != p->page_size) {
+            multifd_qpl_start(qpl, &qpl->pages[i], qpl_op_decompress,
+                              p->iov[i].iov_base, qpl->zlen[i],
+                              p->host + p->normal[i], p->page_size);
+        }
+    }
+    for (i = 0; i < p->normal_num; i++) {
+        QplPage *page = &qpl->pages[i];
+
+        if (qpl->zlen[i] == p->page_size) {
+            continue;
+        }
+        multifd_qpl_finish(page);
+        if (page->status != QPL_STS_OK || page->out_len != p->page_size) {
+            /* Keep going, so that no job is left in flight */
+            if (!ret) {
+                error_setg(errp, "multifd %u: decompression failed, "
+                           "status %u size %u", p->id, page->status,
+                           page->out_len);
+                ret = -1;
+            }
+        }
+    }
+    return ret;
+}
+
+static MultiFDMethods multifd_qpl_ops = {
+    .send_setup = multifd_qpl_send_setup,
+    .send_cleanup = multifd_qpl_send_cleanup,
+    .send_prepare = multifd_qpl_send_prepare,
+    .recv_setup = multifd_qpl_recv_setup,
+    .recv_cleanup = multifd_qpl_recv_cleanup,
+    .recv_pages = multifd_qpl_recv_pages
+};
+
+static void multifd_qpl_register(void)
+{
+    multifd_register_ops(MULTIFD_COMPRESSION_QPL, &multifd_qpl_ops);
+}
+
+migration_init(multifd_qpl_register);
@@ -0,0 +1,418 @@
+/*
+ * Multifd XBZRLE delta encoding
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/rcu.h"
+#include "exec/ramblock.h"
+#include "exec/target_page.h"
+#include "qapi/error.h"
+#include "migration.h"
+#include "migration-stats.h"
+#include "options.h"
+#include "page_cache.h"
+#include "ram.h"
+#include "trace.h"
+#include "xbzrle.h"
+#include "multifd.h"
+
+/*
+ * With multifd, XBZRLE runs in the send threads.  The page cache is
+ * split into shards by guest address, with the granularity of a packet,
+ * and each shard has its own lock: a packet covers contiguous pages of
+ * one RAMBlock, so the channel encoding it takes one or two shard locks
+ * and does not contend with the other channels.
+ *
+ * A page is sent at most once between two multifd syncs, and the
+ * destination applies the packets of different channels in order across
+ * a sync, so a delta is always applied on top of the data it was
+ * computed against, whatever channel carried the previous version.
+ *
+ * On the wire, the payload of a packet is an array of normal_num
+ * big-endian 32-bit lengths followed by the data of each page:
+ * - 0: the page did not change since it was last sent
+ * - the page size: the page is sent as is
+ * - anything else: the page is XBZRLE encoded against its last version
+ */
+
+/* Shards per channel, so that channels rarely meet on the same shard */
+#define XBZRLE_SHARDS_PER_CHANNEL 4
+
+typedef struct {
+    QemuMutex lock;
+    PageCache *cache;
+} XBZRLECacheShard;
+
+static struct {
+    XBZRLECacheShard *shards;
+    unsigned int nr_shards;
+    /* set after the first round, like RAMState::xbzrle_started */
+    bool started;
+    /* protects xbzrle_counters against concurrent updates */
+    QemuMutex stats_lock;
+    /* a page full of zeros, to cache the pages sent as zero pages */
+    uint8_t *zero_page;
+} multifd_xbzrle;
+
+typedef struct {
+    /* encoded data or copies of the pages, one page size slot per page */
+    uint8_t *buf;
+    /* length of each page, in wire (big-endian) format */
+    uint32_t *len;
+    /* stable copy of the page being encoded */
+    uint8_t *current;
+} XBZRLESendData;
+
+bool multifd_xbzrle_enabled(void)
+{
+    /*
+     * The encoded data lives in per-channel buffers that are reused for
+     * every packet, which does not agree with zero copy.  Compression
+     * methods expect to see the guest pages, so with compression XBZRLE
+     * is not used either, as before.
+     */
+    return migrate_multifd() && migrate_xbzrle() &&
+           migrate_multifd_compression() == MULTIFD_COMPRESSION_NONE &&
+           !migrate_zero_copy_send();
+}
+
+static uint64_t multifd_xbzrle_shard_size(uint64_t cache_size)
+{
+    /* Every shard needs at least one page */
+    return MAX(cache_size / multifd_xbzrle.nr_shards, TARGET_PAGE_SIZE);
+}
+
+static XBZRLECacheShard *multifd_xbzrle_shard(ram_addr_t addr)
+{
+    return &multifd_xbzrle.shards[(addr / MULTIFD_PACKET_SIZE) &
+                                  (multifd_xbzrle.nr_shards - 1)];
+}
+
+int multifd_xbzrle_save_setup(Error **errp)
+{
+    uint64_t cache_pages = migrate_xbzrle_cache_size() / TARGET_PAGE_SIZE;
+    unsigned int i;
+
+    multifd_xbzrle.nr_shards =
+        MIN(pow2ceil(migrate_multifd_channels() * XBZRLE_SHARDS_PER_CHANNEL),
+            cache_pages);
+    multifd_xbzrle.shards = g_new0(XBZRLECacheShard,
+                                   multifd_xbzrle.nr_shards);
+    multifd_xbzrle.started = false;
+    qemu_mutex_init(&multifd_xbzrle.stats_lock);
+    multifd_xbzrle.zero_page = g_malloc0(TARGET_PAGE_SIZE);
+
+    for (i = 0; i < multifd_xbzrle.nr_shards; i++) {
+        qemu_mutex_init(&multifd_xbzrle.shards[i].lock);
+    }
+    for (i = 0; i < multifd_xbzrle.nr_shards; i++) {
+        XBZRLECacheShard *shard = &multifd_xbzrle.shards[i];
+
+        shard->cache =
+            cache_init(multifd_xbzrle_shard_size(migrate_xbzrle_cache_size()),
+                       TARGET_PAGE_SIZE, errp);
+        if (!shard->cache) {
+            return -1;
+        }
+    }
+    trace_multifd_xbzrle_save_setup(multifd_xbzrle.nr_shards);
+    return 0;
+}
+
+void multifd_xbzrle_save_cleanup(void)
+{
+    unsigned int i;
+
+    if (!multifd_xbzrle.shards) {
+        return;
+    }
+    for (i = 0; i < multifd_xbzrle.nr_shards; i++) {
+        XBZRLECacheShard *shard = &multifd_xbzrle.shards[i];
+
+        if (shard->cache) {
+            cache_fini(shard->cache);
+        }
+        qemu_mutex_destroy(&shard->lock);
+    }
+    g_free(multifd_xbzrle.shards);
+    multifd_xbzrle.shards = NULL;
+    multifd_xbzrle.nr_shards = 0;
+    g_free(multifd_xbzrle.zero_page);
+    multifd_xbzrle.zero_page = NULL;
+    qemu_mutex_destroy(&multifd_xbzrle.stats_lock);
+}
+
+void multifd_xbzrle_start(void)
+{
+    qatomic_set(&multifd_xbzrle.started, true);
+}
+
+int multifd_xbzrle_cache_resize(uint64_t new_size, Error **errp)
+{
+    uint64_t shard_size = multifd_xbzrle_shard_size(new_size);
+    unsigned int i;
+
+    if (!multifd_xbzrle.shards) {
+        return 0;
+    }
+    for (i = 0; i < multifd_xbzrle.nr_shards; i++) {
+        XBZRLECacheShard *shard = &multifd_xbzrle.shards[i];
+        PageCache *new_cache = cache_init(shard_size, TARGET_PAGE_SIZE, errp);
+
+        if (!new_cache) {
+            return -1;
+        }
+        WITH_QEMU_LOCK_GUARD(&shard->lock) {
+            cache_fini(shard->cache);
+            shard->cache = new_cache;
+        }
+    }
+    return 0;
+}
+
+/**
+ * multifd_xbzrle_zero_pages: let the cache know about zero pages
+ *
+ * Pages found to be zero by the channel replace their stale version in
+ * the cache, so that a later small write to them gets XBZRLE encoded.
+ *
+ * @p: Params for the channel that we are using
+ */
+void multifd_xbzrle_zero_pages(MultiFDSendParams *p)
+{
+    uint64_t generation = stat64_get(&mig_stats.dirty_sync_count);
+    RAMBlock *block = p->pages->block;
+    int i;
+
+    if (!multifd_xbzrle.shards || !qatomic_read(&multifd_xbzrle.started)) {
+        return;
+    }
+    for (i = 0; i < p->zero_num; i++) {
+        ram_addr_t addr = block->offset + p->zero[i];
+        XBZRLECacheShard *shard = multifd_xbzrle_shard(addr);
+
+        /* We don't care if it fails, as long as it updated an old entry */
+        WITH_QEMU_LOCK_GUARD(&shard->lock) {
+            cache_insert(shard->cache, addr, multifd_xbzrle.zero_page,
+                         generation);
+        }
+    }
+}
+
+/* The nocomp method hands its channels to XBZRLE when it is enabled */
+int multifd_xbzrle_send_setup(MultiFDSendParams *p, Error **errp)
+{
+    XBZRLESendData *x = g_new0(XBZRLESendData, 1);
+
+    x->buf = g_malloc(p->page_count * p->page_size);
+    x->len = g_new0(uint32_t, p->page_count);
+    x->current = g_malloc(p->page_size);
+    p->data = x;
+    return 0;
+}
+
+void multifd_xbzrle_send_cleanup(MultiFDSendParams *p)
+{
+    XBZRLESendData *x = p->data;
+
+    if (x) {
+        g_free(x->buf);
+        g_free(x->len);
+        g_free(x->current);
+        g_free(x);
+        p->data = NULL;
+    }
+}
+
+/**
+ * multifd_xbzrle_send_prepare: encode the pages of a packet
+ *
+ * Follows save_xbzrle_page(): a page that misses the cache is added
+ * to it and sent from the cached copy, a page that hits the cache is
+ * encoded against it, and sent as is if the encoding overflows.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @errp: pointer to an error
+ */
+int multifd_xbzrle_send_prepare(MultiFDSendParams *p, Error **errp)
+{
+    XBZRLESendData *x = p->data;
+    RAMBlock *block = p->pages->block;
+    bool started = qatomic_read(&multifd_xbzrle.started);
+    uint64_t generation = stat64_get(&mig_stats.dirty_sync_count);
+    XBZRLECacheShard *shard = NULL;
+    uint64_t pages = 0, cache_miss = 0, overflow = 0, bytes = 0;
+    uint32_t size = p->normal_num * sizeof(uint32_t);
+    uint8_t *out = x->buf;
+    int i;
+
+    p->iov[p->iovs_num].iov_base = x->len;
+    p->iov[p->iovs_num].iov_len = size;
+    p->iovs_num++;
+
+    for (i = 0; i < p->normal_num; i++) {
+        ram_addr_t addr = block->offset + p->normal[i];
+        uint8_t *host = block->host + p->normal[i];
+        struct iovec *iov = &p->iov[p->iovs_num++];
+        uint8_t *cached;
+        int encoded_len;
+
+        /* Until the first round is over, pages go out as is */
+        iov->iov_base = host;
+        iov->iov_len = p->page_size;
+        if (!started) {
+            goto next;
+        }
+
+        if (shard != multifd_xbzrle_shard(addr)) {
+            if (shard) {
+                qemu_mutex_unlock(&shard->lock);
+            }
+            shard = multifd_xbzrle_shard(addr);
+            qemu_mutex_lock(&shard->lock);
+        }
+
+        if (!cache_is_cached(shard->cache, addr, generation)) {
+            cache_miss++;
+            if (cache_insert(shard->cache, addr, host, generation) == 0) {
+                /* Send what was cached, the guest may change the page */
+                memcpy(out, get_cached_data(shard->cache, addr),
+                       p->page_size);
+                iov->iov_base = out;
+                out += p->page_size;
+            }
+            goto next;
+        }
+
+        pages++;
+        cached = get_cached_data(shard->cache, addr);
+        memcpy(x->current, host, p->page_size);
+        /* One byte short, so that the length tells apart encoded pages */
+        encoded_len = xbzrle_encode_buffer(cached, x->current, p->page_size,
+                                           out, p->page_size - 1);
+        if (encoded_len == 0) {
+            trace_save_xbzrle_page_skipping();
+            iov->iov_len = 0;
+            goto next;
+        }
+
+        memcpy(cached, x->current, p->page_size);
+        if (encoded_len < 0) {
+            trace_save_xbzrle_page_overflow();
+            overflow++;
+            bytes += p->page_size;
+            memcpy(out, x->current, p->page_size);
+        } else {
+            bytes += encoded_len;
+            iov->iov_len = encoded_len;
+        }
+        iov->iov_base = out;
+        out += iov->iov_len;
+
+next:
+        x->len[i] = cpu_to_be32(iov->iov_len);
+        size += iov->iov_len;
+    }
+    if (shard) {
+        qemu_mutex_unlock(&shard->lock);
+    }
+
+    if (started) {
+        WITH_QEMU_LOCK_GUARD(&multifd_xbzrle.stats_lock) {
+            xbzrle_counters.pages += pages;
+            xbzrle_counters.cache_miss += cache_miss;
+            xbzrle_counters.overflow += overflow;
+            xbzrle_counters.bytes += bytes;
+        }
+    }
+
+    p->next_packet_size = size;
+    p->flags |= MULTIFD_FLAG_NOCOMP | MULTIFD_FLAG_XBZRLE;
+    return 0;
+}
+
+/**
+ * multifd_xbzrle_recv_pages: read a packet sent with XBZRLE
+ *
+ * Pages sent as is are read straight into guest memory; encoded pages
+ * are read into a buffer and applied on top of the current contents.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @errp: pointer to an error
+ */
+int multifd_xbzrle_recv_pages(MultiFDRecvParams *p, Error **errp)
+{
+    uint32_t hdr_len = p->normal_num * sizeof(uint32_t);
+    uint32_t data_len = 0;
+    uint32_t iov_num = 0;
+    uint8_t *buf;
+    int i, ret;
+
+    if (!p->xbzrle_buf) {
+        p->xbzrle_buf = g_malloc(p->page_count * p->page_size);
+        p->xbzrle_len = g_new0(uint32_t, p->page_count);
+    }
+
+    ret = qio_channel_read_all(p->c, (void *)p->xbzrle_len, hdr_len, errp);
+    if (ret != 0) {
+        return ret;
+    }
+
+    buf = p->xbzrle_buf;
+    for (i = 0; i < p->normal_num; i++) {
+        uint32_t len = be32_to_cpu(p->xbzrle_len[i]);
+
+        if (len > p->page_size) {
+            error_setg(errp, "multifd %u: invalid xbzrle page size %u",
+                       p->id, len);
+            return -1;
+        }
+        p->xbzrle_len[i] = len;
+        data_len += len;
+        if (!len) {
+            continue;
+        }
+        if (len == p->page_size) {
+            p->iov[iov_num].iov_base = p->host + p->normal[i];
+        } else {
+            p->iov[iov_num].iov_base = buf;
+            buf += len;
+        }
+        p->iov[iov_num].iov_len = len;
+        iov_num++;
+    }
+    if (hdr_len + data_len != p->next_packet_size) {
+        error_setg(errp, "multifd %u: packet size received %u size expected %u",
+                   p->id, p->next_packet_size, hdr_len + data_len);
+        return -1;
+    }
+
+    ret = qio_channel_readv_all(p->c, p->iov, iov_num, errp);
+    if (ret != 0) {
+        return ret;
+    }
+
+    buf = p->xbzrle_buf;
+    for (i = 0; i < p->normal_num; i++) {
+        uint32_t len = p->xbzrle_len[i];
+
+        if (!len || len == p->page_size) {
+            continue;
+        }
+        if (xbzrle_decode_buffer(buf, len, p->host + p->normal[i],
+                                 p->page_size) < 0) {
+            error_setg(errp, "multifd %u: failed to decode xbzrle page "
+                       "at offset " RAM_ADDR_FMT, p->id, p->normal[i]);
+            return -1;
+        }
+        buf += len;
+    }
+    return 0;
+}
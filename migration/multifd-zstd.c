@@ -244,6 +244,7 @@ static int zstd_recv_pages(MultiFDRecvParams *p, Error **errp)
     uint32_t expected_size = p->normal_num * p->page_size;
     uint32_t flags = p->flags & MULTIFD_FLAG_COMPRESSION_MASK;
     struct zstd_data *z = p->data;
+    uint32_t iov_num;
     int ret;
     int i;
 
@@ -262,9 +263,14 @@ static int zstd_recv_pages(MultiFDRecvParams *p, Error **errp)
     z->in.size = in_size;
     z->in.pos = 0;
 
-    for (i = 0; i < p->normal_num; i++) {
-        z->out.dst = p->host + p->normal[i];
-        z->out.size = p->page_size;
+    /*
+     * Decompress each run of host-contiguous pages in one go, straight
+     * into guest memory, instead of page by page.
+     */
+    iov_num = multifd_recv_coalesce_pages(p);
+    for (i = 0; i < iov_num; i++) {
+        z->out.dst = p->iov[i].iov_base;
+        z->out.size = p->iov[i].iov_len;
         z->out.pos = 0;
 
         /*
@@ -273,13 +279,13 @@ static int zstd_recv_pages(MultiFDRecvParams *p, Error **errp)
          * We need to loop while:
          * - return is > 0
          * - there is input available
-         * - we haven't put out a full page
+         * - we haven't filled the whole run
          */
         do {
             ret = ZSTD_decompressStream(z->zds, &z->out, &z->in);
         } while (ret > 0 && (z->in.size - z->in.pos > 0)
-                         && (z->out.pos < p->page_size));
-        if (ret > 0 && (z->out.pos < p->page_size)) {
+                         && (z->out.pos < z->out.size));
+        if (ret > 0 && (z->out.pos < z->out.size)) {
             error_setg(errp, "multifd %u: decompressStream buffer too small",
                        p->id);
             return -1;
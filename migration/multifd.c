@@ -11,6 +11,8 @@
  */
 
 #include "qemu/osdep.h"
+#include "qemu/cutils.h"
+#include "qemu/iov.h"
 #include "qemu/rcu.h"
 #include "exec/target_page.h"
 #include "sysemu/sysemu.h"
@@ -21,6 +23,7 @@
 #include "migration.h"
 #include "migration-stats.h"
 #include "socket.h"
+#include "file.h"
 #include "tls.h"
 #include "qemu-file.h"
 #include "trace.h"
@@ -50,7 +53,8 @@ typedef struct {
 /**
  * nocomp_send_setup: setup send side
  *
- * For no compression this function does nothing.
+ * For no compression this function does nothing, unless the pages are
+ * XBZRLE encoded.
  *
  * Returns 0 for success or -1 for error
  *
@@ -59,6 +63,9 @@ typedef struct {
  */
 static int nocomp_send_setup(MultiFDSendParams *p, Error **errp)
 {
+    if (multifd_xbzrle_enabled()) {
+        return multifd_xbzrle_send_setup(p, errp);
+    }
     return 0;
 }
 
@@ -72,7 +79,7 @@ static int nocomp_send_setup(MultiFDSendParams *p, Error **errp)
  */
 static void nocomp_send_cleanup(MultiFDSendParams *p, Error **errp)
 {
-    return;
+    multifd_xbzrle_send_cleanup(p);
 }
 
 /**
@@ -90,6 +97,10 @@ static int nocomp_send_prepare(MultiFDSendParams *p, Error **errp)
 {
     MultiFDPages_t *pages = p->pages;
 
+    if (p->data) {
+        return multifd_xbzrle_send_prepare(p, errp);
+    }
+
     for (int i = 0; i < p->normal_num; i++) {
         p->iov[p->iovs_num].iov_base = pages->block->host + p->normal[i];
         p->iov[p->iovs_num].iov_len = p->page_size;
@@ -137,6 +148,39 @@ static void nocomp_recv_cleanup(MultiFDRecvParams *p)
  * @p: Params for the channel that we are using
  * @errp: pointer to an error
  */
+/**
+ * multifd_recv_coalesce_pages: describe the normal pages of a packet
+ *
+ * Fills p->iov with the guest memory that the normal pages of the
+ * packet land in, merging pages that are adjacent both in the packet
+ * and in host memory.  The sender queues pages in address order, so
+ * most packets collapse into a handful of large runs, which lets the
+ * payload be read or decompressed straight into guest RAM in few
+ * large operations.
+ *
+ * Returns the number of entries of p->iov in use.
+ *
+ * @p: Params for the channel that we are using
+ */
+uint32_t multifd_recv_coalesce_pages(MultiFDRecvParams *p)
+{
+    uint32_t n = 0;
+
+    for (int i = 0; i < p->normal_num; i++) {
+        uint8_t *addr = p->host + p->normal[i];
+
+        if (n && (uint8_t *)p->iov[n - 1].iov_base +
+                 p->iov[n - 1].iov_len == addr) {
+            p->iov[n - 1].iov_len += p->page_size;
+        } else {
+            p->iov[n].iov_base = addr;
+            p->iov[n].iov_len = p->page_size;
+            n++;
+        }
+    }
+    return n;
+}
+
 static int nocomp_recv_pages(MultiFDRecvParams *p, Error **errp)
 {
     uint32_t flags = p->flags & MULTIFD_FLAG_COMPRESSION_MASK;
@@ -146,11 +190,11 @@ static int nocomp_recv_pages(MultiFDRecvParams *p, Error **errp)
                    p->id, flags, MULTIFD_FLAG_NOCOMP);
         return -1;
     }
-    for (int i = 0; i < p->normal_num; i++) {
-        p->iov[i].iov_base = p->host + p->normal[i];
-        p->iov[i].iov_len = p->page_size;
+    if (p->flags & MULTIFD_FLAG_XBZRLE) {
+        return multifd_xbzrle_recv_pages(p, errp);
     }
-    return qio_channel_readv_all(p->c, p->iov, p->normal_num, errp);
+    return qio_channel_readv_all(p->c, p->iov,
+                                 multifd_recv_coalesce_pages(p), errp);
 }
 
 static MultiFDMethods multifd_nocomp_ops = {
@@ -266,6 +310,7 @@ static void multifd_send_fill_packet(MultiFDSendParams *p)
     packet->flags = cpu_to_be32(p->flags);
     packet->pages_alloc = cpu_to_be32(p->pages->allocated);
     packet->normal_pages = cpu_to_be32(p->normal_num);
+    packet->zero_pages = cpu_to_be32(p->zero_num);
     packet->next_packet_size = cpu_to_be32(p->next_packet_size);
     packet->packet_num = cpu_to_be64(p->packet_num);
 
@@ -279,6 +324,11 @@ static void multifd_send_fill_packet(MultiFDSendParams *p)
 
         packet->offset[i] = cpu_to_be64(temp);
     }
+    for (i = 0; i < p->zero_num; i++) {
+        uint64_t temp = p->zero[i];
+
+        packet->offset[p->normal_num + i] = cpu_to_be64(temp);
+    }
 }
 
 static int multifd_recv_unfill_packet(MultiFDRecvParams *p, Error **errp)
@@ -324,10 +374,18 @@ static int multifd_recv_unfill_packet(MultiFDRecvParams *p, Error **errp)
         return -1;
     }
 
+    p->zero_num = be32_to_cpu(packet->zero_pages);
+    if (p->zero_num > packet->pages_alloc - p->normal_num) {
+        error_setg(errp, "multifd: received packet "
+                   "with %u zero pages and expected maximum zero pages are %u",
+                   p->zero_num, packet->pages_alloc - p->normal_num) ;
+        return -1;
+    }
+
     p->next_packet_size = be32_to_cpu(packet->next_packet_size);
     p->packet_num = be64_to_cpu(packet->packet_num);
 
-    if (p->normal_num == 0) {
+    if (p->normal_num == 0 && p->zero_num == 0) {
         return 0;
     }
 
@@ -353,9 +411,74 @@ static int multifd_recv_unfill_packet(MultiFDRecvParams *p, Error **errp)
         p->normal[i] = offset;
     }
 
+    for (i = 0; i < p->zero_num; i++) {
+        uint64_t offset = be64_to_cpu(packet->offset[p->normal_num + i]);
+
+        if (offset > (p->block->used_length - p->page_size)) {
+            error_setg(errp, "multifd: offset too long %" PRIu64
+                       " (max " RAM_ADDR_FMT ")",
+                       offset, p->block->used_length);
+            return -1;
+        }
+        p->zero[i] = offset;
+    }
+
     return 0;
 }
 
+/**
+ * multifd_send_zero_page_detect: split the pages in normal and zero pages
+ *
+ * Zero pages are only listed in the packet header, so that the main
+ * migration thread does not have to scan them.  Without the multifd zero
+ * page detection mode every page is sent as a normal page, either because
+ * detection is disabled or because the migration thread already did it.
+ *
+ * @p: Params for the channel that we are using
+ */
+static void multifd_send_zero_page_detect(MultiFDSendParams *p)
+{
+    MultiFDPages_t *pages = p->pages;
+    bool detect = migrate_zero_page_detection() == ZERO_PAGE_DETECTION_MULTIFD;
+
+    p->normal_num = 0;
+    p->zero_num = 0;
+
+    for (int i = 0; i < pages->num; i++) {
+        ram_addr_t offset = pages->offset[i];
+
+        if (detect && buffer_is_zero(pages->block->host + offset,
+                                     p->page_size)) {
+            p->zero[p->zero_num++] = offset;
+        } else {
+            p->normal[p->normal_num++] = offset;
+        }
+    }
+}
+
+/**
+ * multifd_recv_zero_page_process: fill in the zero pages of a packet
+ *
+ * Pages that were never received are still zero on the destination, so
+ * they are not touched at all; this avoids faulting in memory for them.
+ *
+ * @p: Params for the channel that we are using
+ */
+static void multifd_recv_zero_page_process(MultiFDRecvParams *p)
+{
+    for (int i = 0; i < p->zero_num; i++) {
+        void *page = p->host + p->zero[i];
+
+        if (ramblock_recv_bitmap_test_byte_offset(p->block, p->zero[i])) {
+            if (!buffer_is_zero(page, p->page_size)) {
+                memset(page, 0, p->page_size);
+            }
+        } else {
+            ramblock_recv_bitmap_set(p->block, page);
+        }
+    }
+}
+
 struct {
     MultiFDSendParams *params;
     /* array of pages to sent */
@@ -532,7 +655,11 @@ void multifd_save_cleanup(void)
         if (p->registered_yank) {
             migration_ioc_unregister_yank(p->c);
         }
-        socket_send_channel_destroy(p->c);
+        if (migrate_mapped_ram()) {
+            object_unref(OBJECT(p->c));
+        } else {
+            socket_send_channel_destroy(p->c);
+        }
         p->c = NULL;
         qemu_mutex_destroy(&p->mutex);
         qemu_sem_destroy(&p->sem);
@@ -548,12 +675,15 @@ void multifd_save_cleanup(void)
         p->iov = NULL;
         g_free(p->normal);
         p->normal = NULL;
+        g_free(p->zero);
+        p->zero = NULL;
         multifd_send_state->ops->send_cleanup(p, &local_err);
         if (local_err) {
             migrate_set_error(migrate_get_current(), local_err);
             error_free(local_err);
         }
     }
+    multifd_xbzrle_save_cleanup();
     qemu_sem_destroy(&multifd_send_state->channels_ready);
     g_free(multifd_send_state->params);
     multifd_send_state->params = NULL;
@@ -643,6 +773,79 @@ int multifd_send_sync_main(QEMUFile *f)
     return 0;
 }
 
+/**
+ * multifd_file_write_pages: store the pages of a packet in a mapped-ram file
+ *
+ * With mapped-ram there are no packets on the wire.  Each normal page is
+ * written at its fixed location in the file, merging contiguous pages
+ * into a single pwritev, and the file bitmap records which pages are
+ * present.  Zero pages are dropped from the bitmap, so they read back as
+ * zero on the destination.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @block: RAMBlock that the pages belong to
+ * @errp: pointer to an error
+ */
+static int multifd_file_write_pages(MultiFDSendParams *p, RAMBlock *block,
+                                    Error **errp)
+{
+    uint32_t i = 0;
+
+    while (i < p->normal_num) {
+        ram_addr_t start = p->normal[i];
+        struct iovec *iov = &p->iov[i];
+        unsigned int niov;
+        uint32_t n = 1;
+        off_t offset;
+
+        while (i + n < p->normal_num &&
+               p->normal[i + n] == start + n * p->page_size) {
+            n++;
+        }
+
+        offset = block->pages_offset + start;
+        niov = n;
+        while (niov) {
+            ssize_t ret = qio_channel_pwritev(p->c, iov, niov, offset, errp);
+            if (ret <= 0) {
+                if (ret == 0) {
+                    error_setg(errp, "multifd %u: short write to file", p->id);
+                }
+                return -1;
+            }
+            offset += ret;
+            iov_discard_front(&iov, &niov, ret);
+        }
+
+        for (; n; n--, i++) {
+            set_bit_atomic(p->normal[i] / p->page_size, block->file_bmap);
+        }
+    }
+
+    for (i = 0; i < p->zero_num; i++) {
+        ram_addr_t start = p->zero[i];
+
+        /* Overwrite a stale copy so the file stays an image of the block */
+        if (test_bit(start / p->page_size, block->file_bmap)) {
+            ssize_t ret = qio_channel_pwrite(p->c, (char *)block->host + start,
+                                             p->page_size,
+                                             block->pages_offset + start,
+                                             errp);
+            if (ret != p->page_size) {
+                if (ret >= 0) {
+                    error_setg(errp, "multifd %u: short write to file", p->id);
+                }
+                return -1;
+            }
+        }
+        clear_bit_atomic(start / p->page_size, block->file_bmap);
+    }
+
+    return 0;
+}
+
 static void *multifd_send_thread(void *opaque)
 {
     MultiFDSendParams *p = opaque;
@@ -650,18 +853,22 @@ static void *multifd_send_thread(void *opaque)
     Error *local_err = NULL;
     int ret = 0;
     bool use_zero_copy_send = migrate_zero_copy_send();
+    bool use_mapped_ram = migrate_mapped_ram();
 
     thread = migration_threads_add(p->name, qemu_get_thread_id());
 
     trace_multifd_send_thread_start(p->id);
     rcu_register_thread();
 
-    if (multifd_send_initial_packet(p, &local_err) < 0) {
-        ret = -1;
-        goto out;
+    /* A mapped-ram file only contains the pages, at fixed offsets */
+    if (!use_mapped_ram) {
+        if (multifd_send_initial_packet(p, &local_err) < 0) {
+            ret = -1;
+            goto out;
+        }
+        /* initial packet */
+        p->num_packets = 1;
     }
-    /* initial packet */
-    p->num_packets = 1;
 
     while (true) {
         qemu_sem_post(&multifd_send_state->channels_ready);
@@ -674,18 +881,18 @@ static void *multifd_send_thread(void *opaque)
 
         if (p->pending_job) {
             uint64_t packet_num = p->packet_num;
+            RAMBlock *block = p->pages->block;
             uint32_t flags;
-            p->normal_num = 0;
 
-            if (use_zero_copy_send) {
+            if (use_zero_copy_send || use_mapped_ram) {
                 p->iovs_num = 0;
             } else {
                 p->iovs_num = 1;
             }
 
-            for (int i = 0; i < p->pages->num; i++) {
-                p->normal[p->normal_num] = p->pages->offset[i];
-                p->normal_num++;
+            multifd_send_zero_page_detect(p);
+            if (p->zero_num && multifd_xbzrle_enabled()) {
+                multifd_xbzrle_zero_pages(p);
             }
 
             if (p->normal_num) {
@@ -700,14 +907,23 @@ static void *multifd_send_thread(void *opaque)
             p->flags = 0;
             p->num_packets++;
             p->total_normal_pages += p->normal_num;
+            p->total_zero_pages += p->zero_num;
             p->pages->num = 0;
             p->pages->block = NULL;
             qemu_mutex_unlock(&p->mutex);
 
-            trace_multifd_send(p->id, packet_num, p->normal_num, flags,
-                               p->next_packet_size);
+            stat64_add(&mig_stats.normal_pages, p->normal_num);
+            stat64_add(&mig_stats.zero_pages, p->zero_num);
+
+            trace_multifd_send(p->id, packet_num, p->normal_num, p->zero_num,
+                               flags, p->next_packet_size);
 
-            if (use_zero_copy_send) {
+            if (use_mapped_ram) {
+                ret = multifd_file_write_pages(p, block, &local_err);
+                if (ret != 0) {
+                    break;
+                }
+            } else if (use_zero_copy_send) {
                 /* Send header first, without zerocopy */
                 ret = qio_channel_write_all(p->c, (void *)p->packet,
                                             p->packet_len, &local_err);
@@ -722,10 +938,13 @@ static void *multifd_send_thread(void *opaque)
                 p->iov[0].iov_base = p->packet;
             }
 
-            ret = qio_channel_writev_full_all(p->c, p->iov, p->iovs_num, NULL,
-                                              0, p->write_flags, &local_err);
-            if (ret != 0) {
-                break;
+            if (!use_mapped_ram) {
+                ret = qio_channel_writev_full_all(p->c, p->iov, p->iovs_num,
+                                                  NULL, 0, p->write_flags,
+                                                  &local_err);
+                if (ret != 0) {
+                    break;
+                }
             }
 
             stat64_add(&mig_stats.multifd_bytes, p->next_packet_size);
@@ -768,7 +987,8 @@ out:
 
     rcu_unregister_thread();
     migration_threads_remove(thread);
-    trace_multifd_send_thread_end(p->id, p->num_packets, p->total_normal_pages);
+    trace_multifd_send_thread_end(p->id, p->num_packets, p->total_normal_pages,
+                                  p->total_zero_pages);
 
     return NULL;
 }
@@ -939,9 +1159,13 @@ int multifd_save_setup(Error **errp)
         p->packet->magic = cpu_to_be32(MULTIFD_MAGIC);
         p->packet->version = cpu_to_be32(MULTIFD_VERSION);
         p->name = g_strdup_printf("multifdsend_%d", i);
-        /* We need one extra place for the packet header */
-        p->iov = g_new0(struct iovec, page_count + 1);
+        /*
+         * We need one extra place for the packet header, and one for the
+         * header that some compression methods put before the pages.
+         */
+        p->iov = g_new0(struct iovec, page_count + 2);
         p->normal = g_new0(ram_addr_t, page_count);
+        p->zero = g_new0(ram_addr_t, page_count);
         p->page_size = qemu_target_page_size();
         p->page_count = page_count;
 
@@ -951,7 +1175,15 @@ int multifd_save_setup(Error **errp)
             p->write_flags = 0;
         }
 
-        socket_send_channel_create(multifd_new_send_channel_async, p);
+        if (migrate_mapped_ram()) {
+            file_send_channel_create(multifd_new_send_channel_async, p);
+        } else {
+            socket_send_channel_create(multifd_new_send_channel_async, p);
+        }
+    }
+
+    if (multifd_xbzrle_enabled() && multifd_xbzrle_save_setup(errp)) {
+        return -1;
     }
 
     for (i = 0; i < thread_count; i++) {
@@ -1014,9 +1246,18 @@ static void multifd_recv_terminate_threads(Error *err)
     }
 }
 
+/*
+ * A mapped-ram file is loaded directly by the main thread with positioned
+ * reads, so the receiving side has no multifd channels.
+ */
+static bool multifd_recv_enabled(void)
+{
+    return migrate_multifd() && !migrate_mapped_ram();
+}
+
 void multifd_load_shutdown(void)
 {
-    if (migrate_multifd()) {
+    if (multifd_recv_enabled()) {
         multifd_recv_terminate_threads(NULL);
     }
 }
@@ -1025,7 +1266,7 @@ void multifd_load_cleanup(void)
 {
     int i;
 
-    if (!migrate_multifd()) {
+    if (!multifd_recv_enabled()) {
         return;
     }
     multifd_recv_terminate_threads(NULL);
@@ -1059,6 +1300,12 @@ void multifd_load_cleanup(void)
         p->iov = NULL;
         g_free(p->normal);
         p->normal = NULL;
+        g_free(p->zero);
+        p->zero = NULL;
+        g_free(p->xbzrle_buf);
+        p->xbzrle_buf = NULL;
+        g_free(p->xbzrle_len);
+        p->xbzrle_len = NULL;
         multifd_recv_state->ops->recv_cleanup(p);
     }
     qemu_sem_destroy(&multifd_recv_state->sem_sync);
@@ -1072,7 +1319,7 @@ void multifd_recv_sync_main(void)
 {
     int i;
 
-    if (!migrate_multifd()) {
+    if (!multifd_recv_enabled()) {
         return;
     }
     for (i = 0; i < migrate_multifd_channels(); i++) {
@@ -1127,10 +1374,11 @@ static void *multifd_recv_thread(void *opaque)
         flags = p->flags;
         /* recv methods don't know how to handle the SYNC flag */
         p->flags &= ~MULTIFD_FLAG_SYNC;
-        trace_multifd_recv(p->id, p->packet_num, p->normal_num, flags,
-                           p->next_packet_size);
+        trace_multifd_recv(p->id, p->packet_num, p->normal_num, p->zero_num,
+                           flags, p->next_packet_size);
         p->num_packets++;
         p->total_normal_pages += p->normal_num;
+        p->total_zero_pages += p->zero_num;
         qemu_mutex_unlock(&p->mutex);
 
         if (p->normal_num) {
@@ -1138,6 +1386,13 @@ static void *multifd_recv_thread(void *opaque)
             if (ret != 0) {
                 break;
             }
+            for (int i = 0; i < p->normal_num; i++) {
+                ramblock_recv_bitmap_set(p->block, p->host + p->normal[i]);
+            }
+        }
+
+        if (p->zero_num) {
+            multifd_recv_zero_page_process(p);
         }
 
         if (flags & MULTIFD_FLAG_SYNC) {
@@ -1155,7 +1410,8 @@ static void *multifd_recv_thread(void *opaque)
     qemu_mutex_unlock(&p->mutex);
 
     rcu_unregister_thread();
-    trace_multifd_recv_thread_end(p->id, p->num_packets, p->total_normal_pages);
+    trace_multifd_recv_thread_end(p->id, p->num_packets, p->total_normal_pages,
+                                  p->total_zero_pages);
 
     return NULL;
 }
@@ -1170,7 +1426,7 @@ int multifd_load_setup(Error **errp)
      * Return successfully if multiFD recv state is already initialised
      * or multiFD is not enabled.
      */
-    if (multifd_recv_state || !migrate_multifd()) {
+    if (multifd_recv_state || !multifd_recv_enabled()) {
         return 0;
     }
 
@@ -1194,6 +1450,7 @@ int multifd_load_setup(Error **errp)
         p->name = g_strdup_printf("multifdrecv_%d", i);
         p->iov = g_new0(struct iovec, page_count);
         p->normal = g_new0(ram_addr_t, page_count);
+        p->zero = g_new0(ram_addr_t, page_count);
         p->page_count = page_count;
         p->page_size = qemu_target_page_size();
     }
@@ -1216,7 +1473,7 @@ bool multifd_recv_all_channels_created(void)
 {
     int thread_count = migrate_multifd_channels();
 
-    if (!migrate_multifd()) {
+    if (!multifd_recv_enabled()) {
         return true;
     }
 
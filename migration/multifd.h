@@ -33,6 +33,10 @@ int multifd_queue_page(QEMUFile *f, RAMBlock *block, ram_addr_t offset);
 #define MULTIFD_FLAG_NOCOMP (0 << 1)
 #define MULTIFD_FLAG_ZLIB (1 << 1)
 #define MULTIFD_FLAG_ZSTD (2 << 1)
+#define MULTIFD_FLAG_QPL (3 << 1)
+
+/* The pages of the packet are XBZRLE encoded, see multifd-xbzrle.c */
+#define MULTIFD_FLAG_XBZRLE (1 << 4)
 
 /* This value needs to be a multiple of qemu_target_page_size() */
 #define MULTIFD_PACKET_SIZE (512 * 1024)
@@ -48,8 +52,15 @@ typedef struct {
     /* size of the next packet that contains pages */
     uint32_t next_packet_size;
     uint64_t packet_num;
-    uint64_t unused[4];    /* Reserved for future use */
+    /* zero pages */
+    uint32_t zero_pages;
+    uint32_t unused32[1];    /* Reserved for future use */
+    uint64_t unused64[3];    /* Reserved for future use */
     char ramblock[256];
+    /*
+     * This array contains the offsets of the normal pages followed by
+     * the offsets of the zero pages.
+     */
     uint64_t offset[];
 } __attribute__((packed)) MultiFDPacket_t;
 
@@ -122,6 +133,8 @@ typedef struct {
     uint64_t num_packets;
     /* non zero pages sent through this channel */
     uint64_t total_normal_pages;
+    /* zero pages sent through this channel */
+    uint64_t total_zero_pages;
     /* buffers to send */
     struct iovec *iov;
     /* number of iovs used */
@@ -130,6 +143,10 @@ typedef struct {
     ram_addr_t *normal;
     /* num of non zero pages */
     uint32_t normal_num;
+    /* Pages that are zero */
+    ram_addr_t *zero;
+    /* num of zero pages */
+    uint32_t zero_num;
     /* used for compression methods */
     void *data;
 }  MultiFDSendParams;
@@ -181,14 +198,23 @@ typedef struct {
     uint8_t *host;
     /* non zero pages recv through this channel */
     uint64_t total_normal_pages;
+    /* zero pages recv through this channel */
+    uint64_t total_zero_pages;
     /* buffers to recv */
     struct iovec *iov;
     /* Pages that are not zero */
     ram_addr_t *normal;
     /* num of non zero pages */
     uint32_t normal_num;
+    /* Pages that are zero */
+    ram_addr_t *zero;
+    /* num of zero pages */
+    uint32_t zero_num;
     /* used for de-compression methods */
     void *data;
+    /* XBZRLE encoded data and page lengths, allocated on first use */
+    uint8_t *xbzrle_buf;
+    uint32_t *xbzrle_len;
 } MultiFDRecvParams;
 
 typedef struct {
@@ -207,6 +233,18 @@ typedef struct {
 } MultiFDMethods;
 
 void multifd_register_ops(int method, MultiFDMethods *ops);
+uint32_t multifd_recv_coalesce_pages(MultiFDRecvParams *p);
+
+bool multifd_xbzrle_enabled(void);
+int multifd_xbzrle_save_setup(Error **errp);
+void multifd_xbzrle_save_cleanup(void);
+void multifd_xbzrle_start(void);
+int multifd_xbzrle_cache_resize(uint64_t new_size, Error **errp);
+void multifd_xbzrle_zero_pages(MultiFDSendParams *p);
+int multifd_xbzrle_send_setup(MultiFDSendParams *p, Error **errp);
+void multifd_xbzrle_send_cleanup(MultiFDSendParams *p);
+int multifd_xbzrle_send_prepare(MultiFDSendParams *p, Error **errp);
+int multifd_xbzrle_recv_pages(MultiFDRecvParams *p, Error **errp);
 
 #endif
 
@@ -63,6 +63,7 @@
 #define DEFAULT_MIGRATE_MULTIFD_ZLIB_LEVEL 1
 /* 0: means nocompress, 1: best speed, ... 20: best compress ratio */
 #define DEFAULT_MIGRATE_MULTIFD_ZSTD_LEVEL 1
+#define DEFAULT_MIGRATE_ZERO_PAGE_DETECTION ZERO_PAGE_DETECTION_MULTIFD
 
 /* Background transfer rate for postcopy, 0 means unlimited, note
  * that page requests can still exceed this limit.
@@ -83,6 +84,7 @@
 
 #define DEFAULT_MIGRATE_VCPU_DIRTY_LIMIT_PERIOD     1000    /* milliseconds */
 #define DEFAULT_MIGRATE_VCPU_DIRTY_LIMIT            1       /* MB/s */
+#define DEFAULT_MIGRATE_VCPU_DIRTY_LIMIT_GAIN       100     /* percent */
 
 Property migration_properties[] = {
     DEFINE_PROP_BOOL("store-global-state", MigrationState,
@@ -97,6 +99,8 @@ Property migration_properties[] = {
                       multifd_flush_after_each_section, false),
     DEFINE_PROP_UINT8("x-clear-bitmap-shift", MigrationState,
                       clear_bitmap_shift, CLEAR_BITMAP_SHIFT_DEFAULT),
+    DEFINE_PROP_UINT8("x-dirty-sync-threads", MigrationState,
+                      dirty_sync_threads, DIRTY_SYNC_THREADS_DEFAULT),
     DEFINE_PROP_BOOL("x-preempt-pre-7-2", MigrationState,
                      preempt_pre_7_2, false),
 
@@ -173,6 +177,12 @@ Property migration_properties[] = {
     DEFINE_PROP_UINT64("vcpu-dirty-limit", MigrationState,
                        parameters.vcpu_dirty_limit,
                        DEFAULT_MIGRATE_VCPU_DIRTY_LIMIT),
+    DEFINE_PROP_UINT8("x-vcpu-dirty-limit-gain", MigrationState,
+                      parameters.x_vcpu_dirty_limit_gain,
+                      DEFAULT_MIGRATE_VCPU_DIRTY_LIMIT_GAIN),
+    DEFINE_PROP_ZERO_PAGE_DETECTION("zero-page-detection", MigrationState,
+                       parameters.zero_page_detection,
+                       DEFAULT_MIGRATE_ZERO_PAGE_DETECTION),
 
     /* Migration capabilities */
     DEFINE_PROP_MIG_CAP("x-xbzrle", MIGRATION_CAPABILITY_XBZRLE),
@@ -198,6 +208,12 @@ Property migration_properties[] = {
     DEFINE_PROP_MIG_CAP("x-switchover-ack",
                         MIGRATION_CAPABILITY_SWITCHOVER_ACK),
     DEFINE_PROP_MIG_CAP("x-dirty-limit", MIGRATION_CAPABILITY_DIRTY_LIMIT),
+    DEFINE_PROP_MIG_CAP("x-mapped-ram", MIGRATION_CAPABILITY_MAPPED_RAM),
+    DEFINE_PROP_MIG_CAP("x-lazy-ram", MIGRATION_CAPABILITY_LAZY_RAM),
+    DEFINE_PROP_MIG_CAP("x-parallel-device-state",
+                        MIGRATION_CAPABILITY_PARALLEL_DEVICE_STATE),
+    DEFINE_PROP_MIG_CAP("x-colo-vmstate-delta",
+                        MIGRATION_CAPABILITY_COLO_VMSTATE_DELTA),
     DEFINE_PROP_END_OF_LIST(),
 };
 
@@ -229,6 +245,13 @@ bool migrate_colo(void)
     return s->capabilities[MIGRATION_CAPABILITY_X_COLO];
 }
 
+bool migrate_colo_vmstate_delta(void)
+{
+    MigrationState *s = migrate_get_current();
+
+    return s->capabilities[MIGRATION_CAPABILITY_COLO_VMSTATE_DELTA];
+}
+
 bool migrate_compress(void)
 {
     MigrationState *s = migrate_get_current();
@@ -250,6 +273,20 @@ bool migrate_dirty_limit(void)
     return s->capabilities[MIGRATION_CAPABILITY_DIRTY_LIMIT];
 }
 
+bool migrate_mapped_ram(void)
+{
+    MigrationState *s = migrate_get_current();
+
+    return s->capabilities[MIGRATION_CAPABILITY_MAPPED_RAM];
+}
+
+bool migrate_lazy_ram(void)
+{
+    MigrationState *s = migrate_get_current();
+
+    return s->capabilities[MIGRATION_CAPABILITY_LAZY_RAM];
+}
+
 bool migrate_events(void)
 {
     MigrationState *s = migrate_get_current();
@@ -278,6 +315,13 @@ bool migrate_multifd(void)
     return s->capabilities[MIGRATION_CAPABILITY_MULTIFD];
 }
 
+bool migrate_parallel_device_state(void)
+{
+    MigrationState *s = migrate_get_current();
+
+    return s->capabilities[MIGRATION_CAPABILITY_PARALLEL_DEVICE_STATE];
+}
+
 bool migrate_pause_before_switchover(void)
 {
     MigrationState *s = migrate_get_current();
@@ -609,6 +653,46 @@ bool migrate_caps_check(bool *old_caps, bool *new_caps, Error **errp)
         }
     }
 
+    if (new_caps[MIGRATION_CAPABILITY_COLO_VMSTATE_DELTA] &&
+        !new_caps[MIGRATION_CAPABILITY_X_COLO]) {
+        error_setg(errp, "Capability 'colo-vmstate-delta' requires "
+                   "capability 'x-colo'");
+        return false;
+    }
+
+    if (new_caps[MIGRATION_CAPABILITY_LAZY_RAM] &&
+        !new_caps[MIGRATION_CAPABILITY_MAPPED_RAM]) {
+        error_setg(errp, "Capability 'lazy-ram' requires capability "
+                   "'mapped-ram'");
+        return false;
+    }
+
+    if (new_caps[MIGRATION_CAPABILITY_MAPPED_RAM]) {
+        /*
+         * Pages are stored once at a fixed place in the file, so anything
+         * that encodes them differently or relies on a live destination
+         * does not fit.
+         */
+        if (new_caps[MIGRATION_CAPABILITY_XBZRLE] ||
+            new_caps[MIGRATION_CAPABILITY_COMPRESS] ||
+            new_caps[MIGRATION_CAPABILITY_POSTCOPY_RAM] ||
+            new_caps[MIGRATION_CAPABILITY_ZERO_COPY_SEND] ||
+            new_caps[MIGRATION_CAPABILITY_BACKGROUND_SNAPSHOT] ||
+            new_caps[MIGRATION_CAPABILITY_X_COLO]) {
+            error_setg(errp, "Mapped-ram migration is incompatible with "
+                       "xbzrle, compress, postcopy-ram, zero-copy-send, "
+                       "background-snapshot and x-colo");
+            return false;
+        }
+
+        if (new_caps[MIGRATION_CAPABILITY_MULTIFD] &&
+            migrate_multifd_compression()) {
+            error_setg(errp, "Mapped-ram migration does not support "
+                       "multifd compression");
+            return false;
+        }
+    }
+
     return true;
 }
 
@@ -802,6 +886,13 @@ MultiFDCompression migrate_multifd_compression(void)
     return s->parameters.multifd_compression;
 }
 
+ZeroPageDetection migrate_zero_page_detection(void)
+{
+    MigrationState *s = migrate_get_current();
+
+    return s->parameters.zero_page_detection;
+}
+
 int migrate_multifd_zlib_level(void)
 {
     MigrationState *s = migrate_get_current();
@@ -957,6 +1048,10 @@ MigrationParameters *qmp_query_migrate_parameters(Error **errp)
     params->x_vcpu_dirty_limit_period = s->parameters.x_vcpu_dirty_limit_period;
     params->has_vcpu_dirty_limit = true;
     params->vcpu_dirty_limit = s->parameters.vcpu_dirty_limit;
+    params->has_x_vcpu_dirty_limit_gain = true;
+    params->x_vcpu_dirty_limit_gain = s->parameters.x_vcpu_dirty_limit_gain;
+    params->has_zero_page_detection = true;
+    params->zero_page_detection = s->parameters.zero_page_detection;
 
     return params;
 }
@@ -992,6 +1087,8 @@ void migrate_params_init(MigrationParameters *params)
     params->has_announce_step = true;
     params->has_x_vcpu_dirty_limit_period = true;
     params->has_vcpu_dirty_limit = true;
+    params->has_x_vcpu_dirty_limit_gain = true;
+    params->has_zero_page_detection = true;
 }
 
 /*
@@ -1152,6 +1249,13 @@ bool migrate_params_check(MigrationParameters *params, Error **errp)
     }
 #endif
 
+    if (migrate_mapped_ram() &&
+        params->has_multifd_compression && params->multifd_compression) {
+        error_setg(errp, "Mapped-ram migration does not support "
+                   "multifd compression");
+        return false;
+    }
+
     if (params->has_x_vcpu_dirty_limit_period &&
         (params->x_vcpu_dirty_limit_period < 1 ||
          params->x_vcpu_dirty_limit_period > 1000)) {
@@ -1169,6 +1273,15 @@ bool migrate_params_check(MigrationParameters *params, Error **errp)
         return false;
     }
 
+    if (params->has_x_vcpu_dirty_limit_gain &&
+        (params->x_vcpu_dirty_limit_gain < 1 ||
+         params->x_vcpu_dirty_limit_gain > 200)) {
+        error_setg(errp, QERR_INVALID_PARAMETER_VALUE,
+                   "x-vcpu-dirty-limit-gain",
+                   "a value between 1 and 200");
+        return false;
+    }
+
     return true;
 }
 
@@ -1276,6 +1389,14 @@ static void migrate_params_test_apply(MigrateSetParameters *params,
     if (params->has_vcpu_dirty_limit) {
         dest->vcpu_dirty_limit = params->vcpu_dirty_limit;
     }
+
+    if (params->has_x_vcpu_dirty_limit_gain) {
+        dest->x_vcpu_dirty_limit_gain = params->x_vcpu_dirty_limit_gain;
+    }
+
+    if (params->has_zero_page_detection) {
+        dest->zero_page_detection = params->zero_page_detection;
+    }
 }
 
 static void migrate_params_apply(MigrateSetParameters *params, Error **errp)
@@ -1402,6 +1523,15 @@ static void migrate_params_apply(MigrateSetParameters *params, Error **errp)
     if (params->has_vcpu_dirty_limit) {
         s->parameters.vcpu_dirty_limit = params->vcpu_dirty_limit;
     }
+
+    if (params->has_x_vcpu_dirty_limit_gain) {
+        s->parameters.x_vcpu_dirty_limit_gain =
+            params->x_vcpu_dirty_limit_gain;
+    }
+
+    if (params->has_zero_page_detection) {
+        s->parameters.zero_page_detection = params->zero_page_detection;
+    }
 }
 
 void qmp_migrate_set_parameters(MigrateSetParameters *params, Error **errp)
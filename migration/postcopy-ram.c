@@ -188,6 +188,21 @@ void fill_destination_postcopy_migration_info(MigrationInfo *info)
 {
     MigrationIncomingState *mis = migration_incoming_get_current();
     PostcopyBlocktimeContext *bc = mis->blocktime_ctx;
+    int i, last = -1;
+
+    WITH_QEMU_LOCK_GUARD(&mis->page_request_mutex) {
+        for (i = 0; i < POSTCOPY_LATENCY_BUCKETS; i++) {
+            if (mis->postcopy_latency_dist[i]) {
+                last = i;
+            }
+        }
+        /* Report the buckets up to the last non-empty one */
+        for (i = last; i >= 0; i--) {
+            QAPI_LIST_PREPEND(info->postcopy_latency_dist,
+                              mis->postcopy_latency_dist[i]);
+        }
+        info->has_postcopy_latency_dist = last >= 0;
+    }
 
     if (!bc) {
         return;
@@ -759,7 +774,39 @@ static int postcopy_request_page(MigrationIncomingState *mis, RAMBlock *rb,
         return received ? 0 : postcopy_place_page_zero(mis, aligned, rb);
     }
 
-    return migrate_send_rp_req_pages(mis, rb, start, haddr);
+    return migrate_send_rp_req_pages(mis, rb, start, haddr,
+                                     qemu_ram_pagesize(rb));
+}
+
+/*
+ * Request a range of host pages; each page of a range that meets a
+ * discarded page is requested on its own.
+ */
+static int postcopy_request_pages(MigrationIncomingState *mis, RAMBlock *rb,
+                                  ram_addr_t start, uint64_t haddr, size_t len)
+{
+    size_t pagesize = qemu_ram_pagesize(rb);
+    uint64_t aligned = ROUND_DOWN(haddr, pagesize);
+    size_t offset;
+    int ret;
+
+    for (offset = 0; offset < len; offset += pagesize) {
+        if (ramblock_page_is_discarded(rb, start + offset)) {
+            break;
+        }
+    }
+    if (offset >= len) {
+        return migrate_send_rp_req_pages(mis, rb, start, haddr, len);
+    }
+
+    for (offset = 0; offset < len; offset += pagesize) {
+        ret = postcopy_request_page(mis, rb, start + offset,
+                                    offset ? aligned + offset : haddr);
+        if (ret) {
+            return ret;
+        }
+    }
+    return 0;
 }
 
 /*
@@ -937,14 +984,82 @@ static void postcopy_pause_fault_thread(MigrationIncomingState *mis)
     trace_postcopy_pause_fault_thread_continued();
 }
 
+/* Maximum number of faults read from the userfaultfd in one go */
+#define POSTCOPY_FAULT_BATCH 32
+
+typedef struct PostcopyFault {
+    RAMBlock *rb;
+    /* Offset of the faulting host page in the RAMBlock */
+    ram_addr_t offset;
+    /* Faulting address */
+    uint64_t haddr;
+} PostcopyFault;
+
+static int postcopy_fault_cmp(const void *a, const void *b)
+{
+    const PostcopyFault *fa = a, *fb = b;
+
+    if (fa->rb != fb->rb) {
+        return (uintptr_t)fa->rb < (uintptr_t)fb->rb ? -1 : 1;
+    }
+    if (fa->offset != fb->offset) {
+        return fa->offset < fb->offset ? -1 : 1;
+    }
+    return 0;
+}
+
+/*
+ * Request the pages of a batch of faults.  The vCPUs that faulted are all
+ * waiting, so the batch is sorted and the faults on contiguous host pages
+ * of a RAMBlock are merged into a single request, that the source sends
+ * back with a single flush.
+ */
+static void postcopy_request_faults(MigrationIncomingState *mis,
+                                    PostcopyFault *faults, int nr)
+{
+    int first, i;
+
+    qsort(faults, nr, sizeof(*faults), postcopy_fault_cmp);
+    for (first = 0; first < nr; first = i) {
+        RAMBlock *rb = faults[first].rb;
+        size_t pagesize = qemu_ram_pagesize(rb);
+        ram_addr_t start = faults[first].offset;
+        ram_addr_t end = start + pagesize;
+
+        /* The length of a request is 32 bits on the wire */
+        for (i = first + 1; i < nr && faults[i].rb == rb &&
+             faults[i].offset <= end &&
+             faults[i].offset + pagesize - start <= UINT32_MAX; i++) {
+            end = MAX(end, faults[i].offset + pagesize);
+        }
+        if (i - first > 1) {
+            trace_postcopy_ram_fault_thread_merge(qemu_ram_get_idstr(rb),
+                                                  start, end - start,
+                                                  i - first);
+        }
+
+        /*
+         * Send the request to the source - we want to request whole
+         * host pages (which are >= TPS)
+         */
+        while (postcopy_request_pages(mis, rb, start, faults[first].haddr,
+                                      end - start)) {
+            /* May be network failure, try to wait for recovery */
+            postcopy_pause_fault_thread(mis);
+        }
+    }
+}
+
 /*
  * Handle faults detected by the USERFAULT markings
  */
 static void *postcopy_ram_fault_thread(void *opaque)
 {
     MigrationIncomingState *mis = opaque;
+    struct uffd_msg msgs[POSTCOPY_FAULT_BATCH];
+    PostcopyFault faults[POSTCOPY_FAULT_BATCH];
     struct uffd_msg msg;
-    int ret;
+    int i, ret;
     size_t index;
     RAMBlock *rb = NULL;
 
@@ -1013,9 +1128,11 @@ static void *postcopy_ram_fault_thread(void *opaque)
         }
 
         if (pfd[0].revents) {
+            int nr_msgs, nr_faults = 0;
+
             poll_result--;
-            ret = read(mis->userfault_fd, &msg, sizeof(msg));
-            if (ret != sizeof(msg)) {
+            ret = read(mis->userfault_fd, msgs, sizeof(msgs));
+            if (ret <= 0 || ret % sizeof(msgs[0])) {
                 if (errno == EAGAIN) {
                     /*
                      * if a wake up happens on the other thread just after
@@ -1030,47 +1147,50 @@ static void *postcopy_ram_fault_thread(void *opaque)
                     break;
                 } else {
                     error_report("%s: Read %d bytes from userfaultfd "
-                                 "expected %zd",
-                                 __func__, ret, sizeof(msg));
+                                 "expected a multiple of %zd",
+                                 __func__, ret, sizeof(msgs[0]));
                     break; /* Lost alignment, don't know what we'd read next */
                 }
             }
-            if (msg.event != UFFD_EVENT_PAGEFAULT) {
-                error_report("%s: Read unexpected event %ud from userfaultfd",
-                             __func__, msg.event);
-                continue; /* It's not a page fault, shouldn't happen */
-            }
 
-            rb = qemu_ram_block_from_host(
-                     (void *)(uintptr_t)msg.arg.pagefault.address,
-                     true, &rb_offset);
-            if (!rb) {
-                error_report("postcopy_ram_fault_thread: Fault outside guest: %"
-                             PRIx64, (uint64_t)msg.arg.pagefault.address);
-                break;
-            }
+            nr_msgs = ret / sizeof(msgs[0]);
+            for (i = 0; i < nr_msgs; i++) {
+                struct uffd_msg *m = &msgs[i];
 
-            rb_offset = ROUND_DOWN(rb_offset, qemu_ram_pagesize(rb));
-            trace_postcopy_ram_fault_thread_request(msg.arg.pagefault.address,
-                                                qemu_ram_get_idstr(rb),
-                                                rb_offset,
-                                                msg.arg.pagefault.feat.ptid);
-            mark_postcopy_blocktime_begin(
-                    (uintptr_t)(msg.arg.pagefault.address),
-                                msg.arg.pagefault.feat.ptid, rb);
+                if (m->event != UFFD_EVENT_PAGEFAULT) {
+                    error_report("%s: Read unexpected event %ud from "
+                                 "userfaultfd", __func__, m->event);
+                    continue; /* It's not a page fault, shouldn't happen */
+                }
 
-retry:
-            /*
-             * Send the request to the source - we want to request one
-             * of our host page sizes (which is >= TPS)
-             */
-            ret = postcopy_request_page(mis, rb, rb_offset,
-                                        msg.arg.pagefault.address);
-            if (ret) {
-                /* May be network failure, try to wait for recovery */
-                postcopy_pause_fault_thread(mis);
-                goto retry;
+                rb = qemu_ram_block_from_host(
+                         (void *)(uintptr_t)m->arg.pagefault.address,
+                         true, &rb_offset);
+                if (!rb) {
+                    error_report("postcopy_ram_fault_thread: Fault outside "
+                                 "guest: %" PRIx64,
+                                 (uint64_t)m->arg.pagefault.address);
+                    break;
+                }
+
+                rb_offset = ROUND_DOWN(rb_offset, qemu_ram_pagesize(rb));
+                trace_postcopy_ram_fault_thread_request(
+                        m->arg.pagefault.address, qemu_ram_get_idstr(rb),
+                        rb_offset, m->arg.pagefault.feat.ptid);
+                mark_postcopy_blocktime_begin(
+                        (uintptr_t)(m->arg.pagefault.address),
+                        m->arg.pagefault.feat.ptid, rb);
+
+                faults[nr_faults].rb = rb;
+                faults[nr_faults].offset = rb_offset;
+                faults[nr_faults].haddr = m->arg.pagefault.address;
+                nr_faults++;
+            }
+            if (i < nr_msgs) {
+                break; /* Fault outside guest */
             }
+
+            postcopy_request_faults(mis, faults, nr_faults);
         }
 
         /* Now handle any requests from external processes on shared memory */
@@ -1191,6 +1311,8 @@ int postcopy_ram_incoming_setup(MigrationIncomingState *mis)
 {
     Error *local_err = NULL;
 
+    memset(mis->postcopy_latency_dist, 0, sizeof(mis->postcopy_latency_dist));
+
     /* Open the fd for the kernel to give us userfaults */
     mis->userfault_fd = uffd_open(O_CLOEXEC | O_NONBLOCK);
     if (mis->userfault_fd == -1) {
@@ -1247,10 +1369,28 @@ int postcopy_ram_incoming_setup(MigrationIncomingState *mis)
     return 0;
 }
 
+/*
+ * Account for a requested page that got placed; @requested is the time
+ * of the request as stored in the page_requested tree.  Called with
+ * page_request_mutex held.
+ */
+static void postcopy_latency_account(MigrationIncomingState *mis,
+                                     uintptr_t requested)
+{
+    uintptr_t now = qemu_clock_get_us(QEMU_CLOCK_REALTIME) | 1;
+    /* Wraps correctly even if the clock was truncated */
+    uint64_t latency = now - requested;
+    int bucket = latency ? 63 - clz64(latency) : 0;
+
+    mis->postcopy_latency_dist[MIN(bucket, POSTCOPY_LATENCY_BUCKETS - 1)]++;
+    trace_postcopy_latency_account(latency);
+}
+
 static int qemu_ufd_copy_ioctl(MigrationIncomingState *mis, void *host_addr,
                                void *from_addr, uint64_t pagesize, RAMBlock *rb)
 {
     int userfault_fd = mis->userfault_fd;
+    uintptr_t requested;
     int ret;
 
     if (from_addr) {
@@ -1275,10 +1415,12 @@ static int qemu_ufd_copy_ioctl(MigrationIncomingState *mis, void *host_addr,
          * If this page resolves a page fault for a previous recorded faulted
          * address, take a special note to maintain the requested page list.
          */
-        if (g_tree_lookup(mis->page_requested, host_addr)) {
+        requested = (uintptr_t)g_tree_lookup(mis->page_requested, host_addr);
+        if (requested) {
             g_tree_remove(mis->page_requested, host_addr);
             mis->page_requested_count--;
             trace_postcopy_page_req_del(host_addr, mis->page_requested_count);
+            postcopy_latency_account(mis, requested);
         }
         qemu_mutex_unlock(&mis->page_request_mutex);
         mark_postcopy_blocktime_end((uintptr_t)host_addr);
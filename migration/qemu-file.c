@@ -876,6 +876,119 @@ QIOChannel *qemu_file_get_ioc(QEMUFile *file)
     return file->ioc;
 }
 
+/*
+ * Return the current position of the stream in the underlying channel,
+ * which must be seekable.  Pending writes are flushed first, and data
+ * that was already read ahead is accounted for.
+ */
+off_t qemu_get_offset(QEMUFile *f)
+{
+    Error *local_error = NULL;
+    off_t ret;
+
+    qemu_fflush(f);
+
+    ret = qio_channel_io_seek(f->ioc, 0, SEEK_CUR, &local_error);
+    if (ret < 0) {
+        qemu_file_set_error_obj(f, -EIO, local_error);
+        return ret;
+    }
+
+    if (!qemu_file_is_writable(f)) {
+        ret -= f->buf_size - f->buf_index;
+    }
+    return ret;
+}
+
+/*
+ * Move the stream to the absolute position @offset of the channel.
+ * Pending writes are flushed, and data that was read ahead is dropped.
+ */
+void qemu_set_offset(QEMUFile *f, off_t offset)
+{
+    Error *local_error = NULL;
+
+    if (qemu_file_is_writable(f)) {
+        qemu_fflush(f);
+    } else {
+        f->buf_index = 0;
+        f->buf_size = 0;
+    }
+
+    if (qio_channel_io_seek(f->ioc, offset, SEEK_SET, &local_error) < 0) {
+        qemu_file_set_error_obj(f, -EIO, local_error);
+    }
+}
+
+/*
+ * Write @buflen bytes at position @pos of the channel, bypassing the
+ * buffer and without moving the stream position.  Errors are reported
+ * through the QEMUFile error state.
+ */
+void qemu_put_buffer_at(QEMUFile *f, const uint8_t *buf, size_t buflen,
+                        off_t pos)
+{
+    Error *local_error = NULL;
+    size_t done = 0;
+
+    if (qemu_file_get_error(f)) {
+        return;
+    }
+
+    while (done < buflen) {
+        ssize_t ret = qio_channel_pwrite(f->ioc, (char *)buf + done,
+                                         buflen - done, pos + done,
+                                         &local_error);
+        if (ret <= 0) {
+            if (ret == 0) {
+                error_setg(&local_error, "Short write at offset %lld",
+                           (long long int)(pos + done));
+            }
+            qemu_file_set_error_obj(f, -EIO, local_error);
+            return;
+        }
+        done += ret;
+    }
+
+    f->total_transferred += buflen;
+}
+
+/*
+ * Read @buflen bytes at position @pos of the channel, bypassing the
+ * buffer and without moving the stream position.
+ *
+ * Returns the number of bytes read; on failure the QEMUFile error state
+ * is set.
+ */
+size_t qemu_get_buffer_at(QEMUFile *f, uint8_t *buf, size_t buflen,
+                          off_t pos)
+{
+    Error *local_error = NULL;
+    size_t done = 0;
+
+    if (qemu_file_get_error(f)) {
+        return 0;
+    }
+
+    while (done < buflen) {
+        ssize_t ret = qio_channel_pread(f->ioc, (char *)buf + done,
+                                        buflen - done, pos + done,
+                                        &local_error);
+        if (ret <= 0) {
+            if (ret == 0) {
+                error_setg(&local_error, "Unexpected end of file at "
+                           "offset %lld", (long long int)(pos + done));
+            }
+            qemu_file_set_error_obj(f, -EIO, local_error);
+            break;
+        }
+        done += ret;
+    }
+
+    f->total_transferred += done;
+    return done;
+}
+
 /*
  * Read size bytes from QEMUFile f and write them to fd.
  */
@@ -40,6 +40,7 @@
 #include "migration/register.h"
 #include "migration/misc.h"
 #include "qemu-file.h"
+#include "io/channel-file.h"
 #include "postcopy-ram.h"
 #include "page_cache.h"
 #include "qemu/error-report.h"
@@ -93,6 +94,31 @@
 #define RAM_SAVE_FLAG_MULTIFD_FLUSH    0x200
 /* We can't use any flag that is bigger than 0x200 */
 
+/*
+ * With mapped-ram, the RAM block list in the setup section is followed,
+ * for each block, by this header.  The header is followed by the bitmap
+ * of the pages present in the file, and then by a region of used_length
+ * bytes where each page is stored at its offset within the block.  The
+ * migration stream resumes after that region.
+ */
+/*
+ * Version 2 files also guarantee that the region of each block is a
+ * complete image of its memory, with the pages missing from the bitmap
+ * reading as zero, so that it can be mapped as a whole.
+ */
+#define MAPPED_RAM_HDR_VERSION 2
+#define MAPPED_RAM_HDR_VERSION_IMAGE 2
+#define MAPPED_RAM_FILE_OFFSET_ALIGNMENT 0x100000
+
+typedef struct MappedRamHeader {
+    uint32_t version;
+    /* The target page size used for the bitmap and the page offsets */
+    uint64_t page_size;
+    /* File offsets of the bitmap and of the first page */
+    uint64_t bitmap_offset;
+    uint64_t pages_offset;
+} QEMU_PACKED MappedRamHeader;
+
 XBZRLECacheStats xbzrle_counters;
 
 /* used by the search for pages to send */
@@ -187,6 +213,7 @@ int xbzrle_cache_resize(uint64_t new_size, Error **errp)
         cache_fini(XBZRLE.cache);
         XBZRLE.cache = new_cache;
     }
+    ret = multifd_xbzrle_cache_resize(new_size, errp);
 out:
     XBZRLE_cache_unlock();
     return ret;
@@ -389,6 +416,8 @@ struct RAMState {
      * - pss structures
      */
     QemuMutex bitmap_mutex;
+    /* Helper threads for the dirty bitmap sync, NULL if not used */
+    struct RAMSyncWorkers *sync_workers;
     /* The RAMBlock used in the last src_page_requests */
     RAMBlock *last_req_rb;
     /* Queue of outstanding page requests from the destination */
@@ -572,6 +601,11 @@ void mig_throttle_counter_reset(void)
  */
 static void xbzrle_cache_zero_page(RAMState *rs, ram_addr_t current_addr)
 {
+    /* With multifd, the channels keep their own cache */
+    if (!XBZRLE.cache) {
+        return;
+    }
+
     /* We don't care if this fails to allocate a new cache page
      * as long as it updated an old one */
     cache_insert(XBZRLE.cache, current_addr, XBZRLE.zero_target_page,
@@ -752,49 +786,38 @@ migration_clear_memory_region_dirty_bitmap_range(RAMBlock *rb,
     unsigned long i, chunk_pages = 1UL << rb->clear_bmap_shift;
     unsigned long chunk_start = QEMU_ALIGN_DOWN(start, chunk_pages);
     unsigned long chunk_end = QEMU_ALIGN_UP(start + npages, chunk_pages);
+    unsigned long run_start = 0, run_pages = 0;
+
+    if (!rb->clear_bmap) {
+        return;
+    }
+    /* See migration_clear_memory_region_dirty_bitmap() */
+    assert(rb->clear_bmap_shift >= 6);
 
     /*
      * Clear pages from start to start + npages - 1, so the end boundary is
-     * exclusive.
+     * exclusive.  Adjacent chunks that still need a clear are merged into
+     * one request, so that the accelerator sees a single range per memslot
+     * rather than one per chunk.
      */
-    for (i = chunk_start; i < chunk_end; i += chunk_pages) {
-        migration_clear_memory_region_dirty_bitmap(rb, i);
-    }
-}
-
-/*
- * colo_bitmap_find_diry:find contiguous dirty pages from start
- *
- * Returns the page offset within memory region of the start of the contiguout
- * dirty page
- *
- * @rs: current RAM state
- * @rb: RAMBlock where to search for dirty pages
- * @start: page where we start the search
- * @num: the number of contiguous dirty pages
- */
-static inline
-unsigned long colo_bitmap_find_dirty(RAMState *rs, RAMBlock *rb,
-                                     unsigned long start, unsigned long *num)
-{
-    unsigned long size = rb->used_length >> TARGET_PAGE_BITS;
-    unsigned long *bitmap = rb->bmap;
-    unsigned long first, next;
-
-    *num = 0;
-
-    if (migrate_ram_is_ignored(rb)) {
-        return size;
-    }
-
-    first = find_next_bit(bitmap, size, start);
-    if (first >= size) {
-        return first;
+    for (i = chunk_start; i <= chunk_end; i += chunk_pages) {
+        if (i < chunk_end && clear_bmap_test_and_clear(rb, i)) {
+            if (!run_pages) {
+                run_start = i;
+            }
+            run_pages += chunk_pages;
+            continue;
+        }
+        if (run_pages) {
+            hwaddr run_addr = (hwaddr)run_start << TARGET_PAGE_BITS;
+            hwaddr run_size = (hwaddr)run_pages << TARGET_PAGE_BITS;
+
+            trace_migration_bitmap_clear_dirty(rb->idstr, run_addr,
+                                               run_size, run_start);
+            memory_region_clear_dirty_bitmap(rb->mr, run_addr, run_size);
+            run_pages = 0;
+        }
     }
-    next = find_next_zero_bit(bitmap, size, first + 1);
-    assert(next >= first);
-    *num = next - first;
-    return first;
 }
 
 static inline bool migration_bitmap_clear_dirty(RAMState *rs,
@@ -906,6 +929,189 @@ static void ramblock_sync_dirty_bitmap(RAMState *rs, RAMBlock *rb)
     rs->num_dirty_pages_period += new_dirty_pages;
 }
 
+/*
+ * Large RAMBlocks are split into chunks of this size when the dirty
+ * bitmap is synchronized by several threads.  It is a multiple of
+ * BITS_PER_LONG pages, so that no two chunks share a word of rb->bmap,
+ * and of the default clear_bmap granularity.
+ */
+#define RAM_SYNC_CHUNK_SIZE         (1ULL << 30)
+/*
+ * Below this amount of migratable RAM, a serial sync is fast enough that
+ * waking up helper threads is not worth it.
+ */
+#define RAM_SYNC_THREADS_MIN_RAM    (16ULL << 30)
+
+typedef struct {
+    RAMBlock *block;
+    ram_addr_t start;
+    ram_addr_t length;
+    uint64_t new_dirty_pages;
+} RAMSyncChunk;
+
+typedef struct RAMSyncWorkers {
+    QemuThread *threads;
+    int nr_threads;
+    /* Posted once per helper thread to start a round, or to quit */
+    QemuSemaphore sem_start;
+    /* Posted by each helper thread at the end of a round */
+    QemuSemaphore sem_done;
+    bool quit;
+    RAMSyncChunk *chunks;
+    unsigned int nr_chunks;
+    unsigned int max_chunks;
+    /* Index of the next chunk to be picked up, updated atomically */
+    unsigned int next_chunk;
+} RAMSyncWorkers;
+
+/* Called with RCU critical section */
+static void ram_sync_process_chunks(RAMSyncWorkers *w)
+{
+    unsigned int i;
+
+    while ((i = qatomic_fetch_inc(&w->next_chunk)) < w->nr_chunks) {
+        RAMSyncChunk *c = &w->chunks[i];
+
+        c->new_dirty_pages =
+            cpu_physical_memory_sync_dirty_bitmap(c->block, c->start,
+                                                  c->length);
+    }
+}
+
+static void *ram_sync_thread(void *opaque)
+{
+    RAMSyncWorkers *w = opaque;
+
+    rcu_register_thread();
+
+    for (;;) {
+        qemu_sem_wait(&w->sem_start);
+        if (qatomic_read(&w->quit)) {
+            break;
+        }
+        WITH_RCU_READ_LOCK_GUARD() {
+            ram_sync_process_chunks(w);
+        }
+        qemu_sem_post(&w->sem_done);
+    }
+
+    rcu_unregister_thread();
+    return NULL;
+}
+
+static void ram_sync_workers_init(RAMState *rs)
+{
+    MigrationState *ms = migrate_get_current();
+    int nr_threads = MIN(ms->dirty_sync_threads, DIRTY_SYNC_THREADS_MAX);
+    RAMSyncWorkers *w;
+    int i;
+
+    /* The migration thread takes a share of the work as well */
+    if (nr_threads <= 1 || ram_bytes_total() < RAM_SYNC_THREADS_MIN_RAM) {
+        return;
+    }
+
+    w = g_new0(RAMSyncWorkers, 1);
+    w->nr_threads = nr_threads - 1;
+    w->threads = g_new0(QemuThread, w->nr_threads);
+    qemu_sem_init(&w->sem_start, 0);
+    qemu_sem_init(&w->sem_done, 0);
+    for (i = 0; i < w->nr_threads; i++) {
+        qemu_thread_create(&w->threads[i], "mig/src/sync", ram_sync_thread,
+                           w, QEMU_THREAD_JOINABLE);
+    }
+    trace_ram_sync_workers_init(nr_threads);
+    rs->sync_workers = w;
+}
+
+static void ram_sync_workers_cleanup(RAMState *rs)
+{
+    RAMSyncWorkers *w = rs->sync_workers;
+    int i;
+
+    if (!w) {
+        return;
+    }
+
+    qatomic_set(&w->quit, true);
+    for (i = 0; i < w->nr_threads; i++) {
+        qemu_sem_post(&w->sem_start);
+    }
+    for (i = 0; i < w->nr_threads; i++) {
+        qemu_thread_join(&w->threads[i]);
+    }
+    qemu_sem_destroy(&w->sem_start);
+    qemu_sem_destroy(&w->sem_done);
+    g_free(w->threads);
+    g_free(w->chunks);
+    g_free(w);
+    rs->sync_workers = NULL;
+}
+
+static void ram_sync_add_chunk(RAMSyncWorkers *w, RAMBlock *rb,
+                               ram_addr_t start, ram_addr_t length)
+{
+    RAMSyncChunk *c;
+
+    if (w->nr_chunks == w->max_chunks) {
+        w->max_chunks = MAX(w->max_chunks * 2, 16);
+        w->chunks = g_renew(RAMSyncChunk, w->chunks, w->max_chunks);
+    }
+    c = &w->chunks[w->nr_chunks++];
+    c->block = rb;
+    c->start = start;
+    c->length = length;
+    c->new_dirty_pages = 0;
+}
+
+/*
+ * Synchronize the dirty bitmap of all RAMBlocks using the helper
+ * threads.  Blocks without a clear_bmap clear the dirty log of the
+ * whole block in one go, and are handled serially.
+ *
+ * Called with RCU critical section and bitmap_mutex held.
+ */
+static void ramblock_sync_dirty_bitmap_parallel(RAMState *rs)
+{
+    RAMSyncWorkers *w = rs->sync_workers;
+    RAMBlock *block;
+    unsigned int i;
+
+    w->nr_chunks = 0;
+    RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+        ram_addr_t start;
+
+        if (!block->clear_bmap || block->used_length < RAM_SYNC_CHUNK_SIZE) {
+            ramblock_sync_dirty_bitmap(rs, block);
+            continue;
+        }
+        for (start = 0; start < block->used_length;
+             start += RAM_SYNC_CHUNK_SIZE) {
+            ram_sync_add_chunk(w, block, start,
+                               MIN(RAM_SYNC_CHUNK_SIZE,
+                                   block->used_length - start));
+        }
+    }
+    if (!w->nr_chunks) {
+        return;
+    }
+
+    qatomic_set(&w->next_chunk, 0);
+    for (i = 0; i < w->nr_threads; i++) {
+        qemu_sem_post(&w->sem_start);
+    }
+    ram_sync_process_chunks(w);
+    for (i = 0; i < w->nr_threads; i++) {
+        qemu_sem_wait(&w->sem_done);
+    }
+
+    for (i = 0; i < w->nr_chunks; i++) {
+        rs->migration_dirty_pages += w->chunks[i].new_dirty_pages;
+        rs->num_dirty_pages_period += w->chunks[i].new_dirty_pages;
+    }
+    trace_ramblock_sync_dirty_bitmap_parallel(w->nr_chunks);
+}
+
 /**
  * ram_pagesize_summary: calculate all the pagesizes of a VM
  *
@@ -1038,10 +1244,15 @@ static void migration_trigger_throttle(RAMState *rs)
      * Check to see if the ratio between dirtied bytes and the approx.
      * amount of bytes that just got transferred since the last time
      * we were in this routine reaches the threshold. If that happens
-     * twice, start or increase throttling.
+     * twice, start or increase throttling.  Do not wait for the second
+     * time if the predicted downtime is out of reach already, or if
+     * dirty-limit is in use: its per-vCPU controller converges on the
+     * quota without overshooting, so starting it early only shortens
+     * the time precopy needs to reach the switchover threshold.
      */
     if ((bytes_dirty_period > bytes_dirty_threshold) &&
-        (++rs->dirty_rate_high_cnt >= 2)) {
+        (++rs->dirty_rate_high_cnt >= 2 || migrate_dirty_limit() ||
+         migration_downtime_unreachable())) {
         rs->dirty_rate_high_cnt = 0;
         if (migrate_auto_converge()) {
             trace_migration_throttle();
@@ -1053,7 +1264,13 @@ static void migration_trigger_throttle(RAMState *rs)
     }
 }
 
-static void migration_bitmap_sync(RAMState *rs, bool last_stage)
+/*
+ * @unlock_bql: the caller holds the BQL only for the sake of the sync;
+ * it is then released while the RAMBlock bitmaps are walked, and only
+ * held for the memory listener callbacks.
+ */
+static void migration_bitmap_sync(RAMState *rs, bool last_stage,
+                                  bool unlock_bql)
 {
     RAMBlock *block;
     int64_t end_time;
@@ -1067,14 +1284,24 @@ static void migration_bitmap_sync(RAMState *rs, bool last_stage)
     trace_migration_bitmap_sync_start();
     memory_global_dirty_log_sync(last_stage);
 
+    if (unlock_bql) {
+        qemu_mutex_unlock_iothread();
+    }
     qemu_mutex_lock(&rs->bitmap_mutex);
     WITH_RCU_READ_LOCK_GUARD() {
-        RAMBLOCK_FOREACH_NOT_IGNORED(block) {
-            ramblock_sync_dirty_bitmap(rs, block);
+        if (rs->sync_workers) {
+            ramblock_sync_dirty_bitmap_parallel(rs);
+        } else {
+            RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+                ramblock_sync_dirty_bitmap(rs, block);
+            }
         }
         stat64_set(&mig_stats.dirty_bytes_last_sync, ram_bytes_remaining());
     }
     qemu_mutex_unlock(&rs->bitmap_mutex);
+    if (unlock_bql) {
+        qemu_mutex_lock_iothread();
+    }
 
     memory_global_after_dirty_log_sync();
     trace_migration_bitmap_sync_end(rs->num_dirty_pages_period);
@@ -1100,7 +1327,8 @@ static void migration_bitmap_sync(RAMState *rs, bool last_stage)
     }
 }
 
-static void migration_bitmap_sync_precopy(RAMState *rs, bool last_stage)
+static void migration_bitmap_sync_precopy(RAMState *rs, bool last_stage,
+                                          bool unlock_bql)
 {
     Error *local_err = NULL;
 
@@ -1113,7 +1341,7 @@ static void migration_bitmap_sync_precopy(RAMState *rs, bool last_stage)
         local_err = NULL;
     }
 
-    migration_bitmap_sync(rs, last_stage);
+    migration_bitmap_sync(rs, last_stage, unlock_bql);
 
     if (precopy_notify(PRECOPY_NOTIFY_AFTER_BITMAP_SYNC, &local_err)) {
         error_report_err(local_err);
@@ -1166,7 +1394,31 @@ static int save_zero_page_to_file(PageSearchStatus *pss, QEMUFile *file,
 static int save_zero_page(PageSearchStatus *pss, QEMUFile *f, RAMBlock *block,
                           ram_addr_t offset)
 {
-    int len = save_zero_page_to_file(pss, f, block, offset);
+    int len;
+
+    if (migrate_zero_page_detection() == ZERO_PAGE_DETECTION_NONE) {
+        return -1;
+    }
+
+    if (migrate_mapped_ram()) {
+        if (!buffer_is_zero(block->host + offset, TARGET_PAGE_SIZE)) {
+            return -1;
+        }
+        /*
+         * Pages missing from the file bitmap are loaded as zero.  If the
+         * page was written before, overwrite it anyway so that the region
+         * of the block in the file remains an image of its memory.
+         */
+        if (test_bit(offset >> TARGET_PAGE_BITS, block->file_bmap)) {
+            qemu_put_buffer_at(f, block->host + offset, TARGET_PAGE_SIZE,
+                               block->pages_offset + offset);
+        }
+        clear_bit_atomic(offset >> TARGET_PAGE_BITS, block->file_bmap);
+        stat64_add(&mig_stats.zero_pages, 1);
+        return 1;
+    }
+
+    len = save_zero_page_to_file(pss, f, block, offset);
 
     if (len) {
         stat64_add(&mig_stats.zero_pages, 1);
@@ -1230,6 +1482,15 @@ static int save_normal_page(PageSearchStatus *pss, RAMBlock *block,
 {
     QEMUFile *file = pss->pss_channel;
 
+    if (migrate_mapped_ram()) {
+        qemu_put_buffer_at(file, buf, TARGET_PAGE_SIZE,
+                           block->pages_offset + offset);
+        set_bit_atomic(offset >> TARGET_PAGE_BITS, block->file_bmap);
+        ram_transferred_add(TARGET_PAGE_SIZE);
+        stat64_add(&mig_stats.normal_pages, 1);
+        return 1;
+    }
+
     ram_transferred_add(save_page_header(pss, pss->pss_channel, block,
                                          offset | RAM_SAVE_FLAG_PAGE));
     if (async) {
@@ -1293,10 +1554,10 @@ static int ram_save_page(RAMState *rs, PageSearchStatus *pss)
 static int ram_save_multifd_page(QEMUFile *file, RAMBlock *block,
                                  ram_addr_t offset)
 {
+    /* The multifd channel accounts the page as a normal or zero page */
     if (multifd_queue_page(file, block, offset) < 0) {
         return -1;
     }
-    stat64_add(&mig_stats.normal_pages, 1);
 
     return 1;
 }
@@ -1426,6 +1687,9 @@ static int find_dirty_block(RAMState *rs, PageSearchStatus *pss)
             /* After the first round, enable XBZRLE. */
             if (migrate_xbzrle()) {
                 rs->xbzrle_started = true;
+                if (multifd_xbzrle_enabled()) {
+                    multifd_xbzrle_start();
+                }
             }
         }
         /* Didn't find anything this time, but try again on the new block */
@@ -2009,6 +2273,7 @@ int ram_save_queue_pages(const char *rbname, ram_addr_t start, ram_addr_t len)
         ram_addr_t page_start = start >> TARGET_PAGE_BITS;
         size_t page_size = qemu_ram_pagesize(ramblock);
         PageSearchStatus *pss = &ram_state->pss[RAM_CHANNEL_POSTCOPY];
+        bool sent = false;
         int ret = 0;
 
         qemu_mutex_lock(&rs->bitmap_mutex);
@@ -2028,24 +2293,30 @@ int ram_save_queue_pages(const char *rbname, ram_addr_t start, ram_addr_t len)
          */
         assert(len % page_size == 0);
         while (len) {
-            if (ram_save_host_page_urgent(pss)) {
+            int res = ram_save_host_page_urgent(pss);
+
+            if (res < 0) {
                 error_report("%s: ram_save_host_page_urgent() failed: "
                              "ramblock=%s, start_addr=0x"RAM_ADDR_FMT,
                              __func__, ramblock->idstr, start);
                 ret = -1;
                 break;
             }
+            sent |= res;
             /*
              * NOTE: after ram_save_host_page_urgent() succeeded, pss->page
              * will automatically be moved and point to the next host page
              * we're going to send, so no need to update here.
              *
-             * Normally QEMU never sends >1 host page in requests, so
-             * logically we don't even need that as the loop should only
-             * run once, but just to be consistent.
+             * The destination merges the faults on contiguous host pages
+             * into a single request, so this can loop more than once.
              */
             len -= page_size;
         };
+        /* Flush the whole range at once, the vCPUs are waiting for it */
+        if (sent) {
+            qemu_fflush(pss->pss_channel);
+        }
         qemu_mutex_unlock(&rs->bitmap_mutex);
 
         return ret;
@@ -2131,6 +2402,7 @@ static int ram_save_target_page_legacy(RAMState *rs, PageSearchStatus *pss)
 {
     RAMBlock *block = pss->block;
     ram_addr_t offset = ((ram_addr_t)pss->page) << TARGET_PAGE_BITS;
+    bool use_multifd;
     int res;
 
     if (control_save_page(pss, block, offset, &res)) {
@@ -2141,6 +2413,24 @@ static int ram_save_target_page_legacy(RAMState *rs, PageSearchStatus *pss)
         return 1;
     }
 
+    /*
+     * Do not use multifd in postcopy as one whole host page should be
+     * placed.  Meanwhile postcopy requires atomic update of pages, so even
+     * if host page size == guest page size the dest guest during run may
+     * still see partially copied pages which is data corruption.
+     */
+    use_multifd = migrate_multifd() && !migration_in_postcopy();
+
+    /*
+     * Leave zero page detection to the multifd channels if asked to, or
+     * if they run XBZRLE: its cache has to see every page.
+     */
+    if (use_multifd &&
+        (migrate_zero_page_detection() == ZERO_PAGE_DETECTION_MULTIFD ||
+         multifd_xbzrle_enabled())) {
+        return ram_save_multifd_page(pss->pss_channel, block, offset);
+    }
+
     res = save_zero_page(pss, pss->pss_channel, block, offset);
     if (res > 0) {
         /* Must let xbzrle know, otherwise a previous (now 0'd) cached
@@ -2154,13 +2444,7 @@ static int ram_save_target_page_legacy(RAMState *rs, PageSearchStatus *pss)
         return res;
     }
 
-    /*
-     * Do not use multifd in postcopy as one whole host page should be
-     * placed.  Meanwhile postcopy requires atomic update of pages, so even
-     * if host page size == guest page size the dest guest during run may
-     * still see partially copied pages which is data corruption.
-     */
-    if (migrate_multifd() && !migration_in_postcopy()) {
+    if (use_multifd) {
         return ram_save_multifd_page(pss->pss_channel, block, offset);
     }
 
@@ -2224,9 +2508,10 @@ static void pss_host_page_finish(PageSearchStatus *pss)
 
 /*
  * Send an urgent host page specified by `pss'.  Need to be called with
- * bitmap_mutex held.
+ * bitmap_mutex held.  The caller is responsible for flushing the channel.
  *
- * Returns 0 if save host page succeeded, false otherwise.
+ * Returns 1 if anything was sent, 0 if there was nothing to send, or
+ * negative on error.
  */
 static int ram_save_host_page_urgent(PageSearchStatus *pss)
 {
@@ -2264,11 +2549,7 @@ static int ram_save_host_page_urgent(PageSearchStatus *pss)
     } while (pss_within_range(pss));
 out:
     pss_host_page_finish(pss);
-    /* For urgent requests, flush immediately if sent */
-    if (sent) {
-        qemu_fflush(pss->pss_channel);
-    }
-    return ret;
+    return ret ? ret : sent;
 }
 
 /**
@@ -2458,6 +2739,7 @@ static void xbzrle_load_cleanup(void)
 static void ram_state_cleanup(RAMState **rsp)
 {
     if (*rsp) {
+        ram_sync_workers_cleanup(*rsp);
         migration_page_queue_free(*rsp);
         qemu_mutex_destroy(&(*rsp)->bitmap_mutex);
         qemu_mutex_destroy(&(*rsp)->src_page_req_mutex);
@@ -2509,6 +2791,11 @@ static void ram_save_cleanup(void *opaque)
         block->bmap = NULL;
     }
 
+    RAMBLOCK_FOREACH_MIGRATABLE(block) {
+        g_free(block->file_bmap);
+        block->file_bmap = NULL;
+    }
+
     xbzrle_cleanup();
     compress_threads_save_cleanup();
     ram_state_cleanup(rsp);
@@ -2713,7 +3000,7 @@ void ram_postcopy_send_discard_bitmap(MigrationState *ms)
     RCU_READ_LOCK_GUARD();
 
     /* This should be our last sync, the src is now paused */
-    migration_bitmap_sync(rs, false);
+    migration_bitmap_sync(rs, false, false);
 
     /* Easiest way to make sure we don't resume in the middle of a host-page */
     rs->pss[RAM_CHANNEL_PRECOPY].last_sent_block = NULL;
@@ -2767,7 +3054,8 @@ static int xbzrle_init(void)
 {
     Error *local_err = NULL;
 
-    if (!migrate_xbzrle()) {
+    /* With multifd, XBZRLE runs in the channels, see multifd-xbzrle.c */
+    if (!migrate_xbzrle() || multifd_xbzrle_enabled()) {
         return 0;
     }
 
@@ -2904,7 +3192,7 @@ static void ram_init_bitmaps(RAMState *rs)
         /* We don't use dirty log with background snapshots */
         if (!migrate_background_snapshot()) {
             memory_global_dirty_log_start(GLOBAL_DIRTY_MIGRATION);
-            migration_bitmap_sync_precopy(rs, false);
+            migration_bitmap_sync_precopy(rs, false, false);
         }
     }
     qemu_mutex_unlock_ramlist();
@@ -2928,6 +3216,7 @@ static int ram_init_all(RAMState **rsp)
         return -1;
     }
 
+    ram_sync_workers_init(*rsp);
     ram_init_bitmaps(*rsp);
 
     return 0;
@@ -3029,6 +3318,52 @@ void qemu_guest_free_page_hint(void *addr, size_t len)
  * @f: QEMUFile where to send the data
  * @opaque: RAMState pointer
  */
+/*
+ * Reserve room in the file for the bitmap and the pages of @block, and
+ * move the migration stream past it.
+ */
+static void mapped_ram_setup_ramblock(QEMUFile *file, RAMBlock *block)
+{
+    MappedRamHeader header = {};
+    long num_pages = block->used_length >> TARGET_PAGE_BITS;
+    size_t bitmap_size = BITS_TO_LONGS(num_pages) * sizeof(unsigned long);
+
+    block->file_bmap = bitmap_new(num_pages);
+    block->bitmap_offset = qemu_get_offset(file) + sizeof(header);
+    block->pages_offset = ROUND_UP(block->bitmap_offset + bitmap_size,
+                                   MAPPED_RAM_FILE_OFFSET_ALIGNMENT);
+
+    header.version = cpu_to_be32(MAPPED_RAM_HDR_VERSION);
+    header.page_size = cpu_to_be64(TARGET_PAGE_SIZE);
+    header.bitmap_offset = cpu_to_be64(block->bitmap_offset);
+    header.pages_offset = cpu_to_be64(block->pages_offset);
+
+    qemu_put_buffer(file, (uint8_t *)&header, sizeof(header));
+    qemu_set_offset(file, block->pages_offset + block->used_length);
+}
+
+/* Store the bitmaps of the pages present in a mapped-ram file */
+static void mapped_ram_write_bitmaps(QEMUFile *file)
+{
+    RAMBlock *block;
+
+    RAMBLOCK_FOREACH_MIGRATABLE(block) {
+        long num_pages = block->used_length >> TARGET_PAGE_BITS;
+        size_t bitmap_size = BITS_TO_LONGS(num_pages) * sizeof(unsigned long);
+
+        qemu_put_buffer_at(file, (uint8_t *)block->file_bmap, bitmap_size,
+                           block->bitmap_offset);
+
+        /* Extend the file over the last page even if it was never written */
+        if (num_pages && !test_bit(num_pages - 1, block->file_bmap)) {
+            uint8_t zero = 0;
+
+            qemu_put_buffer_at(file, &zero, 1,
+                               block->pages_offset + block->used_length - 1);
+        }
+    }
+}
+
 static int ram_save_setup(QEMUFile *f, void *opaque)
 {
     RAMState **rsp = opaque;
@@ -3063,6 +3398,9 @@ static int ram_save_setup(QEMUFile *f, void *opaque)
             if (migrate_ignore_shared()) {
                 qemu_put_be64(f, block->mr->addr);
             }
+            if (migrate_mapped_ram()) {
+                mapped_ram_setup_ramblock(f, block);
+            }
         }
     }
 
@@ -3228,7 +3566,7 @@ static int ram_save_complete(QEMUFile *f, void *opaque)
 
     WITH_RCU_READ_LOCK_GUARD() {
         if (!migration_in_postcopy()) {
-            migration_bitmap_sync_precopy(rs, true);
+            migration_bitmap_sync_precopy(rs, true, false);
         }
 
         ram_control_before_iterate(f, RAM_CONTROL_FINISH);
@@ -3265,6 +3603,13 @@ static int ram_save_complete(QEMUFile *f, void *opaque)
         return ret;
     }
 
+    /* All pages are in the file now; the multifd channels have synced */
+    if (migrate_mapped_ram()) {
+        WITH_RCU_READ_LOCK_GUARD() {
+            mapped_ram_write_bitmaps(f);
+        }
+    }
+
     if (!migrate_multifd_flush_after_each_section()) {
         qemu_put_be64(f, RAM_SAVE_FLAG_MULTIFD_FLUSH);
     }
@@ -3302,7 +3647,7 @@ static void ram_state_pending_exact(void *opaque, uint64_t *must_precopy,
     if (!migration_in_postcopy() && remaining_size < s->threshold_size) {
         qemu_mutex_lock_iothread();
         WITH_RCU_READ_LOCK_GUARD() {
-            migration_bitmap_sync_precopy(rs, false);
+            migration_bitmap_sync_precopy(rs, false, runstate_is_running());
         }
         qemu_mutex_unlock_iothread();
         remaining_size = rs->migration_dirty_pages * TARGET_PAGE_SIZE;
@@ -3526,6 +3871,7 @@ int colo_init_ram_cache(void)
     }
 
     colo_init_ram_state();
+    colo_flush_init();
     return 0;
 }
 
@@ -3557,6 +3903,7 @@ void colo_release_ram_cache(void)
     RAMBlock *block;
 
     memory_global_dirty_log_stop(GLOBAL_DIRTY_MIGRATION);
+    colo_flush_cleanup();
     RAMBLOCK_FOREACH_NOT_IGNORED(block) {
         g_free(block->bmap);
         block->bmap = NULL;
@@ -3816,16 +4163,125 @@ static bool postcopy_is_running(void)
     return ps >= POSTCOPY_INCOMING_LISTENING && ps < POSTCOPY_INCOMING_END;
 }
 
+/*
+ * Dirty pages of the COLO cache are copied into SVM's memory by the
+ * thread doing the checkpoint plus up to COLO_FLUSH_MAX_THREADS - 1
+ * helpers, which pick slices of COLO_FLUSH_CHUNK_PAGES pages each.
+ * Helpers are only woken when there are enough dirty pages to pay off.
+ */
+#define COLO_FLUSH_MAX_THREADS      8
+#define COLO_FLUSH_CHUNK_PAGES      (1UL << 14)
+#define COLO_FLUSH_MIN_THREAD_PAGES (1UL << 12)
+
+typedef struct ColoFlushChunk {
+    RAMBlock *block;
+    unsigned long start;
+    unsigned long end;
+} ColoFlushChunk;
+
+typedef struct ColoFlushState {
+    QemuThread *threads;
+    int nr_threads;             /* helpers only */
+    bool quit;
+    QemuSemaphore start;
+    QemuSemaphore done;
+    GArray *chunks;             /* of ColoFlushChunk */
+    unsigned int next_chunk;
+} ColoFlushState;
+
+static ColoFlushState *colo_flush;
+
+static void colo_flush_chunks(ColoFlushState *cf)
+{
+    unsigned int i;
+
+    while ((i = qatomic_fetch_inc(&cf->next_chunk)) < cf->chunks->len) {
+        ColoFlushChunk *c = &g_array_index(cf->chunks, ColoFlushChunk, i);
+        RAMBlock *block = c->block;
+        unsigned long offset = c->start;
+
+        while (offset < c->end) {
+            unsigned long first, next;
+            ram_addr_t addr;
+
+            first = find_next_bit(block->bmap, c->end, offset);
+            if (first >= c->end) {
+                break;
+            }
+            next = find_next_zero_bit(block->bmap, c->end, first + 1);
+            addr = ((ram_addr_t)first) << TARGET_PAGE_BITS;
+            memcpy(block->host + addr, block->colo_cache + addr,
+                   (next - first) << TARGET_PAGE_BITS);
+            offset = next;
+        }
+    }
+}
+
+static void *colo_flush_thread(void *opaque)
+{
+    ColoFlushState *cf = opaque;
+
+    for (;;) {
+        qemu_sem_wait(&cf->start);
+        if (qatomic_read(&cf->quit)) {
+            break;
+        }
+        colo_flush_chunks(cf);
+        qemu_sem_post(&cf->done);
+    }
+    return NULL;
+}
+
+static void colo_flush_init(void)
+{
+    ColoFlushState *cf = g_new0(ColoFlushState, 1);
+    int i;
+
+    cf->nr_threads = MIN(g_get_num_processors(), COLO_FLUSH_MAX_THREADS) - 1;
+    cf->chunks = g_array_new(false, false, sizeof(ColoFlushChunk));
+    qemu_sem_init(&cf->start, 0);
+    qemu_sem_init(&cf->done, 0);
+    cf->threads = g_new0(QemuThread, MAX(cf->nr_threads, 0));
+    for (i = 0; i < cf->nr_threads; i++) {
+        qemu_thread_create(&cf->threads[i], "colo-flush", colo_flush_thread,
+                           cf, QEMU_THREAD_JOINABLE);
+    }
+    colo_flush = cf;
+}
+
+static void colo_flush_cleanup(void)
+{
+    ColoFlushState *cf = colo_flush;
+    int i;
+
+    if (!cf) {
+        return;
+    }
+    qatomic_set(&cf->quit, true);
+    for (i = 0; i < cf->nr_threads; i++) {
+        qemu_sem_post(&cf->start);
+    }
+    for (i = 0; i < cf->nr_threads; i++) {
+        qemu_thread_join(&cf->threads[i]);
+    }
+    g_free(cf->threads);
+    qemu_sem_destroy(&cf->start);
+    qemu_sem_destroy(&cf->done);
+    g_array_free(cf->chunks, true);
+    g_free(cf);
+    colo_flush = NULL;
+}
+
 /*
  * Flush content of RAM cache into SVM's memory.
  * Only flush the pages that be dirtied by PVM or SVM or both.
  */
 void colo_flush_ram_cache(void)
 {
+    ColoFlushState *cf = colo_flush;
     RAMBlock *block = NULL;
-    void *dst_host;
-    void *src_host;
-    unsigned long offset = 0;
+    int nr_threads = 0;
+    int i;
 
     memory_global_dirty_log_sync(false);
     qemu_mutex_lock(&ram_state->bitmap_mutex);
@@ -3837,34 +4293,41 @@ void colo_flush_ram_cache(void)
 
     trace_colo_flush_ram_cache_begin(ram_state->migration_dirty_pages);
     WITH_RCU_READ_LOCK_GUARD() {
-        block = QLIST_FIRST_RCU(&ram_list.blocks);
+        g_array_set_size(cf->chunks, 0);
+        RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+            unsigned long pages = block->used_length >> TARGET_PAGE_BITS;
+            ColoFlushChunk c = { .block = block };
+
+            /* Clear the dirty log before the pages are copied */
+            migration_clear_memory_region_dirty_bitmap_range(block, 0, pages);
+            for (c.start = 0; c.start < pages; c.start = c.end) {
+                c.end = MIN(c.start + COLO_FLUSH_CHUNK_PAGES, pages);
+                g_array_append_val(cf->chunks, c);
+            }
+        }
+        cf->next_chunk = 0;
 
-        while (block) {
-            unsigned long num = 0;
+        if (ram_state->migration_dirty_pages >= COLO_FLUSH_MIN_THREAD_PAGES) {
+            nr_threads = MIN(cf->nr_threads, cf->chunks->len - 1);
+        }
+        for (i = 0; i < nr_threads; i++) {
+            qemu_sem_post(&cf->start);
+        }
+        colo_flush_chunks(cf);
+        for (i = 0; i < nr_threads; i++) {
+            qemu_sem_wait(&cf->done);
+        }
 
-            offset = colo_bitmap_find_dirty(ram_state, block, offset, &num);
-            if (!offset_in_ramblock(block,
-                                    ((ram_addr_t)offset) << TARGET_PAGE_BITS)) {
-                offset = 0;
-                num = 0;
-                block = QLIST_NEXT_RCU(block, next);
-            } else {
-                unsigned long i = 0;
+        RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+            unsigned long pages = block->used_length >> TARGET_PAGE_BITS;
 
-                for (i = 0; i < num; i++) {
-                    migration_bitmap_clear_dirty(ram_state, block, offset + i);
-                }
-                dst_host = block->host
-                         + (((ram_addr_t)offset) << TARGET_PAGE_BITS);
-                src_host = block->colo_cache
-                         + (((ram_addr_t)offset) << TARGET_PAGE_BITS);
-                memcpy(dst_host, src_host, TARGET_PAGE_SIZE * num);
-                offset += num;
-            }
+            ram_state->migration_dirty_pages -=
+                bitmap_count_one(block->bmap, pages);
+            bitmap_clear(block->bmap, 0, pages);
         }
     }
     qemu_mutex_unlock(&ram_state->bitmap_mutex);
-    trace_colo_flush_ram_cache_end();
+    trace_colo_flush_ram_cache_end(nr_threads);
 }
 
 /**
@@ -3877,6 +4340,172 @@ void colo_flush_ram_cache(void)
  *
  * @f: QEMUFile where to send the data
  */
+/*
+ * With lazy-ram, return the descriptor of the mapped-ram file if the pages
+ * of @block can be mapped from it rather than read, or -1.
+ */
+static int mapped_ram_lazy_fd(QEMUFile *f, RAMBlock *block)
+{
+    QIOChannel *ioc = qemu_file_get_ioc(f);
+
+    if (migrate_lazy_ram() &&
+        object_dynamic_cast(OBJECT(ioc), TYPE_QIO_CHANNEL_FILE) &&
+        qemu_ram_can_map_file_private(block)) {
+        return QIO_CHANNEL_FILE(ioc)->fd;
+    }
+    return -1;
+}
+
+/*
+ * Map the host pages fully covered by a run of pages of a mapped-ram
+ * file, and read the partial host pages at either end.
+ */
+static int mapped_ram_map_run(QEMUFile *f, RAMBlock *block, int fd,
+                              ram_addr_t offset, size_t size,
+                              uint64_t file_offset)
+{
+    size_t hps = qemu_real_host_page_size();
+    ram_addr_t start = ROUND_UP(offset, hps);
+    ram_addr_t end = ROUND_DOWN(offset + size, hps);
+    int ret;
+
+    if (start >= end) {
+        start = end = offset + size;
+    }
+    if (start > offset &&
+        qemu_get_buffer_at(f, ramblock_ptr(block, offset), start - offset,
+                           file_offset) != start - offset) {
+        return qemu_file_get_error(f) ?: -EIO;
+    }
+    if (end < offset + size &&
+        qemu_get_buffer_at(f, ramblock_ptr(block, end), offset + size - end,
+                           file_offset + (end - offset)) !=
+        offset + size - end) {
+        return qemu_file_get_error(f) ?: -EIO;
+    }
+    if (start < end) {
+        ret = qemu_ram_map_file_private(block, start, end - start, fd,
+                                        file_offset + (start - offset));
+        if (ret < 0) {
+            error_report("Cannot map block %s at offset " RAM_ADDR_FMT
+                         " from the migration file: %s",
+                         block->idstr, start, strerror(-ret));
+            return ret;
+        }
+        trace_ram_load_mapped_ram_lazy(block->idstr, start, end - start);
+    }
+    return 0;
+}
+
+/*
+ * Whether the region of a block in the file is a complete image of its
+ * memory and the file covers all of it, so that it can be mapped whole.
+ * This is the case for all version 2 files, which cloned VMs can then
+ * share in the page cache up to the first write to each page.
+ */
+static bool mapped_ram_is_image(MappedRamHeader *header, int fd,
+                                ram_addr_t length)
+{
+    struct stat st;
+
+    return header->version >= MAPPED_RAM_HDR_VERSION_IMAGE &&
+           !fstat(fd, &st) && st.st_size >= header->pages_offset + length;
+}
+
+/*
+ * Load the pages of @block from a mapped-ram file, reading each run of
+ * pages present in the file bitmap straight into guest memory (or, with
+ * lazy-ram, mapping it), and move the migration stream past the region of
+ * the block.
+ */
+static int parse_ramblock_mapped_ram(QEMUFile *f, RAMBlock *block,
+                                     ram_addr_t length)
+{
+    g_autofree unsigned long *bitmap = NULL;
+    MappedRamHeader header;
+    long num_pages = length >> TARGET_PAGE_BITS;
+    size_t bitmap_size = BITS_TO_LONGS(num_pages) * sizeof(unsigned long);
+    unsigned long set, clear;
+    uint64_t pages_offset;
+    int lazy_fd = mapped_ram_lazy_fd(f, block);
+
+    qemu_get_buffer(f, (uint8_t *)&header, sizeof(header));
+    header.version = be32_to_cpu(header.version);
+    header.page_size = be64_to_cpu(header.page_size);
+    header.bitmap_offset = be64_to_cpu(header.bitmap_offset);
+    header.pages_offset = be64_to_cpu(header.pages_offset);
+
+    if (header.version > MAPPED_RAM_HDR_VERSION) {
+        error_report("Migration mapped-ram capability version %u not "
+                     "supported (block %s)", header.version, block->idstr);
+        return -EINVAL;
+    }
+    if (header.page_size != TARGET_PAGE_SIZE) {
+        error_report("Mapped-ram page size %" PRIu64 " does not match the "
+                     "target page size %u (block %s)", header.page_size,
+                     (unsigned int)TARGET_PAGE_SIZE, block->idstr);
+        return -EINVAL;
+    }
+    pages_offset = header.pages_offset;
+
+    if (lazy_fd >= 0 && mapped_ram_is_image(&header, lazy_fd, length)) {
+        /* One mapping for the whole block, pages missing read as zero */
+        int ret = mapped_ram_map_run(f, block, lazy_fd, 0, length,
+                                     pages_offset);
+        if (ret < 0) {
+            return ret;
+        }
+        ramblock_recv_bitmap_set_range(block, block->host, num_pages);
+        qemu_set_offset(f, pages_offset + length);
+        return qemu_file_get_error(f);
+    }
+
+    bitmap = bitmap_new(num_pages);
+    if (qemu_get_buffer_at(f, (uint8_t *)bitmap, bitmap_size,
+                           header.bitmap_offset) != bitmap_size) {
+        return qemu_file_get_error(f) ?: -EIO;
+    }
+
+    for (set = find_first_bit(bitmap, num_pages);
+         set < num_pages;
+         set = find_next_bit(bitmap, num_pages, clear + 1)) {
+        ram_addr_t offset = (ram_addr_t)set << TARGET_PAGE_BITS;
+        size_t size;
+        void *host;
+
+        clear = find_next_zero_bit(bitmap, num_pages, set + 1);
+        size = (clear - set) << TARGET_PAGE_BITS;
+
+        host = host_from_ram_block_offset(block, offset);
+        if (!host) {
+            error_report("Illegal RAM offset " RAM_ADDR_FMT, offset);
+            return -EINVAL;
+        }
+
+        if (lazy_fd >= 0) {
+            int ret = mapped_ram_map_run(f, block, lazy_fd, offset, size,
+                                         pages_offset + offset);
+            if (ret < 0) {
+                return ret;
+            }
+        } else {
+            if (qemu_get_buffer_at(f, host, size,
+                                   pages_offset + offset) != size) {
+                return qemu_file_get_error(f) ?: -EIO;
+            }
+            trace_ram_load_mapped_ram(block->idstr, offset, size);
+        }
+        ramblock_recv_bitmap_set_range(block, host, clear - set);
+
+        if (clear >= num_pages) {
+            break;
+        }
+    }
+
+    qemu_set_offset(f, pages_offset + length);
+    return qemu_file_get_error(f);
+}
+
 static int ram_load_precopy(QEMUFile *f)
 {
     MigrationIncomingState *mis = migration_incoming_get_current();
@@ -4008,6 +4637,9 @@ static int ram_load_precopy(QEMUFile *f)
                             ret = -EINVAL;
                         }
                     }
+                    if (!ret && migrate_mapped_ram()) {
+                        ret = parse_ramblock_mapped_ram(f, block, length);
+                    }
                     ram_control_load_hook(f, RAM_CONTROL_BLOCK_REG,
                                           block->idstr);
                 } else {
@@ -1412,9 +1412,224 @@ void qemu_savevm_state_complete_postcopy(QEMUFile *f)
     qemu_fflush(f);
 }
 
-static
+/* Maximum number of sections saved or loaded concurrently */
+#define DEVICE_STATE_THREADS_MAX 8
+
+/*
+ * A section saved or loaded on a worker thread into or out of a buffer,
+ * see SaveVMHandlers::complete_precopy_thread_safe.
+ */
+typedef struct DeviceStateJob {
+    SaveStateEntry *se;
+    QIOChannelBuffer *bioc;
+    QEMUFile *f;
+    QemuThread thread;
+    QemuSemaphore *done;    /* posted when a save job is finished */
+    bool finished;
+    bool save;
+    int ret;
+} DeviceStateJob;
+
+/* A thread-safe section waiting to be saved, and how much it will save */
+typedef struct DeviceStateSection {
+    SaveStateEntry *se;
+    uint64_t size;
+} DeviceStateSection;
+
+static void *device_state_save_thread(void *opaque)
+{
+    DeviceStateJob *job = opaque;
+
+    rcu_register_thread();
+    job->ret = job->se->ops->save_live_complete_precopy(job->f,
+                                                        job->se->opaque);
+    if (!job->ret) {
+        qemu_fflush(job->f);
+        job->ret = qemu_file_get_error(job->f);
+    }
+    rcu_unregister_thread();
+    qatomic_store_release(&job->finished, true);
+    qemu_sem_post(job->done);
+    return NULL;
+}
+
+static void *device_state_load_thread(void *opaque)
+{
+    DeviceStateJob *job = opaque;
+
+    rcu_register_thread();
+    job->ret = vmstate_load(job->f, job->se);
+    rcu_unregister_thread();
+    return NULL;
+}
+
+/* @done must be given for save jobs, and is ignored for load jobs */
+static void device_state_job_start(GQueue *jobs, SaveStateEntry *se,
+                                   QIOChannelBuffer *bioc, bool save,
+                                   QemuSemaphore *done)
+{
+    DeviceStateJob *job = g_new0(DeviceStateJob, 1);
+
+    job->se = se;
+    job->bioc = bioc;
+    job->save = save;
+    job->done = done;
+    if (save) {
+        job->f = qemu_file_new_output(QIO_CHANNEL(bioc));
+    } else {
+        job->f = qemu_file_new_input(QIO_CHANNEL(bioc));
+    }
+    qemu_thread_create(&job->thread, save ? "mig/dev-save" : "mig/dev-load",
+                       save ? device_state_save_thread :
+                       device_state_load_thread,
+                       job, QEMU_THREAD_JOINABLE);
+    g_queue_push_tail(jobs, job);
+}
+
+/*
+ * Wait for @job.  If it saved a section, write the section to @f unless
+ * it is NULL.
+ *
+ * Returns the return value of the job
+ */
+static int device_state_job_complete(DeviceStateJob *job, QEMUFile *f)
+{
+    SaveStateEntry *se = job->se;
+    int ret;
+
+    qemu_thread_join(&job->thread);
+    ret = job->ret;
+    if (job->save) {
+        trace_savevm_section_end(se->idstr, se->section_id, ret);
+        if (!ret && f) {
+            save_section_header(f, se, QEMU_VM_SECTION_END_BUFFER);
+            qemu_put_be64(f, job->bioc->usage);
+            qemu_put_buffer(f, (uint8_t *)job->bioc->data, job->bioc->usage);
+            save_section_footer(f, se);
+        }
+    } else if (ret < 0) {
+        error_report("error while loading state section id %d(%s)",
+                     se->load_section_id, se->idstr);
+    }
+    qemu_fclose(job->f);
+    object_unref(OBJECT(job->bioc));
+    g_free(job);
+    return ret;
+}
+
+/* Wait for the oldest job, see device_state_job_complete() */
+static int device_state_job_finish(GQueue *jobs, QEMUFile *f)
+{
+    return device_state_job_complete(g_queue_pop_head(jobs), f);
+}
+
+/*
+ * Wait for all the jobs, writing out the sections they saved to @f in
+ * order until one fails.
+ *
+ * Returns 0 for success or the first error
+ */
+static int device_state_jobs_finish(GQueue *jobs, QEMUFile *f)
+{
+    int ret = 0;
+
+    while (!g_queue_is_empty(jobs)) {
+        int r = device_state_job_finish(jobs, ret ? NULL : f);
+
+        if (!ret && r < 0) {
+            ret = r;
+        }
+    }
+    return ret;
+}
+
+/* How much a section still has to save, as far as its handlers can tell */
+static uint64_t device_state_estimate(SaveStateEntry *se)
+{
+    uint64_t must_precopy = 0, can_postcopy = 0;
+
+    if (se->ops->state_pending_exact) {
+        se->ops->state_pending_exact(se->opaque, &must_precopy,
+                                     &can_postcopy);
+    }
+    return must_precopy + can_postcopy;
+}
+
+static gint device_state_section_cmp(gconstpointer a, gconstpointer b)
+{
+    const DeviceStateSection *sa = a, *sb = b;
+
+    /* Largest first */
+    return sa->size < sb->size ? 1 : sa->size > sb->size ? -1 : 0;
+}
+
+/*
+ * Save a run of consecutive thread-safe sections on worker threads and
+ * empty @sections.
+ *
+ * The sections are independent of each other, so the destination does
+ * not care about their order.  The largest ones are started first, so
+ * that a big device does not end up running alone after all the small
+ * ones are done, and each section is written to @f as soon as it is
+ * finished rather than behind a slower one.
+ *
+ * Returns 0 for success or the first error
+ */
+static int device_state_save_sections(QEMUFile *f, GArray *sections)
+{
+    GQueue jobs = G_QUEUE_INIT;
+    QemuSemaphore done;
+    guint next = 0;
+    int ret = 0;
+
+    g_array_sort(sections, device_state_section_cmp);
+    qemu_sem_init(&done, 0);
+
+    for (;;) {
+        DeviceStateJob *job;
+        GList *l;
+        int r;
+
+        if (!ret && next < sections->len &&
+            g_queue_get_length(&jobs) < DEVICE_STATE_THREADS_MAX) {
+            DeviceStateSection *sec =
+                &g_array_index(sections, DeviceStateSection, next++);
+
+            trace_savevm_device_state_start(sec->se->idstr, sec->size);
+            device_state_job_start(&jobs, sec->se, qio_channel_buffer_new(4096),
+                                   true, &done);
+            continue;
+        }
+        if (g_queue_is_empty(&jobs)) {
+            break;
+        }
+
+        qemu_sem_wait(&done);
+        for (l = jobs.head; l; l = l->next) {
+            job = l->data;
+            if (qatomic_load_acquire(&job->finished)) {
+                break;
+            }
+        }
+        assert(l);
+        g_queue_delete_link(&jobs, l);
+
+        r = device_state_job_complete(job, ret ? NULL : f);
+        if (!ret && r < 0) {
+            ret = r;
+        }
+    }
+
+    qemu_sem_destroy(&done);
+    g_array_set_size(sections, 0);
+    return ret;
+}
+
 int qemu_savevm_state_complete_precopy_iterable(QEMUFile *f, bool in_postcopy)
 {
+    bool parallel = migrate_parallel_device_state() && !in_postcopy;
+    g_autoptr(GArray) sections =
+        g_array_new(FALSE, FALSE, sizeof(DeviceStateSection));
     SaveStateEntry *se;
     int ret;
 
@@ -1433,18 +1648,41 @@ int qemu_savevm_state_complete_precopy_iterable(QEMUFile *f, bool in_postcopy)
         }
         trace_savevm_section_start(se->idstr, se->section_id);
 
+        if (parallel && se->ops->complete_precopy_thread_safe) {
+            DeviceStateSection sec = {
+                .se = se,
+                .size = device_state_estimate(se),
+            };
+
+            g_array_append_val(sections, sec);
+            continue;
+        }
+
+        /* Sections saved on threads must be in the stream before this one */
+        ret = device_state_save_sections(f, sections);
+        if (ret < 0) {
+            goto err;
+        }
+
         save_section_header(f, se, QEMU_VM_SECTION_END);
 
         ret = se->ops->save_live_complete_precopy(f, se->opaque);
         trace_savevm_section_end(se->idstr, se->section_id, ret);
         save_section_footer(f, se);
         if (ret < 0) {
-            qemu_file_set_error(f, ret);
-            return -1;
+            goto err;
         }
     }
 
+    ret = device_state_save_sections(f, sections);
+    if (ret < 0) {
+        goto err;
+    }
     return 0;
+
+err:
+    qemu_file_set_error(f, ret);
+    return -1;
 }
 
 int qemu_savevm_state_complete_precopy_non_iterable(QEMUFile *f,
@@ -2129,7 +2367,8 @@ static gboolean postcopy_sync_page_req(gpointer key, gpointer value,
         return FALSE;
     }
 
-    ret = migrate_send_rp_message_req_pages(mis, rb, rb_offset);
+    ret = migrate_send_rp_message_req_pages(mis, rb, rb_offset,
+                                            qemu_ram_pagesize(rb));
     if (ret) {
         /* Please refer to above comment. */
         error_report("%s: send rp message failed for addr %p",
@@ -2565,6 +2804,84 @@ qemu_loadvm_section_part_end(QEMUFile *f, MigrationIncomingState *mis)
     return 0;
 }
 
+static int
+qemu_loadvm_section_buffer(QEMUFile *f, MigrationIncomingState *mis,
+                           GQueue *jobs)
+{
+    QIOChannelBuffer *bioc;
+    uint32_t section_id;
+    SaveStateEntry *se;
+    uint64_t len;
+    int ret;
+
+    section_id = qemu_get_be32(f);
+    len = qemu_get_be64(f);
+
+    ret = qemu_file_get_error(f);
+    if (ret) {
+        error_report("%s: Failed to read section ID: %d",
+                     __func__, ret);
+        return ret;
+    }
+
+    trace_qemu_loadvm_state_section_buffer(section_id, len);
+    QTAILQ_FOREACH(se, &savevm_state.handlers, entry) {
+        if (se->load_section_id == section_id) {
+            break;
+        }
+    }
+    if (se == NULL) {
+        error_report("Unknown savevm section %d", section_id);
+        return -EINVAL;
+    }
+    if (len != (size_t)len) {
+        error_report("%s: section %d(%s) too large: %" PRIu64,
+                     __func__, section_id, se->idstr, len);
+        return -EINVAL;
+    }
+
+    bioc = qio_channel_buffer_new(len);
+    qio_channel_set_name(QIO_CHANNEL(bioc), "migration-loadvm-section");
+    if (qemu_get_buffer(f, (uint8_t *)bioc->data, len) != len) {
+        error_report("%s: Failed to read section %d(%s)",
+                     __func__, section_id, se->idstr);
+        object_unref(OBJECT(bioc));
+        return -EINVAL;
+    }
+    bioc->usage = len;
+    if (!check_section_footer(f, se)) {
+        object_unref(OBJECT(bioc));
+        return -EINVAL;
+    }
+
+    if (se->ops && se->ops->complete_precopy_thread_safe) {
+        if (g_queue_get_length(jobs) == DEVICE_STATE_THREADS_MAX) {
+            ret = device_state_job_finish(jobs, NULL);
+            if (ret < 0) {
+                object_unref(OBJECT(bioc));
+                return ret;
+            }
+        }
+        device_state_job_start(jobs, se, bioc, false, NULL);
+        return 0;
+    }
+
+    /* This side does not load it on a thread, so keep the ordering */
+    ret = device_state_jobs_finish(jobs, NULL);
+    if (!ret) {
+        QEMUFile *bf = qemu_file_new_input(QIO_CHANNEL(bioc));
+
+        ret = vmstate_load(bf, se);
+        if (ret < 0) {
+            error_report("error while loading state section id %d(%s)",
+                         section_id, se->idstr);
+        }
+        qemu_fclose(bf);
+    }
+    object_unref(OBJECT(bioc));
+    return ret;
+}
+
 static int qemu_loadvm_state_header(QEMUFile *f)
 {
     unsigned int v;
@@ -2729,6 +3046,7 @@ static bool postcopy_pause_incoming(MigrationIncomingState *mis)
 
 int qemu_loadvm_state_main(QEMUFile *f, MigrationIncomingState *mis)
 {
+    GQueue jobs = G_QUEUE_INIT;
     uint8_t section_type;
     int ret = 0;
 
@@ -2742,6 +3060,14 @@ retry:
         }
 
         trace_qemu_loadvm_state_section(section_type);
+        /* Anything else depends on the sections loaded on threads */
+        if (section_type != QEMU_VM_SECTION_END_BUFFER) {
+            ret = device_state_jobs_finish(&jobs, NULL);
+            if (ret < 0) {
+                goto out;
+            }
+        }
+
         switch (section_type) {
         case QEMU_VM_SECTION_START:
         case QEMU_VM_SECTION_FULL:
@@ -2757,6 +3083,12 @@ retry:
                 goto out;
             }
             break;
+        case QEMU_VM_SECTION_END_BUFFER:
+            ret = qemu_loadvm_section_buffer(f, mis, &jobs);
+            if (ret < 0) {
+                goto out;
+            }
+            break;
         case QEMU_VM_COMMAND:
             ret = loadvm_process_command(f);
             trace_qemu_loadvm_state_section_command(ret);
@@ -2775,6 +3107,13 @@ retry:
     }
 
 out:
+    if (!g_queue_is_empty(&jobs)) {
+        int jobs_ret = device_state_jobs_finish(&jobs, NULL);
+
+        if (ret >= 0 && jobs_ret < 0) {
+            ret = jobs_ret;
+        }
+    }
     if (ret < 0) {
         qemu_file_set_error(f, ret);
 
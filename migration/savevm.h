@@ -27,6 +27,8 @@
 #define QEMU_VM_VMDESCRIPTION        0x06
 #define QEMU_VM_CONFIGURATION        0x07
 #define QEMU_VM_COMMAND              0x08
+/* Section end saved on a worker thread, prefixed with its length */
+#define QEMU_VM_SECTION_END_BUFFER   0x09
 #define QEMU_VM_SECTION_FOOTER       0x7e
 
 bool qemu_savevm_state_blocked(Error **errp);
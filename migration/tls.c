@@ -119,6 +119,7 @@ QIOChannelTLS *migration_tls_client_create(QIOChannel *ioc,
                                            Error **errp)
 {
     QCryptoTLSCreds *creds;
+    QIOChannelTLS *tioc;
 
     creds = migration_tls_get_creds(QCRYPTO_TLS_CREDS_ENDPOINT_CLIENT, errp);
     if (!creds) {
@@ -130,7 +131,15 @@ QIOChannelTLS *migration_tls_client_create(QIOChannel *ioc,
         hostname = tls_hostname;
     }
 
-    return qio_channel_tls_new_client(ioc, creds, hostname, errp);
+    tioc = qio_channel_tls_new_client(ioc, creds, hostname, errp);
+    if (tioc) {
+        /*
+         * The source does nearly all the sending; let the kernel encrypt
+         * it where possible. QEMU's TLS stack never sends KeyUpdate.
+         */
+        qio_channel_tls_set_ktls_tx(tioc, true);
+    }
+    return tioc;
 }
 
 void migration_tls_channel_connect(MigrationState *s,
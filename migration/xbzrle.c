@@ -15,151 +15,311 @@
 #include "qemu/host-utils.h"
 #include "xbzrle.h"
 
-#if defined(CONFIG_AVX512BW_OPT)
-#include <immintrin.h>
+#if defined(CONFIG_AVX512BW_OPT) || defined(CONFIG_AVX2_OPT) || \
+    defined(__aarch64__)
+#define XBZRLE_ENCODE_ACCEL
 #include "host/cpuinfo.h"
+#if defined(__aarch64__)
+#include <arm_neon.h>
+#else
+#include <immintrin.h>
+#endif
+
+/*
+ * The vector encoders compare the old and new page 64 bytes at a time,
+ * into a mask where bit N is set if byte N is unchanged, and leave the
+ * run bookkeeping to the helpers below.  They produce exactly the same
+ * output as the scalar encoder.
+ */
+typedef struct {
+    uint8_t *new_buf;
+    uint8_t *dst;
+    int dlen;
+    /* bytes written to dst */
+    int d;
+    /* bytes of the page consumed so far */
+    int i;
+    /* length of the current run */
+    uint32_t run;
+    /* whether the current run is a zrun */
+    bool in_zrun;
+} XBZRLEEncoder;
+
+static inline QEMU_ALWAYS_INLINE bool
+xbzrle_encoder_init(XBZRLEEncoder *e, uint8_t *new_buf, int slen,
+                    uint8_t *dst, int dlen)
+{
+    *e = (XBZRLEEncoder) {
+        .new_buf = new_buf,
+        .dst = dst,
+        .dlen = dlen,
+        .in_zrun = true,
+    };
+    /* overflow */
+    return !slen || dlen >= 2;
+}
+
+static inline QEMU_ALWAYS_INLINE bool xbzrle_put_zrun(XBZRLEEncoder *e)
+{
+    /* overflow */
+    if (e->d + 2 > e->dlen) {
+        return false;
+    }
+    e->d += uleb128_encode_small(e->dst + e->d, e->run);
+    e->run = 0;
+    return true;
+}
 
+static inline QEMU_ALWAYS_INLINE bool xbzrle_put_nzrun(XBZRLEEncoder *e)
+{
+    /* overflow */
+    if (e->d + 2 > e->dlen) {
+        return false;
+    }
+    e->d += uleb128_encode_small(e->dst + e->d, e->run);
+    /* overflow */
+    if (e->d + e->run > e->dlen) {
+        return false;
+    }
+    memcpy(e->dst + e->d, e->new_buf + e->i - e->run, e->run);
+    e->d += e->run;
+    e->run = 0;
+    return true;
+}
+
+/*
+ * Feed the next @n bytes (at most 64) of the page to the encoder; bit
+ * N of @same is set if byte N is unchanged.  Returns false on overflow.
+ */
+static inline QEMU_ALWAYS_INLINE bool
+xbzrle_encode_mask(XBZRLEEncoder *e, uint64_t same, int n)
+{
+    /* 64 bytes that extend the current run, the common case */
+    if (n == 64 && same == (e->in_zrun ? UINT64_MAX : 0)) {
+        e->run += 64;
+        e->i += 64;
+        return true;
+    }
+
+    while (n) {
+        int k = MIN(e->in_zrun ? ctz64(~same) : ctz64(same), n);
+
+        e->run += k;
+        e->i += k;
+        n -= k;
+        if (!n) {
+            break;
+        }
+        same >>= k;
+        if (e->in_zrun) {
+            if (!xbzrle_put_zrun(e)) {
+                return false;
+            }
+        } else {
+            /* a zrun follows, which needs room as well */
+            if (!xbzrle_put_nzrun(e) || e->d + 2 > e->dlen) {
+                return false;
+            }
+        }
+        e->in_zrun = !e->in_zrun;
+    }
+    return true;
+}
+
+static inline QEMU_ALWAYS_INLINE int xbzrle_encoder_finish(XBZRLEEncoder *e)
+{
+    /* the last zrun is skipped */
+    if (!e->in_zrun && !xbzrle_put_nzrun(e)) {
+        return -1;
+    }
+    return e->d;
+}
+
+/* Mask of the unchanged bytes of a tail shorter than 64 bytes */
+static inline QEMU_ALWAYS_INLINE uint64_t
+xbzrle_same_mask_tail(uint8_t *old_buf, uint8_t *new_buf, int n)
+{
+    uint64_t same = 0;
+    int i;
+
+    for (i = 0; i < n; i++) {
+        same |= (uint64_t)(old_buf[i] == new_buf[i]) << i;
+    }
+    return same;
+}
+#endif
+
+#if defined(CONFIG_AVX512BW_OPT)
 static int __attribute__((target("avx512bw")))
 xbzrle_encode_buffer_avx512(uint8_t *old_buf, uint8_t *new_buf, int slen,
                             uint8_t *dst, int dlen)
 {
-    uint32_t zrun_len = 0, nzrun_len = 0;
-    int d = 0, i = 0, num = 0;
-    uint8_t *nzrun_start = NULL;
-    /* add 1 to include residual part in main loop */
-    uint32_t count512s = (slen >> 6) + 1;
-    /* countResidual is tail of data, i.e., countResidual = slen % 64 */
-    uint32_t count_residual = slen & 0b111111;
-    bool never_same = true;
-    uint64_t mask_residual = 1;
-    mask_residual <<= count_residual;
-    mask_residual -= 1;
-    __m512i r = _mm512_set1_epi32(0);
-
-    while (count512s) {
-        int bytes_to_check = 64;
-        uint64_t mask = 0xffffffffffffffff;
-        if (count512s == 1) {
-            bytes_to_check = count_residual;
-            mask = mask_residual;
+    XBZRLEEncoder e;
+    int i;
+
+    if (!xbzrle_encoder_init(&e, new_buf, slen, dst, dlen)) {
+        return -1;
+    }
+    for (i = 0; i < slen; i += 64) {
+        int n = MIN(slen - i, 64);
+        __mmask64 mask = n == 64 ? UINT64_MAX : (1ULL << n) - 1;
+        __m512i old_data = _mm512_maskz_loadu_epi8(mask, old_buf + i);
+        __m512i new_data = _mm512_maskz_loadu_epi8(mask, new_buf + i);
+
+        if (!xbzrle_encode_mask(&e, _mm512_cmpeq_epi8_mask(old_data,
+                                                           new_data), n)) {
+            return -1;
         }
-        __m512i old_data = _mm512_mask_loadu_epi8(r,
-                                                  mask, old_buf + i);
-        __m512i new_data = _mm512_mask_loadu_epi8(r,
-                                                  mask, new_buf + i);
-        uint64_t comp = _mm512_cmpeq_epi8_mask(old_data, new_data);
-        count512s--;
-
-        bool is_same = (comp & 0x1);
-        while (bytes_to_check) {
-            if (d + 2 > dlen) {
-                return -1;
-            }
-            if (is_same) {
-                if (nzrun_len) {
-                    d += uleb128_encode_small(dst + d, nzrun_len);
-                    if (d + nzrun_len > dlen) {
-                        return -1;
-                    }
-                    nzrun_start = new_buf + i - nzrun_len;
-                    memcpy(dst + d, nzrun_start, nzrun_len);
-                    d += nzrun_len;
-                    nzrun_len = 0;
-                }
-                /* 64 data at a time for speed */
-                if (count512s && (comp == 0xffffffffffffffff)) {
-                    i += 64;
-                    zrun_len += 64;
-                    break;
-                }
-                never_same = false;
-                num = ctz64(~comp);
-                num = (num < bytes_to_check) ? num : bytes_to_check;
-                zrun_len += num;
-                bytes_to_check -= num;
-                comp >>= num;
-                i += num;
-                if (bytes_to_check) {
-                    /* still has different data after same data */
-                    d += uleb128_encode_small(dst + d, zrun_len);
-                    zrun_len = 0;
-                } else {
-                    break;
-                }
-            }
-            if (never_same || zrun_len) {
-                /*
-                 * never_same only acts if
-                 * data begins with diff in first count512s
-                 */
-                d += uleb128_encode_small(dst + d, zrun_len);
-                zrun_len = 0;
-                never_same = false;
-            }
-            /* has diff, 64 data at a time for speed */
-            if ((bytes_to_check == 64) && (comp == 0x0)) {
-                i += 64;
-                nzrun_len += 64;
-                break;
-            }
-            num = ctz64(comp);
-            num = (num < bytes_to_check) ? num : bytes_to_check;
-            nzrun_len += num;
-            bytes_to_check -= num;
-            comp >>= num;
-            i += num;
-            if (bytes_to_check) {
-                /* mask like 111000 */
-                d += uleb128_encode_small(dst + d, nzrun_len);
-                /* overflow */
-                if (d + nzrun_len > dlen) {
-                    return -1;
-                }
-                nzrun_start = new_buf + i - nzrun_len;
-                memcpy(dst + d, nzrun_start, nzrun_len);
-                d += nzrun_len;
-                nzrun_len = 0;
-                is_same = true;
-            }
+    }
+    return xbzrle_encoder_finish(&e);
+}
+#endif /* CONFIG_AVX512BW_OPT */
+
+#if defined(CONFIG_AVX2_OPT)
+static int __attribute__((target("avx2")))
+xbzrle_encode_buffer_avx2(uint8_t *old_buf, uint8_t *new_buf, int slen,
+                          uint8_t *dst, int dlen)
+{
+    XBZRLEEncoder e;
+    int i;
+
+    if (!xbzrle_encoder_init(&e, new_buf, slen, dst, dlen)) {
+        return -1;
+    }
+    for (i = 0; i + 64 <= slen; i += 64) {
+        __m256i o0 = _mm256_loadu_si256((__m256i *)(old_buf + i));
+        __m256i o1 = _mm256_loadu_si256((__m256i *)(old_buf + i + 32));
+        __m256i n0 = _mm256_loadu_si256((__m256i *)(new_buf + i));
+        __m256i n1 = _mm256_loadu_si256((__m256i *)(new_buf + i + 32));
+        uint32_t lo = _mm256_movemask_epi8(_mm256_cmpeq_epi8(o0, n0));
+        uint32_t hi = _mm256_movemask_epi8(_mm256_cmpeq_epi8(o1, n1));
+
+        if (!xbzrle_encode_mask(&e, ((uint64_t)hi << 32) | lo, 64)) {
+            return -1;
         }
     }
+    if (i < slen &&
+        !xbzrle_encode_mask(&e, xbzrle_same_mask_tail(old_buf + i,
+                                                      new_buf + i, slen - i),
+                            slen - i)) {
+        return -1;
+    }
+    return xbzrle_encoder_finish(&e);
+}
+#endif /* CONFIG_AVX2_OPT */
 
-    if (nzrun_len != 0) {
-        d += uleb128_encode_small(dst + d, nzrun_len);
-        /* overflow */
-        if (d + nzrun_len > dlen) {
+#if defined(__aarch64__)
+static int xbzrle_encode_buffer_neon(uint8_t *old_buf, uint8_t *new_buf,
+                                     int slen, uint8_t *dst, int dlen)
+{
+    /* Weight of each byte in the mask, reduced by pairwise additions */
+    static const uint8_t bits[16] = {
+        1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128
+    };
+    const uint8x16_t weight = vld1q_u8(bits);
+    XBZRLEEncoder e;
+    int i;
+
+    if (!xbzrle_encoder_init(&e, new_buf, slen, dst, dlen)) {
+        return -1;
+    }
+    for (i = 0; i + 64 <= slen; i += 64) {
+        uint8x16_t m0 = vandq_u8(vceqq_u8(vld1q_u8(old_buf + i),
+                                          vld1q_u8(new_buf + i)), weight);
+        uint8x16_t m1 = vandq_u8(vceqq_u8(vld1q_u8(old_buf + i + 16),
+                                          vld1q_u8(new_buf + i + 16)), weight);
+        uint8x16_t m2 = vandq_u8(vceqq_u8(vld1q_u8(old_buf + i + 32),
+                                          vld1q_u8(new_buf + i + 32)), weight);
+        uint8x16_t m3 = vandq_u8(vceqq_u8(vld1q_u8(old_buf + i + 48),
+                                          vld1q_u8(new_buf + i + 48)), weight);
+        uint8x16_t m = vpaddq_u8(vpaddq_u8(m0, m1), vpaddq_u8(m2, m3));
+
+        m = vpaddq_u8(m, m);
+        if (!xbzrle_encode_mask(&e, vgetq_lane_u64(vreinterpretq_u64_u8(m), 0),
+                                64)) {
             return -1;
         }
-        nzrun_start = new_buf + i - nzrun_len;
-        memcpy(dst + d, nzrun_start, nzrun_len);
-        d += nzrun_len;
     }
-    return d;
+    if (i < slen &&
+        !xbzrle_encode_mask(&e, xbzrle_same_mask_tail(old_buf + i,
+                                                      new_buf + i, slen - i),
+                            slen - i)) {
+        return -1;
+    }
+    return xbzrle_encoder_finish(&e);
 }
+#endif /* __aarch64__ */
 
+#ifdef XBZRLE_ENCODE_ACCEL
 static int xbzrle_encode_buffer_int(uint8_t *old_buf, uint8_t *new_buf,
                                     int slen, uint8_t *dst, int dlen);
 
-static int (*accel_func)(uint8_t *, uint8_t *, int, uint8_t *, int);
+static const struct {
+    unsigned bit;
+    const char *name;
+    int (*fn)(uint8_t *, uint8_t *, int, uint8_t *, int);
+} accel_all[] = {
+    /* Sorted in order of preference */
+#if defined(CONFIG_AVX512BW_OPT)
+    { CPUINFO_AVX512BW, "avx512bw", xbzrle_encode_buffer_avx512 },
+#endif
+#if defined(CONFIG_AVX2_OPT)
+    { CPUINFO_AVX2, "avx2", xbzrle_encode_buffer_avx2 },
+#endif
+#if defined(__aarch64__)
+    { CPUINFO_ALWAYS, "neon", xbzrle_encode_buffer_neon },
+#endif
+    { CPUINFO_ALWAYS, "int", xbzrle_encode_buffer_int },
+};
 
-static void __attribute__((constructor)) init_accel(void)
+static unsigned accel_index;
+
+static bool select_accel(unsigned first)
 {
     unsigned info = cpuinfo_init();
-    if (info & CPUINFO_AVX512BW) {
-        accel_func = xbzrle_encode_buffer_avx512;
-    } else {
-        accel_func = xbzrle_encode_buffer_int;
+
+    for (unsigned i = first; i < ARRAY_SIZE(accel_all); i++) {
+        if (info & accel_all[i].bit) {
+            accel_index = i;
+            return true;
+        }
     }
+    return false;
+}
+
+static void __attribute__((constructor)) init_accel(void)
+{
+    select_accel(0);
+}
+
+bool test_xbzrle_encode_next_accel(void)
+{
+    return select_accel(accel_index + 1);
+}
+
+const char *xbzrle_encode_accel_name(void)
+{
+    return accel_all[accel_index].name;
 }
 
 int xbzrle_encode_buffer(uint8_t *old_buf, uint8_t *new_buf, int slen,
                          uint8_t *dst, int dlen)
 {
-    return accel_func(old_buf, new_buf, slen, dst, dlen);
+    return accel_all[accel_index].fn(old_buf, new_buf, slen, dst, dlen);
 }
 
 #define xbzrle_encode_buffer xbzrle_encode_buffer_int
-#endif
+#else
+bool test_xbzrle_encode_next_accel(void)
+{
+    return false;
+}
+
+const char *xbzrle_encode_accel_name(void)
+{
+    return "int";
+}
+#endif /* XBZRLE_ENCODE_ACCEL */
 
 /*
   page = zrun nzrun
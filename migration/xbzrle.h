@@ -19,4 +19,13 @@ int xbzrle_encode_buffer(uint8_t *old_buf, uint8_t *new_buf, int slen,
 
 int xbzrle_decode_buffer(uint8_t *src, int slen, uint8_t *dst, int dlen);
 
+/*
+ * Switch xbzrle_encode_buffer() to the next encoder supported by the
+ * host, in order of preference; returns false when there is none left.
+ * For tests and benchmarks only.
+ */
+bool test_xbzrle_encode_next_accel(void);
+/* Name of the encoder currently used by xbzrle_encode_buffer() */
+const char *xbzrle_encode_accel_name(void);
+
 #endif
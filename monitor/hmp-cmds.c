@@ -225,8 +225,29 @@ void hmp_info_iothreads(Monitor *mon, const QDict *qdict)
         monitor_printf(mon, "  poll-max-ns=%" PRId64 "\n", value->poll_max_ns);
         monitor_printf(mon, "  poll-grow=%" PRId64 "\n", value->poll_grow);
         monitor_printf(mon, "  poll-shrink=%" PRId64 "\n", value->poll_shrink);
+        monitor_printf(mon, "  poll-busy=%s\n",
+                       value->poll_busy ? "on" : "off");
         monitor_printf(mon, "  aio-max-batch=%" PRId64 "\n",
                        value->aio_max_batch);
+        monitor_printf(mon, "  aio-batch-adaptive=%s\n",
+                       value->aio_batch_adaptive ? "on" : "off");
+        if (value->has_aio_batch_size) {
+            monitor_printf(mon, "  aio-batch-size=%" PRId64 "\n",
+                           value->aio_batch_size);
+        }
+        if (value->has_aio_latency_ns) {
+            monitor_printf(mon, "  aio-latency-ns=%" PRId64 "\n",
+                           value->aio_latency_ns);
+        }
+        if (value->thread_pool) {
+            ThreadPoolInfo *tp = value->thread_pool;
+
+            monitor_printf(mon, "  thread-pool: min=%" PRId64 " max=%" PRId64
+                           " cur=%" PRId64 " idle=%" PRId64
+                           " queue-depth=%" PRId64 "\n",
+                           tp->min_threads, tp->max_threads, tp->cur_threads,
+                           tp->idle_threads, tp->queue_depth);
+        }
     }
 
     qapi_free_IOThreadInfoList(info_list);
@@ -247,10 +268,11 @@ void hmp_info_sync_profile(Monitor *mon, const QDict *qdict)
     int64_t max = qdict_get_try_int(qdict, "max", 10);
     bool mean = qdict_get_try_bool(qdict, "mean", false);
     bool coalesce = !qdict_get_try_bool(qdict, "no_coalesce", false);
+    bool folded = qdict_get_try_bool(qdict, "folded", false);
     enum QSPSortBy sort_by;
 
     sort_by = mean ? QSP_SORT_BY_AVG_WAIT_TIME : QSP_SORT_BY_TOTAL_WAIT_TIME;
-    qsp_report(max, sort_by, coalesce);
+    qsp_report(max, sort_by, coalesce, folded);
 }
 
 void hmp_info_history(Monitor *mon, const QDict *qdict)
@@ -189,21 +189,21 @@ void monitor_flush(Monitor *mon)
 /* flush at every end of line */
 int monitor_puts_locked(Monitor *mon, const char *str)
 {
-    int i;
-    char c;
+    const char *p = str;
 
-    for (i = 0; str[i]; i++) {
-        c = str[i];
-        if (c == '\n') {
-            g_string_append_c(mon->outbuf, '\r');
-        }
-        g_string_append_c(mon->outbuf, c);
-        if (c == '\n') {
+    while (*p) {
+        size_t len = strcspn(p, "\n");
+
+        g_string_append_len(mon->outbuf, p, len);
+        p += len;
+        if (*p == '\n') {
+            g_string_append(mon->outbuf, "\r\n");
             monitor_flush_locked(mon);
+            p++;
         }
     }
 
-    return i;
+    return p - str;
 }
 
 int monitor_puts(Monitor *mon, const char *str)
@@ -129,19 +129,37 @@ static void monitor_qmp_cleanup_queue_and_resume(MonitorQMP *mon)
 
 }
 
+/* Called with mon->common.mon_lock held.  */
+static void qmp_send_response_chunk(void *opaque, const char *buf, size_t len)
+{
+    Monitor *mon = opaque;
+
+    /* @buf is NUL-terminated, as it comes straight from a GString */
+    assert(!buf[len]);
+    monitor_puts_locked(mon, buf);
+    monitor_flush_locked(mon);
+}
+
 void qmp_send_response(MonitorQMP *mon, const QDict *rsp)
 {
     const QObject *data = QOBJECT(rsp);
-    GString *json;
 
-    json = qobject_to_json_pretty(data, mon->pretty);
-    assert(json != NULL);
-    trace_monitor_qmp_respond(mon, json->str);
+    if (trace_event_get_state_backends(TRACE_MONITOR_QMP_RESPOND)) {
+        g_autoptr(GString) json = qobject_to_json_pretty(data, mon->pretty);
 
-    g_string_append_c(json, '\n');
-    monitor_puts(&mon->common, json->str);
+        trace_monitor_qmp_respond(mon, json->str);
+    }
 
-    g_string_free(json, true);
+    /*
+     * Serialize straight into the output buffer, pushing it to the chardev
+     * as it fills up, instead of building the whole response as a string
+     * first.  Big replies such as query-blockstats on a VM with hundreds of
+     * disks then need neither a second copy nor a long copying pass.
+     */
+    QEMU_LOCK_GUARD(&mon->common.mon_lock);
+    qobject_to_json_stream(data, mon->pretty, qmp_send_response_chunk,
+                           &mon->common);
+    monitor_puts_locked(&mon->common, "\n");
 }
 
 /*
@@ -28,6 +28,7 @@
 #include "nbd-internal.h"
 #include "qemu/units.h"
 #include "qemu/memalign.h"
+#include "sysemu/iothread.h"
 
 #define NBD_META_ID_BASE_ALLOCATION 0
 #define NBD_META_ID_ALLOCATION_DEPTH 1
@@ -42,6 +43,16 @@
  */
 #define NBD_MAX_BLOCK_STATUS_EXTENTS (1 * MiB / 8)
 
+/*
+ * Read payloads smaller than NBD_ZERO_COPY_MIN_SIZE are copied even
+ * with zero-copy enabled: below it, page pinning and the completion
+ * notification cost more than the copy.  Buffers sent with zero copy
+ * are released in batches once NBD_ZERO_COPY_MAX_PENDING bytes of them
+ * are waiting for the kernel's completion notification.
+ */
+#define NBD_ZERO_COPY_MIN_SIZE (16 * KiB)
+#define NBD_ZERO_COPY_MAX_PENDING (64 * MiB)
+
 static int system_errno_to_nbd_errno(int err)
 {
     switch (err) {
@@ -82,6 +93,7 @@ typedef struct NBDRequestData NBDRequestData;
 struct NBDRequestData {
     NBDClient *client;
     uint8_t *data;
+    size_t zero_copy_len; /* bytes of @data the kernel may still reference */
     bool complete;
 };
 
@@ -101,6 +113,13 @@ struct NBDExport {
     bool allocation_depth;
     BdrvDirtyBitmap **export_bitmaps;
     size_t nr_export_bitmaps;
+
+    /* IOThreads new clients are spread across, round-robin */
+    IOThread **client_iothreads;
+    size_t nr_client_iothreads;
+    size_t next_client_iothread;
+
+    bool zero_copy;
 };
 
 static QTAILQ_HEAD(, NBDExport) exports = QTAILQ_HEAD_INITIALIZER(exports);
@@ -124,6 +143,11 @@ struct NBDClient {
     void (*close_fn)(NBDClient *client, bool negotiated);
 
     NBDExport *exp;
+    /*
+     * The IOThread context the client runs in, or NULL to run in the
+     * export's AioContext and follow it when it changes.
+     */
+    AioContext *ctx;
     QCryptoTLSCreds *tlscreds;
     char *tlsauthz;
     QIOChannelSocket *sioc; /* The underlying data channel */
@@ -146,6 +170,15 @@ struct NBDClient {
     bool structured_reply;
     NBDExportMetaContexts export_meta;
 
+    /*
+     * Read payloads are sent with QIO_CHANNEL_WRITE_FLAG_ZERO_COPY.
+     * Their buffers are kept in zero_copy_bufs until qio_channel_flush()
+     * reports that the kernel is done with them.
+     */
+    bool zero_copy;
+    GSList *zero_copy_bufs;
+    size_t zero_copy_pending;
+
     uint32_t opt; /* Current option being negotiated */
     uint32_t optlen; /* remaining length of data in ioc for the option being
                         negotiated now */
@@ -153,6 +186,11 @@ struct NBDClient {
 
 static void nbd_client_receive_next_request(NBDClient *client);
 
+static AioContext *nbd_client_get_aio_context(NBDClient *client)
+{
+    return client->ctx ?: client->exp->common.ctx;
+}
+
 /* Basic flow for negotiation
 
    Server         Client
@@ -1352,10 +1390,28 @@ static coroutine_fn int nbd_negotiate(NBDClient *client, Error **errp)
         return ret;
     }
 
-    /* Attach the channel to the same AioContext as the export */
-    if (client->exp && client->exp->common.ctx) {
-        qio_channel_attach_aio_context(client->ioc, client->exp->common.ctx);
+    /*
+     * Attach the channel to the next of the export's client IOThreads,
+     * or to the same AioContext as the export
+     */
+    if (client->exp && client->exp->nr_client_iothreads) {
+        NBDExport *exp = client->exp;
+        IOThread *iothread = exp->client_iothreads[exp->next_client_iothread];
+
+        exp->next_client_iothread =
+            (exp->next_client_iothread + 1) % exp->nr_client_iothreads;
+        client->ctx = iothread_get_aio_context(iothread);
     }
+    if (client->exp && nbd_client_get_aio_context(client)) {
+        qio_channel_attach_aio_context(client->ioc,
+                                       nbd_client_get_aio_context(client));
+    }
+
+    /* Zero copy needs the plain socket, TLS encrypts into its own buffer */
+    client->zero_copy = client->exp && client->exp->zero_copy &&
+        client->ioc == QIO_CHANNEL(client->sioc) &&
+        qio_channel_has_feature(client->ioc,
+                                QIO_CHANNEL_FEATURE_WRITE_ZERO_COPY);
 
     assert(!client->optlen);
     trace_nbd_negotiate_success();
@@ -1477,6 +1533,8 @@ void nbd_client_put(NBDClient *client)
             blk_exp_unref(&client->exp->common);
         }
         g_free(client->export_meta.bitmaps);
+        /* The socket is closed, nothing can be sent from these anymore */
+        g_slist_free_full(client->zero_copy_bufs, qemu_vfree);
         g_free(client);
     }
 }
@@ -1514,11 +1572,50 @@ static NBDRequestData *nbd_request_get(NBDClient *client)
     return req;
 }
 
+/*
+ * Wait until the kernel has transmitted everything queued with zero
+ * copy, then release the buffers that were retained for it.
+ */
+static void nbd_client_flush_zero_copy(NBDClient *client)
+{
+    Error *local_err = NULL;
+    int ret;
+
+    trace_nbd_client_flush_zero_copy(client, client->zero_copy_pending);
+    ret = qio_channel_flush(client->ioc, &local_err);
+    if (ret < 0) {
+        /*
+         * The connection is broken; keep the buffers until the socket
+         * is closed in nbd_client_put().
+         */
+        error_reportf_err(local_err, "Disconnect client, due to: ");
+        client_close(client, true);
+        return;
+    }
+    if (ret == 1) {
+        /* The kernel copied every buffer anyway, e.g. over loopback */
+        trace_nbd_client_zero_copy_fallback(client);
+        client->zero_copy = false;
+    }
+
+    g_slist_free_full(client->zero_copy_bufs, qemu_vfree);
+    client->zero_copy_bufs = NULL;
+    client->zero_copy_pending = 0;
+}
+
 static void nbd_request_put(NBDRequestData *req)
 {
     NBDClient *client = req->client;
 
-    if (req->data) {
+    if (req->zero_copy_len) {
+        client->zero_copy_bufs = g_slist_prepend(client->zero_copy_bufs,
+                                                 req->data);
+        client->zero_copy_pending += req->zero_copy_len;
+        if (client->zero_copy_pending >= NBD_ZERO_COPY_MAX_PENDING &&
+            !client->closing) {
+            nbd_client_flush_zero_copy(client);
+        }
+    } else if (req->data) {
         qemu_vfree(req->data);
     }
     g_free(req);
@@ -1544,7 +1641,9 @@ static void blk_aio_attached(AioContext *ctx, void *opaque)
     exp->common.ctx = ctx;
 
     QTAILQ_FOREACH(client, &exp->clients, next) {
-        qio_channel_attach_aio_context(client->ioc, ctx);
+        if (!client->ctx) {
+            qio_channel_attach_aio_context(client->ioc, ctx);
+        }
 
         assert(client->nb_requests == 0);
         assert(client->recv_coroutine == NULL);
@@ -1560,7 +1659,9 @@ static void blk_aio_detach(void *opaque)
     trace_nbd_blk_aio_detach(exp->name, exp->common.ctx);
 
     QTAILQ_FOREACH(client, &exp->clients, next) {
-        qio_channel_detach_aio_context(client->ioc);
+        if (!client->ctx) {
+            qio_channel_detach_aio_context(client->ioc);
+        }
     }
 
     exp->common.ctx = NULL;
@@ -1645,6 +1746,7 @@ static int nbd_export_create(BlockExport *blk_exp, BlockExportOptions *exp_args,
     uint64_t perm, shared_perm;
     bool readonly = !exp_args->writable;
     BlockDirtyBitmapOrStrList *bitmaps;
+    strList *iothreads;
     size_t i;
     int ret;
 
@@ -1770,6 +1872,24 @@ static int nbd_export_create(BlockExport *blk_exp, BlockExportOptions *exp_args,
     }
 
     exp->allocation_depth = arg->allocation_depth;
+#ifdef CONFIG_LINUX
+    exp->zero_copy = arg->zero_copy;
+#endif
+
+    for (iothreads = arg->client_iothreads; iothreads;
+         iothreads = iothreads->next) {
+        IOThread *iothread = iothread_by_id(iothreads->value);
+
+        if (!iothread) {
+            ret = -EINVAL;
+            error_setg(errp, "iothread \"%s\" not found", iothreads->value);
+            goto fail_iothreads;
+        }
+        exp->client_iothreads = g_renew(IOThread *, exp->client_iothreads,
+                                        exp->nr_client_iothreads + 1);
+        exp->client_iothreads[exp->nr_client_iothreads++] = iothread;
+        object_ref(OBJECT(iothread));
+    }
 
     /*
      * We need to inhibit request queuing in the block layer to ensure we can
@@ -1786,6 +1906,14 @@ static int nbd_export_create(BlockExport *blk_exp, BlockExportOptions *exp_args,
 
     return 0;
 
+fail_iothreads:
+    for (i = 0; i < exp->nr_client_iothreads; i++) {
+        object_unref(OBJECT(exp->client_iothreads[i]));
+    }
+    g_free(exp->client_iothreads);
+    for (i = 0; i < exp->nr_export_bitmaps; i++) {
+        bdrv_dirty_bitmap_set_busy(exp->export_bitmaps[i], false);
+    }
 fail:
     g_free(exp->export_bitmaps);
     g_free(exp->name);
@@ -1857,6 +1985,11 @@ static void nbd_export_delete(BlockExport *blk_exp)
     for (i = 0; i < exp->nr_export_bitmaps; i++) {
         bdrv_dirty_bitmap_set_busy(exp->export_bitmaps[i], false);
     }
+
+    for (i = 0; i < exp->nr_client_iothreads; i++) {
+        object_unref(OBJECT(exp->client_iothreads[i]));
+    }
+    g_free(exp->client_iothreads);
 }
 
 const BlockExportDriver blk_exp_nbd = {
@@ -1867,8 +2000,15 @@ const BlockExportDriver blk_exp_nbd = {
     .request_shutdown   = nbd_export_request_shutdown,
 };
 
-static int coroutine_fn nbd_co_send_iov(NBDClient *client, struct iovec *iov,
-                                        unsigned niov, Error **errp)
+/*
+ * Send @iov to the client.  If @zero_copy, the last element of @iov is
+ * a read payload that is sent with QIO_CHANNEL_WRITE_FLAG_ZERO_COPY; the
+ * caller's buffer must then stay untouched until nbd_request_put().
+ * The headers before it usually live on the stack and are always copied.
+ */
+static int coroutine_fn nbd_co_send_iov_full(NBDClient *client,
+                                             struct iovec *iov, unsigned niov,
+                                             bool zero_copy, Error **errp)
 {
     int ret;
 
@@ -1876,7 +2016,18 @@ static int coroutine_fn nbd_co_send_iov(NBDClient *client, struct iovec *iov,
     qemu_co_mutex_lock(&client->send_lock);
     client->send_coroutine = qemu_coroutine_self();
 
-    ret = qio_channel_writev_all(client->ioc, iov, niov, errp) < 0 ? -EIO : 0;
+    if (zero_copy) {
+        ret = qio_channel_writev_all(client->ioc, iov, niov - 1, errp);
+        if (ret == 0) {
+            ret = qio_channel_writev_full_all(client->ioc, &iov[niov - 1], 1,
+                                              NULL, 0,
+                                              QIO_CHANNEL_WRITE_FLAG_ZERO_COPY,
+                                              errp);
+        }
+    } else {
+        ret = qio_channel_writev_all(client->ioc, iov, niov, errp);
+    }
+    ret = ret < 0 ? -EIO : 0;
 
     client->send_coroutine = NULL;
     qemu_co_mutex_unlock(&client->send_lock);
@@ -1884,6 +2035,17 @@ static int coroutine_fn nbd_co_send_iov(NBDClient *client, struct iovec *iov,
     return ret;
 }
 
+static int coroutine_fn nbd_co_send_iov(NBDClient *client, struct iovec *iov,
+                                        unsigned niov, Error **errp)
+{
+    return nbd_co_send_iov_full(client, iov, niov, false, errp);
+}
+
+static bool nbd_client_use_zero_copy(NBDClient *client, size_t len)
+{
+    return client->zero_copy && len >= NBD_ZERO_COPY_MIN_SIZE;
+}
+
 static inline void set_be_simple_reply(NBDSimpleReply *reply, uint64_t error,
                                        uint64_t cookie)
 {
@@ -1912,7 +2074,8 @@ static int coroutine_fn nbd_co_send_simple_reply(NBDClient *client,
                                    nbd_err_lookup(nbd_err), len);
     set_be_simple_reply(&reply, nbd_err, request->cookie);
 
-    return nbd_co_send_iov(client, iov, 2, errp);
+    return nbd_co_send_iov_full(client, iov, 2,
+                                nbd_client_use_zero_copy(client, len), errp);
 }
 
 /*
@@ -1981,7 +2144,8 @@ static int coroutine_fn nbd_co_send_chunk_read(NBDClient *client,
                  NBD_REPLY_TYPE_OFFSET_DATA, request);
     stq_be_p(&chunk.offset, offset);
 
-    return nbd_co_send_iov(client, iov, 3, errp);
+    return nbd_co_send_iov_full(client, iov, 3,
+                                nbd_client_use_zero_copy(client, size), errp);
 }
 /*ebb*/
 static int coroutine_fn nbd_co_send_chunk_error(NBDClient *client,
@@ -2703,6 +2867,10 @@ static coroutine_fn void nbd_trip(void *opaque)
         error_free(export_err);
     } else {
         ret = nbd_handle_request(client, &request, req->data, &local_err);
+        if (request.type == NBD_CMD_READ && client->zero_copy) {
+            /* Part of req->data may still be queued in the socket */
+            req->zero_copy_len = request.len;
+        }
     }
     if (ret < 0) {
         error_prepend(&local_err, "Failed to send reply: ");
@@ -2737,8 +2905,11 @@ static void nbd_client_receive_next_request(NBDClient *client)
     if (!client->recv_coroutine && client->nb_requests < MAX_NBD_REQUESTS &&
         !client->quiescing) {
         nbd_client_get(client);
-        client->recv_coroutine = qemu_coroutine_create(nbd_trip, client);
-        aio_co_schedule(client->exp->common.ctx, client->recv_coroutine);
+        client->recv_coroutine =
+            qemu_coroutine_create_sized(nbd_trip, client,
+                                        COROUTINE_STACK_SMALL);
+        aio_co_schedule(nbd_client_get_aio_context(client),
+                        client->recv_coroutine);
     }
 }
 
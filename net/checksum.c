@@ -18,25 +18,221 @@
 #include "qemu/osdep.h"
 #include "net/checksum.h"
 #include "net/eth.h"
+#include "host/cpuinfo.h"
+
+/*
+ * The functions below add up the 16-bit words of a buffer in host byte
+ * order.  A ones' complement sum does not depend on byte order except
+ * for swapping the bytes of the result (RFC 1071, section 2.B), so
+ * net_checksum_add_cont() fixes up the order once at the end.  The
+ * returned 64-bit accumulators are folded to 16 bits by the caller.
+ */
+static uint64_t net_checksum_int(const uint8_t *buf, size_t len)
+{
+    uint64_t sum = 0;
+
+    for (; len >= 8; buf += 8, len -= 8) {
+        uint64_t w = ldq_he_p(buf);
+
+        sum += (uint32_t)w;
+        sum += w >> 32;
+    }
+    if (len >= 4) {
+        sum += ldl_he_p(buf);
+        buf += 4;
+        len -= 4;
+    }
+    if (len >= 2) {
+        sum += lduw_he_p(buf);
+        buf += 2;
+        len -= 2;
+    }
+    if (len) {
+        /* A trailing odd byte is padded with zero */
+        uint8_t tail[2] = { buf[0], 0 };
+
+        sum += lduw_he_p(tail);
+    }
+
+    return sum;
+}
+
+/*
+ * The vector versions widen words into 32-bit lanes, each of which adds
+ * two words per block.  Emptying the lanes every this many blocks keeps
+ * them from overflowing.
+ */
+#define CSUM_BLOCKS_PER_FLUSH 32767
+
+#if defined(CONFIG_AVX2_OPT) || defined(__SSE2__)
+#include <immintrin.h>
+
+static uint64_t __attribute__((target("sse2")))
+net_checksum_sse2(const uint8_t *buf, size_t len)
+{
+    const __m128i zero = _mm_setzero_si128();
+    uint64_t sum = 0;
+
+    while (len >= 16) {
+        size_t n = MIN(len / 16, CSUM_BLOCKS_PER_FLUSH);
+        __m128i acc = zero;
+        uint32_t lanes[4];
+
+        len -= n * 16;
+        for (; n; n--, buf += 16) {
+            __m128i v = _mm_loadu_si128((const __m128i *)buf);
+
+            acc = _mm_add_epi32(acc, _mm_unpacklo_epi16(v, zero));
+            acc = _mm_add_epi32(acc, _mm_unpackhi_epi16(v, zero));
+        }
+        _mm_storeu_si128((__m128i *)lanes, acc);
+        sum += (uint64_t)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    }
+
+    return sum + net_checksum_int(buf, len);
+}
+
+#ifdef CONFIG_AVX2_OPT
+static uint64_t __attribute__((target("avx2")))
+net_checksum_avx2(const uint8_t *buf, size_t len)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    uint64_t sum = 0;
+
+    while (len >= 32) {
+        size_t n = MIN(len / 32, CSUM_BLOCKS_PER_FLUSH);
+        __m256i acc = zero;
+        uint32_t lanes[8];
+
+        len -= n * 32;
+        for (; n; n--, buf += 32) {
+            __m256i v = _mm256_loadu_si256((const __m256i *)buf);
+
+            acc = _mm256_add_epi32(acc, _mm256_unpacklo_epi16(v, zero));
+            acc = _mm256_add_epi32(acc, _mm256_unpackhi_epi16(v, zero));
+        }
+        _mm256_storeu_si256((__m256i *)lanes, acc);
+        for (int i = 0; i < 8; i++) {
+            sum += lanes[i];
+        }
+    }
+
+    return sum + net_checksum_int(buf, len);
+}
+#endif /* CONFIG_AVX2_OPT */
+
+/*
+ * As in util/bufferiszero.c, start from SSE2 if the compiler assumes it
+ * and cannot build the AVX2 version anyway.
+ */
+#ifdef CONFIG_AVX2_OPT
+# define INIT_USED     0
+# define INIT_ACCEL    net_checksum_int
+#else
+# ifndef __SSE2__
+#  error "ISA selection confusion"
+# endif
+# define INIT_USED     CPUINFO_SSE2
+# define INIT_ACCEL    net_checksum_sse2
+#endif
+
+static unsigned used_accel = INIT_USED;
+static uint64_t (*checksum_accel)(const uint8_t *, size_t) = INIT_ACCEL;
+
+static unsigned __attribute__((noinline))
+select_accel_cpuinfo(unsigned info)
+{
+    /* Array is sorted in order of algorithm preference. */
+    static const struct {
+        unsigned bit;
+        uint64_t (*fn)(const uint8_t *, size_t);
+    } all[] = {
+#ifdef CONFIG_AVX2_OPT
+        { CPUINFO_AVX2,     net_checksum_avx2 },
+#endif
+        { CPUINFO_SSE2,     net_checksum_sse2 },
+        { CPUINFO_ALWAYS,   net_checksum_int },
+    };
+
+    for (unsigned i = 0; i < ARRAY_SIZE(all); ++i) {
+        if (info & all[i].bit) {
+            checksum_accel = all[i].fn;
+            return all[i].bit;
+        }
+    }
+    return 0;
+}
+
+#ifdef CONFIG_AVX2_OPT
+static void __attribute__((constructor)) init_accel(void)
+{
+    used_accel = select_accel_cpuinfo(cpuinfo_init());
+}
+#endif /* CONFIG_AVX2_OPT */
+
+bool test_net_checksum_next_accel(void)
+{
+    unsigned used = select_accel_cpuinfo(cpuinfo & ~used_accel);
+    used_accel |= used;
+    return used;
+}
+
+#elif defined(__aarch64__) && !HOST_BIG_ENDIAN
+#include <arm_neon.h>
+
+/* Advanced SIMD is architecturally guaranteed on AArch64 */
+static uint64_t checksum_accel(const uint8_t *buf, size_t len)
+{
+    uint64_t sum = 0;
+
+    while (len >= 16) {
+        size_t n = MIN(len / 16, CSUM_BLOCKS_PER_FLUSH);
+        uint32x4_t acc = vdupq_n_u32(0);
+
+        len -= n * 16;
+        for (; n; n--, buf += 16) {
+            acc = vpadalq_u16(acc, vreinterpretq_u16_u8(vld1q_u8(buf)));
+        }
+        sum += vaddlvq_u32(acc);
+    }
+
+    return sum + net_checksum_int(buf, len);
+}
+
+bool test_net_checksum_next_accel(void)
+{
+    return false;
+}
+#else
+#define checksum_accel net_checksum_int
+bool test_net_checksum_next_accel(void)
+{
+    return false;
+}
+#endif
 
 uint32_t net_checksum_add_cont(int len, uint8_t *buf, int seq)
 {
-    uint32_t sum1 = 0, sum2 = 0;
-    int i;
+    uint64_t sum;
 
-    for (i = 0; i < len - 1; i += 2) {
-        sum1 += (uint32_t)buf[i];
-        sum2 += (uint32_t)buf[i + 1];
+    if (len <= 0) {
+        return 0;
     }
-    if (i < len) {
-        sum1 += (uint32_t)buf[i];
+
+    sum = len >= 64 ? checksum_accel(buf, len) : net_checksum_int(buf, len);
+    while (sum >> 16) {
+        sum = (sum & 0xffff) + (sum >> 16);
     }
 
-    if (seq & 1) {
-        return sum1 + (sum2 << 8);
-    } else {
-        return sum2 + (sum1 << 8);
+    /*
+     * Callers expect the byte at an even position of the stream, as told
+     * by seq, in the upper half of the word.
+     */
+    if (!!(seq & 1) == HOST_BIG_ENDIAN) {
+        sum = bswap16(sum);
     }
+
+    return sum;
 }
 
 uint16_t net_checksum_finish(uint32_t sum)
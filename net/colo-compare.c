@@ -33,6 +33,7 @@
 
 #include "block/aio-wait.h"
 #include "qemu/coroutine.h"
+#include "qemu/thread.h"
 
 #define TYPE_COLO_COMPARE "colo-compare"
 typedef struct CompareState CompareState;
@@ -54,6 +55,8 @@ static NotifierList colo_compare_notifiers =
 #define REGULAR_PACKET_CHECK_MS 1000
 #define DEFAULT_TIME_OUT_MS 3000
 
+#define MAX_COMPARE_THREADS 64
+
 /* #define DEBUG_COLO_PACKETS */
 
 static QemuMutex colo_compare_mutex;
@@ -102,6 +105,50 @@ typedef struct SendEntry {
     uint8_t *buf;
 } SendEntry;
 
+/* A packet handed from the iothread to a compare thread */
+typedef struct CompareWork {
+    Packet *pkt;
+    ConnectionKey key;
+    int mode;
+    QSLIST_ENTRY(CompareWork) next;
+} CompareWork;
+
+/* A released primary packet handed back from a compare thread */
+typedef struct CompareOut {
+    uint8_t *buf;
+    uint32_t size;
+    uint32_t vnet_hdr_len;
+    QSLIST_ENTRY(CompareOut) next;
+} CompareOut;
+
+/*
+ * Connections are sharded by the hash of their key, so all the packets
+ * of one connection are compared in order by the same shard.  Without
+ * compare threads there is a single shard, driven by the iothread.
+ */
+typedef struct CompareShard {
+    struct CompareState *s;
+
+    /*
+     * Record the connection that through the NIC
+     * Element type: Connection
+     */
+    GQueue conn_list;
+    /* Record the connection without repetition */
+    GHashTable *connection_track_table;
+    /*
+     * Held by the compare thread while it works on the connections, and
+     * by the iothread for the regular check and the checkpoint flush.
+     */
+    QemuMutex lock;
+
+    /* Packets pushed by the iothread, in reverse arrival order */
+    QSLIST_HEAD(, CompareWork) inbox;
+    QemuThread thread;
+    QemuEvent event;
+    bool stopping;
+} CompareShard;
+
 struct CompareState {
     Object parent;
 
@@ -121,14 +168,17 @@ struct CompareState {
     bool vnet_hdr;
     uint64_t compare_timeout;
     uint32_t expired_scan_cycle;
+    uint32_t compare_threads;
 
+    CompareShard *shards;
+    uint32_t nr_shards;
     /*
-     * Record the connection that through the NIC
-     * Element type: Connection
+     * Released packets and checkpoint requests from the compare threads,
+     * sent from the iothread by out_bh.
      */
-    GQueue conn_list;
-    /* Record the connection without repetition */
-    GHashTable *connection_track_table;
+    QSLIST_HEAD(, CompareOut) outbox;
+    QEMUBH *out_bh;
+    bool notify_pending;
 
     IOThread *iothread;
     GMainContext *worker_context;
@@ -183,7 +233,7 @@ static void notify_remote_frame(CompareState *s)
     }
 }
 
-static void colo_compare_inconsistency_notify(CompareState *s)
+static void colo_compare_do_inconsistency_notify(CompareState *s)
 {
     if (s->notify_dev) {
         notify_remote_frame(s);
@@ -193,6 +243,16 @@ static void colo_compare_inconsistency_notify(CompareState *s)
     }
 }
 
+static void colo_compare_inconsistency_notify(CompareState *s)
+{
+    if (s->compare_threads) {
+        qatomic_set(&s->notify_pending, true);
+        qemu_bh_schedule(s->out_bh);
+    } else {
+        colo_compare_do_inconsistency_notify(s);
+    }
+}
+
 /* Use restricted to colo_insert_packet() */
 static gint seq_sorter(Packet *a, Packet *b, gpointer data)
 {
@@ -239,15 +299,12 @@ static int colo_insert_packet(GQueue *queue, Packet *pkt, uint32_t *max_ack)
 }
 
 /*
- * Return 0 on success, if return -1 means the pkt
+ * Return the parsed packet, if return NULL means the pkt
  * is unsupported(arp and ipv6) and will be sent later
  */
-static int packet_enqueue(CompareState *s, int mode, Connection **con)
+static Packet *packet_parse(CompareState *s, int mode, ConnectionKey *key)
 {
-    ConnectionKey key;
     Packet *pkt = NULL;
-    Connection *conn;
-    int ret;
 
     if (mode == PRIMARY_IN) {
         pkt = packet_new(s->pri_rs.buf,
@@ -261,17 +318,35 @@ static int packet_enqueue(CompareState *s, int mode, Connection **con)
 
     if (parse_packet_early(pkt)) {
         packet_destroy(pkt, NULL);
-        pkt = NULL;
-        return -1;
+        return NULL;
+    }
+    fill_connection_key(pkt, key, false);
+
+    return pkt;
+}
+
+static CompareShard *colo_compare_get_shard(CompareState *s,
+                                            ConnectionKey *key)
+{
+    if (s->nr_shards == 1) {
+        return &s->shards[0];
     }
-    fill_connection_key(pkt, &key, false);
+    return &s->shards[connection_key_hash(key) % s->nr_shards];
+}
 
-    conn = connection_get(s->connection_track_table,
-                          &key,
-                          &s->conn_list);
+/* Queue the packet to its connection, called with sh->lock held */
+static Connection *packet_enqueue(CompareShard *sh, Packet *pkt,
+                                  ConnectionKey *key, int mode)
+{
+    Connection *conn;
+    int ret;
+
+    conn = connection_get(sh->connection_track_table,
+                          key,
+                          &sh->conn_list);
 
     if (!conn->processing) {
-        g_queue_push_tail(&s->conn_list, conn);
+        g_queue_push_tail(&sh->conn_list, conn);
         conn->processing = true;
     }
 
@@ -288,9 +363,7 @@ static int packet_enqueue(CompareState *s, int mode, Connection **con)
         pkt = NULL;
     }
 
-    *con = conn;
-
-    return 0;
+    return conn;
 }
 
 static inline bool after(uint32_t seq1, uint32_t seq2)
@@ -298,20 +371,41 @@ static inline bool after(uint32_t seq1, uint32_t seq2)
         return (int32_t)(seq1 - seq2) > 0;
 }
 
+/*
+ * Send out a primary packet, the data is handed over to the send path.
+ * With compare threads the send is deferred to the iothread, keeping
+ * the order in which the packets were released.
+ */
+static int colo_send_primary_pkt(CompareState *s, Packet *pkt)
+{
+    CompareOut *out;
+    int ret = 0;
+
+    if (s->compare_threads) {
+        out = g_new(CompareOut, 1);
+        out->buf = pkt->data;
+        out->size = pkt->size;
+        out->vnet_hdr_len = pkt->vnet_hdr_len;
+        QSLIST_INSERT_HEAD_ATOMIC(&s->outbox, out, next);
+        qemu_bh_schedule(s->out_bh);
+    } else {
+        ret = compare_chr_send(s,
+                               pkt->data,
+                               pkt->size,
+                               pkt->vnet_hdr_len,
+                               false,
+                               true);
+    }
+    packet_destroy_partial(pkt, NULL);
+    return ret;
+}
+
 static void colo_release_primary_pkt(CompareState *s, Packet *pkt)
 {
-    int ret;
-    ret = compare_chr_send(s,
-                           pkt->data,
-                           pkt->size,
-                           pkt->vnet_hdr_len,
-                           false,
-                           true);
-    if (ret < 0) {
+    trace_colo_compare_main("packet same and release packet");
+    if (colo_send_primary_pkt(s, pkt) < 0) {
         error_report("colo send primary packet failed");
     }
-    trace_colo_compare_main("packet same and release packet");
-    packet_destroy_partial(pkt, NULL);
 }
 
 /*
@@ -654,13 +748,24 @@ out:
 static void colo_old_packet_check(void *opaque)
 {
     CompareState *s = opaque;
+    CompareShard *sh;
+    GList *result;
+    uint32_t i;
 
     /*
      * If we find one old packet, stop finding job and notify
      * COLO frame do checkpoint.
      */
-    g_queue_find_custom(&s->conn_list, s,
-                        (GCompareFunc)colo_old_packet_check_one_conn);
+    for (i = 0; i < s->nr_shards; i++) {
+        sh = &s->shards[i];
+        qemu_mutex_lock(&sh->lock);
+        result = g_queue_find_custom(&sh->conn_list, s,
+                            (GCompareFunc)colo_old_packet_check_one_conn);
+        qemu_mutex_unlock(&sh->lock);
+        if (result) {
+            break;
+        }
+    }
 }
 
 static void colo_compare_packet(CompareState *s, Connection *conn,
@@ -723,6 +828,104 @@ static void colo_compare_connection(void *opaque, void *user_data)
     }
 }
 
+/* Compare the packets queued to the shard, called with sh->lock held */
+static void colo_compare_shard_run(CompareShard *sh)
+{
+    QSLIST_HEAD(, CompareWork) batch, fifo = QSLIST_HEAD_INITIALIZER(fifo);
+    CompareWork *w;
+    Connection *conn;
+
+    QSLIST_MOVE_ATOMIC(&batch, &sh->inbox);
+    while ((w = QSLIST_FIRST(&batch))) {
+        QSLIST_REMOVE_HEAD(&batch, next);
+        QSLIST_INSERT_HEAD(&fifo, w, next);
+    }
+
+    while ((w = QSLIST_FIRST(&fifo))) {
+        QSLIST_REMOVE_HEAD(&fifo, next);
+        conn = packet_enqueue(sh, w->pkt, &w->key, w->mode);
+        colo_compare_connection(conn, sh->s);
+        g_free(w);
+    }
+}
+
+static void *colo_compare_shard_thread(void *opaque)
+{
+    CompareShard *sh = opaque;
+
+    for (;;) {
+        qemu_event_wait(&sh->event);
+        qemu_event_reset(&sh->event);
+        if (qatomic_read(&sh->stopping)) {
+            break;
+        }
+
+        qemu_mutex_lock(&sh->lock);
+        colo_compare_shard_run(sh);
+        qemu_mutex_unlock(&sh->lock);
+    }
+
+    return NULL;
+}
+
+/*
+ * Hand a parsed packet to the shard owning its connection.
+ * Called from the iothread.
+ */
+static void colo_compare_dispatch(CompareState *s, Packet *pkt,
+                                  ConnectionKey *key, int mode)
+{
+    CompareShard *sh = colo_compare_get_shard(s, key);
+    CompareWork *w;
+    Connection *conn;
+
+    if (!s->compare_threads) {
+        /* compare packet in the specified connection */
+        conn = packet_enqueue(sh, pkt, key, mode);
+        colo_compare_connection(conn, s);
+        return;
+    }
+
+    w = g_new(CompareWork, 1);
+    w->pkt = pkt;
+    w->key = *key;
+    w->mode = mode;
+    QSLIST_INSERT_HEAD_ATOMIC(&sh->inbox, w, next);
+    qemu_event_set(&sh->event);
+}
+
+/* Send the packets released by the compare threads, in order */
+static void colo_compare_out_flush(CompareState *s)
+{
+    QSLIST_HEAD(, CompareOut) batch, fifo = QSLIST_HEAD_INITIALIZER(fifo);
+    CompareOut *out;
+
+    QSLIST_MOVE_ATOMIC(&batch, &s->outbox);
+    while ((out = QSLIST_FIRST(&batch))) {
+        QSLIST_REMOVE_HEAD(&batch, next);
+        QSLIST_INSERT_HEAD(&fifo, out, next);
+    }
+
+    while ((out = QSLIST_FIRST(&fifo))) {
+        QSLIST_REMOVE_HEAD(&fifo, next);
+        if (compare_chr_send(s, out->buf, out->size, out->vnet_hdr_len,
+                             false, true) < 0) {
+            error_report("colo send primary packet failed");
+        }
+        g_free(out);
+    }
+}
+
+static void colo_compare_out_bh(void *opaque)
+{
+    CompareState *s = opaque;
+
+    colo_compare_out_flush(s);
+    if (qatomic_xchg(&s->notify_pending, false)) {
+        colo_compare_do_inconsistency_notify(s);
+    }
+}
+
 static void coroutine_fn _compare_chr_send(void *opaque)
 {
     SendCo *sendco = opaque;
@@ -947,13 +1150,30 @@ static void colo_compare_timer_del(CompareState *s)
 
 static void colo_flush_packets(void *opaque, void *user_data);
 
+/* Flush pri packet and remove sec packet of all the connections */
+static void colo_compare_flush_all(CompareState *s)
+{
+    CompareShard *sh;
+    uint32_t i;
+
+    for (i = 0; i < s->nr_shards; i++) {
+        sh = &s->shards[i];
+        qemu_mutex_lock(&sh->lock);
+        /* Packets not yet picked up by the compare thread go too */
+        colo_compare_shard_run(sh);
+        g_queue_foreach(&sh->conn_list, colo_flush_packets, s);
+        qemu_mutex_unlock(&sh->lock);
+    }
+    colo_compare_out_flush(s);
+}
+
 static void colo_compare_handle_event(void *opaque)
 {
     CompareState *s = opaque;
 
     switch (s->event) {
     case COLO_EVENT_CHECKPOINT:
-        g_queue_foreach(&s->conn_list, colo_flush_packets, s);
+        colo_compare_flush_all(s);
         break;
     case COLO_EVENT_FAILOVER:
         break;
@@ -988,6 +1208,57 @@ static void colo_compare_iothread(CompareState *s)
 
     colo_compare_timer_init(s);
     s->event_bh = aio_bh_new(ctx, colo_compare_handle_event, s);
+    s->out_bh = aio_bh_new(ctx, colo_compare_out_bh, s);
+}
+
+static void colo_compare_shards_init(CompareState *s)
+{
+    CompareShard *sh;
+    uint32_t i;
+
+    s->nr_shards = MAX(s->compare_threads, 1);
+    s->shards = g_new0(CompareShard, s->nr_shards);
+    QSLIST_INIT(&s->outbox);
+
+    for (i = 0; i < s->nr_shards; i++) {
+        sh = &s->shards[i];
+        sh->s = s;
+        g_queue_init(&sh->conn_list);
+        sh->connection_track_table = g_hash_table_new_full(connection_key_hash,
+                                                           connection_key_equal,
+                                                           g_free,
+                                                           NULL);
+        qemu_mutex_init(&sh->lock);
+        QSLIST_INIT(&sh->inbox);
+    }
+}
+
+static void colo_compare_threads_start(CompareState *s)
+{
+    CompareShard *sh;
+    uint32_t i;
+
+    for (i = 0; i < s->compare_threads; i++) {
+        sh = &s->shards[i];
+        qemu_event_init(&sh->event, false);
+        qemu_thread_create(&sh->thread, "colo-compare",
+                           colo_compare_shard_thread, sh,
+                           QEMU_THREAD_JOINABLE);
+    }
+}
+
+static void colo_compare_threads_stop(CompareState *s)
+{
+    CompareShard *sh;
+    uint32_t i;
+
+    for (i = 0; i < s->compare_threads; i++) {
+        sh = &s->shards[i];
+        qatomic_set(&sh->stopping, true);
+        qemu_event_set(&sh->event);
+        qemu_thread_join(&sh->thread);
+        qemu_event_destroy(&sh->event);
+    }
 }
 
 static char *compare_get_pri_indev(Object *obj, Error **errp)
@@ -1122,6 +1393,40 @@ static void compare_set_expired_scan_cycle(Object *obj, Visitor *v,
     s->expired_scan_cycle = value;
 }
 
+static void compare_get_threads(Object *obj, Visitor *v,
+                                const char *name, void *opaque,
+                                Error **errp)
+{
+    CompareState *s = COLO_COMPARE(obj);
+    uint32_t value = s->compare_threads;
+
+    visit_type_uint32(v, name, &value, errp);
+}
+
+static void compare_set_threads(Object *obj, Visitor *v,
+                                const char *name, void *opaque,
+                                Error **errp)
+{
+    CompareState *s = COLO_COMPARE(obj);
+    uint32_t value;
+
+    if (s->shards) {
+        error_setg(errp, "Property '%s.%s' can't be changed after creation",
+                   object_get_typename(obj), name);
+        return;
+    }
+    if (!visit_type_uint32(v, name, &value, errp)) {
+        return;
+    }
+    if (value > MAX_COMPARE_THREADS) {
+        error_setg(errp, "Property '%s.%s' doesn't take value '%u', "
+                   "the maximum is %d", object_get_typename(obj), name,
+                   value, MAX_COMPARE_THREADS);
+        return;
+    }
+    s->compare_threads = value;
+}
+
 static void get_max_queue_size(Object *obj, Visitor *v,
                                const char *name, void *opaque,
                                Error **errp)
@@ -1151,9 +1456,11 @@ static void set_max_queue_size(Object *obj, Visitor *v,
 static void compare_pri_rs_finalize(SocketReadState *pri_rs)
 {
     CompareState *s = container_of(pri_rs, CompareState, pri_rs);
-    Connection *conn = NULL;
+    ConnectionKey key;
+    Packet *pkt;
 
-    if (packet_enqueue(s, PRIMARY_IN, &conn)) {
+    pkt = packet_parse(s, PRIMARY_IN, &key);
+    if (!pkt) {
         trace_colo_compare_main("primary: unsupported packet in");
         compare_chr_send(s,
                          pri_rs->buf,
@@ -1162,21 +1469,21 @@ static void compare_pri_rs_finalize(SocketReadState *pri_rs)
                          false,
                          false);
     } else {
-        /* compare packet in the specified connection */
-        colo_compare_connection(conn, s);
+        colo_compare_dispatch(s, pkt, &key, PRIMARY_IN);
     }
 }
 
 static void compare_sec_rs_finalize(SocketReadState *sec_rs)
 {
     CompareState *s = container_of(sec_rs, CompareState, sec_rs);
-    Connection *conn = NULL;
+    ConnectionKey key;
+    Packet *pkt;
 
-    if (packet_enqueue(s, SECONDARY_IN, &conn)) {
+    pkt = packet_parse(s, SECONDARY_IN, &key);
+    if (!pkt) {
         trace_colo_compare_main("secondary: unsupported packet in");
     } else {
-        /* compare packet in the specified connection */
-        colo_compare_connection(conn, s);
+        colo_compare_dispatch(s, pkt, &key, SECONDARY_IN);
     }
 }
 
@@ -1198,7 +1505,7 @@ static void compare_notify_rs_finalize(SocketReadState *notify_rs)
                                   notify_rs->buf,
                                   notify_rs->packet_len)) {
         /* colo-compare do checkpoint, flush pri packet and remove sec packet */
-        g_queue_foreach(&s->conn_list, colo_flush_packets, s);
+        colo_compare_flush_all(s);
     } else {
         error_report("COLO compare got unsupported instruction");
     }
@@ -1313,14 +1620,10 @@ static void colo_compare_complete(UserCreatable *uc, Error **errp)
         g_queue_init(&s->notify_sendco.send_list);
     }
 
-    g_queue_init(&s->conn_list);
-
-    s->connection_track_table = g_hash_table_new_full(connection_key_hash,
-                                                      connection_key_equal,
-                                                      g_free,
-                                                      NULL);
+    colo_compare_shards_init(s);
 
     colo_compare_iothread(s);
+    colo_compare_threads_start(s);
 
     qemu_mutex_lock(&colo_compare_mutex);
     if (!colo_compare_active) {
@@ -1342,13 +1645,7 @@ static void colo_flush_packets(void *opaque, void *user_data)
 
     while (!g_queue_is_empty(&conn->primary_list)) {
         pkt = g_queue_pop_tail(&conn->primary_list);
-        compare_chr_send(s,
-                         pkt->data,
-                         pkt->size,
-                         pkt->vnet_hdr_len,
-                         false,
-                         true);
-        packet_destroy_partial(pkt, NULL);
+        colo_send_primary_pkt(s, pkt);
     }
     while (!g_queue_is_empty(&conn->secondary_list)) {
         pkt = g_queue_pop_tail(&conn->secondary_list);
@@ -1393,6 +1690,10 @@ static void colo_compare_init(Object *obj)
                         get_max_queue_size,
                         set_max_queue_size, NULL, NULL);
 
+    object_property_add(obj, "compare_threads", "uint32",
+                        compare_get_threads,
+                        compare_set_threads, NULL, NULL);
+
     s->vnet_hdr = false;
     object_property_add_bool(obj, "vnet_hdr_support", compare_get_vnet_hdr,
                              compare_set_vnet_hdr);
@@ -1412,6 +1713,7 @@ static void colo_compare_finalize(Object *obj)
 {
     CompareState *s = COLO_COMPARE(obj);
     CompareState *tmp = NULL;
+    uint32_t i;
 
     qemu_mutex_lock(&colo_compare_mutex);
     QTAILQ_FOREACH(tmp, &net_compares, next) {
@@ -1434,6 +1736,10 @@ static void colo_compare_finalize(Object *obj)
         qemu_chr_fe_deinit(&s->chr_notify_dev, false);
     }
 
+    if (s->shards) {
+        colo_compare_threads_stop(s);
+    }
+
     colo_compare_timer_del(s);
 
     qemu_bh_delete(s->event_bh);
@@ -1447,18 +1753,23 @@ static void colo_compare_finalize(Object *obj)
     aio_context_release(ctx);
 
     /* Release all unhandled packets after compare thead exited */
-    g_queue_foreach(&s->conn_list, colo_flush_packets, s);
+    if (s->shards) {
+        colo_compare_flush_all(s);
+    }
     AIO_WAIT_WHILE(NULL, !s->out_sendco.done);
+    qemu_bh_delete(s->out_bh);
 
-    g_queue_clear(&s->conn_list);
     g_queue_clear(&s->out_sendco.send_list);
     if (s->notify_dev) {
         g_queue_clear(&s->notify_sendco.send_list);
     }
 
-    if (s->connection_track_table) {
-        g_hash_table_destroy(s->connection_track_table);
+    for (i = 0; i < s->nr_shards; i++) {
+        g_queue_clear(&s->shards[i].conn_list);
+        g_hash_table_destroy(s->shards[i].connection_track_table);
+        qemu_mutex_destroy(&s->shards[i].lock);
     }
+    g_free(s->shards);
 
     object_unref(OBJECT(s->iothread));
 
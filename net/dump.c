@@ -29,6 +29,9 @@
 #include "qemu/iov.h"
 #include "qemu/module.h"
 #include "qemu/timer.h"
+#include "qemu/thread.h"
+#include "qemu/atomic.h"
+#include "qemu/host-utils.h"
 #include "qapi/visitor.h"
 #include "net/filter.h"
 #include "qom/object.h"
@@ -38,6 +41,25 @@ typedef struct DumpState {
     int64_t start_ts;
     int fd;
     int pcap_caplen;
+
+    /* Capture one packet out of every @sample */
+    uint32_t sample;
+    uint32_t sample_count;
+
+    /*
+     * With a ring, the packet path only copies the records to the ring
+     * and a thread writes them to the file.  Records that don't fit are
+     * dropped rather than slowing the packet path down.
+     */
+    uint8_t *ring;
+    uint32_t ring_size;
+    uint64_t ring_head;     /* Advanced by the packet path */
+    uint64_t ring_tail;     /* Advanced by the writer thread */
+    uint64_t dropped;
+    QemuThread thread;
+    QemuEvent event;
+    bool stopping;
+    bool write_error;
 } DumpState;
 
 #define PCAP_MAGIC 0xa1b2c3d4
@@ -61,6 +83,79 @@ struct pcap_sf_pkthdr {
     uint32_t len;
 };
 
+static void dump_ring_write(DumpState *s, uint64_t pos,
+                            const void *buf, size_t len)
+{
+    size_t off = pos & (s->ring_size - 1);
+    size_t first = MIN(len, s->ring_size - off);
+
+    memcpy(s->ring + off, buf, first);
+    memcpy(s->ring, (const uint8_t *)buf + first, len - first);
+}
+
+static void dump_ring_write_iov(DumpState *s, uint64_t pos,
+                                const struct iovec *iov, int cnt,
+                                size_t offset, size_t len)
+{
+    size_t off = pos & (s->ring_size - 1);
+    size_t first = MIN(len, s->ring_size - off);
+
+    iov_to_buf(iov, cnt, offset, s->ring + off, first);
+    iov_to_buf(iov, cnt, offset + first, s->ring, len - first);
+}
+
+static void dump_ring_put(DumpState *s, struct pcap_sf_pkthdr *hdr,
+                          const struct iovec *iov, int cnt, int offset)
+{
+    uint64_t head = s->ring_head;
+    uint64_t tail = qatomic_load_acquire(&s->ring_tail);
+    size_t len = sizeof(*hdr) + hdr->caplen;
+
+    if (head - tail + len > s->ring_size) {
+        s->dropped++;
+        return;
+    }
+
+    dump_ring_write(s, head, hdr, sizeof(*hdr));
+    dump_ring_write_iov(s, head + sizeof(*hdr), iov, cnt, offset,
+                        hdr->caplen);
+
+    qatomic_store_release(&s->ring_head, head + len);
+    qemu_event_set(&s->event);
+}
+
+static void *dump_ring_thread(void *opaque)
+{
+    DumpState *s = opaque;
+    uint64_t head, tail = s->ring_tail;
+    size_t off, len;
+
+    for (;;) {
+        qemu_event_reset(&s->event);
+        head = qatomic_load_acquire(&s->ring_head);
+        if (head == tail) {
+            if (qatomic_read(&s->stopping)) {
+                break;
+            }
+            qemu_event_wait(&s->event);
+            continue;
+        }
+
+        off = tail & (s->ring_size - 1);
+        len = MIN(head - tail, s->ring_size - off);
+        if (!s->write_error &&
+            qemu_write_full(s->fd, s->ring + off, len) != len) {
+            error_report("network dump write error - stopping dump");
+            s->write_error = true;
+        }
+
+        tail += len;
+        qatomic_store_release(&s->ring_tail, tail);
+    }
+
+    return NULL;
+}
+
 static ssize_t dump_receive_iov(DumpState *s, const struct iovec *iov, int cnt,
                                 int offset)
 {
@@ -75,6 +170,11 @@ static ssize_t dump_receive_iov(DumpState *s, const struct iovec *iov, int cnt,
         return size;
     }
 
+    if (++s->sample_count < s->sample) {
+        return size;
+    }
+    s->sample_count = 0;
+
     ts = qemu_clock_get_us(QEMU_CLOCK_VIRTUAL);
     caplen = size > s->pcap_caplen ? s->pcap_caplen : size;
 
@@ -83,6 +183,11 @@ static ssize_t dump_receive_iov(DumpState *s, const struct iovec *iov, int cnt,
     hdr.caplen = caplen;
     hdr.len = size;
 
+    if (s->ring) {
+        dump_ring_put(s, &hdr, iov, cnt, offset);
+        return size;
+    }
+
     dumpiov[0].iov_base = &hdr;
     dumpiov[0].iov_len = sizeof(hdr);
     cnt = iov_copy(&dumpiov[1], cnt, iov, cnt, offset, caplen);
@@ -98,12 +203,27 @@ static ssize_t dump_receive_iov(DumpState *s, const struct iovec *iov, int cnt,
 
 static void dump_cleanup(DumpState *s)
 {
+    if (s->ring) {
+        qatomic_set(&s->stopping, true);
+        qemu_event_set(&s->event);
+        qemu_thread_join(&s->thread);
+        qemu_event_destroy(&s->event);
+        g_free(s->ring);
+        s->ring = NULL;
+
+        if (s->dropped) {
+            warn_report("network dump: %" PRIu64 " packets not captured, "
+                        "the ring was full", s->dropped);
+        }
+    }
+
     close(s->fd);
     s->fd = -1;
 }
 
 static int net_dump_state_init(DumpState *s, const char *filename,
-                               int len, Error **errp)
+                               int len, uint32_t ring_size, uint32_t sample,
+                               Error **errp)
 {
     struct pcap_file_hdr hdr;
     struct tm tm;
@@ -131,10 +251,24 @@ static int net_dump_state_init(DumpState *s, const char *filename,
 
     s->fd = fd;
     s->pcap_caplen = len;
+    s->sample = sample;
+    s->sample_count = 0;
 
     qemu_get_timedate(&tm, 0);
     s->start_ts = mktime(&tm);
 
+    if (ring_size) {
+        s->ring = g_malloc(ring_size);
+        s->ring_size = ring_size;
+        s->ring_head = s->ring_tail = 0;
+        s->dropped = 0;
+        s->stopping = false;
+        s->write_error = false;
+        qemu_event_init(&s->event, false);
+        qemu_thread_create(&s->thread, "net-dump", dump_ring_thread, s,
+                           QEMU_THREAD_JOINABLE);
+    }
+
     return 0;
 }
 
@@ -147,6 +281,8 @@ struct NetFilterDumpState {
     DumpState ds;
     char *filename;
     uint32_t maxlen;
+    uint32_t ring_size;
+    uint32_t sample;
 };
 
 static ssize_t filter_dump_receive_iov(NetFilterState *nf, NetClientState *sndr,
@@ -177,7 +313,15 @@ static void filter_dump_setup(NetFilterState *nf, Error **errp)
         return;
     }
 
-    net_dump_state_init(&nfds->ds, nfds->filename, nfds->maxlen, errp);
+    if (nfds->ring_size &&
+        nfds->ring_size < nfds->maxlen + sizeof(struct pcap_sf_pkthdr)) {
+        error_setg(errp, "dump filter 'ring-size' must be able to hold "
+                   "a packet of 'maxlen' bytes");
+        return;
+    }
+
+    net_dump_state_init(&nfds->ds, nfds->filename, nfds->maxlen,
+                        nfds->ring_size, nfds->sample, errp);
 }
 
 static void filter_dump_get_maxlen(Object *obj, Visitor *v, const char *name,
@@ -206,6 +350,60 @@ static void filter_dump_set_maxlen(Object *obj, Visitor *v, const char *name,
     nfds->maxlen = value;
 }
 
+static void filter_dump_get_ring_size(Object *obj, Visitor *v,
+                                      const char *name, void *opaque,
+                                      Error **errp)
+{
+    NetFilterDumpState *nfds = FILTER_DUMP(obj);
+    uint32_t value = nfds->ring_size;
+
+    visit_type_uint32(v, name, &value, errp);
+}
+
+static void filter_dump_set_ring_size(Object *obj, Visitor *v,
+                                      const char *name, void *opaque,
+                                      Error **errp)
+{
+    NetFilterDumpState *nfds = FILTER_DUMP(obj);
+    uint32_t value;
+
+    if (!visit_type_uint32(v, name, &value, errp)) {
+        return;
+    }
+    if (value && !is_power_of_2(value)) {
+        error_setg(errp, "Property '%s.%s' must be 0 or a power of two",
+                   object_get_typename(obj), name);
+        return;
+    }
+    nfds->ring_size = value;
+}
+
+static void filter_dump_get_sample(Object *obj, Visitor *v, const char *name,
+                                   void *opaque, Error **errp)
+{
+    NetFilterDumpState *nfds = FILTER_DUMP(obj);
+    uint32_t value = nfds->sample;
+
+    visit_type_uint32(v, name, &value, errp);
+}
+
+static void filter_dump_set_sample(Object *obj, Visitor *v, const char *name,
+                                   void *opaque, Error **errp)
+{
+    NetFilterDumpState *nfds = FILTER_DUMP(obj);
+    uint32_t value;
+
+    if (!visit_type_uint32(v, name, &value, errp)) {
+        return;
+    }
+    if (value == 0) {
+        error_setg(errp, "Property '%s.%s' doesn't take value '%u'",
+                   object_get_typename(obj), name, value);
+        return;
+    }
+    nfds->sample = value;
+}
+
 static char *file_dump_get_filename(Object *obj, Error **errp)
 {
     NetFilterDumpState *nfds = FILTER_DUMP(obj);
@@ -226,6 +424,7 @@ static void filter_dump_instance_init(Object *obj)
     NetFilterDumpState *nfds = FILTER_DUMP(obj);
 
     nfds->maxlen = 65536;
+    nfds->sample = 1;
 }
 
 static void filter_dump_instance_finalize(Object *obj)
@@ -243,6 +442,11 @@ static void filter_dump_class_init(ObjectClass *oc, void *data)
                               filter_dump_set_maxlen, NULL, NULL);
     object_class_property_add_str(oc, "file", file_dump_get_filename,
                                   file_dump_set_filename);
+    object_class_property_add(oc, "ring-size", "uint32",
+                              filter_dump_get_ring_size,
+                              filter_dump_set_ring_size, NULL, NULL);
+    object_class_property_add(oc, "sample", "uint32", filter_dump_get_sample,
+                              filter_dump_set_sample, NULL, NULL);
 
     nfc->setup = filter_dump_setup;
     nfc->cleanup = filter_dump_cleanup;
@@ -513,6 +513,32 @@ bool qemu_has_vnet_hdr_len(NetClientState *nc, int len)
     return nc->info->has_vnet_hdr_len(nc, len);
 }
 
+bool qemu_net_client_can_set_aio_context(NetClientState *nc)
+{
+    return nc && nc->info->set_aio_context;
+}
+
+/*
+ * Move the processing of packets from @nc to @ctx, or back to the main
+ * loop if @ctx is NULL.  Filters run in the context of the packets they
+ * see, so @nc must not have any.
+ *
+ * Context: @nc's current AioContext, or QEMU global mutex held while
+ * nothing processes @nc.
+ */
+void qemu_net_client_set_aio_context(NetClientState *nc, AioContext *ctx)
+{
+    assert(qemu_net_client_can_set_aio_context(nc));
+    assert(QTAILQ_EMPTY(&nc->filters));
+
+    if (nc->aio_context == ctx) {
+        return;
+    }
+
+    nc->info->set_aio_context(nc, ctx);
+    nc->aio_context = ctx;
+}
+
 bool qemu_get_using_vnet_hdr(NetClientState *nc)
 {
     if (!nc || !nc->info->get_using_vnet_hdr) {
@@ -737,6 +763,82 @@ ssize_t qemu_send_packet_async(NetClientState *sender,
                                              buf, size, sent_cb);
 }
 
+/**
+ * qemu_rx_zerocopy_begin:
+ * @nc: the sending backend
+ * @iov: filled with the receive buffer of the peer
+ * @iovcnt: number of elements available in @iov
+ *
+ * Ask the peer of @nc for a buffer that the next packet can be read into
+ * directly, bypassing the copy done by qemu_send_packet().  This is only
+ * possible when nothing needs to see the packet on its way, i.e. when
+ * neither side has filters attached.
+ *
+ * Returns the number of elements used in @iov, or a negative value if
+ * the packet must be sent the usual way.  On success the buffer is held
+ * until qemu_rx_zerocopy_end() is called.
+ */
+int qemu_rx_zerocopy_begin(NetClientState *nc, struct iovec *iov,
+                           int iovcnt)
+{
+    NetClientState *peer = nc->peer;
+
+    if (!peer || !peer->info->rx_zerocopy_begin ||
+        nc->link_down || peer->link_down || peer->receive_disabled ||
+        !QTAILQ_EMPTY(&nc->filters) || !QTAILQ_EMPTY(&peer->filters)) {
+        return -1;
+    }
+
+    return peer->info->rx_zerocopy_begin(peer, iov, iovcnt);
+}
+
+/**
+ * qemu_rx_zerocopy_end:
+ * @nc: the sending backend
+ * @size: size of the packet read into the buffer, or negative to cancel
+ *
+ * Complete a zero-copy receive started with qemu_rx_zerocopy_begin().
+ *
+ * Returns true if the peer consumed the packet and released the buffer.
+ * Returns false if the peer cannot take the packet in place; the buffer
+ * is still held, and the caller must copy the packet out of it, cancel
+ * with a negative @size and send the copy with qemu_send_packet().
+ */
+bool qemu_rx_zerocopy_end(NetClientState *nc, ssize_t size)
+{
+    return nc->peer->info->rx_zerocopy_end(nc->peer, size);
+}
+
+/**
+ * qemu_send_packet_batch:
+ * @sender: the sending backend
+ * @pkts: the packets to send, one buffer per packet
+ * @count: number of packets in @pkts
+ *
+ * Hand a burst of packets to the peer of @sender in one call, so that
+ * the peer can pay its per-packet costs, such as notifying the guest,
+ * once for the whole burst.  As with qemu_rx_zerocopy_begin(), this is
+ * only possible when neither side has filters attached.
+ *
+ * Returns the number of packets, counted from the start of @pkts, that
+ * the peer consumed.  The caller must send the remaining ones with
+ * qemu_send_packet_async().
+ */
+int qemu_send_packet_batch(NetClientState *sender, const struct iovec *pkts,
+                           int count)
+{
+    NetClientState *peer = sender->peer;
+
+    if (!peer || !peer->info->receive_batch ||
+        sender->link_down || peer->link_down ||
+        !QTAILQ_EMPTY(&sender->filters) || !QTAILQ_EMPTY(&peer->filters) ||
+        !qemu_can_send_packet(sender)) {
+        return 0;
+    }
+
+    return peer->info->receive_batch(peer, pkts, count);
+}
+
 ssize_t qemu_send_packet(NetClientState *nc, const uint8_t *buf, int size)
 {
     return qemu_send_packet_async(nc, buf, size, NULL);
@@ -809,6 +911,7 @@ static ssize_t qemu_deliver_packet_iov(NetClientState *sender,
 
 
     if (nc->link_down) {
+        stat64_add(&nc->rx_dropped, 1);
         return iov_size(iov, iovcnt);
     }
 
@@ -824,6 +927,13 @@ static ssize_t qemu_deliver_packet_iov(NetClientState *sender,
 
     if (ret == 0) {
         nc->receive_disabled = 1;
+    } else if (ret > 0) {
+        stat64_add(&nc->rx_packets, 1);
+        stat64_add(&nc->rx_bytes, ret);
+        if (sender) {
+            stat64_add(&sender->tx_packets, 1);
+            stat64_add(&sender->tx_bytes, ret);
+        }
     }
 
     return ret;
@@ -1082,6 +1192,9 @@ static int (* const net_client_init_fun[NET_CLIENT_DRIVER__MAX])(
 #ifdef CONFIG_NETMAP
         [NET_CLIENT_DRIVER_NETMAP]    = net_init_netmap,
 #endif
+#ifdef CONFIG_AF_XDP
+        [NET_CLIENT_DRIVER_AF_XDP]    = net_init_af_xdp,
+#endif
 #ifdef CONFIG_NET_BRIDGE
         [NET_CLIENT_DRIVER_BRIDGE]    = net_init_bridge,
 #endif
@@ -1186,6 +1299,9 @@ void show_netdevs(void)
 #ifdef CONFIG_NETMAP
         "netmap",
 #endif
+#ifdef CONFIG_AF_XDP
+        "af-xdp",
+#endif
 #ifdef CONFIG_POSIX
         "vhost-user",
 #endif
@@ -1397,6 +1513,43 @@ RxFilterInfoList *qmp_query_rx_filter(const char *name, Error **errp)
     return filter_list;
 }
 
+void qmp_x_set_steering_ebpf(const char *name, const char *fd, Error **errp)
+{
+    NetClientState *ncs[MAX_QUEUE_NUM];
+    NetClientState *nc;
+    int prog_fd = -1;
+
+    if (!qemu_find_net_clients_except(name, ncs, NET_CLIENT_DRIVER__MAX,
+                                      MAX_QUEUE_NUM)) {
+        error_set(errp, ERROR_CLASS_DEVICE_NOT_FOUND,
+                  "Device '%s' not found", name);
+        return;
+    }
+    nc = ncs[0];
+
+    if (nc->info->type != NET_CLIENT_DRIVER_NIC) {
+        error_setg(errp, "net client(%s) isn't a NIC", name);
+        return;
+    }
+
+    if (!nc->info->set_steering_program) {
+        error_setg(errp, "net client(%s) doesn't support"
+                   " steering programs", name);
+        return;
+    }
+
+    if (fd) {
+        prog_fd = monitor_fd_param(monitor_cur(), fd, errp);
+        if (prog_fd < 0) {
+            return;
+        }
+    }
+
+    if (!nc->info->set_steering_program(nc, prog_fd, errp) && prog_fd >= 0) {
+        close(prog_fd);
+    }
+}
+
 void colo_notify_filters_event(int event, Error **errp)
 {
     NetClientState *nc;
@@ -38,13 +38,26 @@
  *
  * If a sent callback isn't provided, we just drop the packet to avoid
  * unbounded queueing.
+ *
+ * Packets of up to NET_PACKET_POOL_SIZE bytes are allocated from a small
+ * per-queue pool, so that a queue absorbing a burst does not go through
+ * malloc and free for each packet.  A queue is only used from the
+ * context of its receiver, so no locking is needed.
+ *
+ * A packet flushed from one queue and queued again in another one (e.g.
+ * by a chain of filters) is moved to the new queue rather than copied.
  */
 
+/* Enough for a 1500 byte MTU frame with vnet header */
+#define NET_PACKET_POOL_SIZE 2048
+#define NET_PACKET_POOL_MAX  256
+
 struct NetPacket {
     QTAILQ_ENTRY(NetPacket) entry;
     NetClientState *sender;
     unsigned flags;
     int size;
+    int capacity;
     NetPacketSent *sent_cb;
     uint8_t data[];
 };
@@ -57,9 +70,73 @@ struct NetQueue {
 
     QTAILQ_HEAD(, NetPacket) packets;
 
+    /* Free packets of NET_PACKET_POOL_SIZE capacity */
+    QTAILQ_HEAD(, NetPacket) pool;
+    uint32_t pool_count;
+
     unsigned delivering : 1;
 };
 
+/*
+ * The packet being delivered by qemu_net_queue_flush(), which another
+ * queue may take over instead of copying it.  Cleared when taken.
+ */
+static __thread NetPacket *net_queue_flushing;
+
+static NetPacket *qemu_net_packet_alloc(NetQueue *queue, size_t size)
+{
+    NetPacket *packet;
+
+    if (size > NET_PACKET_POOL_SIZE) {
+        packet = g_malloc(sizeof(NetPacket) + size);
+        packet->capacity = size;
+        return packet;
+    }
+
+    packet = QTAILQ_FIRST(&queue->pool);
+    if (packet) {
+        QTAILQ_REMOVE(&queue->pool, packet, entry);
+        queue->pool_count--;
+        return packet;
+    }
+
+    packet = g_malloc(sizeof(NetPacket) + NET_PACKET_POOL_SIZE);
+    packet->capacity = NET_PACKET_POOL_SIZE;
+    return packet;
+}
+
+static void qemu_net_packet_free(NetQueue *queue, NetPacket *packet)
+{
+    if (packet->capacity == NET_PACKET_POOL_SIZE &&
+        queue->pool_count < NET_PACKET_POOL_MAX) {
+        QTAILQ_INSERT_HEAD(&queue->pool, packet, entry);
+        queue->pool_count++;
+        return;
+    }
+
+    g_free(packet);
+}
+
+/*
+ * Take over the packet being flushed from another queue if @iov is
+ * exactly its data.  Only packets without sent callback on either side
+ * are moved, as nobody waits for them.
+ */
+static NetPacket *qemu_net_queue_take_flushing(const struct iovec *iov,
+                                               int iovcnt,
+                                               NetPacketSent *sent_cb)
+{
+    NetPacket *packet = net_queue_flushing;
+
+    if (!packet || sent_cb || packet->sent_cb || iovcnt != 1 ||
+        iov[0].iov_base != packet->data || iov[0].iov_len != packet->size) {
+        return NULL;
+    }
+
+    net_queue_flushing = NULL;
+    return packet;
+}
+
 NetQueue *qemu_new_net_queue(NetQueueDeliverFunc *deliver, void *opaque)
 {
     NetQueue *queue;
@@ -72,6 +149,7 @@ NetQueue *qemu_new_net_queue(NetQueueDeliverFunc *deliver, void *opaque)
     queue->deliver = deliver;
 
     QTAILQ_INIT(&queue->packets);
+    QTAILQ_INIT(&queue->pool);
 
     queue->delivering = 0;
 
@@ -86,6 +164,10 @@ void qemu_del_net_queue(NetQueue *queue)
         QTAILQ_REMOVE(&queue->packets, packet, entry);
         g_free(packet);
     }
+    QTAILQ_FOREACH_SAFE(packet, &queue->pool, entry, next) {
+        QTAILQ_REMOVE(&queue->pool, packet, entry);
+        g_free(packet);
+    }
 
     g_free(queue);
 }
@@ -98,16 +180,23 @@ static void qemu_net_queue_append(NetQueue *queue,
                                   NetPacketSent *sent_cb)
 {
     NetPacket *packet;
+    struct iovec iov = {
+        .iov_base = (void *)buf,
+        .iov_len = size
+    };
 
     if (queue->nq_count >= queue->nq_maxlen && !sent_cb) {
         return; /* drop if queue full and no callback */
     }
-    packet = g_malloc(sizeof(NetPacket) + size);
+    packet = qemu_net_queue_take_flushing(&iov, 1, sent_cb);
+    if (!packet) {
+        packet = qemu_net_packet_alloc(queue, size);
+        memcpy(packet->data, buf, size);
+    }
     packet->sender = sender;
     packet->flags = flags;
     packet->size = size;
     packet->sent_cb = sent_cb;
-    memcpy(packet->data, buf, size);
 
     queue->nq_count++;
     QTAILQ_INSERT_TAIL(&queue->packets, packet, entry);
@@ -127,11 +216,20 @@ void qemu_net_queue_append_iov(NetQueue *queue,
     if (queue->nq_count >= queue->nq_maxlen && !sent_cb) {
         return; /* drop if queue full and no callback */
     }
+    packet = qemu_net_queue_take_flushing(iov, iovcnt, sent_cb);
+    if (packet) {
+        packet->sender = sender;
+        packet->flags = flags;
+        queue->nq_count++;
+        QTAILQ_INSERT_TAIL(&queue->packets, packet, entry);
+        return;
+    }
+
     for (i = 0; i < iovcnt; i++) {
         max_len += iov[i].iov_len;
     }
 
-    packet = g_malloc(sizeof(NetPacket) + max_len);
+    packet = qemu_net_packet_alloc(queue, max_len);
     packet->sender = sender;
     packet->sent_cb = sent_cb;
     packet->flags = flags;
@@ -265,13 +363,16 @@ void qemu_net_queue_purge(NetQueue *queue, NetClientState *from)
             if (packet->sent_cb) {
                 packet->sent_cb(packet->sender, 0);
             }
-            g_free(packet);
+            qemu_net_packet_free(queue, packet);
         }
     }
 }
 
 bool qemu_net_queue_flush(NetQueue *queue)
 {
+    /* Flushes nest when delivering a packet flushes another queue */
+    NetPacket *outer = net_queue_flushing;
+
     if (queue->delivering)
         return false;
 
@@ -283,11 +384,22 @@ bool qemu_net_queue_flush(NetQueue *queue)
         QTAILQ_REMOVE(&queue->packets, packet, entry);
         queue->nq_count--;
 
+        net_queue_flushing = packet;
         ret = qemu_net_queue_deliver(queue,
                                      packet->sender,
                                      packet->flags,
                                      packet->data,
                                      packet->size);
+        if (net_queue_flushing != packet) {
+            /* Another queue took it over, it has no sent callback */
+            net_queue_flushing = outer;
+            if (ret == 0) {
+                return false;
+            }
+            continue;
+        }
+        net_queue_flushing = outer;
+
         if (ret == 0) {
             queue->nq_count++;
             QTAILQ_INSERT_HEAD(&queue->packets, packet, entry);
@@ -298,7 +410,7 @@ bool qemu_net_queue_flush(NetQueue *queue)
             packet->sent_cb(packet->sender, ret);
         }
 
-        g_free(packet);
+        qemu_net_packet_free(queue, packet);
     }
     return true;
 }
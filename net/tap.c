@@ -31,6 +31,9 @@
 #include <sys/wait.h>
 #include <sys/socket.h>
 #include <net/if.h>
+#ifdef CONFIG_LINUX_IO_URING
+#include <liburing.h>
+#endif
 
 #include "net/eth.h"
 #include "net/net.h"
@@ -40,6 +43,7 @@
 #include "qapi/error.h"
 #include "qemu/cutils.h"
 #include "qemu/error-report.h"
+#include "qemu/iov.h"
 #include "qemu/main-loop.h"
 #include "qemu/sockets.h"
 
@@ -47,6 +51,12 @@
 
 #include "net/vhost_net.h"
 
+/* Largest accepted batch-size */
+#define TAP_BATCH_MAX 64
+
+/* Frames bigger than this are written directly instead of being batched */
+#define TAP_TX_SLOT_SIZE 2048
+
 typedef struct TAPState {
     NetClientState nc;
     int fd;
@@ -61,6 +71,18 @@ typedef struct TAPState {
     VHostNetState *vhost_net;
     unsigned host_vnet_hdr_len;
     Notifier exit;
+    /* Packets read or written in one go, 0 if batching is disabled */
+    unsigned batch_size;
+    /* batch_size receive buffers of NET_BUFSIZE bytes each */
+    uint8_t *rx_bufs;
+#ifdef CONFIG_LINUX_IO_URING
+    /* Frames copied from the peer and not yet written to the device */
+    struct io_uring tx_ring;
+    QEMUBH *tx_bh;
+    uint8_t *tx_bufs;
+    size_t tx_lens[TAP_BATCH_MAX];
+    unsigned tx_count;
+#endif
 } TAPState;
 
 static void launch_script(const char *setup_script, const char *ifname,
@@ -71,10 +93,15 @@ static void tap_writable(void *opaque);
 
 static void tap_update_fd_handler(TAPState *s)
 {
-    qemu_set_fd_handler(s->fd,
-                        s->read_poll && s->enabled ? tap_send : NULL,
-                        s->write_poll && s->enabled ? tap_writable : NULL,
-                        s);
+    IOHandler *io_read = s->read_poll && s->enabled ? tap_send : NULL;
+    IOHandler *io_write = s->write_poll && s->enabled ? tap_writable : NULL;
+
+    if (s->nc.aio_context) {
+        aio_set_fd_handler(s->nc.aio_context, s->fd, io_read, io_write,
+                           NULL, NULL, s);
+    } else {
+        qemu_set_fd_handler(s->fd, io_read, io_write, s);
+    }
 }
 
 static void tap_read_poll(TAPState *s, bool enable)
@@ -89,12 +116,183 @@ static void tap_write_poll(TAPState *s, bool enable)
     tap_update_fd_handler(s);
 }
 
+#ifdef CONFIG_LINUX_IO_URING
+static void tap_tx_cleanup(TAPState *s)
+{
+    if (!s->tx_bufs) {
+        return;
+    }
+
+    qemu_bh_delete(s->tx_bh);
+    s->tx_bh = NULL;
+    io_uring_queue_exit(&s->tx_ring);
+    g_free(s->tx_bufs);
+    s->tx_bufs = NULL;
+    s->tx_count = 0;
+}
+
+/*
+ * Write all queued frames with a single io_uring_enter().  The writes are
+ * linked so that the frames reach the device in order; a write that fails
+ * cancels the ones behind it, which are then submitted again.  Frames the
+ * device has no room for stay queued until it becomes writable.
+ */
+static void tap_tx_flush(TAPState *s)
+{
+    int res[TAP_BATCH_MAX];
+    unsigned done = 0;
+
+    while (done < s->tx_count) {
+        unsigned n = s->tx_count - done;
+        unsigned i;
+        int ret;
+
+        for (i = 0; i < n; i++) {
+            struct io_uring_sqe *sqe = io_uring_get_sqe(&s->tx_ring);
+
+            io_uring_prep_write(sqe, s->fd,
+                                s->tx_bufs + (done + i) * TAP_TX_SLOT_SIZE,
+                                s->tx_lens[done + i], 0);
+            io_uring_sqe_set_data(sqe, (void *)(uintptr_t)i);
+            if (i + 1 < n) {
+                sqe->flags |= IOSQE_IO_LINK;
+            }
+        }
+
+        do {
+            ret = io_uring_submit_and_wait(&s->tx_ring, n);
+        } while (ret == -EINTR);
+        if (ret < 0) {
+            warn_report("tap: batched write failed (%s), "
+                        "writing packets one at a time", strerror(-ret));
+            tap_tx_cleanup(s);
+            return;
+        }
+
+        for (i = 0; i < n; i++) {
+            struct io_uring_cqe *cqe;
+
+            do {
+                ret = io_uring_wait_cqe(&s->tx_ring, &cqe);
+            } while (ret == -EINTR);
+            assert(ret == 0);
+            res[(uintptr_t)io_uring_cqe_get_data(cqe)] = cqe->res;
+            io_uring_cqe_seen(&s->tx_ring, cqe);
+        }
+
+        /* Other errors drop the frame, just like a failing writev() */
+        i = 0;
+        while (i < n && res[i] != -EAGAIN && res[i] != -ECANCELED) {
+            i++;
+        }
+        done += i;
+
+        if (i < n && res[i] == -EAGAIN) {
+            s->tx_count -= done;
+            memmove(s->tx_bufs, s->tx_bufs + done * TAP_TX_SLOT_SIZE,
+                    s->tx_count * TAP_TX_SLOT_SIZE);
+            memmove(s->tx_lens, s->tx_lens + done,
+                    s->tx_count * sizeof(s->tx_lens[0]));
+            tap_write_poll(s, true);
+            return;
+        }
+    }
+
+    s->tx_count = 0;
+}
+
+static void tap_tx_bh(void *opaque)
+{
+    tap_tx_flush(opaque);
+}
+
+/*
+ * Copy a frame into the transmit batch.  The batch is written when it is
+ * full, or at the latest once the event loop is done with the current
+ * round of callbacks, which covers a whole virtio-net tx flush.
+ */
+static ssize_t tap_tx_queue(TAPState *s, const struct iovec *iov,
+                            int iovcnt, size_t size)
+{
+    if (s->tx_count == s->batch_size) {
+        tap_tx_flush(s);
+        if (!s->tx_bufs) {
+            return -ENOTSUP;
+        }
+        if (s->tx_count == s->batch_size) {
+            return 0;
+        }
+    }
+
+    iov_to_buf(iov, iovcnt, 0, s->tx_bufs + s->tx_count * TAP_TX_SLOT_SIZE,
+               size);
+    s->tx_lens[s->tx_count++] = size;
+
+    if (s->tx_count == s->batch_size) {
+        tap_tx_flush(s);
+    } else {
+        qemu_bh_schedule(s->tx_bh);
+    }
+
+    return size;
+}
+
+static void tap_tx_init(TAPState *s)
+{
+    int ret = io_uring_queue_init(s->batch_size, &s->tx_ring, 0);
+
+    if (ret < 0) {
+        warn_report("tap: io_uring setup failed (%s), "
+                    "writing packets one at a time", strerror(-ret));
+        return;
+    }
+
+    s->tx_bufs = g_malloc(s->batch_size * TAP_TX_SLOT_SIZE);
+    s->tx_bh = aio_bh_new(s->nc.aio_context ?: qemu_get_aio_context(),
+                          tap_tx_bh, s);
+}
+
+static void tap_tx_set_aio_context(TAPState *s, AioContext *ctx)
+{
+    if (!s->tx_bufs) {
+        return;
+    }
+
+    tap_tx_flush(s);
+    if (s->tx_bufs) {
+        qemu_bh_delete(s->tx_bh);
+        s->tx_bh = aio_bh_new(ctx ?: qemu_get_aio_context(), tap_tx_bh, s);
+    }
+}
+#else
+static void tap_tx_cleanup(TAPState *s)
+{
+}
+
+static void tap_tx_flush(TAPState *s)
+{
+}
+
+static void tap_tx_init(TAPState *s)
+{
+}
+
+static void tap_tx_set_aio_context(TAPState *s, AioContext *ctx)
+{
+}
+#endif
+
 static void tap_writable(void *opaque)
 {
     TAPState *s = opaque;
 
     tap_write_poll(s, false);
 
+    tap_tx_flush(s);
+    if (s->write_poll) {
+        return;
+    }
+
     qemu_flush_queued_packets(&s->nc);
 }
 
@@ -102,6 +300,25 @@ static ssize_t tap_write_packet(TAPState *s, const struct iovec *iov, int iovcnt
 {
     ssize_t len;
 
+#ifdef CONFIG_LINUX_IO_URING
+    if (s->tx_bufs) {
+        size_t size = iov_size(iov, iovcnt);
+
+        if (size <= TAP_TX_SLOT_SIZE) {
+            len = tap_tx_queue(s, iov, iovcnt, size);
+            if (len != -ENOTSUP) {
+                return len;
+            }
+        } else {
+            /* Write big frames directly, but not ahead of queued ones */
+            tap_tx_flush(s);
+            if (s->write_poll) {
+                return 0;
+            }
+        }
+    }
+#endif
+
     len = RETRY_ON_EINTR(writev(s->fd, iov, iovcnt));
 
     if (len == -1 && errno == EAGAIN) {
@@ -171,6 +388,69 @@ ssize_t tap_read_packet(int tapfd, uint8_t *buf, int maxlen)
 {
     return read(tapfd, buf, maxlen);
 }
+
+/* Maximum number of peer buffer segments a packet is read into */
+#define TAP_RX_ZEROCOPY_IOV 64
+
+/*
+ * Read a packet straight into the receive buffer of the peer.  Returns
+ * the packet size and sets *consumed if the peer took the packet;
+ * otherwise the packet has been copied to s->buf.  Returns -ENOTSUP
+ * without reading anything if the peer cannot provide a buffer.
+ */
+static ssize_t tap_read_packet_zerocopy(TAPState *s, bool *consumed)
+{
+    struct iovec peer_iov[TAP_RX_ZEROCOPY_IOV];
+    struct iovec iov[TAP_RX_ZEROCOPY_IOV + 1];
+    size_t peer_size;
+    ssize_t size;
+    int iovcnt;
+
+    *consumed = false;
+
+    if (s->host_vnet_hdr_len && !s->using_vnet_hdr) {
+        return -ENOTSUP;
+    }
+
+    iovcnt = qemu_rx_zerocopy_begin(&s->nc, peer_iov, ARRAY_SIZE(peer_iov));
+    if (iovcnt <= 0) {
+        return -ENOTSUP;
+    }
+
+    /*
+     * Whatever does not fit in the peer buffer spills into s->buf right
+     * after the part that would be copied back on fallback, so that the
+     * whole packet ends up contiguous there.
+     */
+    iovcnt = iov_copy(iov, TAP_RX_ZEROCOPY_IOV, peer_iov, iovcnt,
+                      0, sizeof(s->buf));
+    peer_size = iov_size(iov, iovcnt);
+    if (peer_size < sizeof(s->buf)) {
+        iov[iovcnt].iov_base = s->buf + peer_size;
+        iov[iovcnt].iov_len = sizeof(s->buf) - peer_size;
+        iovcnt++;
+    }
+
+    size = readv(s->fd, iov, iovcnt);
+    if (size > 0 && size <= peer_size &&
+        qemu_rx_zerocopy_end(&s->nc, size)) {
+        *consumed = true;
+        return size;
+    }
+
+    if (size > 0) {
+        iov_to_buf(iov, iovcnt, 0, s->buf, MIN(size, peer_size));
+    }
+    qemu_rx_zerocopy_end(&s->nc, -1);
+
+    return size;
+}
+#else
+static ssize_t tap_read_packet_zerocopy(TAPState *s, bool *consumed)
+{
+    *consumed = false;
+    return -ENOTSUP;
+}
 #endif
 
 static void tap_send_completed(NetClientState *nc, ssize_t len)
@@ -179,21 +459,79 @@ static void tap_send_completed(NetClientState *nc, ssize_t len)
     tap_read_poll(s, true);
 }
 
+/*
+ * Read up to batch_size packets and pass them to the peer in one call.
+ * Returns the number of packets read.
+ */
+static int tap_send_batch(TAPState *s)
+{
+    struct iovec pkts[TAP_BATCH_MAX];
+    int count, i;
+
+    for (count = 0; count < s->batch_size; count++) {
+        uint8_t *buf = s->rx_bufs + count * NET_BUFSIZE;
+        ssize_t size = tap_read_packet(s->fd, buf, NET_BUFSIZE);
+
+        if (size <= 0) {
+            break;
+        }
+
+        if (s->host_vnet_hdr_len && !s->using_vnet_hdr) {
+            buf  += s->host_vnet_hdr_len;
+            size -= s->host_vnet_hdr_len;
+        }
+
+        /* The buffer has room to pad in place */
+        if (net_peer_needs_padding(&s->nc) && size < ETH_ZLEN) {
+            memset(buf + size, 0, ETH_ZLEN - size);
+            size = ETH_ZLEN;
+        }
+
+        pkts[count].iov_base = buf;
+        pkts[count].iov_len = size;
+    }
+
+    for (i = qemu_send_packet_batch(&s->nc, pkts, count); i < count; i++) {
+        /* Once a packet is queued, the ones after it are queued behind it */
+        if (qemu_send_packet_async(&s->nc, pkts[i].iov_base, pkts[i].iov_len,
+                                   tap_send_completed) == 0) {
+            tap_read_poll(s, false);
+        }
+    }
+
+    return count;
+}
+
 static void tap_send(void *opaque)
 {
     TAPState *s = opaque;
     int size;
     int packets = 0;
 
+    if (s->rx_bufs) {
+        do {
+            size = tap_send_batch(s);
+            packets += size;
+        } while (size == s->batch_size && s->read_poll && packets < 50);
+        return;
+    }
+
     while (true) {
         uint8_t *buf = s->buf;
         uint8_t min_pkt[ETH_ZLEN];
         size_t min_pktsz = sizeof(min_pkt);
+        bool consumed;
 
-        size = tap_read_packet(s->fd, s->buf, sizeof(s->buf));
+        size = tap_read_packet_zerocopy(s, &consumed);
+        if (size == -ENOTSUP) {
+            size = tap_read_packet(s->fd, s->buf, sizeof(s->buf));
+        }
         if (size <= 0) {
             break;
         }
+        if (consumed) {
+            goto next;
+        }
 
         if (s->host_vnet_hdr_len && !s->using_vnet_hdr) {
             buf  += s->host_vnet_hdr_len;
@@ -215,6 +553,7 @@ static void tap_send(void *opaque)
             break;
         }
 
+next:
         /*
          * When the host keeps receiving more packets while tap_send() is
          * running we can hog the QEMU global mutex.  Limit the number of
@@ -347,13 +686,37 @@ static void tap_cleanup(NetClientState *nc)
 
     tap_read_poll(s, false);
     tap_write_poll(s, false);
+    tap_tx_cleanup(s);
+    g_free(s->rx_bufs);
+    s->rx_bufs = NULL;
     close(s->fd);
     s->fd = -1;
 }
 
+static void tap_set_aio_context(NetClientState *nc, AioContext *ctx)
+{
+    TAPState *s = DO_UPCAST(TAPState, nc, nc);
+
+    /* Drop the handlers from the old context before the new one runs them */
+    if (nc->aio_context) {
+        aio_set_fd_handler(nc->aio_context, s->fd, NULL, NULL, NULL, NULL,
+                           NULL);
+    } else {
+        qemu_set_fd_handler(s->fd, NULL, NULL, NULL);
+    }
+
+    nc->aio_context = ctx;
+    tap_tx_set_aio_context(s, ctx);
+    tap_update_fd_handler(s);
+}
+
 static void tap_poll(NetClientState *nc, bool enable)
 {
     TAPState *s = DO_UPCAST(TAPState, nc, nc);
+
+    if (!enable) {
+        tap_tx_flush(s);
+    }
     tap_read_poll(s, enable);
     tap_write_poll(s, enable);
 }
@@ -394,6 +757,7 @@ static NetClientInfo net_tap_info = {
     .set_vnet_le = tap_set_vnet_le,
     .set_vnet_be = tap_set_vnet_be,
     .set_steering_ebpf = tap_set_steering_ebpf,
+    .set_aio_context = tap_set_aio_context,
 };
 
 static TAPState *net_tap_fd_init(NetClientState *peer,
@@ -700,6 +1064,17 @@ static void net_init_tap_one(const NetdevTapOptions *tap, NetClientState *peer,
         goto failed;
     }
 
+    if (tap->has_batch_size && tap->batch_size) {
+        if (tap->batch_size > TAP_BATCH_MAX) {
+            error_setg(errp, "tap: batch-size must not exceed %d",
+                       TAP_BATCH_MAX);
+            goto failed;
+        }
+        s->batch_size = tap->batch_size;
+        s->rx_bufs = g_malloc(s->batch_size * NET_BUFSIZE);
+        tap_tx_init(s);
+    }
+
     if (tap->fd || tap->fds) {
         qemu_set_info_str(&s->nc, "fd=%d", fd);
     } else if (tap->helper) {
@@ -726,6 +1101,8 @@ static void net_init_tap_one(const NetdevTapOptions *tap, NetClientState *peer,
         } else {
             options.busyloop_timeout = 0;
         }
+        options.worker_per_vq = tap->has_vhost_worker_per_vq &&
+                                tap->vhost_worker_per_vq;
 
         if (vhostfdname) {
             vhostfd = monitor_fd_param(monitor_cur(), vhostfdname, &err);
@@ -1064,6 +1441,7 @@ int tap_disable(NetClientState *nc)
     if (s->enabled == 0) {
         return 0;
     } else {
+        tap_tx_flush(s);
         ret = tap_fd_disable(s->fd);
         if (ret == 0) {
             qemu_purge_queued_packets(nc);
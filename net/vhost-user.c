@@ -94,6 +94,7 @@ static int vhost_user_start(int queues, NetClientState *ncs[],
         options.net_backend = ncs[i];
         options.opaque      = be;
         options.busyloop_timeout = 0;
+        options.worker_per_vq = false;
         options.nvqs = 2;
         net = vhost_net_init(&options);
         if (!net) {
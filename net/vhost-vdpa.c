@@ -191,6 +191,7 @@ static int vhost_vdpa_add(NetClientState *ncs, void *be,
     options.net_backend = ncs;
     options.opaque      = be;
     options.busyloop_timeout = 0;
+    options.worker_per_vq = false;
     options.nvqs = nvqs;
 
     net = vhost_net_init(&options);
@@ -37,6 +37,11 @@ struct qemu_plugin_cb {
     QLIST_ENTRY(qemu_plugin_cb) entry;
 };
 
+struct qemu_plugin_scoreboard {
+    GArray *data;
+    QLIST_ENTRY(qemu_plugin_scoreboard) entry;
+};
+
 struct qemu_plugin_state plugin;
 
 struct qemu_plugin_ctx *plugin_id_to_ctx_locked(qemu_plugin_id_t id)
@@ -210,11 +215,62 @@ plugin_register_cb_udata(qemu_plugin_id_t id, enum qemu_plugin_event ev,
     do_plugin_register_cb(id, ev, func, udata);
 }
 
+/*
+ * Make room for @cpu in every scoreboard. Translated code points straight
+ * into the scoreboards, so resizing them requires all vCPUs to be stopped
+ * and the code cache to be flushed. In user mode, new vCPUs are created by
+ * the thread of an existing one, which can do just that. In system mode,
+ * scoreboards are allocated for max_cpus entries, so this is only reached
+ * while no vCPU runs yet.
+ */
+static void plugin_grow_scoreboards(CPUState *cpu)
+{
+    struct qemu_plugin_scoreboard *score;
+    size_t size;
+
+    qemu_rec_mutex_lock(&plugin.lock);
+    size = plugin.scoreboard_alloc_size;
+    while (cpu->cpu_index >= size) {
+        size *= 2;
+    }
+    if (size == plugin.scoreboard_alloc_size ||
+        QLIST_EMPTY(&plugin.scoreboards)) {
+        /* nothing to move, just remember the size for new scoreboards */
+        plugin.scoreboard_alloc_size = size;
+        qemu_rec_mutex_unlock(&plugin.lock);
+        return;
+    }
+    qemu_rec_mutex_unlock(&plugin.lock);
+
+    /* see qemu_plugin_user_exit() for the locking order */
+    if (current_cpu) {
+        start_exclusive();
+    }
+    qemu_rec_mutex_lock(&plugin.lock);
+    /* another vCPU may have been created meanwhile */
+    if (size > plugin.scoreboard_alloc_size) {
+        QLIST_FOREACH(score, &plugin.scoreboards, entry) {
+            g_array_set_size(score->data, size);
+        }
+        plugin.scoreboard_alloc_size = size;
+    }
+    qemu_rec_mutex_unlock(&plugin.lock);
+    if (current_cpu) {
+        tb_flush(current_cpu);
+        end_exclusive();
+    }
+}
+
 void qemu_plugin_vcpu_init_hook(CPUState *cpu)
 {
     bool success;
 
+    plugin_grow_scoreboards(cpu);
+
     qemu_rec_mutex_lock(&plugin.lock);
+    if (cpu->cpu_index >= plugin.num_vcpus) {
+        qatomic_set(&plugin.num_vcpus, cpu->cpu_index + 1);
+    }
     plugin_cpu_update__locked(&cpu->cpu_index, NULL, NULL);
     success = g_hash_table_insert(plugin.cpu_ht, &cpu->cpu_index,
                                   &cpu->cpu_index);
@@ -224,10 +280,20 @@ void qemu_plugin_vcpu_init_hook(CPUState *cpu)
     plugin_vcpu_cb__simple(cpu, QEMU_PLUGIN_EV_VCPU_INIT);
 }
 
+static void plugin_mem_rings_flush(unsigned int cpu_index)
+{
+    struct qemu_plugin_mem_ring *ring;
+
+    QLIST_FOREACH(ring, &plugin.mem_rings, entry) {
+        qemu_plugin_mem_ring_flush(ring, cpu_index);
+    }
+}
+
 void qemu_plugin_vcpu_exit_hook(CPUState *cpu)
 {
     bool success;
 
+    plugin_mem_rings_flush(cpu->cpu_index);
     plugin_vcpu_cb__simple(cpu, QEMU_PLUGIN_EV_VCPU_EXIT);
 
     qemu_rec_mutex_lock(&plugin.lock);
@@ -290,6 +356,24 @@ void plugin_register_inline_op(GArray **arr,
     dyn_cb->userp = ptr;
     dyn_cb->type = PLUGIN_CB_INLINE;
     dyn_cb->rw = rw;
+    dyn_cb->inline_insn.entry = (qemu_plugin_u64) { NULL, 0 };
+    dyn_cb->inline_insn.op = op;
+    dyn_cb->inline_insn.imm = imm;
+}
+
+void plugin_register_inline_op_on_entry(GArray **arr,
+                                        enum qemu_plugin_mem_rw rw,
+                                        enum qemu_plugin_op op,
+                                        qemu_plugin_u64 entry,
+                                        uint64_t imm)
+{
+    struct qemu_plugin_dyn_cb *dyn_cb;
+
+    dyn_cb = plugin_get_dyn_cb(arr);
+    dyn_cb->userp = NULL;
+    dyn_cb->type = PLUGIN_CB_INLINE;
+    dyn_cb->rw = rw;
+    dyn_cb->inline_insn.entry = entry;
     dyn_cb->inline_insn.op = op;
     dyn_cb->inline_insn.imm = imm;
 }
@@ -307,6 +391,39 @@ void plugin_register_dyn_cb__udata(GArray **arr,
     dyn_cb->type = PLUGIN_CB_REGULAR;
 }
 
+void plugin_register_mem_ring(GArray **arr,
+                              enum qemu_plugin_mem_rw rw,
+                              struct qemu_plugin_mem_ring *ring,
+                              uint64_t pc)
+{
+    struct qemu_plugin_dyn_cb *dyn_cb = plugin_get_dyn_cb(arr);
+
+    dyn_cb->userp = ring;
+    dyn_cb->type = PLUGIN_CB_RING;
+    dyn_cb->rw = rw;
+    dyn_cb->ring.pc = pc;
+    dyn_cb->ring.n_accesses = 0;
+}
+
+void plugin_register_dyn_cond_cb__udata(GArray **arr,
+                                        qemu_plugin_vcpu_udata_cb_t cb,
+                                        enum qemu_plugin_cb_flags flags,
+                                        enum qemu_plugin_cond cond,
+                                        qemu_plugin_u64 entry,
+                                        uint64_t imm,
+                                        void *udata)
+{
+    struct qemu_plugin_dyn_cb *dyn_cb = plugin_get_dyn_cb(arr);
+
+    dyn_cb->userp = udata;
+    /* Note flags are discarded as unused. */
+    dyn_cb->f.vcpu_udata = cb;
+    dyn_cb->type = PLUGIN_CB_COND;
+    dyn_cb->cond.entry = entry;
+    dyn_cb->cond.cond = cond;
+    dyn_cb->cond.imm = imm;
+}
+
 void plugin_register_vcpu_mem_cb(GArray **arr,
                                  void *cb,
                                  enum qemu_plugin_cb_flags flags,
@@ -432,19 +549,74 @@ void qemu_plugin_flush_cb(void)
     plugin_cb__simple(QEMU_PLUGIN_EV_FLUSH);
 }
 
-void exec_inline_op(struct qemu_plugin_dyn_cb *cb)
+void qemu_plugin_u64_layout(qemu_plugin_u64 entry, void *ptr,
+                            char **base, size_t *stride)
 {
-    uint64_t *val = cb->userp;
+    if (!entry.score) {
+        *base = ptr;
+        *stride = 0;
+        return;
+    }
+    *base = entry.score->data->data + entry.offset;
+    *stride = g_array_get_element_size(entry.score->data);
+}
+
+void exec_inline_op(struct qemu_plugin_dyn_cb *cb, int cpu_index)
+{
+    uint64_t *val;
+    size_t stride;
+    char *base;
+
+    qemu_plugin_u64_layout(cb->inline_insn.entry, cb->userp, &base, &stride);
+    val = (uint64_t *)(base + cpu_index * stride);
 
     switch (cb->inline_insn.op) {
     case QEMU_PLUGIN_INLINE_ADD_U64:
         *val += cb->inline_insn.imm;
         break;
+    case QEMU_PLUGIN_INLINE_STORE_U64:
+        *val = cb->inline_insn.imm;
+        break;
     default:
         g_assert_not_reached();
     }
 }
 
+void qemu_plugin_mem_ring_flush(struct qemu_plugin_mem_ring *ring,
+                                unsigned int cpu_index)
+{
+    struct qemu_plugin_mem_ring_buf *buf =
+        qemu_plugin_scoreboard_find(ring->score, cpu_index);
+
+    if (buf->count) {
+        ring->cb(cpu_index, buf->records, buf->count, ring->userdata);
+        buf->count = 0;
+    }
+}
+
+/*
+ * Translated code only makes room for the accesses it logs itself, so
+ * accesses from helpers are delivered immediately.
+ */
+static void plugin_mem_ring_log(struct qemu_plugin_dyn_cb *cb,
+                                unsigned int cpu_index, uint64_t vaddr,
+                                qemu_plugin_meminfo_t info)
+{
+    struct qemu_plugin_mem_ring *ring = cb->userp;
+    struct qemu_plugin_mem_ring_buf *buf =
+        qemu_plugin_scoreboard_find(ring->score, cpu_index);
+    qemu_plugin_mem_record *rec;
+
+    if (buf->count == ring->n_records) {
+        qemu_plugin_mem_ring_flush(ring, cpu_index);
+    }
+    rec = &buf->records[buf->count++];
+    rec->vaddr = vaddr;
+    rec->pc = cb->ring.pc;
+    rec->info = info;
+    qemu_plugin_mem_ring_flush(ring, cpu_index);
+}
+
 void qemu_plugin_vcpu_mem_cb(CPUState *cpu, uint64_t vaddr,
                              MemOpIdx oi, enum qemu_plugin_mem_rw rw)
 {
@@ -459,7 +631,7 @@ void qemu_plugin_vcpu_mem_cb(CPUState *cpu, uint64_t vaddr,
             &g_array_index(arr, struct qemu_plugin_dyn_cb, i);
 
         if (!(rw & cb->rw)) {
-                break;
+            continue;
         }
         switch (cb->type) {
         case PLUGIN_CB_REGULAR:
@@ -467,7 +639,11 @@ void qemu_plugin_vcpu_mem_cb(CPUState *cpu, uint64_t vaddr,
                            vaddr, cb->userp);
             break;
         case PLUGIN_CB_INLINE:
-            exec_inline_op(cb);
+            exec_inline_op(cb, cpu->cpu_index);
+            break;
+        case PLUGIN_CB_RING:
+            plugin_mem_ring_log(cb, cpu->cpu_index, vaddr,
+                                make_plugin_meminfo(oi, rw));
             break;
         default:
             g_assert_not_reached();
@@ -477,6 +653,11 @@ void qemu_plugin_vcpu_mem_cb(CPUState *cpu, uint64_t vaddr,
 
 void qemu_plugin_atexit_cb(void)
 {
+    int i;
+
+    for (i = 0; i < plugin.num_vcpus; i++) {
+        plugin_mem_rings_flush(i);
+    }
     plugin_cb__udata(QEMU_PLUGIN_EV_ATEXIT);
 }
 
@@ -552,6 +733,76 @@ void qemu_plugin_user_postfork(bool is_child)
     }
 }
 
+struct qemu_plugin_scoreboard *plugin_scoreboard_new(size_t element_size)
+{
+    struct qemu_plugin_scoreboard *score =
+        g_new0(struct qemu_plugin_scoreboard, 1);
+
+    score->data = g_array_new(false, true, element_size);
+
+    qemu_rec_mutex_lock(&plugin.lock);
+#ifndef CONFIG_USER_ONLY
+    /* vCPUs may be hot-plugged while others run, make room for all */
+    plugin.scoreboard_alloc_size = MAX(plugin.scoreboard_alloc_size,
+                                       (size_t)qemu_plugin_n_max_vcpus());
+#endif
+    g_array_set_size(score->data, plugin.scoreboard_alloc_size);
+    QLIST_INSERT_HEAD(&plugin.scoreboards, score, entry);
+    qemu_rec_mutex_unlock(&plugin.lock);
+
+    return score;
+}
+
+void plugin_scoreboard_free(struct qemu_plugin_scoreboard *score)
+{
+    qemu_rec_mutex_lock(&plugin.lock);
+    QLIST_REMOVE(score, entry);
+    qemu_rec_mutex_unlock(&plugin.lock);
+
+    g_array_free(score->data, true);
+    g_free(score);
+}
+
+struct qemu_plugin_mem_ring *
+plugin_mem_ring_new(size_t n_records, qemu_plugin_vcpu_mem_batch_cb_t cb,
+                    void *userdata)
+{
+    struct qemu_plugin_mem_ring *ring = g_new0(struct qemu_plugin_mem_ring, 1);
+
+    ring->n_records = n_records;
+    ring->cb = cb;
+    ring->userdata = userdata;
+    ring->score = plugin_scoreboard_new(
+        sizeof(struct qemu_plugin_mem_ring_buf) +
+        n_records * sizeof(qemu_plugin_mem_record));
+
+    qemu_rec_mutex_lock(&plugin.lock);
+    QLIST_INSERT_HEAD(&plugin.mem_rings, ring, entry);
+    qemu_rec_mutex_unlock(&plugin.lock);
+
+    return ring;
+}
+
+void plugin_mem_ring_free(struct qemu_plugin_mem_ring *ring)
+{
+    int i;
+
+    qemu_rec_mutex_lock(&plugin.lock);
+    QLIST_REMOVE(ring, entry);
+    qemu_rec_mutex_unlock(&plugin.lock);
+
+    for (i = 0; i < plugin.num_vcpus; i++) {
+        qemu_plugin_mem_ring_flush(ring, i);
+    }
+    plugin_scoreboard_free(ring->score);
+    g_free(ring);
+}
+
+int plugin_num_vcpus(void)
+{
+    return qatomic_read(&plugin.num_vcpus);
+}
+
 static bool plugin_dyn_cb_arr_cmp(const void *ap, const void *bp)
 {
     return ap == bp;
@@ -570,5 +821,8 @@ static void __attribute__((__constructor__)) plugin_init(void)
     QTAILQ_INIT(&plugin.ctxs);
     qht_init(&plugin.dyn_cb_arr_ht, plugin_dyn_cb_arr_cmp, 16,
              QHT_MODE_AUTO_RESIZE);
+    QLIST_INIT(&plugin.scoreboards);
+    QLIST_INIT(&plugin.mem_rings);
+    plugin.scoreboard_alloc_size = 16; /* avoid frequent reallocation */
     atexit(qemu_plugin_atexit_cb);
 }
@@ -44,6 +44,17 @@ struct qemu_plugin_state {
      * the code cache is flushed.
      */
     struct qht dyn_cb_arr_ht;
+    /*
+     * Scoreboards, and the number of entries each of them has room for.
+     * Translated code points straight into them, so growing them for new
+     * vCPUs stops all vCPUs and flushes the code cache.
+     */
+    QLIST_HEAD(, qemu_plugin_scoreboard) scoreboards;
+    size_t scoreboard_alloc_size;
+    /* highest vCPU index seen so far, plus one */
+    int num_vcpus;
+    /* memory access rings, flushed on vCPU exit and before atexit */
+    QLIST_HEAD(, qemu_plugin_mem_ring) mem_rings;
 };
 
 
@@ -69,6 +80,12 @@ void plugin_register_inline_op(GArray **arr,
                                enum qemu_plugin_op op, void *ptr,
                                uint64_t imm);
 
+void plugin_register_inline_op_on_entry(GArray **arr,
+                                        enum qemu_plugin_mem_rw rw,
+                                        enum qemu_plugin_op op,
+                                        qemu_plugin_u64 entry,
+                                        uint64_t imm);
+
 void plugin_reset_uninstall(qemu_plugin_id_t id,
                             qemu_plugin_simple_cb_t cb,
                             bool reset);
@@ -88,6 +105,15 @@ plugin_register_dyn_cb__udata(GArray **arr,
                               qemu_plugin_vcpu_udata_cb_t cb,
                               enum qemu_plugin_cb_flags flags, void *udata);
 
+void
+plugin_register_dyn_cond_cb__udata(GArray **arr,
+                                   qemu_plugin_vcpu_udata_cb_t cb,
+                                   enum qemu_plugin_cb_flags flags,
+                                   enum qemu_plugin_cond cond,
+                                   qemu_plugin_u64 entry,
+                                   uint64_t imm,
+                                   void *udata);
+
 
 void plugin_register_vcpu_mem_cb(GArray **arr,
                                  void *cb,
@@ -95,6 +121,23 @@ void plugin_register_vcpu_mem_cb(GArray **arr,
                                  enum qemu_plugin_mem_rw rw,
                                  void *udata);
 
-void exec_inline_op(struct qemu_plugin_dyn_cb *cb);
+void plugin_register_mem_ring(GArray **arr,
+                              enum qemu_plugin_mem_rw rw,
+                              struct qemu_plugin_mem_ring *ring,
+                              uint64_t pc);
+
+void exec_inline_op(struct qemu_plugin_dyn_cb *cb, int cpu_index);
+
+struct qemu_plugin_scoreboard *plugin_scoreboard_new(size_t element_size);
+
+void plugin_scoreboard_free(struct qemu_plugin_scoreboard *score);
+
+int plugin_num_vcpus(void);
+
+struct qemu_plugin_mem_ring *
+plugin_mem_ring_new(size_t n_records, qemu_plugin_vcpu_mem_batch_cb_t cb,
+                    void *userdata);
+
+void plugin_mem_ring_free(struct qemu_plugin_mem_ring *ring);
 
 #endif /* PLUGIN_H */
@@ -24,6 +24,7 @@
 
 #include "qemu/osdep.h"
 #include <getopt.h>
+#include <math.h>
 
 #include "qemu/help-texts.h"
 #include "qemu/qemu-progress.h"
@@ -34,6 +35,8 @@
 #include "qapi/qobject-output-visitor.h"
 #include "qapi/qmp/qjson.h"
 #include "qapi/qmp/qdict.h"
+#include "qapi/qmp/qlist.h"
+#include "qapi/qmp/qnum.h"
 #include "qemu/cutils.h"
 #include "qemu/config-file.h"
 #include "qemu/option.h"
@@ -50,6 +53,7 @@
 #include "block/blockjob.h"
 #include "block/dirty-bitmap.h"
 #include "block/qapi.h"
+#include "block/thread-pool.h"
 #include "crypto/init.h"
 #include "trace/control.h"
 #include "qemu/throttle.h"
@@ -86,6 +90,9 @@ enum {
     OPTION_BITMAPS = 275,
     OPTION_FORCE = 276,
     OPTION_SKIP_BROKEN = 277,
+    OPTION_READ_RATIO = 278,
+    OPTION_DISTRIBUTION = 279,
+    OPTION_TIME = 280,
 };
 
 typedef enum OutputFormat {
@@ -730,6 +737,7 @@ static int img_check(int argc, char **argv)
     bool quiet = false;
     bool image_opts = false;
     bool force_share = false;
+    bool progress = false;
 
     fmt = NULL;
     output = NULL;
@@ -747,7 +755,7 @@ static int img_check(int argc, char **argv)
             {"force-share", no_argument, 0, 'U'},
             {0, 0, 0, 0}
         };
-        c = getopt_long(argc, argv, ":hf:r:T:qU",
+        c = getopt_long(argc, argv, ":hf:r:T:pqU",
                         long_options, &option_index);
         if (c == -1) {
             break;
@@ -783,6 +791,9 @@ static int img_check(int argc, char **argv)
         case 'T':
             cache = optarg;
             break;
+        case 'p':
+            progress = true;
+            break;
         case 'q':
             quiet = true;
             break;
@@ -802,6 +813,10 @@ static int img_check(int argc, char **argv)
     }
     filename = argv[optind++];
 
+    if (quiet) {
+        progress = false;
+    }
+
     if (output && !strcmp(output, "json")) {
         output_format = OFORMAT_JSON;
     } else if (output && !strcmp(output, "human")) {
@@ -824,8 +839,14 @@ static int img_check(int argc, char **argv)
     }
     bs = blk_bs(blk);
 
+    /* Progress would get in the way of machine-readable output */
+    qemu_progress_init(progress && output_format == OFORMAT_HUMAN, 1.f);
+    qemu_progress_print(0, 100);
+
     check = g_new0(ImageCheck, 1);
     ret = collect_image_check(bs, check, filename, fmt, fix);
+    qemu_progress_print(100, 0);
+    qemu_progress_end();
 
     if (ret == -ENOTSUP) {
         error_report("This image format does not support checks");
@@ -1179,6 +1200,7 @@ static int64_t find_nonzero(const uint8_t *buf, int64_t n)
 static int is_allocated_sectors(const uint8_t *buf, int n, int *pnum,
                                 int64_t sector_num, int alignment)
 {
+    BufferZeroRun run;
     bool is_zero;
     int i, tail;
 
@@ -1186,13 +1208,10 @@ static int is_allocated_sectors(const uint8_t *buf, int n, int *pnum,
         *pnum = 0;
         return 0;
     }
-    is_zero = buffer_is_zero(buf, BDRV_SECTOR_SIZE);
-    for(i = 1; i < n; i++) {
-        buf += BDRV_SECTOR_SIZE;
-        if (is_zero != buffer_is_zero(buf, BDRV_SECTOR_SIZE)) {
-            break;
-        }
-    }
+    buffer_find_zero_runs(buf, (size_t)n * BDRV_SECTOR_SIZE, BDRV_SECTOR_SIZE,
+                          &run, 1);
+    is_zero = run.zero;
+    i = run.length / BDRV_SECTOR_SIZE;
 
     if (i == n) {
         /*
@@ -1658,7 +1677,7 @@ enum ImgConvertBlockStatus {
     BLK_BACKING_FILE,
 };
 
-#define MAX_COROUTINES 16
+#define MAX_COROUTINES 64
 #define CONVERT_THROTTLE_GROUP "img_convert"
 
 typedef struct ImgConvertState {
@@ -1866,6 +1885,63 @@ static int coroutine_fn convert_co_read(ImgConvertState *s, int64_t sector_num,
     return 0;
 }
 
+/*
+ * Scanning for zeroes is CPU bound, so for large buffers it is done in the
+ * thread pool.  That way the zero detection of all -m coroutines runs in
+ * parallel instead of in the main loop.
+ */
+#define CONVERT_ZERO_DETECT_OFFLOAD_SECTORS ((64 * KiB) >> BDRV_SECTOR_BITS)
+
+typedef struct ConvertZeroDetect {
+    ImgConvertState *s;
+    const uint8_t *buf;
+    int64_t sector_num;
+    int n;
+    int pnum;
+} ConvertZeroDetect;
+
+static int convert_zero_detect(void *opaque)
+{
+    ConvertZeroDetect *zd = opaque;
+    ImgConvertState *s = zd->s;
+
+    /*
+     * Compressed clusters need to be written as a whole, so in that case
+     * we can only save the write if the buffer is completely zeroed.
+     */
+    if (s->compressed) {
+        zd->pnum = zd->n;
+        return !buffer_is_zero(zd->buf, zd->n * BDRV_SECTOR_SIZE);
+    }
+    return is_allocated_sectors_min(zd->buf, zd->n, &zd->pnum, s->min_sparse,
+                                    zd->sector_num, s->alignment);
+}
+
+/*
+ * Return whether the first *pnum sectors of @buf must be written as data,
+ * with *pnum set to the number of sectors (out of @n) that share the
+ * result.
+ */
+static int coroutine_fn convert_co_is_data(ImgConvertState *s,
+                                           int64_t sector_num, int n,
+                                           const uint8_t *buf, int *pnum)
+{
+    ConvertZeroDetect zd = {
+        .s = s,
+        .buf = buf,
+        .sector_num = sector_num,
+        .n = n,
+    };
+    int ret;
+
+    if (n >= CONVERT_ZERO_DETECT_OFFLOAD_SECTORS) {
+        ret = thread_pool_submit_co(convert_zero_detect, &zd);
+    } else {
+        ret = convert_zero_detect(&zd);
+    }
+    *pnum = zd.pnum;
+    return ret;
+}
 
 static int coroutine_fn convert_co_write(ImgConvertState *s, int64_t sector_num,
                                          int nb_sectors, uint8_t *buf,
@@ -1888,16 +1964,9 @@ static int coroutine_fn convert_co_write(ImgConvertState *s, int64_t sector_num,
         case BLK_DATA:
             /* If we're told to keep the target fully allocated (-S 0) or there
              * is real non-zero data, we must write it. Otherwise we can treat
-             * it as zero sectors.
-             * Compressed clusters need to be written as a whole, so in that
-             * case we can only save the write if the buffer is completely
-             * zeroed. */
+             * it as zero sectors. */
             if (!s->min_sparse ||
-                (!s->compressed &&
-                 is_allocated_sectors_min(buf, n, &n, s->min_sparse,
-                                          sector_num, s->alignment)) ||
-                (s->compressed &&
-                 !buffer_is_zero(buf, n * BDRV_SECTOR_SIZE)))
+                convert_co_is_data(s, sector_num, n, buf, &n))
             {
                 ret = blk_co_pwrite(s->target, sector_num << BDRV_SECTOR_BITS,
                                     n << BDRV_SECTOR_BITS, buf, flags);
@@ -4305,23 +4374,127 @@ out_no_progress:
     return 0;
 }
 
-typedef struct BenchData {
+typedef enum BenchDistribution {
+    BENCH_DIST_SEQUENTIAL,
+    BENCH_DIST_UNIFORM,
+    BENCH_DIST_ZIPF,
+} BenchDistribution;
+
+typedef struct BenchData BenchData;
+
+typedef struct BenchRequest {
+    BenchData *b;
+    QEMUIOVector qiov;
+    BlockAcctCookie acct;
+} BenchRequest;
+
+struct BenchData {
     BlockBackend *blk;
     uint64_t image_size;
     bool write;
+    int read_ratio; /* percentage of reads in a mixed test, -1 if not mixed */
     int bufsize;
     int step;
     int nrreq;
     int n;
     int flush_interval;
     bool drain_on_flush;
+    int64_t end_time_ns; /* for time-based runs, 0 otherwise */
     uint8_t *buf;
-    QEMUIOVector *qiov;
+    BenchRequest *reqs;
+    BenchRequest **free_reqs;
+    int nr_free_reqs;
+
+    BenchDistribution distribution;
+    GRand *rand;
+    uint64_t nr_blocks;
+    double zipf_theta;
+    double zipf_zetan;
+    double zipf_eta;
 
     int in_flight;
     bool in_flush;
     uint64_t offset;
-} BenchData;
+};
+
+/*
+ * Latency histogram boundaries in ns, 1-2-5 steps from 1 us to 10 s.  The
+ * percentiles that are printed are the upper bounds of histogram bins.
+ */
+static const uint64_t bench_latency_boundaries[] = {
+    1000, 2000, 5000,
+    10000, 20000, 50000,
+    100000, 200000, 500000,
+    1000000, 2000000, 5000000,
+    10000000, 20000000, 50000000,
+    100000000, 200000000, 500000000,
+    1000000000, 2000000000, 5000000000, 10000000000,
+};
+
+static const double bench_percentiles[] = { 50, 90, 99, 99.9, 99.99 };
+
+/*
+ * Zipf distributed block numbers, following Gray et al., "Quickly
+ * Generating Billion-Record Synthetic Databases".  Low block numbers are
+ * the hot ones.
+ */
+static void bench_zipf_init(BenchData *b, double theta)
+{
+    double zeta2 = 1.0 + pow(0.5, theta);
+    uint64_t i;
+
+    b->zipf_theta = theta;
+    b->zipf_zetan = 0;
+    for (i = 1; i <= b->nr_blocks; i++) {
+        b->zipf_zetan += pow(1.0 / i, theta);
+    }
+    b->zipf_eta = (1.0 - pow(2.0 / b->nr_blocks, 1.0 - theta)) /
+                  (1.0 - zeta2 / b->zipf_zetan);
+}
+
+static uint64_t bench_zipf_next(BenchData *b)
+{
+    double u = g_rand_double(b->rand);
+    double uz = u * b->zipf_zetan;
+    uint64_t block;
+
+    if (uz < 1.0) {
+        return 0;
+    }
+    if (uz < 1.0 + pow(0.5, b->zipf_theta)) {
+        return MIN(1, b->nr_blocks - 1);
+    }
+    block = b->nr_blocks * pow(b->zipf_eta * u - b->zipf_eta + 1.0,
+                               1.0 / (1.0 - b->zipf_theta));
+    return MIN(block, b->nr_blocks - 1);
+}
+
+static uint64_t bench_next_offset(BenchData *b)
+{
+    uint64_t offset;
+
+    switch (b->distribution) {
+    case BENCH_DIST_SEQUENTIAL:
+        offset = b->offset;
+        b->offset += b->step;
+        b->offset %= b->image_size;
+        return offset;
+    case BENCH_DIST_UNIFORM:
+        return (uint64_t)(g_rand_double(b->rand) * b->nr_blocks) * b->bufsize;
+    case BENCH_DIST_ZIPF:
+        return bench_zipf_next(b) * b->bufsize;
+    default:
+        abort();
+    }
+}
+
+static bool bench_next_is_write(BenchData *b)
+{
+    if (b->read_ratio < 0) {
+        return b->write;
+    }
+    return g_rand_int_range(b->rand, 0, 100) >= b->read_ratio;
+}
 
 static void bench_undrained_flush_cb(void *opaque, int ret)
 {
@@ -4331,6 +4504,8 @@ static void bench_undrained_flush_cb(void *opaque, int ret)
     }
 }
 
+static void bench_request_cb(void *opaque, int ret);
+
 static void bench_cb(void *opaque, int ret)
 {
     BenchData *b = opaque;
@@ -4375,19 +4550,30 @@ static void bench_cb(void *opaque, int ret)
         }
     }
 
+    if (b->end_time_ns && b->n > b->in_flight &&
+        qemu_clock_get_ns(QEMU_CLOCK_REALTIME) >= b->end_time_ns) {
+        /* Time is up, only wait for the requests in flight */
+        b->n = b->in_flight;
+    }
+
     while (b->n > b->in_flight && b->in_flight < b->nrreq) {
-        int64_t offset = b->offset;
+        BenchRequest *req = b->free_reqs[--b->nr_free_reqs];
+        int64_t offset = bench_next_offset(b);
+        bool write = bench_next_is_write(b);
+
         /* blk_aio_* might look for completed I/Os and kick bench_cb
          * again, so make sure this operation is counted by in_flight
          * and b->offset is ready for the next submission.
          */
         b->in_flight++;
-        b->offset += b->step;
-        b->offset %= b->image_size;
-        if (b->write) {
-            acb = blk_aio_pwritev(b->blk, offset, b->qiov, 0, bench_cb, b);
+        block_acct_start(blk_get_stats(b->blk), &req->acct, b->bufsize,
+                         write ? BLOCK_ACCT_WRITE : BLOCK_ACCT_READ);
+        if (write) {
+            acb = blk_aio_pwritev(b->blk, offset, &req->qiov, 0,
+                                  bench_request_cb, req);
         } else {
-            acb = blk_aio_preadv(b->blk, offset, b->qiov, 0, bench_cb, b);
+            acb = blk_aio_preadv(b->blk, offset, &req->qiov, 0,
+                                 bench_request_cb, req);
         }
         if (!acb) {
             error_report("Failed to issue request");
@@ -4396,6 +4582,119 @@ static void bench_cb(void *opaque, int ret)
     }
 }
 
+static void bench_request_cb(void *opaque, int ret)
+{
+    BenchRequest *req = opaque;
+    BenchData *b = req->b;
+
+    if (ret < 0) {
+        block_acct_failed(blk_get_stats(b->blk), &req->acct);
+    } else {
+        block_acct_done(blk_get_stats(b->blk), &req->acct);
+    }
+    b->free_reqs[b->nr_free_reqs++] = req;
+
+    bench_cb(b, ret);
+}
+
+static uint64_t bench_latency_percentile(BlockLatencyHistogram *hist,
+                                         uint64_t nr_ops, double percentile)
+{
+    uint64_t target = ceil(nr_ops * percentile / 100);
+    uint64_t sum = 0;
+    int i;
+
+    for (i = 0; i < hist->nbins - 1; i++) {
+        sum += hist->bins[i];
+        if (sum >= target) {
+            return hist->boundaries[i];
+        }
+    }
+    /* Slower than the last boundary */
+    return hist->boundaries[hist->nbins - 2];
+}
+
+static void bench_print_human(BlockAcctStats *stats, double seconds)
+{
+    static const char *const names[] = {
+        [BLOCK_ACCT_READ] = "read",
+        [BLOCK_ACCT_WRITE] = "write",
+    };
+    enum BlockAcctType type;
+    int i;
+
+    for (type = BLOCK_ACCT_READ; type <= BLOCK_ACCT_WRITE; type++) {
+        uint64_t nr_ops = stats->nr_ops[type];
+
+        if (!nr_ops) {
+            continue;
+        }
+        printf("%s: %" PRIu64 " requests, %.1f IOPS, %.2f MiB/s, "
+               "latency avg %.1f us\n",
+               names[type], nr_ops, nr_ops / seconds,
+               stats->nr_bytes[type] / seconds / MiB,
+               (double)stats->total_time_ns[type] / nr_ops / 1000);
+        printf("%s latency percentiles:", names[type]);
+        for (i = 0; i < ARRAY_SIZE(bench_percentiles); i++) {
+            printf(" p%g<=%" PRIu64 "us", bench_percentiles[i],
+                   bench_latency_percentile(&stats->latency_histogram[type],
+                                            nr_ops, bench_percentiles[i]) /
+                   1000);
+        }
+        printf("\n");
+    }
+}
+
+static void bench_print_json(BlockAcctStats *stats, double seconds)
+{
+    static const char *const names[] = {
+        [BLOCK_ACCT_READ] = "read",
+        [BLOCK_ACCT_WRITE] = "write",
+    };
+    QDict *result = qdict_new();
+    enum BlockAcctType type;
+    GString *str;
+    int i;
+
+    qdict_put(result, "seconds", qnum_from_double(seconds));
+    for (type = BLOCK_ACCT_READ; type <= BLOCK_ACCT_WRITE; type++) {
+        BlockLatencyHistogram *hist = &stats->latency_histogram[type];
+        uint64_t nr_ops = stats->nr_ops[type];
+        QDict *dict = qdict_new();
+        QDict *percentiles = qdict_new();
+        QList *boundaries = qlist_new();
+        QList *bins = qlist_new();
+
+        qdict_put_int(dict, "requests", nr_ops);
+        qdict_put_int(dict, "bytes", stats->nr_bytes[type]);
+        qdict_put(dict, "iops", qnum_from_double(nr_ops / seconds));
+        qdict_put_int(dict, "total-latency-ns", stats->total_time_ns[type]);
+        for (i = 0; nr_ops && i < ARRAY_SIZE(bench_percentiles); i++) {
+            g_autofree char *name = g_strdup_printf("p%g",
+                                                    bench_percentiles[i]);
+
+            qdict_put_int(percentiles, name,
+                          bench_latency_percentile(hist, nr_ops,
+                                                   bench_percentiles[i]));
+        }
+        qdict_put(dict, "latency-percentiles-ns", percentiles);
+        for (i = 0; i < hist->nbins - 1; i++) {
+            qlist_append_int(boundaries, hist->boundaries[i]);
+        }
+        for (i = 0; i < hist->nbins; i++) {
+            qlist_append_int(bins, hist->bins[i]);
+        }
+        qdict_put(dict, "latency-histogram-boundaries-ns", boundaries);
+        qdict_put(dict, "latency-histogram-bins", bins);
+        qdict_put(result, names[type], dict);
+    }
+
+    str = qobject_to_json_pretty(QOBJECT(result), true);
+    printf("%s\n", str->str);
+    qobject_unref(result);
+    g_string_free(str, true);
+}
+
 static int img_bench(int argc, char **argv)
 {
     int c, ret = 0;
@@ -4411,12 +4710,21 @@ static int img_bench(int argc, char **argv)
     size_t step = 0;
     int flush_interval = 0;
     bool drain_on_flush = true;
+    int read_ratio = -1;
+    BenchDistribution distribution = BENCH_DIST_SEQUENTIAL;
+    double zipf_theta = 0;
+    int64_t run_time = 0;
+    bool count_set = false;
+    OutputFormat output_format = OFORMAT_HUMAN;
     int64_t image_size;
     BlockBackend *blk = NULL;
     BenchData data = {};
+    BlockAcctStats *stats;
+    uint64List *boundaries = NULL;
     int flags = 0;
     bool writethrough = false;
     struct timeval t1, t2;
+    double seconds;
     int i;
     bool force_share = false;
     size_t buf_size = 0;
@@ -4429,6 +4737,10 @@ static int img_bench(int argc, char **argv)
             {"pattern", required_argument, 0, OPTION_PATTERN},
             {"no-drain", no_argument, 0, OPTION_NO_DRAIN},
             {"force-share", no_argument, 0, 'U'},
+            {"read-ratio", required_argument, 0, OPTION_READ_RATIO},
+            {"distribution", required_argument, 0, OPTION_DISTRIBUTION},
+            {"time", required_argument, 0, OPTION_TIME},
+            {"output", required_argument, 0, OPTION_OUTPUT},
             {0, 0, 0, 0}
         };
         c = getopt_long(argc, argv, ":hc:d:f:ni:o:qs:S:t:wU", long_options,
@@ -4456,6 +4768,7 @@ static int img_bench(int argc, char **argv)
                 return 1;
             }
             count = res;
+            count_set = true;
             break;
         }
         case 'd':
@@ -4559,6 +4872,63 @@ static int img_bench(int argc, char **argv)
         case OPTION_NO_DRAIN:
             drain_on_flush = false;
             break;
+        case OPTION_READ_RATIO:
+        {
+            unsigned long res;
+
+            if (qemu_strtoul(optarg, NULL, 0, &res) < 0 || res > 100) {
+                error_report("Invalid read ratio specified");
+                return 1;
+            }
+            read_ratio = res;
+            break;
+        }
+        case OPTION_DISTRIBUTION:
+            if (!strcmp(optarg, "sequential")) {
+                distribution = BENCH_DIST_SEQUENTIAL;
+            } else if (!strcmp(optarg, "uniform")) {
+                distribution = BENCH_DIST_UNIFORM;
+            } else if (!strcmp(optarg, "zipf")) {
+                distribution = BENCH_DIST_ZIPF;
+                zipf_theta = 1.2;
+            } else if (strstart(optarg, "zipf:", NULL)) {
+                distribution = BENCH_DIST_ZIPF;
+                if (qemu_strtod(optarg + strlen("zipf:"), NULL,
+                                &zipf_theta) < 0 ||
+                    zipf_theta <= 0 || zipf_theta == 1) {
+                    error_report("Invalid zipf theta specified");
+                    return 1;
+                }
+            } else {
+                error_report("Invalid distribution specified "
+                             "(expecting sequential, uniform or "
+                             "zipf[:THETA]): %s", optarg);
+                return 1;
+            }
+            break;
+        case OPTION_TIME:
+        {
+            unsigned long res;
+
+            if (qemu_strtoul(optarg, NULL, 0, &res) < 0 || res == 0 ||
+                res > INT_MAX) {
+                error_report("Invalid run time specified");
+                return 1;
+            }
+            run_time = res;
+            break;
+        }
+        case OPTION_OUTPUT:
+            if (!strcmp(optarg, "json")) {
+                output_format = OFORMAT_JSON;
+            } else if (!strcmp(optarg, "human")) {
+                output_format = OFORMAT_HUMAN;
+            } else {
+                error_report("--output must be used with human or json "
+                             "as argument.");
+                return 1;
+            }
+            break;
         case OPTION_IMAGE_OPTS:
             image_opts = true;
             break;
@@ -4575,6 +4945,14 @@ static int img_bench(int argc, char **argv)
         ret = -1;
         goto out;
     }
+    if (!is_write && read_ratio >= 0) {
+        error_report("--read-ratio is only available in write tests");
+        ret = -1;
+        goto out;
+    }
+    if (run_time && !count_set) {
+        count = INT_MAX;
+    }
     if (flush_interval && flush_interval < depth) {
         error_report("Flush interval can't be smaller than depth");
         ret = -1;
@@ -4603,16 +4981,58 @@ static int img_bench(int argc, char **argv)
         .n              = count,
         .offset         = offset,
         .write          = is_write,
+        .read_ratio     = read_ratio,
         .flush_interval = flush_interval,
         .drain_on_flush = drain_on_flush,
+        .distribution   = distribution,
+        .rand           = g_rand_new(),
+        .nr_blocks      = image_size / bufsize,
     };
-    printf("Sending %d %s requests, %d bytes each, %d in parallel "
-           "(starting at offset %" PRId64 ", step size %d)\n",
-           data.n, data.write ? "write" : "read", data.bufsize, data.nrreq,
-           data.offset, data.step);
-    if (flush_interval) {
-        printf("Sending flush every %d requests\n", flush_interval);
+    if (distribution != BENCH_DIST_SEQUENTIAL && !data.nr_blocks) {
+        error_report("Image is smaller than the buffer size");
+        ret = -1;
+        goto out;
+    }
+    if (distribution == BENCH_DIST_ZIPF) {
+        bench_zipf_init(&data, zipf_theta);
+    }
+
+    if (output_format == OFORMAT_HUMAN) {
+        g_autofree char *nr = count_set || !run_time ?
+                              g_strdup_printf("%d ", data.n) : g_strdup("");
+
+        if (read_ratio >= 0) {
+            printf("Sending %srequests (%d%% reads), %d bytes each, "
+                   "%d in parallel\n",
+                   nr, read_ratio, data.bufsize, data.nrreq);
+        } else {
+            printf("Sending %s%s requests, %d bytes each, %d in parallel\n",
+                   nr, data.write ? "write" : "read", data.bufsize,
+                   data.nrreq);
+        }
+        if (distribution == BENCH_DIST_SEQUENTIAL) {
+            printf("Sequential, starting at offset %" PRId64
+                   ", step size %d\n", data.offset, data.step);
+        } else if (distribution == BENCH_DIST_UNIFORM) {
+            printf("Uniformly distributed random offsets\n");
+        } else {
+            printf("Zipf distributed random offsets (theta %g)\n",
+                   zipf_theta);
+        }
+        if (run_time) {
+            printf("Stopping after %" PRId64 " seconds\n", run_time);
+        }
+        if (flush_interval) {
+            printf("Sending flush every %d requests\n", flush_interval);
+        }
+    }
+
+    stats = blk_get_stats(blk);
+    for (i = ARRAY_SIZE(bench_latency_boundaries) - 1; i >= 0; i--) {
+        QAPI_LIST_PREPEND(boundaries, bench_latency_boundaries[i]);
     }
+    block_latency_histogram_set(stats, BLOCK_ACCT_READ, boundaries);
+    block_latency_histogram_set(stats, BLOCK_ACCT_WRITE, boundaries);
 
     buf_size = data.nrreq * data.bufsize;
     data.buf = blk_blockalign(blk, buf_size);
@@ -4620,14 +5040,21 @@ static int img_bench(int argc, char **argv)
 
     blk_register_buf(blk, data.buf, buf_size, &error_fatal);
 
-    data.qiov = g_new(QEMUIOVector, data.nrreq);
+    data.reqs = g_new0(BenchRequest, data.nrreq);
+    data.free_reqs = g_new(BenchRequest *, data.nrreq);
     for (i = 0; i < data.nrreq; i++) {
-        qemu_iovec_init(&data.qiov[i], 1);
-        qemu_iovec_add(&data.qiov[i],
+        data.reqs[i].b = &data;
+        qemu_iovec_init(&data.reqs[i].qiov, 1);
+        qemu_iovec_add(&data.reqs[i].qiov,
                        data.buf + i * data.bufsize, data.bufsize);
+        data.free_reqs[data.nr_free_reqs++] = &data.reqs[i];
     }
 
     gettimeofday(&t1, NULL);
+    if (run_time) {
+        data.end_time_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME) +
+                           run_time * NANOSECONDS_PER_SECOND;
+    }
     bench_cb(&data, 0);
 
     while (data.n > 0) {
@@ -4635,14 +5062,30 @@ static int img_bench(int argc, char **argv)
     }
     gettimeofday(&t2, NULL);
 
-    printf("Run completed in %3.3f seconds.\n",
-           (t2.tv_sec - t1.tv_sec)
-           + ((double)(t2.tv_usec - t1.tv_usec) / 1000000));
+    seconds = (t2.tv_sec - t1.tv_sec)
+              + ((double)(t2.tv_usec - t1.tv_usec) / 1000000);
+    if (output_format == OFORMAT_JSON) {
+        bench_print_json(stats, seconds);
+    } else {
+        printf("Run completed in %3.3f seconds.\n", seconds);
+        bench_print_human(stats, seconds);
+    }
 
 out:
     if (data.buf) {
         blk_unregister_buf(blk, data.buf, buf_size);
     }
+    if (data.reqs) {
+        for (i = 0; i < data.nrreq; i++) {
+            qemu_iovec_destroy(&data.reqs[i].qiov);
+        }
+    }
+    g_free(data.reqs);
+    g_free(data.free_reqs);
+    if (data.rand) {
+        g_rand_free(data.rand);
+    }
+    qapi_free_uint64List(boundaries);
     qemu_vfree(data.buf);
     blk_unref(blk);
 
@@ -179,6 +179,7 @@ ERST
 DEF("accel", HAS_ARG, QEMU_OPTION_accel,
     "-accel [accel=]accelerator[,prop[=value][,...]]\n"
     "                select accelerator (kvm, xen, hax, hvf, nvmm, whpx or tcg; use 'help' for a list)\n"
+    "                atomic-stripes=on|off (emulate missing host atomics with per-cache-line TCG locks, default=off)\n"
     "                igd-passthru=on|off (enable Xen integrated Intel graphics passthrough, default=off)\n"
     "                kernel-irqchip=on|off|split controls accelerated irqchip support (default=on)\n"
     "                kvm-shadow-mem=size of KVM shadow MMU in bytes\n"
@@ -186,6 +187,9 @@ DEF("accel", HAS_ARG, QEMU_OPTION_accel,
     "                split-wx=on|off (enable TCG split w^x mapping)\n"
     "                tb-size=n (TCG translation block cache size)\n"
     "                dirty-ring-size=n (KVM dirty ring GFN count, default 0)\n"
+    "                dirty-ring-reap-threads=n (threads collecting KVM dirty rings, default 1)\n"
+    "                dirty-ring-soft-full=n (reap KVM dirty rings once n percent full, default 0)\n"
+    "                halt-poll-budget=n,halt-poll-max-ns=n (tune KVM halt polling to waste at most n percent of vCPU time)\n"
     "                notify-vmexit=run|internal-error|disable,notify-window=n (enable notify VM exit and set notify window, x86 only)\n"
     "                thread=single|multi (enable multi-threaded TCG)\n", QEMU_ARCH_ALL)
 SRST
@@ -196,6 +200,16 @@ SRST
     specified, the next one is used if the previous one fails to
     initialize.
 
+    ``atomic-stripes=on|off``
+        With multi-threaded TCG, guest atomic operations that the host
+        cannot perform natively (for example 16-byte compare-and-swap on
+        hosts without such an instruction) stop all vCPUs and run
+        serially. With ``atomic-stripes=on`` they take a lock chosen by
+        the cache line instead, so only vCPUs accessing the same line
+        wait. Such accesses are only atomic with respect to each other,
+        not to plain stores of the same memory. ``info jit`` shows how
+        often each path is taken (default=off)
+
     ``igd-passthru=on|off``
         When Xen is in use, this option controls whether Intel
         integrated graphics devices can be passed through to the guest
@@ -244,6 +258,31 @@ SRST
         is disabled (dirty-ring-size=0).  When enabled, KVM will instead
         record dirty pages in a bitmap.
 
+    ``dirty-ring-reap-threads=n``
+        When the KVM dirty ring is enabled, collect the vCPU rings with
+        ``n`` threads in parallel, each of them taking a share of the vCPUs.
+        This shortens the time the slots are locked for guests with many
+        vCPUs.  Default: 1.
+
+    ``dirty-ring-soft-full=n``
+        When the KVM dirty ring is enabled, the reaper thread collects the
+        rings once a second.  With a non-zero ``n``, it also checks the rings
+        every 100ms and collects them as soon as one of them is ``n`` percent
+        full, so that vCPUs dirtying memory quickly do not have to wait for a
+        full ring to be drained.  Default: 0 (disabled).
+
+    ``halt-poll-budget=n,halt-poll-max-ns=n``
+        When the KVM accelerator is used, let QEMU choose the VM's halt
+        polling time instead of the host default.  Once a second, QEMU
+        reads the ``halt_poll_success_ns`` and ``halt_poll_fail_ns``
+        statistics of all vCPUs (see ``query-stats``).  If the failed
+        polls took more than ``halt-poll-budget`` percent of the vCPU
+        time, the polling time is halved.  Otherwise it grows while
+        polling succeeds more often than it fails, up to
+        ``halt-poll-max-ns``.  The current value can be read from the
+        ``halt-poll-ns`` property.  Default: halt-poll-budget=0 (disabled),
+        halt-poll-max-ns=200000.
+
     ``notify-vmexit=run|internal-error|disable,notify-window=n``
         Enables or disables notify VM exit support on x86 host and specify
         the corresponding notify window to trigger the VM exit if enabled.
@@ -356,17 +395,17 @@ SRST
 ERST
 
 DEF("numa", HAS_ARG, QEMU_OPTION_numa,
-    "-numa node[,mem=size][,cpus=firstcpu[-lastcpu]][,nodeid=node][,initiator=node]\n"
-    "-numa node[,memdev=id][,cpus=firstcpu[-lastcpu]][,nodeid=node][,initiator=node]\n"
+    "-numa node[,mem=size][,cpus=firstcpu[-lastcpu]][,nodeid=node][,initiator=node][,vcpu-context=id]\n"
+    "-numa node[,memdev=id][,cpus=firstcpu[-lastcpu]][,nodeid=node][,initiator=node][,vcpu-context=id]\n"
     "-numa dist,src=source,dst=destination,val=distance\n"
     "-numa cpu,node-id=node[,socket-id=x][,core-id=y][,thread-id=z]\n"
     "-numa hmat-lb,initiator=node,target=node,hierarchy=memory|first-level|second-level|third-level,data-type=access-latency|read-latency|write-latency[,latency=lat][,bandwidth=bw]\n"
     "-numa hmat-cache,node-id=node,size=size,level=level[,associativity=none|direct|complex][,policy=none|write-back|write-through][,line=size]\n",
     QEMU_ARCH_ALL)
 SRST
-``-numa node[,mem=size][,cpus=firstcpu[-lastcpu]][,nodeid=node][,initiator=initiator]``
+``-numa node[,mem=size][,cpus=firstcpu[-lastcpu]][,nodeid=node][,initiator=initiator][,vcpu-context=id]``
   \ 
-``-numa node[,memdev=id][,cpus=firstcpu[-lastcpu]][,nodeid=node][,initiator=initiator]``
+``-numa node[,memdev=id][,cpus=firstcpu[-lastcpu]][,nodeid=node][,initiator=initiator][,vcpu-context=id]``
   \
 ``-numa dist,src=source,dst=destination,val=distance``
   \ 
@@ -451,6 +490,19 @@ SRST
         -numa cpu,node-id=0,socket-id=0 \
         -numa cpu,node-id=0,socket-id=1
 
+    '\ ``vcpu-context``\ ' names a '\ ``thread-context``\ ' object whose
+    CPU affinity is given to the vCPU threads of the node once they are
+    created. Combined with '\ ``host-nodes``\ ' on the node's memory
+    backend and '\ ``thread-context``\ ' on iothreads, this places a
+    guest NUMA node on a host NUMA node without external pinning:
+
+    ::
+
+        -object thread-context,id=tc0,node-affinity=0 \
+        -object memory-backend-ram,size=1G,id=m0,host-nodes=0,policy=bind \
+        -object iothread,id=io0,thread-context=tc0 \
+        -numa node,nodeid=0,memdev=m0,vcpu-context=tc0
+
     source and destination are NUMA node IDs. distance is the NUMA
     distance from source to destination. The distance from a node to
     itself is always 10. If any pair of nodes is given a distance, then
@@ -753,6 +805,7 @@ DEF("audiodev", HAS_ARG, QEMU_OPTION_audiodev,
     "                Use ``-audiodev help`` to list the available drivers\n"
     "                id= identifier of the backend\n"
     "                timer-period= timer period in microseconds\n"
+    "                timer-adaptive=on|off adapt the timer period to the buffer length\n"
     "                in|out.mixing-engine= use mixing engine to mix streams inside QEMU\n"
     "                in|out.fixed-settings= use fixed settings for host audio\n"
     "                in|out.frequency= frequency to use with fixed settings\n"
@@ -841,6 +894,12 @@ SRST
         Sets the timer period used by the audio subsystem in
         microseconds. Default is 10000 (10 ms).
 
+    ``timer-adaptive=on|off``
+        Runs the timer four times per buffer of the active voice with
+        the shortest buffer instead of every timer period, which then
+        acts as the minimum. This reduces wakeups for backends with long
+        buffers. Default is off.
+
     ``in|out.mixing-engine=on|off``
         Use QEMU's mixing engine to mix all streams inside QEMU and
         convert audio formats when not supported by the backend. When
@@ -1339,6 +1398,13 @@ SRST
             Specifies the AIO backend (threads/native/io_uring,
             default: threads)
 
+        ``aio-poll-mode``
+            Selects the io_uring polling mode when ``aio=io_uring``
+            (none/sqpoll/iopoll, default: none). ``sqpoll`` lets a kernel
+            thread placed next to the IOThread pick up submissions without
+            a system call. ``iopoll`` busy-polls the device for completions
+            and requires ``cache.direct=on``.
+
         ``locking``
             Specifies whether the image file is protected with Linux OFD
             / POSIX locks. The default is to use the Linux Open File
@@ -1416,6 +1482,11 @@ SRST
             supporting platforms, and 0 on other platforms. Setting it
             to 0 disables this feature.
 
+        ``alloc-pool-size``
+            Number of bytes of data clusters to allocate in advance, so
+            that allocating writes don't have to update the refcount
+            structures one request at a time (default: 0, disabled)
+
         ``pass-discard-request``
             Whether discard requests to the qcow2 device should be
             forwarded to the data source (on/off; default: on if
@@ -1711,6 +1782,7 @@ ERST
 DEF("fsdev", HAS_ARG, QEMU_OPTION_fsdev,
     "-fsdev local,id=id,path=path,security_model=mapped-xattr|mapped-file|passthrough|none\n"
     " [,writeout=immediate][,readonly=on][,fmode=fmode][,dmode=dmode]\n"
+    " [,attr_cache=ms]\n"
     " [[,throttling.bps-total=b]|[[,throttling.bps-read=r][,throttling.bps-write=w]]]\n"
     " [[,throttling.iops-total=i]|[[,throttling.iops-read=r][,throttling.iops-write=w]]]\n"
     " [[,throttling.bps-total-max=bm]|[[,throttling.bps-read-max=rm][,throttling.bps-write-max=wm]]]\n"
@@ -1722,7 +1794,7 @@ DEF("fsdev", HAS_ARG, QEMU_OPTION_fsdev,
     QEMU_ARCH_ALL)
 
 SRST
-``-fsdev local,id=id,path=path,security_model=security_model [,writeout=writeout][,readonly=on][,fmode=fmode][,dmode=dmode] [,throttling.option=value[,throttling.option=value[,...]]]``
+``-fsdev local,id=id,path=path,security_model=security_model [,writeout=writeout][,readonly=on][,fmode=fmode][,dmode=dmode] [,attr_cache=ms] [,throttling.option=value[,throttling.option=value[,...]]]``
   \ 
 ``-fsdev proxy,id=id,socket=socket[,writeout=writeout][,readonly=on]``
   \
@@ -1797,6 +1869,12 @@ SRST
         host. Works only with security models "mapped-xattr" and
         "mapped-file".
 
+    ``attr_cache=ms``
+        Cache file attributes for up to ms milliseconds (default 0, no
+        caching). Changes made through the 9p server invalidate the
+        cache, but changes made directly on the host may take up to ms
+        milliseconds to become visible to the guest.
+
     ``throttling.bps-total=b,throttling.bps-read=r,throttling.bps-write=w``
         Specify bandwidth throttling limits in bytes per second, either
         for all request types or for reads or writes only.
@@ -2574,6 +2652,12 @@ SRST
     ``power-control=on|off``
         Permit the remote client to issue shutdown, reboot or reset power
         control requests.
+
+    ``encode-threads=n``
+        Number of threads encoding framebuffer updates, shared by all VNC
+        displays. Updates of different clients are encoded in parallel,
+        while the updates of each client are encoded in order by one
+        thread at a time. The default is 1.
 ERST
 
 ARCHHEADING(, QEMU_ARCH_I386)
@@ -2772,7 +2856,7 @@ DEF("netdev", HAS_ARG, QEMU_OPTION_netdev,
     "-netdev tap,id=str[,fd=h][,fds=x:y:...:z][,ifname=name][,script=file][,downscript=dfile]\n"
     "         [,br=bridge][,helper=helper][,sndbuf=nbytes][,vnet_hdr=on|off][,vhost=on|off]\n"
     "         [,vhostfd=h][,vhostfds=x:y:...:z][,vhostforce=on|off][,queues=n]\n"
-    "         [,poll-us=n]\n"
+    "         [,poll-us=n][,batch-size=n][,vhost-worker-per-vq=on|off]\n"
     "                configure a host TAP network backend with ID 'str'\n"
     "                connected to a bridge (default=" DEFAULT_BRIDGE_INTERFACE ")\n"
     "                use network scripts 'file' (default=" DEFAULT_NETWORK_SCRIPT ")\n"
@@ -2795,6 +2879,9 @@ DEF("netdev", HAS_ARG, QEMU_OPTION_netdev,
     "                use 'queues=n' to specify the number of queues to be created for multiqueue TAP\n"
     "                use 'poll-us=n' to specify the maximum number of microseconds that could be\n"
     "                spent on busy polling for vhost net\n"
+    "                use 'batch-size=n' to read and write up to n packets per wakeup\n"
+    "                use 'vhost-worker-per-vq=on' to run each vhost net virtqueue\n"
+    "                in its own worker thread\n"
     "-netdev bridge,id=str[,br=bridge][,helper=helper]\n"
     "                configure a host TAP network backend with ID 'str' that is\n"
     "                connected to a bridge (default=" DEFAULT_BRIDGE_INTERFACE ")\n"
@@ -2863,6 +2950,19 @@ DEF("netdev", HAS_ARG, QEMU_OPTION_netdev,
     "                VALE port (created on the fly) called 'name' ('nmname' is name of the \n"
     "                netmap device, defaults to '/dev/netmap')\n"
 #endif
+#ifdef CONFIG_AF_XDP
+    "-netdev af-xdp,id=str,ifname=name[,mode=native|skb][,force-copy=on|off]\n"
+    "         [,queues=n][,start-queue=m][,inhibit=on|off][,sock-fds=x:y:...:z]\n"
+    "                attach to the existing network interface 'name' with AF_XDP socket\n"
+    "                use 'mode=MODE' to specify an XDP program attach mode\n"
+    "                use 'force-copy=on|off' to force XDP copy mode even if device supports zero-copy (default: off)\n"
+    "                use 'inhibit=on|off' to inhibit loading of a default XDP program (default: off)\n"
+    "                    with inhibit=on,\n"
+    "                      use 'sock-fds' to provide file descriptors for already open AF_XDP sockets\n"
+    "                      added to a socket map in XDP program.  One socket per queue.\n"
+    "                use 'queues=n' to specify how many queues of a multiqueue interface should be used\n"
+    "                use 'start-queue=m' to specify the first queue that should be used\n"
+#endif
 #ifdef CONFIG_POSIX
     "-netdev vhost-user,id=str,chardev=dev[,vhostforce=on|off]\n"
     "                configure a vhost-user network, backed by a chardev 'dev'\n"
@@ -2908,6 +3008,9 @@ DEF("nic", HAS_ARG, QEMU_OPTION_nic,
 #ifdef CONFIG_NETMAP
     "netmap|"
 #endif
+#ifdef CONFIG_AF_XDP
+    "af-xdp|"
+#endif
 #ifdef CONFIG_POSIX
     "vhost-user|"
 #endif
@@ -3357,6 +3460,62 @@ SRST
         # launch QEMU instance
         |qemu_system| linux.img -nic vde,sock=/tmp/myswitch
 
+``-netdev af-xdp,id=str,ifname=name[,mode=native|skb][,force-copy=on|off][,queues=n][,start-queue=m][,inhibit=on|off][,sock-fds=x:y:...:z]``
+    Configure AF_XDP backend to connect to a network interface 'name'
+    using AF_XDP socket.  A specific program attach mode for a default
+    XDP program can be forced with 'mode', defaults to best-effort,
+    where the likely most performant mode will be in use.  Number of
+    queues 'n' should generally match the number of queues in the
+    interface, defaults to 1.  Traffic arriving on non-configured device
+    queues will not be delivered to the network backend.  Packets are
+    received directly into a shared memory area (UMEM) with zero-copy
+    where the device supports it, 'force-copy' disables that.
+
+    ::
+
+        # set number of queues to 4
+        ethtool -L eth0 combined 4
+        # launch QEMU instance
+        |qemu_system| linux.img -device virtio-net-pci,netdev=n1 \\
+            -netdev af-xdp,id=n1,ifname=eth0,queues=4
+
+    'start-queue' option can be specified if a particular range of queues
+    [m, m + n] should be in use.  For example, this may be necessary in
+    order to use certain NICs in native mode.  Kernel allows the driver to
+    create a separate set of XDP queues on top of regular ones, and only
+    these queues can be used for AF_XDP sockets.  NICs that work this way
+    may also require an additional traffic redirection with ethtool to these
+    special queues.
+
+    ::
+
+        # set number of queues to 1
+        ethtool -L eth0 combined 1
+        # redirect all the traffic to the second queue (id: 1)
+        # note: drivers may require non-empty key/mask pair.
+        ethtool -N eth0 flow-type ether \\
+            dst 00:00:00:00:00:00 m FF:FF:FF:FF:FF:FE action 1
+        ethtool -N eth0 flow-type ether \\
+            dst 00:00:00:00:00:01 m FF:FF:FF:FF:FF:FE action 1
+        # launch QEMU instance
+        |qemu_system| linux.img -device virtio-net-pci,netdev=n1 \\
+            -netdev af-xdp,id=n1,ifname=eth0,queues=1,start-queue=1
+
+    The backend polls the rx rings of its sockets without system calls
+    when it is serviced by an IOThread, e.g. with the virtio-net
+    'iothread-vq-mapping' property; combine it with the IOThread
+    'poll-busy' property for a fully busy-polling data path.
+
+    XDP program can also be loaded externally.  In this case 'inhibit'
+    option should be set to 'on' and 'sock-fds' provided with file
+    descriptors for already open but not bound XDP sockets already added
+    to a socket map for corresponding queues.  One socket per queue.
+
+    ::
+
+        |qemu_system| linux.img -device virtio-net-pci,netdev=n1 \\
+            -netdev af-xdp,id=n1,ifname=eth0,queues=3,inhibit=on,sock-fds=15:16:17
+
 ``-netdev vhost-user,chardev=id[,vhostforce=on|off][,queues=n]``
     Establish a vhost-user netdev, backed by a chardev id. The chardev
     should be a unix domain socket backed one. The vhost-user uses a
@@ -4530,13 +4689,13 @@ SRST
 ERST
 
 DEF("icount", HAS_ARG, QEMU_OPTION_icount, \
-    "-icount [shift=N|auto][,align=on|off][,sleep=on|off][,rr=record|replay,rrfile=<filename>[,rrsnapshot=<snapshot>]]\n" \
+    "-icount [shift=N|auto][,align=on|off][,sleep=on|off][,quantum=N][,rr=record|replay,rrfile=<filename>[,rrsnapshot=<snapshot>][,rrcompress=on|off]]\n" \
     "                enable virtual instruction counter with 2^N clock ticks per\n" \
     "                instruction, enable aligning the host and virtual clocks\n" \
     "                or disable real time cpu sleeping, and optionally enable\n" \
     "                record-and-replay mode\n", QEMU_ARCH_ALL)
 SRST
-``-icount [shift=N|auto][,align=on|off][,sleep=on|off][,rr=record|replay,rrfile=filename[,rrsnapshot=snapshot]]``
+``-icount [shift=N|auto][,align=on|off][,sleep=on|off][,quantum=N][,rr=record|replay,rrfile=filename[,rrsnapshot=snapshot][,rrcompress=on|off]]``
     Enable virtual instruction counter. The virtual cpu will execute one
     instruction every 2^N ns of virtual time. If ``auto`` is specified
     then the virtual cpu speed will be automatically adjusted to keep
@@ -4570,6 +4729,14 @@ SRST
     depends on the host machine). The default if icount is enabled
     is ``align=off``.
 
+    ``quantum=N`` lets each virtual CPU run in its own thread
+    (``-accel tcg,thread=multi``, the default where supported) and count
+    its own instructions. A virtual CPU may be at most N instructions
+    ahead of the virtual clock, which moves forward once all the
+    running virtual CPUs have executed their quantum. It requires a
+    fixed ``shift`` and cannot be used together with ``align=on`` or
+    ``rr``.
+
     When the ``rr`` option is specified deterministic record/replay is
     enabled. The ``rrfile=`` option must also be provided to
     specify the path to the replay log. In record mode data is written
@@ -4578,6 +4745,8 @@ SRST
     name. In record mode, a new VM snapshot with the given name is created
     at the start of execution recording. In replay mode this option
     specifies the snapshot name used to load the initial VM state.
+    ``rrcompress=on`` compresses the replay log with zstd while recording;
+    compressed logs are detected automatically when replaying.
 ERST
 
 DEF("watchdog-action", HAS_ARG, QEMU_OPTION_watchdog_action, \
@@ -4833,11 +5002,11 @@ SRST
 ERST
 
 DEF("trace", HAS_ARG, QEMU_OPTION_trace,
-    "-trace [[enable=]<pattern>][,events=<file>][,file=<file>]\n"
+    "-trace [[enable=]<pattern>][,events=<file>][,file=<file>][,sample=<n>]\n"
     "                specify tracing options\n",
     QEMU_ARCH_ALL)
 SRST
-``-trace [[enable=]pattern][,events=file][,file=file]``
+``-trace [[enable=]pattern][,events=file][,file=file][,sample=n]``
   .. include:: ../qemu-option-trace.rst.inc
 
 ERST
@@ -5019,6 +5188,13 @@ SRST
 
         The ``prealloc`` boolean option enables memory preallocation.
 
+        With ``prealloc-async=on``, only the first ``prealloc-sync-size``
+        bytes (default 0) are preallocated before the guest starts. The
+        rest is preallocated by background threads while the guest runs,
+        using MADV\_POPULATE\_WRITE and the ``prealloc-context`` thread
+        context if set. Without MADV\_POPULATE\_WRITE support, all
+        memory is preallocated upfront as with ``prealloc=on`` alone.
+
         The ``host-nodes`` option binds the memory range to a list of
         NUMA host nodes.
 
@@ -5066,13 +5242,20 @@ SRST
         The ``readonly`` option specifies whether the backing file is opened
         read-only or read-write (default).
 
-    ``-object memory-backend-ram,id=id,merge=on|off,dump=on|off,share=on|off,prealloc=on|off,size=size,host-nodes=host-nodes,policy=default|preferred|bind|interleave``
+    ``-object memory-backend-ram,id=id,merge=on|off,dump=on|off,share=on|off,prealloc=on|off,size=size,host-nodes=host-nodes,policy=default|preferred|bind|interleave,layout=default|auto``
         Creates a memory backend object, which can be used to back the
         guest RAM. Memory backend objects offer more control than the
         ``-m`` option that is traditionally used to define guest RAM.
         Please refer to ``memory-backend-file`` for a description of the
         options.
 
+        With ``layout=auto`` the memory is aligned to 1 GiB in the host
+        address space, the 1 GiB aligned part is backed by 1 GiB hugetlb
+        pages and the remainder by transparent huge pages. If no 1 GiB
+        pages are available, transparent huge pages are used throughout.
+        ``query-memdev`` reports the resulting layout. This option is not
+        compatible with ``share=on``. (Linux only)
+
     ``-object memory-backend-memfd,id=id,merge=on|off,dump=on|off,share=on|off,prealloc=on|off,size=size,host-nodes=host-nodes,policy=default|preferred|bind|interleave,seal=on|off,hugetlb=on|off,hugetlbsize=size``
         Creates an anonymous memory file backend object, which allows
         QEMU to share the memory with an external process (e.g. when
@@ -5312,13 +5495,20 @@ SRST
         filter-redirector,id=f2,netdev=hn0,queue=rx,outdev=red1 -object
         filter-rewriter,id=rew0,netdev=hn0,queue=all
 
-    ``-object filter-dump,id=id,netdev=dev[,file=filename][,maxlen=len][,position=head|tail|id=<id>][,insert=behind|before]``
+    ``-object filter-dump,id=id,netdev=dev[,file=filename][,maxlen=len][,ring-size=size][,sample=n][,position=head|tail|id=<id>][,insert=behind|before]``
         Dump the network traffic on netdev dev to the file specified by
         filename. At most len bytes (64k by default) per packet are
         stored. The file format is libpcap, so it can be analyzed with
         tools such as tcpdump or Wireshark.
 
-    ``-object colo-compare,id=id,primary_in=chardevid,secondary_in=chardevid,outdev=chardevid,iothread=id[,vnet_hdr_support][,notify_dev=id][,compare_timeout=@var{ms}][,expired_scan_cycle=@var{ms}][,max_queue_size=@var{size}]``
+        With ``ring-size``, a power of two number of bytes, packets are
+        copied to a ring of that size and written to the file by a
+        separate thread, so that the capture does not slow the network
+        down. Packets that do not fit in the ring are not captured; a
+        small ``maxlen`` lets more of them fit. With ``sample``, only
+        one packet out of every n is captured.
+
+    ``-object colo-compare,id=id,primary_in=chardevid,secondary_in=chardevid,outdev=chardevid,iothread=id[,vnet_hdr_support][,notify_dev=id][,compare_timeout=@var{ms}][,expired_scan_cycle=@var{ms}][,max_queue_size=@var{size}][,compare_threads=@var{n}]``
         Colo-compare gets packet from primary\_in chardevid and
         secondary\_in, then compare whether the payload of primary packet
         and secondary packet are the same. If same, it will output
@@ -5332,6 +5522,11 @@ SRST
         is to set the period of scanning expired primary node network packets.
         The max\_queue\_size=@var{size} is to set the max compare queue
         size depend on user environment.
+        The compare\_threads=@var{n} spreads the comparison over n
+        threads besides the iothread, each owning a share of the
+        connections picked by their hash, so that the comparison
+        throughput scales with the number of host cores. The default 0
+        compares in the iothread.
         If user want to use Xen COLO, need to add the notify\_dev to
         notify Xen colo-frame to do checkpoint.
 
@@ -5401,7 +5596,9 @@ SRST
         be used to reference this cryptodev backend from the
         ``virtio-crypto`` device. The queues parameter is optional,
         which specify the queue number of cryptodev backend, the default
-        of queues is 1.
+        of queues is 1. Asymmetric and large symmetric operations run on
+        the thread pool, so requests from several queues are processed
+        in parallel.
 
         .. parsed-literal::
 
@@ -5670,7 +5867,7 @@ SRST
 
             CN=laptop.example.com,O=Example Home,L=London,ST=London,C=GB
 
-    ``-object iothread,id=id,poll-max-ns=poll-max-ns,poll-grow=poll-grow,poll-shrink=poll-shrink,aio-max-batch=aio-max-batch``
+    ``-object iothread,id=id,poll-max-ns=poll-max-ns,poll-grow=poll-grow,poll-shrink=poll-shrink,poll-busy=on|off,aio-max-batch=aio-max-batch,aio-batch-adaptive=on|off``
         Creates a dedicated event loop thread that devices can be
         assigned to. This is known as an IOThread. By default device
         emulation happens in vCPU threads or the main event loop thread.
@@ -5706,10 +5903,26 @@ SRST
         the polling time when the algorithm detects it is spending too
         long polling without encountering events.
 
+        The ``poll-busy`` parameter makes the IOThread spin instead of
+        ever blocking while it is polling virtqueues or other event
+        sources, so that guest notifications stay disabled. This burns
+        a whole host CPU and is meant for IOThreads pinned to dedicated
+        cores. Devices may also set a polling budget for their own
+        virtqueues, e.g. ``-device virtio-blk-pci,poll-budget-ns=...``,
+        that is not subject to the adaptive algorithm.
+
         The ``aio-max-batch`` parameter is the maximum number of requests
         in a batch for the AIO engine, 0 means that the engine will use
         its default.
 
+        The ``aio-batch-adaptive`` parameter lets the AIO engine pick the
+        batch size from the current queue depth and the measured
+        completion latency, with ``aio-max-batch`` as the upper bound.
+        Requests are submitted early when few are in flight and batched
+        when the device is busy. The chosen batch size is reported by
+        ``query-iothreads``. Currently only ``aio=native`` implements
+        this.
+
         The IOThread parameters can be modified at run-time using the
         ``qom-set`` command (where ``iothread1`` is the IOThread's
         ``id``):
@@ -17,11 +17,17 @@
 #include "qapi/qmp/json-writer.h"
 #include "qemu/unicode.h"
 
+/* Streaming writers flush once this much output has accumulated */
+#define JSON_WRITER_CHUNK_SIZE (64 * 1024)
+
 struct JSONWriter {
     bool pretty;
     bool need_comma;
     GString *contents;
     GByteArray *container_is_array;
+    JSONWriterFlushFunc *flush;
+    void *flush_opaque;
+    size_t flushed;             /* bytes already passed to @flush */
 };
 
 JSONWriter *json_writer_new(bool pretty)
@@ -32,9 +38,34 @@ JSONWriter *json_writer_new(bool pretty)
     writer->need_comma = false;
     writer->contents = g_string_new(NULL);
     writer->container_is_array = g_byte_array_new();
+    writer->flush = NULL;
+    writer->flush_opaque = NULL;
+    writer->flushed = 0;
+    return writer;
+}
+
+JSONWriter *json_writer_new_stream(bool pretty, JSONWriterFlushFunc *flush,
+                                   void *opaque)
+{
+    JSONWriter *writer = json_writer_new(pretty);
+
+    writer->flush = flush;
+    writer->flush_opaque = opaque;
     return writer;
 }
 
+/* Pass everything written so far to the flush callback of @writer */
+void json_writer_flush(JSONWriter *writer)
+{
+    assert(writer->flush);
+    if (writer->contents->len) {
+        writer->flush(writer->flush_opaque, writer->contents->str,
+                      writer->contents->len);
+        writer->flushed += writer->contents->len;
+        g_string_truncate(writer->contents, 0);
+    }
+}
+
 const char *json_writer_get(JSONWriter *writer)
 {
     g_assert(!writer->container_is_array->len);
@@ -156,11 +187,15 @@ static void quoted_str(JSONWriter *writer, const char *str)
 
 static void maybe_comma_name(JSONWriter *writer, const char *name)
 {
+    if (writer->flush && writer->contents->len >= JSON_WRITER_CHUNK_SIZE) {
+        json_writer_flush(writer);
+    }
+
     if (writer->need_comma) {
         g_string_append_c(writer->contents, ',');
         pretty_newline_or_space(writer);
     } else {
-        if (writer->contents->len) {
+        if (writer->contents->len || writer->flushed) {
             pretty_newline(writer);
         }
         writer->need_comma = true;
@@ -230,3 +230,17 @@ GString *qobject_to_json(const QObject *obj)
 {
     return qobject_to_json_pretty(obj, false);
 }
+
+/*
+ * Serialize @obj and pass the text to @flush in chunks, so that large
+ * objects never exist as one big string.
+ */
+void qobject_to_json_stream(const QObject *obj, bool pretty,
+                            JSONWriterFlushFunc *flush, void *opaque)
+{
+    g_autoptr(JSONWriter) writer = json_writer_new_stream(pretty, flush,
+                                                          opaque);
+
+    to_json(writer, NULL, obj);
+    json_writer_flush(writer);
+}
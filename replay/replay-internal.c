@@ -15,6 +15,11 @@
 #include "replay-internal.h"
 #include "qemu/error-report.h"
 #include "qemu/main-loop.h"
+#include "qemu/units.h"
+#include "qemu/bswap.h"
+#ifdef CONFIG_ZSTD
+#include <zstd.h>
+#endif
 
 /* Mutex to protect reading and writing events to the log.
    data_kind and has_unread_data are also protected
@@ -30,6 +35,55 @@ static unsigned long mutex_head, mutex_tail;
 static bool write_error;
 FILE *replay_file;
 
+/*
+ * The log is written and read by an I/O thread, in blocks of up to
+ * REPLAY_BLOCK_SIZE bytes, so that the recording and replaying threads
+ * only wait for the disk when it cannot keep up. Blocks are either stored
+ * as they are, which gives the same file as unbuffered writes, or
+ * compressed with zstd and preceded by their compressed and original
+ * sizes. Log offsets always refer to the uncompressed stream.
+ */
+#define REPLAY_BLOCK_SIZE   (256 * KiB)
+/* Blocks that may be queued between the I/O thread and the others */
+#define REPLAY_MAX_QUEUED   8
+/* Favour speed, the log is mostly made of small, repetitive events */
+#define REPLAY_ZSTD_LEVEL   1
+#define REPLAY_ZSTD_HEADER  (2 * sizeof(uint32_t))
+
+typedef struct ReplayBlock {
+    uint8_t *data;
+    size_t len;
+    QSIMPLEQ_ENTRY(ReplayBlock) next;
+} ReplayBlock;
+
+/* Where compressed blocks start, to seek in compressed logs */
+typedef struct ReplayBlockIndex {
+    uint64_t offset;
+    uint64_t file_offset;
+} ReplayBlockIndex;
+
+static struct {
+    QemuThread thread;
+    bool thread_running;
+    bool compressed;
+
+    /* @lock protects the fields below, up to @index */
+    QemuMutex lock;
+    QemuCond cond;
+    QSIMPLEQ_HEAD(, ReplayBlock) queue;
+    unsigned int queued;
+    bool stop;
+    bool eof;
+    bool error;
+    GArray *index;
+
+    /* Only accessed with the replay mutex held */
+    ReplayBlock *cur;       /* block being written or read */
+    size_t pos;             /* read position in @cur */
+    uint64_t offset;        /* log offset of @cur */
+    bool past_end;          /* tried to read beyond the end of the log */
+} rlog;
+
 static void replay_write_error(void)
 {
     if (!write_error) {
@@ -44,11 +98,379 @@ static void replay_read_error(void)
     exit(1);
 }
 
+static ReplayBlock *replay_block_new(void)
+{
+    ReplayBlock *block = g_new(ReplayBlock, 1);
+
+    block->data = g_malloc(REPLAY_BLOCK_SIZE);
+    block->len = 0;
+    return block;
+}
+
+static void replay_block_free(ReplayBlock *block)
+{
+    g_free(block->data);
+    g_free(block);
+}
+
+static bool replay_block_write(ReplayBlock *block, void *zctx)
+{
+#ifdef CONFIG_ZSTD
+    if (rlog.compressed) {
+        size_t bound = ZSTD_compressBound(block->len);
+        g_autofree uint8_t *buf = g_malloc(REPLAY_ZSTD_HEADER + bound);
+        size_t size;
+
+        size = ZSTD_compressCCtx(zctx, buf + REPLAY_ZSTD_HEADER, bound,
+                                 block->data, block->len, REPLAY_ZSTD_LEVEL);
+        if (ZSTD_isError(size)) {
+            return false;
+        }
+        stl_be_p(buf, size);
+        stl_be_p(buf + sizeof(uint32_t), block->len);
+        size += REPLAY_ZSTD_HEADER;
+        return fwrite(buf, 1, size, replay_file) == size;
+    }
+#endif
+    return fwrite(block->data, 1, block->len, replay_file) == block->len;
+}
+
+static void *replay_log_writer(void *opaque)
+{
+    void *zctx = NULL;
+
+#ifdef CONFIG_ZSTD
+    if (rlog.compressed) {
+        zctx = ZSTD_createCCtx();
+    }
+#endif
+
+    while (true) {
+        ReplayBlock *block;
+
+        qemu_mutex_lock(&rlog.lock);
+        while (QSIMPLEQ_EMPTY(&rlog.queue) && !rlog.stop) {
+            qemu_cond_wait(&rlog.cond, &rlog.lock);
+        }
+        block = QSIMPLEQ_FIRST(&rlog.queue);
+        if (!block) {
+            qemu_mutex_unlock(&rlog.lock);
+            break;
+        }
+        QSIMPLEQ_REMOVE_HEAD(&rlog.queue, next);
+        qemu_mutex_unlock(&rlog.lock);
+
+        if (!replay_block_write(block, zctx)) {
+            replay_write_error();
+        }
+        replay_block_free(block);
+
+        /* the block stays accounted for until it is on disk */
+        qemu_mutex_lock(&rlog.lock);
+        rlog.queued--;
+        qemu_cond_broadcast(&rlog.cond);
+        qemu_mutex_unlock(&rlog.lock);
+    }
+
+#ifdef CONFIG_ZSTD
+    ZSTD_freeCCtx(zctx);
+#endif
+    return NULL;
+}
+
+/*
+ * Read the block at the current file position, which starts at log
+ * offset @offset. Returns false on errors; *@eof is set when the end of
+ * the log was reached.
+ */
+static bool replay_block_read(ReplayBlock *block, uint64_t offset,
+                              void *zctx, bool *eof)
+{
+#ifdef CONFIG_ZSTD
+    if (rlog.compressed) {
+        uint8_t header[REPLAY_ZSTD_HEADER];
+        ReplayBlockIndex entry = { offset, ftell(replay_file) };
+        g_autofree uint8_t *buf = NULL;
+        uint32_t size, len;
+        size_t ret;
+
+        ret = fread(header, 1, sizeof(header), replay_file);
+        if (ret == 0 && feof(replay_file)) {
+            *eof = true;
+            return true;
+        } else if (ret != sizeof(header)) {
+            return false;
+        }
+        size = ldl_be_p(header);
+        len = ldl_be_p(header + sizeof(uint32_t));
+        if (len > REPLAY_BLOCK_SIZE) {
+            return false;
+        }
+
+        buf = g_malloc(size);
+        if (fread(buf, 1, size, replay_file) != size) {
+            return false;
+        }
+        ret = ZSTD_decompressDCtx(zctx, block->data, REPLAY_BLOCK_SIZE,
+                                  buf, size);
+        if (ZSTD_isError(ret) || ret != len) {
+            return false;
+        }
+        block->len = len;
+
+        qemu_mutex_lock(&rlog.lock);
+        if (!rlog.index->len ||
+            g_array_index(rlog.index, ReplayBlockIndex,
+                          rlog.index->len - 1).offset < offset) {
+            g_array_append_val(rlog.index, entry);
+        }
+        qemu_mutex_unlock(&rlog.lock);
+        return true;
+    }
+#endif
+    block->len = fread(block->data, 1, REPLAY_BLOCK_SIZE, replay_file);
+    if (block->len < REPLAY_BLOCK_SIZE) {
+        *eof = feof(replay_file);
+        return !ferror(replay_file);
+    }
+    return true;
+}
+
+static void *replay_log_reader(void *opaque)
+{
+    uint64_t offset = rlog.offset;
+    void *zctx = NULL;
+    bool eof = false;
+    bool ok = true;
+
+#ifdef CONFIG_ZSTD
+    if (rlog.compressed) {
+        zctx = ZSTD_createDCtx();
+    }
+#endif
+
+    while (ok && !eof) {
+        ReplayBlock *block;
+
+        qemu_mutex_lock(&rlog.lock);
+        while (rlog.queued >= REPLAY_MAX_QUEUED && !rlog.stop) {
+            qemu_cond_wait(&rlog.cond, &rlog.lock);
+        }
+        qemu_mutex_unlock(&rlog.lock);
+        if (qatomic_read(&rlog.stop)) {
+            break;
+        }
+
+        block = replay_block_new();
+        ok = replay_block_read(block, offset, zctx, &eof);
+        offset += block->len;
+
+        qemu_mutex_lock(&rlog.lock);
+        if (block->len) {
+            QSIMPLEQ_INSERT_TAIL(&rlog.queue, block, next);
+            rlog.queued++;
+            block = NULL;
+        }
+        rlog.eof = eof;
+        rlog.error = !ok;
+        qemu_cond_broadcast(&rlog.cond);
+        qemu_mutex_unlock(&rlog.lock);
+
+        if (block) {
+            replay_block_free(block);
+        }
+    }
+
+#ifdef CONFIG_ZSTD
+    ZSTD_freeDCtx(zctx);
+#endif
+    return NULL;
+}
+
+static void replay_log_start_thread(void)
+{
+    rlog.stop = false;
+    rlog.eof = false;
+    rlog.error = false;
+    qemu_thread_create(&rlog.thread, "replay-io",
+                       replay_mode == REPLAY_MODE_RECORD ?
+                       replay_log_writer : replay_log_reader,
+                       NULL, QEMU_THREAD_JOINABLE);
+    rlog.thread_running = true;
+}
+
+/* Stop the I/O thread; in record mode, queued blocks are written first */
+static void replay_log_stop_thread(void)
+{
+    ReplayBlock *block;
+
+    if (!rlog.thread_running) {
+        return;
+    }
+    qemu_mutex_lock(&rlog.lock);
+    rlog.stop = true;
+    qemu_cond_broadcast(&rlog.cond);
+    qemu_mutex_unlock(&rlog.lock);
+    qemu_thread_join(&rlog.thread);
+    rlog.thread_running = false;
+
+    while ((block = QSIMPLEQ_FIRST(&rlog.queue))) {
+        QSIMPLEQ_REMOVE_HEAD(&rlog.queue, next);
+        replay_block_free(block);
+    }
+    rlog.queued = 0;
+}
+
+/* Hand the block being recorded to the I/O thread */
+static void replay_log_submit(void)
+{
+    ReplayBlock *block = rlog.cur;
+
+    qemu_mutex_lock(&rlog.lock);
+    while (rlog.queued >= REPLAY_MAX_QUEUED) {
+        qemu_cond_wait(&rlog.cond, &rlog.lock);
+    }
+    QSIMPLEQ_INSERT_TAIL(&rlog.queue, block, next);
+    rlog.queued++;
+    qemu_cond_broadcast(&rlog.cond);
+    qemu_mutex_unlock(&rlog.lock);
+
+    rlog.offset += block->len;
+    rlog.cur = replay_block_new();
+}
+
+/* Make @rlog.cur hold unread data; returns false at the end of the log */
+static bool replay_log_fill(void)
+{
+    ReplayBlock *block;
+
+    if (rlog.cur && rlog.pos < rlog.cur->len) {
+        return true;
+    }
+
+    qemu_mutex_lock(&rlog.lock);
+    while (QSIMPLEQ_EMPTY(&rlog.queue) && !rlog.eof && !rlog.error) {
+        qemu_cond_wait(&rlog.cond, &rlog.lock);
+    }
+    block = QSIMPLEQ_FIRST(&rlog.queue);
+    if (block) {
+        QSIMPLEQ_REMOVE_HEAD(&rlog.queue, next);
+        rlog.queued--;
+        qemu_cond_broadcast(&rlog.cond);
+    }
+    qemu_mutex_unlock(&rlog.lock);
+
+    if (!block) {
+        rlog.past_end = true;
+        return false;
+    }
+    if (rlog.cur) {
+        rlog.offset += rlog.cur->len;
+        replay_block_free(rlog.cur);
+    }
+    rlog.cur = block;
+    rlog.pos = 0;
+    return true;
+}
+
+void replay_log_start(uint64_t offset, bool compressed)
+{
+#ifndef CONFIG_ZSTD
+    if (compressed) {
+        error_report("Replay: compressed logs require zstd support");
+        exit(1);
+    }
+#endif
+    qemu_mutex_init(&rlog.lock);
+    qemu_cond_init(&rlog.cond);
+    QSIMPLEQ_INIT(&rlog.queue);
+    rlog.index = g_array_new(false, false, sizeof(ReplayBlockIndex));
+    rlog.compressed = compressed;
+    rlog.offset = offset;
+    if (replay_mode == REPLAY_MODE_RECORD) {
+        rlog.cur = replay_block_new();
+    }
+    fseek(replay_file, offset, SEEK_SET);
+    replay_log_start_thread();
+}
+
+void replay_log_finish(void)
+{
+    if (replay_mode == REPLAY_MODE_RECORD && rlog.cur->len) {
+        replay_log_submit();
+    }
+    replay_log_stop_thread();
+    if (rlog.cur) {
+        replay_block_free(rlog.cur);
+        rlog.cur = NULL;
+    }
+    g_array_free(rlog.index, true);
+    rlog.index = NULL;
+}
+
+uint64_t replay_log_tell(void)
+{
+    if (replay_mode == REPLAY_MODE_RECORD) {
+        return rlog.offset + rlog.cur->len;
+    }
+    return rlog.offset + rlog.pos;
+}
+
+void replay_log_seek(uint64_t offset)
+{
+    uint64_t start = offset;
+    uint64_t file_offset = offset;
+    int i;
+
+    assert(replay_mode == REPLAY_MODE_PLAY);
+    replay_log_stop_thread();
+    if (rlog.cur) {
+        replay_block_free(rlog.cur);
+        rlog.cur = NULL;
+    }
+
+    if (rlog.compressed) {
+        /*
+         * Start from the closest known block; the reader thread indexes
+         * the following ones as it goes. The first block starts right
+         * after the header, which is where the offsets start.
+         */
+        assert(rlog.index->len);
+        for (i = rlog.index->len - 1; i > 0; i--) {
+            if (g_array_index(rlog.index, ReplayBlockIndex, i).offset <=
+                offset) {
+                break;
+            }
+        }
+        start = g_array_index(rlog.index, ReplayBlockIndex, i).offset;
+        file_offset = g_array_index(rlog.index, ReplayBlockIndex,
+                                    i).file_offset;
+    }
+
+    fseek(replay_file, file_offset, SEEK_SET);
+    rlog.offset = start;
+    rlog.pos = 0;
+    rlog.past_end = false;
+    replay_log_start_thread();
+
+    while (start < offset) {
+        size_t n;
+
+        if (!replay_log_fill()) {
+            replay_read_error();
+        }
+        n = MIN(offset - start, rlog.cur->len - rlog.pos);
+        rlog.pos += n;
+        start += n;
+    }
+}
+
 void replay_put_byte(uint8_t byte)
 {
     if (replay_file) {
-        if (putc(byte, replay_file) == EOF) {
-            replay_write_error();
+        rlog.cur->data[rlog.cur->len++] = byte;
+        if (rlog.cur->len == REPLAY_BLOCK_SIZE) {
+            replay_log_submit();
         }
     }
 }
@@ -82,8 +504,16 @@ void replay_put_array(const uint8_t *buf, size_t size)
 {
     if (replay_file) {
         replay_put_dword(size);
-        if (fwrite(buf, 1, size, replay_file) != size) {
-            replay_write_error();
+        while (size) {
+            size_t n = MIN(size, REPLAY_BLOCK_SIZE - rlog.cur->len);
+
+            memcpy(rlog.cur->data + rlog.cur->len, buf, n);
+            rlog.cur->len += n;
+            buf += n;
+            size -= n;
+            if (rlog.cur->len == REPLAY_BLOCK_SIZE) {
+                replay_log_submit();
+            }
         }
     }
 }
@@ -92,11 +522,10 @@ uint8_t replay_get_byte(void)
 {
     uint8_t byte = 0;
     if (replay_file) {
-        int r = getc(replay_file);
-        if (r == EOF) {
+        if (!replay_log_fill()) {
             replay_read_error();
         }
-        byte = r;
+        byte = rlog.cur->data[rlog.pos++];
     }
     return byte;
 }
@@ -134,13 +563,27 @@ int64_t replay_get_qword(void)
     return qword;
 }
 
+static void replay_get_data(uint8_t *buf, size_t size)
+{
+    while (size) {
+        size_t n;
+
+        if (!replay_log_fill()) {
+            replay_read_error();
+        }
+        n = MIN(size, rlog.cur->len - rlog.pos);
+        memcpy(buf, rlog.cur->data + rlog.pos, n);
+        rlog.pos += n;
+        buf += n;
+        size -= n;
+    }
+}
+
 void replay_get_array(uint8_t *buf, size_t *size)
 {
     if (replay_file) {
         *size = replay_get_dword();
-        if (fread(buf, 1, *size, replay_file) != *size) {
-            replay_read_error();
-        }
+        replay_get_data(buf, *size);
     }
 }
 
@@ -149,20 +592,18 @@ void replay_get_array_alloc(uint8_t **buf, size_t *size)
     if (replay_file) {
         *size = replay_get_dword();
         *buf = g_malloc(*size);
-        if (fread(*buf, 1, *size, replay_file) != *size) {
-            replay_read_error();
-        }
+        replay_get_data(*buf, *size);
     }
 }
 
 void replay_check_error(void)
 {
     if (replay_file) {
-        if (feof(replay_file)) {
+        if (rlog.past_end && !qatomic_read(&rlog.error)) {
             error_report("replay file is over");
             qemu_system_vmstop_request_prepare();
             qemu_system_vmstop_request(RUN_STATE_PAUSED);
-        } else if (ferror(replay_file)) {
+        } else if (qatomic_read(&rlog.error)) {
             error_report("replay file is over or something goes wrong");
             qemu_system_vmstop_request_prepare();
             qemu_system_vmstop_request(RUN_STATE_INTERNAL_ERROR);
@@ -108,6 +108,15 @@ int64_t replay_get_qword(void);
 void replay_get_array(uint8_t *buf, size_t *size);
 void replay_get_array_alloc(uint8_t **buf, size_t *size);
 
+/*! Starts buffered log I/O at file offset @offset, after the header. */
+void replay_log_start(uint64_t offset, bool compressed);
+/*! Writes out the buffered log and stops the I/O thread. */
+void replay_log_finish(void);
+/*! Returns the current offset in the (uncompressed) log. */
+uint64_t replay_log_tell(void);
+/*! Moves the replay position to @offset, as returned by replay_log_tell. */
+void replay_log_seek(uint64_t offset);
+
 /* Mutex functions for protecting replay log file and ensuring
  * synchronisation between vCPU and main-loop threads. */
 
@@ -25,12 +25,16 @@
 #define REPLAY_VERSION              0xe0200c
 /* Size of replay log header */
 #define HEADER_SIZE                 (sizeof(uint32_t) + sizeof(uint64_t))
+/* Header flags, stored after the version */
+#define REPLAY_FLAG_ZSTD            1
 
 ReplayMode replay_mode = REPLAY_MODE_NONE;
 char *replay_snapshot;
 
 /* Name of replay file  */
 static char *replay_filename;
+/* Whether the log blocks are compressed */
+static bool replay_compressed;
 ReplayState replay_state;
 static GSList *replay_blockers;
 
@@ -226,7 +230,7 @@ bool replay_has_event(void)
     return res;
 }
 
-static void replay_enable(const char *fname, int mode)
+static void replay_enable(const char *fname, int mode, bool compress)
 {
     const char *fmode = NULL;
     assert(!replay_file);
@@ -262,15 +266,19 @@ static void replay_enable(const char *fname, int mode)
 
     /* skip file header for RECORD and check it for PLAY */
     if (replay_mode == REPLAY_MODE_RECORD) {
-        fseek(replay_file, HEADER_SIZE, SEEK_SET);
+        replay_compressed = compress;
+        replay_log_start(HEADER_SIZE, compress);
     } else if (replay_mode == REPLAY_MODE_PLAY) {
-        unsigned int version = replay_get_dword();
-        if (version != REPLAY_VERSION) {
+        uint8_t header[HEADER_SIZE];
+
+        if (fread(header, 1, HEADER_SIZE, replay_file) != HEADER_SIZE ||
+            ldl_be_p(header) != REPLAY_VERSION) {
             fprintf(stderr, "Replay: invalid input log file version\n");
             exit(1);
         }
-        /* go to the beginning */
-        fseek(replay_file, HEADER_SIZE, SEEK_SET);
+        replay_compressed = ldl_be_p(header + sizeof(uint32_t)) &
+                            REPLAY_FLAG_ZSTD;
+        replay_log_start(HEADER_SIZE, replay_compressed);
         replay_fetch_data_kind();
     }
 
@@ -312,7 +320,7 @@ void replay_configure(QemuOpts *opts)
 
     replay_snapshot = g_strdup(qemu_opt_get(opts, "rrsnapshot"));
     replay_vmstate_register();
-    replay_enable(fname, mode);
+    replay_enable(fname, mode, qemu_opt_get_bool(opts, "rrcompress", false));
 
 out:
     loc_pop(&loc);
@@ -356,10 +364,20 @@ void replay_finish(void)
             replay_shutdown_request(SHUTDOWN_CAUSE_HOST_SIGNAL);
             /* write end event */
             replay_put_event(EVENT_END);
+        }
+        replay_log_finish();
+
+        if (replay_mode == REPLAY_MODE_RECORD) {
+            uint8_t header[HEADER_SIZE] = { 0 };
 
             /* write header */
+            stl_be_p(header, REPLAY_VERSION);
+            stl_be_p(header + sizeof(uint32_t),
+                     replay_compressed ? REPLAY_FLAG_ZSTD : 0);
             fseek(replay_file, 0, SEEK_SET);
-            replay_put_dword(REPLAY_VERSION);
+            if (fwrite(header, 1, HEADER_SIZE, replay_file) != HEADER_SIZE) {
+                error_report("replay write error");
+            }
         }
 
         fclose(replay_file);
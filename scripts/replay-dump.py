@@ -20,6 +20,7 @@
 
 import argparse
 import struct
+import sys
 from collections import namedtuple
 
 # This mirrors some of the global replay state which some of the
@@ -285,6 +286,11 @@ def decode_file(filename):
 
     print("HEADER: version 0x%x" % (version))
 
+    # the first header dword after the version holds the flags
+    if (junk >> 32) & 1:
+        print("compressed logs are not supported")
+        sys.exit(1)
+
     if version == 0xe02007:
         event_decode_table = v7_event_table
         replay_state.checkpoint_start = 12
@@ -44,6 +44,8 @@
 #include "sysemu/cpu-timers.h"
 #include "sysemu/whpx.h"
 #include "hw/boards.h"
+#include "sysemu/numa.h"
+#include "sysemu/startup-time.h"
 #include "hw/hw.h"
 #include "trace.h"
 
@@ -79,7 +81,7 @@ bool cpu_is_stopped(CPUState *cpu)
 
 bool cpu_work_list_empty(CPUState *cpu)
 {
-    return QSIMPLEQ_EMPTY_ATOMIC(&cpu->work_list);
+    return qatomic_read(&QSLIST_FIRST(&cpu->work_list)) == NULL;
 }
 
 bool cpu_thread_is_idle(CPUState *cpu)
@@ -650,6 +652,8 @@ void qemu_init_vcpu(CPUState *cpu)
     while (!cpu->created) {
         qemu_cond_wait(&qemu_cpu_cond, &qemu_global_mutex);
     }
+
+    numa_cpu_thread_place(ms, cpu);
 }
 
 void cpu_stop_current(void)
@@ -721,6 +725,7 @@ int vm_prepare_start(bool step_pending)
 void vm_start(void)
 {
     if (!vm_prepare_start(false)) {
+        startup_time_finish();
         resume_all_vcpus();
     }
 }
@@ -33,18 +33,21 @@
  * value less than DIRTYLIMIT_TOLERANCE_RANGE
  */
 #define DIRTYLIMIT_TOLERANCE_RANGE  25  /* MB/s */
-/*
- * Plus or minus vcpu sleep time linearly if dirty
- * page rate error value percentage over
- * DIRTYLIMIT_LINEAR_ADJUSTMENT_PCT.
- * Otherwise, plus or minus a fixed vcpu sleep time.
- */
-#define DIRTYLIMIT_LINEAR_ADJUSTMENT_PCT     50
 /*
  * Max vcpu sleep time percentage during a cycle
  * composed of dirty ring full and sleep time.
  */
 #define DIRTYLIMIT_THROTTLE_PCT_MAX 99
+/*
+ * Gains of the per-vCPU PID controller, applied to the relative
+ * dirty page rate error (in percent) once per sample period and
+ * scaled by the controller gain percentage.
+ */
+#define DIRTYLIMIT_PID_KP   0.4
+#define DIRTYLIMIT_PID_KI   0.6
+#define DIRTYLIMIT_PID_KD   0.1
+/* Controller gain percentage used outside of live migration */
+#define DIRTYLIMIT_DEFAULT_GAIN 100
 
 struct {
     VcpuStat stat;
@@ -60,6 +63,10 @@ typedef struct VcpuDirtyLimitState {
      * zero if not enabled.
      */
     uint64_t quota;
+    /* Sleep time percentage of a dirty ring full cycle */
+    double sleep_pct;
+    /* Relative errors of the last two samples, in percent */
+    double error[2];
 } VcpuDirtyLimitState;
 
 struct {
@@ -267,69 +274,64 @@ static inline bool dirtylimit_done(uint64_t quota,
     return ((max - min) <= DIRTYLIMIT_TOLERANCE_RANGE) ? true : false;
 }
 
-static inline bool
-dirtylimit_need_linear_adjustment(uint64_t quota,
-                                  uint64_t current)
+static uint64_t dirtylimit_gain(void)
 {
-    uint64_t min, max;
+    MigrationState *s = migrate_get_current();
 
-    min = MIN(quota, current);
-    max = MAX(quota, current);
+    if (migrate_dirty_limit() &&
+        migration_is_active(s)) {
+        return s->parameters.x_vcpu_dirty_limit_gain;
+    }
 
-    return ((max - min) * 100 / max) > DIRTYLIMIT_LINEAR_ADJUSTMENT_PCT;
+    return DIRTYLIMIT_DEFAULT_GAIN;
 }
 
+/*
+ * Run one step of the vCPU's PID controller.  The controller works in
+ * velocity form on the relative error between the measured and the
+ * quota dirty page rate, so that a vCPU dirtying memory far above its
+ * quota is throttled hard right away, while one that already stays
+ * below it only sees its sleep time decay.
+ */
 static void dirtylimit_set_throttle(CPUState *cpu,
                                     uint64_t quota,
-                                    uint64_t current)
+                                    uint64_t current,
+                                    uint64_t gain)
 {
+    VcpuDirtyLimitState *state = dirtylimit_vcpu_get_state(cpu->cpu_index);
     int64_t ring_full_time_us = 0;
-    uint64_t sleep_pct = 0;
-    uint64_t throttle_us = 0;
+    double error, delta;
 
     if (current == 0) {
+        state->sleep_pct = 0;
+        state->error[0] = state->error[1] = 0;
         cpu->throttle_us_per_full = 0;
         return;
     }
 
     ring_full_time_us = dirtylimit_dirty_ring_full_time(current);
 
-    if (dirtylimit_need_linear_adjustment(quota, current)) {
-        if (quota < current) {
-            sleep_pct = (current - quota) * 100 / current;
-            throttle_us =
-                ring_full_time_us * sleep_pct / (double)(100 - sleep_pct);
-            cpu->throttle_us_per_full += throttle_us;
-        } else {
-            sleep_pct = (quota - current) * 100 / quota;
-            throttle_us =
-                ring_full_time_us * sleep_pct / (double)(100 - sleep_pct);
-            cpu->throttle_us_per_full -= throttle_us;
-        }
+    error = ((double)current - quota) * 100 / MAX(current, quota);
+    delta = DIRTYLIMIT_PID_KP * (error - state->error[0]) +
+            DIRTYLIMIT_PID_KI * error +
+            DIRTYLIMIT_PID_KD * (error - 2 * state->error[0] +
+                                 state->error[1]);
 
-        trace_dirtylimit_throttle_pct(cpu->cpu_index,
-                                      sleep_pct,
-                                      throttle_us);
-    } else {
-        if (quota < current) {
-            cpu->throttle_us_per_full += ring_full_time_us / 10;
-        } else {
-            cpu->throttle_us_per_full -= ring_full_time_us / 10;
-        }
-    }
+    state->error[1] = state->error[0];
+    state->error[0] = error;
+    state->sleep_pct += delta * gain / 100;
+    state->sleep_pct = MIN(state->sleep_pct, DIRTYLIMIT_THROTTLE_PCT_MAX);
+    state->sleep_pct = MAX(state->sleep_pct, 0);
 
-    /*
-     * TODO: in the big kvm_dirty_ring_size case (eg: 65536, or other scenario),
-     *       current dirty page rate may never reach the quota, we should stop
-     *       increasing sleep time?
-     */
-    cpu->throttle_us_per_full = MIN(cpu->throttle_us_per_full,
-        ring_full_time_us * DIRTYLIMIT_THROTTLE_PCT_MAX);
+    cpu->throttle_us_per_full = ring_full_time_us * state->sleep_pct /
+                                (100 - state->sleep_pct);
 
-    cpu->throttle_us_per_full = MAX(cpu->throttle_us_per_full, 0);
+    trace_dirtylimit_throttle_pct(cpu->cpu_index,
+                                  state->sleep_pct,
+                                  cpu->throttle_us_per_full);
 }
 
-static void dirtylimit_adjust_throttle(CPUState *cpu)
+static void dirtylimit_adjust_throttle(CPUState *cpu, uint64_t gain)
 {
     uint64_t quota = 0;
     uint64_t current = 0;
@@ -339,7 +341,7 @@ static void dirtylimit_adjust_throttle(CPUState *cpu)
     current = vcpu_dirty_rate_get(cpu_index);
 
     if (!dirtylimit_done(quota, current)) {
-        dirtylimit_set_throttle(cpu, quota, current);
+        dirtylimit_set_throttle(cpu, quota, current, gain);
     }
 
     return;
@@ -347,6 +349,7 @@ static void dirtylimit_adjust_throttle(CPUState *cpu)
 
 void dirtylimit_process(void)
 {
+    uint64_t gain = dirtylimit_gain();
     CPUState *cpu;
 
     if (!qatomic_read(&dirtylimit_quit)) {
@@ -361,7 +364,7 @@ void dirtylimit_process(void)
             if (!dirtylimit_vcpu_get_state(cpu->cpu_index)->enabled) {
                 continue;
             }
-            dirtylimit_adjust_throttle(cpu);
+            dirtylimit_adjust_throttle(cpu, gain);
         }
         dirtylimit_state_unlock();
     }
@@ -380,8 +383,19 @@ void dirtylimit_set_vcpu(int cpu_index,
                          uint64_t quota,
                          bool enable)
 {
+    VcpuDirtyLimitState *state = &dirtylimit_state->states[cpu_index];
+
     trace_dirtylimit_set_vcpu(cpu_index, quota);
 
+    /*
+     * Keep the current sleep time as the starting point for a new
+     * quota, but forget the errors measured against the old one.
+     */
+    state->error[0] = state->error[1] = 0;
+    if (!enable) {
+        state->sleep_pct = 0;
+    }
+
     if (enable) {
         dirtylimit_state->states[cpu_index].quota = quota;
         if (!dirtylimit_vcpu_get_state(cpu_index)->enabled) {
@@ -57,6 +57,12 @@ static bool icount_sleep = true;
  */
 int use_icount;
 
+/*
+ * Instructions a vCPU may run ahead of QEMU_CLOCK_VIRTUAL when icount is
+ * used with multi-threaded TCG; 0 if not configured.
+ */
+static int64_t icount_quantum;
+
 static void icount_enable_precise(void)
 {
     use_icount = 1;
@@ -88,6 +94,11 @@ static void icount_update_locked(CPUState *cpu)
     int64_t executed = icount_get_executed(cpu);
     cpu->icount_budget -= executed;
 
+    if (qemu_tcg_mttcg_enabled()) {
+        /* The clock only moves at the end of each quantum */
+        qatomic_set_i64(&cpu->icount_local, cpu->icount_local + executed);
+        return;
+    }
     qatomic_set_i64(&timers_state.qemu_icount,
                     timers_state.qemu_icount + executed);
 }
@@ -109,6 +120,7 @@ void icount_update(CPUState *cpu)
 static int64_t icount_get_raw_locked(void)
 {
     CPUState *cpu = current_cpu;
+    int64_t icount;
 
     if (cpu && cpu->running) {
         if (!cpu->can_do_io) {
@@ -119,7 +131,12 @@ static int64_t icount_get_raw_locked(void)
         icount_update_locked(cpu);
     }
     /* The read is protected by the seqlock, but needs atomic64 to avoid UB */
-    return qatomic_read_i64(&timers_state.qemu_icount);
+    icount = qatomic_read_i64(&timers_state.qemu_icount);
+    if (cpu && qemu_tcg_mttcg_enabled()) {
+        /* A vCPU sees its own time, up to one quantum ahead of the clock */
+        icount = MAX(icount, cpu->icount_local);
+    }
+    return icount;
 }
 
 static int64_t icount_get_locked(void)
@@ -156,6 +173,25 @@ int64_t icount_get(void)
     return icount;
 }
 
+int64_t icount_get_quantum(void)
+{
+    return icount_quantum;
+}
+
+int64_t icount_advance_to(int64_t icount)
+{
+    seqlock_write_lock(&timers_state.vm_clock_seqlock,
+                       &timers_state.vm_clock_lock);
+    if (icount > timers_state.qemu_icount) {
+        qatomic_set_i64(&timers_state.qemu_icount, icount);
+    } else {
+        icount = timers_state.qemu_icount;
+    }
+    seqlock_write_unlock(&timers_state.vm_clock_seqlock,
+                         &timers_state.vm_clock_lock);
+    return icount;
+}
+
 int64_t icount_to_ns(int64_t icount)
 {
     return icount << qatomic_read(&timers_state.icount_time_shift);
@@ -425,6 +461,7 @@ void icount_configure(QemuOpts *opts, Error **errp)
     const char *option = qemu_opt_get(opts, "shift");
     bool sleep = qemu_opt_get_bool(opts, "sleep", true);
     bool align = qemu_opt_get_bool(opts, "align", false);
+    uint64_t quantum = qemu_opt_get_number(opts, "quantum", 0);
     long time_shift = -1;
 
     if (!option) {
@@ -453,6 +490,23 @@ void icount_configure(QemuOpts *opts, Error **errp)
         return;
     }
 
+    if (quantum) {
+        if (time_shift < 0) {
+            error_setg(errp, "icount: quantum requires a fixed shift value");
+            return;
+        } else if (align) {
+            error_setg(errp, "quantum and align=on are incompatible");
+            return;
+        } else if (qemu_opt_get(opts, "rr")) {
+            error_setg(errp, "quantum is not supported with record/replay");
+            return;
+        } else if (quantum > INT32_MAX) {
+            error_setg(errp, "icount: Invalid quantum value");
+            return;
+        }
+        icount_quantum = quantum;
+    }
+
     icount_sleep = sleep;
     if (icount_sleep) {
         timers_state.icount_warp_timer = timer_new_ns(QEMU_CLOCK_VIRTUAL_RT,
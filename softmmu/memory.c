@@ -50,6 +50,15 @@ static QTAILQ_HEAD(, AddressSpace) address_spaces
 
 static GHashTable *flat_views;
 
+/*
+ * Regions whose rendering changed in the pending transaction, together with
+ * everything that contains or aliases them.  Only the FlatViews rooted at
+ * one of these are regenerated on commit.  The regions are only used as
+ * keys, they may be gone by then.
+ */
+static GHashTable *flatview_dirty_regions;
+static bool flatviews_all_dirty;
+
 typedef struct AddrRange AddrRange;
 
 /*
@@ -164,6 +173,14 @@ struct CoalescedMemoryRange {
     QTAILQ_ENTRY(CoalescedMemoryRange) link;
 };
 
+struct CoalescingHint {
+    AddrRange addr;
+    bool promoted;
+    int64_t window_start;   /* QEMU_CLOCK_REALTIME */
+    uint32_t writes;        /* since window_start */
+    QTAILQ_ENTRY(CoalescingHint) link;
+};
+
 struct MemoryRegionIoeventfd {
     AddrRange addr;
     bool match_data;
@@ -514,6 +531,13 @@ static MemTxResult memory_region_write_with_attrs_accessor(MemoryRegion *mr,
     return mr->ops->write_with_attrs(mr->opaque, addr, tmp, size, attrs);
 }
 
+static bool memory_region_needs_reentrancy_guard(MemoryRegion *mr)
+{
+    return mr->dev && !mr->disable_reentrancy_guard &&
+        (mr->global_locking || mr->device_locking) &&
+        !mr->ram_device && !mr->ram && !mr->rom_device && !mr->readonly;
+}
+
 static MemTxResult access_with_adjusted_size(hwaddr addr,
                                       uint64_t *value,
                                       unsigned size,
@@ -535,6 +559,7 @@ static MemTxResult access_with_adjusted_size(hwaddr addr,
     unsigned i;
     MemTxResult r = MEMTX_OK;
     bool reentrancy_guard_applied = false;
+    bool device_locked = false;
 
     if (!access_size_min) {
         access_size_min = 1;
@@ -543,13 +568,29 @@ static MemTxResult access_with_adjusted_size(hwaddr addr,
         access_size_max = 4;
     }
 
-    /* Do not allow more than one simultaneous access to a device's IO Regions */
-    if (mr->dev && !mr->disable_reentrancy_guard &&
-        !mr->ram_device && !mr->ram && !mr->rom_device && !mr->readonly) {
+    /*
+     * Regions of a device with its own lock are serialized by that lock rather
+     * than by the BQL.  Nested accesses from the thread that already holds it
+     * are caught by the re-entrancy guard below.
+     */
+    if (mr->device_locking && !qdev_is_locked(mr->dev)) {
+        qdev_lock(mr->dev);
+        device_locked = true;
+    }
+
+    /*
+     * Do not allow more than one simultaneous access to a device's IO Regions.
+     * Regions dispatched without any lock may be entered concurrently by
+     * several vCPUs, so the guard cannot apply to them.
+     */
+    if (memory_region_needs_reentrancy_guard(mr)) {
         if (mr->dev->mem_reentrancy_guard.engaged_in_io) {
             warn_report_once("Blocked re-entrant IO on MemoryRegion: "
                              "%s at addr: 0x%" HWADDR_PRIX,
                              memory_region_name(mr), addr);
+            if (device_locked) {
+                qdev_unlock(mr->dev);
+            }
             return MEMTX_ACCESS_ERROR;
         }
         mr->dev->mem_reentrancy_guard.engaged_in_io = true;
@@ -573,6 +614,9 @@ static MemTxResult access_with_adjusted_size(hwaddr addr,
     if (mr->dev && reentrancy_guard_applied) {
         mr->dev->mem_reentrancy_guard.engaged_in_io = false;
     }
+    if (device_locked) {
+        qdev_unlock(mr->dev);
+    }
     return r;
 }
 
@@ -1019,6 +1063,38 @@ static void flatviews_init(void)
     }
 }
 
+static void memory_region_mark_dirty(MemoryRegion *mr)
+{
+    MemoryRegion *alias;
+
+    while (mr && g_hash_table_add(flatview_dirty_regions, mr)) {
+        QTAILQ_FOREACH(alias, &mr->aliased_by, aliased_by_link) {
+            memory_region_mark_dirty(alias);
+        }
+        mr = mr->container;
+    }
+}
+
+/* Schedule a topology update for a change in the rendering of @mr */
+static void memory_region_update_pending_add(MemoryRegion *mr)
+{
+    memory_region_update_pending = true;
+    if (flatviews_all_dirty) {
+        return;
+    }
+    if (!flatview_dirty_regions) {
+        flatview_dirty_regions = g_hash_table_new(NULL, NULL);
+    }
+    memory_region_mark_dirty(mr);
+}
+
+/* Schedule a topology update that regenerates every FlatView */
+static void memory_region_update_pending_all(void)
+{
+    memory_region_update_pending = true;
+    flatviews_all_dirty = true;
+}
+
 static void flatviews_reset(void)
 {
     AddressSpace *as;
@@ -1041,7 +1117,54 @@ static void flatviews_reset(void)
     }
 }
 
-static void address_space_set_flatview(AddressSpace *as)
+static gboolean flatview_is_stale(gpointer key, gpointer value,
+                                  gpointer user_data)
+{
+    GHashTable *used = user_data;
+
+    /* The empty view for NULL never changes */
+    return key && (g_hash_table_contains(flatview_dirty_regions, key) ||
+                   !g_hash_table_contains(used, key));
+}
+
+/*
+ * Regenerate the FlatViews affected by the pending transaction, and render
+ * views for address spaces whose flatview root changed.  Views no address
+ * space uses any more are dropped.
+ */
+static void flatviews_update(void)
+{
+    g_autoptr(GHashTable) used = NULL;
+    AddressSpace *as;
+
+    if (!flat_views || flatviews_all_dirty || !flatview_dirty_regions) {
+        flatviews_reset();
+        goto out;
+    }
+
+    used = g_hash_table_new(NULL, NULL);
+    QTAILQ_FOREACH(as, &address_spaces, address_spaces_link) {
+        g_hash_table_add(used, memory_region_get_flatview_root(as->root));
+    }
+    g_hash_table_foreach_remove(flat_views, flatview_is_stale, used);
+
+    QTAILQ_FOREACH(as, &address_spaces, address_spaces_link) {
+        MemoryRegion *physmr = memory_region_get_flatview_root(as->root);
+
+        if (!g_hash_table_lookup(flat_views, physmr)) {
+            generate_memory_topology(physmr);
+        }
+    }
+
+out:
+    if (flatview_dirty_regions) {
+        g_hash_table_remove_all(flatview_dirty_regions);
+    }
+    flatviews_all_dirty = false;
+}
+
+/* Returns whether @as switched to a different FlatView */
+static bool address_space_set_flatview(AddressSpace *as)
 {
     FlatView *old_view = address_space_to_flatview(as);
     MemoryRegion *physmr = memory_region_get_flatview_root(as->root);
@@ -1050,7 +1173,7 @@ static void address_space_set_flatview(AddressSpace *as)
     assert(new_view);
 
     if (old_view == new_view) {
-        return;
+        return false;
     }
 
     if (old_view) {
@@ -1084,6 +1207,7 @@ static void address_space_set_flatview(AddressSpace *as)
     if (old_view) {
         flatview_unref(old_view);
     }
+    return true;
 }
 
 static void address_space_update_topology(AddressSpace *as)
@@ -1113,13 +1237,16 @@ void memory_region_transaction_commit(void)
     --memory_region_transaction_depth;
     if (!memory_region_transaction_depth) {
         if (memory_region_update_pending) {
-            flatviews_reset();
+            flatviews_update();
 
             MEMORY_LISTENER_CALL_GLOBAL(begin, Forward);
 
+            /* Address spaces whose FlatView did not change are left alone */
             QTAILQ_FOREACH(as, &address_spaces, address_spaces_link) {
-                address_space_set_flatview(as);
-                address_space_update_ioeventfds(as);
+                if (address_space_set_flatview(as) ||
+                    ioeventfd_update_pending) {
+                    address_space_update_ioeventfds(as);
+                }
             }
             memory_region_update_pending = false;
             ioeventfd_update_pending = false;
@@ -1265,9 +1392,12 @@ static void memory_region_initfn(Object *obj)
     mr->ops = &unassigned_mem_ops;
     mr->enabled = true;
     mr->romd_mode = true;
+    mr->global_locking = true;
     mr->destructor = memory_region_destructor_none;
     QTAILQ_INIT(&mr->subregions);
     QTAILQ_INIT(&mr->coalesced);
+    QTAILQ_INIT(&mr->coalescing_hints);
+    QTAILQ_INIT(&mr->aliased_by);
 
     op = object_property_add(OBJECT(mr), "container",
                              "link<" TYPE_MEMORY_REGION ">",
@@ -1545,6 +1675,104 @@ MemTxResult memory_region_dispatch_write(MemoryRegion *mr,
     }
 }
 
+unsigned memory_region_direct_sizes(MemoryRegion *mr, bool is_write)
+{
+    const MemoryRegionOps *ops = mr->ops;
+    unsigned impl_min = ops->impl.min_access_size ? : 1;
+    unsigned impl_max = ops->impl.max_access_size ? : 4;
+    unsigned sizes = 0;
+    MemOp size;
+
+    if (mr->alias || mr->subpage || mr->device_locking || ops->valid.accepts) {
+        return 0;
+    }
+    if (!(is_write ? ops->write : ops->read)) {
+        return 0;
+    }
+
+    for (size = MO_8; size <= MO_64; size++) {
+        unsigned bytes = 1 << size;
+
+        if (ops->valid.max_access_size &&
+            (bytes > ops->valid.max_access_size ||
+             bytes < ops->valid.min_access_size)) {
+            continue;
+        }
+        if (bytes < impl_min || bytes > impl_max) {
+            continue;
+        }
+        sizes |= 1 << size;
+    }
+    return sizes;
+}
+
+MemTxResult memory_region_dispatch_read_direct(MemoryRegion *mr,
+                                               hwaddr addr,
+                                               uint64_t *pval,
+                                               MemOp op,
+                                               MemTxAttrs attrs)
+{
+    unsigned size = memop_size(op);
+    bool guarded = memory_region_needs_reentrancy_guard(mr);
+    uint64_t tmp;
+
+    if ((!mr->ops->valid.unaligned && (addr & (size - 1))) ||
+        (guarded && mr->dev->mem_reentrancy_guard.engaged_in_io)) {
+        return memory_region_dispatch_read(mr, addr, pval, op, attrs);
+    }
+
+    if (guarded) {
+        mr->dev->mem_reentrancy_guard.engaged_in_io = true;
+    }
+    tmp = mr->ops->read(mr->opaque, addr, size);
+    if (guarded) {
+        mr->dev->mem_reentrancy_guard.engaged_in_io = false;
+    }
+    if (trace_event_get_state_backends(TRACE_MEMORY_REGION_OPS_READ)) {
+        hwaddr abs_addr = memory_region_to_absolute_addr(mr, addr);
+        trace_memory_region_ops_read(get_cpu_index(), mr, abs_addr, tmp, size,
+                                     memory_region_name(mr));
+    }
+
+    *pval = tmp & MAKE_64BIT_MASK(0, size * 8);
+    adjust_endianness(mr, pval, op);
+    return MEMTX_OK;
+}
+
+MemTxResult memory_region_dispatch_write_direct(MemoryRegion *mr,
+                                                hwaddr addr,
+                                                uint64_t data,
+                                                MemOp op,
+                                                MemTxAttrs attrs)
+{
+    unsigned size = memop_size(op);
+    bool guarded = memory_region_needs_reentrancy_guard(mr);
+
+    /* ioeventfds can come and go without a memory map change */
+    if ((!mr->ops->valid.unaligned && (addr & (size - 1))) ||
+        (guarded && mr->dev->mem_reentrancy_guard.engaged_in_io) ||
+        mr->ioeventfd_nb) {
+        return memory_region_dispatch_write(mr, addr, data, op, attrs);
+    }
+
+    adjust_endianness(mr, &data, op);
+    data &= MAKE_64BIT_MASK(0, size * 8);
+    if (trace_event_get_state_backends(TRACE_MEMORY_REGION_OPS_WRITE)) {
+        hwaddr abs_addr = memory_region_to_absolute_addr(mr, addr);
+        trace_memory_region_ops_write(get_cpu_index(), mr, abs_addr, data,
+                                      size, memory_region_name(mr));
+    }
+
+    if (guarded) {
+        mr->dev->mem_reentrancy_guard.engaged_in_io = true;
+    }
+    mr->ops->write(mr->opaque, addr, data, size);
+    if (guarded) {
+        mr->dev->mem_reentrancy_guard.engaged_in_io = false;
+    }
+    return MEMTX_OK;
+}
+
 void memory_region_init_io(MemoryRegion *mr,
                            Object *owner,
                            const MemoryRegionOps *ops,
@@ -1556,6 +1784,10 @@ void memory_region_init_io(MemoryRegion *mr,
     mr->ops = ops ? ops : &unassigned_mem_ops;
     mr->opaque = opaque;
     mr->terminates = true;
+    if (mr->dev && DEVICE_GET_CLASS(mr->dev)->has_lock) {
+        mr->global_locking = false;
+        mr->device_locking = true;
+    }
 }
 
 void memory_region_init_ram_nomigrate(MemoryRegion *mr,
@@ -1708,6 +1940,7 @@ void memory_region_init_alias(MemoryRegion *mr,
     memory_region_init(mr, owner, name, size);
     mr->alias = orig;
     mr->alias_offset = offset;
+    QTAILQ_INSERT_TAIL(&orig->aliased_by, mr, aliased_by_link);
 }
 
 void memory_region_init_rom_nomigrate(MemoryRegion *mr,
@@ -1763,6 +1996,8 @@ void memory_region_init_iommu(void *_iommu_mr,
     iommu_mr->iommu_notify_flags = IOMMU_NOTIFIER_NONE;
 }
 
+static void memory_region_clear_coalescing_hints(MemoryRegion *mr);
+
 static void memory_region_finalize(Object *obj)
 {
     MemoryRegion *mr = MEMORY_REGION(obj);
@@ -1783,8 +2018,17 @@ static void memory_region_finalize(Object *obj)
     }
     memory_region_transaction_commit();
 
+    if (mr->alias && QTAILQ_IN_USE(mr, aliased_by_link)) {
+        QTAILQ_REMOVE(&mr->alias->aliased_by, mr, aliased_by_link);
+    }
+    while (!QTAILQ_EMPTY(&mr->aliased_by)) {
+        MemoryRegion *alias = QTAILQ_FIRST(&mr->aliased_by);
+        QTAILQ_REMOVE(&mr->aliased_by, alias, aliased_by_link);
+    }
+
     mr->destructor(mr);
     memory_region_clear_coalescing(mr);
+    memory_region_clear_coalescing_hints(mr);
     g_free((char *)mr->name);
     g_free(mr->ioeventfds);
 }
@@ -2237,9 +2481,14 @@ void memory_region_set_log(MemoryRegion *mr, bool log, unsigned client)
         return;
     }
 
+    qatomic_set(&ram_list.vga_logging_regions,
+                ram_list.vga_logging_regions + (log ? 1 : -1));
+
     memory_region_transaction_begin();
     mr->dirty_log_mask = (mr->dirty_log_mask & ~mask) | (log * mask);
-    memory_region_update_pending |= mr->enabled;
+    if (mr->enabled) {
+        memory_region_update_pending_add(mr);
+    }
     memory_region_transaction_commit();
 }
 
@@ -2369,7 +2618,9 @@ void memory_region_set_readonly(MemoryRegion *mr, bool readonly)
     if (mr->readonly != readonly) {
         memory_region_transaction_begin();
         mr->readonly = readonly;
-        memory_region_update_pending |= mr->enabled;
+        if (mr->enabled) {
+            memory_region_update_pending_add(mr);
+        }
         memory_region_transaction_commit();
     }
 }
@@ -2379,7 +2630,9 @@ void memory_region_set_nonvolatile(MemoryRegion *mr, bool nonvolatile)
     if (mr->nonvolatile != nonvolatile) {
         memory_region_transaction_begin();
         mr->nonvolatile = nonvolatile;
-        memory_region_update_pending |= mr->enabled;
+        if (mr->enabled) {
+            memory_region_update_pending_add(mr);
+        }
         memory_region_transaction_commit();
     }
 }
@@ -2389,7 +2642,9 @@ void memory_region_rom_device_set_romd(MemoryRegion *mr, bool romd_mode)
     if (mr->romd_mode != romd_mode) {
         memory_region_transaction_begin();
         mr->romd_mode = romd_mode;
-        memory_region_update_pending |= mr->enabled;
+        if (mr->enabled) {
+            memory_region_update_pending_add(mr);
+        }
         memory_region_transaction_commit();
     }
 }
@@ -2526,6 +2781,101 @@ void memory_region_clear_coalescing(MemoryRegion *mr)
     }
 }
 
+/* Hints that are not promoted yet, over all regions */
+static unsigned int coalescing_hints_pending;
+
+/* Trapped writes per second that make a hinted range worth coalescing */
+#define COALESCING_HINT_WRITES  1000
+
+void memory_region_add_coalescing_hint(MemoryRegion *mr,
+                                       hwaddr offset,
+                                       uint64_t size)
+{
+    CoalescingHint *hint = g_new0(CoalescingHint, 1);
+
+    hint->addr = addrrange_make(int128_make64(offset), int128_make64(size));
+    QTAILQ_INSERT_TAIL(&mr->coalescing_hints, hint, link);
+    qatomic_inc(&coalescing_hints_pending);
+}
+
+static void memory_region_clear_coalescing_hints(MemoryRegion *mr)
+{
+    CoalescingHint *hint;
+
+    while (!QTAILQ_EMPTY(&mr->coalescing_hints)) {
+        hint = QTAILQ_FIRST(&mr->coalescing_hints);
+        QTAILQ_REMOVE(&mr->coalescing_hints, hint, link);
+        if (!hint->promoted) {
+            qatomic_dec(&coalescing_hints_pending);
+        }
+        g_free(hint);
+    }
+}
+
+/*
+ * Count a write to @offset of @mr against the hint covering it.  Returns
+ * the hint once it crosses COALESCING_HINT_WRITES within one second.
+ */
+static CoalescingHint *memory_region_hint_write(MemoryRegion *mr,
+                                                hwaddr offset)
+{
+    CoalescingHint *hint;
+    int64_t now;
+
+    QTAILQ_FOREACH(hint, &mr->coalescing_hints, link) {
+        if (qatomic_read(&hint->promoted) ||
+            !addrrange_contains(hint->addr, int128_make64(offset))) {
+            continue;
+        }
+
+        now = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+        if (now - qatomic_read(&hint->window_start) > NANOSECONDS_PER_SECOND) {
+            qatomic_set(&hint->window_start, now);
+            qatomic_set(&hint->writes, 0);
+        }
+        if (qatomic_fetch_inc(&hint->writes) + 1 == COALESCING_HINT_WRITES) {
+            return hint;
+        }
+        return NULL;
+    }
+
+    return NULL;
+}
+
+void address_space_note_write_exit(AddressSpace *as, hwaddr addr)
+{
+    CoalescingHint *hint;
+    MemoryRegion *mr;
+    hwaddr xlat, len = 1;
+
+    if (likely(!qatomic_read(&coalescing_hints_pending))) {
+        return;
+    }
+
+    WITH_RCU_READ_LOCK_GUARD() {
+        mr = address_space_translate(as, addr, &xlat, &len, true,
+                                     MEMTXATTRS_UNSPECIFIED);
+        hint = memory_region_hint_write(mr, xlat);
+        if (!hint) {
+            return;
+        }
+        memory_region_ref(mr);
+    }
+
+    qemu_mutex_lock_iothread();
+    if (!hint->promoted) {
+        hint->promoted = true;
+        qatomic_dec(&coalescing_hints_pending);
+        trace_memory_region_coalescing_promote(memory_region_name(mr),
+                                               int128_get64(hint->addr.start),
+                                               int128_get64(hint->addr.size));
+        memory_region_add_coalescing(mr, int128_get64(hint->addr.start),
+                                     int128_get64(hint->addr.size));
+    }
+    qemu_mutex_unlock_iothread();
+    memory_region_unref(mr);
+}
+
 void memory_region_set_flush_coalesced(MemoryRegion *mr)
 {
     mr->flush_coalesced_mmio = true;
@@ -2539,6 +2889,11 @@ void memory_region_clear_flush_coalesced(MemoryRegion *mr)
     }
 }
 
+void memory_region_clear_global_locking(MemoryRegion *mr)
+{
+    mr->global_locking = false;
+}
+
 static bool userspace_eventfd_warning;
 
 void memory_region_add_eventfd(MemoryRegion *mr,
@@ -2634,7 +2989,9 @@ static void memory_region_update_container_subregions(MemoryRegion *subregion)
     }
     QTAILQ_INSERT_TAIL(&mr->subregions, subregion, subregions_link);
 done:
-    memory_region_update_pending |= mr->enabled && subregion->enabled;
+    if (mr->enabled && subregion->enabled) {
+        memory_region_update_pending_add(mr);
+    }
     memory_region_transaction_commit();
 }
 
@@ -2684,7 +3041,9 @@ void memory_region_del_subregion(MemoryRegion *mr,
     }
     QTAILQ_REMOVE(&mr->subregions, subregion, subregions_link);
     memory_region_unref(subregion);
-    memory_region_update_pending |= mr->enabled && subregion->enabled;
+    if (mr->enabled && subregion->enabled) {
+        memory_region_update_pending_add(mr);
+    }
     memory_region_transaction_commit();
 }
 
@@ -2695,7 +3054,7 @@ void memory_region_set_enabled(MemoryRegion *mr, bool enabled)
     }
     memory_region_transaction_begin();
     mr->enabled = enabled;
-    memory_region_update_pending = true;
+    memory_region_update_pending_add(mr);
     memory_region_transaction_commit();
 }
 
@@ -2711,7 +3070,7 @@ void memory_region_set_size(MemoryRegion *mr, uint64_t size)
     }
     memory_region_transaction_begin();
     mr->size = s;
-    memory_region_update_pending = true;
+    memory_region_update_pending_add(mr);
     memory_region_transaction_commit();
 }
 
@@ -2747,7 +3106,9 @@ void memory_region_set_alias_offset(MemoryRegion *mr, hwaddr offset)
 
     memory_region_transaction_begin();
     mr->alias_offset = offset;
-    memory_region_update_pending |= mr->enabled;
+    if (mr->enabled) {
+        memory_region_update_pending_add(mr);
+    }
     memory_region_transaction_commit();
 }
 
@@ -2918,7 +3279,7 @@ void memory_global_dirty_log_start(unsigned int flags)
     if (!old_flags) {
         MEMORY_LISTENER_CALL_GLOBAL(log_global_start, Forward);
         memory_region_transaction_begin();
-        memory_region_update_pending = true;
+        memory_region_update_pending_all();
         memory_region_transaction_commit();
     }
 }
@@ -2933,7 +3294,7 @@ static void memory_global_dirty_log_do_stop(unsigned int flags)
 
     if (!global_dirty_tracking) {
         memory_region_transaction_begin();
-        memory_region_update_pending = true;
+        memory_region_update_pending_all();
         memory_region_transaction_commit();
         MEMORY_LISTENER_CALL_GLOBAL(log_global_stop, Reverse);
     }
@@ -2105,6 +2105,72 @@ void qemu_ram_remap(ram_addr_t addr, ram_addr_t length)
         }
     }
 }
+
+static void invalidate_and_set_dirty(MemoryRegion *mr, hwaddr addr,
+                                     hwaddr length);
+
+/*
+ * Whether parts of @block can be replaced by qemu_ram_map_file_private():
+ * it must be plain anonymous memory with host-sized pages, not private to
+ * a confidential guest, and nothing may have pinned it (e.g. VFIO) or
+ * track its discarded parts.
+ */
+bool qemu_ram_can_map_file_private(RAMBlock *block)
+{
+    return block->fd < 0 &&
+           !(block->flags & (RAM_SHARED | RAM_PREALLOC | RAM_PROTECTED)) &&
+           block->page_size == qemu_real_host_page_size() &&
+           !memory_region_has_ram_discard_manager(block->mr) &&
+           !ram_block_discard_is_disabled();
+}
+
+/*
+ * Replace [offset, offset + length) of an anonymous private RAM block with
+ * a copy-on-write mapping of @fd, so that its contents are read from the
+ * file on first access.  Readahead of the whole range is started right
+ * away.  Returns 0 on success or a negative errno.
+ */
+int qemu_ram_map_file_private(RAMBlock *block, ram_addr_t offset,
+                              ram_addr_t length, int fd, off_t fd_offset)
+{
+    void *vaddr = ramblock_ptr(block, offset);
+    int flags = MAP_FIXED | MAP_PRIVATE;
+    void *area;
+
+    assert(qemu_ram_can_map_file_private(block));
+    assert(QEMU_IS_ALIGNED(offset | length, qemu_real_host_page_size()));
+
+    flags |= block->flags & RAM_NORESERVE ? MAP_NORESERVE : 0;
+    area = mmap(vaddr, length, PROT_READ | PROT_WRITE, flags, fd, fd_offset);
+    if (area == MAP_FAILED) {
+        return -errno;
+    }
+    assert(area == vaddr);
+
+    /* The new mapping does not inherit the advice given in ram_block_add */
+    memory_try_enable_merging(vaddr, length);
+    qemu_ram_setup_dump(vaddr, length);
+    qemu_madvise(vaddr, length, QEMU_MADV_HUGEPAGE);
+    if (!qtest_enabled()) {
+        qemu_madvise(vaddr, length, QEMU_MADV_DONTFORK);
+    }
+    qemu_madvise(vaddr, length, QEMU_MADV_WILLNEED);
+
+    /* Like a write, the new contents must reach TBs and dirty logging */
+    invalidate_and_set_dirty(block->mr, offset, length);
+    return 0;
+}
+#else
+bool qemu_ram_can_map_file_private(RAMBlock *block)
+{
+    return false;
+}
+
+int qemu_ram_map_file_private(RAMBlock *block, ram_addr_t offset,
+                              ram_addr_t length, int fd, off_t fd_offset)
+{
+    return -ENOSYS;
+}
 #endif /* !_WIN32 */
 
 /* Return a host pointer to ram allocated with qemu_ram_alloc.
@@ -2589,7 +2655,12 @@ bool prepare_mmio_access(MemoryRegion *mr)
 {
     bool release_lock = false;
 
-    if (!qemu_mutex_iothread_locked()) {
+    /*
+     * Flushing the coalesced MMIO ring is not thread-safe, so it still needs
+     * the BQL even for regions that do not otherwise depend on it.
+     */
+    if ((mr->global_locking || mr->flush_coalesced_mmio) &&
+        !qemu_mutex_iothread_locked()) {
         qemu_mutex_lock_iothread();
         release_lock = true;
     }
@@ -3309,6 +3380,268 @@ address_space_write_cached_slow(MemoryRegionCache *cache, hwaddr addr,
 #define RCU_READ_UNLOCK()        ((void)0)
 #include "memory_ldst.c.inc"
 
+#define DMA_TRANSLATION_CACHE_ENTRIES 4
+
+typedef struct DMATranslationEntry {
+    hwaddr iova;
+    hwaddr len;                 /* 0 if the entry is unused */
+    MemoryRegion *mr;
+    hwaddr xlat;                /* offset of @iova within @mr */
+    uint8_t *ptr;
+    bool is_write;
+    MemTxAttrs attrs;
+} DMATranslationEntry;
+
+typedef struct DMATranslationIOMMU {
+    IOMMUNotifier n;
+    MemoryRegion *mr;
+    DMATranslationCache *cache;
+    QLIST_ENTRY(DMATranslationIOMMU) next;
+} DMATranslationIOMMU;
+
+struct DMATranslationCache {
+    AddressSpace *as;
+    MemoryListener listener;
+    QLIST_HEAD(, DMATranslationIOMMU) iommu_list;
+
+    /*
+     * Bumped by the memory listener and the IOMMU notifiers, possibly from
+     * another thread; the user of the cache flushes the entries when it
+     * sees a new value.
+     */
+    unsigned generation;
+    /* Set if a vIOMMU refused the invalidation notifier. */
+    bool disabled;
+
+    /* Owned by the thread using the cache. */
+    unsigned seen_generation;
+    unsigned next_victim;
+    DMATranslationEntry entries[DMA_TRANSLATION_CACHE_ENTRIES];
+};
+
+static void dma_translation_cache_invalidate(DMATranslationCache *cache)
+{
+    qatomic_inc(&cache->generation);
+}
+
+static void dma_translation_cache_iommu_notify(IOMMUNotifier *n,
+                                               IOMMUTLBEntry *iotlb)
+{
+    DMATranslationIOMMU *iommu = container_of(n, DMATranslationIOMMU, n);
+
+    dma_translation_cache_invalidate(iommu->cache);
+}
+
+static void dma_translation_cache_begin(MemoryListener *listener)
+{
+    DMATranslationCache *cache = container_of(listener, DMATranslationCache,
+                                              listener);
+
+    dma_translation_cache_invalidate(cache);
+}
+
+static void dma_translation_cache_commit(MemoryListener *listener)
+{
+    DMATranslationCache *cache = container_of(listener, DMATranslationCache,
+                                              listener);
+
+    /*
+     * Entries filled between begin and the new FlatView being published
+     * may still refer to the old one, so invalidate once more.
+     */
+    dma_translation_cache_invalidate(cache);
+}
+
+static void dma_translation_cache_region_add(MemoryListener *listener,
+                                             MemoryRegionSection *section)
+{
+    DMATranslationCache *cache = container_of(listener, DMATranslationCache,
+                                              listener);
+    DMATranslationIOMMU *iommu;
+    IOMMUMemoryRegion *iommu_mr;
+    Error *local_err = NULL;
+    Int128 end;
+    int iommu_idx;
+
+    if (!memory_region_is_iommu(section->mr)) {
+        return;
+    }
+
+    iommu_mr = IOMMU_MEMORY_REGION(section->mr);
+    end = int128_add(int128_make64(section->offset_within_region),
+                     section->size);
+    end = int128_sub(end, int128_one());
+    iommu_idx = memory_region_iommu_attrs_to_index(iommu_mr,
+                                                   MEMTXATTRS_UNSPECIFIED);
+
+    iommu = g_new0(DMATranslationIOMMU, 1);
+    iommu_notifier_init(&iommu->n, dma_translation_cache_iommu_notify,
+                        IOMMU_NOTIFIER_UNMAP,
+                        section->offset_within_region,
+                        int128_get64(end),
+                        iommu_idx);
+    iommu->mr = section->mr;
+    iommu->cache = cache;
+    if (memory_region_register_iommu_notifier(section->mr, &iommu->n,
+                                              &local_err)) {
+        /* Without invalidations the cache cannot be used safely. */
+        error_free(local_err);
+        g_free(iommu);
+        qatomic_set(&cache->disabled, true);
+        return;
+    }
+    QLIST_INSERT_HEAD(&cache->iommu_list, iommu, next);
+}
+
+static void dma_translation_cache_region_del(MemoryListener *listener,
+                                             MemoryRegionSection *section)
+{
+    DMATranslationCache *cache = container_of(listener, DMATranslationCache,
+                                              listener);
+    DMATranslationIOMMU *iommu;
+
+    if (!memory_region_is_iommu(section->mr)) {
+        return;
+    }
+
+    QLIST_FOREACH(iommu, &cache->iommu_list, next) {
+        if (iommu->mr == section->mr &&
+            iommu->n.start == section->offset_within_region) {
+            memory_region_unregister_iommu_notifier(iommu->mr, &iommu->n);
+            QLIST_REMOVE(iommu, next);
+            g_free(iommu);
+            break;
+        }
+    }
+}
+
+DMATranslationCache *dma_translation_cache_new(AddressSpace *as)
+{
+    DMATranslationCache *cache = g_new0(DMATranslationCache, 1);
+
+    cache->as = as;
+    QLIST_INIT(&cache->iommu_list);
+    cache->listener = (MemoryListener) {
+        .name = "dma-translation-cache",
+        .begin = dma_translation_cache_begin,
+        .commit = dma_translation_cache_commit,
+        .region_add = dma_translation_cache_region_add,
+        .region_del = dma_translation_cache_region_del,
+    };
+    /* The Xen map cache does not allow long-lived pointers to guest RAM. */
+    cache->disabled = xen_enabled();
+    memory_listener_register(&cache->listener, as);
+    return cache;
+}
+
+void dma_translation_cache_free(DMATranslationCache *cache)
+{
+    DMATranslationIOMMU *iommu, *next;
+
+    if (!cache) {
+        return;
+    }
+
+    memory_listener_unregister(&cache->listener);
+    QLIST_FOREACH_SAFE(iommu, &cache->iommu_list, next, next) {
+        memory_region_unregister_iommu_notifier(iommu->mr, &iommu->n);
+        QLIST_REMOVE(iommu, next);
+        g_free(iommu);
+    }
+    g_free(cache);
+}
+
+/* Called from RCU critical section.  */
+static DMATranslationEntry *dma_translation_cache_lookup(
+    DMATranslationCache *cache, hwaddr addr, bool is_write, MemTxAttrs attrs)
+{
+    DMATranslationEntry *e;
+    MemoryRegion *mr;
+    hwaddr xlat, l;
+    uint8_t *ptr;
+    int i;
+
+    for (i = 0; i < DMA_TRANSLATION_CACHE_ENTRIES; i++) {
+        e = &cache->entries[i];
+        if (e->len && addr - e->iova < e->len && e->is_write == is_write &&
+            !memcmp(&e->attrs, &attrs, sizeof(attrs))) {
+            return e;
+        }
+    }
+
+    /*
+     * The returned length is clipped to the section and to the IOTLB
+     * entry that translated @addr, so the whole range can be cached.
+     */
+    l = addr ? -addr : HWADDR_MAX;
+    mr = flatview_translate(address_space_to_flatview(cache->as), addr,
+                            &xlat, &l, is_write, attrs);
+    if (!memory_access_is_direct(mr, is_write)) {
+        return NULL;
+    }
+    ptr = qemu_ram_ptr_length(mr->ram_block, xlat, &l, false);
+
+    e = &cache->entries[cache->next_victim];
+    cache->next_victim = (cache->next_victim + 1) %
+                         DMA_TRANSLATION_CACHE_ENTRIES;
+    *e = (DMATranslationEntry) {
+        .iova = addr,
+        .len = l,
+        .mr = mr,
+        .xlat = xlat,
+        .ptr = ptr,
+        .is_write = is_write,
+        .attrs = attrs,
+    };
+    return e;
+}
+
+MemTxResult dma_translation_cache_rw(DMATranslationCache *cache,
+                                     dma_addr_t addr, void *buf,
+                                     dma_addr_t len, DMADirection dir,
+                                     MemTxAttrs attrs)
+{
+    bool is_write = dir == DMA_DIRECTION_FROM_DEVICE;
+    DMATranslationEntry *e;
+    uint8_t *p = buf;
+    unsigned generation;
+    hwaddr l;
+
+    if (qatomic_read(&cache->disabled)) {
+        return dma_memory_rw(cache->as, addr, buf, len, dir, attrs);
+    }
+
+    dma_barrier(cache->as, dir);
+
+    RCU_READ_LOCK_GUARD();
+    generation = qatomic_load_acquire(&cache->generation);
+    if (generation != cache->seen_generation) {
+        memset(cache->entries, 0, sizeof(cache->entries));
+        cache->seen_generation = generation;
+    }
+
+    while (len) {
+        e = dma_translation_cache_lookup(cache, addr, is_write, attrs);
+        if (!e) {
+            return address_space_rw(cache->as, addr, attrs, p, len, is_write);
+        }
+
+        l = MIN(len, e->iova + e->len - addr);
+        if (is_write) {
+            memcpy(e->ptr + (addr - e->iova), p, l);
+            invalidate_and_set_dirty(e->mr, e->xlat + (addr - e->iova), l);
+        } else {
+            memcpy(p, e->ptr + (addr - e->iova), l);
+        }
+
+        len -= l;
+        addr += l;
+        p += l;
+    }
+
+    return MEMTX_OK;
+}
+
 /* virtual memory access for debug (includes writing to ROM) */
 int cpu_memory_rw_debug(CPUState *cpu, vaddr addr,
                         void *ptr, size_t len, bool is_write)
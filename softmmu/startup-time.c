@@ -0,0 +1,117 @@
+/*
+ * Startup time breakdown
+ *
+ * Wall-clock timestamps of the main milestones of machine creation, from
+ * the start of qemu_init() until the guest first runs, together with the
+ * time each cold-plugged device spent in its realize method.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qapi/qapi-commands-machine.h"
+#include "qapi/type-helpers.h"
+#include "qemu/timer.h"
+#include "qom/object.h"
+#include "hw/qdev-core.h"
+#include "sysemu/startup-time.h"
+#include "trace.h"
+
+#define STARTUP_TIME_MAX_MARKS 32
+
+typedef struct StartupMark {
+    const char *phase;
+    int64_t ns;
+} StartupMark;
+
+typedef struct StartupDevice {
+    char *path;
+    const char *type;
+    int64_t ns;
+} StartupDevice;
+
+static StartupMark startup_marks[STARTUP_TIME_MAX_MARKS];
+static int startup_nr_marks;
+static GArray *startup_devices;
+static bool startup_done;
+
+void startup_time_mark(const char *phase)
+{
+    int64_t now = get_clock();
+
+    if (startup_done || startup_nr_marks == STARTUP_TIME_MAX_MARKS) {
+        return;
+    }
+    startup_marks[startup_nr_marks++] = (StartupMark) { phase, now };
+    trace_startup_time_mark(phase, now - startup_marks[0].ns);
+}
+
+void startup_time_finish(void)
+{
+    startup_time_mark("guest-start");
+    startup_done = true;
+}
+
+void startup_time_device(DeviceState *dev, int64_t ns)
+{
+    StartupDevice d;
+
+    /* Hot-plugged devices are not part of startup */
+    if (startup_done || phase_check(PHASE_MACHINE_READY)) {
+        return;
+    }
+    if (!startup_devices) {
+        startup_devices = g_array_new(false, false, sizeof(StartupDevice));
+    }
+    d.path = object_get_canonical_path(OBJECT(dev));
+    d.type = object_get_typename(OBJECT(dev));
+    d.ns = ns;
+    g_array_append_val(startup_devices, d);
+    trace_startup_time_device(d.path, d.type, ns);
+}
+
+static gint startup_device_cmp(gconstpointer a, gconstpointer b)
+{
+    const StartupDevice *da = a, *db = b;
+
+    return da->ns < db->ns ? 1 : da->ns > db->ns ? -1 : 0;
+}
+
+HumanReadableText *qmp_x_query_startup_time(Error **errp)
+{
+    g_autoptr(GString) buf = g_string_new("");
+    int64_t total = 0;
+    int i;
+
+    g_string_append_printf(buf, "%-20s %12s %12s\n",
+                           "phase", "at (ms)", "took (ms)");
+    for (i = 0; i < startup_nr_marks; i++) {
+        int64_t at = startup_marks[i].ns - startup_marks[0].ns;
+        int64_t took = i ? startup_marks[i].ns - startup_marks[i - 1].ns : 0;
+
+        g_string_append_printf(buf, "%-20s %12.3f %12.3f\n",
+                               startup_marks[i].phase,
+                               at / (double)SCALE_MS, took / (double)SCALE_MS);
+    }
+
+    if (!startup_devices) {
+        return human_readable_text_from_str(buf);
+    }
+
+    g_array_sort(startup_devices, startup_device_cmp);
+    for (i = 0; i < startup_devices->len; i++) {
+        total += g_array_index(startup_devices, StartupDevice, i).ns;
+    }
+    g_string_append_printf(buf, "\ndevice realize: %u devices, %.3f ms, "
+                           "slowest first\n", startup_devices->len,
+                           total / (double)SCALE_MS);
+    for (i = 0; i < startup_devices->len; i++) {
+        StartupDevice *d = &g_array_index(startup_devices, StartupDevice, i);
+
+        g_string_append_printf(buf, "%12.3f  %s (%s)\n",
+                               d->ns / (double)SCALE_MS, d->path, d->type);
+    }
+
+    return human_readable_text_from_str(buf);
+}
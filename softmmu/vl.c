@@ -117,6 +117,7 @@
 #include "semihosting/semihost.h"
 #include "crypto/init.h"
 #include "sysemu/replay.h"
+#include "sysemu/startup-time.h"
 #include "qapi/qapi-events-run-state.h"
 #include "qapi/qapi-types-audio.h"
 #include "qapi/qapi-visit-audio.h"
@@ -446,6 +447,12 @@ static QemuOptsList qemu_icount_opts = {
         }, {
             .name = "rrsnapshot",
             .type = QEMU_OPT_STRING,
+        }, {
+            .name = "rrcompress",
+            .type = QEMU_OPT_BOOL,
+        }, {
+            .name = "quantum",
+            .type = QEMU_OPT_NUMBER,
         },
         { /* end of list */ }
     },
@@ -2638,8 +2645,11 @@ void qmp_x_exit_preconfig(Error **errp)
     }
 
     qemu_init_board();
+    startup_time_mark("board-init");
     qemu_create_cli_devices();
+    startup_time_mark("devices");
     qemu_machine_creation_done();
+    startup_time_mark("machine-done");
 
     if (loadvm) {
         load_snapshot(loadvm, NULL, false, NULL, &error_fatal);
@@ -2673,6 +2683,8 @@ void qemu_init(int argc, char **argv)
     bool userconfig = true;
     FILE *vmstate_dump_file = NULL;
 
+    startup_time_mark("start");
+
     qemu_add_opts(&qemu_drive_opts);
     qemu_add_drive_opts(&qemu_legacy_drive_opts);
     qemu_add_drive_opts(&qemu_common_drive_opts);
@@ -2710,8 +2722,10 @@ void qemu_init(int argc, char **argv)
     qemu_init_exec_dir(argv[0]);
 
     qemu_init_arch_modules();
+    startup_time_mark("modules");
 
     qemu_init_subsystems();
+    startup_time_mark("subsystems");
 
     /* first pass of option parsing */
     optind = 1;
@@ -3547,6 +3561,7 @@ void qemu_init(int argc, char **argv)
 
     qemu_process_help_options();
     qemu_maybe_daemonize(pid_file);
+    startup_time_mark("options");
 
     /*
      * The trace backend must be initialized after daemonizing.
@@ -3584,6 +3599,7 @@ void qemu_init(int argc, char **argv)
     qemu_apply_machine_options(machine_opts_dict);
     qobject_unref(machine_opts_dict);
     phase_advance(PHASE_MACHINE_CREATED);
+    startup_time_mark("machine-created");
 
     /*
      * Note: uses machine properties such as kernel-irqchip, must run
@@ -3591,6 +3607,7 @@ void qemu_init(int argc, char **argv)
      */
     configure_accelerators(argv[0]);
     phase_advance(PHASE_ACCEL_CREATED);
+    startup_time_mark("accel-created");
 
     /*
      * Beware, QOM objects created before this point miss global and
@@ -3620,6 +3637,7 @@ void qemu_init(int argc, char **argv)
      * over memory-backend-file objects).
      */
     qemu_create_late_backends();
+    startup_time_mark("backends");
 
     /*
      * Note: creates a QOM object, must run only after global and
@@ -3651,4 +3669,5 @@ void qemu_init(int argc, char **argv)
     accel_setup_post(current_machine);
     os_setup_post();
     resume_mux_open();
+    startup_time_mark("init-done");
 }
@@ -0,0 +1,178 @@
+/*
+ * Event loop latency statistics
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * (at your option) any later version.
+ */
+
+#include "qemu/osdep.h"
+#include "qom/object.h"
+#include "block/aio.h"
+#include "qemu/main-loop.h"
+#include "sysemu/iothread.h"
+#include "sysemu/stats.h"
+
+static StatsList *aio_stats_add_scalar(StatsList *list, strList *names,
+                                       const char *name, Stat64 *value)
+{
+    Stats *stats;
+
+    if (!apply_str_list_filter(name, names)) {
+        return list;
+    }
+
+    stats = g_new0(Stats, 1);
+    stats->name = g_strdup(name);
+    stats->value = g_new0(StatsValue, 1);
+    stats->value->type = QTYPE_QNUM;
+    stats->value->u.scalar = stat64_get(value);
+    QAPI_LIST_PREPEND(list, stats);
+    return list;
+}
+
+static StatsList *aio_stats_add_hist(StatsList *list, strList *names,
+                                     const char *name, Stat64 *hist)
+{
+    uint64List **tail;
+    Stats *stats;
+    int i;
+
+    if (!apply_str_list_filter(name, names)) {
+        return list;
+    }
+
+    stats = g_new0(Stats, 1);
+    stats->name = g_strdup(name);
+    stats->value = g_new0(StatsValue, 1);
+    stats->value->type = QTYPE_QLIST;
+    tail = &stats->value->u.list;
+    for (i = 0; i < AIO_LATENCY_BUCKETS; i++) {
+        QAPI_LIST_APPEND(tail, stat64_get(&hist[i]));
+    }
+    QAPI_LIST_PREPEND(list, stats);
+    return list;
+}
+
+static void aio_stats_add_ctx(StatsResultList **result, AioContext *ctx,
+                              const char *qom_path, strList *names)
+{
+    AioLatencyStats *stats = aio_context_latency_stats(ctx);
+    StatsList *stats_list = NULL;
+
+    if (!stats) {
+        return;
+    }
+
+    stats_list = aio_stats_add_hist(stats_list, names, "iteration-time",
+                                    stats->iteration);
+    stats_list = aio_stats_add_hist(stats_list, names, "fd-handler-time",
+                                    stats->fd_handler);
+    stats_list = aio_stats_add_hist(stats_list, names, "bh-time",
+                                    stats->bh);
+    stats_list = aio_stats_add_hist(stats_list, names, "bh-delay",
+                                    stats->bh_delay);
+    stats_list = aio_stats_add_hist(stats_list, names, "timer-time",
+                                    stats->timers);
+    stats_list = aio_stats_add_scalar(stats_list, names, "poll-time",
+                                      &stats->poll_ns);
+    stats_list = aio_stats_add_scalar(stats_list, names, "block-time",
+                                      &stats->block_ns);
+
+    if (stats_list) {
+        add_stats_entry(result, STATS_PROVIDER_AIO, qom_path, stats_list);
+    }
+}
+
+typedef struct {
+    StatsResultList **result;
+    strList *names;
+} AioStatsIter;
+
+static int aio_stats_iothread(Object *obj, void *opaque)
+{
+    AioStatsIter *iter = opaque;
+    IOThread *iothread;
+    AioContext *ctx;
+    char *qom_path;
+
+    iothread = (IOThread *)object_dynamic_cast(obj, TYPE_IOTHREAD);
+    if (!iothread) {
+        return 0;
+    }
+    ctx = iothread_get_aio_context(iothread);
+    if (!ctx) {
+        return 0;
+    }
+
+    qom_path = object_get_canonical_path(obj);
+    aio_stats_add_ctx(iter->result, ctx, qom_path, iter->names);
+    g_free(qom_path);
+    return 0;
+}
+
+static void aio_stats_cb(StatsResultList **result, StatsTarget target,
+                         strList *names, strList *targets, Error **errp)
+{
+    AioStatsIter iter = { .result = result, .names = names };
+    Object *main_loop;
+    char *qom_path = NULL;
+
+    if (target != STATS_TARGET_VM) {
+        return;
+    }
+
+    /* The main loop is only in the QOM tree if created with -object */
+    main_loop = object_resolve_path_type("", TYPE_MAIN_LOOP, NULL);
+    if (main_loop) {
+        qom_path = object_get_canonical_path(main_loop);
+    }
+    aio_stats_add_ctx(result, qemu_get_aio_context(), qom_path, names);
+    g_free(qom_path);
+
+    object_child_foreach(object_get_objects_root(), aio_stats_iothread,
+                         &iter);
+}
+
+static StatsSchemaValueList *aio_schemas_add(StatsSchemaValueList *list,
+                                             const char *name,
+                                             StatsType type)
+{
+    StatsSchemaValue *value = g_new0(StatsSchemaValue, 1);
+
+    value->name = g_strdup(name);
+    value->type = type;
+    value->has_unit = true;
+    value->unit = STATS_UNIT_SECONDS;
+    value->has_base = true;
+    value->base = 10;
+    value->exponent = -9;
+    QAPI_LIST_PREPEND(list, value);
+    return list;
+}
+
+static void aio_schemas_cb(StatsSchemaList **result, Error **errp)
+{
+    StatsSchemaValueList *stats_list = NULL;
+
+    stats_list = aio_schemas_add(stats_list, "iteration-time",
+                                 STATS_TYPE_LOG2_HISTOGRAM);
+    stats_list = aio_schemas_add(stats_list, "fd-handler-time",
+                                 STATS_TYPE_LOG2_HISTOGRAM);
+    stats_list = aio_schemas_add(stats_list, "bh-time",
+                                 STATS_TYPE_LOG2_HISTOGRAM);
+    stats_list = aio_schemas_add(stats_list, "bh-delay",
+                                 STATS_TYPE_LOG2_HISTOGRAM);
+    stats_list = aio_schemas_add(stats_list, "timer-time",
+                                 STATS_TYPE_LOG2_HISTOGRAM);
+    stats_list = aio_schemas_add(stats_list, "poll-time",
+                                 STATS_TYPE_CUMULATIVE);
+    stats_list = aio_schemas_add(stats_list, "block-time",
+                                 STATS_TYPE_CUMULATIVE);
+
+    add_stats_schema(result, STATS_PROVIDER_AIO, STATS_TARGET_VM, stats_list);
+}
+
+void aio_stats_init(void)
+{
+    add_stats_callbacks(STATS_PROVIDER_AIO, aio_stats_cb, aio_schemas_cb);
+}
@@ -0,0 +1,194 @@
+/*
+ * Block backend I/O accounting statistics
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * (at your option) any later version.
+ */
+
+#include "qemu/osdep.h"
+#include "block/accounting.h"
+#include "hw/qdev-core.h"
+#include "sysemu/block-backend.h"
+#include "sysemu/stats.h"
+
+/*
+ * Each statistic is one element of one of the per-type arrays in
+ * BlockAcctStats, so sampling is a table walk under the stats lock.
+ */
+static const struct {
+    const char *name;
+    size_t offset;
+    enum BlockAcctType type;
+    bool bytes;
+    bool ns;
+} block_stats_fields[] = {
+#define BLOCK_STAT(name, field, type, bytes, ns) \
+    { name, offsetof(BlockAcctStats, field), type, bytes, ns }
+    BLOCK_STAT("rd-bytes", nr_bytes, BLOCK_ACCT_READ, true, false),
+    BLOCK_STAT("wr-bytes", nr_bytes, BLOCK_ACCT_WRITE, true, false),
+    BLOCK_STAT("unmap-bytes", nr_bytes, BLOCK_ACCT_UNMAP, true, false),
+    BLOCK_STAT("rd-operations", nr_ops, BLOCK_ACCT_READ, false, false),
+    BLOCK_STAT("wr-operations", nr_ops, BLOCK_ACCT_WRITE, false, false),
+    BLOCK_STAT("flush-operations", nr_ops, BLOCK_ACCT_FLUSH, false, false),
+    BLOCK_STAT("unmap-operations", nr_ops, BLOCK_ACCT_UNMAP, false, false),
+    BLOCK_STAT("rd-merged", merged, BLOCK_ACCT_READ, false, false),
+    BLOCK_STAT("wr-merged", merged, BLOCK_ACCT_WRITE, false, false),
+    BLOCK_STAT("failed-rd-operations", failed_ops, BLOCK_ACCT_READ,
+               false, false),
+    BLOCK_STAT("failed-wr-operations", failed_ops, BLOCK_ACCT_WRITE,
+               false, false),
+    BLOCK_STAT("failed-flush-operations", failed_ops, BLOCK_ACCT_FLUSH,
+               false, false),
+    BLOCK_STAT("failed-unmap-operations", failed_ops, BLOCK_ACCT_UNMAP,
+               false, false),
+    BLOCK_STAT("invalid-rd-operations", invalid_ops, BLOCK_ACCT_READ,
+               false, false),
+    BLOCK_STAT("invalid-wr-operations", invalid_ops, BLOCK_ACCT_WRITE,
+               false, false),
+    BLOCK_STAT("rd-total-time", total_time_ns, BLOCK_ACCT_READ, false, true),
+    BLOCK_STAT("wr-total-time", total_time_ns, BLOCK_ACCT_WRITE, false, true),
+    BLOCK_STAT("flush-total-time", total_time_ns, BLOCK_ACCT_FLUSH,
+               false, true),
+    BLOCK_STAT("unmap-total-time", total_time_ns, BLOCK_ACCT_UNMAP,
+               false, true),
+#undef BLOCK_STAT
+};
+
+/* Tail latencies from the always-on log-linear histograms, in ns */
+static const struct {
+    const char *name;
+    enum BlockAcctType type;
+    unsigned ppm;
+} block_latency_fields[] = {
+    { "rd-latency-p50", BLOCK_ACCT_READ, 500000 },
+    { "rd-latency-p99", BLOCK_ACCT_READ, 990000 },
+    { "rd-latency-p999", BLOCK_ACCT_READ, 999000 },
+    { "wr-latency-p50", BLOCK_ACCT_WRITE, 500000 },
+    { "wr-latency-p99", BLOCK_ACCT_WRITE, 990000 },
+    { "wr-latency-p999", BLOCK_ACCT_WRITE, 999000 },
+    { "flush-latency-p50", BLOCK_ACCT_FLUSH, 500000 },
+    { "flush-latency-p99", BLOCK_ACCT_FLUSH, 990000 },
+    { "flush-latency-p999", BLOCK_ACCT_FLUSH, 999000 },
+};
+
+static StatsList *block_stats_add(StatsList *list, const char *name,
+                                  uint64_t value)
+{
+    Stats *stats = g_new0(Stats, 1);
+
+    stats->name = g_strdup(name);
+    stats->value = g_new0(StatsValue, 1);
+    stats->value->type = QTYPE_QNUM;
+    stats->value->u.scalar = value;
+    QAPI_LIST_PREPEND(list, stats);
+    return list;
+}
+
+static StatsSchemaValueList *block_schemas_add(StatsSchemaValueList *list,
+                                               const char *name,
+                                               StatsType type,
+                                               bool bytes, bool ns)
+{
+    StatsSchemaValue *value = g_new0(StatsSchemaValue, 1);
+
+    value->name = g_strdup(name);
+    value->type = type;
+    if (bytes) {
+        value->has_unit = true;
+        value->unit = STATS_UNIT_BYTES;
+    } else if (ns) {
+        value->has_unit = true;
+        value->unit = STATS_UNIT_SECONDS;
+        value->has_base = true;
+        value->base = 10;
+        value->exponent = -9;
+    }
+    QAPI_LIST_PREPEND(list, value);
+    return list;
+}
+
+static void block_stats_add_blk(StatsResultList **result, BlockBackend *blk,
+                                strList *names)
+{
+    BlockAcctStats *acct = blk_get_stats(blk);
+    DeviceState *dev = blk_get_attached_dev(blk);
+    StatsList *stats_list = NULL;
+    g_autofree char *qom_path = NULL;
+    int i;
+
+    qemu_mutex_lock(&acct->lock);
+    for (i = 0; i < ARRAY_SIZE(block_stats_fields); i++) {
+        const uint64_t *field =
+            (const void *)acct + block_stats_fields[i].offset;
+
+        if (apply_str_list_filter(block_stats_fields[i].name, names)) {
+            stats_list = block_stats_add(stats_list,
+                                         block_stats_fields[i].name,
+                                         field[block_stats_fields[i].type]);
+        }
+    }
+    qemu_mutex_unlock(&acct->lock);
+
+    for (i = 0; i < ARRAY_SIZE(block_latency_fields); i++) {
+        if (apply_str_list_filter(block_latency_fields[i].name, names)) {
+            stats_list = block_stats_add(stats_list,
+                block_latency_fields[i].name,
+                block_acct_latency_percentile(acct,
+                                              block_latency_fields[i].type,
+                                              block_latency_fields[i].ppm));
+        }
+    }
+
+    if (!stats_list) {
+        return;
+    }
+    if (dev) {
+        qom_path = object_get_canonical_path(OBJECT(dev));
+    }
+    add_stats_entry_id(result, STATS_PROVIDER_BLOCK, qom_path,
+                       *blk_name(blk) ? blk_name(blk) : NULL, stats_list);
+}
+
+static void block_stats_cb(StatsResultList **result, StatsTarget target,
+                           strList *names, strList *targets, Error **errp)
+{
+    BlockBackend *blk;
+
+    if (target != STATS_TARGET_BLOCK) {
+        return;
+    }
+
+    for (blk = blk_all_next(NULL); blk; blk = blk_all_next(blk)) {
+        if (!*blk_name(blk) && !blk_get_attached_dev(blk)) {
+            continue;
+        }
+        block_stats_add_blk(result, blk, names);
+    }
+}
+
+static void block_schemas_cb(StatsSchemaList **result, Error **errp)
+{
+    StatsSchemaValueList *stats_list = NULL;
+    int i;
+
+    for (i = 0; i < ARRAY_SIZE(block_stats_fields); i++) {
+        stats_list = block_schemas_add(stats_list, block_stats_fields[i].name,
+                                       STATS_TYPE_CUMULATIVE,
+                                       block_stats_fields[i].bytes,
+                                       block_stats_fields[i].ns);
+    }
+    for (i = 0; i < ARRAY_SIZE(block_latency_fields); i++) {
+        stats_list = block_schemas_add(stats_list,
+                                       block_latency_fields[i].name,
+                                       STATS_TYPE_INSTANT, false, true);
+    }
+
+    add_stats_schema(result, STATS_PROVIDER_BLOCK, STATS_TARGET_BLOCK,
+                     stats_list);
+}
+
+void block_stats_init(void)
+{
+    add_stats_callbacks(STATS_PROVIDER_BLOCK, block_stats_cb,
+                        block_schemas_cb);
+}
@@ -0,0 +1,106 @@
+/*
+ * Coroutine stack usage statistics
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * (at your option) any later version.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/coroutine.h"
+#include "sysemu/stats.h"
+
+static const char *const coroutine_stack_class_names[COROUTINE_STACK__MAX] = {
+    [COROUTINE_STACK_DEFAULT] = "default",
+    [COROUTINE_STACK_SMALL] = "small",
+};
+
+static StatsList *coroutine_stats_add(StatsList *list, strList *names,
+                                      const char *class_name,
+                                      const char *suffix, uint64_t value)
+{
+    g_autofree char *name = g_strdup_printf("%s-%s", class_name, suffix);
+    Stats *stats;
+
+    if (!apply_str_list_filter(name, names)) {
+        return list;
+    }
+
+    stats = g_new0(Stats, 1);
+    stats->name = g_steal_pointer(&name);
+    stats->value = g_new0(StatsValue, 1);
+    stats->value->type = QTYPE_QNUM;
+    stats->value->u.scalar = value;
+    QAPI_LIST_PREPEND(list, stats);
+    return list;
+}
+
+static void coroutine_stats_cb(StatsResultList **result, StatsTarget target,
+                               strList *names, strList *targets, Error **errp)
+{
+    StatsList *stats_list = NULL;
+    CoroutineStackClass stack_class;
+
+    if (target != STATS_TARGET_VM) {
+        return;
+    }
+
+    for (stack_class = 0; stack_class < COROUTINE_STACK__MAX; stack_class++) {
+        const char *class_name = coroutine_stack_class_names[stack_class];
+        uint64_t count, reserved, resident;
+
+        qemu_coroutine_stack_stats(stack_class, &count, &reserved, &resident);
+        stats_list = coroutine_stats_add(stats_list, names, class_name,
+                                         "stacks", count);
+        stats_list = coroutine_stats_add(stats_list, names, class_name,
+                                         "stack-reserved", reserved);
+        stats_list = coroutine_stats_add(stats_list, names, class_name,
+                                         "stack-resident", resident);
+    }
+
+    if (stats_list) {
+        add_stats_entry(result, STATS_PROVIDER_COROUTINE, NULL, stats_list);
+    }
+}
+
+static StatsSchemaValueList *coroutine_schemas_add(StatsSchemaValueList *list,
+                                                   const char *class_name,
+                                                   const char *suffix,
+                                                   bool bytes)
+{
+    StatsSchemaValue *value = g_new0(StatsSchemaValue, 1);
+
+    value->name = g_strdup_printf("%s-%s", class_name, suffix);
+    value->type = STATS_TYPE_INSTANT;
+    if (bytes) {
+        value->has_unit = true;
+        value->unit = STATS_UNIT_BYTES;
+    }
+    QAPI_LIST_PREPEND(list, value);
+    return list;
+}
+
+static void coroutine_schemas_cb(StatsSchemaList **result, Error **errp)
+{
+    StatsSchemaValueList *stats_list = NULL;
+    CoroutineStackClass stack_class;
+
+    for (stack_class = 0; stack_class < COROUTINE_STACK__MAX; stack_class++) {
+        const char *class_name = coroutine_stack_class_names[stack_class];
+
+        stats_list = coroutine_schemas_add(stats_list, class_name,
+                                           "stacks", false);
+        stats_list = coroutine_schemas_add(stats_list, class_name,
+                                           "stack-reserved", true);
+        stats_list = coroutine_schemas_add(stats_list, class_name,
+                                           "stack-resident", true);
+    }
+
+    add_stats_schema(result, STATS_PROVIDER_COROUTINE, STATS_TARGET_VM,
+                     stats_list);
+}
+
+void coroutine_stats_init(void)
+{
+    add_stats_callbacks(STATS_PROVIDER_COROUTINE, coroutine_stats_cb,
+                        coroutine_schemas_cb);
+}
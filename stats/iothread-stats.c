@@ -0,0 +1,132 @@
+/*
+ * IOThread adaptive polling statistics
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * (at your option) any later version.
+ */
+
+#include "qemu/osdep.h"
+#include "qom/object.h"
+#include "block/aio.h"
+#include "sysemu/iothread.h"
+#include "sysemu/stats.h"
+
+static StatsList *iothread_stats_add(StatsList *list, strList *names,
+                                     const char *name, uint64_t value)
+{
+    Stats *stats;
+
+    if (!apply_str_list_filter(name, names)) {
+        return list;
+    }
+
+    stats = g_new0(Stats, 1);
+    stats->name = g_strdup(name);
+    stats->value = g_new0(StatsValue, 1);
+    stats->value->type = QTYPE_QNUM;
+    stats->value->u.scalar = value;
+    QAPI_LIST_PREPEND(list, stats);
+    return list;
+}
+
+typedef struct {
+    StatsResultList **result;
+    strList *names;
+} IOThreadStatsIter;
+
+/*
+ * The polling state is owned by the iothread; a torn or slightly stale
+ * sample is good enough for monitoring and avoids stopping the thread.
+ */
+static int iothread_stats_one(Object *obj, void *opaque)
+{
+    IOThreadStatsIter *iter = opaque;
+    StatsList *stats_list = NULL;
+    IOThread *iothread;
+    AioContext *ctx;
+    char *qom_path;
+
+    iothread = (IOThread *)object_dynamic_cast(obj, TYPE_IOTHREAD);
+    if (!iothread) {
+        return 0;
+    }
+    ctx = iothread_get_aio_context(iothread);
+    if (!ctx) {
+        return 0;
+    }
+
+    stats_list = iothread_stats_add(stats_list, iter->names, "poll-ns",
+                                    ctx->poll_ns);
+    stats_list = iothread_stats_add(stats_list, iter->names, "poll-max-ns",
+                                    ctx->poll_max_ns);
+    stats_list = iothread_stats_add(stats_list, iter->names, "poll-grow",
+                                    ctx->poll_grow);
+    stats_list = iothread_stats_add(stats_list, iter->names, "poll-shrink",
+                                    ctx->poll_shrink);
+    stats_list = iothread_stats_add(stats_list, iter->names,
+                                    "poll-disabled-handlers",
+                                    ctx->poll_disable_cnt);
+    stats_list = iothread_stats_add(stats_list, iter->names, "aio-max-batch",
+                                    ctx->aio_max_batch);
+
+    if (stats_list) {
+        qom_path = object_get_canonical_path(obj);
+        add_stats_entry(iter->result, STATS_PROVIDER_IOTHREAD, qom_path,
+                        stats_list);
+        g_free(qom_path);
+    }
+    return 0;
+}
+
+static void iothread_stats_cb(StatsResultList **result, StatsTarget target,
+                              strList *names, strList *targets, Error **errp)
+{
+    IOThreadStatsIter iter = { .result = result, .names = names };
+
+    if (target != STATS_TARGET_VM) {
+        return;
+    }
+
+    object_child_foreach(object_get_objects_root(), iothread_stats_one,
+                         &iter);
+}
+
+static StatsSchemaValueList *iothread_schemas_add(StatsSchemaValueList *list,
+                                                  const char *name, bool ns)
+{
+    StatsSchemaValue *value = g_new0(StatsSchemaValue, 1);
+
+    value->name = g_strdup(name);
+    value->type = STATS_TYPE_INSTANT;
+    if (ns) {
+        value->has_unit = true;
+        value->unit = STATS_UNIT_SECONDS;
+        value->has_base = true;
+        value->base = 10;
+        value->exponent = -9;
+    }
+    QAPI_LIST_PREPEND(list, value);
+    return list;
+}
+
+static void iothread_schemas_cb(StatsSchemaList **result, Error **errp)
+{
+    StatsSchemaValueList *stats_list = NULL;
+
+    stats_list = iothread_schemas_add(stats_list, "poll-ns", true);
+    stats_list = iothread_schemas_add(stats_list, "poll-max-ns", true);
+    stats_list = iothread_schemas_add(stats_list, "poll-grow", false);
+    stats_list = iothread_schemas_add(stats_list, "poll-shrink", false);
+    stats_list = iothread_schemas_add(stats_list, "poll-disabled-handlers",
+                                      false);
+    stats_list = iothread_schemas_add(stats_list, "aio-max-batch", false);
+
+    add_stats_schema(result, STATS_PROVIDER_IOTHREAD, STATS_TARGET_VM,
+                     stats_list);
+}
+
+void iothread_stats_init(void)
+{
+    add_stats_callbacks(STATS_PROVIDER_IOTHREAD, iothread_stats_cb,
+                        iothread_schemas_cb);
+}
@@ -0,0 +1,93 @@
+/*
+ * Network client packet statistics
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * (at your option) any later version.
+ */
+
+#include "qemu/osdep.h"
+#include "net/net.h"
+#include "sysemu/stats.h"
+
+static const struct {
+    const char *name;
+    size_t offset;
+    bool bytes;
+} net_stats_fields[] = {
+    { "rx-packets", offsetof(NetClientState, rx_packets), false },
+    { "rx-bytes", offsetof(NetClientState, rx_bytes), true },
+    { "rx-dropped", offsetof(NetClientState, rx_dropped), false },
+    { "tx-packets", offsetof(NetClientState, tx_packets), false },
+    { "tx-bytes", offsetof(NetClientState, tx_bytes), true },
+};
+
+static void net_stats_cb(StatsResultList **result, StatsTarget target,
+                         strList *names, strList *targets, Error **errp)
+{
+    uint64_t values[ARRAY_SIZE(net_stats_fields)] = { 0 };
+    NetClientState *nc, *next;
+    int i;
+
+    if (target != STATS_TARGET_NET) {
+        return;
+    }
+
+    /* The queues of a multiqueue client are adjacent and share its name */
+    QTAILQ_FOREACH(nc, &net_clients, next) {
+        StatsList *stats_list = NULL;
+
+        for (i = 0; i < ARRAY_SIZE(net_stats_fields); i++) {
+            values[i] += stat64_get((void *)nc + net_stats_fields[i].offset);
+        }
+
+        next = QTAILQ_NEXT(nc, next);
+        if (next && g_str_equal(next->name, nc->name)) {
+            continue;
+        }
+
+        for (i = 0; i < ARRAY_SIZE(net_stats_fields); i++) {
+            Stats *stats;
+
+            if (!apply_str_list_filter(net_stats_fields[i].name, names)) {
+                continue;
+            }
+
+            stats = g_new0(Stats, 1);
+            stats->name = g_strdup(net_stats_fields[i].name);
+            stats->value = g_new0(StatsValue, 1);
+            stats->value->type = QTYPE_QNUM;
+            stats->value->u.scalar = values[i];
+            QAPI_LIST_PREPEND(stats_list, stats);
+        }
+        if (stats_list) {
+            add_stats_entry_id(result, STATS_PROVIDER_NET, NULL, nc->name,
+                               stats_list);
+        }
+        memset(values, 0, sizeof(values));
+    }
+}
+
+static void net_schemas_cb(StatsSchemaList **result, Error **errp)
+{
+    StatsSchemaValueList *stats_list = NULL;
+    int i;
+
+    for (i = 0; i < ARRAY_SIZE(net_stats_fields); i++) {
+        StatsSchemaValue *value = g_new0(StatsSchemaValue, 1);
+
+        value->name = g_strdup(net_stats_fields[i].name);
+        value->type = STATS_TYPE_CUMULATIVE;
+        if (net_stats_fields[i].bytes) {
+            value->has_unit = true;
+            value->unit = STATS_UNIT_BYTES;
+        }
+        QAPI_LIST_PREPEND(stats_list, value);
+    }
+
+    add_stats_schema(result, STATS_PROVIDER_NET, STATS_TARGET_NET, stats_list);
+}
+
+void net_stats_init(void)
+{
+    add_stats_callbacks(STATS_PROVIDER_NET, net_stats_cb, net_schemas_cb);
+}
@@ -0,0 +1,97 @@
+/*
+ * RCU grace period statistics
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * (at your option) any later version.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/rcu.h"
+#include "sysemu/stats.h"
+
+static StatsList *rcu_stats_add(StatsList *list, strList *names,
+                                const char *name, uint64_t value)
+{
+    Stats *stats;
+
+    if (!apply_str_list_filter(name, names)) {
+        return list;
+    }
+
+    stats = g_new0(Stats, 1);
+    stats->name = g_strdup(name);
+    stats->value = g_new0(StatsValue, 1);
+    stats->value->type = QTYPE_QNUM;
+    stats->value->u.scalar = value;
+    QAPI_LIST_PREPEND(list, stats);
+    return list;
+}
+
+static void rcu_stats_cb(StatsResultList **result, StatsTarget target,
+                         strList *names, strList *targets, Error **errp)
+{
+    StatsList *stats_list = NULL;
+    RCUStats stats;
+
+    if (target != STATS_TARGET_VM) {
+        return;
+    }
+
+    rcu_get_stats(&stats);
+    stats_list = rcu_stats_add(stats_list, names, "grace-periods",
+                               stats.grace_periods);
+    stats_list = rcu_stats_add(stats_list, names, "grace-period-time",
+                               stats.grace_period_ns);
+    stats_list = rcu_stats_add(stats_list, names, "grace-period-max",
+                               stats.grace_period_max_ns);
+    stats_list = rcu_stats_add(stats_list, names, "callbacks",
+                               stats.callbacks);
+    stats_list = rcu_stats_add(stats_list, names, "callbacks-pending",
+                               stats.callbacks_pending);
+
+    if (stats_list) {
+        add_stats_entry(result, STATS_PROVIDER_RCU, NULL, stats_list);
+    }
+}
+
+static StatsSchemaValueList *rcu_schemas_add(StatsSchemaValueList *list,
+                                             const char *name,
+                                             StatsType type, bool ns)
+{
+    StatsSchemaValue *value = g_new0(StatsSchemaValue, 1);
+
+    value->name = g_strdup(name);
+    value->type = type;
+    if (ns) {
+        value->has_unit = true;
+        value->unit = STATS_UNIT_SECONDS;
+        value->has_base = true;
+        value->base = 10;
+        value->exponent = -9;
+    }
+    QAPI_LIST_PREPEND(list, value);
+    return list;
+}
+
+static void rcu_schemas_cb(StatsSchemaList **result, Error **errp)
+{
+    StatsSchemaValueList *stats_list = NULL;
+
+    stats_list = rcu_schemas_add(stats_list, "grace-periods",
+                                 STATS_TYPE_CUMULATIVE, false);
+    stats_list = rcu_schemas_add(stats_list, "grace-period-time",
+                                 STATS_TYPE_CUMULATIVE, true);
+    stats_list = rcu_schemas_add(stats_list, "grace-period-max",
+                                 STATS_TYPE_PEAK, true);
+    stats_list = rcu_schemas_add(stats_list, "callbacks",
+                                 STATS_TYPE_CUMULATIVE, false);
+    stats_list = rcu_schemas_add(stats_list, "callbacks-pending",
+                                 STATS_TYPE_INSTANT, false);
+
+    add_stats_schema(result, STATS_PROVIDER_RCU, STATS_TARGET_VM, stats_list);
+}
+
+void rcu_stats_init(void)
+{
+    add_stats_callbacks(STATS_PROVIDER_RCU, rcu_stats_cb, rcu_schemas_cb);
+}
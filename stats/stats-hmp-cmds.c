@@ -91,6 +91,10 @@ static void print_stats_results(Monitor *mon, StatsTarget target,
         monitor_printf(mon, "provider: %s\n",
                        StatsProvider_str(result->provider));
     }
+    if (target != STATS_TARGET_VCPU && (result->id || result->qom_path)) {
+        monitor_printf(mon, "  %s:\n",
+                       result->id ? result->id : result->qom_path);
+    }
 
     for (stats_list = result->stats; stats_list;
              stats_list = stats_list->next,
@@ -156,6 +160,9 @@ static StatsFilter *stats_filter(StatsTarget target, const char *names,
         break;
     }
     case STATS_TARGET_CRYPTODEV:
+    case STATS_TARGET_BLOCK:
+    case STATS_TARGET_NET:
+    case STATS_TARGET_VIRTIO:
         break;
     default:
         break;
@@ -229,6 +236,9 @@ void hmp_info_stats(Monitor *mon, const QDict *qdict)
         filter = stats_filter(target, names, cpu_index, provider);
         break;
     case STATS_TARGET_CRYPTODEV:
+    case STATS_TARGET_BLOCK:
+    case STATS_TARGET_NET:
+    case STATS_TARGET_VIRTIO:
         filter = stats_filter(target, names, -1, provider);
         break;
     default:
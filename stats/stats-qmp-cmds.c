@@ -65,6 +65,9 @@ static bool invoke_stats_cb(StatsCallbacks *entry,
         }
         break;
     case STATS_TARGET_CRYPTODEV:
+    case STATS_TARGET_BLOCK:
+    case STATS_TARGET_NET:
+    case STATS_TARGET_VIRTIO:
         break;
     default:
         abort();
@@ -126,11 +129,19 @@ StatsSchemaList *qmp_query_stats_schemas(bool has_provider,
 
 void add_stats_entry(StatsResultList **stats_results, StatsProvider provider,
                      const char *qom_path, StatsList *stats_list)
+{
+    add_stats_entry_id(stats_results, provider, qom_path, NULL, stats_list);
+}
+
+void add_stats_entry_id(StatsResultList **stats_results,
+                        StatsProvider provider, const char *qom_path,
+                        const char *id, StatsList *stats_list)
 {
     StatsResult *entry = g_new0(StatsResult, 1);
 
     entry->provider = provider;
     entry->qom_path = g_strdup(qom_path);
+    entry->id = g_strdup(id);
     entry->stats = stats_list;
 
     QAPI_LIST_PREPEND(*stats_results, entry);
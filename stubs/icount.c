@@ -25,6 +25,15 @@ int64_t icount_get(void)
     abort();
     return 0;
 }
+int64_t icount_get_quantum(void)
+{
+    return 0;
+}
+int64_t icount_advance_to(int64_t icount)
+{
+    abort();
+    return 0;
+}
 int64_t icount_to_ns(int64_t icount)
 {
     abort();
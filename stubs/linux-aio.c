@@ -30,3 +30,9 @@ void laio_cleanup(LinuxAioState *s)
 {
     abort();
 }
+
+void laio_get_batch_info(LinuxAioState *s, uint64_t *batch,
+                         uint64_t *latency_ns)
+{
+    abort();
+}
@@ -0,0 +1,6 @@
+#include "qemu/osdep.h"
+#include "sysemu/startup-time.h"
+
+void startup_time_device(DeviceState *dev, int64_t ns)
+{
+}
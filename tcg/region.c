@@ -29,6 +29,7 @@
 #include "qemu/memalign.h"
 #include "qemu/cacheinfo.h"
 #include "qemu/qtree.h"
+#include "qemu/rcu.h"
 #include "qapi/error.h"
 #include "tcg/tcg.h"
 #include "exec/translation-block.h"
@@ -61,8 +62,28 @@ struct tcg_region_state {
     /* fields protected by the lock */
     size_t current; /* current region index */
     size_t agg_size_full; /* aggregate size of full regions */
+    /*
+     * Once all regions have been handed out, full regions are evicted
+     * oldest first: @full holds, as a ring, the regions that filled up
+     * and that no context uses anymore, @reclaimed those that were
+     * evicted and can be handed out again.
+     */
+    size_t *full;
+    size_t full_head;
+    size_t n_full;
+    size_t *reclaimed;
+    size_t n_reclaimed;
+    size_t n_evicting; /* evicted, waiting for an RCU grace period */
+    unsigned int generation; /* incremented by tcg_region_reset_all */
+    bool evict_needed;
 };
 
+/*
+ * Not worth it with fewer regions: each eviction would throw away too
+ * large a share of the code buffer.
+ */
+#define TCG_REGION_EVICT_MIN_REGIONS 8
+
 static struct tcg_region_state region;
 
 /*
@@ -288,6 +309,17 @@ size_t tcg_nb_tbs(void)
     return nb_tbs;
 }
 
+static void tcg_region_tree_reset(size_t idx)
+{
+    struct tcg_region_tree *rt = region_trees + idx * tree_size;
+
+    qemu_mutex_lock(&rt->lock);
+    /* Increment the refcount first so that destroy acts as a reset */
+    q_tree_ref(rt->tree);
+    q_tree_destroy(rt->tree);
+    qemu_mutex_unlock(&rt->lock);
+}
+
 static void tcg_region_tree_reset_all(void)
 {
     size_t i;
@@ -334,13 +366,28 @@ static void tcg_region_assign(TCGContext *s, size_t curr_region)
     s->code_gen_highwater = end - TCG_HIGHWATER;
 }
 
+static size_t tcg_region_idx(const void *p)
+{
+    ptrdiff_t offset = p - region.start_aligned;
+
+    return MIN(MAX(offset, 0) / region.stride, region.n - 1);
+}
+
+static size_t tcg_region_available__locked(void)
+{
+    return region.n - region.current + region.n_reclaimed + region.n_evicting;
+}
+
 static bool tcg_region_alloc__locked(TCGContext *s)
 {
-    if (region.current == region.n) {
+    if (region.current < region.n) {
+        tcg_region_assign(s, region.current);
+        region.current++;
+    } else if (region.n_reclaimed) {
+        tcg_region_assign(s, region.reclaimed[--region.n_reclaimed]);
+    } else {
         return true;
     }
-    tcg_region_assign(s, region.current);
-    region.current++;
     return false;
 }
 
@@ -354,15 +401,121 @@ bool tcg_region_alloc(TCGContext *s)
     /* read the region size now; alloc__locked will overwrite it on success */
     size_t size_full = s->code_gen_buffer_size;
 
+    /* the region being left behind, if any */
+    size_t prev = tcg_region_idx(s->code_gen_buffer);
+
     qemu_mutex_lock(&region.lock);
     err = tcg_region_alloc__locked(s);
     if (!err) {
         region.agg_size_full += size_full - TCG_HIGHWATER;
+        if (region.n >= TCG_REGION_EVICT_MIN_REGIONS) {
+            region.full[(region.full_head + region.n_full) % region.n] = prev;
+            region.n_full++;
+            if (tcg_region_available__locked() < region.n / 8) {
+                qatomic_set(&region.evict_needed, true);
+            }
+        }
     }
     qemu_mutex_unlock(&region.lock);
     return err;
 }
 
+/*
+ * Return true if the code buffer runs low on free regions, in which case
+ * tb_evict_region() should be called.  This only reads a flag, so that
+ * it can be checked before each translation.
+ */
+bool tcg_region_evict_needed(void)
+{
+    return qatomic_read(&region.evict_needed);
+}
+
+/*
+ * Pick the oldest full region for eviction.  The caller must invalidate
+ * all TBs of the region and then call tcg_region_evict_end().
+ *
+ * Returns true and sets @pidx and @pgen if there is a region to evict.
+ */
+bool tcg_region_evict_begin(size_t *pidx, unsigned int *pgen)
+{
+    bool ret = false;
+
+    qemu_mutex_lock(&region.lock);
+    if (region.n_full && tcg_region_available__locked() < region.n / 8) {
+        size_t idx = region.full[region.full_head];
+        void *start, *end;
+
+        region.full_head = (region.full_head + 1) % region.n;
+        region.n_full--;
+        region.n_evicting++;
+        tcg_region_bounds(idx, &start, &end);
+        region.agg_size_full -= end - start - TCG_HIGHWATER;
+        *pidx = idx;
+        *pgen = region.generation;
+        ret = true;
+    }
+    qatomic_set(&region.evict_needed,
+                region.n_full && tcg_region_available__locked() < region.n / 8);
+    qemu_mutex_unlock(&region.lock);
+    return ret;
+}
+
+static gboolean tcg_region_collect_tb(gpointer key, gpointer value,
+                                      gpointer data)
+{
+    g_ptr_array_add(data, value);
+    return false;
+}
+
+/*
+ * Return the TBs of region @idx.  They can not be invalidated with the
+ * region tree locked, because the invalidation of TBs on a page calls
+ * tcg_tb_lookup() with the page locked.
+ */
+GPtrArray *tcg_region_tbs(size_t idx)
+{
+    struct tcg_region_tree *rt = region_trees + idx * tree_size;
+    GPtrArray *tbs = g_ptr_array_new();
+
+    qemu_mutex_lock(&rt->lock);
+    q_tree_foreach(rt->tree, tcg_region_collect_tb, tbs);
+    qemu_mutex_unlock(&rt->lock);
+    return tbs;
+}
+
+typedef struct TCGRegionEviction {
+    struct rcu_head rcu;
+    size_t idx;
+    unsigned int generation;
+} TCGRegionEviction;
+
+static void tcg_region_evict_rcu(TCGRegionEviction *e)
+{
+    qemu_mutex_lock(&region.lock);
+    /* Unless the whole buffer was flushed meanwhile */
+    if (e->generation == region.generation) {
+        tcg_region_tree_reset(e->idx);
+        region.reclaimed[region.n_reclaimed++] = e->idx;
+        region.n_evicting--;
+    }
+    qemu_mutex_unlock(&region.lock);
+    g_free(e);
+}
+
+/*
+ * The TBs of region @idx are invalid and unreachable: hand the region out
+ * again once no vCPU can be executing them anymore.  vCPUs run TBs
+ * within an RCU read-side critical section, see cpu_exec().
+ */
+void tcg_region_evict_end(size_t idx, unsigned int generation)
+{
+    TCGRegionEviction *e = g_new(TCGRegionEviction, 1);
+
+    e->idx = idx;
+    e->generation = generation;
+    call_rcu(e, tcg_region_evict_rcu, rcu);
+}
+
 /*
  * Perform a context's first region allocation.
  * This function does _not_ increment region.agg_size_full.
@@ -389,6 +542,12 @@ void tcg_region_reset_all(void)
     qemu_mutex_lock(&region.lock);
     region.current = 0;
     region.agg_size_full = 0;
+    region.full_head = 0;
+    region.n_full = 0;
+    region.n_reclaimed = 0;
+    region.n_evicting = 0;
+    region.generation++;
+    qatomic_set(&region.evict_needed, false);
 
     for (i = 0; i < n_ctxs; i++) {
         TCGContext *s = qatomic_read(&tcg_ctxs[i]);
@@ -834,6 +993,8 @@ void tcg_region_init(size_t tb_size, int splitwx, unsigned max_cpus)
     }
 
     tcg_region_trees_init();
+    region.full = g_new(size_t, region.n);
+    region.reclaimed = g_new(size_t, region.n);
 
     /*
      * Leave the initial context initialized to the first region.
@@ -921,25 +921,21 @@ static void tcg_gen_atomic_cmpxchg_i64_int(TCGv_i64 retv, TCGTemp *addr,
 
     if ((memop & MO_SIZE) == MO_64) {
         gen_atomic_cx_i64 gen;
+        MemOpIdx oi;
+        TCGv_i64 a64;
 
         memop = tcg_canonicalize_memop(memop, 1, 0);
         gen = table_cmpxchg[memop & (MO_SIZE | MO_BSWAP)];
+        oi = make_memop_idx(memop, idx);
+        a64 = maybe_extend_addr64(addr);
         if (gen) {
-            MemOpIdx oi = make_memop_idx(memop, idx);
-            TCGv_i64 a64 = maybe_extend_addr64(addr);
             gen(retv, cpu_env, a64, cmpv, newv, tcg_constant_i32(oi));
-            maybe_free_addr64(a64);
-            return;
+        } else {
+            /* No host atomic: use the striped locks, or go serial. */
+            gen_helper_stripe_cmpxchgq(retv, cpu_env, a64, cmpv, newv,
+                                       tcg_constant_i32(oi));
         }
-
-        gen_helper_exit_atomic(cpu_env);
-
-        /*
-         * Produce a result for a well-formed opcode stream.  This satisfies
-         * liveness for set before used, which happens before this dead code
-         * is removed.
-         */
-        tcg_gen_movi_i64(retv, 0);
+        maybe_free_addr64(a64);
         return;
     }
 
@@ -1039,6 +1035,8 @@ static void tcg_gen_atomic_cmpxchg_i128_int(TCGv_i128 retv, TCGTemp *addr,
                                             TCGArg idx, MemOp memop)
 {
     gen_atomic_cx_i128 gen;
+    MemOpIdx oi;
+    TCGv_i64 a64;
 
     if (!(tcg_ctx->gen_tb->cflags & CF_PARALLEL)) {
         tcg_gen_nonatomic_cmpxchg_i128_int(retv, addr, cmpv, newv, idx, memop);
@@ -1046,23 +1044,16 @@ static void tcg_gen_atomic_cmpxchg_i128_int(TCGv_i128 retv, TCGTemp *addr,
     }
 
     gen = table_cmpxchg[memop & (MO_SIZE | MO_BSWAP)];
+    oi = make_memop_idx(memop, idx);
+    a64 = maybe_extend_addr64(addr);
     if (gen) {
-        MemOpIdx oi = make_memop_idx(memop, idx);
-        TCGv_i64 a64 = maybe_extend_addr64(addr);
         gen(retv, cpu_env, a64, cmpv, newv, tcg_constant_i32(oi));
-        maybe_free_addr64(a64);
-        return;
+    } else {
+        /* No host atomic: use the striped locks, or go serial. */
+        gen_helper_stripe_cmpxchgo(retv, cpu_env, a64, cmpv, newv,
+                                   tcg_constant_i32(oi));
     }
-
-    gen_helper_exit_atomic(cpu_env);
-
-    /*
-     * Produce a result for a well-formed opcode stream.  This satisfies
-     * liveness for set before used, which happens before this dead code
-     * is removed.
-     */
-    tcg_gen_movi_i64(TCGV128_LOW(retv), 0);
-    tcg_gen_movi_i64(TCGV128_HIGH(retv), 0);
+    maybe_free_addr64(a64);
 }
 
 void tcg_gen_atomic_cmpxchg_i128_chk(TCGv_i128 retv, TCGTemp *addr,
@@ -326,18 +326,70 @@ static void tci_qemu_st(CPUArchState *env, uint64_t taddr, uint64_t val,
     }
 }
 
+/*
+ * Call a helper selected for INDEX_op_tci_call_direct by the code generator:
+ * each argument is in its own 64-bit stack slot, so the helper can be called
+ * through a prototype with uint64_t arguments instead of through libffi.
+ */
+static uint64_t QEMU_DISABLE_CFI tci_call_direct(void *func, unsigned nargs,
+                                                 const uint64_t *a)
+{
+    QEMU_BUILD_BUG_ON(TCI_CALL_DIRECT_MAX_ARGS != 6);
+
+    switch (nargs) {
+    case 0:
+        return ((uint64_t (*)(void))func)();
+    case 1:
+        return ((uint64_t (*)(uint64_t))func)(a[0]);
+    case 2:
+        return ((uint64_t (*)(uint64_t, uint64_t))func)(a[0], a[1]);
+    case 3:
+        return ((uint64_t (*)(uint64_t, uint64_t, uint64_t))func)
+            (a[0], a[1], a[2]);
+    case 4:
+        return ((uint64_t (*)(uint64_t, uint64_t, uint64_t, uint64_t))func)
+            (a[0], a[1], a[2], a[3]);
+    case 5:
+        return ((uint64_t (*)(uint64_t, uint64_t, uint64_t, uint64_t,
+                              uint64_t))func)
+            (a[0], a[1], a[2], a[3], a[4]);
+    case 6:
+        return ((uint64_t (*)(uint64_t, uint64_t, uint64_t, uint64_t,
+                              uint64_t, uint64_t))func)
+            (a[0], a[1], a[2], a[3], a[4], a[5]);
+    default:
+        g_assert_not_reached();
+    }
+}
+
 #if TCG_TARGET_REG_BITS == 64
 # define CASE_32_64(x) \
         case glue(glue(INDEX_op_, x), _i64): \
         case glue(glue(INDEX_op_, x), _i32):
 # define CASE_64(x) \
         case glue(glue(INDEX_op_, x), _i64):
+# define DISPATCH_32_64(x) \
+        [glue(glue(INDEX_op_, x), _i64)] = &&glue(op_, x), \
+        [glue(glue(INDEX_op_, x), _i32)] = &&glue(op_, x),
 #else
 # define CASE_32_64(x) \
         case glue(glue(INDEX_op_, x), _i32):
 # define CASE_64(x)
+# define DISPATCH_32_64(x) \
+        [glue(glue(INDEX_op_, x), _i32)] = &&glue(op_, x),
 #endif
 
+/*
+ * The most frequent opcodes have a label besides their case, listed in the
+ * dispatch table of tcg_qemu_tb_exec(), and end with tci_next() instead of
+ * break.  This decodes the next instruction and jumps straight to its label,
+ * or to the switch for the other opcodes.  Each of them thus has its own
+ * indirect branch, which the host predicts much better than the single one
+ * at the top of the loop.
+ */
+#define tci_next() \
+    goto *dispatch[opc = extract32(insn = *tb_ptr++, 0, 8)]
+
 /* Interpret pseudo code in tb. */
 /*
  * Disable CFI checks.
@@ -347,6 +399,47 @@ static void tci_qemu_st(CPUArchState *env, uint64_t taddr, uint64_t val,
 uintptr_t QEMU_DISABLE_CFI tcg_qemu_tb_exec(CPUArchState *env,
                                             const void *v_tb_ptr)
 {
+    static const void *const dispatch[NB_OPS] = {
+        [0 ... NB_OPS - 1] = &&op_switch,
+        [INDEX_op_call] = &&op_call,
+        [INDEX_op_tci_call_direct] = &&op_tci_call_direct,
+        [INDEX_op_br] = &&op_br,
+        [INDEX_op_setcond_i32] = &&op_setcond_i32,
+        [INDEX_op_brcond_i32] = &&op_brcond_i32,
+        [INDEX_op_tci_movi] = &&op_tci_movi,
+        [INDEX_op_tci_movl] = &&op_tci_movl,
+        [INDEX_op_ld_i32] = &&op_ld32u,
+        [INDEX_op_st_i32] = &&op_st32,
+        [INDEX_op_shl_i32] = &&op_shl_i32,
+        [INDEX_op_shr_i32] = &&op_shr_i32,
+        [INDEX_op_sar_i32] = &&op_sar_i32,
+        [INDEX_op_goto_tb] = &&op_goto_tb,
+        DISPATCH_32_64(mov)
+        DISPATCH_32_64(ld8u)
+        DISPATCH_32_64(ld16u)
+        DISPATCH_32_64(st8)
+        DISPATCH_32_64(st16)
+        DISPATCH_32_64(add)
+        DISPATCH_32_64(sub)
+        DISPATCH_32_64(and)
+        DISPATCH_32_64(or)
+        DISPATCH_32_64(xor)
+#if TCG_TARGET_REG_BITS == 64
+        [INDEX_op_setcond_i64] = &&op_setcond_i64,
+        [INDEX_op_brcond_i64] = &&op_brcond_i64,
+        [INDEX_op_ld32u_i64] = &&op_ld32u,
+        [INDEX_op_ld_i64] = &&op_ld_i64,
+        [INDEX_op_st32_i64] = &&op_st32,
+        [INDEX_op_st_i64] = &&op_st_i64,
+        [INDEX_op_shl_i64] = &&op_shl_i64,
+        [INDEX_op_shr_i64] = &&op_shr_i64,
+        [INDEX_op_sar_i64] = &&op_sar_i64,
+        [INDEX_op_ext32s_i64] = &&op_ext32s,
+        [INDEX_op_ext_i32_i64] = &&op_ext32s,
+        [INDEX_op_ext32u_i64] = &&op_ext32u,
+        [INDEX_op_extu_i32_i64] = &&op_ext32u,
+#endif
+    };
     const uint32_t *tb_ptr = v_tb_ptr;
     tcg_target_ulong regs[TCG_TARGET_NB_REGS];
     uint64_t stack[(TCG_STATIC_CALL_ARGS_SIZE + TCG_STATIC_FRAME_SIZE)
@@ -373,8 +466,10 @@ uintptr_t QEMU_DISABLE_CFI tcg_qemu_tb_exec(CPUArchState *env,
         insn = *tb_ptr++;
         opc = extract32(insn, 0, 8);
 
+    op_switch:
         switch (opc) {
         case INDEX_op_call:
+        op_call:
             {
                 void *call_slots[MAX_CALL_IARGS];
                 ffi_cif *cif;
@@ -425,16 +520,28 @@ uintptr_t QEMU_DISABLE_CFI tcg_qemu_tb_exec(CPUArchState *env,
             default:
                 g_assert_not_reached();
             }
-            break;
+            tci_next();
+
+        case INDEX_op_tci_call_direct:
+        op_tci_call_direct:
+            tci_args_nl(insn, tb_ptr, &len, &ptr);
+            tci_tb_ptr = (uintptr_t)tb_ptr;
+            tmp64 = tci_call_direct(((void **)ptr)[0],
+                                    ((ffi_cif **)ptr)[1]->nargs, stack);
+            /* R0 is call-clobbered, so it is fine to write it for void */
+            regs[TCG_REG_R0] = len == 1 ? (uint32_t)tmp64 : tmp64;
+            tci_next();
 
         case INDEX_op_br:
+        op_br:
             tci_args_l(insn, tb_ptr, &ptr);
             tb_ptr = ptr;
-            continue;
+            tci_next();
         case INDEX_op_setcond_i32:
+        op_setcond_i32:
             tci_args_rrrc(insn, &r0, &r1, &r2, &condition);
             regs[r0] = tci_compare32(regs[r1], regs[r2], condition);
-            break;
+            tci_next();
         case INDEX_op_movcond_i32:
             tci_args_rrrrrc(insn, &r0, &r1, &r2, &r3, &r4, &condition);
             tmp32 = tci_compare32(regs[r1], regs[r2], condition);
@@ -449,9 +556,10 @@ uintptr_t QEMU_DISABLE_CFI tcg_qemu_tb_exec(CPUArchState *env,
             break;
 #elif TCG_TARGET_REG_BITS == 64
         case INDEX_op_setcond_i64:
+        op_setcond_i64:
             tci_args_rrrc(insn, &r0, &r1, &r2, &condition);
             regs[r0] = tci_compare64(regs[r1], regs[r2], condition);
-            break;
+            tci_next();
         case INDEX_op_movcond_i64:
             tci_args_rrrrrc(insn, &r0, &r1, &r2, &r3, &r4, &condition);
             tmp32 = tci_compare64(regs[r1], regs[r2], condition);
@@ -459,35 +567,40 @@ uintptr_t QEMU_DISABLE_CFI tcg_qemu_tb_exec(CPUArchState *env,
             break;
 #endif
         CASE_32_64(mov)
+        op_mov:
             tci_args_rr(insn, &r0, &r1);
             regs[r0] = regs[r1];
-            break;
+            tci_next();
         case INDEX_op_tci_movi:
+        op_tci_movi:
             tci_args_ri(insn, &r0, &t1);
             regs[r0] = t1;
-            break;
+            tci_next();
         case INDEX_op_tci_movl:
+        op_tci_movl:
             tci_args_rl(insn, tb_ptr, &r0, &ptr);
             regs[r0] = *(tcg_target_ulong *)ptr;
-            break;
+            tci_next();
 
             /* Load/store operations (32 bit). */
 
         CASE_32_64(ld8u)
+        op_ld8u:
             tci_args_rrs(insn, &r0, &r1, &ofs);
             ptr = (void *)(regs[r1] + ofs);
             regs[r0] = *(uint8_t *)ptr;
-            break;
+            tci_next();
         CASE_32_64(ld8s)
             tci_args_rrs(insn, &r0, &r1, &ofs);
             ptr = (void *)(regs[r1] + ofs);
             regs[r0] = *(int8_t *)ptr;
             break;
         CASE_32_64(ld16u)
+        op_ld16u:
             tci_args_rrs(insn, &r0, &r1, &ofs);
             ptr = (void *)(regs[r1] + ofs);
             regs[r0] = *(uint16_t *)ptr;
-            break;
+            tci_next();
         CASE_32_64(ld16s)
             tci_args_rrs(insn, &r0, &r1, &ofs);
             ptr = (void *)(regs[r1] + ofs);
@@ -495,53 +608,62 @@ uintptr_t QEMU_DISABLE_CFI tcg_qemu_tb_exec(CPUArchState *env,
             break;
         case INDEX_op_ld_i32:
         CASE_64(ld32u)
+        op_ld32u:
             tci_args_rrs(insn, &r0, &r1, &ofs);
             ptr = (void *)(regs[r1] + ofs);
             regs[r0] = *(uint32_t *)ptr;
-            break;
+            tci_next();
         CASE_32_64(st8)
+        op_st8:
             tci_args_rrs(insn, &r0, &r1, &ofs);
             ptr = (void *)(regs[r1] + ofs);
             *(uint8_t *)ptr = regs[r0];
-            break;
+            tci_next();
         CASE_32_64(st16)
+        op_st16:
             tci_args_rrs(insn, &r0, &r1, &ofs);
             ptr = (void *)(regs[r1] + ofs);
             *(uint16_t *)ptr = regs[r0];
-            break;
+            tci_next();
         case INDEX_op_st_i32:
         CASE_64(st32)
+        op_st32:
             tci_args_rrs(insn, &r0, &r1, &ofs);
             ptr = (void *)(regs[r1] + ofs);
             *(uint32_t *)ptr = regs[r0];
-            break;
+            tci_next();
 
             /* Arithmetic operations (mixed 32/64 bit). */
 
         CASE_32_64(add)
+        op_add:
             tci_args_rrr(insn, &r0, &r1, &r2);
             regs[r0] = regs[r1] + regs[r2];
-            break;
+            tci_next();
         CASE_32_64(sub)
+        op_sub:
             tci_args_rrr(insn, &r0, &r1, &r2);
             regs[r0] = regs[r1] - regs[r2];
-            break;
+            tci_next();
         CASE_32_64(mul)
             tci_args_rrr(insn, &r0, &r1, &r2);
             regs[r0] = regs[r1] * regs[r2];
             break;
         CASE_32_64(and)
+        op_and:
             tci_args_rrr(insn, &r0, &r1, &r2);
             regs[r0] = regs[r1] & regs[r2];
-            break;
+            tci_next();
         CASE_32_64(or)
+        op_or:
             tci_args_rrr(insn, &r0, &r1, &r2);
             regs[r0] = regs[r1] | regs[r2];
-            break;
+            tci_next();
         CASE_32_64(xor)
+        op_xor:
             tci_args_rrr(insn, &r0, &r1, &r2);
             regs[r0] = regs[r1] ^ regs[r2];
-            break;
+            tci_next();
 #if TCG_TARGET_HAS_andc_i32 || TCG_TARGET_HAS_andc_i64
         CASE_32_64(andc)
             tci_args_rrr(insn, &r0, &r1, &r2);
@@ -615,17 +737,20 @@ uintptr_t QEMU_DISABLE_CFI tcg_qemu_tb_exec(CPUArchState *env,
             /* Shift/rotate operations (32 bit). */
 
         case INDEX_op_shl_i32:
+        op_shl_i32:
             tci_args_rrr(insn, &r0, &r1, &r2);
             regs[r0] = (uint32_t)regs[r1] << (regs[r2] & 31);
-            break;
+            tci_next();
         case INDEX_op_shr_i32:
+        op_shr_i32:
             tci_args_rrr(insn, &r0, &r1, &r2);
             regs[r0] = (uint32_t)regs[r1] >> (regs[r2] & 31);
-            break;
+            tci_next();
         case INDEX_op_sar_i32:
+        op_sar_i32:
             tci_args_rrr(insn, &r0, &r1, &r2);
             regs[r0] = (int32_t)regs[r1] >> (regs[r2] & 31);
-            break;
+            tci_next();
 #if TCG_TARGET_HAS_rot_i32
         case INDEX_op_rotl_i32:
             tci_args_rrr(insn, &r0, &r1, &r2);
@@ -655,11 +780,12 @@ uintptr_t QEMU_DISABLE_CFI tcg_qemu_tb_exec(CPUArchState *env,
             break;
 #endif
         case INDEX_op_brcond_i32:
+        op_brcond_i32:
             tci_args_rl(insn, tb_ptr, &r0, &ptr);
             if ((uint32_t)regs[r0]) {
                 tb_ptr = ptr;
             }
-            break;
+            tci_next();
 #if TCG_TARGET_REG_BITS == 32 || TCG_TARGET_HAS_add2_i32
         case INDEX_op_add2_i32:
             tci_args_rrrrrr(insn, &r0, &r1, &r2, &r3, &r4, &r5);
@@ -748,15 +874,17 @@ uintptr_t QEMU_DISABLE_CFI tcg_qemu_tb_exec(CPUArchState *env,
             regs[r0] = *(int32_t *)ptr;
             break;
         case INDEX_op_ld_i64:
+        op_ld_i64:
             tci_args_rrs(insn, &r0, &r1, &ofs);
             ptr = (void *)(regs[r1] + ofs);
             regs[r0] = *(uint64_t *)ptr;
-            break;
+            tci_next();
         case INDEX_op_st_i64:
+        op_st_i64:
             tci_args_rrs(insn, &r0, &r1, &ofs);
             ptr = (void *)(regs[r1] + ofs);
             *(uint64_t *)ptr = regs[r0];
-            break;
+            tci_next();
 
             /* Arithmetic operations (64 bit). */
 
@@ -828,17 +956,20 @@ uintptr_t QEMU_DISABLE_CFI tcg_qemu_tb_exec(CPUArchState *env,
             /* Shift/rotate operations (64 bit). */
 
         case INDEX_op_shl_i64:
+        op_shl_i64:
             tci_args_rrr(insn, &r0, &r1, &r2);
             regs[r0] = regs[r1] << (regs[r2] & 63);
-            break;
+            tci_next();
         case INDEX_op_shr_i64:
+        op_shr_i64:
             tci_args_rrr(insn, &r0, &r1, &r2);
             regs[r0] = regs[r1] >> (regs[r2] & 63);
-            break;
+            tci_next();
         case INDEX_op_sar_i64:
+        op_sar_i64:
             tci_args_rrr(insn, &r0, &r1, &r2);
             regs[r0] = (int64_t)regs[r1] >> (regs[r2] & 63);
-            break;
+            tci_next();
 #if TCG_TARGET_HAS_rot_i64
         case INDEX_op_rotl_i64:
             tci_args_rrr(insn, &r0, &r1, &r2);
@@ -868,21 +999,24 @@ uintptr_t QEMU_DISABLE_CFI tcg_qemu_tb_exec(CPUArchState *env,
             break;
 #endif
         case INDEX_op_brcond_i64:
+        op_brcond_i64:
             tci_args_rl(insn, tb_ptr, &r0, &ptr);
             if (regs[r0]) {
                 tb_ptr = ptr;
             }
-            break;
+            tci_next();
         case INDEX_op_ext32s_i64:
         case INDEX_op_ext_i32_i64:
+        op_ext32s:
             tci_args_rr(insn, &r0, &r1);
             regs[r0] = (int32_t)regs[r1];
-            break;
+            tci_next();
         case INDEX_op_ext32u_i64:
         case INDEX_op_extu_i32_i64:
+        op_ext32u:
             tci_args_rr(insn, &r0, &r1);
             regs[r0] = (uint32_t)regs[r1];
-            break;
+            tci_next();
 #if TCG_TARGET_HAS_bswap64_i64
         case INDEX_op_bswap64_i64:
             tci_args_rr(insn, &r0, &r1);
@@ -898,9 +1032,10 @@ uintptr_t QEMU_DISABLE_CFI tcg_qemu_tb_exec(CPUArchState *env,
             return (uintptr_t)ptr;
 
         case INDEX_op_goto_tb:
+        op_goto_tb:
             tci_args_l(insn, tb_ptr, &ptr);
             tb_ptr = *(void **)ptr;
-            break;
+            tci_next();
 
         case INDEX_op_goto_ptr:
             tci_args_r(insn, &r0);
@@ -1089,6 +1224,7 @@ int print_insn_tci(bfd_vma addr, disassemble_info *info)
         break;
 
     case INDEX_op_call:
+    case INDEX_op_tci_call_direct:
         tci_args_nl(insn, tb_ptr, &len, &ptr);
         info->fprintf_func(info->stream, "%-12s  %d, %p", op_name, len, ptr);
         break;
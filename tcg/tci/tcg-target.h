@@ -161,6 +161,9 @@ typedef enum {
 #endif
 #define TCG_TARGET_CALL_RET_I128        TCG_CALL_RET_NORMAL
 
+/* Maximum number of arguments for INDEX_op_tci_call_direct. */
+#define TCI_CALL_DIRECT_MAX_ARGS        6
+
 #define HAVE_TCG_QEMU_TB_EXEC
 #define TCG_TARGET_NEED_POOL_LABELS
 
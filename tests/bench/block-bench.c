@@ -0,0 +1,312 @@
+/*
+ * Block layer request path benchmark
+ *
+ * Builds small block graphs in-process and keeps a fixed number of
+ * blk_aio_preadv/pwritev requests in flight against each of them, either
+ * from the main loop or from one graph per iothread.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * (at your option) any later version.  See the COPYING file in the
+ * top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "block/block.h"
+#include "block/block-global-state.h"
+#include "block/throttle-groups.h"
+#include "sysemu/block-backend.h"
+#include "qapi/error.h"
+#include "qapi/qmp/qdict.h"
+#include "qemu/main-loop.h"
+#include "qemu/timer.h"
+#include "qemu/units.h"
+#include "../unit/iothread.h"
+
+#define BENCH_DURATION_NS   NANOSECONDS_PER_SECOND
+#define BENCH_IMAGE_SIZE    (64 * MiB)
+#define BENCH_REQUEST_SIZE  (4 * KiB)
+#define BENCH_MAX_DEPTH     32
+#define BENCH_MAX_THREADS   4
+
+typedef enum {
+    BENCH_GRAPH_NULL_CO,
+    BENCH_GRAPH_NULL_AIO,
+    BENCH_GRAPH_THROTTLE,
+    BENCH_GRAPH_COPY_ON_READ,
+    BENCH_GRAPH_QCOW2,
+} BenchGraph;
+
+static const char *const bench_graph_names[] = {
+    [BENCH_GRAPH_NULL_CO] = "null-co",
+    [BENCH_GRAPH_NULL_AIO] = "null-aio",
+    [BENCH_GRAPH_THROTTLE] = "throttle",
+    [BENCH_GRAPH_COPY_ON_READ] = "copy-on-read",
+    [BENCH_GRAPH_QCOW2] = "qcow2",
+};
+
+typedef struct BenchCase {
+    BenchGraph graph;
+    bool write;
+    int depth;
+    int threads;        /* 0 for the main loop */
+} BenchCase;
+
+typedef struct BenchWorker BenchWorker;
+
+typedef struct BenchRequest {
+    BenchWorker *worker;
+    QEMUIOVector qiov;
+    void *buf;
+} BenchRequest;
+
+struct BenchWorker {
+    const BenchCase *bc;
+    BlockBackend *blk;
+    IOThread *iothread;
+    AioContext *ctx;
+    char *image;
+    int64_t deadline;
+    uint64_t ops;
+    int in_flight;
+    uint32_t seed;
+    QemuEvent done;
+    BenchRequest reqs[BENCH_MAX_DEPTH];
+};
+
+static char *bench_create_qcow2(void)
+{
+    char *filename;
+    int fd;
+
+    fd = g_file_open_tmp("block-bench-XXXXXX.qcow2", &filename, NULL);
+    g_assert(fd >= 0);
+    close(fd);
+    bdrv_img_create(filename, "qcow2", NULL, NULL, NULL, BENCH_IMAGE_SIZE,
+                    BDRV_O_RDWR, true, &error_abort);
+    return filename;
+}
+
+static BlockBackend *bench_open(BenchWorker *w, int index)
+{
+    QDict *options = qdict_new();
+    BlockBackend *blk;
+
+    switch (w->bc->graph) {
+    case BENCH_GRAPH_NULL_CO:
+    case BENCH_GRAPH_THROTTLE:
+        qdict_put_str(options, "driver", "null-co");
+        qdict_put_int(options, "size", BENCH_IMAGE_SIZE);
+        break;
+    case BENCH_GRAPH_NULL_AIO:
+        qdict_put_str(options, "driver", "null-aio");
+        qdict_put_int(options, "size", BENCH_IMAGE_SIZE);
+        break;
+    case BENCH_GRAPH_COPY_ON_READ:
+        qdict_put_str(options, "driver", "copy-on-read");
+        qdict_put_str(options, "file.driver", "null-co");
+        qdict_put_int(options, "file.size", BENCH_IMAGE_SIZE);
+        break;
+    case BENCH_GRAPH_QCOW2:
+        w->image = bench_create_qcow2();
+        qdict_put_str(options, "driver", "qcow2");
+        qdict_put_str(options, "file.driver", "file");
+        qdict_put_str(options, "file.filename", w->image);
+        break;
+    default:
+        g_assert_not_reached();
+    }
+
+    blk = blk_new_open(NULL, NULL, options, BDRV_O_RDWR, &error_abort);
+
+    if (w->bc->graph == BENCH_GRAPH_THROTTLE) {
+        g_autofree char *group = g_strdup_printf("bench%d", index);
+        ThrottleConfig cfg;
+
+        /* Limits high enough to never delay a request */
+        throttle_config_init(&cfg);
+        cfg.buckets[THROTTLE_OPS_TOTAL].avg = THROTTLE_VALUE_MAX;
+        blk_io_limits_enable(blk, group);
+        blk_set_io_limits(blk, &cfg);
+    } else if (w->bc->graph == BENCH_GRAPH_QCOW2) {
+        g_autofree void *buf = g_malloc0(64 * KiB);
+        int64_t offset;
+
+        /* Allocate every cluster so reads exercise the L2 lookup */
+        for (offset = 0; offset < BENCH_IMAGE_SIZE; offset += 64 * KiB) {
+            g_assert(blk_pwrite(blk, offset, 64 * KiB, buf, 0) >= 0);
+        }
+    }
+    return blk;
+}
+
+static void bench_submit(BenchRequest *req);
+
+static void bench_cb(void *opaque, int ret)
+{
+    BenchRequest *req = opaque;
+    BenchWorker *w = req->worker;
+
+    g_assert(ret >= 0);
+    w->ops++;
+    if (get_clock() < w->deadline) {
+        bench_submit(req);
+    } else if (--w->in_flight == 0) {
+        qemu_event_set(&w->done);
+    }
+}
+
+static void bench_submit(BenchRequest *req)
+{
+    BenchWorker *w = req->worker;
+    int64_t offset;
+
+    w->seed = w->seed * 1103515245 + 12345;
+    offset = (w->seed % (BENCH_IMAGE_SIZE / BENCH_REQUEST_SIZE)) *
+             BENCH_REQUEST_SIZE;
+    if (w->bc->write) {
+        blk_aio_pwritev(w->blk, offset, &req->qiov, 0, bench_cb, req);
+    } else {
+        blk_aio_preadv(w->blk, offset, &req->qiov, 0, bench_cb, req);
+    }
+}
+
+static void bench_start_bh(void *opaque)
+{
+    BenchWorker *w = opaque;
+    int i;
+
+    w->deadline = get_clock() + BENCH_DURATION_NS;
+    w->in_flight = w->bc->depth;
+    for (i = 0; i < w->bc->depth; i++) {
+        bench_submit(&w->reqs[i]);
+    }
+}
+
+static void bench_worker_init(BenchWorker *w, const BenchCase *bc, int index)
+{
+    int i;
+
+    w->bc = bc;
+    w->seed = index + 1;
+    qemu_event_init(&w->done, false);
+    for (i = 0; i < bc->depth; i++) {
+        w->reqs[i].worker = w;
+        w->reqs[i].buf = qemu_blockalign(NULL, BENCH_REQUEST_SIZE);
+        qemu_iovec_init_buf(&w->reqs[i].qiov, w->reqs[i].buf,
+                            BENCH_REQUEST_SIZE);
+    }
+
+    w->blk = bench_open(w, index);
+    if (bc->threads) {
+        w->iothread = iothread_new();
+        w->ctx = iothread_get_aio_context(w->iothread);
+        blk_set_aio_context(w->blk, w->ctx, &error_abort);
+    } else {
+        w->ctx = qemu_get_aio_context();
+    }
+}
+
+static void bench_worker_cleanup(BenchWorker *w)
+{
+    int i;
+
+    if (w->iothread) {
+        aio_context_acquire(w->ctx);
+        blk_set_aio_context(w->blk, qemu_get_aio_context(), &error_abort);
+        aio_context_release(w->ctx);
+        iothread_join(w->iothread);
+    }
+    if (w->bc->graph == BENCH_GRAPH_THROTTLE) {
+        blk_io_limits_disable(w->blk);
+    }
+    blk_unref(w->blk);
+    if (w->image) {
+        unlink(w->image);
+        g_free(w->image);
+    }
+    for (i = 0; i < w->bc->depth; i++) {
+        qemu_vfree(w->reqs[i].buf);
+    }
+    qemu_event_destroy(&w->done);
+}
+
+static void test_block_bench(const void *opaque)
+{
+    const BenchCase *bc = opaque;
+    int nworkers = MAX(bc->threads, 1);
+    BenchWorker *workers = g_new0(BenchWorker, nworkers);
+    uint64_t ops = 0;
+    double elapsed;
+    int i;
+
+    for (i = 0; i < nworkers; i++) {
+        bench_worker_init(&workers[i], bc, i);
+    }
+
+    g_test_timer_start();
+    if (!bc->threads) {
+        bench_start_bh(&workers[0]);
+        while (workers[0].in_flight) {
+            aio_poll(qemu_get_aio_context(), true);
+        }
+    } else {
+        for (i = 0; i < nworkers; i++) {
+            aio_bh_schedule_oneshot(workers[i].ctx, bench_start_bh,
+                                    &workers[i]);
+        }
+        for (i = 0; i < nworkers; i++) {
+            qemu_event_wait(&workers[i].done);
+        }
+    }
+    elapsed = g_test_timer_elapsed();
+
+    for (i = 0; i < nworkers; i++) {
+        ops += workers[i].ops;
+        bench_worker_cleanup(&workers[i]);
+    }
+    g_free(workers);
+
+    g_test_message("%s %s depth %d on %s: %.0f ops/s, %.0f ns/op",
+                   bench_graph_names[bc->graph],
+                   bc->write ? "write" : "read", bc->depth,
+                   bc->threads ? "iothreads" : "main loop",
+                   ops / elapsed, elapsed * nworkers * 1e9 / ops);
+}
+
+int main(int argc, char **argv)
+{
+    static const struct {
+        bool write;
+        int depth;
+        int threads;
+    } modes[] = {
+        { false, 1, 0 },
+        { false, BENCH_MAX_DEPTH, 0 },
+        { false, BENCH_MAX_DEPTH, BENCH_MAX_THREADS },
+        { true, BENCH_MAX_DEPTH, BENCH_MAX_THREADS },
+    };
+    BenchGraph graph;
+    int i;
+
+    bdrv_init();
+    qemu_init_main_loop(&error_abort);
+    g_test_init(&argc, &argv, NULL);
+
+    for (graph = 0; graph < ARRAY_SIZE(bench_graph_names); graph++) {
+        for (i = 0; i < ARRAY_SIZE(modes); i++) {
+            BenchCase *bc = g_new0(BenchCase, 1);
+            g_autofree char *path = NULL;
+
+            bc->graph = graph;
+            bc->write = modes[i].write;
+            bc->depth = modes[i].depth;
+            bc->threads = modes[i].threads;
+            path = g_strdup_printf("/block/%s/%s/depth%d/%s",
+                                   bench_graph_names[graph],
+                                   bc->write ? "write" : "read", bc->depth,
+                                   bc->threads ? "iothreads" : "main");
+            g_test_add_data_func_full(path, bc, test_block_bench, g_free);
+        }
+    }
+
+    return g_test_run();
+}
@@ -0,0 +1,71 @@
+/*
+ * CRC32C speed benchmark
+ *
+ * Compares every CRC32C implementation available on the host, from the
+ * hardware-accelerated ones down to the table lookup.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * (at your option) any later version.  See the COPYING file in the
+ * top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "qemu/units.h"
+#include "qemu/crc32c.h"
+
+static const size_t chunk_sizes[] = { 64, 512, 4096, 65536 };
+
+static double crc32c_speed(const uint8_t *in, size_t chunk_size)
+{
+    const size_t total = 1 * GiB;
+    size_t remain = total;
+    uint32_t crc = 0xffffffff;
+
+    g_test_timer_start();
+    while (remain) {
+        crc = crc32c(crc, in, chunk_size);
+        remain -= chunk_size;
+    }
+    return total / g_test_timer_elapsed() / MiB;
+}
+
+/*
+ * Each round checks that the implementation agrees with the previous one,
+ * then switches to the next until only the table lookup is left.
+ */
+static void test_crc32c_speed(void)
+{
+    const size_t max_size = chunk_sizes[ARRAY_SIZE(chunk_sizes) - 1];
+    uint8_t *in = g_malloc(max_size);
+    uint32_t ref = 0;
+    size_t i;
+    int accel = 0;
+
+    for (i = 0; i < max_size; i++) {
+        in[i] = g_test_rand_int();
+    }
+
+    do {
+        uint32_t crc = crc32c(0xffffffff, in, max_size);
+
+        if (accel == 0) {
+            ref = crc;
+        }
+        g_assert_cmphex(crc, ==, ref);
+
+        for (i = 0; i < ARRAY_SIZE(chunk_sizes); i++) {
+            g_test_message("crc32c(accel %d): chunk %zu bytes %.2f MB/sec",
+                           accel, chunk_sizes[i],
+                           crc32c_speed(in, chunk_sizes[i]));
+        }
+        accel++;
+    } while (test_crc32c_next_accel());
+
+    g_free(in);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/crc32c/benchmark", test_crc32c_speed);
+    return g_test_run();
+}
@@ -11,6 +11,7 @@
 #include "qemu/rcu.h"
 #include "qemu/xxhash.h"
 #include "qemu/memalign.h"
+#include "qemu/timer.h"
 
 struct thread_stats {
     size_t rd;
@@ -21,6 +22,11 @@ struct thread_stats {
     size_t not_rm;
     size_t rz;
     size_t not_rz;
+    /* latencies in ns, only gathered with -L */
+    uint64_t up_ns;
+    uint64_t up_max_ns;
+    uint64_t rz_ns;
+    uint64_t rz_max_ns;
 };
 
 struct thread_info {
@@ -61,6 +67,7 @@ static double resize_rate; /* 0.0 to 1.0 */
 static unsigned int n_rz_threads = 1;
 static QemuThread *rz_threads;
 static bool precompute_hash;
+static bool measure_latency;
 
 static double update_rate; /* 0.0 to 1.0 */
 static uint64_t update_threshold;
@@ -93,7 +100,9 @@ static const char commands_string[] =
     " -R = enable auto-resize\n"
     " -S = resize rate (0.0 to 100.0)\n"
     " -D = delay (in us) between potential resizes\n"
-    " -N = number of resize threads";
+    " -N = number of resize threads\n"
+    "\n"
+    " -L = measure the latency of updates and resizes";
 
 static void usage_complete(int argc, char *argv[])
 {
@@ -135,6 +144,25 @@ static uint64_t xorshift64star(uint64_t x)
     return x * UINT64_C(2685821657736338717);
 }
 
+static inline int64_t latency_start(void)
+{
+    return measure_latency ? get_clock() : 0;
+}
+
+static inline void latency_end(int64_t start, uint64_t *total, uint64_t *max)
+{
+    uint64_t delta;
+
+    if (!measure_latency) {
+        return;
+    }
+    delta = get_clock() - start;
+    *total += delta;
+    if (delta > *max) {
+        *max = delta;
+    }
+}
+
 static void do_rz(struct thread_info *info)
 {
     struct thread_stats *stats = &info->stats;
@@ -143,8 +171,11 @@ static void do_rz(struct thread_info *info)
     if (r < resize_threshold) {
         size_t size = info->resize_down ? resize_min : resize_max;
         bool resized;
+        int64_t t0;
 
+        t0 = latency_start();
         resized = qht_resize(&ht, size);
+        latency_end(t0, &stats->rz_ns, &stats->rz_max_ns);
         info->resize_down = !info->resize_down;
 
         if (resized) {
@@ -175,8 +206,11 @@ static void do_rw(struct thread_info *info)
             stats->not_rd++;
         }
     } else {
+        int64_t t0;
+
         p = &keys[r & (update_range - 1)];
         hash = hfunc(*p);
+        t0 = latency_start();
         if (info->write_op) {
             bool written = false;
 
@@ -200,6 +234,7 @@ static void do_rw(struct thread_info *info)
                 stats->not_rm++;
             }
         }
+        latency_end(t0, &stats->up_ns, &stats->up_max_ns);
         info->write_op = !info->write_op;
     }
 }
@@ -282,6 +317,7 @@ static void pr_params(void)
         printf(" # resize threads   %u\n", n_rz_threads);
     }
     printf(" update rate:       %f%%\n", update_rate * 100.0);
+    printf(" measure latency:   %s\n", measure_latency ? "on" : "off");
     printf(" offset:            %ld\n", populate_offset);
     printf(" initial key range: %zu\n", init_range);
     printf(" lookup range:      %lu\n", lookup_range);
@@ -384,6 +420,11 @@ static void add_stats(struct thread_stats *s, struct thread_info *info, int n)
 
         s->rz += stats->rz;
         s->not_rz += stats->not_rz;
+
+        s->up_ns += stats->up_ns;
+        s->up_max_ns = MAX(s->up_max_ns, stats->up_max_ns);
+        s->rz_ns += stats->rz_ns;
+        s->rz_max_ns = MAX(s->rz_max_ns, stats->rz_max_ns);
     }
 }
 
@@ -418,6 +459,20 @@ static void pr_stats(void)
     tx = (s.rd + s.not_rd + s.in + s.not_in + s.rm + s.not_rm) / 1e6 / duration;
     printf(" Throughput:        %.2f MT/s\n", tx);
     printf(" Throughput/thread: %.2f MT/s/thread\n", tx / n_rw_threads);
+
+    if (measure_latency) {
+        size_t n_up = s.in + s.not_in + s.rm + s.not_rm;
+        size_t n_rz = s.rz + s.not_rz;
+
+        if (n_up) {
+            printf(" Update latency:    avg %.2f us, max %.2f us\n",
+                   (double)s.up_ns / n_up / 1e3, s.up_max_ns / 1e3);
+        }
+        if (n_rz) {
+            printf(" Resize latency:    avg %.2f us, max %.2f us\n",
+                   (double)s.rz_ns / n_rz / 1e3, s.rz_max_ns / 1e3);
+        }
+    }
 }
 
 static void run_test(void)
@@ -445,7 +500,7 @@ static void parse_args(int argc, char *argv[])
     int c;
 
     for (;;) {
-        c = getopt(argc, argv, "d:D:g:k:K:l:hn:N:o:pr:Rs:S:u:");
+        c = getopt(argc, argv, "d:D:g:k:K:l:Lhn:N:o:pr:Rs:S:u:");
         if (c < 0) {
             break;
         }
@@ -475,6 +530,9 @@ static void parse_args(int argc, char *argv[])
         case 'l':
             lookup_range = pow2ceil(atol(optarg));
             break;
+        case 'L':
+            measure_latency = true;
+            break;
         case 'n':
             n_rw_threads = atoi(optarg);
             break;
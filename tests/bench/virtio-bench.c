@@ -0,0 +1,511 @@
+/*
+ * Virtqueue request path benchmark
+ *
+ * Starts a guest-less microvm under the qtest accelerator and drives its
+ * virtio-mmio devices directly: the benchmark plays the driver, lays out
+ * split or packed rings (optionally with indirect descriptors) in guest
+ * RAM and keeps posting full batches of requests.  Only the device model
+ * runs in the QEMU process, so the per-request figures are the cost of
+ * virtqueue processing plus the device backend.
+ *
+ * Where perf events are available, the QEMU main thread's user-space
+ * cycles and instructions are reported per request as well.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * (at your option) any later version.  See the COPYING file in the
+ * top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "qemu/bswap.h"
+#include "qemu/host-utils.h"
+#include "qemu/timer.h"
+#include "qemu/units.h"
+#include "../qtest/libqtest.h"
+#include "standard-headers/linux/virtio_blk.h"
+#include "standard-headers/linux/virtio_config.h"
+#include "standard-headers/linux/virtio_ids.h"
+#include "standard-headers/linux/virtio_mmio.h"
+#include "standard-headers/linux/virtio_ring.h"
+
+#ifdef CONFIG_LINUX
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+#define BENCH_DURATION_NS   NANOSECONDS_PER_SECOND
+
+/* microvm transports, see include/hw/i386/microvm.h */
+#define BENCH_MMIO_BASE     0xfeb00000
+#define BENCH_MMIO_STRIDE   512
+#define BENCH_MMIO_MAX      24
+
+/* Guest physical layout; the rings never exceed 256 entries */
+#define BENCH_MAX_QSIZE     256
+#define BENCH_RING_ADDR     0x100000    /* split descriptors or packed ring */
+#define BENCH_AVAIL_ADDR    0x101000    /* avail ring or driver event */
+#define BENCH_USED_ADDR     0x102000    /* used ring or device event */
+#define BENCH_INDIRECT_ADDR 0x110000    /* 64 bytes per request */
+#define BENCH_HDR_ADDR      0x120000    /* 16 bytes per request */
+#define BENCH_STATUS_ADDR   0x130000    /* 1 byte per request */
+#define BENCH_DATA_ADDR     0x200000    /* 4 KiB per request */
+
+#define BENCH_MAX_SEGS      3
+
+typedef enum {
+    BENCH_DEV_BLK,
+    BENCH_DEV_NET,
+} BenchDevice;
+
+typedef struct BenchDeviceInfo {
+    const char *name;
+    const char *type;
+    const char *args;       /* must end with the -device option */
+    uint32_t device_id;
+    int queue;
+} BenchDeviceInfo;
+
+static const BenchDeviceInfo bench_devices[] = {
+    [BENCH_DEV_BLK] = {
+        .name = "virtio-blk",
+        .type = "virtio-blk-device",
+        .args = "-blockdev driver=null-co,node-name=bench,size=64M "
+                "-device virtio-blk-device,drive=bench",
+        .device_id = VIRTIO_ID_BLOCK,
+        .queue = 0,
+    },
+    [BENCH_DEV_NET] = {
+        /* No peer: transmitted frames are dropped once they leave the NIC */
+        .name = "virtio-net-tx",
+        .type = "virtio-net-device",
+        .args = "-device virtio-net-device",
+        .device_id = VIRTIO_ID_NET,
+        .queue = 1,
+    },
+};
+
+typedef struct BenchCase {
+    BenchDevice device;
+    bool packed;
+    bool indirect;
+} BenchCase;
+
+typedef struct BenchSeg {
+    uint64_t addr;
+    uint32_t len;
+    uint16_t flags;
+} BenchSeg;
+
+typedef struct BenchState {
+    const BenchCase *bc;
+    QTestState *qts;
+    uint64_t base;
+    int qsize;
+    int nsegs;
+    int batch;
+
+    /* split ring */
+    uint16_t avail_idx;
+
+    /* packed ring */
+    int next_slot;
+    bool wrap;
+    struct vring_packed_desc ring[BENCH_MAX_QSIZE];
+} BenchState;
+
+static int bench_segs(const BenchCase *bc, int req, BenchSeg *segs)
+{
+    switch (bc->device) {
+    case BENCH_DEV_BLK:
+        segs[0] = (BenchSeg) { BENCH_HDR_ADDR + req * 16, 16, 0 };
+        segs[1] = (BenchSeg) { BENCH_DATA_ADDR + req * 4 * KiB, 4 * KiB,
+                               VRING_DESC_F_WRITE };
+        segs[2] = (BenchSeg) { BENCH_STATUS_ADDR + req, 1,
+                               VRING_DESC_F_WRITE };
+        return 3;
+    case BENCH_DEV_NET:
+        /* virtio_net_hdr_mrg_rxbuf, then an Ethernet frame */
+        segs[0] = (BenchSeg) { BENCH_HDR_ADDR + req * 16, 12, 0 };
+        segs[1] = (BenchSeg) { BENCH_DATA_ADDR + req * 4 * KiB, 1514, 0 };
+        return 2;
+    default:
+        g_assert_not_reached();
+    }
+}
+
+static void bench_fill_desc(struct vring_desc *desc, const BenchSeg *seg,
+                            uint16_t flags, uint16_t next)
+{
+    desc->addr = cpu_to_le64(seg->addr);
+    desc->len = cpu_to_le32(seg->len);
+    desc->flags = cpu_to_le16(seg->flags | flags);
+    desc->next = cpu_to_le16(next);
+}
+
+/* Request headers and indirect tables never change, write them once */
+static void bench_setup_requests(BenchState *s)
+{
+    int i, j;
+
+    for (i = 0; i < s->batch; i++) {
+        BenchSeg segs[BENCH_MAX_SEGS];
+        int n = bench_segs(s->bc, i, segs);
+
+        if (s->bc->device == BENCH_DEV_BLK) {
+            struct virtio_blk_outhdr hdr = {
+                .type = cpu_to_le32(VIRTIO_BLK_T_IN),
+                .sector = cpu_to_le64(i * 8),
+            };
+            qtest_memwrite(s->qts, segs[0].addr, &hdr, sizeof(hdr));
+        }
+
+        if (s->bc->indirect) {
+            struct vring_desc table[BENCH_MAX_SEGS];
+
+            for (j = 0; j < n; j++) {
+                bench_fill_desc(&table[j], &segs[j],
+                                j < n - 1 ? VRING_DESC_F_NEXT : 0, j + 1);
+            }
+            qtest_memwrite(s->qts, BENCH_INDIRECT_ADDR + i * 64, table,
+                           n * sizeof(table[0]));
+        }
+    }
+}
+
+/* The segments of request @req as they appear in the ring */
+static int bench_ring_segs(BenchState *s, int req, BenchSeg *segs)
+{
+    if (s->bc->indirect) {
+        segs[0] = (BenchSeg) { BENCH_INDIRECT_ADDR + req * 64,
+                               s->nsegs * sizeof(struct vring_desc),
+                               VRING_DESC_F_INDIRECT };
+        return 1;
+    }
+    return bench_segs(s->bc, req, segs);
+}
+
+static void bench_split_init(BenchState *s)
+{
+    struct vring_desc desc[BENCH_MAX_QSIZE] = {};
+    g_autofree uint16_t *avail = g_new0(uint16_t, 2 + s->qsize);
+    int i, j, slot = 0;
+
+    for (i = 0; i < s->batch; i++) {
+        BenchSeg segs[BENCH_MAX_SEGS];
+        int n = bench_ring_segs(s, i, segs);
+
+        for (j = 0; j < n; j++, slot++) {
+            bench_fill_desc(&desc[slot], &segs[j],
+                            j < n - 1 ? VRING_DESC_F_NEXT : 0, slot + 1);
+        }
+    }
+    qtest_memwrite(s->qts, BENCH_RING_ADDR, desc, slot * sizeof(desc[0]));
+
+    /*
+     * The batch divides the queue size, so each avail ring slot always
+     * names the same chain and only the index has to move.
+     */
+    avail[0] = cpu_to_le16(VRING_AVAIL_F_NO_INTERRUPT);
+    for (i = 0; i < s->qsize; i++) {
+        avail[2 + i] = cpu_to_le16((i % s->batch) * (slot / s->batch));
+    }
+    qtest_memwrite(s->qts, BENCH_AVAIL_ADDR, avail,
+                   (2 + s->qsize) * sizeof(uint16_t));
+}
+
+static void bench_split_run_batch(BenchState *s)
+{
+    s->avail_idx += s->batch;
+    qtest_writew(s->qts, BENCH_AVAIL_ADDR + 2, s->avail_idx);
+    qtest_writel(s->qts, s->base + VIRTIO_MMIO_QUEUE_NOTIFY,
+                 bench_devices[s->bc->device].queue);
+    while (qtest_readw(s->qts, BENCH_USED_ADDR + 2) != s->avail_idx) {
+        /* completions run from bottom halves in the QEMU main loop */
+    }
+}
+
+static void bench_packed_init(BenchState *s)
+{
+    uint16_t event[2] = { 0, cpu_to_le16(VRING_PACKED_EVENT_FLAG_DISABLE) };
+
+    s->next_slot = 0;
+    s->wrap = true;
+    qtest_memwrite(s->qts, BENCH_AVAIL_ADDR, event, sizeof(event));
+}
+
+static void bench_packed_write(BenchState *s, int first, int count)
+{
+    int n = MIN(count, s->qsize - first);
+
+    qtest_memwrite(s->qts, BENCH_RING_ADDR + first * sizeof(s->ring[0]),
+                   &s->ring[first], n * sizeof(s->ring[0]));
+    if (n < count) {
+        qtest_memwrite(s->qts, BENCH_RING_ADDR, &s->ring[0],
+                       (count - n) * sizeof(s->ring[0]));
+    }
+}
+
+/*
+ * The whole batch is written before the kick, and qtest has no ioeventfd,
+ * so the device cannot observe a half-built chain; a real driver would
+ * have to publish each head's flags last.
+ */
+static void bench_packed_run_batch(BenchState *s)
+{
+    int first = s->next_slot;
+    int count = 0;
+    int last_head = 0;
+    bool last_wrap = false;
+    uint16_t flags;
+    int i, j;
+
+    for (i = 0; i < s->batch; i++) {
+        BenchSeg segs[BENCH_MAX_SEGS];
+        int n = bench_ring_segs(s, i, segs);
+
+        last_head = s->next_slot;
+        last_wrap = s->wrap;
+        for (j = 0; j < n; j++) {
+            struct vring_packed_desc *desc = &s->ring[s->next_slot];
+            uint16_t f = segs[j].flags | (j < n - 1 ? VRING_DESC_F_NEXT : 0);
+
+            f |= s->wrap ? 1 << VRING_PACKED_DESC_F_AVAIL
+                         : 1 << VRING_PACKED_DESC_F_USED;
+            desc->addr = cpu_to_le64(segs[j].addr);
+            desc->len = cpu_to_le32(segs[j].len);
+            desc->id = cpu_to_le16(i);
+            desc->flags = cpu_to_le16(f);
+            if (++s->next_slot == s->qsize) {
+                s->next_slot = 0;
+                s->wrap = !s->wrap;
+            }
+            count++;
+        }
+    }
+    bench_packed_write(s, first, count);
+
+    qtest_writel(s->qts, s->base + VIRTIO_MMIO_QUEUE_NOTIFY,
+                 bench_devices[s->bc->device].queue);
+
+    /*
+     * All chains have the same length, so the device writes its last used
+     * element exactly over the head of the last chain.
+     */
+    do {
+        flags = qtest_readw(s->qts, BENCH_RING_ADDR +
+                            last_head * sizeof(s->ring[0]) +
+                            offsetof(struct vring_packed_desc, flags));
+    } while (!!(flags & (1 << VRING_PACKED_DESC_F_USED)) != last_wrap);
+}
+
+static uint64_t bench_probe(QTestState *qts, uint32_t device_id)
+{
+    int i;
+
+    for (i = 0; i < BENCH_MMIO_MAX; i++) {
+        uint64_t base = BENCH_MMIO_BASE + i * BENCH_MMIO_STRIDE;
+
+        if (qtest_readl(qts, base + VIRTIO_MMIO_MAGIC_VALUE) == 0x74726976 &&
+            qtest_readl(qts, base + VIRTIO_MMIO_DEVICE_ID) == device_id) {
+            g_assert_cmpuint(qtest_readl(qts, base + VIRTIO_MMIO_VERSION),
+                             ==, 2);
+            return base;
+        }
+    }
+    g_assert_not_reached();
+}
+
+static void bench_device_init(BenchState *s)
+{
+    QTestState *qts = s->qts;
+    uint64_t base = s->base;
+    BenchSeg segs[BENCH_MAX_SEGS];
+    uint64_t features, wanted;
+    uint32_t status;
+
+    wanted = 1ull << VIRTIO_F_VERSION_1;
+    if (s->bc->indirect) {
+        wanted |= 1ull << VIRTIO_RING_F_INDIRECT_DESC;
+    }
+    if (s->bc->packed) {
+        wanted |= 1ull << VIRTIO_F_RING_PACKED;
+    }
+
+    status = VIRTIO_CONFIG_S_ACKNOWLEDGE | VIRTIO_CONFIG_S_DRIVER;
+    qtest_writel(qts, base + VIRTIO_MMIO_STATUS, status);
+
+    qtest_writel(qts, base + VIRTIO_MMIO_DEVICE_FEATURES_SEL, 0);
+    features = qtest_readl(qts, base + VIRTIO_MMIO_DEVICE_FEATURES);
+    qtest_writel(qts, base + VIRTIO_MMIO_DEVICE_FEATURES_SEL, 1);
+    features |= (uint64_t)qtest_readl(qts, base + VIRTIO_MMIO_DEVICE_FEATURES)
+                << 32;
+    g_assert_cmphex(features & wanted, ==, wanted);
+
+    qtest_writel(qts, base + VIRTIO_MMIO_DRIVER_FEATURES_SEL, 0);
+    qtest_writel(qts, base + VIRTIO_MMIO_DRIVER_FEATURES, wanted);
+    qtest_writel(qts, base + VIRTIO_MMIO_DRIVER_FEATURES_SEL, 1);
+    qtest_writel(qts, base + VIRTIO_MMIO_DRIVER_FEATURES, wanted >> 32);
+    status |= VIRTIO_CONFIG_S_FEATURES_OK;
+    qtest_writel(qts, base + VIRTIO_MMIO_STATUS, status);
+    g_assert(qtest_readl(qts, base + VIRTIO_MMIO_STATUS) &
+             VIRTIO_CONFIG_S_FEATURES_OK);
+
+    qtest_writel(qts, base + VIRTIO_MMIO_QUEUE_SEL,
+                 bench_devices[s->bc->device].queue);
+    s->qsize = MIN(qtest_readl(qts, base + VIRTIO_MMIO_QUEUE_NUM_MAX),
+                   BENCH_MAX_QSIZE);
+    g_assert(s->qsize > 0);
+    s->nsegs = bench_segs(s->bc, 0, segs);
+    s->batch = pow2floor(s->qsize / (s->bc->indirect ? 1 : s->nsegs));
+
+    bench_setup_requests(s);
+    if (s->bc->packed) {
+        bench_packed_init(s);
+    } else {
+        bench_split_init(s);
+    }
+
+    qtest_writel(qts, base + VIRTIO_MMIO_QUEUE_NUM, s->qsize);
+    qtest_writel(qts, base + VIRTIO_MMIO_QUEUE_DESC_LOW, BENCH_RING_ADDR);
+    qtest_writel(qts, base + VIRTIO_MMIO_QUEUE_DESC_HIGH, 0);
+    qtest_writel(qts, base + VIRTIO_MMIO_QUEUE_AVAIL_LOW, BENCH_AVAIL_ADDR);
+    qtest_writel(qts, base + VIRTIO_MMIO_QUEUE_AVAIL_HIGH, 0);
+    qtest_writel(qts, base + VIRTIO_MMIO_QUEUE_USED_LOW, BENCH_USED_ADDR);
+    qtest_writel(qts, base + VIRTIO_MMIO_QUEUE_USED_HIGH, 0);
+    qtest_writel(qts, base + VIRTIO_MMIO_QUEUE_READY, 1);
+
+    status |= VIRTIO_CONFIG_S_DRIVER_OK;
+    qtest_writel(qts, base + VIRTIO_MMIO_STATUS, status);
+}
+
+#ifdef CONFIG_LINUX
+static int bench_perf_open(pid_t pid, uint64_t config)
+{
+    struct perf_event_attr attr = {
+        .type = PERF_TYPE_HARDWARE,
+        .size = sizeof(attr),
+        .config = config,
+        .exclude_kernel = 1,
+        .exclude_hv = 1,
+    };
+
+    /* Only the main thread, which is where virtqueues are processed */
+    return syscall(__NR_perf_event_open, &attr, pid, -1, -1, 0);
+}
+
+static uint64_t bench_perf_read(int fd)
+{
+    uint64_t val = 0;
+
+    if (fd >= 0 && read(fd, &val, sizeof(val)) != sizeof(val)) {
+        val = 0;
+    }
+    return val;
+}
+#endif
+
+static void test_virtio_bench(const void *opaque)
+{
+    const BenchCase *bc = opaque;
+    const BenchDeviceInfo *info = &bench_devices[bc->device];
+    g_autofree char *args = NULL;
+    BenchState *s = g_new0(BenchState, 1);
+    uint64_t reqs = 0;
+    int64_t deadline;
+    double elapsed;
+#ifdef CONFIG_LINUX
+    uint64_t cycles, insns;
+    int cycles_fd, insns_fd;
+#endif
+
+    args = g_strdup_printf("-M microvm -m 256M "
+                           "-global virtio-mmio.force-legacy=false "
+                           "%s,packed=%s",
+                           info->args, bc->packed ? "on" : "off");
+
+    s->bc = bc;
+    s->qts = qtest_init(args);
+    s->base = bench_probe(s->qts, info->device_id);
+    bench_device_init(s);
+
+    /* Warm up, then measure whole batches until the deadline passes */
+    if (bc->packed) {
+        bench_packed_run_batch(s);
+    } else {
+        bench_split_run_batch(s);
+    }
+
+#ifdef CONFIG_LINUX
+    cycles_fd = bench_perf_open(qtest_pid(s->qts), PERF_COUNT_HW_CPU_CYCLES);
+    insns_fd = bench_perf_open(qtest_pid(s->qts), PERF_COUNT_HW_INSTRUCTIONS);
+    cycles = bench_perf_read(cycles_fd);
+    insns = bench_perf_read(insns_fd);
+#endif
+
+    g_test_timer_start();
+    deadline = get_clock() + BENCH_DURATION_NS;
+    do {
+        if (bc->packed) {
+            bench_packed_run_batch(s);
+        } else {
+            bench_split_run_batch(s);
+        }
+        reqs += s->batch;
+    } while (get_clock() < deadline);
+    elapsed = g_test_timer_elapsed();
+
+    g_test_message("%s %s%s batch %d: %.0f req/s, %.0f ns/req",
+                   info->name, bc->packed ? "packed" : "split",
+                   bc->indirect ? " indirect" : "", s->batch,
+                   reqs / elapsed, elapsed * 1e9 / reqs);
+
+#ifdef CONFIG_LINUX
+    if (cycles_fd >= 0 && insns_fd >= 0) {
+        cycles = bench_perf_read(cycles_fd) - cycles;
+        insns = bench_perf_read(insns_fd) - insns;
+        g_test_message("  main thread: %.0f cycles/req, %.0f insns/req",
+                       (double)cycles / reqs, (double)insns / reqs);
+    }
+    if (cycles_fd >= 0) {
+        close(cycles_fd);
+    }
+    if (insns_fd >= 0) {
+        close(insns_fd);
+    }
+#endif
+
+    qtest_quit(s->qts);
+    g_free(s);
+}
+
+int main(int argc, char **argv)
+{
+    BenchDevice device;
+    int i;
+
+    g_test_init(&argc, &argv, NULL);
+
+    if (!qtest_has_machine("microvm")) {
+        return g_test_run();
+    }
+
+    for (device = 0; device < ARRAY_SIZE(bench_devices); device++) {
+        if (!qtest_has_device(bench_devices[device].type)) {
+            continue;
+        }
+        for (i = 0; i < 4; i++) {
+            BenchCase *bc = g_new0(BenchCase, 1);
+            g_autofree char *path = NULL;
+
+            bc->device = device;
+            bc->packed = i & 1;
+            bc->indirect = i & 2;
+            path = g_strdup_printf("/virtio/%s/%s%s",
+                                   bench_devices[device].name,
+                                   bc->packed ? "packed" : "split",
+                                   bc->indirect ? "/indirect" : "");
+            g_test_add_data_func_full(path, bc, test_virtio_bench, g_free);
+        }
+    }
+
+    return g_test_run();
+}
@@ -0,0 +1,145 @@
+/*
+ * Xor Based Zero Run Length Encoding speed benchmark
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "qemu/units.h"
+#include "../migration/xbzrle.h"
+
+#define XBZRLE_PAGE_SIZE 4096
+#define BENCH_PAGES 1024
+
+typedef struct {
+    /* one byte out of every @stride is changed */
+    int stride;
+    /* length of each changed run */
+    int run;
+} XBZRLEBenchOpts;
+
+static uint8_t *old_pages, *new_pages;
+
+static void bench_prepare(const XBZRLEBenchOpts *opts)
+{
+    int i, j;
+
+    old_pages = g_malloc(BENCH_PAGES * XBZRLE_PAGE_SIZE);
+    new_pages = g_malloc(BENCH_PAGES * XBZRLE_PAGE_SIZE);
+    for (i = 0; i < BENCH_PAGES * XBZRLE_PAGE_SIZE; i++) {
+        old_pages[i] = g_test_rand_int();
+    }
+    memcpy(new_pages, old_pages, BENCH_PAGES * XBZRLE_PAGE_SIZE);
+    for (i = 0; i < BENCH_PAGES * XBZRLE_PAGE_SIZE; i += opts->stride) {
+        for (j = i; j < i + opts->run && j < BENCH_PAGES * XBZRLE_PAGE_SIZE;
+             j++) {
+            new_pages[j] ^= 0x5a;
+        }
+    }
+}
+
+static void bench_free(void)
+{
+    g_free(old_pages);
+    g_free(new_pages);
+}
+
+static const XBZRLEBenchOpts bench_opts[] = {
+    { .stride = XBZRLE_PAGE_SIZE, .run = 8 },
+    { .stride = 512, .run = 8 },
+    { .stride = 64, .run = 4 },
+    { .stride = 8, .run = 1 },
+};
+
+static void test_xbzrle_decode_speed(const void *opaque)
+{
+    const XBZRLEBenchOpts *opts = opaque;
+    uint8_t *encoded = g_malloc(BENCH_PAGES * XBZRLE_PAGE_SIZE);
+    uint8_t *dst = g_malloc(XBZRLE_PAGE_SIZE);
+    int *len = g_new(int, BENCH_PAGES);
+    const size_t total = 1 * GiB;
+    size_t done;
+    int i;
+
+    bench_prepare(opts);
+    for (i = 0; i < BENCH_PAGES; i++) {
+        len[i] = xbzrle_encode_buffer(old_pages + i * XBZRLE_PAGE_SIZE,
+                                      new_pages + i * XBZRLE_PAGE_SIZE,
+                                      XBZRLE_PAGE_SIZE,
+                                      encoded + i * XBZRLE_PAGE_SIZE,
+                                      XBZRLE_PAGE_SIZE);
+    }
+
+    g_test_timer_start();
+    for (done = 0; done < total; done += BENCH_PAGES * XBZRLE_PAGE_SIZE) {
+        for (i = 0; i < BENCH_PAGES; i++) {
+            if (len[i] > 0) {
+                memcpy(dst, old_pages + i * XBZRLE_PAGE_SIZE,
+                       XBZRLE_PAGE_SIZE);
+                xbzrle_decode_buffer(encoded + i * XBZRLE_PAGE_SIZE, len[i],
+                                     dst, XBZRLE_PAGE_SIZE);
+            }
+        }
+    }
+    g_test_timer_elapsed();
+    g_test_message("decode: stride %d run %d %.2f MB/sec",
+                   opts->stride, opts->run,
+                   total / MiB / g_test_timer_last());
+
+    bench_free();
+    g_free(encoded);
+    g_free(dst);
+    g_free(len);
+}
+
+static void test_xbzrle_encode_speed(void)
+{
+    uint8_t *encoded = g_malloc(XBZRLE_PAGE_SIZE);
+    const size_t total = 1 * GiB;
+    size_t done;
+    int i, j;
+
+    do {
+        for (j = 0; j < ARRAY_SIZE(bench_opts); j++) {
+            const XBZRLEBenchOpts *opts = &bench_opts[j];
+
+            bench_prepare(opts);
+            g_test_timer_start();
+            for (done = 0; done < total;
+                 done += BENCH_PAGES * XBZRLE_PAGE_SIZE) {
+                for (i = 0; i < BENCH_PAGES; i++) {
+                    xbzrle_encode_buffer(old_pages + i * XBZRLE_PAGE_SIZE,
+                                         new_pages + i * XBZRLE_PAGE_SIZE,
+                                         XBZRLE_PAGE_SIZE, encoded,
+                                         XBZRLE_PAGE_SIZE);
+                }
+            }
+            g_test_timer_elapsed();
+            g_test_message("encode(%s): stride %d run %d %.2f MB/sec",
+                           xbzrle_encode_accel_name(), opts->stride,
+                           opts->run, total / MiB / g_test_timer_last());
+            bench_free();
+        }
+    } while (test_xbzrle_encode_next_accel());
+
+    g_free(encoded);
+}
+
+int main(int argc, char **argv)
+{
+    char name[64];
+    int i;
+
+    g_test_init(&argc, &argv, NULL);
+
+    for (i = 0; i < ARRAY_SIZE(bench_opts); i++) {
+        snprintf(name, sizeof(name),
+                 "/xbzrle/benchmark/decode/stride-%d/run-%d",
+                 bench_opts[i].stride, bench_opts[i].run);
+        g_test_add_data_func(name, &bench_opts[i], test_xbzrle_decode_speed);
+    }
+    /* Goes through all the encoders, so it must run last */
+    g_test_add_func("/xbzrle/benchmark/encode", test_xbzrle_encode_speed);
+
+    return g_test_run();
+}
@@ -0,0 +1,19 @@
+#!/usr/bin/env python3
+#
+# Migration performance regression check
+#
+# Runs the fixed set of scenarios from guestperf.comparison.REGRESSION
+# and writes their headline figures as JSON.  Given a --baseline report
+# from another build, exits with a non-zero status when any metric got
+# worse by more than --threshold percent.
+#
+# This work is licensed under the terms of the GNU GPL, version 2 or later.
+# See the COPYING file in the top-level directory.
+#
+
+import sys
+
+from guestperf.shell import RegressionShell
+
+shell = RegressionShell()
+sys.exit(shell.run(sys.argv[1:]))
@@ -24,6 +24,26 @@ def __init__(self, name, scenarios):
         self._name = name
         self._scenarios = scenarios
 
+# Fixed set of scenarios run by guestperf-regress.py.  Their parameters
+# must stay stable, or reports stop being comparable between builds.
+REGRESSION = Comparison("regression", scenarios = [
+    Scenario("precopy"),
+    Scenario("multifd",
+             multifd=True, multifd_channels=4),
+    Scenario("postcopy",
+             post_copy=True, post_copy_iters=1),
+    Scenario("compr-mt",
+             compression_mt=True, compression_mt_threads=2),
+    Scenario("compr-xbzrle",
+             compression_xbzrle=True, compression_xbzrle_cache=10),
+    Scenario("dirty-limit",
+             dirty_limit=True, dirty_limit_rate=100),
+    Scenario("tls",
+             tls=True),
+    Scenario("tls-multifd",
+             tls=True, multifd=True, multifd_channels=4),
+])
+
 COMPARISONS = [
     # Looking at effect of pausing guest during migration
     # at various stages of iteration over RAM
@@ -135,4 +155,18 @@ def __init__(self, name, scenarios):
         Scenario("compr-multifd-channels-64",
                  multifd=True, multifd_channels=64),
     ]),
+
+
+    # Looking at effect of the per-vCPU dirty page rate limit
+    Comparison("dirty-limit", scenarios = [
+        Scenario("dirty-limit-rate-10",
+                 dirty_limit=True, dirty_limit_rate=10),
+        Scenario("dirty-limit-rate-100",
+                 dirty_limit=True, dirty_limit_rate=100),
+        Scenario("dirty-limit-rate-1000",
+                 dirty_limit=True, dirty_limit_rate=1000),
+    ]),
+
+
+    REGRESSION,
 ]
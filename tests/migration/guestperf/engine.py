@@ -20,7 +20,9 @@
 
 import os
 import re
+import shutil
 import sys
+import tempfile
 import time
 
 from guestperf.progress import Progress, ProgressStats
@@ -34,6 +36,14 @@
 
 class Engine(object):
 
+    # Threads whose CPU usage is reported per migration channel; their
+    # names are only visible with -name debug-threads=on
+    MIGRATION_THREADS = re.compile(r"^(live_migration|return path|"
+                                   r"multifd(send|recv)_\d+|"
+                                   r"(de)?compress|mig/.*|"
+                                   r"fault-default|fault-fast|"
+                                   r"postcopy/listen)$")
+
     def __init__(self, binary, dst_host, kernel, initrd, transport="tcp",
                  sleep=15, verbose=False, debug=False):
 
@@ -45,6 +55,7 @@ def __init__(self, binary, dst_host, kernel, initrd, transport="tcp",
         self._sleep = sleep
         self._verbose = verbose
         self._debug = debug
+        self._tls_dir = None
 
         if debug:
             self._verbose = debug
@@ -76,6 +87,30 @@ def _cpu_timing(self, pid):
             utime = int(fields[14])
             return TimingRecord(pid, now, 1000 * (stime + utime) / jiffies_per_sec)
 
+    def _thread_timing(self, pid, threads):
+        jiffies_per_sec = os.sysconf(os.sysconf_names['SC_CLK_TCK'])
+        taskdir = "/proc/%d/task" % pid
+        for tid in os.listdir(taskdir):
+            try:
+                with open(os.path.join(taskdir, tid, "comm"), "r") as fh:
+                    name = fh.readline().strip()
+                with open(os.path.join(taskdir, tid, "stat"), "r") as fh:
+                    stat = fh.readline()
+            except OSError:
+                # The thread went away in the meantime
+                continue
+            if not self.MIGRATION_THREADS.match(name):
+                continue
+
+            # Thread names may contain spaces, skip past "(comm) "
+            fields = stat[stat.rindex(")") + 2:].split(" ")
+            utime = int(fields[11])
+            stime = int(fields[12])
+            threads[int(tid)] = {
+                "name": name,
+                "cpu_ms": 1000 * (utime + stime) / jiffies_per_sec,
+            }
+
     def _migrate_progress(self, vm):
         info = vm.command("query-migrate")
 
@@ -108,6 +143,11 @@ def _migrate(self, hardware, scenario, src, dst, connect_uri):
         src_qemu_time = []
         src_vcpu_time = []
         src_pid = src.get_pid()
+        src_threads_cpu = {}
+        dst_threads_cpu = {}
+        dst_pid = None
+        if self._dst_host == "localhost":
+            dst_pid = dst.get_pid()
 
         vcpus = src.command("query-cpus-fast")
         src_threads = []
@@ -203,6 +243,21 @@ def _migrate(self, hardware, scenario, src, dst, connect_uri):
             resp = dst.command("migrate-set-parameters",
                                multifd_channels=scenario._multifd_channels)
 
+        if scenario._dirty_limit:
+            resp = src.command("migrate-set-capabilities",
+                               capabilities = [
+                                   { "capability": "dirty-limit",
+                                     "state": True }
+                               ])
+            resp = src.command("migrate-set-parameters",
+                               vcpu_dirty_limit=scenario._dirty_limit_rate)
+
+        if scenario._tls:
+            resp = src.command("migrate-set-parameters",
+                               tls_creds="tls0")
+            resp = dst.command("migrate-set-parameters",
+                               tls_creds="tls0")
+
         resp = src.command("migrate", uri=connect_uri)
 
         post_copy = False
@@ -217,6 +272,12 @@ def _migrate(self, hardware, scenario, src, dst, connect_uri):
             time.sleep(0.05)
 
             progress = self._migrate_progress(src)
+
+            # Sampled often since most migration threads exit on completion
+            self._thread_timing(src_pid, src_threads_cpu)
+            if dst_pid is not None:
+                self._thread_timing(dst_pid, dst_threads_cpu)
+
             if (loop % 20) == 0:
                 src_qemu_time.append(self._cpu_timing(src_pid))
                 src_vcpu_time.extend(self._vcpu_timing(src_pid, src_threads))
@@ -242,7 +303,12 @@ def _migrate(self, hardware, scenario, src, dst, connect_uri):
                         src_vcpu_time.extend(self._vcpu_timing(src_pid, src_threads))
                         sleep_secs -= 1
 
-                return [progress_history, src_qemu_time, src_vcpu_time]
+                threads_cpu = {
+                    "src": list(src_threads_cpu.values()),
+                    "dst": list(dst_threads_cpu.values()),
+                }
+                return [progress_history, src_qemu_time, src_vcpu_time,
+                        threads_cpu]
 
             if self._verbose and (loop % 20) == 0:
                 print("Iter %d: remain %5dMB of %5dMB (total %5dMB @ %5dMb/sec)" % (
@@ -301,7 +367,8 @@ def _get_qemu_serial_args(self):
             return ["-chardev", "stdio,id=cdev0",
                     "-device", "isa-serial,chardev=cdev0"]
 
-    def _get_common_args(self, hardware, tunnelled=False):
+    def _get_common_args(self, hardware, scenario, endpoint,
+                         tunnelled=False):
         args = [
             "noapic",
             "edd=off",
@@ -324,9 +391,15 @@ def _get_common_args(self, hardware, tunnelled=False):
         if tunnelled:
             cmdline = "'" + cmdline + "'"
 
+        accel = "kvm"
+        if scenario._dirty_limit:
+            # The dirty limit is enforced through the KVM dirty ring
+            accel += ",dirty-ring-size=4096"
+
         argv = [
-            "-accel", "kvm",
+            "-accel", accel,
             "-cpu", "host",
+            "-name", "guestperf-%s,debug-threads=on" % endpoint,
             "-kernel", self._kernel,
             "-initrd", self._initrd,
             "-append", cmdline,
@@ -336,6 +409,12 @@ def _get_common_args(self, hardware, tunnelled=False):
 
         argv.extend(self._get_qemu_serial_args())
 
+        if scenario._tls:
+            argv.extend(["-object",
+                         "tls-creds-psk,id=tls0,endpoint=%s,dir=%s" % (
+                             "client" if endpoint == "src" else "server",
+                             self._tls_dir)])
+
         if self._debug:
             argv.extend(["-machine", "graphics=off"])
 
@@ -349,16 +428,27 @@ def _get_common_args(self, hardware, tunnelled=False):
 
         return argv
 
-    def _get_src_args(self, hardware):
-        return self._get_common_args(hardware)
+    def _get_src_args(self, hardware, scenario):
+        return self._get_common_args(hardware, scenario, "src")
 
-    def _get_dst_args(self, hardware, uri):
+    def _get_dst_args(self, hardware, scenario, uri):
         tunnelled = False
         if self._dst_host != "localhost":
             tunnelled = True
-        argv = self._get_common_args(hardware, tunnelled)
+        argv = self._get_common_args(hardware, scenario, "dst", tunnelled)
         return argv + ["-incoming", uri]
 
+    def _setup_tls(self):
+        # A pre-shared key avoids having to generate x509 certificates
+        self._tls_dir = tempfile.mkdtemp(prefix="guestperf-tls-")
+        with open(os.path.join(self._tls_dir, "keys.psk"), "w") as fh:
+            print("qemu:%s" % os.urandom(16).hex(), file=fh)
+
+    def _cleanup_tls(self):
+        if self._tls_dir is not None:
+            shutil.rmtree(self._tls_dir, ignore_errors=True)
+            self._tls_dir = None
+
     @staticmethod
     def _get_common_wrapper(cpu_bind, mem_bind):
         wrapper = []
@@ -424,14 +514,19 @@ def run(self, hardware, scenario, result_dir=os.getcwd()):
             dstmonaddr = "/var/tmp/qemu-dst-%d-monitor.sock" % os.getpid()
         srcmonaddr = "/var/tmp/qemu-src-%d-monitor.sock" % os.getpid()
 
+        if scenario._tls:
+            if self._dst_host != "localhost":
+                raise Exception("TLS scenarios need a local target host")
+            self._setup_tls()
+
         src = QEMUMachine(self._binary,
-                          args=self._get_src_args(hardware),
+                          args=self._get_src_args(hardware, scenario),
                           wrapper=self._get_src_wrapper(hardware),
                           name="qemu-src-%d" % os.getpid(),
                           monitor_address=srcmonaddr)
 
         dst = QEMUMachine(self._binary,
-                          args=self._get_dst_args(hardware, uri),
+                          args=self._get_dst_args(hardware, scenario, uri),
                           wrapper=self._get_dst_wrapper(hardware),
                           name="qemu-dst-%d" % os.getpid(),
                           monitor_address=dstmonaddr)
@@ -444,6 +539,7 @@ def run(self, hardware, scenario, result_dir=os.getcwd()):
             progress_history = ret[0]
             qemu_timings = ret[1]
             vcpu_timings = ret[2]
+            threads_cpu = ret[3]
             if uri[0:5] == "unix:" and os.path.exists(uri[5:]):
                 os.remove(uri[5:])
 
@@ -458,13 +554,15 @@ def run(self, hardware, scenario, result_dir=os.getcwd()):
 
             src.shutdown()
             dst.shutdown()
+            self._cleanup_tls()
 
             return Report(hardware, scenario, progress_history,
                           Timings(self._get_timings(src) + self._get_timings(dst)),
                           Timings(qemu_timings),
                           Timings(vcpu_timings),
                           self._binary, self._dst_host, self._kernel,
-                          self._initrd, self._transport, self._sleep)
+                          self._initrd, self._transport, self._sleep,
+                          threads_cpu)
         except Exception as e:
             if self._debug:
                 print("Failed: %s" % str(e))
@@ -476,6 +574,7 @@ def run(self, hardware, scenario, result_dir=os.getcwd()):
                 dst.shutdown()
             except:
                 pass
+            self._cleanup_tls()
 
             if self._debug:
                 print(src.get_log())
@@ -38,7 +38,8 @@ def __init__(self,
                  kernel,
                  initrd,
                  transport,
-                 sleep):
+                 sleep,
+                 threads_cpu=None):
 
         self._hardware = hardware
         self._scenario = scenario
@@ -52,6 +53,10 @@ def __init__(self,
         self._initrd = initrd
         self._transport = transport
         self._sleep = sleep
+        # Migration threads on each side: [{"name", "cpu_ms"}, ...]
+        if threads_cpu is None:
+            threads_cpu = {"src": [], "dst": []}
+        self._threads_cpu = threads_cpu
 
     def serialize(self):
         return {
@@ -67,6 +72,7 @@ def serialize(self):
             "initrd": self._initrd,
             "transport": self._transport,
             "sleep": self._sleep,
+            "threads_cpu": self._threads_cpu,
         }
 
     @classmethod
@@ -83,7 +89,31 @@ def deserialize(cls, data):
             data["kernel"],
             data["initrd"],
             data["transport"],
-            data["sleep"])
+            data["sleep"],
+            data.get("threads_cpu"))
+
+    def summary(self):
+        """Headline figures of the run, suitable for comparing builds"""
+        final = self._progress_history[-1]
+
+        def channels(side):
+            cpu = {}
+            for thread in self._threads_cpu.get(side, []):
+                cpu[thread["name"]] = (cpu.get(thread["name"], 0) +
+                                       thread["cpu_ms"])
+            return cpu
+
+        return {
+            "scenario": self._scenario._name,
+            "status": final._status,
+            "total_time_ms": final._duration,
+            "setup_time_ms": final._setup_time,
+            "downtime_ms": final._downtime,
+            "transferred_bytes": final._ram._transferred_bytes,
+            "iterations": final._ram._iterations,
+            "src_cpu_ms": channels("src"),
+            "dst_cpu_ms": channels("dst"),
+        }
 
     def to_json(self):
         return json.dumps(self.serialize(), indent=4)
@@ -30,7 +30,9 @@ def __init__(self, name,
                  auto_converge=False, auto_converge_step=10,
                  compression_mt=False, compression_mt_threads=1,
                  compression_xbzrle=False, compression_xbzrle_cache=10,
-                 multifd=False, multifd_channels=2):
+                 multifd=False, multifd_channels=2,
+                 dirty_limit=False, dirty_limit_rate=100,
+                 tls=False):
 
         self._name = name
 
@@ -60,6 +62,11 @@ def __init__(self, name,
         self._multifd = multifd
         self._multifd_channels = multifd_channels
 
+        self._dirty_limit = dirty_limit
+        self._dirty_limit_rate = dirty_limit_rate # MB per second, per vCPU
+
+        self._tls = tls
+
     def serialize(self):
         return {
             "name": self._name,
@@ -79,6 +86,9 @@ def serialize(self):
             "compression_xbzrle_cache": self._compression_xbzrle_cache,
             "multifd": self._multifd,
             "multifd_channels": self._multifd_channels,
+            "dirty_limit": self._dirty_limit,
+            "dirty_limit_rate": self._dirty_limit_rate,
+            "tls": self._tls,
         }
 
     @classmethod
@@ -100,4 +110,7 @@ def deserialize(cls, data):
             data["compression_xbzrle"],
             data["compression_xbzrle_cache"],
             data["multifd"],
-            data["multifd_channels"])
+            data["multifd_channels"],
+            data.get("dirty_limit", False),
+            data.get("dirty_limit_rate", 100),
+            data.get("tls", False))
@@ -20,6 +20,7 @@
 
 import argparse
 import fnmatch
+import json
 import os
 import os.path
 import platform
@@ -29,7 +30,7 @@
 from guestperf.hardware import Hardware
 from guestperf.engine import Engine
 from guestperf.scenario import Scenario
-from guestperf.comparison import COMPARISONS
+from guestperf.comparison import COMPARISONS, REGRESSION
 from guestperf.plot import Plot
 from guestperf.report import Report
 
@@ -127,6 +128,14 @@ def __init__(self):
         parser.add_argument("--multifd-channels", dest="multifd_channels",
                             default=2, type=int)
 
+        parser.add_argument("--dirty-limit", dest="dirty_limit", default=False,
+                            action="store_true")
+        parser.add_argument("--dirty-limit-rate", dest="dirty_limit_rate",
+                            default=100, type=int)
+
+        parser.add_argument("--tls", dest="tls", default=False,
+                            action="store_true")
+
     def get_scenario(self, args):
         return Scenario(name="perfreport",
                         downtime=args.downtime,
@@ -150,7 +159,12 @@ def get_scenario(self, args):
                         compression_xbzrle_cache=args.compression_xbzrle_cache,
 
                         multifd=args.multifd,
-                        multifd_channels=args.multifd_channels)
+                        multifd_channels=args.multifd_channels,
+
+                        dirty_limit=args.dirty_limit,
+                        dirty_limit_rate=args.dirty_limit_rate,
+
+                        tls=args.tls)
 
     def run(self, argv):
         args = self._parser.parse_args(argv)
@@ -224,6 +238,110 @@ def run(self, argv):
                 raise
 
 
+class RegressionShell(BaseShell):
+
+    # Metrics where a higher value is worse
+    METRICS = ["total_time_ms", "downtime_ms", "transferred_bytes",
+               "src_cpu_ms", "dst_cpu_ms"]
+
+    def __init__(self):
+        super(RegressionShell, self).__init__()
+
+        parser = self._parser
+
+        parser.add_argument("--filter", dest="filter", default="*")
+        parser.add_argument("--output", dest="output", default=None)
+        parser.add_argument("--repeat", dest="repeat", default=1, type=int)
+        parser.add_argument("--baseline", dest="baseline", default=None)
+        parser.add_argument("--threshold", dest="threshold", default=10,
+                            type=int, help="tolerated slowdown in percent")
+
+    @staticmethod
+    def _metric(result, metric):
+        value = result[metric]
+        if isinstance(value, dict):
+            # CPU time of all migration threads on that side
+            return sum(value.values())
+        return value
+
+    def _compare(self, baseline, results, threshold):
+        old = {result["scenario"]: result for result in baseline["results"]}
+        regressions = 0
+
+        for result in results:
+            base = old.get(result["scenario"])
+            if base is None:
+                continue
+            if base["status"] == "completed" and result["status"] != "completed":
+                print("REGRESSION %s: %s, baseline completed" % (
+                    result["scenario"], result["status"]))
+                regressions += 1
+                continue
+
+            for metric in self.METRICS:
+                before = self._metric(base, metric)
+                after = self._metric(result, metric)
+                if before <= 0:
+                    continue
+                change = 100.0 * (after - before) / before
+                verdict = "ok"
+                if change > threshold:
+                    verdict = "REGRESSION"
+                    regressions += 1
+                print("%-10s %s %s: %d -> %d (%+.1f%%)" % (
+                    verdict, result["scenario"], metric,
+                    before, after, change))
+
+        return regressions
+
+    def run(self, argv):
+        args = self._parser.parse_args(argv)
+        logging.basicConfig(level=(logging.DEBUG if args.debug else
+                                   logging.INFO if args.verbose else
+                                   logging.WARN))
+
+        engine = self.get_engine(args)
+        hardware = self.get_hardware(args)
+        results = []
+
+        try:
+            for scenario in REGRESSION._scenarios:
+                if not fnmatch.fnmatch(scenario._name, args.filter):
+                    continue
+                if args.verbose:
+                    print("Running %s" % scenario._name)
+
+                # Keep the run with the median total time, so that all
+                # metrics of a scenario come from the same migration
+                runs = [engine.run(hardware, scenario).summary()
+                        for i in range(args.repeat)]
+                runs.sort(key=lambda run: run["total_time_ms"])
+                results.append(runs[len(runs) // 2])
+        except Exception as e:
+            print("Error: %s" % str(e), file=sys.stderr)
+            if args.debug:
+                raise
+            return 1
+
+        output = {
+            "binary": args.binary,
+            "hardware": hardware.serialize(),
+            "results": results,
+        }
+        if args.output is None:
+            print(json.dumps(output, indent=4))
+        else:
+            with open(args.output, "w") as fh:
+                print(json.dumps(output, indent=4), file=fh)
+
+        if args.baseline is not None:
+            with open(args.baseline, "r") as fh:
+                baseline = json.load(fh)
+            if self._compare(baseline, results, args.threshold):
+                return 1
+        return 0
+
+
 class PlotShell(object):
 
     def __init__(self):
@@ -121,6 +121,7 @@ static void check_bitmap_set(void)
 {
     bitmap_set_case(bitmap_set);
     bitmap_set_case(bitmap_set_atomic);
+    bitmap_set_case(bitmap_set_atomic_lazy);
 }
 
 int main(int argc, char **argv)
@@ -69,10 +69,53 @@ static void test_2(void)
     }
 }
 
+static void test_zero_runs(void)
+{
+    BufferZeroRun runs[4];
+    size_t n;
+
+    memset(buffer, 0, sizeof(buffer));
+
+    /* All zero, in one run despite the span-wise skipping */
+    n = buffer_find_zero_runs(buffer, sizeof(buffer), 4096, runs, 4);
+    g_assert_cmpint(n, ==, 1);
+    g_assert_true(runs[0].zero);
+    g_assert_cmpint(runs[0].length, ==, sizeof(buffer));
+
+    /* zero [0, 8192), data [8192, 12288), zero [12288, 65537) */
+    buffer[8192 + 100] = 1;
+    n = buffer_find_zero_runs(buffer, 65537, 4096, runs, 4);
+    g_assert_cmpint(n, ==, 3);
+    g_assert_true(runs[0].zero);
+    g_assert_cmpint(runs[0].length, ==, 8192);
+    g_assert_false(runs[1].zero);
+    g_assert_cmpint(runs[1].offset, ==, 8192);
+    g_assert_cmpint(runs[1].length, ==, 4096);
+    g_assert_true(runs[2].zero);
+    g_assert_cmpint(runs[2].offset, ==, 12288);
+    g_assert_cmpint(runs[2].length, ==, 65537 - 12288);
+
+    /* The scan stops where a run beyond max_runs would start */
+    n = buffer_find_zero_runs(buffer, 65537, 4096, runs, 1);
+    g_assert_cmpint(n, ==, 1);
+    g_assert_cmpint(runs[0].length, ==, 8192);
+
+    /* A short tail block is classified on its own */
+    buffer[8192 + 100] = 0;
+    buffer[65536] = 1;
+    n = buffer_find_zero_runs(buffer, 65537, 4096, runs, 4);
+    g_assert_cmpint(n, ==, 2);
+    g_assert_cmpint(runs[0].length, ==, 65536);
+    g_assert_false(runs[1].zero);
+    g_assert_cmpint(runs[1].length, ==, 1);
+    buffer[65536] = 0;
+}
+
 int main(int argc, char **argv)
 {
     g_test_init(&argc, &argv, NULL);
     g_test_add_func("/cutils/bufferiszero", test_2);
+    g_test_add_func("/cutils/bufferiszero/zero-runs", test_zero_runs);
 
     return g_test_run();
 }
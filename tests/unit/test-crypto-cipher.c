@@ -798,6 +798,60 @@ static void test_cipher_short_plaintext(void)
     qcrypto_cipher_free(cipher);
 }
 
+/*
+ * A batch must give the same result as setting the IV and
+ * encrypting each sector on its own, whatever the backend.
+ */
+static void test_cipher_batch(void)
+{
+    g_autoptr(QCryptoCipher) cipher = NULL;
+    QCryptoCipherBatchOp ops[20];
+    uint8_t key[32];
+    uint8_t iv[G_N_ELEMENTS(ops)][16];
+    uint8_t plaintext[G_N_ELEMENTS(ops) * 512];
+    uint8_t expected[sizeof(plaintext)];
+    uint8_t buf[sizeof(plaintext)];
+    size_t i;
+
+    for (i = 0; i < sizeof(key); i++) {
+        key[i] = i;
+    }
+    for (i = 0; i < sizeof(plaintext); i++) {
+        plaintext[i] = i * 7;
+    }
+
+    cipher = qcrypto_cipher_new(
+        QCRYPTO_CIPHER_ALG_AES_256,
+        QCRYPTO_CIPHER_MODE_CBC,
+        key, sizeof(key),
+        &error_abort);
+
+    for (i = 0; i < G_N_ELEMENTS(ops); i++) {
+        memset(iv[i], 0, sizeof(iv[i]));
+        iv[i][0] = i;
+        g_assert(qcrypto_cipher_setiv(cipher, iv[i], sizeof(iv[i]),
+                                      &error_abort) == 0);
+        g_assert(qcrypto_cipher_encrypt(cipher, plaintext + i * 512,
+                                        expected + i * 512, 512,
+                                        &error_abort) == 0);
+        ops[i] = (QCryptoCipherBatchOp) {
+            .iv = iv[i],
+            .in = buf + i * 512,
+            .out = buf + i * 512,
+            .len = 512,
+        };
+    }
+
+    memcpy(buf, plaintext, sizeof(buf));
+    g_assert(qcrypto_cipher_batch(cipher, true, ops, G_N_ELEMENTS(ops),
+                                  &error_abort) == 0);
+    g_assert(memcmp(buf, expected, sizeof(buf)) == 0);
+
+    g_assert(qcrypto_cipher_batch(cipher, false, ops, G_N_ELEMENTS(ops),
+                                  &error_abort) == 0);
+    g_assert(memcmp(buf, plaintext, sizeof(buf)) == 0);
+}
+
 int main(int argc, char **argv)
 {
     size_t i;
@@ -818,5 +872,10 @@ int main(int argc, char **argv)
     g_test_add_func("/crypto/cipher/short-plaintext",
                     test_cipher_short_plaintext);
 
+    if (qcrypto_cipher_supports(QCRYPTO_CIPHER_ALG_AES_256,
+                                QCRYPTO_CIPHER_MODE_CBC)) {
+        g_test_add_func("/crypto/cipher/batch", test_cipher_batch);
+    }
+
     return g_test_run();
 }
@@ -563,6 +563,62 @@ static void test_discard_back_undo(void)
     iov_free(iov, iov_cnt);
 }
 
+static void test_qiov_inline(void)
+{
+    QEMUIOVector qiov;
+    char buf[16];
+    int i;
+
+    qemu_iovec_init(&qiov, 1);
+    g_assert(qiov.iov == qiov.inline_iov);
+    for (i = 0; i < QEMU_IOVEC_INLINE_NIOV; i++) {
+        qemu_iovec_add(&qiov, buf + i, 1);
+    }
+    g_assert(qiov.iov == qiov.inline_iov);
+
+    /* Moving to the heap must keep the existing elements */
+    qemu_iovec_add(&qiov, buf + i, 1);
+    g_assert(qiov.iov != qiov.inline_iov);
+    for (i = 0; i <= QEMU_IOVEC_INLINE_NIOV; i++) {
+        g_assert(qiov.iov[i].iov_base == buf + i);
+    }
+    g_assert(qiov.size == QEMU_IOVEC_INLINE_NIOV + 1);
+    qemu_iovec_destroy(&qiov);
+}
+
+static void test_qiov_cursor(void)
+{
+    struct iovec *iov;
+    unsigned int iov_cnt;
+    QEMUIOVector qiov, slice, expected;
+    QEMUIOVCursor cur;
+    size_t offset, bytes;
+
+    iov_random(&iov, &iov_cnt);
+    qemu_iovec_init_external(&qiov, iov, iov_cnt);
+
+    /* Walk the vector in random steps, comparing against init_slice */
+    offset = g_test_rand_int_range(0, qiov.size);
+    qemu_iovec_cursor_init(&cur, &qiov, offset);
+    while (cur.remaining) {
+        bytes = g_test_rand_int_range(1, cur.remaining + 1);
+        qemu_iovec_init_slice(&expected, &qiov, offset, bytes);
+        qemu_iovec_cursor_slice(&cur, &slice, bytes);
+
+        g_assert(slice.size == bytes);
+        g_assert(slice.niov == expected.niov);
+        g_assert(iov_equals(slice.iov, expected.iov, slice.niov));
+
+        qemu_iovec_destroy(&slice);
+        qemu_iovec_destroy(&expected);
+        offset += bytes;
+    }
+    g_assert(offset == qiov.size);
+    g_assert(cur.iov == cur.end);
+
+    iov_free(iov, iov_cnt);
+}
+
 int main(int argc, char **argv)
 {
     g_test_init(&argc, &argv, NULL);
@@ -573,5 +629,7 @@ int main(int argc, char **argv)
     g_test_add_func("/basic/iov/discard-back", test_discard_back);
     g_test_add_func("/basic/iov/discard-front-undo", test_discard_front_undo);
     g_test_add_func("/basic/iov/discard-back-undo", test_discard_back_undo);
+    g_test_add_func("/basic/iov/qiov-inline", test_qiov_inline);
+    g_test_add_func("/basic/iov/qiov-cursor", test_qiov_cursor);
     return g_test_run();
 }
@@ -0,0 +1,86 @@
+/*
+ * QEMU internet checksum test
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "net/checksum.h"
+
+static uint8_t buffer[128 * 1024];
+
+/* Straightforward byte pair sum of RFC 1071 to compare against */
+static uint16_t reference_checksum(const uint8_t *buf, int len, int seq)
+{
+    uint32_t sum = 0;
+    int i;
+
+    for (i = 0; i < len; i++) {
+        sum += ((i + seq) & 1) ? buf[i] : buf[i] << 8;
+        sum = (sum & 0xffff) + (sum >> 16);
+    }
+
+    return net_checksum_finish(sum);
+}
+
+static void check(const uint8_t *buf, int len, int seq)
+{
+    g_assert_cmpuint(net_checksum_finish(net_checksum_add_cont(len,
+                                                               (uint8_t *)buf,
+                                                               seq)),
+                     ==, reference_checksum(buf, len, seq));
+}
+
+static void test_1(void)
+{
+    int a, len, seq;
+
+    /* Sizes and alignments around the vector block sizes */
+    for (a = 0; a < 64; a++) {
+        for (len = 0; len < 600; len++) {
+            for (seq = 0; seq < 2; seq++) {
+                check(buffer + a, len, seq);
+            }
+        }
+    }
+
+    /* Typical frame sizes */
+    check(buffer, 1514, 0);
+    check(buffer + 1, 9014, 1);
+    check(buffer + 3, 65535, 0);
+    check(buffer, sizeof(buffer), 0);
+}
+
+static void test_2(void)
+{
+    size_t i;
+
+    for (i = 0; i < sizeof(buffer); i++) {
+        buffer[i] = g_test_rand_int();
+    }
+
+    do {
+        test_1();
+    } while (test_net_checksum_next_accel());
+}
+
+/* All ones makes the accumulators carry the most */
+static void test_ones(void)
+{
+    memset(buffer, 0xff, sizeof(buffer));
+
+    do {
+        check(buffer, sizeof(buffer), 0);
+        check(buffer + 1, sizeof(buffer) - 1, 1);
+    } while (test_net_checksum_next_accel());
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/net/checksum/random", test_2);
+    g_test_add_func("/net/checksum/ones", test_ones);
+
+    return g_test_run();
+}
@@ -134,6 +134,33 @@ static void test_submit_many(void)
     }
 }
 
+static void test_stats(void)
+{
+    WorkerTestData data[100];
+    ThreadPoolStats stats;
+    int i;
+
+    for (i = 0; i < 100; i++) {
+        data[i].n = 0;
+        data[i].ret = -EINPROGRESS;
+        thread_pool_submit_aio(worker_cb, &data[i], done_cb, &data[i]);
+    }
+
+    thread_pool_get_stats(aio_get_thread_pool(ctx), &stats);
+    g_assert_cmpint(stats.queued_requests, >=, 0);
+    g_assert_cmpint(stats.queued_requests, <=, 100);
+    g_assert_cmpint(stats.cur_threads, <=, stats.max_threads);
+
+    active = 100;
+    while (active > 0) {
+        aio_poll(ctx, true);
+    }
+
+    thread_pool_get_stats(aio_get_thread_pool(ctx), &stats);
+    g_assert_cmpint(stats.queued_requests, ==, 0);
+    g_assert_cmpint(stats.max_threads, ==, THREAD_POOL_MAX_THREADS_DEFAULT);
+}
+
 static void do_test_cancel(bool sync)
 {
     WorkerTestData data[100];
@@ -240,6 +267,7 @@ int main(int argc, char **argv)
     g_test_add_func("/thread-pool/submit-aio", test_submit_aio);
     g_test_add_func("/thread-pool/submit-co", test_submit_co);
     g_test_add_func("/thread-pool/submit-many", test_submit_many);
+    g_test_add_func("/thread-pool/stats", test_stats);
     g_test_add_func("/thread-pool/cancel", test_cancel);
     g_test_add_func("/thread-pool/cancel-async", test_cancel_async);
 
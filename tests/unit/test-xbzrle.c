@@ -173,6 +173,67 @@ static void test_encode_decode(void)
     }
 }
 
+#define ACCEL_TEST_PAGES 64
+
+/* Every encoder the host supports must produce the same output */
+static void test_encode_accel(void)
+{
+    uint8_t *old_buf = g_malloc(ACCEL_TEST_PAGES * XBZRLE_PAGE_SIZE);
+    uint8_t *new_buf = g_malloc(ACCEL_TEST_PAGES * XBZRLE_PAGE_SIZE);
+    uint8_t *ref = g_malloc(ACCEL_TEST_PAGES * XBZRLE_PAGE_SIZE);
+    uint8_t *compressed = g_malloc(XBZRLE_PAGE_SIZE);
+    int ref_len[ACCEL_TEST_PAGES];
+    int i, j;
+    bool first = true;
+
+    for (i = 0; i < ACCEL_TEST_PAGES; i++) {
+        uint8_t *o = old_buf + i * XBZRLE_PAGE_SIZE;
+        uint8_t *n = new_buf + i * XBZRLE_PAGE_SIZE;
+        int changes = g_test_rand_int_range(0, 1 << (i % 13));
+
+        for (j = 0; j < XBZRLE_PAGE_SIZE; j++) {
+            o[j] = g_test_rand_int();
+        }
+        memcpy(n, o, XBZRLE_PAGE_SIZE);
+        for (j = 0; j < changes; j++) {
+            int start = g_test_rand_int_range(0, XBZRLE_PAGE_SIZE);
+            int len = g_test_rand_int_range(1, 130);
+
+            while (len-- && start < XBZRLE_PAGE_SIZE) {
+                n[start++] ^= g_test_rand_int_range(1, 256);
+            }
+        }
+    }
+
+    do {
+        for (i = 0; i < ACCEL_TEST_PAGES; i++) {
+            int dlen = xbzrle_encode_buffer(old_buf + i * XBZRLE_PAGE_SIZE,
+                                            new_buf + i * XBZRLE_PAGE_SIZE,
+                                            XBZRLE_PAGE_SIZE, compressed,
+                                            XBZRLE_PAGE_SIZE);
+
+            if (first) {
+                ref_len[i] = dlen;
+                if (dlen > 0) {
+                    memcpy(ref + i * XBZRLE_PAGE_SIZE, compressed, dlen);
+                }
+                continue;
+            }
+            g_assert_cmpint(dlen, ==, ref_len[i]);
+            if (dlen > 0) {
+                g_assert(memcmp(ref + i * XBZRLE_PAGE_SIZE, compressed,
+                                dlen) == 0);
+            }
+        }
+        first = false;
+    } while (test_xbzrle_encode_next_accel());
+
+    g_free(old_buf);
+    g_free(new_buf);
+    g_free(ref);
+    g_free(compressed);
+}
+
 int main(int argc, char **argv)
 {
     g_test_init(&argc, &argv, NULL);
@@ -185,6 +246,8 @@ int main(int argc, char **argv)
     g_test_add_func("/xbzrle/encode_decode_overflow",
                     test_encode_decode_overflow);
     g_test_add_func("/xbzrle/encode_decode", test_encode_decode);
+    /* Switches the encoder, so it must run last */
+    g_test_add_func("/xbzrle/encode_accel", test_encode_accel);
 
     return g_test_run();
 }
@@ -57,6 +57,9 @@ QemuOptsList qemu_trace_opts = {
         },{
             .name = "file",
             .type = QEMU_OPT_STRING,
+        },{
+            .name = "sample",
+            .type = QEMU_OPT_NUMBER,
         },
         { /* end of list */ }
     },
@@ -285,6 +288,33 @@ bool trace_init_backends(void)
     return true;
 }
 
+static void trace_set_sample_rate(const char *pattern, uint64_t rate)
+{
+#ifdef CONFIG_TRACE_SIMPLE
+    TraceEventIter iter;
+    TraceEvent *ev;
+
+    if (!pattern) {
+        error_report("--trace sample=...: requires an event pattern");
+        exit(1);
+    }
+    if (rate > UINT32_MAX) {
+        error_report("--trace sample=...: rate must not exceed %" PRIu32,
+                     UINT32_MAX);
+        exit(1);
+    }
+
+    trace_event_iter_init_pattern(&iter, pattern);
+    while ((ev = trace_event_iter_next(&iter)) != NULL) {
+        st_set_event_sample_rate(trace_event_get_id(ev), rate);
+    }
+#else
+    error_report("--trace sample=...: "
+                 "option not supported by the selected tracing backends");
+    exit(1);
+#endif
+}
+
 void trace_opt_parse(const char *optarg)
 {
     QemuOpts *opts = qemu_opts_parse_noisily(qemu_find_opts("trace"),
@@ -295,6 +325,10 @@ void trace_opt_parse(const char *optarg)
     if (qemu_opt_get(opts, "enable")) {
         trace_enable_events(qemu_opt_get(opts, "enable"));
     }
+    if (qemu_opt_get(opts, "sample")) {
+        trace_set_sample_rate(qemu_opt_get(opts, "enable"),
+                              qemu_opt_get_number(opts, "sample", 1));
+    }
     trace_init_events(qemu_opt_get(opts, "events"));
     init_trace_on_startup = true;
     g_free(trace_opts_file);
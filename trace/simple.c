@@ -45,14 +45,53 @@ static bool trace_available;
 static bool trace_writeout_enabled;
 
 enum {
-    TRACE_BUF_LEN = 4096 * 64,
+    TRACE_BUF_LEN = 4096 * 16,
     TRACE_BUF_FLUSH_THRESHOLD = TRACE_BUF_LEN / 4,
 };
 
-uint8_t trace_buf[TRACE_BUF_LEN];
-static volatile gint trace_idx;
-static unsigned int writeout_idx;
-static volatile gint dropped_events;
+enum {
+    TRACE_BUF_IN_USE,       /* owned by a live thread */
+    TRACE_BUF_ORPHANED,     /* owner exited, records may still be pending */
+    TRACE_BUF_FREE,         /* drained, can be adopted by a new thread */
+};
+
+/*
+ * Each thread records into its own ring buffer, so tracepoints that fire on
+ * many vCPU and iothreads at once do not bounce a shared cache line.  The
+ * reservation is still a compare-and-swap because a signal handler may
+ * interrupt the owner in the middle of a record.
+ *
+ * Buffers are never freed.  When a thread exits its buffer is orphaned; once
+ * the writeout thread has drained it, it is handed to the next new thread.
+ */
+struct TraceBuffer {
+    uint8_t buf[TRACE_BUF_LEN];
+    volatile gint idx;              /* next free byte, owner only */
+    volatile gint writeout_idx;     /* next byte to write out, writer only */
+    volatile gint dropped_events;
+    volatile gint state;
+    uint32_t sample_seed;
+    TraceBuffer *next;
+};
+
+static TraceBuffer *volatile trace_buffers;
+static __thread TraceBuffer *trace_thread_buf;
+
+static void trace_thread_exit(gpointer opaque);
+static GPrivate trace_thread_key = G_PRIVATE_INIT(trace_thread_exit);
+
+/*
+ * Per-event sampling: an event with rate N is recorded on average once every
+ * N hits.  The table is only replaced while parsing the command line, old
+ * copies are leaked so that tracing threads never see a freed table.
+ */
+typedef struct {
+    uint32_t len;
+    uint32_t rate[];
+} TraceSampleRates;
+
+static TraceSampleRates *volatile trace_sample_rates;
+
 static uint32_t trace_pid;
 static FILE *trace_fp;
 static char *trace_file_name;
@@ -76,53 +115,70 @@ typedef struct {
 } TraceLogHeader;
 
 
-static void read_from_buffer(unsigned int idx, void *dataptr, size_t size);
-static unsigned int write_to_buffer(unsigned int idx, void *dataptr, size_t size);
+static void read_from_buffer(TraceBuffer *tb, unsigned int idx,
+                             void *dataptr, size_t size);
+static unsigned int write_to_buffer(TraceBuffer *tb, unsigned int idx,
+                                    void *dataptr, size_t size);
 
-static void clear_buffer_range(unsigned int idx, size_t len)
+static void clear_buffer_range(TraceBuffer *tb, unsigned int idx, size_t len)
 {
     uint32_t num = 0;
     while (num < len) {
         if (idx >= TRACE_BUF_LEN) {
             idx = idx % TRACE_BUF_LEN;
         }
-        trace_buf[idx++] = 0;
+        tb->buf[idx++] = 0;
         num++;
     }
 }
+
 /**
- * Read a trace record from the trace buffer
+ * Read the header of the next record in a thread's buffer
  *
- * @idx         Trace buffer index
- * @record      Trace record to fill
+ * @tb          Trace buffer
+ * @record      Trace record header to fill
  *
- * Returns false if the record is not valid.
+ * Returns false if the record is not valid yet.
  */
-static bool get_trace_record(unsigned int idx, TraceRecord **recordptr)
+static bool peek_trace_record(TraceBuffer *tb, TraceRecord *record)
 {
+    unsigned int idx = (unsigned int)tb->writeout_idx % TRACE_BUF_LEN;
     uint64_t event_flag = 0;
-    TraceRecord record;
-    /* read the event flag to see if its a valid record */
-    read_from_buffer(idx, &record, sizeof(event_flag));
 
-    if (!(record.event & TRACE_RECORD_VALID)) {
+    /* read the event flag to see if its a valid record */
+    read_from_buffer(tb, idx, &event_flag, sizeof(event_flag));
+    if (!(event_flag & TRACE_RECORD_VALID)) {
         return false;
     }
 
     smp_rmb(); /* read memory barrier before accessing record */
-    /* read the record header to know record length */
-    read_from_buffer(idx, &record, sizeof(TraceRecord));
-    *recordptr = malloc(record.length); /* don't use g_malloc, can deadlock when traced */
+    read_from_buffer(tb, idx, record, sizeof(TraceRecord));
+    return true;
+}
+
+/**
+ * Copy out the next record of a thread's buffer and release its space
+ *
+ * @tb          Trace buffer
+ * @length      Record length, as returned by peek_trace_record()
+ */
+static TraceRecord *get_trace_record(TraceBuffer *tb, uint32_t length)
+{
+    unsigned int idx = (unsigned int)tb->writeout_idx % TRACE_BUF_LEN;
+    TraceRecord *recordptr;
+
+    recordptr = malloc(length); /* don't use g_malloc, can deadlock when traced */
     /* make a copy of record to avoid being overwritten */
-    read_from_buffer(idx, *recordptr, record.length);
+    read_from_buffer(tb, idx, recordptr, length);
     smp_rmb(); /* memory barrier before clearing valid flag */
-    (*recordptr)->event &= ~TRACE_RECORD_VALID;
+    recordptr->event &= ~TRACE_RECORD_VALID;
     /* clear the trace buffer range for consumed record otherwise any byte
      * with its MSB set may be considered as a valid event id when the writer
      * thread crosses this range of buffer again.
      */
-    clear_buffer_range(idx, record.length);
-    return true;
+    clear_buffer_range(tb, idx, length);
+    g_atomic_int_set(&tb->writeout_idx, tb->writeout_idx + length);
+    return recordptr;
 }
 
 /**
@@ -154,14 +210,51 @@ static void wait_for_trace_records_available(void)
     g_mutex_unlock(&trace_lock);
 }
 
+/*
+ * Pick the buffer whose next valid record is the oldest.  Records that a
+ * thread has reserved but not yet completed are skipped until the next
+ * round, so the output is ordered only among the records that were complete
+ * at the time they were written out.
+ */
+static TraceBuffer *next_trace_buffer(uint32_t *length)
+{
+    TraceBuffer *tb, *oldest = NULL;
+    uint64_t oldest_ns = UINT64_MAX;
+    TraceRecord record;
+
+    for (tb = trace_buffers; tb; tb = tb->next) {
+        if (peek_trace_record(tb, &record) &&
+            record.timestamp_ns < oldest_ns) {
+            oldest = tb;
+            oldest_ns = record.timestamp_ns;
+            *length = record.length;
+        }
+    }
+    return oldest;
+}
+
+static void release_orphaned_buffers(void)
+{
+    TraceBuffer *tb;
+
+    for (tb = trace_buffers; tb; tb = tb->next) {
+        if (g_atomic_int_get(&tb->state) == TRACE_BUF_ORPHANED &&
+            g_atomic_int_get(&tb->idx) == tb->writeout_idx) {
+            g_atomic_int_compare_and_exchange(&tb->state, TRACE_BUF_ORPHANED,
+                                              TRACE_BUF_FREE);
+        }
+    }
+}
+
 static gpointer writeout_thread(gpointer opaque)
 {
     TraceRecord *recordptr;
+    TraceBuffer *tb;
     union {
         TraceRecord rec;
         uint8_t bytes[sizeof(TraceRecord) + sizeof(uint64_t)];
     } dropped;
-    unsigned int idx = 0;
+    uint32_t length;
     int dropped_count;
     size_t unused __attribute__ ((unused));
     uint64_t type = TRACE_RECORD_TYPE_EVENT;
@@ -169,79 +262,177 @@ static gpointer writeout_thread(gpointer opaque)
     for (;;) {
         wait_for_trace_records_available();
 
-        if (g_atomic_int_get(&dropped_events)) {
+        dropped_count = 0;
+        for (tb = trace_buffers; tb; tb = tb->next) {
+            dropped_count += g_atomic_int_and(&tb->dropped_events, 0);
+        }
+        if (dropped_count) {
             dropped.rec.event = DROPPED_EVENT_ID;
             dropped.rec.timestamp_ns = get_clock();
             dropped.rec.length = sizeof(TraceRecord) + sizeof(uint64_t);
             dropped.rec.pid = trace_pid;
-            do {
-                dropped_count = g_atomic_int_get(&dropped_events);
-            } while (!g_atomic_int_compare_and_exchange(&dropped_events,
-                                                        dropped_count, 0));
             dropped.rec.arguments[0] = dropped_count;
             unused = fwrite(&type, sizeof(type), 1, trace_fp);
             unused = fwrite(&dropped.rec, dropped.rec.length, 1, trace_fp);
         }
 
-        while (get_trace_record(idx, &recordptr)) {
+        while ((tb = next_trace_buffer(&length))) {
+            recordptr = get_trace_record(tb, length);
             unused = fwrite(&type, sizeof(type), 1, trace_fp);
             unused = fwrite(recordptr, recordptr->length, 1, trace_fp);
-            writeout_idx += recordptr->length;
             free(recordptr); /* don't use g_free, can deadlock when traced */
-            idx = writeout_idx % TRACE_BUF_LEN;
         }
 
+        release_orphaned_buffers();
         fflush(trace_fp);
     }
     return NULL;
 }
 
+static void trace_thread_exit(gpointer opaque)
+{
+    TraceBuffer *tb = opaque;
+
+    g_atomic_int_set(&tb->state, TRACE_BUF_ORPHANED);
+}
+
+static TraceBuffer *trace_buffer_get(void)
+{
+    TraceBuffer *tb = trace_thread_buf;
+
+    if (likely(tb)) {
+        return tb;
+    }
+
+    /* Adopt a drained buffer from an exited thread if there is one */
+    for (tb = trace_buffers; tb; tb = tb->next) {
+        if (g_atomic_int_compare_and_exchange(&tb->state, TRACE_BUF_FREE,
+                                              TRACE_BUF_IN_USE)) {
+            break;
+        }
+    }
+
+    if (!tb) {
+        tb = calloc(1, sizeof(*tb)); /* don't use g_malloc, see above */
+        if (!tb) {
+            return NULL;
+        }
+        tb->state = TRACE_BUF_IN_USE;
+        do {
+            tb->next = g_atomic_pointer_get(&trace_buffers);
+        } while (!g_atomic_pointer_compare_and_exchange(&trace_buffers,
+                                                        tb->next, tb));
+    }
+
+    tb->sample_seed = (uint32_t)get_clock() | 1;
+    trace_thread_buf = tb;
+    g_private_set(&trace_thread_key, tb);
+    return tb;
+}
+
+/* Return true if this hit of @event should be skipped */
+static bool trace_sample_skip(TraceBuffer *tb, uint32_t event)
+{
+    TraceSampleRates *rates = g_atomic_pointer_get(&trace_sample_rates);
+    uint32_t x;
+
+    if (likely(!rates) || event >= rates->len || rates->rate[event] <= 1) {
+        return false;
+    }
+
+    /* xorshift32 */
+    x = tb->sample_seed;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    tb->sample_seed = x;
+    return x % rates->rate[event] != 0;
+}
+
+/**
+ * Set the sampling rate of an event
+ *
+ * @id          Event ID
+ * @rate        Record one in @rate hits on average; 0 and 1 record all hits
+ */
+void st_set_event_sample_rate(uint32_t id, uint32_t rate)
+{
+    TraceSampleRates *old = g_atomic_pointer_get(&trace_sample_rates);
+    TraceSampleRates *new;
+    uint32_t len = old ? old->len : 0;
+
+    if (id >= len) {
+        len = id + 1;
+    }
+    new = g_malloc0(sizeof(*new) + len * sizeof(new->rate[0]));
+    new->len = len;
+    if (old) {
+        memcpy(new->rate, old->rate, old->len * sizeof(old->rate[0]));
+    }
+    new->rate[id] = rate;
+    g_atomic_pointer_set(&trace_sample_rates, new);
+}
+
 void trace_record_write_u64(TraceBufferRecord *rec, uint64_t val)
 {
-    rec->rec_off = write_to_buffer(rec->rec_off, &val, sizeof(uint64_t));
+    rec->rec_off = write_to_buffer(rec->tbuf, rec->rec_off,
+                                   &val, sizeof(uint64_t));
 }
 
 void trace_record_write_str(TraceBufferRecord *rec, const char *s, uint32_t slen)
 {
     /* Write string length first */
-    rec->rec_off = write_to_buffer(rec->rec_off, &slen, sizeof(slen));
+    rec->rec_off = write_to_buffer(rec->tbuf, rec->rec_off,
+                                   &slen, sizeof(slen));
     /* Write actual string now */
-    rec->rec_off = write_to_buffer(rec->rec_off, (void*)s, slen);
+    rec->rec_off = write_to_buffer(rec->tbuf, rec->rec_off, (void*)s, slen);
 }
 
 int trace_record_start(TraceBufferRecord *rec, uint32_t event, size_t datasize)
 {
+    TraceBuffer *tb = trace_buffer_get();
     unsigned int idx, rec_off, old_idx, new_idx;
     uint32_t rec_len = sizeof(TraceRecord) + datasize;
     uint64_t event_u64 = event;
-    uint64_t timestamp_ns = get_clock();
+    uint64_t timestamp_ns;
 
+    if (unlikely(!tb)) {
+        return -ENOMEM;
+    }
+    if (trace_sample_skip(tb, event)) {
+        return -EAGAIN;
+    }
+
+    timestamp_ns = get_clock();
     do {
-        old_idx = g_atomic_int_get(&trace_idx);
+        old_idx = g_atomic_int_get(&tb->idx);
         smp_rmb();
         new_idx = old_idx + rec_len;
 
-        if (new_idx - writeout_idx > TRACE_BUF_LEN) {
+        if (new_idx - (unsigned int)g_atomic_int_get(&tb->writeout_idx) >
+            TRACE_BUF_LEN) {
             /* Trace Buffer Full, Event dropped ! */
-            g_atomic_int_inc(&dropped_events);
+            g_atomic_int_inc(&tb->dropped_events);
             return -ENOSPC;
         }
-    } while (!g_atomic_int_compare_and_exchange(&trace_idx, old_idx, new_idx));
+    } while (!g_atomic_int_compare_and_exchange(&tb->idx, old_idx, new_idx));
 
     idx = old_idx % TRACE_BUF_LEN;
 
     rec_off = idx;
-    rec_off = write_to_buffer(rec_off, &event_u64, sizeof(event_u64));
-    rec_off = write_to_buffer(rec_off, &timestamp_ns, sizeof(timestamp_ns));
-    rec_off = write_to_buffer(rec_off, &rec_len, sizeof(rec_len));
-    rec_off = write_to_buffer(rec_off, &trace_pid, sizeof(trace_pid));
+    rec_off = write_to_buffer(tb, rec_off, &event_u64, sizeof(event_u64));
+    rec_off = write_to_buffer(tb, rec_off, &timestamp_ns, sizeof(timestamp_ns));
+    rec_off = write_to_buffer(tb, rec_off, &rec_len, sizeof(rec_len));
+    rec_off = write_to_buffer(tb, rec_off, &trace_pid, sizeof(trace_pid));
 
+    rec->tbuf = tb;
     rec->tbuf_idx = idx;
     rec->rec_off  = (idx + sizeof(TraceRecord)) % TRACE_BUF_LEN;
     return 0;
 }
 
-static void read_from_buffer(unsigned int idx, void *dataptr, size_t size)
+static void read_from_buffer(TraceBuffer *tb, unsigned int idx,
+                             void *dataptr, size_t size)
 {
     uint8_t *data_ptr = dataptr;
     uint32_t x = 0;
@@ -249,11 +440,12 @@ static void read_from_buffer(unsigned int idx, void *dataptr, size_t size)
         if (idx >= TRACE_BUF_LEN) {
             idx = idx % TRACE_BUF_LEN;
         }
-        data_ptr[x++] = trace_buf[idx++];
+        data_ptr[x++] = tb->buf[idx++];
     }
 }
 
-static unsigned int write_to_buffer(unsigned int idx, void *dataptr, size_t size)
+static unsigned int write_to_buffer(TraceBuffer *tb, unsigned int idx,
+                                    void *dataptr, size_t size)
 {
     uint8_t *data_ptr = dataptr;
     uint32_t x = 0;
@@ -261,20 +453,23 @@ static unsigned int write_to_buffer(unsigned int idx, void *dataptr, size_t size
         if (idx >= TRACE_BUF_LEN) {
             idx = idx % TRACE_BUF_LEN;
         }
-        trace_buf[idx++] = data_ptr[x++];
+        tb->buf[idx++] = data_ptr[x++];
     }
     return idx; /* most callers wants to know where to write next */
 }
 
 void trace_record_finish(TraceBufferRecord *rec)
 {
+    TraceBuffer *tb = rec->tbuf;
     TraceRecord record;
-    read_from_buffer(rec->tbuf_idx, &record, sizeof(TraceRecord));
+
+    read_from_buffer(tb, rec->tbuf_idx, &record, sizeof(TraceRecord));
     smp_wmb(); /* write barrier before marking as valid */
     record.event |= TRACE_RECORD_VALID;
-    write_to_buffer(rec->tbuf_idx, &record, sizeof(TraceRecord));
+    write_to_buffer(tb, rec->tbuf_idx, &record, sizeof(TraceRecord));
 
-    if (((unsigned int)g_atomic_int_get(&trace_idx) - writeout_idx)
+    if (((unsigned int)g_atomic_int_get(&tb->idx) -
+         (unsigned int)g_atomic_int_get(&tb->writeout_idx))
         > TRACE_BUF_FLUSH_THRESHOLD) {
         flush_trace_file(false);
     }
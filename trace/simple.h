@@ -17,8 +17,12 @@ void st_set_trace_file(const char *file);
 bool st_init(void);
 void st_init_group(size_t group);
 void st_flush_trace_buffer(void);
+void st_set_event_sample_rate(uint32_t id, uint32_t rate);
+
+typedef struct TraceBuffer TraceBuffer;
 
 typedef struct {
+    TraceBuffer *tbuf;
     unsigned int tbuf_idx;
     unsigned int rec_off;
 } TraceBufferRecord;
@@ -26,9 +30,13 @@ typedef struct {
 /* Note for hackers: Make sure MAX_TRACE_LEN < sizeof(uint32_t) */
 #define MAX_TRACE_STRLEN 512
 /**
- * Initialize a trace record and claim space for it in the buffer
+ * Initialize a trace record and claim space for it in the calling thread's
+ * buffer
  *
  * @arglen  number of bytes required for arguments
+ *
+ * Returns nonzero if the event must not be recorded, either because the
+ * buffer is full or because this hit was skipped by sampling.
  */
 int trace_record_start(TraceBufferRecord *rec, uint32_t id, size_t arglen);
 
@@ -31,6 +31,7 @@
 #include "qemu/error-report.h"
 #include "qemu/fifo8.h"
 #include "qemu/main-loop.h"
+#include "qemu/memfd.h"
 #include "qemu/module.h"
 #include "qemu/option.h"
 #include "qemu/timer.h"
@@ -1541,6 +1542,24 @@ win32_pixman_image_destroy(pixman_image_t *image, void *data)
         &error_warn
     );
 }
+#else
+void qemu_displaysurface_set_share_fd(DisplaySurface *surface,
+                                      int fd, uint32_t offset)
+{
+    assert(surface->share_fd < 0);
+
+    surface->share_fd = fd;
+    surface->share_offset = offset;
+}
+
+static void
+memfd_pixman_image_destroy(pixman_image_t *image, void *data)
+{
+    qemu_memfd_free(pixman_image_get_data(image),
+                    pixman_image_get_stride(image) *
+                    pixman_image_get_height(image),
+                    GPOINTER_TO_INT(data));
+}
 #endif
 
 DisplaySurface *qemu_create_displaysurface(int width, int height)
@@ -1549,12 +1568,24 @@ DisplaySurface *qemu_create_displaysurface(int width, int height)
     void *bits = NULL;
 #ifdef WIN32
     HANDLE handle = NULL;
+#else
+    int fd = -1;
 #endif
 
     trace_displaysurface_create(width, height);
 
 #ifdef WIN32
     bits = qemu_win32_map_alloc(width * height * 4, &handle, &error_abort);
+#else
+    /*
+     * Back the surface with a sealed memfd, so that display listeners can
+     * map it instead of receiving copies of the pixels.
+     */
+    if (qemu_memfd_check(MFD_ALLOW_SEALING)) {
+        bits = qemu_memfd_alloc("qemu-surface", width * height * 4,
+                                F_SEAL_GROW | F_SEAL_SHRINK | F_SEAL_SEAL,
+                                &fd, NULL);
+    }
 #endif
 
     surface = qemu_create_displaysurface_from(
@@ -1566,6 +1597,13 @@ DisplaySurface *qemu_create_displaysurface(int width, int height)
 
 #ifdef WIN32
     qemu_displaysurface_win32_set_handle(surface, handle, 0);
+#else
+    if (bits) {
+        pixman_image_set_destroy_function(surface->image,
+                                          memfd_pixman_image_destroy,
+                                          GINT_TO_POINTER(fd));
+        qemu_displaysurface_set_share_fd(surface, fd, 0);
+    }
 #endif
     return surface;
 }
@@ -1585,6 +1623,8 @@ DisplaySurface *qemu_create_displaysurface_from(int width, int height,
 #ifdef WIN32
     pixman_image_set_destroy_function(surface->image,
                                       win32_pixman_image_destroy, surface);
+#else
+    surface->share_fd = -1;
 #endif
 
     return surface;
@@ -1597,6 +1637,9 @@ DisplaySurface *qemu_create_displaysurface_pixman(pixman_image_t *image)
     trace_displaysurface_create_pixman(surface);
     surface->format = pixman_image_get_format(image);
     surface->image = pixman_image_ref(image);
+#ifndef WIN32
+    surface->share_fd = -1;
+#endif
 
     return surface;
 }
@@ -0,0 +1,214 @@
+/*
+ * QEMU VNC display driver: Open H.264 encoding
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * (at your option) any later version.  See the COPYING file in the
+ * top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/error-report.h"
+#include "vnc.h"
+
+#include <gst/gst.h>
+#include <gst/app/gstappsrc.h>
+#include <gst/app/gstappsink.h>
+
+/* Open H.264 rectangle flags */
+#define VNC_H264_RESET_CONTEXT        1
+
+/* How long to wait for the encoder to produce a frame */
+#define VNC_H264_PULL_TIMEOUT (100 * GST_MSECOND)
+
+/* Encoders in order of preference: VA-API first, then software */
+static const char *const vnc_h264_encoders[] = {
+    "vah264lpenc",
+    "vah264enc",
+    "vaapih264enc",
+    "x264enc",
+};
+
+struct VncH264 {
+    GstElement *pipeline;
+    GstElement *source;
+    GstElement *sink;
+    int width;
+    int height;
+    bool reset;     /* send VNC_H264_RESET_CONTEXT with the next frame */
+};
+
+static const char *vnc_h264_encoder_name;
+
+static gpointer vnc_h264_probe(gpointer data)
+{
+    g_autoptr(GError) err = NULL;
+    int i;
+
+    if (!gst_init_check(NULL, NULL, &err)) {
+        warn_report("vnc: cannot initialize GStreamer: %s", err->message);
+        return NULL;
+    }
+
+    for (i = 0; i < ARRAY_SIZE(vnc_h264_encoders); i++) {
+        GstElementFactory *factory =
+            gst_element_factory_find(vnc_h264_encoders[i]);
+
+        if (factory) {
+            gst_object_unref(factory);
+            vnc_h264_encoder_name = vnc_h264_encoders[i];
+            break;
+        }
+    }
+    return NULL;
+}
+
+bool vnc_h264_available(void)
+{
+    static GOnce once = G_ONCE_INIT;
+
+    g_once(&once, vnc_h264_probe, NULL);
+    return vnc_h264_encoder_name != NULL;
+}
+
+static void vnc_h264_destroy(VncH264 *h264)
+{
+    if (h264->pipeline) {
+        gst_element_set_state(h264->pipeline, GST_STATE_NULL);
+        gst_object_unref(h264->pipeline);
+    }
+    g_free(h264);
+}
+
+static VncH264 *vnc_h264_create(int width, int height)
+{
+    VncH264 *h264 = g_new0(VncH264, 1);
+    g_autoptr(GError) err = NULL;
+    g_autofree char *desc = NULL;
+    GstElement *enc;
+
+    /*
+     * The server surface is x8r8g8b8, i.e. BGRx in memory.  Clients decode
+     * constrained baseline Annex B streams with one access unit per frame.
+     */
+    desc = g_strdup_printf("appsrc name=src is-live=true do-timestamp=true "
+                           "format=time caps=video/x-raw,format=BGRx,"
+                           "width=%d,height=%d,framerate=0/1 "
+                           "! videoconvert ! %s name=enc ! h264parse "
+                           "! video/x-h264,stream-format=byte-stream,"
+                           "alignment=au,profile=constrained-baseline "
+                           "! appsink name=sink sync=false max-buffers=4",
+                           width, height, vnc_h264_encoder_name);
+
+    h264->width = width;
+    h264->height = height;
+    h264->reset = true;
+    h264->pipeline = gst_parse_launch(desc, &err);
+    if (!h264->pipeline) {
+        error_report("vnc: cannot create the H.264 encoding pipeline: %s",
+                     err->message);
+        goto fail;
+    }
+
+    /* The bin keeps its own reference, so don't hold on to these */
+    h264->source = gst_bin_get_by_name(GST_BIN(h264->pipeline), "src");
+    h264->sink = gst_bin_get_by_name(GST_BIN(h264->pipeline), "sink");
+    gst_object_unref(h264->source);
+    gst_object_unref(h264->sink);
+
+    enc = gst_bin_get_by_name(GST_BIN(h264->pipeline), "enc");
+    if (g_str_equal(vnc_h264_encoder_name, "x264enc")) {
+        gst_util_set_object_arg(G_OBJECT(enc), "tune", "zerolatency");
+        gst_util_set_object_arg(G_OBJECT(enc), "speed-preset", "ultrafast");
+    }
+    gst_object_unref(enc);
+
+    if (gst_element_set_state(h264->pipeline, GST_STATE_PLAYING) ==
+        GST_STATE_CHANGE_FAILURE) {
+        error_report("vnc: cannot start the H.264 encoding pipeline");
+        goto fail;
+    }
+    return h264;
+
+fail:
+    vnc_h264_destroy(h264);
+    return NULL;
+}
+
+/* Feed the whole server surface to the encoder and return the coded frame */
+static GstSample *vnc_h264_encode(VncState *vs, VncH264 *h264)
+{
+    size_t line = h264->width * VNC_SERVER_FB_BYTES;
+    GstBuffer *buf = gst_buffer_new_allocate(NULL, line * h264->height, NULL);
+    GstMapInfo map;
+    int y;
+
+    gst_buffer_map(buf, &map, GST_MAP_WRITE);
+    for (y = 0; y < h264->height; y++) {
+        memcpy(map.data + y * line, vnc_server_fb_ptr(vs->vd, 0, y), line);
+    }
+    gst_buffer_unmap(buf, &map);
+
+    if (gst_app_src_push_buffer(GST_APP_SRC(h264->source), buf) !=
+        GST_FLOW_OK) {
+        return NULL;
+    }
+    return gst_app_sink_try_pull_sample(GST_APP_SINK(h264->sink),
+                                        VNC_H264_PULL_TIMEOUT);
+}
+
+/*
+ * Send the whole framebuffer as a single Open H.264 rectangle.  The encoder
+ * is recreated, and the client told to reset its decoder, whenever the
+ * framebuffer size changes.
+ */
+int vnc_h264_send_framebuffer_update(VncState *vs, int x, int y, int w, int h)
+{
+    int width = pixman_image_get_width(vs->vd->server);
+    int height = pixman_image_get_height(vs->vd->server);
+    g_autoptr(GstSample) sample = NULL;
+    GstBuffer *buf;
+    GstMapInfo map;
+
+    width = MIN(width, vs->client_width);
+    height = MIN(height, vs->client_height);
+
+    if (vs->h264 && (vs->h264->width != width ||
+                     vs->h264->height != height)) {
+        vnc_h264_destroy(vs->h264);
+        vs->h264 = NULL;
+    }
+    if (!vs->h264) {
+        vs->h264 = vnc_h264_create(width, height);
+        if (!vs->h264) {
+            /* Fall back to raw for this update */
+            vnc_framebuffer_update(vs, x, y, w, h, VNC_ENCODING_RAW);
+            return vnc_raw_send_framebuffer_update(vs, x, y, w, h);
+        }
+    }
+
+    sample = vnc_h264_encode(vs, vs->h264);
+    if (!sample) {
+        return 0;
+    }
+    buf = gst_sample_get_buffer(sample);
+    if (!buf || !gst_buffer_map(buf, &map, GST_MAP_READ)) {
+        return 0;
+    }
+
+    vnc_framebuffer_update(vs, 0, 0, width, height, VNC_ENCODING_H264);
+    vnc_write_u32(vs, map.size);
+    vnc_write_u32(vs, vs->h264->reset ? VNC_H264_RESET_CONTEXT : 0);
+    vnc_write(vs, map.data, map.size);
+    vs->h264->reset = false;
+
+    gst_buffer_unmap(buf, &map);
+    return 1;
+}
+
+void vnc_h264_clear(VncState *vs)
+{
+    if (vs->h264) {
+        vnc_h264_destroy(vs->h264);
+        vs->h264 = NULL;
+    }
+}
@@ -45,28 +45,30 @@
  * - VncState::output lock: used to make sure the output buffer is not corrupted
  *                          if two threads try to write on it at the same time
  *
- * While the VNC worker thread is working, the VncDisplay global lock is held
- * to avoid screen corruption (this does not block vnc_refresh() because it
- * uses trylock()) but the output lock is not held because the thread works on
- * its own output buffer.
+ * While a VNC worker thread is working, the VncDisplay global lock is held in
+ * shared mode to avoid screen corruption (this does not block vnc_refresh()
+ * because it uses trylock()) but the output lock is not held because the
+ * thread works on its own output buffer.
  * When the encoding job is done, the worker thread will hold the output lock
  * and copy its output buffer in vs->output.
+ *
+ * Several worker threads serve the queue.  The encoders keep per-client
+ * state (zlib streams, tight/zrle contexts) and updates must reach the client
+ * in order, so the jobs of a client are encoded one at a time, in the order
+ * they were pushed; jobs of different clients are encoded in parallel.
  */
 
 struct VncJobQueue {
     QemuCond cond;
     QemuMutex mutex;
-    QemuThread thread;
+    int n_threads;
     bool exit;
     QTAILQ_HEAD(, VncJob) jobs;
 };
 
 typedef struct VncJobQueue VncJobQueue;
 
-/*
- * We use a single global queue, but most of the functions are
- * already reentrant, so we can easily add more than one encoding thread
- */
+/* A single global queue, served by all the encoding threads */
 static VncJobQueue *queue;
 
 static void vnc_lock_queue(VncJobQueue *queue)
@@ -114,12 +116,38 @@ void vnc_job_push(VncJob *job)
     if (queue->exit || QLIST_EMPTY(&job->rectangles)) {
         g_free(job);
     } else {
+        job->queued_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
         QTAILQ_INSERT_TAIL(&queue->jobs, job, next);
         qemu_cond_broadcast(&queue->cond);
     }
     vnc_unlock_queue(queue);
 }
 
+/*
+ * Return the oldest job that can be encoded now, i.e. whose client has no
+ * older job queued or being encoded.
+ */
+static VncJob *vnc_next_job_locked(VncJobQueue *queue)
+{
+    VncJob *job, *prev;
+
+    QTAILQ_FOREACH(job, &queue->jobs, next) {
+        if (job->running) {
+            continue;
+        }
+        for (prev = QTAILQ_FIRST(&queue->jobs); prev != job;
+             prev = QTAILQ_NEXT(prev, next)) {
+            if (prev->vs == job->vs) {
+                break;
+            }
+        }
+        if (prev == job) {
+            return job;
+        }
+    }
+    return NULL;
+}
+
 static bool vnc_has_job_locked(VncState *vs)
 {
     VncJob *job;
@@ -193,6 +221,9 @@ static void vnc_async_encoding_start(VncState *orig, VncState *local)
     local->zlib = orig->zlib;
     local->hextile = orig->hextile;
     local->zrle = orig->zrle;
+#ifdef CONFIG_VNC_H264
+    local->h264 = orig->h264;
+#endif
     local->client_width = orig->client_width;
     local->client_height = orig->client_height;
 }
@@ -204,6 +235,9 @@ static void vnc_async_encoding_end(VncState *orig, VncState *local)
     orig->zlib = local->zlib;
     orig->hextile = local->hextile;
     orig->zrle = local->zrle;
+#ifdef CONFIG_VNC_H264
+    orig->h264 = local->h264;
+#endif
     orig->lossy_rect = local->lossy_rect;
 }
 
@@ -235,6 +269,18 @@ static bool vnc_worker_clamp_rect(VncState *vs, VncJob *job, VncRect *rect)
     return false;
 }
 
+/* Called with the output lock of the job's client held */
+static void vnc_job_account(VncJob *job, int n_rectangles)
+{
+    VncState *vs = job->vs;
+    uint64_t latency = qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - job->queued_ns;
+
+    vs->encode_updates++;
+    vs->encode_rects += n_rectangles;
+    vs->encode_latency_ns += latency;
+    vs->encode_latency_max_ns = MAX(vs->encode_latency_max_ns, latency);
+}
+
 static int vnc_worker_thread_loop(VncJobQueue *queue)
 {
     VncJob *job;
@@ -244,11 +290,13 @@ static int vnc_worker_thread_loop(VncJobQueue *queue)
     int saved_offset;
 
     vnc_lock_queue(queue);
-    while (QTAILQ_EMPTY(&queue->jobs) && !queue->exit) {
+    while (!(job = vnc_next_job_locked(queue)) && !queue->exit) {
         qemu_cond_wait(&queue->cond, &queue->mutex);
     }
     /* Here job can only be NULL if queue->exit is true */
-    job = QTAILQ_FIRST(&queue->jobs);
+    if (job) {
+        job->running = true;
+    }
     vnc_unlock_queue(queue);
 
     if (queue->exit) {
@@ -283,12 +331,12 @@ static int vnc_worker_thread_loop(VncJobQueue *queue)
     saved_offset = vs.output.offset;
     vnc_write_u16(&vs, 0);
 
-    vnc_lock_display(job->vs->vd);
+    vnc_lock_display_shared(job->vs->vd);
     QLIST_FOREACH_SAFE(entry, &job->rectangles, next, tmp) {
         int n;
 
         if (job->vs->ioc == NULL) {
-            vnc_unlock_display(job->vs->vd);
+            vnc_unlock_display_shared(job->vs->vd);
             /* Copy persistent encoding data */
             vnc_async_encoding_end(job->vs, &vs);
             goto disconnected;
@@ -305,7 +353,7 @@ static int vnc_worker_thread_loop(VncJobQueue *queue)
         g_free(entry);
     }
     trace_vnc_job_nrects(&vs, job, n_rectangles);
-    vnc_unlock_display(job->vs->vd);
+    vnc_unlock_display_shared(job->vs->vd);
 
     /* Put n_rectangles at the beginning of the message */
     vs.output.buffer[saved_offset] = (n_rectangles >> 8) & 0xFF;
@@ -316,6 +364,7 @@ static int vnc_worker_thread_loop(VncJobQueue *queue)
         buffer_move(&job->vs->jobs_buffer, &vs.output);
         /* Copy persistent encoding data */
         vnc_async_encoding_end(job->vs, &vs);
+        vnc_job_account(job, n_rectangles);
 
         qemu_bh_schedule(job->vs->bh);
     }  else {
@@ -356,28 +405,32 @@ static void vnc_queue_clear(VncJobQueue *q)
 static void *vnc_worker_thread(void *arg)
 {
     VncJobQueue *queue = arg;
-
-    qemu_thread_get_self(&queue->thread);
+    bool last;
 
     while (!vnc_worker_thread_loop(queue)) ;
-    vnc_queue_clear(queue);
-    return NULL;
-}
 
-static bool vnc_worker_thread_running(void)
-{
-    return queue; /* Check global queue */
+    vnc_lock_queue(queue);
+    last = --queue->n_threads == 0;
+    vnc_unlock_queue(queue);
+    if (last) {
+        vnc_queue_clear(queue);
+    }
+    return NULL;
 }
 
-void vnc_start_worker_thread(void)
+void vnc_start_worker_threads(int n)
 {
-    VncJobQueue *q;
+    QemuThread thread;
 
-    if (vnc_worker_thread_running())
-        return;
+    if (!queue) {
+        queue = vnc_queue_init(); /* Set global queue */
+    }
 
-    q = vnc_queue_init();
-    qemu_thread_create(&q->thread, "vnc_worker", vnc_worker_thread, q,
-                       QEMU_THREAD_DETACHED);
-    queue = q; /* Set global queue */
+    vnc_lock_queue(queue);
+    while (queue->n_threads < n) {
+        qemu_thread_create(&thread, "vnc_worker", vnc_worker_thread, queue,
+                           QEMU_THREAD_DETACHED);
+        queue->n_threads++;
+    }
+    vnc_unlock_queue(queue);
 }
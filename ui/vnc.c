@@ -317,7 +317,7 @@ static void vnc_qmp_event(VncState *vs, QAPIEvent event)
     qapi_free_VncServerInfo(si);
 }
 
-static VncClientInfo *qmp_query_vnc_client(const VncState *client)
+static VncClientInfo *qmp_query_vnc_client(VncState *client)
 {
     VncClientInfo *info;
     Error *err = NULL;
@@ -344,6 +344,14 @@ static VncClientInfo *qmp_query_vnc_client(const VncState *client)
     }
 #endif
 
+    info->encoder = g_new0(VncEncoderStats, 1);
+    vnc_lock_output(client);
+    info->encoder->updates = client->encode_updates;
+    info->encoder->rects = client->encode_rects;
+    info->encoder->latency = client->encode_latency_ns;
+    info->encoder->latency_max = client->encode_latency_max_ns;
+    vnc_unlock_output(client);
+
     return info;
 }
 
@@ -972,6 +980,11 @@ int vnc_send_framebuffer_update(VncState *vs, int x, int y, int w, int h)
         case VNC_ENCODING_ZYWRLE:
             n = vnc_zywrle_send_framebuffer_update(vs, x, y, w, h);
             break;
+#ifdef CONFIG_VNC_H264
+        case VNC_ENCODING_H264:
+            n = vnc_h264_send_framebuffer_update(vs, x, y, w, h);
+            break;
+#endif
         default:
             vnc_framebuffer_update(vs, x, y, w, h, VNC_ENCODING_RAW);
             n = vnc_raw_send_framebuffer_update(vs, x, y, w, h);
@@ -1174,6 +1187,17 @@ static int vnc_update_client(VncState *vs, int has_dirty)
     height = pixman_image_get_height(vd->server);
     width = pixman_image_get_width(vd->server);
 
+#ifdef CONFIG_VNC_H264
+    if (vs->vnc_encoding == VNC_ENCODING_H264) {
+        /*
+         * The encoder codes whole frames and skips unchanged macroblocks
+         * itself, so replace the dirty map with a single rectangle.
+         */
+        bitmap_zero((unsigned long *) &vs->dirty, height * VNC_DIRTY_BPL(vs));
+        n += vnc_job_add_rect(job, 0, 0, width, height);
+    }
+#endif
+
     y = 0;
     for (;;) {
         int x, h;
@@ -1325,6 +1349,9 @@ void vnc_disconnect_finish(VncState *vs)
     vnc_zlib_clear(vs);
     vnc_tight_clear(vs);
     vnc_zrle_clear(vs);
+#ifdef CONFIG_VNC_H264
+    vnc_h264_clear(vs);
+#endif
 
 #ifdef CONFIG_VNC_SASL
     vnc_sasl_client_cleanup(vs);
@@ -2176,6 +2203,14 @@ static void set_encodings(VncState *vs, int32_t *encodings, size_t n_encodings)
             vs->features |= VNC_FEATURE_ZYWRLE_MASK;
             vs->vnc_encoding = enc;
             break;
+#ifdef CONFIG_VNC_H264
+        case VNC_ENCODING_H264:
+            if (vnc_h264_available()) {
+                vs->features |= VNC_FEATURE_H264_MASK;
+                vs->vnc_encoding = enc;
+            }
+            break;
+#endif
         case VNC_ENCODING_DESKTOPRESIZE:
             vs->features |= VNC_FEATURE_RESIZE_MASK;
             break;
@@ -3078,12 +3113,39 @@ static void vnc_rect_updated(VncDisplay *vd, int x, int y, struct timeval * tv)
     rect->updated = true;
 }
 
+typedef uint64_t VncCmpVec __attribute__((vector_size(16)));
+
+/*
+ * Copy @len bytes from @src to @dst if they differ, and return whether they
+ * did.  The comparison has no early exit, so that a block is loaded in one
+ * pass over both surfaces and the copy finds it still in cache.
+ */
+static bool vnc_cmp_copy(uint8_t *dst, const uint8_t *src, size_t len)
+{
+    VncCmpVec diff = { 0, 0 };
+    size_t i;
+
+    for (i = 0; i + sizeof(VncCmpVec) <= len; i += sizeof(VncCmpVec)) {
+        VncCmpVec a, b;
+
+        memcpy(&a, dst + i, sizeof(a));
+        memcpy(&b, src + i, sizeof(b));
+        diff |= a ^ b;
+    }
+    if (!(diff[0] | diff[1]) && memcmp(dst + i, src + i, len - i) == 0) {
+        return false;
+    }
+    memcpy(dst, src, len);
+    return true;
+}
+
 static int vnc_refresh_server_surface(VncDisplay *vd)
 {
     int width = MIN(pixman_image_get_width(vd->guest.fb),
                     pixman_image_get_width(vd->server));
     int height = MIN(pixman_image_get_height(vd->guest.fb),
                      pixman_image_get_height(vd->server));
+    int nblocks = DIV_ROUND_UP(width, VNC_DIRTY_PIXELS_PER_BIT);
     int cmp_bytes, server_stride, line_bytes, guest_ll, guest_stride, y = 0;
     uint8_t *guest_row0 = NULL, *server_row0;
     VncState *vs;
@@ -3092,6 +3154,8 @@ static int vnc_refresh_server_surface(VncDisplay *vd)
     unsigned long offset;
     int x;
     uint8_t *guest_ptr, *server_ptr;
+    DECLARE_BITMAP(changed, VNC_DIRTY_BITS);
+    bool row_changed;
 
     struct timeval tv = { 0, 0 };
 
@@ -3134,7 +3198,7 @@ static int vnc_refresh_server_surface(VncDisplay *vd)
         y = offset / VNC_DIRTY_BPL(&vd->guest);
         x = offset % VNC_DIRTY_BPL(&vd->guest);
 
-        server_ptr = server_row0 + y * server_stride + x * cmp_bytes;
+        server_ptr = server_row0 + y * server_stride;
 
         if (vd->guest.format != VNC_SERVER_FB_FORMAT) {
             qemu_pixman_linebuf_fill(tmpbuf, vd->guest.fb, width, 0, y);
@@ -3142,30 +3206,40 @@ static int vnc_refresh_server_surface(VncDisplay *vd)
         } else {
             guest_ptr = guest_row0 + y * guest_stride;
         }
-        guest_ptr += x * cmp_bytes;
 
-        for (; x < DIV_ROUND_UP(width, VNC_DIRTY_PIXELS_PER_BIT);
-             x++, guest_ptr += cmp_bytes, server_ptr += cmp_bytes) {
+        /*
+         * Only visit the dirty blocks of the row, and collect the blocks
+         * that really changed so that every client's dirty map is updated
+         * once per row.
+         */
+        bitmap_zero(changed, nblocks);
+        row_changed = false;
+        for (x = find_next_bit(vd->guest.dirty[y], nblocks, x); x < nblocks;
+             x = find_next_bit(vd->guest.dirty[y], nblocks, x + 1)) {
             int _cmp_bytes = cmp_bytes;
-            if (!test_and_clear_bit(x, vd->guest.dirty[y])) {
-                continue;
-            }
+
             if ((x + 1) * cmp_bytes > line_bytes) {
                 _cmp_bytes = line_bytes - x * cmp_bytes;
             }
             assert(_cmp_bytes >= 0);
-            if (memcmp(server_ptr, guest_ptr, _cmp_bytes) == 0) {
+            if (!vnc_cmp_copy(server_ptr + x * cmp_bytes,
+                              guest_ptr + x * cmp_bytes, _cmp_bytes)) {
                 continue;
             }
-            memcpy(server_ptr, guest_ptr, _cmp_bytes);
             if (!vd->non_adaptive) {
                 vnc_rect_updated(vd, x * VNC_DIRTY_PIXELS_PER_BIT,
                                  y, &tv);
             }
+            set_bit(x, changed);
+            row_changed = true;
+            has_dirty++;
+        }
+        bitmap_clear(vd->guest.dirty[y], 0, nblocks);
+
+        if (row_changed) {
             QTAILQ_FOREACH(vs, &vd->clients, next) {
-                set_bit(x, vs->dirty[y]);
+                bitmap_or(vs->dirty[y], vs->dirty[y], changed, nblocks);
             }
-            has_dirty++;
         }
 
         y++;
@@ -3398,7 +3472,8 @@ void vnc_display_init(const char *id, Error **errp)
     vd->connections_limit = 32;
 
     qemu_mutex_init(&vd->mutex);
-    vnc_start_worker_thread();
+    qemu_cond_init(&vd->encoders_cond);
+    vnc_start_worker_threads(1);
 
     vd->dcl.ops = &dcl_ops;
     register_displaychangelistener(&vd->dcl);
@@ -3576,6 +3651,9 @@ static QemuOptsList qemu_vnc_opts = {
         },{
             .name = "power-control",
             .type = QEMU_OPT_BOOL,
+        },{
+            .name = "encode-threads",
+            .type = QEMU_OPT_NUMBER,
         },
         { /* end of list */ }
     },
@@ -4012,6 +4090,7 @@ void vnc_display_open(const char *id, Error **errp)
     const char *saslauthz;
     int lock_key_sync = 1;
     int key_delay_ms;
+    int64_t encode_threads;
     const char *audiodev;
     const char *passwordSecret;
 
@@ -4121,6 +4200,14 @@ void vnc_display_open(const char *id, Error **errp)
     }
     vd->connections_limit = qemu_opt_get_number(opts, "connections", 32);
 
+    encode_threads = qemu_opt_get_number(opts, "encode-threads", 1);
+    if (encode_threads < 1 || encode_threads > VNC_MAX_ENCODE_THREADS) {
+        error_setg(errp, "encode-threads must be between 1 and %d",
+                   VNC_MAX_ENCODE_THREADS);
+        goto fail;
+    }
+    vnc_start_worker_threads(encode_threads);
+
 #ifdef CONFIG_VNC_JPEG
     vd->lossy = qemu_opt_get_bool(opts, "lossy", false);
 #endif
@@ -64,6 +64,7 @@ typedef struct VncState VncState;
 typedef struct VncJob VncJob;
 typedef struct VncRect VncRect;
 typedef struct VncRectEntry VncRectEntry;
+typedef struct VncH264 VncH264;
 
 typedef int VncReadEvent(VncState *vs, uint8_t *data, size_t len);
 
@@ -91,6 +92,9 @@ typedef void VncSendHextileTile(VncState *vs,
  * VNC_DIRTY_BITS due to alignment */
 #define VNC_DIRTY_BPL(x) (sizeof((x)->dirty) / VNC_MAX_HEIGHT * BITS_PER_BYTE)
 
+/* Encoding threads shared by all VNC displays */
+#define VNC_MAX_ENCODE_THREADS 64
+
 #define VNC_STAT_RECT  64
 #define VNC_STAT_COLS (VNC_MAX_WIDTH / VNC_STAT_RECT)
 #define VNC_STAT_ROWS (VNC_MAX_HEIGHT / VNC_STAT_RECT)
@@ -158,6 +162,8 @@ struct VncDisplay
     int ledstate;
     QKbdState *kbd;
     QemuMutex mutex;
+    QemuCond encoders_cond;
+    int encoders; /* worker threads holding the display lock shared */
 
     int cursor_msize;
     uint8_t *cursor_mask;
@@ -249,6 +255,8 @@ struct VncRectEntry
 struct VncJob
 {
     VncState *vs;
+    bool running; /* picked by a worker thread */
+    int64_t queued_ns;
 
     QLIST_HEAD(, VncRectEntry) rectangles;
     QTAILQ_ENTRY(VncJob) next;
@@ -337,6 +345,12 @@ struct VncState
     QEMUBH *bh;
     Buffer jobs_buffer;
 
+    /* Encoding statistics, protected by output_mutex */
+    uint64_t encode_updates;
+    uint64_t encode_rects;
+    uint64_t encode_latency_ns;     /* from vnc_job_push() to jobs_buffer */
+    uint64_t encode_latency_max_ns;
+
     /* Encoding specific, if you add something here, don't forget to
      *  update vnc_async_encoding_start()
      */
@@ -345,6 +359,9 @@ struct VncState
     VncHextile hextile;
     VncZrle *zrle;
     VncZywrle zywrle;
+#ifdef CONFIG_VNC_H264
+    VncH264 *h264;
+#endif
 
     Notifier mouse_mode_notifier;
 
@@ -405,6 +422,7 @@ enum {
 #define VNC_ENCODING_TRLE                 0x0000000f
 #define VNC_ENCODING_ZRLE                 0x00000010
 #define VNC_ENCODING_ZYWRLE               0x00000011
+#define VNC_ENCODING_H264                 0x00000032 /* Open H.264 */
 #define VNC_ENCODING_COMPRESSLEVEL0       0xFFFFFF00 /* -256 */
 #define VNC_ENCODING_QUALITYLEVEL0        0xFFFFFFE0 /* -32  */
 #define VNC_ENCODING_XCURSOR              0xFFFFFF10 /* -240 */
@@ -464,6 +482,7 @@ enum VncFeatures {
     VNC_FEATURE_LED_STATE,
     VNC_FEATURE_XVP,
     VNC_FEATURE_CLIPBOARD_EXT,
+    VNC_FEATURE_H264,
 };
 
 #define VNC_FEATURE_RESIZE_MASK              (1 << VNC_FEATURE_RESIZE)
@@ -481,6 +500,7 @@ enum VncFeatures {
 #define VNC_FEATURE_LED_STATE_MASK           (1 << VNC_FEATURE_LED_STATE)
 #define VNC_FEATURE_XVP_MASK                 (1 << VNC_FEATURE_XVP)
 #define VNC_FEATURE_CLIPBOARD_EXT_MASK       (1 <<  VNC_FEATURE_CLIPBOARD_EXT)
+#define VNC_FEATURE_H264_MASK                (1 << VNC_FEATURE_H264)
 
 
 /* Client -> Server message IDs */
@@ -636,6 +656,12 @@ int vnc_zrle_send_framebuffer_update(VncState *vs, int x, int y, int w, int h);
 int vnc_zywrle_send_framebuffer_update(VncState *vs, int x, int y, int w, int h);
 void vnc_zrle_clear(VncState *vs);
 
+#ifdef CONFIG_VNC_H264
+bool vnc_h264_available(void);
+int vnc_h264_send_framebuffer_update(VncState *vs, int x, int y, int w, int h);
+void vnc_h264_clear(VncState *vs);
+#endif
+
 /* vnc-clipboard.c */
 void vnc_server_cut_text_caps(VncState *vs);
 void vnc_client_cut_text(VncState *vs, size_t len, uint8_t *text);
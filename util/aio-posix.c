@@ -27,6 +27,9 @@
 /* Stop userspace polling on a handler if it isn't active for some time */
 #define POLL_IDLE_INTERVAL_NS (7 * NANOSECONDS_PER_SECOND)
 
+/* How often busy-poll mode checks the file descriptors that are not polled */
+#define POLL_BUSY_ROUND_NS (100 * SCALE_US)
+
 bool aio_poll_disabled(AioContext *ctx)
 {
     return qatomic_read(&ctx->poll_disable_cnt);
@@ -192,6 +195,19 @@ static void aio_set_fd_poll(AioContext *ctx, int fd,
     node->io_poll_end = io_poll_end;
 }
 
+void aio_set_event_notifier_poll_budget(AioContext *ctx,
+                                        EventNotifier *notifier,
+                                        int64_t budget_ns)
+{
+    AioHandler *node = find_aio_handler(ctx, event_notifier_get_fd(notifier));
+
+    if (!node) {
+        return;
+    }
+
+    node->poll_budget_ns = budget_ns;
+}
+
 void aio_set_event_notifier(AioContext *ctx,
                             EventNotifier *notifier,
                             EventNotifierHandler *io_read,
@@ -386,6 +402,16 @@ static bool aio_dispatch_handler(AioContext *ctx, AioHandler *node)
     return progress;
 }
 
+static bool aio_dispatch_handler_timed(AioContext *ctx, AioHandler *node,
+                                       AioLatencyStats *stats)
+{
+    int64_t start = get_clock();
+    bool progress = aio_dispatch_handler(ctx, node);
+
+    aio_latency_record(stats->fd_handler, get_clock() - start);
+    return progress;
+}
+
 /*
  * If we have a list of ready handlers then this is more efficient than
  * scanning all handlers with aio_dispatch_handlers().
@@ -393,12 +419,17 @@ static bool aio_dispatch_handler(AioContext *ctx, AioHandler *node)
 static bool aio_dispatch_ready_handlers(AioContext *ctx,
                                         AioHandlerList *ready_list)
 {
+    AioLatencyStats *stats = aio_context_latency_stats(ctx);
     bool progress = false;
     AioHandler *node;
 
     while ((node = QLIST_FIRST(ready_list))) {
         QLIST_REMOVE(node, node_ready);
-        progress = aio_dispatch_handler(ctx, node) || progress;
+        if (unlikely(stats)) {
+            progress = aio_dispatch_handler_timed(ctx, node, stats) || progress;
+        } else {
+            progress = aio_dispatch_handler(ctx, node) || progress;
+        }
     }
 
     return progress;
@@ -407,16 +438,40 @@ static bool aio_dispatch_ready_handlers(AioContext *ctx,
 /* Slower than aio_dispatch_ready_handlers() but only used via glib */
 static bool aio_dispatch_handlers(AioContext *ctx)
 {
+    AioLatencyStats *stats = aio_context_latency_stats(ctx);
     AioHandler *node, *tmp;
     bool progress = false;
 
     QLIST_FOREACH_SAFE_RCU(node, &ctx->aio_handlers, node, tmp) {
-        progress = aio_dispatch_handler(ctx, node) || progress;
+        if (unlikely(stats) && (node->pfd.revents || node->poll_ready)) {
+            progress = aio_dispatch_handler_timed(ctx, node, stats) || progress;
+        } else {
+            progress = aio_dispatch_handler(ctx, node) || progress;
+        }
     }
 
     return progress;
 }
 
+/* Run expired timers, recording how long their callbacks took */
+static bool aio_run_timers(AioContext *ctx)
+{
+    AioLatencyStats *stats = aio_context_latency_stats(ctx);
+    int64_t start;
+    bool progress;
+
+    if (likely(!stats)) {
+        return timerlistgroup_run_timers(&ctx->tlg);
+    }
+
+    start = get_clock();
+    progress = timerlistgroup_run_timers(&ctx->tlg);
+    if (progress) {
+        aio_latency_record(stats->timers, get_clock() - start);
+    }
+    return progress;
+}
+
 void aio_dispatch(AioContext *ctx)
 {
     qemu_lockcnt_inc(&ctx->list_lock);
@@ -425,7 +480,7 @@ void aio_dispatch(AioContext *ctx)
     aio_free_deleted_handlers(ctx);
     qemu_lockcnt_dec(&ctx->list_lock);
 
-    timerlistgroup_run_timers(&ctx->tlg);
+    aio_run_timers(ctx);
 }
 
 static bool run_poll_handlers_once(AioContext *ctx,
@@ -578,13 +633,23 @@ static bool run_poll_handlers(AioContext *ctx, AioHandlerList *ready_list,
 static bool try_poll_mode(AioContext *ctx, AioHandlerList *ready_list,
                           int64_t *timeout)
 {
+    AioHandler *node;
+    int64_t poll_ns = ctx->poll_ns;
     int64_t max_ns;
 
     if (QLIST_EMPTY_RCU(&ctx->poll_aio_handlers)) {
         return false;
     }
 
-    max_ns = qemu_soonest_timeout(*timeout, ctx->poll_ns);
+    /* Handlers with a polling budget are not subject to adaptive polling */
+    QLIST_FOREACH(node, &ctx->poll_aio_handlers, node_poll) {
+        poll_ns = MAX(poll_ns, node->poll_budget_ns);
+    }
+    if (ctx->poll_busy) {
+        poll_ns = MAX(poll_ns, POLL_BUSY_ROUND_NS);
+    }
+
+    max_ns = qemu_soonest_timeout(*timeout, poll_ns);
     if (max_ns && !ctx->fdmon_ops->need_wait(ctx)) {
         /*
          * Enable poll mode. It pairs with the poll_set_started() in
@@ -602,10 +667,13 @@ static bool try_poll_mode(AioContext *ctx, AioHandlerList *ready_list,
 bool aio_poll(AioContext *ctx, bool blocking)
 {
     AioHandlerList ready_list = QLIST_HEAD_INITIALIZER(ready_list);
+    AioLatencyStats *stats = aio_context_latency_stats(ctx);
     bool progress;
     bool use_notify_me;
     int64_t timeout;
     int64_t start = 0;
+    int64_t iter_start = 0;
+    int64_t wait_ns = 0;
 
     /*
      * There cannot be two concurrent aio_poll calls for the same AioContext (or
@@ -624,11 +692,30 @@ bool aio_poll(AioContext *ctx, bool blocking)
     if (ctx->poll_max_ns) {
         start = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
     }
+    if (unlikely(stats)) {
+        iter_start = get_clock();
+    }
 
     timeout = blocking ? aio_compute_timeout(ctx) : 0;
     progress = try_poll_mode(ctx, &ready_list, &timeout);
     assert(!(timeout && progress));
 
+    if (unlikely(stats)) {
+        stat64_add(&stats->poll_ns, get_clock() - iter_start);
+    }
+
+    /*
+     * In busy-poll mode, do not leave poll mode so that the polled handlers
+     * keep their notifications suppressed.  Check the other file descriptors
+     * without blocking and go back to polling.
+     */
+    if (ctx->poll_busy && timeout && ctx->poll_started &&
+        !QLIST_EMPTY_RCU(&ctx->poll_aio_handlers) &&
+        !ctx->fdmon_ops->need_wait(ctx)) {
+        timeout = 0;
+        ctx->fdmon_ops->wait(ctx, &ready_list, 0);
+    }
+
     /*
      * aio_notify can avoid the expensive event_notifier_set if
      * everything (file descriptors, bottom halves, timers) will
@@ -667,7 +754,15 @@ bool aio_poll(AioContext *ctx, bool blocking)
             progress = true;
         }
 
-        ctx->fdmon_ops->wait(ctx, &ready_list, timeout);
+        if (unlikely(stats)) {
+            int64_t wait_start = get_clock();
+
+            ctx->fdmon_ops->wait(ctx, &ready_list, timeout);
+            wait_ns = get_clock() - wait_start;
+            stat64_add(&stats->block_ns, wait_ns);
+        } else {
+            ctx->fdmon_ops->wait(ctx, &ready_list, timeout);
+        }
     }
 
     if (use_notify_me) {
@@ -722,11 +817,21 @@ bool aio_poll(AioContext *ctx, bool blocking)
     progress |= aio_bh_poll(ctx);
     progress |= aio_dispatch_ready_handlers(ctx, &ready_list);
 
+    if (ctx->fdmon_ops->dispatch) {
+        progress |= ctx->fdmon_ops->dispatch(ctx);
+    }
+
     aio_free_deleted_handlers(ctx);
 
     qemu_lockcnt_dec(&ctx->list_lock);
 
-    progress |= timerlistgroup_run_timers(&ctx->tlg);
+    progress |= aio_run_timers(ctx);
+
+    if (unlikely(stats)) {
+        /* Waiting for events is accounted separately in block_ns */
+        aio_latency_record(stats->iteration,
+                           get_clock() - iter_start - wait_ns);
+    }
 
     return progress;
 }
@@ -777,14 +882,22 @@ void aio_context_set_poll_params(AioContext *ctx, int64_t max_ns,
     aio_notify(ctx);
 }
 
+void aio_context_set_poll_busy(AioContext *ctx, bool busy, Error **errp)
+{
+    ctx->poll_busy = busy;
+
+    aio_notify(ctx);
+}
+
 void aio_context_set_aio_params(AioContext *ctx, int64_t max_batch,
-                                Error **errp)
+                                bool adaptive, Error **errp)
 {
     /*
      * No thread synchronization here, it doesn't matter if an incorrect value
      * is used once.
      */
     ctx->aio_max_batch = max_batch;
+    ctx->aio_batch_adaptive = adaptive;
 
     aio_notify(ctx);
 }
@@ -177,6 +177,13 @@ void aio_set_event_notifier_poll(AioContext *ctx,
     /* Not implemented */
 }
 
+void aio_set_event_notifier_poll_budget(AioContext *ctx,
+                                        EventNotifier *notifier,
+                                        int64_t budget_ns)
+{
+    /* Not implemented */
+}
+
 bool aio_prepare(AioContext *ctx)
 {
     static struct timeval tv0;
@@ -438,7 +445,14 @@ void aio_context_set_poll_params(AioContext *ctx, int64_t max_ns,
     }
 }
 
+void aio_context_set_poll_busy(AioContext *ctx, bool busy, Error **errp)
+{
+    if (busy) {
+        error_setg(errp, "AioContext polling is not implemented on Windows");
+    }
+}
+
 void aio_context_set_aio_params(AioContext *ctx, int64_t max_batch,
-                                Error **errp)
+                                bool adaptive, Error **errp)
 {
 }
@@ -66,6 +66,7 @@ struct QEMUBH {
     QSLIST_ENTRY(QEMUBH) next;
     unsigned flags;
     MemReentrancyGuard *reentrancy_guard;
+    int64_t enqueue_ns;     /* for latency stats, 0 if not recorded */
 };
 
 /* Called concurrently from any thread */
@@ -81,6 +82,9 @@ static void aio_bh_enqueue(QEMUBH *bh, unsigned new_flags)
     old_flags = qatomic_fetch_or(&bh->flags, BH_PENDING | new_flags);
 
     if (!(old_flags & BH_PENDING)) {
+        /* Only aio_bh_enqueue() touches this while BH_PENDING is clear */
+        bh->enqueue_ns = aio_context_latency_stats(ctx) ? get_clock() : 0;
+
         /*
          * At this point the bottom half becomes visible to aio_bh_poll().
          * This insertion thus synchronizes with QSLIST_MOVE_ATOMIC in
@@ -104,7 +108,8 @@ static void aio_bh_enqueue(QEMUBH *bh, unsigned new_flags)
 }
 
 /* Only called from aio_bh_poll() and aio_ctx_finalize() */
-static QEMUBH *aio_bh_dequeue(BHList *head, unsigned *flags)
+static QEMUBH *aio_bh_dequeue(BHList *head, unsigned *flags,
+                              int64_t *enqueue_ns)
 {
     QEMUBH *bh = QSLIST_FIRST_RCU(head);
 
@@ -113,6 +118,7 @@ static QEMUBH *aio_bh_dequeue(BHList *head, unsigned *flags)
     }
 
     QSLIST_REMOVE_HEAD(head, next);
+    *enqueue_ns = bh->enqueue_ns;
 
     /*
      * Synchronizes with qatomic_fetch_or() in aio_bh_enqueue(), ensuring that
@@ -201,8 +207,9 @@ int aio_bh_poll(AioContext *ctx)
     while ((s = QSIMPLEQ_FIRST(&ctx->bh_slice_list))) {
         QEMUBH *bh;
         unsigned flags;
+        int64_t enqueue_ns;
 
-        bh = aio_bh_dequeue(&s->bh_list, &flags);
+        bh = aio_bh_dequeue(&s->bh_list, &flags, &enqueue_ns);
         if (!bh) {
             QSIMPLEQ_REMOVE_HEAD(&ctx->bh_slice_list, next);
             continue;
@@ -210,10 +217,22 @@ int aio_bh_poll(AioContext *ctx)
 
         if ((flags & (BH_SCHEDULED | BH_DELETED)) == BH_SCHEDULED) {
             /* Idle BHs don't count as progress */
+            AioLatencyStats *stats = aio_context_latency_stats(ctx);
+
             if (!(flags & BH_IDLE)) {
                 ret = 1;
             }
-            aio_bh_call(bh);
+            if (unlikely(stats)) {
+                int64_t start = get_clock();
+
+                if (enqueue_ns) {
+                    aio_latency_record(stats->bh_delay, start - enqueue_ns);
+                }
+                aio_bh_call(bh);
+                aio_latency_record(stats->bh, get_clock() - start);
+            } else {
+                aio_bh_call(bh);
+            }
         }
         if (flags & (BH_DELETED | BH_ONESHOT)) {
             g_free(bh);
@@ -365,6 +384,7 @@ aio_ctx_finalize(GSource     *source)
     AioContext *ctx = (AioContext *) source;
     QEMUBH *bh;
     unsigned flags;
+    int64_t enqueue_ns;
 
     thread_pool_free(ctx->thread_pool);
 
@@ -377,10 +397,12 @@ aio_ctx_finalize(GSource     *source)
 #endif
 
 #ifdef CONFIG_LINUX_IO_URING
-    if (ctx->linux_io_uring) {
-        luring_detach_aio_context(ctx->linux_io_uring, ctx);
-        luring_cleanup(ctx->linux_io_uring);
-        ctx->linux_io_uring = NULL;
+    for (int i = 0; i < LURING_MODE__MAX; i++) {
+        if (ctx->linux_io_uring[i]) {
+            luring_detach_aio_context(ctx->linux_io_uring[i], ctx);
+            luring_cleanup(ctx->linux_io_uring[i]);
+            ctx->linux_io_uring[i] = NULL;
+        }
     }
 #endif
 
@@ -390,7 +412,7 @@ aio_ctx_finalize(GSource     *source)
     /* There must be no aio_bh_poll() calls going on */
     assert(QSIMPLEQ_EMPTY(&ctx->bh_slice_list));
 
-    while ((bh = aio_bh_dequeue(&ctx->bh_list, &flags))) {
+    while ((bh = aio_bh_dequeue(&ctx->bh_list, &flags, &enqueue_ns))) {
         /*
          * qemu_bh_delete() must have been called on BHs in this AioContext. In
          * many cases memory leaks, hangs, or inconsistent state occur when a
@@ -416,6 +438,7 @@ aio_ctx_finalize(GSource     *source)
     timerlistgroup_deinit(&ctx->tlg);
     unregister_aiocontext(ctx);
     aio_context_destroy(ctx);
+    g_free(ctx->latency_stats_data);
 }
 
 static GSourceFuncs aio_source_funcs = {
@@ -460,25 +483,36 @@ LinuxAioState *aio_get_linux_aio(AioContext *ctx)
 #endif
 
 #ifdef CONFIG_LINUX_IO_URING
-LuringState *aio_setup_linux_io_uring(AioContext *ctx, Error **errp)
+LuringState *aio_setup_linux_io_uring(AioContext *ctx, LuringMode mode,
+                                      Error **errp)
 {
-    if (ctx->linux_io_uring) {
-        return ctx->linux_io_uring;
+    if (ctx->linux_io_uring[mode]) {
+        return ctx->linux_io_uring[mode];
     }
 
-    ctx->linux_io_uring = luring_init(errp);
-    if (!ctx->linux_io_uring) {
+    ctx->linux_io_uring[mode] = luring_init(mode, errp);
+    if (!ctx->linux_io_uring[mode]) {
         return NULL;
     }
 
-    luring_attach_aio_context(ctx->linux_io_uring, ctx);
-    return ctx->linux_io_uring;
+    luring_attach_aio_context(ctx->linux_io_uring[mode], ctx);
+    return ctx->linux_io_uring[mode];
 }
 
-LuringState *aio_get_linux_io_uring(AioContext *ctx)
+LuringState *aio_get_linux_io_uring(AioContext *ctx, LuringMode mode)
 {
-    assert(ctx->linux_io_uring);
-    return ctx->linux_io_uring;
+    if (mode != LURING_MODE_DEFAULT && !ctx->linux_io_uring[mode]) {
+        Error *local_err = NULL;
+
+        assert(qemu_get_current_aio_context() == ctx);
+        if (!aio_setup_linux_io_uring(ctx, mode, &local_err)) {
+            error_report_err(local_err);
+            return NULL;
+        }
+    }
+
+    assert(ctx->linux_io_uring[mode]);
+    return ctx->linux_io_uring[mode];
 }
 #endif
 
@@ -601,7 +635,9 @@ AioContext *aio_context_new(Error **errp)
 #endif
 
 #ifdef CONFIG_LINUX_IO_URING
-    ctx->linux_io_uring = NULL;
+    for (int i = 0; i < LURING_MODE__MAX; i++) {
+        ctx->linux_io_uring[i] = NULL;
+    }
 #endif
 
     ctx->thread_pool = NULL;
@@ -612,8 +648,10 @@ AioContext *aio_context_new(Error **errp)
     ctx->poll_max_ns = 0;
     ctx->poll_grow = 0;
     ctx->poll_shrink = 0;
+    ctx->poll_busy = false;
 
     ctx->aio_max_batch = 0;
+    ctx->aio_batch_adaptive = false;
 
     ctx->thread_pool_min = 0;
     ctx->thread_pool_max = THREAD_POOL_MAX_THREADS_DEFAULT;
@@ -754,6 +792,16 @@ void qemu_set_current_aio_context(AioContext *ctx)
     set_my_aiocontext(ctx);
 }
 
+void aio_context_set_latency_stats(AioContext *ctx, bool enable)
+{
+    /* Samples are kept until the AioContext goes away */
+    if (enable && !ctx->latency_stats_data) {
+        ctx->latency_stats_data = g_new0(AioLatencyStats, 1);
+    }
+    qatomic_rcu_set(&ctx->latency_stats,
+                    enable ? ctx->latency_stats_data : NULL);
+}
+
 void aio_context_set_thread_pool_params(AioContext *ctx, int64_t min,
                                         int64_t max, Error **errp)
 {
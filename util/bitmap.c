@@ -218,6 +218,43 @@ void bitmap_set_atomic(unsigned long *map, long start, long nr)
     }
 }
 
+/*
+ * Like bitmap_set_atomic(), but words that already have all the requested
+ * bits set are only read.  This keeps cache lines of mostly-set bitmaps
+ * shared when many threads mark the same area, at the cost of one full
+ * barrier up front: stores done before the call are ordered before the
+ * bitmap is read, pairing with the barrier in bitmap_test_and_clear_atomic()
+ * and friends.  No barrier is implied after the bits are set.
+ */
+void bitmap_set_atomic_lazy(unsigned long *map, long start, long nr)
+{
+    unsigned long *p = map + BIT_WORD(start);
+    const long size = start + nr;
+    int bits_to_set = BITS_PER_LONG - (start % BITS_PER_LONG);
+    unsigned long mask_to_set = BITMAP_FIRST_WORD_MASK(start);
+
+    assert(start >= 0 && nr >= 0);
+
+    smp_mb();
+
+    while (nr - bits_to_set >= 0) {
+        if ((qatomic_read(p) & mask_to_set) != mask_to_set) {
+            qatomic_or(p, mask_to_set);
+        }
+        nr -= bits_to_set;
+        bits_to_set = BITS_PER_LONG;
+        mask_to_set = ~0UL;
+        p++;
+    }
+
+    if (nr) {
+        mask_to_set &= BITMAP_LAST_WORD_MASK(size);
+        if ((qatomic_read(p) & mask_to_set) != mask_to_set) {
+            qatomic_or(p, mask_to_set);
+        }
+    }
+}
+
 void bitmap_clear(unsigned long *map, long start, long nr)
 {
     unsigned long *p = map + BIT_WORD(start);
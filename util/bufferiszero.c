@@ -24,6 +24,7 @@
 #include "qemu/osdep.h"
 #include "qemu/cutils.h"
 #include "qemu/bswap.h"
+#include "qemu/units.h"
 #include "host/cpuinfo.h"
 
 static bool
@@ -288,3 +289,64 @@ bool buffer_is_zero(const void *buf, size_t len)
        includes a check for an unrolled loop over 64-bit integers.  */
     return select_accel_fn(buf, len);
 }
+
+/*
+ * Blocks are checked in groups of this many while inside a zero run, so
+ * that long runs of zeroes are scanned with few calls into the kernel.
+ */
+#define ZERO_RUN_SPAN       16
+
+/*
+ * Larger buffers will not stay in the cache until they are used again, so
+ * fetch them with a non-temporal hint to avoid evicting the caller's data.
+ */
+#define ZERO_RUN_NTA_LEN    (8 * MiB)
+
+size_t buffer_find_zero_runs(const void *buf, size_t len, size_t granularity,
+                             BufferZeroRun *runs, size_t max_runs)
+{
+    const char *p = buf;
+    bool nta = len >= ZERO_RUN_NTA_LEN;
+    size_t off = 0, span_end = 0, n = 0;
+
+    assert(granularity > 0 && max_runs > 0);
+
+    while (off < len) {
+        size_t blen = MIN(granularity, len - off);
+        BufferZeroRun *r = n ? &runs[n - 1] : NULL;
+        bool zero;
+
+        if (nta && len - off > granularity) {
+            __builtin_prefetch(p + off + granularity, 0, 0);
+        }
+
+        /*
+         * Inside a zero run, try to skip a whole span at once.  If the span
+         * has data, go block by block until its end before trying again.
+         */
+        if (r && r->zero && off >= span_end) {
+            size_t span = MIN(ZERO_RUN_SPAN * granularity, len - off);
+
+            if (span > blen && select_accel_fn(p + off, span)) {
+                r->length += span;
+                off += span;
+                continue;
+            }
+            span_end = off + span;
+        }
+
+        zero = select_accel_fn(p + off, blen);
+        if (r && r->zero == zero) {
+            r->length += blen;
+        } else if (n < max_runs) {
+            r = &runs[n++];
+            r->offset = off;
+            r->length = blen;
+            r->zero = zero;
+        } else {
+            break;
+        }
+        off += blen;
+    }
+    return n;
+}
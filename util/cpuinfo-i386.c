@@ -37,6 +37,8 @@ unsigned __attribute__((constructor)) cpuinfo_init(void)
         info |= (d & bit_CMOV ? CPUINFO_CMOV : 0);
         info |= (d & bit_SSE2 ? CPUINFO_SSE2 : 0);
         info |= (c & bit_SSE4_1 ? CPUINFO_SSE4 : 0);
+        info |= (c & bit_SSE4_2 ? CPUINFO_SSE42 : 0);
+        info |= (c & bit_PCLMUL ? CPUINFO_PCLMUL : 0);
         info |= (c & bit_MOVBE ? CPUINFO_MOVBE : 0);
         info |= (c & bit_POPCNT ? CPUINFO_POPCNT : 0);
 
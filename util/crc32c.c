@@ -26,7 +26,9 @@
  */
 
 #include "qemu/osdep.h"
+#include "qemu/bswap.h"
 #include "qemu/crc32c.h"
+#include "host/cpuinfo.h"
 
 /*
  * This is the CRC-32C table
@@ -105,12 +107,193 @@ static const uint32_t crc32c_table[256] = {
 };
 
 
-uint32_t crc32c(uint32_t crc, const uint8_t *data, unsigned int length)
+static uint32_t crc32c_table_update(uint32_t crc, const uint8_t *data,
+                                    size_t length)
 {
     while (length--) {
         crc = crc32c_table[(crc ^ *data++) & 0xFFL] ^ (crc >> 8);
     }
-    return crc^0xffffffff;
+    return crc;
+}
+
+#ifdef CONFIG_CRC32C_SSE42_OPT
+#include <immintrin.h>
+
+/* Reflected CRC-32C polynomial, used to multiply by x */
+#define CRC32C_POLY_REV     0x82F63B78u
+
+/* Length of each of the three interleaved streams, in bytes */
+#define CRC32C_STRIDE       512
+
+/*
+ * Return x^n mod P, bit-reflected like the CRC itself.  The combination
+ * constants below depend on the stream length only, so they are computed
+ * once at startup.
+ */
+static uint32_t crc32c_xpow(unsigned n)
+{
+    uint32_t r = 0x80000000u;   /* x^0 */
+
+    while (n--) {
+        r = (r >> 1) ^ (r & 1 ? CRC32C_POLY_REV : 0);
+    }
+    return r;
+}
+
+/*
+ * Multiplying the 32-bit CRC by x^(n-33) with a carry-less multiply and
+ * reducing the 64-bit product with the CRC instruction yields the CRC
+ * multiplied by x^n, i.e. the CRC advanced over n/8 zero bytes.
+ */
+static uint32_t crc32c_k1;      /* x^(8 * CRC32C_STRIDE - 33) */
+static uint32_t crc32c_k2;      /* x^(16 * CRC32C_STRIDE - 33) */
+
+static uint32_t __attribute__((target("sse4.2")))
+crc32c_sse42(uint32_t crc, const uint8_t *data, size_t length)
+{
+    uint64_t crc64;
+
+    while (length && ((uintptr_t)data & 7)) {
+        crc = _mm_crc32_u8(crc, *data++);
+        length--;
+    }
+
+    crc64 = crc;
+    while (length >= 8) {
+        crc64 = _mm_crc32_u64(crc64, ldq_le_p(data));
+        data += 8;
+        length -= 8;
+    }
+
+    crc = crc64;
+    while (length--) {
+        crc = _mm_crc32_u8(crc, *data++);
+    }
+    return crc;
+}
+
+static inline uint32_t __attribute__((target("sse4.2,pclmul")))
+crc32c_shift_pclmul(uint32_t crc, uint32_t k)
+{
+    __m128i p = _mm_clmulepi64_si128(_mm_cvtsi32_si128(crc),
+                                     _mm_cvtsi32_si128(k), 0);
+
+    return _mm_crc32_u64(0, _mm_cvtsi128_si64(p));
+}
+
+/*
+ * The CRC32 instruction has a latency of three cycles but a throughput of
+ * one per cycle, so run three independent streams and merge them with
+ * carry-less multiplications.
+ */
+static uint32_t __attribute__((target("sse4.2,pclmul")))
+crc32c_pclmul(uint32_t crc, const uint8_t *data, size_t length)
+{
+    while (length >= 3 * CRC32C_STRIDE) {
+        uint64_t c0 = crc, c1 = 0, c2 = 0;
+        size_t i;
+
+        for (i = 0; i < CRC32C_STRIDE; i += 8) {
+            c0 = _mm_crc32_u64(c0, ldq_le_p(data + i));
+            c1 = _mm_crc32_u64(c1, ldq_le_p(data + CRC32C_STRIDE + i));
+            c2 = _mm_crc32_u64(c2, ldq_le_p(data + 2 * CRC32C_STRIDE + i));
+        }
+        crc = crc32c_shift_pclmul(c0, crc32c_k2) ^
+              crc32c_shift_pclmul(c1, crc32c_k1) ^ c2;
+        data += 3 * CRC32C_STRIDE;
+        length -= 3 * CRC32C_STRIDE;
+    }
+    return crc32c_sse42(crc, data, length);
+}
+#endif /* CONFIG_CRC32C_SSE42_OPT */
+
+#ifdef CONFIG_CRC32C_AARCH64_OPT
+#include <arm_acle.h>
+
+static uint32_t __attribute__((target("+crc")))
+crc32c_aarch64(uint32_t crc, const uint8_t *data, size_t length)
+{
+    while (length && ((uintptr_t)data & 7)) {
+        crc = __crc32cb(crc, *data++);
+        length--;
+    }
+    while (length >= 8) {
+        crc = __crc32cd(crc, ldq_le_p(data));
+        data += 8;
+        length -= 8;
+    }
+    while (length--) {
+        crc = __crc32cb(crc, *data++);
+    }
+    return crc;
+}
+#endif /* CONFIG_CRC32C_AARCH64_OPT */
+
+static uint32_t (*crc32c_accel)(uint32_t, const uint8_t *, size_t) =
+    crc32c_table_update;
+
+#if defined(CONFIG_CRC32C_SSE42_OPT) || defined(CONFIG_CRC32C_AARCH64_OPT)
+static unsigned used_accel;
+
+static unsigned __attribute__((noinline))
+select_accel_cpuinfo(unsigned info)
+{
+    /* Array is sorted in order of algorithm preference. */
+    static const struct {
+        unsigned bit;
+        uint32_t (*fn)(uint32_t, const uint8_t *, size_t);
+    } all[] = {
+#ifdef CONFIG_CRC32C_SSE42_OPT
+        { CPUINFO_PCLMUL,   crc32c_pclmul },
+        { CPUINFO_SSE42,    crc32c_sse42 },
+#endif
+#ifdef CONFIG_CRC32C_AARCH64_OPT
+        { CPUINFO_CRC32,    crc32c_aarch64 },
+#endif
+        { CPUINFO_ALWAYS,   crc32c_table_update },
+    };
+
+    for (unsigned i = 0; i < ARRAY_SIZE(all); ++i) {
+        /* PCLMUL on its own is not enough, the streams use CRC32 */
+        if ((info & all[i].bit) &&
+            (all[i].bit != CPUINFO_PCLMUL || (cpuinfo & CPUINFO_SSE42))) {
+            crc32c_accel = all[i].fn;
+            return all[i].bit;
+        }
+    }
+    return 0;
+}
+
+static void __attribute__((constructor)) init_crc32c_accel(void)
+{
+#ifdef CONFIG_CRC32C_SSE42_OPT
+    crc32c_k1 = crc32c_xpow(8 * CRC32C_STRIDE - 33);
+    crc32c_k2 = crc32c_xpow(16 * CRC32C_STRIDE - 33);
+#endif
+    used_accel = select_accel_cpuinfo(cpuinfo_init());
+}
+
+bool test_crc32c_next_accel(void)
+{
+    /*
+     * Accumulate the accelerators that we've already tested, and
+     * remove them from the set to test this round.  We'll get back
+     * a zero from select_accel_cpuinfo when there are no more.
+     */
+    unsigned used = select_accel_cpuinfo(cpuinfo & ~used_accel);
+    used_accel |= used;
+    return used;
+}
+#else
+bool test_crc32c_next_accel(void)
+{
+    return false;
+}
+#endif
+
+uint32_t crc32c(uint32_t crc, const uint8_t *data, unsigned int length)
+{
+    return crc32c_accel(crc, data, length) ^ 0xffffffff;
 }
 
 uint32_t iov_crc32c(uint32_t crc, const struct iovec *iov, size_t iov_cnt)
@@ -19,9 +19,13 @@
  * 4. Nanosecond timeouts are supported so it requires fewer syscalls than
  *    epoll(7).
  *
- * This code only monitors file descriptors and does not do asynchronous disk
- * I/O.  Implementing disk I/O efficiently has other requirements and should
- * use a separate io_uring so it does not make sense to unify the code.
+ * Other io_uring requests, such as disk I/O from block/io_uring.c, can be
+ * placed on the same ring with aio_add_sqe().  They are submitted together
+ * with the fd monitoring sqes and their cqes are reaped in the same
+ * io_uring_enter(2) call, so an IOThread needs a single system call per event
+ * loop iteration instead of one for submission plus an eventfd wakeup and
+ * poll for a separate ring.  Their user_data carries the CqeHandler pointer
+ * tagged with FDMON_IO_URING_CQE_HANDLER to distinguish it from AioHandlers.
  *
  * File descriptor monitoring is implemented using the following operations:
  *
@@ -55,6 +59,9 @@ enum {
     FDMON_IO_URING_PENDING  = (1 << 0),
     FDMON_IO_URING_ADD      = (1 << 1),
     FDMON_IO_URING_REMOVE   = (1 << 2),
+
+    /* Tag in cqe user_data, AioHandler and CqeHandler are pointer-aligned */
+    FDMON_IO_URING_CQE_HANDLER = 1,
 };
 
 static inline int poll_events_from_pfd(int pfd_events)
@@ -74,8 +81,9 @@ static inline int pfd_events_from_poll(int poll_events)
 }
 
 /*
- * Returns an sqe for submitting a request.  Only be called within
- * fdmon_io_uring_wait().
+ * Returns an sqe for submitting a request.  Only be called from the
+ * AioContext's home thread, either within fdmon_io_uring_wait() or through
+ * aio_add_sqe().
  */
 static struct io_uring_sqe *get_sqe(AioContext *ctx)
 {
@@ -232,6 +240,16 @@ static bool process_cqe(AioContext *ctx,
         return false;
     }
 
+    if ((uintptr_t)node & FDMON_IO_URING_CQE_HANDLER) {
+        CqeHandler *cqe_handler = (CqeHandler *)
+            ((uintptr_t)node & ~(uintptr_t)FDMON_IO_URING_CQE_HANDLER);
+
+        /* The cqe is recycled after io_uring_cq_advance(), keep a copy */
+        cqe_handler->cqe = *cqe;
+        QSIMPLEQ_INSERT_TAIL(&ctx->cqe_handler_ready_list, cqe_handler, next);
+        return true;
+    }
+
     /*
      * Deletion can only happen when IORING_OP_POLL_ADD completes.  If we race
      * with enqueue() here then we can safely clear the FDMON_IO_URING_REMOVE
@@ -313,12 +331,49 @@ static bool fdmon_io_uring_need_wait(AioContext *ctx)
     return false;
 }
 
+static bool fdmon_io_uring_dispatch(AioContext *ctx)
+{
+    CqeHandlerSimpleQ *ready_list = &ctx->cqe_handler_ready_list;
+    bool progress = false;
+
+    /* Callbacks may run a nested aio_poll() that drains this list too */
+    while (!QSIMPLEQ_EMPTY(ready_list)) {
+        CqeHandler *cqe_handler = QSIMPLEQ_FIRST(ready_list);
+
+        QSIMPLEQ_REMOVE_HEAD(ready_list, next);
+        cqe_handler->cb(cqe_handler);
+        progress = true;
+    }
+
+    return progress;
+}
+
 static const FDMonOps fdmon_io_uring_ops = {
     .update = fdmon_io_uring_update,
     .wait = fdmon_io_uring_wait,
     .need_wait = fdmon_io_uring_need_wait,
+    .dispatch = fdmon_io_uring_dispatch,
 };
 
+bool aio_has_io_uring(AioContext *ctx)
+{
+    return ctx->fdmon_ops == &fdmon_io_uring_ops;
+}
+
+void aio_add_sqe(void (*prep_sqe)(struct io_uring_sqe *sqe, void *opaque),
+                 void *opaque, CqeHandler *cqe_handler)
+{
+    AioContext *ctx = qemu_get_current_aio_context();
+    struct io_uring_sqe *sqe;
+
+    assert(aio_has_io_uring(ctx));
+
+    sqe = get_sqe(ctx);
+    prep_sqe(sqe, opaque);
+    io_uring_sqe_set_data(sqe, (void *)((uintptr_t)cqe_handler |
+                                        FDMON_IO_URING_CQE_HANDLER));
+}
+
 bool fdmon_io_uring_setup(AioContext *ctx)
 {
     int ret;
@@ -329,6 +384,7 @@ bool fdmon_io_uring_setup(AioContext *ctx)
     }
 
     QSLIST_INIT(&ctx->submit_list);
+    QSIMPLEQ_INIT(&ctx->cqe_handler_ready_list);
     ctx->fdmon_ops = &fdmon_io_uring_ops;
     return true;
 }
@@ -338,6 +394,12 @@ void fdmon_io_uring_destroy(AioContext *ctx)
     if (ctx->fdmon_ops == &fdmon_io_uring_ops) {
         AioHandler *node;
 
+        /*
+         * aio_add_sqe() requests would be lost, users must have drained them
+         * before switching to glib or destroying the AioContext.
+         */
+        assert(QSIMPLEQ_EMPTY(&ctx->cqe_handler_ready_list));
+
         io_uring_queue_exit(&ctx->fdmon_io_uring);
 
         /* Move handlers due to be removed onto the deleted list */
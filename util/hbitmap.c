@@ -50,8 +50,28 @@
  * extremely sparse, this is also O(m + m/W + m/W^2 + ...), so the amortized
  * cost of advancing from one bit to the next is usually constant (worst case
  * O(logB n) as in the non-amortized complexity).
+ *
+ * The last level is by far the largest, and dirty bitmaps for big disks are
+ * usually either sparse or have long fully-dirty runs.  It is therefore
+ * split into chunks of HBITMAP_CHUNK_WORDS words.  A chunk whose bits are
+ * all clear is not allocated at all (NULL), a chunk whose bits are all set
+ * points to the shared, read-only hb_full_chunk, and only chunks with mixed
+ * content get their own memory.  Chunks are materialized when a partial
+ * update hits them and released again when they become entirely clear.
  */
 
+/* 512 words (4 KiB) per chunk of the last level */
+#define HBITMAP_CHUNK_SHIFT    9
+#define HBITMAP_CHUNK_WORDS    (1 << HBITMAP_CHUNK_SHIFT)
+#define HBITMAP_CHUNK_MASK     (HBITMAP_CHUNK_WORDS - 1)
+
+static const unsigned long hb_full_chunk[HBITMAP_CHUNK_WORDS] = {
+    [0 ... HBITMAP_CHUNK_WORDS - 1] = ~0UL
+};
+static const unsigned long hb_zero_chunk[HBITMAP_CHUNK_WORDS];
+
+#define HB_FULL_CHUNK          ((unsigned long *)hb_full_chunk)
+
 struct HBitmap {
     /*
      * Size of the bitmap, as requested in hbitmap_alloc or in hbitmap_truncate.
@@ -93,14 +113,113 @@ struct HBitmap {
      * actual bitmap.
      *
      * Note that all bitmaps have the same number of levels.  Even a 1-bit
-     * bitmap will still allocate HBITMAP_LEVELS arrays.
+     * bitmap will still allocate HBITMAP_LEVELS - 1 arrays.  The last level
+     * is not stored in levels[] but in @chunks.
      */
     unsigned long *levels[HBITMAP_LEVELS];
 
-    /* The length of each levels[] array. */
+    /* The length of each level, in words. */
     uint64_t sizes[HBITMAP_LEVELS];
+
+    /* The last level, HBITMAP_CHUNK_WORDS words at a time. */
+    unsigned long **chunks;
+    uint64_t nr_chunks;
 };
 
+static inline uint64_t hb_nr_chunks(uint64_t words)
+{
+    return (words + HBITMAP_CHUNK_WORDS - 1) >> HBITMAP_CHUNK_SHIFT;
+}
+
+/* Read word @pos of @level. */
+static inline unsigned long hb_word(const HBitmap *hb, int level, uint64_t pos)
+{
+    unsigned long *chunk;
+
+    if (level < HBITMAP_LEVELS - 1) {
+        return hb->levels[level][pos];
+    }
+
+    chunk = hb->chunks[pos >> HBITMAP_CHUNK_SHIFT];
+    return chunk ? chunk[pos & HBITMAP_CHUNK_MASK] : 0;
+}
+
+static void hb_chunk_free(HBitmap *hb, uint64_t c)
+{
+    if (hb->chunks[c] != HB_FULL_CHUNK) {
+        g_free(hb->chunks[c]);
+    }
+    hb->chunks[c] = NULL;
+}
+
+static void hb_chunk_set_full(HBitmap *hb, uint64_t c)
+{
+    hb_chunk_free(hb, c);
+    hb->chunks[c] = HB_FULL_CHUNK;
+}
+
+/* Give chunk @c private memory, preserving its contents. */
+static unsigned long *hb_chunk_materialize(HBitmap *hb, uint64_t c)
+{
+    unsigned long *chunk = hb->chunks[c];
+
+    if (!chunk) {
+        chunk = g_new0(unsigned long, HBITMAP_CHUNK_WORDS);
+    } else if (chunk == HB_FULL_CHUNK) {
+        chunk = g_memdup2(hb_full_chunk, sizeof(hb_full_chunk));
+    } else {
+        return chunk;
+    }
+
+    hb->chunks[c] = chunk;
+    return chunk;
+}
+
+/* Writable pointer to word @pos of @level. */
+static inline unsigned long *hb_word_ptr(HBitmap *hb, int level, uint64_t pos)
+{
+    if (level < HBITMAP_LEVELS - 1) {
+        return &hb->levels[level][pos];
+    }
+
+    return &hb_chunk_materialize(hb, pos >> HBITMAP_CHUNK_SHIFT)
+        [pos & HBITMAP_CHUNK_MASK];
+}
+
+/*
+ * Word @i is the first of a chunk that lies entirely before @lastpos, so
+ * the whole chunk can be set or cleared at once.
+ */
+static inline bool hb_whole_chunk(int level, uint64_t i, uint64_t lastpos)
+{
+    return level == HBITMAP_LEVELS - 1 && !(i & HBITMAP_CHUNK_MASK) &&
+           i + HBITMAP_CHUNK_WORDS <= lastpos;
+}
+
+/*
+ * Release chunk @c of the last level if all its bits have been cleared.
+ * The level above has one bit per word of the chunk, so that is cheap to
+ * check.
+ */
+static void hb_chunk_trim(HBitmap *hb, uint64_t c)
+{
+    unsigned long *upper = hb->levels[HBITMAP_LEVELS - 2];
+    uint64_t first = (c << HBITMAP_CHUNK_SHIFT) >> BITS_PER_LEVEL;
+    uint64_t last = MIN(((c + 1) << HBITMAP_CHUNK_SHIFT) >> BITS_PER_LEVEL,
+                        hb->sizes[HBITMAP_LEVELS - 2]);
+    uint64_t i;
+
+    if (!hb->chunks[c] || hb->chunks[c] == HB_FULL_CHUNK) {
+        return;
+    }
+    for (i = first; i < last; i++) {
+        if (upper[i]) {
+            return;
+        }
+    }
+    hb_chunk_free(hb, c);
+}
+
 /* Advance hbi to the next nonzero word and return it.  hbi->pos
  * is updated.  Returns zero if we reach the end of the bitmap.
  */
@@ -114,7 +233,7 @@ static unsigned long hbitmap_iter_skip_words(HBitmapIter *hbi)
     do {
         i--;
         pos >>= BITS_PER_LEVEL;
-        cur = hbi->cur[i] & hb->levels[i][pos];
+        cur = hbi->cur[i] & hb_word(hb, i, pos);
     } while (cur == 0);
 
     /* Check for end of iteration.  We always use fewer than BITS_PER_LONG
@@ -136,7 +255,7 @@ static unsigned long hbitmap_iter_skip_words(HBitmapIter *hbi)
         hbi->cur[i] = cur & (cur - 1);
 
         /* Set up next level for iteration.  */
-        cur = hb->levels[i + 1][pos];
+        cur = hb_word(hb, i + 1, pos);
     }
 
     hbi->pos = pos;
@@ -149,7 +268,7 @@ static unsigned long hbitmap_iter_skip_words(HBitmapIter *hbi)
 int64_t hbitmap_iter_next(HBitmapIter *hbi)
 {
     unsigned long cur = hbi->cur[HBITMAP_LEVELS - 1] &
-            hbi->hb->levels[HBITMAP_LEVELS - 1][hbi->pos];
+            hb_word(hbi->hb, HBITMAP_LEVELS - 1, hbi->pos);
     int64_t item;
 
     if (cur == 0) {
@@ -182,7 +301,7 @@ void hbitmap_iter_init(HBitmapIter *hbi, const HBitmap *hb, uint64_t first)
         pos >>= BITS_PER_LEVEL;
 
         /* Drop bits representing items before first.  */
-        hbi->cur[i] = hb->levels[i][pos] & ~((1UL << bit) - 1);
+        hbi->cur[i] = hb_word(hb, i, pos) & ~((1UL << bit) - 1);
 
         /* We have already added level i+1, so the lowest set bit has
          * been processed.  Clear it.
@@ -220,8 +339,7 @@ int64_t hbitmap_next_dirty(const HBitmap *hb, int64_t start, int64_t count)
 int64_t hbitmap_next_zero(const HBitmap *hb, int64_t start, int64_t count)
 {
     size_t pos = (start >> hb->granularity) >> BITS_PER_LEVEL;
-    unsigned long *last_lev = hb->levels[HBITMAP_LEVELS - 1];
-    unsigned long cur = last_lev[pos];
+    unsigned long cur;
     unsigned start_bit_offset;
     uint64_t end_bit, sz;
     int64_t res;
@@ -241,19 +359,27 @@ int64_t hbitmap_next_zero(const HBitmap *hb, int64_t start, int64_t count)
      * in them, let's set them.
      */
     start_bit_offset = (start >> hb->granularity) & (BITS_PER_LONG - 1);
+    cur = hb_word(hb, HBITMAP_LEVELS - 1, pos);
     cur |= (1UL << start_bit_offset) - 1;
     assert((start >> hb->granularity) < hb->size);
 
     if (cur == (unsigned long)-1) {
-        do {
+        for (;;) {
             pos++;
-        } while (pos < sz && last_lev[pos] == (unsigned long)-1);
-
-        if (pos >= sz) {
-            return -1;
+            if (!(pos & HBITMAP_CHUNK_MASK) && pos < sz &&
+                hb->chunks[pos >> HBITMAP_CHUNK_SHIFT] == HB_FULL_CHUNK) {
+                /* Skip fully set chunks in one go */
+                pos += HBITMAP_CHUNK_WORDS - 1;
+                continue;
+            }
+            if (pos >= sz) {
+                return -1;
+            }
+            cur = hb_word(hb, HBITMAP_LEVELS - 1, pos);
+            if (cur != (unsigned long)-1) {
+                break;
+            }
         }
-
-        cur = last_lev[pos];
     }
 
     res = (pos << BITS_PER_LEVEL) + ctol(cur);
@@ -426,6 +552,16 @@ static inline bool hb_set_elem(unsigned long *elem, uint64_t start, uint64_t las
     return old != *elem;
 }
 
+static bool hb_set_elem_at(HBitmap *hb, int level, uint64_t i,
+                           uint64_t start, uint64_t last)
+{
+    if (level == HBITMAP_LEVELS - 1 &&
+        hb->chunks[i >> HBITMAP_CHUNK_SHIFT] == HB_FULL_CHUNK) {
+        return false;
+    }
+    return hb_set_elem(hb_word_ptr(hb, level, i), start, last);
+}
+
 /* The recursive workhorse (the depth is limited to HBITMAP_LEVELS)...
  * Returns true if at least one bit is changed. */
 static bool hb_set_between(HBitmap *hb, int level, uint64_t start,
@@ -439,18 +575,32 @@ static bool hb_set_between(HBitmap *hb, int level, uint64_t start,
     i = pos;
     if (i < lastpos) {
         uint64_t next = (start | (BITS_PER_LONG - 1)) + 1;
-        changed |= hb_set_elem(&hb->levels[level][i], start, next - 1);
+        changed |= hb_set_elem_at(hb, level, i, start, next - 1);
         for (;;) {
             start = next;
             next += BITS_PER_LONG;
             if (++i == lastpos) {
                 break;
             }
-            changed |= (hb->levels[level][i] == 0);
-            hb->levels[level][i] = ~0UL;
+            if (hb_whole_chunk(level, i, lastpos)) {
+                uint64_t c = i >> HBITMAP_CHUNK_SHIFT;
+
+                if (hb->chunks[c] != HB_FULL_CHUNK) {
+                    hb_chunk_set_full(hb, c);
+                    changed = true;
+                }
+                i += HBITMAP_CHUNK_WORDS - 1;
+                start += (uint64_t)(HBITMAP_CHUNK_WORDS - 1) << BITS_PER_LEVEL;
+                next = start + BITS_PER_LONG;
+                continue;
+            }
+            changed |= (hb_word(hb, level, i) == 0);
+            if (hb_word(hb, level, i) != ~0UL) {
+                *hb_word_ptr(hb, level, i) = ~0UL;
+            }
         }
     }
-    changed |= hb_set_elem(&hb->levels[level][i], start, last);
+    changed |= hb_set_elem_at(hb, level, i, start, last);
 
     /* If there was any change in this layer, we may have to update
      * the one above.
@@ -504,6 +654,33 @@ static inline bool hb_reset_elem(unsigned long *elem, uint64_t start, uint64_t l
     return blanked;
 }
 
+static bool hb_reset_elem_at(HBitmap *hb, int level, uint64_t i,
+                             uint64_t start, uint64_t last)
+{
+    if (level == HBITMAP_LEVELS - 1 && !hb->chunks[i >> HBITMAP_CHUNK_SHIFT]) {
+        return false;
+    }
+    return hb_reset_elem(hb_word_ptr(hb, level, i), start, last);
+}
+
+/* Clear a whole chunk of the last level; return true if it had bits set. */
+static bool hb_chunk_reset(HBitmap *hb, uint64_t c)
+{
+    unsigned long *chunk = hb->chunks[c];
+    bool changed = false;
+    int i;
+
+    if (chunk == HB_FULL_CHUNK) {
+        changed = true;
+    } else if (chunk) {
+        for (i = 0; i < HBITMAP_CHUNK_WORDS && !changed; i++) {
+            changed = chunk[i] != 0;
+        }
+    }
+    hb_chunk_free(hb, c);
+    return changed;
+}
+
 /* The recursive workhorse (the depth is limited to HBITMAP_LEVELS)...
  * Returns true if at least one bit is changed. */
 static bool hb_reset_between(HBitmap *hb, int level, uint64_t start,
@@ -523,7 +700,7 @@ static bool hb_reset_between(HBitmap *hb, int level, uint64_t start,
          * unless the lower-level word became entirely zero.  So, remove pos
          * from the upper-level range if bits remain set.
          */
-        if (hb_reset_elem(&hb->levels[level][i], start, next - 1)) {
+        if (hb_reset_elem_at(hb, level, i, start, next - 1)) {
             changed = true;
         } else {
             pos++;
@@ -535,13 +712,22 @@ static bool hb_reset_between(HBitmap *hb, int level, uint64_t start,
             if (++i == lastpos) {
                 break;
             }
-            changed |= (hb->levels[level][i] != 0);
-            hb->levels[level][i] = 0UL;
+            if (hb_whole_chunk(level, i, lastpos)) {
+                changed |= hb_chunk_reset(hb, i >> HBITMAP_CHUNK_SHIFT);
+                i += HBITMAP_CHUNK_WORDS - 1;
+                start += (uint64_t)(HBITMAP_CHUNK_WORDS - 1) << BITS_PER_LEVEL;
+                next = start + BITS_PER_LONG;
+                continue;
+            }
+            if (hb_word(hb, level, i) != 0) {
+                changed = true;
+                *hb_word_ptr(hb, level, i) = 0UL;
+            }
         }
     }
 
     /* Same as above, this time for lastpos.  */
-    if (hb_reset_elem(&hb->levels[level][i], start, last)) {
+    if (hb_reset_elem_at(hb, level, i, start, last)) {
         changed = true;
     } else {
         lastpos--;
@@ -577,9 +763,13 @@ void hbitmap_reset(HBitmap *hb, uint64_t start, uint64_t count)
     assert(last < hb->size);
 
     hb->count -= hb_count_between(hb, first, last);
-    if (hb_reset_between(hb, HBITMAP_LEVELS - 1, first, last) &&
-        hb->meta) {
-        hbitmap_set(hb->meta, start, count);
+    if (hb_reset_between(hb, HBITMAP_LEVELS - 1, first, last)) {
+        /* Chunks in the middle are gone already, check the boundaries */
+        hb_chunk_trim(hb, (first >> BITS_PER_LEVEL) >> HBITMAP_CHUNK_SHIFT);
+        hb_chunk_trim(hb, (last >> BITS_PER_LEVEL) >> HBITMAP_CHUNK_SHIFT);
+        if (hb->meta) {
+            hbitmap_set(hb->meta, start, count);
+        }
     }
 }
 
@@ -588,7 +778,10 @@ void hbitmap_reset_all(HBitmap *hb)
     unsigned int i;
 
     /* Same as hbitmap_alloc() except for memset() instead of malloc() */
-    for (i = HBITMAP_LEVELS; --i >= 1; ) {
+    for (i = 0; i < hb->nr_chunks; i++) {
+        hb_chunk_free(hb, i);
+    }
+    for (i = HBITMAP_LEVELS - 1; --i >= 1; ) {
         memset(hb->levels[i], 0, hb->sizes[i] * sizeof(unsigned long));
     }
 
@@ -621,7 +814,7 @@ bool hbitmap_get(const HBitmap *hb, uint64_t item)
     unsigned long bit = 1UL << (pos & (BITS_PER_LONG - 1));
     assert(pos < hb->size);
 
-    return (hb->levels[HBITMAP_LEVELS - 1][pos >> BITS_PER_LEVEL] & bit) != 0;
+    return (hb_word(hb, HBITMAP_LEVELS - 1, pos >> BITS_PER_LEVEL) & bit) != 0;
 }
 
 uint64_t hbitmap_serialization_align(const HBitmap *hb)
@@ -638,7 +831,7 @@ uint64_t hbitmap_serialization_align(const HBitmap *hb)
  */
 static void serialization_chunk(const HBitmap *hb,
                                 uint64_t start, uint64_t count,
-                                unsigned long **first_el, uint64_t *el_count)
+                                uint64_t *first_el, uint64_t *el_count)
 {
     uint64_t last = start + count - 1;
     uint64_t gran = hbitmap_serialization_align(hb);
@@ -652,15 +845,39 @@ static void serialization_chunk(const HBitmap *hb,
     start = (start >> hb->granularity) >> BITS_PER_LEVEL;
     last = (last >> hb->granularity) >> BITS_PER_LEVEL;
 
-    *first_el = &hb->levels[HBITMAP_LEVELS - 1][start];
+    *first_el = start;
     *el_count = last - start + 1;
 }
 
+/* Set words [@first, @first + @count) of the last level to @val. */
+static void hb_fill_words(HBitmap *hb, uint64_t first, uint64_t count,
+                          unsigned long val)
+{
+    uint64_t end = first + count;
+    uint64_t i;
+
+    for (i = first; i < end; i++) {
+        uint64_t c = i >> HBITMAP_CHUNK_SHIFT;
+
+        if (!(i & HBITMAP_CHUNK_MASK) && i + HBITMAP_CHUNK_WORDS <= end &&
+            (val == 0 || val == ~0UL)) {
+            if (val) {
+                hb_chunk_set_full(hb, c);
+            } else {
+                hb_chunk_free(hb, c);
+            }
+            i += HBITMAP_CHUNK_WORDS - 1;
+        } else if (hb_word(hb, HBITMAP_LEVELS - 1, i) != val) {
+            *hb_word_ptr(hb, HBITMAP_LEVELS - 1, i) = val;
+        }
+    }
+}
+
 uint64_t hbitmap_serialization_size(const HBitmap *hb,
                                     uint64_t start, uint64_t count)
 {
     uint64_t el_count;
-    unsigned long *cur;
+    uint64_t cur;
 
     if (!count) {
         return 0;
@@ -674,7 +891,7 @@ void hbitmap_serialize_part(const HBitmap *hb, uint8_t *buf,
                             uint64_t start, uint64_t count)
 {
     uint64_t el_count;
-    unsigned long *cur, *end;
+    uint64_t cur, end;
 
     if (!count) {
         return;
@@ -683,8 +900,9 @@ void hbitmap_serialize_part(const HBitmap *hb, uint8_t *buf,
     end = cur + el_count;
 
     while (cur != end) {
-        unsigned long el =
-            (BITS_PER_LONG == 32 ? cpu_to_le32(*cur) : cpu_to_le64(*cur));
+        unsigned long el = hb_word(hb, HBITMAP_LEVELS - 1, cur);
+
+        el = (BITS_PER_LONG == 32 ? cpu_to_le32(el) : cpu_to_le64(el));
 
         memcpy(buf, &el, sizeof(el));
         buf += sizeof(el);
@@ -697,7 +915,7 @@ void hbitmap_deserialize_part(HBitmap *hb, uint8_t *buf,
                               bool finish)
 {
     uint64_t el_count;
-    unsigned long *cur, *end;
+    uint64_t cur, end;
 
     if (!count) {
         return;
@@ -706,13 +924,11 @@ void hbitmap_deserialize_part(HBitmap *hb, uint8_t *buf,
     end = cur + el_count;
 
     while (cur != end) {
-        memcpy(cur, buf, sizeof(*cur));
+        unsigned long el;
 
-        if (BITS_PER_LONG == 32) {
-            le32_to_cpus((uint32_t *)cur);
-        } else {
-            le64_to_cpus((uint64_t *)cur);
-        }
+        memcpy(&el, buf, sizeof(el));
+        el = (BITS_PER_LONG == 32 ? le32_to_cpu(el) : le64_to_cpu(el));
+        hb_fill_words(hb, cur, 1, el);
 
         buf += sizeof(unsigned long);
         cur++;
@@ -726,14 +942,14 @@ void hbitmap_deserialize_zeroes(HBitmap *hb, uint64_t start, uint64_t count,
                                 bool finish)
 {
     uint64_t el_count;
-    unsigned long *first;
+    uint64_t first;
 
     if (!count) {
         return;
     }
     serialization_chunk(hb, start, count, &first, &el_count);
 
-    memset(first, 0, el_count * sizeof(unsigned long));
+    hb_fill_words(hb, first, el_count, 0);
     if (finish) {
         hbitmap_deserialize_finish(hb);
     }
@@ -743,14 +959,14 @@ void hbitmap_deserialize_ones(HBitmap *hb, uint64_t start, uint64_t count,
                               bool finish)
 {
     uint64_t el_count;
-    unsigned long *first;
+    uint64_t first;
 
     if (!count) {
         return;
     }
     serialization_chunk(hb, start, count, &first, &el_count);
 
-    memset(first, 0xff, el_count * sizeof(unsigned long));
+    hb_fill_words(hb, first, el_count, ~0UL);
     if (finish) {
         hbitmap_deserialize_finish(hb);
     }
@@ -770,13 +986,24 @@ void hbitmap_deserialize_finish(HBitmap *bitmap)
         memset(bitmap->levels[lev], 0, size * sizeof(unsigned long));
 
         for (i = 0; i < prev_size; ++i) {
-            if (bitmap->levels[lev + 1][i]) {
+            if (lev + 1 == HBITMAP_LEVELS - 1 &&
+                !(i & HBITMAP_CHUNK_MASK) &&
+                !bitmap->chunks[i >> HBITMAP_CHUNK_SHIFT]) {
+                i += HBITMAP_CHUNK_WORDS - 1;
+                continue;
+            }
+            if (hb_word(bitmap, lev + 1, i)) {
                 bitmap->levels[lev][i >> BITS_PER_LEVEL] |=
                     1UL << (i & (BITS_PER_LONG - 1));
             }
         }
     }
 
+    /* Deserialization fills chunks word by word; drop the empty ones */
+    for (i = 0; i < bitmap->nr_chunks; i++) {
+        hb_chunk_trim(bitmap, i);
+    }
+
     bitmap->levels[0][0] |= 1UL << (BITS_PER_LONG - 1);
     bitmap->count = hb_count_between(bitmap, 0, bitmap->size - 1);
 }
@@ -785,7 +1012,11 @@ void hbitmap_free(HBitmap *hb)
 {
     unsigned i;
     assert(!hb->meta);
-    for (i = HBITMAP_LEVELS; i-- > 0; ) {
+    for (i = 0; i < hb->nr_chunks; i++) {
+        hb_chunk_free(hb, i);
+    }
+    g_free(hb->chunks);
+    for (i = HBITMAP_LEVELS - 1; i-- > 0; ) {
         g_free(hb->levels[i]);
     }
     g_free(hb);
@@ -808,7 +1039,12 @@ HBitmap *hbitmap_alloc(uint64_t size, int granularity)
     for (i = HBITMAP_LEVELS; i-- > 0; ) {
         size = MAX((size + BITS_PER_LONG - 1) >> BITS_PER_LEVEL, 1);
         hb->sizes[i] = size;
-        hb->levels[i] = g_new0(unsigned long, size);
+        if (i == HBITMAP_LEVELS - 1) {
+            hb->nr_chunks = hb_nr_chunks(size);
+            hb->chunks = g_new0(unsigned long *, hb->nr_chunks);
+        } else {
+            hb->levels[i] = g_new0(unsigned long, size);
+        }
     }
 
     /* We necessarily have free bits in level 0 due to the definition
@@ -862,6 +1098,21 @@ void hbitmap_truncate(HBitmap *hb, uint64_t size)
         }
         old = hb->sizes[i];
         hb->sizes[i] = size;
+        if (i == HBITMAP_LEVELS - 1) {
+            uint64_t nr_chunks = hb_nr_chunks(size);
+            uint64_t c;
+
+            /* The bits past the new end were cleared above */
+            for (c = nr_chunks; c < hb->nr_chunks; c++) {
+                hb_chunk_free(hb, c);
+            }
+            hb->chunks = g_renew(unsigned long *, hb->chunks, nr_chunks);
+            for (c = hb->nr_chunks; c < nr_chunks; c++) {
+                hb->chunks[c] = NULL;
+            }
+            hb->nr_chunks = nr_chunks;
+            continue;
+        }
         hb->levels[i] = g_renew(unsigned long, hb->levels[i], size);
         if (!shrink) {
             memset(&hb->levels[i][old], 0x00,
@@ -932,9 +1183,34 @@ void hbitmap_merge(const HBitmap *a, const HBitmap *b, HBitmap *result)
     /* This merge is O(size), as BITS_PER_LONG and HBITMAP_LEVELS are constant.
      * It may be possible to improve running times for sparsely populated maps
      * by using hbitmap_iter_next, but this is suboptimal for dense maps.
+     * Unallocated and full chunks of the last level are merged in one step.
      */
     assert(a->size == b->size);
-    for (i = HBITMAP_LEVELS - 1; i >= 0; i--) {
+    for (j = 0; j < a->nr_chunks; j++) {
+        unsigned long *ca = a->chunks[j];
+        unsigned long *cb = b->chunks[j];
+        unsigned long *dst;
+        int k;
+
+        if (ca == HB_FULL_CHUNK || cb == HB_FULL_CHUNK) {
+            hb_chunk_set_full(result, j);
+        } else if (!ca && !cb) {
+            hb_chunk_free(result, j);
+        } else if (!ca || !cb) {
+            unsigned long *src = ca ?: cb;
+
+            if (result->chunks[j] != src) {
+                dst = hb_chunk_materialize(result, j);
+                memcpy(dst, src, sizeof(hb_full_chunk));
+            }
+        } else {
+            dst = hb_chunk_materialize(result, j);
+            for (k = 0; k < HBITMAP_CHUNK_WORDS; k++) {
+                dst[k] = ca[k] | cb[k];
+            }
+        }
+    }
+    for (i = HBITMAP_LEVELS - 2; i >= 0; i--) {
         for (j = 0; j < a->sizes[i]; j++) {
             result->levels[i][j] = a->levels[i][j] | b->levels[i][j];
         }
@@ -946,10 +1222,21 @@ void hbitmap_merge(const HBitmap *a, const HBitmap *b, HBitmap *result)
 
 char *hbitmap_sha256(const HBitmap *bitmap, Error **errp)
 {
-    size_t size = bitmap->sizes[HBITMAP_LEVELS - 1] * sizeof(unsigned long);
-    char *data = (char *)bitmap->levels[HBITMAP_LEVELS - 1];
+    uint64_t words = bitmap->sizes[HBITMAP_LEVELS - 1];
+    g_autofree struct iovec *iov = g_new(struct iovec, bitmap->nr_chunks);
     char *hash = NULL;
-    qcrypto_hash_digest(QCRYPTO_HASH_ALG_SHA256, data, size, &hash, errp);
+    uint64_t c;
+
+    /* Hash the same bytes as a flat array of the last level would have */
+    for (c = 0; c < bitmap->nr_chunks; c++) {
+        uint64_t n = MIN(words - (c << HBITMAP_CHUNK_SHIFT),
+                         HBITMAP_CHUNK_WORDS);
+
+        iov[c].iov_base = bitmap->chunks[c] ?: (void *)hb_zero_chunk;
+        iov[c].iov_len = n * sizeof(unsigned long);
+    }
+    qcrypto_hash_digestv(QCRYPTO_HASH_ALG_SHA256, iov, bitmap->nr_chunks,
+                         &hash, errp);
 
     return hash;
 }
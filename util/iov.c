@@ -274,9 +274,14 @@ unsigned iov_copy(struct iovec *dst_iov, unsigned int dst_iov_cnt,
 
 void qemu_iovec_init(QEMUIOVector *qiov, int alloc_hint)
 {
-    qiov->iov = g_new(struct iovec, alloc_hint);
+    if (alloc_hint <= QEMU_IOVEC_INLINE_NIOV) {
+        qiov->iov = qiov->inline_iov;
+        qiov->nalloc = QEMU_IOVEC_INLINE_NIOV;
+    } else {
+        qiov->iov = g_new(struct iovec, alloc_hint);
+        qiov->nalloc = alloc_hint;
+    }
     qiov->niov = 0;
-    qiov->nalloc = alloc_hint;
     qiov->size = 0;
 }
 
@@ -298,7 +303,12 @@ void qemu_iovec_add(QEMUIOVector *qiov, void *base, size_t len)
 
     if (qiov->niov == qiov->nalloc) {
         qiov->nalloc = 2 * qiov->nalloc + 1;
-        qiov->iov = g_renew(struct iovec, qiov->iov, qiov->nalloc);
+        if (qiov->iov == qiov->inline_iov) {
+            qiov->iov = g_new(struct iovec, qiov->nalloc);
+            memcpy(qiov->iov, qiov->inline_iov, sizeof(qiov->inline_iov));
+        } else {
+            qiov->iov = g_renew(struct iovec, qiov->iov, qiov->nalloc);
+        }
     }
     qiov->iov[qiov->niov].iov_base = base;
     qiov->iov[qiov->niov].iov_len = len;
@@ -384,15 +394,12 @@ static struct iovec *iov_skip_offset(struct iovec *iov, size_t offset,
  * be offset in first iov (returned by the function), @tail would be
  * count of extra bytes in last iovec (returned iov + @niov - 1).
  */
-struct iovec *qemu_iovec_slice(QEMUIOVector *qiov,
-                               size_t offset, size_t len,
+static struct iovec *iov_slice(struct iovec *iov, size_t offset, size_t len,
                                size_t *head, size_t *tail, int *niov)
 {
-    struct iovec *iov, *end_iov;
+    struct iovec *end_iov;
 
-    assert(offset + len <= qiov->size);
-
-    iov = iov_skip_offset(qiov->iov, offset, head);
+    iov = iov_skip_offset(iov, offset, head);
     end_iov = iov_skip_offset(iov, *head + len, tail);
 
     if (*tail > 0) {
@@ -406,6 +413,15 @@ struct iovec *qemu_iovec_slice(QEMUIOVector *qiov,
     return iov;
 }
 
+struct iovec *qemu_iovec_slice(QEMUIOVector *qiov,
+                               size_t offset, size_t len,
+                               size_t *head, size_t *tail, int *niov)
+{
+    assert(offset + len <= qiov->size);
+
+    return iov_slice(qiov->iov, offset, len, head, tail, niov);
+}
+
 int qemu_iovec_subvec_niov(QEMUIOVector *qiov, size_t offset, size_t len)
 {
     size_t head, tail;
@@ -444,6 +460,33 @@ bool qemu_iovec_is_zero(QEMUIOVector *qiov, size_t offset, size_t bytes)
     return true;
 }
 
+/*
+ * Initialize @qiov with the @niov elements at @iov, trimmed by @head bytes
+ * at the front and @tail bytes at the back (as returned by iov_slice()).
+ * Slices of up to QEMU_IOVEC_INLINE_NIOV elements do not allocate.
+ */
+static void qemu_iovec_init_iov_slice(QEMUIOVector *qiov, struct iovec *iov,
+                                      int niov, size_t head, size_t tail,
+                                      size_t len)
+{
+    if (niov == 1) {
+        qemu_iovec_init_buf(qiov, iov[0].iov_base + head, len);
+        return;
+    }
+
+    qemu_iovec_init(qiov, niov);
+    if (niov == 0) {
+        return;
+    }
+
+    memcpy(qiov->iov, iov, niov * sizeof(*iov));
+    qiov->iov[0].iov_base += head;
+    qiov->iov[0].iov_len -= head;
+    qiov->iov[niov - 1].iov_len -= tail;
+    qiov->niov = niov;
+    qiov->size = len;
+}
+
 void qemu_iovec_init_slice(QEMUIOVector *qiov, QEMUIOVector *source,
                            size_t offset, size_t len)
 {
@@ -456,17 +499,53 @@ void qemu_iovec_init_slice(QEMUIOVector *qiov, QEMUIOVector *source,
 
     slice_iov = qemu_iovec_slice(source, offset, len,
                                  &slice_head, &slice_tail, &slice_niov);
-    if (slice_niov == 1) {
-        qemu_iovec_init_buf(qiov, slice_iov[0].iov_base + slice_head, len);
-    } else {
-        qemu_iovec_init(qiov, slice_niov);
-        qemu_iovec_concat_iov(qiov, slice_iov, slice_niov, slice_head, len);
-    }
+    qemu_iovec_init_iov_slice(qiov, slice_iov, slice_niov,
+                              slice_head, slice_tail, len);
+}
+
+void qemu_iovec_cursor_init(QEMUIOVCursor *cur, QEMUIOVector *qiov,
+                            size_t offset)
+{
+    assert(offset <= qiov->size);
+
+    cur->iov = iov_skip_offset(qiov->iov, offset, &cur->offset);
+    cur->end = qiov->iov + qiov->niov;
+    cur->remaining = qiov->size - offset;
+}
+
+void qemu_iovec_cursor_advance(QEMUIOVCursor *cur, size_t bytes)
+{
+    assert(bytes <= cur->remaining);
+
+    cur->iov = iov_skip_offset(cur->iov, cur->offset + bytes, &cur->offset);
+    cur->remaining -= bytes;
+    assert(cur->iov <= cur->end);
+}
+
+/*
+ * Initialize @qiov as a slice of the next @bytes bytes after @cur, and
+ * advance @cur past them.  @qiov references the memory of the vector
+ * walked by @cur and must be destroyed with qemu_iovec_destroy().
+ */
+void qemu_iovec_cursor_slice(QEMUIOVCursor *cur, QEMUIOVector *qiov,
+                             size_t bytes)
+{
+    struct iovec *slice_iov;
+    int slice_niov;
+    size_t slice_head, slice_tail;
+
+    assert(bytes <= cur->remaining);
+
+    slice_iov = iov_slice(cur->iov, cur->offset, bytes,
+                          &slice_head, &slice_tail, &slice_niov);
+    qemu_iovec_init_iov_slice(qiov, slice_iov, slice_niov,
+                              slice_head, slice_tail, bytes);
+    qemu_iovec_cursor_advance(cur, bytes);
 }
 
 void qemu_iovec_destroy(QEMUIOVector *qiov)
 {
-    if (qiov->nalloc != -1) {
+    if (qiov->nalloc != -1 && qiov->iov != qiov->inline_iov) {
         g_free(qiov->iov);
     }
 
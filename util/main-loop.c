@@ -192,11 +192,14 @@ static void main_loop_update_params(EventLoopBase *base, Error **errp)
         return;
     }
 
-    aio_context_set_aio_params(qemu_aio_context, base->aio_max_batch, errp);
+    aio_context_set_aio_params(qemu_aio_context, base->aio_max_batch,
+                               base->aio_batch_adaptive, errp);
     if (*errp) {
         return;
     }
 
+    aio_context_set_latency_stats(qemu_aio_context, base->latency_stats);
+
     aio_context_set_thread_pool_params(qemu_aio_context, base->thread_pool_min,
                                        base->thread_pool_max, errp);
 }
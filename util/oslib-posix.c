@@ -557,6 +557,119 @@ void qemu_prealloc_mem(int fd, char *area, size_t sz, int max_threads,
     }
 }
 
+/*
+ * Background preallocation populates the area in chunks of this size, so
+ * that the guest's own faults interleave with it rather than queue behind
+ * one huge madvise() call.
+ */
+#define PREALLOC_ASYNC_CHUNK (1 * GiB)
+
+typedef struct PreallocAsync PreallocAsync;
+
+typedef struct PreallocAsyncThread {
+    PreallocAsync *prealloc;
+    char *addr;
+    size_t size;
+    size_t chunk;
+    QemuThread thread;
+} PreallocAsyncThread;
+
+struct PreallocAsync {
+    PreallocAsyncThread *threads;
+    unsigned int pending;
+    int ret;
+    PreallocAsyncDoneFunc *done;
+    void *opaque;
+};
+
+static void prealloc_async_put(PreallocAsync *prealloc)
+{
+    if (qatomic_fetch_dec(&prealloc->pending) == 1) {
+        prealloc->done(prealloc->opaque, prealloc->ret);
+        g_free(prealloc->threads);
+        g_free(prealloc);
+    }
+}
+
+static void *do_prealloc_async(void *arg)
+{
+    PreallocAsyncThread *t = arg;
+    PreallocAsync *prealloc = t->prealloc;
+    size_t offset;
+
+    for (offset = 0; offset < t->size; offset += t->chunk) {
+        size_t len = MIN(t->chunk, t->size - offset);
+
+        if (qatomic_read(&prealloc->ret)) {
+            break;
+        }
+        if (qemu_madvise(t->addr + offset, len, QEMU_MADV_POPULATE_WRITE)) {
+            qatomic_cmpxchg(&prealloc->ret, 0, -errno);
+            break;
+        }
+    }
+
+    prealloc_async_put(prealloc);
+    return NULL;
+}
+
+bool qemu_prealloc_mem_async(int fd, char *area, size_t sz, int max_threads,
+                             ThreadContext *tc, PreallocAsyncDoneFunc *done,
+                             void *opaque)
+{
+    size_t hpagesize = qemu_fd_getpagesize(fd);
+    size_t numpages = DIV_ROUND_UP(sz, hpagesize);
+    size_t numpages_per_thread, leftover;
+    PreallocAsync *prealloc;
+    char *addr = area;
+    int i, num_threads;
+
+    /*
+     * Touching pages reads and writes back their contents, which would race
+     * with a running guest, so only MADV_POPULATE_WRITE can be used here.
+     */
+    if (!numpages || !madv_populate_write_possible(area, hpagesize)) {
+        return false;
+    }
+
+    num_threads = get_memset_num_threads(hpagesize, numpages, max_threads);
+    prealloc = g_new0(PreallocAsync, 1);
+    prealloc->threads = g_new0(PreallocAsyncThread, num_threads);
+    /* One reference for each thread, one dropped once all are created */
+    prealloc->pending = num_threads + 1;
+    prealloc->done = done;
+    prealloc->opaque = opaque;
+
+    numpages_per_thread = numpages / num_threads;
+    leftover = numpages % num_threads;
+    for (i = 0; i < num_threads; i++) {
+        PreallocAsyncThread *t = &prealloc->threads[i];
+
+        t->prealloc = prealloc;
+        t->addr = addr;
+        t->size = (numpages_per_thread + (i < leftover)) * hpagesize;
+        t->chunk = MAX(QEMU_ALIGN_DOWN(PREALLOC_ASYNC_CHUNK, hpagesize),
+                       hpagesize);
+        addr += t->size;
+    }
+
+    for (i = 0; i < num_threads; i++) {
+        PreallocAsyncThread *t = &prealloc->threads[i];
+
+        if (tc) {
+            thread_context_create_thread(tc, &t->thread, "prealloc_async",
+                                         do_prealloc_async, t,
+                                         QEMU_THREAD_DETACHED);
+        } else {
+            qemu_thread_create(&t->thread, "prealloc_async",
+                               do_prealloc_async, t, QEMU_THREAD_DETACHED);
+        }
+    }
+
+    prealloc_async_put(prealloc);
+    return true;
+}
+
 char *qemu_get_pid_name(pid_t pid)
 {
     char *name = NULL;
@@ -601,7 +714,11 @@ void *qemu_alloc_stack(size_t *sz)
     /* allocate one extra page for the guard page */
     *sz += pagesz;
 
-    flags = MAP_PRIVATE | MAP_ANONYMOUS;
+    /*
+     * Stack pages are committed lazily as the stack grows, so do not reserve
+     * swap for the whole area.  Most coroutines only ever touch a few pages.
+     */
+    flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE;
 #if defined(MAP_STACK) && defined(__OpenBSD__)
     /* Only enable MAP_STACK on OpenBSD. Other OS's such as
      * Linux/FreeBSD/NetBSD have a flag with the same name
@@ -646,6 +763,28 @@ void *qemu_alloc_stack(size_t *sz)
 static __thread unsigned int max_stack_usage;
 #endif
 
+size_t qemu_stack_resident(void *stack, size_t sz)
+{
+#ifdef CONFIG_LINUX
+    size_t pagesz = qemu_real_host_page_size();
+    size_t pages = sz / pagesz;
+    g_autofree unsigned char *vec = g_malloc(pages);
+    size_t i, resident = 0;
+
+    if (mincore(stack, sz, vec) < 0) {
+        return sz;
+    }
+    for (i = 0; i < pages; i++) {
+        if (vec[i] & 1) {
+            resident += pagesz;
+        }
+    }
+    return resident;
+#else
+    return sz;
+#endif
+}
+
 void qemu_free_stack(void *stack, size_t sz)
 {
 #ifdef CONFIG_DEBUG_STACK_USAGE
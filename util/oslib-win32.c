@@ -276,6 +276,13 @@ void qemu_prealloc_mem(int fd, char *area, size_t sz, int max_threads,
     }
 }
 
+bool qemu_prealloc_mem_async(int fd, char *area, size_t sz, int max_threads,
+                             ThreadContext *tc, PreallocAsyncDoneFunc *done,
+                             void *opaque)
+{
+    return false;
+}
+
 char *qemu_get_pid_name(pid_t pid)
 {
     /* XXX Implement me */
@@ -39,9 +39,12 @@ void qemu_co_queue_init(CoQueue *queue)
 }
 
 void coroutine_fn qemu_co_queue_wait_impl(CoQueue *queue, QemuLockable *lock,
-                                          CoQueueWaitFlags flags)
+                                          CoQueueWaitFlags flags,
+                                          const char *file, int line)
 {
     Coroutine *self = qemu_coroutine_self();
+    int64_t t0 = qsp_co_start();
+
     if (flags & CO_QUEUE_WAIT_FRONT) {
         QSIMPLEQ_INSERT_HEAD(&queue->entries, self, co_queue_next);
     } else {
@@ -69,6 +72,7 @@ void coroutine_fn qemu_co_queue_wait_impl(CoQueue *queue, QemuLockable *lock,
     if (lock) {
         qemu_lockable_lock(lock);
     }
+    qsp_co_record(queue, QSP_CO_QUEUE, file, line, t0);
 }
 
 bool qemu_co_enter_next_impl(CoQueue *queue, QemuLockable *lock)
@@ -233,10 +237,12 @@ static void coroutine_fn qemu_co_mutex_lock_slowpath(AioContext *ctx,
     trace_qemu_co_mutex_lock_return(mutex, self);
 }
 
-void coroutine_fn qemu_co_mutex_lock(CoMutex *mutex)
+void coroutine_fn qemu_co_mutex_lock_impl(CoMutex *mutex, const char *file,
+                                          int line)
 {
     AioContext *ctx = qemu_get_current_aio_context();
     Coroutine *self = qemu_coroutine_self();
+    int64_t t0 = qsp_co_start();
     int waiters, i;
 
     /* Running a very small critical section on pthread_mutex_t and CoMutex
@@ -271,6 +277,7 @@ retry_fast_path:
     }
     mutex->holder = self;
     self->locks_held++;
+    qsp_co_record(mutex, QSP_CO_MUTEX, file, line, t0);
 }
 
 void coroutine_fn qemu_co_mutex_unlock(CoMutex *mutex)
@@ -376,9 +383,11 @@ static void coroutine_fn qemu_co_rwlock_maybe_wake_one(CoRwlock *lock)
     }
 }
 
-void coroutine_fn qemu_co_rwlock_rdlock(CoRwlock *lock)
+void coroutine_fn qemu_co_rwlock_rdlock_impl(CoRwlock *lock,
+                                             const char *file, int line)
 {
     Coroutine *self = qemu_coroutine_self();
+    int64_t t0 = qsp_co_start();
 
     qemu_co_mutex_lock(&lock->mutex);
     /* For fairness, wait if a writer is in line.  */
@@ -399,6 +408,7 @@ void coroutine_fn qemu_co_rwlock_rdlock(CoRwlock *lock)
     }
 
     self->locks_held++;
+    qsp_co_record(lock, QSP_CO_RWLOCK, file, line, t0);
 }
 
 void coroutine_fn qemu_co_rwlock_unlock(CoRwlock *lock)
@@ -429,9 +439,11 @@ void coroutine_fn qemu_co_rwlock_downgrade(CoRwlock *lock)
     qemu_co_rwlock_maybe_wake_one(lock);
 }
 
-void coroutine_fn qemu_co_rwlock_wrlock(CoRwlock *lock)
+void coroutine_fn qemu_co_rwlock_wrlock_impl(CoRwlock *lock,
+                                             const char *file, int line)
 {
     Coroutine *self = qemu_coroutine_self();
+    int64_t t0 = qsp_co_start();
 
     qemu_co_mutex_lock(&lock->mutex);
     if (lock->owners == 0) {
@@ -447,10 +459,14 @@ void coroutine_fn qemu_co_rwlock_wrlock(CoRwlock *lock)
     }
 
     self->locks_held++;
+    qsp_co_record(lock, QSP_CO_RWLOCK, file, line, t0);
 }
 
-void coroutine_fn qemu_co_rwlock_upgrade(CoRwlock *lock)
+void coroutine_fn qemu_co_rwlock_upgrade_impl(CoRwlock *lock,
+                                              const char *file, int line)
 {
+    int64_t t0 = qsp_co_start();
+
     qemu_co_mutex_lock(&lock->mutex);
     assert(lock->owners > 0);
     /* For fairness, wait if a writer is in line.  */
@@ -466,4 +482,5 @@ void coroutine_fn qemu_co_rwlock_upgrade(CoRwlock *lock)
         qemu_coroutine_yield();
         assert(lock->owners == -1);
     }
+    qsp_co_record(lock, QSP_CO_RWLOCK, file, line, t0);
 }
@@ -18,6 +18,7 @@
 #include "qemu/atomic.h"
 #include "qemu/coroutine_int.h"
 #include "qemu/coroutine-tls.h"
+#include "qemu/lockable.h"
 #include "block/aio.h"
 
 /**
@@ -31,38 +32,75 @@ enum {
     POOL_INITIAL_MAX_SIZE = 64,
 };
 
-/** Free list to speed up creation */
-static QSLIST_HEAD(, Coroutine) release_pool = QSLIST_HEAD_INITIALIZER(pool);
+typedef QSLIST_HEAD(, Coroutine) CoroutineQSList;
+
+/** Free lists to speed up creation, one per stack size class */
+static CoroutineQSList release_pool[COROUTINE_STACK__MAX];
 static unsigned int pool_max_size = POOL_INITIAL_MAX_SIZE;
-static unsigned int release_pool_size;
+static unsigned int release_pool_size[COROUTINE_STACK__MAX];
 
-typedef QSLIST_HEAD(, Coroutine) CoroutineQSList;
-QEMU_DEFINE_STATIC_CO_TLS(CoroutineQSList, alloc_pool);
-QEMU_DEFINE_STATIC_CO_TLS(unsigned int, alloc_pool_size);
+typedef struct {
+    CoroutineQSList list[COROUTINE_STACK__MAX];
+    unsigned int size[COROUTINE_STACK__MAX];
+} CoroutineAllocPool;
+QEMU_DEFINE_STATIC_CO_TLS(CoroutineAllocPool, alloc_pool);
 QEMU_DEFINE_STATIC_CO_TLS(Notifier, coroutine_pool_cleanup_notifier);
 
+static const size_t coroutine_stack_sizes[COROUTINE_STACK__MAX] = {
+    [COROUTINE_STACK_DEFAULT] = COROUTINE_STACK_SIZE,
+    [COROUTINE_STACK_SMALL] = COROUTINE_SMALL_STACK_SIZE,
+};
+
+/* All coroutines that have a stack, for the stack usage statistics */
+static QemuMutex all_coroutines_lock;
+static QLIST_HEAD(, Coroutine) all_coroutines =
+    QLIST_HEAD_INITIALIZER(all_coroutines);
+
+static void __attribute__((__constructor__)) coroutine_init(void)
+{
+    qemu_mutex_init(&all_coroutines_lock);
+}
+
+static void coroutine_free(Coroutine *co)
+{
+    WITH_QEMU_LOCK_GUARD(&all_coroutines_lock) {
+        QLIST_REMOVE(co, all_next);
+    }
+    qemu_coroutine_delete(co);
+}
+
 static void coroutine_pool_cleanup(Notifier *n, void *value)
 {
     Coroutine *co;
     Coroutine *tmp;
-    CoroutineQSList *alloc_pool = get_ptr_alloc_pool();
+    CoroutineAllocPool *alloc_pool = get_ptr_alloc_pool();
+    CoroutineStackClass stack_class;
+
+    for (stack_class = 0; stack_class < COROUTINE_STACK__MAX; stack_class++) {
+        CoroutineQSList *list = &alloc_pool->list[stack_class];
 
-    QSLIST_FOREACH_SAFE(co, alloc_pool, pool_next, tmp) {
-        QSLIST_REMOVE_HEAD(alloc_pool, pool_next);
-        qemu_coroutine_delete(co);
+        QSLIST_FOREACH_SAFE(co, list, pool_next, tmp) {
+            QSLIST_REMOVE_HEAD(list, pool_next);
+            coroutine_free(co);
+        }
+        alloc_pool->size[stack_class] = 0;
     }
 }
 
-Coroutine *qemu_coroutine_create(CoroutineEntry *entry, void *opaque)
+Coroutine *qemu_coroutine_create_sized(CoroutineEntry *entry, void *opaque,
+                                       CoroutineStackClass stack_class)
 {
     Coroutine *co = NULL;
 
+    assert(stack_class < COROUTINE_STACK__MAX);
+
     if (CONFIG_COROUTINE_POOL) {
-        CoroutineQSList *alloc_pool = get_ptr_alloc_pool();
+        CoroutineAllocPool *alloc_pool = get_ptr_alloc_pool();
+        CoroutineQSList *list = &alloc_pool->list[stack_class];
 
-        co = QSLIST_FIRST(alloc_pool);
+        co = QSLIST_FIRST(list);
         if (!co) {
-            if (release_pool_size > POOL_MIN_BATCH_SIZE) {
+            if (release_pool_size[stack_class] > POOL_MIN_BATCH_SIZE) {
                 /* Slow path; a good place to register the destructor, too.  */
                 Notifier *notifier = get_ptr_coroutine_pool_cleanup_notifier();
                 if (!notifier->notify) {
@@ -74,19 +112,24 @@ Coroutine *qemu_coroutine_create(CoroutineEntry *entry, void *opaque)
                  * release_pool_size and the actual size of release_pool.  But
                  * it is just a heuristic, it does not need to be perfect.
                  */
-                set_alloc_pool_size(qatomic_xchg(&release_pool_size, 0));
-                QSLIST_MOVE_ATOMIC(alloc_pool, &release_pool);
-                co = QSLIST_FIRST(alloc_pool);
+                alloc_pool->size[stack_class] =
+                    qatomic_xchg(&release_pool_size[stack_class], 0);
+                QSLIST_MOVE_ATOMIC(list, &release_pool[stack_class]);
+                co = QSLIST_FIRST(list);
             }
         }
         if (co) {
-            QSLIST_REMOVE_HEAD(alloc_pool, pool_next);
-            set_alloc_pool_size(get_alloc_pool_size() - 1);
+            QSLIST_REMOVE_HEAD(list, pool_next);
+            alloc_pool->size[stack_class]--;
         }
     }
 
     if (!co) {
-        co = qemu_coroutine_new();
+        co = qemu_coroutine_new(coroutine_stack_sizes[stack_class]);
+        co->stack_class = stack_class;
+        WITH_QEMU_LOCK_GUARD(&all_coroutines_lock) {
+            QLIST_INSERT_HEAD(&all_coroutines, co, all_next);
+        }
     }
 
     co->entry = entry;
@@ -95,24 +138,36 @@ Coroutine *qemu_coroutine_create(CoroutineEntry *entry, void *opaque)
     return co;
 }
 
+Coroutine *qemu_coroutine_create(CoroutineEntry *entry, void *opaque)
+{
+    return qemu_coroutine_create_sized(entry, opaque, COROUTINE_STACK_DEFAULT);
+}
+
 static void coroutine_delete(Coroutine *co)
 {
+    CoroutineStackClass stack_class = co->stack_class;
+
     co->caller = NULL;
 
     if (CONFIG_COROUTINE_POOL) {
-        if (release_pool_size < qatomic_read(&pool_max_size) * 2) {
-            QSLIST_INSERT_HEAD_ATOMIC(&release_pool, co, pool_next);
-            qatomic_inc(&release_pool_size);
+        CoroutineAllocPool *alloc_pool;
+
+        if (release_pool_size[stack_class] <
+            qatomic_read(&pool_max_size) * 2) {
+            QSLIST_INSERT_HEAD_ATOMIC(&release_pool[stack_class], co,
+                                      pool_next);
+            qatomic_inc(&release_pool_size[stack_class]);
             return;
         }
-        if (get_alloc_pool_size() < qatomic_read(&pool_max_size)) {
-            QSLIST_INSERT_HEAD(get_ptr_alloc_pool(), co, pool_next);
-            set_alloc_pool_size(get_alloc_pool_size() + 1);
+        alloc_pool = get_ptr_alloc_pool();
+        if (alloc_pool->size[stack_class] < qatomic_read(&pool_max_size)) {
+            QSLIST_INSERT_HEAD(&alloc_pool->list[stack_class], co, pool_next);
+            alloc_pool->size[stack_class]++;
             return;
         }
     }
 
-    qemu_coroutine_delete(co);
+    coroutine_free(co);
 }
 
 void qemu_aio_coroutine_enter(AioContext *ctx, Coroutine *co)
@@ -230,3 +285,21 @@ void qemu_coroutine_dec_pool_size(unsigned int removing_pool_size)
 {
     qatomic_sub(&pool_max_size, removing_pool_size);
 }
+
+void qemu_coroutine_stack_stats(CoroutineStackClass stack_class,
+                                uint64_t *count, uint64_t *reserved,
+                                uint64_t *resident)
+{
+    Coroutine *co;
+
+    *count = *reserved = *resident = 0;
+
+    QEMU_LOCK_GUARD(&all_coroutines_lock);
+    QLIST_FOREACH(co, &all_coroutines, all_next) {
+        if (co->stack_class == stack_class) {
+            (*count)++;
+            *reserved += coroutine_stack_sizes[stack_class];
+            *resident += qemu_coroutine_stack_resident(co);
+        }
+    }
+}
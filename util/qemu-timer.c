@@ -63,10 +63,41 @@ static QEMUClock qemu_clocks[QEMU_CLOCK_MAX];
  * reenabling the clock can call all the notifiers.
  */
 
+/*
+ * Active timers are kept in a hierarchical timer wheel, so that arming and
+ * cancelling a timer are O(1) regardless of the number of armed timers.
+ *
+ * Expiry times are split in TIMER_WHEEL_BITS-wide digits above
+ * TIMER_WHEEL_SHIFT.  A timer lives on the level of the most significant
+ * digit in which its expiry time differs from the wheel base, in the slot
+ * given by that digit.  Timers on lower levels therefore always expire
+ * before timers on higher levels, and within a level slots are ordered by
+ * index.  Level 0 slots are kept sorted; higher slots are FIFOs, which are
+ * moved down a level when the base reaches them.  Either way timers with
+ * the same expiry time fire in the order they were armed.
+ */
+#define TIMER_WHEEL_SHIFT   16
+#define TIMER_WHEEL_BITS    6
+#define TIMER_WHEEL_SIZE    (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_LEVELS  DIV_ROUND_UP(64 - TIMER_WHEEL_SHIFT, TIMER_WHEEL_BITS)
+
+typedef struct QEMUTimerSlot {
+    QEMUTimer *head;
+    QEMUTimer *last;
+} QEMUTimerSlot;
+
 struct QEMUTimerList {
     QEMUClock *clock;
     QemuMutex active_timers_lock;
-    QEMUTimer *active_timers;
+    QEMUTimerSlot wheel[TIMER_WHEEL_LEVELS * TIMER_WHEEL_SIZE];
+    /* Bitmap of the non-empty slots on each level */
+    uint64_t wheel_pending[TIMER_WHEEL_LEVELS];
+    /* No timer may expire before this, except timers armed in the past */
+    int64_t wheel_base;
+    /* Earliest timer, valid unless first_stale */
+    QEMUTimer *first;
+    bool first_stale;
+    unsigned nr_timers;
     QLIST_ENTRY(QEMUTimerList) list;
     QEMUTimerListNotifyCB *notify_cb;
     void *notify_opaque;
@@ -171,7 +202,46 @@ void qemu_clock_enable(QEMUClockType type, bool enabled)
 
 bool timerlist_has_timers(QEMUTimerList *timer_list)
 {
-    return !!qatomic_read(&timer_list->active_timers);
+    return !!qatomic_read(&timer_list->nr_timers);
+}
+
+/* Return the earliest timer whose attributes are all in @attr_mask */
+static QEMUTimer *timerlist_find_first_locked(QEMUTimerList *timer_list,
+                                              int attr_mask)
+{
+    unsigned level;
+
+    for (level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+        uint64_t pending = timer_list->wheel_pending[level];
+
+        while (pending) {
+            unsigned idx = level * TIMER_WHEEL_SIZE + ctz64(pending);
+            QEMUTimer *ts, *first = NULL;
+
+            /* Only the level 0 slots are sorted, scan the whole slot */
+            for (ts = timer_list->wheel[idx].head; ts; ts = ts->next) {
+                if (!(ts->attributes & ~attr_mask) &&
+                    (!first || ts->expire_time < first->expire_time)) {
+                    first = ts;
+                }
+            }
+            if (first) {
+                return first;
+            }
+            pending &= pending - 1;
+        }
+    }
+    return NULL;
+}
+
+static QEMUTimer *timerlist_first_locked(QEMUTimerList *timer_list)
+{
+    if (timer_list->first_stale) {
+        timer_list->first = timerlist_find_first_locked(timer_list,
+                                                        QEMU_TIMER_ATTR_ALL);
+        timer_list->first_stale = false;
+    }
+    return timer_list->first;
 }
 
 bool qemu_clock_has_timers(QEMUClockType type)
@@ -184,15 +254,17 @@ bool timerlist_expired(QEMUTimerList *timer_list)
 {
     int64_t expire_time;
 
-    if (!qatomic_read(&timer_list->active_timers)) {
+    if (!qatomic_read(&timer_list->nr_timers)) {
         return false;
     }
 
     WITH_QEMU_LOCK_GUARD(&timer_list->active_timers_lock) {
-        if (!timer_list->active_timers) {
+        QEMUTimer *ts = timerlist_first_locked(timer_list);
+
+        if (!ts) {
             return false;
         }
-        expire_time = timer_list->active_timers->expire_time;
+        expire_time = ts->expire_time;
     }
 
     return expire_time <= qemu_clock_get_ns(timer_list->clock->type);
@@ -214,7 +286,7 @@ int64_t timerlist_deadline_ns(QEMUTimerList *timer_list)
     int64_t delta;
     int64_t expire_time;
 
-    if (!qatomic_read(&timer_list->active_timers)) {
+    if (!qatomic_read(&timer_list->nr_timers)) {
         return -1;
     }
 
@@ -227,10 +299,12 @@ int64_t timerlist_deadline_ns(QEMUTimerList *timer_list)
      * the caller should notice the change and there is no race condition.
      */
     WITH_QEMU_LOCK_GUARD(&timer_list->active_timers_lock) {
-        if (!timer_list->active_timers) {
+        QEMUTimer *ts = timerlist_first_locked(timer_list);
+
+        if (!ts) {
             return -1;
         }
-        expire_time = timer_list->active_timers->expire_time;
+        expire_time = ts->expire_time;
     }
 
     delta = expire_time - qemu_clock_get_ns(timer_list->clock->type);
@@ -261,15 +335,12 @@ int64_t qemu_clock_deadline_ns_all(QEMUClockType type, int attr_mask)
     }
 
     QLIST_FOREACH(timer_list, &clock->timerlists, list) {
-        if (!qatomic_read(&timer_list->active_timers)) {
+        if (!qatomic_read(&timer_list->nr_timers)) {
             continue;
         }
         qemu_mutex_lock(&timer_list->active_timers_lock);
-        ts = timer_list->active_timers;
         /* Skip all external timers */
-        while (ts && (ts->attributes & ~attr_mask)) {
-            ts = ts->next;
-        }
+        ts = timerlist_find_first_locked(timer_list, attr_mask);
         if (!ts) {
             qemu_mutex_unlock(&timer_list->active_timers_lock);
             continue;
@@ -378,43 +449,140 @@ void timer_deinit(QEMUTimer *ts)
     ts->timer_list = NULL;
 }
 
+static unsigned timer_wheel_index(QEMUTimerList *timer_list,
+                                  int64_t expire_time)
+{
+    /* Timers armed in the past go in the base slot, where they sort first */
+    uint64_t base = timer_list->wheel_base >> TIMER_WHEEL_SHIFT;
+    uint64_t expire = MAX(expire_time, timer_list->wheel_base)
+                      >> TIMER_WHEEL_SHIFT;
+    uint64_t diff = base ^ expire;
+    unsigned level = diff ? (63 - clz64(diff)) / TIMER_WHEEL_BITS : 0;
+    unsigned digit = (expire >> (level * TIMER_WHEEL_BITS)) &
+                     (TIMER_WHEEL_SIZE - 1);
+
+    return level * TIMER_WHEEL_SIZE + digit;
+}
+
+static void timer_wheel_insert(QEMUTimerList *timer_list, QEMUTimer *ts)
+{
+    unsigned idx = timer_wheel_index(timer_list, ts->expire_time);
+    QEMUTimerSlot *slot = &timer_list->wheel[idx];
+    QEMUTimer **pt;
+
+    if (idx < TIMER_WHEEL_SIZE) {
+        /* Level 0 is sorted, after any timer with the same expiry time */
+        pt = &slot->head;
+        while (*pt && (*pt)->expire_time <= ts->expire_time) {
+            pt = &(*pt)->next;
+        }
+    } else {
+        pt = slot->last ? &slot->last->next : &slot->head;
+    }
+
+    ts->next = *pt;
+    ts->pprev = pt;
+    if (ts->next) {
+        ts->next->pprev = &ts->next;
+    } else {
+        slot->last = ts;
+    }
+    *pt = ts;
+
+    ts->slot = idx;
+    timer_list->wheel_pending[idx / TIMER_WHEEL_SIZE] |=
+        1ULL << (idx % TIMER_WHEEL_SIZE);
+}
+
+static void timer_wheel_remove(QEMUTimerList *timer_list, QEMUTimer *ts)
+{
+    QEMUTimerSlot *slot = &timer_list->wheel[ts->slot];
+
+    *ts->pprev = ts->next;
+    if (ts->next) {
+        ts->next->pprev = ts->pprev;
+    } else if (ts->pprev == &slot->head) {
+        slot->last = NULL;
+    } else {
+        slot->last = container_of(ts->pprev, QEMUTimer, next);
+    }
+    if (!slot->head) {
+        timer_list->wheel_pending[ts->slot / TIMER_WHEEL_SIZE] &=
+            ~(1ULL << (ts->slot % TIMER_WHEEL_SIZE));
+    }
+    ts->next = NULL;
+    ts->pprev = NULL;
+}
+
+/*
+ * Move the wheel base forward to @now.  All timers expiring at or before
+ * @now must have been removed already.  Only the slot that @now falls in
+ * on the highest level whose digit changes can hold timers that now
+ * belong to a lower level.
+ */
+static void timer_wheel_advance(QEMUTimerList *timer_list, int64_t now)
+{
+    uint64_t diff;
+    unsigned level, idx;
+    QEMUTimer *ts, *next;
+
+    if (now <= timer_list->wheel_base) {
+        return;
+    }
+
+    diff = (timer_list->wheel_base ^ now) >> TIMER_WHEEL_SHIFT;
+    timer_list->wheel_base = now;
+    if (!diff) {
+        return;
+    }
+
+    level = (63 - clz64(diff)) / TIMER_WHEEL_BITS;
+    if (!level) {
+        return;
+    }
+
+    idx = level * TIMER_WHEEL_SIZE +
+          (((uint64_t)now >> (TIMER_WHEEL_SHIFT + level * TIMER_WHEEL_BITS)) &
+           (TIMER_WHEEL_SIZE - 1));
+    ts = timer_list->wheel[idx].head;
+    timer_list->wheel[idx].head = NULL;
+    timer_list->wheel[idx].last = NULL;
+    timer_list->wheel_pending[level] &= ~(1ULL << (idx % TIMER_WHEEL_SIZE));
+
+    /* Keep FIFO order, so that equal expiry times still fire in order */
+    for (; ts; ts = next) {
+        next = ts->next;
+        timer_wheel_insert(timer_list, ts);
+    }
+}
+
 static void timer_del_locked(QEMUTimerList *timer_list, QEMUTimer *ts)
 {
-    QEMUTimer **pt, *t;
+    if (ts->expire_time == -1) {
+        return;
+    }
 
     ts->expire_time = -1;
-    pt = &timer_list->active_timers;
-    for(;;) {
-        t = *pt;
-        if (!t)
-            break;
-        if (t == ts) {
-            qatomic_set(pt, t->next);
-            break;
-        }
-        pt = &t->next;
+    timer_wheel_remove(timer_list, ts);
+    if (ts == timer_list->first) {
+        timer_list->first_stale = true;
     }
+    qatomic_set(&timer_list->nr_timers, timer_list->nr_timers - 1);
 }
 
 static bool timer_mod_ns_locked(QEMUTimerList *timer_list,
                                 QEMUTimer *ts, int64_t expire_time)
 {
-    QEMUTimer **pt, *t;
-
-    /* add the timer in the sorted list */
-    pt = &timer_list->active_timers;
-    for (;;) {
-        t = *pt;
-        if (!timer_expired_ns(t, expire_time)) {
-            break;
-        }
-        pt = &t->next;
-    }
     ts->expire_time = MAX(expire_time, 0);
-    ts->next = *pt;
-    qatomic_set(pt, ts);
+    timer_wheel_insert(timer_list, ts);
+    qatomic_set(&timer_list->nr_timers, timer_list->nr_timers + 1);
 
-    return pt == &timer_list->active_timers;
+    if (!timer_list->first_stale &&
+        (!timer_list->first ||
+         ts->expire_time < timer_list->first->expire_time)) {
+        timer_list->first = ts;
+    }
+    return timerlist_first_locked(timer_list) == ts;
 }
 
 static void timerlist_rearm(QEMUTimerList *timer_list)
@@ -506,7 +674,7 @@ bool timerlist_run_timers(QEMUTimerList *timer_list)
     QEMUTimerCB *cb;
     void *opaque;
 
-    if (!qatomic_read(&timer_list->active_timers)) {
+    if (!qatomic_read(&timer_list->nr_timers)) {
         return false;
     }
 
@@ -545,7 +713,7 @@ bool timerlist_run_timers(QEMUTimerList *timer_list)
      */
     current_time = qemu_clock_get_ns(timer_list->clock->type);
     qemu_mutex_lock(&timer_list->active_timers_lock);
-    while ((ts = timer_list->active_timers)) {
+    while ((ts = timerlist_first_locked(timer_list))) {
         if (!timer_expired_ns(ts, current_time)) {
             /* No expired timers left.  The checkpoint can be skipped
              * if no timers fired or they were all external.
@@ -565,9 +733,7 @@ bool timerlist_run_timers(QEMUTimerList *timer_list)
         }
 
         /* remove timer from the list before calling the callback */
-        timer_list->active_timers = ts->next;
-        ts->next = NULL;
-        ts->expire_time = -1;
+        timer_del_locked(timer_list, ts);
         cb = ts->cb;
         opaque = ts->opaque;
 
@@ -578,6 +744,8 @@ bool timerlist_run_timers(QEMUTimerList *timer_list)
 
         progress = true;
     }
+    /* Everything up to current_time has fired, keep new timers shallow */
+    timer_wheel_advance(timer_list, current_time);
     qemu_mutex_unlock(&timer_list->active_timers_lock);
 
 out:
@@ -43,10 +43,20 @@
  * just-removed entry. This makes lookups slightly faster, since the moment an
  * invalid entry is found, the (failed) lookup is over.
  *
- * Resizing is done by taking all bucket spinlocks (so that no other writers can
- * race with us) and then copying all entries into a new hash map. Then, the
- * ht->map pointer is set, and the old map is freed once no RCU readers can see
- * it anymore.
+ * Explicit resizes (and resets) are done by taking all bucket spinlocks (so
+ * that no other writers can race with us) and then copying all entries into a
+ * new hash map. Then, the ht->map pointer is set, and the old map is freed once
+ * no RCU readers can see it anymore.
+ *
+ * Automatic growth is incremental instead, so that writers do not stall while
+ * a large table is copied. The new map is published right away with new->old
+ * pointing to the previous map, and the old head buckets are then copied one
+ * chain at a time, either on demand by a writer that needs the corresponding
+ * new bucket or a few at a time by every writer. Entries are only copied, so
+ * the old map stays a consistent snapshot: a lookup that finds the old bucket
+ * not yet migrated falls back to it after missing in the new map. Once all
+ * buckets are migrated, new->old is cleared and the old map is freed after a
+ * grace period.
  *
  * Writers check for concurrent resizes by comparing ht->map before and after
  * acquiring their bucket lock. If they don't match, a resize has occurred
@@ -70,6 +80,7 @@
 #include "qemu/atomic.h"
 #include "qemu/rcu.h"
 #include "qemu/memalign.h"
+#include "qemu/bitmap.h"
 
 //#define QHT_DEBUG
 
@@ -176,6 +187,13 @@ struct qht_tsan_lock {
  * @n_added_buckets: number of added (i.e. "non-head") buckets
  * @n_added_buckets_threshold: threshold to trigger an upward resize once the
  *                             number of added buckets surpasses it.
+ * @old: map whose entries are being migrated into this one by an incremental
+ *       resize, or NULL.
+ * @migrated: bitmap of the head buckets that have been copied to the new map,
+ *            allocated when this map becomes the @old map of another one.
+ *            Bits are set under the bucket lock.
+ * @n_migrated: number of bits set in @migrated.
+ * @migrate_next: next head bucket to be migrated by writers helping out.
  * @tsan_bucket_locks: Array of striped locks to be used only under TSAN.
  *
  * Buckets are tracked in what we call a "map", i.e. this structure.
@@ -186,6 +204,10 @@ struct qht_map {
     size_t n_buckets;
     size_t n_added_buckets;
     size_t n_added_buckets_threshold;
+    struct qht_map *old;
+    unsigned long *migrated;
+    size_t n_migrated;
+    size_t migrate_next;
 #ifdef CONFIG_TSAN
     struct qht_tsan_lock tsan_bucket_locks[QHT_TSAN_BUCKET_LOCKS];
 #endif
@@ -194,9 +216,16 @@ struct qht_map {
 /* trigger a resize when n_added_buckets > n_buckets / div */
 #define QHT_NR_ADDED_BUCKETS_THRESHOLD_DIV 8
 
+/* old head buckets migrated by each writer during an incremental resize */
+#define QHT_MIGRATE_BATCH 4
+
 static void qht_do_resize_reset(struct qht *ht, struct qht_map *new,
                                 bool reset);
 static void qht_grow_maybe(struct qht *ht);
+static void qht_map_destroy(struct qht_map *map);
+static void *qht_insert__locked(const struct qht *ht, struct qht_map *map,
+                                struct qht_bucket *head, void *p, uint32_t hash,
+                                bool *needs_resize);
 
 #ifdef QHT_DEBUG
 
@@ -341,35 +370,6 @@ static inline bool qht_map_is_stale__locked(const struct qht *ht,
     return map != ht->map;
 }
 
-/*
- * Grab all bucket locks, and set @pmap after making sure the map isn't stale.
- *
- * Pairs with qht_map_unlock_buckets(), hence the pass-by-reference.
- *
- * Note: callers cannot have ht->lock held.
- */
-static inline
-void qht_map_lock_buckets__no_stale(struct qht *ht, struct qht_map **pmap)
-{
-    struct qht_map *map;
-
-    map = qatomic_rcu_read(&ht->map);
-    qht_map_lock_buckets(map);
-    if (likely(!qht_map_is_stale__locked(ht, map))) {
-        *pmap = map;
-        return;
-    }
-    qht_map_unlock_buckets(map);
-
-    /* we raced with a resize; acquire ht->lock to see the updated ht->map */
-    qht_lock(ht);
-    map = ht->map;
-    qht_map_lock_buckets(map);
-    qht_unlock(ht);
-    *pmap = map;
-    return;
-}
-
 /*
  * Get a head bucket and lock it, making sure its parent map is not stale.
  * @pmap is filled with a pointer to the bucket's parent map.
@@ -405,6 +405,140 @@ struct qht_bucket *qht_bucket_lock__no_stale(struct qht *ht, uint32_t hash,
     return b;
 }
 
+static inline bool qht_map_bucket_migrated(const struct qht_map *old,
+                                           size_t idx)
+{
+    return qatomic_load_acquire(&old->migrated[BIT_WORD(idx)]) & BIT_MASK(idx);
+}
+
+/*
+ * Copy the chain of head bucket @idx of @old into @map, unless it is already
+ * there.  Returns true if this completed the migration of @old.
+ *
+ * Note: callers cannot hold any bucket lock.
+ */
+static bool qht_map_migrate_bucket(const struct qht *ht, struct qht_map *map,
+                                   struct qht_map *old, size_t idx)
+{
+    struct qht_bucket *head = &old->buckets[idx];
+    struct qht_bucket *b;
+    int i;
+
+    qht_bucket_lock(old, head);
+    if (qht_map_bucket_migrated(old, idx)) {
+        qht_bucket_unlock(old, head);
+        return false;
+    }
+    for (b = head; b; b = b->next) {
+        for (i = 0; i < QHT_BUCKET_ENTRIES && b->pointers[i]; i++) {
+            struct qht_bucket *to = qht_map_to_bucket(map, b->hashes[i]);
+
+            qht_bucket_lock(map, to);
+            qht_insert__locked(ht, map, to, b->pointers[i], b->hashes[i],
+                               NULL);
+            qht_bucket_unlock(map, to);
+        }
+    }
+    /* pairs with qatomic_load_acquire in qht_map_bucket_migrated */
+    set_bit_atomic(idx, old->migrated);
+    qht_bucket_unlock(old, head);
+
+    return qatomic_fetch_inc(&old->n_migrated) + 1 == old->n_buckets;
+}
+
+/*
+ * Detach @old from @map once all its buckets have been migrated.
+ * Call with ht->lock held.
+ */
+static void qht_map_migration_done__locked(struct qht *ht, struct qht_map *map,
+                                           struct qht_map *old)
+{
+    if (map->old == old) {
+        qatomic_rcu_set(&map->old, NULL);
+        call_rcu(old, qht_map_destroy, rcu);
+    }
+}
+
+/* Call from an RCU read-side critical section, without bucket locks held. */
+static void qht_map_migration_done(struct qht *ht, struct qht_map *map,
+                                   struct qht_map *old)
+{
+    qht_lock(ht);
+    qht_map_migration_done__locked(ht, map, old);
+    qht_unlock(ht);
+}
+
+/* Finish an incremental resize of ht->map.  Call with ht->lock held. */
+static void qht_map_migrate_all__locked(struct qht *ht)
+{
+    struct qht_map *map = ht->map;
+    struct qht_map *old = map->old;
+    size_t i;
+
+    if (likely(!old)) {
+        return;
+    }
+    for (i = 0; i < old->n_buckets; i++) {
+        qht_map_migrate_bucket(ht, map, old, i);
+    }
+    qht_map_migration_done__locked(ht, map, old);
+}
+
+/*
+ * Help an incremental resize of @map make progress.
+ * Call from an RCU read-side critical section, without bucket locks held.
+ */
+static void qht_map_migrate_some(struct qht *ht, struct qht_map *map)
+{
+    struct qht_map *old = qatomic_rcu_read(&map->old);
+    int i;
+
+    if (likely(!old)) {
+        return;
+    }
+    for (i = 0; i < QHT_MIGRATE_BATCH; i++) {
+        size_t idx = qatomic_fetch_inc(&old->migrate_next);
+
+        if (idx >= old->n_buckets) {
+            return;
+        }
+        if (qht_map_migrate_bucket(ht, map, old, idx)) {
+            qht_map_migration_done(ht, map, old);
+            return;
+        }
+    }
+}
+
+/*
+ * Like qht_bucket_lock__no_stale, but if an incremental resize is in progress
+ * also make sure that the entries for @hash have been migrated to the map.
+ *
+ * Call from an RCU read-side critical section.
+ */
+static struct qht_bucket *qht_bucket_lock__migrated(struct qht *ht,
+                                                    uint32_t hash,
+                                                    struct qht_map **pmap)
+{
+    for (;;) {
+        struct qht_bucket *b = qht_bucket_lock__no_stale(ht, hash, pmap);
+        struct qht_map *map = *pmap;
+        struct qht_map *old = qatomic_rcu_read(&map->old);
+        size_t idx;
+
+        if (likely(!old)) {
+            return b;
+        }
+        idx = hash & (old->n_buckets - 1);
+        if (qht_map_bucket_migrated(old, idx)) {
+            return b;
+        }
+        qht_bucket_unlock(map, b);
+        if (qht_map_migrate_bucket(ht, map, old, idx)) {
+            qht_map_migration_done(ht, map, old);
+        }
+    }
+}
+
 static inline bool qht_map_needs_resize(const struct qht_map *map)
 {
     return qatomic_read(&map->n_added_buckets) >
@@ -434,6 +568,7 @@ static void qht_map_destroy(struct qht_map *map)
         qht_chain_destroy(map, &map->buckets[i]);
     }
     qemu_vfree(map->buckets);
+    g_free(map->migrated);
     g_free(map);
 }
 
@@ -442,7 +577,7 @@ static struct qht_map *qht_map_create(size_t n_buckets)
     struct qht_map *map;
     size_t i;
 
-    map = g_malloc(sizeof(*map));
+    map = g_malloc0(sizeof(*map));
     map->n_buckets = n_buckets;
 
     map->n_added_buckets = 0;
@@ -479,6 +614,9 @@ void qht_init(struct qht *ht, qht_cmp_func_t cmp, size_t n_elems,
 /* call only when there are no readers/writers left */
 void qht_destroy(struct qht *ht)
 {
+    if (ht->map->old) {
+        qht_map_destroy(ht->map->old);
+    }
     qht_map_destroy(ht->map);
     memset(ht, 0, sizeof(*ht));
 }
@@ -518,7 +656,11 @@ void qht_reset(struct qht *ht)
 {
     struct qht_map *map;
 
-    qht_map_lock_buckets__no_stale(ht, &map);
+    qht_lock(ht);
+    qht_map_migrate_all__locked(ht);
+    map = ht->map;
+    qht_map_lock_buckets(map);
+    qht_unlock(ht);
     qht_map_reset__all_locked(map);
     qht_map_unlock_buckets(map);
 }
@@ -593,15 +735,41 @@ void *qht_lookup__slowpath(const struct qht_bucket *b, qht_lookup_func_t func,
     return ret;
 }
 
+/*
+ * An incremental resize is in progress: if the old bucket for @hash has not
+ * been migrated yet, entries might still be only there.  Entries are copied,
+ * never moved, so checking the new map first cannot miss them.
+ */
+static __attribute__((noinline))
+void *qht_lookup__resizing(const struct qht_map *map,
+                           const struct qht_map *old, qht_lookup_func_t func,
+                           const void *userp, uint32_t hash)
+{
+    size_t idx = hash & (old->n_buckets - 1);
+    bool migrated = qht_map_bucket_migrated(old, idx);
+    void *ret;
+
+    ret = qht_lookup__slowpath(qht_map_to_bucket(map, hash), func, userp, hash);
+    if (ret || migrated) {
+        return ret;
+    }
+    return qht_lookup__slowpath(&old->buckets[idx], func, userp, hash);
+}
+
 void *qht_lookup_custom(const struct qht *ht, const void *userp, uint32_t hash,
                         qht_lookup_func_t func)
 {
     const struct qht_bucket *b;
     const struct qht_map *map;
+    const struct qht_map *old;
     unsigned int version;
     void *ret;
 
     map = qatomic_rcu_read(&ht->map);
+    old = qatomic_rcu_read(&map->old);
+    if (unlikely(old)) {
+        return qht_lookup__resizing(map, old, func, userp, hash);
+    }
     b = qht_map_to_bucket(map, hash);
 
     version = seqlock_read_begin(&b->sequence);
@@ -683,11 +851,16 @@ static __attribute__((noinline)) void qht_grow_maybe(struct qht *ht)
         return;
     }
     map = ht->map;
-    /* another thread might have just performed the resize we were after */
-    if (qht_map_needs_resize(map)) {
+    /*
+     * Another thread might have just performed the resize we were after,
+     * and we do not start a new one before the previous one is complete.
+     */
+    if (!map->old && qht_map_needs_resize(map)) {
         struct qht_map *new = qht_map_create(map->n_buckets * 2);
 
-        qht_do_resize(ht, new);
+        map->migrated = bitmap_new(map->n_buckets);
+        new->old = map;
+        qatomic_rcu_set(&ht->map, new);
     }
     qht_unlock(ht);
 }
@@ -702,7 +875,8 @@ bool qht_insert(struct qht *ht, void *p, uint32_t hash, void **existing)
     /* NULL pointers are not supported */
     qht_debug_assert(p);
 
-    b = qht_bucket_lock__no_stale(ht, hash, &map);
+    RCU_READ_LOCK_GUARD();
+    b = qht_bucket_lock__migrated(ht, hash, &map);
     prev = qht_insert__locked(ht, map, b, p, hash, &needs_resize);
     qht_bucket_debug__locked(b);
     qht_bucket_unlock(map, b);
@@ -710,6 +884,7 @@ bool qht_insert(struct qht *ht, void *p, uint32_t hash, void **existing)
     if (unlikely(needs_resize) && ht->mode & QHT_MODE_AUTO_RESIZE) {
         qht_grow_maybe(ht);
     }
+    qht_map_migrate_some(ht, qatomic_rcu_read(&ht->map));
     if (likely(prev == NULL)) {
         return true;
     }
@@ -813,10 +988,12 @@ bool qht_remove(struct qht *ht, const void *p, uint32_t hash)
     /* NULL pointers are not supported */
     qht_debug_assert(p);
 
-    b = qht_bucket_lock__no_stale(ht, hash, &map);
+    RCU_READ_LOCK_GUARD();
+    b = qht_bucket_lock__migrated(ht, hash, &map);
     ret = qht_remove__locked(b, p, hash);
     qht_bucket_debug__locked(b);
     qht_bucket_unlock(map, b);
+    qht_map_migrate_some(ht, map);
     return ret;
 }
 
@@ -872,8 +1049,11 @@ do_qht_iter(struct qht *ht, const struct qht_iter *iter, void *userp)
 {
     struct qht_map *map;
 
-    map = qatomic_rcu_read(&ht->map);
+    qht_lock(ht);
+    qht_map_migrate_all__locked(ht);
+    map = ht->map;
     qht_map_lock_buckets(map);
+    qht_unlock(ht);
     qht_map_iter__all_locked(map, iter, userp);
     qht_map_unlock_buckets(map);
 }
@@ -927,6 +1107,7 @@ static void qht_do_resize_reset(struct qht *ht, struct qht_map *new, bool reset)
     };
     struct qht_map_copy_data data;
 
+    qht_map_migrate_all__locked(ht);
     old = ht->map;
     qht_map_lock_buckets(old);
 
@@ -974,6 +1155,7 @@ void qht_statistics_init(const struct qht *ht, struct qht_stats *stats)
     const struct qht_map *map;
     int i;
 
+    /* entries of an incremental resize that are not migrated yet are missed */
     map = qatomic_rcu_read(&ht->map);
 
     stats->used_head_buckets = 0;
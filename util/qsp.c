@@ -10,8 +10,9 @@
  * help diagnose performance problems, e.g. scalability issues when
  * contention is high.
  *
- * The primitives currently supported are mutexes, recursive mutexes and
- * condition variables. Note that not all related functions are intercepted;
+ * The primitives currently supported are mutexes, recursive mutexes,
+ * condition variables, and the coroutine CoMutex, CoRwlock, CoQueue and
+ * block graph lock. Note that not all related functions are intercepted;
  * instead we profile only those functions that can have a performance impact,
  * either due to blocking (e.g. cond_wait, mutex_lock) or cache line
  * contention (e.g. mutex_lock, mutex_trylock).
@@ -65,13 +66,6 @@
 #include "qemu/rcu.h"
 #include "qemu/xxhash.h"
 
-enum QSPType {
-    QSP_MUTEX,
-    QSP_BQL_MUTEX,
-    QSP_REC_MUTEX,
-    QSP_CONDVAR,
-};
-
 struct QSPCallSite {
     const void *obj;
     const char *file; /* i.e. __FILE__; shortened later */
@@ -122,8 +116,14 @@ static const char * const qsp_typenames[] = {
     [QSP_BQL_MUTEX] = "BQL mutex",
     [QSP_REC_MUTEX] = "rec_mutex",
     [QSP_CONDVAR]   = "condvar",
+    [QSP_CO_MUTEX]  = "co_mutex",
+    [QSP_CO_RWLOCK] = "co_rwlock",
+    [QSP_CO_QUEUE]  = "co_queue",
+    [QSP_GRAPH_LOCK] = "graphlock",
 };
 
+bool qsp_co_enabled;
+
 QemuMutexLockFunc qemu_bql_mutex_lock_func = qemu_mutex_lock_impl;
 QemuMutexLockFunc qemu_mutex_lock_func = qemu_mutex_lock_impl;
 QemuMutexTrylockFunc qemu_mutex_trylock_func = qemu_mutex_trylock_impl;
@@ -430,6 +430,27 @@ qsp_cond_timedwait(QemuCond *cond, QemuMutex *mutex, int ms,
     return ret;
 }
 
+int64_t qsp_co_clock(void)
+{
+    return get_clock();
+}
+
+/*
+ * Unlike the wrappers above, this runs in the thread where the coroutine
+ * resumed, which need not be the thread where it started waiting.  That is
+ * fine, since the entry is looked up only now.
+ */
+void qsp_co_do_record(const void *obj, enum QSPType type, const char *file,
+                      int line, int64_t t0)
+{
+    QSPEntry *e;
+    int64_t t1;
+
+    t1 = get_clock();
+    e = qsp_entry_get(obj, file, line, type);
+    qsp_entry_record(e, t1 - t0);
+}
+
 bool qsp_is_enabled(void)
 {
     return qatomic_read(&qemu_mutex_lock_func) == qsp_mutex_lock;
@@ -444,6 +465,7 @@ void qsp_enable(void)
     qatomic_set(&qemu_rec_mutex_trylock_func, qsp_rec_mutex_trylock);
     qatomic_set(&qemu_cond_wait_func, qsp_cond_wait);
     qatomic_set(&qemu_cond_timedwait_func, qsp_cond_timedwait);
+    qatomic_set(&qsp_co_enabled, true);
 }
 
 void qsp_disable(void)
@@ -455,6 +477,7 @@ void qsp_disable(void)
     qatomic_set(&qemu_rec_mutex_trylock_func, qemu_rec_mutex_trylock_impl);
     qatomic_set(&qemu_cond_wait_func, qemu_cond_wait_impl);
     qatomic_set(&qemu_cond_timedwait_func, qemu_cond_timedwait_impl);
+    qatomic_set(&qsp_co_enabled, false);
 }
 
 static gint qsp_tree_cmp(gconstpointer ap, gconstpointer bp, gpointer up)
@@ -664,6 +687,7 @@ struct QSPReportEntry {
     const char *typename;
     double time_s;
     double ns_avg;
+    uint64_t ns;
     uint64_t n_acqs;
     unsigned int n_objs;
 };
@@ -693,6 +717,7 @@ static gboolean qsp_tree_report(gpointer key, gpointer value, gpointer udata)
     entry->callsite_at = qsp_at(e->callsite);
     entry->typename = qsp_typenames[e->callsite->type];
     entry->time_s = e->ns * 1e-9;
+    entry->ns = e->ns;
     entry->n_acqs = e->n_acqs;
     entry->ns_avg = e->n_acqs ? e->ns / e->n_acqs : 0;
     return FALSE;
@@ -753,6 +778,26 @@ static void pr_report(const QSPReport *rep)
     g_free(dashes);
 }
 
+/*
+ * Print one line per entry in the "folded stacks" format understood by
+ * flamegraph.pl and similar tools, weighted by wait time in nanoseconds.
+ */
+static void pr_report_folded(const QSPReport *rep)
+{
+    size_t i;
+
+    for (i = 0; i < rep->n_entries; i++) {
+        const QSPReportEntry *e = &rep->entries[i];
+
+        if (e->n_objs > 1) {
+            qemu_printf("%s;%s", e->typename, e->callsite_at);
+        } else {
+            qemu_printf("%s;%p;%s", e->typename, e->obj, e->callsite_at);
+        }
+        qemu_printf(" %" PRIu64 "\n", e->ns);
+    }
+}
+
 static void report_destroy(QSPReport *rep)
 {
     size_t i;
@@ -766,7 +811,7 @@ static void report_destroy(QSPReport *rep)
 }
 
 void qsp_report(size_t max, enum QSPSortBy sort_by,
-                bool callsite_coalesce)
+                bool callsite_coalesce, bool folded)
 {
     GTree *tree = g_tree_new_full(qsp_tree_cmp, &sort_by, g_free, NULL);
     QSPReport rep;
@@ -781,7 +826,11 @@ void qsp_report(size_t max, enum QSPSortBy sort_by,
     g_tree_foreach(tree, qsp_tree_report, &rep);
     g_tree_destroy(tree);
 
-    pr_report(&rep);
+    if (folded) {
+        pr_report_folded(&rep);
+    } else {
+        pr_report(&rep);
+    }
     report_destroy(&rep);
 }
 
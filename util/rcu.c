@@ -32,6 +32,8 @@
 #include "qemu/thread.h"
 #include "qemu/main-loop.h"
 #include "qemu/lockable.h"
+#include "qemu/stats64.h"
+#include "qemu/timer.h"
 #if defined(CONFIG_MALLOC_TRIM)
 #include <malloc.h>
 #endif
@@ -50,6 +52,11 @@ static int in_drain_call_rcu;
 static QemuMutex rcu_registry_lock;
 static QemuMutex rcu_sync_lock;
 
+static Stat64 rcu_stat_grace_periods;
+static Stat64 rcu_stat_grace_period_ns;
+static Stat64 rcu_stat_grace_period_max_ns;
+static Stat64 rcu_stat_callbacks;
+
 /*
  * Check whether a quiescent state was crossed between the beginning of
  * update_counter_and_wait and now.
@@ -143,6 +150,9 @@ static void wait_for_readers(void)
 
 void synchronize_rcu(void)
 {
+    int64_t start = get_clock();
+    uint64_t elapsed;
+
     QEMU_LOCK_GUARD(&rcu_sync_lock);
 
     /* Write RCU-protected pointers before reading p_rcu_reader->ctr.
@@ -171,6 +181,11 @@ void synchronize_rcu(void)
 
         wait_for_readers();
     }
+
+    elapsed = get_clock() - start;
+    stat64_add(&rcu_stat_grace_periods, 1);
+    stat64_add(&rcu_stat_grace_period_ns, elapsed);
+    stat64_max(&rcu_stat_grace_period_max_ns, elapsed);
 }
 
 
@@ -178,13 +193,28 @@ void synchronize_rcu(void)
 
 /* Multi-producer, single-consumer queue based on urcu/static/wfqueue.h
  * from liburcu.  Note that head is only used by the consumer.
+ *
+ * Registered threads queue callbacks on their own rcu_reader_data, so that
+ * they do not all bounce the same tail pointer; the global queue is used by
+ * threads that are not registered.  The call_rcu thread merges all queues
+ * into one batch before each grace period.  Callbacks from the same thread
+ * are still invoked in the order in which they were queued.
  */
-static struct rcu_head dummy;
-static struct rcu_head *head = &dummy, **tail = &dummy.next;
-static int rcu_call_count;
+static struct rcu_call_queue rcu_call_queue = {
+    .head = &rcu_call_queue.dummy,
+    .tail = &rcu_call_queue.dummy.next,
+};
 static QemuEvent rcu_call_ready_event;
 
-static void enqueue(struct rcu_head *node)
+static void rcu_call_queue_init(struct rcu_call_queue *q)
+{
+    q->dummy.next = NULL;
+    q->head = &q->dummy;
+    q->tail = &q->dummy.next;
+    q->count = 0;
+}
+
+static void enqueue(struct rcu_call_queue *q, struct rcu_head *node)
 {
     struct rcu_head **old_tail;
 
@@ -195,7 +225,7 @@ static void enqueue(struct rcu_head *node)
      * used by further enqueue operations, but it will not
      * be dequeued yet...
      */
-    old_tail = qatomic_xchg(&tail, &node->next);
+    old_tail = qatomic_xchg(&q->tail, &node->next);
 
     /*
      * ... until it is pointed to from another item in the list.
@@ -207,13 +237,13 @@ static void enqueue(struct rcu_head *node)
     qatomic_store_release(old_tail, node);
 }
 
-static struct rcu_head *try_dequeue(void)
+static struct rcu_head *try_dequeue(struct rcu_call_queue *q)
 {
     struct rcu_head *node, *next;
 
 retry:
     /* Head is only written by this thread, so no need for barriers.  */
-    node = head;
+    node = q->head;
 
     /*
      * If the head node has NULL in its next pointer, the value is
@@ -231,7 +261,7 @@ retry:
      * The tail, because it is the first step in the enqueuing.
      * It is only the next pointers that might be inconsistent.
      */
-    if (head == &dummy && qatomic_read(&tail) == &dummy.next) {
+    if (q->head == &q->dummy && qatomic_read(&q->tail) == &q->dummy.next) {
         abort();
     }
 
@@ -241,17 +271,87 @@ retry:
      * dummy node, and the one being removed.  So we do not need to update
      * the tail pointer.
      */
-    head = next;
+    q->head = next;
 
     /* If we dequeued the dummy node, add it back at the end and retry.  */
-    if (node == &dummy) {
-        enqueue(node);
+    if (node == &q->dummy) {
+        enqueue(q, node);
         goto retry;
     }
 
     return node;
 }
 
+/*
+ * Move the callbacks that are completely queued on @q to the list ending
+ * at *@batch_tail.  Called with rcu_registry_lock held, which makes the
+ * caller the only consumer of @q.
+ */
+static int rcu_call_queue_take(struct rcu_call_queue *q,
+                               struct rcu_head ***batch_tail)
+{
+    struct rcu_head *node;
+    int n = 0;
+
+    while ((node = try_dequeue(q)) != NULL) {
+        node->next = NULL;
+        **batch_tail = node;
+        *batch_tail = &node->next;
+        n++;
+    }
+    qatomic_sub(&q->count, n);
+    return n;
+}
+
+/*
+ * Readers that a concurrent synchronize_rcu() has temporarily moved off
+ * the registry are skipped; their callbacks are picked up next time.
+ */
+static int rcu_call_pending(void)
+{
+    struct rcu_reader_data *index;
+    int n;
+
+    QEMU_LOCK_GUARD(&rcu_registry_lock);
+    n = qatomic_read(&rcu_call_queue.count);
+    QLIST_FOREACH(index, &registry, node) {
+        n += qatomic_read(&index->call_queue.count);
+    }
+    return n;
+}
+
+static int rcu_call_take_all(struct rcu_head ***batch_tail)
+{
+    struct rcu_reader_data *index;
+    int n;
+
+    QEMU_LOCK_GUARD(&rcu_registry_lock);
+    n = rcu_call_queue_take(&rcu_call_queue, batch_tail);
+    QLIST_FOREACH(index, &registry, node) {
+        n += rcu_call_queue_take(&index->call_queue, batch_tail);
+    }
+    return n;
+}
+
+/*
+ * Hand the callbacks of a reader that goes away to the global queue.
+ * Called with rcu_registry_lock held.
+ */
+static void rcu_call_queue_orphan(struct rcu_reader_data *p)
+{
+    struct rcu_head *batch = NULL, **batch_tail = &batch;
+    struct rcu_head *node, *next;
+    int n;
+
+    n = rcu_call_queue_take(&p->call_queue, &batch_tail);
+    for (node = batch; node; node = next) {
+        next = node->next;
+        enqueue(&rcu_call_queue, node);
+    }
+    qatomic_add(&rcu_call_queue.count, n);
+    qatomic_set(&p->call_queue.tail, NULL);
+}
+
 static void *call_rcu_thread(void *opaque)
 {
     struct rcu_head *node;
@@ -259,18 +359,22 @@ static void *call_rcu_thread(void *opaque)
     rcu_register_thread();
 
     for (;;) {
+        struct rcu_head *batch = NULL, **batch_tail = &batch;
         int tries = 0;
-        int n = qatomic_read(&rcu_call_count);
+        int n = rcu_call_pending();
 
-        /* Heuristically wait for a decent number of callbacks to pile up.
-         * Fetch rcu_call_count now, we only must process elements that were
-         * added before synchronize_rcu() starts.
+        /* Heuristically wait for a decent number of callbacks to pile up,
+         * unless somebody is waiting in drain_call_rcu().  Only elements
+         * that were added before synchronize_rcu() starts are processed.
          */
-        while (n == 0 || (n < RCU_CALL_MIN_SIZE && ++tries <= 5)) {
-            g_usleep(10000);
+        while (n == 0 || (n < RCU_CALL_MIN_SIZE &&
+                          !qatomic_read(&in_drain_call_rcu) && ++tries <= 5)) {
+            if (!qatomic_read(&in_drain_call_rcu)) {
+                g_usleep(10000);
+            }
             if (n == 0) {
                 qemu_event_reset(&rcu_call_ready_event);
-                n = qatomic_read(&rcu_call_count);
+                n = rcu_call_pending();
                 if (n == 0) {
 #if defined(CONFIG_MALLOC_TRIM)
                     malloc_trim(4 * 1024 * 1024);
@@ -278,41 +382,50 @@ static void *call_rcu_thread(void *opaque)
                     qemu_event_wait(&rcu_call_ready_event);
                 }
             }
-            n = qatomic_read(&rcu_call_count);
+            n = rcu_call_pending();
+        }
+
+        n = rcu_call_take_all(&batch_tail);
+        if (n == 0) {
+            continue;
         }
 
-        qatomic_sub(&rcu_call_count, n);
         synchronize_rcu();
         qemu_mutex_lock_iothread();
-        while (n > 0) {
-            node = try_dequeue();
-            while (!node) {
-                qemu_mutex_unlock_iothread();
-                qemu_event_reset(&rcu_call_ready_event);
-                node = try_dequeue();
-                if (!node) {
-                    qemu_event_wait(&rcu_call_ready_event);
-                    node = try_dequeue();
-                }
-                qemu_mutex_lock_iothread();
-            }
-
-            n--;
+        while (batch) {
+            node = batch;
+            batch = node->next;
             node->func(node);
         }
         qemu_mutex_unlock_iothread();
+        stat64_add(&rcu_stat_callbacks, n);
     }
     abort();
 }
 
 void call_rcu1(struct rcu_head *node, void (*func)(struct rcu_head *node))
 {
+    struct rcu_call_queue *q = &get_ptr_rcu_reader()->call_queue;
+
+    /* Threads that are not registered have no queue of their own.  */
+    if (!qatomic_read(&q->tail)) {
+        q = &rcu_call_queue;
+    }
+
     node->func = func;
-    enqueue(node);
-    qatomic_inc(&rcu_call_count);
+    enqueue(q, node);
+    qatomic_inc(&q->count);
     qemu_event_set(&rcu_call_ready_event);
 }
 
+void rcu_get_stats(RCUStats *stats)
+{
+    stats->grace_periods = stat64_get(&rcu_stat_grace_periods);
+    stats->grace_period_ns = stat64_get(&rcu_stat_grace_period_ns);
+    stats->grace_period_max_ns = stat64_get(&rcu_stat_grace_period_max_ns);
+    stats->callbacks = stat64_get(&rcu_stat_callbacks);
+    stats->callbacks_pending = rcu_call_pending();
+}
 
 struct rcu_drain {
     struct rcu_head rcu;
@@ -353,10 +466,10 @@ void drain_call_rcu(void)
      * is called, all RCU callbacks that were registered on this thread
      * prior to calling this function are completed.
      *
-     * Note that since we have only one global queue of the RCU callbacks,
-     * we also end up waiting for most of RCU callbacks that were registered
-     * on the other threads, but this is a side effect that shoudn't be
-     * assumed.
+     * Note that the queues of all threads are merged before each grace
+     * period, so we also end up waiting for most of RCU callbacks that
+     * were registered on the other threads, but this is a side effect
+     * that shoudn't be assumed.
      */
 
     qatomic_inc(&in_drain_call_rcu);
@@ -374,6 +487,7 @@ void rcu_register_thread(void)
 {
     assert(get_ptr_rcu_reader()->ctr == 0);
     qemu_mutex_lock(&rcu_registry_lock);
+    rcu_call_queue_init(&get_ptr_rcu_reader()->call_queue);
     QLIST_INSERT_HEAD(&registry, get_ptr_rcu_reader(), node);
     qemu_mutex_unlock(&rcu_registry_lock);
 }
@@ -382,6 +496,7 @@ void rcu_unregister_thread(void)
 {
     qemu_mutex_lock(&rcu_registry_lock);
     QLIST_REMOVE(get_ptr_rcu_reader(), node);
+    rcu_call_queue_orphan(get_ptr_rcu_reader());
     qemu_mutex_unlock(&rcu_registry_lock);
 }
 
@@ -453,10 +568,16 @@ static void rcu_init_unlock(void)
 
 static void rcu_init_child(void)
 {
+    struct rcu_reader_data *index;
+
     if (atfork_depth < 1) {
         return;
     }
 
+    /* The other threads are gone, but their callbacks must still run.  */
+    QLIST_FOREACH(index, &registry, node) {
+        rcu_call_queue_orphan(index);
+    }
     memset(&registry, 0, sizeof(registry));
     rcu_init_complete();
 }
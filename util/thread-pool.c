@@ -45,7 +45,13 @@ struct ThreadPoolElement {
     enum ThreadState state;
     int ret;
 
-    /* Access to this list is protected by lock.  */
+    /* Lock-free lists: ThreadPool.incoming, then ThreadPool.done_list.  */
+    QSLIST_ENTRY(ThreadPoolElement) next;
+
+    /* Access to request_list is protected by lock.  Once the request is
+     * done, the entry is reused for the completed list in the pool's
+     * AioContext.
+     */
     QTAILQ_ENTRY(ThreadPoolElement) reqs;
 
     /* This list is only written by the thread pool's mother thread.  */
@@ -62,8 +68,25 @@ struct ThreadPool {
 
     /* The following variables are only accessed from one AioContext. */
     QLIST_HEAD(, ThreadPoolElement) head;
+    QTAILQ_HEAD(, ThreadPoolElement) completed;
+
+    /*
+     * New requests are pushed here by the AioContext without taking lock,
+     * and moved to request_list by the worker threads.
+     */
+    QSLIST_HEAD(, ThreadPoolElement) incoming;
+
+    /* Requests finished by the worker threads, reaped by completion_bh */
+    QSLIST_HEAD(, ThreadPoolElement) done_list;
 
-    /* The following variables are protected by lock.  */
+    /* Number of requests not picked up by a worker yet, for statistics */
+    int queued_requests;
+
+    /*
+     * The following variables are protected by lock.  cur_threads,
+     * idle_threads and max_threads are also read without the lock by the
+     * submission fast path.
+     */
     QTAILQ_HEAD(, ThreadPoolElement) request_list;
     int cur_threads;
     int idle_threads;
@@ -73,6 +96,34 @@ struct ThreadPool {
     int max_threads;
 };
 
+static bool thread_pool_has_incoming(ThreadPool *pool)
+{
+    return qatomic_read(&pool->incoming.slh_first) != NULL;
+}
+
+/*
+ * Move requests submitted since the last call to request_list.  The
+ * incoming list is LIFO, so reverse it to keep requests in submission order.
+ */
+static void thread_pool_fetch_incoming(ThreadPool *pool)
+{
+    QSLIST_HEAD(, ThreadPoolElement) incoming;
+    QTAILQ_HEAD(, ThreadPoolElement) reqs = QTAILQ_HEAD_INITIALIZER(reqs);
+    ThreadPoolElement *req;
+
+    /* Runs with lock taken.  */
+    QSLIST_MOVE_ATOMIC(&incoming, &pool->incoming);
+    while ((req = QSLIST_FIRST(&incoming))) {
+        QSLIST_REMOVE_HEAD(&incoming, next);
+        QTAILQ_INSERT_HEAD(&reqs, req, reqs);
+    }
+
+    while ((req = QTAILQ_FIRST(&reqs))) {
+        QTAILQ_REMOVE(&reqs, req, reqs);
+        QTAILQ_INSERT_TAIL(&pool->request_list, req, reqs);
+    }
+}
+
 static void *worker_thread(void *opaque)
 {
     ThreadPool *pool = opaque;
@@ -86,14 +137,36 @@ static void *worker_thread(void *opaque)
         int ret;
 
         if (QTAILQ_EMPTY(&pool->request_list)) {
-            pool->idle_threads++;
+            thread_pool_fetch_incoming(pool);
+        }
+
+        if (QTAILQ_EMPTY(&pool->request_list)) {
+            /*
+             * Pairs with the barrier between pushing to pool->incoming and
+             * reading pool->idle_threads in thread_pool_submit_aio(): either
+             * the submitter sees us idle and signals request_cond with the
+             * lock taken, or we see its request here.
+             */
+            qatomic_inc(&pool->idle_threads);
+            if (thread_pool_has_incoming(pool)) {
+                qatomic_dec(&pool->idle_threads);
+                continue;
+            }
             ret = qemu_cond_timedwait(&pool->request_cond, &pool->lock, 10000);
-            pool->idle_threads--;
+            qatomic_dec(&pool->idle_threads);
             if (ret == 0 &&
                 QTAILQ_EMPTY(&pool->request_list) &&
                 pool->cur_threads > pool->min_threads) {
-                /* Timed out + no work to do + no need for warm threads = exit.  */
-                break;
+                /*
+                 * Timed out + no work to do + no need for warm threads = exit.
+                 * A submitter that saw the old cur_threads may not have
+                 * woken anybody, so stay if a request came in meanwhile.
+                 */
+                qatomic_dec(&pool->cur_threads);
+                if (!thread_pool_has_incoming(pool)) {
+                    goto stopped;
+                }
+                qatomic_inc(&pool->cur_threads);
             }
             /*
              * Even if there was some work to do, check if there aren't
@@ -105,6 +178,7 @@ static void *worker_thread(void *opaque)
         req = QTAILQ_FIRST(&pool->request_list);
         QTAILQ_REMOVE(&pool->request_list, req, reqs);
         req->state = THREAD_ACTIVE;
+        qatomic_dec(&pool->queued_requests);
         qemu_mutex_unlock(&pool->lock);
 
         ret = req->func(req->arg);
@@ -114,11 +188,13 @@ static void *worker_thread(void *opaque)
         smp_wmb();
         req->state = THREAD_DONE;
 
+        QSLIST_INSERT_HEAD_ATOMIC(&pool->done_list, req, next);
         qemu_bh_schedule(pool->completion_bh);
         qemu_mutex_lock(&pool->lock);
     }
 
     pool->cur_threads--;
+stopped:
     qemu_cond_signal(&pool->worker_stopped);
 
     /*
@@ -170,17 +246,34 @@ static void spawn_thread(ThreadPool *pool)
     }
 }
 
+/*
+ * Reap all requests on done_list at once.  They are kept in pool->completed
+ * rather than in a local list, so that a nested invocation from a completion
+ * callback that calls aio_poll() can pick up where we left off.
+ */
 static void thread_pool_completion_bh(void *opaque)
 {
     ThreadPool *pool = opaque;
-    ThreadPoolElement *elem, *next;
+    ThreadPoolElement *elem;
 
-restart:
-    QLIST_FOREACH_SAFE(elem, &pool->head, all, next) {
-        if (elem->state != THREAD_DONE) {
-            continue;
+    for (;;) {
+        if (QTAILQ_EMPTY(&pool->completed)) {
+            QSLIST_HEAD(, ThreadPoolElement) done;
+
+            QSLIST_MOVE_ATOMIC(&done, &pool->done_list);
+            if (QSLIST_EMPTY(&done)) {
+                break;
+            }
+            while ((elem = QSLIST_FIRST(&done))) {
+                QSLIST_REMOVE_HEAD(&done, next);
+                QTAILQ_INSERT_HEAD(&pool->completed, elem, reqs);
+            }
         }
 
+        elem = QTAILQ_FIRST(&pool->completed);
+        QTAILQ_REMOVE(&pool->completed, elem, reqs);
+        assert(elem->state == THREAD_DONE);
+
         trace_thread_pool_complete(pool, elem, elem->common.opaque,
                                    elem->ret);
         QLIST_REMOVE(elem, all);
@@ -197,16 +290,12 @@ restart:
             elem->common.cb(elem->common.opaque, elem->ret);
 
             /* We can safely cancel the completion_bh here regardless of someone
-             * else having scheduled it meanwhile because we reenter the
-             * completion function anyway (goto restart).
+             * else having scheduled it meanwhile because the loop checks
+             * done_list again before returning.
              */
             qemu_bh_cancel(pool->completion_bh);
-
-            qemu_aio_unref(elem);
-            goto restart;
-        } else {
-            qemu_aio_unref(elem);
         }
+        qemu_aio_unref(elem);
     }
 }
 
@@ -219,11 +308,16 @@ static void thread_pool_cancel(BlockAIOCB *acb)
 
     QEMU_LOCK_GUARD(&pool->lock);
     if (elem->state == THREAD_QUEUED) {
+        /* The request may still be on the lock-free incoming list */
+        thread_pool_fetch_incoming(pool);
         QTAILQ_REMOVE(&pool->request_list, elem, reqs);
-        qemu_bh_schedule(pool->completion_bh);
+        qatomic_dec(&pool->queued_requests);
 
         elem->state = THREAD_DONE;
         elem->ret = -ECANCELED;
+
+        QSLIST_INSERT_HEAD_ATOMIC(&pool->done_list, elem, next);
+        qemu_bh_schedule(pool->completion_bh);
     }
 
 }
@@ -261,13 +355,32 @@ BlockAIOCB *thread_pool_submit_aio(ThreadPoolFunc *func, void *arg,
 
     trace_thread_pool_submit(pool, req, arg);
 
-    qemu_mutex_lock(&pool->lock);
-    if (pool->idle_threads == 0 && pool->cur_threads < pool->max_threads) {
-        spawn_thread(pool);
+    /*
+     * The cmpxchg in QSLIST_INSERT_HEAD_ATOMIC() is a full barrier, so the
+     * request is visible before idle_threads is read below.
+     */
+    qatomic_inc(&pool->queued_requests);
+    QSLIST_INSERT_HEAD_ATOMIC(&pool->incoming, req, next);
+
+    /*
+     * pool->lock is only needed to wake up an idle worker or to add one.
+     * When all workers are busy and the pool is at its maximum size, the
+     * request is picked up without the submitter ever touching the lock.
+     */
+    if (qatomic_read(&pool->idle_threads) > 0) {
+        qemu_mutex_lock(&pool->lock);
+        qemu_cond_signal(&pool->request_cond);
+        qemu_mutex_unlock(&pool->lock);
+    } else if (qatomic_read(&pool->cur_threads) <
+               qatomic_read(&pool->max_threads)) {
+        qemu_mutex_lock(&pool->lock);
+        if (pool->idle_threads == 0 && pool->cur_threads < pool->max_threads) {
+            spawn_thread(pool);
+        } else {
+            qemu_cond_signal(&pool->request_cond);
+        }
+        qemu_mutex_unlock(&pool->lock);
     }
-    QTAILQ_INSERT_TAIL(&pool->request_list, req, reqs);
-    qemu_mutex_unlock(&pool->lock);
-    qemu_cond_signal(&pool->request_cond);
     return &req->common;
 }
 
@@ -298,6 +411,17 @@ void thread_pool_submit(ThreadPoolFunc *func, void *arg)
     thread_pool_submit_aio(func, arg, NULL, NULL);
 }
 
+void thread_pool_get_stats(ThreadPool *pool, ThreadPoolStats *stats)
+{
+    QEMU_LOCK_GUARD(&pool->lock);
+
+    stats->min_threads = pool->min_threads;
+    stats->max_threads = pool->max_threads;
+    stats->cur_threads = pool->cur_threads;
+    stats->idle_threads = pool->idle_threads;
+    stats->queued_requests = qatomic_read(&pool->queued_requests);
+}
+
 void thread_pool_update_params(ThreadPool *pool, AioContext *ctx)
 {
     qemu_mutex_lock(&pool->lock);
@@ -340,6 +464,9 @@ static void thread_pool_init_one(ThreadPool *pool, AioContext *ctx)
     pool->new_thread_bh = aio_bh_new(ctx, spawn_thread_bh_fn, pool);
 
     QLIST_INIT(&pool->head);
+    QTAILQ_INIT(&pool->completed);
+    QSLIST_INIT(&pool->incoming);
+    QSLIST_INIT(&pool->done_list);
     QTAILQ_INIT(&pool->request_list);
 
     thread_pool_update_params(pool, ctx);
@@ -359,6 +486,7 @@ void thread_pool_free(ThreadPool *pool)
     }
 
     assert(QLIST_EMPTY(&pool->head));
+    assert(QSLIST_EMPTY(&pool->incoming));
 
     qemu_mutex_lock(&pool->lock);
 
@@ -444,12 +444,44 @@ bool throttle_schedule_timer(ThrottleState *ts,
     return true;
 }
 
+/* Check if a request could be issued right now, without arming a timer
+ *
+ * @is_write: the type of operation (read/write)
+ * @now:      the current timestamp
+ * @ret:      true if the request would have to wait
+ */
+bool throttle_must_wait(ThrottleState *ts, bool is_write, int64_t now)
+{
+    int64_t next_timestamp;
+
+    return throttle_compute_timer(ts, is_write, now, &next_timestamp);
+}
+
 /* do the accounting for this operation
  *
  * @is_write: the type of operation (read/write)
  * @size:     the size of the operation
  */
 void throttle_account(ThrottleState *ts, bool is_write, uint64_t size)
+{
+    double units = 1.0;
+
+    /* if cfg.op_size is defined and smaller than size we compute unit count */
+    if (ts->cfg.op_size && size > ts->cfg.op_size) {
+        units = (double) size / ts->cfg.op_size;
+    }
+
+    throttle_account_units(ts, is_write, size, units);
+}
+
+/* do the accounting for several operations at once
+ *
+ * @is_write: the type of operation (read/write)
+ * @size:     the total size of the operations
+ * @units:    the number of I/O operations
+ */
+void throttle_account_units(ThrottleState *ts, bool is_write, uint64_t size,
+                            double units)
 {
     const BucketType bucket_types_size[2][2] = {
         { THROTTLE_BPS_TOTAL, THROTTLE_BPS_READ },
@@ -459,14 +491,8 @@ void throttle_account(ThrottleState *ts, bool is_write, uint64_t size)
         { THROTTLE_OPS_TOTAL, THROTTLE_OPS_READ },
         { THROTTLE_OPS_TOTAL, THROTTLE_OPS_WRITE }
     };
-    double units = 1.0;
     unsigned i;
 
-    /* if cfg.op_size is defined and smaller than size we compute unit count */
-    if (ts->cfg.op_size && size > ts->cfg.op_size) {
-        units = (double) size / ts->cfg.op_size;
-    }
-
     for (i = 0; i < 2; i++) {
         LeakyBucket *bkt;
 
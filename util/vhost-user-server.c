@@ -9,6 +9,7 @@
  */
 #include "qemu/osdep.h"
 #include "qemu/error-report.h"
+#include "qemu/lockable.h"
 #include "qemu/main-loop.h"
 #include "qemu/vhost-user-server.h"
 #include "block/aio-wait.h"
@@ -52,6 +53,14 @@
  * possible by QIOChannel's support for spurious coroutine re-entry in
  * qio_channel_yield(). The coroutine will restart I/O when re-entered from the
  * new AioContext.
+ *
+ * Virtqueues can be spread over several AioContexts with
+ * vhost_user_server_set_queue_ctxs(). Their kick fds are then monitored in
+ * those contexts and requests are processed there, while vhost-user messages
+ * are still processed by vu_client_trip() in VuServer->ctx. Messages may
+ * change the memory table or the virtqueues, so before one is processed kick
+ * monitoring is stopped in the virtqueue AioContexts and in-flight requests
+ * are waited for. Monitoring resumes once the message has been handled.
  */
 
 static void vmsg_close_fds(VhostUserMsg *vmsg)
@@ -181,6 +190,9 @@ vu_message_read(VuDev *vu_dev, int conn_fd, VhostUserMsg *vmsg)
         }
     }
 
+    /* Resumed by vu_client_trip() once the message has been processed */
+    vu_pause_queues(server);
+
     return true;
 
 fail:
@@ -195,9 +207,10 @@ static coroutine_fn void vu_client_trip(void *opaque)
     VuDev *vu_dev = &server->vu_dev;
 
     while (!vu_dev->broken && vu_dispatch(vu_dev)) {
-        /* Keep running */
+        vu_resume_queues(server);
     }
 
+    vu_pause_queues(server);
     if (vhost_user_server_has_in_flight(server)) {
         /* Wait for requests to complete before we can unmap the memory */
         server->wait_idle = true;
@@ -210,6 +223,7 @@ static coroutine_fn void vu_client_trip(void *opaque)
 
     /* vu_deinit() should have called remove_watch() */
     assert(QTAILQ_EMPTY(&server->vu_fd_watches));
+    qatomic_set(&server->queues_paused, false);
 
     object_unref(OBJECT(server->sioc));
     server->sioc = NULL;
@@ -246,6 +260,125 @@ static void kick_handler(void *opaque)
     }
 }
 
+/* Whether queue_ctxs[i] is the first occurrence of its AioContext */
+static bool vu_queue_ctx_is_first(VuServer *server, int i)
+{
+    int j;
+
+    for (j = 0; j < i; j++) {
+        if (server->queue_ctxs[j] == server->queue_ctxs[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * Start or stop monitoring the kick fds of the virtqueues that are handled
+ * in the current AioContext, according to queues_paused and queues_detached.
+ */
+static void vu_queue_ctx_sync(VuServer *server)
+{
+    AioContext *ctx = qemu_get_current_aio_context();
+    bool active = !qatomic_read(&server->queues_paused) &&
+                  !qatomic_read(&server->queues_detached);
+    VuFdWatch *vu_fd_watch;
+
+    QEMU_LOCK_GUARD(&server->fd_watches_lock);
+    QTAILQ_FOREACH(vu_fd_watch, &server->vu_fd_watches, next) {
+        if (vu_fd_watch->ctx == ctx) {
+            aio_set_fd_handler(ctx, vu_fd_watch->fd,
+                               active ? kick_handler : NULL,
+                               NULL, NULL, NULL, vu_fd_watch);
+        }
+    }
+}
+
+static void vu_queue_ctx_sync_bh(void *opaque)
+{
+    vu_queue_ctx_sync(opaque);
+}
+
+static void vu_queue_ctx_pause_bh(void *opaque)
+{
+    VuServer *server = opaque;
+
+    vu_queue_ctx_sync(server);
+    if (qatomic_fetch_dec(&server->queue_ctxs_pausing) == 1) {
+        aio_co_wake(server->co_trip);
+    }
+}
+
+/*
+ * Stop processing virtqueues in their AioContexts and wait for the requests
+ * they have in flight, so that vhost-user messages can be processed.
+ */
+static void coroutine_fn vu_pause_queues(VuServer *server)
+{
+    int i;
+
+    if (!server->nr_queue_ctxs || server->queues_paused) {
+        return;
+    }
+
+    qatomic_set(&server->queues_paused, true);
+
+    /* Count ourselves so that only the last BH wakes us */
+    qatomic_set(&server->queue_ctxs_pausing, 1);
+    for (i = 0; i < server->nr_queue_ctxs; i++) {
+        if (vu_queue_ctx_is_first(server, i)) {
+            qatomic_inc(&server->queue_ctxs_pausing);
+            aio_bh_schedule_oneshot(server->queue_ctxs[i],
+                                    vu_queue_ctx_pause_bh, server);
+        }
+    }
+    if (qatomic_fetch_dec(&server->queue_ctxs_pausing) != 1) {
+        qemu_coroutine_yield();
+    }
+
+    /* Requests complete in other threads, poll rather than set wait_idle */
+    while (vhost_user_server_has_in_flight(server)) {
+        qemu_co_sleep_ns(QEMU_CLOCK_REALTIME, 100 * SCALE_US);
+    }
+}
+
+static void vu_resume_queues(VuServer *server)
+{
+    int i;
+
+    if (!server->queues_paused) {
+        return;
+    }
+
+    qatomic_set(&server->queues_paused, false);
+    for (i = 0; i < server->nr_queue_ctxs; i++) {
+        if (vu_queue_ctx_is_first(server, i)) {
+            aio_bh_schedule_oneshot(server->queue_ctxs[i],
+                                    vu_queue_ctx_sync_bh, server);
+        }
+    }
+}
+
+/* Called from the main loop thread */
+static void vu_set_queues_detached(VuServer *server, bool detached)
+{
+    int i;
+
+    qatomic_set(&server->queues_detached, detached);
+    for (i = 0; i < server->nr_queue_ctxs; i++) {
+        if (!vu_queue_ctx_is_first(server, i)) {
+            continue;
+        }
+        if (detached) {
+            aio_wait_bh_oneshot(server->queue_ctxs[i],
+                                vu_queue_ctx_sync_bh, server);
+        } else {
+            aio_bh_schedule_oneshot(server->queue_ctxs[i],
+                                    vu_queue_ctx_sync_bh, server);
+        }
+    }
+}
+
 static VuFdWatch *find_vu_fd_watch(VuServer *server, int fd)
 {
 
@@ -268,6 +401,7 @@ set_watch(VuDev *vu_dev, int fd, int vu_evt,
     g_assert(fd >= 0);
     g_assert(cb);
 
+    QEMU_LOCK_GUARD(&server->fd_watches_lock);
     VuFdWatch *vu_fd_watch = find_vu_fd_watch(server, fd);
 
     if (!vu_fd_watch) {
@@ -277,11 +411,19 @@ set_watch(VuDev *vu_dev, int fd, int vu_evt,
 
         vu_fd_watch->fd = fd;
         vu_fd_watch->cb = cb;
-        qemu_socket_set_nonblock(fd);
-        aio_set_fd_handler(server->ioc->ctx, fd, kick_handler,
-                           NULL, NULL, NULL, vu_fd_watch);
         vu_fd_watch->vu_dev = vu_dev;
         vu_fd_watch->pvt = pvt;
+        qemu_socket_set_nonblock(fd);
+        if (server->nr_queue_ctxs) {
+            /* pvt is the virtqueue index, see vu_set_queue_handler() */
+            vu_fd_watch->ctx = server->queue_ctxs[(intptr_t)pvt %
+                                                  server->nr_queue_ctxs];
+            /* Monitoring starts in vu_resume_queues() */
+            assert(server->queues_paused);
+        } else {
+            aio_set_fd_handler(server->ioc->ctx, fd, kick_handler,
+                               NULL, NULL, NULL, vu_fd_watch);
+        }
     }
 }
 
@@ -294,12 +436,18 @@ static void remove_watch(VuDev *vu_dev, int fd)
 
     server = container_of(vu_dev, VuServer, vu_dev);
 
+    QEMU_LOCK_GUARD(&server->fd_watches_lock);
     VuFdWatch *vu_fd_watch = find_vu_fd_watch(server, fd);
 
     if (!vu_fd_watch) {
         return;
     }
-    aio_set_fd_handler(server->ioc->ctx, fd, NULL, NULL, NULL, NULL, NULL);
+    if (!vu_fd_watch->ctx) {
+        aio_set_fd_handler(server->ioc->ctx, fd, NULL, NULL, NULL, NULL, NULL);
+    } else if (!server->queues_paused) {
+        /* Only vu_kick_cb() does this, from the virtqueue's AioContext */
+        aio_set_fd_handler(vu_fd_watch->ctx, fd, NULL, NULL, NULL, NULL, NULL);
+    }
 
     QTAILQ_REMOVE(&server->vu_fd_watches, vu_fd_watch, next);
     g_free(vu_fd_watch);
@@ -361,9 +509,12 @@ void vhost_user_server_stop(VuServer *server)
         VuFdWatch *vu_fd_watch;
 
         QTAILQ_FOREACH(vu_fd_watch, &server->vu_fd_watches, next) {
-            aio_set_fd_handler(server->ctx, vu_fd_watch->fd,
-                               NULL, NULL, NULL, NULL, vu_fd_watch);
+            if (!vu_fd_watch->ctx) {
+                aio_set_fd_handler(server->ctx, vu_fd_watch->fd,
+                                   NULL, NULL, NULL, NULL, vu_fd_watch);
+            }
         }
+        vu_set_queues_detached(server, true);
 
         qio_channel_shutdown(server->ioc, QIO_CHANNEL_SHUTDOWN_BOTH, NULL);
 
@@ -376,6 +527,19 @@ void vhost_user_server_stop(VuServer *server)
     }
 }
 
+/*
+ * Handle virtqueue i in ctxs[i % nr_ctxs] instead of in the server's
+ * AioContext.  Must be called before a client connects.  The caller keeps
+ * the AioContexts alive until vhost_user_server_stop().
+ */
+void vhost_user_server_set_queue_ctxs(VuServer *server, AioContext **ctxs,
+                                      int nr_ctxs)
+{
+    assert(!server->sioc);
+    server->queue_ctxs = ctxs;
+    server->nr_queue_ctxs = nr_ctxs;
+}
+
 /*
  * Allow the next client to connect to the server. Called from a BH in the main
  * loop.
@@ -402,9 +566,12 @@ void vhost_user_server_attach_aio_context(VuServer *server, AioContext *ctx)
     qio_channel_attach_aio_context(server->ioc, ctx);
 
     QTAILQ_FOREACH(vu_fd_watch, &server->vu_fd_watches, next) {
-        aio_set_fd_handler(ctx, vu_fd_watch->fd, kick_handler, NULL,
-                           NULL, NULL, vu_fd_watch);
+        if (!vu_fd_watch->ctx) {
+            aio_set_fd_handler(ctx, vu_fd_watch->fd, kick_handler, NULL,
+                               NULL, NULL, vu_fd_watch);
+        }
     }
+    vu_set_queues_detached(server, false);
 
     aio_co_schedule(ctx, server->co_trip);
 }
@@ -416,9 +583,12 @@ void vhost_user_server_detach_aio_context(VuServer *server)
         VuFdWatch *vu_fd_watch;
 
         QTAILQ_FOREACH(vu_fd_watch, &server->vu_fd_watches, next) {
-            aio_set_fd_handler(server->ctx, vu_fd_watch->fd,
-                               NULL, NULL, NULL, NULL, vu_fd_watch);
+            if (!vu_fd_watch->ctx) {
+                aio_set_fd_handler(server->ctx, vu_fd_watch->fd,
+                                   NULL, NULL, NULL, NULL, vu_fd_watch);
+            }
         }
+        vu_set_queues_detached(server, true);
 
         qio_channel_detach_aio_context(server->ioc);
     }
@@ -461,6 +631,7 @@ bool vhost_user_server_start(VuServer *server,
     };
 
     qio_net_listener_set_name(server->listener, "vhost-user-backend-listener");
+    qemu_mutex_init(&server->fd_watches_lock);
 
     qio_net_listener_set_client_func(server->listener,
                                      vu_accept,